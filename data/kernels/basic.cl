@@ -423,6 +423,163 @@ highlights_1f_lch_xtrans (read_only image2d_t in, write_only image2d_t out, cons
 
   write_imagef (out, (int2)(x, y), pixel);
 }
+
+/* color reconstruction of the highlights plugin along one row (dim 0) or column (dim 1) of the raw, as
+   interpolate_color() in highlights.c. the passes of the other lines don't interfere, so every line is a work
+   item. passes 0 to 2 collect the guesses for the clipped pixels in tmp, pass 3 writes the output. */
+void
+inpaint_line_bayer(read_only image2d_t in, global float *tmp, write_only image2d_t out, const int width,
+                   const int height, const int dim, const int dir, const int line, const float *clip,
+                   const int rx, const int ry, const int filters, const int pass)
+{
+  float ratio = 1.0f;
+  const int len = dim ? height : width;
+  const int beg = (dir > 0) ? 0 : len - 1;
+  const int end = (dir > 0) ? len : -1;
+
+  for(int k = beg; k != end; k += dir)
+  {
+    const int i = dim ? line : k;
+    const int j = dim ? k : line;
+    const int idx = mad24(j, width, i);
+    const float in0 = read_imagef(in, sampleri, (int2)(i, j)).x;
+
+    if(i == 0 || i == width - 1 || j == 0 || j == height - 1)
+    {
+      if(pass == 3) write_imagef(out, (int2)(i, j), in0);
+      continue;
+    }
+
+    const float in1 = read_imagef(in, sampleri, dim ? (int2)(i, j + dir) : (int2)(i + dir, j)).x;
+    const float clip0 = clip[FC(j + ry, i + rx, filters)];
+    const float clip1 = clip[FC((dim ? j + 1 : j) + ry, (dim ? i : i + 1) + rx, filters)];
+
+    // update ratio, exponential decay. ratio = in[odd]/in[even]
+    if(in0 < clip0 && in0 > 1e-5f && in1 < clip1 && in1 > 1e-5f)
+      ratio = (k & 1) ? (3.0f * ratio + in0 / in1) / 4.0f : (3.0f * ratio + in1 / in0) / 4.0f;
+
+    if(in0 >= clip0 - 1e-5f)
+    {
+      // in0 is clipped, restore it as in1 adjusted according to ratio
+      const float add = (in1 >= clip1 - 1e-5f) ? fmax(clip0, clip1) : ((k & 1) ? in1 * ratio : in1 / ratio);
+
+      if(pass == 0)
+        tmp[idx] = add;
+      else if(pass == 3)
+        write_imagef(out, (int2)(i, j), (tmp[idx] + add) / 4.0f);
+      else
+        tmp[idx] += add;
+    }
+    else if(pass == 3)
+      write_imagef(out, (int2)(i, j), in0);
+  }
+}
+
+float
+inpaint_pix_xtrans(const int ratio_next, const float in_next, const float clip0, const float clip_next,
+                   const float *ratios)
+{
+  const float clip_val = fmax(clip0, clip_next);
+  if(in_next >= clip_next - 1e-5f) return clip_val;
+  return (ratio_next > 0) ? fmin(in_next / ratios[ratio_next], clip_val)
+                          : fmin(in_next * ratios[-ratio_next], clip_val);
+}
+
+/* the same for x-trans, as interpolate_color_xtrans() */
+void
+inpaint_line_xtrans(read_only image2d_t in, global float *tmp, write_only image2d_t out, const int width,
+                    const int height, const int dim, const int dir, const int line, const float *clip,
+                    const int rx, const int ry, global const unsigned char (*const xtrans)[6], const int pass)
+{
+  // index into ratios of the color transitions, negative if the ratio has to be inverted
+  const int roff[3][3] = { { 0, -1, -2 }, { 1, 0, -3 }, { 2, 3, 0 } };
+  float ratios[4] = { 1.0f, 1.0f, 1.0f, 1.0f };
+  const float clip_max = fmax(fmax(clip[0], clip[1]), clip[2]);
+  const int len = dim ? height : width;
+  const int beg = (dir > 0) ? 0 : len - 1;
+  const int end = (dir > 0) ? len : -1;
+
+  for(int k = beg; k != end; k += dir)
+  {
+    const int i = dim ? line : k;
+    const int j = dim ? k : line;
+    const int idx = mad24(j, width, i);
+    const float in0 = read_imagef(in, sampleri, (int2)(i, j)).x;
+
+    if(i == 0 || i == width - 1 || j == 0 || j == height - 1)
+    {
+      if(pass == 3) write_imagef(out, (int2)(i, j), fmin(clip_max, in0));
+      continue;
+    }
+
+    // the next pixel and its neighbours across the line
+    const int2 p1 = dim ? (int2)(i, j + dir) : (int2)(i + dir, j);
+    const int2 pl = dim ? (int2)(i - 1, j + dir) : (int2)(i + dir, j - 1);
+    const int2 pr = dim ? (int2)(i + 1, j + dir) : (int2)(i + dir, j + 1);
+    const int f0 = FCxtrans(j + ry, i + rx, xtrans);
+    const int f1 = FCxtrans(p1.y + ry, p1.x + rx, xtrans);
+    const int fl = FCxtrans(pl.y + ry, pl.x + rx, xtrans);
+    const int fr = FCxtrans(pr.y + ry, pr.x + rx, xtrans);
+    const float clip0 = clip[f0];
+    const float clip1 = clip[f1];
+    const float in1 = read_imagef(in, sampleri, p1).x;
+
+    // ratio to next pixel if this & next are unclamped and not in 2x2 green block
+    if(f0 != f1 && in0 < clip0 && in0 > 1e-5f && in1 < clip1 && in1 > 1e-5f)
+    {
+      const int r = roff[f0][f1];
+      if(r > 0)
+        ratios[r] = (3.0f * ratios[r] + in1 / in0) / 4.0f;
+      else
+        ratios[-r] = (3.0f * ratios[-r] + in0 / in1) / 4.0f;
+    }
+
+    if(in0 >= clip0 - 1e-5f)
+    {
+      // next pixel is different color, else at start of 2x2 green block, look diagonally
+      float add;
+      if(f0 != f1)
+        add = inpaint_pix_xtrans(roff[f0][f1], in1, clip0, clip1, ratios);
+      else if(fl != f0)
+        add = inpaint_pix_xtrans(roff[f0][fl], read_imagef(in, sampleri, pl).x, clip0, clip[fl], ratios);
+      else
+        add = inpaint_pix_xtrans(roff[f0][fr], read_imagef(in, sampleri, pr).x, clip0, clip[fr], ratios);
+
+      if(pass == 0)
+        tmp[idx] = add;
+      else if(pass == 3)
+        write_imagef(out, (int2)(i, j), fmin(clip_max, (tmp[idx] + add) / 4.0f));
+      else
+        tmp[idx] += add;
+    }
+    else if(pass == 3)
+      write_imagef(out, (int2)(i, j), in0);
+  }
+}
+
+/* both directions along the rows (dim 0, passes 0 and 1) or the columns (dim 1, passes 2 and 3), one work
+   item per line */
+kernel void
+highlights_1f_inpaint (read_only image2d_t in, global float *tmp, write_only image2d_t out, const int width,
+                       const int height, const float4 clips, const int rx, const int ry, const int filters,
+                       global const unsigned char (*const xtrans)[6], const int dim)
+{
+  const int line = get_global_id(0);
+
+  if(line >= (dim ? width : height)) return;
+
+  const float clip[4] = { clips.x, clips.y, clips.z, clips.w };
+
+  for(int p = 0; p < 2; p++)
+  {
+    const int pass = 2 * dim + p;
+    const int dir = p ? -1 : 1;
+    if(filters == 9u)
+      inpaint_line_xtrans(in, tmp, out, width, height, dim, dir, line, clip, rx, ry, xtrans, pass);
+    else
+      inpaint_line_bayer(in, tmp, out, width, height, dim, dir, line, clip, rx, ry, filters, pass);
+  }
+}
 #undef SQRT3
 #undef SQRT12
 
@@ -1811,6 +1968,45 @@ colorout (read_only image2d_t in, write_only image2d_t out, const int width, con
 }
 
 
+/* kernel for the plugins colorin and colorout, applies a 3d lut a littlecms transform has been baked into.
+   the nodes run with x fastest, every cell is split into six tetrahedra along its diagonal. */
+kernel void
+lut3d_tetrahedral (read_only image2d_t in, write_only image2d_t out, const int width, const int height,
+                   global const float4 *clut, const int size, const float4 lmin, const float4 lscale)
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+
+  if(x >= width || y >= height) return;
+
+  float4 pixel = read_imagef(in, sampleri, (int2)(x, y));
+  const float4 p = clamp((pixel - lmin) * lscale, 0.0f, (float)(size - 1));
+  const int4 i = min(convert_int4(p), size - 2);
+  const float4 f = p - convert_float4(i);
+
+  const int dx = 1, dy = size, dz = size * size;
+  int a, b;
+  float t1, t2, t3;
+  if(f.x >= f.y)
+  {
+    if(f.y >= f.z)      { a = dx; b = dx + dy; t1 = f.x; t2 = f.y; t3 = f.z; }
+    else if(f.x >= f.z) { a = dx; b = dx + dz; t1 = f.x; t2 = f.z; t3 = f.y; }
+    else                { a = dz; b = dx + dz; t1 = f.z; t2 = f.x; t3 = f.y; }
+  }
+  else
+  {
+    if(f.z >= f.y)      { a = dz; b = dy + dz; t1 = f.z; t2 = f.y; t3 = f.x; }
+    else if(f.z >= f.x) { a = dy; b = dy + dz; t1 = f.y; t2 = f.z; t3 = f.x; }
+    else                { a = dy; b = dx + dy; t1 = f.y; t2 = f.x; t3 = f.z; }
+  }
+
+  global const float4 *c000 = clut + i.x + dy * i.y + dz * i.z;
+  float4 res = (1.0f - t1) * c000[0] + (t1 - t2) * c000[a] + (t2 - t3) * c000[b] + t3 * c000[dx + dy + dz];
+  res.w = pixel.w;
+  write_imagef (out, (int2)(x, y), res);
+}
+
+
 /* kernel for the levels plugin */
 kernel void
 levels (read_only image2d_t in, write_only image2d_t out, const int width, const int height,
@@ -2262,3 +2458,29 @@ interpolation_resample (read_only image2d_t in, write_only image2d_t out, const
   }
 }
 
+/* kernel for the dither plugin: ordered dithering by a tiled blue noise mask of mask_size^2 offsets, mask_size
+   a power of two. every pixel is rounded to the nearest of f + 1 levels, f = 0 only clips. */
+kernel void
+dither_bluenoise (read_only image2d_t in, write_only image2d_t out, const int width, const int height,
+                  global const float *mask, const int mask_size, const int ox, const int oy,
+                  const float f, const float rf, const int gray)
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+
+  if(x >= width || y >= height) return;
+
+  float4 pixel = read_imagef(in, sampleri, (int2)(x, y));
+
+  pixel = select(clamp(pixel, 0.0f, 1.0f), (float4)0.5f, isnan(pixel));
+
+  if(f > 0.0f)
+  {
+    const float d = mask[mad24((y + oy) & (mask_size - 1), mask_size, (x + ox) & (mask_size - 1))];
+    if(gray) pixel = (float4)(0.30f * pixel.x + 0.59f * pixel.y + 0.11f * pixel.z);
+    pixel = clamp(rint(pixel * f + d), 0.0f, f) * rf;
+  }
+
+  write_imagef (out, (int2)(x, y), pixel);
+}
+
@@ -0,0 +1,235 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2017 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "common.h"
+
+// automatic chromatic aberration correction, the raw therapee algorithm of src/iop/cacorrect.c. the cpu
+// version works on tiles of 128 pixels which overlap by 16, so every block of 112x112 pixels gets one
+// shift estimate. here all the filters are evaluated on the whole image instead, mirrored at its borders.
+
+#define CA_BLOCK 112
+#define CA_EPS 1e-5f
+
+// mirrors at the border without repeating the border pixel, which keeps the bayer pattern
+int
+ca_mirror(int i, const int n)
+{
+  i = i < 0 ? -i : i;
+  return i >= n ? 2 * n - 2 - i : i;
+}
+
+float
+ca_read(read_only image2d_t img, const int x, const int y, const int width, const int height)
+{
+  return read_imagef(img, sampleri, (int2)(ca_mirror(x, width), ca_mirror(y, height))).x;
+}
+
+float
+ca_sqr(const float x)
+{
+  return x * x;
+}
+
+float
+ca_intp(const float a, const float b, const float c)
+{
+  return a * (b - c) + c;
+}
+
+#define RAW(dx, dy) ca_read(in, x + (dx), y + (dy), width, height)
+#define GRN(dx, dy) ca_read(green, x + (dx), y + (dy), width, height)
+
+// green interpolated at the red and blue sites, from directionally weighted neighbours
+kernel void
+cacorrect_green(read_only image2d_t in, write_only image2d_t green, const int width, const int height,
+                const unsigned int filters)
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+  if(x >= width || y >= height) return;
+
+  const float v = RAW(0, 0);
+  float g = v;
+  if(FC(y, x, filters) != 1)
+  {
+    const float wtu = 1.0f / ca_sqr(CA_EPS + fabs(RAW(0, 1) - RAW(0, -1)) + fabs(v - RAW(0, -2))
+                                      + fabs(RAW(0, -1) - RAW(0, -3)));
+    const float wtd = 1.0f / ca_sqr(CA_EPS + fabs(RAW(0, -1) - RAW(0, 1)) + fabs(v - RAW(0, 2))
+                                      + fabs(RAW(0, 1) - RAW(0, 3)));
+    const float wtl = 1.0f / ca_sqr(CA_EPS + fabs(RAW(1, 0) - RAW(-1, 0)) + fabs(v - RAW(-2, 0))
+                                      + fabs(RAW(-1, 0) - RAW(-3, 0)));
+    const float wtr = 1.0f / ca_sqr(CA_EPS + fabs(RAW(-1, 0) - RAW(1, 0)) + fabs(v - RAW(2, 0))
+                                      + fabs(RAW(1, 0) - RAW(3, 0)));
+    g = (wtu * RAW(0, -1) + wtd * RAW(0, 1) + wtl * RAW(-1, 0) + wtr * RAW(1, 0)) / (wtu + wtd + wtl + wtr);
+  }
+  write_imagef(green, (int2)(x, y), (float4)(g, 0.0f, 0.0f, 0.0f));
+}
+
+// high pass of the colour difference along one direction (dx, dy)
+float
+ca_hpf(read_only image2d_t in, read_only image2d_t green, const int x, const int y, const int dx, const int dy,
+       const int width, const int height)
+{
+  const float d0 = GRN(0, 0) - RAW(0, 0);
+  const float dp = GRN(4 * dx, 4 * dy) - RAW(4 * dx, 4 * dy);
+  const float dm = GRN(-4 * dx, -4 * dy) - RAW(-4 * dx, -4 * dy);
+  return fabs(fabs(d0 - dp) + fabs(dm - d0) - fabs(dm - dp));
+}
+
+// low passes of green and the red/blue channel along (dx, dy): their difference and their sum
+float2
+ca_lpf(read_only image2d_t in, read_only image2d_t green, const int x, const int y, const int dx, const int dy,
+       const int width, const int height)
+{
+  const float g = 0.25f * (2.0f * GRN(0, 0) + GRN(2 * dx, 2 * dy) + GRN(-2 * dx, -2 * dy));
+  const float c = 0.25f * (2.0f * RAW(0, 0) + RAW(2 * dx, 2 * dy) + RAW(-2 * dx, -2 * dy));
+  return (float2)(CA_EPS + fabs(g - c), g + c);
+}
+
+// sums of the quadratic fit to the colour difference over one row of a block. work item (i, y) covers row y
+// of block column i and writes coeff[vert/hor][k][red/blue] to rows[12 * (y * blocks_h + i)].
+kernel void
+cacorrect_coeffs(read_only image2d_t in, read_only image2d_t green, global float *rows, const int width,
+                 const int height, const unsigned int filters, const int blocks_h)
+{
+  const int i = get_global_id(0);
+  const int y = get_global_id(1);
+  if(i >= blocks_h || y >= height) return;
+
+  float coeff[12] = { 0.0f };
+  const int left = i * CA_BLOCK;
+  const int right = min(left + CA_BLOCK, width);
+  for(int x = left + (FC(y, left, filters) & 1); x < right; x += 2)
+  {
+    const float2 lpfvm = ca_lpf(in, green, x, y - 2, 0, 1, width, height);
+    const float2 lpfvp = ca_lpf(in, green, x, y + 2, 0, 1, width, height);
+    const float2 lpfhm = ca_lpf(in, green, x - 2, y, 1, 0, width, height);
+    const float2 lpfhp = ca_lpf(in, green, x + 2, y, 1, 0, width, height);
+    const float deltgrb = RAW(0, 0) - GRN(0, 0);
+    const int c = FC(y, x, filters) >> 1;
+
+    // vertical
+    float gdiff = 0.3125f * (GRN(0, 1) - GRN(0, -1))
+                  + 0.09375f * (GRN(1, 1) - GRN(1, -1) + GRN(-1, 1) - GRN(-1, -1));
+    float gradwt = fabs(0.25f * ca_hpf(in, green, x, y, 0, 1, width, height)
+                        + 0.125f * (ca_hpf(in, green, x + 2, y, 0, 1, width, height)
+                                    + ca_hpf(in, green, x - 2, y, 0, 1, width, height)))
+                   * (lpfvm.y + lpfvp.y) / (CA_EPS + 0.1f * (lpfvm.y + lpfvp.y) + lpfvm.x + lpfvp.x);
+    coeff[0 + c] += gradwt * deltgrb * deltgrb;
+    coeff[2 + c] += gradwt * gdiff * deltgrb;
+    coeff[4 + c] += gradwt * gdiff * gdiff;
+
+    // horizontal
+    gdiff = 0.3125f * (GRN(1, 0) - GRN(-1, 0))
+            + 0.09375f * (GRN(1, 1) - GRN(-1, 1) + GRN(1, -1) - GRN(-1, -1));
+    gradwt = fabs(0.25f * ca_hpf(in, green, x, y, 1, 0, width, height)
+                  + 0.125f * (ca_hpf(in, green, x, y + 2, 1, 0, width, height)
+                              + ca_hpf(in, green, x, y - 2, 1, 0, width, height)))
+             * (lpfhm.y + lpfhp.y) / (CA_EPS + 0.1f * (lpfhm.y + lpfhp.y) + lpfhm.x + lpfhp.x);
+    coeff[6 + c] += gradwt * deltgrb * deltgrb;
+    coeff[8 + c] += gradwt * gdiff * deltgrb;
+    coeff[10 + c] += gradwt * gdiff * gdiff;
+  }
+
+  global float *out = rows + 12 * (y * blocks_h + i);
+  for(int k = 0; k < 12; k++) out[k] = coeff[k];
+}
+
+// adds up the rows of every block: blocks[12 * (j * blocks_h + i)] for block (i, j)
+kernel void
+cacorrect_blocks(global const float *rows, global float *blocks, const int height, const int blocks_h,
+                 const int blocks_v)
+{
+  const int i = get_global_id(0);
+  const int j = get_global_id(1);
+  if(i >= blocks_h || j >= blocks_v) return;
+
+  float sum[12] = { 0.0f };
+  const int bottom = min((j + 1) * CA_BLOCK, height);
+  for(int y = j * CA_BLOCK; y < bottom; y++)
+    for(int k = 0; k < 12; k++) sum[k] += rows[12 * (y * blocks_h + i) + k];
+
+  global float *out = blocks + 12 * (j * blocks_h + i);
+  for(int k = 0; k < 12; k++) out[k] = sum[k];
+}
+
+// green at (x, y) moved by the shift of the block, and the colour difference there
+float2
+ca_shifted(read_only image2d_t in, read_only image2d_t green, const int x, const int y, const int4 shift,
+           const float2 frac, const int width, const int height)
+{
+  // shift: vertical floor, vertical ceil, horizontal floor, horizontal ceil
+  const float gfloor = ca_intp(frac.x, GRN(shift.w, shift.x), GRN(shift.z, shift.x));
+  const float gceil = ca_intp(frac.x, GRN(shift.w, shift.y), GRN(shift.z, shift.y));
+  const float gint = ca_intp(frac.y, gceil, gfloor);
+  return (float2)(gint - RAW(0, 0), gint);
+}
+
+// moves red and blue by the shifts fitted to their block, shifts[4 * (j * blocks_h + i)] holding
+// red vertical, red horizontal, blue vertical, blue horizontal.
+kernel void
+cacorrect_apply(read_only image2d_t in, read_only image2d_t green, write_only image2d_t out, const int width,
+                const int height, const unsigned int filters, global const float *shifts, const int blocks_h)
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+  if(x >= width || y >= height) return;
+
+  float v = RAW(0, 0);
+  const int c = FC(y, x, filters);
+  if(c != 1)
+  {
+    global const float *s = shifts + 4 * ((y / CA_BLOCK) * blocks_h + x / CA_BLOCK) + (c & 2);
+    const float sv = s[0], sh = s[1];
+    const int4 shift = (int4)(floor(sv), ceil(sv), floor(sh), ceil(sh));
+    const float2 frac = (float2)(sh - floor(sh), sv - floor(sv));
+    const int dv = sv > 0.0f ? 2 : -2, dh = sh > 0.0f ? 2 : -2;
+
+    // colour difference and shifted green at the four same coloured sites around the optical position
+    const float2 d0 = ca_shifted(in, green, x, y, shift, frac, width, height);
+    const float2 d1 = ca_shifted(in, green, x - dh, y, shift, frac, width, height);
+    const float2 d2 = ca_shifted(in, green, x, y - dv, shift, frac, width, height);
+    const float2 d3 = ca_shifted(in, green, x - dh, y - dv, shift, frac, width, height);
+
+    const float g = GRN(0, 0);
+    const float grbdiffold = g - v;
+    const float2 half = 0.5f * frac;
+    float grbdiffint = ca_intp(half.y, ca_intp(half.x, d3.x, d2.x), ca_intp(half.x, d1.x, d0.x));
+    const float RBint = g - grbdiffint;
+    if(fabs(RBint - v) < 0.25f * (RBint + v))
+    {
+      if(fabs(grbdiffold) > fabs(grbdiffint)) v = RBint;
+    }
+    else
+    {
+      // gradient weights using difference from G at CA shift points and G at grid points
+      const float p0 = 1.0f / (CA_EPS + fabs(g - d0.y));
+      const float p1 = 1.0f / (CA_EPS + fabs(g - d1.y));
+      const float p2 = 1.0f / (CA_EPS + fabs(g - d2.y));
+      const float p3 = 1.0f / (CA_EPS + fabs(g - d3.y));
+      grbdiffint = (p0 * d0.x + p1 * d1.x + p2 * d2.x + p3 * d3.x) / (p0 + p1 + p2 + p3);
+      if(fabs(grbdiffold) > fabs(grbdiffint)) v = g - grbdiffint;
+    }
+    // if colour difference interpolation overshot the correction, just desaturate
+    if(grbdiffold * grbdiffint < 0.0f) v = g - 0.5f * (grbdiffold + grbdiffint);
+  }
+  write_imagef(out, (int2)(x, y), (float4)(v, 0.0f, 0.0f, 0.0f));
+}
+
+#undef RAW
+#undef GRN
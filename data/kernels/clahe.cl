@@ -0,0 +1,150 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2017 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "common.h"
+#include "colorspace.cl"
+
+// contrast limited adaptive histogram equalization of src/iop/clahe.c. the cpu version slides the window
+// histogram along every row. here the clipped cdf of the window is computed only on a grid of pixels, and
+// every pixel interpolates between the four grid points around it.
+
+#define BINS 256
+
+int
+clahe_bin(const float l)
+{
+  return (int)(l * (float)BINS + 0.5f);
+}
+
+kernel void
+clahe_luminance(read_only image2d_t in, write_only image2d_t luminance, const int width, const int height)
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+  if(x >= width || y >= height) return;
+
+  const float4 pixel = read_imagef(in, sampleri, (int2)(x, y));
+  const float pmax = clamp(fmax(pixel.x, fmax(pixel.y, pixel.z)), 0.0f, 1.0f);
+  const float pmin = clamp(fmin(pixel.x, fmin(pixel.y, pixel.z)), 0.0f, 1.0f);
+  write_imagef(luminance, (int2)(x, y), (float4)(0.5f * (pmax + pmin), 0.0f, 0.0f, 0.0f));
+}
+
+// one work group per grid point: the histogram of the window around it, clipped at slope times the mean
+// bin count, and its cdf in luts[(BINS + 1) * point]
+kernel void
+clahe_histogram(read_only image2d_t luminance, global float *luts, const int width, const int height,
+                const int rad, const float slope, const int step, const int grid_w, const int grid_h,
+                local int *hist)
+{
+  const int lid = get_local_id(0);
+  const int lsize = get_local_size(0);
+  const int point = get_global_id(1);
+  if(point >= grid_w * grid_h) return;
+
+  const int x = min((point % grid_w) * step, width - 1);
+  const int y = min((point / grid_w) * step, height - 1);
+  const int xMin = max(0, x - rad), xMax = min(width, x + rad + 1);
+  const int yMin = max(0, y - rad), yMax = min(height, y + rad + 1);
+  const int w = xMax - xMin, h = yMax - yMin;
+
+  for(int b = lid; b <= BINS; b += lsize) hist[b] = 0;
+  barrier(CLK_LOCAL_MEM_FENCE);
+
+  for(int k = lid; k < w * h; k += lsize)
+  {
+    const float l = read_imagef(luminance, sampleri, (int2)(xMin + k % w, yMin + k / w)).x;
+    atomic_inc(hist + clahe_bin(l));
+  }
+  barrier(CLK_LOCAL_MEM_FENCE);
+
+  if(lid != 0) return;
+
+  // clip histogram and redistribute clipped entries, as on the cpu
+  const int limit = (int)(slope * (w * h) / BINS + 0.5f);
+  int ce = 0, ceb = 0;
+  do
+  {
+    ceb = ce;
+    ce = 0;
+    for(int b = 0; b <= BINS; b++)
+    {
+      const int d = hist[b] - limit;
+      if(d > 0)
+      {
+        ce += d;
+        hist[b] = limit;
+      }
+    }
+
+    const int d = ce / (BINS + 1);
+    const int m = ce % (BINS + 1);
+    for(int b = 0; b <= BINS; b++) hist[b] += d;
+
+    if(m != 0)
+    {
+      const int s = (int)(BINS / (float)m);
+      for(int b = 0; b <= BINS; b += s) hist[b]++;
+    }
+  } while(ce != ceb);
+
+  int hMin = BINS;
+  for(int b = 0; b < hMin; b++)
+    if(hist[b] != 0) hMin = b;
+
+  int cdfMax = 0;
+  for(int b = hMin; b <= BINS; b++) cdfMax += hist[b];
+  const int cdfMin = hist[hMin];
+
+  global float *lut = luts + (BINS + 1) * point;
+  int cdf = 0;
+  for(int b = 0; b <= BINS; b++)
+  {
+    if(b >= hMin) cdf += hist[b];
+    lut[b] = (cdf - cdfMin) / (float)(cdfMax - cdfMin);
+  }
+}
+
+kernel void
+clahe_apply(read_only image2d_t in, read_only image2d_t luminance, write_only image2d_t out, const int width,
+            const int height, global const float *luts, const int step, const int grid_w, const int grid_h)
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+  if(x >= width || y >= height) return;
+
+  const int v = clahe_bin(read_imagef(luminance, sampleri, (int2)(x, y)).x);
+
+  const int gx0 = min(x / step, grid_w - 1), gx1 = min(gx0 + 1, grid_w - 1);
+  const int gy0 = min(y / step, grid_h - 1), gy1 = min(gy0 + 1, grid_h - 1);
+  const int x0 = gx0 * step, x1 = min(gx1 * step, width - 1);
+  const int y0 = gy0 * step, y1 = min(gy1 * step, height - 1);
+  const float fx = x1 > x0 ? (x - x0) / (float)(x1 - x0) : 0.0f;
+  const float fy = y1 > y0 ? (y - y0) / (float)(y1 - y0) : 0.0f;
+
+  const float l00 = luts[(BINS + 1) * (gy0 * grid_w + gx0) + v];
+  const float l01 = luts[(BINS + 1) * (gy0 * grid_w + gx1) + v];
+  const float l10 = luts[(BINS + 1) * (gy1 * grid_w + gx0) + v];
+  const float l11 = luts[(BINS + 1) * (gy1 * grid_w + gx1) + v];
+  const float l = mix(mix(l00, l01, fx), mix(l10, l11, fx), fy);
+
+  float4 hsl = RGB_2_HSL(read_imagef(in, sampleri, (int2)(x, y)));
+  hsl.z = l;
+  write_imagef(out, (int2)(x, y), HSL_2_RGB(hsl));
+}
+
+#undef BINS
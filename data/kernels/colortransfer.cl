@@ -0,0 +1,72 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2017 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "common.h"
+
+// applies the colour transfer of src/iop/colortransfer.c. the histogram and the clusters of the input are
+// computed on the host, clusters[8 * c] holds mean and deviation of input cluster c, followed by those of the
+// target cluster it maps to.
+
+#define HISTN (1 << 11)
+#define MAXN 5
+
+kernel void
+colortransfer_apply(read_only image2d_t in, write_only image2d_t out, const int width, const int height,
+                    global const int *hist, global const float *target_hist, global const float *clusters,
+                    const int n)
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+  if(x >= width || y >= height) return;
+
+  const float4 pixel = read_imagef(in, sampleri, (int2)(x, y));
+  float4 o = pixel;
+
+  // L: match histogram
+  o.x = clamp(target_hist[hist[(int)clamp(HISTN * pixel.x / 100.0f, 0.0f, (float)(HISTN - 1))]], 0.0f, 100.0f);
+
+  // a, b: fuzzy weighting of the clusters by their distance
+  float weight[MAXN];
+  float Mdist = 0.0f, mdist = FLT_MAX;
+  for(int c = 0; c < n; c++)
+  {
+    const float da = pixel.y - clusters[8 * c + 0], db = pixel.z - clusters[8 * c + 1];
+    weight[c] = da * da + db * db;
+    mdist = fmin(mdist, weight[c]);
+    Mdist = fmax(Mdist, weight[c]);
+  }
+  if(Mdist - mdist > 0.0f)
+    for(int c = 0; c < n; c++) weight[c] = (weight[c] - mdist) / (Mdist - mdist);
+  float sum = 0.0f;
+  for(int c = 0; c < n; c++) sum += weight[c];
+  if(sum > 0.0f)
+    for(int c = 0; c < n; c++) weight[c] /= sum;
+
+  // subtract mean, scale nvar/var, add nmean
+  o.y = o.z = 0.0f;
+  for(int c = 0; c < n; c++)
+  {
+    global const float *k = clusters + 8 * c;
+    o.y += weight[c] * ((pixel.y - k[0]) * k[6] / k[2] + k[4]);
+    o.z += weight[c] * ((pixel.z - k[1]) * k[7] / k[3] + k[5]);
+  }
+  write_imagef(out, (int2)(x, y), o);
+}
+
+#undef HISTN
+#undef MAXN
@@ -0,0 +1,106 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2017 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "common.h"
+
+// defringe of src/iop/defringe.c, see there for how it works
+
+#define MAGIC_THRESHOLD_COEFF 33.0f
+
+// squared chroma difference of the input to its gaussian blurred copy
+kernel void
+defringe_edge(read_only image2d_t in, read_only image2d_t blurred, write_only image2d_t edge, const int width,
+              const int height)
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+  if(x >= width || y >= height) return;
+
+  const float4 i = read_imagef(in, sampleri, (int2)(x, y));
+  const float4 b = read_imagef(blurred, sampleri, (int2)(x, y));
+  const float da = i.y - b.y, db = i.z - b.z;
+  write_imagef(edge, (int2)(x, y), (float4)(da * da + db * db, 0.0f, 0.0f, 0.0f));
+}
+
+// sum of the edge chroma of every row, for the global average
+kernel void
+defringe_rowsum(read_only image2d_t edge, global float *rows, const int width, const int height)
+{
+  const int y = get_global_id(0);
+  if(y >= height) return;
+
+  float sum = 0.0f;
+  for(int x = 0; x < width; x++) sum += read_imagef(edge, sampleri, (int2)(x, y)).x;
+  rows[y] = sum;
+}
+
+float
+defringe_edge_at(read_only image2d_t edge, const int x, const int y, const int width, const int height)
+{
+  return read_imagef(edge, sampleri, (int2)(clamp(x, 0, width - 1), clamp(y, 0, height - 1))).x;
+}
+
+// replaces the chroma of pixels at or next to a fringe by the inverse chroma weighted average of the samples
+// of xy_small. in local average mode the threshold comes from the samples of xy_avg.
+kernel void
+defringe_apply(read_only image2d_t in, read_only image2d_t edge, write_only image2d_t out, const int width,
+               const int height, const int local_average, const float thresh, const float avg_edge_chroma,
+               const float user_thresh, global const int *xy_small, const int samples_small,
+               global const int *xy_avg, const int samples_avg)
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+  if(x >= width || y >= height) return;
+
+  float4 pixel = read_imagef(in, sampleri, (int2)(x, y));
+  const float e = defringe_edge_at(edge, x, y, width, height);
+
+  float local_thresh = thresh;
+  float avg_chroma = avg_edge_chroma;
+  if(local_average && e > thresh)
+  {
+    float local_avg = 0.0f;
+    for(int u = 0; u < samples_avg; u++)
+      local_avg += defringe_edge_at(edge, x + xy_avg[2 * u], y + xy_avg[2 * u + 1], width, height);
+    avg_chroma = fmax(0.01f, local_avg / samples_avg);
+    local_thresh = fmax(0.1f, 4.0f * user_thresh * avg_chroma / MAGIC_THRESHOLD_COEFF);
+  }
+
+  // the pixel or one of its neighbours is over the threshold ("region growing by 1 pixel")
+  int fringe = 0;
+  for(int j = -1; j <= 1; j++)
+    for(int i = -1; i <= 1; i++) fringe |= defringe_edge_at(edge, x + i, y + j, width, height) > local_thresh;
+
+  if(fringe)
+  {
+    float atot = 0.0f, btot = 0.0f, norm = 0.0f;
+    for(int u = 0; u < samples_small; u++)
+    {
+      const int xx = clamp(x + xy_small[2 * u], 0, width - 1);
+      const int yy = clamp(y + xy_small[2 * u + 1], 0, height - 1);
+      const float weight = 1.0f / (defringe_edge_at(edge, xx, yy, width, height) + avg_chroma);
+      const float4 sample = read_imagef(in, sampleri, (int2)(xx, yy));
+      atot += weight * sample.y;
+      btot += weight * sample.z;
+      norm += weight;
+    }
+    pixel.y = atot / norm;
+    pixel.z = btot / norm;
+  }
+  write_imagef(out, (int2)(x, y), pixel);
+}
@@ -0,0 +1,797 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2017 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "common.h"
+
+// AMaZE demosaic (Aliasing Minimization and Zipper Elimination) by Emil Martinec, as in
+// src/iop/amaze_demosaic_RT.cc. the cpu version works on tiles with a 16 pixel border; here every step runs on
+// the whole image, mirrored into a buffer of width + 32 by height + 32 pixels. every step keeps the margin of
+// the cpu tile loops, so the pixels within 16 of the padded border never feed into the output.
+//
+// all buffers have a stride of pw floats. the half size buffers hold one value per red or blue site at
+// index >> 1, where index is (y * pw + x), with pw even so that every pair of columns holds one such site.
+// the steps which refine weights from their already refined neighbours on the cpu use the unrefined ones here.
+
+#define AMAZE_EPS 1e-5f
+#define AMAZE_EPSSQ 1e-10f
+#define AMAZE_ARTHRESH 0.75f
+#define AMAZE_NYQTHRESH 0.5f
+
+#define AMAZE_OFFSETS                                                                                        \
+  const int v1 = pw, v2 = 2 * pw, v3 = 3 * pw;                                                               \
+  const int p1 = -pw + 1, p2 = -2 * pw + 2, p3 = -3 * pw + 3;                                                \
+  const int m1 = pw + 1, m2 = 2 * pw + 2, m3 = 3 * pw + 3;
+
+// inside the margin of b pixels of the W x H padded image
+#define AMAZE_INSIDE(b) (x >= (b) && y >= (b) && x < W - (b) && y < H - (b))
+
+float
+amaze_sqr(const float x)
+{
+  return x * x;
+}
+
+float
+amaze_ulim(const float a, const float b, const float c)
+{
+  return b < c ? fmax(b, fmin(a, c)) : fmax(c, fmin(a, b));
+}
+
+float
+amaze_intp(const float a, const float b, const float c)
+{
+  return a * (b - c) + c;
+}
+
+// clamps infinite values to [0, 1] and maps nan to 0.5, leaves all others alone
+float
+amaze_clampnan(const float x)
+{
+  if(isinf(x)) return x < 0.0f ? 0.0f : 1.0f;
+  if(isnan(x)) return 0.5f;
+  return x;
+}
+
+// mirrors at the border without repeating the border pixel, which keeps the bayer pattern
+int
+amaze_mirror(int i, const int n)
+{
+  i = i < 0 ? -i : i;
+  return i >= n ? 2 * n - 2 - i : i;
+}
+
+kernel void
+amaze_init(read_only image2d_t in, global float *cfa, global float *rgbgreen, const int width,
+           const int height, const int W, const int H, const int pw)
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+  if(x >= pw || y >= H) return;
+
+  const int indx = mad24(y, pw, x);
+  float v = 0.0f;
+  if(x < W)
+    v = read_imagef(in, sampleri, (int2)(amaze_mirror(x - 16, width), amaze_mirror(y - 16, height))).x;
+  cfa[indx] = rgbgreen[indx] = v;
+}
+
+// horizontal and vertical gradients
+kernel void
+amaze_gradients(global const float *cfa, global float *dirwts0, global float *dirwts1,
+                global float *delhvsqsum, const int W, const int H, const int pw)
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+  if(!AMAZE_INSIDE(2)) return;
+  AMAZE_OFFSETS
+
+  const int indx = mad24(y, pw, x);
+  const float delh = fabs(cfa[indx + 1] - cfa[indx - 1]);
+  const float delv = fabs(cfa[indx + v1] - cfa[indx - v1]);
+  dirwts0[indx] = AMAZE_EPS + fabs(cfa[indx + v2] - cfa[indx]) + fabs(cfa[indx] - cfa[indx - v2]) + delv;
+  dirwts1[indx] = AMAZE_EPS + fabs(cfa[indx + 2] - cfa[indx]) + fabs(cfa[indx] - cfa[indx - 2]) + delh;
+  delhvsqsum[indx] = amaze_sqr(delh) + amaze_sqr(delv);
+}
+
+// vertical and horizontal colour differences, by adaptive ratios and by hamilton-adams
+kernel void
+amaze_colour_differences(global const float *cfa, global const float *dirwts0, global const float *dirwts1,
+                         global float *vcd, global float *hcd, global float *vcdalt, global float *hcdalt,
+                         global float *dgintv, global float *dginth, const int W, const int H, const int pw,
+                         const unsigned int filters, const float clip_pt8)
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+  if(!AMAZE_INSIDE(4)) return;
+  AMAZE_OFFSETS
+
+  const int indx = mad24(y, pw, x);
+  const float c0 = cfa[indx];
+
+  // colour ratios in each cardinal direction
+  const float cru = cfa[indx - v1] * (dirwts0[indx - v2] + dirwts0[indx])
+                    / (dirwts0[indx - v2] * (AMAZE_EPS + c0) + dirwts0[indx] * (AMAZE_EPS + cfa[indx - v2]));
+  const float crd = cfa[indx + v1] * (dirwts0[indx + v2] + dirwts0[indx])
+                    / (dirwts0[indx + v2] * (AMAZE_EPS + c0) + dirwts0[indx] * (AMAZE_EPS + cfa[indx + v2]));
+  const float crl = cfa[indx - 1] * (dirwts1[indx - 2] + dirwts1[indx])
+                    / (dirwts1[indx - 2] * (AMAZE_EPS + c0) + dirwts1[indx] * (AMAZE_EPS + cfa[indx - 2]));
+  const float crr = cfa[indx + 1] * (dirwts1[indx + 2] + dirwts1[indx])
+                    / (dirwts1[indx + 2] * (AMAZE_EPS + c0) + dirwts1[indx] * (AMAZE_EPS + cfa[indx + 2]));
+
+  // G interpolated in vert/hor directions using Hamilton-Adams method
+  const float guha = cfa[indx - v1] + 0.5f * (c0 - cfa[indx - v2]);
+  const float gdha = cfa[indx + v1] + 0.5f * (c0 - cfa[indx + v2]);
+  const float glha = cfa[indx - 1] + 0.5f * (c0 - cfa[indx - 2]);
+  const float grha = cfa[indx + 1] + 0.5f * (c0 - cfa[indx + 2]);
+
+  // G interpolated in vert/hor directions using adaptive ratios
+  float guar = fabs(1.0f - cru) < AMAZE_ARTHRESH ? c0 * cru : guha;
+  float gdar = fabs(1.0f - crd) < AMAZE_ARTHRESH ? c0 * crd : gdha;
+  float glar = fabs(1.0f - crl) < AMAZE_ARTHRESH ? c0 * crl : glha;
+  float grar = fabs(1.0f - crr) < AMAZE_ARTHRESH ? c0 * crr : grha;
+
+  // adaptive weights for vertical/horizontal directions
+  const float hwt = dirwts1[indx - 1] / (dirwts1[indx - 1] + dirwts1[indx + 1]);
+  const float vwt = dirwts0[indx - v1] / (dirwts0[indx + v1] + dirwts0[indx - v1]);
+
+  // interpolated G via adaptive weights of cardinal evaluations
+  const float Gintvha = vwt * gdha + (1.0f - vwt) * guha;
+  const float Ginthha = hwt * grha + (1.0f - hwt) * glha;
+
+  // interpolated colour differences
+  float v, h, valt, halt;
+  if(FC(y, x, filters) & 1)
+  {
+    v = c0 - (vwt * gdar + (1.0f - vwt) * guar);
+    h = c0 - (hwt * grar + (1.0f - hwt) * glar);
+    valt = c0 - Gintvha;
+    halt = c0 - Ginthha;
+  }
+  else
+  {
+    v = (vwt * gdar + (1.0f - vwt) * guar) - c0;
+    h = (hwt * grar + (1.0f - hwt) * glar) - c0;
+    valt = Gintvha - c0;
+    halt = Ginthha - c0;
+  }
+
+  if(c0 > clip_pt8 || Gintvha > clip_pt8 || Ginthha > clip_pt8)
+  {
+    // use HA if highlights are (nearly) clipped
+    guar = guha;
+    gdar = gdha;
+    glar = glha;
+    grar = grha;
+    v = valt;
+    h = halt;
+  }
+
+  vcd[indx] = v;
+  hcd[indx] = h;
+  vcdalt[indx] = valt;
+  hcdalt[indx] = halt;
+
+  // differences of interpolations in opposite directions
+  dgintv[indx] = fmin(amaze_sqr(guha - gdha), amaze_sqr(guar - gdar));
+  dginth[indx] = fmin(amaze_sqr(glha - grha), amaze_sqr(glar - grar));
+}
+
+float
+amaze_var3(global const float *d, const int indx, const int o)
+{
+  return 3.0f * (amaze_sqr(d[indx - o]) + amaze_sqr(d[indx]) + amaze_sqr(d[indx + o]))
+         - amaze_sqr(d[indx - o] + d[indx] + d[indx + o]);
+}
+
+// picks the colour difference of smaller variance and bounds it in regions of high saturation
+kernel void
+amaze_variances(global const float *cfa, global const float *vcd, global const float *hcd,
+                global const float *vcdalt, global const float *hcdalt, global float *vcd_out,
+                global float *hcd_out, global float *cddiffsq, const int W, const int H, const int pw,
+                const unsigned int filters, const float clip_pt)
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+  if(!AMAZE_INSIDE(4)) return;
+  AMAZE_OFFSETS
+
+  const int indx = mad24(y, pw, x);
+  const float c0 = cfa[indx];
+
+  // choose the smallest variance; this yields a smoother interpolation
+  float h = amaze_var3(hcdalt, indx, 2) < amaze_var3(hcd, indx, 2) ? hcdalt[indx] : hcd[indx];
+  float v = amaze_var3(vcdalt, indx, v2) < amaze_var3(vcd, indx, v2) ? vcdalt[indx] : vcd[indx];
+
+  // bound the interpolation in regions of high saturation
+  if(FC(y, x, filters) & 1)
+  {
+    // G site
+    const float Ginth = -h + c0; // R or B
+    const float Gintv = -v + c0; // B or R
+
+    if(h > 0.0f)
+    {
+      if(3.0f * h > (Ginth + c0))
+        h = -amaze_ulim(Ginth, cfa[indx - 1], cfa[indx + 1]) + c0;
+      else
+      {
+        const float hwt = 1.0f - 3.0f * h / (AMAZE_EPS + Ginth + c0);
+        h = hwt * h + (1.0f - hwt) * (-amaze_ulim(Ginth, cfa[indx - 1], cfa[indx + 1]) + c0);
+      }
+    }
+
+    if(v > 0.0f)
+    {
+      if(3.0f * v > (Gintv + c0))
+        v = -amaze_ulim(Gintv, cfa[indx - v1], cfa[indx + v1]) + c0;
+      else
+      {
+        const float vwt = 1.0f - 3.0f * v / (AMAZE_EPS + Gintv + c0);
+        v = vwt * v + (1.0f - vwt) * (-amaze_ulim(Gintv, cfa[indx - v1], cfa[indx + v1]) + c0);
+      }
+    }
+
+    if(Ginth > clip_pt) h = -amaze_ulim(Ginth, cfa[indx - 1], cfa[indx + 1]) + c0;
+    if(Gintv > clip_pt) v = -amaze_ulim(Gintv, cfa[indx - v1], cfa[indx + v1]) + c0;
+  }
+  else
+  {
+    // R or B site
+    const float Ginth = h + c0; // interpolated G
+    const float Gintv = v + c0;
+
+    if(h < 0.0f)
+    {
+      if(3.0f * h < -(Ginth + c0))
+        h = amaze_ulim(Ginth, cfa[indx - 1], cfa[indx + 1]) - c0;
+      else
+      {
+        const float hwt = 1.0f + 3.0f * h / (AMAZE_EPS + Ginth + c0);
+        h = hwt * h + (1.0f - hwt) * (amaze_ulim(Ginth, cfa[indx - 1], cfa[indx + 1]) - c0);
+      }
+    }
+
+    if(v < 0.0f)
+    {
+      if(3.0f * v < -(Gintv + c0))
+        v = amaze_ulim(Gintv, cfa[indx - v1], cfa[indx + v1]) - c0;
+      else
+      {
+        const float vwt = 1.0f + 3.0f * v / (AMAZE_EPS + Gintv + c0);
+        v = vwt * v + (1.0f - vwt) * (amaze_ulim(Gintv, cfa[indx - v1], cfa[indx + v1]) - c0);
+      }
+    }
+
+    if(Ginth > clip_pt) h = amaze_ulim(Ginth, cfa[indx - 1], cfa[indx + 1]) - c0;
+    if(Gintv > clip_pt) v = amaze_ulim(Gintv, cfa[indx - v1], cfa[indx + v1]) - c0;
+
+    cddiffsq[indx] = amaze_sqr(v - h);
+  }
+
+  vcd_out[indx] = v;
+  hcd_out[indx] = h;
+}
+
+// weight of horizontal vs vertical interpolation at the red and blue sites
+kernel void
+amaze_hvwt(global const float *vcd, global const float *hcd, global const float *dirwts0,
+           global const float *dirwts1, global const float *dgintv, global const float *dginth,
+           global float *hvwt, const int W, const int H, const int pw, const unsigned int filters)
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+  if(!AMAZE_INSIDE(6) || (FC(y, x, filters) & 1)) return;
+  AMAZE_OFFSETS
+
+  const int indx = mad24(y, pw, x);
+
+  // compute colour difference variances in cardinal directions
+  const float uave = vcd[indx] + vcd[indx - v1] + vcd[indx - v2] + vcd[indx - v3];
+  const float dave = vcd[indx] + vcd[indx + v1] + vcd[indx + v2] + vcd[indx + v3];
+  const float lave = hcd[indx] + hcd[indx - 1] + hcd[indx - 2] + hcd[indx - 3];
+  const float rave = hcd[indx] + hcd[indx + 1] + hcd[indx + 2] + hcd[indx + 3];
+
+  // colour difference (G-R or G-B) variance in up/down/left/right directions
+  float Dgrbvvaru = amaze_sqr(vcd[indx] - uave) + amaze_sqr(vcd[indx - v1] - uave)
+                    + amaze_sqr(vcd[indx - v2] - uave) + amaze_sqr(vcd[indx - v3] - uave);
+  float Dgrbvvard = amaze_sqr(vcd[indx] - dave) + amaze_sqr(vcd[indx + v1] - dave)
+                    + amaze_sqr(vcd[indx + v2] - dave) + amaze_sqr(vcd[indx + v3] - dave);
+  float Dgrbhvarl = amaze_sqr(hcd[indx] - lave) + amaze_sqr(hcd[indx - 1] - lave)
+                    + amaze_sqr(hcd[indx - 2] - lave) + amaze_sqr(hcd[indx - 3] - lave);
+  float Dgrbhvarr = amaze_sqr(hcd[indx] - rave) + amaze_sqr(hcd[indx + 1] - rave)
+                    + amaze_sqr(hcd[indx + 2] - rave) + amaze_sqr(hcd[indx + 3] - rave);
+
+  const float hwt = dirwts1[indx - 1] / (dirwts1[indx - 1] + dirwts1[indx + 1]);
+  const float vwt = dirwts0[indx - v1] / (dirwts0[indx + v1] + dirwts0[indx - v1]);
+
+  const float vcdvar = AMAZE_EPSSQ + vwt * Dgrbvvard + (1.0f - vwt) * Dgrbvvaru;
+  const float hcdvar = AMAZE_EPSSQ + hwt * Dgrbhvarr + (1.0f - hwt) * Dgrbhvarl;
+
+  // compute fluctuations in up/down and left/right interpolations of colours
+  Dgrbvvaru = dgintv[indx] + dgintv[indx - v1] + dgintv[indx - v2];
+  Dgrbvvard = dgintv[indx] + dgintv[indx + v1] + dgintv[indx + v2];
+  Dgrbhvarl = dginth[indx] + dginth[indx - 1] + dginth[indx - 2];
+  Dgrbhvarr = dginth[indx] + dginth[indx + 1] + dginth[indx + 2];
+
+  const float vcdvar1 = AMAZE_EPSSQ + vwt * Dgrbvvard + (1.0f - vwt) * Dgrbvvaru;
+  const float hcdvar1 = AMAZE_EPSSQ + hwt * Dgrbhvarr + (1.0f - hwt) * Dgrbhvarl;
+
+  // determine adaptive weights for G interpolation
+  const float varwt = hcdvar / (vcdvar + hcdvar);
+  const float diffwt = hcdvar1 / (vcdvar1 + hcdvar1);
+
+  // if both agree on interpolation direction, choose the one with strongest directional discrimination;
+  // otherwise, choose the u/d and l/r difference fluctuation weights
+  if((0.5f - varwt) * (0.5f - diffwt) > 0.0f && fabs(0.5f - diffwt) < fabs(0.5f - varwt))
+    hvwt[indx >> 1] = varwt;
+  else
+    hvwt[indx >> 1] = diffwt;
+}
+
+// nyquist texture test at the red and blue sites: is the difference of vcd to hcd larger than the gradients?
+kernel void
+amaze_nyquist_test(global const float *cddiffsq, global const float *delhvsqsum, global uchar *nyquist,
+                   const int W, const int H, const int pw, const unsigned int filters)
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+  if(x >= W || y >= H || (FC(y, x, filters) & 1)) return;
+  AMAZE_OFFSETS
+
+  const int indx = mad24(y, pw, x);
+  if(!AMAZE_INSIDE(6))
+  {
+    nyquist[indx >> 1] = 0;
+    return;
+  }
+
+  // gaussian on 5x5 quincunx, sigma=1.2
+  const float gaussodd[4]
+      = { 0.14659727707323927f, 0.103592713382435f, 0.0732036125103057f, 0.0365543548389495f };
+  // gaussian on 5x5, sigma=1.2, multiplied with nyqthresh
+  const float gaussgrad[6]
+      = { AMAZE_NYQTHRESH * 0.07384411893421103f, AMAZE_NYQTHRESH * 0.06207511968171489f,
+          AMAZE_NYQTHRESH * 0.0521818194747806f,  AMAZE_NYQTHRESH * 0.03687419286733595f,
+          AMAZE_NYQTHRESH * 0.03099732204057846f, AMAZE_NYQTHRESH * 0.018413194161458882f };
+
+  const float nyqutest
+      = (gaussodd[0] * cddiffsq[indx]
+         + gaussodd[1] * (cddiffsq[indx - m1] + cddiffsq[indx + p1] + cddiffsq[indx - p1] + cddiffsq[indx + m1])
+         + gaussodd[2] * (cddiffsq[indx - v2] + cddiffsq[indx - 2] + cddiffsq[indx + 2] + cddiffsq[indx + v2])
+         + gaussodd[3] * (cddiffsq[indx - m2] + cddiffsq[indx + p2] + cddiffsq[indx - p2] + cddiffsq[indx + m2]))
+        - (gaussgrad[0] * delhvsqsum[indx]
+           + gaussgrad[1] * (delhvsqsum[indx - v1] + delhvsqsum[indx + 1] + delhvsqsum[indx - 1]
+                             + delhvsqsum[indx + v1])
+           + gaussgrad[2] * (delhvsqsum[indx - m1] + delhvsqsum[indx + p1] + delhvsqsum[indx - p1]
+                             + delhvsqsum[indx + m1])
+           + gaussgrad[3] * (delhvsqsum[indx - v2] + delhvsqsum[indx - 2] + delhvsqsum[indx + 2]
+                             + delhvsqsum[indx + v2])
+           + gaussgrad[4] * (delhvsqsum[indx - v2 - 1] + delhvsqsum[indx - v2 + 1] + delhvsqsum[indx - pw - 2]
+                             + delhvsqsum[indx - pw + 2] + delhvsqsum[indx + pw - 2] + delhvsqsum[indx + pw + 2]
+                             + delhvsqsum[indx + v2 - 1] + delhvsqsum[indx + v2 + 1])
+           + gaussgrad[5] * (delhvsqsum[indx - m2] + delhvsqsum[indx + p2] + delhvsqsum[indx - p2]
+                             + delhvsqsum[indx + m2]));
+
+  nyquist[indx >> 1] = nyqutest > 0.0f;
+}
+
+// if most of your neighbours are named Nyquist, it's likely that you're one too, or not
+kernel void
+amaze_nyquist_vote(global const uchar *nyquist, global uchar *nyquist2, const int W, const int H, const int pw,
+                   const unsigned int filters)
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+  if(x >= W || y >= H || (FC(y, x, filters) & 1)) return;
+  AMAZE_OFFSETS
+
+  const int indx = mad24(y, pw, x);
+  if(!AMAZE_INSIDE(8))
+  {
+    nyquist2[indx >> 1] = 0;
+    return;
+  }
+
+  const int nyquisttemp = nyquist[(indx - v2) >> 1] + nyquist[(indx - m1) >> 1] + nyquist[(indx + p1) >> 1]
+                          + nyquist[(indx - 2) >> 1] + nyquist[(indx + 2) >> 1] + nyquist[(indx - p1) >> 1]
+                          + nyquist[(indx + m1) >> 1] + nyquist[(indx + v2) >> 1];
+  nyquist2[indx >> 1] = nyquisttemp > 4 ? 1 : (nyquisttemp < 4 ? 0 : nyquist[indx >> 1]);
+}
+
+// in areas of nyquist texture, do area interpolation
+kernel void
+amaze_nyquist_area(global const float *cfa, global const uchar *nyquist2, global float *hvwt, const int W,
+                   const int H, const int pw, const unsigned int filters)
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+  if(!AMAZE_INSIDE(8) || (FC(y, x, filters) & 1)) return;
+  AMAZE_OFFSETS
+
+  const int indx = mad24(y, pw, x);
+  if(!nyquist2[indx >> 1]) return;
+
+  float sumcfa = 0.0f, sumh = 0.0f, sumv = 0.0f, sumsqh = 0.0f, sumsqv = 0.0f, areawt = 0.0f;
+  for(int i = -6; i < 7; i += 2)
+  {
+    int indx1 = indx + (i * pw) - 6;
+    for(int j = -6; j < 7; j += 2, indx1 += 2)
+    {
+      if(nyquist2[indx1 >> 1])
+      {
+        const float cfatemp = cfa[indx1];
+        sumcfa += cfatemp;
+        sumh += (cfa[indx1 - 1] + cfa[indx1 + 1]);
+        sumv += (cfa[indx1 - v1] + cfa[indx1 + v1]);
+        sumsqh += amaze_sqr(cfatemp - cfa[indx1 - 1]) + amaze_sqr(cfatemp - cfa[indx1 + 1]);
+        sumsqv += amaze_sqr(cfatemp - cfa[indx1 - v1]) + amaze_sqr(cfatemp - cfa[indx1 + v1]);
+        areawt += 1.0f;
+      }
+    }
+  }
+
+  // horizontal and vertical colour differences, and adaptive weight
+  sumh = sumcfa - 0.5f * sumh;
+  sumv = sumcfa - 0.5f * sumv;
+  areawt = 0.5f * areawt;
+  const float hcdvar = AMAZE_EPSSQ + fabs(areawt * sumsqh - sumh * sumh);
+  const float vcdvar = AMAZE_EPSSQ + fabs(areawt * sumsqv - sumv * sumv);
+  hvwt[indx >> 1] = hcdvar / (vcdvar + hcdvar);
+}
+
+// populate G at the red and blue sites, and the local curvature of G for the nyquist refinement
+kernel void
+amaze_populate_green(global const float *cfa, global const float *vcd, global const float *hcd,
+                     global const float *hvwt, global float *hvwt_out, global const uchar *nyquist2,
+                     global float *Dgrb0, global float *Dgrb2h, global float *Dgrb2v, global float *rgbgreen,
+                     const int W, const int H, const int pw, const unsigned int filters)
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+  if(x >= W || y >= H || (FC(y, x, filters) & 1)) return;
+  AMAZE_OFFSETS
+
+  const int indx = mad24(y, pw, x);
+  const int indx1 = indx >> 1;
+  if(!AMAZE_INSIDE(8))
+  {
+    hvwt_out[indx1] = hvwt[indx1];
+    Dgrb0[indx1] = Dgrb2h[indx1] = Dgrb2v[indx1] = 0.0f;
+    return;
+  }
+
+  // first ask if one gets more directional discrimination from nearby B/R sites
+  const float hvwtalt = 0.25f * (hvwt[(indx - m1) >> 1] + hvwt[(indx + p1) >> 1] + hvwt[(indx - p1) >> 1]
+                                 + hvwt[(indx + m1) >> 1]);
+  const float w = fabs(0.5f - hvwt[indx1]) < fabs(0.5f - hvwtalt) ? hvwtalt : hvwt[indx1];
+  hvwt_out[indx1] = w;
+
+  // evaluate colour differences, and G (finally!)
+  const float d = amaze_intp(w, vcd[indx], hcd[indx]);
+  const float g = cfa[indx] + d;
+  Dgrb0[indx1] = d;
+  rgbgreen[indx] = g;
+
+  // local curvature in G (preparation for nyquist refinement step)
+  const int nyq = nyquist2[indx1];
+  Dgrb2h[indx1] = nyq ? amaze_sqr(g - 0.5f * (rgbgreen[indx - 1] + rgbgreen[indx + 1])) : 0.0f;
+  Dgrb2v[indx1] = nyq ? amaze_sqr(g - 0.5f * (rgbgreen[indx - v1] + rgbgreen[indx + v1])) : 0.0f;
+}
+
+float
+amaze_gquinc(global const float *d, const int indx, const int pw)
+{
+  AMAZE_OFFSETS
+  // gaussian on quincunx grid
+  return 0.169917f * d[indx >> 1]
+         + 0.108947f * (d[(indx - m1) >> 1] + d[(indx + p1) >> 1] + d[(indx - p1) >> 1] + d[(indx + m1) >> 1])
+         + 0.069855f * (d[(indx - v2) >> 1] + d[(indx - 2) >> 1] + d[(indx + 2) >> 1] + d[(indx + v2) >> 1])
+         + 0.0287182f * (d[(indx - m2) >> 1] + d[(indx + p2) >> 1] + d[(indx - p2) >> 1] + d[(indx + m2) >> 1]);
+}
+
+// refine nyquist areas using G curvatures
+kernel void
+amaze_nyquist_refine(global const float *cfa, global const float *vcd, global const float *hcd,
+                     global const uchar *nyquist2, global const float *Dgrb2h, global const float *Dgrb2v,
+                     global float *Dgrb0, global float *rgbgreen, const int W, const int H, const int pw,
+                     const unsigned int filters)
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+  if(!AMAZE_INSIDE(8) || (FC(y, x, filters) & 1)) return;
+
+  const int indx = mad24(y, pw, x);
+  if(!nyquist2[indx >> 1]) return;
+
+  // local averages (over Nyquist pixels only) of G curvature squared
+  const float gvarh = AMAZE_EPSSQ + amaze_gquinc(Dgrb2h, indx, pw);
+  const float gvarv = AMAZE_EPSSQ + amaze_gquinc(Dgrb2v, indx, pw);
+
+  // use the results as weights for refined G interpolation
+  const float d = (hcd[indx] * gvarv + vcd[indx] * gvarh) / (gvarv + gvarh);
+  Dgrb0[indx >> 1] = d;
+  rgbgreen[indx] = cfa[indx] + d;
+}
+
+// diagonal gradients: work item (k, y) covers columns 2k and 2k + 1, delp/delm belong to the red or blue
+// site of the pair, Dgrbsq1p/Dgrbsq1m to the green one
+kernel void
+amaze_diagonal_gradients(global const float *cfa, global float *delp, global float *delm,
+                         global float *Dgrbsq1p, global float *Dgrbsq1m, const int W, const int H, const int pw,
+                         const unsigned int filters)
+{
+  const int x = 2 * get_global_id(0);
+  const int y = get_global_id(1);
+  if(!AMAZE_INSIDE(6)) return;
+  AMAZE_OFFSETS
+
+  const int indx = mad24(y, pw, x);
+  const int rb = (FC(y, 2, filters) & 1) ? indx + 1 : indx;
+  const int g = (FC(y, 2, filters) & 1) ? indx : indx + 1;
+  delp[indx >> 1] = fabs(cfa[rb + p1] - cfa[rb - p1]);
+  delm[indx >> 1] = fabs(cfa[rb + m1] - cfa[rb - m1]);
+  Dgrbsq1p[indx >> 1] = amaze_sqr(cfa[g] - cfa[g - p1]) + amaze_sqr(cfa[g] - cfa[g + p1]);
+  Dgrbsq1m[indx >> 1] = amaze_sqr(cfa[g] - cfa[g - m1]) + amaze_sqr(cfa[g] - cfa[g + m1]);
+}
+
+float
+amaze_gausseven(global const float *d, const int indx, const int pw)
+{
+  AMAZE_OFFSETS
+  // gaussian on 5x5 alt quincunx, sigma=1.5
+  return 0.13719494435797422f
+             * (d[(indx - v1) >> 1] + d[(indx - 1) >> 1] + d[(indx + 1) >> 1] + d[(indx + v1) >> 1])
+         + 0.05640252782101291f
+               * (d[(indx - v2 - 1) >> 1] + d[(indx - v2 + 1) >> 1] + d[(indx - 2 - v1) >> 1]
+                  + d[(indx + 2 - v1) >> 1] + d[(indx - 2 + v1) >> 1] + d[(indx + 2 + v1) >> 1]
+                  + d[(indx + v2 - 1) >> 1] + d[(indx + v2 + 1) >> 1]);
+}
+
+// B/R at the R/B sites, interpolated along both diagonals
+float
+amaze_diagonal(global const float *cfa, const int indx, const int o)
+{
+  const float cr = 2.0f * cfa[indx + o] / (AMAZE_EPS + cfa[indx] + cfa[indx + 2 * o]);
+  return fabs(1.0f - cr) < AMAZE_ARTHRESH ? cfa[indx] * cr : cfa[indx + o] + 0.5f * (cfa[indx] - cfa[indx + 2 * o]);
+}
+
+// bounds the diagonal interpolation in regions of high saturation
+float
+amaze_bound_diagonal(global const float *cfa, const int indx, const int o, float rb, const float clip_pt)
+{
+  const float c0 = cfa[indx];
+  if(rb < c0)
+  {
+    if(2.0f * rb < c0)
+      rb = amaze_ulim(rb, cfa[indx - o], cfa[indx + o]);
+    else
+    {
+      const float wt = 2.0f * (c0 - rb) / (AMAZE_EPS + rb + c0);
+      rb = wt * rb + (1.0f - wt) * amaze_ulim(rb, cfa[indx - o], cfa[indx + o]);
+    }
+  }
+  if(rb > clip_pt) rb = amaze_ulim(rb, cfa[indx - o], cfa[indx + o]);
+  return rb;
+}
+
+kernel void
+amaze_diagonal_interpolate(global const float *cfa, global const float *delp, global const float *delm,
+                           global const float *Dgrbsq1p, global const float *Dgrbsq1m, global float *rbm,
+                           global float *rbp, global float *pmwt, const int W, const int H, const int pw,
+                           const unsigned int filters, const float clip_pt)
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+  if(!AMAZE_INSIDE(8) || (FC(y, x, filters) & 1)) return;
+  AMAZE_OFFSETS
+
+  const int indx = mad24(y, pw, x);
+  const int indx1 = indx >> 1;
+
+  // colour differences in diagonal directions
+  const float rbse = amaze_diagonal(cfa, indx, m1);
+  const float rbnw = amaze_diagonal(cfa, indx, -m1);
+  const float rbne = amaze_diagonal(cfa, indx, p1);
+  const float rbsw = amaze_diagonal(cfa, indx, -p1);
+
+  const float wtse = AMAZE_EPS + delm[indx1] + delm[(indx + m1) >> 1] + delm[(indx + m2) >> 1];
+  const float wtnw = AMAZE_EPS + delm[indx1] + delm[(indx - m1) >> 1] + delm[(indx - m2) >> 1];
+  const float wtne = AMAZE_EPS + delp[indx1] + delp[(indx + p1) >> 1] + delp[(indx + p2) >> 1];
+  const float wtsw = AMAZE_EPS + delp[indx1] + delp[(indx - p1) >> 1] + delp[(indx - p2) >> 1];
+
+  const float m = (wtse * rbnw + wtnw * rbse) / (wtse + wtnw);
+  const float p = (wtne * rbsw + wtsw * rbne) / (wtne + wtsw);
+
+  // variance of R-B in plus/minus directions
+  const float rbvarm = AMAZE_EPSSQ + amaze_gausseven(Dgrbsq1m, indx, pw);
+  pmwt[indx1] = rbvarm / ((AMAZE_EPSSQ + amaze_gausseven(Dgrbsq1p, indx, pw)) + rbvarm);
+
+  rbp[indx1] = amaze_bound_diagonal(cfa, indx, p1, p, clip_pt);
+  rbm[indx1] = amaze_bound_diagonal(cfa, indx, m1, m, clip_pt);
+}
+
+// R+B interpolated along the diagonals
+kernel void
+amaze_rbint(global const float *cfa, global const float *rbm, global const float *rbp,
+            global const float *pmwt, global float *pmwt_out, global float *rbint, const int W, const int H,
+            const int pw, const unsigned int filters)
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+  if(x >= W || y >= H || (FC(y, x, filters) & 1)) return;
+  AMAZE_OFFSETS
+
+  const int indx = mad24(y, pw, x);
+  const int indx1 = indx >> 1;
+  if(!AMAZE_INSIDE(10))
+  {
+    pmwt_out[indx1] = pmwt[indx1];
+    return;
+  }
+
+  // first ask if one gets more directional discrimination from nearby B/R sites
+  const float pmwtalt = 0.25f * (pmwt[(indx - m1) >> 1] + pmwt[(indx + p1) >> 1] + pmwt[(indx - p1) >> 1]
+                                 + pmwt[(indx + m1) >> 1]);
+  const float w = fabs(0.5f - pmwt[indx1]) < fabs(0.5f - pmwtalt) ? pmwtalt : pmwt[indx1];
+  pmwt_out[indx1] = w;
+  rbint[indx1] = 0.5f * (cfa[indx] + rbm[indx1] * (1.0f - w) + rbp[indx1] * w);
+}
+
+// G interpolated vertically and horizontally from R+B, where the diagonals discriminate better
+float
+amaze_green_from_rbint(global const float *cfa, global const float *rbint, const int indx, const int indx1,
+                       const int o, const int o1)
+{
+  const float cr = cfa[indx + o] * 2.0f / (AMAZE_EPS + rbint[indx1] + rbint[indx1 + o1]);
+  return fabs(1.0f - cr) < AMAZE_ARTHRESH ? rbint[indx1] * cr
+                                          : cfa[indx + o] + 0.5f * (rbint[indx1] - rbint[indx1 + o1]);
+}
+
+float
+amaze_bound_green(global const float *cfa, const int indx, const int o, float g, const float rb,
+                  const float clip_pt)
+{
+  if(g < rb)
+  {
+    if(2.0f * g < rb)
+      g = amaze_ulim(g, cfa[indx - o], cfa[indx + o]);
+    else
+    {
+      const float wt = 2.0f * (rb - g) / (AMAZE_EPS + g + rb);
+      g = wt * g + (1.0f - wt) * amaze_ulim(g, cfa[indx - o], cfa[indx + o]);
+    }
+  }
+  if(g > clip_pt) g = amaze_ulim(g, cfa[indx - o], cfa[indx + o]);
+  return g;
+}
+
+kernel void
+amaze_diagonal_green(global const float *cfa, global const float *dirwts0, global const float *dirwts1,
+                     global const float *hvwt, global const float *pmwt, global const float *rbint,
+                     global float *rgbgreen, global float *Dgrb0, const int W, const int H, const int pw,
+                     const unsigned int filters, const float clip_pt)
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+  if(!AMAZE_INSIDE(12) || (FC(y, x, filters) & 1)) return;
+  AMAZE_OFFSETS
+
+  const int indx = mad24(y, pw, x);
+  const int indx1 = indx >> 1;
+  if(fabs(0.5f - pmwt[indx1]) < fabs(0.5f - hvwt[indx1])) return;
+
+  // the half size neighbours two rows and two columns away are v1 and 1 apart
+  const float gu = amaze_green_from_rbint(cfa, rbint, indx, indx1, -v1, -v1);
+  const float gd = amaze_green_from_rbint(cfa, rbint, indx, indx1, v1, v1);
+  const float gl = amaze_green_from_rbint(cfa, rbint, indx, indx1, -1, -1);
+  const float gr = amaze_green_from_rbint(cfa, rbint, indx, indx1, 1, 1);
+
+  // interpolated G via adaptive weights of cardinal evaluations
+  float Gintv = (dirwts0[indx - v1] * gd + dirwts0[indx + v1] * gu) / (dirwts0[indx + v1] + dirwts0[indx - v1]);
+  float Ginth = (dirwts1[indx - 1] * gr + dirwts1[indx + 1] * gl) / (dirwts1[indx - 1] + dirwts1[indx + 1]);
+
+  // bound the interpolation in regions of high saturation
+  Gintv = amaze_bound_green(cfa, indx, v1, Gintv, rbint[indx1], clip_pt);
+  Ginth = amaze_bound_green(cfa, indx, 1, Ginth, rbint[indx1], clip_pt);
+
+  const float g = Ginth * (1.0f - hvwt[indx1]) + Gintv * hvwt[indx1];
+  rgbgreen[indx] = g;
+  Dgrb0[indx1] = g - cfa[indx];
+}
+
+// split out G-B from G-R: work item (k, y) covers columns 2k and 2k + 1, rows of parity ey hold red
+kernel void
+amaze_chroma_split(global float *Dgrb0, global float *Dgrb1, const int W, const int H, const int pw,
+                   const int ey)
+{
+  const int x = 2 * get_global_id(0);
+  const int y = get_global_id(1);
+  if(x >= W || y >= H) return;
+
+  const int indx1 = mad24(y, pw, x) >> 1;
+  if((y & 1) != ey)
+  {
+    Dgrb1[indx1] = Dgrb0[indx1];
+    Dgrb0[indx1] = 0.0f;
+  }
+  else
+    Dgrb1[indx1] = 0.0f;
+}
+
+// fancy chrominance interpolation: G-B at the red sites, G-R at the blue ones. these only read the other
+// colour's sites, so this runs in place.
+kernel void
+amaze_chroma(global float *Dgrb0, global float *Dgrb1, const int W, const int H, const int pw,
+             const unsigned int filters)
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+  if(!AMAZE_INSIDE(14) || (FC(y, x, filters) & 1)) return;
+  AMAZE_OFFSETS
+
+  const int indx = mad24(y, pw, x);
+  global float *D = (FC(y, x, filters) / 2) ? Dgrb0 : Dgrb1;
+
+#define DG(o) D[(indx + (o)) >> 1]
+  const float wtnw = 1.0f / (AMAZE_EPS + fabs(DG(-m1) - DG(m1)) + fabs(DG(-m1) - DG(-m3)) + fabs(DG(m1) - DG(-m3)));
+  const float wtne = 1.0f / (AMAZE_EPS + fabs(DG(p1) - DG(-p1)) + fabs(DG(p1) - DG(p3)) + fabs(DG(-p1) - DG(p3)));
+  const float wtsw = 1.0f / (AMAZE_EPS + fabs(DG(-p1) - DG(p1)) + fabs(DG(-p1) - DG(m3)) + fabs(DG(p1) - DG(-p3)));
+  const float wtse = 1.0f / (AMAZE_EPS + fabs(DG(m1) - DG(-m1)) + fabs(DG(m1) - DG(-p3)) + fabs(DG(-m1) - DG(m3)));
+
+  D[indx >> 1] = (wtnw * (1.325f * DG(-m1) - 0.175f * DG(-m3) - 0.075f * DG(-m1 - 2) - 0.075f * DG(-m1 - v2))
+                  + wtne * (1.325f * DG(p1) - 0.175f * DG(p3) - 0.075f * DG(p1 + 2) - 0.075f * DG(p1 + v2))
+                  + wtsw * (1.325f * DG(-p1) - 0.175f * DG(-p3) - 0.075f * DG(-p1 - 2) - 0.075f * DG(-p1 - v2))
+                  + wtse * (1.325f * DG(m1) - 0.175f * DG(m3) - 0.075f * DG(m1 + 2) - 0.075f * DG(m1 + v2)))
+                 / (wtnw + wtne + wtsw + wtse);
+#undef DG
+}
+
+// R and B from the colour differences, interpolated at the green sites, and the output without the padding
+kernel void
+amaze_output(global const float *rgbgreen, global const float *hvwt, global const float *Dgrb0,
+             global const float *Dgrb1, write_only image2d_t out, const int width, const int height,
+             const int pw, const unsigned int filters)
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+  if(x >= width || y >= height) return;
+  AMAZE_OFFSETS
+
+  const int indx = mad24(y + 16, pw, x + 16);
+  const float g = rgbgreen[indx];
+  float r, b;
+  if(FC(y, x, filters) & 1)
+  {
+    const float wu = hvwt[(indx - v1) >> 1], wd = hvwt[(indx + v1) >> 1];
+    const float wl = 1.0f - hvwt[(indx - 1) >> 1], wr = 1.0f - hvwt[(indx + 1) >> 1];
+    const float temp = 1.0f / (wu + wr + wl + wd);
+    r = g - (wu * Dgrb0[(indx - v1) >> 1] + wr * Dgrb0[(indx + 1) >> 1] + wl * Dgrb0[(indx - 1) >> 1]
+             + wd * Dgrb0[(indx + v1) >> 1]) * temp;
+    b = g - (wu * Dgrb1[(indx - v1) >> 1] + wr * Dgrb1[(indx + 1) >> 1] + wl * Dgrb1[(indx - 1) >> 1]
+             + wd * Dgrb1[(indx + v1) >> 1]) * temp;
+  }
+  else
+  {
+    r = g - Dgrb0[indx >> 1];
+    b = g - Dgrb1[indx >> 1];
+  }
+  write_imagef(out, (int2)(x, y), (float4)(amaze_clampnan(r), amaze_clampnan(g), amaze_clampnan(b), 0.0f));
+}
+
+#undef AMAZE_INSIDE
+#undef AMAZE_OFFSETS
@@ -0,0 +1,136 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2017 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "common.h"
+
+// the edge-avoiding lifting wavelet of src/iop/equalizer_eaw.h. the cpu version runs the predict and update
+// steps of every row and column in place. here each step is one kernel over all of them, working in place
+// on a buffer: predict only reads the even samples and writes the odd ones, update the other way round.
+// weight holds the luma of level l on its coarse grid of wd x ht points.
+
+float
+equalizer_gweight(global const float *weight, const int wd, const int l, const int i, const int j, const int ii,
+                  const int jj)
+{
+  return 1.0f / (fabs(weight[wd * (j >> (l - 1)) + (i >> (l - 1))] - weight[wd * (jj >> (l - 1)) + (ii >> (l - 1))])
+                 + 1.e-5f);
+}
+
+kernel void
+equalizer_weights(global const float4 *buf, global float *weight, const int width, const int wd, const int ht,
+                  const int l)
+{
+  const int i = get_global_id(0);
+  const int j = get_global_id(1);
+  if(i >= wd || j >= ht) return;
+
+  weight[wd * j + i] = (i < wd - 1 && j < ht - 1) ? buf[(size_t)width * (j << (l - 1)) + (i << (l - 1))].x : 0.0f;
+}
+
+// odd samples p = st + k * step along rows (horizontal) or columns: buf += sign * prediction from the
+// two even neighbours
+kernel void
+equalizer_predict(global float4 *buf, global const float *weight, const int width, const int height,
+                  const int wd, const int l, const int horizontal, const float sign)
+{
+  const int st = 1 << (l - 1);
+  const int step = 1 << l;
+  const int k = get_global_id(0);
+  const int q = get_global_id(1);
+  const int n = horizontal ? width : height;
+  const int p = st + k * step;
+  if(p >= n || q >= (horizontal ? height : width)) return;
+
+  const int dx = horizontal ? 1 : 0, dy = 1 - dx;
+  const int i = horizontal ? p : q, j = horizontal ? q : p;
+  const size_t c = (size_t)width * j + i;
+  const size_t o = (size_t)width * st * dy + st * dx;
+
+  float4 pred;
+  if(p < n - st)
+  {
+    const float w0 = equalizer_gweight(weight, wd, l, i - st * dx, j - st * dy, i, j);
+    const float w1 = equalizer_gweight(weight, wd, l, i, j, i + st * dx, j + st * dy);
+    pred = (w0 * buf[c - o] + w1 * buf[c + o]) / (w0 + w1);
+  }
+  else
+    pred = buf[c - o];
+
+  float4 v = buf[c];
+  v.xyz += sign * pred.xyz;
+  buf[c] = v;
+}
+
+// even samples p = k * step: buf += sign * update from the two odd neighbours
+kernel void
+equalizer_update(global float4 *buf, global const float *weight, const int width, const int height,
+                 const int wd, const int l, const int horizontal, const float sign)
+{
+  const int st = 1 << (l - 1);
+  const int step = 1 << l;
+  const int k = get_global_id(0);
+  const int q = get_global_id(1);
+  const int n = horizontal ? width : height;
+  const int p = k * step;
+  if(p >= n || q >= (horizontal ? height : width)) return;
+
+  const int dx = horizontal ? 1 : 0, dy = 1 - dx;
+  const int i = horizontal ? p : q, j = horizontal ? q : p;
+  const size_t c = (size_t)width * j + i;
+  const size_t o = (size_t)width * st * dy + st * dx;
+
+  float4 upd;
+  if(p == 0)
+    upd = 0.5f * buf[c + o];
+  else if(p < n - st)
+  {
+    const float w0 = equalizer_gweight(weight, wd, l, i - st * dx, j - st * dy, i, j);
+    const float w1 = equalizer_gweight(weight, wd, l, i, j, i + st * dx, j + st * dy);
+    upd = (w0 * buf[c - o] + w1 * buf[c + o]) / (2.0f * (w0 + w1));
+  }
+  else
+    upd = 0.5f * buf[c - o];
+
+  float4 v = buf[c];
+  v.xyz += sign * upd.xyz;
+  buf[c] = v;
+}
+
+// scales the detail coefficients of level l by coeff (L, a, b), the diagonal ones by its square
+kernel void
+equalizer_scale(global float4 *buf, const int width, const int height, const int l, const float4 coeff)
+{
+  const int i = get_global_id(0);
+  const int j = get_global_id(1);
+  if(i >= width || j >= height) return;
+
+  const int st = 1 << (l - 1);
+  const int step = 1 << l;
+  const int mi = i % step, mj = j % step;
+  float4 f;
+  if(mi == st && mj == st)
+    f = coeff * coeff;
+  else if((mi == st && mj == 0) || (mi == 0 && mj == st))
+    f = coeff;
+  else
+    return;
+
+  float4 v = buf[(size_t)width * j + i];
+  v.xyz *= f.xyz;
+  buf[(size_t)width * j + i] = v;
+}
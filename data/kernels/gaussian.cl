@@ -348,3 +348,69 @@ shadows_highlights_mix(read_only image2d_t in, read_only image2d_t mask, write_o
 }
 
 
+/* the box means of the guided filter of shadows and highlights, as running sums along a row or column per work
+   item. the boxes shrink at the borders, as on the cpu. */
+
+static inline float2
+guided_value(read_only image2d_t in, const int x, const int y, const int from_Lab)
+{
+  const float4 pixel = read_imagef(in, sampleri, (int2)(x, y));
+  if(!from_Lab) return pixel.xy;
+  const float L = pixel.x / 100.0f;
+  return (float2)(L, L * L);
+}
+
+/* horizontal box mean of the first two channels of in, or of L and L^2 of a Lab image */
+kernel void
+shadows_highlights_guided_rows(read_only image2d_t in, write_only image2d_t out, const int width,
+                               const int height, const int r, const int from_Lab)
+{
+  const int y = get_global_id(0);
+
+  if(y >= height) return;
+
+  float2 sum = (float2)0.0f;
+  for(int x = 0; x < min(r, width); x++) sum += guided_value(in, x, y, from_Lab);
+
+  for(int x = 0; x < width; x++)
+  {
+    if(x + r < width) sum += guided_value(in, x + r, y, from_Lab);
+    if(x > r) sum -= guided_value(in, x - r - 1, y, from_Lab);
+    const float norm = 1.0f / (min(x + r, width - 1) - max(x - r, 0) + 1);
+    write_imagef(out, (int2)(x, y), (float4)(sum * norm, 0.0f, 0.0f));
+  }
+}
+
+/* vertical box mean of the first two channels of in. those are the means of L and L^2, which are turned into the
+   coefficients of the box, or the means of the coefficients, which are applied to L of the Lab image guide. */
+kernel void
+shadows_highlights_guided_cols(read_only image2d_t in, read_only image2d_t guide, write_only image2d_t out,
+                               const int width, const int height, const int r, const float eps,
+                               const int apply)
+{
+  const int x = get_global_id(0);
+
+  if(x >= width) return;
+
+  float2 sum = (float2)0.0f;
+  for(int y = 0; y < min(r, height); y++) sum += read_imagef(in, sampleri, (int2)(x, y)).xy;
+
+  for(int y = 0; y < height; y++)
+  {
+    if(y + r < height) sum += read_imagef(in, sampleri, (int2)(x, y + r)).xy;
+    if(y > r) sum -= read_imagef(in, sampleri, (int2)(x, y - r - 1)).xy;
+    const float2 mean = sum / (float)(min(y + r, height - 1) - max(y - r, 0) + 1);
+
+    if(apply)
+    {
+      const float4 pixel = read_imagef(guide, sampleri, (int2)(x, y));
+      write_imagef(out, (int2)(x, y), (float4)(100.0f * (mean.x * pixel.x / 100.0f + mean.y), pixel.yzw));
+    }
+    else
+    {
+      const float var = fmax(mean.y - mean.x * mean.x, 0.0f);
+      const float a = var / (var + eps);
+      write_imagef(out, (int2)(x, y), (float4)(a, mean.x - a * mean.x, 0.0f, 0.0f));
+    }
+  }
+}
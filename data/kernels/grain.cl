@@ -0,0 +1,192 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2017 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "common.h"
+
+// film grain of src/iop/grain.c: three octaves of 3d simplex noise, put on the lightness through the paper
+// response lut. the noise coordinates get large, so the host reduces the offset of the roi modulo the period
+// of the noise and only the part relative to it is computed in single precision here.
+
+#define GRAIN_LUT_SIZE 128
+
+constant int grain_grad3[12][3] = { { 1, 1, 0 }, { -1, 1, 0 }, { 1, -1, 0 }, { -1, -1, 0 },
+                                    { 1, 0, 1 }, { -1, 0, 1 }, { 1, 0, -1 }, { -1, 0, -1 },
+                                    { 0, 1, 1 }, { 0, -1, 1 }, { 0, 1, -1 }, { 0, -1, -1 } };
+
+constant int grain_perm[256]
+    = { 151, 160, 137, 91, 90, 15, 131, 13, 201, 95, 96, 53, 194, 233, 7, 225, 140, 36, 103, 30, 69, 142, 8, 99, 37,
+        240, 21, 10, 23, 190, 6, 148, 247, 120, 234, 75, 0, 26, 197, 62, 94, 252, 219, 203, 117, 35, 11, 32, 57,
+        177, 33, 88, 237, 149, 56, 87, 174, 20, 125, 136, 171, 168, 68, 175, 74, 165, 71, 134, 139, 48, 27, 166, 77,
+        146, 158, 231, 83, 111, 229, 122, 60, 211, 133, 230, 220, 105, 92, 41, 55, 46, 245, 40, 244, 102, 143, 54,
+        65, 25, 63, 161, 1, 216, 80, 73, 209, 76, 132, 187, 208, 89, 18, 169, 200, 196, 135, 130, 116, 188, 159, 86,
+        164, 100, 109, 198, 173, 186, 3, 64, 52, 217, 226, 250, 124, 123, 5, 202, 38, 147, 118, 126, 255, 82, 85,
+        212, 207, 206, 59, 227, 47, 16, 58, 17, 182, 189, 28, 42, 223, 183, 170, 213, 119, 248, 152, 2, 44, 154,
+        163, 70, 221, 153, 101, 155, 167, 43, 172, 9, 129, 22, 39, 253, 19, 98, 108, 110, 79, 113, 224, 232, 178,
+        185, 112, 104, 218, 246, 97, 228, 251, 34, 242, 193, 238, 210, 144, 12, 191, 179, 162, 241, 81, 51, 145,
+        235, 249, 14, 239, 107, 49, 192, 214, 31, 181, 199, 106, 157, 184, 84, 204, 176, 115, 121, 50, 45, 127, 4,
+        150, 254, 138, 236, 205, 93, 222, 114, 67, 29, 24, 72, 243, 141, 128, 195, 78, 66, 215, 61, 156, 180 };
+
+// perm[] of the cpu version is two copies of the permutation
+int
+grain_hash(const int i)
+{
+  return grain_perm[i & 255];
+}
+
+float
+grain_corner(const int gi, const float x, const float y, const float z)
+{
+  float t = 0.6f - x * x - y * y - z * z;
+  if(t < 0.0f) return 0.0f;
+  t *= t;
+  return t * t * (grain_grad3[gi][0] * x + grain_grad3[gi][1] * y + grain_grad3[gi][2] * z);
+}
+
+#define FASTFLOOR(x) (x > 0 ? (int)(x) : (int)(x)-1)
+
+float
+grain_simplex_noise(const float xin, const float yin, const float zin)
+{
+  // skew the input space to determine which simplex cell we're in
+  const float F3 = 1.0f / 3.0f;
+  const float s = (xin + yin + zin) * F3;
+  const int i = FASTFLOOR(xin + s);
+  const int j = FASTFLOOR(yin + s);
+  const int k = FASTFLOOR(zin + s);
+  const float G3 = 1.0f / 6.0f;
+  const float t = (i + j + k) * G3;
+  // the x,y,z distances from the cell origin
+  const float x0 = xin - (i - t);
+  const float y0 = yin - (j - t);
+  const float z0 = zin - (k - t);
+
+  // offsets of the second and third corner of the tetrahedron in (i,j,k) coords
+  int i1, j1, k1, i2, j2, k2;
+  if(x0 >= y0)
+  {
+    if(y0 >= z0)
+    {
+      i1 = 1; j1 = 0; k1 = 0; i2 = 1; j2 = 1; k2 = 0; // X Y Z order
+    }
+    else if(x0 >= z0)
+    {
+      i1 = 1; j1 = 0; k1 = 0; i2 = 1; j2 = 0; k2 = 1; // X Z Y order
+    }
+    else
+    {
+      i1 = 0; j1 = 0; k1 = 1; i2 = 1; j2 = 0; k2 = 1; // Z X Y order
+    }
+  }
+  else
+  {
+    if(y0 < z0)
+    {
+      i1 = 0; j1 = 0; k1 = 1; i2 = 0; j2 = 1; k2 = 1; // Z Y X order
+    }
+    else if(x0 < z0)
+    {
+      i1 = 0; j1 = 1; k1 = 0; i2 = 0; j2 = 1; k2 = 1; // Y Z X order
+    }
+    else
+    {
+      i1 = 0; j1 = 1; k1 = 0; i2 = 1; j2 = 1; k2 = 0; // Y X Z order
+    }
+  }
+
+  const int ii = i & 255;
+  const int jj = j & 255;
+  const int kk = k & 255;
+  const int gi0 = grain_hash(ii + grain_hash(jj + grain_hash(kk))) % 12;
+  const int gi1 = grain_hash(ii + i1 + grain_hash(jj + j1 + grain_hash(kk + k1))) % 12;
+  const int gi2 = grain_hash(ii + i2 + grain_hash(jj + j2 + grain_hash(kk + k2))) % 12;
+  const int gi3 = grain_hash(ii + 1 + grain_hash(jj + 1 + grain_hash(kk + 1))) % 12;
+
+  const float n0 = grain_corner(gi0, x0, y0, z0);
+  const float n1 = grain_corner(gi1, x0 - i1 + G3, y0 - j1 + G3, z0 - k1 + G3);
+  const float n2 = grain_corner(gi2, x0 - i2 + 2.0f * G3, y0 - j2 + 2.0f * G3, z0 - k2 + 2.0f * G3);
+  const float n3 = grain_corner(gi3, x0 - 1.0f + 3.0f * G3, y0 - 1.0f + 3.0f * G3, z0 - 1.0f + 3.0f * G3);
+  return 32.0f * (n0 + n1 + n2 + n3);
+}
+
+#undef FASTFLOOR
+
+// the three octaves at (x, y) relative to the roi offset, octave o at (ox[o] + x * mul[o], oy[o] + y * mul[o])
+float
+grain_simplex_2d_noise(const float x, const float y, const float4 ox, const float4 oy, const float4 mul)
+{
+  return grain_simplex_noise(ox.x + x * mul.x, oy.x + y * mul.x, 0.0f) * 0.2340f
+         + grain_simplex_noise(ox.y + x * mul.y, oy.y + y * mul.y, 1.0f) * 0.7850f
+         + grain_simplex_noise(ox.z + x * mul.z, oy.z + y * mul.z, 2.0f) * 1.2150f;
+}
+
+float
+grain_lut_lookup(global const float *grain_lut, const float x, const float y)
+{
+  const float _x = clamp((x + 0.5f) * (GRAIN_LUT_SIZE - 1), 0.0f, (float)(GRAIN_LUT_SIZE - 1));
+  const float _y = clamp(y * (GRAIN_LUT_SIZE - 1), 0.0f, (float)(GRAIN_LUT_SIZE - 1));
+
+  const int _x0 = _x < GRAIN_LUT_SIZE - 2 ? _x : GRAIN_LUT_SIZE - 2;
+  const int _y0 = _y < GRAIN_LUT_SIZE - 2 ? _y : GRAIN_LUT_SIZE - 2;
+
+  const float x_diff = _x - _x0;
+  const float y_diff = _y - _y0;
+
+  const float l00 = grain_lut[_y0 * GRAIN_LUT_SIZE + _x0];
+  const float l01 = grain_lut[_y0 * GRAIN_LUT_SIZE + _x0 + 1];
+  const float l10 = grain_lut[(_y0 + 1) * GRAIN_LUT_SIZE + _x0];
+  const float l11 = grain_lut[(_y0 + 1) * GRAIN_LUT_SIZE + _x0 + 1];
+
+  const float xy0 = (1.0f - y_diff) * l00 + l10 * y_diff;
+  const float xy1 = (1.0f - y_diff) * l01 + l11 * y_diff;
+  return xy0 * (1.0f - x_diff) + xy1 * x_diff;
+}
+
+// x and y of the noise advance by step per pixel. when zoomed out a lot, filtermul > 0 averages the noise
+// over a rank-1 lattice of 21 points.
+kernel void
+grain(read_only image2d_t in, write_only image2d_t out, const int width, const int height, const float4 ox,
+      const float4 oy, const float4 mul, const float step, const float filtermul, const float strength,
+      global const float *grain_lut)
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+  if(x >= width || y >= height) return;
+
+  float4 pixel = read_imagef(in, sampleri, (int2)(x, y));
+  const float nx = x * step, ny = y * step;
+
+  float noise = 0.0f;
+  if(filtermul > 0.0f)
+  {
+    const float fib1 = 34.0f, fib2 = 21.0f;
+    for(int l = 0; l < fib2; l++)
+    {
+      const float px = l / fib2;
+      float py = l * (fib1 / fib2);
+      py -= (int)py;
+      noise += (1.0f / fib2) * grain_simplex_2d_noise(nx + px * filtermul, ny + py * filtermul, ox, oy, mul);
+    }
+  }
+  else
+    noise = grain_simplex_2d_noise(nx, ny, ox, oy, mul);
+
+  pixel.x += grain_lut_lookup(grain_lut, noise * strength, pixel.x / 100.0f);
+  write_imagef(out, (int2)(x, y), pixel);
+}
+
+#undef GRAIN_LUT_SIZE
@@ -0,0 +1,203 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2017 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "common.h"
+
+// haze removal of src/iop/hazeremoval.c: dark channel prior with a guided filter to refine the transition
+// map. all box filters shrink at the image borders, as on the cpu.
+
+// minimal colour component
+kernel void
+hazeremoval_dark_channel(read_only image2d_t in, write_only image2d_t out, const int width, const int height)
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+  if(x >= width || y >= height) return;
+
+  const float4 pixel = read_imagef(in, sampleri, (int2)(x, y));
+  write_imagef(out, (int2)(x, y), (float4)(fmin(pixel.x, fmin(pixel.y, pixel.z)), 0.0f, 0.0f, 0.0f));
+}
+
+// 1 - strength * min_c(pixel / A0)
+kernel void
+hazeremoval_transition_map(read_only image2d_t in, write_only image2d_t out, const int width, const int height,
+                           const float strength, const float4 A0)
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+  if(x >= width || y >= height) return;
+
+  const float4 pixel = read_imagef(in, sampleri, (int2)(x, y)) / A0;
+  const float m = fmin(pixel.x, fmin(pixel.y, pixel.z));
+  write_imagef(out, (int2)(x, y), (float4)(1.0f - m * strength, 0.0f, 0.0f, 0.0f));
+}
+
+// moving minimum or maximum of one channel over 2 * w + 1 pixels along (dx, dy)
+kernel void
+hazeremoval_box_min_max(read_only image2d_t in, write_only image2d_t out, const int width, const int height,
+                        const int w, const int dx, const int dy, const int maximum)
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+  if(x >= width || y >= height) return;
+
+  const int n = dx ? width : height;
+  const int i = dx ? x : y;
+  const int lo = max(i - w, 0) - i, hi = min(i + w, n - 1) - i;
+  float m = read_imagef(in, sampleri, (int2)(x, y)).x;
+  for(int k = lo; k <= hi; k++)
+  {
+    const float v = read_imagef(in, sampleri, (int2)(x + k * dx, y + k * dy)).x;
+    m = maximum ? fmax(m, v) : fmin(m, v);
+  }
+  write_imagef(out, (int2)(x, y), (float4)(m, 0.0f, 0.0f, 0.0f));
+}
+
+// moving average of four channels over 2 * w + 1 pixels along (dx, dy)
+kernel void
+hazeremoval_box_mean(read_only image2d_t in, write_only image2d_t out, const int width, const int height,
+                     const int w, const int dx, const int dy)
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+  if(x >= width || y >= height) return;
+
+  const int n = dx ? width : height;
+  const int i = dx ? x : y;
+  const int lo = max(i - w, 0) - i, hi = min(i + w, n - 1) - i;
+  float4 sum = (float4)0.0f;
+  for(int k = lo; k <= hi; k++) sum += read_imagef(in, sampleri, (int2)(x + k * dx, y + k * dy));
+  write_imagef(out, (int2)(x, y), sum / (float)(hi - lo + 1));
+}
+
+// the products of guide and filtered image the guided filter needs the means of
+kernel void
+hazeremoval_guided_products(read_only image2d_t in, read_only image2d_t trans, write_only image2d_t mean_ip,
+                            write_only image2d_t cov_ip, write_only image2d_t var_rgb,
+                            write_only image2d_t var_gb, const int width, const int height)
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+  if(x >= width || y >= height) return;
+
+  const float4 pixel = read_imagef(in, sampleri, (int2)(x, y));
+  const float p = read_imagef(trans, sampleri, (int2)(x, y)).x;
+  write_imagef(mean_ip, (int2)(x, y), (float4)(pixel.x, pixel.y, pixel.z, p));
+  write_imagef(cov_ip, (int2)(x, y), (float4)(pixel.x * p, pixel.y * p, pixel.z * p, 0.0f));
+  write_imagef(var_rgb, (int2)(x, y), (float4)(pixel.x * pixel.x, pixel.x * pixel.y, pixel.x * pixel.z, 0.0f));
+  write_imagef(var_gb, (int2)(x, y), (float4)(pixel.y * pixel.y, pixel.y * pixel.z, pixel.z * pixel.z, 0.0f));
+}
+
+// linear coefficients (a_r, a_g, a_b, b) of the guided filter, from the box means of the products
+kernel void
+hazeremoval_guided_coeffs(read_only image2d_t mean_ip, read_only image2d_t cov_ip, read_only image2d_t var_rgb,
+                          read_only image2d_t var_gb, write_only image2d_t coeffs, const int width,
+                          const int height, const float eps)
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+  if(x >= width || y >= height) return;
+
+  const float4 m = read_imagef(mean_ip, sampleri, (int2)(x, y));
+  const float4 c = read_imagef(cov_ip, sampleri, (int2)(x, y));
+  const float4 v1 = read_imagef(var_rgb, sampleri, (int2)(x, y));
+  const float4 v2 = read_imagef(var_gb, sampleri, (int2)(x, y));
+
+  const float cov[3] = { c.x - m.x * m.w, c.y - m.y * m.w, c.z - m.z * m.w };
+  const float s00 = v1.x - m.x * m.x + eps, s01 = v1.y - m.x * m.y, s02 = v1.z - m.x * m.z;
+  const float s11 = v2.x - m.y * m.y + eps, s12 = v2.y - m.y * m.z, s22 = v2.z - m.z * m.z + eps;
+
+  // solve linear system of equations of size 3x3 via Cramer's rule
+  float4 coeff = (float4)0.0f;
+  const float det0 = s00 * (s11 * s22 - s12 * s12) - s01 * (s01 * s22 - s02 * s12) + s02 * (s01 * s12 - s02 * s11);
+  if(fabs(det0) > 4.0f * FLT_EPSILON)
+  {
+    const float det1 = cov[0] * (s11 * s22 - s12 * s12) - s01 * (cov[1] * s22 - cov[2] * s12)
+                       + s02 * (cov[1] * s12 - cov[2] * s11);
+    const float det2 = s00 * (cov[1] * s22 - cov[2] * s12) - cov[0] * (s01 * s22 - s02 * s12)
+                       + s02 * (s01 * cov[2] - s02 * cov[1]);
+    const float det3 = s00 * (s11 * cov[2] - s12 * cov[1]) - s01 * (s01 * cov[2] - s02 * cov[1])
+                       + cov[0] * (s01 * s12 - s02 * s11);
+    coeff.x = det1 / det0;
+    coeff.y = det2 / det0;
+    coeff.z = det3 / det0;
+  }
+  coeff.w = m.w - coeff.x * m.x - coeff.y * m.y - coeff.z * m.z;
+  write_imagef(coeffs, (int2)(x, y), coeff);
+}
+
+// the filtered transition map decides how much of the ambient light to take out
+kernel void
+hazeremoval_apply(read_only image2d_t in, read_only image2d_t coeffs, write_only image2d_t out, const int width,
+                  const int height, const float t_min, const float4 A0)
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+  if(x >= width || y >= height) return;
+
+  const float4 pixel = read_imagef(in, sampleri, (int2)(x, y));
+  const float4 c = read_imagef(coeffs, sampleri, (int2)(x, y));
+  const float t = fmax(c.x * pixel.x + c.y * pixel.y + c.z * pixel.z + c.w, t_min);
+  float4 o = (pixel - A0) / t + A0;
+  o.w = pixel.w;
+  write_imagef(out, (int2)(x, y), o);
+}
+
+// histogram of one channel over [lo, hi) with the outside values in the first and last bin, or, with a
+// guide given, of the brightness of the pixels whose guide value is at least lo_guide
+kernel void
+hazeremoval_histogram(read_only image2d_t in, read_only image2d_t guide, global int *hist, const int width,
+                      const int height, const float lo, const float hi, const int bins, const int brightness,
+                      const float lo_guide)
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+  if(x >= width || y >= height) return;
+
+  float v;
+  if(brightness)
+  {
+    if(read_imagef(guide, sampleri, (int2)(x, y)).x < lo_guide) return;
+    const float4 pixel = read_imagef(in, sampleri, (int2)(x, y));
+    v = pixel.x + pixel.y + pixel.z;
+  }
+  else
+    v = read_imagef(in, sampleri, (int2)(x, y)).x;
+  const int bin = clamp((int)((v - lo) / (hi - lo) * bins), 0, bins - 1);
+  atomic_inc(hist + bin);
+}
+
+// per row sum of the colour and the count of the brightest of the most hazy pixels
+kernel void
+hazeremoval_ambient_light(read_only image2d_t in, read_only image2d_t dark, global float4 *rows,
+                          const int width, const int height, const float crit_haze_level,
+                          const float crit_brightness)
+{
+  const int y = get_global_id(0);
+  if(y >= height) return;
+
+  float4 sum = (float4)0.0f;
+  for(int x = 0; x < width; x++)
+  {
+    const float4 pixel = read_imagef(in, sampleri, (int2)(x, y));
+    if(read_imagef(dark, sampleri, (int2)(x, y)).x >= crit_haze_level
+       && pixel.x + pixel.y + pixel.z >= crit_brightness)
+      sum += (float4)(pixel.x, pixel.y, pixel.z, 1.0f);
+  }
+  rows[y] = sum;
+}
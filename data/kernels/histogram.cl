@@ -0,0 +1,69 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2017 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "common.h"
+
+// the histograms of dt_histogram_helper() in src/common/histogram.c, with the bins of the channels
+// interleaved by four as there. every work group counts its pixels in local memory first and then adds its
+// counts to the global bins.
+
+// colour spaces, as dt_iop_colorspace_type_t
+#define HISTOGRAM_RAW 0
+#define HISTOGRAM_LAB 1
+#define HISTOGRAM_RGB 2
+
+// width and height are the number of samples, every step-th pixel from (crop_x, crop_y)
+kernel void
+histogram_collect(read_only image2d_t in, global uint *hist, const int width, const int height,
+                  const int crop_x, const int crop_y, const int step, const int bins, const float mul,
+                  const int cst, local uint *buffer)
+{
+  const int lid = get_local_id(1) * get_local_size(0) + get_local_id(0);
+  const int lsize = get_local_size(0) * get_local_size(1);
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+
+  for(int k = lid; k < 4 * bins; k += lsize) buffer[k] = 0;
+  barrier(CLK_LOCAL_MEM_FENCE);
+
+  if(x < width && y < height)
+  {
+    const float4 pixel = read_imagef(in, sampleri, (int2)(crop_x + x * step, crop_y + y * step));
+    const float max = bins - 1;
+    if(cst == HISTOGRAM_RAW)
+      atomic_inc(buffer + 4 * (int)clamp(mul * pixel.x, 0.0f, max));
+    else
+    {
+      const float4 scale = cst == HISTOGRAM_LAB ? (float4)(mul / 100.0f, mul / 256.0f, mul / 256.0f, 0.0f)
+                                                : (float4)(mul, mul, mul, 0.0f);
+      const float4 shift = cst == HISTOGRAM_LAB ? (float4)(0.0f, 128.0f, 128.0f, 0.0f) : (float4)0.0f;
+      const int4 bin = convert_int4(clamp(scale * (pixel + shift), 0.0f, max));
+      atomic_inc(buffer + 4 * bin.x);
+      atomic_inc(buffer + 4 * bin.y + 1);
+      atomic_inc(buffer + 4 * bin.z + 2);
+    }
+  }
+  barrier(CLK_LOCAL_MEM_FENCE);
+
+  for(int k = lid; k < 4 * bins; k += lsize)
+    if(buffer[k]) atomic_add(hist + k, buffer[k]);
+}
+
+#undef HISTOGRAM_RAW
+#undef HISTOGRAM_LAB
+#undef HISTOGRAM_RGB
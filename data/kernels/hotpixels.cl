@@ -0,0 +1,108 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2017 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "common.h"
+
+// hot pixels of src/iop/hotpixels.c. offsets[8 * (6 * (y % 6) + x % 6)] holds the x/y offsets of the four
+// nearest pixels of the same colour, colors[6 * (y % 6) + x % 6] the cfa colour, both for bayer and x-trans.
+
+float
+hotpixels_read(read_only image2d_t in, const int x, const int y)
+{
+  return read_imagef(in, sampleri, (int2)(x, y)).x;
+}
+
+// whether (x, y) is a hot pixel, and the maximum of its darker neighbours it gets replaced by
+int
+hotpixels_detect(read_only image2d_t in, const int x, const int y, const int width, const int height,
+                 const float threshold, const float multiplier, const int min_neighbours,
+                 global const int *offsets, float *maxin)
+{
+  if(x < 2 || y < 2 || x >= width - 2 || y >= height - 2) return 0;
+
+  const float v = hotpixels_read(in, x, y);
+  if(!(v > threshold)) return 0;
+
+  const float mid = v * multiplier;
+  global const int *o = offsets + 8 * (6 * (y % 6) + x % 6);
+  int count = 0;
+  float m = 0.0f;
+  for(int n = 0; n < 4; n++)
+  {
+    const float other = hotpixels_read(in, x + o[2 * n], y + o[2 * n + 1]);
+    if(mid > other)
+    {
+      count++;
+      m = fmax(m, other);
+    }
+  }
+  *maxin = m;
+  return count >= min_neighbours;
+}
+
+// every pixel gathers what the cpu scatters along the row: its own fix, and with markfixed the value of the
+// hot pixels of the same colour up to 10 pixels away. the last of these in row order wins, as on the cpu.
+kernel void
+hotpixels(read_only image2d_t in, write_only image2d_t out, const int width, const int height,
+          const float threshold, const float multiplier, const int min_neighbours, const int markfixed,
+          global const int *offsets, global const unsigned char *colors, global int *fixed)
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+  if(x >= width || y >= height) return;
+
+  float v = hotpixels_read(in, x, y);
+  const int c = colors[6 * (y % 6) + x % 6];
+  float maxin;
+  int done = 0;
+
+  if(markfixed)
+  {
+    for(int i = 10; i >= 2 && !done; i--)
+    {
+      if(x + i >= width || colors[6 * (y % 6) + (x + i) % 6] != c) continue;
+      if(hotpixels_detect(in, x + i, y, width, height, threshold, multiplier, min_neighbours, offsets, &maxin))
+      {
+        v = hotpixels_read(in, x + i, y);
+        done = 1;
+      }
+    }
+  }
+
+  if(hotpixels_detect(in, x, y, width, height, threshold, multiplier, min_neighbours, offsets, &maxin))
+  {
+    atomic_inc(fixed);
+    if(!done) v = maxin;
+    done = 1;
+  }
+
+  if(markfixed)
+  {
+    for(int i = 2; i <= 10 && !done; i++)
+    {
+      if(x - i < 0 || colors[6 * (y % 6) + (x - i) % 6] != c) continue;
+      if(hotpixels_detect(in, x - i, y, width, height, threshold, multiplier, min_neighbours, offsets, &maxin))
+      {
+        v = hotpixels_read(in, x - i, y);
+        done = 1;
+      }
+    }
+  }
+
+  write_imagef(out, (int2)(x, y), (float4)(v, 0.0f, 0.0f, 0.0f));
+}
@@ -0,0 +1,131 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2017 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "common.h"
+
+// wavelet denoise of src/iop/rawdenoise.c, one cfa color at a time. the planes are buffers of
+// width * height floats: a quarter of the raw for bayer, all of it with x-trans.
+
+// square root of the pixels of color c. for bayer, (xoff, yoff) is the position of c in the 2x2 cell. the
+// detail accumulator gets cleared along the way.
+kernel void
+rawdenoise_split_bayer(read_only image2d_t in, global float *plane, global float *detail, const int width,
+                       const int height, const int xoff, const int yoff)
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+  if(x >= width || y >= height) return;
+
+  const float v = read_imagef(in, sampleri, (int2)(2 * x + xoff, 2 * y + yoff)).x;
+  plane[mad24(y, width, x)] = sqrt(fmax(0.0f, v));
+  detail[mad24(y, width, x)] = 0.0f;
+}
+
+// the cpu interpolates the other sites by writing every pixel of color c into its neighbours: the right and
+// lower one for green, all eight for red and blue. here each pixel takes the last of these writes instead.
+kernel void
+rawdenoise_split_xtrans(read_only image2d_t in, global float *plane, global float *detail, const int width,
+                        const int height, const int c, const int rx, const int ry,
+                        global const unsigned char (*const xtrans)[6])
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+  if(x >= width || y >= height) return;
+
+  // the sites the cpu writes from
+  const int lo = (c != 1), hi_x = width - 2, hi_y = height - 2;
+  float v = 0.0f;
+  int found = 0;
+  for(int j = 1; j >= -1 && !found; j--)
+    for(int i = 1; i >= -1 && !found; i--)
+    {
+      const int xx = x + i, yy = y + j;
+      if(xx < lo || yy < lo || xx > hi_x || yy > hi_y) continue;
+      // green only reaches its right and lower neighbour
+      if(c == 1 && (i > 0 || j > 0 || (i < 0 && j < 0))) continue;
+      if(FCxtrans(yy + ry, xx + rx, xtrans) != c) continue;
+      v = sqrt(fmax(0.0f, read_imagef(in, sampleri, (int2)(xx, yy)).x));
+      found = 1;
+    }
+  plane[mad24(y, width, x)] = v;
+  detail[mad24(y, width, x)] = 0.0f;
+}
+
+// mirrors at the border without repeating the border pixel, like hat_transform() on the cpu
+int
+rawdenoise_mirror(int i, const int n)
+{
+  i = i < 0 ? -i : i;
+  return i >= n ? 2 * n - 2 - i : i;
+}
+
+// one separable step of the a trous hat filter at the given scale, along (dx, dy)
+kernel void
+rawdenoise_hat(global const float *in, global float *out, const int width, const int height, const int scale,
+               const int dx, const int dy)
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+  if(x >= width || y >= height) return;
+
+  const float m = in[mad24(y, width, x)];
+  const int xm = rawdenoise_mirror(x - scale * dx, width), xp = rawdenoise_mirror(x + scale * dx, width);
+  const int ym = rawdenoise_mirror(y - scale * dy, height), yp = rawdenoise_mirror(y + scale * dy, height);
+  out[mad24(y, width, x)] = (2.0f * m + in[mad24(ym, width, xm)] + in[mad24(yp, width, xp)]) * 0.25f;
+}
+
+// adds the soft thresholded detail between two scales to the accumulator
+kernel void
+rawdenoise_detail(global float *detail, global const float *fine, global const float *coarse, const int width,
+                  const int height, const float thold)
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+  if(x >= width || y >= height) return;
+
+  const int k = mad24(y, width, x);
+  const float diff = fine[k] - coarse[k];
+  detail[k] += copysign(fmax(fabs(diff) - thold, 0.0f), diff);
+}
+
+// squares the denoised value back into the pixels of the color
+kernel void
+rawdenoise_merge_bayer(global const float *detail, global const float *coarse, write_only image2d_t out,
+                       const int width, const int height, const int xoff, const int yoff)
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+  if(x >= width || y >= height) return;
+
+  const float d = detail[mad24(y, width, x)] + coarse[mad24(y, width, x)];
+  write_imagef(out, (int2)(2 * x + xoff, 2 * y + yoff), (float4)(d * d, 0.0f, 0.0f, 0.0f));
+}
+
+kernel void
+rawdenoise_merge_xtrans(global const float *detail, global const float *coarse, write_only image2d_t out,
+                        const int width, const int height, const int c, const int rx, const int ry,
+                        global const unsigned char (*const xtrans)[6])
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+  if(x >= width || y >= height) return;
+  if(FCxtrans(y + ry, x + rx, xtrans) != c) return;
+
+  const float d = detail[mad24(y, width, x)] + coarse[mad24(y, width, x)];
+  write_imagef(out, (int2)(x, y), (float4)(d * d, 0.0f, 0.0f, 0.0f));
+}
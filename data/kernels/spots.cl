@@ -0,0 +1,59 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2017 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "common.h"
+
+// the smooth circle of clone_algo 1, at index k of the 2 * rad + 1 taps
+float
+spots_filter(const int k, const int rad)
+{
+  const float kk = 1.0f - fabs((k - rad) / (float)rad);
+  return kk * kk * (3.0f - 2.0f * kk);
+}
+
+// all spots of src/iop/spots.c in one pass. every pixel runs through the stamps in the order of the group,
+// which blends it just like the cpu stamping them one after the other. stamps[12 * k] holds circle,
+// x0, y0, x1, y1, dx, dy, ox, oy, the radius or the mask width and the mask offset, in image coordinates.
+kernel void
+spots(read_only image2d_t in, write_only image2d_t out, const int width, const int height, const int out_x,
+      const int out_y, const int in_x, const int in_y, const int in_width, const int in_height,
+      const float scale, global const int *stamps, const int count, global const float *masks)
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+  if(x >= width || y >= height) return;
+
+  const int xx = x + out_x, yy = y + out_y;
+  float4 pixel = read_imagef(in, sampleri, (int2)(xx - in_x, yy - in_y));
+
+  for(int k = 0; k < count; k++)
+  {
+    global const int *st = stamps + 12 * k;
+    if(xx < st[1] || yy < st[2] || xx >= st[3] || yy >= st[4]) continue;
+
+    // the source point has to be inside roi_in
+    const int sx = xx - st[5], sy = yy - st[6];
+    if(sx < in_x || sy < in_y || sx >= in_x + in_width || sy >= in_y + in_height) continue;
+
+    const float f = st[0] ? spots_filter(xx - st[7] + 1, st[9]) * spots_filter(yy - st[8] + 1, st[9])
+                          : masks[st[10] + (int)((yy - st[8]) / scale) * st[9] + (int)((xx - st[7]) / scale)];
+    pixel = pixel * (1.0f - f) + read_imagef(in, sampleri, (int2)(sx - in_x, sy - in_y)) * f;
+  }
+
+  write_imagef(out, (int2)(x, y), pixel);
+}
@@ -0,0 +1,66 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2017 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "common.h"
+
+// durand's tone mapping of src/iop/tonemap.cc. the cpu version filters the log luminance with the
+// permutohedral lattice, here the bilateral grid of common/bilateralcl.c does it. the grid expects values
+// in [0, 100], so the log luminance is shifted by -log(1e-6) and scaled by TONEMAP_SCALE.
+
+#define TONEMAP_LOG_MIN -13.815511f
+#define TONEMAP_SCALE 5.0f
+
+float
+tonemap_log_luminance(const float4 pixel)
+{
+  const float L = 0.2126f * pixel.x + 0.7152f * pixel.y + 0.0722f * pixel.z;
+  return log(L <= 0.0f ? 1e-6f : L);
+}
+
+// the scaled log luminance the grid is splatted with
+kernel void
+tonemap_log(read_only image2d_t in, write_only image2d_t out, const int width, const int height)
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+  if(x >= width || y >= height) return;
+
+  const float L = tonemap_log_luminance(read_imagef(in, sampleri, (int2)(x, y)));
+  write_imagef(out, (int2)(x, y), (float4)(TONEMAP_SCALE * (L - TONEMAP_LOG_MIN), 0.0f, 0.0f, 0.0f));
+}
+
+// compresses the base layer, the sliced grid in base, and keeps the detail
+kernel void
+tonemap_apply(read_only image2d_t in, read_only image2d_t base, write_only image2d_t out, const int width,
+              const int height, const float contr)
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+  if(x >= width || y >= height) return;
+
+  const float4 pixel = read_imagef(in, sampleri, (int2)(x, y));
+  const float L = tonemap_log_luminance(pixel);
+  const float B = read_imagef(base, sampleri, (int2)(x, y)).x / TONEMAP_SCALE + TONEMAP_LOG_MIN;
+  const float Ln = exp(B * (contr - 1.0f) + (L - B) - 1.0f);
+  float4 o = pixel * Ln;
+  o.w = pixel.w;
+  write_imagef(out, (int2)(x, y), o);
+}
+
+#undef TONEMAP_LOG_MIN
+#undef TONEMAP_SCALE
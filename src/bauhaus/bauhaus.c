@@ -2257,6 +2257,7 @@ static gboolean dt_bauhaus_slider_button_press(GtkWidget *widget, GdkEventButton
     {
       const float l = 4.0f / tmp.width;
       const float r = 1.0f - (tmp.height + 4.0f) / tmp.width;
+      if(w->module) dt_dev_set_interacting(darktable.develop, w->module);
       dt_bauhaus_slider_set_normalized(w, (event->x / tmp.width - l) / (r - l));
       dt_bauhaus_slider_data_t *d = &w->data.slider;
       d->is_dragging = 1;
@@ -2284,6 +2285,7 @@ static gboolean dt_bauhaus_slider_button_release(GtkWidget *widget, GdkEventButt
     d->is_dragging = 0;
     if(d->timeout_handle) g_source_remove(d->timeout_handle);
     d->timeout_handle = 0;
+    if(w->module) dt_dev_set_interacting(darktable.develop, NULL);
     const float l = 4.0f / tmp.width;
     const float r = 1.0f - (tmp.height + 4.0f) / tmp.width;
     dt_bauhaus_slider_set_normalized(w, (event->x / tmp.width - l) / (r - l));
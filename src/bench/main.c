@@ -0,0 +1,495 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2017 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/**
+ * runs the export pixelpipe over a set of images, each with the history of its xmp sidecar, a number of
+ * times on the cpu only, on opencl only and with the scheduling profile of the user. the medians and
+ * 95th percentiles of the whole run and of every module are printed and can be written as csv and json,
+ * to track performance across releases. the module times come from the pixelpipe reports. the cpu-sse2
+ * mode, only run when asked for, leaves out the avx2 and avx-512 codepaths to compare against them.
+ */
+
+#include "common/darktable.h"
+#include "common/exif.h"
+#include "common/film.h"
+#include "common/image.h"
+#include "common/image_cache.h"
+#include "common/imageio.h"
+#include "common/mipmap_cache.h"
+#include "common/opencl.h"
+#include "control/conf.h"
+#include "develop/develop.h"
+#include "develop/pixelpipe_hb.h"
+
+#include <glib/gstdio.h>
+#include <json-glib/json-glib.h>
+#include <libintl.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include "win/main_wrapper.h"
+#endif
+
+typedef enum dt_bench_mode_t
+{
+  DT_BENCH_CPU = 0,
+  DT_BENCH_CPU_SSE2, // the plain and sse2 code the wider codepaths are measured against
+  DT_BENCH_OPENCL,
+  DT_BENCH_DEFAULT,
+  DT_BENCH_MODES
+} dt_bench_mode_t;
+
+static const char *_mode_names[DT_BENCH_MODES] = { "cpu", "cpu-sse2", "opencl", "default" };
+
+// all times of one module (or the whole run, "total") of one image in one mode
+typedef struct dt_bench_series_t
+{
+  gchar *image;
+  dt_bench_mode_t mode;
+  gchar *name;
+  GArray *times; // seconds, double
+  double median, p95;
+} dt_bench_series_t;
+
+typedef struct dt_bench_image_t
+{
+  gchar *filename;
+  gchar *xmp_filename; // history to apply, NULL for the one darktable would pick up itself
+} dt_bench_image_t;
+
+static void usage(const char *progname)
+{
+  fprintf(stderr, "usage: %s [--runs <n>] [--width <max width>] [--height <max height>] "
+                  "[--modes <cpu,cpu-sse2,opencl,default>] [--csv <file>] [--json <file>] "
+                  "<raw> [<xmp>] [<raw> [<xmp>] ...] [--core <darktable options>]\n",
+          progname);
+}
+
+static dt_bench_series_t *_series_get(GPtrArray *results, const char *image, const dt_bench_mode_t mode,
+                                      const char *name)
+{
+  for(guint k = 0; k < results->len; k++)
+  {
+    dt_bench_series_t *s = (dt_bench_series_t *)g_ptr_array_index(results, k);
+    if(s->mode == mode && !strcmp(s->name, name) && !strcmp(s->image, image)) return s;
+  }
+  dt_bench_series_t *s = (dt_bench_series_t *)calloc(1, sizeof(dt_bench_series_t));
+  s->image = g_strdup(image);
+  s->mode = mode;
+  s->name = g_strdup(name);
+  s->times = g_array_new(FALSE, FALSE, sizeof(double));
+  g_ptr_array_add(results, s);
+  return s;
+}
+
+static void _series_free(gpointer data)
+{
+  dt_bench_series_t *s = (dt_bench_series_t *)data;
+  g_free(s->image);
+  g_free(s->name);
+  g_array_free(s->times, TRUE);
+  free(s);
+}
+
+static gint _double_cmp(gconstpointer a, gconstpointer b)
+{
+  const double da = *(const double *)a, db = *(const double *)b;
+  return (da > db) - (da < db);
+}
+
+// nearest rank, so the p95 of a handful of runs is an actual run instead of an interpolation
+static double _percentile(const GArray *sorted, const double p)
+{
+  if(!sorted->len) return NAN;
+  const int rank = CLAMP((int)ceil(p * sorted->len) - 1, 0, (int)sorted->len - 1);
+  return g_array_index(sorted, double, rank);
+}
+
+static void _series_finish(dt_bench_series_t *s)
+{
+  GArray *sorted = g_array_sized_new(FALSE, FALSE, sizeof(double), s->times->len);
+  g_array_append_vals(sorted, s->times->data, s->times->len);
+  g_array_sort(sorted, _double_cmp);
+  s->median = _percentile(sorted, 0.5);
+  s->p95 = _percentile(sorted, 0.95);
+  g_array_free(sorted, TRUE);
+}
+
+static void _set_mode(const dt_bench_mode_t mode, const gboolean opencl, const char *profile,
+                      const dt_codepath_t codepath)
+{
+  darktable.codepath = codepath;
+  switch(mode)
+  {
+    case DT_BENCH_CPU:
+      dt_conf_set_bool("opencl", FALSE);
+      break;
+    case DT_BENCH_CPU_SSE2:
+      dt_conf_set_bool("opencl", FALSE);
+      darktable.codepath.AVX2 = darktable.codepath.AVX512 = 0;
+      break;
+    case DT_BENCH_OPENCL:
+      // every pipe has to wait for a device, modules without opencl code still run on the cpu
+      dt_conf_set_bool("opencl", TRUE);
+      dt_conf_set_string("opencl_scheduling_profile", "very fast GPU");
+      break;
+    default:
+      dt_conf_set_bool("opencl", opencl);
+      dt_conf_set_string("opencl_scheduling_profile", profile ? profile : "default");
+      break;
+  }
+}
+
+// one warm-up run for kernel compilation and lazy initialization, then runs measured ones.
+// returns 0 on success.
+static int _bench_image(const uint32_t imgid, const char *label, const dt_bench_mode_t mode, const int runs,
+                        const int max_width, const int max_height, GPtrArray *results)
+{
+  dt_develop_t dev;
+  dt_dev_init(&dev, 0);
+  dt_dev_load_image(&dev, imgid);
+
+  dt_mipmap_buffer_t buf;
+  dt_mipmap_cache_get(darktable.mipmap_cache, &buf, imgid, DT_MIPMAP_FULL, DT_MIPMAP_BLOCKING, 'r');
+  if(!buf.buf || !buf.width || !buf.height)
+  {
+    fprintf(stderr, "[bench] image `%s' is not available\n", label);
+    dt_mipmap_cache_release(darktable.mipmap_cache, &buf);
+    dt_dev_cleanup(&dev);
+    return 1;
+  }
+
+  int res = 0;
+  dt_dev_pixelpipe_t pipe;
+  if(!dt_dev_pixelpipe_init_export(&pipe, dev.image_storage.width, dev.image_storage.height,
+                                   IMAGEIO_RGB | IMAGEIO_FLOAT))
+  {
+    fprintf(stderr, "[bench] failed to allocate the pixelpipe for `%s'\n", label);
+    dt_mipmap_cache_release(darktable.mipmap_cache, &buf);
+    dt_dev_cleanup(&dev);
+    return 1;
+  }
+  dt_dev_pixelpipe_set_input(&pipe, &dev, (float *)buf.buf, buf.width, buf.height, buf.iscale);
+  dt_dev_pixelpipe_create_nodes(&pipe, &dev);
+  dt_dev_pixelpipe_synch_all(&pipe, &dev);
+  dt_dev_pixelpipe_get_dimensions(&pipe, &dev, pipe.iwidth, pipe.iheight, &pipe.processed_width,
+                                  &pipe.processed_height);
+
+  const double scalex = max_width > 0 ? fmin(max_width / (double)pipe.processed_width, 1.0) : 1.0;
+  const double scaley = max_height > 0 ? fmin(max_height / (double)pipe.processed_height, 1.0) : 1.0;
+  const double scale = fmin(scalex, scaley);
+  const int width = scale * pipe.processed_width + .5f;
+  const int height = scale * pipe.processed_height + .5f;
+
+  for(int run = -1; run < runs && !res; run++)
+  {
+    // all runs have to do the full work
+    pipe.cache_obsolete = 1;
+    const double start = dt_get_wtime();
+    if(dt_dev_pixelpipe_process_no_gamma(&pipe, &dev, 0, 0, width, height, scale))
+    {
+      fprintf(stderr, "[bench] processing `%s' on %s failed\n", label, _mode_names[mode]);
+      res = 1;
+      break;
+    }
+    const double wall = dt_get_wtime() - start;
+    if(run < 0) continue;
+
+    g_array_append_val(_series_get(results, label, mode, "total")->times, wall);
+    int on_device = 0;
+    for(int k = 0; k < pipe.report.count; k++)
+    {
+      const dt_dev_pixelpipe_report_entry_t *entry = pipe.report.entries + k;
+      on_device |= entry->device >= 0;
+      gchar *name = entry->instance ? g_strdup_printf("%s %d", entry->op, entry->instance)
+                                    : g_strdup(entry->op);
+      if(entry->fused > 1)
+      {
+        gchar *fused = g_strdup_printf("%s (+%d fused)", name, entry->fused - 1);
+        g_free(name);
+        name = fused;
+      }
+      g_array_append_val(_series_get(results, label, mode, name)->times, entry->wall);
+      g_free(name);
+    }
+    if(mode == DT_BENCH_OPENCL && !on_device)
+      fprintf(stderr, "[bench] no opencl device for `%s', run %d was on the cpu\n", label, run);
+  }
+
+  dt_dev_pixelpipe_cleanup(&pipe);
+  dt_mipmap_cache_release(darktable.mipmap_cache, &buf);
+  dt_dev_cleanup(&dev);
+  return res;
+}
+
+static void _write_csv(const char *filename, GPtrArray *results)
+{
+  FILE *f = g_fopen(filename, "wb");
+  if(!f)
+  {
+    fprintf(stderr, "[bench] can't write `%s'\n", filename);
+    return;
+  }
+  char median[G_ASCII_DTOSTR_BUF_SIZE], p95[G_ASCII_DTOSTR_BUF_SIZE];
+  fprintf(f, "image,mode,module,runs,median,p95\n");
+  for(guint k = 0; k < results->len; k++)
+  {
+    const dt_bench_series_t *s = (const dt_bench_series_t *)g_ptr_array_index(results, k);
+    fprintf(f, "\"%s\",%s,\"%s\",%u,%s,%s\n", s->image, _mode_names[s->mode], s->name, s->times->len,
+            g_ascii_formatd(median, sizeof(median), "%.6f", s->median),
+            g_ascii_formatd(p95, sizeof(p95), "%.6f", s->p95));
+  }
+  fclose(f);
+}
+
+static void _write_json(const char *filename, GPtrArray *results, const int runs, const int width,
+                        const int height)
+{
+  JsonBuilder *builder = json_builder_new();
+  json_builder_begin_object(builder);
+  json_builder_set_member_name(builder, "version");
+  json_builder_add_string_value(builder, darktable_package_version);
+  json_builder_set_member_name(builder, "runs");
+  json_builder_add_int_value(builder, runs);
+  json_builder_set_member_name(builder, "width");
+  json_builder_add_int_value(builder, width);
+  json_builder_set_member_name(builder, "height");
+  json_builder_add_int_value(builder, height);
+  json_builder_set_member_name(builder, "results");
+  json_builder_begin_array(builder);
+  for(guint k = 0; k < results->len; k++)
+  {
+    const dt_bench_series_t *s = (const dt_bench_series_t *)g_ptr_array_index(results, k);
+    json_builder_begin_object(builder);
+    json_builder_set_member_name(builder, "image");
+    json_builder_add_string_value(builder, s->image);
+    json_builder_set_member_name(builder, "mode");
+    json_builder_add_string_value(builder, _mode_names[s->mode]);
+    json_builder_set_member_name(builder, "module");
+    json_builder_add_string_value(builder, s->name);
+    json_builder_set_member_name(builder, "runs");
+    json_builder_add_int_value(builder, s->times->len);
+    json_builder_set_member_name(builder, "median");
+    json_builder_add_double_value(builder, s->median);
+    json_builder_set_member_name(builder, "p95");
+    json_builder_add_double_value(builder, s->p95);
+    json_builder_end_object(builder);
+  }
+  json_builder_end_array(builder);
+  json_builder_end_object(builder);
+
+  JsonGenerator *generator = json_generator_new();
+  JsonNode *root = json_builder_get_root(builder);
+  json_generator_set_root(generator, root);
+  json_generator_set_pretty(generator, TRUE);
+  GError *error = NULL;
+  if(!json_generator_to_file(generator, filename, &error))
+  {
+    fprintf(stderr, "[bench] can't write `%s': %s\n", filename, error->message);
+    g_error_free(error);
+  }
+  json_node_free(root);
+  g_object_unref(generator);
+  g_object_unref(builder);
+}
+
+int main(int argc, char *arg[])
+{
+  bindtextdomain(GETTEXT_PACKAGE, DARKTABLE_LOCALEDIR);
+  bind_textdomain_codeset(GETTEXT_PACKAGE, "UTF-8");
+  textdomain(GETTEXT_PACKAGE);
+
+  if(!gtk_parse_args(&argc, &arg)) exit(1);
+
+  int runs = 5, width = 0, height = 0;
+  gboolean modes[DT_BENCH_MODES] = { TRUE, FALSE, TRUE, TRUE };
+  const char *csv_filename = NULL, *json_filename = NULL;
+  GList *images = NULL;
+
+  int k;
+  for(k = 1; k < argc; k++)
+  {
+    if(arg[k][0] == '-')
+    {
+      if(!strcmp(arg[k], "--help"))
+      {
+        usage(arg[0]);
+        exit(1);
+      }
+      else if(!strcmp(arg[k], "--runs") && argc > k + 1)
+        runs = MAX(atoi(arg[++k]), 1);
+      else if(!strcmp(arg[k], "--width") && argc > k + 1)
+        width = MAX(atoi(arg[++k]), 0);
+      else if(!strcmp(arg[k], "--height") && argc > k + 1)
+        height = MAX(atoi(arg[++k]), 0);
+      else if(!strcmp(arg[k], "--csv") && argc > k + 1)
+        csv_filename = arg[++k];
+      else if(!strcmp(arg[k], "--json") && argc > k + 1)
+        json_filename = arg[++k];
+      else if(!strcmp(arg[k], "--modes") && argc > k + 1)
+      {
+        gchar **names = g_strsplit(arg[++k], ",", -1);
+        for(int m = 0; m < DT_BENCH_MODES; m++)
+        {
+          modes[m] = FALSE;
+          for(gchar **name = names; *name; name++)
+            if(!strcmp(*name, _mode_names[m])) modes[m] = TRUE;
+        }
+        g_strfreev(names);
+      }
+      else if(!strcmp(arg[k], "--core"))
+      {
+        // everything from here on should be passed to the core
+        k++;
+        break;
+      }
+      else
+      {
+        usage(arg[0]);
+        exit(1);
+      }
+    }
+    else if(g_str_has_suffix(arg[k], ".xmp") || g_str_has_suffix(arg[k], ".XMP"))
+    {
+      // the history for the image before it
+      dt_bench_image_t *image = images ? (dt_bench_image_t *)g_list_last(images)->data : NULL;
+      if(!image || image->xmp_filename)
+      {
+        usage(arg[0]);
+        exit(1);
+      }
+      image->xmp_filename = g_strdup(arg[k]);
+    }
+    else
+    {
+      dt_bench_image_t *image = (dt_bench_image_t *)calloc(1, sizeof(dt_bench_image_t));
+      image->filename = g_strdup(arg[k]);
+      images = g_list_append(images, image);
+    }
+  }
+
+  if(!images)
+  {
+    usage(arg[0]);
+    exit(1);
+  }
+
+  // same as darktable-cli, and every run has to go through the whole pipe
+  int m_argc = 0;
+  char **m_arg = malloc((9 + argc - k + 1) * sizeof(char *));
+  m_arg[m_argc++] = "darktable-bench";
+  m_arg[m_argc++] = "--library";
+  m_arg[m_argc++] = ":memory:";
+  m_arg[m_argc++] = "--conf";
+  m_arg[m_argc++] = "write_sidecar_files=FALSE";
+  m_arg[m_argc++] = "--conf";
+  m_arg[m_argc++] = "pixelpipe_report=TRUE";
+  m_arg[m_argc++] = "--conf";
+  m_arg[m_argc++] = "cache_pixelpipe_checkpoint=";
+  for(; k < argc; k++) m_arg[m_argc++] = arg[k];
+  m_arg[m_argc] = NULL;
+
+  // init dt without gui and without data.db:
+  if(dt_init(m_argc, m_arg, FALSE, FALSE, NULL))
+  {
+    free(m_arg);
+    exit(1);
+  }
+
+  // the modes change the opencl settings of the user, who gets them back at the end
+  const gboolean opencl = dt_conf_get_bool("opencl");
+  gchar *profile = dt_conf_get_string("opencl_scheduling_profile");
+  const dt_codepath_t codepath = darktable.codepath;
+
+  if(modes[DT_BENCH_OPENCL] && !dt_opencl_is_inited())
+  {
+    fprintf(stderr, "[bench] opencl is not available, skipping the opencl runs\n");
+    modes[DT_BENCH_OPENCL] = FALSE;
+  }
+
+  GPtrArray *results = g_ptr_array_new_with_free_func(_series_free);
+  int failed = 0;
+  for(GList *iter = images; iter; iter = g_list_next(iter))
+  {
+    dt_bench_image_t *image = (dt_bench_image_t *)iter->data;
+    dt_film_t film;
+    gchar *directory = g_path_get_dirname(image->filename);
+    const int filmid = dt_film_new(&film, directory);
+    g_free(directory);
+    const uint32_t imgid = dt_image_import(filmid, image->filename, TRUE);
+    if(!imgid)
+    {
+      fprintf(stderr, "[bench] can't open `%s'\n", image->filename);
+      failed = 1;
+      continue;
+    }
+    if(image->xmp_filename)
+    {
+      dt_image_t *img = dt_image_cache_get(darktable.image_cache, imgid, 'w');
+      dt_exif_xmp_read(img, image->xmp_filename, 1);
+      // don't write new xmp:
+      dt_image_cache_write_release(darktable.image_cache, img, DT_IMAGE_CACHE_RELAXED);
+    }
+
+    gchar *label = g_path_get_basename(image->filename);
+    for(int m = 0; m < DT_BENCH_MODES; m++)
+    {
+      if(!modes[m]) continue;
+      _set_mode(m, opencl, profile, codepath);
+      failed |= _bench_image(imgid, label, m, runs, width, height, results);
+    }
+    g_free(label);
+  }
+
+  dt_conf_set_bool("opencl", opencl);
+  if(profile) dt_conf_set_string("opencl_scheduling_profile", profile);
+  g_free(profile);
+  darktable.codepath = codepath;
+
+  printf("%-24s %-8s %-32s %10s %10s\n", "image", "mode", "module", "median", "p95");
+  for(guint r = 0; r < results->len; r++)
+  {
+    dt_bench_series_t *s = (dt_bench_series_t *)g_ptr_array_index(results, r);
+    _series_finish(s);
+    printf("%-24s %-8s %-32s %10.4f %10.4f\n", s->image, _mode_names[s->mode], s->name, s->median, s->p95);
+  }
+  if(csv_filename) _write_csv(csv_filename, results);
+  if(json_filename) _write_json(json_filename, results, runs, width, height);
+
+  g_ptr_array_free(results, TRUE);
+  for(GList *iter = images; iter; iter = g_list_next(iter))
+  {
+    dt_bench_image_t *image = (dt_bench_image_t *)iter->data;
+    g_free(image->filename);
+    g_free(image->xmp_filename);
+    free(image);
+  }
+  g_list_free(images);
+
+  dt_cleanup();
+
+  free(m_arg);
+  return failed;
+}
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
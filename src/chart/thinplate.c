@@ -137,6 +137,110 @@ static inline int solve(double *As, double *w, double *v, const double *b, doubl
   return 0;
 }
 
+// orthonormal basis of the columns chosen so far, A_s = Q R with Q wd x s and R upper triangular. it grows by a
+// column per step of the greedy selection, which costs O(wd s) instead of an svd of A_s for every channel.
+typedef struct thinplate_basis_t
+{
+  int wd, S, s;
+  double *Q;   // s columns of wd values each
+  double *R;   // S x S
+  double *Qtb; // dim x S, the targets projected onto the columns of Q
+} thinplate_basis_t;
+
+static void basis_init(thinplate_basis_t *B, const int wd, const int S, const int dim)
+{
+  B->wd = wd;
+  B->S = S;
+  B->s = 0;
+  B->Q = malloc((size_t)wd * S * sizeof(double));
+  B->R = calloc((size_t)S * S, sizeof(double));
+  B->Qtb = calloc((size_t)dim * S, sizeof(double));
+}
+
+static void basis_cleanup(thinplate_basis_t *B)
+{
+  free(B->Q);
+  free(B->R);
+  free(B->Qtb);
+}
+
+// adds column a to the basis and takes its direction off the dim residuals of wd values each. non-zero if a is
+// too close to the span of the others, as solve() does when the smallest singular value gets too small.
+static int basis_add(thinplate_basis_t *B, const double *a, double *r, const int dim)
+{
+  const int s = B->s, S = B->S, wd = B->wd;
+  if(s >= S) return 1;
+  double *q = B->Q + (size_t)s * wd;
+  memcpy(q, a, wd * sizeof(double));
+  for(int i = 0; i < s; i++) B->R[i * S + s] = 0.0;
+  // modified gram-schmidt, twice: the columns of large targets are close to dependent and one pass loses
+  // the orthogonality
+  for(int pass = 0; pass < 2; pass++)
+    for(int i = 0; i < s; i++)
+    {
+      const double *qi = B->Q + (size_t)i * wd;
+      double d = 0.0;
+      for(int j = 0; j < wd; j++) d += qi[j] * q[j];
+      for(int j = 0; j < wd; j++) q[j] -= d * qi[j];
+      B->R[i * S + s] += d;
+    }
+  double n = 0.0;
+  for(int j = 0; j < wd; j++) n += q[j] * q[j];
+  n = sqrt(n);
+  if(n < 1e-3) return 1;
+  for(int j = 0; j < wd; j++) q[j] /= n;
+  B->R[s * S + s] = n;
+
+  // the residuals are orthogonal to the basis before, so this is their least squares update
+  for(int ch = 0; ch < dim; ch++)
+  {
+    double *rc = r + (size_t)ch * wd;
+    double d = 0.0;
+    for(int j = 0; j < wd; j++) d += q[j] * rc[j];
+    B->Qtb[ch * S + s] = d;
+    for(int j = 0; j < wd; j++) rc[j] -= d * q[j];
+  }
+  B->s++;
+  return 0;
+}
+
+// least squares coefficients of the columns in the basis, R c = Q^t b
+static void basis_coefficients(const thinplate_basis_t *B, double **coeff, const int dim)
+{
+  const int S = B->S;
+  for(int ch = 0; ch < dim; ch++)
+    for(int i = B->s - 1; i >= 0; i--)
+    {
+      double c = B->Qtb[ch * S + i];
+      for(int k = i + 1; k < B->s; k++) c -= B->R[i * S + k] * coeff[ch][k];
+      coeff[ch][i] = c / B->R[i * S + i];
+    }
+}
+
+// dot products of the residuals with every column not chosen yet. A is symmetric, so column t is contiguous
+// as row t, and the columns are independent of each other.
+static void column_dots(const double *A, const double *r, const double *norm, double *dots, int wd, int dim)
+{
+#ifdef _OPENMP
+#pragma omp parallel for default(none) shared(A, r, norm, dots, wd, dim) schedule(static)
+#endif
+  for(int t = 0; t < wd; t++)
+  {
+    double dot = 0.0;
+    if(norm[t] > 0.0)
+    {
+      for(int ch = 0; ch < dim; ch++)
+      {
+        double chdot = 0.0;
+        for(int j = 0; j < wd; j++) chdot += A[(size_t)t * wd + j] * r[(size_t)ch * wd + j];
+        dot += fabs(chdot);
+      }
+      dot *= norm[t];
+    }
+    dots[t] = dot;
+  }
+}
+
 #pragma GCC diagnostic push
 #pragma GCC diagnostic warning "-Wvla"
 
@@ -199,6 +303,11 @@ int thinplate_match(const tonecurve_t *curve, // tonecurve to apply after this (
   double *w = malloc(S * sizeof(double));
   double *v = malloc(S * S * sizeof(double));
   double *As = calloc(wd * S, sizeof(double));
+#if !defined(EXACT) && !defined(REPLACEMENT)
+  thinplate_basis_t basis;
+  basis_init(&basis, wd, S, dim);
+  double *dots = malloc(wd * sizeof(double));
+#endif
 
   // for rank from 0 to sparsity level
   int s = 0, patches = 0;
@@ -210,6 +319,11 @@ int thinplate_match(const tonecurve_t *curve, // tonecurve to apply after this (
 #ifndef REPLACEMENT
     if(patches >= S - 4)
     {
+#ifndef EXACT
+      basis_coefficients(&basis, coeff, dim);
+      basis_cleanup(&basis);
+      free(dots);
+#endif
       free(r);
       free(b);
       free(w);
@@ -225,6 +339,15 @@ int thinplate_match(const tonecurve_t *curve, // tonecurve to apply after this (
     // by searching over all three residuals
     double maxdot = 0.0;
     int maxcol = 0;
+#if !defined(EXACT) && !defined(REPLACEMENT)
+    column_dots(A, (const double *)r, norm, dots, wd, dim);
+    for(int t = 0; t < wd; t++)
+      if(dots[t] > maxdot)
+      {
+        maxcol = t;
+        maxdot = dots[t];
+      }
+#else
     for(int t = 0; t < wd; t++)
     {
       double dot = 0.0;
@@ -280,6 +403,7 @@ int thinplate_match(const tonecurve_t *curve, // tonecurve to apply after this (
         maxdot = dot;
       }
     }
+#endif
 
     if(patches < S - 4)
     {
@@ -373,6 +497,24 @@ int thinplate_match(const tonecurve_t *curve, // tonecurve to apply after this (
     double err = 1. / maxdot;
 #else
     const int sp = MIN(sparsity, S-1); // need to fix up for replacement
+#ifndef REPLACEMENT
+    // the new column joins the basis, which updates the least squares residuals of all channels at once. on
+    // error, return last valid configuration
+    if(basis_add(&basis, A + (size_t)maxcol * wd, (double *)r, dim))
+    {
+      basis_coefficients(&basis, coeff, dim);
+      basis_cleanup(&basis);
+      free(dots);
+      free(r);
+      free(b);
+      free(w);
+      free(v);
+      free(As);
+      free(norm);
+      free(A);
+      return sparsity;
+    }
+#else
     // solve linear least squares for sparse c for every output channel:
     for(int ch = 0; ch < dim; ch++)
     {
@@ -402,6 +544,7 @@ int thinplate_match(const tonecurve_t *curve, // tonecurve to apply after this (
         for(int i = 0; i <= sp; i++) r[ch][j] -= A[j * wd + permutation[i]] * coeff[ch][i];
       }
     }
+#endif
 
     double merr = 0.0;
     const double err = compute_error(curve, target, r[0], r[1], r[2], wd, &merr);
@@ -420,6 +563,11 @@ int thinplate_match(const tonecurve_t *curve, // tonecurve to apply after this (
     // if(err < 2.0) return sparsity+1;
     olderr = err;
   }
+#if !defined(EXACT) && !defined(REPLACEMENT)
+  basis_coefficients(&basis, coeff, dim);
+  basis_cleanup(&basis);
+  free(dots);
+#endif
   free(r);
   free(b);
   free(w);
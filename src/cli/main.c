@@ -40,22 +40,711 @@
 #include "control/conf.h"
 #include "develop/imageop.h"
 
+#include <glib/gstdio.h>
 #include <inttypes.h>
 #include <libintl.h>
 #include <sys/time.h>
 #include <unistd.h>
 
+#ifdef HAVE_HTTP_SERVER
+#include <libsoup/soup.h>
+#ifndef _WIN32
+#include <glib-unix.h>
+#include <signal.h>
+#endif
+#endif
+
 #ifdef _WIN32
 #include "win/main_wrapper.h"
 #endif
 
 static void usage(const char *progname)
 {
-  fprintf(stderr, "usage: %s <input file> [<xmp file>] <output file> [--width <max width>,--height <max "
-                  "height>,--bpp <bpp>,--hq <0|1|true|false>,--upscale <0|1|true|false>,--verbose] [--core <darktable options>]\n",
+  fprintf(stderr, "usage: %s <input file> [<xmp file>] <output file|-> [--width <max width>,--height <max "
+                  "height>,--bpp <bpp>,--hq <0|1|true|false>,--upscale <0|1|true|false>,--out-ext <extension>,"
+                  "--verbose] [--core <darktable options>]\n",
           progname);
+  fprintf(stderr, "       %s --batch <list file|-> [--jobs <n>] [options] [--core <darktable options>]\n", progname);
+  fprintf(stderr, "       %s --server <port> [--jobs <n>] [options] [--core <darktable options>]\n", progname);
+}
+
+typedef struct dt_cli_options_t
+{
+  int width, height;
+  gboolean verbose, high_quality, upscale;
+  char *out_ext;  // format of an output file "-"
+  int stdout_fd;  // where the image written to stdout goes, anything printed meanwhile ends up on stderr
+} dt_cli_options_t;
+
+// one input file or folder exported to one output file name, as given on the command line or by a line of the
+// batch list
+typedef struct dt_cli_job_t
+{
+  gchar *input_filename;
+  gchar *xmp_filename;
+  gchar *output_filename;
+  GList *id_list;
+  dt_imageio_module_format_t *format;
+  dt_imageio_module_storage_t *storage;
+  dt_imageio_module_data_t *sdata, *fdata;
+  gboolean reset_history; // without an xmp file the images get their own sidecar, not the history of a job before
+  gboolean to_stdout;     // output file "-". storage is NULL if the format can write into the pipe itself
+  gchar *dirname;         // temporary folder the image is exported to otherwise
+  int failed;
+} dt_cli_job_t;
+
+// the jobs the export threads take turns on
+typedef struct dt_cli_queue_t
+{
+  dt_cli_job_t **jobs;
+  int count;
+  int next;
+  const dt_cli_options_t *options;
+} dt_cli_queue_t;
+
+static dt_cli_job_t *_job_new(const char *input_filename, const char *xmp_filename, const char *output_filename)
+{
+  dt_cli_job_t *job = (dt_cli_job_t *)calloc(1, sizeof(dt_cli_job_t));
+  job->input_filename = g_strdup(input_filename);
+  job->xmp_filename = g_strdup(xmp_filename);
+  job->output_filename = g_strdup(output_filename);
+  return job;
+}
+
+// removes a temporary folder and the files exported into it
+static void _remove_folder(const gchar *dirname)
+{
+  GDir *dir = g_dir_open(dirname, 0, NULL);
+  const gchar *name;
+  while(dir && (name = g_dir_read_name(dir)))
+  {
+    gchar *filename = g_build_filename(dirname, name, NULL);
+    g_unlink(filename);
+    g_free(filename);
+  }
+  if(dir) g_dir_close(dir);
+  g_rmdir(dirname);
+}
+
+static void _job_free(dt_cli_job_t *job)
+{
+  if(job->dirname) _remove_folder(job->dirname);
+  if(job->sdata) job->storage->free_params(job->storage, job->sdata);
+  if(job->fdata) job->format->free_params(job->format, job->fdata);
+  g_list_free(job->id_list);
+  g_free(job->input_filename);
+  g_free(job->xmp_filename);
+  g_free(job->output_filename);
+  g_free(job->dirname);
+  free(job);
+}
+
+// every non-empty line of the list is "<input file> [<xmp file>] <output file>", quoted like on a shell.
+// lines starting with # are skipped.
+static int _read_batch_list(const char *list_filename, GPtrArray *jobs)
+{
+  gchar *contents = NULL;
+  if(!strcmp(list_filename, "-"))
+  {
+    GString *str = g_string_new(NULL);
+    char buf[4096];
+    size_t length;
+    while((length = fread(buf, 1, sizeof(buf), stdin)) > 0) g_string_append_len(str, buf, length);
+    contents = g_string_free(str, FALSE);
+  }
+  else if(!g_file_get_contents(list_filename, &contents, NULL, NULL))
+  {
+    fprintf(stderr, _("error: can't read batch list %s"), list_filename);
+    fprintf(stderr, "\n");
+    return 1;
+  }
+
+  int error = 0;
+  gchar **lines = g_strsplit(contents, "\n", -1);
+  for(int i = 0; lines[i] && !error; i++)
+  {
+    gchar *line = g_strstrip(lines[i]);
+    if(line[0] == '\0' || line[0] == '#') continue;
+
+    int n = 0;
+    gchar **files = NULL;
+    if(!g_shell_parse_argv(line, &n, &files, NULL) || n < 2 || n > 3)
+    {
+      fprintf(stderr, _("error: line %d of the batch list needs an input file, an optional xmp file and an "
+                        "output file"), i + 1);
+      fprintf(stderr, "\n");
+      error = 1;
+    }
+    else if(!strcmp(files[n - 1], "-"))
+    {
+      fprintf(stderr, _("error: line %d of the batch list writes to stdout, which only a single export can"), i + 1);
+      fprintf(stderr, "\n");
+      error = 1;
+    }
+    else
+      g_ptr_array_add(jobs, _job_new(files[0], n == 3 ? files[1] : NULL, files[n - 1]));
+    g_strfreev(files);
+  }
+  g_strfreev(lines);
+  g_free(contents);
+  return error;
+}
+
+// imports the images of a job and sets up the format and storage to export them, 1 if that fails
+static int _job_prepare(dt_cli_job_t *job, const dt_cli_options_t *options)
+{
+  job->to_stdout = !strcmp(job->output_filename, "-");
+
+  if(!job->to_stdout && g_file_test(job->output_filename, G_FILE_TEST_IS_DIR))
+  {
+    fprintf(stderr, _("error: output file is a directory. please specify file name"));
+    fprintf(stderr, "\n");
+    return 1;
+  }
+
+  // the output file already exists, so there will be a sequence number added
+  if(!job->to_stdout && g_file_test(job->output_filename, G_FILE_TEST_EXISTS))
+  {
+    fprintf(stderr, "%s\n", _("output file already exists, it will get renamed"));
+  }
+
+  if(g_file_test(job->input_filename, G_FILE_TEST_IS_DIR))
+  {
+    int filmid = dt_film_import(job->input_filename);
+    if(!filmid)
+    {
+      fprintf(stderr, _("error: can't open folder %s"), job->input_filename);
+      fprintf(stderr, "\n");
+      return 1;
+    }
+    job->id_list = dt_film_get_image_ids(filmid);
+  }
+  else
+  {
+    dt_film_t film;
+    int id = 0;
+    int filmid = 0;
+
+    gchar *directory = g_path_get_dirname(job->input_filename);
+    filmid = dt_film_new(&film, directory);
+    g_free(directory);
+    id = dt_image_import(filmid, job->input_filename, TRUE);
+    if(!id)
+    {
+      fprintf(stderr, _("error: can't open file %s"), job->input_filename);
+      fprintf(stderr, "\n");
+      return 1;
+    }
+
+    job->id_list = g_list_append(job->id_list, GINT_TO_POINTER(id));
+  }
+
+  if(!job->id_list)
+  {
+    fprintf(stderr, _("no images to export, aborting\n"));
+    return 1;
+  }
+
+  if(job->to_stdout && g_list_next(job->id_list))
+  {
+    fprintf(stderr, "%s\n", _("error: only a single image can be written to stdout"));
+    return 1;
+  }
+
+  // attach xmp, if requested:
+  if(job->xmp_filename || job->reset_history)
+  {
+    for(GList *iter = job->id_list; iter; iter = g_list_next(iter))
+    {
+      int id = GPOINTER_TO_INT(iter->data);
+      char sidecar[PATH_MAX] = { 0 };
+      if(job->xmp_filename)
+        g_strlcpy(sidecar, job->xmp_filename, sizeof(sidecar));
+      else
+      {
+        gboolean from_cache = FALSE;
+        dt_image_full_path(id, sidecar, sizeof(sidecar), &from_cache);
+        dt_image_path_append_version(id, sidecar, sizeof(sidecar));
+        g_strlcat(sidecar, ".xmp", sizeof(sidecar));
+        if(!g_file_test(sidecar, G_FILE_TEST_IS_REGULAR))
+        {
+          dt_history_delete_on_image(id);
+          continue;
+        }
+      }
+      dt_image_t *image = dt_image_cache_get(darktable.image_cache, id, 'w');
+      dt_exif_xmp_read(image, sidecar, 1);
+      // don't write new xmp:
+      dt_image_cache_write_release(darktable.image_cache, image, DT_IMAGE_CACHE_RELAXED);
+    }
+  }
+
+  // print the history stack. only look at the first image and assume all got the same processing applied
+  if(options->verbose)
+  {
+    int id = GPOINTER_TO_INT(job->id_list->data);
+    gchar *history = dt_history_get_items_as_string(id);
+    if(history)
+      printf("%s\n", history);
+    else
+      printf("[%s]\n", _("empty history stack"));
+    g_free(history);
+  }
+
+  // try to find out the export format from the output_filename, stdout gets the one asked for
+  char *output_filename = job->output_filename;
+  char *ext = options->out_ext;
+  if(!job->to_stdout)
+  {
+    ext = output_filename + strlen(output_filename);
+    while(ext > output_filename && *ext != '.') ext--;
+    *ext = '\0';
+    ext++;
+  }
+
+  if(!strcmp(ext, "jpg")) ext = "jpeg";
+
+  if(!strcmp(ext, "tif")) ext = "tiff";
+
+  // init the export data structures
+  job->format = dt_imageio_get_format_by_name(ext);
+  if(job->format == NULL)
+  {
+    fprintf(stderr, _("unknown extension '.%s'"), ext);
+    fprintf(stderr, "\n");
+    return 1;
+  }
+
+  dt_imageio_module_format_t *format = job->format;
+
+  job->fdata = format->get_params(format);
+  if(job->fdata == NULL)
+  {
+    fprintf(stderr, "%s\n", _("failed to get parameters from format module, aborting export ..."));
+    return 1;
+  }
+
+  dt_imageio_module_data_t *fdata = job->fdata;
+  uint32_t w, h, fw, fh, sw, sh;
+  fw = fh = sw = sh = 0;
+  format->dimension(format, fdata, &fw, &fh);
+
+  // formats that seek in their file or write exif into it afterwards go through a temporary one
+  const gboolean streamed = job->to_stdout && (format->flags(fdata) & FORMAT_FLAGS_STREAMABLE);
+  if(job->to_stdout && !streamed)
+  {
+    job->dirname = g_dir_make_tmp("darktable-cli-XXXXXX", NULL);
+    if(!job->dirname)
+    {
+      fprintf(stderr, "%s\n", _("error: can't create a temporary folder"));
+      return 1;
+    }
+    g_free(job->output_filename);
+    job->output_filename = output_filename = g_build_filename(job->dirname, "stdout", NULL);
+  }
+
+  dt_imageio_module_storage_t *storage = NULL;
+  if(!streamed)
+  {
+    job->storage = storage = dt_imageio_get_storage_by_name("disk"); // only exporting to disk makes sense
+    if(job->storage == NULL)
+    {
+      fprintf(
+          stderr, "%s\n",
+          _("cannot find disk storage module. please check your installation, something seems to be broken."));
+      return 1;
+    }
+
+    job->sdata = storage->get_params(storage);
+    if(job->sdata == NULL)
+    {
+      fprintf(stderr, "%s\n", _("failed to get parameters from storage module, aborting export ..."));
+      return 1;
+    }
+
+    // and now for the really ugly hacks. don't tell your children about this one or they won't sleep at night
+    // any longer ...
+    g_strlcpy((char *)job->sdata, output_filename, DT_MAX_PATH_FOR_PARAMS);
+    // all is good now, the last line didn't happen.
+
+    storage->dimension(storage, job->sdata, &sw, &sh);
+  }
+
+  if(sw == 0 || fw == 0)
+    w = sw > fw ? sw : fw;
+  else
+    w = sw < fw ? sw : fw;
+
+  if(sh == 0 || fh == 0)
+    h = sh > fh ? sh : fh;
+  else
+    h = sh < fh ? sh : fh;
+
+  fdata->max_width = options->width;
+  fdata->max_height = options->height;
+  fdata->max_width = (w != 0 && fdata->max_width > w) ? w : fdata->max_width;
+  fdata->max_height = (h != 0 && fdata->max_height > h) ? h : fdata->max_height;
+  fdata->style[0] = '\0';
+  fdata->style_append = 0;
+
+  if(storage && storage->initialize_store)
+  {
+    storage->initialize_store(storage, job->sdata, &job->format, &job->fdata, &job->id_list,
+                              options->high_quality, options->upscale);
+
+    job->format->set_params(job->format, job->fdata, job->format->params_size(job->format));
+    storage->set_params(storage, job->sdata, storage->params_size(storage));
+  }
+
+  return 0;
+}
+
+// the disk storage picked the name, the file is the only one in the temporary folder
+static int _copy_to_stdout(const dt_cli_job_t *job, const dt_cli_options_t *options)
+{
+  GDir *dir = g_dir_open(job->dirname, 0, NULL);
+  const gchar *name = dir ? g_dir_read_name(dir) : NULL;
+  gchar *filename = name ? g_build_filename(job->dirname, name, NULL) : NULL;
+  if(dir) g_dir_close(dir);
+  FILE *f = filename ? g_fopen(filename, "rb") : NULL;
+  g_free(filename);
+  if(!f) return 1;
+
+  int error = 0;
+  char buf[65536];
+  size_t length;
+  while(!error && (length = fread(buf, 1, sizeof(buf), f)) > 0)
+    for(size_t done = 0; done < length && !error;)
+    {
+      const ssize_t written = write(options->stdout_fd, buf + done, length - done);
+      if(written < 0)
+        error = 1;
+      else
+        done += written;
+    }
+  fclose(f);
+  return error;
+}
+
+static void _job_export(dt_cli_job_t *job, const dt_cli_options_t *options)
+{
+  // TODO: add a callback to set the bpp without going through the config
+
+  if(job->to_stdout && !job->storage)
+  {
+    // the format writes into the pipe itself, without the xmp that would have to be attached afterwards
+    const int id = GPOINTER_TO_INT(job->id_list->data);
+    gchar *filename = g_strdup_printf("/dev/fd/%d", options->stdout_fd);
+    if(dt_imageio_export(id, filename, job->format, job->fdata, options->high_quality, options->upscale, FALSE,
+                         NULL, NULL, 1, 1))
+      job->failed = 1;
+    g_free(filename);
+    return;
+  }
+
+  const int total = g_list_length(job->id_list);
+  int num = 1;
+  for(GList *iter = job->id_list; iter; iter = g_list_next(iter), num++)
+  {
+    int id = GPOINTER_TO_INT(iter->data);
+    if(job->storage->store(job->storage, job->sdata, id, job->format, job->fdata, num, total,
+                           options->high_quality, options->upscale))
+      job->failed = 1;
+  }
+
+  if(job->storage->finalize_store) job->storage->finalize_store(job->storage, job->sdata);
+
+  if(job->to_stdout && !job->failed) job->failed = _copy_to_stdout(job, options);
+}
+
+// the export pipes of the threads run side by side, every one on the first opencl device that is free. the
+// images of one job stay on one thread, their format and storage params carry state from one to the next.
+static void *_export_thread(void *data)
+{
+  dt_cli_queue_t *queue = (dt_cli_queue_t *)data;
+  int k;
+  while((k = __sync_fetch_and_add(&queue->next, 1)) < queue->count)
+    if(!queue->jobs[k]->failed) _job_export(queue->jobs[k], queue->options);
+  return NULL;
+}
+
+#ifdef HAVE_HTTP_SERVER
+
+#ifndef SOUP_CHECK_VERSION
+// SOUP_CHECK_VERSION was introduced only in 2.42
+#define SOUP_CHECK_VERSION(x, y, z) false
+#endif
+
+// renders waiting for a thread or running, any more requests are turned down until some of them are done
+#define DT_CLI_SERVER_QUEUE 64
+
+typedef struct dt_cli_server_t
+{
+  SoupServer *server;
+  GAsyncQueue *queue;
+  dt_cli_options_t options;
+  double start;
+  int running; // renders on the threads right now
+  // the others are only touched on the main thread
+  int pending;
+  int requests, rendered, failed, rejected;
+  double latency_sum, latency_max;
+} dt_cli_server_t;
+
+// one request of /render, handed from the main thread to an export thread and back
+typedef struct dt_cli_render_t
+{
+  dt_cli_server_t *server;
+  SoupMessage *msg;
+  dt_cli_job_t *job;
+  dt_cli_options_t options;
+  gchar *dirname; // temporary folder the image is exported to
+  gchar *data;    // the exported file, NULL if that failed
+  gsize size;
+  double start;
+} dt_cli_render_t;
+
+static void _render_free(dt_cli_render_t *render)
+{
+  if(render->dirname) _remove_folder(render->dirname);
+  if(render->msg) g_object_unref(render->msg);
+  if(render->job) _job_free(render->job);
+  g_free(render->dirname);
+  g_free(render->data);
+  free(render);
+}
+
+// the disk storage picked the name, the file is the only one in the folder
+static void _render_read(dt_cli_render_t *render)
+{
+  GDir *dir = g_dir_open(render->dirname, 0, NULL);
+  if(!dir) return;
+  const gchar *name = g_dir_read_name(dir);
+  if(name)
+  {
+    gchar *filename = g_build_filename(render->dirname, name, NULL);
+    if(!g_file_get_contents(filename, &render->data, &render->size, NULL)) render->data = NULL;
+    g_free(filename);
+  }
+  g_dir_close(dir);
+}
+
+// back on the main thread, libsoup isn't thread safe
+static gboolean _server_reply(gpointer user_data)
+{
+  dt_cli_render_t *render = (dt_cli_render_t *)user_data;
+  dt_cli_server_t *s = render->server;
+  const double latency = dt_get_wtime() - render->start;
+
+  if(render->data)
+  {
+    soup_message_set_status(render->msg, SOUP_STATUS_OK);
+    soup_message_set_response(render->msg, render->job->format->mime(render->job->fdata), SOUP_MEMORY_TAKE,
+                              render->data, render->size);
+    render->data = NULL;
+    s->rendered++;
+    s->latency_sum += latency;
+    s->latency_max = MAX(s->latency_max, latency);
+  }
+  else
+  {
+    soup_message_set_status(render->msg, SOUP_STATUS_INTERNAL_SERVER_ERROR);
+    s->failed++;
+  }
+  dt_print(DT_DEBUG_PERF, "[server] %s took %.3f secs\n", render->job->input_filename, latency);
+
+  soup_server_unpause_message(s->server, render->msg);
+  s->pending--;
+  _render_free(render);
+  return FALSE;
+}
+
+static void *_server_thread(void *data)
+{
+  dt_cli_server_t *s = (dt_cli_server_t *)data;
+  gpointer item;
+  // the server itself is queued to stop the thread
+  while((item = g_async_queue_pop(s->queue)) != s)
+  {
+    dt_cli_render_t *render = (dt_cli_render_t *)item;
+    __sync_fetch_and_add(&s->running, 1);
+    _job_export(render->job, &render->options);
+    if(!render->job->failed) _render_read(render);
+    __sync_fetch_and_sub(&s->running, 1);
+    g_idle_add(_server_reply, render);
+  }
+  return NULL;
+}
+
+static void _server_error(SoupMessage *msg, const guint status, const char *text)
+{
+  soup_message_set_status(msg, status);
+  soup_message_set_response(msg, "text/plain", SOUP_MEMORY_COPY, text, strlen(text));
+}
+
+// GET /render?image=<file>[&xmp=<file>][&width=<max width>][&height=<max height>][&format=<extension>]
+static void _server_render(SoupServer *server, SoupMessage *msg, const char *path, GHashTable *query,
+                           SoupClientContext *client, gpointer user_data)
+{
+  dt_cli_server_t *s = (dt_cli_server_t *)user_data;
+  s->requests++;
+
+  if(msg->method != SOUP_METHOD_GET)
+  {
+    soup_message_set_status(msg, SOUP_STATUS_NOT_IMPLEMENTED);
+    s->failed++;
+    return;
+  }
+
+  const char *image = query ? g_hash_table_lookup(query, "image") : NULL;
+  const char *xmp = query ? g_hash_table_lookup(query, "xmp") : NULL;
+  const char *format = query ? g_hash_table_lookup(query, "format") : NULL;
+  const char *width = query ? g_hash_table_lookup(query, "width") : NULL;
+  const char *height = query ? g_hash_table_lookup(query, "height") : NULL;
+  if(!format || !*format) format = "jpg";
+
+  // the format ends up in a file name the disk storage expands variables in
+  gboolean valid = image && *image;
+  for(const char *c = format; *c; c++) valid = valid && g_ascii_isalnum(*c);
+  if(!valid)
+  {
+    _server_error(msg, SOUP_STATUS_BAD_REQUEST, "usage: /render?image=<file>[&xmp=<file>][&width=<max width>]"
+                                                "[&height=<max height>][&format=<extension>]\n");
+    s->failed++;
+    return;
+  }
+
+  if(s->pending >= DT_CLI_SERVER_QUEUE)
+  {
+    _server_error(msg, SOUP_STATUS_SERVICE_UNAVAILABLE, "too many renders queued\n");
+    s->rejected++;
+    return;
+  }
+
+  dt_cli_render_t *render = (dt_cli_render_t *)calloc(1, sizeof(dt_cli_render_t));
+  render->server = s;
+  render->start = dt_get_wtime();
+  render->options = s->options;
+  if(width) render->options.width = MAX(atoi(width), 0);
+  if(height) render->options.height = MAX(atoi(height), 0);
+  render->dirname = g_dir_make_tmp("darktable-cli-XXXXXX", NULL);
+  if(!render->dirname)
+  {
+    _server_error(msg, SOUP_STATUS_INTERNAL_SERVER_ERROR, "can't create a temporary folder\n");
+    _render_free(render);
+    s->failed++;
+    return;
+  }
+
+  // importing goes through the database and stays on the main thread
+  gchar *output_filename = g_strdup_printf("%s/render.%s", render->dirname, format);
+  render->job = _job_new(image, xmp, output_filename);
+  render->job->reset_history = TRUE;
+  g_free(output_filename);
+  if(_job_prepare(render->job, &render->options))
+  {
+    _server_error(msg, SOUP_STATUS_UNPROCESSABLE_ENTITY, "can't export this image\n");
+    _render_free(render);
+    s->failed++;
+    return;
+  }
+
+  render->msg = g_object_ref(msg);
+  soup_server_pause_message(server, msg);
+  s->pending++;
+  g_async_queue_push(s->queue, render);
+}
+
+// GET /metrics, plain text counters since the server started
+static void _server_metrics(SoupServer *server, SoupMessage *msg, const char *path, GHashTable *query,
+                            SoupClientContext *client, gpointer user_data)
+{
+  dt_cli_server_t *s = (dt_cli_server_t *)user_data;
+  const double uptime = dt_get_wtime() - s->start;
+  gchar *body = g_strdup_printf("requests %d\nrendered %d\nfailed %d\nrejected %d\nqueued %d\nrunning %d\n"
+                                "latency_mean_seconds %.4f\nlatency_max_seconds %.4f\nrenders_per_second %.4f\n",
+                                s->requests, s->rendered, s->failed, s->rejected, s->pending - s->running,
+                                s->running, s->rendered ? s->latency_sum / s->rendered : 0.0, s->latency_max,
+                                uptime > 0.0 ? s->rendered / uptime : 0.0);
+  soup_message_set_status(msg, SOUP_STATUS_OK);
+  soup_message_set_response(msg, "text/plain", SOUP_MEMORY_TAKE, body, strlen(body));
+}
+
+#ifndef _WIN32
+static gboolean _server_quit(gpointer user_data)
+{
+  g_main_loop_quit((GMainLoop *)user_data);
+  return TRUE;
+}
+#endif
+
+// renders images on request until SIGINT or SIGTERM, keeping darktable, its caches and opencl up in between
+static int _server_run(const int port, const int num_threads, const dt_cli_options_t *options)
+{
+#if !SOUP_CHECK_VERSION(2, 48, 0)
+  fprintf(stderr, "%s\n", _("error: the render server needs libsoup 2.48 or newer"));
+  return 1;
+#else
+  dt_cli_server_t s = { 0 };
+  s.options = *options;
+  s.start = dt_get_wtime();
+
+  // only local clients, requests name any file the user running darktable-cli can read
+  GError *error = NULL;
+  s.server = soup_server_new(SOUP_SERVER_SERVER_HEADER, "darktable-cli", NULL);
+  if(!s.server || !soup_server_listen_local(s.server, port, 0, &error))
+  {
+    fprintf(stderr, _("error: can't listen on port %d: %s"), port, error ? error->message : "");
+    fprintf(stderr, "\n");
+    if(error) g_error_free(error);
+    if(s.server) g_object_unref(s.server);
+    return 1;
+  }
+  soup_server_add_handler(s.server, "/render", _server_render, &s, NULL);
+  soup_server_add_handler(s.server, "/metrics", _server_metrics, &s, NULL);
+
+  s.queue = g_async_queue_new();
+  pthread_t *threads = (pthread_t *)calloc(num_threads, sizeof(pthread_t));
+  int started = 0;
+  for(; started < num_threads; started++)
+    if(dt_pthread_create(&threads[started], _server_thread, &s)) break;
+  if(started == 0)
+  {
+    fprintf(stderr, "%s\n", _("error: can't start the render threads"));
+    free(threads);
+    g_async_queue_unref(s.queue);
+    g_object_unref(s.server);
+    return 1;
+  }
+
+  GMainLoop *loop = g_main_loop_new(NULL, FALSE);
+#ifndef _WIN32
+  g_unix_signal_add(SIGINT, _server_quit, loop);
+  g_unix_signal_add(SIGTERM, _server_quit, loop);
+#endif
+  printf("listening on http://localhost:%d/render and http://localhost:%d/metrics\n", port, port);
+  fflush(stdout);
+  g_main_loop_run(loop);
+
+  // the renders not started yet are dropped, the running ones finish
+  gpointer item;
+  while((item = g_async_queue_try_pop(s.queue))) _render_free((dt_cli_render_t *)item);
+  for(int t = 0; t < started; t++) g_async_queue_push(s.queue, &s);
+  for(int t = 0; t < started; t++) pthread_join(threads[t], NULL);
+  free(threads);
+
+  soup_server_disconnect(s.server);
+  g_object_unref(s.server);
+  g_main_loop_unref(loop);
+  g_async_queue_unref(s.queue);
+  return 0;
+#endif
 }
 
+#undef DT_CLI_SERVER_QUEUE
+
+#endif // HAVE_HTTP_SERVER
+
 int main(int argc, char *arg[])
 {
   bindtextdomain(GETTEXT_PACKAGE, DARKTABLE_LOCALEDIR);
@@ -68,14 +757,18 @@ int main(int argc, char *arg[])
   char *input_filename = NULL;
   char *xmp_filename = NULL;
   char *output_filename = NULL;
+  char *batch_filename = NULL;
+  int server_port = 0;
   int file_counter = 0;
-  int width = 0, height = 0, bpp = 0;
-  gboolean verbose = FALSE, high_quality = TRUE, upscale = FALSE;
+  int bpp = 0, num_jobs = 1;
+  dt_cli_options_t options = { .width = 0, .height = 0, .verbose = FALSE, .high_quality = TRUE, .upscale = FALSE,
+                               .out_ext = "jpg", .stdout_fd = STDOUT_FILENO };
 
   int k;
   for(k = 1; k < argc; k++)
   {
-    if(arg[k][0] == '-')
+    // a lone "-" is the output file stdout
+    if(arg[k][0] == '-' && arg[k][1] != '\0')
     {
       if(!strcmp(arg[k], "--help"))
       {
@@ -91,12 +784,12 @@ int main(int argc, char *arg[])
       else if(!strcmp(arg[k], "--width") && argc > k + 1)
       {
         k++;
-        width = MAX(atoi(arg[k]), 0);
+        options.width = MAX(atoi(arg[k]), 0);
       }
       else if(!strcmp(arg[k], "--height") && argc > k + 1)
       {
         k++;
-        height = MAX(atoi(arg[k]), 0);
+        options.height = MAX(atoi(arg[k]), 0);
       }
       else if(!strcmp(arg[k], "--bpp") && argc > k + 1)
       {
@@ -110,9 +803,9 @@ int main(int argc, char *arg[])
         k++;
         gchar *str = g_ascii_strup(arg[k], -1);
         if(!g_strcmp0(str, "0") || !g_strcmp0(str, "FALSE"))
-          high_quality = FALSE;
+          options.high_quality = FALSE;
         else if(!g_strcmp0(str, "1") || !g_strcmp0(str, "TRUE"))
-          high_quality = TRUE;
+          options.high_quality = TRUE;
         else
         {
           fprintf(stderr, "%s: %s\n", _("unknown option for --hq"), arg[k]);
@@ -126,9 +819,9 @@ int main(int argc, char *arg[])
         k++;
         gchar *str = g_ascii_strup(arg[k], -1);
         if(!g_strcmp0(str, "0") || !g_strcmp0(str, "FALSE"))
-          upscale = FALSE;
+          options.upscale = FALSE;
         else if(!g_strcmp0(str, "1") || !g_strcmp0(str, "TRUE"))
-          upscale= TRUE;
+          options.upscale= TRUE;
         else
         {
           fprintf(stderr, "%s: %s\n", _("unknown option for --upscale"), arg[k]);
@@ -137,9 +830,30 @@ int main(int argc, char *arg[])
         }
         g_free(str);
       }
+      else if(!strcmp(arg[k], "--batch") && argc > k + 1)
+      {
+        k++;
+        batch_filename = arg[k];
+      }
+      else if(!strcmp(arg[k], "--server") && argc > k + 1)
+      {
+        k++;
+        server_port = CLAMP(atoi(arg[k]), 1, 65535);
+      }
+      else if(!strcmp(arg[k], "--jobs") && argc > k + 1)
+      {
+        k++;
+        num_jobs = CLAMP(atoi(arg[k]), 1, 64);
+      }
+      else if(!strcmp(arg[k], "--out-ext") && argc > k + 1)
+      {
+        k++;
+        options.out_ext = arg[k];
+        if(options.out_ext[0] == '.') options.out_ext++;
+      }
       else if(!strcmp(arg[k], "-v") || !strcmp(arg[k], "--verbose"))
       {
-        verbose = TRUE;
+        options.verbose = TRUE;
       }
       else if(!strcmp(arg[k], "--core"))
       {
@@ -170,7 +884,8 @@ int main(int argc, char *arg[])
   for(; k < argc; k++) m_arg[m_argc++] = arg[k];
   m_arg[m_argc] = NULL;
 
-  if(file_counter < 2 || file_counter > 3)
+  if((server_port && (batch_filename || file_counter != 0))
+     || (!server_port && (!batch_filename || file_counter != 0) && (file_counter < 2 || file_counter > 3)))
   {
     usage(arg[0]);
     free(m_arg);
@@ -183,198 +898,111 @@ int main(int argc, char *arg[])
     xmp_filename = NULL;
   }
 
-  if(g_file_test(output_filename, G_FILE_TEST_IS_DIR))
-  {
-    fprintf(stderr, _("error: output file is a directory. please specify file name"));
-    fprintf(stderr, "\n");
-    free(m_arg);
-    exit(1);
-  }
-
-  // the output file already exists, so there will be a sequence number added
-  if(g_file_test(output_filename, G_FILE_TEST_EXISTS))
-  {
-    fprintf(stderr, "%s\n", _("output file already exists, it will get renamed"));
-  }
-
-  // init dt without gui and without data.db:
-  if(dt_init(m_argc, m_arg, FALSE, FALSE, NULL))
+  if(file_counter && !strcmp(output_filename, "-"))
   {
+#ifdef _WIN32
+    fprintf(stderr, "%s\n", _("error: writing the image to stdout isn't supported on windows"));
     free(m_arg);
     exit(1);
-  }
-
-  GList *id_list = NULL;
-
-  if(g_file_test(input_filename, G_FILE_TEST_IS_DIR))
-  {
-    int filmid = dt_film_import(input_filename);
-    if(!filmid)
+#else
+    // everything darktable prints goes to stderr from now on, stdout only gets the image
+    fflush(stdout);
+    options.stdout_fd = dup(STDOUT_FILENO);
+    if(options.stdout_fd < 0 || dup2(STDERR_FILENO, STDOUT_FILENO) < 0)
     {
-      fprintf(stderr, _("error: can't open folder %s"), input_filename);
-      fprintf(stderr, "\n");
-      free(m_arg);
-      exit(1);
-    }
-    id_list = dt_film_get_image_ids(filmid);
-  }
-  else
-  {
-    dt_film_t film;
-    int id = 0;
-    int filmid = 0;
-
-    gchar *directory = g_path_get_dirname(input_filename);
-    filmid = dt_film_new(&film, directory);
-    id = dt_image_import(filmid, input_filename, TRUE);
-    if(!id)
-    {
-      fprintf(stderr, _("error: can't open file %s"), input_filename);
-      fprintf(stderr, "\n");
+      fprintf(stderr, "%s\n", _("error: can't write to stdout"));
       free(m_arg);
       exit(1);
     }
-    g_free(directory);
-
-    id_list = g_list_append(id_list, GINT_TO_POINTER(id));
+#endif
   }
 
-  int total = g_list_length(id_list);
-
-  if(total == 0)
+  // all the jobs share one start of darktable: the modules, the caches and the compiled opencl programs
+  GPtrArray *jobs = g_ptr_array_new_with_free_func((GDestroyNotify)_job_free);
+  if(file_counter) g_ptr_array_add(jobs, _job_new(input_filename, xmp_filename, output_filename));
+  if(batch_filename && _read_batch_list(batch_filename, jobs))
   {
-    fprintf(stderr, _("no images to export, aborting\n"));
+    g_ptr_array_free(jobs, TRUE);
     free(m_arg);
     exit(1);
   }
 
-  // attach xmp, if requested:
-  if(xmp_filename)
-  {
-    for(GList *iter = id_list; iter; iter = g_list_next(iter))
-    {
-      int id = GPOINTER_TO_INT(iter->data);
-      dt_image_t *image = dt_image_cache_get(darktable.image_cache, id, 'w');
-      dt_exif_xmp_read(image, xmp_filename, 1);
-      // don't write new xmp:
-      dt_image_cache_write_release(darktable.image_cache, image, DT_IMAGE_CACHE_RELAXED);
-    }
-  }
-
-  // print the history stack. only look at the first image and assume all got the same processing applied
-  if(verbose)
+#ifndef HAVE_HTTP_SERVER
+  if(server_port)
   {
-    int id = GPOINTER_TO_INT(id_list->data);
-    gchar *history = dt_history_get_items_as_string(id);
-    if(history)
-      printf("%s\n", history);
-    else
-      printf("[%s]\n", _("empty history stack"));
-  }
-
-  // try to find out the export format from the output_filename
-  char *ext = output_filename + strlen(output_filename);
-  while(ext > output_filename && *ext != '.') ext--;
-  *ext = '\0';
-  ext++;
-
-  if(!strcmp(ext, "jpg")) ext = "jpeg";
-
-  if(!strcmp(ext, "tif")) ext = "tiff";
-
-  // init the export data structures
-  dt_imageio_module_format_t *format;
-  dt_imageio_module_storage_t *storage;
-  dt_imageio_module_data_t *sdata, *fdata;
-
-  storage = dt_imageio_get_storage_by_name("disk"); // only exporting to disk makes sense
-  if(storage == NULL)
-  {
-    fprintf(
-        stderr, "%s\n",
-        _("cannot find disk storage module. please check your installation, something seems to be broken."));
-    free(m_arg);
-    exit(1);
-  }
-
-  sdata = storage->get_params(storage);
-  if(sdata == NULL)
-  {
-    fprintf(stderr, "%s\n", _("failed to get parameters from storage module, aborting export ..."));
+    fprintf(stderr, "%s\n", _("error: darktable-cli was built without libsoup, there is no render server"));
+    g_ptr_array_free(jobs, TRUE);
     free(m_arg);
     exit(1);
   }
+#endif
 
-  // and now for the really ugly hacks. don't tell your children about this one or they won't sleep at night
-  // any longer ...
-  g_strlcpy((char *)sdata, output_filename, DT_MAX_PATH_FOR_PARAMS);
-  // all is good now, the last line didn't happen.
-
-  format = dt_imageio_get_format_by_name(ext);
-  if(format == NULL)
+  // init dt without gui and without data.db:
+  if(dt_init(m_argc, m_arg, FALSE, FALSE, NULL))
   {
-    fprintf(stderr, _("unknown extension '.%s'"), ext);
-    fprintf(stderr, "\n");
+    g_ptr_array_free(jobs, TRUE);
     free(m_arg);
     exit(1);
   }
 
-  fdata = format->get_params(format);
-  if(fdata == NULL)
+#ifdef HAVE_HTTP_SERVER
+  if(server_port)
   {
-    fprintf(stderr, "%s\n", _("failed to get parameters from format module, aborting export ..."));
+    const int res = _server_run(server_port, num_jobs, &options);
+    g_ptr_array_free(jobs, TRUE);
+    dt_cleanup();
     free(m_arg);
-    exit(1);
+    return res;
   }
+#endif
 
-  uint32_t w, h, fw, fh, sw, sh;
-  fw = fh = sw = sh = 0;
-  storage->dimension(storage, sdata, &sw, &sh);
-  format->dimension(format, fdata, &fw, &fh);
-
-  if(sw == 0 || fw == 0)
-    w = sw > fw ? sw : fw;
-  else
-    w = sw < fw ? sw : fw;
-
-  if(sh == 0 || fh == 0)
-    h = sh > fh ? sh : fh;
-  else
-    h = sh < fh ? sh : fh;
-
-  fdata->max_width = width;
-  fdata->max_height = height;
-  fdata->max_width = (w != 0 && fdata->max_width > w) ? w : fdata->max_width;
-  fdata->max_height = (h != 0 && fdata->max_height > h) ? h : fdata->max_height;
-  fdata->style[0] = '\0';
-  fdata->style_append = 0;
-
-  if(storage->initialize_store)
+  // importing goes through the database, which is done up front
+  int failed = 0;
+  for(guint i = 0; i < jobs->len; i++)
   {
-    storage->initialize_store(storage, sdata, &format, &fdata, &id_list, high_quality, upscale);
-
-    format->set_params(format, fdata, format->params_size(format));
-    storage->set_params(storage, sdata, storage->params_size(storage));
+    dt_cli_job_t *job = (dt_cli_job_t *)g_ptr_array_index(jobs, i);
+    if(_job_prepare(job, &options))
+    {
+      job->failed = 1;
+      // a single export fails as a whole, a batch goes on with the other jobs
+      if(!batch_filename)
+      {
+        g_ptr_array_free(jobs, TRUE);
+        free(m_arg);
+        exit(1);
+      }
+    }
   }
 
-  // TODO: add a callback to set the bpp without going through the config
-
-  int num = 1;
-  for(GList *iter = id_list; iter; iter = g_list_next(iter), num++)
+  dt_cli_queue_t queue = { .jobs = (dt_cli_job_t **)jobs->pdata, .count = jobs->len, .next = 0, .options = &options };
+  num_jobs = MIN(num_jobs, jobs->len);
+  pthread_t *threads = (pthread_t *)calloc(num_jobs, sizeof(pthread_t));
+  int num_threads = 0;
+  for(; num_threads < num_jobs - 1; num_threads++)
+    if(dt_pthread_create(&threads[num_threads], _export_thread, &queue)) break;
+  _export_thread(&queue);
+  for(int t = 0; t < num_threads; t++) pthread_join(threads[t], NULL);
+  free(threads);
+
+  for(guint i = 0; i < jobs->len; i++)
   {
-    int id = GPOINTER_TO_INT(iter->data);
-    storage->store(storage, sdata, id, format, fdata, num, total, high_quality, upscale);
+    dt_cli_job_t *job = (dt_cli_job_t *)g_ptr_array_index(jobs, i);
+    if(!job->failed) continue;
+    failed = 1;
+    if(batch_filename)
+    {
+      fprintf(stderr, _("error: exporting %s failed"), job->input_filename);
+      fprintf(stderr, "\n");
+    }
   }
 
   // cleanup time
-  if(storage->finalize_store) storage->finalize_store(storage, sdata);
-  storage->free_params(storage, sdata);
-  format->free_params(format, fdata);
-  g_list_free(id_list);
+  g_ptr_array_free(jobs, TRUE);
 
   dt_cleanup();
 
   free(m_arg);
+  return failed;
 }
 
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
@@ -19,29 +19,398 @@
 #include "common/darktable.h"
 #include "common/opencl.h"
 
+#ifdef HAVE_OPENCL
+#include "common/bilateral.h"
+#include "common/bilateralcl.h"
+#include "common/gaussian.h"
+#include "common/locallaplacian.h"
+#include "common/locallaplaciancl.h"
+#include <glib/gstdio.h>
+#include <math.h>
+#include <stdio.h>
+#endif
+
+#include <string.h>
+
 #ifdef _WIN32
 #include <conio.h>
 #include "win/main_wrapper.h"
 #endif
 
+#ifdef HAVE_OPENCL
+
+// parameters of the kernels, close to the defaults of the modules using them
+#define DT_CLTEST_GAUSSIAN_SIGMA 20.0f
+#define DT_CLTEST_BILATERAL_SIGMA_S 20.0f
+#define DT_CLTEST_BILATERAL_SIGMA_R 10.0f
+#define DT_CLTEST_BILATERAL_DETAIL 0.5f
+
+// the benchmark images are square with these sides, the larger ones only on devices they fit on
+static const int _sizes[] = { 512, 1024, 2048, 4096 };
+
+typedef struct dt_cltest_kernel_t
+{
+  const char *name;
+  float tolerance; // largest difference of the device result to the cpu one still counted as correct, in L
+  float factor;    // memory the kernel needs on the device, in multiples of the input
+  cl_int (*process_cl)(const int devid, cl_mem dev_in, cl_mem dev_out, const int width, const int height);
+  void (*process)(const float *const in, float *const out, const int width, const int height);
+} dt_cltest_kernel_t;
+
+static cl_int _gaussian_cl(const int devid, cl_mem dev_in, cl_mem dev_out, const int width, const int height)
+{
+  const float max[4] = { INFINITY, INFINITY, INFINITY, INFINITY };
+  const float min[4] = { -INFINITY, -INFINITY, -INFINITY, -INFINITY };
+  dt_gaussian_cl_t *g = dt_gaussian_init_cl(devid, width, height, 4, max, min, DT_CLTEST_GAUSSIAN_SIGMA, 0);
+  if(!g) return -666;
+  const cl_int err = dt_gaussian_blur_cl(g, dev_in, dev_out);
+  dt_gaussian_free_cl(g);
+  return err;
+}
+
+static void _gaussian(const float *const in, float *const out, const int width, const int height)
+{
+  const float max[4] = { INFINITY, INFINITY, INFINITY, INFINITY };
+  const float min[4] = { -INFINITY, -INFINITY, -INFINITY, -INFINITY };
+  dt_gaussian_t *g = dt_gaussian_init(width, height, 4, max, min, DT_CLTEST_GAUSSIAN_SIGMA, 0);
+  if(!g) return;
+  dt_gaussian_blur_4c(g, in, out);
+  dt_gaussian_free(g);
+}
+
+static cl_int _bilateral_cl(const int devid, cl_mem dev_in, cl_mem dev_out, const int width, const int height)
+{
+  dt_bilateral_cl_t *b
+      = dt_bilateral_init_cl(devid, width, height, DT_CLTEST_BILATERAL_SIGMA_S, DT_CLTEST_BILATERAL_SIGMA_R);
+  if(!b) return -666;
+  cl_int err = dt_bilateral_splat_cl(b, dev_in);
+  if(err == CL_SUCCESS) err = dt_bilateral_blur_cl(b);
+  if(err == CL_SUCCESS) err = dt_bilateral_slice_cl(b, dev_in, dev_out, DT_CLTEST_BILATERAL_DETAIL);
+  dt_bilateral_free_cl(b);
+  return err;
+}
+
+static void _bilateral(const float *const in, float *const out, const int width, const int height)
+{
+  dt_bilateral_t *b = dt_bilateral_init(width, height, DT_CLTEST_BILATERAL_SIGMA_S, DT_CLTEST_BILATERAL_SIGMA_R);
+  if(!b) return;
+  dt_bilateral_splat(b, in);
+  dt_bilateral_blur(b);
+  dt_bilateral_slice(b, in, out, DT_CLTEST_BILATERAL_DETAIL);
+  dt_bilateral_free(b);
+}
+
+static cl_int _local_laplacian_cl(const int devid, cl_mem dev_in, cl_mem dev_out, const int width,
+                                  const int height)
+{
+  dt_local_laplacian_cl_t *l = dt_local_laplacian_init_cl(devid, width, height, 0.2f, 1.0f, 1.0f, 0.2f);
+  if(!l) return -666;
+  const cl_int err = dt_local_laplacian_cl(l, dev_in, dev_out);
+  dt_local_laplacian_free_cl(l);
+  return err;
+}
+
+static void _local_laplacian(const float *const in, float *const out, const int width, const int height)
+{
+  local_laplacian(in, out, width, height, 0.2f, 1.0f, 1.0f, 0.2f, 0);
+}
+
+// the local laplacian on the cpu picks the curves it processes from the range of the image, the device uses
+// all of them
+static const dt_cltest_kernel_t _kernels[] = {
+  { "gaussian", 0.01f, 3.0f, _gaussian_cl, _gaussian },
+  { "bilateral", 0.5f, 3.0f, _bilateral_cl, _bilateral },
+  { "local_laplacian", 2.0f, 10.0f, _local_laplacian_cl, _local_laplacian },
+};
+#define DT_CLTEST_KERNELS ((int)G_N_ELEMENTS(_kernels))
+
+typedef struct dt_cltest_t
+{
+  int runs;      // timed runs of every kernel and transfer, after one to warm up
+  FILE *profile; // NULL if none is written
+  int mismatches;
+} dt_cltest_t;
+
+// size bucket of the learned routing, see develop/pixelpipe_routing.c
+static int _bucket(const int width, const int height)
+{
+  return MAX(0, (int)(log2(MAX((double)width * height, 1.0)) / 2.0));
+}
+
+// a row of the profile, laid out like data.module_timings. time is in seconds per megapixel, or per megabyte
+// for the transfers.
+static void _profile_row(dt_cltest_t *t, const char *operation, const char *device, const int width,
+                         const int height, const double time)
+{
+  if(t->profile)
+    fprintf(t->profile, "%s\t%s\t%d\t%.9f\t%d\n", operation, device, _bucket(width, height), time, t->runs);
+}
+
+// a smooth Lab image with some noise on it, the same on every run
+static void _fill_image(float *const buf, const int width, const int height)
+{
+#ifdef _OPENMP
+#pragma omp parallel for default(none) schedule(static)
+#endif
+  for(int j = 0; j < height; j++)
+    for(int i = 0; i < width; i++)
+    {
+      uint32_t h = (uint32_t)(j * width + i) * 2654435761u;
+      h ^= h >> 15;
+      const float noise = (h & 0xffff) / 65535.0f - 0.5f;
+      float *const px = buf + (size_t)4 * (j * width + i);
+      px[0] = CLAMPS(50.0f + 40.0f * sinf(i * 0.011f) * cosf(j * 0.007f) + 10.0f * noise, 0.0f, 100.0f);
+      px[1] = 30.0f * sinf((i + j) * 0.003f);
+      px[2] = 30.0f * cosf((i - j) * 0.005f);
+      px[3] = 0.0f;
+    }
+}
+
+static double _mbytes(const int width, const int height)
+{
+  return (double)width * height * 4 * sizeof(float) * 1e-6;
+}
+
+// seconds of one blocking copy from host to dev_mem and back, averaged over the runs
+static int _time_transfer(const dt_cltest_t *t, const int devid, float *host, cl_mem dev_mem, const int width,
+                          const int height, double *up, double *down)
+{
+  const int bpp = 4 * sizeof(float);
+  if(dt_opencl_write_host_to_device(devid, host, dev_mem, width, height, bpp) != CL_SUCCESS) return 1;
+
+  double start = dt_get_wtime();
+  for(int r = 0; r < t->runs; r++)
+    if(dt_opencl_write_host_to_device(devid, host, dev_mem, width, height, bpp) != CL_SUCCESS) return 1;
+  *up = (dt_get_wtime() - start) / t->runs;
+
+  start = dt_get_wtime();
+  for(int r = 0; r < t->runs; r++)
+    if(dt_opencl_read_host_from_device(devid, host, dev_mem, width, height, bpp) != CL_SUCCESS) return 1;
+  *down = (dt_get_wtime() - start) / t->runs;
+  return 0;
+}
+
+// host to device and back, from ordinary memory as the pixelpipe does and from pinned memory as tiling does
+static void _bench_transfer(dt_cltest_t *t, const int devid, float *const host, cl_mem dev_mem, const int width,
+                            const int height)
+{
+  const char *device = darktable.opencl->dev[devid].cname;
+  const size_t size = (size_t)width * height * 4 * sizeof(float);
+  const double mb = _mbytes(width, height);
+
+  double up = 0.0, down = 0.0;
+  if(_time_transfer(t, devid, host, dev_mem, width, height, &up, &down))
+  {
+    printf("  %-16s %4dx%-4d  failed\n", "transfer", width, height);
+    return;
+  }
+  printf("  %-16s %4dx%-4d  pageable up %8.1f MB/s, down %8.1f MB/s", "transfer", width, height, mb / up,
+         mb / down);
+  _profile_row(t, "_transfer", device, width, height, up / mb);
+  _profile_row(t, "_transfer_down", device, width, height, down / mb);
+
+  cl_mem pinned = dt_opencl_alloc_device_buffer_with_flags(devid, size, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR);
+  float *mapped = pinned ? dt_opencl_map_buffer(devid, pinned, CL_TRUE, CL_MAP_READ | CL_MAP_WRITE, 0, size) : NULL;
+  if(mapped)
+  {
+    memcpy(mapped, host, size);
+    if(!_time_transfer(t, devid, mapped, dev_mem, width, height, &up, &down))
+    {
+      printf(", pinned up %8.1f MB/s, down %8.1f MB/s", mb / up, mb / down);
+      _profile_row(t, "_transfer_pinned", device, width, height, up / mb);
+      _profile_row(t, "_transfer_pinned_down", device, width, height, down / mb);
+    }
+    dt_opencl_unmap_mem_object(devid, pinned, mapped);
+    dt_opencl_finish(devid);
+  }
+  printf("\n");
+  dt_opencl_release_mem_object(pinned);
+}
+
+// times a kernel on the device and compares its output to the one of the cpu, cpu_out is computed already
+static void _bench_kernel(dt_cltest_t *t, const int devid, const dt_cltest_kernel_t *k, cl_mem dev_in,
+                          cl_mem dev_out, const float *const cpu_out, float *const out, const int width,
+                          const int height, const double cpu_time)
+{
+  const char *device = darktable.opencl->dev[devid].cname;
+  const double mpix = (double)width * height * 1e-6;
+
+  // one run to warm up: some drivers compile the kernels only on their first use
+  cl_int err = k->process_cl(devid, dev_in, dev_out, width, height);
+  if(err == CL_SUCCESS && !dt_opencl_finish(devid)) err = -666;
+
+  const double start = dt_get_wtime();
+  for(int r = 0; r < t->runs && err == CL_SUCCESS; r++) err = k->process_cl(devid, dev_in, dev_out, width, height);
+  if(err == CL_SUCCESS && !dt_opencl_finish(devid)) err = -666;
+  const double time = (dt_get_wtime() - start) / t->runs;
+
+  if(err == CL_SUCCESS) err = dt_opencl_read_host_from_device(devid, out, dev_out, width, height, 4 * sizeof(float));
+  if(err != CL_SUCCESS)
+  {
+    printf("  %-16s %4dx%-4d  failed (%d)\n", k->name, width, height, err);
+    t->mismatches++;
+    return;
+  }
+
+  // only the colour channels, the fourth one carries whatever the kernels leave in there
+  double max_error = 0.0, sum_error = 0.0;
+  for(size_t p = 0; p < (size_t)width * height; p++)
+    for(int c = 0; c < 3; c++)
+    {
+      const double e = fabs((double)out[4 * p + c] - cpu_out[4 * p + c]);
+      max_error = isnan(e) ? INFINITY : MAX(max_error, e);
+      sum_error += e;
+    }
+  const int ok = max_error <= k->tolerance;
+  if(!ok) t->mismatches++;
+
+  printf("  %-16s %4dx%-4d  %9.3f ms  %8.1f MP/s  cpu %8.1f MP/s  error max %.4f mean %.5f  %s\n", k->name, width,
+         height, 1000.0 * time, mpix / time, mpix / cpu_time, max_error, sum_error / (3.0 * width * height),
+         ok ? "ok" : "MISMATCH");
+  _profile_row(t, k->name, device, width, height, time / mpix);
+}
+
+static void _bench_device(dt_cltest_t *t, const int devid, const int width, const int height, float *const in,
+                          float *const *const cpu_out, const double *const cpu_time, float *const out)
+{
+  const int bpp = 4 * sizeof(float);
+  cl_mem dev_in = dt_opencl_copy_host_to_device(devid, in, width, height, bpp);
+  cl_mem dev_out = dt_opencl_alloc_device(devid, width, height, bpp);
+  if(!dev_in || !dev_out)
+    printf("  %4dx%-4d  can't allocate the buffers\n", width, height);
+  else
+  {
+    // the transfers copy the input to the device and back, which leaves both as they are
+    _bench_transfer(t, devid, in, dev_in, width, height);
+    for(int k = 0; k < DT_CLTEST_KERNELS; k++)
+    {
+      if(!cpu_out[k]) continue;
+      if(!dt_opencl_image_fits_device(devid, width, height, bpp, _kernels[k].factor, 0))
+      {
+        printf("  %-16s %4dx%-4d  doesn't fit on the device\n", _kernels[k].name, width, height);
+        continue;
+      }
+      _bench_kernel(t, devid, &_kernels[k], dev_in, dev_out, cpu_out[k], out, width, height, cpu_time[k]);
+    }
+  }
+  dt_opencl_release_mem_object(dev_in);
+  dt_opencl_release_mem_object(dev_out);
+}
+
+// runs every kernel at every size on every device, 0 if all of them match the cpu
+static int _bench(dt_cltest_t *t)
+{
+  dt_opencl_t *cl = darktable.opencl;
+  if(!cl->inited || cl->num_devs == 0)
+  {
+    fprintf(stderr, "[cltest] no opencl device to benchmark\n");
+    return 1;
+  }
+
+  // the programs are built in the background at startup
+  while(!dt_opencl_is_ready()) g_usleep(100000);
+
+  if(t->profile)
+    fprintf(t->profile, "# operation\tdevice\tbucket\tseconds per megapixel (megabyte for transfers)\truns\n");
+
+  for(int s = 0; s < (int)G_N_ELEMENTS(_sizes); s++)
+  {
+    const int width = _sizes[s], height = _sizes[s];
+    const size_t size = (size_t)width * height * 4 * sizeof(float);
+    float *in = dt_alloc_align(64, size);
+    float *out = dt_alloc_align(64, size);
+    float *cpu_out[DT_CLTEST_KERNELS] = { NULL };
+    double cpu_time[DT_CLTEST_KERNELS] = { 0.0 };
+    if(!in || !out)
+    {
+      fprintf(stderr, "[cltest] out of memory for %dx%d\n", width, height);
+      dt_free_align(in);
+      dt_free_align(out);
+      break;
+    }
+    _fill_image(in, width, height);
+
+    // the reference, computed and timed once for all devices
+    const double mpix = (double)width * height * 1e-6;
+    for(int k = 0; k < DT_CLTEST_KERNELS; k++)
+    {
+      if(!(cpu_out[k] = dt_alloc_align(64, size))) continue;
+      const double start = dt_get_wtime();
+      _kernels[k].process(in, cpu_out[k], width, height);
+      cpu_time[k] = dt_get_wtime() - start;
+      _profile_row(t, _kernels[k].name, "cpu", width, height, cpu_time[k] / mpix);
+    }
+
+    for(int devid = 0; devid < cl->num_devs; devid++)
+    {
+      if(cl->dev[devid].ready != 1) continue;
+      printf("[cltest] %s, %dx%d\n", cl->dev[devid].name, width, height);
+      dt_pthread_mutex_lock(&cl->dev[devid].lock);
+      _bench_device(t, devid, width, height, in, cpu_out, cpu_time, out);
+      dt_pthread_mutex_unlock(&cl->dev[devid].lock);
+    }
+
+    for(int k = 0; k < DT_CLTEST_KERNELS; k++) dt_free_align(cpu_out[k]);
+    dt_free_align(in);
+    dt_free_align(out);
+  }
+
+  if(t->mismatches) printf("[cltest] %d results don't match the cpu\n", t->mismatches);
+  return t->mismatches != 0;
+}
+
+#endif // HAVE_OPENCL
+
 int main(int argc, char *arg[])
 {
   int result = 1;
+  int bench = 0;
+#ifdef HAVE_OPENCL
+  dt_cltest_t t = { .runs = 5, .profile = NULL, .mismatches = 0 };
+#endif
   // only used to force-init opencl, so we want these options:
   char *m_arg[] = { "-d", "opencl", "--library", ":memory:"};
   const int m_argc = sizeof(m_arg) / sizeof(m_arg[0]);
   char **argv = malloc(argc * sizeof(arg[0]) + sizeof(m_arg));
   if(!argv) goto end;
+  // our own options, everything else goes to the core
+  int n = 0;
   for(int i = 0; i < argc; i++)
-    argv[i] = arg[i];
+  {
+    if(i > 0 && !strcmp(arg[i], "--bench"))
+      bench = 1;
+#ifdef HAVE_OPENCL
+    else if(i > 0 && !strcmp(arg[i], "--runs") && i + 1 < argc)
+      t.runs = CLAMP(atoi(arg[++i]), 1, 1000);
+    else if(i > 0 && !strcmp(arg[i], "--profile") && i + 1 < argc)
+    {
+      bench = 1;
+      i++;
+      if(!t.profile && !(t.profile = g_fopen(arg[i], "w")))
+      {
+        fprintf(stderr, "[cltest] can't write profile `%s'\n", arg[i]);
+        free(argv);
+        goto end;
+      }
+    }
+#endif
+    else
+      argv[n++] = arg[i];
+  }
   for(int i = 0; i < m_argc; i++)
-    argv[argc + i] = m_arg[i];
-  argc += m_argc;
+    argv[n + i] = m_arg[i];
+  argc = n + m_argc;
   if(dt_init(argc, argv, FALSE, FALSE, NULL)) goto end;
+  result = 0;
+#ifdef HAVE_OPENCL
+  if(bench) result = _bench(&t);
+  if(t.profile) fclose(t.profile);
+#else
+  if(bench) fprintf(stderr, "[cltest] darktable was built without opencl\n");
+#endif
   dt_cleanup();
   free(argv);
 
-  result = 0;
 end:
 
 #ifdef _WIN32
@@ -53,6 +422,14 @@ end:
   exit(result);
 }
 
+#ifdef HAVE_OPENCL
+#undef DT_CLTEST_GAUSSIAN_SIGMA
+#undef DT_CLTEST_BILATERAL_SIGMA_S
+#undef DT_CLTEST_BILATERAL_SIGMA_R
+#undef DT_CLTEST_BILATERAL_DETAIL
+#undef DT_CLTEST_KERNELS
+#endif
+
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
 // kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
@@ -125,80 +125,64 @@ void dt_bilateral_splat(dt_bilateral_t *b, const float *const in)
   const int ox = 1;
   const int oy = b->size_x;
   const int oz = b->size_y * b->size_x;
-// splat into downsampled grid
-#ifdef _OPENMP
-#pragma omp parallel for default(none) shared(b)
-#endif
-  for(int j = 0; j < b->height; j++)
+  const float contrib = 100.0f / (b->sigma_s * b->sigma_s);
+
+  // the image rows of slab s are the ones splatted to grid rows s and s+1, so slabs two apart never touch
+  // the same cells. splat all even slabs in parallel, then all odd ones, and the threads never collide.
+  const int num_slabs = b->size_y - 1;
+  int *const slab = malloc(sizeof(int) * (num_slabs + 1));
+  for(int s = 0, j = 0; s <= num_slabs; s++)
   {
-    size_t index = 4 * j * b->width;
-    for(int i = 0; i < b->width; i++)
+    for(; j < b->height; j++)
     {
       float x, y, z;
-      const float L = in[index];
-      image_to_grid(b, i, j, L, &x, &y, &z);
-      const int xi = MIN((int)x, b->size_x - 2);
-      const int yi = MIN((int)y, b->size_y - 2);
-      const int zi = MIN((int)z, b->size_z - 2);
-      const float xf = x - xi;
-      const float yf = y - yi;
-      const float zf = z - zi;
-      // nearest neighbour splatting:
-      const size_t grid_index = xi + b->size_x * (yi + b->size_y * zi);
-      // sum up payload here, doesn't have to be same as edge stopping data
-      // for cross bilateral applications.
-      // also note that this is not clipped (as L->z is), so potentially hdr/out of gamut
-      // should not cause clipping here.
-      for(int k = 0; k < 8; k++)
-      {
-        const size_t ii = grid_index + ((k & 1) ? ox : 0) + ((k & 2) ? oy : 0) + ((k & 4) ? oz : 0);
-        const float contrib = ((k & 1) ? xf : (1.0f - xf)) * ((k & 2) ? yf : (1.0f - yf))
-                              * ((k & 4) ? zf : (1.0f - zf)) * 100.0f / (b->sigma_s * b->sigma_s);
-#ifdef _OPENMP
-#pragma omp atomic
-#endif
-        b->buf[ii] += contrib;
-      }
-      index += 4;
+      image_to_grid(b, 0, j, 0.0f, &x, &y, &z);
+      if(MIN((int)y, b->size_y - 2) >= s) break;
     }
+    slab[s] = j;
   }
-}
+  slab[num_slabs] = b->height;
 
-static void blur_line_z(float *buf, const int offset1, const int offset2, const int offset3, const int size1,
-                        const int size2, const int size3)
-{
-  const float w1 = 4.f / 16.f;
-  const float w2 = 2.f / 16.f;
+  for(int parity = 0; parity < 2; parity++)
+  {
+// splat into downsampled grid
 #ifdef _OPENMP
-#pragma omp parallel for default(none) shared(buf)
+#pragma omp parallel for default(none) shared(b, parity) schedule(dynamic)
 #endif
-  for(int k = 0; k < size1; k++)
-  {
-    size_t index = (size_t)k * offset1;
-    for(int j = 0; j < size2; j++)
+    for(int s = parity; s < num_slabs; s += 2)
     {
-      float tmp1 = buf[index];
-      buf[index] = w1 * buf[index + offset3] + w2 * buf[index + 2 * offset3];
-      index += offset3;
-      float tmp2 = buf[index];
-      buf[index] = w1 * (buf[index + offset3] - tmp1) + w2 * buf[index + 2 * offset3];
-      index += offset3;
-      for(int i = 2; i < size3 - 2; i++)
+      for(int j = slab[s]; j < slab[s + 1]; j++)
       {
-        const float tmp3 = buf[index];
-        buf[index] = +w1 * (buf[index + offset3] - tmp2) + w2 * (buf[index + 2 * offset3] - tmp1);
-        index += offset3;
-        tmp1 = tmp2;
-        tmp2 = tmp3;
+        size_t index = (size_t)4 * j * b->width;
+        for(int i = 0; i < b->width; i++)
+        {
+          float x, y, z;
+          const float L = in[index];
+          image_to_grid(b, i, j, L, &x, &y, &z);
+          const int xi = MIN((int)x, b->size_x - 2);
+          const int yi = MIN((int)y, b->size_y - 2);
+          const int zi = MIN((int)z, b->size_z - 2);
+          const float xf = x - xi;
+          const float yf = y - yi;
+          const float zf = z - zi;
+          // nearest neighbour splatting:
+          const size_t grid_index = xi + b->size_x * (yi + b->size_y * zi);
+          // sum up payload here, doesn't have to be same as edge stopping data
+          // for cross bilateral applications.
+          // also note that this is not clipped (as L->z is), so potentially hdr/out of gamut
+          // should not cause clipping here.
+          for(int k = 0; k < 8; k++)
+          {
+            const size_t ii = grid_index + ((k & 1) ? ox : 0) + ((k & 2) ? oy : 0) + ((k & 4) ? oz : 0);
+            b->buf[ii] += ((k & 1) ? xf : (1.0f - xf)) * ((k & 2) ? yf : (1.0f - yf))
+                          * ((k & 4) ? zf : (1.0f - zf)) * contrib;
+          }
+          index += 4;
+        }
       }
-      const float tmp3 = buf[index];
-      buf[index] = w1 * (buf[index + offset3] - tmp2) - w2 * tmp1;
-      index += offset3;
-      buf[index] = -w1 * tmp3 - w2 * tmp2;
-      index += offset3;
-      index += offset2 - offset3 * size3;
     }
   }
+  free(slab);
 }
 
 static void blur_line(float *buf, const int offset1, const int offset2, const int offset3, const int size1,
@@ -241,60 +225,173 @@ static void blur_line(float *buf, const int offset1, const int offset2, const in
 }
 
 
+// the lines of blur_line() and blur_line_z() across the rows of the grid: size1 sets of size_x lines next to
+// each other, offset1 apart, along which the filter runs with stride offset3. a block of neighbouring lines
+// is filtered at once, so the inner loops run over contiguous memory: out = w0 * b + w1 * (b[+1] + s * b[-1])
+// + w2 * (b[+2] + s * b[-2]), where s is 1 for the gaussian and -1 for its derivative.
+#define DT_BILATERAL_BLUR_BLOCK 64
+static void blur_lines_across(float *buf, const int offset1, const int offset3, const int size1, const int size3,
+                              const int size_x, const float w0, const float w1, const float w2, const float s)
+{
+  const int blocks = (size_x + DT_BILATERAL_BLUR_BLOCK - 1) / DT_BILATERAL_BLUR_BLOCK;
+#ifdef _OPENMP
+#pragma omp parallel for default(none) shared(buf) collapse(2) schedule(static)
+#endif
+  for(int k = 0; k < size1; k++)
+    for(int i0 = 0; i0 < blocks; i0++)
+    {
+      const int x0 = i0 * DT_BILATERAL_BLUR_BLOCK;
+      const int n = MIN(DT_BILATERAL_BLUR_BLOCK, size_x - x0);
+      float p1[DT_BILATERAL_BLUR_BLOCK] = { 0.0f }, p2[DT_BILATERAL_BLUR_BLOCK] = { 0.0f };
+      float *line = buf + (size_t)k * offset1 + x0;
+      for(int i = 0; i < size3 - 2; i++)
+      {
+        for(int c = 0; c < n; c++)
+        {
+          const float v = line[c];
+          line[c] = w0 * v + w1 * (line[c + offset3] + s * p1[c]) + w2 * (line[c + 2 * offset3] + s * p2[c]);
+          p2[c] = p1[c];
+          p1[c] = v;
+        }
+        line += offset3;
+      }
+      for(int c = 0; c < n; c++)
+      {
+        const float v = line[c];
+        line[c] = w0 * v + w1 * (line[c + offset3] + s * p1[c]) + w2 * s * p2[c];
+        p2[c] = p1[c];
+        p1[c] = v;
+      }
+      line += offset3;
+      for(int c = 0; c < n; c++) line[c] = w0 * line[c] + w1 * s * p1[c] + w2 * s * p2[c];
+    }
+}
+#undef DT_BILATERAL_BLUR_BLOCK
+
 void dt_bilateral_blur(dt_bilateral_t *b)
 {
   // gaussian up to 3 sigma
   blur_line(b->buf, b->size_x * b->size_y, b->size_x, 1, b->size_z, b->size_y, b->size_x);
   // gaussian up to 3 sigma
-  blur_line(b->buf, b->size_x * b->size_y, 1, b->size_x, b->size_z, b->size_x, b->size_y);
+  blur_lines_across(b->buf, b->size_x * b->size_y, b->size_x, b->size_z, b->size_y, b->size_x, 6.f / 16.f,
+                    4.f / 16.f, 1.f / 16.f, 1.0f);
   // -2 derivative of the gaussian up to 3 sigma: x*exp(-x*x)
-  blur_line_z(b->buf, 1, b->size_x, b->size_x * b->size_y, b->size_x, b->size_y, b->size_z);
+  blur_lines_across(b->buf, b->size_x, b->size_x * b->size_y, b->size_y, b->size_z, b->size_x, 0.0f, 4.f / 16.f,
+                    2.f / 16.f, -1.0f);
 }
 
 
-void dt_bilateral_slice(const dt_bilateral_t *const b, const float *const in, float *out, const float detail)
+// trilinear lookup of the grid for the pixels of row j, the x coordinates of the columns are the same for all
+// rows and come precomputed. written for the compiler to vectorize, with the loads as gathers on avx2 and
+// avx512.
+DT_ALWAYS_INLINE void slice_row_plain(const dt_bilateral_t *const b, const float *const in, const int *const xi,
+                                      const float *const xf, const int j, float *const v)
 {
-  // detail: 0 is leave as is, -1 is bilateral filtered, +1 is contrast boost
-  const float norm = -detail * b->sigma_r * 0.04f;
   const int ox = 1;
   const int oy = b->size_x;
   const int oz = b->size_y * b->size_x;
+  const int width = b->width;
+  const int zmax = b->size_z - 2;
+  const float zclamp = b->size_z - 1;
+  const float sigma_r = b->sigma_r;
+  const float *const buf = b->buf;
+  float x, y, z;
+  image_to_grid(b, 0, j, 0.0f, &x, &y, &z);
+  const int yi = MIN((int)y, b->size_y - 2);
+  const float yf = y - yi;
+  const float *const row = buf + (size_t)b->size_x * yi;
+  for(int i = 0; i < width; i++)
+  {
+    const float zz = CLAMPS(in[4 * i] / sigma_r, 0, zclamp);
+    const int zi = MIN((int)zz, zmax);
+    const float zf = zz - zi;
+    const float fx = xf[i];
+    const size_t gi = xi[i] + (size_t)oz * zi;
+    v[i] = row[gi] * (1.0f - fx) * (1.0f - yf) * (1.0f - zf) + row[gi + ox] * (fx) * (1.0f - yf) * (1.0f - zf)
+           + row[gi + oy] * (1.0f - fx) * (yf) * (1.0f - zf) + row[gi + ox + oy] * (fx) * (yf) * (1.0f - zf)
+           + row[gi + oz] * (1.0f - fx) * (1.0f - yf) * (zf) + row[gi + ox + oz] * (fx) * (1.0f - yf) * (zf)
+           + row[gi + oy + oz] * (1.0f - fx) * (yf) * (zf) + row[gi + ox + oy + oz] * (fx) * (yf) * (zf);
+  }
+}
+
+typedef void(slice_row_func)(const dt_bilateral_t *const b, const float *const in, const int *const xi,
+                             const float *const xf, const int j, float *const v);
+
+#ifdef DT_TARGET_AVX2
+static DT_TARGET_AVX2 void slice_row_avx2(const dt_bilateral_t *const b, const float *const in,
+                                          const int *const xi, const float *const xf, const int j,
+                                          float *const v)
+{
+  slice_row_plain(b, in, xi, xf, j, v);
+}
+
+static DT_TARGET_AVX512 void slice_row_avx512(const dt_bilateral_t *const b, const float *const in,
+                                              const int *const xi, const float *const xf, const int j,
+                                              float *const v)
+{
+  slice_row_plain(b, in, xi, xf, j, v);
+}
+#endif
+
+static void slice_row_plain_func(const dt_bilateral_t *const b, const float *const in, const int *const xi,
+                                 const float *const xf, const int j, float *const v)
+{
+  slice_row_plain(b, in, xi, xf, j, v);
+}
+
+static slice_row_func *slice_row_function(void)
+{
+#ifdef DT_TARGET_AVX2
+  if(darktable.codepath.AVX512) return slice_row_avx512;
+  if(darktable.codepath.AVX2) return slice_row_avx2;
+#endif
+  return slice_row_plain_func;
+}
+
+// grid column and weight of every image column, shared by all rows
+static void slice_columns(const dt_bilateral_t *const b, int *const xi, float *const xf)
+{
+  for(int i = 0; i < b->width; i++)
+  {
+    float x, y, z;
+    image_to_grid(b, i, 0, 0.0f, &x, &y, &z);
+    xi[i] = MIN((int)x, b->size_x - 2);
+    xf[i] = x - xi[i];
+  }
+}
+
+void dt_bilateral_slice(const dt_bilateral_t *const b, const float *const in, float *out, const float detail)
+{
+  // detail: 0 is leave as is, -1 is bilateral filtered, +1 is contrast boost
+  const float norm = -detail * b->sigma_r * 0.04f;
+  slice_row_func *const slice_row = slice_row_function();
+  const int width = b->width;
+  int *const xi = dt_alloc_align(64, sizeof(int) * width);
+  float *const xf = dt_alloc_align(64, sizeof(float) * width);
+  float *const rows = dt_alloc_align(64, sizeof(float) * width * dt_get_num_threads());
+  slice_columns(b, xi, xf);
 #ifdef _OPENMP
 #pragma omp parallel for default(none) shared(out)
 #endif
   for(int j = 0; j < b->height; j++)
   {
-    size_t index = 4 * j * b->width;
-    for(int i = 0; i < b->width; i++)
+    const size_t index = (size_t)4 * j * width;
+    float *const v = rows + (size_t)width * dt_get_thread_num();
+    slice_row(b, in + index, xi, xf, j, v);
+    for(int i = 0; i < width; i++)
     {
-      float x, y, z;
-      const float L = in[index];
-      image_to_grid(b, i, j, L, &x, &y, &z);
-      // trilinear lookup:
-      const int xi = MIN((int)x, b->size_x - 2);
-      const int yi = MIN((int)y, b->size_y - 2);
-      const int zi = MIN((int)z, b->size_z - 2);
-      const float xf = x - xi;
-      const float yf = y - yi;
-      const float zf = z - zi;
-      const size_t gi = xi + b->size_x * (yi + b->size_y * zi);
-      const float Lout = L
-                         + norm * (b->buf[gi] * (1.0f - xf) * (1.0f - yf) * (1.0f - zf)
-                                   + b->buf[gi + ox] * (xf) * (1.0f - yf) * (1.0f - zf)
-                                   + b->buf[gi + oy] * (1.0f - xf) * (yf) * (1.0f - zf)
-                                   + b->buf[gi + ox + oy] * (xf) * (yf) * (1.0f - zf)
-                                   + b->buf[gi + oz] * (1.0f - xf) * (1.0f - yf) * (zf)
-                                   + b->buf[gi + ox + oz] * (xf) * (1.0f - yf) * (zf)
-                                   + b->buf[gi + oy + oz] * (1.0f - xf) * (yf) * (zf)
-                                   + b->buf[gi + ox + oy + oz] * (xf) * (yf) * (zf));
-      out[index] = Lout;
-      // and copy color and mask
-      out[index + 1] = in[index + 1];
-      out[index + 2] = in[index + 2];
-      out[index + 3] = in[index + 3];
-      index += 4;
+      // copy color and mask with the new L
+      const size_t k = index + 4 * i;
+      const float Lout = in[k] + norm * v[i];
+      out[k + 1] = in[k + 1];
+      out[k + 2] = in[k + 2];
+      out[k + 3] = in[k + 3];
+      out[k] = Lout;
     }
   }
+  dt_free_align(rows);
+  dt_free_align(xf);
+  dt_free_align(xi);
 }
 
 void dt_bilateral_slice_to_output(const dt_bilateral_t *const b, const float *const in, float *out,
@@ -302,40 +399,25 @@ void dt_bilateral_slice_to_output(const dt_bilateral_t *const b, const float *co
 {
   // detail: 0 is leave as is, -1 is bilateral filtered, +1 is contrast boost
   const float norm = -detail * b->sigma_r * 0.04f;
-  const int ox = 1;
-  const int oy = b->size_x;
-  const int oz = b->size_y * b->size_x;
+  slice_row_func *const slice_row = slice_row_function();
+  const int width = b->width;
+  int *const xi = dt_alloc_align(64, sizeof(int) * width);
+  float *const xf = dt_alloc_align(64, sizeof(float) * width);
+  float *const rows = dt_alloc_align(64, sizeof(float) * width * dt_get_num_threads());
+  slice_columns(b, xi, xf);
 #ifdef _OPENMP
 #pragma omp parallel for default(none) shared(out)
 #endif
   for(int j = 0; j < b->height; j++)
   {
-    size_t index = 4 * j * b->width;
-    for(int i = 0; i < b->width; i++)
-    {
-      float x, y, z;
-      const float L = in[index];
-      image_to_grid(b, i, j, L, &x, &y, &z);
-      // trilinear lookup:
-      const int xi = MIN((int)x, b->size_x - 2);
-      const int yi = MIN((int)y, b->size_y - 2);
-      const int zi = MIN((int)z, b->size_z - 2);
-      const float xf = x - xi;
-      const float yf = y - yi;
-      const float zf = z - zi;
-      const size_t gi = xi + b->size_x * (yi + b->size_y * zi);
-      const float Lout = norm * (b->buf[gi] * (1.0f - xf) * (1.0f - yf) * (1.0f - zf)
-                                 + b->buf[gi + ox] * (xf) * (1.0f - yf) * (1.0f - zf)
-                                 + b->buf[gi + oy] * (1.0f - xf) * (yf) * (1.0f - zf)
-                                 + b->buf[gi + ox + oy] * (xf) * (yf) * (1.0f - zf)
-                                 + b->buf[gi + oz] * (1.0f - xf) * (1.0f - yf) * (zf)
-                                 + b->buf[gi + ox + oz] * (xf) * (1.0f - yf) * (zf)
-                                 + b->buf[gi + oy + oz] * (1.0f - xf) * (yf) * (zf)
-                                 + b->buf[gi + ox + oy + oz] * (xf) * (yf) * (zf));
-      out[index] = MAX(0.0f, out[index] + Lout);
-      index += 4;
-    }
+    const size_t index = (size_t)4 * j * width;
+    float *const v = rows + (size_t)width * dt_get_thread_num();
+    slice_row(b, in + index, xi, xf, j, v);
+    for(int i = 0; i < width; i++) out[index + 4 * i] = MAX(0.0f, out[index + 4 * i] + norm * v[i]);
   }
+  dt_free_align(rows);
+  dt_free_align(xf);
+  dt_free_align(xi);
 }
 
 void dt_bilateral_free(dt_bilateral_t *b)
@@ -0,0 +1,287 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2017 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "common/buffer_pool.h"
+#include "common/darktable.h"
+#include "control/conf.h"
+
+#include <assert.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <string.h>
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
+
+#define DT_BUFFER_POOL_MAGIC 0x64746270u
+// every buffer starts with its header, the caller gets what follows
+#define DT_BUFFER_POOL_HEADER ((size_t)64)
+// smaller buffers are not worth a mapping of their own
+#define DT_BUFFER_POOL_MIN_SIZE ((size_t)1 << 20)
+#define DT_BUFFER_POOL_HUGE_PAGE ((size_t)2 << 20)
+
+typedef struct dt_buffer_pool_header_t
+{
+  uint32_t magic;
+  uint32_t mapped;                // from _buffer_map(), else from dt_alloc_align()
+  size_t size;                    // of the whole block, header included
+  dt_memory_consumer_t *consumer; // what it is accounted to while in use
+} dt_buffer_pool_header_t;
+
+static struct
+{
+  int initialized;
+  dt_pthread_mutex_t lock; // protects the idle queue and the stats
+  GQueue *idle;            // headers of buffers waiting for reuse, most recently freed first
+  size_t idle_size;        // bytes in there
+  size_t idle_quota, idle_quota_configured;
+  int hugetlb; // try MAP_HUGETLB first
+  dt_memory_consumer_t memory;
+  // stats:
+  uint64_t hits, misses, maps, unmaps;
+} _pool = { 0 };
+
+// huge page multiples, and above 16MB four classes per doubling. wastes at most a quarter of a buffer, and
+// buffers of similar sizes, like those of one pipe at slightly different zoom, are reused for each other.
+static size_t _buffer_class_size(const size_t size)
+{
+  size_t n = (size + DT_BUFFER_POOL_HEADER + DT_BUFFER_POOL_HUGE_PAGE - 1) & ~(DT_BUFFER_POOL_HUGE_PAGE - 1);
+  if(n > 8 * DT_BUFFER_POOL_HUGE_PAGE)
+  {
+    size_t p = 8 * DT_BUFFER_POOL_HUGE_PAGE;
+    while(2 * p <= n) p *= 2;
+    const size_t step = p / 4;
+    n = (n + step - 1) / step * step;
+  }
+  return n;
+}
+
+static void *_buffer_map(const size_t size)
+{
+#ifdef _WIN32
+  return dt_alloc_align(DT_BUFFER_POOL_HEADER, size);
+#else
+#ifdef MAP_HUGETLB
+  if(_pool.hugetlb)
+  {
+    void *mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if(mem != MAP_FAILED) return mem;
+    // no huge pages reserved, or not enough of them. don't try again for every buffer.
+    dt_print(DT_DEBUG_MEMORY, "[buffer_pool] MAP_HUGETLB failed, falling back to transparent huge pages\n");
+    _pool.hugetlb = 0;
+  }
+#endif
+  // map one huge page more to be able to align the buffer to one, and give back what sticks out
+  const size_t mapped = size + DT_BUFFER_POOL_HUGE_PAGE;
+  char *mem = (char *)mmap(NULL, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if(mem == MAP_FAILED) return NULL;
+  char *aligned = (char *)(((uintptr_t)mem + DT_BUFFER_POOL_HUGE_PAGE - 1) & ~(DT_BUFFER_POOL_HUGE_PAGE - 1));
+  if(aligned > mem) munmap(mem, aligned - mem);
+  if(mem + mapped > aligned + size) munmap(aligned + size, mem + mapped - (aligned + size));
+#ifdef MADV_HUGEPAGE
+  madvise(aligned, size, MADV_HUGEPAGE);
+#endif
+  return aligned;
+#endif
+}
+
+static void _buffer_unmap(dt_buffer_pool_header_t *header)
+{
+#ifdef _WIN32
+  dt_free_align(header);
+#else
+  munmap(header, header->size);
+#endif
+}
+
+static size_t _pool_memory_usage(void *data)
+{
+  return _pool.idle_size;
+}
+
+static size_t _pool_memory_reclaim(void *data, size_t wanted)
+{
+  return dt_buffer_pool_trim(wanted);
+}
+
+static void _pool_memory_limit(void *data, float fraction)
+{
+  dt_pthread_mutex_lock(&_pool.lock);
+  _pool.idle_quota = _pool.idle_quota_configured * fraction;
+  const size_t excess = _pool.idle_size > _pool.idle_quota ? _pool.idle_size - _pool.idle_quota : 0;
+  dt_pthread_mutex_unlock(&_pool.lock);
+  if(excess) dt_buffer_pool_trim(excess);
+}
+
+void dt_buffer_pool_init(void)
+{
+  dt_pthread_mutex_init(&_pool.lock, NULL);
+  _pool.idle = g_queue_new();
+  _pool.idle_size = 0;
+  _pool.idle_quota = _pool.idle_quota_configured = (size_t)MAX(dt_conf_get_int64("buffer_pool_memory"), 0) << 20;
+  _pool.hugetlb = dt_conf_get_bool("buffer_pool_hugetlb");
+  _pool.hits = _pool.misses = _pool.maps = _pool.unmaps = 0;
+  // idle buffers are cheaper to lose than anything a cache holds
+  _pool.memory = (dt_memory_consumer_t){ .name = "buffer pool",
+                                         .usage = _pool_memory_usage,
+                                         .reclaim = _pool_memory_reclaim,
+                                         .limit = _pool_memory_limit,
+                                         .priority = -1 };
+  dt_memory_register(darktable.memory, &_pool.memory);
+  _pool.initialized = 1;
+}
+
+void dt_buffer_pool_cleanup(void)
+{
+  if(!_pool.initialized) return;
+  dt_memory_unregister(darktable.memory, &_pool.memory);
+  dt_buffer_pool_trim(SIZE_MAX);
+  dt_print(DT_DEBUG_MEMORY, "[buffer_pool] %" PRIu64 " buffers reused, %" PRIu64 " mapped, %" PRIu64
+                            " unmapped\n",
+           _pool.hits, _pool.maps, _pool.unmaps);
+  // buffers still in use are unmapped when they are freed
+  _pool.initialized = 0;
+  g_queue_free(_pool.idle);
+  _pool.idle = NULL;
+  dt_pthread_mutex_destroy(&_pool.lock);
+}
+
+void *dt_buffer_pool_alloc(dt_memory_consumer_t *consumer, size_t size)
+{
+  dt_buffer_pool_header_t *header = NULL;
+  const size_t small = size + DT_BUFFER_POOL_HEADER;
+  const size_t block = small < DT_BUFFER_POOL_MIN_SIZE ? small : _buffer_class_size(size);
+
+  // the governor gets to make room before anything is mapped
+  if(consumer) dt_memory_reserve(darktable.memory, consumer, block);
+
+  if(small < DT_BUFFER_POOL_MIN_SIZE)
+  {
+    header = (dt_buffer_pool_header_t *)dt_alloc_align(DT_BUFFER_POOL_HEADER, block);
+    if(header) header->mapped = 0;
+  }
+  else
+  {
+    if(_pool.initialized)
+    {
+      dt_pthread_mutex_lock(&_pool.lock);
+      for(GList *l = _pool.idle->head; l; l = g_list_next(l))
+      {
+        dt_buffer_pool_header_t *h = (dt_buffer_pool_header_t *)l->data;
+        if(h->size != block) continue;
+        g_queue_delete_link(_pool.idle, l);
+        _pool.idle_size -= block;
+        header = h;
+        break;
+      }
+      if(header)
+        _pool.hits++;
+      else
+        _pool.misses++;
+      dt_pthread_mutex_unlock(&_pool.lock);
+    }
+    if(!header)
+    {
+      if(!consumer) dt_memory_make_room(darktable.memory, block);
+      header = (dt_buffer_pool_header_t *)_buffer_map(block);
+      if(header)
+      {
+        header->mapped = 1;
+        __sync_fetch_and_add(&_pool.maps, 1);
+      }
+    }
+  }
+
+  if(!header)
+  {
+    if(consumer) dt_memory_release(darktable.memory, consumer, block);
+    return NULL;
+  }
+  header->magic = DT_BUFFER_POOL_MAGIC;
+  header->size = block;
+  header->consumer = consumer;
+  return (char *)header + DT_BUFFER_POOL_HEADER;
+}
+
+void dt_buffer_pool_free(void *mem)
+{
+  if(!mem) return;
+  dt_buffer_pool_header_t *header = (dt_buffer_pool_header_t *)((char *)mem - DT_BUFFER_POOL_HEADER);
+  assert(header->magic == DT_BUFFER_POOL_MAGIC);
+  if(header->consumer) dt_memory_release(darktable.memory, header->consumer, header->size);
+  header->consumer = NULL;
+
+  if(!header->mapped)
+  {
+    header->magic = 0;
+    dt_free_align(header);
+    return;
+  }
+
+  if(_pool.initialized)
+  {
+    dt_pthread_mutex_lock(&_pool.lock);
+    const int keep = _pool.idle_size + header->size <= _pool.idle_quota;
+    if(keep)
+    {
+      g_queue_push_head(_pool.idle, header);
+      _pool.idle_size += header->size;
+    }
+    dt_pthread_mutex_unlock(&_pool.lock);
+    if(keep) return;
+  }
+  header->magic = 0;
+  __sync_fetch_and_add(&_pool.unmaps, 1);
+  _buffer_unmap(header);
+}
+
+size_t dt_buffer_pool_trim(size_t wanted)
+{
+  if(!_pool.initialized) return 0;
+  GList *trimmed = NULL;
+  size_t freed = 0;
+  dt_pthread_mutex_lock(&_pool.lock);
+  while(freed < wanted && !g_queue_is_empty(_pool.idle))
+  {
+    dt_buffer_pool_header_t *header = (dt_buffer_pool_header_t *)g_queue_pop_tail(_pool.idle);
+    _pool.idle_size -= header->size;
+    freed += header->size;
+    trimmed = g_list_prepend(trimmed, header);
+  }
+  dt_pthread_mutex_unlock(&_pool.lock);
+
+  // outside the lock, munmap takes its time
+  for(GList *l = trimmed; l; l = g_list_next(l))
+  {
+    dt_buffer_pool_header_t *header = (dt_buffer_pool_header_t *)l->data;
+    header->magic = 0;
+    __sync_fetch_and_add(&_pool.unmaps, 1);
+    _buffer_unmap(header);
+  }
+  g_list_free(trimmed);
+  return freed;
+}
+
+#undef DT_BUFFER_POOL_MAGIC
+#undef DT_BUFFER_POOL_HEADER
+#undef DT_BUFFER_POOL_MIN_SIZE
+#undef DT_BUFFER_POOL_HUGE_PAGE
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
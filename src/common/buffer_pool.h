@@ -0,0 +1,45 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2017 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "common/memory.h"
+#include <stddef.h>
+
+/*
+ * pool of large pixel buffers. they are mapped in size classes aligned to huge pages, so the kernel can back
+ * them with transparent huge pages (or hugetlbfs, with buffer_pool_hugetlb), and freed buffers are kept around
+ * to serve the next pipe run without mmap/munmap and page faults. idle buffers count against the memory budget
+ * and are the first thing the governor takes back.
+ * small requests are served by dt_alloc_align(). without dt_buffer_pool_init() nothing is kept for reuse.
+ */
+
+void dt_buffer_pool_init(void);
+void dt_buffer_pool_cleanup(void);
+
+// 64 byte aligned buffer of at least size bytes, accounted to consumer (may be NULL) until it is freed.
+// has to be freed with dt_buffer_pool_free(), never with dt_free_align().
+void *dt_buffer_pool_alloc(dt_memory_consumer_t *consumer, size_t size);
+void dt_buffer_pool_free(void *mem);
+
+// unmaps idle buffers, oldest first, until about wanted bytes are gone. returns how much was unmapped.
+size_t dt_buffer_pool_trim(size_t wanted);
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
@@ -25,57 +25,107 @@
 #include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
-// this implements a concurrent LRU cache
+// this implements a concurrent LRU cache, split into independently locked segments
 
-void dt_cache_init(
+static inline dt_cache_segment_t *_cache_segment(dt_cache_t *cache, const uint32_t key)
+{
+  // fibonacci hashing, so that consecutive keys (and the mip level bits in the
+  // upper part of mipmap keys) are spread evenly over the segments:
+  const uint32_t h = key * 2654435761u;
+  return cache->segments + (h >> 16) % cache->num_segments;
+}
+
+void dt_cache_init_segmented(
     dt_cache_t *cache,
     size_t entry_size,
-    size_t cost_quota)
+    size_t cost_quota,
+    uint32_t num_segments)
 {
+  uint32_t n = 1;
+  while(n < num_segments && n < 256) n <<= 1;
+
   cache->cost = 0;
-  cache->lru = 0;
   cache->entry_size = entry_size;
   cache->cost_quota = cost_quota;
-  dt_pthread_mutex_init(&cache->lock, 0);
   cache->allocate = 0;
   cache->allocate_data = 0;
   cache->cleanup = 0;
   cache->cleanup_data = 0;
-  cache->hashtable = g_hash_table_new(0, 0);
+  cache->stats_hits = cache->stats_misses = cache->stats_evictions = 0;
+  cache->num_segments = n;
+  cache->segments = (dt_cache_segment_t *)calloc(n, sizeof(dt_cache_segment_t));
+  for(uint32_t k = 0; k < n; k++)
+  {
+    dt_cache_segment_t *seg = cache->segments + k;
+    seg->cost = 0;
+    seg->cost_quota = MAX(1, cost_quota / n);
+    seg->lru = 0;
+    seg->hashtable = g_hash_table_new(0, 0);
+    dt_pthread_mutex_init(&seg->lock, 0);
+  }
 }
 
-void dt_cache_cleanup(dt_cache_t *cache)
+void dt_cache_set_cost_quota(dt_cache_t *cache, size_t cost_quota)
 {
-  g_hash_table_destroy(cache->hashtable);
-  GList *l = cache->lru;
-  while(l)
+  cache->cost_quota = cost_quota;
+  for(uint32_t k = 0; k < cache->num_segments; k++)
   {
-    dt_cache_entry_t *entry = (dt_cache_entry_t *)l->data;
+    dt_cache_segment_t *seg = cache->segments + k;
+    dt_pthread_mutex_lock(&seg->lock);
+    seg->cost_quota = MAX(1, cost_quota / cache->num_segments);
+    dt_pthread_mutex_unlock(&seg->lock);
+  }
+}
 
-    if(cache->cleanup)
+void dt_cache_init(
+    dt_cache_t *cache,
+    size_t entry_size,
+    size_t cost_quota)
+{
+  dt_cache_init_segmented(cache, entry_size, cost_quota, 1);
+}
+
+void dt_cache_cleanup(dt_cache_t *cache)
+{
+  for(uint32_t k = 0; k < cache->num_segments; k++)
+  {
+    dt_cache_segment_t *seg = cache->segments + k;
+    g_hash_table_destroy(seg->hashtable);
+    GList *l = seg->lru;
+    while(l)
     {
-      assert(entry->data_size);
-      ASAN_UNPOISON_MEMORY_REGION(entry->data, entry->data_size);
+      dt_cache_entry_t *entry = (dt_cache_entry_t *)l->data;
 
-      cache->cleanup(cache->cleanup_data, entry);
-    }
-    else
-      dt_free_align(entry->data);
+      if(cache->cleanup)
+      {
+        assert(entry->data_size);
+        ASAN_UNPOISON_MEMORY_REGION(entry->data, entry->data_size);
 
-    dt_pthread_rwlock_destroy(&entry->lock);
-    g_slice_free1(sizeof(*entry), entry);
-    l = g_list_next(l);
+        cache->cleanup(cache->cleanup_data, entry);
+      }
+      else
+        dt_free_align(entry->data);
+
+      dt_pthread_rwlock_destroy(&entry->lock);
+      g_slice_free1(sizeof(*entry), entry);
+      l = g_list_next(l);
+    }
+    g_list_free(seg->lru);
+    dt_pthread_mutex_destroy(&seg->lock);
   }
-  g_list_free(cache->lru);
-  dt_pthread_mutex_destroy(&cache->lock);
+  free(cache->segments);
+  cache->segments = 0;
+  cache->num_segments = 0;
 }
 
 int32_t dt_cache_contains(dt_cache_t *cache, const uint32_t key)
 {
-  dt_pthread_mutex_lock(&cache->lock);
-  int32_t result = g_hash_table_contains(cache->hashtable, GINT_TO_POINTER(key));
-  dt_pthread_mutex_unlock(&cache->lock);
+  dt_cache_segment_t *seg = _cache_segment(cache, key);
+  dt_pthread_mutex_lock(&seg->lock);
+  int32_t result = g_hash_table_contains(seg->hashtable, GINT_TO_POINTER(key));
+  dt_pthread_mutex_unlock(&seg->lock);
   return result;
 }
 
@@ -84,22 +134,26 @@ int dt_cache_for_all(
     int (*process)(const uint32_t key, const void *data, void *user_data),
     void *user_data)
 {
-  dt_pthread_mutex_lock(&cache->lock);
-  GHashTableIter iter;
-  gpointer key, value;
-
-  g_hash_table_iter_init (&iter, cache->hashtable);
-  while (g_hash_table_iter_next (&iter, &key, &value))
+  for(uint32_t k = 0; k < cache->num_segments; k++)
   {
-    dt_cache_entry_t *entry = (dt_cache_entry_t *)value;
-    const int err = process(GPOINTER_TO_INT(key), entry->data, user_data);
-    if(err)
+    dt_cache_segment_t *seg = cache->segments + k;
+    dt_pthread_mutex_lock(&seg->lock);
+    GHashTableIter iter;
+    gpointer key, value;
+
+    g_hash_table_iter_init (&iter, seg->hashtable);
+    while (g_hash_table_iter_next (&iter, &key, &value))
     {
-      dt_pthread_mutex_unlock(&cache->lock);
-      return err;
+      dt_cache_entry_t *entry = (dt_cache_entry_t *)value;
+      const int err = process(GPOINTER_TO_INT(key), entry->data, user_data);
+      if(err)
+      {
+        dt_pthread_mutex_unlock(&seg->lock);
+        return err;
+      }
     }
+    dt_pthread_mutex_unlock(&seg->lock);
   }
-  dt_pthread_mutex_unlock(&cache->lock);
   return 0;
 }
 
@@ -110,10 +164,11 @@ dt_cache_entry_t *dt_cache_testget(dt_cache_t *cache, const uint32_t key, char m
   gpointer orig_key, value;
   gboolean res;
   int result;
+  dt_cache_segment_t *seg = _cache_segment(cache, key);
   double start = dt_get_wtime();
-  dt_pthread_mutex_lock(&cache->lock);
+  dt_pthread_mutex_lock(&seg->lock);
   res = g_hash_table_lookup_extended(
-      cache->hashtable, GINT_TO_POINTER(key), &orig_key, &value);
+      seg->hashtable, GINT_TO_POINTER(key), &orig_key, &value);
   if(res)
   {
     dt_cache_entry_t *entry = (dt_cache_entry_t *)value;
@@ -123,13 +178,13 @@ dt_cache_entry_t *dt_cache_testget(dt_cache_t *cache, const uint32_t key, char m
     if(result)
     { // need to give up mutex so other threads have a chance to get in between and
       // free the lock we're trying to acquire:
-      dt_pthread_mutex_unlock(&cache->lock);
+      dt_pthread_mutex_unlock(&seg->lock);
       return 0;
     }
     // bubble up in lru list:
-    cache->lru = g_list_remove_link(cache->lru, entry->link);
-    cache->lru = g_list_concat(cache->lru, entry->link);
-    dt_pthread_mutex_unlock(&cache->lock);
+    seg->lru = g_list_remove_link(seg->lru, entry->link);
+    seg->lru = g_list_concat(seg->lru, entry->link);
+    dt_pthread_mutex_unlock(&seg->lock);
     double end = dt_get_wtime();
     if(end - start > 0.1)
       fprintf(stderr, "try+ wait time %.06fs mode %c \n", end - start, mode);
@@ -144,13 +199,57 @@ dt_cache_entry_t *dt_cache_testget(dt_cache_t *cache, const uint32_t key, char m
 
     return entry;
   }
-  dt_pthread_mutex_unlock(&cache->lock);
+  dt_pthread_mutex_unlock(&seg->lock);
   double end = dt_get_wtime();
   if(end - start > 0.1)
     fprintf(stderr, "try- wait time %.06fs\n", end - start);
   return 0;
 }
 
+// best-effort garbage collection of one segment, the segment lock must be held by the caller.
+static void _cache_segment_gc(dt_cache_t *cache, dt_cache_segment_t *seg, const float fill_ratio)
+{
+  GList *l = seg->lru;
+  while(l)
+  {
+    dt_cache_entry_t *entry = (dt_cache_entry_t *)l->data;
+    assert(entry->link->data == entry);
+    l = g_list_next(l); // we might remove this element, so walk to the next one while we still have the pointer..
+    if(seg->cost < seg->cost_quota * fill_ratio) break;
+
+    // if still locked by anyone else give up:
+    if(dt_pthread_rwlock_trywrlock(&entry->lock)) continue;
+
+    if(entry->_lock_demoting)
+    {
+      // oops, we are currently demoting (rw -> r) lock to this entry in some thread. do not touch!
+      dt_pthread_rwlock_unlock(&entry->lock);
+      continue;
+    }
+
+    // delete!
+    g_hash_table_remove(seg->hashtable, GINT_TO_POINTER(entry->key));
+    seg->lru = g_list_delete_link(seg->lru, entry->link);
+    seg->cost -= entry->cost;
+    __sync_fetch_and_sub(&cache->cost, entry->cost);
+    __sync_fetch_and_add(&cache->stats_evictions, 1);
+
+    if(cache->cleanup)
+    {
+      assert(entry->data_size);
+      ASAN_UNPOISON_MEMORY_REGION(entry->data, entry->data_size);
+
+      cache->cleanup(cache->cleanup_data, entry);
+    }
+    else
+      dt_free_align(entry->data);
+
+    dt_pthread_rwlock_unlock(&entry->lock);
+    dt_pthread_rwlock_destroy(&entry->lock);
+    g_slice_free1(sizeof(*entry), entry);
+  }
+}
+
 // if found, the data void* is returned. if not, it is set to be
 // the given *data and a new hash table entry is created, which can be
 // found using the given key later on.
@@ -159,11 +258,12 @@ dt_cache_entry_t *dt_cache_get_with_caller(dt_cache_t *cache, const uint32_t key
   gpointer orig_key, value;
   gboolean res;
   int result;
+  dt_cache_segment_t *seg = _cache_segment(cache, key);
   double start = dt_get_wtime();
 restart:
-  dt_pthread_mutex_lock(&cache->lock);
+  dt_pthread_mutex_lock(&seg->lock);
   res = g_hash_table_lookup_extended(
-      cache->hashtable, GINT_TO_POINTER(key), &orig_key, &value);
+      seg->hashtable, GINT_TO_POINTER(key), &orig_key, &value);
   if(res)
   { // yay, found. read lock and pass on.
     dt_cache_entry_t *entry = (dt_cache_entry_t *)value;
@@ -172,14 +272,15 @@ restart:
     if(result)
     { // need to give up mutex so other threads have a chance to get in between and
       // free the lock we're trying to acquire:
-      dt_pthread_mutex_unlock(&cache->lock);
+      dt_pthread_mutex_unlock(&seg->lock);
       g_usleep(5);
       goto restart;
     }
     // bubble up in lru list:
-    cache->lru = g_list_remove_link(cache->lru, entry->link);
-    cache->lru = g_list_concat(cache->lru, entry->link);
-    dt_pthread_mutex_unlock(&cache->lock);
+    seg->lru = g_list_remove_link(seg->lru, entry->link);
+    seg->lru = g_list_concat(seg->lru, entry->link);
+    dt_pthread_mutex_unlock(&seg->lock);
+    __sync_fetch_and_add(&cache->stats_hits, 1);
 
 #ifdef _DEBUG
     const pthread_t writer = dt_pthread_rwlock_get_writer(&entry->lock);
@@ -208,12 +309,14 @@ restart:
 
   // first try to clean up.
   // also wait if we can't free more than the requested fill ratio.
-  if(cache->cost > 0.8f * cache->cost_quota)
+  if(seg->cost > 0.8f * seg->cost_quota)
   {
     // need to roll back all the way to get a consistent lock state:
-    dt_cache_gc(cache, 0.8f);
+    _cache_segment_gc(cache, seg, 0.8f);
   }
 
+  __sync_fetch_and_add(&cache->stats_misses, 1);
+
   // here dies your 32-bit system:
   dt_cache_entry_t *entry = (dt_cache_entry_t *)g_slice_alloc(sizeof(dt_cache_entry_t));
   int ret = dt_pthread_rwlock_init(&entry->lock, 0);
@@ -225,7 +328,7 @@ restart:
   entry->key = key;
   entry->_lock_demoting = 0;
 
-  g_hash_table_insert(cache->hashtable, GINT_TO_POINTER(key), entry);
+  g_hash_table_insert(seg->hashtable, GINT_TO_POINTER(key), entry);
 
   assert(cache->allocate || entry->data_size);
 
@@ -244,12 +347,13 @@ restart:
   if(write) dt_pthread_rwlock_wrlock_with_caller(&entry->lock, file, line);
   else      dt_pthread_rwlock_rdlock_with_caller(&entry->lock, file, line);
 
-  cache->cost += entry->cost;
+  seg->cost += entry->cost;
+  __sync_fetch_and_add(&cache->cost, entry->cost);
 
   // put at end of lru list (most recently used):
-  cache->lru = g_list_concat(cache->lru, entry->link);
+  seg->lru = g_list_concat(seg->lru, entry->link);
 
-  dt_pthread_mutex_unlock(&cache->lock);
+  dt_pthread_mutex_unlock(&seg->lock);
   double end = dt_get_wtime();
   if(end - start > 0.1)
     fprintf(stderr, "wait time %.06fs\n", end - start);
@@ -265,22 +369,23 @@ int dt_cache_remove(dt_cache_t *cache, const uint32_t key)
   gboolean res;
   int result;
   dt_cache_entry_t *entry;
+  dt_cache_segment_t *seg = _cache_segment(cache, key);
 restart:
-  dt_pthread_mutex_lock(&cache->lock);
+  dt_pthread_mutex_lock(&seg->lock);
 
   res = g_hash_table_lookup_extended(
-      cache->hashtable, GINT_TO_POINTER(key), &orig_key, &value);
+      seg->hashtable, GINT_TO_POINTER(key), &orig_key, &value);
   entry = (dt_cache_entry_t *)value;
   if(!res)
   { // not found in cache, not deleting.
-    dt_pthread_mutex_unlock(&cache->lock);
+    dt_pthread_mutex_unlock(&seg->lock);
     return 1;
   }
   // need write lock to be able to delete:
   result = dt_pthread_rwlock_trywrlock(&entry->lock);
   if(result)
   {
-    dt_pthread_mutex_unlock(&cache->lock);
+    dt_pthread_mutex_unlock(&seg->lock);
     g_usleep(5);
     goto restart;
   }
@@ -289,15 +394,15 @@ restart:
   {
     // oops, we are currently demoting (rw -> r) lock to this entry in some thread. do not touch!
     dt_pthread_rwlock_unlock(&entry->lock);
-    dt_pthread_mutex_unlock(&cache->lock);
+    dt_pthread_mutex_unlock(&seg->lock);
     g_usleep(5);
     goto restart;
   }
 
-  gboolean removed = g_hash_table_remove(cache->hashtable, GINT_TO_POINTER(key));
+  gboolean removed = g_hash_table_remove(seg->hashtable, GINT_TO_POINTER(key));
   (void)removed; // make non-assert compile happy
   assert(removed);
-  cache->lru = g_list_delete_link(cache->lru, entry->link);
+  seg->lru = g_list_delete_link(seg->lru, entry->link);
 
   if(cache->cleanup)
   {
@@ -311,57 +416,38 @@ restart:
 
   dt_pthread_rwlock_unlock(&entry->lock);
   dt_pthread_rwlock_destroy(&entry->lock);
-  cache->cost -= entry->cost;
+  seg->cost -= entry->cost;
+  __sync_fetch_and_sub(&cache->cost, entry->cost);
   g_slice_free1(sizeof(*entry), entry);
 
-  dt_pthread_mutex_unlock(&cache->lock);
+  dt_pthread_mutex_unlock(&seg->lock);
   return 0;
 }
 
 // best-effort garbage collection. never blocks, never fails. well, sometimes it just doesn't free anything.
 void dt_cache_gc(dt_cache_t *cache, const float fill_ratio)
 {
-  GList *l = cache->lru;
-  int cnt = 0;
-  while(l)
+  for(uint32_t k = 0; k < cache->num_segments; k++)
   {
-    cnt++;
-    dt_cache_entry_t *entry = (dt_cache_entry_t *)l->data;
-    assert(entry->link->data == entry);
-    l = g_list_next(l); // we might remove this element, so walk to the next one while we still have the pointer..
-    if(cache->cost < cache->cost_quota * fill_ratio) break;
-
-    // if still locked by anyone else give up:
-    if(dt_pthread_rwlock_trywrlock(&entry->lock)) continue;
-
-    if(entry->_lock_demoting)
-    {
-      // oops, we are currently demoting (rw -> r) lock to this entry in some thread. do not touch!
-      dt_pthread_rwlock_unlock(&entry->lock);
-      continue;
-    }
-
-    // delete!
-    g_hash_table_remove(cache->hashtable, GINT_TO_POINTER(entry->key));
-    cache->lru = g_list_delete_link(cache->lru, entry->link);
-    cache->cost -= entry->cost;
-
-    if(cache->cleanup)
-    {
-      assert(entry->data_size);
-      ASAN_UNPOISON_MEMORY_REGION(entry->data, entry->data_size);
-
-      cache->cleanup(cache->cleanup_data, entry);
-    }
-    else
-      dt_free_align(entry->data);
-
-    dt_pthread_rwlock_unlock(&entry->lock);
-    dt_pthread_rwlock_destroy(&entry->lock);
-    g_slice_free1(sizeof(*entry), entry);
+    dt_cache_segment_t *seg = cache->segments + k;
+    dt_pthread_mutex_lock(&seg->lock);
+    _cache_segment_gc(cache, seg, fill_ratio);
+    dt_pthread_mutex_unlock(&seg->lock);
   }
 }
 
+void dt_cache_get_stats(const dt_cache_t *cache, dt_cache_stats_t *stats, const char *name, const char *unit)
+{
+  memset(stats, 0, sizeof(*stats));
+  stats->name = name;
+  stats->unit = unit;
+  stats->used = cache->cost;
+  stats->quota = cache->cost_quota;
+  stats->hits = cache->stats_hits;
+  stats->misses = cache->stats_misses;
+  stats->evictions = cache->stats_evictions;
+}
+
 void dt_cache_release_with_caller(dt_cache_t *cache, dt_cache_entry_t *entry, const char *file, int line)
 {
 #if((__has_feature(address_sanitizer) || defined(__SANITIZE_ADDRESS__)) && 1)
@@ -38,28 +38,65 @@ dt_cache_entry_t;
 typedef void((*dt_cache_allocate_t)(void *userdata, dt_cache_entry_t *entry));
 typedef void((*dt_cache_cleanup_t)(void *userdata, dt_cache_entry_t *entry));
 
-typedef struct dt_cache_t
+// one independent slice of the cache. every key maps to exactly one segment,
+// which owns its own lock, hashtable, lru list and share of the cost quota.
+typedef struct dt_cache_segment_t
 {
-  dt_pthread_mutex_t lock; // big fat lock. we're only expecting a couple hand full of cpu threads to use this concurrently.
+  dt_pthread_mutex_t lock; // protects hashtable, lru and cost of this segment only.
 
-  size_t entry_size; // cache line allocation
-  size_t cost;       // user supplied cost per cache line (bytes?)
-  size_t cost_quota; // quota to try and meet. but don't use as hard limit.
+  size_t cost;       // accumulated cost of the entries in this segment
+  size_t cost_quota; // this segment's share of the cache quota
 
   GHashTable *hashtable; // stores (key, entry) pairs
   GList *lru;            // last element is most recently used, first is about to be kicked from cache.
+}
+dt_cache_segment_t;
+
+typedef struct dt_cache_t
+{
+  // the cache is split into num_segments independent segments (a power of two),
+  // so threads working on different keys don't serialize on one big fat lock.
+  // with one segment this is the plain lru cache it always was.
+  uint32_t num_segments;
+  dt_cache_segment_t *segments;
+
+  size_t entry_size; // cache line allocation
+  size_t cost;       // user supplied cost per cache line (bytes?), summed over all segments
+  size_t cost_quota; // quota to try and meet. but don't use as hard limit.
 
   // callback functions for cache misses/garbage collection
   dt_cache_allocate_t allocate;
   dt_cache_allocate_t cleanup;
   void *allocate_data;
   void *cleanup_data;
+
+  // stats, updated atomically
+  uint64_t stats_hits;      // lookups served from the cache
+  uint64_t stats_misses;    // lookups which allocated a new entry
+  uint64_t stats_evictions; // entries dropped to stay within the quota
 }
 dt_cache_t;
 
+// a snapshot of the counters of one cache, to show them while tuning quotas.
+// taken without locks, so the numbers of busy caches might be a little off.
+typedef struct dt_cache_stats_t
+{
+  const char *name;
+  const char *unit; // of used and quota, "bytes" or "entries"
+  size_t used, quota;
+  uint64_t hits, misses, evictions;
+  uint64_t disk_reads, disk_misses; // served from the disk cache or a compressed tier, and not found there
+} dt_cache_stats_t;
+
 // entry size is only used if alloc callback is 0
 void dt_cache_init(dt_cache_t *cache, size_t entry_size, size_t cost_quota);
+// same, but split the cache into num_segments lock-striped segments (rounded up to a power of two).
+// every segment gets an equal share of cost_quota, so only use this when the quota is large
+// compared to the cost of a single entry.
+void dt_cache_init_segmented(dt_cache_t *cache, size_t entry_size, size_t cost_quota, uint32_t num_segments);
 void dt_cache_cleanup(dt_cache_t *cache);
+// changes the quota, shared out to the segments like on init. doesn't free anything, see dt_cache_gc().
+void dt_cache_set_cost_quota(dt_cache_t *cache, size_t cost_quota);
 
 static inline void dt_cache_set_allocate_callback(dt_cache_t *cache, dt_cache_allocate_t allocate_cb,
                                                   void *allocate_data)
@@ -87,12 +124,15 @@ void dt_cache_release_with_caller(dt_cache_t *cache, dt_cache_entry_t *entry, co
 int32_t dt_cache_contains(dt_cache_t *cache, const uint32_t key);
 // returns 0 on success, 1 if the key was not found.
 int32_t dt_cache_remove(dt_cache_t *cache, const uint32_t key);
-// removes from the tip of the lru list, until the fill ratio of the hashtable
+// removes from the tip of the lru lists, until the fill ratio of each segment
 // goes below the given parameter, in terms of the user defined cost measure.
-// will never lock and never fail, but sometimes not free memory (in case all
-// is locked)
+// takes the segment locks in turn, but will never block on an entry and never
+// fail, but sometimes not free memory (in case all is locked)
 void dt_cache_gc(dt_cache_t *cache, const float fill_ratio);
 
+// fills in what the cache itself counts, used and quota in the cost measure of the cache.
+void dt_cache_get_stats(const dt_cache_t *cache, dt_cache_stats_t *stats, const char *name, const char *unit);
+
 // iterate over all currently contained data blocks.
 // not thread safe! only use this for init/cleanup!
 // returns non zero the first time process() returns non zero.
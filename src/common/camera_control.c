@@ -21,11 +21,13 @@
 #endif
 #include "common/camera_control.h"
 #include "common/exif.h"
+#include "common/imageio_jpeg.h"
 #include "control/control.h"
 #include <gphoto2/gphoto2-file.h>
 
 #include <fcntl.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <errno.h>
 
@@ -323,8 +325,7 @@ static void _camera_process_job(const dt_camctl_t *c, const dt_camera_t *camera,
     {
       CameraFile *fp = NULL;
       int res = GP_OK;
-      const gchar *data = NULL;
-      unsigned long int data_size = 0;
+      const double time = dt_get_wtime();
 
       gp_file_new(&fp);
 
@@ -332,48 +333,20 @@ static void _camera_process_job(const dt_camctl_t *c, const dt_camera_t *camera,
       {
         dt_print(DT_DEBUG_CAMCTL, "[camera_control] live view failed to capture preview: %s\n",
                  gp_result_as_string(res));
-      }
-      else if((res = gp_file_get_data_and_size(fp, &data, &data_size)) != GP_OK)
-      {
-        dt_print(DT_DEBUG_CAMCTL, "[camera_control] live view failed to get preview data: %s\n",
-                 gp_result_as_string(res));
+        gp_file_free(fp);
       }
       else
       {
-        // everything worked
-        GError *error = NULL;
-        GdkPixbufLoader *loader = gdk_pixbuf_loader_new_with_mime_type(
-            "image/jpeg", &error); // there were cases where GDKPixbufLoader failed to recognize the JPEG
-        if(error)
-        {
-          dt_print(DT_DEBUG_CAMCTL, "[camera_control] live view failed to create jpeg image loader: %s\n",
-                   error->message);
-          g_error_free(error);
-        }
-        else
-        {
-          if(gdk_pixbuf_loader_write(loader, (guchar *)data, data_size, NULL) == TRUE)
-          {
-            dt_pthread_mutex_lock(&cam->live_view_pixbuf_mutex);
-            if(cam->live_view_pixbuf != NULL) g_object_unref(cam->live_view_pixbuf);
-            // Calling gdk_pixbuf_loader_close forces the data to be parsed by the
-            // loader.  We must do this before calling gdk_pixbuf_loader_get_pixbuf.
-            gdk_pixbuf_loader_close(loader, &error);
-            if(error)
-            {
-              dt_print(DT_DEBUG_CAMCTL, "[camera_control] live view failed to close image loader: %s\n",
-                       error->message);
-              g_error_free(error);
-            }
-            cam->live_view_pixbuf = gdk_pixbuf_loader_get_pixbuf(loader);
-            dt_pthread_mutex_unlock(&cam->live_view_pixbuf_mutex);
-          }
-        }
-        gdk_pixbuf_loader_close(loader, NULL);
+        // the decode thread takes it from here, so the next preview can be fetched meanwhile. one it didn't
+        // get to yet is out of date now.
+        dt_pthread_mutex_lock(&cam->live_view_buffer_mutex);
+        if(cam->live_view_jpeg) gp_file_free(cam->live_view_jpeg);
+        cam->live_view_jpeg = fp;
+        cam->live_view_jpeg_time = time;
+        pthread_cond_signal(&cam->live_view_decode_cond);
+        dt_pthread_mutex_unlock(&cam->live_view_buffer_mutex);
       }
-      if(fp) gp_file_free(fp);
       dt_pthread_mutex_BAD_unlock(&cam->live_view_synch);
-      dt_control_queue_redraw_center();
     }
     break;
 
@@ -520,6 +493,156 @@ static void *dt_camctl_camera_get_live_view(void *data)
   return NULL;
 }
 
+// decodes the jpeg of a preview into *surface, which is replaced if it doesn't have the size of the frame.
+// the idct already scales it down as far as the fit size allows, and the pixels are written in the layout
+// of cairo right away, so drawing the frame doesn't have to convert it.
+static gboolean _camctl_live_view_decode(CameraFile *fp, const int fit_width, const int fit_height,
+                                         cairo_surface_t **surface)
+{
+  const char *data = NULL;
+  unsigned long int data_size = 0;
+  int res = GP_OK;
+  if((res = gp_file_get_data_and_size(fp, &data, &data_size)) != GP_OK)
+  {
+    dt_print(DT_DEBUG_CAMCTL, "[camera_control] live view failed to get preview data: %s\n",
+             gp_result_as_string(res));
+    return FALSE;
+  }
+
+  dt_imageio_jpeg_t jpg;
+  if(dt_imageio_jpeg_decompress_header(data, data_size, &jpg))
+  {
+    dt_print(DT_DEBUG_CAMCTL, "[camera_control] live view failed to read the preview\n");
+    return FALSE;
+  }
+  dt_imageio_jpeg_fit_scale(&jpg, fit_width, fit_height);
+
+  if(*surface
+     && (cairo_image_surface_get_width(*surface) != jpg.width
+         || cairo_image_surface_get_height(*surface) != jpg.height))
+  {
+    cairo_surface_destroy(*surface);
+    *surface = NULL;
+  }
+  if(!*surface) *surface = cairo_image_surface_create(CAIRO_FORMAT_RGB24, jpg.width, jpg.height);
+  if(cairo_surface_status(*surface) != CAIRO_STATUS_SUCCESS
+     || cairo_image_surface_get_stride(*surface) != 4 * jpg.width)
+  {
+    cairo_surface_destroy(*surface);
+    *surface = NULL;
+    jpeg_destroy_decompress(&jpg.dinfo);
+    return FALSE;
+  }
+
+  cairo_surface_flush(*surface);
+  uint8_t *const buf = cairo_image_surface_get_data(*surface);
+  if(dt_imageio_jpeg_decompress(&jpg, buf))
+  {
+    dt_print(DT_DEBUG_CAMCTL, "[camera_control] live view failed to decode the preview\n");
+    return FALSE;
+  }
+  // the jpeg comes as r, g, b and a padding byte, cairo wants native endian 0xffrrggbb words
+  const size_t npixels = (size_t)jpg.width * jpg.height;
+  for(size_t k = 0; k < npixels; k++)
+  {
+    const uint8_t *const px = buf + 4 * k;
+    const uint32_t word = 0xff000000u | (uint32_t)px[0] << 16 | (uint32_t)px[1] << 8 | px[2];
+    memcpy(buf + 4 * k, &word, sizeof(word));
+  }
+  cairo_surface_mark_dirty(*surface);
+  return TRUE;
+}
+
+static void *dt_camctl_camera_decode_live_view(void *data)
+{
+  dt_camera_t *cam = (dt_camera_t *)data;
+
+  dt_pthread_setname("live view dec");
+
+  dt_pthread_mutex_lock(&cam->live_view_buffer_mutex);
+  while(TRUE)
+  {
+    while(cam->is_live_viewing == TRUE && !cam->live_view_jpeg)
+      dt_pthread_cond_wait(&cam->live_view_decode_cond, &cam->live_view_buffer_mutex);
+    if(cam->is_live_viewing == FALSE) break;
+
+    CameraFile *fp = cam->live_view_jpeg;
+    const double time = cam->live_view_jpeg_time;
+    cairo_surface_t *surface = cam->live_view_spare;
+    const int fit_width = cam->live_view_fit_width, fit_height = cam->live_view_fit_height;
+    cam->live_view_jpeg = NULL;
+    cam->live_view_spare = NULL;
+    dt_pthread_mutex_unlock(&cam->live_view_buffer_mutex);
+
+    const gboolean decoded = _camctl_live_view_decode(fp, fit_width, fit_height, &surface);
+    gp_file_free(fp);
+
+    dt_pthread_mutex_lock(&cam->live_view_buffer_mutex);
+    if(decoded)
+    {
+      // a frame that wasn't shown yet is out of date now and gets written to next
+      cairo_surface_t *old = cam->live_view_ready;
+      cam->live_view_ready = surface;
+      cam->live_view_ready_time = time;
+      surface = old;
+    }
+    if(surface && !cam->live_view_spare)
+      cam->live_view_spare = surface;
+    else if(surface)
+      cairo_surface_destroy(surface);
+
+    if(decoded)
+    {
+      dt_pthread_mutex_unlock(&cam->live_view_buffer_mutex);
+      dt_control_queue_redraw_center();
+      dt_pthread_mutex_lock(&cam->live_view_buffer_mutex);
+    }
+  }
+  dt_pthread_mutex_unlock(&cam->live_view_buffer_mutex);
+  return NULL;
+}
+
+// drops all frames and the preview waiting, the caller holds live_view_buffer_mutex
+static void _camctl_live_view_clear(dt_camera_t *cam)
+{
+  cairo_surface_t **frames[3] = { &cam->live_view_shown, &cam->live_view_ready, &cam->live_view_spare };
+  for(int k = 0; k < 3; k++)
+  {
+    if(*frames[k]) cairo_surface_destroy(*frames[k]);
+    *frames[k] = NULL;
+  }
+  if(cam->live_view_jpeg) gp_file_free(cam->live_view_jpeg);
+  cam->live_view_jpeg = NULL;
+}
+
+gboolean dt_camctl_camera_update_live_view(dt_camera_t *cam)
+{
+  if(cam->live_view_ready)
+  {
+    if(cam->live_view_shown && !cam->live_view_spare)
+      cam->live_view_spare = cam->live_view_shown;
+    else if(cam->live_view_shown)
+      cairo_surface_destroy(cam->live_view_shown);
+    cam->live_view_shown = cam->live_view_ready;
+    cam->live_view_shown_time = cam->live_view_ready_time;
+    cam->live_view_ready = NULL;
+
+    // frames shown per second, counted over a second, and the latency smoothed over a few frames
+    const double now = dt_get_wtime();
+    const float latency = now - cam->live_view_shown_time;
+    cam->live_view_latency = cam->live_view_latency > 0.0f ? 0.8f * cam->live_view_latency + 0.2f * latency
+                                                           : latency;
+    cam->live_view_frames++;
+    if(now - cam->live_view_count_time >= 1.0)
+    {
+      cam->live_view_fps = cam->live_view_frames / (now - cam->live_view_count_time);
+      cam->live_view_frames = 0;
+      cam->live_view_count_time = now;
+    }
+  }
+  return cam->live_view_shown != NULL;
+}
+
 gboolean dt_camctl_camera_start_live_view(const dt_camctl_t *c)
 {
   dt_camctl_t *camctl = (dt_camctl_t *)c;
@@ -537,9 +660,17 @@ gboolean dt_camctl_camera_start_live_view(const dt_camctl_t *c)
     dt_print(DT_DEBUG_CAMCTL, "[camera_control] Camera does not support live view\n");
     return FALSE;
   }
+  dt_pthread_mutex_lock(&cam->live_view_buffer_mutex);
+  _camctl_live_view_clear(cam);
+  cam->live_view_fps = cam->live_view_latency = 0.0f;
+  cam->live_view_frames = 0;
+  cam->live_view_count_time = dt_get_wtime();
+  dt_pthread_mutex_unlock(&cam->live_view_buffer_mutex);
+
   cam->is_live_viewing = TRUE;
   dt_camctl_camera_set_property_int(camctl, NULL, "eosviewfinder", 1);
 
+  dt_pthread_create(&cam->live_view_decode_thread, &dt_camctl_camera_decode_live_view, (void *)cam);
   dt_pthread_create(&cam->live_view_thread, &dt_camctl_camera_get_live_view, (void *)camctl);
 
   return TRUE;
@@ -557,6 +688,16 @@ void dt_camctl_camera_stop_live_view(const dt_camctl_t *c)
   dt_print(DT_DEBUG_CAMCTL, "[camera_control] Stopping live view\n");
   cam->is_live_viewing = FALSE;
   pthread_join(cam->live_view_thread, NULL);
+  // the last preview job is done once it gives up the synch
+  dt_pthread_mutex_BAD_lock(&cam->live_view_synch);
+  dt_pthread_mutex_BAD_unlock(&cam->live_view_synch);
+  dt_pthread_mutex_lock(&cam->live_view_buffer_mutex);
+  pthread_cond_signal(&cam->live_view_decode_cond);
+  dt_pthread_mutex_unlock(&cam->live_view_buffer_mutex);
+  pthread_join(cam->live_view_decode_thread, NULL);
+  dt_pthread_mutex_lock(&cam->live_view_buffer_mutex);
+  _camctl_live_view_clear(cam);
+  dt_pthread_mutex_unlock(&cam->live_view_buffer_mutex);
   // tell camera to get back to normal state (close mirror)
   dt_camctl_camera_set_property_int(camctl, NULL, "eosviewfinder", 0);
 }
@@ -626,15 +767,12 @@ static void dt_camctl_camera_destroy(dt_camera_t *cam)
   gp_camera_exit(cam->gpcam, cam->gpcontext);
   gp_camera_unref(cam->gpcam);
   gp_widget_unref(cam->configuration);
-  if(cam->live_view_pixbuf != NULL)
-  {
-    g_object_unref(cam->live_view_pixbuf);
-    cam->live_view_pixbuf = NULL; // just in case someone else is using this
-  }
+  _camctl_live_view_clear(cam);
   g_free(cam->model);
   g_free(cam->port);
   dt_pthread_mutex_destroy(&cam->config_lock);
-  dt_pthread_mutex_destroy(&cam->live_view_pixbuf_mutex);
+  dt_pthread_mutex_destroy(&cam->live_view_buffer_mutex);
+  pthread_cond_destroy(&cam->live_view_decode_cond);
   dt_pthread_mutex_destroy(&cam->live_view_synch);
   // TODO: cam->jobqueue
   g_free(cam);
@@ -725,7 +863,8 @@ void dt_camctl_detect_cameras(const dt_camctl_t *c)
     gp_list_get_value(available_cameras, i, &s);
     camera->port = g_strdup(s);
     dt_pthread_mutex_init(&camera->config_lock, NULL);
-    dt_pthread_mutex_init(&camera->live_view_pixbuf_mutex, NULL);
+    dt_pthread_mutex_init(&camera->live_view_buffer_mutex, NULL);
+    pthread_cond_init(&camera->live_view_decode_cond, NULL);
     dt_pthread_mutex_init(&camera->live_view_synch, NULL);
 
     // if(strcmp(camera->port,"usb:")==0) { g_free(camera); continue; }
@@ -1162,6 +1301,9 @@ void dt_camctl_tether_mode(const dt_camctl_t *c, const dt_camera_t *cam, gboolea
     else
     {
       camera->is_live_viewing = FALSE;
+      dt_pthread_mutex_lock(&camera->live_view_buffer_mutex);
+      pthread_cond_signal(&camera->live_view_decode_cond);
+      dt_pthread_mutex_unlock(&camera->live_view_buffer_mutex);
       camera->is_tethering = FALSE;
       dt_print(DT_DEBUG_CAMCTL, "[camera_control] disabling tether mode\n");
       _camctl_unlock(c);
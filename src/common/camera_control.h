@@ -82,8 +82,20 @@ typedef struct dt_camera_t
 
   /** Live view */
   gboolean is_live_viewing;
-  /** The last preview image from the camera */
-  GdkPixbuf *live_view_pixbuf;
+  /** The live view frames as cairo RGB24 surfaces: the one shown, the newest decoded one not shown yet and
+      the one the decode thread writes to next. Any of them may be NULL */
+  cairo_surface_t *live_view_shown, *live_view_ready, *live_view_spare;
+  /** When the shown and the ready frame were requested from the camera */
+  double live_view_shown_time, live_view_ready_time;
+  /** The newest preview from the camera the decode thread hasn't started on, NULL if there is none */
+  CameraFile *live_view_jpeg;
+  double live_view_jpeg_time;
+  /** Size the frames are decoded to fit, they are decoded at full size if this is 0x0 */
+  int live_view_fit_width, live_view_fit_height;
+  /** Frames shown per second and the seconds from requesting a frame to showing it */
+  float live_view_fps, live_view_latency;
+  int live_view_frames;
+  double live_view_count_time;
   /** Rotation of live view, multiples of 90° */
   int32_t live_view_rotation;
   /** Zoom level for live view */
@@ -96,8 +108,12 @@ typedef struct dt_camera_t
   gboolean live_view_flip;
   /** The thread adding the live view jobs */
   pthread_t live_view_thread;
-  /** A guard so that writing and reading the pixbuf don't interfere */
-  dt_pthread_mutex_t live_view_pixbuf_mutex;
+  /** The thread decoding the previews the jobs fetched */
+  pthread_t live_view_decode_thread;
+  /** A guard for the frames, the preview waiting to be decoded and the counters */
+  dt_pthread_mutex_t live_view_buffer_mutex;
+  /** Tells the decode thread that a preview came in or live view stopped */
+  pthread_cond_t live_view_decode_cond;
   /** A flag to tell the live view thread that the last job was completed */
   dt_pthread_mutex_t live_view_synch;
 } dt_camera_t;
@@ -238,6 +254,9 @@ void dt_camctl_camera_capture(const dt_camctl_t *c, const dt_camera_t *cam);
 gboolean dt_camctl_camera_start_live_view(const dt_camctl_t *c);
 /** Stop live view of camera.*/
 void dt_camctl_camera_stop_live_view(const dt_camctl_t *c);
+/** Makes the newest decoded live view frame the one shown, the caller holds live_view_buffer_mutex. Returns
+    TRUE if there is a frame to show. */
+gboolean dt_camctl_camera_update_live_view(dt_camera_t *cam);
 /** Returns a model string of camera.*/
 const char *dt_camctl_camera_get_model(const dt_camctl_t *c, const dt_camera_t *cam);
 
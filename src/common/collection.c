@@ -63,9 +63,87 @@ static void _dt_collection_recount_callback_2(gpointer instance, uint8_t id, gpo
 /* determine image offset of specified imgid for the given collection */
 static int dt_collection_image_offset_with_collection(const dt_collection_t *collection, int imgid);
 
+/* with -d sql, collection queries taking longer than this many seconds get their plan printed */
+#define DT_COLLECTION_SLOW_QUERY 0.05
+
+/* prints the plan sqlite picked for a query that took seconds to run, so a filter missing an index shows up as
+ * a SCAN of the table. the query is prepared again with its limit bound the same way. */
+static void _dt_collection_explain(const gchar *query, const gboolean limit, const double seconds)
+{
+  if(!(darktable.unmuted & DT_DEBUG_SQL) || seconds < DT_COLLECTION_SLOW_QUERY) return;
+
+  dt_print(DT_DEBUG_SQL, "[sql] slow collection query (%.3f secs): %s\n", seconds, query);
+  gchar *explain = g_strdup_printf("EXPLAIN QUERY PLAN %s", query);
+  sqlite3_stmt *stmt;
+  if(sqlite3_prepare_v2(dt_database_get(darktable.db), explain, -1, &stmt, NULL) == SQLITE_OK)
+  {
+    if(limit)
+    {
+      sqlite3_bind_int(stmt, 1, 0);
+      sqlite3_bind_int(stmt, 2, -1);
+    }
+    // the last column is the detail, the ones before are ids of the nested selects
+    const int detail = sqlite3_column_count(stmt) - 1;
+    while(sqlite3_step(stmt) == SQLITE_ROW)
+      dt_print(DT_DEBUG_SQL, "[sql]   %s\n", (const char *)sqlite3_column_text(stmt, detail));
+    sqlite3_finalize(stmt);
+  }
+  g_free(explain);
+}
+
+/* drops the images of the query, they are fetched again when needed */
+static void _dt_collection_drop_imgids(dt_collection_t *collection)
+{
+  if(collection->imgids) g_array_free(collection->imgids, TRUE);
+  if(collection->offsets) g_hash_table_destroy(collection->offsets);
+  collection->imgids = NULL;
+  collection->offsets = NULL;
+}
+
+/* runs the query into collection->imgids unless that is still up to date. call with imgids_mutex held, after
+ * dt_collection_get_query() made sure there is a query. a change to any table may change what the query
+ * returns, and checking the change count of the database is so cheap that nth and offset can be looked up in
+ * the array instead of running the query every time. */
+static void _dt_collection_fetch_imgids(dt_collection_t *collection)
+{
+  sqlite3 *db = dt_database_get(darktable.db);
+  const gchar *query = collection->query;
+  if(collection->imgids && collection->imgids_changes == sqlite3_total_changes(db)) return;
+  _dt_collection_drop_imgids(collection);
+  if(!query) return;
+
+  collection->imgids = g_array_new(FALSE, FALSE, sizeof(int));
+  collection->offsets = g_hash_table_new(NULL, NULL);
+  const gboolean limit = (collection->params.query_flags & COLLECTION_QUERY_USE_LIMIT) != 0;
+  const double start = dt_get_wtime();
+  sqlite3 *reader = dt_database_get_reader(darktable.db);
+  sqlite3_stmt *stmt;
+  DT_DEBUG_SQLITE3_PREPARE_V2(reader, query, -1, &stmt, NULL);
+  // was the limit portion of the query tacked on?
+  if(limit)
+  {
+    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, 0);
+    DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, -1);
+  }
+  while(sqlite3_step(stmt) == SQLITE_ROW)
+  {
+    const int id = sqlite3_column_int(stmt, 0);
+    // the offset of the first occurrence is kept, as when going through the query
+    if(!g_hash_table_contains(collection->offsets, GINT_TO_POINTER(id)))
+      g_hash_table_insert(collection->offsets, GINT_TO_POINTER(id), GINT_TO_POINTER(collection->imgids->len));
+    g_array_append_val(collection->imgids, id);
+  }
+  sqlite3_finalize(stmt);
+  dt_database_release_reader(darktable.db, reader);
+  _dt_collection_explain(query, limit, dt_get_wtime() - start);
+  // the changes of the writer, a reader doesn't make any
+  collection->imgids_changes = sqlite3_total_changes(db);
+}
+
 const dt_collection_t *dt_collection_new(const dt_collection_t *clone)
 {
   dt_collection_t *collection = g_malloc0(sizeof(dt_collection_t));
+  dt_pthread_mutex_init(&collection->imgids_mutex, NULL);
 
   /* initialize collection context*/
   if(clone) /* if clone is provided let's copy it into this context */
@@ -104,6 +182,8 @@ void dt_collection_free(const dt_collection_t *collection)
   dt_control_signal_disconnect(darktable.signals, G_CALLBACK(_dt_collection_recount_callback_2),
                                (gpointer)collection);
 
+  _dt_collection_drop_imgids((dt_collection_t *)collection);
+  dt_pthread_mutex_destroy((dt_pthread_mutex_t *)&collection->imgids_mutex);
   g_free(collection->query);
   g_free(collection->where_ext);
   g_free((dt_collection_t *)collection);
@@ -420,9 +500,12 @@ static int _dt_collection_store(const dt_collection_t *collection, gchar *query)
   }
 
   /* store query in context */
+  dt_pthread_mutex_lock((dt_pthread_mutex_t *)&collection->imgids_mutex);
   g_free(collection->query);
 
   ((dt_collection_t *)collection)->query = g_strdup(query);
+  _dt_collection_drop_imgids((dt_collection_t *)collection);
+  dt_pthread_mutex_unlock((dt_pthread_mutex_t *)&collection->imgids_mutex);
 
   return 1;
 }
@@ -440,9 +523,12 @@ static uint32_t _dt_collection_compute_count(const dt_collection_t *collection)
   else
     count_query = dt_util_dstrcat(count_query, "SELECT COUNT(DISTINCT id) %s", fq);
 
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), count_query, -1, &stmt, NULL);
-  if((collection->params.query_flags & COLLECTION_QUERY_USE_LIMIT)
-     && !(collection->params.query_flags & COLLECTION_QUERY_USE_ONLY_WHERE_EXT))
+  const gboolean limit = (collection->params.query_flags & COLLECTION_QUERY_USE_LIMIT)
+                         && !(collection->params.query_flags & COLLECTION_QUERY_USE_ONLY_WHERE_EXT);
+  const double start = dt_get_wtime();
+  sqlite3 *reader = dt_database_get_reader(darktable.db);
+  DT_DEBUG_SQLITE3_PREPARE_V2(reader, count_query, -1, &stmt, NULL);
+  if(limit)
   {
     DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, 0);
     DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, -1);
@@ -450,6 +536,8 @@ static uint32_t _dt_collection_compute_count(const dt_collection_t *collection)
 
   if(sqlite3_step(stmt) == SQLITE_ROW) count = sqlite3_column_int(stmt, 0);
   sqlite3_finalize(stmt);
+  dt_database_release_reader(darktable.db, reader);
+  _dt_collection_explain(count_query, limit, dt_get_wtime() - start);
   g_free(count_query);
   return count;
 }
@@ -519,22 +607,31 @@ int dt_collection_get_nth(const dt_collection_t *collection, int nth)
 {
   if(nth < 0 || nth >= dt_collection_get_count(collection))
     return -1;
-  const gchar *query = dt_collection_get_query(collection);
-  sqlite3_stmt *stmt = NULL;
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), query, -1, &stmt, NULL);
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, nth);
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, 1);
 
-  int result = -1;
-  if(sqlite3_step(stmt) == SQLITE_ROW)
-  {
-    result  = sqlite3_column_int(stmt, 0);
-  }
-
-  sqlite3_finalize(stmt);
+  dt_collection_t *c = (dt_collection_t *)collection;
+  dt_collection_get_query(collection);
+  dt_pthread_mutex_lock(&c->imgids_mutex);
+  _dt_collection_fetch_imgids(c);
+  const int result = c->imgids && nth < c->imgids->len ? g_array_index(c->imgids, int, nth) : -1;
+  dt_pthread_mutex_unlock(&c->imgids_mutex);
 
   return result;
+}
 
+int dt_collection_get_range(const dt_collection_t *collection, int offset, int count, int *ids)
+{
+  if(offset < 0 || count <= 0) return 0;
+
+  dt_collection_t *c = (dt_collection_t *)collection;
+  dt_collection_get_query(collection);
+  dt_pthread_mutex_lock(&c->imgids_mutex);
+  _dt_collection_fetch_imgids(c);
+  const int available = c->imgids && offset < c->imgids->len ? c->imgids->len - offset : 0;
+  const int copied = MIN(count, available);
+  if(copied > 0) memcpy(ids, &g_array_index(c->imgids, int, offset), sizeof(int) * copied);
+  dt_pthread_mutex_unlock(&c->imgids_mutex);
+
+  return copied;
 }
 
 GList *dt_collection_get_selected(const dt_collection_t *collection, int limit)
@@ -867,14 +964,14 @@ static gchar *get_query_string(const dt_collection_properties_t property, const
     break;
 
     case DT_COLLECTION_PROP_HISTORY: // history
-      query = dt_util_dstrcat(query, "(id %s IN (SELECT imgid FROM main.history WHERE imgid=images.id)) ",
-                              (strcmp(escaped_text, _("altered")) == 0) ? "" : "not");
+      // a lookup in the index of history per image, instead of a subquery run again for every one
+      query = dt_util_dstrcat(query, "(%s EXISTS (SELECT 1 FROM main.history WHERE imgid = images.id)) ",
+                              (strcmp(escaped_text, _("altered")) == 0) ? "" : "NOT");
       break;
 
     case DT_COLLECTION_PROP_GEOTAGGING: // geotagging
-      query = dt_util_dstrcat(query, "(id %s IN (SELECT id AS imgid FROM main.images WHERE "
-                                     "(longitude IS NOT NULL AND latitude IS NOT NULL))) ",
-                              (strcmp(escaped_text, _("tagged")) == 0) ? "" : "not");
+      query = dt_util_dstrcat(query, "(%s(longitude IS NOT NULL AND latitude IS NOT NULL)) ",
+                              (strcmp(escaped_text, _("tagged")) == 0) ? "" : "NOT ");
       break;
 
     case DT_COLLECTION_PROP_CAMERA: // camera
@@ -882,8 +979,10 @@ static gchar *get_query_string(const dt_collection_properties_t property, const
         query = dt_util_dstrcat(query, "(1=1)");
       else
       {
-        // Start query with a false statement to avoid special casing the first condition
-        query = dt_util_dstrcat(query, "((1=0)");
+        // a constant false term in front would keep sqlite from using the index on maker and model, so the
+        // first condition is special cased
+        const char *op = "";
+        query = dt_util_dstrcat(query, "(");
         GList *lists = NULL;
         dt_collection_get_makermodel(text, NULL, &lists);
         GList *element = lists;
@@ -892,7 +991,8 @@ static gchar *get_query_string(const dt_collection_properties_t property, const
           GList *tuple = element->data;
           char *mk = sqlite3_mprintf("%q", tuple->data);
           char *md = sqlite3_mprintf("%q", tuple->next->data);
-          query = dt_util_dstrcat(query, " OR (maker = '%s' AND model = '%s')", mk, md);
+          query = dt_util_dstrcat(query, "%s(maker = '%s' AND model = '%s')", op, mk, md);
+          op = " OR ";
           sqlite3_free(mk);
           sqlite3_free(md);
           g_free(tuple->data);
@@ -901,12 +1001,13 @@ static gchar *get_query_string(const dt_collection_properties_t property, const
           element = element->next;
         }
         g_list_free(lists);
-        query = dt_util_dstrcat(query, ")");
+        query = dt_util_dstrcat(query, "%s)", *op ? "" : "1=0");
       }
       break;
     case DT_COLLECTION_PROP_TAG: // tag
-      query = dt_util_dstrcat(query, "(id IN (SELECT imgid FROM main.tagged_images AS a JOIN "
-                                     "data.tags AS b ON a.tagid = b.id WHERE name LIKE '%s'))",
+      // the few matching tags first, then their images from the (tagid, imgid) index of tagged_images
+      query = dt_util_dstrcat(query, "(id IN (SELECT imgid FROM main.tagged_images WHERE tagid IN "
+                                     "(SELECT id FROM data.tags WHERE name LIKE '%s')))",
                               escaped_text);
       break;
 
@@ -1255,39 +1356,15 @@ void dt_collection_hint_message(const dt_collection_t *collection)
 
 static int dt_collection_image_offset_with_collection(const dt_collection_t *collection, int imgid)
 {
-  const gchar *qin = dt_collection_get_query(collection);
-  int offset = 0;
-  sqlite3_stmt *stmt;
-
-  if(qin)
-  {
-    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), qin, -1, &stmt, NULL);
-
-    // was the limit portion of the query tacked on?
-    if(collection->params.query_flags & COLLECTION_QUERY_USE_LIMIT)
-    {
-      DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, 0);
-      DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, -1);
-    }
-
-    gboolean found = FALSE;
-
-    while(sqlite3_step(stmt) == SQLITE_ROW)
-    {
-      int id = sqlite3_column_int(stmt, 0);
-      if(imgid == id)
-      {
-        found = TRUE;
-        break;
-      }
-      offset++;
-    }
-
-    if(!found) offset = 0;
-
-    sqlite3_finalize(stmt);
-  }
-  return offset;
+  dt_collection_t *c = (dt_collection_t *)collection;
+  dt_collection_get_query(collection);
+  dt_pthread_mutex_lock(&c->imgids_mutex);
+  _dt_collection_fetch_imgids(c);
+  gpointer offset = NULL;
+  const gboolean found
+      = c->offsets && g_hash_table_lookup_extended(c->offsets, GINT_TO_POINTER(imgid), NULL, &offset);
+  dt_pthread_mutex_unlock(&c->imgids_mutex);
+  return found ? GPOINTER_TO_INT(offset) : 0;
 }
 
 int dt_collection_image_offset(int imgid)
@@ -1319,6 +1396,8 @@ static void _dt_collection_recount_callback_2(gpointer instance, uint8_t id, gpo
   }
 }
 
+#undef DT_COLLECTION_SLOW_QUERY
+
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
 // kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
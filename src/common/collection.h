@@ -18,6 +18,8 @@
 
 #pragma once
 
+#include "common/dtpthread.h"
+
 #include <glib.h>
 #include <inttypes.h>
 
@@ -131,6 +133,13 @@ typedef struct dt_collection_t
   unsigned int count;
   dt_collection_params_t params;
   dt_collection_params_t store;
+
+  // the images of the query in its order and their offsets in there, kept until the query or the database
+  // change. the database has changed when its total change count differs from imgids_changes.
+  GArray *imgids;
+  GHashTable *offsets;
+  int imgids_changes;
+  dt_pthread_mutex_t imgids_mutex;
 } dt_collection_t;
 
 
@@ -186,6 +195,8 @@ gchar *dt_collection_get_sort_query(const dt_collection_t *collection);
 uint32_t dt_collection_get_count(const dt_collection_t *collection);
 /** get the nth image in the query */
 int dt_collection_get_nth(const dt_collection_t *collection, int nth);
+/** copy the ids of the images from offset on, no more than count, into ids. returns how many were copied. */
+int dt_collection_get_range(const dt_collection_t *collection, int offset, int count, int *ids);
 /** get all image ids order as current selection. no more than limit many images are returned, <0 ==
  * unlimited */
 GList *dt_collection_get_all(const dt_collection_t *collection, int limit);
@@ -22,6 +22,9 @@
 #include "develop/imageop.h"
 #include "develop/imageop_math.h"
 
+#include <stdlib.h>
+#include <string.h>
+
 static void color_picker_helper_4ch_seq(const dt_iop_buffer_dsc_t *dsc, const float *const pixel,
                                         const dt_iop_roi_t *roi, const int *const box, float *const picked_color,
                                         float *const picked_color_min, float *const picked_color_max)
@@ -407,6 +410,152 @@ void dt_color_picker_helper(const dt_iop_buffer_dsc_t *dsc, const float *const p
     dt_unreachable_codepath();
 }
 
+// edge of the blocks of the picker table in pixels
+#define DT_COLOR_PICKER_BLOCK 16
+
+dt_color_picker_table_t *dt_color_picker_table_new(const uint8_t *const pixel, const int width, const int height)
+{
+  // the sums have to fit into 32 bits
+  if(width <= 0 || height <= 0 || (uint64_t)255 * width * height > UINT32_MAX) return NULL;
+
+  dt_color_picker_table_t *table = (dt_color_picker_table_t *)calloc(1, sizeof(dt_color_picker_table_t));
+  if(!table) return NULL;
+  table->pixel = pixel;
+  table->width = width;
+  table->height = height;
+  table->blocks_x = (width + DT_COLOR_PICKER_BLOCK - 1) / DT_COLOR_PICKER_BLOCK;
+  table->blocks_y = (height + DT_COLOR_PICKER_BLOCK - 1) / DT_COLOR_PICKER_BLOCK;
+  table->sum = (uint32_t *)dt_alloc_align(64, sizeof(uint32_t) * 3 * (width + 1) * (height + 1));
+  table->min = (uint8_t *)malloc((size_t)3 * table->blocks_x * table->blocks_y);
+  table->max = (uint8_t *)malloc((size_t)3 * table->blocks_x * table->blocks_y);
+  if(!table->sum || !table->min || !table->max)
+  {
+    dt_color_picker_table_free(table);
+    return NULL;
+  }
+
+  uint32_t *const sum = table->sum;
+  const size_t stride = (size_t)3 * (width + 1);
+  memset(sum, 0, sizeof(uint32_t) * stride);
+
+  // sums along the rows, then down the columns
+#ifdef _OPENMP
+#pragma omp parallel for default(none) schedule(static)
+#endif
+  for(int j = 0; j < height; j++)
+  {
+    const uint8_t *const in = pixel + (size_t)4 * width * j;
+    uint32_t *const out = sum + stride * (j + 1);
+    for(int c = 0; c < 3; c++) out[c] = 0;
+    for(int i = 0; i < width; i++)
+      for(int c = 0; c < 3; c++) out[3 * (i + 1) + c] = out[3 * i + c] + in[4 * i + c];
+  }
+  for(int j = 1; j < height; j++)
+  {
+    const uint32_t *const above = sum + stride * j;
+    uint32_t *const out = sum + stride * (j + 1);
+    for(size_t k = 0; k < stride; k++) out[k] += above[k];
+  }
+
+  const int blocks_x = table->blocks_x;
+#ifdef _OPENMP
+#pragma omp parallel for default(none) shared(table) schedule(static)
+#endif
+  for(int b = 0; b < table->blocks_x * table->blocks_y; b++)
+  {
+    const int x0 = (b % blocks_x) * DT_COLOR_PICKER_BLOCK, x1 = MIN(width, x0 + DT_COLOR_PICKER_BLOCK);
+    const int y0 = (b / blocks_x) * DT_COLOR_PICKER_BLOCK, y1 = MIN(height, y0 + DT_COLOR_PICKER_BLOCK);
+    uint8_t mn[3] = { 255, 255, 255 }, mx[3] = { 0, 0, 0 };
+    for(int j = y0; j < y1; j++)
+      for(int i = x0; i < x1; i++)
+        for(int c = 0; c < 3; c++)
+        {
+          const uint8_t v = pixel[4 * ((size_t)width * j + i) + c];
+          mn[c] = MIN(mn[c], v);
+          mx[c] = MAX(mx[c], v);
+        }
+    for(int c = 0; c < 3; c++)
+    {
+      table->min[3 * b + c] = mn[c];
+      table->max[3 * b + c] = mx[c];
+    }
+  }
+
+  return table;
+}
+
+void dt_color_picker_table_free(dt_color_picker_table_t *table)
+{
+  if(!table) return;
+  dt_free_align(table->sum);
+  free(table->min);
+  free(table->max);
+  free(table);
+}
+
+static inline void color_picker_table_scan(const dt_color_picker_table_t *const table, const int x0,
+                                           const int x1, const int y0, const int y1, uint8_t *const min,
+                                           uint8_t *const max)
+{
+  for(int j = y0; j < y1; j++)
+    for(int i = x0; i < x1; i++)
+      for(int c = 0; c < 3; c++)
+      {
+        const uint8_t v = table->pixel[4 * ((size_t)table->width * j + i) + c];
+        min[c] = MIN(min[c], v);
+        max[c] = MAX(max[c], v);
+      }
+}
+
+void dt_color_picker_table_sample(const dt_color_picker_table_t *const table, const int *const box,
+                                  float *const mean, uint8_t *const min, uint8_t *const max)
+{
+  const int x0 = box[0], y0 = box[1], x1 = box[2] + 1, y1 = box[3] + 1;
+  const size_t stride = (size_t)3 * (table->width + 1);
+  const uint32_t *const s00 = table->sum + stride * y0 + 3 * x0;
+  const uint32_t *const s01 = table->sum + stride * y0 + 3 * x1;
+  const uint32_t *const s10 = table->sum + stride * y1 + 3 * x0;
+  const uint32_t *const s11 = table->sum + stride * y1 + 3 * x1;
+  const float w = 1.0f / ((float)(x1 - x0) * (y1 - y0));
+  for(int c = 0; c < 3; c++)
+  {
+    // wraps around in between but comes out right
+    mean[c] = w * (uint32_t)(s11[c] - s10[c] - s01[c] + s00[c]);
+    min[c] = 255;
+    max[c] = 0;
+  }
+
+  // the blocks entirely inside of the box, and the pixels of the box around them
+  const int bx0 = (x0 + DT_COLOR_PICKER_BLOCK - 1) / DT_COLOR_PICKER_BLOCK;
+  const int by0 = (y0 + DT_COLOR_PICKER_BLOCK - 1) / DT_COLOR_PICKER_BLOCK;
+  const int bx1 = x1 == table->width ? table->blocks_x : x1 / DT_COLOR_PICKER_BLOCK;
+  const int by1 = y1 == table->height ? table->blocks_y : y1 / DT_COLOR_PICKER_BLOCK;
+  if(bx0 >= bx1 || by0 >= by1)
+  {
+    color_picker_table_scan(table, x0, x1, y0, y1, min, max);
+    return;
+  }
+
+  for(int by = by0; by < by1; by++)
+    for(int bx = bx0; bx < bx1; bx++)
+    {
+      const size_t b = 3 * ((size_t)table->blocks_x * by + bx);
+      for(int c = 0; c < 3; c++)
+      {
+        min[c] = MIN(min[c], table->min[b + c]);
+        max[c] = MAX(max[c], table->max[b + c]);
+      }
+    }
+  const int ix0 = bx0 * DT_COLOR_PICKER_BLOCK, ix1 = MIN(x1, bx1 * DT_COLOR_PICKER_BLOCK);
+  const int iy0 = by0 * DT_COLOR_PICKER_BLOCK, iy1 = MIN(y1, by1 * DT_COLOR_PICKER_BLOCK);
+  color_picker_table_scan(table, x0, x1, y0, iy0, min, max);
+  color_picker_table_scan(table, x0, x1, iy1, y1, min, max);
+  color_picker_table_scan(table, x0, ix0, iy0, iy1, min, max);
+  color_picker_table_scan(table, ix1, x1, iy0, iy1, min, max);
+}
+
+#undef DT_COLOR_PICKER_BLOCK
+
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
 // kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
@@ -18,6 +18,8 @@
 
 #pragma once
 
+#include <stdint.h>
+
 struct dt_iop_buffer_dsc_t;
 struct dt_iop_roi_t;
 
@@ -25,6 +27,28 @@ void dt_color_picker_helper(const struct dt_iop_buffer_dsc_t *dsc, const float *
                             const struct dt_iop_roi_t *roi, const int *const box, float *const picked_color,
                             float *const picked_color_min, float *const picked_color_max);
 
+/**
+ * summed-area table and minima / maxima of blocks of an 8 bit 4 channel buffer, built once so that any number
+ * of boxes can be sampled from it. the mean of a box then takes four lookups and its minimum and maximum the
+ * blocks inside of it plus the pixels along its border, however large it is. the fourth channel is ignored.
+ */
+typedef struct dt_color_picker_table_t
+{
+  const uint8_t *pixel; // the buffer, which has to stay around while the table is used
+  int width, height;
+  uint32_t *sum;        // (width + 1) x (height + 1) sums of the first three channels of the pixels above left
+  int blocks_x, blocks_y;
+  uint8_t *min, *max;   // of the first three channels in every block
+} dt_color_picker_table_t;
+
+/** NULL if out of memory or if the buffer is too large for the sums */
+dt_color_picker_table_t *dt_color_picker_table_new(const uint8_t *const pixel, const int width, const int height);
+void dt_color_picker_table_free(dt_color_picker_table_t *table);
+
+/** mean, minimum and maximum of the first three channels in box, whose last row and column are included */
+void dt_color_picker_table_sample(const dt_color_picker_table_t *const table, const int *const box,
+                                  float *const mean, uint8_t *const min, uint8_t *const max);
+
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
 // kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
@@ -40,39 +40,40 @@ void dt_colorlabels_remove_labels_selection()
 void dt_colorlabels_remove_labels(const int imgid)
 {
   sqlite3_stmt *stmt;
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "DELETE FROM main.color_labels WHERE imgid=?1", -1,
-                              &stmt, NULL);
+  DT_DEBUG_SQLITE3_PREPARE_CACHED(darktable.db, "DELETE FROM main.color_labels WHERE imgid=?1", &stmt);
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
   sqlite3_step(stmt);
-  sqlite3_finalize(stmt);
+  dt_database_release_cached(darktable.db, stmt);
 }
 
 void dt_colorlabels_set_label(const int imgid, const int color)
 {
   sqlite3_stmt *stmt;
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                              "INSERT INTO main.color_labels (imgid, color) VALUES (?1, ?2)", -1, &stmt, NULL);
+  DT_DEBUG_SQLITE3_PREPARE_CACHED(darktable.db,
+                                  "INSERT INTO main.color_labels (imgid, color) VALUES (?1, ?2)", &stmt);
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, color);
   sqlite3_step(stmt);
-  sqlite3_finalize(stmt);
+  dt_database_release_cached(darktable.db, stmt);
 }
 
 void dt_colorlabels_remove_label(const int imgid, const int color)
 {
   sqlite3_stmt *stmt;
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                              "DELETE FROM main.color_labels WHERE imgid=?1 AND color=?2", -1, &stmt, NULL);
+  DT_DEBUG_SQLITE3_PREPARE_CACHED(darktable.db, "DELETE FROM main.color_labels WHERE imgid=?1 AND color=?2", &stmt);
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, color);
   sqlite3_step(stmt);
-  sqlite3_finalize(stmt);
+  dt_database_release_cached(darktable.db, stmt);
 }
 
 void dt_colorlabels_toggle_label_selection(const int color)
 {
   sqlite3_stmt *stmt, *stmt2;
 
+  // the check and the change see the same selection, and are written out at once
+  sqlite3_exec(dt_database_get(darktable.db), "BEGIN TRANSACTION", NULL, NULL, NULL);
+
   // check if all images in selection have that color label, i.e. try to get those which do not have the label
   DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "SELECT imgid FROM main.selected_images WHERE imgid "
                                                              "NOT IN (SELECT a.imgid FROM main.selected_images AS "
@@ -103,6 +104,7 @@ void dt_colorlabels_toggle_label_selection(const int color)
     sqlite3_finalize(stmt2);
   }
   sqlite3_finalize(stmt);
+  sqlite3_exec(dt_database_get(darktable.db), "COMMIT", NULL, NULL, NULL);
 
   dt_collection_hint_message(darktable.collection);
 }
@@ -111,30 +113,29 @@ void dt_colorlabels_toggle_label(const int imgid, const int color)
 {
   if(imgid <= 0) return;
   sqlite3_stmt *stmt, *stmt2;
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                              "SELECT * FROM main.color_labels WHERE imgid=?1 AND color=?2 LIMIT 1",
-                              -1, &stmt, NULL);
+  DT_DEBUG_SQLITE3_PREPARE_CACHED(darktable.db,
+                                  "SELECT * FROM main.color_labels WHERE imgid=?1 AND color=?2 LIMIT 1", &stmt);
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, color);
   if(sqlite3_step(stmt) == SQLITE_ROW)
   {
-    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                                "DELETE FROM main.color_labels WHERE imgid=?1 AND color=?2", -1, &stmt2, NULL);
+    DT_DEBUG_SQLITE3_PREPARE_CACHED(darktable.db,
+                                    "DELETE FROM main.color_labels WHERE imgid=?1 AND color=?2", &stmt2);
     DT_DEBUG_SQLITE3_BIND_INT(stmt2, 1, imgid);
     DT_DEBUG_SQLITE3_BIND_INT(stmt2, 2, color);
     sqlite3_step(stmt2);
-    sqlite3_finalize(stmt2);
+    dt_database_release_cached(darktable.db, stmt2);
   }
   else
   {
-    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                                "INSERT INTO main.color_labels (imgid, color) VALUES (?1, ?2)", -1, &stmt2, NULL);
+    DT_DEBUG_SQLITE3_PREPARE_CACHED(darktable.db,
+                                    "INSERT INTO main.color_labels (imgid, color) VALUES (?1, ?2)", &stmt2);
     DT_DEBUG_SQLITE3_BIND_INT(stmt2, 1, imgid);
     DT_DEBUG_SQLITE3_BIND_INT(stmt2, 2, color);
     sqlite3_step(stmt2);
-    sqlite3_finalize(stmt2);
+    dt_database_release_cached(darktable.db, stmt2);
   }
-  sqlite3_finalize(stmt);
+  dt_database_release_cached(darktable.db, stmt);
 
   dt_collection_hint_message(darktable.collection);
 }
@@ -143,19 +144,18 @@ int dt_colorlabels_check_label(const int imgid, const int color)
 {
   if(imgid <= 0) return 0;
   sqlite3_stmt *stmt;
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                              "SELECT * FROM main.color_labels WHERE imgid=?1 AND color=?2 LIMIT 1",
-                              -1, &stmt, NULL);
+  DT_DEBUG_SQLITE3_PREPARE_CACHED(darktable.db,
+                                  "SELECT * FROM main.color_labels WHERE imgid=?1 AND color=?2 LIMIT 1", &stmt);
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, color);
   if(sqlite3_step(stmt) == SQLITE_ROW)
   {
-    sqlite3_finalize(stmt);
+    dt_database_release_cached(darktable.db, stmt);
     return 1;
   }
   else
   {
-    sqlite3_finalize(stmt);
+    dt_database_release_cached(darktable.db, stmt);
     return 0;
   }
 }
@@ -21,6 +21,7 @@
 #include "common/colormatrices.c"
 #include "common/darktable.h"
 #include "common/debug.h"
+#include "common/lut3d.h"
 #include "common/srgb_tone_curve_values.h"
 #include "control/conf.h"
 #include "control/control.h"
@@ -1146,6 +1147,7 @@ dt_colorspaces_t *dt_colorspaces_init()
   dt_colorspaces_t *res = (dt_colorspaces_t *)calloc(1, sizeof(dt_colorspaces_t));
 
   pthread_rwlock_init(&res->xprofile_lock, NULL);
+  dt_pthread_mutex_init(&res->luts_lock, NULL);
 
   int in_pos = -1,
       out_pos = -1,
@@ -1277,6 +1279,9 @@ void dt_colorspaces_cleanup(dt_colorspaces_t *self)
   }
   g_list_free_full(self->profiles, free);
 
+  dt_lut3d_cache_cleanup();
+  dt_pthread_mutex_destroy(&self->luts_lock);
+
   pthread_rwlock_destroy(&self->xprofile_lock);
   g_free(self->colord_profile_file);
   g_free(self->xprofile_data);
@@ -97,6 +97,10 @@ typedef struct dt_colorspaces_t
 
   cmsHTRANSFORM transform_srgb_to_display, transform_adobe_rgb_to_display;
 
+  // 3d luts littlecms transforms have been baked into, see common/lut3d.h
+  GList *luts;
+  dt_pthread_mutex_t luts_lock;
+
 } dt_colorspaces_t;
 
 typedef struct dt_colorspaces_color_profile_t
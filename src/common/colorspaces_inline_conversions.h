@@ -20,9 +20,10 @@
 
 #pragma once
 
-#ifdef __SSE2__
+#include "common/simd.h"
+
+#ifdef DT_SIMD_SSE
 #include "common/sse.h"
-#include <xmmintrin.h>
 
 static inline __m128 lab_f_inv_m(const __m128 x)
 {
@@ -264,6 +265,100 @@ static inline void dt_prophotorgb_to_Lab(const float *const rgb, float *Lab)
   dt_XYZ_to_Lab(XYZ, Lab);
 }
 
+/** the conversions above for n pixels of four floats, as in a row of a pixelpipe buffer. in and out may be
+ *  the same buffer, the fourth channel of out is left alone. they do the same arithmetic as the functions for
+ *  one pixel but without branches, so the compiler can vectorise them over the pixels: the results agree
+ *  with those up to rounding, a relative error below 1e-6. */
+static inline void dt_XYZ_to_Lab_array(const float *const XYZ, float *const Lab, const size_t n)
+{
+  const float d50[3] = { 0.9642, 1.0, 0.8249 };
+  const float epsilon = 216.0f / 24389.0f;
+  const float kappa = 24389.0f / 27.0f;
+  for(size_t k = 0; k < n; k++)
+  {
+    float f[3];
+    for(int c = 0; c < 3; c++)
+    {
+      const float x = XYZ[4 * k + c] / d50[c];
+      // cbrt_5f() and cbrta_halleyf() of lab_f(), the bits are garbage for the x the result isn't used for
+      union {
+        float f;
+        uint32_t i;
+      } a = { .f = x };
+      a.i = a.i / 3 + 709921077;
+      const float big = cbrta_halleyf(a.f, x);
+      const float small = (kappa * x + 16.0f) / 116.0f;
+      f[c] = x > epsilon ? big : small;
+    }
+    Lab[4 * k + 0] = 116.0f * f[1] - 16.0f;
+    Lab[4 * k + 1] = 500.0f * (f[0] - f[1]);
+    Lab[4 * k + 2] = 200.0f * (f[1] - f[2]);
+  }
+}
+
+static inline void dt_Lab_to_XYZ_array(const float *const Lab, float *const XYZ, const size_t n)
+{
+  const float d50[3] = { 0.9642, 1.0, 0.8249 };
+  const float epsilon = 0.20689655172413796; // cbrtf(216.0f/24389.0f);
+  const float kappa = 24389.0f / 27.0f;
+  for(size_t k = 0; k < n; k++)
+  {
+    const float fy = (Lab[4 * k + 0] + 16.0f) / 116.0f;
+    const float fx = Lab[4 * k + 1] / 500.0f + fy;
+    const float fz = fy - Lab[4 * k + 2] / 200.0f;
+    const float f[3] = { fx, fy, fz };
+    for(int c = 0; c < 3; c++)
+    {
+      const float x = f[c];
+      XYZ[4 * k + c] = d50[c] * (x > epsilon ? x * x * x : (116.0f * x - 16.0f) / kappa);
+    }
+  }
+}
+
+static inline void dt_Lab_to_prophotorgb_array(const float *const Lab, float *const rgb, const size_t n)
+{
+  const float xyz_to_rgb[3][3] = {
+    // prophoto rgb d50
+    { 1.3459433, -0.2556075, -0.0511118 },
+    { -0.5445989, 1.5081673, 0.0205351 },
+    { 0.0000000, 0.0000000, 1.2118128 },
+  };
+
+  dt_Lab_to_XYZ_array(Lab, rgb, n);
+  for(size_t k = 0; k < n; k++)
+  {
+    const float XYZ[3] = { rgb[4 * k + 0], rgb[4 * k + 1], rgb[4 * k + 2] };
+    for(int r = 0; r < 3; r++)
+    {
+      float sum = 0.0f;
+      for(int c = 0; c < 3; c++) sum += xyz_to_rgb[r][c] * XYZ[c];
+      rgb[4 * k + r] = sum;
+    }
+  }
+}
+
+static inline void dt_prophotorgb_to_Lab_array(const float *const rgb, float *const Lab, const size_t n)
+{
+  const float rgb_to_xyz[3][3] = {
+    // prophoto rgb
+    { 0.7976749, 0.1351917, 0.0313534 },
+    { 0.2880402, 0.7118741, 0.0000857 },
+    { 0.0000000, 0.0000000, 0.8252100 },
+  };
+
+  for(size_t k = 0; k < n; k++)
+  {
+    const float RGB[3] = { rgb[4 * k + 0], rgb[4 * k + 1], rgb[4 * k + 2] };
+    for(int r = 0; r < 3; r++)
+    {
+      float sum = 0.0f;
+      for(int c = 0; c < 3; c++) sum += rgb_to_xyz[r][c] * RGB[c];
+      Lab[4 * k + r] = sum;
+    }
+  }
+  dt_XYZ_to_Lab_array(Lab, Lab, n);
+}
+
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
 // kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
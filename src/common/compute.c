@@ -0,0 +1,182 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2017 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "common/compute.h"
+#include "common/darktable.h"
+#include "common/opencl.h"
+
+#include <string.h>
+
+static const dt_compute_backend_t *_backends[DT_COMPUTE_MAX_BACKENDS];
+static int _num_backends = 0;
+
+#ifdef HAVE_OPENCL
+static int _opencl_num_devices(void)
+{
+  return darktable.opencl->inited ? darktable.opencl->num_devs : 0;
+}
+
+static const char *_opencl_device_name(const int dev)
+{
+  return darktable.opencl->dev[dev].name;
+}
+
+static void _opencl_memory(const int dev, dt_compute_memory_t *mem)
+{
+  const dt_opencl_device_t *device = darktable.opencl->dev + dev;
+  mem->in_use = device->memory_in_use;
+  mem->peak = device->peak_memory;
+  mem->total = device->max_global_mem;
+}
+
+static const dt_compute_backend_t _opencl_backend = {.type = DT_COMPUTE_BACKEND_OPENCL,
+                                                     .name = "opencl",
+                                                     .is_enabled = dt_opencl_is_enabled,
+                                                     .num_devices = _opencl_num_devices,
+                                                     .device_name = _opencl_device_name,
+                                                     .lock_device = dt_opencl_lock_device,
+                                                     .unlock_device = dt_opencl_unlock_device,
+                                                     .memory = _opencl_memory,
+                                                     .events_reset = dt_opencl_events_reset,
+                                                     .events_flush = dt_opencl_events_flush,
+                                                     .events_count = dt_opencl_events_count,
+                                                     .events_time = dt_opencl_events_time };
+#endif
+
+void dt_compute_init(void)
+{
+  _num_backends = 0;
+#ifdef HAVE_OPENCL
+  dt_compute_register(&_opencl_backend);
+#endif
+}
+
+void dt_compute_cleanup(void)
+{
+  _num_backends = 0;
+}
+
+int dt_compute_register(const dt_compute_backend_t *backend)
+{
+  if(_num_backends >= DT_COMPUTE_MAX_BACKENDS) return 1;
+  for(int k = 0; k < _num_backends; k++)
+    if(_backends[k]->type == backend->type) return 1;
+  _backends[_num_backends++] = backend;
+  dt_print(DT_DEBUG_OPENCL, "[compute] registered backend %s\n", backend->name);
+  return 0;
+}
+
+int dt_compute_num_devices(void)
+{
+  int num = 0;
+  for(int k = 0; k < _num_backends; k++)
+    if(_backends[k]->is_enabled()) num += _backends[k]->num_devices();
+  return num;
+}
+
+const dt_compute_backend_t *dt_compute_device_backend(const int devid, int *local)
+{
+  *local = -1;
+  if(devid < 0) return NULL;
+  int first = 0;
+  for(int k = 0; k < _num_backends; k++)
+  {
+    // a disabled backend keeps its numbers, so devices handed out before don't change meaning
+    const int num = _backends[k]->num_devices();
+    if(devid < first + num)
+    {
+      *local = devid - first;
+      return _backends[k];
+    }
+    first += num;
+  }
+  return NULL;
+}
+
+static int _first_device(const dt_compute_backend_t *backend)
+{
+  int first = 0;
+  for(int k = 0; k < _num_backends && _backends[k] != backend; k++) first += _backends[k]->num_devices();
+  return first;
+}
+
+const char *dt_compute_device_name(const int devid)
+{
+  int local;
+  const dt_compute_backend_t *backend = dt_compute_device_backend(devid, &local);
+  return backend ? backend->device_name(local) : NULL;
+}
+
+int dt_compute_lock_device(const int pipetype)
+{
+  for(int k = 0; k < _num_backends; k++)
+  {
+    const dt_compute_backend_t *backend = _backends[k];
+    if(!backend->is_enabled()) continue;
+    const int local = backend->lock_device(pipetype);
+    if(local >= 0) return _first_device(backend) + local;
+  }
+  return -1;
+}
+
+void dt_compute_unlock_device(const int devid)
+{
+  int local;
+  const dt_compute_backend_t *backend = dt_compute_device_backend(devid, &local);
+  if(backend) backend->unlock_device(local);
+}
+
+void dt_compute_memory(const int devid, dt_compute_memory_t *mem)
+{
+  memset(mem, 0, sizeof(dt_compute_memory_t));
+  int local;
+  const dt_compute_backend_t *backend = dt_compute_device_backend(devid, &local);
+  if(backend) backend->memory(local, mem);
+}
+
+void dt_compute_events_reset(const int devid)
+{
+  int local;
+  const dt_compute_backend_t *backend = dt_compute_device_backend(devid, &local);
+  if(backend) backend->events_reset(local);
+}
+
+int dt_compute_events_flush(const int devid, const int reset)
+{
+  int local;
+  const dt_compute_backend_t *backend = dt_compute_device_backend(devid, &local);
+  return backend ? backend->events_flush(local, reset) : 0;
+}
+
+int dt_compute_events_count(const int devid)
+{
+  int local;
+  const dt_compute_backend_t *backend = dt_compute_device_backend(devid, &local);
+  return backend ? backend->events_count(local) : 0;
+}
+
+double dt_compute_events_time(const int devid, const int first, const int last)
+{
+  int local;
+  const dt_compute_backend_t *backend = dt_compute_device_backend(devid, &local);
+  return backend ? backend->events_time(local, first, last) : 0.0;
+}
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
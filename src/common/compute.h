@@ -0,0 +1,92 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2017 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <stddef.h>
+
+#define DT_COMPUTE_MAX_BACKENDS 4
+
+/**
+ * device layer between the pixelpipe and the accelerator apis. every backend numbers its devices from 0, the
+ * pipe sees them one after the other in the order the backends were registered in. opencl always comes
+ * first, so its device ids are the ones the process_cl() callbacks of the modules get.
+ */
+typedef enum dt_compute_backend_type_t
+{
+  DT_COMPUTE_BACKEND_OPENCL = 0,
+  DT_COMPUTE_BACKEND_VULKAN = 1
+} dt_compute_backend_type_t;
+
+typedef struct dt_compute_memory_t
+{
+  size_t in_use;
+  size_t peak;
+  size_t total;
+} dt_compute_memory_t;
+
+/**
+ * what a backend has to provide. lock_device() gets the pipe type and returns a device of the backend or -1,
+ * all other device arguments are the backend's own numbers.
+ */
+typedef struct dt_compute_backend_t
+{
+  dt_compute_backend_type_t type;
+  const char *name;
+  int (*is_enabled)(void);
+  int (*num_devices)(void);
+  const char *(*device_name)(const int dev);
+  int (*lock_device)(const int pipetype);
+  void (*unlock_device)(const int dev);
+  void (*memory)(const int dev, dt_compute_memory_t *mem);
+  void (*events_reset)(const int dev);
+  int (*events_flush)(const int dev, const int reset);
+  int (*events_count)(const int dev);
+  double (*events_time)(const int dev, const int first, const int last);
+} dt_compute_backend_t;
+
+/** registers the backends compiled in, after their own initialization */
+void dt_compute_init(void);
+void dt_compute_cleanup(void);
+
+/** adds a backend, returns 1 if there is no room for it */
+int dt_compute_register(const dt_compute_backend_t *backend);
+
+/** total number of devices of all enabled backends */
+int dt_compute_num_devices(void);
+
+/** backend and its own device number of a device, -1 and NULL if there is no such device */
+const dt_compute_backend_t *dt_compute_device_backend(const int devid, int *local);
+const char *dt_compute_device_name(const int devid);
+
+/** locks a device for the pipe type, trying the backends in turn, -1 for the cpu */
+int dt_compute_lock_device(const int pipetype);
+void dt_compute_unlock_device(const int devid);
+
+/** memory statistics of a device, all zero if it has none */
+void dt_compute_memory(const int devid, dt_compute_memory_t *mem);
+
+/** events of the work queued on a device, as dt_opencl_events_*() */
+void dt_compute_events_reset(const int devid);
+int dt_compute_events_flush(const int devid, const int reset);
+int dt_compute_events_count(const int devid);
+double dt_compute_events_time(const int devid, const int first, const int last);
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
@@ -53,10 +53,19 @@ dt_cpu_flags_t dt_detect_cpu_features()
                  : "=a"(ax), "=c"(cx), "=d"(dx)                                                              \
                  : "0"(cmd))
 
+// with a sub leaf, and ebx moved out of the way of the pic register
+#define cpuid_count(cmd, sub) \
+  __asm volatile("push %%" R_BX "\n"                                                                         \
+                 "cpuid\n"                                                                                   \
+                 "mov %%" R_BX ", %1\n"                                                                      \
+                 "pop %%" R_BX "\n"                                                                          \
+                 : "=a"(ax), "=S"(bx), "=c"(cx), "=d"(dx)                                                    \
+                 : "0"(cmd), "2"(sub))
+
 #ifdef __x86_64__
-  guint64 ax, cx, dx, tmp;
+  guint64 ax, bx, cx, dx, tmp;
 #else
-  guint32 ax, cx, dx, tmp;
+  guint32 ax, bx, cx, dx, tmp;
 #endif
 
   static dt_cpu_flags_t cpuflags = -1;
@@ -85,6 +94,7 @@ dt_cpu_flags_t dt_detect_cpu_features()
     {
       /* Get the standard level */
       cpuid(0x00000000);
+      const guint32 max_level = ax;
 
       if(ax)
       {
@@ -100,6 +110,25 @@ dt_cpu_flags_t dt_detect_cpu_features()
         if(cx & 0x00000200) cpuflags |= CPU_FLAG_SSSE3;
         if(cx & 0x00040000) cpuflags |= CPU_FLAG_SSE4_1;
         if(cx & 0x00080000) cpuflags |= CPU_FLAG_SSE4_2;
+
+        /* the wide registers need the support of the os as well, which xgetbv tells if osxsave is set */
+        if((cx & 0x18000000) == 0x18000000)
+        {
+          const int fma = (cx & 0x00001000) != 0;
+          __asm volatile("xgetbv" : "=a"(ax), "=d"(dx) : "c"(0));
+          const guint32 xcr0 = ax;
+          if((xcr0 & 0x06) == 0x06)
+          {
+            cpuflags |= CPU_FLAG_AVX;
+            if(fma) cpuflags |= CPU_FLAG_FMA;
+            if(max_level >= 7)
+            {
+              cpuid_count(0x00000007, 0);
+              if(bx & 0x00000020) cpuflags |= CPU_FLAG_AVX2;
+              if((bx & 0x00010000) && (xcr0 & 0xe0) == 0xe0) cpuflags |= CPU_FLAG_AVX512F;
+            }
+          }
+        }
       }
 
       /* Are there extensions? */
@@ -134,6 +163,9 @@ dt_cpu_flags_t dt_detect_cpu_features()
     report("SSE4.1", CPU_FLAG_SSE4_1);
     report("SSE4.2", CPU_FLAG_SSE4_2);
     report("AVX", CPU_FLAG_AVX);
+    report("AVX2", CPU_FLAG_AVX2);
+    report("FMA", CPU_FLAG_FMA);
+    report("AVX512F", CPU_FLAG_AVX512F);
 #undef report
   }
 #endif
@@ -141,6 +173,7 @@ dt_cpu_flags_t dt_detect_cpu_features()
   return cpuflags;
 
 #undef cpuid
+#undef cpuid_count
 }
 #else
 dt_cpu_flags_t dt_detect_cpu_features()
@@ -33,7 +33,10 @@ typedef enum dt_cpu_flags_t
   CPU_FLAG_SSSE3 = 1 << 8,
   CPU_FLAG_SSE4_1 = 1 << 9,
   CPU_FLAG_SSE4_2 = 1 << 10,
-  CPU_FLAG_AVX = 1 << 11
+  CPU_FLAG_AVX = 1 << 11,
+  CPU_FLAG_AVX2 = 1 << 12,
+  CPU_FLAG_FMA = 1 << 13,
+  CPU_FLAG_AVX512F = 1 << 14
 } dt_cpu_flags_t;
 
 dt_cpu_flags_t dt_detect_cpu_features();
@@ -30,26 +30,34 @@
 
 #include "common/collection.h"
 #include "common/colorspaces.h"
+#include "common/compute.h"
 #include "common/darktable.h"
 #include "common/exif.h"
 #include "common/pwstorage/pwstorage.h"
 #include "common/selection.h"
+#include "common/simd.h"
 #include "common/system_signal_handling.h"
+#include "common/timers.h"
+#include "common/trace.h"
 #ifdef HAVE_GPHOTO2
 #include "common/camera_control.h"
 #endif
 #include "bauhaus/bauhaus.h"
+#include "common/buffer_pool.h"
 #include "common/cpuid.h"
 #include "common/film.h"
+#include "common/film_watch.h"
 #include "common/grealpath.h"
 #include "common/image.h"
 #include "common/image_cache.h"
 #include "common/imageio_module.h"
+#include "common/memory.h"
 #include "common/mipmap_cache.h"
 #include "common/noiseprofiles.h"
 #include "common/opencl.h"
 #include "common/points.h"
 #include "common/resource_limits.h"
+#include "common/tags.h"
 #include "common/undo.h"
 #include "control/conf.h"
 #include "control/control.h"
@@ -58,6 +66,7 @@
 #include "control/signal.h"
 #include "develop/blend.h"
 #include "develop/imageop.h"
+#include "develop/pixelpipe_routing.h"
 #include "gui/gtk.h"
 #include "gui/guides.h"
 #include "gui/presets.h"
@@ -107,7 +116,9 @@ darktable_t darktable;
 static int usage(const char *argv0)
 {
   printf("usage: %s [-d "
-         "{all,cache,camctl,camsupport,control,dev,input,lighttable,lua,masks,memory,nan,opencl,perf,pwstorage,print,sql}]"
+         "{all,cache,camctl,camsupport,control,dev,input,lighttable,locks,lua,masks,memory,nan,opencl,perf,pwstorage,"
+         "print,sql,"
+         "timers,tiling,trace}]"
          " [IMG_1234.{RAW,..}|image_folder/]",
          argv0);
 #ifdef HAVE_OPENCL
@@ -279,14 +290,29 @@ static void dt_codepaths_init()
 #else
     dt_cpu_flags_t flags = dt_detect_cpu_features();
     darktable.codepath.SSE2 = ((flags & (CPU_FLAG_SSE)) && (flags & (CPU_FLAG_SSE2)));
+#endif
+#if defined(__i386__) || defined(__x86_64__)
+    // __builtin_cpu_supports() doesn't know whether the os saves the wide registers, cpuid does
+    const dt_cpu_flags_t wide = dt_detect_cpu_features();
+    darktable.codepath.AVX2 = darktable.codepath.SSE2 && (wide & CPU_FLAG_AVX2) && (wide & CPU_FLAG_FMA);
+    darktable.codepath.AVX512 = darktable.codepath.AVX2 && (wide & CPU_FLAG_AVX512F);
+#endif
+#if defined(DT_SIMD_NEON)
+    // neon is part of every 64 bit arm cpu
+    darktable.codepath.NEON = 1;
 #endif
   }
 
   // second, apply overrides from conf
   // NOTE: all intrinsics sets can only be overridden to OFF
   if(!dt_conf_get_bool("codepaths/sse2")) darktable.codepath.SSE2 = 0;
+  if(!darktable.codepath.SSE2 || !dt_conf_get_bool("codepaths/avx2")) darktable.codepath.AVX2 = 0;
+  if(!darktable.codepath.AVX2 || !dt_conf_get_bool("codepaths/avx512")) darktable.codepath.AVX512 = 0;
+  if(!dt_conf_get_bool("codepaths/neon")) darktable.codepath.NEON = 0;
 
   // last: do we have any intrinsics sets enabled?
+  // neon covers only part of the sse2 code, everything else keeps running the plain code below. the code
+  // paths ported to neon check for it before OPENMP_SIMD.
   darktable.codepath._no_intrinsics = !(darktable.codepath.SSE2);
 
 // if there is no SSE, we must enable plain codepath by default,
@@ -311,6 +337,26 @@ static void dt_codepaths_init()
   }
 }
 
+// the color profiles and the noise profiles only read their files and need nothing but the config, they load on
+// threads of their own while the database is opened
+static void *_init_colorspaces_thread(void *data)
+{
+  dt_times_t start;
+  dt_get_times(&start);
+  darktable.color_profiles = dt_colorspaces_init();
+  dt_show_times(&start, "[dt_init] loading color profiles", NULL);
+  return NULL;
+}
+
+static void *_init_noiseprofiles_thread(void *data)
+{
+  dt_times_t start;
+  dt_get_times(&start);
+  darktable.noiseprofile_parser = dt_noiseprofile_init((const char *)data);
+  dt_show_times(&start, "[dt_init] loading noise profiles", NULL);
+  return NULL;
+}
+
 int dt_init(int argc, char *argv[], const gboolean init_gui, const gboolean load_data, lua_State *L)
 {
 #ifndef __WIN32__
@@ -584,12 +630,20 @@ int dt_init(int argc, char *argv[], const gboolean init_gui, const gboolean load
           darktable.unmuted |= DT_DEBUG_NAN; // check for NANs when processing the pipe.
         else if(!strcmp(argv[k + 1], "masks"))
           darktable.unmuted |= DT_DEBUG_MASKS; // masks related stuff.
+        else if(!strcmp(argv[k + 1], "locks"))
+          darktable.unmuted |= DT_DEBUG_LOCKS; // where threads wait for each other's locks
         else if(!strcmp(argv[k + 1], "lua"))
           darktable.unmuted |= DT_DEBUG_LUA; // lua errors are reported on console
         else if(!strcmp(argv[k + 1], "print"))
           darktable.unmuted |= DT_DEBUG_PRINT; // print errors are reported on console
         else if(!strcmp(argv[k + 1], "camsupport"))
           darktable.unmuted |= DT_DEBUG_CAMERA_SUPPORT; // camera support warnings are reported on console
+        else if(!strcmp(argv[k + 1], "tiling"))
+          darktable.unmuted |= DT_DEBUG_TILING; // where the modules of a pipe run and why
+        else if(!strcmp(argv[k + 1], "timers"))
+          darktable.unmuted |= DT_DEBUG_TIMERS; // aggregated timings of pipes, modules, loads and queries
+        else if(!strcmp(argv[k + 1], "trace"))
+          darktable.unmuted |= DT_DEBUG_TRACE; // timeline of jobs, pipes and opencl kernels
         else
           return usage(argv[0]);
         k++;
@@ -692,6 +746,8 @@ int dt_init(int argc, char *argv[], const gboolean init_gui, const gboolean load
   }
   dt_loc_init_user_config_dir(configdir_from_command);
   dt_loc_init_user_cache_dir(cachedir_from_command);
+  dt_trace_init();
+  dt_pthread_lock_set_profiling(darktable.unmuted & DT_DEBUG_LOCKS);
 
 #ifdef USE_LUA
   dt_lua_init_early(L);
@@ -707,6 +763,7 @@ int dt_init(int argc, char *argv[], const gboolean init_gui, const gboolean load
   // initialize the config backend. this needs to be done first...
   darktable.conf = (dt_conf_t *)calloc(1, sizeof(dt_conf_t));
   dt_conf_init(darktable.conf, darktablerc, config_override);
+  dt_timers_init();
   g_slist_free_full(config_override, g_free);
 
   // set the interface language
@@ -754,11 +811,25 @@ int dt_init(int argc, char *argv[], const gboolean init_gui, const gboolean load
   // detect cpu features and decide which codepaths to enable
   dt_codepaths_init();
 
-  // get the list of color profiles
-  darktable.color_profiles = dt_colorspaces_init();
+  dt_times_t start, phase;
+  dt_get_times(&start);
+
+  // get the list of color profiles and the noise profiles, both are needed only once the caches are set up
+  pthread_t colorspaces_thread, noiseprofiles_thread;
+  const gboolean colorspaces_threaded = !dt_pthread_create(&colorspaces_thread, _init_colorspaces_thread, NULL);
+  if(!colorspaces_threaded) _init_colorspaces_thread(NULL);
+  const gboolean noiseprofiles_threaded
+      = !dt_pthread_create(&noiseprofiles_thread, _init_noiseprofiles_thread, noiseprofiles_from_command);
+  if(!noiseprofiles_threaded) _init_noiseprofiles_thread(noiseprofiles_from_command);
 
   // initialize the database
+  dt_get_times(&phase);
   darktable.db = dt_database_init(dbfilename_from_command, load_data);
+  dt_show_times(&phase, "[dt_init] opening the database", NULL);
+
+  if(colorspaces_threaded) pthread_join(colorspaces_thread, NULL);
+  if(noiseprofiles_threaded) pthread_join(noiseprofiles_thread, NULL);
+
   if(darktable.db == NULL)
   {
     printf("ERROR : cannot open database\n");
@@ -797,15 +868,6 @@ int dt_init(int argc, char *argv[], const gboolean init_gui, const gboolean load
   // Initialize the signal system
   darktable.signals = dt_control_signal_init();
 
-  // Make sure that the database and xmp files are in sync
-  // We need conf and db to be up and running for that which is the case here.
-  // FIXME: is this also useful in non-gui mode?
-  GList *changed_xmp_files = NULL;
-  if(init_gui && dt_conf_get_bool("run_crawler_on_start"))
-  {
-    changed_xmp_files = dt_control_crawler_run();
-  }
-
   // FIXME: move there into dt_database_t
   dt_pthread_mutex_init(&(darktable.db_insert), NULL);
   dt_pthread_mutex_init(&(darktable.plugin_threadsafe), NULL);
@@ -848,26 +910,37 @@ int dt_init(int argc, char *argv[], const gboolean init_gui, const gboolean load
 
   darktable.opencl = (dt_opencl_t *)calloc(1, sizeof(dt_opencl_t));
 #ifdef HAVE_OPENCL
+  dt_get_times(&phase);
   dt_opencl_init(darktable.opencl, exclude_opencl, print_statistics);
+  dt_show_times(&phase, "[dt_init] starting opencl", NULL);
 #endif
+  dt_compute_init();
 
   darktable.points = (dt_points_t *)calloc(1, sizeof(dt_points_t));
   dt_points_init(darktable.points, dt_get_num_threads());
 
-  darktable.noiseprofile_parser = dt_noiseprofile_init(noiseprofiles_from_command);
+  // the caches register with it
+  darktable.memory = (dt_memory_t *)calloc(1, sizeof(dt_memory_t));
+  dt_memory_init(darktable.memory);
+  dt_buffer_pool_init();
 
   // must come before mipmap_cache, because that one will need to access
   // image dimensions stored in here:
+  dt_get_times(&phase);
   darktable.image_cache = (dt_image_cache_t *)calloc(1, sizeof(dt_image_cache_t));
   dt_image_cache_init(darktable.image_cache);
 
   darktable.mipmap_cache = (dt_mipmap_cache_t *)calloc(1, sizeof(dt_mipmap_cache_t));
   dt_mipmap_cache_init(darktable.mipmap_cache);
 
+  dt_image_sidecar_init();
+  dt_show_times(&phase, "[dt_init] setting up the caches", NULL);
+
   // The GUI must be initialized before the views, because the init()
   // functions of the views depend on darktable.control->accels_* to register
   // their keyboard accelerators
 
+  dt_get_times(&phase);
   if(init_gui)
   {
     darktable.gui = (dt_gui_gtk_t *)calloc(1, sizeof(dt_gui_gtk_t));
@@ -879,6 +952,7 @@ int dt_init(int argc, char *argv[], const gboolean init_gui, const gboolean load
 
   darktable.view_manager = (dt_view_manager_t *)calloc(1, sizeof(dt_view_manager_t));
   dt_view_manager_init(darktable.view_manager);
+  dt_show_times(&phase, "[dt_init] setting up the gui and views", NULL);
 
   // check whether we were able to load darkroom view. if we failed, we'll crash everywhere later on.
   if(!darktable.develop) return 1;
@@ -887,7 +961,15 @@ int dt_init(int argc, char *argv[], const gboolean init_gui, const gboolean load
   dt_imageio_init(darktable.imageio);
 
   // load the darkroom mode plugins once:
+  dt_get_times(&phase);
   dt_iop_load_modules_so();
+  dt_show_times(&phase, "[dt_init] loading the processing modules", NULL);
+
+#ifdef HAVE_OPENCL
+  // without a gui there is nothing to do meanwhile, and the first export should use the devices
+  if(!init_gui)
+    while(dt_opencl_is_inited() && !dt_opencl_is_ready()) g_usleep(10000);
+#endif
 
   if(init_gui)
   {
@@ -897,6 +979,7 @@ int dt_init(int argc, char *argv[], const gboolean init_gui, const gboolean load
     darktable.camctl = dt_camctl_new();
 #endif
 
+    dt_get_times(&phase);
     darktable.lib = (dt_lib_t *)calloc(1, sizeof(dt_lib_t));
     dt_lib_init(darktable.lib);
 
@@ -904,6 +987,7 @@ int dt_init(int argc, char *argv[], const gboolean init_gui, const gboolean load
 
     // init the gui part of views
     dt_view_manager_gui_init(darktable.view_manager);
+    dt_show_times(&phase, "[dt_init] loading the utility modules", NULL);
     // Loading the keybindings
     char keyfile[PATH_MAX] = { 0 };
 
@@ -932,13 +1016,16 @@ int dt_init(int argc, char *argv[], const gboolean init_gui, const gboolean load
   {
     fprintf(stderr, "[memory] after successful startup\n");
     dt_print_mem_usage();
+    dt_memory_print(darktable.memory);
   }
 
   dt_image_local_copy_synch();
 
 /* init lua last, since it's user made stuff it must be in the real environment */
 #ifdef USE_LUA
+  dt_get_times(&phase);
   dt_lua_init(darktable.lua_state.state, lua_command);
+  dt_show_times(&phase, "[dt_init] running the lua scripts", NULL);
 #endif
 
   if(init_gui)
@@ -983,13 +1070,21 @@ int dt_init(int argc, char *argv[], const gboolean init_gui, const gboolean load
 #endif
   }
 
-  // last but not least construct the popup that asks the user about images whose xmp files are newer than the
-  // db entry
-  if(init_gui && changed_xmp_files)
+  // make sure that the database and xmp files are in sync. this runs in the background once the gui is up, a
+  // popup asks the user about images whose xmp files are newer than the db entry.
+  // FIXME: is this also useful in non-gui mode?
+  if(init_gui && dt_conf_get_bool("run_crawler_on_start"))
+  {
+    dt_control_crawler_run_job();
+  }
+
+  if(init_gui)
   {
-    dt_control_crawler_show_image_list(changed_xmp_files);
+    dt_film_watch_init();
+    dt_tag_init();
   }
 
+  dt_show_times(&start, "[dt_init] startup", NULL);
   return 0;
 }
 
@@ -1006,10 +1101,12 @@ void dt_cleanup()
 #endif
   if(init_gui)
   {
+    dt_film_watch_cleanup();
     dt_ctl_switch_mode_to("");
     dt_dbus_destroy(darktable.dbus);
 
     dt_control_shutdown(darktable.control);
+    dt_tag_cleanup();
 
     dt_lib_cleanup(darktable.lib);
     free(darktable.lib);
@@ -1025,10 +1122,17 @@ void dt_cleanup()
     free(darktable.imageio);
     free(darktable.gui);
   }
+  // the sidecars still pending are written while the library is open
+  dt_image_cache_flush(darktable.image_cache);
+  dt_image_sidecar_cleanup();
   dt_image_cache_cleanup(darktable.image_cache);
   free(darktable.image_cache);
   dt_mipmap_cache_cleanup(darktable.mipmap_cache);
   free(darktable.mipmap_cache);
+  dt_buffer_pool_cleanup();
+  dt_memory_cleanup(darktable.memory);
+  free(darktable.memory);
+  darktable.memory = NULL;
   if(init_gui)
   {
     dt_control_cleanup(darktable.control);
@@ -1041,6 +1145,7 @@ void dt_cleanup()
   dt_points_cleanup(darktable.points);
   free(darktable.points);
   dt_iop_unload_modules_so();
+  dt_compute_cleanup();
   dt_opencl_cleanup(darktable.opencl);
   free(darktable.opencl);
 #ifdef HAVE_GPHOTO2
@@ -1054,6 +1159,7 @@ void dt_cleanup()
 
   dt_guides_cleanup(darktable.guides);
 
+  dt_dev_pixelpipe_routing_cleanup();
   dt_database_destroy(darktable.db);
 
   if(init_gui)
@@ -1068,6 +1174,10 @@ void dt_cleanup()
   dt_pthread_mutex_destroy(&(darktable.capabilities_threadsafe));
 
   dt_exif_cleanup();
+  if(darktable.unmuted & DT_DEBUG_LOCKS) dt_pthread_lock_print(30);
+  dt_pthread_lock_set_profiling(0);
+  dt_timers_cleanup();
+  dt_trace_cleanup();
 }
 
 void dt_print(dt_debug_thread_t thread, const char *msg, ...)
@@ -154,6 +154,7 @@ struct dt_imageio_t;
 struct dt_bauhaus_t;
 struct dt_undo_t;
 struct dt_colorspaces_t;
+struct dt_memory_t;
 
 typedef enum dt_debug_thread_t
 {
@@ -174,15 +175,33 @@ typedef enum dt_debug_thread_t
   DT_DEBUG_INPUT = 1 << 14,
   DT_DEBUG_PRINT = 1 << 15,
   DT_DEBUG_CAMERA_SUPPORT = 1 << 16,
+  DT_DEBUG_TILING = 1 << 17,
+  DT_DEBUG_TRACE = 1 << 18,
+  DT_DEBUG_TIMERS = 1 << 19,
+  DT_DEBUG_LOCKS = 1 << 20,
 } dt_debug_thread_t;
 
 typedef struct dt_codepath_t
 {
   unsigned int SSE2 : 1;
+  unsigned int AVX2 : 1;   // with fma
+  unsigned int AVX512 : 1; // avx512f
+  unsigned int NEON : 1;   // the sse2 code ported to 64 bit arm, see common/simd.h
   unsigned int _no_intrinsics : 1;
   unsigned int OPENMP_SIMD : 1; // always stays the last one
 } dt_codepath_t;
 
+/* with gcc and clang on x86 code is built for the wider instruction sets of darktable.codepath by inlining
+ * always inlined plain c into functions with a target attribute. the wrappers must not contain openmp
+ * regions: those are outlined before inlining and would stay plain. */
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define DT_ALWAYS_INLINE static inline __attribute__((always_inline))
+#define DT_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#define DT_TARGET_AVX512 __attribute__((target("avx512f,avx2,fma")))
+#else
+#define DT_ALWAYS_INLINE static
+#endif
+
 typedef struct darktable_t
 {
   dt_codepath_t codepath;
@@ -201,6 +220,7 @@ typedef struct darktable_t
   struct dt_gui_gtk_t *gui;
   struct dt_mipmap_cache_t *mipmap_cache;
   struct dt_image_cache_t *image_cache;
+  struct dt_memory_t *memory;
   struct dt_bauhaus_t *bauhaus;
   const struct dt_database_t *db;
   const struct dt_pwstorage_t *pwstorage;
@@ -37,8 +37,13 @@
 
 // whenever _create_*_schema() gets changed you HAVE to bump this version and add an update path to
 // _upgrade_*_schema_step()!
-#define CURRENT_DATABASE_VERSION_LIBRARY 15
-#define CURRENT_DATABASE_VERSION_DATA 1
+#define CURRENT_DATABASE_VERSION_LIBRARY 18
+#define CURRENT_DATABASE_VERSION_DATA 2
+
+// idle read connections kept open, more are opened when needed and closed again once they are handed back
+#define DT_DATABASE_MAX_READERS 4
+// frames in the write ahead log after a commit that wake up the checkpoint thread
+#define DT_DATABASE_CHECKPOINT_FRAMES 1000
 
 typedef struct dt_database_t
 {
@@ -54,6 +59,22 @@ typedef struct dt_database_t
   sqlite3 *handle;
 
   gchar *error_message, *error_dbfilename;
+
+  /* statements of dt_database_prepare_cached() nobody uses right now, queues of them by their sql */
+  GHashTable *stmt_cache;
+  dt_pthread_mutex_t stmt_cache_mutex;
+  int stmt_cache_hits, stmt_cache_misses;
+
+  /* in wal mode: idle read-only connections of dt_database_get_reader(), and the connection and thread
+   * copying the log back into the databases */
+  gboolean wal;
+  GQueue *readers;
+  dt_pthread_mutex_t readers_mutex;
+  sqlite3 *checkpoint_handle;
+  pthread_t checkpoint_thread;
+  pthread_cond_t checkpoint_cond;
+  dt_pthread_mutex_t checkpoint_mutex;
+  gboolean checkpoint_pending, checkpoint_stop;
 } dt_database_t;
 
 
@@ -967,6 +988,49 @@ static int _upgrade_library_schema_step(dt_database_t *db, int version)
 
     sqlite3_exec(db->handle, "COMMIT", NULL, NULL, NULL);
     new_version = 15;
+  }
+  else if(version == 15)
+  {
+    // 15 -> 16 indexes covering the filters of the collect module, so they don't scan whole tables
+    sqlite3_exec(db->handle, "BEGIN TRANSACTION", NULL, NULL, NULL);
+
+    TRY_EXEC("DROP INDEX IF EXISTS main.tagged_images_tagid_index",
+             "[init] can't drop index `tagged_images_tagid_index' from database\n");
+    TRY_EXEC("CREATE INDEX main.tagged_images_tagid_index ON tagged_images (tagid, imgid)",
+             "[init] can't create index `tagged_images_tagid_index' in database\n");
+    TRY_EXEC("CREATE INDEX main.images_maker_model_index ON images (maker, model)",
+             "[init] can't create index `images_maker_model_index' in database\n");
+    TRY_EXEC("CREATE INDEX main.images_lens_index ON images (lens)",
+             "[init] can't create index `images_lens_index' in database\n");
+    TRY_EXEC("CREATE INDEX main.images_datetime_taken_index ON images (datetime_taken)",
+             "[init] can't create index `images_datetime_taken_index' in database\n");
+    TRY_EXEC("CREATE INDEX main.color_labels_color_index ON color_labels (color, imgid)",
+             "[init] can't create index `color_labels_color_index' in database\n");
+    TRY_EXEC("CREATE INDEX main.metadata_key_value_index ON meta_data (key, value, id)",
+             "[init] can't create index `metadata_key_value_index' in database\n");
+
+    sqlite3_exec(db->handle, "COMMIT", NULL, NULL, NULL);
+    new_version = 16;
+  }
+  else if(version == 16)
+  {
+    // 16 -> 17 loading and writing the history of an image scanned all masks of the library
+    sqlite3_exec(db->handle, "BEGIN TRANSACTION", NULL, NULL, NULL);
+
+    TRY_EXEC("CREATE INDEX main.mask_imgid_index ON mask (imgid)",
+             "[init] can't create index `mask_imgid_index' in database\n");
+
+    sqlite3_exec(db->handle, "COMMIT", NULL, NULL, NULL);
+    new_version = 17;
+  }
+  else if(version == 17)
+  {
+    // 17 -> 18 the crawler skips folders that didn't change since it looked at them
+    sqlite3_exec(db->handle, "BEGIN TRANSACTION", NULL, NULL, NULL);
+    TRY_EXEC("ALTER TABLE main.film_rolls ADD COLUMN crawl_timestamp INTEGER",
+             "[init] can't add `crawl_timestamp' column to film_rolls table in database\n");
+    sqlite3_exec(db->handle, "COMMIT", NULL, NULL, NULL);
+    new_version = 18;
   } // maybe in the future, see commented out code elsewhere
     //   else if(version == XXX)
     //   {
@@ -1006,6 +1070,14 @@ static int _upgrade_data_schema_step(dt_database_t *db, int version)
     new_version = 1; // the version we transformed the db to. this way it might be possible to roll back or
     // add fast paths
   }
+  else if(version == 1)
+  {
+    // timings of the modules on the cpu and the opencl devices, see develop/pixelpipe_routing.h
+    sqlite3_exec(db->handle, "CREATE TABLE data.module_timings (operation VARCHAR, device VARCHAR, "
+                             "bucket INTEGER, time REAL, count INTEGER, PRIMARY KEY (operation, device, bucket))",
+                 NULL, NULL, NULL);
+    new_version = 2;
+  }
   else
     new_version = version; // should be the fallback so that calling code sees that we are in an infinite loop
 
@@ -1038,7 +1110,7 @@ static gboolean _upgrade_library_schema(dt_database_t *db, int version)
  * _upgrade_data_schema_step() instead. */
 static gboolean _upgrade_data_schema(dt_database_t *db, int version)
 {
-  while(version < CURRENT_DATABASE_VERSION_LIBRARY)
+  while(version < CURRENT_DATABASE_VERSION_DATA)
   {
     int new_version = _upgrade_data_schema_step(db, version);
     if(new_version == version)
@@ -1068,7 +1140,7 @@ static void _create_library_schema(dt_database_t *db)
                //                        "folder VARCHAR(1024), external_drive VARCHAR(1024))", //
                //                        FIXME: make sure to bump CURRENT_DATABASE_VERSION_LIBRARY and add a
                //                        case to _upgrade_library_schema_step when adding this!
-               "folder VARCHAR(1024) NOT NULL)",
+               "folder VARCHAR(1024) NOT NULL, crawl_timestamp INTEGER)",
                NULL, NULL, NULL);
   sqlite3_exec(db->handle, "CREATE INDEX main.film_rolls_folder_index ON film_rolls (folder)", NULL, NULL, NULL);
   ////////////////////////////// images
@@ -1089,6 +1161,10 @@ static void _create_library_schema(dt_database_t *db)
   sqlite3_exec(db->handle, "CREATE INDEX main.images_group_id_index ON images (group_id)", NULL, NULL, NULL);
   sqlite3_exec(db->handle, "CREATE INDEX main.images_film_id_index ON images (film_id)", NULL, NULL, NULL);
   sqlite3_exec(db->handle, "CREATE INDEX main.images_filename_index ON images (filename)", NULL, NULL, NULL);
+  sqlite3_exec(db->handle, "CREATE INDEX main.images_maker_model_index ON images (maker, model)", NULL, NULL, NULL);
+  sqlite3_exec(db->handle, "CREATE INDEX main.images_lens_index ON images (lens)", NULL, NULL, NULL);
+  sqlite3_exec(db->handle, "CREATE INDEX main.images_datetime_taken_index ON images (datetime_taken)", NULL, NULL,
+               NULL);
   ////////////////////////////// selected_images
   sqlite3_exec(db->handle, "CREATE TABLE main.selected_images (imgid INTEGER PRIMARY KEY)", NULL, NULL, NULL);
   ////////////////////////////// history
@@ -1104,10 +1180,12 @@ static void _create_library_schema(dt_database_t *db)
                "CREATE TABLE main.mask (imgid INTEGER, formid INTEGER, form INTEGER, name VARCHAR(256), "
                "version INTEGER, points BLOB, points_count INTEGER, source BLOB)",
                NULL, NULL, NULL);
+  sqlite3_exec(db->handle, "CREATE INDEX main.mask_imgid_index ON mask (imgid)", NULL, NULL, NULL);
   ////////////////////////////// tagged_images
   sqlite3_exec(db->handle, "CREATE TABLE main.tagged_images (imgid INTEGER, tagid INTEGER, "
                            "PRIMARY KEY (imgid, tagid))", NULL, NULL, NULL);
-  sqlite3_exec(db->handle, "CREATE INDEX main.tagged_images_tagid_index ON tagged_images (tagid)", NULL, NULL, NULL);
+  sqlite3_exec(db->handle, "CREATE INDEX main.tagged_images_tagid_index ON tagged_images (tagid, imgid)", NULL, NULL,
+               NULL);
   ////////////////////////////// used_tags
   sqlite3_exec(db->handle, "CREATE TABLE main.used_tags (id INTEGER, name VARCHAR NOT NULL)", NULL, NULL, NULL);
   sqlite3_exec(db->handle, "CREATE UNIQUE INDEX main.used_tags_idx ON used_tags (id, name)", NULL, NULL, NULL);
@@ -1115,9 +1193,13 @@ static void _create_library_schema(dt_database_t *db)
   sqlite3_exec(db->handle, "CREATE TABLE main.color_labels (imgid INTEGER, color INTEGER)", NULL, NULL, NULL);
   sqlite3_exec(db->handle, "CREATE UNIQUE INDEX main.color_labels_idx ON color_labels (imgid, color)", NULL, NULL,
                NULL);
+  sqlite3_exec(db->handle, "CREATE INDEX main.color_labels_color_index ON color_labels (color, imgid)", NULL, NULL,
+               NULL);
   ////////////////////////////// meta_data
   sqlite3_exec(db->handle, "CREATE TABLE main.meta_data (id INTEGER, key INTEGER, value VARCHAR)", NULL, NULL, NULL);
   sqlite3_exec(db->handle, "CREATE INDEX main.metadata_index ON meta_data (id, key)", NULL, NULL, NULL);
+  sqlite3_exec(db->handle, "CREATE INDEX main.metadata_key_value_index ON meta_data (key, value, id)", NULL, NULL,
+               NULL);
 }
 
 /* create the current database schema and set the version in db_info accordingly */
@@ -1159,6 +1241,10 @@ static void _create_data_schema(dt_database_t *db)
                NULL, NULL, NULL);
   sqlite3_exec(db->handle, "CREATE UNIQUE INDEX data.presets_idx ON presets (name, operation, op_version)",
                NULL, NULL, NULL);
+  ////////////////////////////// module_timings
+  sqlite3_exec(db->handle, "CREATE TABLE data.module_timings (operation VARCHAR, device VARCHAR, "
+                           "bucket INTEGER, time REAL, count INTEGER, PRIMARY KEY (operation, device, bucket))",
+               NULL, NULL, NULL);
 }
 
 // create the in-memory tables
@@ -1187,6 +1273,9 @@ static void _create_memory_schema(dt_database_t *db)
       "operation VARCHAR(256), op_params BLOB, enabled INTEGER, "
       "blendop_params BLOB, blendop_version INTEGER, multi_priority INTEGER, multi_name VARCHAR(256))",
       NULL, NULL, NULL);
+  sqlite3_exec(db->handle, "CREATE TABLE memory.style_images (imgid INTEGER PRIMARY KEY, offs INTEGER)", NULL,
+               NULL, NULL);
+  sqlite3_exec(db->handle, "CREATE TABLE memory.lua_images (imgid INTEGER PRIMARY KEY)", NULL, NULL, NULL);
 }
 
 static void _sanitize_db(dt_database_t *db)
@@ -1492,8 +1581,230 @@ static gboolean _lock_databases(dt_database_t *db)
   return TRUE;
 }
 
+/* a connection of its own to the library with data attached, NULL if it can't be opened */
+static sqlite3 *_database_open_connection(const dt_database_t *db, const int flags)
+{
+  sqlite3 *handle = NULL;
+  if(sqlite3_open_v2(db->dbfilename_library, &handle, flags, NULL) != SQLITE_OK)
+  {
+    sqlite3_close(handle);
+    return NULL;
+  }
+  sqlite3_stmt *stmt;
+  int rc = sqlite3_prepare_v2(handle, "ATTACH DATABASE ?1 AS data", -1, &stmt, NULL);
+  sqlite3_bind_text(stmt, 1, db->dbfilename_data, -1, SQLITE_TRANSIENT);
+  if(rc == SQLITE_OK) rc = sqlite3_step(stmt) == SQLITE_DONE ? SQLITE_OK : SQLITE_ERROR;
+  sqlite3_finalize(stmt);
+  if(rc != SQLITE_OK)
+  {
+    sqlite3_close(handle);
+    return NULL;
+  }
+  sqlite3_busy_timeout(handle, 1000);
+  return handle;
+}
+
+/* called by sqlite after every commit of the write connection, instead of it checkpointing right there */
+static int _database_wal_hook(void *data, sqlite3 *handle, const char *schema, int frames)
+{
+  dt_database_t *db = (dt_database_t *)data;
+  if(frames < DT_DATABASE_CHECKPOINT_FRAMES) return SQLITE_OK;
+  dt_pthread_mutex_lock(&db->checkpoint_mutex);
+  db->checkpoint_pending = TRUE;
+  pthread_cond_signal(&db->checkpoint_cond);
+  dt_pthread_mutex_unlock(&db->checkpoint_mutex);
+  return SQLITE_OK;
+}
+
+/* passive checkpoints copy what they can without waiting for the readers or the writer */
+static void *_database_checkpoint_thread(void *data)
+{
+  dt_database_t *db = (dt_database_t *)data;
+  dt_pthread_mutex_lock(&db->checkpoint_mutex);
+  while(!db->checkpoint_stop)
+  {
+    if(!db->checkpoint_pending)
+    {
+      dt_pthread_cond_wait(&db->checkpoint_cond, &db->checkpoint_mutex);
+      continue;
+    }
+    db->checkpoint_pending = FALSE;
+    dt_pthread_mutex_unlock(&db->checkpoint_mutex);
+
+    int frames = 0, copied = 0;
+    const double start = dt_get_wtime();
+    sqlite3_wal_checkpoint_v2(db->checkpoint_handle, NULL, SQLITE_CHECKPOINT_PASSIVE, &frames, &copied);
+    dt_print(DT_DEBUG_SQL, "[sql] checkpoint copied %d of %d frames in %.3f secs\n", copied, frames,
+             dt_get_wtime() - start);
+
+    dt_pthread_mutex_lock(&db->checkpoint_mutex);
+  }
+  dt_pthread_mutex_unlock(&db->checkpoint_mutex);
+  return NULL;
+}
+
+/* switches library and data to a write ahead log, so readers on connections of their own don't wait for the
+ * writer and the other way round. databases in memory stay as they are, and so does everything if the log
+ * can't be set up. */
+static void _database_start_wal(dt_database_t *db)
+{
+  if(!strcmp(db->dbfilename_library, ":memory:") || !strcmp(db->dbfilename_data, ":memory:")) return;
+
+  sqlite3_stmt *stmt;
+  gboolean wal = TRUE;
+  const char *pragmas[] = { "PRAGMA main.journal_mode = WAL", "PRAGMA data.journal_mode = WAL" };
+  for(int k = 0; k < 2; k++)
+  {
+    if(sqlite3_prepare_v2(db->handle, pragmas[k], -1, &stmt, NULL) != SQLITE_OK) return;
+    if(sqlite3_step(stmt) != SQLITE_ROW || g_ascii_strcasecmp((const char *)sqlite3_column_text(stmt, 0), "wal"))
+      wal = FALSE;
+    sqlite3_finalize(stmt);
+  }
+  if(!wal)
+  {
+    fprintf(stderr, "[init] can't switch the databases to wal mode, staying with one connection\n");
+    sqlite3_exec(db->handle, "PRAGMA main.journal_mode = MEMORY", NULL, NULL, NULL);
+    sqlite3_exec(db->handle, "PRAGMA data.journal_mode = MEMORY", NULL, NULL, NULL);
+    return;
+  }
+
+  db->readers = g_queue_new();
+  dt_pthread_mutex_init(&db->readers_mutex, NULL);
+  db->wal = TRUE;
+
+  db->checkpoint_handle = _database_open_connection(db, SQLITE_OPEN_READWRITE);
+  if(!db->checkpoint_handle) return; // sqlite checkpoints on the write connection then
+  dt_pthread_mutex_init(&db->checkpoint_mutex, NULL);
+  pthread_cond_init(&db->checkpoint_cond, NULL);
+  if(dt_pthread_create(&db->checkpoint_thread, _database_checkpoint_thread, db))
+  {
+    pthread_cond_destroy(&db->checkpoint_cond);
+    dt_pthread_mutex_destroy(&db->checkpoint_mutex);
+    sqlite3_close(db->checkpoint_handle);
+    db->checkpoint_handle = NULL;
+    return;
+  }
+  sqlite3_wal_hook(db->handle, _database_wal_hook, db);
+}
+
+#ifndef _DEBUG
+/* with `-d locks` sqlite gets mutexes built on dt_pthread_mutex_t, so the time spent waiting for the database
+ * shows up in the lock profile. the site is the mutex type, the recursive ones are those of the connections. */
+typedef struct dt_database_mutex_t
+{
+  dt_pthread_mutex_t lock;
+  int id;
+  pthread_t owner;
+  int depth;
+} dt_database_mutex_t;
+
+#define DT_DATABASE_STATIC_MUTEXES 32
+static dt_database_mutex_t _database_static_mutexes[DT_DATABASE_STATIC_MUTEXES];
+static const char *_database_mutex_file = "sqlite3";
+
+static int _database_mutex_init(void)
+{
+  for(int k = 0; k < DT_DATABASE_STATIC_MUTEXES; k++)
+  {
+    dt_pthread_mutex_init(&_database_static_mutexes[k].lock, NULL);
+    _database_static_mutexes[k].id = k;
+    _database_static_mutexes[k].depth = 0;
+  }
+  return SQLITE_OK;
+}
+
+static int _database_mutex_end(void)
+{
+  for(int k = 0; k < DT_DATABASE_STATIC_MUTEXES; k++) dt_pthread_mutex_destroy(&_database_static_mutexes[k].lock);
+  return SQLITE_OK;
+}
+
+static sqlite3_mutex *_database_mutex_alloc(int id)
+{
+  if(id != SQLITE_MUTEX_FAST && id != SQLITE_MUTEX_RECURSIVE)
+    return id < DT_DATABASE_STATIC_MUTEXES ? (sqlite3_mutex *)&_database_static_mutexes[id] : NULL;
+  dt_database_mutex_t *m = (dt_database_mutex_t *)g_malloc0(sizeof(dt_database_mutex_t));
+  dt_pthread_mutex_init(&m->lock, NULL);
+  m->id = id;
+  return (sqlite3_mutex *)m;
+}
+
+static void _database_mutex_free(sqlite3_mutex *mutex)
+{
+  dt_database_mutex_t *m = (dt_database_mutex_t *)mutex;
+  dt_pthread_mutex_destroy(&m->lock);
+  g_free(m);
+}
+
+static int _database_mutex_held(sqlite3_mutex *mutex)
+{
+  const dt_database_mutex_t *m = (const dt_database_mutex_t *)mutex;
+  return m->depth && pthread_equal(m->owner, pthread_self());
+}
+
+static int _database_mutex_notheld(sqlite3_mutex *mutex)
+{
+  return !_database_mutex_held(mutex);
+}
+
+static void _database_mutex_enter(sqlite3_mutex *mutex)
+{
+  dt_database_mutex_t *m = (dt_database_mutex_t *)mutex;
+  // only the owner can see itself as owner, so this is fine without the lock
+  if(_database_mutex_held(mutex))
+  {
+    m->depth++;
+    return;
+  }
+  dt_pthread_mutex_lock_with_caller(&m->lock, _database_mutex_file, m->id, "sqlite3_mutex_enter");
+  m->owner = pthread_self();
+  m->depth = 1;
+}
+
+static int _database_mutex_try(sqlite3_mutex *mutex)
+{
+  dt_database_mutex_t *m = (dt_database_mutex_t *)mutex;
+  if(_database_mutex_held(mutex))
+  {
+    m->depth++;
+    return SQLITE_OK;
+  }
+  if(dt_pthread_mutex_trylock_with_caller(&m->lock, _database_mutex_file, m->id, "sqlite3_mutex_try"))
+    return SQLITE_BUSY;
+  m->owner = pthread_self();
+  m->depth = 1;
+  return SQLITE_OK;
+}
+
+static void _database_mutex_leave(sqlite3_mutex *mutex)
+{
+  dt_database_mutex_t *m = (dt_database_mutex_t *)mutex;
+  if(--m->depth) return;
+  m->owner = (pthread_t)0;
+  dt_pthread_mutex_unlock(&m->lock);
+}
+
+static void _database_profile_mutexes(void)
+{
+  static int done = 0;
+  if(done || !(darktable.unmuted & DT_DEBUG_LOCKS)) return;
+  done = 1;
+  static const sqlite3_mutex_methods methods
+      = { _database_mutex_init,  _database_mutex_end,   _database_mutex_alloc,
+          _database_mutex_free,  _database_mutex_enter, _database_mutex_try,
+          _database_mutex_leave, _database_mutex_held,  _database_mutex_notheld };
+  // fails if sqlite was used already, or built without threads
+  if(sqlite3_config(SQLITE_CONFIG_MUTEX, &methods) != SQLITE_OK)
+    dt_print(DT_DEBUG_LOCKS, "[locks] can't profile the database mutexes\n");
+}
+#undef DT_DATABASE_STATIC_MUTEXES
+#endif
+
 dt_database_t *dt_database_init(const char *alternative, const gboolean load_data)
 {
+#ifndef _DEBUG
+  _database_profile_mutexes();
+#endif
 start:
   /* migrate default database location to new default */
   _database_migrate_to_xdg_structure();
@@ -1538,6 +1849,8 @@ start:
 
   /* create database */
   dt_database_t *db = (dt_database_t *)g_malloc0(sizeof(dt_database_t));
+  db->stmt_cache = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, (GDestroyNotify)g_queue_free);
+  dt_pthread_mutex_init(&db->stmt_cache_mutex, NULL);
   db->dbfilename_data = g_strdup(dbfilename_data);
   db->dbfilename_library = g_strdup(dbfilename_library);
 
@@ -1564,6 +1877,8 @@ start:
     dt_loc_get_datadir(dbfilename_library, sizeof(dbfilename_library));
     fprintf(stderr, "[init] try `cp %s/darktablerc %s/darktablerc'\n", dbfilename_library, datadir);
     sqlite3_close(db->handle);
+    g_hash_table_destroy(db->stmt_cache);
+    dt_pthread_mutex_destroy(&db->stmt_cache_mutex);
     g_free(dbname);
     g_free(db->lockfile_data);
     g_free(db->dbfilename_data);
@@ -1814,6 +2129,8 @@ start:
     goto error;
   }
 
+  _database_start_wal(db);
+
 error:
   g_free(dbname);
 
@@ -1822,6 +2139,35 @@ error:
 
 void dt_database_destroy(const dt_database_t *db)
 {
+  // all cached statements have to be gone before the database can be closed
+  GHashTableIter iter;
+  gpointer idle;
+  g_hash_table_iter_init(&iter, db->stmt_cache);
+  while(g_hash_table_iter_next(&iter, NULL, &idle))
+    for(GList *l = ((GQueue *)idle)->head; l; l = g_list_next(l)) sqlite3_finalize((sqlite3_stmt *)l->data);
+  g_hash_table_destroy(db->stmt_cache);
+  dt_pthread_mutex_destroy((dt_pthread_mutex_t *)&db->stmt_cache_mutex);
+  dt_print(DT_DEBUG_SQL, "[sql] statement cache: %d hits, %d misses\n", db->stmt_cache_hits,
+           db->stmt_cache_misses);
+
+  if(db->checkpoint_handle)
+  {
+    dt_pthread_mutex_lock((dt_pthread_mutex_t *)&db->checkpoint_mutex);
+    ((dt_database_t *)db)->checkpoint_stop = TRUE;
+    pthread_cond_signal((pthread_cond_t *)&db->checkpoint_cond);
+    dt_pthread_mutex_unlock((dt_pthread_mutex_t *)&db->checkpoint_mutex);
+    pthread_join(db->checkpoint_thread, NULL);
+    pthread_cond_destroy((pthread_cond_t *)&db->checkpoint_cond);
+    dt_pthread_mutex_destroy((dt_pthread_mutex_t *)&db->checkpoint_mutex);
+    sqlite3_close(db->checkpoint_handle);
+  }
+  if(db->readers)
+  {
+    for(GList *l = db->readers->head; l; l = g_list_next(l)) sqlite3_close((sqlite3 *)l->data);
+    g_queue_free(db->readers);
+    dt_pthread_mutex_destroy((dt_pthread_mutex_t *)&db->readers_mutex);
+  }
+  // the last connection to close copies the whole log back and removes it
   sqlite3_close(db->handle);
   if (db->lockfile_data)
   {
@@ -1843,6 +2189,69 @@ sqlite3 *dt_database_get(const dt_database_t *db)
   return db ? db->handle : NULL;
 }
 
+sqlite3 *dt_database_get_reader(dt_database_t *db)
+{
+  // while the writer is inside of a transaction a reader of its own wouldn't see what it did so far
+  if(!db->wal || !sqlite3_get_autocommit(db->handle)) return db->handle;
+
+  dt_pthread_mutex_lock(&db->readers_mutex);
+  sqlite3 *handle = g_queue_pop_head(db->readers);
+  dt_pthread_mutex_unlock(&db->readers_mutex);
+  if(!handle) handle = _database_open_connection(db, SQLITE_OPEN_READONLY);
+  return handle ? handle : db->handle;
+}
+
+void dt_database_release_reader(dt_database_t *db, sqlite3 *handle)
+{
+  if(!handle || handle == db->handle) return;
+
+  dt_pthread_mutex_lock(&db->readers_mutex);
+  if(g_queue_get_length(db->readers) < DT_DATABASE_MAX_READERS)
+  {
+    g_queue_push_head(db->readers, handle);
+    handle = NULL;
+  }
+  dt_pthread_mutex_unlock(&db->readers_mutex);
+  if(handle) sqlite3_close(handle);
+}
+
+int dt_database_prepare_cached(dt_database_t *db, const char *sql, sqlite3_stmt **stmt)
+{
+  dt_pthread_mutex_lock(&db->stmt_cache_mutex);
+  GQueue *idle = g_hash_table_lookup(db->stmt_cache, sql);
+  *stmt = idle ? g_queue_pop_head(idle) : NULL;
+  const int hit = *stmt != NULL;
+  if(hit)
+    db->stmt_cache_hits++;
+  else
+    db->stmt_cache_misses++;
+  dt_pthread_mutex_unlock(&db->stmt_cache_mutex);
+
+  // a statement is only ever used by one thread at a time, others get one of their own
+  if(hit) return SQLITE_OK;
+  dt_print(DT_DEBUG_SQL, "[sql] statement cache miss: %d hits, %d misses\n", db->stmt_cache_hits,
+           db->stmt_cache_misses);
+  return sqlite3_prepare_v2(db->handle, sql, -1, stmt, NULL);
+}
+
+void dt_database_release_cached(dt_database_t *db, sqlite3_stmt *stmt)
+{
+  if(!stmt) return;
+  sqlite3_reset(stmt);
+  sqlite3_clear_bindings(stmt);
+
+  dt_pthread_mutex_lock(&db->stmt_cache_mutex);
+  const char *sql = sqlite3_sql(stmt);
+  GQueue *idle = g_hash_table_lookup(db->stmt_cache, sql);
+  if(!idle)
+  {
+    idle = g_queue_new();
+    g_hash_table_insert(db->stmt_cache, g_strdup(sql), idle);
+  }
+  g_queue_push_head(idle, stmt);
+  dt_pthread_mutex_unlock(&db->stmt_cache_mutex);
+}
+
 const gchar *dt_database_get_path(const struct dt_database_t *db)
 {
   return db->dbfilename_library;
@@ -1903,6 +2312,9 @@ gboolean dt_database_get_lock_acquired(const dt_database_t *db)
   return db->lock_acquired;
 }
 
+#undef DT_DATABASE_MAX_READERS
+#undef DT_DATABASE_CHECKPOINT_FRAMES
+
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
 // kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
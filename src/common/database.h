@@ -28,6 +28,20 @@ struct dt_database_t *dt_database_init(const char *alternative, const gboolean l
 void dt_database_destroy(const struct dt_database_t *);
 /** get handle */
 struct sqlite3 *dt_database_get(const struct dt_database_t *);
+/**
+ * a prepared statement for sql from the cache, compiled only if there is none that isn't in use. sql has to be
+ * the same text every time, not formatted with values. give it back with dt_database_release_cached() instead
+ * of sqlite3_finalize(), it is reset and its bindings cleared then. use DT_DEBUG_SQLITE3_PREPARE_CACHED().
+ */
+int dt_database_prepare_cached(struct dt_database_t *db, const char *sql, struct sqlite3_stmt **stmt);
+void dt_database_release_cached(struct dt_database_t *db, struct sqlite3_stmt *stmt);
+/**
+ * a read-only connection of its own for a thread that only reads main and data, so it doesn't queue up behind
+ * the writer. it is the shared one of dt_database_get() if the databases aren't in wal mode or that is inside
+ * of a transaction right now. hand it back with dt_database_release_reader().
+ */
+struct sqlite3 *dt_database_get_reader(struct dt_database_t *db);
+void dt_database_release_reader(struct dt_database_t *db, struct sqlite3 *handle);
 /** Returns database path */
 const gchar *dt_database_get_path(const struct dt_database_t *db);
 /** test if database was already locked by another instance */
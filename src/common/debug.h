@@ -19,6 +19,7 @@
 
 #pragma once
 
+#include "common/timers.h"
 #include <sqlite3.h>
 
 // define this to see all sql queries passed to prepare and exec at compile time, or a variable name
@@ -87,7 +88,10 @@
   do                                                                                                              \
   {                                                                                                               \
     dt_print(DT_DEBUG_SQL, "[sql] %s:%d, function %s(): exec \"%s\"\n", __FILE__, __LINE__, __FUNCTION__, (b));   \
+    dt_timer_scope_t _sql_timer;                                                                                  \
+    dt_timer_begin(&_sql_timer, "sql exec");                                                                      \
     __DT_DEBUG_ASSERT_WITH_QUERY__(sqlite3_exec(a, b, c, d, e), (b));                                             \
+    dt_timer_end(&_sql_timer);                                                                                    \
     __DT_DEBUG_SQL_QUERY__(b)                                                                                     \
   } while(0)
 
@@ -95,7 +99,21 @@
   do                                                                                                              \
   {                                                                                                               \
     dt_print(DT_DEBUG_SQL, "[sql] %s:%d, function %s(): prepare \"%s\"\n", __FILE__, __LINE__, __FUNCTION__, (b));\
+    dt_timer_scope_t _sql_timer;                                                                                  \
+    dt_timer_begin(&_sql_timer, "sql prepare");                                                                   \
     __DT_DEBUG_ASSERT_WITH_QUERY__(sqlite3_prepare_v2(a, b, c, d, e), (b));                                       \
+    dt_timer_end(&_sql_timer);                                                                                    \
+    __DT_DEBUG_SQL_QUERY__(b)                                                                                     \
+  } while(0)
+
+// prepares the statement c for the constant sql b from the cache of the database a (darktable.db), give it
+// back with dt_database_release_cached() instead of finalizing it
+#define DT_DEBUG_SQLITE3_PREPARE_CACHED(a, b, c)                                                                  \
+  do                                                                                                              \
+  {                                                                                                               \
+    dt_print(DT_DEBUG_SQL, "[sql] %s:%d, function %s(): prepare cached \"%s\"\n", __FILE__, __LINE__,             \
+             __FUNCTION__, (b));                                                                                  \
+    __DT_DEBUG_ASSERT_WITH_QUERY__(dt_database_prepare_cached(a, b, c), (b));                                     \
     __DT_DEBUG_SQL_QUERY__(b)                                                                                     \
   } while(0)
 
@@ -22,9 +22,19 @@
 #include "config.h"
 #endif
 
+#include "common/dtpthread.h"
+#include "common/trace.h"
+#include <errno.h>
+#include <inttypes.h>
 #include <pthread.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#if defined __linux__
+#include <sched.h>
+#endif
 
 #ifdef _WIN32
 #include "win/dtwin.h"
@@ -75,6 +85,7 @@ int dt_pthread_create(pthread_t *thread, void *(*start_routine)(void *), void *a
 
 void dt_pthread_setname(const char *name)
 {
+  dt_trace_thread_name(name);
 #if defined __linux__
   pthread_setname_np(pthread_self(), name);
 #elif defined __FreeBSD__ || defined __DragonFly__
@@ -92,6 +103,343 @@ void dt_pthread_setname(const char *name)
 #endif
 }
 
+#if defined __linux__
+#define DT_PTHREAD_MAX_NUMA_NODES 64
+
+static struct
+{
+  pthread_once_t once;
+  int nodes;
+  cpu_set_t cpus[DT_PTHREAD_MAX_NUMA_NODES];
+} _numa = { PTHREAD_ONCE_INIT, 0 };
+
+// "0-7,16-23\n" -> set
+static void _numa_parse_cpulist(const char *list, cpu_set_t *set)
+{
+  CPU_ZERO(set);
+  const char *c = list;
+  while(*c)
+  {
+    char *end = NULL;
+    const long first = strtol(c, &end, 10);
+    if(end == c) break;
+    long last = first;
+    c = end;
+    if(*c == '-')
+    {
+      last = strtol(c + 1, &end, 10);
+      c = end;
+    }
+    for(long cpu = first; cpu <= last && cpu < CPU_SETSIZE; cpu++) CPU_SET(cpu, set);
+    if(*c != ',') break;
+    c++;
+  }
+}
+
+static void _numa_init()
+{
+  // only the cpus we may run on at all, e.g. with taskset or in a container
+  cpu_set_t allowed;
+  if(sched_getaffinity(0, sizeof(allowed), &allowed)) return;
+
+  for(int node = 0; node < DT_PTHREAD_MAX_NUMA_NODES; node++)
+  {
+    char filename[64];
+    snprintf(filename, sizeof(filename), "/sys/devices/system/node/node%d/cpulist", node);
+    FILE *f = fopen(filename, "rb");
+    if(!f) break;
+    char list[4096] = { 0 };
+    const int ok = fgets(list, sizeof(list), f) != NULL;
+    fclose(f);
+    if(!ok) break;
+
+    cpu_set_t cpus;
+    _numa_parse_cpulist(list, &cpus);
+    CPU_AND(&_numa.cpus[_numa.nodes], &cpus, &allowed);
+    // skip memory-only nodes and ones we're not allowed on
+    if(CPU_COUNT(&_numa.cpus[_numa.nodes]) > 0) _numa.nodes++;
+  }
+}
+#endif
+
+int dt_pthread_numa_nodes()
+{
+#if defined __linux__
+  pthread_once(&_numa.once, _numa_init);
+  return _numa.nodes;
+#else
+  return 0;
+#endif
+}
+
+int dt_pthread_set_numa_node(const int node)
+{
+#if defined __linux__
+  if(dt_pthread_numa_nodes() < 2) return 0;
+  const cpu_set_t *cpus = &_numa.cpus[node % _numa.nodes];
+  if(pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), cpus)) return 0;
+  return CPU_COUNT(cpus);
+#else
+  return 0;
+#endif
+}
+
+#ifndef _DEBUG
+
+// has to be a power of two
+#define DT_PTHREAD_LOCK_SITES 4096
+
+typedef struct dt_pthread_lock_site_t
+{
+  dt_pthread_lock_stat_t s;
+} dt_pthread_lock_site_t;
+
+int dt_pthread_lock_profiling = 0;
+
+static struct
+{
+  pthread_mutex_t lock; // serializes adding sites, not profiled itself
+  dt_pthread_lock_site_t sites[DT_PTHREAD_LOCK_SITES];
+  dt_pthread_lock_site_t other; // for everything that doesn't fit the table
+} _locks = { PTHREAD_MUTEX_INITIALIZER };
+
+static inline int64_t _lock_now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static inline int _site_matches(const dt_pthread_lock_site_t *site, const char *file, const int line,
+                                const char mode)
+{
+  return site->s.file == file && site->s.line == line && site->s.mode == mode;
+}
+
+static dt_pthread_lock_site_t *_lock_site(const char *file, const int line, const char *function, const char mode)
+{
+  const uint32_t hash = (uint32_t)((uintptr_t)file >> 3) * 2654435761u ^ (uint32_t)line * 40503u ^ mode;
+  // sites are only ever added, and file is set last. a site seen half written just doesn't match, and the
+  // search below under the lock finds it.
+  for(int k = 0; k < DT_PTHREAD_LOCK_SITES; k++)
+  {
+    dt_pthread_lock_site_t *site = _locks.sites + ((hash + k) & (DT_PTHREAD_LOCK_SITES - 1));
+    if(!site->s.file) break;
+    if(_site_matches(site, file, line, mode)) return site;
+  }
+
+  dt_pthread_lock_site_t *found = &_locks.other;
+  pthread_mutex_lock(&_locks.lock);
+  for(int k = 0; k < DT_PTHREAD_LOCK_SITES; k++)
+  {
+    dt_pthread_lock_site_t *site = _locks.sites + ((hash + k) & (DT_PTHREAD_LOCK_SITES - 1));
+    if(site->s.file && !_site_matches(site, file, line, mode)) continue;
+    if(!site->s.file)
+    {
+      site->s.line = line;
+      site->s.function = function;
+      site->s.mode = mode;
+      __sync_synchronize();
+      site->s.file = file;
+    }
+    found = site;
+    break;
+  }
+  pthread_mutex_unlock(&_locks.lock);
+  return found;
+}
+
+static inline void _lock_max(uint64_t *max, const uint64_t value)
+{
+  for(uint64_t m = *max; value > m && !__sync_bool_compare_and_swap(max, m, value);) m = *max;
+}
+
+static void _lock_account_wait(dt_pthread_lock_site_t *site, const int contended, const int64_t wait)
+{
+  __sync_fetch_and_add(&site->s.count, 1);
+  if(!contended) return;
+  __sync_fetch_and_add(&site->s.contended, 1);
+  __sync_fetch_and_add(&site->s.wait, wait);
+  _lock_max(&site->s.wait_max, wait);
+}
+
+static void _lock_account_hold(dt_pthread_lock_site_t *site, const int64_t hold)
+{
+  __sync_fetch_and_add(&site->s.hold, hold);
+  _lock_max(&site->s.hold_max, hold);
+}
+
+int dt_pthread_mutex_lock_profiled(dt_pthread_mutex_t *mutex, const char *file, const int line,
+                                   const char *function, const int trylock)
+{
+  dt_pthread_lock_site_t *site = _lock_site(file, line, function, 'm');
+  int ret = pthread_mutex_trylock(&mutex->mutex);
+  const int contended = ret == EBUSY;
+  int64_t now = _lock_now();
+  if(contended && !trylock)
+  {
+    const int64_t start = now;
+    ret = pthread_mutex_lock(&mutex->mutex);
+    now = _lock_now();
+    if(!ret) _lock_account_wait(site, contended, now - start);
+  }
+  else if(!ret)
+    _lock_account_wait(site, 0, 0);
+  if(ret) return ret;
+  mutex->site = site;
+  mutex->locked_at = now;
+  return 0;
+}
+
+int dt_pthread_mutex_unlock_profiled(dt_pthread_mutex_t *mutex)
+{
+  dt_pthread_lock_site_t *site = mutex->site;
+  const int64_t hold = _lock_now() - mutex->locked_at;
+  mutex->site = NULL;
+  const int ret = pthread_mutex_unlock(&mutex->mutex);
+  _lock_account_hold(site, hold);
+  return ret;
+}
+
+int dt_pthread_cond_wait_profiled(pthread_cond_t *cond, dt_pthread_mutex_t *mutex, const struct timespec *abstime)
+{
+  // the time spent waiting for the condition doesn't count as held
+  dt_pthread_lock_site_t *site = mutex->site;
+  _lock_account_hold(site, _lock_now() - mutex->locked_at);
+  mutex->site = NULL;
+  const int ret = abstime ? pthread_cond_timedwait(cond, &mutex->mutex, abstime)
+                          : pthread_cond_wait(cond, &mutex->mutex);
+  mutex->site = site;
+  mutex->locked_at = _lock_now();
+  return ret;
+}
+
+int dt_pthread_rwlock_lock_profiled(dt_pthread_rwlock_t *rwlock, const char *file, const int line, const char mode)
+{
+  const int write = mode == 'w' || mode == 'W';
+  const int trylock = mode == 'R' || mode == 'W';
+  dt_pthread_lock_site_t *site = _lock_site(file, line, NULL, write ? 'w' : 'r');
+  int ret = write ? pthread_rwlock_trywrlock(&rwlock->lock) : pthread_rwlock_tryrdlock(&rwlock->lock);
+  const int contended = ret == EBUSY;
+  int64_t now = _lock_now();
+  if(contended && !trylock)
+  {
+    const int64_t start = now;
+    ret = write ? pthread_rwlock_wrlock(&rwlock->lock) : pthread_rwlock_rdlock(&rwlock->lock);
+    now = _lock_now();
+    if(!ret) _lock_account_wait(site, contended, now - start);
+  }
+  else if(!ret)
+    _lock_account_wait(site, 0, 0);
+  if(ret || !write) return ret;
+  rwlock->site = site;
+  rwlock->locked_at = now;
+  return 0;
+}
+
+int dt_pthread_rwlock_unlock_profiled(dt_pthread_rwlock_t *rwlock)
+{
+  dt_pthread_lock_site_t *site = rwlock->site;
+  const int64_t hold = _lock_now() - rwlock->locked_at;
+  rwlock->site = NULL;
+  const int ret = pthread_rwlock_unlock(&rwlock->lock);
+  _lock_account_hold(site, hold);
+  return ret;
+}
+
+void dt_pthread_lock_set_profiling(const int enabled)
+{
+  dt_pthread_lock_profiling = enabled;
+}
+
+static int _lock_stat_compare(const void *a, const void *b)
+{
+  const dt_pthread_lock_stat_t *sa = (const dt_pthread_lock_stat_t *)a;
+  const dt_pthread_lock_stat_t *sb = (const dt_pthread_lock_stat_t *)b;
+  if(sa->wait != sb->wait) return sa->wait > sb->wait ? -1 : 1;
+  if(sa->hold != sb->hold) return sa->hold > sb->hold ? -1 : 1;
+  return 0;
+}
+
+int dt_pthread_lock_get_stats(dt_pthread_lock_stat_t **stats)
+{
+  int count = 0;
+  *stats = (dt_pthread_lock_stat_t *)g_malloc((DT_PTHREAD_LOCK_SITES + 1) * sizeof(dt_pthread_lock_stat_t));
+  pthread_mutex_lock(&_locks.lock);
+  for(int k = 0; k < DT_PTHREAD_LOCK_SITES; k++)
+    if(_locks.sites[k].s.file && _locks.sites[k].s.count) (*stats)[count++] = _locks.sites[k].s;
+  if(_locks.other.s.count)
+  {
+    (*stats)[count] = _locks.other.s;
+    (*stats)[count++].file = "other";
+  }
+  pthread_mutex_unlock(&_locks.lock);
+  qsort(*stats, count, sizeof(dt_pthread_lock_stat_t), _lock_stat_compare);
+  return count;
+}
+
+void dt_pthread_lock_reset(void)
+{
+  // threads holding a lock right now add their hold time once they unlock
+  pthread_mutex_lock(&_locks.lock);
+  for(int k = 0; k <= DT_PTHREAD_LOCK_SITES; k++)
+  {
+    dt_pthread_lock_stat_t *s = k < DT_PTHREAD_LOCK_SITES ? &_locks.sites[k].s : &_locks.other.s;
+    s->count = s->contended = 0;
+    s->wait = s->wait_max = s->hold = s->hold_max = 0;
+  }
+  pthread_mutex_unlock(&_locks.lock);
+}
+
+#undef DT_PTHREAD_LOCK_SITES
+
+#else
+
+void dt_pthread_lock_set_profiling(const int enabled)
+{
+}
+
+int dt_pthread_lock_get_stats(dt_pthread_lock_stat_t **stats)
+{
+  *stats = NULL;
+  return 0;
+}
+
+void dt_pthread_lock_reset(void)
+{
+}
+
+#endif
+
+void dt_pthread_lock_print(const int top)
+{
+  dt_pthread_lock_stat_t *stats = NULL;
+  const int count = dt_pthread_lock_get_stats(&stats);
+  if(count)
+    printf("[locks] %-56s %4s %10s %9s %10s %9s %10s %9s\n", "site", "type", "count", "waited %", "wait ms",
+           "max ms", "hold ms", "max ms");
+  for(int k = 0; k < MIN(count, top); k++)
+  {
+    const dt_pthread_lock_stat_t *s = stats + k;
+    // the last two components of the path are enough to find it
+    const char *file = s->file, *last = strrchr(s->file, '/');
+    for(const char *c = last ? last - 1 : NULL; c && c >= s->file; c--)
+      if(*c == '/')
+      {
+        file = c + 1;
+        break;
+      }
+    char site[256];
+    if(s->function)
+      snprintf(site, sizeof(site), "%s:%d (%s)", file, s->line, s->function);
+    else
+      snprintf(site, sizeof(site), "%s:%d", file, s->line);
+    printf("[locks] %-56s %4c %10" PRIu64 " %9.2f %10.3f %9.3f %10.3f %9.3f\n", site, s->mode, s->count,
+           100.0 * s->contended / MAX(s->count, 1), s->wait / 1e6, s->wait_max / 1e6, s->hold / 1e6,
+           s->hold_max / 1e6);
+  }
+  g_free(stats);
+}
 
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
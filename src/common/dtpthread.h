@@ -25,6 +25,7 @@
 #include <float.h>
 #include <glib.h>
 #include <pthread.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -199,6 +200,12 @@ static inline int dt_pthread_cond_wait(pthread_cond_t *cond, dt_pthread_mutex_t
   return pthread_cond_wait(cond, &(mutex->mutex));
 }
 
+static inline int dt_pthread_cond_timedwait(pthread_cond_t *cond, dt_pthread_mutex_t *mutex,
+                                            const struct timespec *abstime)
+{
+  return pthread_cond_timedwait(cond, &(mutex->mutex), abstime);
+}
+
 
 static inline int dt_pthread_rwlock_init(dt_pthread_rwlock_t *lock,
     const pthread_rwlockattr_t *attr)
@@ -291,29 +298,71 @@ static inline int dt_pthread_rwlock_trywrlock_with_caller(dt_pthread_rwlock_t *r
 #undef TOPN
 #else
 
+/*
+ * lock contention profiling for release builds, switched on with `-d locks`. while it is off every wrapper costs
+ * one well predicted branch. while it is on, the wait for and the hold time of every lock are added up per place
+ * it was locked from, see dt_pthread_lock_get_stats(). read locks only count waits, as there can be many holders.
+ */
+
+struct dt_pthread_lock_site_t;
+extern int dt_pthread_lock_profiling;
+
 typedef struct CAPABILITY("mutex") dt_pthread_mutex_t
 {
   pthread_mutex_t mutex;
+  // where the holder locked it from and when, only while profiling
+  struct dt_pthread_lock_site_t *site;
+  int64_t locked_at;
 } CAPABILITY("mutex") dt_pthread_mutex_t;
 
+typedef struct dt_pthread_rwlock_t
+{
+  pthread_rwlock_t lock;
+  // same for the writer holding it
+  struct dt_pthread_lock_site_t *site;
+  int64_t locked_at;
+} dt_pthread_rwlock_t;
+
+int dt_pthread_mutex_lock_profiled(dt_pthread_mutex_t *mutex, const char *file, const int line,
+                                   const char *function, const int trylock);
+int dt_pthread_mutex_unlock_profiled(dt_pthread_mutex_t *mutex);
+int dt_pthread_cond_wait_profiled(pthread_cond_t *cond, dt_pthread_mutex_t *mutex, const struct timespec *abstime);
+// mode is 'r' or 'w', in upper case for the try variants
+int dt_pthread_rwlock_lock_profiled(dt_pthread_rwlock_t *rwlock, const char *file, const int line, const char mode);
+int dt_pthread_rwlock_unlock_profiled(dt_pthread_rwlock_t *rwlock);
+
 // *please* do use these;
 static inline int dt_pthread_mutex_init(dt_pthread_mutex_t *mutex, const pthread_mutexattr_t *mutexattr)
 {
+  mutex->site = NULL;
+  mutex->locked_at = 0;
   return pthread_mutex_init(&mutex->mutex, mutexattr);
 };
 
-static inline int dt_pthread_mutex_lock(dt_pthread_mutex_t *mutex) ACQUIRE(mutex) NO_THREAD_SAFETY_ANALYSIS
+#define dt_pthread_mutex_lock(A) dt_pthread_mutex_lock_with_caller(A, __FILE__, __LINE__, __FUNCTION__)
+static inline int dt_pthread_mutex_lock_with_caller(dt_pthread_mutex_t *mutex, const char *file, const int line,
+                                                    const char *function) ACQUIRE(mutex) NO_THREAD_SAFETY_ANALYSIS
 {
+  if(__builtin_expect(dt_pthread_lock_profiling, 0))
+    return dt_pthread_mutex_lock_profiled(mutex, file, line, function, 0);
   return pthread_mutex_lock(&mutex->mutex);
 };
 
-static inline int dt_pthread_mutex_trylock(dt_pthread_mutex_t *mutex) TRY_ACQUIRE(0, mutex)
+#define dt_pthread_mutex_trylock(A) dt_pthread_mutex_trylock_with_caller(A, __FILE__, __LINE__, __FUNCTION__)
+static inline int dt_pthread_mutex_trylock_with_caller(dt_pthread_mutex_t *mutex, const char *file,
+                                                       const int line, const char *function) TRY_ACQUIRE(0, mutex)
 {
+  if(__builtin_expect(dt_pthread_lock_profiling, 0))
+    return dt_pthread_mutex_lock_profiled(mutex, file, line, function, 1);
   return pthread_mutex_trylock(&mutex->mutex);
 };
 
-static inline int dt_pthread_mutex_unlock(dt_pthread_mutex_t *mutex) RELEASE(mutex) NO_THREAD_SAFETY_ANALYSIS
+#define dt_pthread_mutex_unlock(A) dt_pthread_mutex_unlock_with_caller(A, __FILE__, __LINE__, __FUNCTION__)
+static inline int dt_pthread_mutex_unlock_with_caller(dt_pthread_mutex_t *mutex, const char *file, const int line,
+                                                      const char *function) RELEASE(mutex) NO_THREAD_SAFETY_ANALYSIS
 {
+  // decided by how it was locked, so switching profiling on or off while it is held is fine
+  if(__builtin_expect(mutex->site != NULL, 0)) return dt_pthread_mutex_unlock_profiled(mutex);
   return pthread_mutex_unlock(&mutex->mutex);
 };
 
@@ -324,22 +373,64 @@ static inline int dt_pthread_mutex_destroy(dt_pthread_mutex_t *mutex)
 
 static inline int dt_pthread_cond_wait(pthread_cond_t *cond, dt_pthread_mutex_t *mutex)
 {
+  if(__builtin_expect(mutex->site != NULL, 0)) return dt_pthread_cond_wait_profiled(cond, mutex, NULL);
   return pthread_cond_wait(cond, &mutex->mutex);
 };
 
-#define dt_pthread_rwlock_t pthread_rwlock_t
-#define dt_pthread_rwlock_init pthread_rwlock_init
-#define dt_pthread_rwlock_destroy pthread_rwlock_destroy
-#define dt_pthread_rwlock_unlock pthread_rwlock_unlock
-#define dt_pthread_rwlock_rdlock pthread_rwlock_rdlock
-#define dt_pthread_rwlock_wrlock pthread_rwlock_wrlock
-#define dt_pthread_rwlock_tryrdlock pthread_rwlock_tryrdlock
-#define dt_pthread_rwlock_trywrlock pthread_rwlock_trywrlock
+static inline int dt_pthread_cond_timedwait(pthread_cond_t *cond, dt_pthread_mutex_t *mutex,
+                                            const struct timespec *abstime)
+{
+  if(__builtin_expect(mutex->site != NULL, 0)) return dt_pthread_cond_wait_profiled(cond, mutex, abstime);
+  return pthread_cond_timedwait(cond, &mutex->mutex, abstime);
+};
+
+static inline int dt_pthread_rwlock_init(dt_pthread_rwlock_t *lock, const pthread_rwlockattr_t *attr)
+{
+  lock->site = NULL;
+  lock->locked_at = 0;
+  return pthread_rwlock_init(&lock->lock, attr);
+}
+
+static inline int dt_pthread_rwlock_destroy(dt_pthread_rwlock_t *lock)
+{
+  return pthread_rwlock_destroy(&lock->lock);
+}
+
+static inline int dt_pthread_rwlock_unlock(dt_pthread_rwlock_t *lock)
+{
+  // only a profiled writer sets the site, and no reader can hold the lock at the same time
+  if(__builtin_expect(lock->site != NULL, 0)) return dt_pthread_rwlock_unlock_profiled(lock);
+  return pthread_rwlock_unlock(&lock->lock);
+}
+
+static inline int dt_pthread_rwlock_rdlock_with_caller(dt_pthread_rwlock_t *rwlock, const char *file, int line)
+{
+  if(__builtin_expect(dt_pthread_lock_profiling, 0)) return dt_pthread_rwlock_lock_profiled(rwlock, file, line, 'r');
+  return pthread_rwlock_rdlock(&rwlock->lock);
+}
+
+static inline int dt_pthread_rwlock_wrlock_with_caller(dt_pthread_rwlock_t *rwlock, const char *file, int line)
+{
+  if(__builtin_expect(dt_pthread_lock_profiling, 0)) return dt_pthread_rwlock_lock_profiled(rwlock, file, line, 'w');
+  return pthread_rwlock_wrlock(&rwlock->lock);
+}
+
+static inline int dt_pthread_rwlock_tryrdlock_with_caller(dt_pthread_rwlock_t *rwlock, const char *file, int line)
+{
+  if(__builtin_expect(dt_pthread_lock_profiling, 0)) return dt_pthread_rwlock_lock_profiled(rwlock, file, line, 'R');
+  return pthread_rwlock_tryrdlock(&rwlock->lock);
+}
 
-#define dt_pthread_rwlock_rdlock_with_caller(A,B,C) pthread_rwlock_rdlock(A)
-#define dt_pthread_rwlock_wrlock_with_caller(A,B,C) pthread_rwlock_wrlock(A)
-#define dt_pthread_rwlock_tryrdlock_with_caller(A,B,C) pthread_rwlock_tryrdlock(A)
-#define dt_pthread_rwlock_trywrlock_with_caller(A,B,C) pthread_rwlock_trywrlock(A)
+static inline int dt_pthread_rwlock_trywrlock_with_caller(dt_pthread_rwlock_t *rwlock, const char *file, int line)
+{
+  if(__builtin_expect(dt_pthread_lock_profiling, 0)) return dt_pthread_rwlock_lock_profiled(rwlock, file, line, 'W');
+  return pthread_rwlock_trywrlock(&rwlock->lock);
+}
+
+#define dt_pthread_rwlock_rdlock(A) dt_pthread_rwlock_rdlock_with_caller(A, __FILE__, __LINE__)
+#define dt_pthread_rwlock_wrlock(A) dt_pthread_rwlock_wrlock_with_caller(A, __FILE__, __LINE__)
+#define dt_pthread_rwlock_tryrdlock(A) dt_pthread_rwlock_tryrdlock_with_caller(A, __FILE__, __LINE__)
+#define dt_pthread_rwlock_trywrlock(A) dt_pthread_rwlock_trywrlock_with_caller(A, __FILE__, __LINE__)
 
 #endif
 
@@ -356,6 +447,9 @@ static inline int dt_pthread_mutex_BAD_trylock(dt_pthread_mutex_t *mutex)
 
 static inline int dt_pthread_mutex_BAD_unlock(dt_pthread_mutex_t *mutex)
 {
+#ifndef _DEBUG
+  mutex->site = NULL; // the hold time is lost
+#endif
   return pthread_mutex_unlock(&mutex->mutex);
 };
 
@@ -363,6 +457,33 @@ int dt_pthread_create(pthread_t *thread, void *(*start_routine)(void *), void *a
 
 void dt_pthread_setname(const char *name);
 
+// number of numa nodes with cpus we may run on, 0 if unknown.
+int dt_pthread_numa_nodes();
+// pin the calling thread, and threads it creates later on, to the cpus of numa node node % nodes. memory
+// it touches first is then allocated on that node. returns the number of cpus of the node, or 0 if the thread
+// was left alone, e.g. on machines with a single node.
+int dt_pthread_set_numa_node(const int node);
+
+/** one line of the contention profile, times in nanoseconds. */
+typedef struct dt_pthread_lock_stat_t
+{
+  const char *file, *function; // function is NULL for rwlocks
+  int line;
+  char mode; // 'm' for mutexes, 'r' and 'w' for rwlocks
+  uint64_t count, contended; // acquisitions, and those which had to wait
+  uint64_t wait, wait_max, hold, hold_max;
+} dt_pthread_lock_stat_t;
+
+// switches lock profiling on or off, what was collected is kept. does nothing in _DEBUG builds, they have
+// their own bookkeeping per mutex.
+void dt_pthread_lock_set_profiling(const int enabled);
+// all sites which were locked at least once, most waited for first. to be freed with g_free().
+int dt_pthread_lock_get_stats(dt_pthread_lock_stat_t **stats);
+// forgets everything collected so far
+void dt_pthread_lock_reset(void);
+// prints the top sites to stdout
+void dt_pthread_lock_print(const int top);
+
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
 // kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
@@ -38,6 +38,8 @@ extern "C" {
 #include <cmath>
 #include <fstream>
 #include <iostream>
+#include <list>
+#include <memory>
 #include <sstream>
 #include <string>
 
@@ -63,6 +65,7 @@ extern "C" {
 #include "common/imageio_jpeg.h"
 #include "common/metadata.h"
 #include "common/tags.h"
+#include "common/timers.h"
 #include "control/conf.h"
 #include "develop/imageop.h"
 }
@@ -981,6 +984,93 @@ int dt_exif_read_from_blob(dt_image_t *img, uint8_t *blob, const int size)
   }
 }
 
+/*
+ * the parsed metadata of the files read last. import, thumbnail extraction and export tend to come back to the
+ * same file shortly after each other, and parsing is what takes the time. an entry is used as long as its file
+ * keeps its inode, size and modification time. exiv2 parses all metadata of a file at once, so that's what
+ * is kept.
+ */
+#define DT_EXIF_CACHE_SIZE 16
+
+struct dt_exif_cached_t
+{
+  dt_pthread_mutex_t lock; // held while image is used, exiv2 images aren't thread safe
+  std::unique_ptr<Exiv2::Image> image;
+  std::string path;
+  ino_t ino;
+  off_t size;
+  time_t mtime;
+
+  dt_exif_cached_t()
+  {
+    dt_pthread_mutex_init(&lock, NULL);
+  }
+  ~dt_exif_cached_t()
+  {
+    dt_pthread_mutex_destroy(&lock);
+  }
+};
+
+// locks an entry for as long as it's in scope
+struct dt_exif_cache_use_t
+{
+  dt_exif_cached_t *entry;
+  dt_exif_cache_use_t(dt_exif_cached_t *e) : entry(e)
+  {
+    dt_pthread_mutex_lock(&entry->lock);
+  }
+  ~dt_exif_cache_use_t()
+  {
+    dt_pthread_mutex_unlock(&entry->lock);
+  }
+};
+
+static dt_pthread_mutex_t _exif_cache_lock;
+static std::list<std::shared_ptr<dt_exif_cached_t>> _exif_cache; // most recently used first
+
+/** the parsed metadata of path, throws the exiv2 errors of reading it */
+static std::shared_ptr<dt_exif_cached_t> _exif_cache_get(const char *path)
+{
+  struct stat statbuf;
+  const int cacheable = !stat(path, &statbuf);
+  if(cacheable)
+  {
+    dt_pthread_mutex_lock(&_exif_cache_lock);
+    for(auto it = _exif_cache.begin(); it != _exif_cache.end(); ++it)
+    {
+      std::shared_ptr<dt_exif_cached_t> entry = *it;
+      if(entry->path != path) continue;
+      _exif_cache.erase(it);
+      if(entry->ino == statbuf.st_ino && entry->size == statbuf.st_size && entry->mtime == statbuf.st_mtime)
+      {
+        _exif_cache.push_front(entry);
+        dt_pthread_mutex_unlock(&_exif_cache_lock);
+        return entry;
+      }
+      break; // the file changed
+    }
+    dt_pthread_mutex_unlock(&_exif_cache_lock);
+  }
+
+  std::shared_ptr<dt_exif_cached_t> entry = std::make_shared<dt_exif_cached_t>();
+  entry->image = std::unique_ptr<Exiv2::Image>(Exiv2::ImageFactory::open(WIDEN(path)));
+  assert(entry->image.get() != 0);
+  entry->image->readMetadata();
+  if(!cacheable) return entry;
+
+  entry->path = path;
+  entry->ino = statbuf.st_ino;
+  entry->size = statbuf.st_size;
+  entry->mtime = statbuf.st_mtime;
+  dt_pthread_mutex_lock(&_exif_cache_lock);
+  // another thread might have read it in the meantime
+  _exif_cache.remove_if([path](const std::shared_ptr<dt_exif_cached_t> &e) { return e->path == path; });
+  _exif_cache.push_front(entry);
+  if(_exif_cache.size() > DT_EXIF_CACHE_SIZE) _exif_cache.pop_back();
+  dt_pthread_mutex_unlock(&_exif_cache_lock);
+  return entry;
+}
+
 /**
  * Get the largest possible thumbnail from the image
  */
@@ -988,13 +1078,12 @@ int dt_exif_get_thumbnail(const char *path, uint8_t **buffer, size_t *size, char
 {
   try
   {
-    std::unique_ptr<Exiv2::Image> image(Exiv2::ImageFactory::open(WIDEN(path)));
-    assert(image.get() != 0);
-    image->readMetadata();
+    std::shared_ptr<dt_exif_cached_t> cached = _exif_cache_get(path);
+    dt_exif_cache_use_t use(cached.get());
 
     // Get a list of preview images available in the image. The list is sorted
     // by the preview image pixel size, starting with the smallest preview.
-    Exiv2::PreviewManager loader(*image);
+    Exiv2::PreviewManager loader(*cached->image);
     Exiv2::PreviewPropertiesList list = loader.getPreviewProperties();
     if(list.empty())
     {
@@ -1035,23 +1124,105 @@ int dt_exif_get_thumbnail(const char *path, uint8_t **buffer, size_t *size, char
 /** read the metadata of an image.
  * XMP data trumps IPTC data trumps EXIF data
  */
+struct dt_exif_prefetch_t
+{
+  std::shared_ptr<dt_exif_cached_t> cached; // metadata of the file, NULL if it couldn't be read
+  std::string error;                     // and why
+  std::unique_ptr<Exiv2::Image> sidecar; // metadata of its xmp sidecar, NULL if there is none
+  int have_mtime;
+  time_t mtime;
+};
+
+dt_exif_prefetch_t *dt_exif_prefetch(const char *path)
+{
+  dt_exif_prefetch_t *prefetch = new dt_exif_prefetch_t();
+  struct stat statbuf;
+  prefetch->have_mtime = !stat(path, &statbuf);
+  if(prefetch->have_mtime) prefetch->mtime = statbuf.st_mtime;
+
+  try
+  {
+    prefetch->cached = _exif_cache_get(path);
+  }
+  catch(Exiv2::AnyError &e)
+  {
+    prefetch->error = e.what();
+  }
+
+  gchar *sidecar = g_strconcat(path, ".xmp", NULL);
+  try
+  {
+    if(g_file_test(sidecar, G_FILE_TEST_IS_REGULAR))
+    {
+      std::unique_ptr<Exiv2::Image> image(Exiv2::ImageFactory::open(WIDEN(sidecar)));
+      assert(image.get() != 0);
+      image->readMetadata();
+      prefetch->sidecar = std::move(image);
+    }
+  }
+  catch(Exiv2::AnyError &e)
+  {
+    // the same as a missing one to dt_exif_xmp_read()
+  }
+  g_free(sidecar);
+  return prefetch;
+}
+
+void dt_exif_prefetch_free(dt_exif_prefetch_t *prefetch)
+{
+  delete prefetch;
+}
+
 int dt_exif_read(dt_image_t *img, const char *path)
+{
+  return dt_exif_read_prefetched(img, path, NULL);
+}
+
+static int _exif_read_prefetched(dt_image_t *img, const char *path, const dt_exif_prefetch_t *prefetch);
+
+int dt_exif_read_prefetched(dt_image_t *img, const char *path, const dt_exif_prefetch_t *prefetch)
+{
+  dt_timer_scope_t timer;
+  dt_timer_begin(&timer, "exif read");
+  const int res = _exif_read_prefetched(img, path, prefetch);
+  dt_timer_end(&timer);
+  return res;
+}
+
+static int _exif_read_prefetched(dt_image_t *img, const char *path, const dt_exif_prefetch_t *prefetch)
 {
   // at least set datetime taken to something useful in case there is no exif data in this file (pfm, png,
   // ...)
   struct stat statbuf;
-
-  if(!stat(path, &statbuf))
+  time_t mtime = 0;
+  int have_mtime = 0;
+  if(prefetch)
+  {
+    have_mtime = prefetch->have_mtime;
+    mtime = prefetch->mtime;
+  }
+  else if(!stat(path, &statbuf))
+  {
+    have_mtime = 1;
+    mtime = statbuf.st_mtime;
+  }
+  if(have_mtime)
   {
     struct tm result;
-    strftime(img->exif_datetime_taken, 20, "%Y:%m:%d %H:%M:%S", localtime_r(&statbuf.st_mtime, &result));
+    strftime(img->exif_datetime_taken, 20, "%Y:%m:%d %H:%M:%S", localtime_r(&mtime, &result));
+  }
+
+  if(prefetch && !prefetch->cached)
+  {
+    std::cerr << "[exiv2] " << path << ": " << prefetch->error << std::endl;
+    return 1;
   }
 
   try
   {
-    std::unique_ptr<Exiv2::Image> image(Exiv2::ImageFactory::open(WIDEN(path)));
-    assert(image.get() != 0);
-    image->readMetadata();
+    std::shared_ptr<dt_exif_cached_t> cached = prefetch ? prefetch->cached : _exif_cache_get(path);
+    dt_exif_cache_use_t use(cached.get());
+    Exiv2::Image *image = cached->image.get();
     bool res = true;
 
     // EXIF metadata
@@ -1152,10 +1323,13 @@ int dt_exif_read_blob(uint8_t **buf, const char *path, const int imgid, const in
   *buf = NULL;
   try
   {
-    std::unique_ptr<Exiv2::Image> image(Exiv2::ImageFactory::open(WIDEN(path)));
-    assert(image.get() != 0);
-    image->readMetadata();
-    Exiv2::ExifData &exifData = image->exifData();
+    // a copy, it gets stripped down below
+    Exiv2::ExifData exifData;
+    {
+      std::shared_ptr<dt_exif_cached_t> cached = _exif_cache_get(path);
+      dt_exif_cache_use_t use(cached.get());
+      exifData = cached->image->exifData();
+    }
 
     // get rid of thumbnails
     Exiv2::ExifThumb(exifData).erase();
@@ -1979,16 +2153,30 @@ skip:
 
 // need a write lock on *img (non-const) to write stars (and soon color labels).
 int dt_exif_xmp_read(dt_image_t *img, const char *filename, const int history_only)
+{
+  return dt_exif_xmp_read_prefetched(img, filename, history_only, NULL);
+}
+
+int dt_exif_xmp_read_prefetched(dt_image_t *img, const char *filename, const int history_only,
+                                const dt_exif_prefetch_t *prefetch)
 {
   // exclude pfm to avoid stupid errors on the console
   const char *c = filename + strlen(filename) - 4;
   if(c >= filename && !strcmp(c, ".pfm")) return 1;
+  // there is no sidecar, or it couldn't be read
+  if(prefetch && !prefetch->sidecar) return 1;
   try
   {
     // read xmp sidecar
-    std::unique_ptr<Exiv2::Image> image(Exiv2::ImageFactory::open(WIDEN(filename)));
-    assert(image.get() != 0);
-    image->readMetadata();
+    std::unique_ptr<Exiv2::Image> opened;
+    Exiv2::Image *image = prefetch ? prefetch->sidecar.get() : NULL;
+    if(!image)
+    {
+      opened = std::unique_ptr<Exiv2::Image>(Exiv2::ImageFactory::open(WIDEN(filename)));
+      assert(opened.get() != 0);
+      opened->readMetadata();
+      image = opened.get();
+    }
     Exiv2::XmpData &xmpData = image->xmpData();
 
     sqlite3_stmt *stmt;
@@ -2129,7 +2317,8 @@ int dt_exif_xmp_read(dt_image_t *img, const char *filename, const int history_on
       return 1;
     }
 
-    sqlite3_exec(dt_database_get(darktable.db), "BEGIN TRANSACTION", NULL, NULL, NULL);
+    // a savepoint nests into the transaction an import might be batched into
+    sqlite3_exec(dt_database_get(darktable.db), "SAVEPOINT xmp_history", NULL, NULL, NULL);
 
     DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "DELETE FROM main.history WHERE imgid = ?1", -1,
                                 &stmt, NULL);
@@ -2233,12 +2422,13 @@ end:
 
     if(all_ok)
     {
-      sqlite3_exec(dt_database_get(darktable.db), "COMMIT", NULL, NULL, NULL);
+      sqlite3_exec(dt_database_get(darktable.db), "RELEASE xmp_history", NULL, NULL, NULL);
     }
     else
     {
       std::cerr << "[exif] error reading history from '" << filename << "'" << std::endl;
-      sqlite3_exec(dt_database_get(darktable.db), "ROLLBACK TRANSACTION", NULL, NULL, NULL);
+      sqlite3_exec(dt_database_get(darktable.db), "ROLLBACK TO xmp_history", NULL, NULL, NULL);
+      sqlite3_exec(dt_database_get(darktable.db), "RELEASE xmp_history", NULL, NULL, NULL);
       return 1;
     }
 
@@ -2602,6 +2792,35 @@ char *dt_exif_xmp_read_string(const int imgid)
   }
 }
 
+// adds the sidecar of imgid and what the database has to the xmp taken over from its source file, as the
+// exported files get it
+static void _exif_xmp_export_data(Exiv2::XmpData &xmpData, const int imgid, const char *input_filename)
+{
+  char sidecar[PATH_MAX] = { 0 };
+  g_strlcpy(sidecar, input_filename, sizeof(sidecar));
+
+  // now add whatever we have in the sidecar XMP. this overwrites stuff from the source image
+  dt_image_path_append_version(imgid, sidecar, sizeof(sidecar));
+  g_strlcat(sidecar, ".xmp", sizeof(sidecar));
+  if(g_file_test(sidecar, G_FILE_TEST_EXISTS))
+  {
+    Exiv2::XmpData sidecarXmpData;
+    std::string xmpPacket;
+
+    Exiv2::DataBuf buf = Exiv2::readFile(WIDEN(sidecar));
+    xmpPacket.assign(reinterpret_cast<char *>(buf.pData_), buf.size_);
+    Exiv2::XmpParser::decode(sidecarXmpData, xmpPacket);
+
+    for(Exiv2::XmpData::const_iterator it = sidecarXmpData.begin(); it != sidecarXmpData.end(); ++it)
+      xmpData.add(*it);
+  }
+
+  dt_remove_known_keys(xmpData); // is this needed?
+  // last but not least attach what we have in DB to the XMP. in theory that should be
+  // the same as what we just copied over from the sidecar file, but you never know ...
+  dt_exif_xmp_read_data(xmpData, imgid);
+}
+
 int dt_exif_xmp_attach(const int imgid, const char *filename)
 {
   try
@@ -2632,36 +2851,53 @@ int dt_exif_xmp_attach(const int imgid, const char *filename)
       std::cerr << "[xmp_attach] " << input_filename << ": caught exiv2 exception '" << e << "'\n";
     }
 
-    Exiv2::XmpData &xmpData = img->xmpData();
+    _exif_xmp_export_data(img->xmpData(), imgid, input_filename);
 
-    // now add whatever we have in the sidecar XMP. this overwrites stuff from the source image
-    dt_image_path_append_version(imgid, input_filename, sizeof(input_filename));
-    g_strlcat(input_filename, ".xmp", sizeof(input_filename));
-    if(g_file_test(input_filename, G_FILE_TEST_EXISTS))
-    {
-      Exiv2::XmpData sidecarXmpData;
-      std::string xmpPacket;
+    img->writeMetadata();
+    return 0;
+  }
+  catch(Exiv2::AnyError &e)
+  {
+    std::cerr << "[xmp_attach] " << filename << ": caught exiv2 exception '" << e << "'\n";
+    return -1;
+  }
+}
 
-      Exiv2::DataBuf buf = Exiv2::readFile(WIDEN(input_filename));
-      xmpPacket.assign(reinterpret_cast<char *>(buf.pData_), buf.size_);
-      Exiv2::XmpParser::decode(sidecarXmpData, xmpPacket);
+char *dt_exif_xmp_read_export(const int imgid)
+{
+  char input_filename[PATH_MAX] = { 0 };
+  try
+  {
+    gboolean from_cache = TRUE;
+    dt_image_full_path(imgid, input_filename, sizeof(input_filename), &from_cache);
 
-      for(Exiv2::XmpData::const_iterator it = sidecarXmpData.begin(); it != sidecarXmpData.end(); ++it)
-        xmpData.add(*it);
+    Exiv2::XmpData xmpData;
+    try
+    {
+      std::shared_ptr<dt_exif_cached_t> cached = _exif_cache_get(input_filename);
+      dt_exif_cache_use_t use(cached.get());
+      // iptc can only be written by exiv2 into the finished file
+      if(!cached->image->iptcData().empty()) return NULL;
+      xmpData = cached->image->xmpData();
+    }
+    catch(Exiv2::AnyError &e)
+    {
+      std::cerr << "[xmp_read_export] " << input_filename << ": caught exiv2 exception '" << e << "'\n";
     }
 
-    dt_remove_known_keys(xmpData); // is this needed?
-    // last but not least attach what we have in DB to the XMP. in theory that should be
-    // the same as what we just copied over from the sidecar file, but you never know ...
-    dt_exif_xmp_read_data(xmpData, imgid);
+    _exif_xmp_export_data(xmpData, imgid, input_filename);
 
-    img->writeMetadata();
-    return 0;
+    std::string xmpPacket;
+    if(Exiv2::XmpParser::encode(xmpPacket, xmpData, Exiv2::XmpParser::useCompactFormat) != 0)
+    {
+      throw Exiv2::Error(1, "[xmp_read_export] failed to serialize xmp data");
+    }
+    return g_strdup(xmpPacket.c_str());
   }
   catch(Exiv2::AnyError &e)
   {
-    std::cerr << "[xmp_attach] " << filename << ": caught exiv2 exception '" << e << "'\n";
-    return -1;
+    std::cerr << "[xmp_read_export] " << input_filename << ": caught exiv2 exception '" << e << "'\n";
+    return NULL;
   }
 }
 
@@ -2857,6 +3093,7 @@ void dt_exif_init()
   Exiv2::LogMsg::setHandler(&dt_exif_log_handler);
 
   Exiv2::XmpParser::initialize();
+  dt_pthread_mutex_init(&_exif_cache_lock, NULL);
   // this has te stay with the old url (namespace already propagated outside dt)
   Exiv2::XmpProperties::registerNs("http://darktable.sf.net/", "darktable");
   Exiv2::XmpProperties::registerNs("http://ns.adobe.com/lightroom/1.0/", "lr");
@@ -2865,9 +3102,13 @@ void dt_exif_init()
 
 void dt_exif_cleanup()
 {
+  _exif_cache.clear();
+  dt_pthread_mutex_destroy(&_exif_cache_lock);
   Exiv2::XmpParser::terminate();
 }
 
+#undef DT_EXIF_CACHE_SIZE
+
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
 // kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
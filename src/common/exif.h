@@ -30,6 +30,14 @@ extern "C" {
  * struct. returns 0 on success. */
 int dt_exif_read(dt_image_t *img, const char *path);
 
+/** metadata of a file and its xmp sidecar, read ahead without touching the database, so on any thread. */
+typedef struct dt_exif_prefetch_t dt_exif_prefetch_t;
+dt_exif_prefetch_t *dt_exif_prefetch(const char *path);
+void dt_exif_prefetch_free(dt_exif_prefetch_t *prefetch);
+
+/** dt_exif_read() from the metadata read by dt_exif_prefetch(path), or from the file if prefetch is NULL. */
+int dt_exif_read_prefetched(dt_image_t *img, const char *path, const dt_exif_prefetch_t *prefetch);
+
 /** read exif data to image struct from given data blob, wherever you got it from. */
 int dt_exif_read_from_blob(dt_image_t *img, uint8_t *blob, const int size);
 
@@ -47,11 +55,18 @@ int dt_exif_xmp_write(const int imgid, const char *filename);
 /** write xmp packet inside an image. */
 int dt_exif_xmp_attach(const int imgid, const char *filename);
 
+/** the xmp packet dt_exif_xmp_attach() would write, for formats that embed it while encoding. NULL if the
+ * exported file has to get it from dt_exif_xmp_attach() after all, when the source has iptc data. */
+char *dt_exif_xmp_read_export(const int imgid);
+
 /** get the xmp blob for imgid. */
 char *dt_exif_xmp_read_string(const int imgid);
 
 /** read xmp sidecar file. */
 int dt_exif_xmp_read(dt_image_t *img, const char *filename, const int history_only);
+/** dt_exif_xmp_read() of the sidecar read by dt_exif_prefetch(), or from the file if prefetch is NULL. */
+int dt_exif_xmp_read_prefetched(dt_image_t *img, const char *filename, const int history_only,
+                                const dt_exif_prefetch_t *prefetch);
 
 /** fetch largest exif thumbnail jpg bytestream into buffer*/
 int dt_exif_get_thumbnail(const char *path, uint8_t **buffer, size_t *size, char **mime_type);
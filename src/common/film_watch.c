@@ -0,0 +1,234 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2017 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "common/film_watch.h"
+#include "common/darktable.h"
+#include "common/database.h"
+#include "common/debug.h"
+#include "common/film.h"
+#include "control/conf.h"
+#include "control/control.h"
+#include "control/jobs.h"
+#include "control/jobs/film_jobs.h"
+
+#include <gio/gio.h>
+#include <glib.h>
+
+// seconds a folder has to stay quiet before its changes are imported. a file being written or copied changes
+// many times, and tethering or a copy usually brings a few of them at once.
+#define DT_FILM_WATCH_DELAY 2
+
+typedef struct dt_film_watch_folder_t
+{
+  int film_id;
+  gchar *dirname;
+  GFileMonitor *monitor;
+  GHashTable *files;   // full paths that showed up or changed since the last import
+  GHashTable *removed; // full paths that went away
+  guint timeout;       // source importing the changes, 0 if there are none
+} dt_film_watch_folder_t;
+
+// the folders watched, by their name. NULL if watching is off.
+static GHashTable *_folders = NULL;
+
+static void _folder_free(gpointer data)
+{
+  dt_film_watch_folder_t *folder = (dt_film_watch_folder_t *)data;
+  if(folder->timeout) g_source_remove(folder->timeout);
+  g_file_monitor_cancel(folder->monitor);
+  g_object_unref(folder->monitor);
+  g_hash_table_destroy(folder->files);
+  g_hash_table_destroy(folder->removed);
+  g_free(folder->dirname);
+  free(folder);
+}
+
+static GList *_folder_take(GHashTable *paths)
+{
+  GList *list = NULL;
+  GHashTableIter iter;
+  gpointer key;
+  g_hash_table_iter_init(&iter, paths);
+  while(g_hash_table_iter_next(&iter, &key, NULL))
+  {
+    list = g_list_prepend(list, key);
+    g_hash_table_iter_steal(&iter);
+  }
+  return list;
+}
+
+// hands the changes collected to an import job
+static gboolean _folder_import(gpointer user_data)
+{
+  dt_film_watch_folder_t *folder = (dt_film_watch_folder_t *)user_data;
+  folder->timeout = 0;
+
+  dt_print(DT_DEBUG_CONTROL, "[film_watch] `%s': %u files changed, %u removed\n", folder->dirname,
+           g_hash_table_size(folder->files), g_hash_table_size(folder->removed));
+
+  dt_film_t *film = (dt_film_t *)malloc(sizeof(dt_film_t));
+  dt_film_init(film);
+  film->id = folder->film_id;
+  g_strlcpy(film->dirname, folder->dirname, sizeof(film->dirname));
+  dt_job_t *job = dt_film_import_files_create(film, _folder_take(folder->files), _folder_take(folder->removed));
+  if(job)
+    dt_control_add_job(darktable.control, DT_JOB_QUEUE_USER_BG, job);
+  else
+  {
+    dt_film_cleanup(film);
+    free(film);
+  }
+  return FALSE;
+}
+
+// path is there now, or went away
+static void _folder_note(dt_film_watch_folder_t *folder, const gchar *path, const gboolean present)
+{
+  gchar *filename = g_path_get_basename(path);
+  const gboolean supported = dt_supported_image(filename);
+  g_free(filename);
+  if(!supported) return;
+
+  g_hash_table_remove(present ? folder->removed : folder->files, path);
+  g_hash_table_add(present ? folder->files : folder->removed, g_strdup(path));
+
+  // wait for the folder to calm down
+  if(folder->timeout) g_source_remove(folder->timeout);
+  folder->timeout = g_timeout_add_seconds(DT_FILM_WATCH_DELAY, _folder_import, folder);
+}
+
+static void _folder_changed(GFileMonitor *monitor, GFile *file, GFile *other_file, GFileMonitorEvent event,
+                            gpointer user_data)
+{
+  dt_film_watch_folder_t *folder = (dt_film_watch_folder_t *)user_data;
+  gchar *path = g_file_get_path(file);
+  if(!path) return;
+
+  switch(event)
+  {
+    case G_FILE_MONITOR_EVENT_CREATED:
+    case G_FILE_MONITOR_EVENT_CHANGED:
+    case G_FILE_MONITOR_EVENT_CHANGES_DONE_HINT:
+      _folder_note(folder, path, TRUE);
+      break;
+    case G_FILE_MONITOR_EVENT_DELETED:
+      _folder_note(folder, path, FALSE);
+      break;
+    case G_FILE_MONITOR_EVENT_MOVED:
+    {
+      // a rename, the new name might be in another folder
+      _folder_note(folder, path, FALSE);
+      gchar *other_path = other_file ? g_file_get_path(other_file) : NULL;
+      gchar *other_dir = other_path ? g_path_get_dirname(other_path) : NULL;
+      if(other_dir && !g_strcmp0(other_dir, folder->dirname)) _folder_note(folder, other_path, TRUE);
+      g_free(other_dir);
+      g_free(other_path);
+      break;
+    }
+    default:
+      break;
+  }
+  g_free(path);
+}
+
+// watches the film rolls not watched yet and stops watching the ones gone from the library
+static void _film_watch_sync(void)
+{
+  GHashTable *current = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+  sqlite3_stmt *stmt;
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "SELECT id, folder FROM main.film_rolls", -1, &stmt,
+                              NULL);
+  while(sqlite3_step(stmt) == SQLITE_ROW)
+  {
+    const gchar *dirname = (const gchar *)sqlite3_column_text(stmt, 1);
+    if(!dirname) continue;
+    g_hash_table_add(current, g_strdup(dirname));
+    if(g_hash_table_contains(_folders, dirname)) continue;
+
+    GError *error = NULL;
+    GFile *dir = g_file_new_for_path(dirname);
+    GFileMonitor *monitor = g_file_monitor_directory(dir, G_FILE_MONITOR_SEND_MOVED, NULL, &error);
+    g_object_unref(dir);
+    if(!monitor)
+    {
+      // folders on drives that aren't there right now get picked up once they are
+      dt_print(DT_DEBUG_CONTROL, "[film_watch] can't watch `%s': %s\n", dirname, error->message);
+      g_error_free(error);
+      continue;
+    }
+
+    dt_film_watch_folder_t *folder = (dt_film_watch_folder_t *)calloc(1, sizeof(dt_film_watch_folder_t));
+    folder->film_id = sqlite3_column_int(stmt, 0);
+    folder->dirname = g_strdup(dirname);
+    folder->monitor = monitor;
+    folder->files = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    folder->removed = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    g_signal_connect(monitor, "changed", G_CALLBACK(_folder_changed), folder);
+    g_hash_table_insert(_folders, folder->dirname, folder);
+  }
+  sqlite3_finalize(stmt);
+
+  GHashTableIter iter;
+  gpointer key;
+  g_hash_table_iter_init(&iter, _folders);
+  while(g_hash_table_iter_next(&iter, &key, NULL))
+    if(!g_hash_table_contains(current, key)) g_hash_table_iter_remove(&iter);
+  g_hash_table_destroy(current);
+}
+
+static void _film_watch_filmrolls_changed(gpointer instance, gpointer user_data)
+{
+  _film_watch_sync();
+}
+
+static void _film_watch_filmrolls_imported(gpointer instance, int film_id, gpointer user_data)
+{
+  _film_watch_sync();
+}
+
+void dt_film_watch_init(void)
+{
+  if(_folders || !dt_conf_get_bool("plugins/lighttable/import/watch")) return;
+
+  _folders = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, _folder_free);
+  _film_watch_sync();
+  dt_print(DT_DEBUG_CONTROL, "[film_watch] watching %u folders\n", g_hash_table_size(_folders));
+
+  dt_control_signal_connect(darktable.signals, DT_SIGNAL_FILMROLLS_CHANGED,
+                            G_CALLBACK(_film_watch_filmrolls_changed), NULL);
+  dt_control_signal_connect(darktable.signals, DT_SIGNAL_FILMROLLS_REMOVED,
+                            G_CALLBACK(_film_watch_filmrolls_changed), NULL);
+  dt_control_signal_connect(darktable.signals, DT_SIGNAL_FILMROLLS_IMPORTED,
+                            G_CALLBACK(_film_watch_filmrolls_imported), NULL);
+}
+
+void dt_film_watch_cleanup(void)
+{
+  if(!_folders) return;
+
+  dt_control_signal_disconnect(darktable.signals, G_CALLBACK(_film_watch_filmrolls_changed), NULL);
+  dt_control_signal_disconnect(darktable.signals, G_CALLBACK(_film_watch_filmrolls_imported), NULL);
+  g_hash_table_destroy(_folders);
+  _folders = NULL;
+}
+
+#undef DT_FILM_WATCH_DELAY
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
@@ -0,0 +1,38 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2017 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+/**
+ * watches the folders of the film rolls for files showing up, changing and going away, when the
+ * plugins/lighttable/import/watch option is set. the changes of a folder are collected until it stayed quiet for
+ * a moment and then imported as one job, so files written by tethering or copied in from outside show up without
+ * importing the folder again.
+ *
+ * it uses the gio file monitors, inotify, fsevents or ReadDirectoryChangesW depending on the platform. the gui
+ * thread runs everything but the import jobs.
+ */
+
+/** starts watching all film rolls, and the ones imported later on */
+void dt_film_watch_init(void);
+/** stops watching, changes not imported yet are dropped */
+void dt_film_watch_cleanup(void);
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
@@ -33,6 +33,19 @@
 
 #define BLOCKSIZE (1 << 6)
 
+// the sigma a blur keeps on the pyramid level it is done on, and the smallest level worth blurring on
+#define DT_GAUSSIAN_PYRAMID_SIGMA 8.0f
+#define DT_GAUSSIAN_PYRAMID_MIN_SIZE 32
+
+// pixels per block of the cache blocked 4 channel blur: columns of the vertical pass and rows of the
+// horizontal one
+#define DT_GAUSSIAN_BLOCK 8
+
+typedef struct dt_gaussian_coeffs_t
+{
+  float a0, a1, a2, a3, b1, b2, coefp, coefn;
+} dt_gaussian_coeffs_t;
+
 static void compute_gauss_params(const float sigma, dt_gaussian_order_t order, float *a0, float *a1,
                                  float *a2, float *a3, float *b1, float *b2, float *coefp, float *coefn)
 {
@@ -96,6 +109,8 @@ size_t dt_gaussian_memory_use(const int width,    // width of input image
 #else
   mem_use = (size_t)width * height * channels * sizeof(float);
 #endif
+  // transposed row blocks of the blocked 4 channel blur, two planes per thread
+  mem_use += (size_t)2 * DT_GAUSSIAN_BLOCK * width * channels * sizeof(float) * dt_get_num_threads();
   return mem_use;
 }
 
@@ -476,8 +491,250 @@ static void dt_gaussian_blur_4c_sse(dt_gaussian_t *g, const float *const in, flo
 }
 #endif
 
+// the blur of DT_GAUSSIAN_BLOCK adjacent columns or rows at once, written for the compiler to vectorize over
+// the 4 * n floats of the block and cloned for avx2 and avx512 below. lo and hi are the clamping bounds
+// repeated for every pixel of a block.
+
+// vertical pass of the n <= DT_GAUSSIAN_BLOCK columns from i0: they are next to each other in memory, so every
+// row of the block is one contiguous run of cache lines
+DT_ALWAYS_INLINE void gauss_4c_columns_plain(const float *const in, float *const temp, const int width,
+                                             const int height, const int i0, const int n,
+                                             const dt_gaussian_coeffs_t *const c, const float *const lo,
+                                             const float *const hi)
+{
+  const int m = 4 * n;
+  float xp[4 * DT_GAUSSIAN_BLOCK], yb[4 * DT_GAUSSIAN_BLOCK], yp[4 * DT_GAUSSIAN_BLOCK];
+
+  // forward filter
+  for(int k = 0; k < m; k++)
+  {
+    xp[k] = CLAMPF(in[(size_t)4 * i0 + k], lo[k], hi[k]);
+    yb[k] = xp[k] * c->coefp;
+    yp[k] = yb[k];
+  }
+  for(int j = 0; j < height; j++)
+  {
+    const size_t offset = ((size_t)j * width + i0) * 4;
+    for(int k = 0; k < m; k++)
+    {
+      const float xc = CLAMPF(in[offset + k], lo[k], hi[k]);
+      const float yc = (c->a0 * xc) + (c->a1 * xp[k]) - (c->b1 * yp[k]) - (c->b2 * yb[k]);
+      temp[offset + k] = yc;
+      xp[k] = xc;
+      yb[k] = yp[k];
+      yp[k] = yc;
+    }
+  }
+
+  // backward filter, reusing the state arrays as xn, xa, yn and ya
+  float *const xn = xp, *const xa = yb, *const yn = yp;
+  float ya[4 * DT_GAUSSIAN_BLOCK];
+  for(int k = 0; k < m; k++)
+  {
+    xn[k] = CLAMPF(in[((size_t)(height - 1) * width + i0) * 4 + k], lo[k], hi[k]);
+    xa[k] = xn[k];
+    yn[k] = xn[k] * c->coefn;
+    ya[k] = yn[k];
+  }
+  for(int j = height - 1; j > -1; j--)
+  {
+    const size_t offset = ((size_t)j * width + i0) * 4;
+    for(int k = 0; k < m; k++)
+    {
+      const float xc = CLAMPF(in[offset + k], lo[k], hi[k]);
+      const float yc = (c->a2 * xn[k]) + (c->a3 * xa[k]) - (c->b1 * yn[k]) - (c->b2 * ya[k]);
+      xa[k] = xn[k];
+      xn[k] = xc;
+      ya[k] = yn[k];
+      yn[k] = yc;
+      temp[offset + k] += yc;
+    }
+  }
+}
+
+// horizontal pass of the n <= DT_GAUSSIAN_BLOCK rows from j0: the block is transposed into buf, so that the
+// pixels with the same x of all rows are next to each other, filtered there and transposed back. buf has
+// room for two planes of 4 * DT_GAUSSIAN_BLOCK * width floats, the clamped input and the forward result.
+DT_ALWAYS_INLINE void gauss_4c_rows_plain(const float *const temp, float *const out, float *const buf,
+                                          const int width, const int j0, const int n,
+                                          const dt_gaussian_coeffs_t *const c, const float *const lo,
+                                          const float *const hi)
+{
+  const int m = 4 * n;
+  float *const x = buf;
+  float *const y = buf + (size_t)4 * DT_GAUSSIAN_BLOCK * width;
+
+  for(int r = 0; r < n; r++)
+  {
+    const float *const row = temp + (size_t)(j0 + r) * width * 4;
+    for(int i = 0; i < width; i++)
+      for(int k = 0; k < 4; k++) x[(size_t)i * m + 4 * r + k] = CLAMPF(row[4 * i + k], lo[k], hi[k]);
+  }
+
+  // forward filter
+  float xp[4 * DT_GAUSSIAN_BLOCK], yb[4 * DT_GAUSSIAN_BLOCK], yp[4 * DT_GAUSSIAN_BLOCK];
+  for(int k = 0; k < m; k++)
+  {
+    xp[k] = x[k];
+    yb[k] = xp[k] * c->coefp;
+    yp[k] = yb[k];
+  }
+  for(int i = 0; i < width; i++)
+  {
+    const size_t offset = (size_t)i * m;
+    for(int k = 0; k < m; k++)
+    {
+      const float xc = x[offset + k];
+      const float yc = (c->a0 * xc) + (c->a1 * xp[k]) - (c->b1 * yp[k]) - (c->b2 * yb[k]);
+      y[offset + k] = yc;
+      xp[k] = xc;
+      yb[k] = yp[k];
+      yp[k] = yc;
+    }
+  }
+
+  // backward filter
+  float *const xn = xp, *const xa = yb, *const yn = yp;
+  float ya[4 * DT_GAUSSIAN_BLOCK];
+  for(int k = 0; k < m; k++)
+  {
+    xn[k] = x[(size_t)(width - 1) * m + k];
+    xa[k] = xn[k];
+    yn[k] = xn[k] * c->coefn;
+    ya[k] = yn[k];
+  }
+  for(int i = width - 1; i > -1; i--)
+  {
+    const size_t offset = (size_t)i * m;
+    for(int k = 0; k < m; k++)
+    {
+      const float xc = x[offset + k];
+      const float yc = (c->a2 * xn[k]) + (c->a3 * xa[k]) - (c->b1 * yn[k]) - (c->b2 * ya[k]);
+      xa[k] = xn[k];
+      xn[k] = xc;
+      ya[k] = yn[k];
+      yn[k] = yc;
+      y[offset + k] += yc;
+    }
+  }
+
+  for(int r = 0; r < n; r++)
+  {
+    float *const row = out + (size_t)(j0 + r) * width * 4;
+    for(int i = 0; i < width; i++)
+      for(int k = 0; k < 4; k++) row[4 * i + k] = y[(size_t)i * m + 4 * r + k];
+  }
+}
+
+typedef void(gauss_4c_columns_func)(const float *const in, float *const temp, const int width, const int height,
+                                    const int i0, const int n, const dt_gaussian_coeffs_t *const c,
+                                    const float *const lo, const float *const hi);
+typedef void(gauss_4c_rows_func)(const float *const temp, float *const out, float *const buf, const int width,
+                                 const int j0, const int n, const dt_gaussian_coeffs_t *const c,
+                                 const float *const lo, const float *const hi);
+
+// full blocks get a constant block size, so the inner loops have a fixed trip count
+#ifdef DT_TARGET_AVX2
+static DT_TARGET_AVX2 void gauss_4c_columns_avx2(const float *const in, float *const temp, const int width,
+                                                 const int height, const int i0, const int n,
+                                                 const dt_gaussian_coeffs_t *const c, const float *const lo,
+                                                 const float *const hi)
+{
+  if(n == DT_GAUSSIAN_BLOCK)
+    gauss_4c_columns_plain(in, temp, width, height, i0, DT_GAUSSIAN_BLOCK, c, lo, hi);
+  else
+    gauss_4c_columns_plain(in, temp, width, height, i0, n, c, lo, hi);
+}
+
+static DT_TARGET_AVX2 void gauss_4c_rows_avx2(const float *const temp, float *const out, float *const buf,
+                                              const int width, const int j0, const int n,
+                                              const dt_gaussian_coeffs_t *const c, const float *const lo,
+                                              const float *const hi)
+{
+  if(n == DT_GAUSSIAN_BLOCK)
+    gauss_4c_rows_plain(temp, out, buf, width, j0, DT_GAUSSIAN_BLOCK, c, lo, hi);
+  else
+    gauss_4c_rows_plain(temp, out, buf, width, j0, n, c, lo, hi);
+}
+
+static DT_TARGET_AVX512 void gauss_4c_columns_avx512(const float *const in, float *const temp, const int width,
+                                                     const int height, const int i0, const int n,
+                                                     const dt_gaussian_coeffs_t *const c, const float *const lo,
+                                                     const float *const hi)
+{
+  if(n == DT_GAUSSIAN_BLOCK)
+    gauss_4c_columns_plain(in, temp, width, height, i0, DT_GAUSSIAN_BLOCK, c, lo, hi);
+  else
+    gauss_4c_columns_plain(in, temp, width, height, i0, n, c, lo, hi);
+}
+
+static DT_TARGET_AVX512 void gauss_4c_rows_avx512(const float *const temp, float *const out, float *const buf,
+                                                  const int width, const int j0, const int n,
+                                                  const dt_gaussian_coeffs_t *const c, const float *const lo,
+                                                  const float *const hi)
+{
+  if(n == DT_GAUSSIAN_BLOCK)
+    gauss_4c_rows_plain(temp, out, buf, width, j0, DT_GAUSSIAN_BLOCK, c, lo, hi);
+  else
+    gauss_4c_rows_plain(temp, out, buf, width, j0, n, c, lo, hi);
+}
+
+static void dt_gaussian_blur_4c_blocked(dt_gaussian_t *g, const float *const in, float *const out,
+                                        gauss_4c_columns_func *const columns, gauss_4c_rows_func *const rows)
+{
+  const int width = g->width;
+  const int height = g->height;
+
+  assert(g->channels == 4);
+
+  // one transposed block of rows per thread, fall back to the unblocked blur without the memory for them
+  const size_t bufsize = (size_t)2 * 4 * DT_GAUSSIAN_BLOCK * width;
+  float *const rowbuf = dt_alloc_align(64, sizeof(float) * bufsize * dt_get_num_threads());
+  if(!rowbuf)
+  {
+    dt_gaussian_blur(g, in, out);
+    return;
+  }
+
+  dt_gaussian_coeffs_t c;
+  compute_gauss_params(g->sigma, g->order, &c.a0, &c.a1, &c.a2, &c.a3, &c.b1, &c.b2, &c.coefp, &c.coefn);
+
+  float lo[4 * DT_GAUSSIAN_BLOCK], hi[4 * DT_GAUSSIAN_BLOCK];
+  for(int k = 0; k < 4 * DT_GAUSSIAN_BLOCK; k++)
+  {
+    lo[k] = g->min[k & 3];
+    hi[k] = g->max[k & 3];
+  }
+
+  float *const temp = g->buf;
+
+// vertical blur block of columns by block of columns
+#ifdef _OPENMP
+#pragma omp parallel for default(none) shared(c, lo, hi) schedule(static)
+#endif
+  for(int i = 0; i < width; i += DT_GAUSSIAN_BLOCK)
+    columns(in, temp, width, height, i, MIN(DT_GAUSSIAN_BLOCK, width - i), &c, lo, hi);
+
+// horizontal blur block of lines by block of lines
+#ifdef _OPENMP
+#pragma omp parallel for default(none) shared(c, lo, hi) schedule(static)
+#endif
+  for(int j = 0; j < height; j += DT_GAUSSIAN_BLOCK)
+    rows(temp, out, rowbuf + bufsize * dt_get_thread_num(), width, j, MIN(DT_GAUSSIAN_BLOCK, height - j), &c,
+         lo, hi);
+
+  dt_free_align(rowbuf);
+}
+#endif
+
 void dt_gaussian_blur_4c(dt_gaussian_t *g, const float *const in, float *const out)
 {
+#ifdef DT_TARGET_AVX2
+  if(darktable.codepath.AVX512)
+    return dt_gaussian_blur_4c_blocked(g, in, out, gauss_4c_columns_avx512, gauss_4c_rows_avx512);
+  else if(darktable.codepath.AVX2)
+    return dt_gaussian_blur_4c_blocked(g, in, out, gauss_4c_columns_avx2, gauss_4c_rows_avx2);
+#endif
   if(darktable.codepath.OPENMP_SIMD) return dt_gaussian_blur(g, in, out);
 #if defined(__SSE__)
   else if(darktable.codepath.SSE2)
@@ -496,6 +753,152 @@ void dt_gaussian_free(dt_gaussian_t *g)
   free(g);
 }
 
+dt_gaussian_pyramid_t *dt_gaussian_pyramid_init(const float *const in, const int width, const int height)
+{
+  dt_gaussian_pyramid_t *p = (dt_gaussian_pyramid_t *)calloc(1, sizeof(dt_gaussian_pyramid_t));
+  if(!p) return NULL;
+  p->width = p->lwidth[0] = width;
+  p->height = p->lheight[0] = height;
+  p->level[0] = in;
+  p->levels = 1;
+  return p;
+}
+
+void dt_gaussian_pyramid_free(dt_gaussian_pyramid_t *p)
+{
+  if(!p) return;
+  for(int k = 1; k < p->levels; k++) dt_free_align((void *)p->level[k]);
+  free(p);
+}
+
+// averages 2x2 blocks of in, the last row and column are repeated for odd sizes
+static void _pyramid_reduce(const float *const in, const int iw, const int ih, float *const out, const int ow,
+                            const int oh)
+{
+#ifdef _OPENMP
+#pragma omp parallel for default(none) schedule(static)
+#endif
+  for(int j = 0; j < oh; j++)
+  {
+    const float *const row0 = in + (size_t)4 * iw * (2 * j);
+    const float *const row1 = in + (size_t)4 * iw * MIN(2 * j + 1, ih - 1);
+    float *const o = out + (size_t)4 * ow * j;
+    for(int i = 0; i < ow; i++)
+    {
+      const int x0 = 4 * (2 * i), x1 = 4 * MIN(2 * i + 1, iw - 1);
+      for(int c = 0; c < 4; c++)
+        o[4 * i + c] = 0.25f * (row0[x0 + c] + row0[x1 + c] + row1[x0 + c] + row1[x1 + c]);
+    }
+  }
+}
+
+// bilinear upsampling of level k to the size of level 0, pixel centers aligned
+static int _pyramid_expand(const float *const in, const int iw, const int ih, const int k, float *const out,
+                           const int ow, const int oh)
+{
+  const float scale = 1.0f / (1 << k);
+  int *const x0 = (int *)malloc(sizeof(int) * ow);
+  float *const fx = (float *)malloc(sizeof(float) * ow);
+  if(!x0 || !fx)
+  {
+    free(x0);
+    free(fx);
+    return 1;
+  }
+  for(int i = 0; i < ow; i++)
+  {
+    const float u = CLAMPF((i + 0.5f) * scale - 0.5f, 0.0f, iw - 1);
+    x0[i] = MIN((int)u, MAX(iw - 2, 0));
+    fx[i] = iw > 1 ? u - x0[i] : 0.0f;
+  }
+  const int xstep = iw > 1 ? 4 : 0;
+
+#ifdef _OPENMP
+#pragma omp parallel for default(none) schedule(static)
+#endif
+  for(int j = 0; j < oh; j++)
+  {
+    const float v = CLAMPF((j + 0.5f) * scale - 0.5f, 0.0f, ih - 1);
+    const int y0 = MIN((int)v, MAX(ih - 2, 0));
+    const float fy = ih > 1 ? v - y0 : 0.0f;
+    const float *const row0 = in + (size_t)4 * iw * y0;
+    const float *const row1 = ih > 1 ? row0 + (size_t)4 * iw : row0;
+    float *const o = out + (size_t)4 * ow * j;
+    for(int i = 0; i < ow; i++)
+    {
+      const float *const a = row0 + 4 * x0[i];
+      const float *const b = row1 + 4 * x0[i];
+      const float f = fx[i];
+      for(int c = 0; c < 4; c++)
+      {
+        const float top = a[c] + f * (a[xstep + c] - a[c]);
+        const float bottom = b[c] + f * (b[xstep + c] - b[c]);
+        o[4 * i + c] = top + fy * (bottom - top);
+      }
+    }
+  }
+  free(x0);
+  free(fx);
+  return 0;
+}
+
+int dt_gaussian_pyramid_blur_4c(dt_gaussian_pyramid_t *p, const float sigma, const float *max, const float *min,
+                                float *const out)
+{
+  int k = 0;
+  for(int w = (p->width + 1) / 2, h = (p->height + 1) / 2;
+      k + 1 < DT_GAUSSIAN_PYRAMID_LEVELS && sigma / (2 << k) >= DT_GAUSSIAN_PYRAMID_SIGMA
+      && w >= DT_GAUSSIAN_PYRAMID_MIN_SIZE && h >= DT_GAUSSIAN_PYRAMID_MIN_SIZE;
+      w = (w + 1) / 2, h = (h + 1) / 2)
+    k++;
+
+  for(int l = p->levels; l <= k; l++)
+  {
+    const int w = (p->lwidth[l - 1] + 1) / 2, h = (p->lheight[l - 1] + 1) / 2;
+    float *level = dt_alloc_align(64, sizeof(float) * 4 * w * h);
+    if(!level) return 1;
+    _pyramid_reduce(p->level[l - 1], p->lwidth[l - 1], p->lheight[l - 1], level, w, h);
+    p->level[l] = level;
+    p->lwidth[l] = w;
+    p->lheight[l] = h;
+    p->levels = l + 1;
+  }
+
+  const int w = p->lwidth[k], h = p->lheight[k];
+  // the averaging and the bilinear upsampling blur already, by about a box and a tent of 2^k pixels
+  const float s = 1 << k;
+  const float sigma_k = k ? sqrtf(MAX(sigma * sigma - (s * s - 1.0f) / 12.0f - s * s / 6.0f, s * s)) / s : sigma;
+  dt_gaussian_t *g = dt_gaussian_init(w, h, 4, max, min, sigma_k, DT_IOP_GAUSSIAN_ZERO);
+  if(!g) return 1;
+  if(!k)
+  {
+    dt_gaussian_blur_4c(g, p->level[0], out);
+    dt_gaussian_free(g);
+    return 0;
+  }
+  float *blurred = dt_alloc_align(64, sizeof(float) * 4 * w * h);
+  if(!blurred)
+  {
+    dt_gaussian_free(g);
+    return 1;
+  }
+  dt_gaussian_blur_4c(g, p->level[k], blurred);
+  dt_gaussian_free(g);
+  const int err = _pyramid_expand(blurred, w, h, k, out, p->width, p->height);
+  dt_free_align(blurred);
+  return err;
+}
+
+int dt_gaussian_pyramid_blur_once_4c(const float *const in, float *const out, const int width, const int height,
+                                     const float sigma, const float *max, const float *min)
+{
+  dt_gaussian_pyramid_t *p = dt_gaussian_pyramid_init(in, width, height);
+  if(!p) return 1;
+  const int err = dt_gaussian_pyramid_blur_4c(p, sigma, max, min, out);
+  dt_gaussian_pyramid_free(p);
+  return err;
+}
+
 
 #ifdef HAVE_OPENCL
 dt_gaussian_cl_global_t *dt_gaussian_init_cl_global()
@@ -53,6 +53,33 @@ void dt_gaussian_blur_4c(dt_gaussian_t *g, const float *const in, float *const o
 
 void dt_gaussian_free(dt_gaussian_t *g);
 
+#define DT_GAUSSIAN_PYRAMID_LEVELS 8
+
+/** an image and versions of it downsampled by powers of two, built as they are needed. a blur of order zero
+ * with a large sigma is done on the level where it still spans DT_GAUSSIAN_PYRAMID_SIGMA pixels and
+ * upsampled, which is cheaper than the full resolution blur and looks the same. */
+typedef struct dt_gaussian_pyramid_t
+{
+  int width, height; // of level 0
+  int levels;        // built so far, level 0 included
+  const float *level[DT_GAUSSIAN_PYRAMID_LEVELS]; // 4 channels, level 0 is the caller's buffer
+  int lwidth[DT_GAUSSIAN_PYRAMID_LEVELS], lheight[DT_GAUSSIAN_PYRAMID_LEVELS];
+} dt_gaussian_pyramid_t;
+
+/** in has to stay valid and unchanged as long as the pyramid is used. */
+dt_gaussian_pyramid_t *dt_gaussian_pyramid_init(const float *const in, const int width, const int height);
+
+/** blurs level 0 with sigma and order zero into out, clamped to max and min. returns non-zero if out of memory. */
+int dt_gaussian_pyramid_blur_4c(dt_gaussian_pyramid_t *p, const float sigma, const float *max, const float *min,
+                                float *const out);
+
+void dt_gaussian_pyramid_free(dt_gaussian_pyramid_t *p);
+
+/** dt_gaussian_blur_4c() of order zero through a pyramid of its own, for a single blur of in. returns non-zero
+ * if out of memory. */
+int dt_gaussian_pyramid_blur_once_4c(const float *const in, float *const out, const int width, const int height,
+                                     const float sigma, const float *max, const float *min);
+
 
 #ifdef HAVE_OPENCL
 typedef struct dt_gaussian_cl_global_t
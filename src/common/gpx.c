@@ -18,8 +18,12 @@
 #include "common/gpx.h"
 #include "common/darktable.h"
 #include <glib.h>
+#include <glib/gstdio.h>
 #include <inttypes.h>
 
+// parsed tracks kept for the next apply of the same file
+#define DT_GPX_CACHED_TRACKS 4
+
 typedef struct _gpx_track_point_t
 {
   gdouble longitude, latitude, elevation;
@@ -37,8 +41,14 @@ typedef enum _gpx_parser_element_t
 
 typedef struct dt_gpx_t
 {
-  /* the list of track records parsed */
-  GList *track;
+  /* the track records parsed, sorted by time */
+  GArray *track;
+
+  /* the file it was parsed from, to find it in the cache */
+  gchar *filename;
+  gint64 mtime;
+  goffset size;
+  gint refcount;
 
   /* currently parsed track point */
   _gpx_track_point_t *current_track_point;
@@ -68,8 +78,32 @@ static gint _sort_track(gconstpointer a, gconstpointer b)
   return diff != 0 ? diff : pa->time.tv_usec - pb->time.tv_usec;
 }
 
+/* most recently used first, each holding a reference */
+static GList *_gpx_cache = NULL;
+G_LOCK_DEFINE_STATIC(_gpx_cache);
+
 dt_gpx_t *dt_gpx_new(const gchar *filename)
 {
+  GStatBuf st;
+  const gboolean have_stat = g_stat(filename, &st) == 0;
+  if(have_stat)
+  {
+    G_LOCK(_gpx_cache);
+    for(GList *l = _gpx_cache; l; l = g_list_next(l))
+    {
+      dt_gpx_t *cached = (dt_gpx_t *)l->data;
+      if(cached->mtime != (gint64)st.st_mtime || cached->size != (goffset)st.st_size
+         || strcmp(cached->filename, filename))
+        continue;
+      _gpx_cache = g_list_remove_link(_gpx_cache, l);
+      _gpx_cache = g_list_concat(l, _gpx_cache);
+      g_atomic_int_inc(&cached->refcount);
+      G_UNLOCK(_gpx_cache);
+      return cached;
+    }
+    G_UNLOCK(_gpx_cache);
+  }
+
   dt_gpx_t *gpx = NULL;
   GMarkupParseContext *ctx = NULL;
   GError *err = NULL;
@@ -89,6 +123,7 @@ dt_gpx_t *dt_gpx_new(const gchar *filename)
 
   /* allocate new dt_gpx_t context */
   gpx = g_malloc0(sizeof(dt_gpx_t));
+  gpx->track = g_array_new(FALSE, FALSE, sizeof(_gpx_track_point_t));
 
   /* skip UTF-8 BOM */
   if(gpxmf_size > 3 && gpxmf_content[0] == '\xef' && gpxmf_content[1] == '\xbb' && gpxmf_content[2] == '\xbf')
@@ -105,7 +140,27 @@ dt_gpx_t *dt_gpx_new(const gchar *filename)
   g_mapped_file_unref(gpxmf);
 
   /* safeguard against corrupt gpx files that have the points not ordered by time */
-  gpx->track = g_list_sort(gpx->track, _sort_track);
+  g_array_sort(gpx->track, _sort_track);
+
+  gpx->refcount = 1;
+  if(have_stat)
+  {
+    gpx->filename = g_strdup(filename);
+    gpx->mtime = st.st_mtime;
+    gpx->size = st.st_size;
+    gpx->refcount++;
+
+    G_LOCK(_gpx_cache);
+    _gpx_cache = g_list_prepend(_gpx_cache, gpx);
+    GList *evicted = g_list_nth(_gpx_cache, DT_GPX_CACHED_TRACKS);
+    if(evicted) evicted->prev->next = NULL;
+    G_UNLOCK(_gpx_cache);
+    if(evicted)
+    {
+      evicted->prev = NULL;
+      g_list_free_full(evicted, (GDestroyNotify)dt_gpx_destroy);
+    }
+  }
 
   return gpx;
 
@@ -118,6 +173,11 @@ error:
 
   if(ctx) g_markup_parse_context_free(ctx);
 
+  if(gpx)
+  {
+    g_free(gpx->current_track_point);
+    g_array_free(gpx->track, TRUE);
+  }
   g_free(gpx);
 
   if(gpxmf) g_mapped_file_unref(gpxmf);
@@ -129,8 +189,10 @@ void dt_gpx_destroy(struct dt_gpx_t *gpx)
 {
   g_assert(gpx != NULL);
 
-  if(gpx->track) g_list_free_full(gpx->track, g_free);
+  if(!g_atomic_int_dec_and_test(&gpx->refcount)) return;
 
+  g_array_free(gpx->track, TRUE);
+  g_free(gpx->filename);
   g_free(gpx);
 }
 
@@ -139,40 +201,41 @@ gboolean dt_gpx_get_location(struct dt_gpx_t *gpx, GTimeVal *timestamp, gdouble
 {
   g_assert(gpx != NULL);
 
-  GList *item = g_list_first(gpx->track);
-
   /* verify that we got at least 2 trackpoints */
-  if(!item || !item->next) return FALSE;
-
-  do
+  const guint n = gpx->track->len;
+  if(n < 2) return FALSE;
+  const _gpx_track_point_t *track = &g_array_index(gpx->track, _gpx_track_point_t, 0);
+
+  /* if timestamp is out of time range return false but fill
+     closest location value start or end point */
+  const _gpx_track_point_t *tp = NULL;
+  if(timestamp->tv_sec <= track[0].time.tv_sec)
+    tp = track;
+  else if(timestamp->tv_sec > track[n - 1].time.tv_sec)
+    tp = track + n - 1;
+  if(tp)
   {
+    *lon = tp->longitude;
+    *lat = tp->latitude;
+    *ele = tp->elevation;
+    return FALSE;
+  }
 
-    _gpx_track_point_t *tp = (_gpx_track_point_t *)item->data;
-
-    /* if timestamp is out of time range return false but fill
-       closest location value start or end point */
-    if((!item->next && timestamp->tv_sec >= tp->time.tv_sec) || (timestamp->tv_sec <= tp->time.tv_sec))
-    {
-      *lon = tp->longitude;
-      *lat = tp->latitude;
-      *ele = tp->elevation;
-      return FALSE;
-    }
-
-    /* check if timestamp is within current and next trackpoint */
-    if(timestamp->tv_sec >= tp->time.tv_sec
-       && timestamp->tv_sec <= ((_gpx_track_point_t *)item->next->data)->time.tv_sec)
-    {
-      *lon = tp->longitude;
-      *lat = tp->latitude;
-      *ele = tp->elevation;
-      return TRUE;
-    }
-
-  } while((item = g_list_next(item)) != NULL);
-
-  /* should not reach this point */
-  return FALSE;
+  /* find the first trackpoint not before timestamp, the one before it is where we were */
+  guint lo = 1, hi = n - 1;
+  while(lo < hi)
+  {
+    const guint mid = lo + (hi - lo) / 2;
+    if(track[mid].time.tv_sec < timestamp->tv_sec)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  tp = track + lo - 1;
+  *lon = tp->longitude;
+  *lat = tp->latitude;
+  *ele = tp->elevation;
+  return TRUE;
 }
 
 /*
@@ -276,10 +339,9 @@ void _gpx_parser_end_element(GMarkupParseContext *context, const gchar *element_
     }
     else if(strcmp(element_name, "trkpt") == 0)
     {
-      if(!gpx->invalid_track_point)
-        gpx->track = g_list_append(gpx->track, gpx->current_track_point);
-      else
-        g_free(gpx->current_track_point);
+      if(gpx->current_track_point && !gpx->invalid_track_point)
+        g_array_append_val(gpx->track, *gpx->current_track_point);
+      g_free(gpx->current_track_point);
 
       gpx->current_track_point = NULL;
     }
@@ -309,6 +371,8 @@ void _gpx_parser_text(GMarkupParseContext *context, const gchar *text, gsize tex
     gpx->current_track_point->elevation = g_ascii_strtod(text, NULL);
 }
 
+#undef DT_GPX_CACHED_TRACKS
+
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
 // kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
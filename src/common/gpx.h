@@ -22,8 +22,10 @@
 
 struct dt_gpx_t;
 
-/* loads and parses a gpx track file */
+/* loads and parses a gpx track file. the last few files parsed are kept and handed out again as long as
+   their modification time and size stay the same, so the result must not be changed. */
 struct dt_gpx_t *dt_gpx_new(const gchar *filename);
+/* releases what dt_gpx_new() returned */
 void dt_gpx_destroy(struct dt_gpx_t *);
 
 /* fetch the lon,lat coords for time t, if within time range
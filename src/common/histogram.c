@@ -26,6 +26,7 @@
 
 #include "common/darktable.h"
 #include "common/histogram.h"
+#include "common/opencl.h"
 #include "develop/imageop.h"
 
 #define S(V, params) ((params->mul) * ((float)V))
@@ -46,8 +47,9 @@ inline static void histogram_helper_cs_RAW(const dt_dev_histogram_collection_par
                                            const void *pixel, uint32_t *histogram, int j)
 {
   const dt_histogram_roi_t *roi = histogram_params->roi;
+  const int step = histogram_params->step;
   const float *input = (float *)pixel + roi->width * j + roi->crop_x;
-  for(int i = 0; i < roi->width - roi->crop_width - roi->crop_x; i++, input++)
+  for(int i = 0; i < roi->width - roi->crop_width - roi->crop_x; i += step, input += step)
   {
     histogram_helper_cs_RAW_helper_process_pixel_float(histogram_params, input, histogram);
   }
@@ -67,10 +69,11 @@ inline void dt_histogram_helper_cs_RAW_uint16(const dt_dev_histogram_collection_
                                               const void *pixel, uint32_t *histogram, int j)
 {
   const dt_histogram_roi_t *roi = histogram_params->roi;
+  const int step = histogram_params->step;
   uint16_t *in = (uint16_t *)pixel + roi->width * j + roi->crop_x;
 
   // process pixels
-  for(int i = 0; i < roi->width - roi->crop_width - roi->crop_x; i++, in++)
+  for(int i = 0; i < roi->width - roi->crop_width - roi->crop_x; i += step, in += step)
     histogram_helper_cs_RAW_helper_process_pixel_uint16(histogram_params, in, histogram);
 }
 
@@ -117,21 +120,26 @@ inline static void histogram_helper_cs_rgb(const dt_dev_histogram_collection_par
                                            const void *pixel, uint32_t *histogram, int j)
 {
   const dt_histogram_roi_t *roi = histogram_params->roi;
+  const int step = histogram_params->step;
   float *in = (float *)pixel + 4 * (roi->width * j + roi->crop_x);
 
-  // process aligned pixels with SSE
-  for(int i = 0; i < roi->width - roi->crop_width - roi->crop_x; i++, in += 4)
-  {
-    if(darktable.codepath.OPENMP_SIMD)
-      histogram_helper_cs_rgb_helper_process_pixel_float(histogram_params, in, histogram);
+  for(int i = 0; i < roi->width - roi->crop_width - roi->crop_x; i += step, in += 4 * step)
+    histogram_helper_cs_rgb_helper_process_pixel_float(histogram_params, in, histogram);
+}
+
 #if defined(__SSE2__)
-    else if(darktable.codepath.SSE2)
-      histogram_helper_cs_rgb_helper_process_pixel_m128(histogram_params, in, histogram);
-#endif
-    else
-      dt_unreachable_codepath();
-  }
+inline static void histogram_helper_cs_rgb_sse2(const dt_dev_histogram_collection_params_t *const histogram_params,
+                                                const void *pixel, uint32_t *histogram, int j)
+{
+  const dt_histogram_roi_t *roi = histogram_params->roi;
+  const int step = histogram_params->step;
+  float *in = (float *)pixel + 4 * (roi->width * j + roi->crop_x);
+
+  // process aligned pixels with SSE
+  for(int i = 0; i < roi->width - roi->crop_width - roi->crop_x; i += step, in += 4 * step)
+    histogram_helper_cs_rgb_helper_process_pixel_m128(histogram_params, in, histogram);
 }
+#endif
 
 //------------------------------------------------------------------------------
 
@@ -184,24 +192,45 @@ inline static void histogram_helper_cs_Lab(const dt_dev_histogram_collection_par
                                            const void *pixel, uint32_t *histogram, int j)
 {
   const dt_histogram_roi_t *roi = histogram_params->roi;
+  const int step = histogram_params->step;
   float *in = (float *)pixel + 4 * (roi->width * j + roi->crop_x);
 
-  // process aligned pixels with SSE
-  for(int i = 0; i < roi->width - roi->crop_width - roi->crop_x; i++, in += 4)
-  {
-    if(darktable.codepath.OPENMP_SIMD)
-      histogram_helper_cs_Lab_helper_process_pixel_float(histogram_params, in, histogram);
+  for(int i = 0; i < roi->width - roi->crop_width - roi->crop_x; i += step, in += 4 * step)
+    histogram_helper_cs_Lab_helper_process_pixel_float(histogram_params, in, histogram);
+}
+
 #if defined(__SSE2__)
-    else if(darktable.codepath.SSE2)
-      histogram_helper_cs_Lab_helper_process_pixel_m128(histogram_params, in, histogram);
-#endif
-    else
-      dt_unreachable_codepath();
-  }
+inline static void histogram_helper_cs_Lab_sse2(const dt_dev_histogram_collection_params_t *const histogram_params,
+                                                const void *pixel, uint32_t *histogram, int j)
+{
+  const dt_histogram_roi_t *roi = histogram_params->roi;
+  const int step = histogram_params->step;
+  float *in = (float *)pixel + 4 * (roi->width * j + roi->crop_x);
+
+  // process aligned pixels with SSE
+  for(int i = 0; i < roi->width - roi->crop_width - roi->crop_x; i += step, in += 4 * step)
+    histogram_helper_cs_Lab_helper_process_pixel_m128(histogram_params, in, histogram);
 }
+#endif
 
 //==============================================================================
 
+// number of samples of every step-th of n pixels
+static inline int _samples(const int n, const int step)
+{
+  return n > 0 ? (n + step - 1) / step : 0;
+}
+
+uint32_t dt_histogram_preview_step(const dt_histogram_roi_t *const roi, const uint32_t bins_count)
+{
+  // about 256 samples per bin keep the shape of the histogram. the step stays odd, so a bayer mosaic still
+  // gets all of its colours.
+  const double pixels = (double)(roi->width - roi->crop_width - roi->crop_x)
+                        * (roi->height - roi->crop_height - roi->crop_y);
+  const int step = sqrt(pixels / (256.0 * bins_count));
+  return step > 1 ? step - !(step & 1) : 1;
+}
+
 void dt_histogram_worker(dt_dev_histogram_collection_params_t *const histogram_params,
                          dt_dev_histogram_stats_t *histogram_stats, const void *const pixel,
                          uint32_t **histogram, const dt_worker Worker)
@@ -213,13 +242,15 @@ void dt_histogram_worker(dt_dev_histogram_collection_params_t *const histogram_p
   void *partial_hists = calloc(nthreads, buf_size);
 
   if(histogram_params->mul == 0) histogram_params->mul = (double)(histogram_params->bins_count - 1);
+  if(histogram_params->step == 0) histogram_params->step = 1;
 
   const dt_histogram_roi_t *const roi = histogram_params->roi;
+  const int step = histogram_params->step;
 
 #ifdef _OPENMP
 #pragma omp parallel for schedule(static) default(none) shared(partial_hists)
 #endif
-  for(int j = roi->crop_y; j < roi->height - roi->crop_height; j++)
+  for(int j = roi->crop_y; j < roi->height - roi->crop_height; j += step)
   {
     uint32_t *thread_hist = (uint32_t *)partial_hists + bins_total * omp_get_thread_num();
     Worker(histogram_params, pixel, thread_hist, j);
@@ -246,8 +277,8 @@ void dt_histogram_worker(dt_dev_histogram_collection_params_t *const histogram_p
   free(partial_hists);
 
   histogram_stats->bins_count = histogram_params->bins_count;
-  histogram_stats->pixels = (roi->width - roi->crop_width - roi->crop_x)
-                            * (roi->height - roi->crop_height - roi->crop_y);
+  histogram_stats->pixels = _samples(roi->width - roi->crop_width - roi->crop_x, step)
+                            * _samples(roi->height - roi->crop_height - roi->crop_y, step);
 }
 
 //------------------------------------------------------------------------------
@@ -264,13 +295,23 @@ void dt_histogram_helper(dt_dev_histogram_collection_params_t *histogram_params,
       break;
 
     case iop_cs_rgb:
-      dt_histogram_worker(histogram_params, histogram_stats, pixel, histogram, histogram_helper_cs_rgb);
+#if defined(__SSE2__)
+      if(darktable.codepath.SSE2 && !darktable.codepath.OPENMP_SIMD)
+        dt_histogram_worker(histogram_params, histogram_stats, pixel, histogram, histogram_helper_cs_rgb_sse2);
+      else
+#endif
+        dt_histogram_worker(histogram_params, histogram_stats, pixel, histogram, histogram_helper_cs_rgb);
       histogram_stats->ch = 3u;
       break;
 
     case iop_cs_Lab:
     default:
-      dt_histogram_worker(histogram_params, histogram_stats, pixel, histogram, histogram_helper_cs_Lab);
+#if defined(__SSE2__)
+      if(darktable.codepath.SSE2 && !darktable.codepath.OPENMP_SIMD)
+        dt_histogram_worker(histogram_params, histogram_stats, pixel, histogram, histogram_helper_cs_Lab_sse2);
+      else
+#endif
+        dt_histogram_worker(histogram_params, histogram_stats, pixel, histogram, histogram_helper_cs_Lab);
       histogram_stats->ch = 3u;
       break;
   }
@@ -316,6 +357,93 @@ void dt_histogram_max_helper(const dt_dev_histogram_stats_t *const histogram_sta
   }
 }
 
+#ifdef HAVE_OPENCL
+dt_histogram_cl_global_t *dt_histogram_init_cl_global()
+{
+  dt_histogram_cl_global_t *g = (dt_histogram_cl_global_t *)malloc(sizeof(dt_histogram_cl_global_t));
+
+  const int program = 32; // histogram.cl, from programs.conf
+  g->kernel_histogram_collect = dt_opencl_create_kernel(program, "histogram_collect");
+  return g;
+}
+
+void dt_histogram_free_cl_global(dt_histogram_cl_global_t *g)
+{
+  if(!g) return;
+  dt_opencl_free_kernel(g->kernel_histogram_collect);
+  free(g);
+}
+
+int dt_histogram_helper_cl(const int devid, dt_dev_histogram_collection_params_t *histogram_params,
+                           dt_dev_histogram_stats_t *histogram_stats, dt_iop_colorspace_type_t cst, cl_mem img,
+                           uint32_t **histogram)
+{
+  if(darktable.opencl->avoid_atomics) return FALSE;
+
+  const int kernel = darktable.opencl->histogram->kernel_histogram_collect;
+  if(histogram_params->mul == 0) histogram_params->mul = (double)(histogram_params->bins_count - 1);
+  if(histogram_params->step == 0) histogram_params->step = 1;
+
+  const dt_histogram_roi_t *const roi = histogram_params->roi;
+  const int step = histogram_params->step;
+  const int bins = histogram_params->bins_count;
+  const int width = _samples(roi->width - roi->crop_width - roi->crop_x, step);
+  const int height = _samples(roi->height - roi->crop_height - roi->crop_y, step);
+  const int crop_x = roi->crop_x, crop_y = roi->crop_y;
+  const int colorspace = cst;
+  const size_t buf_size = (size_t)4 * bins * sizeof(uint32_t);
+
+  // the bins of a work group have to fit into local memory
+  dt_opencl_local_buffer_t locopt
+    = (dt_opencl_local_buffer_t){ .xoffset = 0, .xfactor = 1, .yoffset = 0, .yfactor = 1,
+                                  .cellsize = 0, .overhead = buf_size,
+                                  .sizex = 1 << 4, .sizey = 1 << 4 };
+  if(!dt_opencl_local_buffer_opt(devid, kernel, &locopt)) return FALSE;
+
+  uint32_t *hist = realloc(*histogram, buf_size);
+  if(!hist) return FALSE;
+  *histogram = hist;
+  memset(hist, 0, buf_size);
+
+  cl_int err = -999;
+  cl_mem dev_hist = dt_opencl_alloc_device_buffer(devid, buf_size);
+  if(dev_hist == NULL) return FALSE;
+  err = dt_opencl_write_buffer_to_device(devid, hist, dev_hist, 0, buf_size, CL_TRUE);
+  if(err != CL_SUCCESS) goto error;
+
+  size_t sizes[] = { ROUNDUP(width, locopt.sizex), ROUNDUP(height, locopt.sizey), 1 };
+  size_t local[] = { locopt.sizex, locopt.sizey, 1 };
+  dt_opencl_set_kernel_arg(devid, kernel, 0, sizeof(cl_mem), (void *)&img);
+  dt_opencl_set_kernel_arg(devid, kernel, 1, sizeof(cl_mem), (void *)&dev_hist);
+  dt_opencl_set_kernel_arg(devid, kernel, 2, sizeof(int), (void *)&width);
+  dt_opencl_set_kernel_arg(devid, kernel, 3, sizeof(int), (void *)&height);
+  dt_opencl_set_kernel_arg(devid, kernel, 4, sizeof(int), (void *)&crop_x);
+  dt_opencl_set_kernel_arg(devid, kernel, 5, sizeof(int), (void *)&crop_y);
+  dt_opencl_set_kernel_arg(devid, kernel, 6, sizeof(int), (void *)&step);
+  dt_opencl_set_kernel_arg(devid, kernel, 7, sizeof(int), (void *)&bins);
+  dt_opencl_set_kernel_arg(devid, kernel, 8, sizeof(float), (void *)&histogram_params->mul);
+  dt_opencl_set_kernel_arg(devid, kernel, 9, sizeof(int), (void *)&colorspace);
+  dt_opencl_set_kernel_arg(devid, kernel, 10, buf_size, NULL);
+  err = dt_opencl_enqueue_kernel_2d_with_local(devid, kernel, sizes, local);
+  if(err != CL_SUCCESS) goto error;
+
+  // only the bins come back to the host
+  err = dt_opencl_read_buffer_from_device(devid, hist, dev_hist, 0, buf_size, CL_TRUE);
+  if(err != CL_SUCCESS) goto error;
+  dt_opencl_release_mem_object(dev_hist);
+
+  histogram_stats->bins_count = bins;
+  histogram_stats->pixels = width * height;
+  histogram_stats->ch = cst == iop_cs_RAW ? 1u : 3u;
+  return TRUE;
+
+error:
+  dt_opencl_release_mem_object(dev_hist);
+  dt_print(DT_DEBUG_OPENCL, "[opencl_histogram] couldn't collect the histogram: %d\n", err);
+  return FALSE;
+}
+#endif
+
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
 // kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
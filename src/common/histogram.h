@@ -20,6 +20,7 @@
 
 #include <stdint.h>
 
+#include "common/opencl.h"
 #include "develop/imageop.h"
 #include "develop/pixelpipe.h"
 
@@ -49,9 +50,28 @@ void dt_histogram_helper(dt_dev_histogram_collection_params_t *histogram_params,
                          dt_dev_histogram_stats_t *histogram_stats, dt_iop_colorspace_type_t cst,
                          const void *pixel, uint32_t **histogram);
 
+/** every how many rows and columns the preview pipe samples for a histogram of bins_count bins */
+uint32_t dt_histogram_preview_step(const dt_histogram_roi_t *const roi, const uint32_t bins_count);
+
 void dt_histogram_max_helper(const dt_dev_histogram_stats_t *const histogram_stats,
                              dt_iop_colorspace_type_t cst, uint32_t **histogram, uint32_t *histogram_max);
 
+#ifdef HAVE_OPENCL
+typedef struct dt_histogram_cl_global_t
+{
+  int kernel_histogram_collect;
+} dt_histogram_cl_global_t;
+
+dt_histogram_cl_global_t *dt_histogram_init_cl_global(void);
+void dt_histogram_free_cl_global(dt_histogram_cl_global_t *g);
+
+/** dt_histogram_helper() for an image on the device. returns FALSE if the device can't collect it, the
+ * histogram then has to be collected on the host. */
+int dt_histogram_helper_cl(const int devid, dt_dev_histogram_collection_params_t *histogram_params,
+                           dt_dev_histogram_stats_t *histogram_stats, dt_iop_colorspace_type_t cst, cl_mem img,
+                           uint32_t **histogram);
+#endif
+
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
 // kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
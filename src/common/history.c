@@ -27,8 +27,12 @@
 #include "common/tags.h"
 #include "common/utility.h"
 #include "control/control.h"
+#include "control/jobs.h"
 #include "develop/develop.h"
 
+// images pasted onto per transaction by the paste job
+#define DT_HISTORY_PASTE_BATCH 64
+
 void dt_history_item_free(gpointer data)
 {
   dt_history_item_t *item = (dt_history_item_t *)data;
@@ -188,7 +192,7 @@ void dt_history_delete_on_image(int32_t imgid)
   if(dt_dev_is_current_image(darktable.develop, imgid)) dt_dev_reload_history_items(darktable.develop);
 
   /* make sure mipmaps are recomputed */
-  dt_mipmap_cache_remove(darktable.mipmap_cache, imgid);
+  dt_mipmap_cache_invalidate(darktable.mipmap_cache, imgid);
 
   /* remove darktable|style|* tags */
   dt_tag_detach_by_string("darktable|style%", imgid);
@@ -219,7 +223,7 @@ int dt_history_load_and_apply(int imgid, gchar *filename, int history_only)
     if(dt_dev_is_current_image(darktable.develop, imgid)) dt_dev_reload_history_items(darktable.develop);
 
     dt_image_cache_write_release(darktable.image_cache, img, DT_IMAGE_CACHE_SAFE);
-    dt_mipmap_cache_remove(darktable.mipmap_cache, imgid);
+    dt_mipmap_cache_invalidate(darktable.mipmap_cache, imgid);
   }
   return res;
 }
@@ -239,20 +243,88 @@ int dt_history_load_and_apply_on_selection(gchar *filename)
   return res;
 }
 
-int dt_history_copy_and_paste_on_image(int32_t imgid, int32_t dest_imgid, gboolean merge, GList *ops)
+typedef struct _history_row_t
 {
-  sqlite3_stmt *stmt;
-  if(imgid == dest_imgid) return 1;
+  int module;
+  gchar *operation;
+  void *op_params;
+  int op_params_size;
+  int enabled;
+  void *blendop_params;
+  int blendop_params_size;
+  int blendop_version;
+  int multi_priority;
+  gchar *multi_name;
+} _history_row_t;
+
+static void _history_row_free(gpointer data)
+{
+  _history_row_t *row = (_history_row_t *)data;
+  g_free(row->operation);
+  g_free(row->op_params);
+  g_free(row->blendop_params);
+  g_free(row->multi_name);
+  free(row);
+}
 
-  if(imgid == -1)
+// the history items of imgid to paste, the ones numbered in ops or all of them
+static GList *_history_read_rows(int32_t imgid, GList *ops)
+{
+  //  prepare SQL request
+  char req[2048];
+  g_strlcpy(req, "SELECT module, operation, op_params, enabled, blendop_params, blendop_version, multi_priority, "
+                 "multi_name FROM main.history WHERE imgid = ?1",
+            sizeof(req));
+
+  //  Add ops selection if any format: ... and num in (val1, val2)
+  if(ops)
   {
-    dt_control_log(_("you need to copy history from an image before you paste it onto another"));
-    return 1;
+    GList *l = ops;
+    int first = 1;
+    g_strlcat(req, " AND num IN (", sizeof(req));
+
+    while(l)
+    {
+      unsigned int value = GPOINTER_TO_UINT(l->data);
+      char v[30];
+
+      if(!first) g_strlcat(req, ",", sizeof(req));
+      snprintf(v, sizeof(v), "%u", value);
+      g_strlcat(req, v, sizeof(req));
+      first = 0;
+      l = g_list_next(l);
+    }
+    g_strlcat(req, ")", sizeof(req));
   }
+  g_strlcat(req, " ORDER BY num", sizeof(req));
 
-  // be sure the current history is written before pasting some other history data
-  const dt_view_t *cv = dt_view_manager_get_current_view(darktable.view_manager);
-  if(cv->view((dt_view_t *)cv) == DT_VIEW_DARKROOM) dt_dev_write_history(darktable.develop);
+  GList *rows = NULL;
+  sqlite3_stmt *stmt;
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), req, -1, &stmt, NULL);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
+  while(sqlite3_step(stmt) == SQLITE_ROW)
+  {
+    _history_row_t *row = (_history_row_t *)calloc(1, sizeof(_history_row_t));
+    row->module = sqlite3_column_int(stmt, 0);
+    row->operation = g_strdup((const gchar *)sqlite3_column_text(stmt, 1));
+    row->op_params_size = sqlite3_column_bytes(stmt, 2);
+    row->op_params = g_memdup(sqlite3_column_blob(stmt, 2), row->op_params_size);
+    row->enabled = sqlite3_column_int(stmt, 3);
+    row->blendop_params_size = sqlite3_column_bytes(stmt, 4);
+    row->blendop_params = g_memdup(sqlite3_column_blob(stmt, 4), row->blendop_params_size);
+    row->blendop_version = sqlite3_column_int(stmt, 5);
+    row->multi_priority = sqlite3_column_int(stmt, 6);
+    row->multi_name = g_strdup((const gchar *)sqlite3_column_text(stmt, 7));
+    rows = g_list_prepend(rows, row);
+  }
+  sqlite3_finalize(stmt);
+  return g_list_reverse(rows);
+}
+
+// puts the rows of imgid onto the history of dest_imgid, inside the transaction of the caller
+static void _history_paste_rows(GList *rows, int32_t imgid, int32_t dest_imgid, gboolean merge, GList *ops)
+{
+  sqlite3_stmt *stmt;
 
   /* if merge onto history stack, lets find history offest in destination image */
   int32_t offs = 0;
@@ -283,57 +355,29 @@ int dt_history_copy_and_paste_on_image(int32_t imgid, int32_t dest_imgid, gboole
   }
   sqlite3_finalize(stmt);
 
-  /* delete all items from the temp styles_items, this table is used only to get a ROWNUM of the results */
-  DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), "DELETE FROM memory.style_items", NULL, NULL, NULL);
-
-  /* copy history items from styles onto temp table */
-
-  //  prepare SQL request
-  char req[2048];
-  g_strlcpy(req, "INSERT INTO memory.style_items (num, module, operation, op_params, enabled, blendop_params, "
-                 "blendop_version, multi_name, multi_priority) SELECT num, module, operation, "
-                 "op_params, enabled, blendop_params, blendop_version, multi_name, multi_priority FROM "
-                 "main.history WHERE imgid = ?1",
-            sizeof(req));
-
-  //  Add ops selection if any format: ... and num in (val1, val2)
-  if(ops)
-  {
-    GList *l = ops;
-    int first = 1;
-    g_strlcat(req, " AND num IN (", sizeof(req));
-
-    while(l)
-    {
-      unsigned int value = GPOINTER_TO_UINT(l->data);
-      char v[30];
-
-      if(!first) g_strlcat(req, ",", sizeof(req));
-      snprintf(v, sizeof(v), "%u", value);
-      g_strlcat(req, v, sizeof(req));
-      first = 0;
-      l = g_list_next(l);
-    }
-    g_strlcat(req, ")", sizeof(req));
-  }
-
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), req, -1, &stmt, NULL);
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
-  sqlite3_step(stmt);
-  sqlite3_finalize(stmt);
-
-  /* copy the history items into the history of the dest image */
-  /* note: rowid starts at 1 while num has to start at 0! */
+  /* copy the history items into the history of the dest image, numbered from offs on */
   DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
                               "INSERT INTO main.history "
                               "(imgid,num,module,operation,op_params,enabled,blendop_params,blendop_"
-                              "version,multi_priority,multi_name) SELECT "
-                              "?1,?2+rowid-1,module,operation,op_params,enabled,blendop_params,blendop_"
-                              "version,multi_priority,multi_name FROM memory.style_items",
+                              "version,multi_priority,multi_name) VALUES (?1,?2,?3,?4,?5,?6,?7,?8,?9,?10)",
                               -1, &stmt, NULL);
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, dest_imgid);
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, offs);
-  sqlite3_step(stmt);
+  int num = offs;
+  for(GList *iter = rows; iter; iter = g_list_next(iter))
+  {
+    const _history_row_t *row = (const _history_row_t *)iter->data;
+    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, dest_imgid);
+    DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, num++);
+    DT_DEBUG_SQLITE3_BIND_INT(stmt, 3, row->module);
+    DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 4, row->operation, -1, SQLITE_STATIC);
+    DT_DEBUG_SQLITE3_BIND_BLOB(stmt, 5, row->op_params, row->op_params_size, SQLITE_STATIC);
+    DT_DEBUG_SQLITE3_BIND_INT(stmt, 6, row->enabled);
+    DT_DEBUG_SQLITE3_BIND_BLOB(stmt, 7, row->blendop_params, row->blendop_params_size, SQLITE_STATIC);
+    DT_DEBUG_SQLITE3_BIND_INT(stmt, 8, row->blendop_version);
+    DT_DEBUG_SQLITE3_BIND_INT(stmt, 9, row->multi_priority);
+    DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 10, row->multi_name, -1, SQLITE_STATIC);
+    sqlite3_step(stmt);
+    sqlite3_reset(stmt);
+  }
   sqlite3_finalize(stmt);
 
   if(merge && ops) _dt_history_cleanup_multi_instance(dest_imgid, offs);
@@ -357,10 +401,11 @@ int dt_history_copy_and_paste_on_image(int32_t imgid, int32_t dest_imgid, gboole
   }
 
   // let's copy now
-  g_strlcpy(req, "INSERT INTO main.mask (imgid, formid, form, name, version, points, points_count, source) SELECT "
-                 "?1, formid, form, name, version, points, points_count, source FROM main.mask WHERE imgid = ?2",
-            sizeof(req));
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), req, -1, &stmt, NULL);
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                              "INSERT INTO main.mask (imgid, formid, form, name, version, points, points_count, "
+                              "source) SELECT ?1, formid, form, name, version, points, points_count, source FROM "
+                              "main.mask WHERE imgid = ?2",
+                              -1, &stmt, NULL);
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, dest_imgid);
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, imgid);
   sqlite3_step(stmt);
@@ -374,18 +419,46 @@ int dt_history_copy_and_paste_on_image(int32_t imgid, int32_t dest_imgid, gboole
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, dest_imgid);
   sqlite3_step(stmt);
   sqlite3_finalize(stmt);
+}
 
+static void _history_reload_current(const int32_t dest_imgid)
+{
   /* if current image in develop reload history */
   if(dt_dev_is_current_image(darktable.develop, dest_imgid))
   {
     dt_dev_reload_history_items(darktable.develop);
     dt_dev_modulegroups_set(darktable.develop, dt_dev_modulegroups_get(darktable.develop));
   }
+}
+
+int dt_history_copy_and_paste_on_image(int32_t imgid, int32_t dest_imgid, gboolean merge, GList *ops)
+{
+  if(imgid == dest_imgid) return 1;
+
+  if(imgid == -1)
+  {
+    dt_control_log(_("you need to copy history from an image before you paste it onto another"));
+    return 1;
+  }
+
+  // be sure the current history is written before pasting some other history data
+  const dt_view_t *cv = dt_view_manager_get_current_view(darktable.view_manager);
+  if(cv->view((dt_view_t *)cv) == DT_VIEW_DARKROOM) dt_dev_write_history(darktable.develop);
+
+  GList *rows = _history_read_rows(imgid, ops);
+
+  // the stack and masks are swapped out at once, and not journaled statement by statement
+  sqlite3_exec(dt_database_get(darktable.db), "BEGIN TRANSACTION", NULL, NULL, NULL);
+  _history_paste_rows(rows, imgid, dest_imgid, merge, ops);
+  sqlite3_exec(dt_database_get(darktable.db), "COMMIT", NULL, NULL, NULL);
+  g_list_free_full(rows, _history_row_free);
+
+  _history_reload_current(dest_imgid);
 
   /* update xmp file */
   dt_image_synch_xmp(dest_imgid);
 
-  dt_mipmap_cache_remove(darktable.mipmap_cache, dest_imgid);
+  dt_mipmap_cache_invalidate(darktable.mipmap_cache, dest_imgid);
 
   return 0;
 }
@@ -472,34 +545,111 @@ char *dt_history_get_items_as_string(int32_t imgid)
   return result;
 }
 
+typedef struct _history_paste_t
+{
+  int32_t imgid;
+  gboolean merge;
+  GList *ops;
+  GList *images;
+} _history_paste_t;
+
+static void _history_paste_free(void *data)
+{
+  _history_paste_t *params = (_history_paste_t *)data;
+  g_list_free(params->ops);
+  g_list_free(params->images);
+  free(params);
+}
+
+static gboolean _history_reload_current_idle(gpointer user_data)
+{
+  _history_reload_current(GPOINTER_TO_INT(user_data));
+  return FALSE;
+}
+
+static int32_t _history_paste_job_run(dt_job_t *job)
+{
+  _history_paste_t *params = (_history_paste_t *)dt_control_job_get_params(job);
+  const guint total = g_list_length(params->images);
+  char message[512] = { 0 };
+  snprintf(message, sizeof(message), ngettext("pasting history onto %d image", "pasting history onto %d images",
+                                              total),
+           total);
+  dt_control_job_set_progress_message(job, message);
+
+  // the source is read once, its stack doesn't change while we paste it
+  GList *rows = _history_read_rows(params->imgid, params->ops);
+  sqlite3 *db = dt_database_get(darktable.db);
+
+  guint done = 0;
+  GList *t = params->images;
+  while(t && dt_control_job_get_state(job) != DT_JOB_STATE_CANCELLED)
+  {
+    // a batch of images per transaction, so the database isn't locked up for the whole selection
+    GList *batch = t;
+    int count = 0;
+    sqlite3_exec(db, "BEGIN TRANSACTION", NULL, NULL, NULL);
+    for(; t && count < DT_HISTORY_PASTE_BATCH; t = g_list_next(t), count++)
+      _history_paste_rows(rows, params->imgid, GPOINTER_TO_INT(t->data), params->merge, params->ops);
+    sqlite3_exec(db, "COMMIT", NULL, NULL, NULL);
+
+    for(; batch != t; batch = g_list_next(batch))
+    {
+      const int32_t dest_imgid = GPOINTER_TO_INT(batch->data);
+      // the develop view has to be touched from the gui thread
+      if(dt_dev_is_current_image(darktable.develop, dest_imgid))
+        g_idle_add(_history_reload_current_idle, GINT_TO_POINTER(dest_imgid));
+      /* update xmp file, the sidecar writers take care of it in the background */
+      dt_image_synch_xmp(dest_imgid);
+      dt_mipmap_cache_invalidate(darktable.mipmap_cache, dest_imgid);
+    }
+
+    done += count;
+    dt_control_job_set_progress(job, (double)done / total);
+    dt_control_queue_redraw_center();
+  }
+  g_list_free_full(rows, _history_row_free);
+  return 0;
+}
+
 int dt_history_copy_and_paste_on_selection(int32_t imgid, gboolean merge, GList *ops)
 {
   if(imgid < 0) return 1;
 
-  int res = 0;
+  // get all selected images now, to avoid the set changing during the paste
+  GList *images = NULL;
   sqlite3_stmt *stmt;
   DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
                               "SELECT imgid FROM main.selected_images WHERE imgid != ?1", -1, &stmt, NULL);
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
-  if(sqlite3_step(stmt) == SQLITE_ROW)
-  {
-    do
-    {
-      /* get imgid of selected image */
-      int32_t dest_imgid = sqlite3_column_int(stmt, 0);
+  while(sqlite3_step(stmt) == SQLITE_ROW)
+    images = g_list_prepend(images, GINT_TO_POINTER(sqlite3_column_int(stmt, 0)));
+  sqlite3_finalize(stmt);
+  if(!images) return 1;
 
-      /* paste history stack onto image id */
-      dt_history_copy_and_paste_on_image(imgid, dest_imgid, merge, ops);
+  // be sure the current history is written before pasting some other history data
+  const dt_view_t *cv = dt_view_manager_get_current_view(darktable.view_manager);
+  if(cv->view((dt_view_t *)cv) == DT_VIEW_DARKROOM) dt_dev_write_history(darktable.develop);
 
-    } while(sqlite3_step(stmt) == SQLITE_ROW);
+  dt_job_t *job = dt_control_job_create(&_history_paste_job_run, "paste history");
+  if(!job)
+  {
+    g_list_free(images);
+    return 1;
   }
-  else
-    res = 1;
-
-  sqlite3_finalize(stmt);
-  return res;
+  _history_paste_t *params = (_history_paste_t *)calloc(1, sizeof(_history_paste_t));
+  params->imgid = imgid;
+  params->merge = merge;
+  params->ops = g_list_copy(ops);
+  params->images = g_list_reverse(images);
+  dt_control_job_add_progress(job, _("paste history"), TRUE);
+  dt_control_job_set_params(job, params, _history_paste_free);
+  dt_control_add_job(darktable.control, DT_JOB_QUEUE_USER_BG, job);
+  return 0;
 }
 
+#undef DT_HISTORY_PASTE_BATCH
+
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
 // kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
@@ -30,7 +30,8 @@ int dt_history_copy_and_paste_on_image(int32_t imgid, int32_t dest_imgid, gboole
 
 void dt_history_delete_on_image(int32_t imgid);
 
-/** copy history from imgid and pasts on selected images, merge or overwrite... */
+/** copy history from imgid and pasts on selected images, merge or overwrite... in a background job, returns 1
+    if there is nothing selected */
 int dt_history_copy_and_paste_on_selection(int32_t imgid, gboolean merge, GList *ops);
 
 /** load a dt file and applies to selected images */
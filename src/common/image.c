@@ -28,6 +28,7 @@
 #include "common/imageio_rawspeed.h"
 #include "common/mipmap_cache.h"
 #include "common/tags.h"
+#include "common/utility.h"
 #include "control/conf.h"
 #include "control/control.h"
 #include "control/jobs.h"
@@ -322,8 +323,8 @@ void dt_image_set_location_and_elevation(const int32_t imgid, double lon, double
   image->latitude = lat;
   image->elevation = ele;
 
-  /* store */
-  dt_image_cache_write_release(darktable.image_cache, image, DT_IMAGE_CACHE_SAFE);
+  /* store together with the other images of the track */
+  dt_image_cache_write_release(darktable.image_cache, image, DT_IMAGE_CACHE_DEFERRED);
 }
 
 void dt_image_set_flip(const int32_t imgid, const dt_image_orientation_t orientation)
@@ -357,7 +358,7 @@ void dt_image_set_flip(const int32_t imgid, const dt_image_orientation_t orienta
   sqlite3_step(stmt);
   sqlite3_finalize(stmt);
 
-  dt_mipmap_cache_remove(darktable.mipmap_cache, imgid);
+  dt_mipmap_cache_invalidate(darktable.mipmap_cache, imgid);
   // write that through to xmp:
   dt_image_write_sidecar_file(imgid);
 }
@@ -575,6 +576,9 @@ void dt_image_remove(const int32_t imgid)
 
   if(dt_image_local_copy_reset(imgid)) return;
 
+  // a sidecar written after this would be one of an image that's not in the library any more
+  dt_image_sidecar_discard(imgid);
+
   sqlite3_stmt *stmt;
   const dt_image_t *img = dt_image_cache_get(darktable.image_cache, imgid, 'r');
   int old_group_id = img->group_id;
@@ -751,7 +755,8 @@ void dt_image_read_duplicates(const uint32_t id, const char *filename)
 }
 
 
-static uint32_t dt_image_import_internal(const int32_t film_id, const char *filename, gboolean override_ignore_jpegs, gboolean lua_locking)
+static uint32_t dt_image_import_internal(const int32_t film_id, const char *filename, gboolean override_ignore_jpegs,
+                                         gboolean lua_locking, const dt_exif_prefetch_t *exif)
 {
   char *normalized_filename = dt_util_normalize_path(filename);
   if(!normalized_filename || !g_file_test(normalized_filename, G_FILE_TEST_IS_REGULAR) || dt_util_get_file_size(normalized_filename) == 0)
@@ -947,13 +952,13 @@ static uint32_t dt_image_import_internal(const int32_t film_id, const char *file
   img->group_id = group_id;
 
   // read dttags and exif for database queries!
-  (void)dt_exif_read(img, normalized_filename);
+  (void)dt_exif_read_prefetched(img, normalized_filename, exif);
   char dtfilename[PATH_MAX] = { 0 };
   g_strlcpy(dtfilename, normalized_filename, sizeof(dtfilename));
   // dt_image_path_append_version(id, dtfilename, sizeof(dtfilename));
   g_strlcat(dtfilename, ".xmp", sizeof(dtfilename));
 
-  int res = dt_exif_xmp_read(img, dtfilename, 0);
+  int res = dt_exif_xmp_read_prefetched(img, dtfilename, 0, exif);
 
   // write through to db, but not to xmp.
   dt_image_cache_write_release(darktable.image_cache, img, DT_IMAGE_CACHE_RELAXED);
@@ -1008,12 +1013,18 @@ static uint32_t dt_image_import_internal(const int32_t film_id, const char *file
 
 uint32_t dt_image_import(const int32_t film_id, const char *filename, gboolean override_ignore_jpegs)
 {
-  return dt_image_import_internal(film_id, filename, override_ignore_jpegs, TRUE);
+  return dt_image_import_internal(film_id, filename, override_ignore_jpegs, TRUE, NULL);
+}
+
+uint32_t dt_image_import_prefetched(const int32_t film_id, const char *filename, gboolean override_ignore_jpegs,
+                                    const dt_exif_prefetch_t *exif)
+{
+  return dt_image_import_internal(film_id, filename, override_ignore_jpegs, TRUE, exif);
 }
 
 uint32_t dt_image_import_lua(const int32_t film_id, const char *filename, gboolean override_ignore_jpegs)
 {
-  return dt_image_import_internal(film_id, filename, override_ignore_jpegs, FALSE);
+  return dt_image_import_internal(film_id, filename, override_ignore_jpegs, FALSE, NULL);
 }
 
 void dt_image_init(dt_image_t *img)
@@ -1117,6 +1128,16 @@ int32_t dt_image_move(const int32_t imgid, const int32_t filmid)
     // get current local copy if any
     _image_local_copy_full_path(imgid, copysrcpath, sizeof(copysrcpath));
 
+    // pending sidecar writes of the image and its duplicates have to be done before the image leaves the folder
+    sqlite3_stmt *flush_stmt;
+    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                                "SELECT id FROM main.images WHERE filename IN (SELECT filename FROM main.images "
+                                "WHERE id = ?1) AND film_id IN (SELECT film_id FROM main.images WHERE id = ?1)",
+                                -1, &flush_stmt, NULL);
+    DT_DEBUG_SQLITE3_BIND_INT(flush_stmt, 1, imgid);
+    while(sqlite3_step(flush_stmt) == SQLITE_ROW) dt_image_sidecar_flush(sqlite3_column_int(flush_stmt, 0));
+    sqlite3_finalize(flush_stmt);
+
     // move image
     GFile *old, *new;
     old = g_file_new_for_path(oldimg);
@@ -1220,19 +1241,17 @@ int32_t dt_image_copy(const int32_t imgid, const int32_t filmid)
     dt_image_full_path(imgid, srcpath, sizeof(srcpath), &from_cache);
     gchar *imgbname = g_path_get_basename(srcpath);
     gchar *destpath = g_build_filename(newdir, imgbname, NULL);
-    GFile *src = g_file_new_for_path(srcpath);
-    GFile *dest = g_file_new_for_path(destpath);
     g_free(imgbname);
     imgbname = NULL;
     g_free(newdir);
     newdir = NULL;
-    g_free(destpath);
-    destpath = NULL;
 
     // copy image to new folder
     // if image file already exists, continue
     GError *gerror = NULL;
-    g_file_copy(src, dest, G_FILE_COPY_NONE, NULL, NULL, NULL, &gerror);
+    dt_util_copy_file(srcpath, destpath, FALSE, &gerror);
+    g_free(destpath);
+    destpath = NULL;
 
     if((gerror == NULL) || (gerror != NULL && gerror->code == G_IO_ERROR_EXISTS))
     {
@@ -1375,8 +1394,6 @@ int32_t dt_image_copy(const int32_t imgid, const int32_t filmid)
     {
       fprintf(stderr, "Failed to copy image %s: %s\n", srcpath, gerror->message);
     }
-    g_object_unref(dest);
-    g_object_unref(src);
     g_clear_error(&gerror);
   }
 
@@ -1402,22 +1419,15 @@ int dt_image_local_copy_set(const int32_t imgid)
 
   if(!g_file_test(destpath, G_FILE_TEST_EXISTS))
   {
-    GFile *src = g_file_new_for_path(srcpath);
-    GFile *dest = g_file_new_for_path(destpath);
-
     // copy image to cache directory
     GError *gerror = NULL;
 
-    if(!g_file_copy(src, dest, G_FILE_COPY_NONE, NULL, NULL, NULL, &gerror))
+    if(!dt_util_copy_file(srcpath, destpath, FALSE, &gerror))
     {
       dt_control_log(_("cannot create local copy."));
-      g_object_unref(dest);
-      g_object_unref(src);
+      g_clear_error(&gerror);
       return 1;
     }
-
-    g_object_unref(dest);
-    g_object_unref(src);
   }
 
   // update cache local copy flags, do this even if the local copy already exists as we need to set the flags
@@ -1496,6 +1506,7 @@ int dt_image_local_copy_reset(const int32_t imgid)
     // first sync the xmp with the original picture
 
     dt_image_write_sidecar_file(imgid);
+    dt_image_sidecar_flush(imgid);
 
     // delete image from cache directory only if there is no other local cache image referencing it
     // for example duplicates are all referencing the same base picture.
@@ -1527,7 +1538,24 @@ int dt_image_local_copy_reset(const int32_t imgid)
 // xmp stuff
 // *******************************************************
 
-void dt_image_write_sidecar_file(int imgid)
+// pending sidecar writes and the threads flushing them. every image is in the queue at most once, a write
+// that comes in while it's waiting is merged into it. an image being written isn't picked up a second time
+// before that finishes, a change made meanwhile gets its own write afterwards.
+typedef struct dt_image_sidecar_queue_t
+{
+  dt_pthread_mutex_t lock;
+  pthread_cond_t cond; // a write got queued or finished, or the writers are to stop
+  GQueue *pending;     // imgids in the order they were queued
+  GHashTable *queued;  // the same imgids, to merge writes
+  GHashTable *busy;    // imgids being written right now
+  pthread_t *writers;  // NULL while the sidecars are written right away
+  int num_writers;
+  int stop;
+} dt_image_sidecar_queue_t;
+
+static dt_image_sidecar_queue_t _sidecar = { 0 };
+
+static void _image_write_sidecar_file(const int imgid)
 {
   // TODO: compute hash and don't write if not needed!
   // write .xmp file
@@ -1567,6 +1595,169 @@ void dt_image_write_sidecar_file(int imgid)
   }
 }
 
+// takes imgid off the queue and marks it busy, the lock is held
+static void _image_sidecar_take(const int imgid)
+{
+  g_queue_remove(_sidecar.pending, GINT_TO_POINTER(imgid));
+  g_hash_table_remove(_sidecar.queued, GINT_TO_POINTER(imgid));
+  g_hash_table_add(_sidecar.busy, GINT_TO_POINTER(imgid));
+}
+
+static void _image_sidecar_done(const int imgid)
+{
+  g_hash_table_remove(_sidecar.busy, GINT_TO_POINTER(imgid));
+  pthread_cond_broadcast(&_sidecar.cond);
+}
+
+static void *_image_sidecar_writer(void *data)
+{
+  dt_pthread_setname("sidecar");
+  dt_pthread_mutex_lock(&_sidecar.lock);
+  while(TRUE)
+  {
+    // the oldest write of an image that isn't being written already
+    int imgid = -1;
+    for(GList *iter = _sidecar.pending->head; iter; iter = g_list_next(iter))
+      if(!g_hash_table_contains(_sidecar.busy, iter->data))
+      {
+        imgid = GPOINTER_TO_INT(iter->data);
+        break;
+      }
+
+    if(imgid < 0)
+    {
+      // everything is written before the writers stop
+      if(_sidecar.stop && g_queue_is_empty(_sidecar.pending)) break;
+      dt_pthread_cond_wait(&_sidecar.cond, &_sidecar.lock);
+      continue;
+    }
+
+    _image_sidecar_take(imgid);
+    dt_pthread_mutex_unlock(&_sidecar.lock);
+    _image_write_sidecar_file(imgid);
+    dt_pthread_mutex_lock(&_sidecar.lock);
+    _image_sidecar_done(imgid);
+  }
+  dt_pthread_mutex_unlock(&_sidecar.lock);
+  return NULL;
+}
+
+void dt_image_write_sidecar_file(int imgid)
+{
+  if(imgid <= 0 || !dt_conf_get_bool("write_sidecar_files")) return;
+
+  if(_sidecar.writers)
+  {
+    dt_pthread_mutex_lock(&_sidecar.lock);
+    if(!_sidecar.stop)
+    {
+      if(!g_hash_table_contains(_sidecar.queued, GINT_TO_POINTER(imgid)))
+      {
+        g_queue_push_tail(_sidecar.pending, GINT_TO_POINTER(imgid));
+        g_hash_table_add(_sidecar.queued, GINT_TO_POINTER(imgid));
+        pthread_cond_signal(&_sidecar.cond);
+      }
+      dt_pthread_mutex_unlock(&_sidecar.lock);
+      return;
+    }
+    dt_pthread_mutex_unlock(&_sidecar.lock);
+  }
+
+  _image_write_sidecar_file(imgid);
+}
+
+void dt_image_sidecar_flush(const int imgid)
+{
+  if(!_sidecar.writers) return;
+
+  dt_pthread_mutex_lock(&_sidecar.lock);
+  if(imgid > 0)
+  {
+    while(g_hash_table_contains(_sidecar.busy, GINT_TO_POINTER(imgid)))
+      dt_pthread_cond_wait(&_sidecar.cond, &_sidecar.lock);
+    if(g_hash_table_contains(_sidecar.queued, GINT_TO_POINTER(imgid)))
+    {
+      _image_sidecar_take(imgid);
+      dt_pthread_mutex_unlock(&_sidecar.lock);
+      _image_write_sidecar_file(imgid);
+      dt_pthread_mutex_lock(&_sidecar.lock);
+      _image_sidecar_done(imgid);
+    }
+  }
+  else
+  {
+    while(!g_queue_is_empty(_sidecar.pending) || g_hash_table_size(_sidecar.busy))
+      dt_pthread_cond_wait(&_sidecar.cond, &_sidecar.lock);
+  }
+  dt_pthread_mutex_unlock(&_sidecar.lock);
+}
+
+void dt_image_sidecar_discard(const int imgid)
+{
+  if(!_sidecar.writers) return;
+
+  dt_pthread_mutex_lock(&_sidecar.lock);
+  if(g_hash_table_remove(_sidecar.queued, GINT_TO_POINTER(imgid)))
+    g_queue_remove(_sidecar.pending, GINT_TO_POINTER(imgid));
+  while(g_hash_table_contains(_sidecar.busy, GINT_TO_POINTER(imgid)))
+    dt_pthread_cond_wait(&_sidecar.cond, &_sidecar.lock);
+  dt_pthread_mutex_unlock(&_sidecar.lock);
+}
+
+void dt_image_sidecar_init(void)
+{
+  const int num_writers = MIN(dt_conf_get_int("write_sidecar_files_threads"), 8);
+  if(num_writers <= 0) return;
+
+  dt_pthread_mutex_init(&_sidecar.lock, NULL);
+  pthread_cond_init(&_sidecar.cond, NULL);
+  _sidecar.pending = g_queue_new();
+  _sidecar.queued = g_hash_table_new(NULL, NULL);
+  _sidecar.busy = g_hash_table_new(NULL, NULL);
+  _sidecar.stop = 0;
+  _sidecar.num_writers = 0;
+  pthread_t *writers = (pthread_t *)calloc(num_writers, sizeof(pthread_t));
+  for(int k = 0; k < num_writers; k++)
+  {
+    if(dt_pthread_create(&writers[k], _image_sidecar_writer, NULL)) break;
+    _sidecar.num_writers++;
+  }
+
+  if(_sidecar.num_writers)
+  {
+    _sidecar.writers = writers;
+    return;
+  }
+
+  // no thread could be started, write right away
+  free(writers);
+  g_queue_free(_sidecar.pending);
+  g_hash_table_destroy(_sidecar.queued);
+  g_hash_table_destroy(_sidecar.busy);
+  pthread_cond_destroy(&_sidecar.cond);
+  dt_pthread_mutex_destroy(&_sidecar.lock);
+}
+
+void dt_image_sidecar_cleanup(void)
+{
+  if(!_sidecar.writers) return;
+
+  dt_pthread_mutex_lock(&_sidecar.lock);
+  _sidecar.stop = 1;
+  pthread_cond_broadcast(&_sidecar.cond);
+  dt_pthread_mutex_unlock(&_sidecar.lock);
+  for(int k = 0; k < _sidecar.num_writers; k++) pthread_join(_sidecar.writers[k], NULL);
+
+  free(_sidecar.writers);
+  _sidecar.writers = NULL;
+  _sidecar.num_writers = 0;
+  g_queue_free(_sidecar.pending);
+  g_hash_table_destroy(_sidecar.queued);
+  g_hash_table_destroy(_sidecar.busy);
+  pthread_cond_destroy(&_sidecar.cond);
+  dt_pthread_mutex_destroy(&_sidecar.lock);
+}
+
 
 void dt_image_synch_xmp(const int selected)
 {
@@ -1697,7 +1888,7 @@ void dt_image_add_time_offset(const int imgid, const long int offset)
     dt_image_cache_read_release(darktable.image_cache, cimg);
     dt_image_t *img = dt_image_cache_get(darktable.image_cache, imgid, 'w');
     g_strlcpy(img->exif_datetime_taken, datetime, sizeof(img->exif_datetime_taken));
-    dt_image_cache_write_release(darktable.image_cache, img, DT_IMAGE_CACHE_SAFE);
+    dt_image_cache_write_release(darktable.image_cache, img, DT_IMAGE_CACHE_DEFERRED);
   }
   else dt_image_cache_read_release(darktable.image_cache, cimg);
 
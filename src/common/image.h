@@ -213,6 +213,9 @@ void dt_image_print_exif(const dt_image_t *img, char *line, size_t line_len);
 void dt_image_read_duplicates(uint32_t id, const char *filename);
 /** imports a new image from raw/etc file and adds it to the data base and image cache. Use from threads other than lua.*/
 uint32_t dt_image_import(int32_t film_id, const char *filename, gboolean override_ignore_jpegs);
+/** dt_image_import() with the metadata of filename and its sidecar read ahead by dt_exif_prefetch(). */
+uint32_t dt_image_import_prefetched(int32_t film_id, const char *filename, gboolean override_ignore_jpegs,
+                                    const struct dt_exif_prefetch_t *exif);
 /** imports a new image from raw/etc file and adds it to the data base and image cache. Use from lua thread.*/
 uint32_t dt_image_import_lua(int32_t film_id, const char *filename, gboolean override_ignore_jpegs);
 /** removes the given image from the database. */
@@ -231,7 +234,7 @@ void dt_image_set_flip(const int32_t imgid, const dt_image_orientation_t user_fl
 dt_image_orientation_t dt_image_get_orientation(const int imgid);
 /** set image location lon/lat */
 void dt_image_set_location(const int32_t imgid, double lon, double lat);
-/** set image location lon/lat/ele */
+/** set image location lon/lat/ele. written back deferred, see dt_image_cache_flush() */
 void dt_image_set_location_and_elevation(const int32_t imgid, double lon, double lat, double ele);
 /** returns 1 if there is history data found for this image, 0 else. */
 int dt_image_altered(const uint32_t imgid);
@@ -280,11 +283,19 @@ gboolean dt_image_safe_remove(const int32_t imgid);
 /* try to sync .xmp for all local copies */
 void dt_image_local_copy_synch(void);
 // xmp functions:
+/** queues a write of the sidecar of imgid for the background writers, pending writes of an image are merged */
 void dt_image_write_sidecar_file(int imgid);
+/** writes the pending sidecar of imgid, or of all images with -1, now and waits for the ones in flight */
+void dt_image_sidecar_flush(const int imgid);
+/** drops a pending write of imgid and waits for one in flight, before the image leaves the library */
+void dt_image_sidecar_discard(const int imgid);
+/** starts the background writers, cleanup writes everything that is pending before it stops them */
+void dt_image_sidecar_init(void);
+void dt_image_sidecar_cleanup(void);
 void dt_image_synch_xmp(const int selected);
 void dt_image_synch_all_xmp(const gchar *pathname);
 
-// add an offset to the exif_datetime_taken field
+// add an offset to the exif_datetime_taken field. written back deferred, see dt_image_cache_flush()
 void dt_image_add_time_offset(const int imgid, const long int offset);
 
 /** helper function to get the audio file filename that is accompanying the image. g_free() after use */
@@ -26,6 +26,9 @@
 
 #include <sqlite3.h>
 
+// seconds a deferred change may stay in the cache only
+#define DT_IMAGE_CACHE_FLUSH_DELAY 5
+
 void dt_image_cache_allocate(void *data, dt_cache_entry_t *entry)
 {
   entry->cost = sizeof(dt_image_t);
@@ -36,13 +39,13 @@ void dt_image_cache_allocate(void *data, dt_cache_entry_t *entry)
   // load stuff from db and store in cache:
   char *str;
   sqlite3_stmt *stmt;
-  DT_DEBUG_SQLITE3_PREPARE_V2(
-      dt_database_get(darktable.db),
+  DT_DEBUG_SQLITE3_PREPARE_CACHED(
+      darktable.db,
       "SELECT id, group_id, film_id, width, height, filename, maker, model, lens, exposure, "
       "aperture, iso, focal_length, datetime_taken, flags, crop, orientation, focus_distance, "
       "raw_parameters, longitude, latitude, altitude, color_matrix, colorspace, version, raw_black, "
       "raw_maximum FROM main.images WHERE id = ?1",
-      -1, &stmt, NULL);
+      &stmt);
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, entry->key);
   if(sqlite3_step(stmt) == SQLITE_ROW)
   {
@@ -134,15 +137,68 @@ void dt_image_cache_allocate(void *data, dt_cache_entry_t *entry)
     fprintf(stderr, "[image_cache_allocate] failed to open image %d from database: %s\n", entry->key,
             sqlite3_errmsg(dt_database_get(darktable.db)));
   }
-  sqlite3_finalize(stmt);
+  dt_database_release_cached(darktable.db, stmt);
   img->cache_entry = entry; // init backref
   // could downgrade lock write->read on entry->lock if we were using concurrencykit..
   dt_image_refresh_makermodel(img);
 }
 
+// writes the image struct to sql
+static void _image_cache_write(const dt_image_t *img)
+{
+  sqlite3_stmt *stmt;
+  DT_DEBUG_SQLITE3_PREPARE_CACHED(
+      darktable.db,
+      "UPDATE main.images SET width = ?1, height = ?2, maker = ?3, model = ?4, "
+      "lens = ?5, exposure = ?6, aperture = ?7, iso = ?8, focal_length = ?9, "
+      "focus_distance = ?10, film_id = ?11, datetime_taken = ?12, flags = ?13, "
+      "crop = ?14, orientation = ?15, raw_parameters = ?16, group_id = ?17, longitude = ?18, "
+      "latitude = ?19, altitude = ?20, color_matrix = ?21, colorspace = ?22, raw_black = ?23, "
+      "raw_maximum = ?24 WHERE id = ?25",
+      &stmt);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, img->width);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, img->height);
+  DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 3, img->exif_maker, -1, SQLITE_STATIC);
+  DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 4, img->exif_model, -1, SQLITE_STATIC);
+  DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 5, img->exif_lens, -1, SQLITE_STATIC);
+  DT_DEBUG_SQLITE3_BIND_DOUBLE(stmt, 6, img->exif_exposure);
+  DT_DEBUG_SQLITE3_BIND_DOUBLE(stmt, 7, img->exif_aperture);
+  DT_DEBUG_SQLITE3_BIND_DOUBLE(stmt, 8, img->exif_iso);
+  DT_DEBUG_SQLITE3_BIND_DOUBLE(stmt, 9, img->exif_focal_length);
+  DT_DEBUG_SQLITE3_BIND_DOUBLE(stmt, 10, img->exif_focus_distance);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 11, img->film_id);
+  DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 12, img->exif_datetime_taken, -1, SQLITE_STATIC);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 13, img->flags);
+  DT_DEBUG_SQLITE3_BIND_DOUBLE(stmt, 14, img->exif_crop);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 15, img->orientation);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 16, *(uint32_t *)(&img->legacy_flip));
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 17, img->group_id);
+  DT_DEBUG_SQLITE3_BIND_DOUBLE(stmt, 18, img->longitude);
+  DT_DEBUG_SQLITE3_BIND_DOUBLE(stmt, 19, img->latitude);
+  DT_DEBUG_SQLITE3_BIND_DOUBLE(stmt, 20, img->elevation);
+  DT_DEBUG_SQLITE3_BIND_BLOB(stmt, 21, &img->d65_color_matrix, sizeof(img->d65_color_matrix), SQLITE_STATIC);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 22, img->colorspace);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 23, img->raw_black_level);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 24, img->raw_white_point);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 25, img->id);
+  int rc = sqlite3_step(stmt);
+  if(rc != SQLITE_DONE) fprintf(stderr, "[image_cache_write_release] sqlite3 error %d\n", rc);
+  dt_database_release_cached(darktable.db, stmt);
+}
+
 void dt_image_cache_deallocate(void *data, dt_cache_entry_t *entry)
 {
+  dt_image_cache_t *cache = (dt_image_cache_t *)data;
   dt_image_t *img = (dt_image_t *)entry->data;
+
+  // a deferred change can't wait any longer. the sidecar is written by the next flush, writing it from here
+  // would need the image from the cache again.
+  dt_pthread_mutex_lock(&cache->dirty_lock);
+  const gboolean dirty = g_hash_table_remove(cache->dirty, GINT_TO_POINTER(entry->key));
+  if(dirty) g_hash_table_add(cache->sidecars, GINT_TO_POINTER(entry->key));
+  dt_pthread_mutex_unlock(&cache->dirty_lock);
+  if(dirty && img->id > 0) _image_cache_write(img);
+
   g_free(img->profile);
   g_free(img);
 }
@@ -157,16 +213,28 @@ void dt_image_cache_init(dt_image_cache_t *cache)
   //       can we get away with a fixed size?
   const uint32_t max_mem = 50 * 1024 * 1024;
   uint32_t num = (uint32_t)(1.5f * max_mem / sizeof(dt_image_t));
-  dt_cache_init(&cache->cache, sizeof(dt_image_t), max_mem);
+  // the image structs are small, so one lock-striped segment per thread is cheap:
+  dt_cache_init_segmented(&cache->cache, sizeof(dt_image_t), max_mem, dt_get_num_threads());
   dt_cache_set_allocate_callback(&cache->cache, &dt_image_cache_allocate, cache);
   dt_cache_set_cleanup_callback(&cache->cache, &dt_image_cache_deallocate, cache);
 
+  dt_pthread_mutex_init(&cache->dirty_lock, NULL);
+  cache->dirty = g_hash_table_new(NULL, NULL);
+  cache->sidecars = g_hash_table_new(NULL, NULL);
+  cache->flush_timeout = 0;
+
   dt_print(DT_DEBUG_CACHE, "[image_cache] has %d entries\n", num);
 }
 
 void dt_image_cache_cleanup(dt_image_cache_t *cache)
 {
+  dt_image_cache_flush(cache);
+  if(cache->flush_timeout) g_source_remove(cache->flush_timeout);
+  cache->flush_timeout = 0;
   dt_cache_cleanup(&cache->cache);
+  g_hash_table_destroy(cache->dirty);
+  g_hash_table_destroy(cache->sidecars);
+  dt_pthread_mutex_destroy(&cache->dirty_lock);
 }
 
 void dt_image_cache_print(dt_image_cache_t *cache)
@@ -205,54 +273,43 @@ void dt_image_cache_read_release(dt_image_cache_t *cache, const dt_image_t *img)
   dt_cache_release(&cache->cache, img->cache_entry);
 }
 
+static gboolean _image_cache_flush_timeout(gpointer user_data)
+{
+  dt_image_cache_t *cache = (dt_image_cache_t *)user_data;
+  dt_pthread_mutex_lock(&cache->dirty_lock);
+  cache->flush_timeout = 0;
+  dt_pthread_mutex_unlock(&cache->dirty_lock);
+  dt_image_cache_flush(cache);
+  return FALSE;
+}
+
 // drops the write privileges on an image struct.
 // this triggers a write-through to sql, and if the setting
 // is present, also to xmp sidecar files (safe setting).
 void dt_image_cache_write_release(dt_image_cache_t *cache, dt_image_t *img, dt_image_cache_write_mode_t mode)
 {
   if(img->id <= 0) return;
-  sqlite3_stmt *stmt;
-  DT_DEBUG_SQLITE3_PREPARE_V2(
-      dt_database_get(darktable.db),
-      "UPDATE main.images SET width = ?1, height = ?2, maker = ?3, model = ?4, "
-      "lens = ?5, exposure = ?6, aperture = ?7, iso = ?8, focal_length = ?9, "
-      "focus_distance = ?10, film_id = ?11, datetime_taken = ?12, flags = ?13, "
-      "crop = ?14, orientation = ?15, raw_parameters = ?16, group_id = ?17, longitude = ?18, "
-      "latitude = ?19, altitude = ?20, color_matrix = ?21, colorspace = ?22, raw_black = ?23, "
-      "raw_maximum = ?24 WHERE id = ?25",
-      -1, &stmt, NULL);
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, img->width);
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, img->height);
-  DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 3, img->exif_maker, -1, SQLITE_STATIC);
-  DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 4, img->exif_model, -1, SQLITE_STATIC);
-  DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 5, img->exif_lens, -1, SQLITE_STATIC);
-  DT_DEBUG_SQLITE3_BIND_DOUBLE(stmt, 6, img->exif_exposure);
-  DT_DEBUG_SQLITE3_BIND_DOUBLE(stmt, 7, img->exif_aperture);
-  DT_DEBUG_SQLITE3_BIND_DOUBLE(stmt, 8, img->exif_iso);
-  DT_DEBUG_SQLITE3_BIND_DOUBLE(stmt, 9, img->exif_focal_length);
-  DT_DEBUG_SQLITE3_BIND_DOUBLE(stmt, 10, img->exif_focus_distance);
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 11, img->film_id);
-  DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 12, img->exif_datetime_taken, -1, SQLITE_STATIC);
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 13, img->flags);
-  DT_DEBUG_SQLITE3_BIND_DOUBLE(stmt, 14, img->exif_crop);
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 15, img->orientation);
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 16, *(uint32_t *)(&img->legacy_flip));
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 17, img->group_id);
-  DT_DEBUG_SQLITE3_BIND_DOUBLE(stmt, 18, img->longitude);
-  DT_DEBUG_SQLITE3_BIND_DOUBLE(stmt, 19, img->latitude);
-  DT_DEBUG_SQLITE3_BIND_DOUBLE(stmt, 20, img->elevation);
-  DT_DEBUG_SQLITE3_BIND_BLOB(stmt, 21, &img->d65_color_matrix, sizeof(img->d65_color_matrix), SQLITE_STATIC);
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 22, img->colorspace);
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 23, img->raw_black_level);
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 24, img->raw_white_point);
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 25, img->id);
-  int rc = sqlite3_step(stmt);
-  if(rc != SQLITE_DONE) fprintf(stderr, "[image_cache_write_release] sqlite3 error %d\n", rc);
-  sqlite3_finalize(stmt);
+  if(mode == DT_IMAGE_CACHE_DEFERRED)
+  {
+    dt_pthread_mutex_lock(&cache->dirty_lock);
+    g_hash_table_add(cache->dirty, GINT_TO_POINTER(img->id));
+    if(!cache->flush_timeout)
+      cache->flush_timeout = g_timeout_add_seconds(DT_IMAGE_CACHE_FLUSH_DELAY, _image_cache_flush_timeout, cache);
+    dt_pthread_mutex_unlock(&cache->dirty_lock);
+    dt_cache_release(&cache->cache, img->cache_entry);
+    return;
+  }
+
+  _image_cache_write(img);
 
   // TODO: make this work in relaxed mode, too.
   if(mode == DT_IMAGE_CACHE_SAFE)
   {
+    // nothing left to write back
+    dt_pthread_mutex_lock(&cache->dirty_lock);
+    g_hash_table_remove(cache->dirty, GINT_TO_POINTER(img->id));
+    dt_pthread_mutex_unlock(&cache->dirty_lock);
+
     // rest about sidecars:
     // also synch dttags file:
     dt_image_write_sidecar_file(img->id);
@@ -267,7 +324,56 @@ void dt_image_cache_remove(dt_image_cache_t *cache, const uint32_t imgid)
   dt_cache_remove(&cache->cache, imgid);
 }
 
+void dt_image_cache_flush(dt_image_cache_t *cache)
+{
+  dt_pthread_mutex_lock(&cache->dirty_lock);
+  GList *ids = g_hash_table_get_keys(cache->dirty);
+  GList *sidecars = g_hash_table_get_keys(cache->sidecars);
+  g_hash_table_remove_all(cache->sidecars);
+  dt_pthread_mutex_unlock(&cache->dirty_lock);
+  if(!ids && !sidecars) return;
+
+  // join the transaction of the caller, if there is one
+  sqlite3 *db = dt_database_get(darktable.db);
+  const gboolean transaction = sqlite3_get_autocommit(db);
+  if(transaction) sqlite3_exec(db, "BEGIN TRANSACTION", NULL, NULL, NULL);
+  for(GList *iter = ids; iter; iter = g_list_next(iter))
+  {
+    // the read lock keeps the image in the cache. if it got dropped before, that wrote it already.
+    const dt_image_t *img = dt_image_cache_get(cache, GPOINTER_TO_INT(iter->data), 'r');
+    if(!img) continue;
+    dt_pthread_mutex_lock(&cache->dirty_lock);
+    const gboolean dirty = g_hash_table_remove(cache->dirty, iter->data);
+    dt_pthread_mutex_unlock(&cache->dirty_lock);
+    if(dirty && img->id > 0) _image_cache_write(img);
+    dt_image_cache_read_release(cache, img);
+  }
+  if(transaction) sqlite3_exec(db, "COMMIT", NULL, NULL, NULL);
+
+  dt_print(DT_DEBUG_CACHE, "[image_cache] wrote back %u images\n", g_list_length(ids));
+
+  for(GList *iter = ids; iter; iter = g_list_next(iter)) dt_image_write_sidecar_file(GPOINTER_TO_INT(iter->data));
+  for(GList *iter = sidecars; iter; iter = g_list_next(iter))
+    dt_image_write_sidecar_file(GPOINTER_TO_INT(iter->data));
+  g_list_free(ids);
+  g_list_free(sidecars);
+}
+
+void dt_image_cache_update_cached(dt_image_cache_t *cache, const GArray *imgids, dt_image_cache_update_t update,
+                                  void *data)
+{
+  for(guint i = 0; i < imgids->len; i++)
+  {
+    dt_image_t *img = dt_image_cache_testget(cache, g_array_index(imgids, int, i), 'w');
+    if(!img) continue;
+    update(img, data);
+    dt_cache_release(&cache->cache, img->cache_entry);
+  }
+}
+
+
 
+#undef DT_IMAGE_CACHE_FLUSH_DELAY
 
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
@@ -19,11 +19,18 @@
 #pragma once
 
 #include "common/cache.h"
+#include "common/dtpthread.h"
 #include "common/image.h"
 
 typedef struct dt_image_cache_t
 {
   dt_cache_t cache;
+
+  // images released with DT_IMAGE_CACHE_DEFERRED that are not written back yet, and the ones that got written
+  // when they were dropped from the cache but still need their sidecar
+  dt_pthread_mutex_t dirty_lock;
+  GHashTable *dirty, *sidecars;
+  guint flush_timeout; // source flushing them, 0 if none is pending
 }
 dt_image_cache_t;
 
@@ -34,7 +41,10 @@ typedef enum dt_image_cache_write_mode_t
   // always write to database and xmp
   DT_IMAGE_CACHE_SAFE = 0,
   // only write to db and do xmp only during shutdown
-  DT_IMAGE_CACHE_RELAXED = 1
+  DT_IMAGE_CACHE_RELAXED = 1,
+  // write to db and xmp later, together with the other images changed in the meantime. for code changing many
+  // images one after the other, which calls dt_image_cache_flush() once it is done.
+  DT_IMAGE_CACHE_DEFERRED = 2
 }
 dt_image_cache_write_mode_t;
 
@@ -66,6 +76,18 @@ void dt_image_cache_write_release(dt_image_cache_t *cache, dt_image_t *img, dt_i
 // remove the image from the cache
 void dt_image_cache_remove(dt_image_cache_t *cache, const uint32_t imgid);
 
+// writes the images released with DT_IMAGE_CACHE_DEFERRED to sql in one transaction and queues their sidecars.
+// once it returns, the database has all the changes released before the call. this also runs a few seconds
+// after a deferred release, when an image is dropped from the cache and on shutdown. the caller must not hold
+// any image locks.
+void dt_image_cache_flush(dt_image_cache_t *cache);
+
+// write locks the ones of the images in imgids that are in the cache in turn and runs update on them, without
+// writing them through to sql or xmp. for changes to many images the caller writes to the database in one go.
+typedef void (*dt_image_cache_update_t)(dt_image_t *img, void *data);
+void dt_image_cache_update_cached(dt_image_cache_t *cache, const GArray *imgids, dt_image_cache_update_t update,
+                                  void *data);
+
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
 // kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
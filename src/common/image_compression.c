@@ -16,11 +16,17 @@
     along with darktable.  If not, see <http://www.gnu.org/licenses/>.
 */
 #include "common/image_compression.h"
+#include "common/darktable.h"
 
+#include <glib.h>
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <zlib.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 typedef union
 {
@@ -28,129 +34,505 @@ typedef union
   uint32_t i;
 } dt_image_float_int_t;
 
-void dt_image_uncompress(const uint8_t *in, float *out, const int32_t width, const int32_t height)
+// every 4x4 block takes 16 bytes: the exponent of its smallest luma and the number of leading zero bits of the
+// luma range in byte 0, 4 bits of luma per pixel relative to those in bytes 1-8, and 7 bits each of red and blue
+// chroma for the four 2x2 quadrants in bytes 9-15. the blocks don't depend on each other, every row of them is
+// processed on its own. the sse2 versions give the same bytes and floats as the plain ones.
+
+static inline void _uncompress_chroma(const uint8_t *block, float chrom[4][3])
+{
+  uint8_t r[4], b[4];
+  r[0] = block[9] >> 1;
+  b[0] = ((block[9] & 0x01) << 6) | (block[10] >> 2);
+  r[1] = ((block[10] & 0x03) << 5) | (block[11] >> 3);
+  b[1] = ((block[11] & 0x07) << 4) | (block[12] >> 4);
+  r[2] = ((block[12] & 0x0f) << 3) | (block[13] >> 5);
+  b[2] = ((block[13] & 0x1f) << 2) | (block[14] >> 6);
+  r[3] = ((block[14] & 0x3f) << 1) | (block[15] >> 7);
+  b[3] = block[15] & 0x7f;
+
+  for(int q = 0; q < 4; q++)
+  {
+    chrom[q][0] = r[q] * (1. / 127.);
+    chrom[q][2] = b[q] * (1. / 127.);
+    chrom[q][1] = 1. - chrom[q][0] - chrom[q][2];
+  }
+}
+
+static inline void _compress_chroma(uint8_t *block, const uint8_t r[4], const uint8_t b[4])
+{
+  block[9] = (r[0] << 1) | (b[0] >> 6);
+  block[10] = (b[0] << 2) | (r[1] >> 5);
+  block[11] = (r[1] << 3) | (b[1] >> 4);
+  block[12] = (b[1] << 4) | (r[2] >> 3);
+  block[13] = (r[2] << 5) | (b[2] >> 2);
+  block[14] = (b[2] << 6) | (r[3] >> 1);
+  block[15] = (r[3] << 7) | (b[3] >> 0);
+}
+
+// the leading zero bits of the luma range, which decide how far the 4 bits per pixel are shifted
+static inline int _compress_zeroes(const int Lmax)
+{
+  int n_zeroes = 0;
+  for(int k = 1 << 14; (k & Lmax) == 0 && n_zeroes < 7; k >>= 1) n_zeroes++;
+  return n_zeroes;
+}
+
+// out points to the upper left pixel of the block in an image width pixels wide
+static inline void _uncompress_block(const uint8_t *block, float *out, const int32_t width)
 {
   dt_image_float_int_t L[16];
   float chrom[4][3];
   const float fac[3] = { 4., 2., 4. };
   uint16_t L16[16];
-  int32_t n_zeroes, Lbias;
+
+  // luma
+  const int32_t Lbias = (block[0] >> 3) << 10;
+  const int32_t n_zeroes = block[0] & 0x7;
+  const int shift = 14 - n_zeroes - 4 + 1;
+
+  for(int k = 0; k < 8; k++)
+  {
+    L16[2 * k] = ((int)(block[1 + k] >> 4) << shift) + Lbias;
+    L16[2 * k + 1] = ((int)(block[1 + k] & 0xf) << shift) + Lbias;
+  }
+  for(int k = 0; k < 16; k++)
+  {
+    L[k].i = (((int)(L16[k]) >> 10) - (15 - 127)) << (23);
+    L[k].i |= (L16[k] & 0x3ff) << 13;
+  }
+  // chroma
+  _uncompress_chroma(block, chrom);
+
+  for(int k = 0; k < 16; k++)
+    for(int c = 0; c < 3; c++)
+      out[3 * ((k & 3) + width * (k >> 2)) + c] = L[k].f * fac[c] * chrom[((k >> 3) << 1) | ((k & 3) >> 1)][c];
+}
+
+// in points to the upper left pixel of the block in an image width pixels wide
+static inline void _compress_block(const float *in, uint8_t *block, const int32_t width)
+{
+  dt_image_float_int_t L[16];
+  int16_t Lmin, Lmax, L16[16];
   uint8_t r[4], b[4];
-  const uint8_t *block = in;
-  for(int j = 0; j < height; j += 4)
+
+  Lmin = 0x7fff;
+  for(int q = 0; q < 4; q++)
   {
-    for(int i = 0; i < width; i += 4)
+    float chrom[3] = { 0, 0, 0 };
+    for(int pj = 0; pj < 2; pj++)
     {
-      // luma
-      Lbias = (block[0] >> 3) << 10;
-      n_zeroes = block[0] & 0x7;
-      const int shift = 14 - n_zeroes - 4 + 1;
-
-      for(int k = 0; k < 8; k++)
-      {
-        L16[2 * k] = ((int)(block[1 + k] >> 4) << shift) + Lbias;
-        L16[2 * k + 1] = ((int)(block[1 + k] & 0xf) << shift) + Lbias;
-      }
-      for(int k = 0; k < 16; k++)
-      {
-        L[k].i = (((int)(L16[k]) >> 10) - (15 - 127)) << (23);
-        L[k].i |= (L16[k] & 0x3ff) << 13;
-      }
-      // chroma
-      r[0] = block[9] >> 1;
-      b[0] = ((block[9] & 0x01) << 6) | (block[10] >> 2);
-      r[1] = ((block[10] & 0x03) << 5) | (block[11] >> 3);
-      b[1] = ((block[11] & 0x07) << 4) | (block[12] >> 4);
-      r[2] = ((block[12] & 0x0f) << 3) | (block[13] >> 5);
-      b[2] = ((block[13] & 0x1f) << 2) | (block[14] >> 6);
-      r[3] = ((block[14] & 0x3f) << 1) | (block[15] >> 7);
-      b[3] = block[15] & 0x7f;
-
-      for(int q = 0; q < 4; q++)
+      for(int pi = 0; pi < 2; pi++)
       {
-        chrom[q][0] = r[q] * (1. / 127.);
-        chrom[q][2] = b[q] * (1. / 127.);
-        chrom[q][1] = 1. - chrom[q][0] - chrom[q][2];
+        const int io = (pi + ((q & 1) << 1)), jo = (pj + (q & 2));
+        const float *pixel = in + 3 * (io + width * jo);
+
+        L[io + 4 * jo].f = (pixel[0] + 2 * pixel[1] + pixel[2]) * .25;
+        for(int k = 0; k < 3; k++) chrom[k] += L[io + 4 * jo].f * pixel[k];
+        L16[io + 4 * jo] = (L[io + 4 * jo].i >> 13) & 0x3ff;
+        int e = ((L[io + 4 * jo].i >> (23)) - (127 - 15));
+        e = e > 0 ? e : 0;
+        e = e > 30 ? 30 : e;
+        L16[io + 4 * jo] |= e << 10;
+        Lmin = Lmin < L16[io + 4 * jo] ? Lmin : L16[io + 4 * jo];
       }
-      for(int k = 0; k < 16; k++)
-        for(int c = 0; c < 3; c++)
-          out[3 * (i + (k & 3) + width * (j + (k >> 2))) + c] = L[k].f * fac[c]
-                                                                * chrom[((k >> 3) << 1) | ((k & 3) >> 1)][c];
-      block += 16 * sizeof(uint8_t);
+    }
+    const float norm = 1. / (chrom[0] + 2 * chrom[1] + chrom[2]);
+    r[q] = (int)(127. * (chrom[0] * norm));
+    b[q] = (int)(127. * (chrom[2] * norm));
+  }
+  // store luma
+  Lmin &= ~0x3ff;
+  block[0] = (Lmin >> 10) << 3; // Lbias
+  Lmax = 0;
+  for(int k = 0; k < 16; k++)
+  {
+    L16[k] -= Lmin;
+    Lmax = Lmax > L16[k] ? Lmax : L16[k];
+  }
+  const int n_zeroes = _compress_zeroes(Lmax);
+  block[0] |= n_zeroes;
+  const int shift = 14 - n_zeroes - 4 + 1;
+  const int off = (1 << shift) >> 1;
+  for(int k = 0; k < 8; k++)
+  {
+    L16[2 * k] = ((int)L16[2 * k] + off) >> shift;
+    L16[2 * k] = L16[2 * k] > 0xf ? 0xf : L16[2 * k];
+    L16[2 * k + 1] = ((int)L16[2 * k + 1] + off) >> shift;
+    L16[2 * k + 1] = L16[2 * k + 1] > 0xf ? 0xf : L16[2 * k + 1];
+    block[k + 1] = L16[2 * k + 1] | (L16[2 * k] << 4);
+  }
+  // store chroma
+  _compress_chroma(block, r, b);
+}
+
+#if defined(__SSE2__)
+static inline int _hmin_epi16(__m128i v)
+{
+  v = _mm_min_epi16(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2)));
+  v = _mm_min_epi16(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(2, 3, 0, 1)));
+  v = _mm_min_epi16(v, _mm_shufflelo_epi16(v, _MM_SHUFFLE(2, 3, 0, 1)));
+  return (int16_t)_mm_cvtsi128_si32(v);
+}
+
+static inline int _hmax_epi16(__m128i v)
+{
+  v = _mm_max_epi16(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2)));
+  v = _mm_max_epi16(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(2, 3, 0, 1)));
+  v = _mm_max_epi16(v, _mm_shufflelo_epi16(v, _MM_SHUFFLE(2, 3, 0, 1)));
+  return (int16_t)_mm_cvtsi128_si32(v);
+}
+
+DT_ALWAYS_INLINE void _uncompress_block_sse2(const uint8_t *block, float *out, const int32_t width)
+{
+  // the nibbles to 16 bits, the upper one of every byte is the first pixel
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i bytes = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(block + 1)), zero);
+  const __m128i hi = _mm_srli_epi16(bytes, 4), lo = _mm_and_si128(bytes, _mm_set1_epi16(0xf));
+  const __m128i Lbias = _mm_set1_epi16((block[0] >> 3) << 10);
+  const __m128i shift = _mm_cvtsi32_si128(14 - (block[0] & 0x7) - 4 + 1);
+  const __m128i L16[2] = { _mm_add_epi16(_mm_sll_epi16(_mm_unpacklo_epi16(hi, lo), shift), Lbias),
+                           _mm_add_epi16(_mm_sll_epi16(_mm_unpackhi_epi16(hi, lo), shift), Lbias) };
+  // the half float exponent and mantissa are right next to each other, they only need the bias of a float
+  const __m128i bias = _mm_set1_epi32((127 - 15) << 23);
+
+  float chrom[4][3];
+  _uncompress_chroma(block, chrom);
+
+  for(int h = 0; h < 2; h++)
+  {
+    // a row is 12 floats, the left two pixels from the left quadrant and the right two from the right one
+    const float *a = chrom[2 * h], *b = chrom[2 * h + 1];
+    const __m128 c0 = _mm_setr_ps(4.f * a[0], 2.f * a[1], 4.f * a[2], 4.f * a[0]);
+    const __m128 c1 = _mm_setr_ps(2.f * a[1], 4.f * a[2], 4.f * b[0], 2.f * b[1]);
+    const __m128 c2 = _mm_setr_ps(4.f * b[2], 4.f * b[0], 2.f * b[1], 4.f * b[2]);
+    const __m128i rows[2] = { _mm_unpacklo_epi16(L16[h], zero), _mm_unpackhi_epi16(L16[h], zero) };
+    for(int r = 0; r < 2; r++)
+    {
+      const __m128 L = _mm_castsi128_ps(_mm_add_epi32(_mm_slli_epi32(rows[r], 13), bias));
+      float *o = out + (size_t)3 * width * (2 * h + r);
+      _mm_storeu_ps(o, _mm_mul_ps(_mm_shuffle_ps(L, L, _MM_SHUFFLE(1, 0, 0, 0)), c0));
+      _mm_storeu_ps(o + 4, _mm_mul_ps(_mm_shuffle_ps(L, L, _MM_SHUFFLE(2, 2, 1, 1)), c1));
+      _mm_storeu_ps(o + 8, _mm_mul_ps(_mm_shuffle_ps(L, L, _MM_SHUFFLE(3, 3, 3, 2)), c2));
+    }
+  }
+}
+
+DT_ALWAYS_INLINE void _compress_block_sse2(const float *in, uint8_t *block, const int32_t width)
+{
+  __m128 L[4], LR[4], LG[4], LB[4];
+  for(int r = 0; r < 4; r++)
+  {
+    // split a row of 4 rgb pixels into the channels
+    const float *p = in + (size_t)3 * width * r;
+    const __m128 a = _mm_loadu_ps(p), b = _mm_loadu_ps(p + 4), c = _mm_loadu_ps(p + 8);
+    const __m128 R = _mm_shuffle_ps(a, _mm_shuffle_ps(b, c, _MM_SHUFFLE(1, 1, 2, 2)), _MM_SHUFFLE(2, 0, 3, 0));
+    const __m128 G = _mm_shuffle_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(0, 0, 1, 1)),
+                                    _mm_shuffle_ps(b, c, _MM_SHUFFLE(2, 2, 3, 3)), _MM_SHUFFLE(2, 0, 2, 0));
+    const __m128 B = _mm_shuffle_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(1, 1, 2, 2)), c, _MM_SHUFFLE(3, 0, 2, 0));
+    L[r] = _mm_mul_ps(_mm_add_ps(_mm_add_ps(R, _mm_add_ps(G, G)), B), _mm_set1_ps(.25f));
+    LR[r] = _mm_mul_ps(L[r], R);
+    LG[r] = _mm_mul_ps(L[r], G);
+    LB[r] = _mm_mul_ps(L[r], B);
+  }
+
+  // chroma of the four quadrants side by side, summed up in the same order as one at a time
+  __m128 chrom[3] = { _mm_setzero_ps(), _mm_setzero_ps(), _mm_setzero_ps() };
+  for(int r = 0; r < 2; r++)
+  {
+    chrom[0] = _mm_add_ps(chrom[0], _mm_shuffle_ps(LR[r], LR[r + 2], _MM_SHUFFLE(2, 0, 2, 0)));
+    chrom[1] = _mm_add_ps(chrom[1], _mm_shuffle_ps(LG[r], LG[r + 2], _MM_SHUFFLE(2, 0, 2, 0)));
+    chrom[2] = _mm_add_ps(chrom[2], _mm_shuffle_ps(LB[r], LB[r + 2], _MM_SHUFFLE(2, 0, 2, 0)));
+    chrom[0] = _mm_add_ps(chrom[0], _mm_shuffle_ps(LR[r], LR[r + 2], _MM_SHUFFLE(3, 1, 3, 1)));
+    chrom[1] = _mm_add_ps(chrom[1], _mm_shuffle_ps(LG[r], LG[r + 2], _MM_SHUFFLE(3, 1, 3, 1)));
+    chrom[2] = _mm_add_ps(chrom[2], _mm_shuffle_ps(LB[r], LB[r + 2], _MM_SHUFFLE(3, 1, 3, 1)));
+  }
+  float cr[4], cg[4], cb[4];
+  uint8_t r[4], b[4];
+  _mm_storeu_ps(cr, chrom[0]);
+  _mm_storeu_ps(cg, chrom[1]);
+  _mm_storeu_ps(cb, chrom[2]);
+  for(int q = 0; q < 4; q++)
+  {
+    const float norm = 1. / (cr[q] + 2 * cg[q] + cb[q]);
+    r[q] = (int)(127. * (cr[q] * norm));
+    b[q] = (int)(127. * (cb[q] * norm));
+  }
+
+  // luma to half floats, without sign and clamped to the exponents that fit in 5 bits
+  const __m128i mask = _mm_set1_epi32(0x3ff), ebias = _mm_set1_epi32(127 - 15);
+  __m128i L16[2];
+  for(int h = 0; h < 2; h++)
+  {
+    const __m128i i0 = _mm_castps_si128(L[2 * h]), i1 = _mm_castps_si128(L[2 * h + 1]);
+    const __m128i m = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(i0, 13), mask),
+                                      _mm_and_si128(_mm_srli_epi32(i1, 13), mask));
+    __m128i e = _mm_packs_epi32(_mm_sub_epi32(_mm_srli_epi32(i0, 23), ebias),
+                                _mm_sub_epi32(_mm_srli_epi32(i1, 23), ebias));
+    e = _mm_min_epi16(_mm_max_epi16(e, _mm_setzero_si128()), _mm_set1_epi16(30));
+    L16[h] = _mm_or_si128(m, _mm_slli_epi16(e, 10));
+  }
+
+  // store luma
+  const int Lmin = MIN(_hmin_epi16(L16[0]), _hmin_epi16(L16[1])) & ~0x3ff;
+  block[0] = (Lmin >> 10) << 3; // Lbias
+  const __m128i vmin = _mm_set1_epi16(Lmin);
+  L16[0] = _mm_sub_epi16(L16[0], vmin);
+  L16[1] = _mm_sub_epi16(L16[1], vmin);
+  const int n_zeroes = _compress_zeroes(MAX(_hmax_epi16(L16[0]), _hmax_epi16(L16[1])));
+  block[0] |= n_zeroes;
+  const __m128i shift = _mm_cvtsi32_si128(14 - n_zeroes - 4 + 1);
+  const __m128i off = _mm_set1_epi16((1 << (14 - n_zeroes - 4 + 1)) >> 1), top = _mm_set1_epi16(0xf);
+  __m128i nibbles[2];
+  for(int h = 0; h < 2; h++)
+  {
+    // the range and the rounding offset fit below 1 << 15, there is no overflow
+    const __m128i q = _mm_min_epi16(_mm_srl_epi16(_mm_add_epi16(L16[h], off), shift), top);
+    // every 32 bits hold two pixels, the first one goes to the upper nibble
+    nibbles[h] = _mm_and_si128(_mm_or_si128(_mm_slli_epi32(q, 4), _mm_srli_epi32(q, 16)), _mm_set1_epi32(0xff));
+  }
+  const __m128i packed = _mm_packs_epi32(nibbles[0], nibbles[1]);
+  _mm_storel_epi64((__m128i *)(block + 1), _mm_packus_epi16(packed, packed));
+
+  // store chroma
+  _compress_chroma(block, r, b);
+}
+#endif
+
+void dt_image_uncompress(const uint8_t *in, float *out, const int32_t width, const int32_t height)
+{
+  const size_t row = (size_t)16 * ((width + 3) / 4);
+#ifdef _OPENMP
+#pragma omp parallel for default(none) shared(in, out) schedule(static)
+#endif
+  for(int j = 0; j < height; j += 4)
+  {
+    const uint8_t *block = in + row * (j / 4);
+    for(int i = 0; i < width; i += 4, block += 16)
+    {
+#if defined(__SSE2__)
+      _uncompress_block_sse2(block, out + 3 * (i + (size_t)width * j), width);
+#else
+      _uncompress_block(block, out + 3 * (i + (size_t)width * j), width);
+#endif
     }
   }
 }
 
 void dt_image_compress(const float *in, uint8_t *out, const int32_t width, const int32_t height)
 {
-  dt_image_float_int_t L[16];
-  int16_t Lmin, Lmax, n_zeroes, L16[16];
-  uint8_t *block = out, r[4], b[4];
+  const size_t row = (size_t)16 * ((width + 3) / 4);
+#ifdef _OPENMP
+#pragma omp parallel for default(none) shared(in, out) schedule(static)
+#endif
   for(int j = 0; j < height; j += 4)
   {
-    for(int i = 0; i < width; i += 4)
+    uint8_t *block = out + row * (j / 4);
+    for(int i = 0; i < width; i += 4, block += 16)
     {
-      Lmin = 0x7fff;
-      for(int q = 0; q < 4; q++)
-      {
-        float chrom[3] = { 0, 0, 0 };
-        for(int pj = 0; pj < 2; pj++)
-        {
-          for(int pi = 0; pi < 2; pi++)
-          {
-            const int io = (pi + ((q & 1) << 1)), jo = (pj + (q & 2));
-            const int ii = i + io, jj = j + jo;
-
-            L[io + 4 * jo].f = (in[3 * (ii + width * jj) + 0] + 2 * in[3 * (ii + width * jj) + 1]
-                                + in[3 * (ii + width * jj) + 2]) * .25;
-            for(int k = 0; k < 3; k++) chrom[k] += L[io + 4 * jo].f * in[3 * (ii + width * jj) + k];
-            L16[io + 4 * jo] = (L[io + 4 * jo].i >> 13) & 0x3ff;
-            int e = ((L[io + 4 * jo].i >> (23)) - (127 - 15));
-            e = e > 0 ? e : 0;
-            e = e > 30 ? 30 : e;
-            L16[io + 4 * jo] |= e << 10;
-            Lmin = Lmin < L16[io + 4 * jo] ? Lmin : L16[io + 4 * jo];
-          }
-        }
-        const float norm = 1. / (chrom[0] + 2 * chrom[1] + chrom[2]);
-        r[q] = (int)(127. * (chrom[0] * norm));
-        b[q] = (int)(127. * (chrom[2] * norm));
-      }
-      // store luma
-      Lmin &= ~0x3ff;
-      block[0] = (Lmin >> 10) << 3; // Lbias
-      Lmax = 0;
-      for(int k = 0; k < 16; k++)
+#if defined(__SSE2__)
+      _compress_block_sse2(in + 3 * (i + (size_t)width * j), block, width);
+#else
+      _compress_block(in + 3 * (i + (size_t)width * j), block, width);
+#endif
+    }
+  }
+}
+
+float dt_image_compression_psnr(const float *in, const float *out, const int32_t width, const int32_t height)
+{
+  const size_t n = (size_t)3 * width * height;
+  double sum = 0.0;
+  float peak = 0.0f;
+#ifdef _OPENMP
+#pragma omp parallel for default(none) shared(in, out) reduction(+ : sum) reduction(max : peak) schedule(static)
+#endif
+  for(size_t k = 0; k < n; k++)
+  {
+    const double d = (double)out[k] - in[k];
+    sum += d * d;
+    peak = MAX(peak, in[k]);
+  }
+  if(sum == 0.0) return INFINITY;
+  return 10.0 * log10((double)peak * peak * n / sum);
+}
+
+#define DT_IMAGE_LOSSLESS_MAGIC 0x64746c31u
+// rows are grouped to strips of about this many bytes, each one deflated on its own
+#define DT_IMAGE_LOSSLESS_STRIP ((size_t)1 << 20)
+
+typedef struct dt_image_lossless_header_t
+{
+  uint32_t magic;
+  uint32_t width, height, bpp;
+  uint32_t word, stride; // bytes per value, and the distance in values to the one it is predicted from
+  uint32_t strips, rows; // rows per strip, the last one might have less
+  // followed by strips + 1 uint64_t offsets of the deflated strips, relative to the end of the offsets
+} dt_image_lossless_header_t;
+
+static inline uint32_t _lossless_load(const uint8_t *p, const uint32_t word)
+{
+  if(word == 4)
+  {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+  }
+  if(word == 2)
+  {
+    uint16_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+  }
+  return *p;
+}
+
+static inline void _lossless_store(uint8_t *p, const uint32_t v, const uint32_t word)
+{
+  if(word == 4)
+    memcpy(p, &v, sizeof(v));
+  else if(word == 2)
+  {
+    const uint16_t v16 = v;
+    memcpy(p, &v16, sizeof(v16));
+  }
+  else
+    *p = v;
+}
+
+static void _lossless_layout(dt_image_lossless_header_t *h, const uint32_t width, const uint32_t height,
+                             const size_t bpp)
+{
+  h->magic = DT_IMAGE_LOSSLESS_MAGIC;
+  h->width = width;
+  h->height = height;
+  h->bpp = bpp;
+  h->word = (bpp % 4 == 0) ? 4 : (bpp % 2 == 0) ? 2 : 1;
+  const uint32_t channels = bpp / h->word;
+  h->stride = channels == 1 ? 2 : channels;
+  const size_t row = (size_t)width * bpp;
+  h->rows = MAX(1, MIN(height, DT_IMAGE_LOSSLESS_STRIP / MAX(row, 1)));
+  h->strips = height ? (height + h->rows - 1) / h->rows : 0;
+}
+
+uint8_t *dt_image_compress_lossless(const void *in, const uint32_t width, const uint32_t height,
+                                    const size_t bpp, size_t *len)
+{
+  dt_image_lossless_header_t h;
+  _lossless_layout(&h, width, height, bpp);
+  const size_t row = (size_t)width * bpp;
+  const size_t strip_bound = compressBound(row * h.rows);
+  const size_t head = sizeof(h) + sizeof(uint64_t) * (h.strips + 1);
+  // every strip gets the space it could take at most, they are moved together afterwards
+  uint8_t *out = (uint8_t *)malloc(head + strip_bound * h.strips);
+  if(!out) return NULL;
+  memcpy(out, &h, sizeof(h));
+  uint64_t *offsets = (uint64_t *)(out + sizeof(h));
+  uint8_t *data = out + head;
+  const uint8_t *pixels = (const uint8_t *)in;
+  int err = 0;
+
+#ifdef _OPENMP
+#pragma omp parallel for default(none) shared(offsets, data, pixels, err, h) schedule(dynamic)
+#endif
+  for(uint32_t s = 0; s < h.strips; s++)
+  {
+    const uint32_t r0 = s * h.rows, r1 = MIN(height, r0 + h.rows);
+    const size_t values = row / h.word, plane = (size_t)(r1 - r0) * values;
+    uint8_t *tmp = (uint8_t *)malloc(plane * h.word);
+    if(!tmp)
+    {
+      err = 1;
+      continue;
+    }
+    for(uint32_t r = r0; r < r1; r++)
+    {
+      const uint8_t *line = pixels + r * row;
+      const size_t base = (size_t)(r - r0) * values;
+      for(size_t i = 0; i < values; i++)
       {
-        L16[k] -= Lmin;
-        Lmax = Lmax > L16[k] ? Lmax : L16[k];
+        const uint32_t v = _lossless_load(line + i * h.word, h.word);
+        const uint32_t pred = i >= h.stride ? _lossless_load(line + (i - h.stride) * h.word, h.word) : 0;
+        const uint32_t d = v - pred;
+        for(uint32_t b = 0; b < h.word; b++) tmp[b * plane + base + i] = (d >> (8 * b)) & 0xff;
       }
-      n_zeroes = 0;
-      for(int k = 1 << 14; (k & Lmax) == 0 && n_zeroes < 7; k >>= 1) n_zeroes++;
-      block[0] |= n_zeroes;
-      const int shift = 14 - n_zeroes - 4 + 1;
-      const int off = (1 << shift) >> 1;
-      for(int k = 0; k < 8; k++)
+    }
+    uLongf out_len = strip_bound;
+    if(compress2(data + s * strip_bound, &out_len, tmp, plane * h.word, Z_BEST_SPEED) != Z_OK) err = 1;
+    offsets[s + 1] = out_len; // only the length for now
+    free(tmp);
+  }
+  if(err)
+  {
+    free(out);
+    return NULL;
+  }
+
+  offsets[0] = 0;
+  for(uint32_t s = 0; s < h.strips; s++)
+  {
+    memmove(data + offsets[s], data + s * strip_bound, offsets[s + 1]);
+    offsets[s + 1] += offsets[s];
+  }
+  *len = head + offsets[h.strips];
+  uint8_t *shrunk = (uint8_t *)realloc(out, *len);
+  return shrunk ? shrunk : out;
+}
+
+int dt_image_uncompress_lossless(const uint8_t *in, const size_t len, void *out, const uint32_t width,
+                                 const uint32_t height, const size_t bpp)
+{
+  dt_image_lossless_header_t h, expected;
+  if(len < sizeof(h)) return 1;
+  memcpy(&h, in, sizeof(h));
+  _lossless_layout(&expected, width, height, bpp);
+  if(memcmp(&h, &expected, sizeof(h))) return 1;
+  const size_t head = sizeof(h) + sizeof(uint64_t) * (h.strips + 1);
+  if(len < head) return 1;
+  const uint64_t *offsets = (const uint64_t *)(in + sizeof(h));
+  if(offsets[h.strips] > len - head) return 1;
+  const uint8_t *data = in + head;
+  const size_t row = (size_t)width * bpp;
+  uint8_t *pixels = (uint8_t *)out;
+  int err = 0;
+
+#ifdef _OPENMP
+#pragma omp parallel for default(none) shared(offsets, data, pixels, err, h) schedule(dynamic)
+#endif
+  for(uint32_t s = 0; s < h.strips; s++)
+  {
+    const uint32_t r0 = s * h.rows, r1 = MIN(height, r0 + h.rows);
+    const size_t values = row / h.word, plane = (size_t)(r1 - r0) * values;
+    uint8_t *tmp = (uint8_t *)malloc(plane * h.word);
+    uLongf out_len = plane * h.word;
+    if(!tmp || offsets[s + 1] < offsets[s]
+       || uncompress(tmp, &out_len, data + offsets[s], offsets[s + 1] - offsets[s]) != Z_OK
+       || out_len != plane * h.word)
+    {
+      free(tmp);
+      err = 1;
+      continue;
+    }
+    for(uint32_t r = r0; r < r1; r++)
+    {
+      uint8_t *line = pixels + r * row;
+      const size_t base = (size_t)(r - r0) * values;
+      for(size_t i = 0; i < values; i++)
       {
-        L16[2 * k] = ((int)L16[2 * k] + off) >> shift;
-        L16[2 * k] = L16[2 * k] > 0xf ? 0xf : L16[2 * k];
-        L16[2 * k + 1] = ((int)L16[2 * k + 1] + off) >> shift;
-        L16[2 * k + 1] = L16[2 * k + 1] > 0xf ? 0xf : L16[2 * k + 1];
-        block[k + 1] = L16[2 * k + 1] | (L16[2 * k] << 4);
+        uint32_t d = 0;
+        for(uint32_t b = 0; b < h.word; b++) d |= (uint32_t)tmp[b * plane + base + i] << (8 * b);
+        const uint32_t pred = i >= h.stride ? _lossless_load(line + (i - h.stride) * h.word, h.word) : 0;
+        _lossless_store(line + i * h.word, d + pred, h.word);
       }
-      // store chroma
-      block[9] = (r[0] << 1) | (b[0] >> 6);
-      block[10] = (b[0] << 2) | (r[1] >> 5);
-      block[11] = (r[1] << 3) | (b[1] >> 4);
-      block[12] = (b[1] << 4) | (r[2] >> 3);
-      block[13] = (r[2] << 5) | (b[2] >> 2);
-      block[14] = (b[2] << 6) | (r[3] >> 1);
-      block[15] = (r[3] << 7) | (b[3] >> 0);
-      block += 16 * sizeof(uint8_t);
     }
+    free(tmp);
   }
+  return err;
 }
 
+#undef DT_IMAGE_LOSSLESS_MAGIC
+#undef DT_IMAGE_LOSSLESS_STRIP
+
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
 // kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
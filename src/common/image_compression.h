@@ -19,11 +19,27 @@
 #pragma once
 
 #include <inttypes.h>
+#include <stddef.h>
 
 /** K. Roimela, T. Aarnio and J. Itäranta. High Dynamic Range Texture Compression. Proceedings of SIGGRAPH
- * 2006. */
+ * 2006. packs every 4x4 block of an rgb float image into 16 bytes, width and height have to be multiples of 4.
+ * the rows of blocks are processed in parallel. */
 void dt_image_compress(const float *in, uint8_t *out, const int32_t width, const int32_t height);
 void dt_image_uncompress(const uint8_t *in, float *out, const int32_t width, const int32_t height);
+/** peak signal to noise ratio in dB of out compared to in, two rgb float images of the same size, relative to the
+ * largest value of in. infinite if they are the same. */
+float dt_image_compression_psnr(const float *in, const float *out, const int32_t width, const int32_t height);
+
+/** lossless compression of width x height pixels of bpp bytes each, such as raw mosaics or float buffers.
+ * every value is replaced by its difference to the same channel of the pixel before (two before for one channel
+ * data, to stay on the same colour of a bayer pattern), split into byte planes and deflated in strips of rows
+ * which are processed in parallel. returns a buffer to free() holding *len bytes, or NULL. */
+uint8_t *dt_image_compress_lossless(const void *in, const uint32_t width, const uint32_t height,
+                                    const size_t bpp, size_t *len);
+/** restores what dt_image_compress_lossless() packed, out has to hold width x height pixels of bpp bytes.
+ * returns non zero if the data doesn't match these dimensions or is corrupted. */
+int dt_image_uncompress_lossless(const uint8_t *in, const size_t len, void *out, const uint32_t width,
+                                 const uint32_t height, const size_t bpp);
 
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
@@ -34,6 +34,7 @@
 #include "common/imageio_j2k.h"
 #endif
 #include "common/image_compression.h"
+#include "common/interpolation.h"
 #include "common/imageio_gm.h"
 #include "common/imageio_jpeg.h"
 #include "common/imageio_pfm.h"
@@ -47,7 +48,9 @@
 #include "control/control.h"
 #include "develop/blend.h"
 #include "develop/develop.h"
+#include "develop/format.h"
 #include "develop/imageop.h"
+#include "develop/imageop_math.h"
 
 #ifdef HAVE_GRAPHICSMAGICK
 #include <magick/api.h>
@@ -55,6 +58,9 @@
 #endif
 
 #include <assert.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 #include <glib/gstdio.h>
 #include <inttypes.h>
 #include <math.h>
@@ -65,7 +71,8 @@
 
 // load a full-res thumbnail:
 int dt_imageio_large_thumbnail(const char *filename, uint8_t **buffer, int32_t *width, int32_t *height,
-                               dt_colorspaces_color_profile_type_t *color_space)
+                               dt_colorspaces_color_profile_type_t *color_space, const int32_t fit_width,
+                               const int32_t fit_height)
 {
   int res = 1;
 
@@ -81,6 +88,7 @@ int dt_imageio_large_thumbnail(const char *filename, uint8_t **buffer, int32_t *
     // Decompress the JPG into our own memory format
     dt_imageio_jpeg_t jpg;
     if(dt_imageio_jpeg_decompress_header(buf, bufsize, &jpg)) goto error;
+    dt_imageio_jpeg_fit_scale(&jpg, fit_width, fit_height);
     *buffer = (uint8_t *)malloc((size_t)sizeof(uint8_t) * jpg.width * jpg.height * 4);
     if(!*buffer) goto error;
 
@@ -170,99 +178,145 @@ error:
   return res;
 }
 
-void dt_imageio_flip_buffers(char *out, const char *in, const size_t bpp, const int wd, const int ht,
-                             const int fwd, const int fht, const int stride,
-                             const dt_image_orientation_t orientation)
+// square tiles of that many pixels keep the writes of a transpose in cache
+#define DT_IMAGEIO_FLIP_TILE 32
+
+// where the first input pixel goes in out, and how far apart the output of neighbouring input columns (si) and
+// rows (sj) is, in units of ps
+static void _flip_steps(const dt_image_orientation_t orientation, const int wd, const int ht, const int fwd,
+                        const int fht, const ptrdiff_t ps, ptrdiff_t *origin, ptrdiff_t *si, ptrdiff_t *sj)
 {
-  if(!orientation)
-  {
-#ifdef _OPENMP
-#pragma omp parallel for schedule(static) default(none) shared(in, out)
-#endif
-    for(int j = 0; j < ht; j++) memcpy(out + (size_t)j * bpp * wd, in + (size_t)j * stride, bpp * wd);
-    return;
-  }
   int ii = 0, jj = 0;
-  int si = bpp, sj = wd * bpp;
+  *si = ps;
+  *sj = (ptrdiff_t)wd * ps;
   if(orientation & ORIENTATION_SWAP_XY)
   {
-    sj = bpp;
-    si = ht * bpp;
+    *sj = ps;
+    *si = (ptrdiff_t)ht * ps;
   }
   if(orientation & ORIENTATION_FLIP_X)
   {
     jj = (int)fht - jj - 1;
-    sj = -sj;
+    *sj = -*sj;
   }
   if(orientation & ORIENTATION_FLIP_Y)
   {
     ii = (int)fwd - ii - 1;
-    si = -si;
+    *si = -*si;
+  }
+  *origin = labs(*sj) * jj + labs(*si) * ii;
+}
+
+// the sizes that show up get a copy of fixed size, which the compiler turns into plain moves
+DT_ALWAYS_INLINE void _flip_copy_span(char *out, const ptrdiff_t si, const char *in, const int n, const size_t bpp)
+{
+  switch(bpp)
+  {
+    case 2:
+      for(int i = 0; i < n; i++, in += 2, out += si) memcpy(out, in, 2);
+      break;
+    case 4:
+      for(int i = 0; i < n; i++, in += 4, out += si) memcpy(out, in, 4);
+      break;
+    case 8:
+      for(int i = 0; i < n; i++, in += 8, out += si) memcpy(out, in, 8);
+      break;
+    case 16:
+      for(int i = 0; i < n; i++, in += 16, out += si) memcpy(out, in, 16);
+      break;
+    default:
+      for(int i = 0; i < n; i++, in += bpp, out += si) memcpy(out, in, bpp);
+      break;
+  }
+}
+
+DT_ALWAYS_INLINE void _flip_ui16_span(float *out, const ptrdiff_t si, const uint16_t *in, const int n, const int ch,
+                                      const float black, const float scale)
+{
+#if defined(__SSE2__)
+  if(ch == 4)
+  {
+    const __m128 blackv = _mm_set1_ps(black), scalev = _mm_set1_ps(scale);
+    const __m128i zero = _mm_setzero_si128();
+    for(int i = 0; i < n; i++, in += 4, out += si)
+    {
+      const __m128i v = _mm_unpacklo_epi16(_mm_loadl_epi64((const __m128i *)in), zero);
+      _mm_storeu_ps(out, _mm_mul_ps(_mm_sub_ps(_mm_cvtepi32_ps(v), blackv), scalev));
+    }
+    return;
   }
-#ifdef _OPENMP
-#pragma omp parallel for schedule(static) default(none) shared(in, out, jj, ii, sj, si)
 #endif
-  for(int j = 0; j < ht; j++)
+  for(int i = 0; i < n; i++, in += ch, out += si)
+    for(int k = 0; k < ch; k++) out[k] = (in[k] - black) * scale;
+}
+
+DT_ALWAYS_INLINE void _flip_ui8_span(float *out, const ptrdiff_t si, const uint8_t *in, const int n, const int ch,
+                                     const float black, const float scale)
+{
+#if defined(__SSE2__)
+  if(ch == 4)
   {
-    char *out2 = out + (size_t)labs(sj) * jj + (size_t)labs(si) * ii + (size_t)sj * j;
-    const char *in2 = in + (size_t)stride * j;
-    for(int i = 0; i < wd; i++)
+    const __m128 blackv = _mm_set1_ps(black), scalev = _mm_set1_ps(scale);
+    const __m128i zero = _mm_setzero_si128();
+    for(int i = 0; i < n; i++, in += 4, out += si)
     {
-      memcpy(out2, in2, bpp);
-      in2 += bpp;
-      out2 += si;
+      int32_t px;
+      memcpy(&px, in, sizeof(px));
+      const __m128i v = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(px), zero), zero);
+      _mm_storeu_ps(out, _mm_mul_ps(_mm_sub_ps(_mm_cvtepi32_ps(v), blackv), scalev));
     }
+    return;
   }
+#endif
+  for(int i = 0; i < n; i++, in += ch, out += si)
+    for(int k = 0; k < ch; k++) out[k] = (in[k] - black) * scale;
 }
 
-void dt_imageio_flip_buffers_ui16_to_float(float *out, const uint16_t *in, const float black,
-                                           const float white, const int ch, const int wd, const int ht,
-                                           const int fwd, const int fht, const int stride,
-                                           const dt_image_orientation_t orientation)
+void dt_imageio_flip_buffers(char *out, const char *in, const size_t bpp, const int wd, const int ht,
+                             const int fwd, const int fht, const int stride,
+                             const dt_image_orientation_t orientation)
 {
-  const float scale = 1.0f / (white - black);
   if(!orientation)
   {
 #ifdef _OPENMP
 #pragma omp parallel for schedule(static) default(none) shared(in, out)
 #endif
-    for(int j = 0; j < ht; j++)
-      for(int i = 0; i < wd; i++)
-        for(int k = 0; k < ch; k++)
-          out[4 * ((size_t)j * wd + i) + k] = (in[ch * ((size_t)j * stride + i) + k] - black) * scale;
+    for(int j = 0; j < ht; j++) memcpy(out + (size_t)j * bpp * wd, in + (size_t)j * stride, bpp * wd);
     return;
   }
-  int ii = 0, jj = 0;
-  int si = 4, sj = wd * 4;
-  if(orientation & ORIENTATION_SWAP_XY)
-  {
-    sj = 4;
-    si = ht * 4;
-  }
-  if(orientation & ORIENTATION_FLIP_X)
-  {
-    jj = (int)fht - jj - 1;
-    sj = -sj;
-  }
-  if(orientation & ORIENTATION_FLIP_Y)
-  {
-    ii = (int)fwd - ii - 1;
-    si = -si;
-  }
+  ptrdiff_t origin, si, sj;
+  _flip_steps(orientation, wd, ht, fwd, fht, bpp, &origin, &si, &sj);
+  // flips write whole rows, a transpose goes tile by tile
+  const int tile_w = (orientation & ORIENTATION_SWAP_XY) ? DT_IMAGEIO_FLIP_TILE : MAX(wd, 1);
+  const int tile_h = (orientation & ORIENTATION_SWAP_XY) ? DT_IMAGEIO_FLIP_TILE : 1;
 #ifdef _OPENMP
-#pragma omp parallel for schedule(static) default(none) shared(in, out, jj, ii, sj, si)
+#pragma omp parallel for collapse(2) schedule(static) default(none) shared(in, out, origin, sj, si)
 #endif
-  for(int j = 0; j < ht; j++)
-  {
-    float *out2 = out + (size_t)labs(sj) * jj + (size_t)labs(si) * ii + (size_t)sj * j;
-    const uint16_t *in2 = in + stride * j;
-    for(int i = 0; i < wd; i++)
-    {
-      for(int k = 0; k < ch; k++) out2[k] = (in2[k] - black) * scale;
-      in2 += ch;
-      out2 += si;
-    }
-  }
+  for(int tj = 0; tj < ht; tj += tile_h)
+    for(int ti = 0; ti < wd; ti += tile_w)
+      for(int j = tj; j < MIN(tj + tile_h, ht); j++)
+        _flip_copy_span(out + origin + sj * j + si * ti, si, in + (size_t)stride * j + bpp * ti,
+                        MIN(tile_w, wd - ti), bpp);
+}
+
+void dt_imageio_flip_buffers_ui16_to_float(float *out, const uint16_t *in, const float black,
+                                           const float white, const int ch, const int wd, const int ht,
+                                           const int fwd, const int fht, const int stride,
+                                           const dt_image_orientation_t orientation)
+{
+  const float scale = 1.0f / (white - black);
+  ptrdiff_t origin, si, sj;
+  _flip_steps(orientation, wd, ht, fwd, fht, 4, &origin, &si, &sj);
+  const int tile_w = (orientation & ORIENTATION_SWAP_XY) ? DT_IMAGEIO_FLIP_TILE : MAX(wd, 1);
+  const int tile_h = (orientation & ORIENTATION_SWAP_XY) ? DT_IMAGEIO_FLIP_TILE : 1;
+#ifdef _OPENMP
+#pragma omp parallel for collapse(2) schedule(static) default(none) shared(in, out, origin, sj, si)
+#endif
+  for(int tj = 0; tj < ht; tj += tile_h)
+    for(int ti = 0; ti < wd; ti += tile_w)
+      for(int j = tj; j < MIN(tj + tile_h, ht); j++)
+        _flip_ui16_span(out + origin + sj * j + si * ti, si, in + (size_t)stride * j + (size_t)ch * ti,
+                        MIN(tile_w, wd - ti), ch, black, scale);
 }
 
 void dt_imageio_flip_buffers_ui8_to_float(float *out, const uint8_t *in, const float black, const float white,
@@ -271,48 +325,18 @@ void dt_imageio_flip_buffers_ui8_to_float(float *out, const uint8_t *in, const f
                                           const dt_image_orientation_t orientation)
 {
   const float scale = 1.0f / (white - black);
-  if(!orientation)
-  {
-#ifdef _OPENMP
-#pragma omp parallel for schedule(static) default(none) shared(in, out)
-#endif
-    for(int j = 0; j < ht; j++)
-      for(int i = 0; i < wd; i++)
-        for(int k = 0; k < ch; k++)
-          out[4 * ((size_t)j * wd + i) + k] = (in[(size_t)j * stride + ch * i + k] - black) * scale;
-    return;
-  }
-  int ii = 0, jj = 0;
-  int si = 4, sj = wd * 4;
-  if(orientation & ORIENTATION_SWAP_XY)
-  {
-    sj = 4;
-    si = ht * 4;
-  }
-  if(orientation & ORIENTATION_FLIP_X)
-  {
-    jj = (int)fht - jj - 1;
-    sj = -sj;
-  }
-  if(orientation & ORIENTATION_FLIP_Y)
-  {
-    ii = (int)fwd - ii - 1;
-    si = -si;
-  }
+  ptrdiff_t origin, si, sj;
+  _flip_steps(orientation, wd, ht, fwd, fht, 4, &origin, &si, &sj);
+  const int tile_w = (orientation & ORIENTATION_SWAP_XY) ? DT_IMAGEIO_FLIP_TILE : MAX(wd, 1);
+  const int tile_h = (orientation & ORIENTATION_SWAP_XY) ? DT_IMAGEIO_FLIP_TILE : 1;
 #ifdef _OPENMP
-#pragma omp parallel for schedule(static) default(none) shared(in, out, jj, ii, sj, si)
+#pragma omp parallel for collapse(2) schedule(static) default(none) shared(in, out, origin, sj, si)
 #endif
-  for(int j = 0; j < ht; j++)
-  {
-    float *out2 = out + (size_t)labs(sj) * jj + (size_t)labs(si) * ii + sj * j;
-    const uint8_t *in2 = in + (size_t)stride * j;
-    for(int i = 0; i < wd; i++)
-    {
-      for(int k = 0; k < ch; k++) out2[k] = (in2[k] - black) * scale;
-      in2 += ch;
-      out2 += si;
-    }
-  }
+  for(int tj = 0; tj < ht; tj += tile_h)
+    for(int ti = 0; ti < wd; ti += tile_w)
+      for(int j = tj; j < MIN(tj + tile_h, ht); j++)
+        _flip_ui8_span(out + origin + sj * j + si * ti, si, in + (size_t)stride * j + (size_t)ch * ti,
+                       MIN(tile_w, wd - ti), ch, black, scale);
 }
 
 size_t dt_imageio_write_pos(int i, int j, int wd, int ht, float fwd, float fht,
@@ -531,27 +555,332 @@ int dt_imageio_export(const uint32_t imgid, const char *filename, dt_imageio_mod
 {
   if(strcmp(format->mime(format_params), "x-copy") == 0)
     /* This is a just a copy, skip process and just export */
-    return format->write_image(format_params, filename, NULL, NULL, 0, imgid, num, total);
+    return format->write_image(format_params, filename, NULL, NULL, 0, NULL, imgid, num, total);
   else
     return dt_imageio_export_with_flags(imgid, filename, format, format_params, 0, 0, high_quality, upscale,
                                         0, NULL, copy_metadata, storage, storage_params, num, total);
 }
 
-// internal function: to avoid exif blob reading + 8-bit byteorder flag + high-quality override
-int dt_imageio_export_with_flags(const uint32_t imgid, const char *filename,
-                                 dt_imageio_module_format_t *format, dt_imageio_module_data_t *format_params,
-                                 const int32_t ignore_exif, const int32_t display_byteorder,
-                                 const gboolean high_quality, const gboolean upscale, const int32_t thumbnail_export,
-                                 const char *filter, const gboolean copy_metadata,
-                                 dt_imageio_module_storage_t *storage,
-                                 dt_imageio_module_data_t *storage_params, int num, int total)
+// minimum border around streamed tiles, for the small neighbourhoods modules don't report to the tiling code
+#define DT_IMAGEIO_STREAMING_MIN_OVERLAP 16
+
+static int _export_process_pipe(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, const int x, const int y,
+                                const int width, const int height, const double scale, const int gamma)
+{
+  return gamma ? dt_dev_pixelpipe_process(pipe, dev, x, y, width, height, scale)
+               : dt_dev_pixelpipe_process_no_gamma(pipe, dev, x, y, width, height, scale);
+}
+
+// a format writing the image as the pipe produces it, see write_image_begin()
+typedef struct dt_imageio_export_rows_t
+{
+  dt_imageio_module_format_t *format;
+  dt_imageio_module_data_t *data;
+  void *handle;
+  int bpp;      // of the format, it gets 8 bit or the float pipe output as it is
+  int is_float; // the pipe output is float, not 8 bit
+  int display_byteorder;
+} dt_imageio_export_rows_t;
+
+// converts npixels of pipe output in place to 8 bit, in display byte order or rgb
+static void _export_to_8bit(uint8_t *const outbuf, const size_t npixels, const int is_float,
+                            const int display_byteorder)
+{
+  if(display_byteorder)
+  {
+    if(is_float)
+    {
+      const float *const inbuf = (float *)outbuf;
+      for(size_t k = 0; k < npixels; k++)
+      {
+        // convert in place, this is unfortunately very serial..
+        const uint8_t r = CLAMP(inbuf[4 * k + 2] * 0xff, 0, 0xff);
+        const uint8_t g = CLAMP(inbuf[4 * k + 1] * 0xff, 0, 0xff);
+        const uint8_t b = CLAMP(inbuf[4 * k + 0] * 0xff, 0, 0xff);
+        outbuf[4 * k + 0] = r;
+        outbuf[4 * k + 1] = g;
+        outbuf[4 * k + 2] = b;
+      }
+    }
+    // else processing output was 8-bit already, and no need to swap order
+  }
+  else // need to flip
+  {
+    // ldr output: char
+    if(is_float)
+    {
+      const float *const inbuf = (float *)outbuf;
+      for(size_t k = 0; k < npixels; k++)
+      {
+        // convert in place, this is unfortunately very serial..
+        const uint8_t r = CLAMP(inbuf[4 * k + 0] * 0xff, 0, 0xff);
+        const uint8_t g = CLAMP(inbuf[4 * k + 1] * 0xff, 0, 0xff);
+        const uint8_t b = CLAMP(inbuf[4 * k + 2] * 0xff, 0, 0xff);
+        outbuf[4 * k + 0] = r;
+        outbuf[4 * k + 1] = g;
+        outbuf[4 * k + 2] = b;
+      }
+    }
+    else
+    { // !display_byteorder, need to swap:
+      uint8_t *const buf8 = outbuf;
+#ifdef _OPENMP
+#pragma omp parallel for default(none) schedule(static)
+#endif
+      // just flip byte order
+      for(size_t k = 0; k < npixels; k++)
+      {
+        uint8_t tmp = buf8[4 * k + 0];
+        buf8[4 * k + 0] = buf8[4 * k + 2];
+        buf8[4 * k + 2] = tmp;
+      }
+    }
+  }
+}
+
+static int _export_write_rows(dt_imageio_export_rows_t *rows, uint8_t *const buf, const int width,
+                              const int first_row, const int num_rows)
+{
+  if(rows->bpp == 8) _export_to_8bit(buf, (size_t)width * num_rows, rows->is_float, rows->display_byteorder);
+  return rows->format->write_image_rows(rows->data, rows->handle, buf, first_row, num_rows);
+}
+
+// runs the export pipe. a streaming pipe goes through the image in tiles of tile_size output pixels, each
+// with enough border for the neighbourhoods of all modules, and only the inner parts of the tiles end up in
+// the output, which is allocated here then. otherwise the output is the backbuffer of the pipe.
+// with rows, the output is handed to the format instead, a row of tiles at a time when streaming, and only
+// holds that one.
+static int _export_process(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, const int width, const int height,
+                           const double scale, const int gamma, const int tile_size,
+                           dt_imageio_export_rows_t *rows, uint8_t **output)
+{
+  *output = NULL;
+  if(pipe->tile_streaming && tile_size > 0 && (width > tile_size || height > tile_size))
+    *output = dt_alloc_align(64, (size_t)4 * sizeof(float) * width * (rows ? MIN(tile_size, height) : height));
+  if(!*output)
+  {
+    pipe->tile_streaming = 0;
+    const int res = _export_process_pipe(pipe, dev, 0, 0, width, height, scale, gamma);
+    *output = pipe->backbuf;
+    if(!res && rows) return _export_write_rows(rows, *output, width, 0, height);
+    return res;
+  }
+
+  const int overlap = DT_IMAGEIO_STREAMING_MIN_OVERLAP + dt_dev_pixelpipe_streaming_overlap(pipe, dev, scale);
+  dt_print(DT_DEBUG_DEV, "[export] streaming %dx%d in tiles of %d with an overlap of %d\n", width, height,
+           tile_size, overlap);
+
+  for(int ty = 0; ty < height; ty += tile_size)
+  {
+    const int oy = rows ? ty : 0; // first row of the output
+    for(int tx = 0; tx < width; tx += tile_size)
+    {
+      const int x = MAX(0, tx - overlap), y = MAX(0, ty - overlap);
+      const int w = MIN(width, tx + tile_size + overlap) - x, h = MIN(height, ty + tile_size + overlap) - y;
+      if(_export_process_pipe(pipe, dev, x, y, w, h, scale, gamma)) return 1;
+
+      const size_t bpp = dt_iop_buffer_dsc_to_bpp(&pipe->dsc);
+      const int cp_width = MIN(tile_size, width - tx), cp_height = MIN(tile_size, height - ty);
+      const uint8_t *const in = pipe->backbuf;
+      uint8_t *const out = *output;
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static) default(none) shared(tx, ty)
+#endif
+      for(int j = 0; j < cp_height; j++)
+        memcpy(out + bpp * ((size_t)(ty - oy + j) * width + tx),
+               in + bpp * ((size_t)(ty - y + j) * w + (tx - x)), bpp * cp_width);
+    }
+    if(rows && _export_write_rows(rows, *output, width, ty, MIN(tile_size, height - ty))) return 1;
+  }
+  return 0;
+}
+
+// converts the pipe output to what a format with bpp bits per channel takes, in place
+static void _export_convert(uint8_t *const outbuf, const int width, const int height, const int bpp,
+                            const int is_float, const int display_byteorder)
 {
+  if(bpp == 8)
+    _export_to_8bit(outbuf, (size_t)width * height, is_float, display_byteorder);
+  else if(bpp == 16)
+  {
+    // uint16_t per color channel
+    float *buff = (float *)outbuf;
+    uint16_t *buf16 = (uint16_t *)outbuf;
+    for(int y = 0; y < height; y++)
+      for(int x = 0; x < width; x++)
+      {
+        // convert in place
+        const size_t k = (size_t)width * y + x;
+        for(int i = 0; i < 3; i++) buf16[4 * k + i] = CLAMP(buff[4 * k + i] * 0x10000, 0, 0xffff);
+      }
+  }
+  // else output float, no further harm done to the pixels :)
+}
+
+// writes the smaller copies of an export. they are scaled down from the float pipe output in outbuf, one after
+// the other as the resampling is parallel already, and then encoded all at once.
+static int _export_targets(dt_imageio_export_target_t *targets, const int num_targets, const float *outbuf,
+                           const int width, const int height, const int display_byteorder, const int ignore_exif,
+                           const char *xmp, const int sRGB, const uint32_t imgid,
+                           dt_imageio_module_format_t *format, dt_imageio_module_data_t *format_params,
+                           const int num, const int total)
+{
+  uint8_t **bufs = (uint8_t **)calloc(num_targets, sizeof(uint8_t *));
+  dt_imageio_module_data_t **datas = (dt_imageio_module_data_t **)calloc(num_targets, sizeof(void *));
+  int res = !bufs || !datas;
+  const struct dt_interpolation *itor = dt_interpolation_new(DT_INTERPOLATION_USERPREF);
+  for(int t = 0; t < num_targets && !res; t++)
+  {
+    dt_imageio_export_target_t *target = targets + t;
+    const double scalex = target->max_width > 0 ? target->max_width / (double)width : 1.0;
+    const double scaley = target->max_height > 0 ? target->max_height / (double)height : 1.0;
+    const double scale = fmin(fmin(scalex, scaley), 1.0);
+    target->width = MAX(scale * width + .5, 1);
+    target->height = MAX(scale * height + .5, 1);
+
+    // every encoder needs its own format data, the jpeg one keeps its state in there
+    dt_imageio_module_format_t *tformat = target->format ? target->format : format;
+    datas[t] = target->format ? target->format_params : format->get_params(format);
+    bufs[t] = dt_alloc_align(64, (size_t)4 * sizeof(float) * target->width * target->height);
+    if(!datas[t] || !bufs[t])
+    {
+      res = 1;
+      break;
+    }
+    if(!target->format) memcpy(datas[t], format_params, format->params_size(format));
+    datas[t]->max_width = target->max_width;
+    datas[t]->max_height = target->max_height;
+    datas[t]->width = target->width;
+    datas[t]->height = target->height;
+
+    const dt_iop_roi_t roi_in = { 0, 0, width, height, 1.0f };
+    const dt_iop_roi_t roi_out = { 0, 0, target->width, target->height, scale };
+    dt_interpolation_resample(itor, (float *)bufs[t], &roi_out, target->width * 4 * sizeof(float), outbuf,
+                              &roi_in, width * 4 * sizeof(float));
+    _export_convert(bufs[t], target->width, target->height, tformat->bpp(datas[t]), 1, display_byteorder);
+  }
+
+  if(!res)
+  {
+#ifdef _OPENMP
+#pragma omp parallel for default(none) schedule(dynamic) reduction(|| : res) shared(targets, bufs, datas, format, xmp)
+#endif
+    for(int t = 0; t < num_targets; t++)
+    {
+      const dt_imageio_export_target_t *target = targets + t;
+      dt_imageio_module_format_t *tformat = target->format ? target->format : format;
+      int length = 0;
+      uint8_t *exif_profile = NULL;
+      if(!ignore_exif)
+      {
+        char pathname[PATH_MAX] = { 0 };
+        gboolean from_cache = TRUE;
+        dt_image_full_path(imgid, pathname, sizeof(pathname), &from_cache);
+        length = dt_exif_read_blob(&exif_profile, pathname, imgid, sRGB, target->width, target->height, 0);
+      }
+      const char *target_xmp = (tformat->flags(datas[t]) & FORMAT_FLAGS_EMBED_XMP) ? xmp : NULL;
+      res = res
+            || tformat->write_image(datas[t], target->filename, bufs[t], exif_profile, length, target_xmp, imgid,
+                                    num, total);
+      free(exif_profile);
+    }
+  }
+
+  for(int t = 0; t < num_targets && bufs && datas; t++)
+  {
+    dt_free_align(bufs[t]);
+    if(datas[t] && !targets[t].format) format->free_params(format, datas[t]);
+  }
+  free(bufs);
+  free(datas);
+  return res;
+}
+
+// the dev and pipe of the last image a thread exported, kept between dt_imageio_export_pool_begin() and
+// dt_imageio_export_pool_end() for the next one. module instances, their pipe nodes and the pipe buffers
+// are set up once for the batch, not once per image.
+typedef struct dt_imageio_export_pool_t
+{
+  int dev_valid, pipe_valid;
+  int tile_size; // the pipe was set up for
   dt_develop_t dev;
-  dt_dev_init(&dev, 0);
-  dt_dev_load_image(&dev, imgid);
+  dt_dev_pixelpipe_t pipe;
+  // stats
+  int exported, nodes_reused;
+} dt_imageio_export_pool_t;
+
+static __thread dt_imageio_export_pool_t *_export_pool = NULL;
+
+static void _export_pool_drop(dt_imageio_export_pool_t *pool)
+{
+  if(pool->pipe_valid) dt_dev_pixelpipe_cleanup(&pool->pipe);
+  if(pool->dev_valid) dt_dev_cleanup(&pool->dev);
+  pool->pipe_valid = pool->dev_valid = 0;
+}
+
+// dt_dev_load_next_image() drops all but one instance of every module
+static int _export_has_instances(const dt_develop_t *dev)
+{
+  for(const GList *modules = dev->iop; modules; modules = g_list_next(modules))
+    if(((const dt_iop_module_t *)modules->data)->multi_priority > 0) return 1;
+  return 0;
+}
 
+void dt_imageio_export_pool_begin(void)
+{
+  if(_export_pool) return;
+  _export_pool = (dt_imageio_export_pool_t *)calloc(1, sizeof(dt_imageio_export_pool_t));
+}
+
+void dt_imageio_export_pool_end(void)
+{
+  dt_imageio_export_pool_t *pool = _export_pool;
+  if(!pool) return;
+  _export_pool = NULL;
+  dt_print(DT_DEBUG_DEV, "[export] %d images from one dev, the pipe nodes reused for %d of them\n",
+           pool->exported, pool->nodes_reused);
+  _export_pool_drop(pool);
+  free(pool);
+}
+
+// internal function: to avoid exif blob reading + 8-bit byteorder flag + high-quality override
+static int _export_with_flags(const uint32_t imgid, const char *filename, dt_imageio_module_format_t *format,
+                              dt_imageio_module_data_t *format_params, const int32_t ignore_exif,
+                              const int32_t display_byteorder, const gboolean high_quality,
+                              const gboolean upscale, const int32_t thumbnail_export, const char *filter,
+                              const gboolean copy_metadata, dt_imageio_module_storage_t *storage,
+                              dt_imageio_module_data_t *storage_params, int num, int total,
+                              dt_imageio_export_target_t *targets, const int num_targets)
+{
+  // exports of a batch take over the dev and pipe the last image of the thread left in the pool
+  dt_imageio_export_pool_t *pool = thumbnail_export ? NULL : _export_pool;
+  dt_develop_t local_dev;
+  dt_dev_pixelpipe_t local_pipe;
+  dt_develop_t *dev = pool ? &pool->dev : &local_dev;
+  dt_dev_pixelpipe_t *pipe = pool ? &pool->pipe : &local_pipe;
+  if(pool && pool->dev_valid)
+  {
+    // the nodes are of modules the next image might not have, they go first then
+    if(pool->pipe_valid && _export_has_instances(dev)) dt_dev_pixelpipe_cleanup_nodes(pipe);
+    dt_dev_load_next_image(dev, imgid);
+  }
+  else
+  {
+    dt_dev_init(dev, 0);
+    dt_dev_load_image(dev, imgid);
+    if(pool) pool->dev_valid = 1;
+  }
+
+  // thumbnails at most half the size of mip f are processed from that, the mosaic binned 2x2 (3x3 for
+  // x-trans) to fit it. the pipe then works on a fraction of the pixels from the start, and the thumbnail
+  // still has its full resolution unless the image is cropped to less than half.
+  const int mipf_width = darktable.mipmap_cache->max_width[DT_MIPMAP_F];
+  const int mipf_height = darktable.mipmap_cache->max_height[DT_MIPMAP_F];
+  const int small_thumbnail = thumbnail_export && format_params->max_width > 0 && format_params->max_height > 0
+                              && 2 * format_params->max_width <= mipf_width
+                              && 2 * format_params->max_height <= mipf_height;
   const int buf_is_downscaled
-      = (thumbnail_export && dt_conf_get_bool("plugins/lighttable/low_quality_thumbnails"));
+      = (thumbnail_export && (small_thumbnail || dt_conf_get_bool("plugins/lighttable/low_quality_thumbnails")));
 
   dt_mipmap_buffer_t buf;
   if(buf_is_downscaled)
@@ -559,7 +888,7 @@ int dt_imageio_export_with_flags(const uint32_t imgid, const char *filename,
   else
     dt_mipmap_cache_get(darktable.mipmap_cache, &buf, imgid, DT_MIPMAP_FULL, DT_MIPMAP_BLOCKING, 'r');
 
-  const dt_image_t *img = &dev.image_storage;
+  const dt_image_t *img = &dev->image_storage;
 
   if(!buf.buf || !buf.width || !buf.height)
   {
@@ -576,9 +905,33 @@ int dt_imageio_export_with_flags(const uint32_t imgid, const char *filename,
 
   dt_times_t start;
   dt_get_times(&start);
-  dt_dev_pixelpipe_t pipe;
-  res = thumbnail_export ? dt_dev_pixelpipe_init_thumbnail(&pipe, wd, ht)
-                         : dt_dev_pixelpipe_init_export(&pipe, wd, ht, format->levels(format_params));
+  const int tile_size = thumbnail_export ? 0 : dt_conf_get_int("plugins/lighttable/export/streaming_tile_size");
+  const int levels = thumbnail_export ? 0 : format->levels(format_params);
+  if(pool && pool->pipe_valid && (pool->tile_size > 0) != (tile_size > 0))
+  {
+    dt_dev_pixelpipe_cleanup(pipe);
+    pool->pipe_valid = 0;
+  }
+  const int reuse_pipe = pool && pool->pipe_valid;
+  if(reuse_pipe)
+  {
+    // the buffers stay, what they hold was of the last image
+    dt_dev_pixelpipe_cache_flush(&pipe->cache);
+    pipe->levels = levels;
+    pipe->tile_streaming = tile_size > 0;
+    res = 1;
+  }
+  else if(thumbnail_export)
+    res = dt_dev_pixelpipe_init_thumbnail(pipe, wd, ht);
+  else if(tile_size > 0)
+    res = dt_dev_pixelpipe_init_export_streaming(pipe, levels);
+  else
+    res = dt_dev_pixelpipe_init_export(pipe, wd, ht, levels);
+  if(pool && res)
+  {
+    pool->pipe_valid = 1;
+    pool->tile_size = tile_size;
+  }
   if(!res)
   {
     dt_control_log(
@@ -601,7 +954,7 @@ int dt_imageio_export_with_flags(const uint32_t imgid, const char *filename,
     }
 
     // remove everything above history_end
-    GList *history = g_list_nth(dev.history, dev.history_end);
+    GList *history = g_list_nth(dev->history, dev->history_end);
     while(history)
     {
       GList *next = g_list_next(history);
@@ -609,7 +962,7 @@ int dt_imageio_export_with_flags(const uint32_t imgid, const char *filename,
       free(hist->params);
       free(hist->blend_params);
       free(history->data);
-      dev.history = g_list_delete_link(dev.history, history);
+      dev->history = g_list_delete_link(dev->history, history);
       history = next;
     }
 
@@ -619,7 +972,7 @@ int dt_imageio_export_with_flags(const uint32_t imgid, const char *filename,
       dt_style_item_t *s = (dt_style_item_t *)stls->data;
       gboolean module_found = FALSE;
 
-      GList *modules = dev.iop;
+      GList *modules = dev->iop;
       while(modules)
       {
         m = (dt_iop_module_t *)modules->data;
@@ -657,8 +1010,8 @@ int dt_imageio_export_with_flags(const uint32_t imgid, const char *filename,
             h->params = new_params;
           }
 
-          dev.history_end++;
-          dev.history = g_list_append(dev.history, h);
+          dev->history_end++;
+          dev->history = g_list_append(dev->history, h);
           module_found = TRUE;
           g_free(s->name);
           break;
@@ -671,18 +1024,26 @@ int dt_imageio_export_with_flags(const uint32_t imgid, const char *filename,
     g_list_free(stls);
   }
 
-  dt_dev_pixelpipe_set_input(&pipe, &dev, (float *)buf.buf, buf.width, buf.height, buf.iscale);
-  dt_dev_pixelpipe_create_nodes(&pipe, &dev);
-  dt_dev_pixelpipe_synch_all(&pipe, &dev);
+  dt_dev_pixelpipe_set_input(pipe, dev, (float *)buf.buf, buf.width, buf.height, buf.iscale);
+  if(reuse_pipe)
+    pool->nodes_reused += dt_dev_pixelpipe_renew_nodes(pipe, dev);
+  else
+    dt_dev_pixelpipe_create_nodes(pipe, dev);
+  dt_dev_pixelpipe_synch_all(pipe, dev);
 
   if(filter)
   {
-    if(!strncmp(filter, "pre:", 4)) dt_dev_pixelpipe_disable_after(&pipe, filter + 4);
-    if(!strncmp(filter, "post:", 5)) dt_dev_pixelpipe_disable_before(&pipe, filter + 5);
+    if(!strncmp(filter, "pre:", 4)) dt_dev_pixelpipe_disable_after(pipe, filter + 4);
+    if(!strncmp(filter, "post:", 5)) dt_dev_pixelpipe_disable_before(pipe, filter + 5);
   }
 
-  dt_dev_pixelpipe_get_dimensions(&pipe, &dev, pipe.iwidth, pipe.iheight, &pipe.processed_width,
-                                  &pipe.processed_height);
+  dt_dev_pixelpipe_get_dimensions(pipe, dev, pipe->iwidth, pipe->iheight, &pipe->processed_width,
+                                  &pipe->processed_height);
+
+  // every module that needs its full input keeps a full size buffer around, too many of them and
+  // streaming is pointless
+  if(pipe->tile_streaming && dt_dev_pixelpipe_streaming_barriers(pipe, dev) > DT_DEV_PIXELPIPE_STREAMING_MAX_BARRIERS)
+    pipe->tile_streaming = 0;
 
   dt_show_times(&start, "[export] creating pixelpipe", NULL);
 
@@ -695,7 +1056,7 @@ int dt_imageio_export_with_flags(const uint32_t imgid, const char *filename,
   }
   else if(icctype == DT_COLORSPACE_NONE)
   {
-    GList *modules = dev.iop;
+    GList *modules = dev->iop;
     dt_iop_module_t *colorout = NULL;
     while(modules)
     {
@@ -716,22 +1077,57 @@ int dt_imageio_export_with_flags(const uint32_t imgid, const char *filename,
 
   // get only once at the beginning, in case the user changes it on the way:
   const gboolean high_quality_processing
-      = ((format_params->max_width == 0 || format_params->max_width >= pipe.processed_width)
-         && (format_params->max_height == 0 || format_params->max_height >= pipe.processed_height))
+      = ((format_params->max_width == 0 || format_params->max_width >= pipe->processed_width)
+         && (format_params->max_height == 0 || format_params->max_height >= pipe->processed_height))
             ? FALSE
             : high_quality;
 
   const int width = format_params->max_width;
   const int height = format_params->max_height;
-  const double scalex = width > 0 ? fminf(width / (double)pipe.processed_width, max_scale) : 1.0;
-  const double scaley = height > 0 ? fminf(height / (double)pipe.processed_height, max_scale) : 1.0;
+  const double scalex = width > 0 ? fminf(width / (double)pipe->processed_width, max_scale) : 1.0;
+  const double scaley = height > 0 ? fminf(height / (double)pipe->processed_height, max_scale) : 1.0;
   const double scale = fminf(scalex, scaley);
 
-  const int processed_width = scale * pipe.processed_width + .5f;
-  const int processed_height = scale * pipe.processed_height + .5f;
+  const int processed_width = scale * pipe->processed_width + .5f;
+  const int processed_height = scale * pipe->processed_height + .5f;
 
   const int bpp = format->bpp(format_params);
 
+  format_params->width = processed_width;
+  format_params->height = processed_height;
+
+  // the smaller copies are resampled from the float output of the pipe, before finalscale if the export is
+  // resampled late. they need all of it, so the format doesn't get it row by row then.
+  const int float_output = high_quality_processing || num_targets;
+
+  // the metadata goes to the format before the image, a streaming one writes it first
+  int exif_len = 0;
+  uint8_t *exif_profile = NULL; // Exif data should be 65536 bytes max, but if original size is close to that,
+                                // adding new tags could make it go over that... so let it be and see what
+                                // happens when we write the image
+  if(!ignore_exif)
+  {
+    char pathname[PATH_MAX] = { 0 };
+    gboolean from_cache = TRUE;
+    dt_image_full_path(imgid, pathname, sizeof(pathname), &from_cache);
+    // last param is dng mode, it's false here
+    exif_len = dt_exif_read_blob(&exif_profile, pathname, imgid, sRGB, processed_width, processed_height, 0);
+  }
+  // formats that can embed the xmp packet write it while encoding, the others get it attached afterwards
+  char *xmp = NULL;
+  if(copy_metadata && (format->flags(format_params) & FORMAT_FLAGS_EMBED_XMP))
+    xmp = dt_exif_xmp_read_export(imgid);
+
+  // formats that take the image row by row get it straight from the pipe, a streaming one then never holds
+  // all of it
+  dt_imageio_export_rows_t rows
+      = { format, format_params, NULL, bpp, float_output, display_byteorder };
+  if((bpp == 8 || bpp == 32) && format->write_image_begin && !num_targets)
+    rows.handle = format->write_image_begin(format_params, filename, exif_profile, exif_len, xmp, imgid, num,
+                                            total);
+
+  uint8_t *outbuf = NULL;
+  int failed = 0;
   dt_get_times(&start);
   if(high_quality_processing)
   {
@@ -739,7 +1135,8 @@ int dt_imageio_export_with_flags(const uint32_t imgid, const char *filename,
      * if high quality processing was requested, downsampling will be done
      * at the very end of the pipe (just before border and watermark)
      */
-    dt_dev_pixelpipe_process_no_gamma(&pipe, &dev, 0, 0, processed_width, processed_height, scale);
+    failed = _export_process(pipe, dev, processed_width, processed_height, scale, FALSE, tile_size,
+                             rows.handle ? &rows : NULL, &outbuf);
   }
   else
   {
@@ -750,7 +1147,7 @@ int dt_imageio_export_with_flags(const uint32_t imgid, const char *filename,
     // find the finalscale module
     dt_dev_pixelpipe_iop_t *finalscale = NULL;
     {
-      GList *nodes = g_list_last(pipe.nodes);
+      GList *nodes = g_list_last(pipe->nodes);
       while(nodes)
       {
         dt_dev_pixelpipe_iop_t *node = (dt_dev_pixelpipe_iop_t *)(nodes->data);
@@ -766,10 +1163,8 @@ int dt_imageio_export_with_flags(const uint32_t imgid, const char *filename,
     if(finalscale) finalscale->enabled = 0;
 
     // do the processing (8-bit with special treatment, to make sure we can use openmp further down):
-    if(bpp == 8)
-      dt_dev_pixelpipe_process(&pipe, &dev, 0, 0, processed_width, processed_height, scale);
-    else
-      dt_dev_pixelpipe_process_no_gamma(&pipe, &dev, 0, 0, processed_width, processed_height, scale);
+    failed = _export_process(pipe, dev, processed_width, processed_height, scale, bpp == 8 && !float_output,
+                             tile_size, rows.handle ? &rows : NULL, &outbuf);
 
     if(finalscale) finalscale->enabled = 1;
   }
@@ -777,111 +1172,40 @@ int dt_imageio_export_with_flags(const uint32_t imgid, const char *filename,
                                          : "[dev_process_export] pixel pipeline processing",
                 NULL);
 
-  uint8_t *outbuf = pipe.backbuf;
+  const int targets_failed
+      = num_targets
+        && (failed
+            || _export_targets(targets, num_targets, (const float *)outbuf, processed_width, processed_height,
+                               display_byteorder, ignore_exif, xmp, sRGB, imgid, format, format_params, num,
+                               total));
 
   // downconversion to low-precision formats:
-  if(bpp == 8)
-  {
-    if(display_byteorder)
-    {
-      if(high_quality_processing)
-      {
-        const float *const inbuf = (float *)outbuf;
-        for(size_t k = 0; k < (size_t)processed_width * processed_height; k++)
-        {
-          // convert in place, this is unfortunately very serial..
-          const uint8_t r = CLAMP(inbuf[4 * k + 2] * 0xff, 0, 0xff);
-          const uint8_t g = CLAMP(inbuf[4 * k + 1] * 0xff, 0, 0xff);
-          const uint8_t b = CLAMP(inbuf[4 * k + 0] * 0xff, 0, 0xff);
-          outbuf[4 * k + 0] = r;
-          outbuf[4 * k + 1] = g;
-          outbuf[4 * k + 2] = b;
-        }
-      }
-      // else processing output was 8-bit already, and no need to swap order
-    }
-    else // need to flip
-    {
-      // ldr output: char
-      if(high_quality_processing)
-      {
-        const float *const inbuf = (float *)outbuf;
-        for(size_t k = 0; k < (size_t)processed_width * processed_height; k++)
-        {
-          // convert in place, this is unfortunately very serial..
-          const uint8_t r = CLAMP(inbuf[4 * k + 0] * 0xff, 0, 0xff);
-          const uint8_t g = CLAMP(inbuf[4 * k + 1] * 0xff, 0, 0xff);
-          const uint8_t b = CLAMP(inbuf[4 * k + 2] * 0xff, 0, 0xff);
-          outbuf[4 * k + 0] = r;
-          outbuf[4 * k + 1] = g;
-          outbuf[4 * k + 2] = b;
-        }
-      }
-      else
-      { // !display_byteorder, need to swap:
-        uint8_t *const buf8 = pipe.backbuf;
-#ifdef _OPENMP
-#pragma omp parallel for default(none) schedule(static)
-#endif
-        // just flip byte order
-        for(size_t k = 0; k < (size_t)processed_width * processed_height; k++)
-        {
-          uint8_t tmp = buf8[4 * k + 0];
-          buf8[4 * k + 0] = buf8[4 * k + 2];
-          buf8[4 * k + 2] = tmp;
-        }
-      }
-    }
-  }
-  else if(bpp == 16)
-  {
-    // uint16_t per color channel
-    float *buff = (float *)outbuf;
-    uint16_t *buf16 = (uint16_t *)outbuf;
-    for(int y = 0; y < processed_height; y++)
-      for(int x = 0; x < processed_width; x++)
-      {
-        // convert in place
-        const size_t k = (size_t)processed_width * y + x;
-        for(int i = 0; i < 3; i++) buf16[4 * k + i] = CLAMP(buff[4 * k + i] * 0x10000, 0, 0xffff);
-      }
-  }
-  // else output float, no further harm done to the pixels :)
-
-  format_params->width = processed_width;
-  format_params->height = processed_height;
+  if(!rows.handle)
+    _export_convert(outbuf, processed_width, processed_height, bpp, float_output, display_byteorder);
 
-  if(!ignore_exif)
-  {
-    int length;
-    uint8_t *exif_profile = NULL; // Exif data should be 65536 bytes max, but if original size is close to that,
-                                  // adding new tags could make it go over that... so let it be and see what
-                                  // happens when we write the image
-    char pathname[PATH_MAX] = { 0 };
-    gboolean from_cache = TRUE;
-    dt_image_full_path(imgid, pathname, sizeof(pathname), &from_cache);
-    // last param is dng mode, it's false here
-    length = dt_exif_read_blob(&exif_profile, pathname, imgid, sRGB, processed_width, processed_height, 0);
-
-    res = format->write_image(format_params, filename, outbuf, exif_profile, length, imgid, num, total);
+  if(rows.handle)
+    res = format->write_image_end(format_params, rows.handle, failed);
+  else
+    res = format->write_image(format_params, filename, outbuf, exif_profile, exif_len, xmp, imgid, num, total);
+  free(exif_profile);
 
-    free(exif_profile);
-  }
+  if(pipe->tile_streaming) dt_free_align(outbuf);
+  if(pool)
+    pool->exported++;
   else
   {
-    res = format->write_image(format_params, filename, outbuf, NULL, 0, imgid, num, total);
+    dt_dev_pixelpipe_cleanup(pipe);
+    dt_dev_cleanup(dev);
   }
-
-  dt_dev_pixelpipe_cleanup(&pipe);
-  dt_dev_cleanup(&dev);
   dt_mipmap_cache_release(darktable.mipmap_cache, &buf);
 
   /* now write xmp into that container, if possible */
-  if(copy_metadata && (format->flags(format_params) & FORMAT_FLAGS_SUPPORT_XMP))
+  if(copy_metadata && !xmp && (format->flags(format_params) & FORMAT_FLAGS_SUPPORT_XMP))
   {
     dt_exif_xmp_attach(imgid, filename);
     // no need to cancel the export if this fail
   }
+  g_free(xmp);
 
   if(!thumbnail_export && strcmp(format->mime(format_params), "memory")
     && !(format->flags(format_params) & FORMAT_FLAGS_NO_TMPFILE))
@@ -890,16 +1214,47 @@ int dt_imageio_export_with_flags(const uint32_t imgid, const char *filename,
                             format_params, storage, storage_params);
   }
 
-  return res;
+  return res ? res : targets_failed;
 
 error:
-  dt_dev_pixelpipe_cleanup(&pipe);
+  if(!pool) dt_dev_pixelpipe_cleanup(pipe);
 error_early:
-  dt_dev_cleanup(&dev);
+  // a pooled dev might be half way through the style, better start over
+  if(pool)
+    _export_pool_drop(pool);
+  else
+    dt_dev_cleanup(dev);
   dt_mipmap_cache_release(darktable.mipmap_cache, &buf);
   return 1;
 }
 
+int dt_imageio_export_with_flags(const uint32_t imgid, const char *filename,
+                                 dt_imageio_module_format_t *format, dt_imageio_module_data_t *format_params,
+                                 const int32_t ignore_exif, const int32_t display_byteorder,
+                                 const gboolean high_quality, const gboolean upscale, const int32_t thumbnail_export,
+                                 const char *filter, const gboolean copy_metadata,
+                                 dt_imageio_module_storage_t *storage,
+                                 dt_imageio_module_data_t *storage_params, int num, int total)
+{
+  return _export_with_flags(imgid, filename, format, format_params, ignore_exif, display_byteorder, high_quality,
+                            upscale, thumbnail_export, filter, copy_metadata, storage, storage_params, num, total,
+                            NULL, 0);
+}
+
+int dt_imageio_export_multi(const uint32_t imgid, const char *filename, dt_imageio_module_format_t *format,
+                            dt_imageio_module_data_t *format_params, const gboolean high_quality,
+                            const gboolean upscale, const gboolean copy_metadata,
+                            dt_imageio_module_storage_t *storage, dt_imageio_module_data_t *storage_params, int num,
+                            int total, dt_imageio_export_target_t *targets, const int num_targets)
+{
+  if(strcmp(format->mime(format_params), "x-copy") == 0)
+    return 1;
+  for(int t = 0; t < num_targets; t++)
+    if(targets[t].format && strcmp(targets[t].format->mime(targets[t].format_params), "x-copy") == 0) return 1;
+  return _export_with_flags(imgid, filename, format, format_params, 0, 0, high_quality, upscale, 0, NULL,
+                            copy_metadata, storage, storage_params, num, total, targets, num_targets);
+}
+
 
 // fallback read method in case file could not be opened yet.
 // use GraphicsMagick (if supported) to read exotic LDRs
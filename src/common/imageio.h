@@ -78,6 +78,29 @@ int dt_imageio_export_with_flags(const uint32_t imgid, const char *filename,
                                  const gboolean copy_metadata, dt_imageio_module_storage_t *storage,
                                  dt_imageio_module_data_t *storage_params, int num, int total);
 
+/** a smaller copy of an export, resampled from the output of the same pipe run. */
+typedef struct dt_imageio_export_target_t
+{
+  const char *filename;
+  struct dt_imageio_module_format_t *format;      // NULL for the format of the export
+  struct dt_imageio_module_data_t *format_params; // of format, not touched but for the sizes
+  int max_width, max_height; // the box it is scaled down into, it isn't scaled up
+  int width, height;         // what it ended up with
+} dt_imageio_export_target_t;
+
+/** dt_imageio_export() that also writes the targets. the pipe runs once for the export, the targets are
+ * resampled from its float output and encoded in parallel. the x-copy format can't do that and fails. */
+int dt_imageio_export_multi(const uint32_t imgid, const char *filename, struct dt_imageio_module_format_t *format,
+                            struct dt_imageio_module_data_t *format_params, const gboolean high_quality,
+                            const gboolean upscale, const gboolean copy_metadata,
+                            dt_imageio_module_storage_t *storage, dt_imageio_module_data_t *storage_params, int num,
+                            int total, dt_imageio_export_target_t *targets, const int num_targets);
+
+/** between these two the exports on the calling thread keep their dev and pipe for the next image, instead of
+ * setting up the modules, the pipe nodes and the pipe buffers again for every one. thumbnails are left out. */
+void dt_imageio_export_pool_begin(void);
+void dt_imageio_export_pool_end(void);
+
 size_t dt_imageio_write_pos(int i, int j, int wd, int ht, float fwd, float fht,
                             dt_image_orientation_t orientation);
 
@@ -96,9 +119,12 @@ void dt_imageio_flip_buffers_ui8_to_float(float *out, const uint8_t *in, const f
                                           const int fht, const int stride,
                                           const dt_image_orientation_t orientation);
 
-// allocate buffer and return 0 on success along with largest jpg thumbnail from raw.
+// allocate buffer and return 0 on success along with largest jpg thumbnail from raw. jpeg thumbnails are
+// decoded at the smallest of 1/1 to 1/8 of their size that still covers their fit into fit_width x fit_height,
+// pass 0 for the full size.
 int dt_imageio_large_thumbnail(const char *filename, uint8_t **buffer, int32_t *width, int32_t *height,
-                               dt_colorspaces_color_profile_type_t *color_space);
+                               dt_colorspaces_color_profile_type_t *color_space, const int32_t fit_width,
+                               const int32_t fit_height);
 
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
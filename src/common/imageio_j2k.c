@@ -42,6 +42,34 @@ static char J2K_HEAD[] = { 0xFF, 0x4F, 0xFF, 0x51, 0x00 };
 
 static void color_sycc_to_rgb(opj_image_t *img);
 
+// decodes with as many threads as darktable uses, the code blocks of a tile in parallel since openjpeg 2.2.
+// has to be called between opj_setup_decoder() and opj_read_header().
+static void _j2k_set_threads(opj_codec_t *d_codec)
+{
+#if defined(OPJ_VERSION_MAJOR) && (OPJ_VERSION_MAJOR > 2 || (OPJ_VERSION_MAJOR == 2 && OPJ_VERSION_MINOR >= 2))
+  if(opj_has_thread_support()) opj_codec_set_threads(d_codec, dt_get_num_threads());
+#endif
+}
+
+// the number of times the image can be halved for decoding, staying at least fit_width x fit_height if these
+// are > 0. every halving needs one of the resolution levels the code stream has.
+static int _j2k_reduce_factor(opj_codec_t *d_codec, const opj_image_t *image, const int fit_width,
+                              const int fit_height)
+{
+  opj_codestream_info_v2_t *info = opj_get_cstr_info(d_codec);
+  if(!info) return 0;
+  const opj_tccp_info_t *const tccp = info->m_default_tile_info.tccp_info;
+  const int numresolutions = tccp ? tccp[0].numresolutions : 1;
+  opj_destroy_cstr_info(&info);
+
+  const int width = image->x1 - image->x0, height = image->y1 - image->y0;
+  int reduce = 0;
+  while(reduce + 1 < numresolutions && (width >> (reduce + 1)) >= MAX(fit_width, 1)
+        && (height >> (reduce + 1)) >= MAX(fit_height, 1))
+    reduce++;
+  return reduce;
+}
+
 /**
 sample error callback expecting a FILE* client object
 */
@@ -171,6 +199,7 @@ dt_imageio_retval_t dt_imageio_open_j2k(dt_image_t *img, const char *filename, d
     opj_destroy_codec(d_codec);
     return DT_IMAGEIO_FILE_CORRUPTED;
   }
+  _j2k_set_threads(d_codec);
 
   d_stream = opj_stream_create_default_file_stream(parameters.infile, 1);
   if(!d_stream)
@@ -309,6 +338,92 @@ end_of_the_world:
   return ret;
 }
 
+int dt_imageio_j2k_thumbnail(const char *filename, uint8_t **buffer, int32_t *width, int32_t *height,
+                             dt_colorspaces_color_profile_type_t *color_space, const int fit_width,
+                             const int fit_height)
+{
+  opj_dparameters_t parameters;
+  opj_image_t *image = NULL;
+  unsigned char src_header[12] = { 0 };
+  OPJ_CODEC_FORMAT codec;
+  int res = 1;
+  *buffer = NULL;
+
+  FILE *fsrc = g_fopen(filename, "rb");
+  if(!fsrc) return 1;
+  const size_t header_len = fread(src_header, 1, 12, fsrc);
+  fclose(fsrc);
+  if(header_len != 12) return 1;
+
+  if(memcmp(JP2_HEAD, src_header, sizeof(JP2_HEAD)) == 0 || memcmp(JP2_MAGIC, src_header, sizeof(JP2_MAGIC)) == 0)
+    codec = OPJ_CODEC_JP2;
+  else if(memcmp(J2K_HEAD, src_header, sizeof(J2K_HEAD)) == 0)
+    codec = OPJ_CODEC_J2K;
+  else
+    return 1;
+
+  opj_set_default_decoder_parameters(&parameters);
+  opj_codec_t *d_codec = opj_create_decompress(codec);
+  if(!d_codec) return 1;
+  opj_set_error_handler(d_codec, error_callback, stderr);
+  if(!opj_setup_decoder(d_codec, &parameters))
+  {
+    opj_destroy_codec(d_codec);
+    return 1;
+  }
+  _j2k_set_threads(d_codec);
+
+  opj_stream_t *d_stream = opj_stream_create_default_file_stream(filename, 1);
+  if(!d_stream)
+  {
+    opj_destroy_codec(d_codec);
+    return 1;
+  }
+
+  // only the resolution levels it takes to fill the thumbnail are decoded
+  const int ok = opj_read_header(d_stream, d_codec, &image)
+                 && opj_set_decoded_resolution_factor(d_codec,
+                                                      _j2k_reduce_factor(d_codec, image, fit_width, fit_height))
+                 && opj_decode(d_codec, d_stream, image) && opj_end_decompress(d_codec, d_stream);
+  opj_stream_destroy(d_stream);
+  if(!ok || !image || image->numcomps == 0) goto end;
+
+  // the thumbnail has to be srgb, anything else goes through the pipe
+  if(image->icc_profile_buf) goto end;
+  if(image->color_space == OPJ_CLRSPC_SYCC) color_sycc_to_rgb(image);
+
+  const int numcomps = image->numcomps < 3 ? 1 : 3;
+  const int wd = image->comps[0].w, ht = image->comps[0].h;
+  long signed_offsets[3] = { 0, 0, 0 };
+  float scales[3] = { 1.0f, 1.0f, 1.0f };
+  for(int k = 0; k < numcomps; k++)
+  {
+    if(image->comps[k].w != wd || image->comps[k].h != ht || image->comps[k].prec > 16) goto end;
+    if(image->comps[k].sgnd) signed_offsets[k] = 1 << (image->comps[k].prec - 1);
+    scales[k] = 255.0f / ((1 << image->comps[k].prec) - 1);
+  }
+
+  *buffer = (uint8_t *)malloc(sizeof(uint8_t) * 4 * wd * ht);
+  if(!*buffer) goto end;
+  for(size_t i = 0; i < (size_t)wd * ht; i++)
+    for(int c = 0; c < 3; c++)
+    {
+      const int k = numcomps == 1 ? 0 : c;
+      const float v = (image->comps[k].data[i] + signed_offsets[k]) * scales[k];
+      (*buffer)[4 * i + c] = CLAMP(v + 0.5f, 0, 255);
+    }
+
+  *width = wd;
+  *height = ht;
+  *color_space = DT_COLORSPACE_SRGB;
+  res = 0;
+
+end:
+  opj_destroy_codec(d_codec);
+  opj_image_destroy(image);
+  return res;
+}
+
 int dt_imageio_j2k_read_profile(const char *filename, uint8_t **out)
 {
   opj_dparameters_t parameters; /* decompression parameters */
@@ -378,6 +493,7 @@ int dt_imageio_j2k_read_profile(const char *filename, uint8_t **out)
     fprintf(stderr, "[j2k_read_profile] Error: failed to setup the decoder %s\n", parameters.infile);
     return DT_IMAGEIO_FILE_CORRUPTED;
   }
+  _j2k_set_threads(d_codec);
 
   d_stream = opj_stream_create_default_file_stream(parameters.infile, 1);
   if(!d_stream)
@@ -396,6 +512,11 @@ int dt_imageio_j2k_read_profile(const char *filename, uint8_t **out)
     return EXIT_FAILURE;
   }
 
+  // the profile is only copied to the image by decoding, make that as cheap as it gets: the smallest
+  // resolution of a single pixel, which is one code block of the first tile
+  opj_set_decoded_resolution_factor(d_codec, _j2k_reduce_factor(d_codec, image, 0, 0));
+  opj_set_decode_area(d_codec, image, image->x0, image->y0, image->x0 + 1, image->y0 + 1);
+
   /* Get the decoded image */
   if(!(opj_decode(d_codec, d_stream, image) && opj_end_decompress(d_codec, d_stream)))
   {
@@ -406,10 +527,9 @@ int dt_imageio_j2k_read_profile(const char *filename, uint8_t **out)
     return DT_IMAGEIO_FILE_CORRUPTED;
   }
 
-  // FIXME: how to do it without fully-decoding the whole image?
   // opj_jp2_decode() copies the icc_profile_{buf,len}
   // from opj_codec_t *d_codec d_codec->color into opj_image_t *image, but
-  // opj_codec_t is private type.
+  // opj_codec_t is private type. so a tiny part of the image is decoded, see above.
 
   /* Close the byte stream */
   opj_stream_destroy(d_stream);
@@ -23,6 +23,14 @@
 
 dt_imageio_retval_t dt_imageio_open_j2k(dt_image_t *img, const char *filename, dt_mipmap_buffer_t *buf);
 
+/**
+ * decodes the image at the smallest of its resolution levels that still is at least fit_width x fit_height,
+ * to 8 bit rgba in *buffer, to be freed with free(). fails for images with an embedded color profile.
+ */
+int dt_imageio_j2k_thumbnail(const char *filename, uint8_t **buffer, int32_t *width, int32_t *height,
+                             dt_colorspaces_color_profile_type_t *color_space, const int fit_width,
+                             const int fit_height);
+
 /** reads the color profile attached to the image */
 int dt_imageio_j2k_read_profile(const char *filename, uint8_t **out);
 
@@ -155,11 +155,39 @@ int dt_imageio_jpeg_decompress_header(const void *in, size_t length, dt_imageio_
   return 0;
 }
 
+void dt_imageio_jpeg_fit_scale(dt_imageio_jpeg_t *jpg, const int width, const int height)
+{
+  if(width <= 0 || height <= 0) return;
+
+  struct dt_imageio_jpeg_error_mgr jerr;
+  jpg->dinfo.err = jpeg_std_error(&jerr.pub);
+  jerr.pub.error_exit = dt_imageio_jpeg_error_exit;
+  if(setjmp(jerr.setjmp_buffer))
+  {
+    // decode at full size then, which dt_imageio_jpeg_decompress() reports on its own if it fails, too
+    jpg->dinfo.scale_num = jpg->dinfo.scale_denom = 1;
+    jpg->width = jpg->dinfo.image_width;
+    jpg->height = jpg->dinfo.image_height;
+    return;
+  }
+
+  // the idct produces the image scaled by 1/denom right away. the largest denominator at which the image
+  // still isn't smaller than its fit into width x height, which it is as long as one side covers the box
+  unsigned int denom = 8;
+  while(denom > 1 && jpg->dinfo.image_width < denom * width && jpg->dinfo.image_height < denom * height)
+    denom /= 2;
+  jpg->dinfo.scale_num = 1;
+  jpg->dinfo.scale_denom = denom;
+  jpeg_calc_output_dimensions(&(jpg->dinfo));
+  jpg->width = jpg->dinfo.output_width;
+  jpg->height = jpg->dinfo.output_height;
+}
+
 #ifdef JCS_EXTENSIONS
 static int decompress_jsc(dt_imageio_jpeg_t *jpg, uint8_t *out)
 {
   uint8_t *tmp = out;
-  while(jpg->dinfo.output_scanline < jpg->dinfo.image_height)
+  while(jpg->dinfo.output_scanline < jpg->dinfo.output_height)
   {
     if(jpeg_read_scanlines(&(jpg->dinfo), &tmp, 1) != 1)
     {
@@ -176,14 +204,14 @@ static int decompress_plain(dt_imageio_jpeg_t *jpg, uint8_t *out)
   JSAMPROW row_pointer[1];
   row_pointer[0] = (uint8_t *)malloc(jpg->dinfo.output_width * jpg->dinfo.num_components);
   uint8_t *tmp = out;
-  while(jpg->dinfo.output_scanline < jpg->dinfo.image_height)
+  while(jpg->dinfo.output_scanline < jpg->dinfo.output_height)
   {
     if(jpeg_read_scanlines(&(jpg->dinfo), row_pointer, 1) != 1)
     {
       free(row_pointer[0]);
       return 1;
     }
-    for(unsigned int i = 0; i < jpg->dinfo.image_width; i++)
+    for(unsigned int i = 0; i < jpg->dinfo.output_width; i++)
     {
       for(int k = 0; k < 3; k++) tmp[4 * i + k] = row_pointer[0][3 * i + k];
     }
@@ -598,7 +626,7 @@ int dt_imageio_jpeg_read_header(const char *filename, dt_imageio_jpeg_t *jpg)
 static int read_jsc(dt_imageio_jpeg_t *jpg, uint8_t *out)
 {
   uint8_t *tmp = out;
-  while(jpg->dinfo.output_scanline < jpg->dinfo.image_height)
+  while(jpg->dinfo.output_scanline < jpg->dinfo.output_height)
   {
     if(jpeg_read_scanlines(&(jpg->dinfo), &tmp, 1) != 1)
     {
@@ -615,7 +643,7 @@ static int read_plain(dt_imageio_jpeg_t *jpg, uint8_t *out)
   JSAMPROW row_pointer[1];
   row_pointer[0] = (uint8_t *)malloc(jpg->dinfo.output_width * jpg->dinfo.num_components);
   uint8_t *tmp = out;
-  while(jpg->dinfo.output_scanline < jpg->dinfo.image_height)
+  while(jpg->dinfo.output_scanline < jpg->dinfo.output_height)
   {
     if(jpeg_read_scanlines(&(jpg->dinfo), row_pointer, 1) != 1)
     {
@@ -624,7 +652,7 @@ static int read_plain(dt_imageio_jpeg_t *jpg, uint8_t *out)
       fclose(jpg->f);
       return 1;
     }
-    for(unsigned int i = 0; i < jpg->dinfo.image_width; i++)
+    for(unsigned int i = 0; i < jpg->dinfo.output_width; i++)
       for(int k = 0; k < 3; k++) tmp[4 * i + k] = row_pointer[0][3 * i + k];
     tmp += 4 * jpg->width;
   }
@@ -44,6 +44,11 @@ typedef struct dt_imageio_jpeg_t
 
 /** reads the header and fills width/height in jpg struct. */
 int dt_imageio_jpeg_decompress_header(const void *in, size_t length, dt_imageio_jpeg_t *jpg);
+/**
+ * after the header was read, makes the jpeg decode at 1/2, 1/4 or 1/8 of its size, the smallest that still
+ * covers the image scaled to fit into width x height. updates width/height in the jpg struct.
+ */
+void dt_imageio_jpeg_fit_scale(dt_imageio_jpeg_t *jpg, const int width, const int height);
 /** reads the whole image to the out buffer, which has to be large enough. */
 int dt_imageio_jpeg_decompress(dt_imageio_jpeg_t *jpg, uint8_t *out);
 /** compresses in to out buffer with given quality (0..100). out buffer must be large enough. returns actual
@@ -36,7 +36,9 @@
 typedef enum dt_imageio_format_flags_t
 {
   FORMAT_FLAGS_SUPPORT_XMP = 1,
-  FORMAT_FLAGS_NO_TMPFILE = 2
+  FORMAT_FLAGS_NO_TMPFILE = 2,
+  FORMAT_FLAGS_STREAMABLE = 4, // written front to back in one go, exif included, so the file may be a pipe
+  FORMAT_FLAGS_EMBED_XMP = 8   // writes the xmp packet it gets while encoding, the file isn't opened again
 } dt_imageio_format_flags_t;
 
 /**
@@ -113,9 +115,18 @@ typedef struct dt_imageio_module_format_t
   // writing functions:
   /* bits per pixel and color channel we want to write: 8: char x3, 16: uint16_t x3, 32: float x3. */
   int (*bpp)(dt_imageio_module_data_t *data);
-  /* write to file, with exif if not NULL, and icc profile if supported. */
+  /* write to file, with exif if not NULL, and icc profile if supported. xmp is the packet to embed if not NULL,
+   * only given to formats with FORMAT_FLAGS_EMBED_XMP. */
   int (*write_image)(dt_imageio_module_data_t *data, const char *filename, const void *in, void *exif,
-                     int exif_len, int imgid, int num, int total);
+                     int exif_len, const char *xmp, int imgid, int num, int total);
+  /* optional, write the image as the export pipe produces it, in place of write_image. begin returns NULL if
+   * that's not possible with these parameters. the rows are handed over top to bottom, 8 bit with 4 channels,
+   * or for 32 bpp as the pipe writes them. exif and xmp are as for write_image and stay valid until end,
+   * which removes the file if failed != 0. */
+  void *(*write_image_begin)(dt_imageio_module_data_t *data, const char *filename, void *exif, int exif_len,
+                             const char *xmp, int imgid, int num, int total);
+  int (*write_image_rows)(dt_imageio_module_data_t *data, void *handle, const void *in, int first_row, int rows);
+  int (*write_image_end)(dt_imageio_module_data_t *data, void *handle, int failed);
   /* flag that describes the available precision/levels of output format. mainly used for dithering. */
   int (*levels)(dt_imageio_module_data_t *data);
 
@@ -175,6 +186,8 @@ typedef struct dt_imageio_module_storage_t
                const int num, const int total, const gboolean high_quality, const gboolean upscale);
   /* called once at the end (after exporting all images), if implemented. */
   void (*finalize_store)(struct dt_imageio_module_storage_t *self, dt_imageio_module_data_t *data);
+  /* non-zero if store() may be called for several images at once, if implemented. */
+  int (*parallel)(struct dt_imageio_module_storage_t *self);
 
   void *(*legacy_params)(struct dt_imageio_module_storage_t *self, const void *const old_params,
                          const size_t old_params_size, const int old_version, const int new_version,
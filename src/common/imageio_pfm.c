@@ -36,71 +36,62 @@ dt_imageio_retval_t dt_imageio_open_pfm(dt_image_t *img, const char *filename, d
   const char *ext = filename + strlen(filename);
   while(*ext != '.' && ext > filename) ext--;
   if(strcasecmp(ext, ".pfm")) return DT_IMAGEIO_FILE_CORRUPTED;
-  FILE *f = g_fopen(filename, "rb");
-  if(!f) return DT_IMAGEIO_FILE_CORRUPTED;
-  int ret = 0;
-  int cols = 3;
+
+  // the pixels are converted straight from the mapped file into the mipmap buffer
+  GMappedFile *mf = g_mapped_file_new(filename, FALSE, NULL);
+  if(!mf) return DT_IMAGEIO_FILE_CORRUPTED;
+  const char *const contents = g_mapped_file_get_contents(mf);
+  const size_t length = g_mapped_file_get_length(mf);
+  dt_imageio_retval_t res = DT_IMAGEIO_FILE_CORRUPTED;
+
+  char head[256] = { 0 };
+  if(!contents) goto end;
+  memcpy(head, contents, MIN(length, sizeof(head) - 1));
+  char type[2] = { 'X', 'X' };
   float scale_factor;
-  char head[2] = { 'X', 'X' };
-  ret = fscanf(f, "%c%c\n", head, head + 1);
-  if(ret != 2 || head[0] != 'P') goto error_corrupt;
-  if(head[1] == 'F')
-    cols = 3;
-  else if(head[1] == 'f')
-    cols = 1;
-  else
-    goto error_corrupt;
-  ret = fscanf(f, "%d %d %f%*[^\n]", &img->width, &img->height, &scale_factor);
-  if(ret != 3) goto error_corrupt;
-  ret = fread(&ret, sizeof(char), 1, f);
-  if(ret != 1) goto error_corrupt;
-  ret = 0;
+  int end_of_numbers = 0;
+  if(sscanf(head, "%c%c\n%d %d %f%n", type, type + 1, &img->width, &img->height, &scale_factor, &end_of_numbers) != 5
+     || type[0] != 'P' || (type[1] != 'F' && type[1] != 'f') || img->width <= 0 || img->height <= 0)
+    goto end;
+  // the rest of the line, and the single newline ending the header
+  const char *const eol = memchr(head + end_of_numbers, '\n', sizeof(head) - end_of_numbers);
+  if(!eol) goto end;
+  const size_t offset = eol + 1 - head;
 
-  int swap_byte_order = (scale_factor >= 0.0) ^ (G_BYTE_ORDER == G_BIG_ENDIAN);
+  const int cols = type[1] == 'F' ? 3 : 1;
+  if(length < offset + sizeof(float) * cols * img->width * img->height) goto end;
+  const int swap_byte_order = (scale_factor >= 0.0) ^ (G_BYTE_ORDER == G_BIG_ENDIAN);
 
   float *buf = (float *)dt_mipmap_cache_alloc(mbuf, img);
-  if(!buf) goto error_cache_full;
+  if(!buf)
+  {
+    res = DT_IMAGEIO_CACHE_FULL;
+    goto end;
+  }
 
-  if(cols == 3)
+  const uint8_t *const data = (const uint8_t *)contents + offset;
+#ifdef _OPENMP
+#pragma omp parallel for default(none) shared(img, buf) schedule(static)
+#endif
+  for(size_t j = 0; j < img->height; j++)
   {
-    ret = fread(buf, 3 * sizeof(float), (size_t)img->width * img->height, f);
-    for(size_t i = (size_t)img->width * img->height; i > 0; i--)
+    // the rows are stored bottom to top
+    const uint8_t *const in = data + sizeof(float) * cols * img->width * (img->height - 1 - j);
+    float *const out = buf + (size_t)4 * img->width * j;
+    for(size_t i = 0; i < img->width; i++)
       for(int c = 0; c < 3; c++)
       {
         union { float f; guint32 i; } v;
-        v.f = buf[3 * (i - 1) + c];
+        memcpy(&v.i, in + sizeof(float) * (cols * i + (cols == 3 ? c : 0)), sizeof(float));
         if(swap_byte_order) v.i = GUINT32_SWAP_LE_BE(v.i);
-        buf[4 * (i - 1) + c] = v.f;
+        out[4 * i + c] = v.f;
       }
   }
-  else
-    for(size_t j = 0; j < img->height; j++)
-      for(size_t i = 0; i < img->width; i++)
-      {
-        union { float f; guint32 i; } v;
-        ret = fread(&v.f, sizeof(float), 1, f);
-        if(swap_byte_order) v.i = GUINT32_SWAP_LE_BE(v.i);
-        buf[4 * (img->width * j + i) + 2] = buf[4 * (img->width * j + i) + 1]
-            = buf[4 * (img->width * j + i) + 0] = v.f;
-      }
-  float *line = (float *)calloc(4 * img->width, sizeof(float));
-  for(size_t j = 0; j < img->height / 2; j++)
-  {
-    memcpy(line, buf + img->width * j * 4, 4 * sizeof(float) * img->width);
-    memcpy(buf + img->width * j * 4, buf + img->width * (img->height - 1 - j) * 4,
-           4 * sizeof(float) * img->width);
-    memcpy(buf + img->width * (img->height - 1 - j) * 4, line, 4 * sizeof(float) * img->width);
-  }
-  free(line);
-  fclose(f);
-  return DT_IMAGEIO_OK;
+  res = DT_IMAGEIO_OK;
 
-error_corrupt:
-  fclose(f);
-  return DT_IMAGEIO_FILE_CORRUPTED;
-error_cache_full:
-  fclose(f);
-  return DT_IMAGEIO_CACHE_FULL;
+end:
+  g_mapped_file_unref(mf);
+  return res;
 }
 
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
@@ -24,6 +24,19 @@
 
 #include <memory>
 
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#if defined(__linux__)
+#include <sys/vfs.h>
+#elif defined(__APPLE__) || defined(__FreeBSD__) || defined(__OpenBSD__)
+#include <sys/mount.h>
+#include <sys/param.h>
+#endif
+
 #define __STDC_LIMIT_MACROS
 
 extern "C" {
@@ -40,7 +53,8 @@ extern "C" {
 int rawspeed_get_number_of_processor_cores()
 {
 #ifdef _OPENMP
-  return omp_get_num_procs();
+  // the share of the cores the calling thread got, see dt_control_run_job()
+  return omp_get_max_threads();
 #else
   return 1;
 #endif
@@ -102,6 +116,105 @@ void dt_rawspeed_lookup_makermodel(const char *maker, const char *model,
   }
 }
 
+#ifndef _WIN32
+// whether fd is on a file system where reading through a mapping is slower than read(), the ones over the
+// network fetch every page on its own as the decoder touches it
+static gboolean _rawspeed_network_fs(const int fd)
+{
+#if defined(__linux__)
+  struct statfs s;
+  if(fstatfs(fd, &s)) return TRUE;
+  switch((unsigned long)s.f_type)
+  {
+    case 0x6969UL:     // nfs
+    case 0x517bUL:     // smb
+    case 0xff534d42UL: // cifs
+    case 0xfe534d42UL: // smb2
+    case 0x65735546UL: // fuse, sshfs and the like
+    case 0x564cUL:     // ncp
+    case 0x6b414653UL: // afs
+    case 0x73757245UL: // coda
+    case 0x01021997UL: // 9p
+    case 0x00c36400UL: // ceph
+      return TRUE;
+    default:
+      return FALSE;
+  }
+#elif defined(__APPLE__) || defined(__FreeBSD__) || defined(__OpenBSD__)
+  struct statfs s;
+  if(fstatfs(fd, &s)) return TRUE;
+  return !(s.f_flags & MNT_LOCAL);
+#else
+  return TRUE;
+#endif
+}
+#endif
+
+// a raw file mapped read only, for rawspeed to parse it straight from the page cache instead of a copy on the
+// heap. the file is followed by at least a page of zeros, as FileReader pads its buffer for the decoders that
+// read ahead of their input. files on network shares are left to FileReader.
+class dt_rawspeed_mapped_file_t
+{
+public:
+  explicit dt_rawspeed_mapped_file_t(const char *filename)
+  {
+#ifndef _WIN32
+    const int fd = open(filename, O_RDONLY);
+    if(fd < 0) return;
+
+    struct stat st;
+    if(!fstat(fd, &st) && S_ISREG(st.st_mode) && st.st_size > 0 && !_rawspeed_network_fs(fd))
+    {
+      const size_t page = sysconf(_SC_PAGESIZE);
+      const size_t file_size = st.st_size;
+      const size_t map_length = (file_size / page + 2) * page;
+      if(map_length < UINT32_MAX)
+      {
+        // the anonymous mapping provides the zeros behind the file, whose pages are mapped over its start
+        void *reserved = mmap(NULL, map_length, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if(reserved != MAP_FAILED)
+        {
+          if(mmap(reserved, file_size, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0) != MAP_FAILED)
+          {
+            addr = reserved;
+            length = map_length;
+            size = file_size;
+#ifdef MADV_WILLNEED
+            madvise(addr, size, MADV_WILLNEED);
+#endif
+          }
+          else
+            munmap(reserved, map_length);
+        }
+      }
+    }
+    close(fd);
+#endif
+  }
+
+  ~dt_rawspeed_mapped_file_t()
+  {
+#ifndef _WIN32
+    if(addr) munmap(addr, length);
+#endif
+  }
+
+  dt_rawspeed_mapped_file_t(const dt_rawspeed_mapped_file_t &) = delete;
+  dt_rawspeed_mapped_file_t &operator=(const dt_rawspeed_mapped_file_t &) = delete;
+
+  // a buffer not owning the mapping, which has to outlive it. NULL if the file isn't mapped
+  std::unique_ptr<const Buffer> buffer() const
+  {
+    if(!addr) return nullptr;
+    return std::unique_ptr<const Buffer>(new Buffer((const uchar8 *)addr, (Buffer::size_type)size));
+  }
+
+private:
+  void *addr = nullptr;
+  size_t length = 0;
+  size_t size = 0;
+};
+
 uint32_t dt_rawspeed_crop_dcraw_filters(uint32_t filters, uint32_t crop_x, uint32_t crop_y)
 {
   if(!filters || filters == 9u) return filters;
@@ -118,6 +231,8 @@ dt_imageio_retval_t dt_imageio_open_rawspeed(dt_image_t *img, const char *filena
   snprintf(filen, sizeof(filen), "%s", filename);
   FileReader f(filen);
 
+  // declared first, the buffer and the decoder refer to the mapping until they are gone
+  dt_rawspeed_mapped_file_t mapped(filen);
   std::unique_ptr<RawDecoder> d;
   std::unique_ptr<const Buffer> m;
 
@@ -125,7 +240,8 @@ dt_imageio_retval_t dt_imageio_open_rawspeed(dt_image_t *img, const char *filena
   {
     dt_rawspeed_load_meta();
 
-    m = f.readFile();
+    m = mapped.buffer();
+    if(!m) m = f.readFile();
 
     RawParser t(m.get());
     d = t.getDecoder(meta);
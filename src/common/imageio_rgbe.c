@@ -57,8 +57,8 @@ typedef struct
 #define RGBE_DATA_RED 0
 #define RGBE_DATA_GREEN 1
 #define RGBE_DATA_BLUE 2
-/* number of floats per pixel */
-#define RGBE_DATA_SIZE 3
+/* number of floats per pixel, the layout of the mipmap buffer so the pixels are read straight into it */
+#define RGBE_DATA_SIZE 4
 
 enum rgbe_error_codes
 {
@@ -499,8 +499,11 @@ dt_imageio_retval_t dt_imageio_open_rgbe(dt_image_t *img, const char *filename,
   }
   fclose(f);
   // repair nan/inf etc
-  for(size_t i = (size_t)img->width * img->height; i > 0; i--)
-    for(int c = 0; c < 3; c++) buf[4 * (i - 1) + c] = fmaxf(0.0f, fminf(10000.0, buf[3 * (i - 1) + c]));
+#ifdef _OPENMP
+#pragma omp parallel for default(none) shared(img, buf) schedule(static)
+#endif
+  for(size_t k = 0; k < (size_t)img->width * img->height; k++)
+    for(int c = 0; c < 3; c++) buf[4 * k + c] = fmaxf(0.0f, fminf(10000.0f, buf[4 * k + c]));
   return DT_IMAGEIO_OK;
 
 error_corrupt:
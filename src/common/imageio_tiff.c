@@ -241,6 +241,136 @@ dt_imageio_retval_t dt_imageio_open_tiff(dt_image_t *img, const char *filename,
   return (ok == 1 ? DT_IMAGEIO_OK : DT_IMAGEIO_FILE_CORRUPTED);
 }
 
+// the directory of the smallest overview at least fit_width x fit_height large, the full image if there is
+// none. overviews are the reduced resolution images following the full one, or its subifds.
+static int _tiff_set_overview(TIFF *tiff, const int fit_width, const int fit_height)
+{
+  uint32_t width = 0, height = 0;
+  TIFFGetField(tiff, TIFFTAG_IMAGEWIDTH, &width);
+  TIFFGetField(tiff, TIFFTAG_IMAGELENGTH, &height);
+
+  uint16_t nsubifds = 0;
+  toff_t *subifd_offsets = NULL, *subifds = NULL;
+  if(TIFFGetField(tiff, TIFFTAG_SUBIFD, &nsubifds, &subifd_offsets) && nsubifds > 0)
+  {
+    // they are gone as soon as another directory is read
+    subifds = g_memdup(subifd_offsets, sizeof(toff_t) * nsubifds);
+  }
+
+  char emsg[1024] = { 0 };
+  tdir_t best_dir = 0;
+  toff_t best_offset = 0;
+  uint32_t best_width = width;
+  const tdir_t ndirs = TIFFNumberOfDirectories(tiff);
+  for(int k = 1; k < ndirs + nsubifds; k++)
+  {
+    if(k < ndirs ? !TIFFSetDirectory(tiff, k) : !TIFFSetSubDirectory(tiff, subifds[k - ndirs])) continue;
+    uint32_t subfiletype = 0, wd = 0, ht = 0;
+    TIFFGetField(tiff, TIFFTAG_SUBFILETYPE, &subfiletype);
+    TIFFGetField(tiff, TIFFTAG_IMAGEWIDTH, &wd);
+    TIFFGetField(tiff, TIFFTAG_IMAGELENGTH, &ht);
+    // other pages of the file aren't overviews
+    if(!(subfiletype & FILETYPE_REDUCEDIMAGE) || !TIFFRGBAImageOK(tiff, emsg)) continue;
+    if(wd < best_width && wd >= fit_width && ht >= fit_height)
+    {
+      best_dir = k < ndirs ? k : 0;
+      best_offset = k < ndirs ? 0 : subifds[k - ndirs];
+      best_width = wd;
+    }
+  }
+  g_free(subifds);
+
+  return best_offset ? TIFFSetSubDirectory(tiff, best_offset) : TIFFSetDirectory(tiff, best_dir);
+}
+
+int dt_imageio_tiff_thumbnail(const char *filename, uint8_t **buffer, int32_t *width, int32_t *height,
+                              dt_colorspaces_color_profile_type_t *color_space, const int fit_width,
+                              const int fit_height)
+{
+  TIFFSetWarningHandler(_warning_handler);
+  *buffer = NULL;
+
+  TIFF *tiff = TIFFOpen(filename, "rb");
+  if(!tiff) return 1;
+
+  int res = 1;
+  uint32_t profile_len = 0;
+  uint8_t *profile = NULL;
+  uint32_t *raster = NULL;
+  // the thumbnail has to be srgb, anything else goes through the pipe
+  if(TIFFGetField(tiff, TIFFTAG_ICCPROFILE, &profile_len, &profile)) goto end;
+  if(!_tiff_set_overview(tiff, fit_width, fit_height)) goto end;
+
+  char emsg[1024] = { 0 };
+  TIFFRGBAImage img;
+  if(!TIFFRGBAImageOK(tiff, emsg) || !TIFFRGBAImageBegin(&img, tiff, 0, emsg)) goto end;
+  // keep the rows as they are stored, the orientation of the image is applied with the one from exif
+  img.req_orientation = img.orientation;
+
+  // the image is reduced by the largest integer factor that still fills the thumbnail while it is read, in
+  // bands of whole strips or tiles where they aren't too large, so it is never held at full size
+  const int factor = MAX(1, MIN(img.width / MAX(fit_width, 1), img.height / MAX(fit_height, 1)));
+  const int wd = img.width / factor, ht = img.height / factor;
+  uint32_t unit = 1;
+  TIFFGetField(tiff, TIFFIsTiled(tiff) ? TIFFTAG_TILELENGTH : TIFFTAG_ROWSPERSTRIP, &unit);
+  const int band = MAX(1, (int)(MIN(unit, 256) + factor - 1) / factor); // in rows of the thumbnail
+  raster = (uint32_t *)_TIFFmalloc(sizeof(uint32_t) * img.width * factor * band);
+  *buffer = (uint8_t *)malloc(sizeof(uint8_t) * 4 * wd * ht);
+  if(!raster || !*buffer || wd == 0 || ht == 0)
+  {
+    TIFFRGBAImageEnd(&img);
+    goto end;
+  }
+
+  for(int j0 = 0; j0 < ht; j0 += band)
+  {
+    const int rows = MIN(band, ht - j0);
+    img.row_offset = j0 * factor;
+    img.col_offset = 0;
+    if(!TIFFRGBAImageGet(&img, raster, img.width, rows * factor))
+    {
+      TIFFRGBAImageEnd(&img);
+      goto end;
+    }
+    uint8_t *const out = *buffer + (size_t)4 * wd * j0;
+#ifdef _OPENMP
+#pragma omp parallel for default(none) shared(img, raster) schedule(static)
+#endif
+    for(int j = 0; j < rows; j++)
+      for(int i = 0; i < wd; i++)
+      {
+        uint32_t sum[3] = { 0, 0, 0 };
+        for(int jj = 0; jj < factor; jj++)
+          for(int ii = 0; ii < factor; ii++)
+          {
+            const uint32_t px = raster[(size_t)(j * factor + jj) * img.width + i * factor + ii];
+            sum[0] += TIFFGetR(px);
+            sum[1] += TIFFGetG(px);
+            sum[2] += TIFFGetB(px);
+          }
+        uint8_t *const o = out + (size_t)4 * (j * wd + i);
+        for(int c = 0; c < 3; c++) o[c] = (sum[c] + factor * factor / 2) / (factor * factor);
+        o[3] = 0;
+      }
+  }
+  TIFFRGBAImageEnd(&img);
+
+  *width = wd;
+  *height = ht;
+  *color_space = DT_COLORSPACE_SRGB;
+  res = 0;
+
+end:
+  if(res)
+  {
+    free(*buffer);
+    *buffer = NULL;
+  }
+  _TIFFfree(raster);
+  TIFFClose(tiff);
+  return res;
+}
+
 int dt_imageio_tiff_read_profile(const char *filename, uint8_t **out)
 {
   TIFF *tiff = NULL;
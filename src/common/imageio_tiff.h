@@ -25,6 +25,15 @@ dt_imageio_retval_t dt_imageio_open_tiff(dt_image_t *img, const char *filename,
 
 int dt_imageio_tiff_read_profile(const char *filename, uint8_t **out);
 
+/**
+ * an 8 bit srgb thumbnail at least fit_width x fit_height large, unless the image is smaller. it comes from
+ * the smallest overview of a pyramidal tiff that is large enough, and is reduced while it is read. fails for
+ * images with an icc profile. free the buffer with free(), returns 0 on success.
+ */
+int dt_imageio_tiff_thumbnail(const char *filename, uint8_t **buffer, int32_t *width, int32_t *height,
+                              dt_colorspaces_color_profile_type_t *color_space, const int fit_width,
+                              const int fit_height);
+
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
 // kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
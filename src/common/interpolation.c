@@ -1080,6 +1080,58 @@ void dt_interpolation_compute_pixel4c(const struct dt_interpolation *itor, const
     dt_unreachable_codepath();
 }
 
+void dt_interpolation_compute_pixel4c_scaled(const struct dt_interpolation *itor, const float *in, float *out,
+                                             const float x, const float y, const float scale, const int width,
+                                             const int height, const int linestride)
+{
+  if(scale >= 1.0f)
+  {
+    dt_interpolation_compute_pixel4c(itor, in, out, x, y, width, height, linestride);
+    return;
+  }
+
+  const int ix = (int)x;
+  const int iy = (int)y;
+  if(ix < 0 || iy < 0 || ix >= width || iy >= height)
+  {
+    for(int c = 0; c < 3; c++) out[c] = 0.0f;
+    return;
+  }
+
+  float kernelh[2 * MAX_HALF_FILTER_WIDTH * DT_INTERPOLATION_MAX_DOWNSCALE + 2];
+  float kernelv[2 * MAX_HALF_FILTER_WIDTH * DT_INTERPOLATION_MAX_DOWNSCALE + 2];
+
+  // the kernel stretched over all input samples within its width in output samples
+  const float s = fmaxf(scale, 1.0f / DT_INTERPOLATION_MAX_DOWNSCALE);
+  const float w = (float)itor->width;
+  const int x0 = (int)ceilf(x - w / s), x1 = (int)floorf(x + w / s);
+  const int y0 = (int)ceilf(y - w / s), y1 = (int)floorf(y + w / s);
+  float normh = 0.0f, normv = 0.0f;
+  for(int i = x0; i <= x1; i++) normh += kernelh[i - x0] = itor->func(w, (i - x) * s);
+  for(int j = y0; j <= y1; j++) normv += kernelv[j - y0] = itor->func(w, (j - y) * s);
+  const float oonorm = 1.0f / (normh * normv);
+
+  static const enum border_mode bordermode = INTERPOLATION_BORDER_MODE;
+  float pixel[3] = { 0.0f, 0.0f, 0.0f };
+  for(int j = y0; j <= y1; j++)
+  {
+    // footprints wider than the image mirror out of it again
+    const int my = clip(j, 0, height - 1, bordermode);
+    const int clip_y = CLAMPS(my, 0, height - 1);
+    float h[3] = { 0.0f, 0.0f, 0.0f };
+    for(int i = x0; i <= x1; i++)
+    {
+      const int mx = clip(i, 0, width - 1, bordermode);
+      const int clip_x = CLAMPS(mx, 0, width - 1);
+      const float *ipixel = in + (size_t)clip_y * linestride + clip_x * 4;
+      for(int c = 0; c < 3; c++) h[c] += kernelh[i - x0] * ipixel[c];
+    }
+    for(int c = 0; c < 3; c++) pixel[c] += kernelv[j - y0] * h[c];
+  }
+
+  for(int c = 0; c < 3; c++) out[c] = oonorm * pixel[c];
+}
+
 /* --------------------------------------------------------------------------
  * Interpolation factory
  * ------------------------------------------------------------------------*/
@@ -1350,168 +1402,142 @@ static int prepare_resampling_plan(const struct dt_interpolation *itor, int in,
   return 0;
 }
 
-static void dt_interpolation_resample_plain(const struct dt_interpolation *itor, float *out,
-                                            const dt_iop_roi_t *const roi_out, const int32_t out_stride,
-                                            const float *const in, const dt_iop_roi_t *const roi_in,
-                                            const int32_t in_stride)
-{
-  int *hindex = NULL;
-  int *hlength = NULL;
-  float *hkernel = NULL;
-  int *vindex = NULL;
-  int *vlength = NULL;
-  float *vkernel = NULL;
-  int *vmeta = NULL;
-
-  int r;
-
-  debug_info("resampling %p (%dx%d@%dx%d scale %f) -> %p (%dx%d@%dx%d scale %f)\n", in, roi_in->width,
-             roi_in->height, roi_in->x, roi_in->y, roi_in->scale, out, roi_out->width, roi_out->height,
-             roi_out->x, roi_out->y, roi_out->scale);
+/* the resampling is separable: the input lines the vertical taps use are filtered horizontally to the output
+ * width, and the output lines are weighted sums of those. every thread keeps the filtered lines of its last
+ * output lines in a ring, so each is computed about once instead of for every output line it contributes to.
+ * all sums are done in the same order as a direct loop over both kernels would do them. */
 
-  // Fast code path for 1:1 copy, only cropping area can change
-  if(roi_out->scale == 1.f)
+// horizontal pass of one input line
+DT_ALWAYS_INLINE void resample_hline_plain(const float *const in, float *const out, const int out_width,
+                                           const int *const hlength, const float *const hkernel,
+                                           const int *const hindex)
+{
+  int hkidx = 0; // kernel and index have the same layout
+  for(int ox = 0; ox < out_width; ox++)
   {
-    const int x0 = roi_out->x * 4 * sizeof(float);
-    const int l = roi_out->width * 4 * sizeof(float);
-#if DEBUG_RESAMPLING_TIMING
-    int64_t ts_resampling = getts();
-#endif
-#ifdef _OPENMP
-#pragma omp parallel for default(none) shared(out)
-#endif
-    for(int y = 0; y < roi_out->height; y++)
+    float vhs[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+    for(int ix = 0; ix < hlength[ox]; ix++, hkidx++)
     {
-      float *i = (float *)((char *)in + (size_t)in_stride * (y + roi_out->y) + x0);
-      float *o = (float *)((char *)out + (size_t)out_stride * y);
-      memcpy(o, i, l);
+      const size_t baseidx = (size_t)hindex[hkidx] * 4;
+      const float htap = hkernel[hkidx];
+      for(int c = 0; c < 4; c++) vhs[c] += in[baseidx + c] * htap;
     }
-#if DEBUG_RESAMPLING_TIMING
-    ts_resampling = getts() - ts_resampling;
-    fprintf(stderr, "resampling %p plan:0us resampling:%" PRId64 "us\n", in, ts_resampling);
-#endif
-    // All done, so easy case
-    return;
+    for(int c = 0; c < 4; c++) out[4 * ox + c] = vhs[c];
   }
+}
 
-// Generic non 1:1 case... much more complicated :D
-#if DEBUG_RESAMPLING_TIMING
-  int64_t ts_plan = getts();
-#endif
-
-  // Prepare resampling plans once and for all
-  r = prepare_resampling_plan(itor, roi_in->width, roi_in->x, roi_out->width, roi_out->x, roi_out->scale,
-                              &hlength, &hkernel, &hindex, NULL);
-  if(r)
+// vertical pass of one output line from the ring of filtered lines, in blocks of pixels whose sums fit into
+// registers
+#define RESAMPLE_VBLOCK 16
+DT_ALWAYS_INLINE void resample_vline_plain(const float *const lines, const int ring, float *const out,
+                                           const int out_width, const int vl, const float *const vkernel,
+                                           const int *const vindex)
+{
+  for(int ox = 0; ox < out_width; ox += RESAMPLE_VBLOCK)
   {
-    goto exit;
+    const int n = 4 * MIN(RESAMPLE_VBLOCK, out_width - ox);
+    float vs[4 * RESAMPLE_VBLOCK] = { 0.0f };
+    for(int iy = 0; iy < vl; iy++)
+    {
+      const float *const t = lines + ((size_t)(vindex[iy] % ring) * out_width + ox) * 4;
+      const float vtap = vkernel[iy];
+      for(int k = 0; k < n; k++) vs[k] += t[k] * vtap;
+    }
+    for(int k = 0; k < n; k++) out[4 * ox + k] = vs[k];
   }
+}
+#undef RESAMPLE_VBLOCK
 
-  r = prepare_resampling_plan(itor, roi_in->height, roi_in->y, roi_out->height, roi_out->y, roi_out->scale,
-                              &vlength, &vkernel, &vindex, &vmeta);
-  if(r)
+#if defined(__SSE2__)
+static void resample_hline_sse(const float *const in, float *const out, const int out_width,
+                               const int *const hlength, const float *const hkernel, const int *const hindex)
+{
+  int hkidx = 0;
+  for(int ox = 0; ox < out_width; ox++)
   {
-    goto exit;
+    __m128 vhs = _mm_setzero_ps();
+    for(int ix = 0; ix < hlength[ox]; ix++, hkidx++)
+    {
+      const size_t baseidx = (size_t)hindex[hkidx] * 4;
+      const __m128 vhtap = _mm_set_ps1(hkernel[hkidx]);
+      vhs = _mm_add_ps(vhs, _mm_mul_ps(*(__m128 *)&in[baseidx], vhtap));
+    }
+    _mm_store_ps(out + 4 * ox, vhs);
   }
+}
 
-#if DEBUG_RESAMPLING_TIMING
-  ts_plan = getts() - ts_plan;
-#endif
-
-#if DEBUG_RESAMPLING_TIMING
-  int64_t ts_resampling = getts();
-#endif
-
-// Process each output line
-#ifdef _OPENMP
-#pragma omp parallel for default(none) shared(out, hindex, hlength, hkernel, vindex, vlength, vkernel, vmeta)
-#endif
-  for(int oy = 0; oy < roi_out->height; oy++)
+static void resample_vline_sse(const float *const lines, const int ring, float *const out, const int out_width,
+                               const int vl, const float *const vkernel, const int *const vindex)
+{
+  for(int ox = 0; ox < out_width; ox++)
   {
-    // Initialize column resampling indexes
-    int vlidx = vmeta[3 * oy + 0]; // V(ertical) L(ength) I(n)d(e)x
-    int vkidx = vmeta[3 * oy + 1]; // V(ertical) K(ernel) I(n)d(e)x
-    int viidx = vmeta[3 * oy + 2]; // V(ertical) I(ndex) I(n)d(e)x
-
-    // Initialize row resampling indexes
-    int hlidx = 0; // H(orizontal) L(ength) I(n)d(e)x
-    int hkidx = 0; // H(orizontal) K(ernel) I(n)d(e)x
-    int hiidx = 0; // H(orizontal) I(ndex) I(n)d(e)x
-
-    // Number of lines contributing to the output line
-    int vl = vlength[vlidx++]; // V(ertical) L(ength)
-
-    // Process each output column
-    for(int ox = 0; ox < roi_out->width; ox++)
+    __m128 vs = _mm_setzero_ps();
+    for(int iy = 0; iy < vl; iy++)
     {
-      debug_extra("output %p [% 4d % 4d]\n", out, ox, oy);
-
-      // This will hold the resulting pixel
-      float vs[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
-
-      // Number of horizontal samples contributing to the output
-      int hl = hlength[hlidx++]; // H(orizontal) L(ength)
-
-      for(int iy = 0; iy < vl; iy++)
-      {
-        // This is our input line
-        const float *i = (float *)((char *)in + (size_t)in_stride * vindex[viidx++]);
-
-        float vhs[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
-
-        for(int ix = 0; ix < hl; ix++)
-        {
-          // Apply the precomputed filter kernel
-          size_t baseidx = (size_t)hindex[hiidx++] * 4;
-          const float htap = hkernel[hkidx++];
-          for(int c = 0; c < 3; c++) vhs[c] += i[baseidx + c] * htap;
-        }
-
-        // Accumulate contribution from this line
-        const float vtap = vkernel[vkidx++];
-        for(int c = 0; c < 3; c++) vs[c] += vhs[c] * vtap;
-
-        // Reset horizontal resampling context
-        hkidx -= hl;
-        hiidx -= hl;
-      }
+      const float *const t = lines + ((size_t)(vindex[iy] % ring) * out_width + ox) * 4;
+      vs = _mm_add_ps(vs, _mm_mul_ps(*(__m128 *)t, _mm_set_ps1(vkernel[iy])));
+    }
+    _mm_stream_ps(out + 4 * ox, vs);
+  }
+  _mm_sfence();
+}
+#endif
 
-      // Output pixel is ready
-      float *o = (float *)((char *)out + (size_t)oy * out_stride + (size_t)ox * 4 * sizeof(float));
-      for(int c = 0; c < 3; c++) o[c] = vs[c];
+typedef void(resample_hline_func)(const float *const in, float *const out, const int out_width,
+                                  const int *const hlength, const float *const hkernel, const int *const hindex);
+typedef void(resample_vline_func)(const float *const lines, const int ring, float *const out,
+                                  const int out_width, const int vl, const float *const vkernel,
+                                  const int *const vindex);
 
-      // Reset vertical resampling context
-      viidx -= vl;
-      vkidx -= vl;
+#ifdef DT_TARGET_AVX2
+static DT_TARGET_AVX2 void resample_hline_avx2(const float *const in, float *const out, const int out_width,
+                                               const int *const hlength, const float *const hkernel,
+                                               const int *const hindex)
+{
+  resample_hline_plain(in, out, out_width, hlength, hkernel, hindex);
+}
 
-      // Progress in horizontal context
-      hiidx += hl;
-      hkidx += hl;
-    }
+static DT_TARGET_AVX2 void resample_vline_avx2(const float *const lines, const int ring, float *const out,
+                                               const int out_width, const int vl, const float *const vkernel,
+                                               const int *const vindex)
+{
+  resample_vline_plain(lines, ring, out, out_width, vl, vkernel, vindex);
+}
 
-    // Progress in vertical context
-    viidx += vl;
-    vkidx += vl;
-  }
+static DT_TARGET_AVX512 void resample_hline_avx512(const float *const in, float *const out, const int out_width,
+                                                   const int *const hlength, const float *const hkernel,
+                                                   const int *const hindex)
+{
+  resample_hline_plain(in, out, out_width, hlength, hkernel, hindex);
+}
 
-#if DEBUG_RESAMPLING_TIMING
-  ts_resampling = getts() - ts_resampling;
-  fprintf(stderr, "resampling %p plan:%" PRId64 "us resampling:%" PRId64 "us\n", in, ts_plan, ts_resampling);
+static DT_TARGET_AVX512 void resample_vline_avx512(const float *const lines, const int ring, float *const out,
+                                                   const int out_width, const int vl,
+                                                   const float *const vkernel, const int *const vindex)
+{
+  resample_vline_plain(lines, ring, out, out_width, vl, vkernel, vindex);
+}
 #endif
 
-exit:
-  /* Free the resampling plans. It's nasty to optimize allocs like that, but
-   * it simplifies the code :-D. The length array is in fact the only memory
-   * allocated. */
-  dt_free_align(hlength);
-  dt_free_align(vlength);
+static void resample_hline_plain_func(const float *const in, float *const out, const int out_width,
+                                      const int *const hlength, const float *const hkernel,
+                                      const int *const hindex)
+{
+  resample_hline_plain(in, out, out_width, hlength, hkernel, hindex);
 }
 
-#if defined(__SSE2__)
-static void dt_interpolation_resample_sse(const struct dt_interpolation *itor, float *out,
-                                          const dt_iop_roi_t *const roi_out, const int32_t out_stride,
-                                          const float *const in, const dt_iop_roi_t *const roi_in,
-                                          const int32_t in_stride)
+static void resample_vline_plain_func(const float *const lines, const int ring, float *const out,
+                                      const int out_width, const int vl, const float *const vkernel,
+                                      const int *const vindex)
+{
+  resample_vline_plain(lines, ring, out, out_width, vl, vkernel, vindex);
+}
+
+static void dt_interpolation_resample_lines(const struct dt_interpolation *itor, float *out,
+                                            const dt_iop_roi_t *const roi_out, const int32_t out_stride,
+                                            const float *const in, const dt_iop_roi_t *const roi_in,
+                                            const int32_t in_stride, resample_hline_func *const hline,
+                                            resample_vline_func *const vline)
 {
   int *hindex = NULL;
   int *hlength = NULL;
@@ -1520,6 +1546,8 @@ static void dt_interpolation_resample_sse(const struct dt_interpolation *itor, f
   int *vlength = NULL;
   float *vkernel = NULL;
   int *vmeta = NULL;
+  float *tmp = NULL;
+  int *ring_y = NULL;
 
   int r;
 
@@ -1572,6 +1600,21 @@ static void dt_interpolation_resample_sse(const struct dt_interpolation *itor, f
     goto exit;
   }
 
+  /* The lines of one output line span at most as many input lines as it has taps, a ring of that many
+   * filtered lines per thread holds them all */
+  int maxvl = 1;
+  for(int oy = 0; oy < roi_out->height; oy++) maxvl = MAX(maxvl, vlength[oy]);
+  const int ring = maxvl;
+  const size_t ring_size = (size_t)4 * roi_out->width * ring;
+
+  tmp = dt_alloc_align(64, sizeof(float) * ring_size * dt_get_num_threads());
+  ring_y = dt_alloc_align(64, sizeof(int) * ring * dt_get_num_threads());
+  if(!tmp || !ring_y)
+  {
+    goto exit;
+  }
+  for(int k = 0; k < ring * dt_get_num_threads(); k++) ring_y[k] = -1;
+
 #if DEBUG_RESAMPLING_TIMING
   ts_plan = getts() - ts_plan;
 #endif
@@ -1580,82 +1623,35 @@ static void dt_interpolation_resample_sse(const struct dt_interpolation *itor, f
   int64_t ts_resampling = getts();
 #endif
 
-// Process each output line
+// Process each output line, static scheduling hands every thread consecutive lines that share input lines
 #ifdef _OPENMP
-#pragma omp parallel for default(none) shared(out, hindex, hlength, hkernel, vindex, vlength, vkernel, vmeta)
+#pragma omp parallel for default(none) \
+  shared(out, tmp, ring_y, hindex, hlength, hkernel, vindex, vlength, vkernel, vmeta) schedule(static)
 #endif
   for(int oy = 0; oy < roi_out->height; oy++)
   {
-    // Initialize column resampling indexes
-    int vlidx = vmeta[3 * oy + 0]; // V(ertical) L(ength) I(n)d(e)x
-    int vkidx = vmeta[3 * oy + 1]; // V(ertical) K(ernel) I(n)d(e)x
-    int viidx = vmeta[3 * oy + 2]; // V(ertical) I(ndex) I(n)d(e)x
+    float *const lines = tmp + ring_size * dt_get_thread_num();
+    int *const lines_y = ring_y + ring * dt_get_thread_num();
 
-    // Initialize row resampling indexes
-    int hlidx = 0; // H(orizontal) L(ength) I(n)d(e)x
-    int hkidx = 0; // H(orizontal) K(ernel) I(n)d(e)x
-    int hiidx = 0; // H(orizontal) I(ndex) I(n)d(e)x
+    const int vl = vlength[oy];
+    const int vkidx = vmeta[3 * oy + 1]; // V(ertical) K(ernel) I(n)d(e)x
+    const int viidx = vmeta[3 * oy + 2]; // V(ertical) I(ndex) I(n)d(e)x
 
-    // Number of lines contributing to the output line
-    int vl = vlength[vlidx++]; // V(ertical) L(ength)
-
-    // Process each output column
-    for(int ox = 0; ox < roi_out->width; ox++)
+    // Filter the input lines not in the ring yet
+    for(int iy = 0; iy < vl; iy++)
     {
-      debug_extra("output %p [% 4d % 4d]\n", out, ox, oy);
-
-      // This will hold the resulting pixel
-      __m128 vs = _mm_setzero_ps();
-
-      // Number of horizontal samples contributing to the output
-      int hl = hlength[hlidx++]; // H(orizontal) L(ength)
-
-      for(int iy = 0; iy < vl; iy++)
-      {
-        // This is our input line
-        const float *i = (float *)((char *)in + (size_t)in_stride * vindex[viidx++]);
-
-        __m128 vhs = _mm_setzero_ps();
-
-        for(int ix = 0; ix < hl; ix++)
-        {
-          // Apply the precomputed filter kernel
-          size_t baseidx = (size_t)hindex[hiidx++] * 4;
-          float htap = hkernel[hkidx++];
-          __m128 vhtap = _mm_set_ps1(htap);
-          vhs = _mm_add_ps(vhs, _mm_mul_ps(*(__m128 *)&i[baseidx], vhtap));
-        }
-
-        // Accumulate contribution from this line
-        float vtap = vkernel[vkidx++];
-        __m128 vvtap = _mm_set_ps1(vtap);
-        vs = _mm_add_ps(vs, _mm_mul_ps(vhs, vvtap));
-
-        // Reset horizontal resampling context
-        hkidx -= hl;
-        hiidx -= hl;
-      }
-
-      // Output pixel is ready
-      float *o = (float *)((char *)out + (size_t)oy * out_stride + (size_t)ox * 4 * sizeof(float));
-      _mm_stream_ps(o, vs);
-
-      // Reset vertical resampling context
-      viidx -= vl;
-      vkidx -= vl;
-
-      // Progress in horizontal context
-      hiidx += hl;
-      hkidx += hl;
+      const int y = vindex[viidx + iy];
+      const int slot = y % ring;
+      if(lines_y[slot] == y) continue;
+      const float *i = (const float *)((const char *)in + (size_t)in_stride * y);
+      hline(i, lines + (size_t)4 * roi_out->width * slot, roi_out->width, hlength, hkernel, hindex);
+      lines_y[slot] = y;
     }
 
-    // Progress in vertical context
-//     viidx += vl;
-//     vkidx += vl;
+    float *o = (float *)((char *)out + (size_t)oy * out_stride);
+    vline(lines, ring, o, roi_out->width, vl, vkernel + vkidx, vindex + viidx);
   }
 
-  _mm_sfence();
-
 #if DEBUG_RESAMPLING_TIMING
   ts_resampling = getts() - ts_resampling;
   fprintf(stderr, "resampling %p plan:%" PRId64 "us resampling:%" PRId64 "us\n", in, ts_plan, ts_resampling);
@@ -1667,8 +1663,9 @@ exit:
    * allocated. */
   dt_free_align(hlength);
   dt_free_align(vlength);
+  dt_free_align(tmp);
+  dt_free_align(ring_y);
 }
-#endif
 
 /** Applies resampling (re-scaling) on *full* input and output buffers.
  *  roi_in and roi_out define the part of the buffers that is affected.
@@ -1678,11 +1675,21 @@ void dt_interpolation_resample(const struct dt_interpolation *itor, float *out,
                                const float *const in, const dt_iop_roi_t *const roi_in,
                                const int32_t in_stride)
 {
+#ifdef DT_TARGET_AVX2
+  if(darktable.codepath.AVX512)
+    return dt_interpolation_resample_lines(itor, out, roi_out, out_stride, in, roi_in, in_stride,
+                                           resample_hline_avx512, resample_vline_avx512);
+  else if(darktable.codepath.AVX2)
+    return dt_interpolation_resample_lines(itor, out, roi_out, out_stride, in, roi_in, in_stride,
+                                           resample_hline_avx2, resample_vline_avx2);
+#endif
   if(darktable.codepath.OPENMP_SIMD)
-    return dt_interpolation_resample_plain(itor, out, roi_out, out_stride, in, roi_in, in_stride);
+    return dt_interpolation_resample_lines(itor, out, roi_out, out_stride, in, roi_in, in_stride,
+                                           resample_hline_plain_func, resample_vline_plain_func);
 #if defined(__SSE2__)
   else if(darktable.codepath.SSE2)
-    return dt_interpolation_resample_sse(itor, out, roi_out, out_stride, in, roi_in, in_stride);
+    return dt_interpolation_resample_lines(itor, out, roi_out, out_stride, in, roi_in, in_stride,
+                                           resample_hline_sse, resample_vline_sse);
 #endif
   else
     dt_unreachable_codepath();
@@ -105,6 +105,21 @@ void dt_interpolation_compute_pixel4c(const struct dt_interpolation *itor, const
                                       const float x, const float y, const int width, const int height,
                                       const int linestride);
 
+/** The widest footprint of dt_interpolation_compute_pixel4c_scaled(), in kernel widths */
+#define DT_INTERPOLATION_MAX_DOWNSCALE 16
+
+/** Compute an interpolated 4 component pixel for a resampling by scale.
+ *
+ * Same as dt_interpolation_compute_pixel4c() for scale >= 1. Downscaling stretches the kernel over all
+ * input samples within its width in output samples, as dt_interpolation_resample() does, so the sample
+ * doesn't alias. Scales below 1/DT_INTERPOLATION_MAX_DOWNSCALE are filtered as that one.
+ *
+ * @param scale output samples over input samples
+ */
+void dt_interpolation_compute_pixel4c_scaled(const struct dt_interpolation *itor, const float *in, float *out,
+                                             const float x, const float y, const float scale, const int width,
+                                             const int height, const int linestride);
+
 /** Get an interpolator from type
  * @param type Interpolator to search for
  * @return requested interpolator or default if not found (this function can't fail)
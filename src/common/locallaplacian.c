@@ -25,6 +25,7 @@
 #include <assert.h>
 #include <stdio.h>
 #include <math.h>
+#include <float.h>
 #if defined(__SSE2__)
 #include <xmmintrin.h>
 #endif
@@ -107,128 +108,152 @@ static inline void ll_fill_boundary2(
   memcpy(input+wd*(ht-1), input+wd*(ht-2), sizeof(float)*wd);
 }
 
-static inline void gauss_expand(
-    const float *const input, // coarse input
-    float *const fine,        // upsampled, blurry output
-    const int wd,             // fine res
-    const int ht)
+// one row j of the upsampled coarse buffer as ll_expand_gaussian() computes it, for 1<=i<((wd-1)&~1).
+// c1 is coarse row j/2, c0 and c2 are the ones above and below.
+DT_ALWAYS_INLINE void ll_expand_row_plain(
+    const float *const c0,
+    const float *const c1,
+    const float *const c2,
+    float *const fine,
+    const int j,
+    const int wd)
 {
-#ifdef _OPENMP
-#pragma omp parallel for default(none) schedule(static) collapse(2)
-#endif
-  for(int j=1;j<((ht-1)&~1);j++)  // even ht: two px boundary. odd ht: one px.
-    for(int i=1;i<((wd-1)&~1);i++)
-      fine[j*wd+i] = ll_expand_gaussian(input, i, j, wd, ht);
-  ll_fill_boundary2(fine, wd, ht);
+  const int n = ((wd-1)&~1)/2;
+  if(j & 1)
+  { // odd row: 3x2 and 2x2 stencils between c1 and c2
+    fine[1] = .25f * (c1[0] + c1[1] + c2[0] + c2[1]);
+    for(int k=1;k<n;k++)
+    {
+      fine[2*k]   = 4.f/256.f * (24.0f*(c1[k] + c2[k]) + 4.0f*(c1[k-1] + c1[k+1] + c2[k-1] + c2[k+1]));
+      fine[2*k+1] = .25f * (c1[k] + c1[k+1] + c2[k] + c2[k+1]);
+    }
+  }
+  else
+  { // even row: 3x3 and 2x3 stencils around c1
+    fine[1] = 4.f/256.f * (24.0f*(c1[0] + c1[1]) + 4.0f*(c0[0] + c0[1] + c2[0] + c2[1]));
+    for(int k=1;k<n;k++)
+    {
+      fine[2*k] = 4.f/256.f * (
+          6.0f*(c0[k] + c1[k-1] + 6.0f*c1[k] + c1[k+1] + c2[k])
+          + c0[k-1] + c0[k+1] + c2[k-1] + c2[k+1]);
+      fine[2*k+1] = 4.f/256.f * (24.0f*(c1[k] + c1[k+1]) + 4.0f*(c0[k] + c0[k+1] + c2[k] + c2[k+1]));
+    }
+  }
 }
 
-#if defined(__SSE2__)
-static inline void gauss_reduce_sse2(
-    const float *const input, // fine input buffer
-    float *const coarse,      // coarse scale, blurred input buf
-    const int wd,             // fine res
-    const int ht)
+// coarse rows j0..j1-1 from the five fine rows around each: separable 1 4 6 4 1 kernel, decimated. h is a
+// ring of five rows of cw floats for the horizontal pass, fine row y goes to h[y % 5].
+DT_ALWAYS_INLINE void ll_reduce_rows_plain(
+    const float *const input,
+    float *const coarse,
+    float *const h,
+    const int wd,
+    const int cw,
+    const int j0,   // first coarse row and
+    const int j1)   // the one after the last
 {
-  // blur, store only coarse res
-  const int cw = (wd-1)/2+1, ch = (ht-1)/2+1;
-
-  // this version is inspired by opencv's pyrDown_ :
-  // - allocate 5 rows of ring buffer (aligned)
-  // - for coarse res y
-  //   - fill 5 coarse-res row buffers with 1 4 6 4 1 weights (reuse some from last time)
-  //   - do vertical convolution via sse and write to coarse output buf
-
-  const int stride = ((cw+8)&~7); // assure sse alignment of rows
-  float *ringbuf = dt_alloc_align(16, sizeof(*ringbuf)*stride*5);
-  float *rows[5] = {0};
-  int rowj = 0; // we initialised this many rows so far
-
-  for(int j=1;j<ch-1;j++)
+  int rowj = 2*j0-2; // next fine row for the horizontal pass
+  for(int j=j0;j<j1;j++)
   {
-    // horizontal pass, convolve with 1 4 6 4 1 kernel and decimate
+    // horizontal pass, once per fine row: consecutive coarse rows share three of their five
     for(;rowj<=2*j+2;rowj++)
     {
-      float *const row = ringbuf + (rowj % 5)*stride;
-      const float *const in = input + rowj*wd;
-#ifdef _OPENMP
-#pragma omp parallel for schedule(static) default(none)
-#endif
+      float *const row = h + (rowj % 5)*cw;
+      const float *const in = input + (size_t)rowj*wd;
       for(int i=1;i<cw-1;i++)
-        row[i] = 6*in[2*i] + 4*(in[2*i-1]+in[2*i+1]) + in[2*i-2] + in[2*i+2];
+        row[i] = 6.0f*in[2*i] + 4.0f*(in[2*i-1] + in[2*i+1]) + in[2*i-2] + in[2*i+2];
     }
+    const float *const r0 = h + ((2*j-2)%5)*cw, *const r1 = h + ((2*j-1)%5)*cw, *const r2 = h + ((2*j)%5)*cw,
+                *const r3 = h + ((2*j+1)%5)*cw, *const r4 = h + ((2*j+2)%5)*cw;
+    float *const out = coarse + (size_t)j*cw;
+    for(int i=1;i<cw-1;i++)
+      out[i] = (6.0f*r2[i] + 4.0f*(r1[i] + r3[i]) + r0[i] + r4[i]) * (1.0f/256.0f);
+  }
+}
 
-    // init row pointers
-    for(int k=0;k<5;k++)
-      rows[k] = ringbuf + ((2*j-2+k)%5)*stride;
-
-    // vertical pass, convolve and decimate using SIMD:
-    // note that we're ignoring the (1..cw-1) buffer limit, we'll pull in
-    // garbage and fix it later by border filling.
-    float *const out = coarse + j*cw;
-    const float *const row0 = rows[0], *const row1 = rows[1],
-                *const row2 = rows[2], *const row3 = rows[3], *const row4 = rows[4];
-    const __m128 four = _mm_set1_ps(4.f), scale = _mm_set1_ps(1.f/256.f);
-#ifdef _OPENMP
-#pragma omp parallel for schedule(static) default(none)
+typedef void(ll_expand_row_func)(const float *const c0, const float *const c1, const float *const c2,
+                                 float *const fine, const int j, const int wd);
+typedef void(ll_reduce_rows_func)(const float *const input, float *const coarse, float *const h, const int wd,
+                                  const int cw, const int j0, const int j1);
+
+#ifdef DT_TARGET_AVX2
+static DT_TARGET_AVX2 void ll_expand_row_avx2(const float *const c0, const float *const c1,
+                                              const float *const c2, float *const fine, const int j, const int wd)
+{
+  ll_expand_row_plain(c0, c1, c2, fine, j, wd);
+}
+
+static DT_TARGET_AVX2 void ll_reduce_rows_avx2(const float *const input, float *const coarse, float *const h,
+                                               const int wd, const int cw, const int j0, const int j1)
+{
+  ll_reduce_rows_plain(input, coarse, h, wd, cw, j0, j1);
+}
+
+static DT_TARGET_AVX512 void ll_expand_row_avx512(const float *const c0, const float *const c1,
+                                                  const float *const c2, float *const fine, const int j,
+                                                  const int wd)
+{
+  ll_expand_row_plain(c0, c1, c2, fine, j, wd);
+}
+
+static DT_TARGET_AVX512 void ll_reduce_rows_avx512(const float *const input, float *const coarse,
+                                                   float *const h, const int wd, const int cw, const int j0,
+                                                   const int j1)
+{
+  ll_reduce_rows_plain(input, coarse, h, wd, cw, j0, j1);
+}
 #endif
-    for(int i=0;i<=cw-8;i+=8)
-    {
-      __m128 r0, r1, r2, r3, r4, t0, t1;
-      r0 = _mm_load_ps(row0 + i);
-      r1 = _mm_load_ps(row1 + i);
-      r2 = _mm_load_ps(row2 + i);
-      r3 = _mm_load_ps(row3 + i);
-      r4 = _mm_load_ps(row4 + i);
-      r0 = _mm_add_ps(r0, r4);
-      r1 = _mm_add_ps(_mm_add_ps(r1, r3), r2);
-      r0 = _mm_add_ps(r0, _mm_add_ps(r2, r2));
-      t0 = _mm_add_ps(r0, _mm_mul_ps(r1, four));
-
-      r0 = _mm_load_ps(row0 + i + 4);
-      r1 = _mm_load_ps(row1 + i + 4);
-      r2 = _mm_load_ps(row2 + i + 4);
-      r3 = _mm_load_ps(row3 + i + 4);
-      r4 = _mm_load_ps(row4 + i + 4);
-      r0 = _mm_add_ps(r0, r4);
-      r1 = _mm_add_ps(_mm_add_ps(r1, r3), r2);
-      r0 = _mm_add_ps(r0, _mm_add_ps(r2, r2));
-      t1 = _mm_add_ps(r0, _mm_mul_ps(r1, four));
-
-      t0 = _mm_mul_ps(t0, scale);
-      t1 = _mm_mul_ps(t1, scale);
-
-      _mm_storeu_ps(out + i, t0);
-      _mm_storeu_ps(out + i + 4, t1);
-    }
-    // process the rest
-    for(int i=cw&~7;i<cw-1;i++)
-      out[i] = (6*row2[i] + 4*(row1[i] + row3[i]) + row0[i] + row4[i])*(1.0f/256.0f);
-  }
-  dt_free_align(ringbuf);
-  ll_fill_boundary1(coarse, cw, ch);
+
+static void ll_expand_row_plain_func(const float *const c0, const float *const c1, const float *const c2,
+                                     float *const fine, const int j, const int wd)
+{
+  ll_expand_row_plain(c0, c1, c2, fine, j, wd);
+}
+
+static void ll_reduce_rows_plain_func(const float *const input, float *const coarse, float *const h,
+                                      const int wd, const int cw, const int j0, const int j1)
+{
+  ll_reduce_rows_plain(input, coarse, h, wd, cw, j0, j1);
 }
+
+static inline void gauss_expand(
+    const float *const input, // coarse input
+    float *const fine,        // upsampled, blurry output
+    const int wd,             // fine res
+    const int ht,
+    ll_expand_row_func *const expand_row)
+{
+  const int cw = (wd-1)/2+1;
+#ifdef _OPENMP
+#pragma omp parallel for default(none) schedule(static)
 #endif
+  for(int j=1;j<((ht-1)&~1);j++)  // even ht: two px boundary. odd ht: one px.
+    expand_row(input + (size_t)MAX(j/2-1, 0)*cw, input + (size_t)(j/2)*cw, input + (size_t)(j/2+1)*cw,
+               fine + (size_t)j*wd, j, wd);
+  ll_fill_boundary2(fine, wd, ht);
+}
 
 static inline void gauss_reduce(
     const float *const input, // fine input buffer
     float *const coarse,      // coarse scale, blurred input buf
     const int wd,             // fine res
-    const int ht)
+    const int ht,
+    ll_reduce_rows_func *const reduce_rows)
 {
   // blur, store only coarse res
   const int cw = (wd-1)/2+1, ch = (ht-1)/2+1;
 
-  // this is the scalar (non-simd) code:
-  const float a = 0.4f;
-  const float w[5] = {1./4.-a/2., 1./4., a, 1./4., 1./4.-a/2.};
-  memset(coarse, 0, sizeof(float)*cw*ch);
-  // direct 5x5 stencil only on required pixels:
+  // every thread reduces a block of rows, keeping the horizontally filtered fine rows in its own ring
+  // (inspired by opencv's pyrDown_)
+  const int nthreads = MAX(1, MIN(dt_get_num_threads(), ch-2));
+  float *const ringbuf = dt_alloc_align(64, sizeof(float)*5*cw*nthreads);
 #ifdef _OPENMP
-#pragma omp parallel for schedule(static) default(none) collapse(2)
+#pragma omp parallel for default(none) schedule(static) num_threads(nthreads)
 #endif
-  for(int j=1;j<ch-1;j++) for(int i=1;i<cw-1;i++)
-    for(int jj=-2;jj<=2;jj++) for(int ii=-2;ii<=2;ii++)
-      coarse[j*cw+i] += input[(2*j+jj)*wd+2*i+ii] * w[ii+2] * w[jj+2];
+  for(int t=0;t<nthreads;t++)
+    reduce_rows(input, coarse, ringbuf + (size_t)5*cw*t, wd, cw, 1 + (ch-2)*t/nthreads,
+                1 + (ch-2)*(t+1)/nthreads);
+  dt_free_align(ringbuf);
   ll_fill_boundary1(coarse, cw, ch);
 }
 
@@ -460,6 +485,14 @@ void apply_curve(
   for(int j=h-padding;j<h;j++) memcpy(out + w*j, out+w*(h-padding-1), sizeof(float)*w);
 }
 
+// index of the gamma sample above v the output interpolates from, with the one below it
+static inline int ll_gamma_hi(const float *const gamma, const int num, const float v)
+{
+  int hi = 1;
+  for(;hi<num-1 && gamma[hi] <= v;hi++);
+  return hi;
+}
+
 void local_laplacian_internal(
     const float *const input,   // input buffer in some Labx or yuvx format
     float *const out,           // output buffer with colour
@@ -469,10 +502,12 @@ void local_laplacian_internal(
     const float shadows,        // user param: lift shadows
     const float highlights,     // user param: compress highlights
     const float clarity,        // user param: increase clarity/local contrast
+    const int draft,            // sample fewer brightness levels, faster but coarser
     const int use_sse2)         // flag whether to use SSE version
 {
 #define max_levels 30
-#define num_gamma 6
+#define max_gamma 6
+  const int num_gamma = draft ? max_gamma / 2 : max_gamma;
   // don't divide by 2 more often than we can:
   const int num_levels = MIN(max_levels, 31-__builtin_clz(MIN(wd,ht)));
   const int max_supp = 1<<(num_levels-1);
@@ -489,36 +524,55 @@ void local_laplacian_internal(
   for(int l=0;l<num_levels;l++)
     output[l] = dt_alloc_align(16, sizeof(float)*dl(w,l)*dl(h,l));
 
-  // create gauss pyramid of padded input, write coarse directly to output
-#if defined(__SSE2__)
-  if(use_sse2)
+  ll_expand_row_func *expand_row = ll_expand_row_plain_func;
+  ll_reduce_rows_func *reduce_rows = ll_reduce_rows_plain_func;
+#ifdef DT_TARGET_AVX2
+  if(darktable.codepath.AVX512)
   {
-    for(int l=1;l<num_levels-1;l++)
-      gauss_reduce_sse2(padded[l-1], padded[l], dl(w,l-1), dl(h,l-1));
-    gauss_reduce_sse2(padded[num_levels-2], output[num_levels-1], dl(w,num_levels-2), dl(h,num_levels-2));
+    expand_row = ll_expand_row_avx512;
+    reduce_rows = ll_reduce_rows_avx512;
   }
-  else
-#endif
+  else if(darktable.codepath.AVX2)
   {
-    for(int l=1;l<num_levels-1;l++)
-      gauss_reduce(padded[l-1], padded[l], dl(w,l-1), dl(h,l-1));
-    gauss_reduce(padded[num_levels-2], output[num_levels-1], dl(w,num_levels-2), dl(h,num_levels-2));
+    expand_row = ll_expand_row_avx2;
+    reduce_rows = ll_reduce_rows_avx2;
   }
+#endif
+
+  // create gauss pyramid of padded input, write coarse directly to output
+  for(int l=1;l<num_levels-1;l++)
+    gauss_reduce(padded[l-1], padded[l], dl(w,l-1), dl(h,l-1), reduce_rows);
+  gauss_reduce(padded[num_levels-2], output[num_levels-1], dl(w,num_levels-2), dl(h,num_levels-2), reduce_rows);
 
   // evenly sample brightness [0,1]:
-  float gamma[num_gamma] = {0.0f};
+  float gamma[max_gamma] = {0.0f};
   for(int k=0;k<num_gamma;k++) gamma[k] = (k+.5f)/(float)num_gamma;
   // for(int k=0;k<num_gamma;k++) gamma[k] = k/(num_gamma-1.0f);
 
+  // the gaussian levels are weighted averages of the finest, so they stay inside its range and the
+  // interpolation below only ever picks the gamma samples around it. skip the pyramids of the others.
+  float vmin = FLT_MAX, vmax = -FLT_MAX;
+  const float *const pad0 = padded[0];
+#ifdef _OPENMP
+#pragma omp parallel for default(none) schedule(static) shared(w,h) reduction(min:vmin) reduction(max:vmax)
+#endif
+  for(size_t k=0;k<(size_t)w*h;k++)
+  {
+    vmin = fminf(vmin, pad0[k]);
+    vmax = fmaxf(vmax, pad0[k]);
+  }
+  const int kmin = ll_gamma_hi(gamma, num_gamma, vmin) - 1;
+  const int kmax = ll_gamma_hi(gamma, num_gamma, vmax);
+
   // allocate memory for intermediate laplacian pyramids
-  float *buf[num_gamma][max_levels] = {{0}};
-  for(int k=0;k<num_gamma;k++) for(int l=0;l<num_levels;l++)
+  float *buf[max_gamma][max_levels] = {{0}};
+  for(int k=kmin;k<=kmax;k++) for(int l=0;l<num_levels;l++)
     buf[k][l] = dt_alloc_align(16, sizeof(float)*dl(w,l)*dl(h,l));
 
   // the paper says remapping only level 3 not 0 does the trick, too
   // (but i really like the additional octave of sharpness we get,
   // willing to pay the cost).
-  for(int k=0;k<num_gamma;k++)
+  for(int k=kmin;k<=kmax;k++)
   { // process images
 #if defined(__SSE2__)
     if(use_sse2)
@@ -529,12 +583,7 @@ void local_laplacian_internal(
 
     // create gaussian pyramids
     for(int l=1;l<num_levels;l++)
-#if defined(__SSE2__)
-      if(use_sse2)
-        gauss_reduce_sse2(buf[k][l-1], buf[k][l], dl(w,l-1), dl(h,l-1));
-      else
-#endif
-        gauss_reduce(buf[k][l-1], buf[k][l], dl(w,l-1), dl(h,l-1));
+      gauss_reduce(buf[k][l-1], buf[k][l], dl(w,l-1), dl(h,l-1), reduce_rows);
   }
 
   // assemble output pyramid coarse to fine
@@ -542,7 +591,7 @@ void local_laplacian_internal(
   {
     const int pw = dl(w,l), ph = dl(h,l);
 
-    gauss_expand(output[l+1], output[l], pw, ph);
+    gauss_expand(output[l+1], output[l], pw, ph, expand_row);
     // go through all coefficients in the upsampled gauss buffer:
 #ifdef _OPENMP
 #pragma omp parallel for default(none) schedule(static) collapse(2) shared(w,h,buf,output,l,gamma,padded)
@@ -550,9 +599,9 @@ void local_laplacian_internal(
     for(int j=0;j<ph;j++) for(int i=0;i<pw;i++)
     {
       const float v = padded[l][j*pw+i];
-      int hi = 1;
-      for(;hi<num_gamma-1 && gamma[hi] <= v;hi++);
-      int lo = hi-1;
+      // clamped to the pyramids computed, for rounding at the ends of the range
+      const int hi = CLAMPS(ll_gamma_hi(gamma, num_gamma, v), kmin+1, kmax);
+      const int lo = hi-1;
       const float a = CLAMPS((v - gamma[lo])/(gamma[hi]-gamma[lo]), 0.0f, 1.0f);
       const float l0 = ll_laplacian(buf[lo][l+1], buf[lo][l], i, j, pw, ph);
       const float l1 = ll_laplacian(buf[hi][l+1], buf[hi][l], i, j, pw, ph);
@@ -578,10 +627,10 @@ void local_laplacian_internal(
   {
     dt_free_align(padded[l]);
     dt_free_align(output[l]);
-    for(int k = 0; k < num_gamma; k++) dt_free_align(buf[k][l]);
+    for(int k = 0; k < max_gamma; k++) dt_free_align(buf[k][l]);
   }
-#undef num_levels
-#undef num_gamma
+#undef max_levels
+#undef max_gamma
 }
 
 
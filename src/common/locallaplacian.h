@@ -26,6 +26,7 @@ void local_laplacian_internal(
     const float shadows,        // user param: lift shadows
     const float highlights,     // user param: compress highlights
     const float clarity,        // user param: increase clarity/local contrast
+    const int draft,            // sample fewer brightness levels, faster but coarser
     const int use_sse2);        // switch on sse optimised version, if available
 
 void local_laplacian(
@@ -36,9 +37,10 @@ void local_laplacian(
     const float sigma,          // user param: separate shadows/midtones/highlights
     const float shadows,        // user param: lift shadows
     const float highlights,     // user param: compress highlights
-    const float clarity)        // user param: increase clarity/local contrast
+    const float clarity,        // user param: increase clarity/local contrast
+    const int draft)            // sample fewer brightness levels, faster but coarser
 {
-  local_laplacian_internal(input, out, wd, ht, sigma, shadows, highlights, clarity, 0);
+  local_laplacian_internal(input, out, wd, ht, sigma, shadows, highlights, clarity, draft, 0);
 }
 
 size_t local_laplacian_memory_use(const int width,      // width of input image
@@ -58,8 +60,9 @@ void local_laplacian_sse2(
     const float sigma,          // user param: separate shadows/midtones/highlights
     const float shadows,        // user param: lift shadows
     const float highlights,     // user param: compress highlights
-    const float clarity)        // user param: increase clarity/local contrast
+    const float clarity,        // user param: increase clarity/local contrast
+    const int draft)            // sample fewer brightness levels, faster but coarser
 {
-  local_laplacian_internal(input, out, wd, ht, sigma, shadows, highlights, clarity, 1);
+  local_laplacian_internal(input, out, wd, ht, sigma, shadows, highlights, clarity, draft, 1);
 }
 #endif
@@ -0,0 +1,341 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2017 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "common/lut3d.h"
+#include "common/colorspaces.h"
+#include "common/darktable.h"
+#include "common/simd.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+// luts kept in the cache besides the ones in use
+#define DT_LUT3D_CACHE_SIZE 8
+
+// points per axis the error is measured at, in the middle between the nodes of a lut of that size
+#define DT_LUT3D_ERROR_SAMPLES 16
+
+// cell and weights of the tetrahedron the pixel falls into. the cube of the cell is cut along its diagonal from
+// node 000 to node 111 into six of them, one for each order of the fractional coordinates. the pixel then is
+// w0 * c000 + w1 * cA + w2 * cB + w3 * c111, with the nodes cA and cB at offsets a and b from c000.
+static inline size_t _lut3d_locate(const dt_lut3d_t *const lut, const float *const px, float w[4], size_t *a,
+                                   size_t *b)
+{
+  const int n = lut->size;
+  int i[3];
+  float f[3];
+  for(int c = 0; c < 3; c++)
+  {
+    const float x = CLAMPS((px[c] - lut->min[c]) * lut->scale[c], 0.0f, (float)(n - 1));
+    i[c] = MIN((int)x, n - 2);
+    f[c] = x - i[c];
+  }
+  const size_t dx = 4, dy = (size_t)4 * n, dz = (size_t)4 * n * n;
+  float t1, t2, t3;
+  if(f[0] >= f[1])
+  {
+    if(f[1] >= f[2])
+    {
+      *a = dx, *b = dx + dy, t1 = f[0], t2 = f[1], t3 = f[2];
+    }
+    else if(f[0] >= f[2])
+    {
+      *a = dx, *b = dx + dz, t1 = f[0], t2 = f[2], t3 = f[1];
+    }
+    else
+    {
+      *a = dz, *b = dx + dz, t1 = f[2], t2 = f[0], t3 = f[1];
+    }
+  }
+  else
+  {
+    if(f[2] >= f[1])
+    {
+      *a = dz, *b = dy + dz, t1 = f[2], t2 = f[1], t3 = f[0];
+    }
+    else if(f[2] >= f[0])
+    {
+      *a = dy, *b = dy + dz, t1 = f[1], t2 = f[2], t3 = f[0];
+    }
+    else
+    {
+      *a = dy, *b = dx + dy, t1 = f[1], t2 = f[0], t3 = f[2];
+    }
+  }
+  w[0] = 1.0f - t1;
+  w[1] = t1 - t2;
+  w[2] = t2 - t3;
+  w[3] = t3;
+  return dx * i[0] + dy * i[1] + dz * i[2];
+}
+
+void dt_lut3d_apply(const dt_lut3d_t *const lut, const float *const in, float *const out, const size_t npixels)
+{
+  const size_t d111 = (size_t)4 * (1 + lut->size + lut->size * lut->size);
+  for(size_t k = 0; k < 4 * npixels; k += 4)
+  {
+    float w[4];
+    size_t a, b;
+    const float *const c000 = lut->clut + _lut3d_locate(lut, in + k, w, &a, &b);
+    const float alpha = in[k + 3];
+#ifdef DT_SIMD_SSE
+    // every node is a vector of its 4 floats
+    const __m128 o = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(w[0]), _mm_load_ps(c000)),
+                                           _mm_mul_ps(_mm_set1_ps(w[1]), _mm_load_ps(c000 + a))),
+                                _mm_add_ps(_mm_mul_ps(_mm_set1_ps(w[2]), _mm_load_ps(c000 + b)),
+                                           _mm_mul_ps(_mm_set1_ps(w[3]), _mm_load_ps(c000 + d111))));
+    _mm_store_ps(out + k, o);
+#else
+    for(int c = 0; c < 3; c++)
+      out[k + c] = w[0] * c000[c] + w[1] * c000[a + c] + w[2] * c000[b + c] + w[3] * c000[d111 + c];
+#endif
+    out[k + 3] = alpha;
+  }
+}
+
+void dt_lut3d_eval_transform(const float *const in, float *const out, const size_t npixels, void *data)
+{
+  cmsDoTransform((cmsHTRANSFORM)data, in, out, npixels);
+}
+
+// compares the lut to eval in the middle between the nodes, where the interpolation is off the most
+static void _lut3d_measure_error(dt_lut3d_t *lut, const dt_lut3d_eval_t eval, void *const data)
+{
+  const int n = DT_LUT3D_ERROR_SAMPLES;
+  const size_t npixels = (size_t)n * n * n;
+  float *const in = dt_alloc_align(64, sizeof(float) * 4 * npixels);
+  float *const exact = dt_alloc_align(64, sizeof(float) * 4 * npixels);
+  float *const approx = dt_alloc_align(64, sizeof(float) * 4 * npixels);
+  lut->max_error = lut->mean_error = NAN;
+  if(!in || !exact || !approx) goto end;
+
+  // spread the points over all cells, at half steps of the lut
+  const int step = MAX(1, (lut->size - 1) / n);
+  for(size_t k = 0; k < npixels; k++)
+  {
+    const int ijk[3] = { k % n, (k / n) % n, k / n / n };
+    for(int c = 0; c < 3; c++)
+    {
+      const float x = (ijk[c] * step) % (lut->size - 1) + 0.5f;
+      in[4 * k + c] = lut->min[c] + x / lut->scale[c];
+    }
+    in[4 * k + 3] = 0.0f;
+  }
+  eval(in, exact, npixels, data);
+  dt_lut3d_apply(lut, in, approx, npixels);
+
+  double sum = 0.0;
+  float max = 0.0f;
+  for(size_t k = 0; k < npixels; k++)
+    for(int c = 0; c < 3; c++)
+    {
+      const float d = fabsf(exact[4 * k + c] - approx[4 * k + c]);
+      max = MAX(max, d);
+      sum += d;
+    }
+  lut->max_error = max;
+  lut->mean_error = sum / (3.0 * npixels);
+
+end:
+  dt_free_align(in);
+  dt_free_align(exact);
+  dt_free_align(approx);
+}
+
+dt_lut3d_t *dt_lut3d_bake(const int size, const float min[3], const float max[3], const dt_lut3d_eval_t eval,
+                          void *const data)
+{
+  const int n = CLAMPS(size, 2, DT_LUT3D_MAX_SIZE);
+  const size_t nodes = (size_t)n * n * n;
+  dt_lut3d_t *lut = (dt_lut3d_t *)calloc(1, sizeof(dt_lut3d_t));
+  float *const in = dt_alloc_align(64, sizeof(float) * 4 * nodes);
+  if(lut) lut->clut = dt_alloc_align(64, sizeof(float) * 4 * nodes);
+  if(!lut || !lut->clut || !in)
+  {
+    dt_free_align(in);
+    dt_lut3d_free(lut);
+    return NULL;
+  }
+
+  lut->size = n;
+  for(int c = 0; c < 3; c++)
+  {
+    lut->min[c] = min[c];
+    lut->max[c] = max[c];
+    lut->scale[c] = (n - 1) / (max[c] - min[c]);
+  }
+
+  for(size_t k = 0; k < nodes; k++)
+  {
+    const int ijk[3] = { k % n, (k / n) % n, k / n / n };
+    for(int c = 0; c < 3; c++) in[4 * k + c] = min[c] + ijk[c] / lut->scale[c];
+    in[4 * k + 3] = 0.0f;
+  }
+
+  // one plane of nodes per call
+  float *const clut = lut->clut;
+#ifdef _OPENMP
+#pragma omp parallel for default(none) schedule(static)
+#endif
+  for(int z = 0; z < n; z++)
+  {
+    const size_t offset = (size_t)4 * n * n * z;
+    eval(in + offset, clut + offset, (size_t)n * n, data);
+  }
+  dt_free_align(in);
+
+  _lut3d_measure_error(lut, eval, data);
+  return lut;
+}
+
+void dt_lut3d_free(dt_lut3d_t *lut)
+{
+  if(!lut) return;
+  dt_free_align(lut->clut);
+  g_free(lut->key);
+  free(lut);
+}
+
+static gchar *_profile_checksum(cmsHPROFILE profile)
+{
+  cmsUInt32Number size = 0;
+  if(!profile || !cmsSaveProfileToMem(profile, NULL, &size)) return g_strdup("-");
+  void *buf = malloc(size);
+  gchar *sum = NULL;
+  if(buf && cmsSaveProfileToMem(profile, buf, &size)) sum = g_compute_checksum_for_data(G_CHECKSUM_MD5, buf, size);
+  free(buf);
+  return sum ? sum : g_strdup("-");
+}
+
+gchar *dt_lut3d_cache_key(cmsHPROFILE input, cmsHPROFILE output, cmsHPROFILE proof, const int intent,
+                          const cmsUInt32Number flags, const char *tag, const int size)
+{
+  // the profiles themselves rather than their handles, the display profile and the soft proofing copies of
+  // profiles get new handles all the time
+  gchar *in = _profile_checksum(input);
+  gchar *out = _profile_checksum(output);
+  gchar *pr = proof ? _profile_checksum(proof) : g_strdup("-");
+  gchar *key = g_strdup_printf("%s:%s:%s:%s:%d:%u:%d", tag, in, out, pr, intent, flags, size);
+  g_free(in);
+  g_free(out);
+  g_free(pr);
+  return key;
+}
+
+static void _lut3d_unref(dt_lut3d_t *lut)
+{
+  if(--lut->refs == 0) dt_lut3d_free(lut);
+}
+
+dt_lut3d_t *dt_lut3d_cache_get(const char *key, const int size, const float min[3], const float max[3],
+                               const dt_lut3d_eval_t eval, void *const data)
+{
+  dt_colorspaces_t *cs = darktable.color_profiles;
+  dt_pthread_mutex_lock(&cs->luts_lock);
+
+  for(GList *iter = cs->luts; iter; iter = g_list_next(iter))
+  {
+    dt_lut3d_t *lut = (dt_lut3d_t *)iter->data;
+    if(!strcmp(lut->key, key))
+    {
+      // most recently used first
+      cs->luts = g_list_remove_link(cs->luts, iter);
+      cs->luts = g_list_concat(iter, cs->luts);
+      lut->refs++;
+      dt_pthread_mutex_unlock(&cs->luts_lock);
+      return lut;
+    }
+  }
+
+  // baking under the lock, so pipes asking for the same lut at the same time don't all build it
+  dt_times_t start;
+  dt_get_times(&start);
+  dt_lut3d_t *lut = dt_lut3d_bake(size, min, max, eval, data);
+  if(lut)
+  {
+    lut->key = g_strdup(key);
+    lut->refs = 2; // the cache's and the caller's
+    cs->luts = g_list_prepend(cs->luts, lut);
+    if(g_list_length(cs->luts) > DT_LUT3D_CACHE_SIZE)
+    {
+      GList *last = g_list_last(cs->luts);
+      _lut3d_unref((dt_lut3d_t *)last->data);
+      cs->luts = g_list_delete_link(cs->luts, last);
+    }
+    dt_show_times(&start, "[lut3d]", "baking %d^3 nodes, error max %g mean %g", lut->size, lut->max_error,
+                  lut->mean_error);
+  }
+  dt_pthread_mutex_unlock(&cs->luts_lock);
+  return lut;
+}
+
+void dt_lut3d_cache_release(dt_lut3d_t *lut)
+{
+  if(!lut) return;
+  dt_colorspaces_t *cs = darktable.color_profiles;
+  dt_pthread_mutex_lock(&cs->luts_lock);
+  _lut3d_unref(lut);
+  dt_pthread_mutex_unlock(&cs->luts_lock);
+}
+
+void dt_lut3d_cache_cleanup(void)
+{
+  dt_colorspaces_t *cs = darktable.color_profiles;
+  dt_pthread_mutex_lock(&cs->luts_lock);
+  for(GList *iter = cs->luts; iter; iter = g_list_next(iter)) _lut3d_unref((dt_lut3d_t *)iter->data);
+  g_list_free(cs->luts);
+  cs->luts = NULL;
+  dt_pthread_mutex_unlock(&cs->luts_lock);
+}
+
+#ifdef HAVE_OPENCL
+cl_int dt_lut3d_apply_cl(const int devid, const int kernel, const dt_lut3d_t *const lut, cl_mem dev_in,
+                         cl_mem dev_out, const int width, const int height)
+{
+  const size_t bytes = sizeof(float) * 4 * lut->size * lut->size * lut->size;
+  cl_mem dev_clut = dt_opencl_alloc_device_buffer(devid, bytes);
+  if(dev_clut == NULL) return -999;
+  cl_int err = dt_opencl_write_buffer_to_device(devid, lut->clut, dev_clut, 0, bytes, CL_TRUE);
+  if(err != CL_SUCCESS) goto error;
+
+  const float lmin[4] = { lut->min[0], lut->min[1], lut->min[2], 0.0f };
+  const float lscale[4] = { lut->scale[0], lut->scale[1], lut->scale[2], 0.0f };
+  size_t sizes[] = { ROUNDUPWD(width), ROUNDUPHT(height), 1 };
+  dt_opencl_set_kernel_arg(devid, kernel, 0, sizeof(cl_mem), (void *)&dev_in);
+  dt_opencl_set_kernel_arg(devid, kernel, 1, sizeof(cl_mem), (void *)&dev_out);
+  dt_opencl_set_kernel_arg(devid, kernel, 2, sizeof(int), (void *)&width);
+  dt_opencl_set_kernel_arg(devid, kernel, 3, sizeof(int), (void *)&height);
+  dt_opencl_set_kernel_arg(devid, kernel, 4, sizeof(cl_mem), (void *)&dev_clut);
+  dt_opencl_set_kernel_arg(devid, kernel, 5, sizeof(int), (void *)&lut->size);
+  dt_opencl_set_kernel_arg(devid, kernel, 6, 4 * sizeof(float), (void *)lmin);
+  dt_opencl_set_kernel_arg(devid, kernel, 7, 4 * sizeof(float), (void *)lscale);
+  err = dt_opencl_enqueue_kernel_2d(devid, kernel, sizes);
+
+error:
+  dt_opencl_release_mem_object(dev_clut);
+  return err;
+}
+#endif
+
+#undef DT_LUT3D_CACHE_SIZE
+#undef DT_LUT3D_ERROR_SAMPLES
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
@@ -0,0 +1,93 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2017 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "common/opencl.h"
+#include <glib.h>
+#include <lcms2.h>
+#include <stddef.h>
+
+/**
+ * 3d lookup tables a pixel function of three channels is baked into, for the color transforms of littlecms
+ * that are too slow to run per pixel. the function is sampled at size^3 nodes spread evenly over the box
+ * [min, max] of the input and interpolated tetrahedrally, inputs outside of the box are clamped to it.
+ *
+ * building one takes size^3 evaluations, so they are kept in a cache shared by all pipes, keyed by the
+ * profiles, intent and flags of the transform.
+ */
+
+#define DT_LUT3D_MAX_SIZE 129
+
+/** in and out are npixels 4 channel pixels, the function may ignore and change the fourth one */
+typedef void (*dt_lut3d_eval_t)(const float *const in, float *const out, const size_t npixels, void *data);
+
+typedef struct dt_lut3d_t
+{
+  int size;          // nodes per axis
+  float min[3];      // box of the input the nodes are spread over
+  float max[3];
+  float scale[3];    // (size - 1) / (max - min)
+  float *clut;       // size^3 nodes of 4 floats, the first input channel running fastest
+  float max_error;   // largest and average difference of all output channels to the function itself,
+  float mean_error;  // measured away from the nodes
+  gchar *key;        // of the cache, NULL if the lut isn't in there
+  int refs;
+} dt_lut3d_t;
+
+/** samples eval at size^3 nodes over [min, max], NULL if out of memory */
+dt_lut3d_t *dt_lut3d_bake(const int size, const float min[3], const float max[3], const dt_lut3d_eval_t eval,
+                          void *const data);
+void dt_lut3d_free(dt_lut3d_t *lut);
+
+/**
+ * interpolates npixels 4 channel pixels, the fourth channel is copied. in and out are 16 byte aligned and may
+ * be the same.
+ */
+void dt_lut3d_apply(const dt_lut3d_t *const lut, const float *const in, float *const out, const size_t npixels);
+
+/** eval function running the cmsHTRANSFORM passed as data */
+void dt_lut3d_eval_transform(const float *const in, float *const out, const size_t npixels, void *data);
+
+/**
+ * cache key of a lut for the transform from input to output, soft proofed with proof if that's not NULL.
+ * tag tells apart luts of different functions on the same profiles. free the result with g_free().
+ */
+gchar *dt_lut3d_cache_key(cmsHPROFILE input, cmsHPROFILE output, cmsHPROFILE proof, const int intent,
+                          const cmsUInt32Number flags, const char *tag, const int size);
+
+/**
+ * the cached lut of key, baked with dt_lut3d_bake() if there is none. the caller holds a reference until
+ * dt_lut3d_cache_release(). NULL if baking failed.
+ */
+dt_lut3d_t *dt_lut3d_cache_get(const char *key, const int size, const float min[3], const float max[3],
+                               const dt_lut3d_eval_t eval, void *const data);
+void dt_lut3d_cache_release(dt_lut3d_t *lut);
+
+/** drops all luts nobody holds, called on shutdown */
+void dt_lut3d_cache_cleanup(void);
+
+#ifdef HAVE_OPENCL
+/** dt_lut3d_apply() on a device, kernel is lut3d_tetrahedral of basic.cl */
+cl_int dt_lut3d_apply_cl(const int devid, const int kernel, const dt_lut3d_t *const lut, cl_mem dev_in,
+                         cl_mem dev_out, const int width, const int height);
+#endif
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
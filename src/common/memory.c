@@ -0,0 +1,371 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2017 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "common/memory.h"
+#include "common/darktable.h"
+#include "control/conf.h"
+
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+// the budget never shrinks below this fraction of the configured one
+#define DT_MEMORY_MIN_SCALE 0.125f
+// seconds without pressure before the budget grows again, one step each
+#define DT_MEMORY_CALM_PERIOD 10
+
+static void _memory_monitor_start(dt_memory_t *memory);
+static void _memory_monitor_stop(dt_memory_t *memory);
+
+void dt_memory_init(dt_memory_t *memory)
+{
+  memset(memory, 0, sizeof(*memory));
+  dt_pthread_mutex_init(&memory->lock, NULL);
+
+  // by default three quarters of the ram, the rest is left to the system and everything we don't track
+  const int64_t budget = dt_conf_get_int64("memory_budget");
+  const size_t total = dt_get_total_memory() * (size_t)1024;
+  if(budget > 0)
+    memory->budget = (size_t)budget << 20;
+  else if(total)
+    memory->budget = total / 4 * 3;
+  else
+    memory->budget = (size_t)4 << 30;
+  memory->configured = memory->budget;
+  memory->scale = 1.0f;
+
+  memory->tiling.name = "tiling";
+  memory->tiling.priority = G_MAXINT;
+  dt_memory_register(memory, &memory->tiling);
+
+  dt_print(DT_DEBUG_MEMORY, "[memory] budget of %zu MB for caches, pipes and tiling\n", memory->budget >> 20);
+
+  _memory_monitor_start(memory);
+}
+
+void dt_memory_cleanup(dt_memory_t *memory)
+{
+  _memory_monitor_stop(memory);
+  g_list_free(memory->consumers);
+  memory->consumers = NULL;
+  dt_pthread_mutex_destroy(&memory->lock);
+}
+
+static gint _consumer_priority_cmp(gconstpointer a, gconstpointer b)
+{
+  const dt_memory_consumer_t *ca = (const dt_memory_consumer_t *)a;
+  const dt_memory_consumer_t *cb = (const dt_memory_consumer_t *)b;
+  return (ca->priority > cb->priority) - (ca->priority < cb->priority);
+}
+
+void dt_memory_register(dt_memory_t *memory, dt_memory_consumer_t *consumer)
+{
+  if(!memory) return;
+  dt_pthread_mutex_lock(&memory->lock);
+  memory->consumers = g_list_insert_sorted(memory->consumers, consumer, _consumer_priority_cmp);
+  dt_pthread_mutex_unlock(&memory->lock);
+}
+
+void dt_memory_unregister(dt_memory_t *memory, dt_memory_consumer_t *consumer)
+{
+  if(!memory) return;
+  dt_pthread_mutex_lock(&memory->lock);
+  memory->consumers = g_list_remove(memory->consumers, consumer);
+  dt_pthread_mutex_unlock(&memory->lock);
+}
+
+static size_t _consumer_used(const dt_memory_consumer_t *consumer)
+{
+  const size_t used = consumer->usage ? consumer->usage(consumer->data) : 0;
+  return used + consumer->reserved;
+}
+
+// governor lock has to be held.
+static size_t _memory_used(const dt_memory_t *memory)
+{
+  size_t used = 0;
+  for(const GList *l = memory->consumers; l; l = g_list_next(l))
+  {
+    dt_memory_consumer_t *consumer = (dt_memory_consumer_t *)l->data;
+    const size_t c = _consumer_used(consumer);
+    consumer->peak = MAX(consumer->peak, c);
+    used += c;
+  }
+  return used;
+}
+
+static inline size_t _memory_free(const dt_memory_t *memory, const size_t used)
+{
+  return used < memory->budget ? memory->budget - used : 0;
+}
+
+// governor lock has to be held. with wanted 0 this shrinks everything back into the budget.
+static size_t _memory_make_room(dt_memory_t *memory, const size_t wanted)
+{
+  size_t used = _memory_used(memory);
+  for(const GList *l = memory->consumers; l && used + wanted > memory->budget; l = g_list_next(l))
+  {
+    const dt_memory_consumer_t *consumer = (const dt_memory_consumer_t *)l->data;
+    if(!consumer->reclaim) continue;
+    const size_t freed = consumer->reclaim(consumer->data, used + wanted - memory->budget);
+    if(!freed) continue;
+    memory->reclaimed += freed;
+    memory->reclaims++;
+    dt_print(DT_DEBUG_MEMORY, "[memory] %s gave back %zu MB\n", consumer->name, freed >> 20);
+    used = _memory_used(memory);
+  }
+  return _memory_free(memory, used);
+}
+
+gboolean dt_memory_reserve(dt_memory_t *memory, dt_memory_consumer_t *consumer, size_t size)
+{
+  if(!memory) return TRUE;
+  dt_pthread_mutex_lock(&memory->lock);
+  const size_t available = _memory_make_room(memory, size);
+  consumer->reserved += size;
+  consumer->peak = MAX(consumer->peak, _consumer_used(consumer));
+  dt_pthread_mutex_unlock(&memory->lock);
+  if(available < size)
+    dt_print(DT_DEBUG_MEMORY, "[memory] %s exceeds the budget by %zu MB\n", consumer->name,
+             (size - available) >> 20);
+  return available >= size;
+}
+
+void dt_memory_release(dt_memory_t *memory, dt_memory_consumer_t *consumer, size_t size)
+{
+  if(!memory) return;
+  dt_pthread_mutex_lock(&memory->lock);
+  consumer->reserved -= MIN(size, consumer->reserved);
+  dt_pthread_mutex_unlock(&memory->lock);
+}
+
+size_t dt_memory_used(dt_memory_t *memory)
+{
+  if(!memory) return 0;
+  dt_pthread_mutex_lock(&memory->lock);
+  const size_t used = _memory_used(memory);
+  dt_pthread_mutex_unlock(&memory->lock);
+  return used;
+}
+
+size_t dt_memory_make_room(dt_memory_t *memory, size_t wanted)
+{
+  if(!memory) return SIZE_MAX;
+  dt_pthread_mutex_lock(&memory->lock);
+  const size_t available = _memory_make_room(memory, wanted);
+  dt_pthread_mutex_unlock(&memory->lock);
+  return available;
+}
+
+void dt_memory_set_scale(dt_memory_t *memory, float scale)
+{
+  if(!memory) return;
+  scale = CLAMPS(scale, DT_MEMORY_MIN_SCALE, 1.0f);
+  dt_pthread_mutex_lock(&memory->lock);
+  memory->scale = scale;
+  memory->budget = memory->configured * scale;
+  for(const GList *l = memory->consumers; l; l = g_list_next(l))
+  {
+    const dt_memory_consumer_t *consumer = (const dt_memory_consumer_t *)l->data;
+    if(consumer->limit) consumer->limit(consumer->data, scale);
+  }
+  _memory_make_room(memory, 0);
+  dt_pthread_mutex_unlock(&memory->lock);
+  dt_print(DT_DEBUG_MEMORY, "[memory] budget scaled to %zu MB\n", memory->budget >> 20);
+}
+
+gboolean dt_memory_under_pressure(dt_memory_t *memory)
+{
+  return memory && memory->scale < 1.0f;
+}
+
+#ifdef __linux__
+// the "some avg10" percentage of a psi file, -1 if there is none
+static float _memory_read_psi(const char *path)
+{
+  FILE *f = g_fopen(path, "r");
+  if(!f) return -1.0f;
+  float avg10 = -1.0f;
+  char line[256];
+  while(fgets(line, sizeof(line), f))
+    if(sscanf(line, "some avg10=%f", &avg10) == 1) break;
+  fclose(f);
+  return avg10;
+}
+
+// times the cgroup went over its high or max limit, or ran out of memory
+static uint64_t _memory_read_events(const char *path)
+{
+  FILE *f = g_fopen(path, "r");
+  if(!f) return 0;
+  uint64_t events = 0;
+  char line[256], key[64];
+  uint64_t value;
+  while(fgets(line, sizeof(line), f))
+    if(sscanf(line, "%63s %" SCNu64, key, &value) == 2
+       && (!strcmp(key, "high") || !strcmp(key, "max") || !strcmp(key, "oom")))
+      events += value;
+  fclose(f);
+  return events;
+}
+
+// directory of our cgroup in the v2 hierarchy, NULL if there is none
+static gchar *_memory_cgroup_dir(void)
+{
+  gchar *contents = NULL;
+  if(!g_file_get_contents("/proc/self/cgroup", &contents, NULL, NULL)) return NULL;
+  gchar *dir = NULL;
+  gchar **lines = g_strsplit(contents, "\n", -1);
+  for(gchar **line = lines; *line && !dir; line++)
+    if(g_str_has_prefix(*line, "0::")) dir = g_strconcat("/sys/fs/cgroup", *line + 3, NULL);
+  g_strfreev(lines);
+  g_free(contents);
+  return dir;
+}
+
+static void *_memory_monitor_thread(void *data)
+{
+  dt_memory_t *memory = (dt_memory_t *)data;
+  const float threshold = dt_conf_get_float("memory_pressure_threshold");
+  gchar *cgroup = _memory_cgroup_dir();
+  // the pressure inside our cgroup if it is accounted, else the one of the system
+  gchar *psi = cgroup ? g_build_filename(cgroup, "memory.pressure", NULL) : NULL;
+  if(!psi || _memory_read_psi(psi) < 0.0f)
+  {
+    g_free(psi);
+    psi = g_strdup("/proc/pressure/memory");
+  }
+  gchar *events = cgroup ? g_build_filename(cgroup, "memory.events", NULL) : NULL;
+  uint64_t last_events = events ? _memory_read_events(events) : 0;
+  float scale = 1.0f;
+  int calm = 0;
+
+  dt_pthread_mutex_lock(&memory->monitor_lock);
+  while(memory->monitor_running)
+  {
+    struct timespec until;
+    clock_gettime(CLOCK_REALTIME, &until);
+    until.tv_sec += 1;
+    dt_pthread_cond_timedwait(&memory->monitor_cond, &memory->monitor_lock, &until);
+    if(!memory->monitor_running) break;
+    dt_pthread_mutex_unlock(&memory->monitor_lock);
+
+    const uint64_t current_events = events ? _memory_read_events(events) : 0;
+    const gboolean pressure = _memory_read_psi(psi) >= threshold || current_events > last_events;
+    last_events = current_events;
+
+    if(pressure)
+    {
+      calm = 0;
+      if(scale > DT_MEMORY_MIN_SCALE)
+      {
+        scale = MAX(scale * 0.5f, DT_MEMORY_MIN_SCALE);
+        dt_print(DT_DEBUG_MEMORY, "[memory] system under memory pressure, shrinking the caches\n");
+        dt_memory_set_scale(memory, scale);
+      }
+    }
+    else if(scale < 1.0f && ++calm >= DT_MEMORY_CALM_PERIOD)
+    {
+      calm = 0;
+      scale = MIN(scale * 2.0f, 1.0f);
+      dt_memory_set_scale(memory, scale);
+    }
+
+    dt_pthread_mutex_lock(&memory->monitor_lock);
+  }
+  dt_pthread_mutex_unlock(&memory->monitor_lock);
+
+  g_free(events);
+  g_free(psi);
+  g_free(cgroup);
+  return NULL;
+}
+#endif
+
+static void _memory_monitor_start(dt_memory_t *memory)
+{
+  memory->monitor_running = 0;
+#ifdef __linux__
+  if(dt_conf_get_float("memory_pressure_threshold") <= 0.0f) return;
+  // kernels before 4.20, or without CONFIG_PSI, have nothing to watch
+  if(_memory_read_psi("/proc/pressure/memory") < 0.0f) return;
+  dt_pthread_mutex_init(&memory->monitor_lock, NULL);
+  pthread_cond_init(&memory->monitor_cond, NULL);
+  memory->monitor_running = 1;
+  if(dt_pthread_create(&memory->monitor_thread, _memory_monitor_thread, memory))
+  {
+    fprintf(stderr, "[memory] could not start the memory pressure monitor\n");
+    memory->monitor_running = 0;
+    pthread_cond_destroy(&memory->monitor_cond);
+    dt_pthread_mutex_destroy(&memory->monitor_lock);
+  }
+#endif
+}
+
+static void _memory_monitor_stop(dt_memory_t *memory)
+{
+  if(!memory->monitor_running) return;
+  dt_pthread_mutex_lock(&memory->monitor_lock);
+  memory->monitor_running = 0;
+  pthread_cond_signal(&memory->monitor_cond);
+  dt_pthread_mutex_unlock(&memory->monitor_lock);
+  pthread_join(memory->monitor_thread, NULL);
+  pthread_cond_destroy(&memory->monitor_cond);
+  dt_pthread_mutex_destroy(&memory->monitor_lock);
+}
+
+void dt_memory_print(dt_memory_t *memory)
+{
+  if(!memory) return;
+  dt_pthread_mutex_lock(&memory->lock);
+  // consumers of the same kind, like the pipes, are summed up and show up once
+  GList *printed = NULL;
+  size_t total = 0;
+  for(const GList *l = memory->consumers; l; l = g_list_next(l))
+  {
+    const dt_memory_consumer_t *consumer = (const dt_memory_consumer_t *)l->data;
+    if(g_list_find_custom(printed, consumer->name, (GCompareFunc)g_strcmp0)) continue;
+    size_t used = 0, peak = 0;
+    int count = 0;
+    for(const GList *m = l; m; m = g_list_next(m))
+    {
+      const dt_memory_consumer_t *other = (const dt_memory_consumer_t *)m->data;
+      if(g_strcmp0(other->name, consumer->name)) continue;
+      used += _consumer_used(other);
+      peak = MAX(peak, other->peak);
+      count++;
+    }
+    total += used;
+    printed = g_list_prepend(printed, (gpointer)consumer->name);
+    fprintf(stderr, "[memory] %-20s %3dx %10zu kB (peak of one %zu kB)\n", consumer->name, count, used >> 10,
+            peak >> 10);
+  }
+  fprintf(stderr, "[memory] governed total        %10zu kB of %zu kB, %u reclaims gave back %zu kB\n",
+          total >> 10, memory->budget >> 10, memory->reclaims, memory->reclaimed >> 10);
+  g_list_free(printed);
+  dt_pthread_mutex_unlock(&memory->lock);
+}
+
+#undef DT_MEMORY_MIN_SCALE
+#undef DT_MEMORY_CALM_PERIOD
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
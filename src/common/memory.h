@@ -0,0 +1,101 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2017 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "common/dtpthread.h"
+#include <glib.h>
+#include <stddef.h>
+
+/*
+ * the memory governor keeps one budget for the big memory users: the caches tell it what they hold, pipes and
+ * tiling reserve what they are about to allocate. when a reservation or tiling needs more than is left, the
+ * governor asks the caches that can give memory back to shrink, cheapest first.
+ * on linux a monitor thread watches the pressure stall information and the memory.events of our cgroup. while
+ * the system is short on memory the budget and the quotas of the caches are scaled down, and they grow back to
+ * what is configured once the pressure is gone.
+ * all functions accept a NULL governor and then do nothing, so code paths running without dt_init() are fine.
+ */
+
+// bytes currently held by a consumer
+typedef size_t (*dt_memory_usage_t)(void *data);
+// try to free about wanted bytes, returns how much was freed. must not call back into the governor.
+typedef size_t (*dt_memory_reclaim_t)(void *data, size_t wanted);
+// scale the quotas to fraction of what they are configured to, 1 restores them. must not call back either.
+typedef void (*dt_memory_limit_t)(void *data, float fraction);
+
+typedef struct dt_memory_consumer_t
+{
+  const char *name;
+  dt_memory_usage_t usage;     // NULL if the consumer only reserves
+  dt_memory_reclaim_t reclaim; // NULL if nothing can be given back on request
+  dt_memory_limit_t limit;     // NULL if there are no quotas to shrink under memory pressure
+  void *data;
+  int priority; // consumers with lower priority are asked to reclaim first
+  size_t reserved, peak; // bytes reserved through dt_memory_reserve(), and the most that ever was
+} dt_memory_consumer_t;
+
+typedef struct dt_memory_t
+{
+  dt_pthread_mutex_t lock; // protects the list of consumers and serializes reclaims
+  GList *consumers;        // sorted by priority
+  size_t budget;           // in bytes
+  size_t configured;       // the budget without memory pressure
+  float scale;             // budget / configured
+  // the consumers of the governor itself, for buffers not owned by any cache
+  dt_memory_consumer_t tiling;
+  // the pressure monitor, running if monitor_running is set
+  dt_pthread_mutex_t monitor_lock;
+  pthread_cond_t monitor_cond;
+  pthread_t monitor_thread;
+  int monitor_running;
+  // stats:
+  size_t reclaimed;
+  uint32_t reclaims;
+} dt_memory_t;
+
+void dt_memory_init(dt_memory_t *memory);
+void dt_memory_cleanup(dt_memory_t *memory);
+
+// consumers have to stay valid until they are unregistered
+void dt_memory_register(dt_memory_t *memory, dt_memory_consumer_t *consumer);
+void dt_memory_unregister(dt_memory_t *memory, dt_memory_consumer_t *consumer);
+
+// accounts size bytes to consumer and makes room for them if the budget is exceeded. the reservation always
+// succeeds, returns FALSE if even after reclaiming it doesn't fit the budget.
+gboolean dt_memory_reserve(dt_memory_t *memory, dt_memory_consumer_t *consumer, size_t size);
+void dt_memory_release(dt_memory_t *memory, dt_memory_consumer_t *consumer, size_t size);
+
+// bytes used by all consumers together
+size_t dt_memory_used(dt_memory_t *memory);
+// reclaims from the caches until wanted bytes are free in the budget, or nothing more can be freed.
+// returns the bytes free afterwards, SIZE_MAX without a governor.
+size_t dt_memory_make_room(dt_memory_t *memory, size_t wanted);
+
+// scales the budget and the cache quotas to fraction of the configuration and shrinks the caches to fit.
+// the pressure monitor calls this, 1 restores everything.
+void dt_memory_set_scale(dt_memory_t *memory, float scale);
+// TRUE while the quotas are scaled down, things that can wait, like prefetching, should
+gboolean dt_memory_under_pressure(dt_memory_t *memory);
+
+// current usage by consumer, with -d memory
+void dt_memory_print(dt_memory_t *memory);
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
@@ -22,12 +22,22 @@
 #include "common/exif.h"
 #include "common/grealpath.h"
 #include "common/image_cache.h"
+#include "common/image_compression.h"
 #include "common/imageio.h"
+#ifdef HAVE_OPENJPEG
+#include "common/imageio_j2k.h"
+#endif
 #include "common/imageio_jpeg.h"
 #include "common/imageio_module.h"
+#include "common/imageio_tiff.h"
+#include "common/mipmap_pack.h"
+#include "common/opencl.h"
+#include "common/timers.h"
+#include "common/trace.h"
 #include "control/conf.h"
 #include "control/jobs.h"
 #include "develop/imageop_math.h"
+#include "develop/pixelpipe.h"
 
 #include <assert.h>
 #include <errno.h>
@@ -39,6 +49,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <zlib.h>
 #if defined(__SSE__)
 #include <xmmintrin.h>
 #endif
@@ -58,7 +69,8 @@ typedef enum dt_mipmap_buffer_dsc_flags
 {
   DT_MIPMAP_BUFFER_DSC_FLAG_NONE = 0,
   DT_MIPMAP_BUFFER_DSC_FLAG_GENERATE = 1 << 0,
-  DT_MIPMAP_BUFFER_DSC_FLAG_INVALIDATE = 1 << 1
+  DT_MIPMAP_BUFFER_DSC_FLAG_INVALIDATE = 1 << 1,
+  DT_MIPMAP_BUFFER_DSC_FLAG_RGBA_F = 1 << 2 // DT_MIPMAP_F buffer holds 4 channel floats, not mosaic data
 } dt_mipmap_buffer_dsc_flags;
 
 // the embedded Exif data to tag thumbnails as sRGB or AdobeRGB
@@ -235,7 +247,7 @@ exit:
 }
 
 static void _init_f(dt_mipmap_buffer_t *mipmap_buf, float *buf, uint32_t *width, uint32_t *height, float *iscale,
-                    const uint32_t imgid);
+                    dt_mipmap_buffer_dsc_flags *flags, const uint32_t imgid);
 static void _init_8(uint8_t *buf, uint32_t *width, uint32_t *height, float *iscale,
                     dt_colorspaces_color_profile_type_t *color_space, const uint32_t imgid,
                     const dt_mipmap_size_t size);
@@ -304,6 +316,657 @@ void *dt_mipmap_cache_alloc(dt_mipmap_buffer_t *buf, const dt_image_t *img)
   return dsc + 1;
 }
 
+static int32_t _compact_pack_job_run(dt_job_t *job)
+{
+  dt_mipmap_pack_compact((dt_mipmap_pack_t *)dt_control_job_get_params(job));
+  return 0;
+}
+
+// hand stale space in the packed disk cache back in the background once enough has piled up
+static void _maybe_compact_pack(dt_mipmap_pack_t *pack)
+{
+  if(!darktable.control || !dt_mipmap_pack_needs_compaction(pack)) return;
+  dt_job_t *job = dt_control_job_create(&_compact_pack_job_run, "compact thumbnail cache");
+  if(job)
+  {
+    // no destroy callback, the pack is owned by the mipmap cache:
+    dt_control_job_set_params(job, pack, NULL);
+    if(!dt_control_add_job(darktable.control, DT_JOB_QUEUE_SYSTEM_BG, job)) return;
+  }
+  // couldn't schedule, try again right away:
+  dt_mipmap_pack_compact(pack);
+}
+
+// header of thumbnails stored with DT_MIPMAP_DISK_CODEC_DEFLATE, followed by the zlib stream of the 8-bit buffer
+#define DT_MIPMAP_DEFLATE_MAGIC 0x317a7464u // "dtz1"
+typedef struct dt_mipmap_deflate_header_t
+{
+  uint32_t magic;
+  uint32_t width;
+  uint32_t height;
+  int32_t color_space;
+} dt_mipmap_deflate_header_t;
+
+// only so many evicted buffers may wait for the background writer, beyond that eviction writes itself
+#define DT_MIPMAP_WRITER_MAX_QUEUE 128
+
+// an evicted thumbnail waiting for the background writer. owns the cache line data.
+typedef struct dt_mipmap_disk_write_t
+{
+  uint32_t key;
+  void *data;
+  int cancelled; // invalidated while queued, must not (or no longer) be on disk
+} dt_mipmap_disk_write_t;
+
+static void _disk_thumbnail_filename(const dt_mipmap_cache_t *cache, const dt_mipmap_size_t mip,
+                                     const uint32_t imgid, const dt_mipmap_disk_codec_t codec, char *filename,
+                                     size_t size)
+{
+  snprintf(filename, size, "%s.d/%d/%d.%s", cache->cachedir, mip, imgid,
+           codec == DT_MIPMAP_DISK_CODEC_DEFLATE ? "dtz" : "jpg");
+}
+
+static void _unlink_disk_thumbnail(dt_mipmap_cache_t *cache, const uint32_t imgid, const dt_mipmap_size_t mip)
+{
+  if(cache->pack[mip])
+  {
+    dt_mipmap_pack_remove(cache->pack[mip], imgid);
+    _maybe_compact_pack(cache->pack[mip]);
+  }
+  else if(cache->cachedir[0])
+  {
+    // remove any codec, the user might have switched it in between
+    char filename[PATH_MAX] = { 0 };
+    _disk_thumbnail_filename(cache, mip, imgid, DT_MIPMAP_DISK_CODEC_JPEG, filename, sizeof(filename));
+    g_unlink(filename);
+    _disk_thumbnail_filename(cache, mip, imgid, DT_MIPMAP_DISK_CODEC_DEFLATE, filename, sizeof(filename));
+    g_unlink(filename);
+  }
+}
+
+static void dt_mipmap_cache_unlink_ondisk_thumbnail(void *data, uint32_t imgid, dt_mipmap_size_t mip)
+{
+  dt_mipmap_cache_t *cache = (dt_mipmap_cache_t *)data;
+
+  // drop a pending write first, or the writer would bring the thumbnail back:
+  if(cache->writer_pending)
+  {
+    dt_pthread_mutex_lock(&cache->writer_lock);
+    dt_mipmap_disk_write_t *job = g_hash_table_lookup(cache->writer_pending, GUINT_TO_POINTER(get_key(imgid, mip)));
+    if(job)
+    {
+      job->cancelled = 1;
+      g_hash_table_remove(cache->writer_pending, GUINT_TO_POINTER(job->key));
+    }
+    dt_pthread_mutex_unlock(&cache->writer_lock);
+  }
+
+  // also remove jpg backing (always try to do that, in case user just temporarily switched it off,
+  // to avoid inconsistencies.
+  // if(dt_conf_get_bool("cache_disk_backend"))
+  _unlink_disk_thumbnail(cache, imgid, mip);
+}
+
+int dt_mipmap_cache_has_disk_thumbnail(const dt_mipmap_cache_t *cache, const uint32_t imgid,
+                                       const dt_mipmap_size_t mip)
+{
+  if(!cache->cachedir[0] || mip >= DT_MIPMAP_F) return 0;
+  if(cache->writer_pending)
+  {
+    // about to be written counts as written:
+    dt_pthread_mutex_lock((dt_pthread_mutex_t *)&cache->writer_lock);
+    const int pending = g_hash_table_contains(cache->writer_pending, GUINT_TO_POINTER(get_key(imgid, mip)));
+    dt_pthread_mutex_unlock((dt_pthread_mutex_t *)&cache->writer_lock);
+    if(pending) return 1;
+  }
+  if(cache->pack[mip]) return dt_mipmap_pack_contains(cache->pack[mip], imgid);
+  char filename[PATH_MAX] = { 0 };
+  _disk_thumbnail_filename(cache, mip, imgid, cache->codec, filename, sizeof(filename));
+  return g_file_test(filename, G_FILE_TEST_EXISTS);
+}
+
+// returns the encoded thumbnail from the disk cache, free with g_free(). color_space is only set by the packed format.
+static uint8_t *_read_disk_thumbnail(dt_mipmap_cache_t *cache, const uint32_t imgid, const dt_mipmap_size_t mip,
+                                     size_t *len, int32_t *color_space)
+{
+  if(cache->pack[mip]) return dt_mipmap_pack_read(cache->pack[mip], imgid, len, color_space);
+
+  char filename[PATH_MAX] = { 0 };
+  _disk_thumbnail_filename(cache, mip, imgid, cache->codec, filename, sizeof(filename));
+  gchar *blob = NULL;
+  gsize length = 0;
+  if(!g_file_get_contents(filename, &blob, &length, NULL)) return NULL;
+  if(length == 0)
+  {
+    g_free(blob);
+    g_unlink(filename);
+    return NULL;
+  }
+  *len = length;
+  return (uint8_t *)blob;
+}
+
+// decode a thumbnail from the disk cache into the cache line. returns non zero on failure.
+static int _decode_disk_thumbnail(dt_mipmap_cache_t *cache, const dt_mipmap_size_t mip, const uint8_t *blob,
+                                  const size_t len, const int32_t pack_color_space,
+                                  struct dt_mipmap_buffer_dsc *dsc)
+{
+  const dt_mipmap_deflate_header_t *hdr = (const dt_mipmap_deflate_header_t *)blob;
+  if(len > sizeof(*hdr) && hdr->magic == DT_MIPMAP_DEFLATE_MAGIC)
+  {
+    if(hdr->width > cache->max_width[mip] || hdr->height > cache->max_height[mip]) return 1;
+    uLongf out_len = (uLongf)4 * hdr->width * hdr->height;
+    if(uncompress((Bytef *)(dsc + 1), &out_len, blob + sizeof(*hdr), len - sizeof(*hdr)) != Z_OK
+       || out_len != (uLongf)4 * hdr->width * hdr->height)
+      return 1;
+    dsc->width = hdr->width;
+    dsc->height = hdr->height;
+    dsc->color_space = hdr->color_space;
+    return 0;
+  }
+
+  dt_colorspaces_color_profile_type_t color_space;
+  dt_imageio_jpeg_t jpg;
+  if(dt_imageio_jpeg_decompress_header(blob, len, &jpg)
+     || (jpg.width > cache->max_width[mip] || jpg.height > cache->max_height[mip])
+     // the packed format keeps the color space in its index, single files carry it in their exif data:
+     || ((color_space = cache->pack[mip] ? (dt_colorspaces_color_profile_type_t)pack_color_space
+                                         : dt_imageio_jpeg_read_color_space(&jpg)) == DT_COLORSPACE_NONE) // pointless test to keep it in the if clause
+     || dt_imageio_jpeg_decompress(&jpg, (uint8_t *)(dsc + 1)))
+    return 1;
+  dsc->width = jpg.width;
+  dsc->height = jpg.height;
+  dsc->color_space = color_space;
+  return 0;
+}
+
+// serve a thumbnail that was evicted but not written yet straight from the writer queue
+static int _read_pending_thumbnail(dt_mipmap_cache_t *cache, const uint32_t key, void *data, const size_t size)
+{
+  if(!cache->writer_pending) return 0;
+  dt_pthread_mutex_lock(&cache->writer_lock);
+  const dt_mipmap_disk_write_t *job = g_hash_table_lookup(cache->writer_pending, GUINT_TO_POINTER(key));
+  if(job) memcpy(data, job->data, size);
+  dt_pthread_mutex_unlock(&cache->writer_lock);
+  return job != NULL;
+}
+
+// a cold DT_MIPMAP_F buffer, compressed with dt_image_compress() which packs 4x4 blocks into 16 bytes
+typedef struct dt_mipmap_compressed_t
+{
+  uint32_t width, height; // of the image, the blocks cover both rounded up to multiples of 4
+  float iscale;
+  size_t size;
+  uint8_t *data;
+} dt_mipmap_compressed_t;
+
+static void _compressed_free(gpointer data)
+{
+  dt_mipmap_compressed_t *c = (dt_mipmap_compressed_t *)data;
+  free(c->data);
+  free(c);
+}
+
+// decompress a cold float buffer into the cache line, returns non zero if there is none.
+static int _read_compressed_f(dt_mipmap_cache_t *cache, const uint32_t key, struct dt_mipmap_buffer_dsc *dsc)
+{
+  if(!cache->mip_f_compressed) return 1;
+  dt_pthread_mutex_lock(&cache->mip_f_compressed_lock);
+  dt_mipmap_compressed_t *c = g_hash_table_lookup(cache->mip_f_compressed, GUINT_TO_POINTER(key));
+  if(!c)
+  {
+    dt_pthread_mutex_unlock(&cache->mip_f_compressed_lock);
+    return 1;
+  }
+  // bump in lru
+  g_queue_remove(cache->mip_f_compressed_lru, GUINT_TO_POINTER(key));
+  g_queue_push_tail(cache->mip_f_compressed_lru, GUINT_TO_POINTER(key));
+
+  const int wd4 = (c->width + 3) & ~3, ht4 = (c->height + 3) & ~3;
+  float *rgb = dt_alloc_align(64, sizeof(float) * 3 * wd4 * ht4);
+  if(!rgb)
+  {
+    dt_pthread_mutex_unlock(&cache->mip_f_compressed_lock);
+    return 1;
+  }
+  dt_image_uncompress(c->data, rgb, wd4, ht4);
+  const uint32_t width = c->width, height = c->height;
+  dsc->width = width;
+  dsc->height = height;
+  dsc->iscale = c->iscale;
+  dt_pthread_mutex_unlock(&cache->mip_f_compressed_lock);
+
+  float *out = (float *)(dsc + 1);
+#ifdef _OPENMP
+#pragma omp parallel for default(none) shared(out, rgb) schedule(static)
+#endif
+  for(uint32_t j = 0; j < height; j++)
+    for(uint32_t i = 0; i < width; i++)
+    {
+      for(int k = 0; k < 3; k++) out[4 * (j * width + i) + k] = rgb[3 * (j * wd4 + i) + k];
+      out[4 * (j * width + i) + 3] = 0.0f;
+    }
+  dt_free_align(rgb);
+  dsc->flags |= DT_MIPMAP_BUFFER_DSC_FLAG_RGBA_F;
+  return 0;
+}
+
+// keep an evicted float buffer around in compressed form, dropping the least recently used ones beyond quota
+static void _write_compressed_f(dt_mipmap_cache_t *cache, const uint32_t key,
+                                const struct dt_mipmap_buffer_dsc *dsc)
+{
+  dt_pthread_mutex_lock(&cache->mip_f_compressed_lock);
+  // nothing new to learn, and recompressing would only lose more detail:
+  const int contained = g_hash_table_contains(cache->mip_f_compressed, GUINT_TO_POINTER(key));
+  dt_pthread_mutex_unlock(&cache->mip_f_compressed_lock);
+  if(contained) return;
+
+  const int wd4 = (dsc->width + 3) & ~3, ht4 = (dsc->height + 3) & ~3;
+  float *rgb = dt_alloc_align(64, sizeof(float) * 3 * wd4 * ht4);
+  dt_mipmap_compressed_t *c = (dt_mipmap_compressed_t *)malloc(sizeof(dt_mipmap_compressed_t));
+  uint8_t *data = (uint8_t *)malloc((size_t)wd4 * ht4);
+  if(!rgb || !c || !data)
+  {
+    dt_free_align(rgb);
+    free(c);
+    free(data);
+    return;
+  }
+
+  // pad the border by replicating the last row and column, the compression works on 4x4 blocks
+  const float *in = (const float *)(dsc + 1);
+  const int width = dsc->width, height = dsc->height;
+#ifdef _OPENMP
+#pragma omp parallel for default(none) shared(in, rgb) schedule(static)
+#endif
+  for(int j = 0; j < ht4; j++)
+    for(int i = 0; i < wd4; i++)
+    {
+      const int ii = MIN(i, width - 1), jj = MIN(j, height - 1);
+      for(int k = 0; k < 3; k++) rgb[3 * (j * wd4 + i) + k] = in[4 * (jj * width + ii) + k];
+    }
+  dt_image_compress(rgb, data, wd4, ht4);
+  dt_free_align(rgb);
+
+  c->width = dsc->width;
+  c->height = dsc->height;
+  c->iscale = dsc->iscale;
+  c->size = (size_t)wd4 * ht4;
+  c->data = data;
+
+  dt_pthread_mutex_lock(&cache->mip_f_compressed_lock);
+  dt_mipmap_compressed_t *old = g_hash_table_lookup(cache->mip_f_compressed, GUINT_TO_POINTER(key));
+  if(old)
+  {
+    cache->mip_f_compressed_size -= old->size;
+    g_queue_remove(cache->mip_f_compressed_lru, GUINT_TO_POINTER(key));
+  }
+  g_hash_table_insert(cache->mip_f_compressed, GUINT_TO_POINTER(key), c);
+  g_queue_push_tail(cache->mip_f_compressed_lru, GUINT_TO_POINTER(key));
+  cache->mip_f_compressed_size += c->size;
+  while(cache->mip_f_compressed_size > cache->mip_f_compressed_quota
+        && g_queue_get_length(cache->mip_f_compressed_lru) > 1)
+  {
+    gpointer k = g_queue_pop_head(cache->mip_f_compressed_lru);
+    dt_mipmap_compressed_t *e = g_hash_table_lookup(cache->mip_f_compressed, k);
+    if(e) cache->mip_f_compressed_size -= e->size;
+    g_hash_table_remove(cache->mip_f_compressed, k);
+  }
+  dt_pthread_mutex_unlock(&cache->mip_f_compressed_lock);
+}
+
+static void _remove_compressed_f(dt_mipmap_cache_t *cache, const uint32_t key)
+{
+  if(!cache->mip_f_compressed) return;
+  dt_pthread_mutex_lock(&cache->mip_f_compressed_lock);
+  dt_mipmap_compressed_t *c = g_hash_table_lookup(cache->mip_f_compressed, GUINT_TO_POINTER(key));
+  if(c)
+  {
+    cache->mip_f_compressed_size -= c->size;
+    g_queue_remove(cache->mip_f_compressed_lru, GUINT_TO_POINTER(key));
+    g_hash_table_remove(cache->mip_f_compressed, GUINT_TO_POINTER(key));
+  }
+  dt_pthread_mutex_unlock(&cache->mip_f_compressed_lock);
+}
+
+// a cold DT_MIPMAP_FULL buffer, the raw mosaic or float input as the loader left it
+typedef struct dt_mipmap_cold_t
+{
+  uint32_t width, height;
+  float iscale;
+  size_t bpp;
+  size_t len;    // of the compressed data
+  uint8_t *data; // NULL once spilled to the scratch directory
+} dt_mipmap_cold_t;
+
+static void _cold_free(gpointer data)
+{
+  dt_mipmap_cold_t *c = (dt_mipmap_cold_t *)data;
+  free(c->data);
+  free(c);
+}
+
+static void _cold_spill_filename(const dt_mipmap_cache_t *cache, const uint32_t key, char *filename,
+                                 const size_t size)
+{
+  snprintf(filename, size, "%s" G_DIR_SEPARATOR_S "%u", cache->mip_full_spill_dir, key);
+}
+
+// cold lock has to be held.
+static void _cold_drop(dt_mipmap_cache_t *cache, const uint32_t key)
+{
+  dt_mipmap_cold_t *c = g_hash_table_lookup(cache->mip_full_cold, GUINT_TO_POINTER(key));
+  if(!c) return;
+  if(c->data)
+    cache->mip_full_cold_size -= c->len;
+  else
+  {
+    char filename[PATH_MAX] = { 0 };
+    _cold_spill_filename(cache, key, filename, sizeof(filename));
+    g_unlink(filename);
+    cache->mip_full_spill_size -= c->len;
+  }
+  g_queue_remove(cache->mip_full_cold_lru, GUINT_TO_POINTER(key));
+  g_hash_table_remove(cache->mip_full_cold, GUINT_TO_POINTER(key));
+}
+
+// cold lock has to be held. moves the compressed data of c to the scratch directory, making room there by
+// dropping the oldest spilled buffers. returns non zero if it doesn't fit or couldn't be written.
+static int _cold_spill(dt_mipmap_cache_t *cache, const uint32_t key, dt_mipmap_cold_t *c)
+{
+  if(!cache->mip_full_spill_dir || c->len > cache->mip_full_spill_quota) return 1;
+  GList *l = cache->mip_full_cold_lru->head;
+  while(l && cache->mip_full_spill_size + c->len > cache->mip_full_spill_quota)
+  {
+    GList *next = g_list_next(l);
+    const dt_mipmap_cold_t *e = g_hash_table_lookup(cache->mip_full_cold, l->data);
+    if(e && !e->data) _cold_drop(cache, GPOINTER_TO_UINT(l->data));
+    l = next;
+  }
+  char filename[PATH_MAX] = { 0 };
+  _cold_spill_filename(cache, key, filename, sizeof(filename));
+  if(!g_file_set_contents(filename, (const gchar *)c->data, c->len, NULL))
+  {
+    g_unlink(filename);
+    return 1;
+  }
+  free(c->data);
+  c->data = NULL;
+  cache->mip_full_cold_size -= c->len;
+  cache->mip_full_spill_size += c->len;
+  return 0;
+}
+
+// keep an evicted full buffer around, compressed in memory or spilled, instead of decoding the raw again later
+static void _write_cold_full(dt_mipmap_cache_t *cache, const uint32_t key, const struct dt_mipmap_buffer_dsc *dsc)
+{
+  const size_t pixels = (size_t)dsc->width * dsc->height;
+  const size_t payload = dsc->size - sizeof(*dsc);
+  if(!pixels || payload % pixels) return;
+
+  dt_pthread_mutex_lock(&cache->mip_full_cold_lock);
+  // it came from here and didn't change:
+  const int contained = g_hash_table_contains(cache->mip_full_cold, GUINT_TO_POINTER(key));
+  dt_pthread_mutex_unlock(&cache->mip_full_cold_lock);
+  if(contained) return;
+
+  dt_mipmap_cold_t *c = (dt_mipmap_cold_t *)malloc(sizeof(dt_mipmap_cold_t));
+  if(!c) return;
+  c->width = dsc->width;
+  c->height = dsc->height;
+  c->iscale = dsc->iscale;
+  c->bpp = payload / pixels;
+  c->data = dt_image_compress_lossless(dsc + 1, c->width, c->height, c->bpp, &c->len);
+  if(!c->data)
+  {
+    free(c);
+    return;
+  }
+
+  dt_pthread_mutex_lock(&cache->mip_full_cold_lock);
+  _cold_drop(cache, key);
+  g_hash_table_insert(cache->mip_full_cold, GUINT_TO_POINTER(key), c);
+  g_queue_push_tail(cache->mip_full_cold_lru, GUINT_TO_POINTER(key));
+  cache->mip_full_cold_size += c->len;
+  // oldest first, spill what is beyond quota or drop it if there is no room on disk either
+  while(cache->mip_full_cold_size > cache->mip_full_cold_quota)
+  {
+    // spilling drops older spilled buffers, so start over every time
+    GList *l = cache->mip_full_cold_lru->head;
+    dt_mipmap_cold_t *e = NULL;
+    for(; l; l = g_list_next(l))
+      if((e = g_hash_table_lookup(cache->mip_full_cold, l->data)) && e->data) break;
+    if(!l) break;
+    const uint32_t k = GPOINTER_TO_UINT(l->data);
+    if(_cold_spill(cache, k, e)) _cold_drop(cache, k);
+  }
+  dt_pthread_mutex_unlock(&cache->mip_full_cold_lock);
+}
+
+// bring back a cold full buffer into buf, which has to be write locked. only if the image still describes the
+// same data, else the loader has to run to restore everything it sets in there. returns non zero if there is none.
+static int _read_cold_full(dt_mipmap_cache_t *cache, const uint32_t key, dt_mipmap_buffer_t *buf,
+                           const dt_image_t *img)
+{
+  if(!cache->mip_full_cold) return 1;
+  dt_pthread_mutex_lock(&cache->mip_full_cold_lock);
+  dt_mipmap_cold_t *c = g_hash_table_lookup(cache->mip_full_cold, GUINT_TO_POINTER(key));
+  if(!c)
+  {
+    dt_pthread_mutex_unlock(&cache->mip_full_cold_lock);
+    return 1;
+  }
+  if(c->width != (uint32_t)img->width || c->height != (uint32_t)img->height
+     || c->bpp != dt_iop_buffer_dsc_to_bpp(&img->buf_dsc))
+  {
+    _cold_drop(cache, key);
+    dt_pthread_mutex_unlock(&cache->mip_full_cold_lock);
+    return 1;
+  }
+  // bump in lru
+  g_queue_remove(cache->mip_full_cold_lru, GUINT_TO_POINTER(key));
+  g_queue_push_tail(cache->mip_full_cold_lru, GUINT_TO_POINTER(key));
+
+  uint8_t *blob = c->data;
+  gsize len = c->len;
+  if(!blob)
+  {
+    char filename[PATH_MAX] = { 0 };
+    _cold_spill_filename(cache, key, filename, sizeof(filename));
+    gchar *contents = NULL;
+    if(!g_file_get_contents(filename, &contents, &len, NULL)) len = 0;
+    blob = (uint8_t *)contents;
+  }
+  void *out = len ? dt_mipmap_cache_alloc(buf, img) : NULL;
+  const int err = !out || dt_image_uncompress_lossless(blob, len, out, c->width, c->height, c->bpp);
+  if(!err)
+  {
+    struct dt_mipmap_buffer_dsc *dsc = (struct dt_mipmap_buffer_dsc *)buf->cache_entry->data;
+    dsc->iscale = c->iscale;
+  }
+  if(blob != c->data) g_free(blob);
+  if(err) _cold_drop(cache, key);
+  dt_pthread_mutex_unlock(&cache->mip_full_cold_lock);
+  return err;
+}
+
+static void _remove_cold_full(dt_mipmap_cache_t *cache, const uint32_t key)
+{
+  if(!cache->mip_full_cold) return;
+  dt_pthread_mutex_lock(&cache->mip_full_cold_lock);
+  _cold_drop(cache, key);
+  dt_pthread_mutex_unlock(&cache->mip_full_cold_lock);
+}
+
+// what decoded sources are told apart by, NULL if the file can't be stat'ed
+static gchar *_full_source_key(const char *filename)
+{
+  GStatBuf st;
+  if(!filename[0] || g_stat(filename, &st)) return NULL;
+  return g_strdup_printf("%s|%" G_GINT64_FORMAT "|%" G_GINT64_FORMAT, filename, (gint64)st.st_mtime,
+                         (gint64)st.st_size);
+}
+
+static void _set_full_source(dt_mipmap_cache_t *cache, const gchar *source, const uint32_t imgid)
+{
+  if(!source) return;
+  dt_pthread_mutex_lock(&cache->full_sources_lock);
+  g_hash_table_insert(cache->full_sources, g_strdup(source), GUINT_TO_POINTER(imgid));
+  dt_pthread_mutex_unlock(&cache->full_sources_lock);
+}
+
+// what the loader sets in the image, everything else is the image's own
+static void _copy_loader_fields(dt_image_t *img, const dt_image_t *src)
+{
+  const int loader_flags = DT_IMAGE_LDR | DT_IMAGE_RAW | DT_IMAGE_HDR | DT_IMAGE_4BAYER;
+  img->width = src->width;
+  img->height = src->height;
+  img->crop_x = src->crop_x;
+  img->crop_y = src->crop_y;
+  img->crop_width = src->crop_width;
+  img->crop_height = src->crop_height;
+  img->flags = (img->flags & ~loader_flags) | (src->flags & loader_flags);
+  img->loader = src->loader;
+  img->buf_dsc = src->buf_dsc;
+  memcpy(img->d65_color_matrix, src->d65_color_matrix, sizeof(img->d65_color_matrix));
+  img->raw_black_level = src->raw_black_level;
+  memcpy(img->raw_black_level_separate, src->raw_black_level_separate, sizeof(img->raw_black_level_separate));
+  img->raw_white_point = src->raw_white_point;
+  img->fuji_rotation_pos = src->fuji_rotation_pos;
+  img->pixel_aspect_ratio = src->pixel_aspect_ratio;
+  memcpy(img->wb_coeffs, src->wb_coeffs, sizeof(img->wb_coeffs));
+}
+
+// fill buf, which has to be write locked, with the full buffer of another image loaded from the same source,
+// from memory if it is still there, else from its cold copy. img gets what the loader would have set.
+// returns non zero if there is none.
+static int _read_shared_full(dt_mipmap_cache_t *cache, const gchar *source, dt_mipmap_buffer_t *buf,
+                             dt_image_t *img)
+{
+  if(!source) return 1;
+  dt_pthread_mutex_lock(&cache->full_sources_lock);
+  const uint32_t sibling = GPOINTER_TO_UINT(g_hash_table_lookup(cache->full_sources, source));
+  dt_pthread_mutex_unlock(&cache->full_sources_lock);
+  if(!sibling || sibling == (uint32_t)img->id) return 1;
+
+  dt_image_t loaded = *img;
+  const dt_image_t *simg = dt_image_cache_get(darktable.image_cache, sibling, 'r');
+  if(!simg) return 1;
+  // only raws, decoding anything else is cheap, and jpegs and tiffs might have an embedded profile to copy too
+  const int usable = (simg->flags & DT_IMAGE_RAW) && !simg->profile && simg->width > 0 && simg->height > 0;
+  if(usable) _copy_loader_fields(&loaded, simg);
+  dt_image_cache_read_release(darktable.image_cache, simg);
+  if(!usable) return 1;
+
+  // copied, not shared: the cache entry owns its buffer, the descriptor in front of the pixels is its own and
+  // pipes write to the full buffers they got, so the copy is what a decode would have left there.
+  // doesn't block, the sibling might be loading right now.
+  const uint32_t skey = get_key(sibling, DT_MIPMAP_FULL);
+  int err = 1;
+  dt_cache_entry_t *entry = dt_cache_testget(&cache->mip_full.cache, skey, 'r');
+  if(entry)
+  {
+    ASAN_UNPOISON_MEMORY_REGION(entry->data, dt_mipmap_buffer_dsc_size);
+    const struct dt_mipmap_buffer_dsc *sdsc = (const struct dt_mipmap_buffer_dsc *)entry->data;
+    const size_t payload = (size_t)loaded.width * loaded.height * dt_iop_buffer_dsc_to_bpp(&loaded.buf_dsc);
+    if((void *)sdsc != (void *)dt_mipmap_cache_static_dead_image && sdsc->width == (uint32_t)loaded.width
+       && sdsc->height == (uint32_t)loaded.height && sdsc->size == payload + sizeof(*sdsc)
+       && !(sdsc->flags & (DT_MIPMAP_BUFFER_DSC_FLAG_GENERATE | DT_MIPMAP_BUFFER_DSC_FLAG_INVALIDATE)))
+    {
+      void *out = dt_mipmap_cache_alloc(buf, &loaded);
+      if(out)
+      {
+        memcpy(out, sdsc + 1, payload);
+        ((struct dt_mipmap_buffer_dsc *)buf->cache_entry->data)->iscale = sdsc->iscale;
+        err = 0;
+      }
+    }
+    dt_cache_release(&cache->mip_full.cache, entry);
+  }
+  if(err) err = _read_cold_full(cache, skey, buf, &loaded);
+  if(!err)
+  {
+    dt_print(DT_DEBUG_CACHE, "[mipmap_cache] full buffer of image %d copied from image %u\n", img->id, sibling);
+    *img = loaded;
+  }
+  return err;
+}
+
+// full buffers are left out, there are only a few of them and they are in use while they are around
+static size_t _memory_usage(void *data)
+{
+  const dt_mipmap_cache_t *cache = (const dt_mipmap_cache_t *)data;
+  return cache->mip_thumbs.cache.cost + cache->mip_f.cache.cost * cache->buffer_size[DT_MIPMAP_F]
+         + cache->mip_f_compressed_size + cache->mip_full_cold_size;
+}
+
+// thumbnails come back from the disk cache cheaply, so they go first, then the compressed float buffers and
+// last the cold full buffers still in memory, the spilled ones don't count.
+static size_t _memory_reclaim(void *data, size_t wanted)
+{
+  dt_mipmap_cache_t *cache = (dt_mipmap_cache_t *)data;
+  dt_cache_t *thumbs = &cache->mip_thumbs.cache;
+  const size_t before = _memory_usage(cache);
+  if(thumbs->cost_quota)
+    dt_cache_gc(thumbs, thumbs->cost > wanted ? (float)(thumbs->cost - wanted) / thumbs->cost_quota : 0.0f);
+  size_t freed = before - MIN(before, _memory_usage(cache));
+  if(freed < wanted && cache->mip_f_compressed)
+  {
+    dt_pthread_mutex_lock(&cache->mip_f_compressed_lock);
+    while(freed < wanted && !g_queue_is_empty(cache->mip_f_compressed_lru))
+    {
+      gpointer k = g_queue_pop_head(cache->mip_f_compressed_lru);
+      dt_mipmap_compressed_t *e = g_hash_table_lookup(cache->mip_f_compressed, k);
+      if(e)
+      {
+        cache->mip_f_compressed_size -= e->size;
+        freed += e->size;
+      }
+      g_hash_table_remove(cache->mip_f_compressed, k);
+    }
+    dt_pthread_mutex_unlock(&cache->mip_f_compressed_lock);
+  }
+  if(freed < wanted && cache->mip_full_cold)
+  {
+    dt_pthread_mutex_lock(&cache->mip_full_cold_lock);
+    for(GList *l = cache->mip_full_cold_lru->head; l && freed < wanted;)
+    {
+      GList *next = g_list_next(l);
+      const dt_mipmap_cold_t *e = g_hash_table_lookup(cache->mip_full_cold, l->data);
+      if(e && e->data)
+      {
+        freed += e->len;
+        _cold_drop(cache, GPOINTER_TO_UINT(l->data));
+      }
+      l = next;
+    }
+    dt_pthread_mutex_unlock(&cache->mip_full_cold_lock);
+  }
+  return freed;
+}
+
+// nothing new is prefetched while the quotas are scaled down, and what is queued is dropped.
+static void _memory_limit(void *data, float fraction)
+{
+  dt_mipmap_cache_t *cache = (dt_mipmap_cache_t *)data;
+  dt_cache_set_cost_quota(&cache->mip_thumbs.cache,
+                          MAX((size_t)(cache->thumbs_quota * fraction), (size_t)100 << 20));
+  dt_cache_gc(&cache->mip_thumbs.cache, 1.0f);
+  if(cache->mip_f_compressed)
+  {
+    dt_pthread_mutex_lock(&cache->mip_f_compressed_lock);
+    cache->mip_f_compressed_quota = cache->mip_f_compressed_configured * fraction;
+    dt_pthread_mutex_unlock(&cache->mip_f_compressed_lock);
+  }
+  if(cache->mip_full_cold)
+  {
+    dt_pthread_mutex_lock(&cache->mip_full_cold_lock);
+    cache->mip_full_cold_quota = cache->mip_full_cold_configured * fraction;
+    dt_pthread_mutex_unlock(&cache->mip_full_cold_lock);
+  }
+  if(fraction < 1.0f) dt_mipmap_cache_cancel_prefetch(cache);
+}
+
 // callback for the cache backend to initialize payload pointers
 void dt_mipmap_cache_allocate_dynamic(void *data, dt_cache_entry_t *entry)
 {
@@ -362,50 +1025,44 @@ void dt_mipmap_cache_allocate_dynamic(void *data, dt_cache_entry_t *entry)
     if(cache->cachedir[0] && dt_conf_get_bool("cache_disk_backend"))
     {
       // try and load from disk, if successful set flag
-      char filename[PATH_MAX] = {0};
-      snprintf(filename, sizeof(filename), "%s.d/%d/%d.jpg", cache->cachedir, mip, get_imgid(entry->key));
-      FILE *f = g_fopen(filename, "rb");
-      if(f)
+      const uint32_t imgid = get_imgid(entry->key);
+      size_t len = 0;
+      int32_t pack_color_space = DT_COLORSPACE_NONE;
+      uint8_t *blob = NULL;
+      if(_read_pending_thumbnail(cache, entry->key, entry->data, cache->buffer_size[mip]))
       {
-        long len = 0;
-        uint8_t *blob = 0;
-        fseek(f, 0, SEEK_END);
-        len = ftell(f);
-        if(len <= 0) goto read_error; // coverity madness
-        blob = (uint8_t *)malloc(len);
-        if(!blob) goto read_error;
-        fseek(f, 0, SEEK_SET);
-        int rd = fread(blob, sizeof(uint8_t), len, f);
-        if(rd != len) goto read_error;
-        dt_colorspaces_color_profile_type_t color_space;
-        dt_imageio_jpeg_t jpg;
-        if(dt_imageio_jpeg_decompress_header(blob, len, &jpg)
-           || (jpg.width > cache->max_width[mip] || jpg.height > cache->max_height[mip])
-           || ((color_space = dt_imageio_jpeg_read_color_space(&jpg)) == DT_COLORSPACE_NONE) // pointless test to keep it in the if clause
-           || dt_imageio_jpeg_decompress(&jpg, entry->data + sizeof(*dsc)))
+        loaded_from_disk = 1;
+      }
+      else if((blob = _read_disk_thumbnail(cache, imgid, mip, &len, &pack_color_space)))
+      {
+        if(_decode_disk_thumbnail(cache, mip, blob, len, pack_color_space, dsc))
         {
-          fprintf(stderr, "[mipmap_cache] failed to decompress thumbnail for image %d from `%s'!\n", get_imgid(entry->key), filename);
-          goto read_error;
+          fprintf(stderr, "[mipmap_cache] failed to decompress thumbnail for image %d mip %d!\n", imgid, mip);
+          dt_mipmap_cache_unlink_ondisk_thumbnail(cache, imgid, mip);
         }
-        dsc->width = jpg.width;
-        dsc->height = jpg.height;
-        dsc->iscale = 1.0f;
-        dsc->color_space = color_space;
-        loaded_from_disk = 1;
-        if(0)
+        else
         {
-read_error:
-          g_unlink(filename);
+          dsc->iscale = 1.0f;
+          loaded_from_disk = 1;
         }
-        free(blob);
-        fclose(f);
+        g_free(blob);
       }
+      if(!loaded_from_disk) __sync_fetch_and_add(&cache->stats_disk_misses[mip], 1);
     }
   }
+  else if(mip == DT_MIPMAP_F)
+  {
+    // a cold float buffer might still be around in compressed form, that's a lot cheaper than loading the raw:
+    dsc->flags = 0;
+    loaded_from_disk = !_read_compressed_f(cache, entry->key, dsc);
+    if(cache->mip_f_compressed) __sync_fetch_and_add(&cache->stats_disk_misses[mip], !loaded_from_disk);
+  }
+  if(mip <= DT_MIPMAP_F) __sync_fetch_and_add(&cache->stats_disk_reads[mip], loaded_from_disk);
+  __sync_fetch_and_add(&cache->stats_level_loads[mip], 1);
 
   if(!loaded_from_disk)
     dsc->flags = DT_MIPMAP_BUFFER_DSC_FLAG_GENERATE;
-  else dsc->flags = 0;
+  else dsc->flags &= DT_MIPMAP_BUFFER_DSC_FLAG_RGBA_F;
 
   // cost is just flat one for the buffer, as the buffers might have different sizes,
   // to make sure quota is meaningful.
@@ -413,25 +1070,188 @@ read_error:
   else entry->cost = cache->buffer_size[mip];
 }
 
-static void dt_mipmap_cache_unlink_ondisk_thumbnail(void *data, uint32_t imgid, dt_mipmap_size_t mip)
+static int _disk_is_full(const char *filename)
 {
-  dt_mipmap_cache_t *cache = (dt_mipmap_cache_t *)data;
+  struct statvfs vfsbuf;
+  if(!statvfs(filename, &vfsbuf))
+  {
+    int64_t free_mb = ((vfsbuf.f_frsize * vfsbuf.f_bavail) >> 20);
+    if(free_mb < 100)
+    {
+      fprintf(stderr, "Aborting image write as only %" PRId64 " MB free to write %s\n", free_mb, filename);
+      return 1;
+    }
+    return 0;
+  }
+  fprintf(stderr, "Aborting image write since couldn't determine free space available to write %s\n", filename);
+  return 1;
+}
 
-  // also remove jpg backing (always try to do that, in case user just temporarily switched it off,
-  // to avoid inconsistencies.
-  // if(dt_conf_get_bool("cache_disk_backend"))
-  if(cache->cachedir[0])
+// encode the 8-bit buffer with the configured codec. returns a buffer to free() or NULL.
+static uint8_t *_encode_thumbnail(const dt_mipmap_cache_t *cache, const struct dt_mipmap_buffer_dsc *dsc,
+                                  size_t *len)
+{
+  const size_t size = (size_t)4 * dsc->width * dsc->height;
+  if(cache->codec == DT_MIPMAP_DISK_CODEC_DEFLATE)
   {
-    char filename[PATH_MAX] = { 0 };
-    snprintf(filename, sizeof(filename), "%s.d/%d/%d.jpg", cache->cachedir, mip, imgid);
+    uLongf out_len = compressBound(size);
+    uint8_t *blob = (uint8_t *)malloc(sizeof(dt_mipmap_deflate_header_t) + out_len);
+    if(!blob) return NULL;
+    dt_mipmap_deflate_header_t *hdr = (dt_mipmap_deflate_header_t *)blob;
+    hdr->magic = DT_MIPMAP_DEFLATE_MAGIC;
+    hdr->width = dsc->width;
+    hdr->height = dsc->height;
+    hdr->color_space = dsc->color_space;
+    // fastest level, decoding speed is the same for all of them anyways
+    if(compress2(blob + sizeof(*hdr), &out_len, (const Bytef *)(dsc + 1), size, Z_BEST_SPEED) != Z_OK)
+    {
+      free(blob);
+      return NULL;
+    }
+    *len = sizeof(*hdr) + out_len;
+    return blob;
+  }
+
+  const int cache_quality = dt_conf_get_int("database_cache_quality");
+  // the jpeg will never be larger than the uncompressed input:
+  uint8_t *blob = (uint8_t *)malloc(size);
+  if(!blob) return NULL;
+  const int jpg_len = dt_imageio_jpeg_compress((const uint8_t *)(dsc + 1), blob, dsc->width, dsc->height,
+                                               MIN(100, MAX(10, cache_quality)));
+  if(jpg_len <= 1)
+  {
+    free(blob);
+    return NULL;
+  }
+  *len = jpg_len;
+  return blob;
+}
+
+// encode and write a thumbnail to the disk cache, unless it is already there.
+static void _write_disk_thumbnail(dt_mipmap_cache_t *cache, const dt_mipmap_size_t mip, const uint32_t imgid,
+                                  const struct dt_mipmap_buffer_dsc *dsc)
+{
+  if(cache->pack[mip])
+  {
+    // serialize into the packed container, again only if not there yet
+    if(dt_mipmap_pack_contains(cache->pack[mip], imgid) || _disk_is_full(cache->pack[mip]->data_filename)) return;
+    size_t len = 0;
+    uint8_t *blob = _encode_thumbnail(cache, dsc, &len);
+    if(blob) dt_mipmap_pack_write(cache->pack[mip], imgid, blob, len, dsc->color_space);
+    free(blob);
+    return;
+  }
+
+  // serialize to disk
+  char filename[PATH_MAX] = {0};
+  snprintf(filename, sizeof(filename), "%s.d/%d", cache->cachedir, mip);
+  if(g_mkdir_with_parents(filename, 0750)) return;
+
+  _disk_thumbnail_filename(cache, mip, imgid, cache->codec, filename, sizeof(filename));
+  // Don't write existing files as both performance and quality (lossy jpg) suffer
+  if(g_file_test(filename, G_FILE_TEST_EXISTS)) return;
+
+  if(cache->codec == DT_MIPMAP_DISK_CODEC_DEFLATE)
+  {
+    size_t len = 0;
+    uint8_t *blob = _encode_thumbnail(cache, dsc, &len);
+    if(blob && !_disk_is_full(cache->cachedir)) g_file_set_contents(filename, (const gchar *)blob, len, NULL);
+    free(blob);
+    return;
+  }
+
+  FILE *f = g_fopen(filename, "wb");
+  if(!f) return;
+  // first check the disk isn't full
+  if(_disk_is_full(filename)) goto write_error;
+
+  const int cache_quality = dt_conf_get_int("database_cache_quality");
+  const uint8_t *exif = NULL;
+  int exif_len = 0;
+  if(dsc->color_space == DT_COLORSPACE_SRGB)
+  {
+    exif = dt_mipmap_cache_exif_data_srgb;
+    exif_len = dt_mipmap_cache_exif_data_srgb_length;
+  }
+  else if(dsc->color_space == DT_COLORSPACE_ADOBERGB)
+  {
+    exif = dt_mipmap_cache_exif_data_adobergb;
+    exif_len = dt_mipmap_cache_exif_data_adobergb_length;
+  }
+  if(dt_imageio_jpeg_write(filename, (const uint8_t *)(dsc + 1), dsc->width, dsc->height, MIN(100, MAX(10, cache_quality)), exif, exif_len))
+  {
+write_error:
     g_unlink(filename);
   }
+  fclose(f);
+}
+
+static void *_disk_writer_thread(void *data)
+{
+  dt_mipmap_cache_t *cache = (dt_mipmap_cache_t *)data;
+  dt_pthread_mutex_lock(&cache->writer_lock);
+  while(1)
+  {
+    while(cache->writer_running && g_queue_is_empty(cache->writer_queue))
+      dt_pthread_cond_wait(&cache->writer_cond, &cache->writer_lock);
+    // keep going until the queue is drained, even when asked to stop:
+    dt_mipmap_disk_write_t *job = g_queue_pop_head(cache->writer_queue);
+    if(!job) break;
+
+    if(!job->cancelled)
+    {
+      // the job stays in the pending table while encoding, so readers can still pick it up
+      dt_pthread_mutex_unlock(&cache->writer_lock);
+      _write_disk_thumbnail(cache, get_size(job->key), get_imgid(job->key), job->data);
+      dt_pthread_mutex_lock(&cache->writer_lock);
+      if(job->cancelled)
+        // invalidated while we were writing it:
+        _unlink_disk_thumbnail(cache, get_imgid(job->key), get_size(job->key));
+      else
+        g_hash_table_remove(cache->writer_pending, GUINT_TO_POINTER(job->key));
+    }
+    dt_free_align(job->data);
+    free(job);
+  }
+  dt_pthread_mutex_unlock(&cache->writer_lock);
+  return NULL;
+}
+
+// hand an evicted cache line over to the background writer. returns 0 if it took ownership of data.
+static int _queue_disk_thumbnail(dt_mipmap_cache_t *cache, const uint32_t key, void *data)
+{
+  if(!cache->writer_pending) return 1;
+  int err = 0;
+  dt_pthread_mutex_lock(&cache->writer_lock);
+  if(!cache->writer_running || g_queue_get_length(cache->writer_queue) >= DT_MIPMAP_WRITER_MAX_QUEUE)
+    err = 1;
+  else if(g_hash_table_contains(cache->writer_pending, GUINT_TO_POINTER(key)))
+    // the same buffer was read back from the queue and is evicted again:
+    dt_free_align(data);
+  else
+  {
+    dt_mipmap_disk_write_t *job = (dt_mipmap_disk_write_t *)malloc(sizeof(dt_mipmap_disk_write_t));
+    if(job)
+    {
+      job->key = key;
+      job->data = data;
+      job->cancelled = 0;
+      g_queue_push_tail(cache->writer_queue, job);
+      g_hash_table_insert(cache->writer_pending, GUINT_TO_POINTER(key), job);
+      pthread_cond_signal(&cache->writer_cond);
+    }
+    else
+      err = 1;
+  }
+  dt_pthread_mutex_unlock(&cache->writer_lock);
+  return err;
 }
 
 void dt_mipmap_cache_deallocate_dynamic(void *data, dt_cache_entry_t *entry)
 {
   dt_mipmap_cache_t *cache = (dt_mipmap_cache_t *)data;
   const dt_mipmap_size_t mip = get_size(entry->key);
+  __sync_fetch_and_add(&cache->stats_level_drops[mip], 1);
   if(mip < DT_MIPMAP_F)
   {
     struct dt_mipmap_buffer_dsc *dsc = (struct dt_mipmap_buffer_dsc *)entry->data;
@@ -444,58 +1264,28 @@ void dt_mipmap_cache_deallocate_dynamic(void *data, dt_cache_entry_t *entry)
       }
       else if(cache->cachedir[0] && dt_conf_get_bool("cache_disk_backend"))
       {
-        // serialize to disk
-        char filename[PATH_MAX] = {0};
-        snprintf(filename, sizeof(filename), "%s.d/%d", cache->cachedir, mip);
-        int mkd = g_mkdir_with_parents(filename, 0750);
-        if(!mkd)
-        {
-          snprintf(filename, sizeof(filename), "%s.d/%d/%d.jpg", cache->cachedir, mip, get_imgid(entry->key));
-          // Don't write existing files as both performance and quality (lossy jpg) suffer
-          FILE *f = NULL;
-          if (!g_file_test(filename, G_FILE_TEST_EXISTS) && (f = g_fopen(filename, "wb")))
-          {
-            // first check the disk isn't full
-            struct statvfs vfsbuf;
-            if (!statvfs(filename, &vfsbuf))
-            {
-              int64_t free_mb = ((vfsbuf.f_frsize * vfsbuf.f_bavail) >> 20);
-              if (free_mb < 100)
-              {
-                fprintf(stderr, "Aborting image write as only %" PRId64 " MB free to write %s\n", free_mb, filename);
-                goto write_error;
-              }
-            }
-            else
-            {
-              fprintf(stderr, "Aborting image write since couldn't determine free space available to write %s\n", filename);
-              goto write_error;
-            }
-
-            const int cache_quality = dt_conf_get_int("database_cache_quality");
-            const uint8_t *exif = NULL;
-            int exif_len = 0;
-            if(dsc->color_space == DT_COLORSPACE_SRGB)
-            {
-              exif = dt_mipmap_cache_exif_data_srgb;
-              exif_len = dt_mipmap_cache_exif_data_srgb_length;
-            }
-            else if(dsc->color_space == DT_COLORSPACE_ADOBERGB)
-            {
-              exif = dt_mipmap_cache_exif_data_adobergb;
-              exif_len = dt_mipmap_cache_exif_data_adobergb_length;
-            }
-            if(dt_imageio_jpeg_write(filename, entry->data + sizeof(*dsc), dsc->width, dsc->height, MIN(100, MAX(10, cache_quality)), exif, exif_len))
-            {
-write_error:
-              g_unlink(filename);
-            }
-          }
-          if(f) fclose(f);
-        }
+        // encoding is left to the background writer, only if it's swamped we do it ourselves
+        if(!_queue_disk_thumbnail(cache, entry->key, entry->data)) return;
+        _write_disk_thumbnail(cache, mip, get_imgid(entry->key), dsc);
       }
     }
   }
+  else if(mip == DT_MIPMAP_F && cache->mip_f_compressed)
+  {
+    struct dt_mipmap_buffer_dsc *dsc = (struct dt_mipmap_buffer_dsc *)entry->data;
+    // mosaic data would not survive the lossy compression, only keep demosaiced buffers:
+    if(dsc->width > 8 && dsc->height > 8 && (dsc->flags & DT_MIPMAP_BUFFER_DSC_FLAG_RGBA_F)
+       && !(dsc->flags & (DT_MIPMAP_BUFFER_DSC_FLAG_GENERATE | DT_MIPMAP_BUFFER_DSC_FLAG_INVALIDATE)))
+      _write_compressed_f(cache, entry->key, dsc);
+  }
+  else if(mip == DT_MIPMAP_FULL && cache->mip_full_cold
+          && (void *)entry->data != (void *)dt_mipmap_cache_static_dead_image)
+  {
+    struct dt_mipmap_buffer_dsc *dsc = (struct dt_mipmap_buffer_dsc *)entry->data;
+    if(dsc->width > 8 && dsc->height > 8
+       && !(dsc->flags & (DT_MIPMAP_BUFFER_DSC_FLAG_GENERATE | DT_MIPMAP_BUFFER_DSC_FLAG_INVALIDATE)))
+      _write_cold_full(cache, entry->key, dsc);
+  }
   dt_free_align(entry->data);
 }
 
@@ -551,18 +1341,32 @@ void dt_mipmap_cache_init(dt_mipmap_cache_t *cache)
   cache->mip_thumbs.stats_misses = 0;
   cache->mip_thumbs.stats_fetches = 0;
   cache->mip_thumbs.stats_standin = 0;
+  cache->mip_thumbs.stats_prefetches = 0;
+  cache->mip_thumbs.stats_prefetch_cancelled = 0;
   cache->mip_f.stats_requests = 0;
   cache->mip_f.stats_near_match = 0;
   cache->mip_f.stats_misses = 0;
   cache->mip_f.stats_fetches = 0;
   cache->mip_f.stats_standin = 0;
+  cache->mip_f.stats_prefetches = 0;
+  cache->mip_f.stats_prefetch_cancelled = 0;
   cache->mip_full.stats_requests = 0;
   cache->mip_full.stats_near_match = 0;
   cache->mip_full.stats_misses = 0;
   cache->mip_full.stats_fetches = 0;
   cache->mip_full.stats_standin = 0;
-
-  dt_cache_init(&cache->mip_thumbs.cache, 0, max_mem);
+  cache->mip_full.stats_prefetches = 0;
+  cache->mip_full.stats_prefetch_cancelled = 0;
+  cache->prefetch_generation = 0;
+  for(int k = 0; k < DT_MIPMAP_NONE; k++)
+    cache->stats_level_requests[k] = cache->stats_level_loads[k] = cache->stats_level_drops[k]
+        = cache->stats_disk_reads[k] = cache->stats_disk_misses[k] = 0;
+
+  // split the thumbnail cache into lock-striped segments so worker threads don't serialize on one lock.
+  // keep every segment large enough to hold a few of the bigger thumbnails though, or it would thrash.
+  const size_t segment_min = 8 * cache->buffer_size[DT_MIPMAP_4];
+  const uint32_t segments = CLAMP(max_mem / segment_min, 1, dt_get_num_threads());
+  dt_cache_init_segmented(&cache->mip_thumbs.cache, 0, max_mem, segments);
   dt_cache_set_allocate_callback(&cache->mip_thumbs.cache, dt_mipmap_cache_allocate_dynamic, cache);
   dt_cache_set_cleanup_callback(&cache->mip_thumbs.cache, dt_mipmap_cache_deallocate_dynamic, cache);
 
@@ -583,13 +1387,177 @@ void dt_mipmap_cache_init(dt_mipmap_cache_t *cache)
   cache->buffer_size[DT_MIPMAP_F] = sizeof(struct dt_mipmap_buffer_dsc)
                                         + 4 * sizeof(float) * cache->max_width[DT_MIPMAP_F]
                                           * cache->max_height[DT_MIPMAP_F];
+
+  dt_print(DT_DEBUG_CACHE, "[mipmap_cache] thumbnail cache uses %u segments\n",
+           cache->mip_thumbs.cache.num_segments);
+
+  // optionally keep the disk cache in one packed container per mip level instead of one jpg per thumbnail:
+  for(int k = 0; k < DT_MIPMAP_F; k++) cache->pack[k] = NULL;
+  gchar *format = dt_conf_get_string("cache_disk_backend_format");
+  if(cache->cachedir[0] && format && !strcmp(format, "packed"))
+  {
+    char basename[PATH_MAX] = { 0 };
+    snprintf(basename, sizeof(basename), "%s.d", cache->cachedir);
+    if(!g_mkdir_with_parents(basename, 0750))
+    {
+      for(int k = 0; k < DT_MIPMAP_F; k++)
+      {
+        snprintf(basename, sizeof(basename), "%s.d/%d", cache->cachedir, k);
+        cache->pack[k] = dt_mipmap_pack_open(basename);
+      }
+    }
+  }
+  g_free(format);
+
+  // keep evicted float buffers compressed, in the same amount of memory the uncompressed slots take:
+  cache->mip_f_compressed = NULL;
+  cache->mip_f_compressed_lru = NULL;
+  cache->mip_f_compressed_size = 0;
+  cache->mip_f_compressed_quota = max_mem_bufs * cache->buffer_size[DT_MIPMAP_F];
+  if(dt_conf_get_bool("cache_compress_mip_f"))
+  {
+    dt_pthread_mutex_init(&cache->mip_f_compressed_lock, NULL);
+    cache->mip_f_compressed = g_hash_table_new_full(NULL, NULL, NULL, _compressed_free);
+    cache->mip_f_compressed_lru = g_queue_new();
+  }
+
+  // keep evicted full buffers, so going back to an image recently worked on costs a decompress, not a decode:
+  cache->mip_full_cold = NULL;
+  cache->mip_full_cold_lru = NULL;
+  cache->mip_full_cold_size = cache->mip_full_spill_size = 0;
+  cache->mip_full_cold_quota = (size_t)MAX(dt_conf_get_int64("cache_full_compressed_memory"), 0) << 20;
+  cache->mip_full_spill_quota = (size_t)MAX(dt_conf_get_int64("cache_full_spill_size"), 0) << 20;
+  cache->mip_full_spill_dir = NULL;
+  gchar *spill = dt_conf_get_string("cache_full_spill_directory");
+  if(spill && spill[0] && cache->mip_full_spill_quota)
+  {
+    gchar *dir = g_build_filename(spill, "darktable-XXXXXX", NULL);
+    if(!g_mkdir_with_parents(spill, 0750) && g_mkdtemp(dir))
+      cache->mip_full_spill_dir = dir;
+    else
+    {
+      fprintf(stderr, "[mipmap_cache] could not create a directory in `%s', not spilling full buffers\n", spill);
+      g_free(dir);
+    }
+  }
+  g_free(spill);
+  dt_pthread_mutex_init(&cache->full_sources_lock, NULL);
+  cache->full_sources = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+  if(cache->mip_full_cold_quota || cache->mip_full_spill_dir)
+  {
+    dt_pthread_mutex_init(&cache->mip_full_cold_lock, NULL);
+    cache->mip_full_cold = g_hash_table_new_full(NULL, NULL, NULL, _cold_free);
+    cache->mip_full_cold_lru = g_queue_new();
+  }
+
+  gchar *codec = dt_conf_get_string("cache_disk_backend_codec");
+  cache->codec = (codec && !strcmp(codec, "deflate")) ? DT_MIPMAP_DISK_CODEC_DEFLATE : DT_MIPMAP_DISK_CODEC_JPEG;
+  g_free(codec);
+
+  cache->writer_queue = NULL;
+  cache->writer_pending = NULL;
+  cache->writer_running = 0;
+  if(cache->cachedir[0])
+  {
+    dt_pthread_mutex_init(&cache->writer_lock, NULL);
+    pthread_cond_init(&cache->writer_cond, NULL);
+    cache->writer_queue = g_queue_new();
+    cache->writer_pending = g_hash_table_new(NULL, NULL);
+    cache->writer_running = 1;
+    if(dt_pthread_create(&cache->writer_thread, _disk_writer_thread, cache))
+    {
+      fprintf(stderr, "[mipmap_cache] could not start the disk cache writer, writing synchronously\n");
+      cache->writer_running = 0;
+    }
+  }
+
+  dt_pthread_mutex_init(&cache->regenerate_lock, NULL);
+  cache->regenerate_queue = g_queue_new();
+  cache->regenerate_pending = g_hash_table_new(NULL, NULL);
+  cache->regenerate_running = 0;
+  cache->regenerate_serial = 0;
+  cache->stats_regenerated = 0;
+  cache->stats_regenerate_time = 0.0;
+
+  cache->memory = (dt_memory_consumer_t){ .name = "mipmap cache",
+                                          .usage = _memory_usage,
+                                          .reclaim = _memory_reclaim,
+                                          .limit = _memory_limit,
+                                          .data = cache,
+                                          .priority = 0 };
+  cache->thumbs_quota = cache->mip_thumbs.cache.cost_quota;
+  cache->mip_f_compressed_configured = cache->mip_f_compressed_quota;
+  cache->mip_full_cold_configured = cache->mip_full_cold_quota;
+  dt_memory_register(darktable.memory, &cache->memory);
 }
 
 void dt_mipmap_cache_cleanup(dt_mipmap_cache_t *cache)
 {
+  dt_memory_unregister(darktable.memory, &cache->memory);
+  // the control threads are gone already, what is left won't be regenerated
+  if(cache->regenerate_queue)
+  {
+    g_queue_free_full(cache->regenerate_queue, free);
+    g_hash_table_destroy(cache->regenerate_pending);
+    cache->regenerate_queue = NULL;
+    cache->regenerate_pending = NULL;
+    dt_pthread_mutex_destroy(&cache->regenerate_lock);
+  }
+  // first, so the full cache doesn't compress the buffers it drops now
+  if(cache->mip_full_cold)
+  {
+    dt_pthread_mutex_lock(&cache->mip_full_cold_lock);
+    while(!g_queue_is_empty(cache->mip_full_cold_lru))
+      _cold_drop(cache, GPOINTER_TO_UINT(g_queue_peek_head(cache->mip_full_cold_lru)));
+    dt_pthread_mutex_unlock(&cache->mip_full_cold_lock);
+    g_hash_table_destroy(cache->mip_full_cold);
+    g_queue_free(cache->mip_full_cold_lru);
+    cache->mip_full_cold = NULL;
+    cache->mip_full_cold_lru = NULL;
+    dt_pthread_mutex_destroy(&cache->mip_full_cold_lock);
+  }
+  g_hash_table_destroy(cache->full_sources);
+  cache->full_sources = NULL;
+  dt_pthread_mutex_destroy(&cache->full_sources_lock);
+  if(cache->mip_full_spill_dir)
+  {
+    g_rmdir(cache->mip_full_spill_dir);
+    g_free(cache->mip_full_spill_dir);
+    cache->mip_full_spill_dir = NULL;
+  }
   dt_cache_cleanup(&cache->mip_thumbs.cache);
   dt_cache_cleanup(&cache->mip_full.cache);
   dt_cache_cleanup(&cache->mip_f.cache);
+  if(cache->mip_f_compressed)
+  {
+    g_hash_table_destroy(cache->mip_f_compressed);
+    g_queue_free(cache->mip_f_compressed_lru);
+    cache->mip_f_compressed = NULL;
+    cache->mip_f_compressed_lru = NULL;
+    dt_pthread_mutex_destroy(&cache->mip_f_compressed_lock);
+  }
+  // the thumbnail cache cleanup queued everything for writing, wait for the writer to drain the queue:
+  if(cache->writer_pending)
+  {
+    dt_pthread_mutex_lock(&cache->writer_lock);
+    const int running = cache->writer_running;
+    cache->writer_running = 0;
+    pthread_cond_signal(&cache->writer_cond);
+    dt_pthread_mutex_unlock(&cache->writer_lock);
+    if(running) pthread_join(cache->writer_thread, NULL);
+    g_queue_free(cache->writer_queue);
+    g_hash_table_destroy(cache->writer_pending);
+    cache->writer_queue = NULL;
+    cache->writer_pending = NULL;
+    pthread_cond_destroy(&cache->writer_cond);
+    dt_pthread_mutex_destroy(&cache->writer_lock);
+  }
+  // after the caches, their cleanup callbacks serialize into the packs:
+  for(int k = 0; k < DT_MIPMAP_F; k++)
+  {
+    dt_mipmap_pack_close(cache->pack[k]);
+    cache->pack[k] = NULL;
+  }
 }
 
 void dt_mipmap_cache_print(dt_mipmap_cache_t *cache)
@@ -604,6 +1572,10 @@ void dt_mipmap_cache_print(dt_mipmap_cache_t *cache)
   printf("[mipmap_cache] full  fill %d/%d slots (%.2f%%)\n",
          (uint32_t)cache->mip_full.cache.cost, (uint32_t)cache->mip_full.cache.cost_quota,
          100.0f * (float)cache->mip_full.cache.cost / (float)cache->mip_full.cache.cost_quota);
+  if(cache->mip_full_cold)
+    printf("[mipmap_cache] cold full %u buffers, %.2f MB in memory, %.2f MB spilled\n",
+           g_hash_table_size(cache->mip_full_cold), cache->mip_full_cold_size / (1024.0 * 1024.0),
+           cache->mip_full_spill_size / (1024.0 * 1024.0));
 
   uint64_t sum = 0;
   uint64_t sum_fetches = 0;
@@ -636,9 +1608,59 @@ void dt_mipmap_cache_print(dt_mipmap_cache_t *cache)
          100.0 * cache->mip_full.stats_standin / (float)sum_standins,
          100.0 * cache->mip_full.stats_fetches / (float)sum_fetches,
          100.0 * cache->mip_full.stats_requests / (float)sum);
+  printf("[mipmap_cache] thumb hit rate %6.2f%%, prefetches %ld queued, %ld cancelled\n",
+         100.0 * (cache->mip_thumbs.stats_requests - cache->mip_thumbs.stats_near_match
+                  - cache->mip_thumbs.stats_misses) / (float)MAX(cache->mip_thumbs.stats_requests, 1),
+         cache->mip_thumbs.stats_prefetches, cache->mip_thumbs.stats_prefetch_cancelled);
+  if(cache->stats_regenerated)
+    printf("[mipmap_cache] regenerated %ld thumbnails, %.1f per second\n", cache->stats_regenerated,
+           cache->stats_regenerate_time > 0.0 ? cache->stats_regenerated / cache->stats_regenerate_time : 0.0);
   printf("\n\n");
 }
 
+int dt_mipmap_cache_get_stats(const dt_mipmap_cache_t *cache, dt_cache_stats_t *stats, const int max)
+{
+  static const char *level_names[DT_MIPMAP_NONE]
+      = { "mipmap 0", "mipmap 1", "mipmap 2", "mipmap 3", "mipmap 4",
+          "mipmap 5", "mipmap 6", "mipmap 7", "mipmap float", "mipmap full" };
+  int n = 0;
+  if(n < max) dt_cache_get_stats(&cache->mip_thumbs.cache, stats + n++, "mipmap thumbnails", "bytes");
+  if(n < max) dt_cache_get_stats(&cache->mip_f.cache, stats + n++, "mipmap float buffers", "entries");
+  if(n < max) dt_cache_get_stats(&cache->mip_full.cache, stats + n++, "mipmap full buffers", "entries");
+  if(cache->mip_f_compressed && n < max)
+  {
+    dt_cache_stats_t *s = stats + n++;
+    memset(s, 0, sizeof(*s));
+    s->name = "mipmap compressed float buffers";
+    s->unit = "bytes";
+    s->used = cache->mip_f_compressed_size;
+    s->quota = cache->mip_f_compressed_quota;
+  }
+  if(cache->mip_full_cold && n < max)
+  {
+    dt_cache_stats_t *s = stats + n++;
+    memset(s, 0, sizeof(*s));
+    s->name = "mipmap cold full buffers";
+    s->unit = "bytes";
+    s->used = cache->mip_full_cold_size + cache->mip_full_spill_size;
+    s->quota = cache->mip_full_cold_quota + (cache->mip_full_spill_dir ? cache->mip_full_spill_quota : 0);
+  }
+  // the levels share the caches above, so they only have their own counters
+  for(int k = 0; k < DT_MIPMAP_NONE && n < max; k++)
+  {
+    dt_cache_stats_t *s = stats + n++;
+    memset(s, 0, sizeof(*s));
+    s->name = level_names[k];
+    s->unit = "entries";
+    s->misses = cache->stats_level_loads[k];
+    s->hits = MAX(cache->stats_level_requests[k] - cache->stats_level_loads[k], 0);
+    s->evictions = cache->stats_level_drops[k];
+    s->disk_reads = cache->stats_disk_reads[k];
+    s->disk_misses = cache->stats_disk_misses[k];
+  }
+  return n;
+}
+
 static gboolean _raise_signal_mipmap_updated(gpointer user_data)
 {
   dt_control_signal_raise(darktable.signals, DT_SIGNAL_DEVELOP_MIPMAP_UPDATED);
@@ -658,6 +1680,117 @@ static dt_mipmap_cache_one_t *_get_cache(dt_mipmap_cache_t *cache, const dt_mipm
   }
 }
 
+typedef struct dt_mipmap_prefetch_t
+{
+  uint32_t imgid;
+  dt_mipmap_size_t mip;
+  uint32_t generation;
+} dt_mipmap_prefetch_t;
+
+static int32_t _prefetch_job_run(dt_job_t *job)
+{
+  dt_mipmap_prefetch_t *params = (dt_mipmap_prefetch_t *)dt_control_job_get_params(job);
+  dt_mipmap_cache_t *cache = darktable.mipmap_cache;
+  if(params->generation != __sync_fetch_and_add(&cache->prefetch_generation, 0))
+  {
+    __sync_fetch_and_add(&(_get_cache(cache, params->mip)->stats_prefetch_cancelled), 1);
+    return 0;
+  }
+  dt_mipmap_buffer_t buf;
+  dt_mipmap_cache_get(cache, &buf, params->imgid, params->mip, DT_MIPMAP_BLOCKING, 'r');
+  dt_mipmap_cache_release(cache, &buf);
+  return 0;
+}
+
+static void _prefetch(dt_mipmap_cache_t *cache, const uint32_t imgid, const dt_mipmap_size_t mip)
+{
+  // would only push out what is needed right now
+  if(dt_memory_under_pressure(darktable.memory)) return;
+  dt_job_t *job = dt_control_job_create(&_prefetch_job_run, "prefetch image %d mip %d", imgid, mip);
+  if(!job) return;
+  dt_mipmap_prefetch_t *params = (dt_mipmap_prefetch_t *)calloc(1, sizeof(dt_mipmap_prefetch_t));
+  if(!params)
+  {
+    dt_control_job_dispose(job);
+    return;
+  }
+  params->imgid = imgid;
+  params->mip = mip;
+  params->generation = __sync_fetch_and_add(&cache->prefetch_generation, 0);
+  dt_control_job_set_params_with_size(job, params, sizeof(dt_mipmap_prefetch_t), free);
+  __sync_fetch_and_add(&(_get_cache(cache, mip)->stats_prefetches), 1);
+  dt_control_add_job(darktable.control, DT_JOB_QUEUE_SYSTEM_FG, job);
+}
+
+void dt_mipmap_cache_cancel_prefetch(dt_mipmap_cache_t *cache)
+{
+  __sync_fetch_and_add(&cache->prefetch_generation, 1);
+}
+
+typedef struct dt_mipmap_regenerate_t
+{
+  uint32_t imgid;
+  uint32_t mips; // bit k set for DT_MIPMAP_0 + k
+} dt_mipmap_regenerate_t;
+
+static int32_t _regenerate_job_run(dt_job_t *job)
+{
+  dt_mipmap_cache_t *cache = darktable.mipmap_cache;
+  const double start = dt_get_wtime();
+  int rendered = 0;
+  // the thumbnail pipes keep their device from one image to the next, as long as nobody else wants it
+  dt_opencl_batch_begin(DT_DEV_PIXELPIPE_THUMBNAIL);
+  while(1)
+  {
+    dt_opencl_batch_yield();
+    dt_pthread_mutex_lock(&cache->regenerate_lock);
+    dt_mipmap_regenerate_t *r = (dt_mipmap_regenerate_t *)g_queue_pop_head(cache->regenerate_queue);
+    if(r)
+      g_hash_table_remove(cache->regenerate_pending, GUINT_TO_POINTER(r->imgid));
+    else
+      cache->regenerate_running = 0;
+    dt_pthread_mutex_unlock(&cache->regenerate_lock);
+    if(!r) break;
+
+    // the largest first, _init_8() scales the smaller ones down from it instead of processing the image again
+    for(int k = DT_MIPMAP_F - 1; k >= DT_MIPMAP_0; k--)
+    {
+      if(!(r->mips & (1u << k))) continue;
+      dt_mipmap_buffer_t buf;
+      dt_mipmap_cache_get(cache, &buf, r->imgid, k, DT_MIPMAP_BLOCKING, 'r');
+      dt_mipmap_cache_release(cache, &buf);
+      rendered++;
+    }
+    free(r);
+  }
+  dt_opencl_batch_end();
+
+  const double elapsed = dt_get_wtime() - start;
+  __sync_fetch_and_add(&cache->stats_regenerated, rendered);
+  dt_pthread_mutex_lock(&cache->regenerate_lock);
+  cache->stats_regenerate_time += elapsed;
+  dt_pthread_mutex_unlock(&cache->regenerate_lock);
+  dt_print(DT_DEBUG_PERF, "[mipmap_cache] regenerated %d thumbnails in %.3f secs, %.1f per second\n", rendered,
+           elapsed, elapsed > 0.0 ? rendered / elapsed : 0.0);
+  return 0;
+}
+
+// moves imgid to the front of the regeneration, with mip added to what it renders. FALSE if it isn't waiting.
+static gboolean _regenerate_raise(dt_mipmap_cache_t *cache, const uint32_t imgid, const dt_mipmap_size_t mip)
+{
+  if(!cache->regenerate_queue || mip >= DT_MIPMAP_F) return FALSE;
+  dt_pthread_mutex_lock(&cache->regenerate_lock);
+  GList *link = (GList *)g_hash_table_lookup(cache->regenerate_pending, GUINT_TO_POINTER(imgid));
+  if(link)
+  {
+    ((dt_mipmap_regenerate_t *)link->data)->mips |= 1u << mip;
+    g_queue_unlink(cache->regenerate_queue, link);
+    g_queue_push_head_link(cache->regenerate_queue, link);
+  }
+  dt_pthread_mutex_unlock(&cache->regenerate_lock);
+  return link != NULL;
+}
+
 void dt_mipmap_cache_get_with_caller(
     dt_mipmap_cache_t *cache,
     dt_mipmap_buffer_t *buf,
@@ -669,6 +1802,8 @@ void dt_mipmap_cache_get_with_caller(
     int line)
 {
   const uint32_t key = get_key(imgid, mip);
+  if(flags != DT_MIPMAP_TESTLOCK && (int)mip >= DT_MIPMAP_0 && mip < DT_MIPMAP_NONE)
+    __sync_fetch_and_add(&cache->stats_level_requests[mip], 1);
   if(flags == DT_MIPMAP_TESTLOCK)
   {
     // simple case: only get and lock if it's there.
@@ -706,7 +1841,7 @@ void dt_mipmap_cache_get_with_caller(
     // and opposite: prefetch without locking
     if(mip > DT_MIPMAP_FULL || (int)mip < DT_MIPMAP_0)
       return; // remove the (int) once we no longer have to support gcc < 4.8 :/
-    dt_control_add_job(darktable.control, DT_JOB_QUEUE_SYSTEM_FG, dt_image_load_job_create(imgid, mip));
+    _prefetch(cache, imgid, mip);
   }
   else if(flags == DT_MIPMAP_PREFETCH_DISK)
   {
@@ -714,11 +1849,9 @@ void dt_mipmap_cache_get_with_caller(
     if(!cache->cachedir[0]) return;
     if(mip > DT_MIPMAP_FULL || (int)mip < DT_MIPMAP_0)
       return; // remove the (int) once we no longer have to support gcc < 4.8 :/
-    char filename[PATH_MAX] = {0};
-    snprintf(filename, sizeof(filename), "%s.d/%d/%d.jpg", cache->cachedir, mip, key);
     // don't attempt to load if disk cache doesn't exist
-    if(!g_file_test(filename, G_FILE_TEST_EXISTS)) return;
-    dt_control_add_job(darktable.control, DT_JOB_QUEUE_SYSTEM_FG, dt_image_load_job_create(imgid, mip));
+    if(!dt_mipmap_cache_has_disk_thumbnail(cache, imgid, mip)) return;
+    _prefetch(cache, imgid, mip);
   }
   else if(flags == DT_MIPMAP_BLOCKING)
   {
@@ -734,6 +1867,10 @@ void dt_mipmap_cache_get_with_caller(
     if(dsc->flags & DT_MIPMAP_BUFFER_DSC_FLAG_GENERATE)
     {
       mipmap_generated = 1;
+      const int64_t trace_start = dt_trace_now();
+      DT_TIMER_SCOPE(load_timer, mip == DT_MIPMAP_FULL ? "mipmap load full"
+                                 : mip == DT_MIPMAP_F  ? "mipmap load f"
+                                                       : "mipmap load thumb");
 
       __sync_fetch_and_add(&(_get_cache(cache, mip)->stats_fetches), 1);
       // fprintf(stderr, "[mipmap cache get] now initializing buffer for img %u mip %d!\n", imgid, mip);
@@ -760,7 +1897,17 @@ void dt_mipmap_cache_get_with_caller(
         buf->width = buf->height = 0;
         buf->iscale = 0.0f;
         buf->color_space = DT_COLORSPACE_NONE; // TODO: does the full buffer need to know this?
-        dt_imageio_retval_t ret = dt_imageio_open(&buffered_image, filename, buf); // TODO: color_space?
+        // a cold copy of what the loader made last time is much cheaper than decoding again:
+        const int revived = !_read_cold_full(cache, key, buf, &buffered_image);
+        if(cache->mip_full_cold)
+          __sync_fetch_and_add(revived ? &cache->stats_disk_reads[mip] : &cache->stats_disk_misses[mip], 1);
+        // and so is a copy of what another image of the same file got:
+        gchar *source = revived ? NULL : _full_source_key(filename);
+        const int shared = !revived && !_read_shared_full(cache, source, buf, &buffered_image);
+        dt_imageio_retval_t ret = DT_IMAGEIO_OK;
+        if(!revived && !shared) ret = dt_imageio_open(&buffered_image, filename, buf); // TODO: color_space?
+        if(ret == DT_IMAGEIO_OK) _set_full_source(cache, source, imgid);
+        g_free(source);
         // might have been reallocated:
         ASAN_UNPOISON_MEMORY_REGION(entry->data, dt_mipmap_buffer_dsc_size);
         dsc = (struct dt_mipmap_buffer_dsc *)buf->cache_entry->data;
@@ -778,7 +1925,7 @@ void dt_mipmap_cache_get_with_caller(
             dsc->color_space = DT_COLORSPACE_NONE;
           }
         }
-        else
+        else if(!revived)
         {
           // swap back new image data:
           dt_image_t *img = dt_image_cache_get(darktable.image_cache, imgid, 'w');
@@ -792,7 +1939,7 @@ void dt_mipmap_cache_get_with_caller(
       else if(mip == DT_MIPMAP_F)
       {
         ASAN_UNPOISON_MEMORY_REGION(dsc + 1, dsc->size - sizeof(struct dt_mipmap_buffer_dsc));
-        _init_f(buf, (float *)(dsc + 1), &dsc->width, &dsc->height, &dsc->iscale, imgid);
+        _init_f(buf, (float *)(dsc + 1), &dsc->width, &dsc->height, &dsc->iscale, &dsc->flags, imgid);
       }
       else
       {
@@ -802,6 +1949,15 @@ void dt_mipmap_cache_get_with_caller(
       }
       dsc->color_space = buf->color_space;
       dsc->flags &= ~DT_MIPMAP_BUFFER_DSC_FLAG_GENERATE;
+
+      dt_timer_end(&load_timer);
+      if(dt_trace_enabled())
+      {
+        gchar *detail = g_strdup_printf("image %u", imgid);
+        dt_trace_span("mipmap", mip == DT_MIPMAP_FULL ? "load full" : mip == DT_MIPMAP_F ? "load f" : "load thumb",
+                      trace_start, detail);
+        g_free(detail);
+      }
     }
 
     // image cache is leaving the write lock in place in case the image has been newly allocated.
@@ -875,11 +2031,12 @@ void dt_mipmap_cache_get_with_caller(
         if(mip != k) __sync_fetch_and_add(&(_get_cache(cache, mip)->stats_standin), 1);
         return;
       }
-      // didn't succeed the first time? prefetch for later!
+      // didn't succeed the first time? prefetch for later, unless it is about to be regenerated anyway!
       if(mip == k)
       {
         __sync_fetch_and_add(&(_get_cache(cache, mip)->stats_near_match), 1);
-        dt_mipmap_cache_get(cache, buf, imgid, mip, DT_MIPMAP_PREFETCH, 'r');
+        if(!_regenerate_raise(cache, imgid, mip))
+          dt_mipmap_cache_get(cache, buf, imgid, mip, DT_MIPMAP_PREFETCH, 'r');
       }
     }
     // couldn't find a smaller thumb, try larger ones only now (these will be slightly slower due to cairo rescaling):
@@ -897,13 +2054,8 @@ void dt_mipmap_cache_get_with_caller(
     __sync_fetch_and_add(&(_get_cache(cache, mip)->stats_misses), 1);
     // in case we don't even have a disk cache for our requested thumbnail,
     // prefetch at least mip0, in case we have that in the disk caches:
-    if(cache->cachedir[0])
-    {
-      char filename[PATH_MAX] = {0};
-      snprintf(filename, sizeof(filename), "%s.d/%d/%d.jpg", cache->cachedir, mip, key);
-      if(g_file_test(filename, G_FILE_TEST_EXISTS))
-        dt_mipmap_cache_get(cache, 0, imgid, DT_MIPMAP_0, DT_MIPMAP_PREFETCH_DISK, 0);
-    }
+    if(dt_mipmap_cache_has_disk_thumbnail(cache, imgid, mip))
+      dt_mipmap_cache_get(cache, 0, imgid, DT_MIPMAP_0, DT_MIPMAP_PREFETCH_DISK, 0);
     // nothing found :(
     buf->buf = NULL;
     buf->imgid = 0;
@@ -956,8 +2108,14 @@ dt_mipmap_size_t dt_mipmap_cache_get_matching_size(const dt_mipmap_cache_t *cach
   return best;
 }
 
-void dt_mipmap_cache_remove(dt_mipmap_cache_t *cache, const uint32_t imgid)
+// returns the ldr sizes that were in memory, bit k for DT_MIPMAP_0 + k
+static uint32_t _remove(dt_mipmap_cache_t *cache, const uint32_t imgid)
 {
+  uint32_t mips = 0;
+  // the float buffer might have changed, too (e.g. after reloading the image):
+  _remove_compressed_f(cache, get_key(imgid, DT_MIPMAP_F));
+  _remove_cold_full(cache, get_key(imgid, DT_MIPMAP_FULL));
+
   // get rid of all ldr thumbnails:
 
   for(dt_mipmap_size_t k = DT_MIPMAP_0; k < DT_MIPMAP_F; k++)
@@ -973,6 +2131,7 @@ void dt_mipmap_cache_remove(dt_mipmap_cache_t *cache, const uint32_t imgid)
 
       // due to DT_MIPMAP_BUFFER_DSC_FLAG_INVALIDATE, removes thumbnail from disc
       dt_cache_remove(&_get_cache(cache, k)->cache, key);
+      mips |= 1u << k;
     }
     else
     {
@@ -980,6 +2139,55 @@ void dt_mipmap_cache_remove(dt_mipmap_cache_t *cache, const uint32_t imgid)
       dt_mipmap_cache_unlink_ondisk_thumbnail((&_get_cache(cache, k)->cache)->cleanup_data, imgid, k);
     }
   }
+  return mips;
+}
+
+void dt_mipmap_cache_remove(dt_mipmap_cache_t *cache, const uint32_t imgid)
+{
+  _remove(cache, imgid);
+}
+
+void dt_mipmap_cache_invalidate(dt_mipmap_cache_t *cache, const uint32_t imgid)
+{
+  const uint32_t mips = _remove(cache, imgid);
+  // nothing was shown, the thumbnails are made once they are asked for
+  if(!mips || !cache->regenerate_queue) return;
+
+  dt_pthread_mutex_lock(&cache->regenerate_lock);
+  GList *link = (GList *)g_hash_table_lookup(cache->regenerate_pending, GUINT_TO_POINTER(imgid));
+  if(link)
+    ((dt_mipmap_regenerate_t *)link->data)->mips |= mips;
+  else
+  {
+    dt_mipmap_regenerate_t *r = (dt_mipmap_regenerate_t *)malloc(sizeof(dt_mipmap_regenerate_t));
+    r->imgid = imgid;
+    r->mips = mips;
+    g_queue_push_tail(cache->regenerate_queue, r);
+    g_hash_table_insert(cache->regenerate_pending, GUINT_TO_POINTER(imgid), cache->regenerate_queue->tail);
+  }
+  const int start = !cache->regenerate_running;
+  cache->regenerate_running = 1;
+  const uint32_t serial = ++cache->regenerate_serial;
+  dt_pthread_mutex_unlock(&cache->regenerate_lock);
+  if(!start) return;
+
+  dt_job_t *job = dt_control_job_create(&_regenerate_job_run, "regenerate thumbnails");
+  uint32_t *params = job ? (uint32_t *)malloc(sizeof(uint32_t)) : NULL;
+  if(params)
+  {
+    *params = serial;
+    dt_control_job_set_params_with_size(job, params, sizeof(uint32_t), free);
+    dt_control_add_job(darktable.control, DT_JOB_QUEUE_SYSTEM_FG, job);
+    return;
+  }
+  if(job) dt_control_job_dispose(job);
+  // the thumbnails are made the usual way when they are drawn
+  dt_pthread_mutex_lock(&cache->regenerate_lock);
+  g_queue_free_full(cache->regenerate_queue, free);
+  cache->regenerate_queue = g_queue_new();
+  g_hash_table_remove_all(cache->regenerate_pending);
+  cache->regenerate_running = 0;
+  dt_pthread_mutex_unlock(&cache->regenerate_lock);
 }
 
 void dt_mimap_cache_evict(dt_mipmap_cache_t *cache, const uint32_t imgid)
@@ -994,7 +2202,7 @@ void dt_mimap_cache_evict(dt_mipmap_cache_t *cache, const uint32_t imgid)
 }
 
 static void _init_f(dt_mipmap_buffer_t *mipmap_buf, float *out, uint32_t *width, uint32_t *height, float *iscale,
-                    const uint32_t imgid)
+                    dt_mipmap_buffer_dsc_flags *flags, const uint32_t imgid)
 {
   const uint32_t wd = *width, ht = *height;
 
@@ -1077,6 +2285,7 @@ static void _init_f(dt_mipmap_buffer_t *mipmap_buf, float *out, uint32_t *width,
   {
     // downsample
     dt_iop_clip_and_zoom(out, (const float *)buf.buf, &roi_out, &roi_in, roi_out.width, roi_in.width);
+    *flags |= DT_MIPMAP_BUFFER_DSC_FLAG_RGBA_F;
   }
 
   dt_mipmap_cache_release(darktable.mipmap_cache, &buf);
@@ -1107,7 +2316,7 @@ static int _bpp(dt_imageio_module_data_t *data)
 }
 
 static int _write_image(dt_imageio_module_data_t *data, const char *filename, const void *in, void *exif,
-                        int exif_len, int imgid, int num, int total)
+                        int exif_len, const char *xmp, int imgid, int num, int total)
 {
   _dummy_data_t *d = (_dummy_data_t *)data;
   memcpy(d->buf, in, data->width * data->height * sizeof(uint32_t));
@@ -1145,6 +2354,9 @@ static void _init_8(uint8_t *buf, uint32_t *width, uint32_t *height, float *isca
   if(!altered && !dt_conf_get_bool("never_use_embedded_thumb") && !incompatible)
   {
     const dt_image_orientation_t orientation = dt_image_get_orientation(imgid);
+    // the box the thumbnail is scaled into, in its own orientation: the jpegs are only decoded that large
+    const int fit_wd = (orientation & ORIENTATION_SWAP_XY) ? ht : wd;
+    const int fit_ht = (orientation & ORIENTATION_SWAP_XY) ? wd : ht;
 
     // try to load the embedded thumbnail in raw
     from_cache = TRUE;
@@ -1159,6 +2371,7 @@ static void _init_8(uint8_t *buf, uint32_t *width, uint32_t *height, float *isca
       dt_imageio_jpeg_t jpg;
       if(!dt_imageio_jpeg_read_header(filename, &jpg))
       {
+        dt_imageio_jpeg_fit_scale(&jpg, fit_wd, fit_ht);
         uint8_t *tmp = (uint8_t *)malloc(sizeof(uint8_t) * jpg.width * jpg.height * 4);
         *color_space = dt_imageio_jpeg_read_color_space(&jpg);
         if(!dt_imageio_jpeg_read(&jpg, tmp))
@@ -1170,11 +2383,36 @@ static void _init_8(uint8_t *buf, uint32_t *width, uint32_t *height, float *isca
         free(tmp);
       }
     }
+#ifdef HAVE_OPENJPEG
+    else if(!strcasecmp(c, ".jp2") || !strcasecmp(c, ".j2k") || !strcasecmp(c, ".j2c") || !strcasecmp(c, ".jpc"))
+    {
+      // jpeg 2000 has smaller resolutions built in, only as many are decoded as the thumbnail needs
+      uint8_t *tmp = NULL;
+      int32_t thumb_width, thumb_height;
+      res = dt_imageio_j2k_thumbnail(filename, &tmp, &thumb_width, &thumb_height, color_space, fit_wd, fit_ht);
+      if(!res)
+        dt_iop_flip_and_zoom_8(tmp, thumb_width, thumb_height, buf, wd, ht, orientation, width, height);
+      free(tmp);
+    }
+#endif
+    else if(!strcasecmp(c, ".tif") || !strcasecmp(c, ".tiff"))
+    {
+      // taken from the smallest overview of a pyramidal tiff that fills the thumbnail, and reduced while it is
+      // read. otherwise the thumbnail embedded in the exif, if there is one.
+      uint8_t *tmp = NULL;
+      int32_t thumb_width, thumb_height;
+      res = dt_imageio_tiff_thumbnail(filename, &tmp, &thumb_width, &thumb_height, color_space, fit_wd, fit_ht);
+      if(res)
+        res = dt_imageio_large_thumbnail(filename, &tmp, &thumb_width, &thumb_height, color_space, fit_wd, fit_ht);
+      if(!res)
+        dt_iop_flip_and_zoom_8(tmp, thumb_width, thumb_height, buf, wd, ht, orientation, width, height);
+      free(tmp);
+    }
     else
     {
       uint8_t *tmp = 0;
       int32_t thumb_width, thumb_height;
-      res = dt_imageio_large_thumbnail(filename, &tmp, &thumb_width, &thumb_height, color_space);
+      res = dt_imageio_large_thumbnail(filename, &tmp, &thumb_width, &thumb_height, color_space, fit_wd, fit_ht);
       if(!res)
       {
         // scale to fit
@@ -1211,6 +2449,7 @@ static void _init_8(uint8_t *buf, uint32_t *width, uint32_t *height, float *isca
     _dummy_data_t dat;
     format.bpp = _bpp;
     format.write_image = _write_image;
+    format.write_image_begin = NULL;
     format.levels = _levels;
     dat.head.max_width = wd;
     dat.head.max_height = ht;
@@ -1261,6 +2500,15 @@ void dt_mipmap_cache_copy_thumbnails(const dt_mipmap_cache_t *cache, const uint3
   {
     for(dt_mipmap_size_t mip = DT_MIPMAP_0; mip < DT_MIPMAP_F; mip++)
     {
+      if(cache->pack[mip])
+      {
+        size_t len = 0;
+        int32_t color_space = DT_COLORSPACE_NONE;
+        uint8_t *blob = dt_mipmap_pack_read(cache->pack[mip], src_imgid, &len, &color_space);
+        if(blob) dt_mipmap_pack_write(cache->pack[mip], dst_imgid, blob, len, color_space);
+        g_free(blob);
+        continue;
+      }
       // try and load from disk, if successful set flag
       char srcpath[PATH_MAX] = {0};
       char dstpath[PATH_MAX] = {0};
@@ -21,6 +21,7 @@
 #include "common/cache.h"
 #include "common/colorspaces.h"
 #include "common/image.h"
+#include "common/memory.h"
 
 // sizes stored in the mipmap cache, set to fixed values in mipmap_cache.c
 typedef enum dt_mipmap_size_t
@@ -83,8 +84,17 @@ typedef struct dt_mipmap_cache_one_t
   long int stats_misses;     // nothing returned at all.
   long int stats_fetches;    // texture was fetched (either as a stand-in or as per request)
   long int stats_standin;    // texture used as stand-in
+  long int stats_prefetches;         // DT_MIPMAP_PREFETCH(_DISK) jobs queued
+  long int stats_prefetch_cancelled; // of those, dropped by dt_mipmap_cache_cancel_prefetch() before they ran
 } dt_mipmap_cache_one_t;
 
+// how thumbnails are encoded in the disk cache
+typedef enum dt_mipmap_disk_codec_t
+{
+  DT_MIPMAP_DISK_CODEC_JPEG = 0,   // lossy, small, slow to encode
+  DT_MIPMAP_DISK_CODEC_DEFLATE = 1 // lossless zlib compressed 8-bit buffers, larger but cheap to encode and decode
+} dt_mipmap_disk_codec_t;
+
 typedef struct dt_mipmap_cache_t
 {
   // real width and height are stored per element
@@ -99,6 +109,63 @@ typedef struct dt_mipmap_cache_t
   dt_mipmap_cache_one_t mip_f;
   dt_mipmap_cache_one_t mip_full;
   char cachedir[PATH_MAX]; // cached sha1sum filename for faster access
+  // packed disk cache containers, one per thumbnail mip level. NULL when using one file per thumbnail.
+  struct dt_mipmap_pack_t *pack[DT_MIPMAP_F];
+  dt_mipmap_disk_codec_t codec;
+
+  // evicted thumbnails are encoded and written by a background thread, so eviction never waits for the encoder
+  dt_pthread_mutex_t writer_lock;
+  pthread_cond_t writer_cond;
+  pthread_t writer_thread;
+  GQueue *writer_queue;       // buffers waiting to be written, oldest first
+  GHashTable *writer_pending; // key -> queued write, to serve and invalidate thumbnails not yet on disk
+  int writer_running;
+
+  // evicted DT_MIPMAP_F buffers, kept compressed with dt_image_compress(). NULL if disabled.
+  dt_pthread_mutex_t mip_f_compressed_lock;
+  GHashTable *mip_f_compressed; // key -> compressed buffer
+  GQueue *mip_f_compressed_lru; // keys, last is most recently used
+  size_t mip_f_compressed_size, mip_f_compressed_quota; // in bytes
+
+  // evicted DT_MIPMAP_FULL buffers, compressed losslessly with dt_image_compress_lossless(). the least recently
+  // used ones beyond the memory quota are spilled to a scratch directory, if there is one. NULL if disabled.
+  dt_pthread_mutex_t mip_full_cold_lock;
+  GHashTable *mip_full_cold; // key -> cold buffer
+  GQueue *mip_full_cold_lru; // keys, last is most recently used
+  size_t mip_full_cold_size, mip_full_cold_quota;   // in memory, in bytes
+  size_t mip_full_spill_size, mip_full_spill_quota; // on disk, in bytes
+  gchar *mip_full_spill_dir; // made for this session and removed at cleanup, NULL if not spilling
+
+  // full buffers don't depend on anything but the file, so duplicates and versions share the decode.
+  // source key (path, mtime and size) -> the image the last full buffer of that file was loaded for
+  dt_pthread_mutex_t full_sources_lock;
+  GHashTable *full_sources;
+
+  // bumped to drop disk prefetch jobs still waiting in the queue
+  uint32_t prefetch_generation;
+
+  // thumbnails dropped by dt_mipmap_cache_invalidate(), rendered again by one background job
+  dt_pthread_mutex_t regenerate_lock;
+  GQueue *regenerate_queue;        // dt_mipmap_regenerate_t, the next one first
+  GHashTable *regenerate_pending;  // imgid -> its link in regenerate_queue
+  int regenerate_running;          // a job is queued or running
+  uint32_t regenerate_serial;      // keeps the job queue from taking a new job for the one finishing
+  // thumbnails rendered by it and the seconds it took, busy time only
+  long int stats_regenerated;
+  double stats_regenerate_time;
+
+  // what the thumbnails and float buffers take from the memory budget
+  dt_memory_consumer_t memory;
+  // the quotas as configured, the ones in use shrink while the system is short on memory
+  size_t thumbs_quota, mip_f_compressed_configured, mip_full_cold_configured;
+
+  // per mip level, for dt_mipmap_cache_get_stats()
+  long int stats_level_requests[DT_MIPMAP_NONE];
+  long int stats_level_loads[DT_MIPMAP_NONE]; // buffers which had to be allocated
+  long int stats_level_drops[DT_MIPMAP_NONE]; // buffers which left the cache, evicted or removed
+  // thumbnails read from the disk cache, float and full buffers from the compressed tiers, and not found there:
+  long int stats_disk_reads[DT_MIPMAP_NONE];
+  long int stats_disk_misses[DT_MIPMAP_NONE];
 } dt_mipmap_cache_t;
 
 // dynamic memory allocation interface for imageio backend: a write locked
@@ -109,6 +176,8 @@ void *dt_mipmap_cache_alloc(dt_mipmap_buffer_t *buf, const dt_image_t *img);
 void dt_mipmap_cache_init(dt_mipmap_cache_t *cache);
 void dt_mipmap_cache_cleanup(dt_mipmap_cache_t *cache);
 void dt_mipmap_cache_print(dt_mipmap_cache_t *cache);
+// one line per cache and one per mip level, returns how many of max were filled in
+int dt_mipmap_cache_get_stats(const dt_mipmap_cache_t *cache, dt_cache_stats_t *stats, const int max);
 
 // get a buffer and lock according to mode ('r' or 'w').
 // see dt_mipmap_get_flags_t for explanation of the exact
@@ -139,9 +208,18 @@ void dt_mipmap_cache_write_get_with_caller(
 void dt_mipmap_cache_release_with_caller(dt_mipmap_cache_t *cache, dt_mipmap_buffer_t *buf, const char *file,
                                          int line);
 
+// drop all DT_MIPMAP_PREFETCH(_DISK) requests which haven't started yet, e.g. because they
+// are for thumbnails which have been scrolled past already.
+void dt_mipmap_cache_cancel_prefetch(dt_mipmap_cache_t *cache);
+
 // remove thumbnails, so they will be regenerated:
 void dt_mipmap_cache_remove(dt_mipmap_cache_t *cache, const uint32_t imgid);
 
+// remove thumbnails after the history of an image changed. the sizes that were in memory are rendered again in
+// the background: once through the pipe at the largest of them, the smaller ones scaled down from that. images
+// waiting for that are moved ahead once the lighttable asks for them.
+void dt_mipmap_cache_invalidate(dt_mipmap_cache_t *cache, const uint32_t imgid);
+
 // evict thumbnails from cache. They will be written to disc if not existing
 void dt_mimap_cache_evict(dt_mipmap_cache_t *cache, const uint32_t imgid);
 
@@ -159,8 +237,12 @@ dt_mipmap_size_t dt_mipmap_cache_get_matching_size(
 // returns the colorspace to use for created thumbnails, takes config into account
 dt_colorspaces_color_profile_type_t dt_mipmap_cache_get_colorspace();
 
+// 0: there is no thumbnail of this size for this image in the disk cache (in whatever format is configured)
+int dt_mipmap_cache_has_disk_thumbnail(const dt_mipmap_cache_t *cache, const uint32_t imgid,
+                                       const dt_mipmap_size_t mip);
+
 // copy over thumbnails. used by file operation that copies raw files, to speed up thumbnail generation.
-// only copies over the jpg backend on disk, doesn't directly affect the in-memory cache.
+// only copies over the disk backend, doesn't directly affect the in-memory cache.
 void dt_mipmap_cache_copy_thumbnails(const dt_mipmap_cache_t *cache, const uint32_t dst_imgid, const uint32_t src_imgid);
 
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
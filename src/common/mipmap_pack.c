@@ -0,0 +1,413 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2017 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "common/mipmap_pack.h"
+#include "common/darktable.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <glib/gstdio.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+// bump this when the on-disk layout changes, old packs are discarded then.
+#define DT_MIPMAP_PACK_MAGIC "dtpack01"
+#define DT_MIPMAP_PACK_MAGIC_LEN 8
+
+// only compact when at least half of the data file and a reasonable amount of bytes are stale
+#define DT_MIPMAP_PACK_MIN_STALE (16u << 20)
+
+// one record of the index journal. length 0 marks a removed entry.
+typedef struct dt_mipmap_pack_record_t
+{
+  uint32_t imgid;
+  int32_t color_space;
+  uint64_t offset;
+  uint32_t length;
+  uint32_t reserved;
+} dt_mipmap_pack_record_t;
+
+static void _pack_unmap(dt_mipmap_pack_t *pack)
+{
+#ifndef _WIN32
+  if(pack->map) munmap(pack->map, pack->map_size);
+#endif
+  pack->map = NULL;
+  pack->map_size = 0;
+}
+
+// (re-)map the whole data file. on failure reads fall back to read().
+static void _pack_remap(dt_mipmap_pack_t *pack)
+{
+  _pack_unmap(pack);
+#ifndef _WIN32
+  if(pack->data_size == 0) return;
+  void *map = mmap(NULL, pack->data_size, PROT_READ, MAP_SHARED, pack->fd, 0);
+  if(map == MAP_FAILED)
+  {
+    dt_print(DT_DEBUG_CACHE, "[mipmap_pack] could not map `%s': %s\n", pack->data_filename, strerror(errno));
+    return;
+  }
+  pack->map = (uint8_t *)map;
+  pack->map_size = pack->data_size;
+#endif
+}
+
+static int _pack_write_record(FILE *f, const uint32_t imgid, const dt_mipmap_pack_entry_t *e)
+{
+  dt_mipmap_pack_record_t rec = { 0 };
+  rec.imgid = imgid;
+  if(e)
+  {
+    rec.color_space = e->color_space;
+    rec.offset = e->offset;
+    rec.length = e->length;
+  }
+  return fwrite(&rec, sizeof(rec), 1, f) != 1;
+}
+
+static FILE *_pack_create_index(const char *filename)
+{
+  FILE *f = g_fopen(filename, "wb");
+  if(!f) return NULL;
+  if(fwrite(DT_MIPMAP_PACK_MAGIC, DT_MIPMAP_PACK_MAGIC_LEN, 1, f) != 1)
+  {
+    fclose(f);
+    return NULL;
+  }
+  return f;
+}
+
+// replay the journal into the hashtable. returns non zero if the index is unusable.
+static int _pack_load_index(dt_mipmap_pack_t *pack)
+{
+  FILE *f = g_fopen(pack->index_filename, "rb");
+  if(!f) return 1;
+
+  char magic[DT_MIPMAP_PACK_MAGIC_LEN];
+  if(fread(magic, DT_MIPMAP_PACK_MAGIC_LEN, 1, f) != 1 || memcmp(magic, DT_MIPMAP_PACK_MAGIC, DT_MIPMAP_PACK_MAGIC_LEN))
+  {
+    fclose(f);
+    return 1;
+  }
+
+  dt_mipmap_pack_record_t rec;
+  while(fread(&rec, sizeof(rec), 1, f) == 1)
+  {
+    dt_mipmap_pack_entry_t *old = g_hash_table_lookup(pack->entries, GUINT_TO_POINTER(rec.imgid));
+    if(old) pack->stale_size += old->length;
+
+    // drop removals and anything pointing past the end of the data file (interrupted append):
+    if(rec.length == 0 || rec.offset + rec.length > pack->data_size)
+    {
+      g_hash_table_remove(pack->entries, GUINT_TO_POINTER(rec.imgid));
+      continue;
+    }
+
+    dt_mipmap_pack_entry_t *e = g_malloc(sizeof(dt_mipmap_pack_entry_t));
+    e->offset = rec.offset;
+    e->length = rec.length;
+    e->color_space = rec.color_space;
+    g_hash_table_insert(pack->entries, GUINT_TO_POINTER(rec.imgid), e);
+  }
+  fclose(f);
+  return 0;
+}
+
+dt_mipmap_pack_t *dt_mipmap_pack_open(const char *basename)
+{
+  dt_mipmap_pack_t *pack = (dt_mipmap_pack_t *)calloc(1, sizeof(dt_mipmap_pack_t));
+  if(!pack) return NULL;
+  snprintf(pack->data_filename, sizeof(pack->data_filename), "%s.pack", basename);
+  snprintf(pack->index_filename, sizeof(pack->index_filename), "%s.idx", basename);
+  pack->entries = g_hash_table_new_full(NULL, NULL, NULL, g_free);
+  dt_pthread_mutex_init(&pack->lock, NULL);
+
+  pack->fd = g_open(pack->data_filename, O_RDWR | O_CREAT | O_BINARY, 0640);
+  if(pack->fd < 0)
+  {
+    fprintf(stderr, "[mipmap_pack] could not open `%s': %s\n", pack->data_filename, strerror(errno));
+    goto error;
+  }
+  struct stat st;
+  if(fstat(pack->fd, &st)) goto error;
+  pack->data_size = st.st_size;
+
+  if(_pack_load_index(pack))
+  {
+    // no or broken index: start from scratch.
+    g_hash_table_remove_all(pack->entries);
+    if(ftruncate(pack->fd, 0)) goto error;
+    pack->data_size = pack->stale_size = 0;
+    FILE *f = _pack_create_index(pack->index_filename);
+    if(!f) goto error;
+    fclose(f);
+  }
+  else
+  {
+    // bytes not referenced by the index are stale, too:
+    size_t live = 0;
+    GHashTableIter iter;
+    gpointer key, value;
+    g_hash_table_iter_init(&iter, pack->entries);
+    while(g_hash_table_iter_next(&iter, &key, &value)) live += ((dt_mipmap_pack_entry_t *)value)->length;
+    pack->stale_size = pack->data_size - MIN(live, pack->data_size);
+  }
+
+  pack->index = g_fopen(pack->index_filename, "ab");
+  if(!pack->index) goto error;
+
+  _pack_remap(pack);
+
+  dt_print(DT_DEBUG_CACHE, "[mipmap_pack] opened `%s' with %u entries, %zu of %zu bytes stale\n",
+           pack->data_filename, g_hash_table_size(pack->entries), pack->stale_size, pack->data_size);
+  return pack;
+
+error:
+  if(pack->fd >= 0) close(pack->fd);
+  g_hash_table_destroy(pack->entries);
+  dt_pthread_mutex_destroy(&pack->lock);
+  free(pack);
+  return NULL;
+}
+
+void dt_mipmap_pack_close(dt_mipmap_pack_t *pack)
+{
+  if(!pack) return;
+  _pack_unmap(pack);
+  if(pack->index) fclose(pack->index);
+  if(pack->fd >= 0) close(pack->fd);
+  g_hash_table_destroy(pack->entries);
+  dt_pthread_mutex_destroy(&pack->lock);
+  free(pack);
+}
+
+int dt_mipmap_pack_contains(dt_mipmap_pack_t *pack, const uint32_t imgid)
+{
+  dt_pthread_mutex_lock(&pack->lock);
+  const int res = g_hash_table_contains(pack->entries, GUINT_TO_POINTER(imgid));
+  dt_pthread_mutex_unlock(&pack->lock);
+  return res;
+}
+
+// copy a blob out of the data file, mapping new appends on demand. lock must be held.
+static int _pack_read_locked(dt_mipmap_pack_t *pack, const dt_mipmap_pack_entry_t *e, uint8_t *out)
+{
+  if(e->offset + e->length > pack->map_size) _pack_remap(pack);
+  if(pack->map && e->offset + e->length <= pack->map_size)
+  {
+    memcpy(out, pack->map + e->offset, e->length);
+    return 0;
+  }
+  if(lseek(pack->fd, e->offset, SEEK_SET) < 0) return 1;
+  return read(pack->fd, out, e->length) != (ssize_t)e->length;
+}
+
+uint8_t *dt_mipmap_pack_read(dt_mipmap_pack_t *pack, const uint32_t imgid, size_t *length, int32_t *color_space)
+{
+  uint8_t *blob = NULL;
+  dt_pthread_mutex_lock(&pack->lock);
+  const dt_mipmap_pack_entry_t *e = g_hash_table_lookup(pack->entries, GUINT_TO_POINTER(imgid));
+  if(e && (blob = g_try_malloc(e->length)))
+  {
+    if(_pack_read_locked(pack, e, blob))
+    {
+      g_free(blob);
+      blob = NULL;
+    }
+    else
+    {
+      *length = e->length;
+      if(color_space) *color_space = e->color_space;
+    }
+  }
+  dt_pthread_mutex_unlock(&pack->lock);
+  return blob;
+}
+
+int dt_mipmap_pack_write(dt_mipmap_pack_t *pack, const uint32_t imgid, const uint8_t *blob, const size_t length,
+                         const int32_t color_space)
+{
+  if(!length || length > UINT32_MAX) return 1;
+  int err = 1;
+  dt_pthread_mutex_lock(&pack->lock);
+  // a failed compaction might have left us without files:
+  if(pack->fd < 0 || !pack->index) goto done;
+
+  if(lseek(pack->fd, pack->data_size, SEEK_SET) < 0) goto done;
+  if(write(pack->fd, blob, length) != (ssize_t)length)
+  {
+    // don't leave half a blob behind
+    if(ftruncate(pack->fd, pack->data_size)) goto done;
+    goto done;
+  }
+
+  dt_mipmap_pack_entry_t *e = g_malloc(sizeof(dt_mipmap_pack_entry_t));
+  e->offset = pack->data_size;
+  e->length = length;
+  e->color_space = color_space;
+  pack->data_size += length;
+
+  dt_mipmap_pack_entry_t *old = g_hash_table_lookup(pack->entries, GUINT_TO_POINTER(imgid));
+  if(old) pack->stale_size += old->length;
+  g_hash_table_insert(pack->entries, GUINT_TO_POINTER(imgid), e);
+
+  // the data is written before the index record, so a crash in between only leaves stale bytes.
+  err = _pack_write_record(pack->index, imgid, e) || fflush(pack->index);
+
+done:
+  dt_pthread_mutex_unlock(&pack->lock);
+  return err;
+}
+
+void dt_mipmap_pack_remove(dt_mipmap_pack_t *pack, const uint32_t imgid)
+{
+  dt_pthread_mutex_lock(&pack->lock);
+  dt_mipmap_pack_entry_t *old = g_hash_table_lookup(pack->entries, GUINT_TO_POINTER(imgid));
+  if(old)
+  {
+    pack->stale_size += old->length;
+    g_hash_table_remove(pack->entries, GUINT_TO_POINTER(imgid));
+    if(!pack->index || _pack_write_record(pack->index, imgid, NULL) || fflush(pack->index))
+      fprintf(stderr, "[mipmap_pack] could not write to `%s'\n", pack->index_filename);
+  }
+  dt_pthread_mutex_unlock(&pack->lock);
+}
+
+int dt_mipmap_pack_needs_compaction(dt_mipmap_pack_t *pack)
+{
+  dt_pthread_mutex_lock(&pack->lock);
+  const int res = !pack->compacting && pack->stale_size > DT_MIPMAP_PACK_MIN_STALE
+                  && 2 * pack->stale_size > pack->data_size;
+  if(res) pack->compacting = 1;
+  dt_pthread_mutex_unlock(&pack->lock);
+  return res;
+}
+
+int dt_mipmap_pack_compact(dt_mipmap_pack_t *pack)
+{
+  char data_tmp[PATH_MAX] = { 0 };
+  char index_tmp[PATH_MAX] = { 0 };
+  snprintf(data_tmp, sizeof(data_tmp), "%s.tmp", pack->data_filename);
+  snprintf(index_tmp, sizeof(index_tmp), "%s.tmp", pack->index_filename);
+
+  int err = 1;
+  uint8_t *blob = NULL;
+  size_t blob_size = 0;
+  FILE *data = NULL, *index = NULL;
+  GHashTable *entries = g_hash_table_new_full(NULL, NULL, NULL, g_free);
+
+  dt_pthread_mutex_lock(&pack->lock);
+  const double start = dt_get_wtime();
+  const size_t old_size = pack->data_size;
+
+  data = g_fopen(data_tmp, "wb");
+  index = _pack_create_index(index_tmp);
+  if(!data || !index) goto error;
+
+  uint64_t offset = 0;
+  GHashTableIter iter;
+  gpointer key, value;
+  g_hash_table_iter_init(&iter, pack->entries);
+  while(g_hash_table_iter_next(&iter, &key, &value))
+  {
+    const dt_mipmap_pack_entry_t *e = (dt_mipmap_pack_entry_t *)value;
+    if(e->length > blob_size)
+    {
+      g_free(blob);
+      blob_size = e->length;
+      blob = g_try_malloc(blob_size);
+      if(!blob) goto error;
+    }
+    if(_pack_read_locked(pack, e, blob)) goto error;
+    if(fwrite(blob, e->length, 1, data) != 1) goto error;
+
+    dt_mipmap_pack_entry_t *n = g_malloc(sizeof(dt_mipmap_pack_entry_t));
+    n->offset = offset;
+    n->length = e->length;
+    n->color_space = e->color_space;
+    g_hash_table_insert(entries, key, n);
+    if(_pack_write_record(index, GPOINTER_TO_UINT(key), n)) goto error;
+    offset += e->length;
+  }
+  if(fclose(data)) { data = NULL; goto error; }
+  data = NULL;
+  if(fclose(index)) { index = NULL; goto error; }
+  index = NULL;
+
+  // swap in the new files. the old index goes first, so a crash in between leaves no index at all
+  // and the pack is started from scratch instead of pointing at the wrong blobs.
+  _pack_unmap(pack);
+  fclose(pack->index);
+  pack->index = NULL;
+  close(pack->fd);
+  g_unlink(pack->index_filename);
+  const int renamed = !g_rename(data_tmp, pack->data_filename) && !g_rename(index_tmp, pack->index_filename);
+
+  pack->fd = g_open(pack->data_filename, O_RDWR | O_CREAT | O_BINARY, 0640);
+  if(!renamed)
+  {
+    fprintf(stderr, "[mipmap_pack] could not replace `%s', discarding the packed cache\n", pack->data_filename);
+    g_hash_table_remove_all(entries);
+    offset = 0;
+    if(pack->fd >= 0 && ftruncate(pack->fd, 0))
+      fprintf(stderr, "[mipmap_pack] could not truncate `%s'\n", pack->data_filename);
+    FILE *f = _pack_create_index(pack->index_filename);
+    if(f) fclose(f);
+  }
+  pack->index = g_fopen(pack->index_filename, "ab");
+
+  g_hash_table_destroy(pack->entries);
+  pack->entries = entries;
+  entries = NULL;
+  pack->data_size = offset;
+  pack->stale_size = 0;
+  _pack_remap(pack);
+  err = (pack->fd < 0 || !pack->index);
+
+  dt_print(DT_DEBUG_CACHE, "[mipmap_pack] compacted `%s' from %zu to %zu bytes in %.3fs\n",
+           pack->data_filename, old_size, pack->data_size, dt_get_wtime() - start);
+
+error:
+  if(data) fclose(data);
+  if(index) fclose(index);
+  if(err)
+  {
+    g_unlink(data_tmp);
+    g_unlink(index_tmp);
+  }
+  if(entries) g_hash_table_destroy(entries);
+  g_free(blob);
+  pack->compacting = 0;
+  dt_pthread_mutex_unlock(&pack->lock);
+  return err;
+}
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
@@ -0,0 +1,79 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2017 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "common/dtpthread.h"
+#include <glib.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stddef.h>
+
+// packed on-disk container for the thumbnail cache, one per mip level.
+// instead of one small file per thumbnail, all blobs are appended to a single
+// data file (<base>.pack) and an append-only journal (<base>.idx) maps an
+// image id to offset and length. reads go through a read-only mmap of the
+// data file. removed and overwritten blobs stay in the data file as stale
+// bytes until dt_mipmap_pack_compact() rewrites it.
+
+typedef struct dt_mipmap_pack_entry_t
+{
+  uint64_t offset;
+  uint32_t length;
+  int32_t color_space;
+} dt_mipmap_pack_entry_t;
+
+typedef struct dt_mipmap_pack_t
+{
+  dt_pthread_mutex_t lock;
+  int fd;              // data file, opened for appending and reading
+  FILE *index;         // index journal, opened for appending
+  uint8_t *map;        // read-only mapping of the first map_size bytes of the data file
+  size_t map_size;
+  size_t data_size;    // total bytes in the data file
+  size_t stale_size;   // bytes in the data file not referenced by any entry
+  int compacting;      // a compaction job has been scheduled and not yet finished
+  GHashTable *entries; // imgid -> dt_mipmap_pack_entry_t
+  char data_filename[PATH_MAX];
+  char index_filename[PATH_MAX];
+} dt_mipmap_pack_t;
+
+// open (and create if needed) the pack at <basename>.pack/<basename>.idx. returns NULL on failure.
+dt_mipmap_pack_t *dt_mipmap_pack_open(const char *basename);
+void dt_mipmap_pack_close(dt_mipmap_pack_t *pack);
+
+// 0: not contained
+int dt_mipmap_pack_contains(dt_mipmap_pack_t *pack, const uint32_t imgid);
+// returns a newly allocated copy of the blob stored for imgid, or NULL. free with g_free().
+uint8_t *dt_mipmap_pack_read(dt_mipmap_pack_t *pack, const uint32_t imgid, size_t *length, int32_t *color_space);
+// append a blob for imgid, replacing any previous one. returns 0 on success.
+int dt_mipmap_pack_write(dt_mipmap_pack_t *pack, const uint32_t imgid, const uint8_t *blob, const size_t length,
+                         const int32_t color_space);
+// drop the blob for imgid, if any.
+void dt_mipmap_pack_remove(dt_mipmap_pack_t *pack, const uint32_t imgid);
+
+// returns non zero if enough of the data file is stale to make a compaction worthwhile. the caller
+// then owns the compaction and has to run dt_mipmap_pack_compact(), until then this returns 0.
+int dt_mipmap_pack_needs_compaction(dt_mipmap_pack_t *pack);
+// rewrite data file and index with only the live entries. blocks readers and writers while running,
+// so call it from a background job. returns 0 on success.
+int dt_mipmap_pack_compact(dt_mipmap_pack_t *pack);
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
@@ -0,0 +1,229 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2017 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "common/nlmeans_core.h"
+#include "common/darktable.h"
+#include "develop/pixelpipe_hb.h"
+
+#include <stdint.h>
+#include <string.h>
+
+// the image is processed in tiles of this size, every one for all shifts before the next. the input the
+// shifts of a tile read then stays in the caches, instead of the whole image passing through them once per
+// shift.
+#define DT_NLMEANS_TILE_W 128
+#define DT_NLMEANS_TILE_H 32
+
+typedef union floatint_t
+{
+  float f;
+  int32_t i;
+} floatint_t;
+
+// 2^-x for x >= 0, as fast_mexp2f() in the modules. the conversion is done unconditionally and in range, so
+// the loops calling this vectorize.
+static inline float nlmeans_mexp2f(const float x)
+{
+  const float i1 = (float)0x3f800000u; // 2^0
+  const float i2 = (float)0x3f000000u; // 2^-1
+  const float k0 = MAX(i1 + x * (i2 - i1), 0.0f);
+  const int32_t ki = (int32_t)k0;
+  floatint_t k;
+  k.i = ki & -(int32_t)(k0 >= (float)0x800000u);
+  return k.f;
+}
+
+// adds the weighted squared differences of the pixels of row y to their shifted partners to the column sums S
+// of the columns from sx0, for the columns [dx0, dx1) whose partner is inside the image. every channel keeps
+// its own sum, so the loop runs over the floats of the row as they are. with sub, the ones of row ym are taken
+// off at the same time.
+DT_ALWAYS_INLINE void nlmeans_add_row(float *const S, const float *const in, const int width, const int y,
+                                      const int ym, const int sub, const int ki, const int kj, const int sx0,
+                                      const int dx0, const int dx1, const float *const norm)
+{
+  const float *const a = in + (size_t)4 * y * width;
+  const float *const b = in + (size_t)4 * ((y + kj) * width + ki);
+  const float *const am = in + (size_t)4 * ym * width;
+  const float *const bm = in + (size_t)4 * ((ym + kj) * width + ki);
+  for(int i = dx0; i < dx1; i++)
+    for(int c = 0; c < 4; c++)
+    {
+      const int k = 4 * i + c;
+      const float dp = a[k] - b[k];
+      const float dm = sub ? am[k] - bm[k] : 0.0f;
+      S[k - 4 * sx0] += (dp * dp - dm * dm) * norm[c];
+    }
+}
+
+// all rows of the tile [x0, x1) x [y0, y1) for the shift (ki, kj). the column sums over the patch height
+// slide down the rows and the box sums along the rows are added up directly, a running sum would chain every
+// pixel to the one before. so all loops run over independent pixels.
+DT_ALWAYS_INLINE void nlmeans_tile_plain(const float *const in, float *const out, const int width,
+                                         const int height, const int x0, const int x1, const int y0,
+                                         const int y1, const int ki, const int kj,
+                                         const dt_nlmeans_param_t *const p, float *const scratch,
+                                         const int stride)
+{
+  const int P = p->patch_radius;
+  const int last = width - 2 * P - 1; // last start of a patch window inside the image
+  // column sums the windows of the tile need, the ones with a partner inside the image and the columns
+  // of the tile that have one
+  const int sx0 = CLAMPS(x0 - P, 0, last);
+  const int sx1 = CLAMPS(x1 - 1 - P, 0, last) + 2 * P + 1;
+  const int dx0 = MAX(sx0, -ki), dx1 = MIN(sx1, width - ki);
+  const int ilo = MAX(x0, -ki), ihi = MIN(x1, width - ki);
+  // columns of the tile whose window doesn't touch the image border
+  const int ia = MAX(ilo, MIN(ihi, P)), ib = MAX(ia, MIN(ihi, width - P));
+  if(ilo >= ihi) return;
+
+  const float norm[4] = { p->norm[0], p->norm[1], p->norm[2], 0.0f };
+  float *const S = scratch;
+  float *const B = scratch + 4 * stride;
+  float *const w = scratch + 8 * stride;
+  const size_t n = sx1 - sx0;
+
+  int full = 0; // S holds the full window of the row before
+  for(int j = y0; j < y1; j++)
+  {
+    if(j + kj < 0 || j + kj >= height)
+    {
+      full = 0;
+      continue;
+    }
+    const int Pm = MIN(MIN(P, j + kj), j);
+    const int PM = MIN(MIN(P, height - 1 - j - kj), height - 1 - j);
+    const int is_full = Pm == P && PM == P;
+    if(full && is_full)
+      nlmeans_add_row(S, in, width, j + P, j - P - 1, 1, ki, kj, sx0, dx0, dx1, norm);
+    else
+    {
+      memset(S, 0, sizeof(float) * 4 * n);
+      for(int jj = -Pm; jj <= PM; jj++)
+        nlmeans_add_row(S, in, width, j + jj, j + jj, 0, ki, kj, sx0, dx0, dx1, norm);
+    }
+    full = is_full;
+
+    // box sums along the row, per channel
+    for(int i = 4 * ilo; i < 4 * ihi; i++) B[i - 4 * x0] = 0.0f;
+    for(int k = 0; k <= 2 * P; k++)
+    {
+      for(int i = ilo; i < ia; i++)
+        for(int c = 0; c < 4; c++) B[4 * (i - x0) + c] += S[4 * (CLAMPS(i - P, 0, last) - sx0 + k) + c];
+      for(int i = 4 * ia; i < 4 * ib; i++) B[i - 4 * x0] += S[i - 4 * (P + sx0 - k)];
+      for(int i = ib; i < ihi; i++)
+        for(int c = 0; c < 4; c++) B[4 * (i - x0) + c] += S[4 * (CLAMPS(i - P, 0, last) - sx0 + k) + c];
+    }
+    for(int i = ilo; i < ihi; i++)
+    {
+      const float *const b = B + 4 * (i - x0);
+      w[i - x0] = nlmeans_mexp2f(MAX(0.0f, (b[0] + b[1] + b[2]) * p->scale + p->bias));
+    }
+
+    float *const o = out + (size_t)4 * j * width;
+    const float *const s = in + (size_t)4 * ((j + kj) * width + ki);
+    for(int i = ilo; i < ihi; i++)
+    {
+      const float wt = w[i - x0];
+      for(int c = 0; c < 3; c++) o[4 * i + c] += s[4 * i + c] * wt;
+      o[4 * i + 3] += wt;
+    }
+  }
+}
+
+typedef void(nlmeans_tile_func)(const float *const in, float *const out, const int width, const int height,
+                                const int x0, const int x1, const int y0, const int y1, const int ki,
+                                const int kj, const dt_nlmeans_param_t *const p, float *const scratch,
+                                const int stride);
+
+#ifdef DT_TARGET_AVX2
+static DT_TARGET_AVX2 void nlmeans_tile_avx2(const float *const in, float *const out, const int width,
+                                             const int height, const int x0, const int x1, const int y0,
+                                             const int y1, const int ki, const int kj,
+                                             const dt_nlmeans_param_t *const p, float *const scratch,
+                                             const int stride)
+{
+  nlmeans_tile_plain(in, out, width, height, x0, x1, y0, y1, ki, kj, p, scratch, stride);
+}
+
+static DT_TARGET_AVX512 void nlmeans_tile_avx512(const float *const in, float *const out, const int width,
+                                                 const int height, const int x0, const int x1, const int y0,
+                                                 const int y1, const int ki, const int kj,
+                                                 const dt_nlmeans_param_t *const p, float *const scratch,
+                                                 const int stride)
+{
+  nlmeans_tile_plain(in, out, width, height, x0, x1, y0, y1, ki, kj, p, scratch, stride);
+}
+#endif
+
+static void nlmeans_tile_plain_func(const float *const in, float *const out, const int width,
+                                    const int height, const int x0, const int x1, const int y0, const int y1,
+                                    const int ki, const int kj, const dt_nlmeans_param_t *const p,
+                                    float *const scratch, const int stride)
+{
+  nlmeans_tile_plain(in, out, width, height, x0, x1, y0, y1, ki, kj, p, scratch, stride);
+}
+
+void dt_nlmeans_denoise(const float *const in, float *const out, const int width, const int height,
+                        const dt_nlmeans_param_t *const params)
+{
+  nlmeans_tile_func *tile = nlmeans_tile_plain_func;
+#ifdef DT_TARGET_AVX2
+  if(darktable.codepath.AVX512)
+    tile = nlmeans_tile_avx512;
+  else if(darktable.codepath.AVX2)
+    tile = nlmeans_tile_avx2;
+#endif
+
+  // the patch has to fit into the image
+  dt_nlmeans_param_t p = *params;
+  p.patch_radius = MAX(0, MIN(p.patch_radius, (MIN(width, height) - 1) / 2));
+  const int K = p.search_radius;
+
+  // column sums, box sums and weights of a tile row for every thread
+  const int stride = (DT_NLMEANS_TILE_W + 2 * p.patch_radius + 1 + 15) & ~15;
+  float *const scratch = dt_alloc_align(64, sizeof(float) * 9 * stride * dt_get_num_threads());
+
+  const int tiles_x = (width + DT_NLMEANS_TILE_W - 1) / DT_NLMEANS_TILE_W;
+  const int tiles_y = (height + DT_NLMEANS_TILE_H - 1) / DT_NLMEANS_TILE_H;
+#ifdef _OPENMP
+#pragma omp parallel for default(none) shared(p) schedule(dynamic)
+#endif
+  for(int t = 0; t < tiles_x * tiles_y; t++)
+  {
+    const int x0 = (t % tiles_x) * DT_NLMEANS_TILE_W, x1 = MIN(width, x0 + DT_NLMEANS_TILE_W);
+    const int y0 = (t / tiles_x) * DT_NLMEANS_TILE_H, y1 = MIN(height, y0 + DT_NLMEANS_TILE_H);
+    float *const s = scratch + (size_t)9 * stride * dt_get_thread_num();
+    for(int j = y0; j < y1; j++) memset(out + (size_t)4 * (j * width + x0), 0, sizeof(float) * 4 * (x1 - x0));
+
+    // for each shift vector
+    for(int kj = -K; kj <= K; kj++)
+    {
+      // skip through, the output will be thrown away
+      if(p.pipe && dt_dev_pixelpipe_cancelled(p.pipe)) break;
+      for(int ki = -K; ki <= K; ki++) tile(in, out, width, height, x0, x1, y0, y1, ki, kj, &p, s, stride);
+    }
+  }
+  dt_free_align(scratch);
+}
+
+#undef DT_NLMEANS_TILE_W
+#undef DT_NLMEANS_TILE_H
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
@@ -0,0 +1,52 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2017 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "develop/pixelpipe_hb.h"
+
+/**
+ * non-local means on 4 channel images, shared by the nlmeans and denoiseprofile modules. the distance of two
+ * patches is the box sum of the weighted squared differences of their first three channels, over a square of
+ * 2 * patch_radius + 1 pixels clamped to the image. every shift within search_radius adds its colour with the
+ * weight 2^-max(0, scale * distance + bias) to the output, whose fourth channel sums up the weights; the
+ * caller normalizes.
+ */
+typedef struct dt_nlmeans_param_t
+{
+  int patch_radius;
+  int search_radius;
+  float norm[3];   // weights of the channels in the distance
+  float scale;
+  float bias;
+  const struct dt_dev_pixelpipe_t *pipe; // stop early once it is cancelled, may be NULL
+} dt_nlmeans_param_t;
+
+/** search radius of the modules at scale 1, a smaller one while piece is rendered in draft quality */
+static inline int dt_nlmeans_search_radius(const struct dt_dev_pixelpipe_iop_t *piece)
+{
+  return piece->draft ? 3 : 7;
+}
+
+/** in and out are width x height 4 channel buffers, out is overwritten */
+void dt_nlmeans_denoise(const float *const in, float *const out, const int width, const int height,
+                        const dt_nlmeans_param_t *const params);
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
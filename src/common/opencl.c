@@ -25,15 +25,19 @@
 #include "common/darktable.h"
 #include "common/dlopencl.h"
 #include "common/gaussian.h"
+#include "common/histogram.h"
 #include "common/interpolation.h"
 #include "common/nvidia_gpus.h"
 #include "common/opencl_drivers_blacklist.h"
+#include "common/timers.h"
+#include "common/trace.h"
 #include "control/conf.h"
 #include "control/control.h"
 #include "develop/blend.h"
 #include "develop/pixelpipe.h"
 
 #include <assert.h>
+#include <float.h>
 #include <locale.h>
 #include <stdio.h>
 #include <string.h>
@@ -44,6 +48,21 @@
 #include <sys/stat.h>
 #include <zlib.h>
 
+// an interactive pipe that got a device this many seconds ago keeps one free of exports and thumbnails
+#define DT_OPENCL_INTERACTIVE_WINDOW 2.0
+// thumbnail pipes get opencl_thumbnail_share of the time of a device, measured over this many seconds
+#define DT_OPENCL_SHARE_WINDOW 4.0
+// a batch gives its device back to the scheduler at least this often, in seconds
+#define DT_OPENCL_BATCH_SLICE 0.5
+
+// the batch of pipes on this thread, see dt_opencl_batch_begin()
+static __thread struct
+{
+  int pipetype; // -1 while there is no batch
+  int devid;    // held for the batch, -1 if none
+  int in_use;   // a pipe of the batch has it right now
+} _batch = { -1, -1, 0 };
+
 static const char *dt_opencl_get_vendor_by_id(unsigned int id);
 static float dt_opencl_benchmark_gpu(const int devid, const size_t width, const size_t height, const int count, const float sigma);
 static float dt_opencl_benchmark_cpu(const size_t width, const size_t height, const int count, const float sigma);
@@ -147,13 +166,27 @@ static int dt_opencl_device_init(dt_opencl_t *cl, const int dev, cl_device_id *d
   cl->dev[dev].totallost = 0;
   cl->dev[dev].summary = CL_COMPLETE;
   cl->dev[dev].used_global_mem = 0;
+  cl->dev[dev].cache_memory_in_use = 0;
   cl->dev[dev].nvidia_sm_20 = 0;
   cl->dev[dev].vendor = NULL;
   cl->dev[dev].name = NULL;
   cl->dev[dev].cname = NULL;
   cl->dev[dev].options = NULL;
+  cl->dev[dev].cachedir = NULL;
+  cl->dev[dev].ready = -1;
   cl->dev[dev].memory_in_use = 0;
   cl->dev[dev].peak_memory = 0;
+  cl->dev[dev].module_peak = 0;
+  cl->dev[dev].module_peaks = NULL;
+  cl->dev[dev].pool = NULL;
+  cl->dev[dev].pool_memory = cl->dev[dev].pool_peak = 0;
+  cl->dev[dev].pool_hits = cl->dev[dev].pool_misses = 0;
+  cl->dev[dev].locked = 0;
+  cl->dev[dev].waiting = 0;
+  cl->dev[dev].lock_time = cl->dev[dev].release_time = 0.0;
+  cl->dev[dev].hold_time = cl->dev[dev].load = 0.0;
+  cl->dev[dev].locked_type = -1;
+  cl->dev[dev].thumbnail_busy = cl->dev[dev].thumbnail_time = 0.0;
   cl_device_id devid = cl->dev[dev].devid = devices[k];
 
   char *infostr = NULL;
@@ -339,7 +372,7 @@ static int dt_opencl_device_init(dt_opencl_t *cl, const int dev, cl_device_id *d
   }
   // create a command queue for first device the context reported
   cl->dev[dev].cmd_queue = (cl->dlocl->symbols->dt_clCreateCommandQueue)(
-      cl->dev[dev].context, devid, (darktable.unmuted & DT_DEBUG_PERF) ? CL_QUEUE_PROFILING_ENABLE : 0, &err);
+      cl->dev[dev].context, devid, cl->profiling ? CL_QUEUE_PROFILING_ENABLE : 0, &err);
   if(err != CL_SUCCESS)
   {
     dt_print(DT_DEBUG_OPENCL, "[opencl_init] could not create command queue for device %d: %d\n", k, err);
@@ -350,7 +383,6 @@ static int dt_opencl_device_init(dt_opencl_t *cl, const int dev, cl_device_id *d
   char dtcache[PATH_MAX] = { 0 };
   char cachedir[PATH_MAX] = { 0 };
   char devname[1024];
-  double tstart, tend, tdiff;
   dt_loc_get_user_cache_dir(dtcache, sizeof(dtcache));
 
   int len = strlen(infostr);
@@ -368,11 +400,7 @@ static int dt_opencl_device_init(dt_opencl_t *cl, const int dev, cl_device_id *d
   }
 
   char dtpath[PATH_MAX] = { 0 };
-  char filename[PATH_MAX] = { 0 };
-  char confentry[PATH_MAX] = { 0 };
-  char binname[PATH_MAX] = { 0 };
   dt_loc_get_datadir(dtpath, sizeof(dtpath));
-  snprintf(filename, sizeof(filename), "%s/kernels/programs.conf", dtpath);
   char kerneldir[PATH_MAX] = { 0 };
   snprintf(kerneldir, sizeof(kerneldir), "%s/kernels", dtpath);
 
@@ -383,18 +411,46 @@ static int dt_opencl_device_init(dt_opencl_t *cl, const int dev, cl_device_id *d
   g_free(options);
   options = NULL;
 
+  // the programs get built in the background, see _opencl_build_programs()
+  cl->dev[dev].cachedir = strdup(cachedir);
+  cl->dev[dev].ready = 0;
+
+  res = 0;
+
+end:
+
+  free(infostr);
+  free(cname);
+  free(options);
+  free(vendor);
+  free(driverversion);
+  free(deviceversion);
+
+  return res;
+}
+
+// loads and builds all programs of programs.conf for one device. returns 0 on success.
+static int _opencl_build_programs(dt_opencl_t *cl, const int dev)
+{
+  int res = 1;
+  char dtpath[PATH_MAX] = { 0 };
+  char filename[PATH_MAX] = { 0 };
+  char confentry[PATH_MAX] = { 0 };
+  char binname[PATH_MAX] = { 0 };
+  const char *cachedir = cl->dev[dev].cachedir;
+  dt_loc_get_datadir(dtpath, sizeof(dtpath));
+  snprintf(filename, sizeof(filename), "%s/kernels/programs.conf", dtpath);
+
   const char *clincludes[DT_OPENCL_MAX_INCLUDES] = { "colorspace.cl", "common.h", NULL };
   char *includemd5[DT_OPENCL_MAX_INCLUDES] = { NULL };
   dt_opencl_md5sum(clincludes, includemd5);
 
-  // now load all darktable cl kernels.
-  // TODO: compile as a job?
-  tstart = dt_get_wtime();
+  const double tstart = dt_get_wtime();
   FILE *f = g_fopen(filename, "rb");
   if(f)
   {
 
-    while(!feof(f))
+    while(!feof(f) && !cl->shutdown)
     {
       int prog = -1;
       gchar *confline_pattern = g_strdup_printf("%%%zu[^\n]\n", sizeof(confentry) - 1);
@@ -431,19 +487,22 @@ static int dt_opencl_device_init(dt_opencl_t *cl, const int dev, cl_device_id *d
 
       if(!programname || programname[0] == '\0' || prog < 0)
       {
-        dt_print(DT_DEBUG_OPENCL, "[opencl_init] malformed entry in programs.conf `%s'; ignoring it!\n", confentry);
+        dt_print(DT_DEBUG_OPENCL, "[opencl_build_programs] malformed entry in programs.conf `%s'; ignoring it!\n",
+                 confentry);
         continue;
       }
 
       snprintf(filename, sizeof(filename), "%s/kernels/%s", dtpath, programname);
       snprintf(binname, sizeof(binname), "%s/%s.bin", cachedir, programname);
-      dt_print(DT_DEBUG_OPENCL, "[opencl_init] compiling program `%s' ..\n", programname);
+      dt_print(DT_DEBUG_OPENCL, "[opencl_build_programs] compiling program `%s' for device %d ..\n", programname,
+               dev);
       int loaded_cached;
       char md5sum[33];
       if(dt_opencl_load_program(dev, prog, filename, binname, cachedir, md5sum, includemd5, &loaded_cached)
          && dt_opencl_build_program(dev, prog, binname, cachedir, md5sum, loaded_cached) != CL_SUCCESS)
       {
-        dt_print(DT_DEBUG_OPENCL, "[opencl_init] failed to compile program `%s'!\n", programname);
+        dt_print(DT_DEBUG_OPENCL, "[opencl_build_programs] failed to compile program `%s' for device %d!\n",
+                 programname, dev);
         fclose(f);
         g_strfreev(tokens);
         res = 1;
@@ -454,30 +513,139 @@ static int dt_opencl_device_init(dt_opencl_t *cl, const int dev, cl_device_id *d
     }
 
     fclose(f);
-    tend = dt_get_wtime();
-    tdiff = tend - tstart;
-    dt_print(DT_DEBUG_OPENCL, "[opencl_init] kernel loading time: %2.4lf \n", tdiff);
+    if(cl->shutdown) goto end;
+    dt_print(DT_DEBUG_OPENCL, "[opencl_build_programs] kernel loading time for device %d: %2.4lf \n", dev,
+             dt_get_wtime() - tstart);
   }
   else
   {
-    dt_print(DT_DEBUG_OPENCL, "[opencl_init] could not open `%s'!\n", filename);
+    dt_print(DT_DEBUG_OPENCL, "[opencl_build_programs] could not open `%s'!\n", filename);
     res = 1;
     goto end;
   }
-  for(int n = 0; n < DT_OPENCL_MAX_INCLUDES; n++) g_free(includemd5[n]);
-
   res = 0;
 
 end:
+  for(int n = 0; n < DT_OPENCL_MAX_INCLUDES; n++) g_free(includemd5[n]);
+  return res;
+}
 
-  free(infostr);
-  free(cname);
-  free(options);
-  free(vendor);
-  free(driverversion);
-  free(deviceversion);
+// creates the kernels of all modules on a device whose programs were just built. expects the lock.
+static void _opencl_create_pending_kernels(dt_opencl_t *cl, const int dev)
+{
+  for(int k = 0; k < DT_OPENCL_MAX_KERNELS; k++)
+  {
+    if(!cl->kernel_name[k]) continue;
+    cl_int err;
+    cl->dev[dev].kernel[k] = (cl->dlocl->symbols->dt_clCreateKernel)(cl->dev[dev].program[cl->kernel_program[k]],
+                                                                      cl->kernel_name[k], &err);
+    if(err != CL_SUCCESS)
+    {
+      dt_print(DT_DEBUG_OPENCL, "[opencl_create_kernel] could not create kernel `%s' for device %d! (%d)\n",
+               cl->kernel_name[k], dev, err);
+      cl->dev[dev].kernel[k] = NULL;
+    }
+  }
+}
 
-  return res;
+// one per device: pipes don't get the device until its programs are built, and use the cpu meanwhile
+static void *_opencl_build_thread(void *arg)
+{
+  dt_opencl_t *cl = darktable.opencl;
+  const int dev = GPOINTER_TO_INT(arg);
+  dt_pthread_setname("opencl build");
+
+  // work-around for AMD OpenCL compilers failing on numerical constants in other locales, see dt_opencl_init()
+#ifdef _WIN32
+  _configthreadlocale(_ENABLE_PER_THREAD_LOCALE);
+  setlocale(LC_ALL, "C");
+#else
+  locale_t c_locale = newlocale(LC_ALL_MASK, "C", (locale_t)0);
+  if(c_locale) uselocale(c_locale);
+#endif
+
+  const int res = _opencl_build_programs(cl, dev);
+
+#ifndef _WIN32
+  if(c_locale)
+  {
+    uselocale(LC_GLOBAL_LOCALE);
+    freelocale(c_locale);
+  }
+#endif
+
+  dt_pthread_mutex_lock(&cl->lock);
+  if(res == 0) _opencl_create_pending_kernels(cl, dev);
+  cl->dev[dev].ready = res == 0 ? 1 : -1;
+  dt_pthread_mutex_unlock(&cl->lock);
+
+  if(res == 0)
+    dt_print(DT_DEBUG_OPENCL, "[opencl_init] device %d '%s' is ready.\n", dev, cl->dev[dev].name);
+  else if(!cl->shutdown)
+    dt_print(DT_DEBUG_OPENCL, "[opencl_init] device %d '%s' could not build its programs and won't be used.\n",
+             dev, cl->dev[dev].name);
+  return NULL;
+}
+
+// first start with a new device setup: compares the devices to the cpu once their programs are built and
+// picks a scheduling profile
+static void *_opencl_benchmark_thread(void *arg)
+{
+  dt_opencl_t *cl = darktable.opencl;
+  dt_pthread_setname("opencl bench");
+  while(!cl->shutdown && !dt_opencl_is_ready()) dt_iop_nap(100000);
+  if(cl->shutdown) return NULL;
+
+  // do CPU bencharking
+  float tcpu = dt_opencl_benchmark_cpu(1024, 1024, 5, 100.0f);
+  // get best benchmarking value of all detected OpenCL devices
+  float tgpumin = INFINITY;
+  for(int n = 0; n < cl->num_devs && !cl->shutdown; n++)
+  {
+    if(cl->dev[n].ready != 1) continue;
+    dt_pthread_mutex_lock(&cl->dev[n].lock);
+    float tgpu = cl->dev[n].benchmark = dt_opencl_benchmark_gpu(n, 1024, 1024, 5, 100.0f);
+    dt_pthread_mutex_unlock(&cl->dev[n].lock);
+    tgpumin = fmin(tgpu, tgpumin);
+  }
+  if(cl->shutdown || tgpumin == INFINITY) return NULL;
+  dt_print(DT_DEBUG_OPENCL,
+           "[opencl_init] benchmarking results: %f seconds for fastest GPU versus %f seconds for CPU.\n", tgpumin,
+           tcpu);
+
+  if(tcpu <= 1.5f * tgpumin)
+  {
+    // de-activate opencl for darktable in case of too slow GPU(s). user can always manually overrule this later.
+    cl->enabled = FALSE;
+    dt_conf_set_bool("opencl", FALSE);
+    dt_print(DT_DEBUG_OPENCL, "[opencl_init] due to a slow GPU the opencl flag has been set to OFF.\n");
+    dt_control_log(_("due to a slow GPU hardware acceleration via opencl has been de-activated."));
+  }
+  else if(cl->num_devs >= 2)
+  {
+    // set scheduling profile to "multiple GPUs" if more than one device has been found
+    dt_conf_set_string("opencl_scheduling_profile", "multiple GPUs");
+    dt_print(DT_DEBUG_OPENCL, "[opencl_init] set scheduling profile for multipe GPUs.\n");
+    dt_control_log(_("multiple GPUs detected - opencl scheduling profile has been set accordingly."));
+  }
+  else if(tcpu >= 6.0f * tgpumin)
+  {
+    // set scheduling profile to "very fast GPU" if CPU is way too slow
+    dt_conf_set_string("opencl_scheduling_profile", "very fast GPU");
+    dt_print(DT_DEBUG_OPENCL, "[opencl_init] set scheduling profile for very fast GPU.\n");
+    dt_control_log(_("very fast GPU detected - opencl scheduling profile has been set accordingly."));
+  }
+  else
+  {
+    // set scheduling profile to "default"
+    dt_conf_set_string("opencl_scheduling_profile", "default");
+    dt_print(DT_DEBUG_OPENCL, "[opencl_init] set scheduling profile to default.\n");
+    dt_control_log(_("opencl scheduling profile set to default."));
+  }
+
+  // takes over the new opencl flag and scheduling profile
+  dt_opencl_update_settings();
+  return NULL;
 }
 
 void dt_opencl_init(dt_opencl_t *cl, const gboolean exclude_opencl, const gboolean print_statistics)
@@ -487,8 +655,16 @@ void dt_opencl_init(dt_opencl_t *cl, const gboolean exclude_opencl, const gboole
   cl->inited = 0;
   cl->enabled = 0;
   cl->stopped = 0;
+  cl->shutdown = 0;
+  cl->benchmark = 0;
   cl->error_count = 0;
   cl->print_statistics = print_statistics;
+  memset(cl->kernel_name, 0, sizeof(cl->kernel_name));
+  dt_pthread_mutex_init(&cl->pool_lock, NULL);
+  cl->pool_objects = g_hash_table_new(g_direct_hash, g_direct_equal);
+  cl->pool_limit = (size_t)MAX(0, dt_conf_get_int("opencl_memory_pool")) * 1024 * 1024;
+  memset(cl->kernel_program, 0, sizeof(cl->kernel_program));
+  cl->profiling = (darktable.unmuted & (DT_DEBUG_PERF | DT_DEBUG_TRACE)) || dt_conf_get_bool("pixelpipe_report");
 
   // work-around to fix a bug in some AMD OpenCL compilers, which would fail parsing certain numerical
   // constants if locale is different from "C".
@@ -673,6 +849,10 @@ void dt_opencl_init(dt_opencl_t *cl, const gboolean exclude_opencl, const gboole
     cl->inited = 1;
     cl->enabled = dt_conf_get_bool("opencl");
     memset(cl->mandatory, 0, sizeof(cl->mandatory));
+    memset(cl->lock_stats, 0, sizeof(cl->lock_stats));
+    for(int k = 0; k < 4; k++) cl->last_device[k] = -1;
+    cl->interactive_time = 0.0;
+    cl->interactive_waiting = 0;
     cl->dev_priority_image = (int *)malloc(sizeof(int) * (dev + 1));
     cl->dev_priority_preview = (int *)malloc(sizeof(int) * (dev + 1));
     cl->dev_priority_export = (int *)malloc(sizeof(int) * (dev + 1));
@@ -702,11 +882,15 @@ finally:
   if(cl->inited)
   {
     dt_capabilities_add("opencl");
+    // build the programs of all devices at the same time, in the background
+    for(int n = 0; n < cl->num_devs; n++)
+      cl->dev[n].building = !dt_pthread_create(&cl->dev[n].builder, _opencl_build_thread, GINT_TO_POINTER(n));
     cl->blendop = dt_develop_blend_init_cl_global();
     cl->bilateral = dt_bilateral_init_cl_global();
     cl->gaussian = dt_gaussian_init_cl_global();
     cl->interpolation = dt_interpolation_init_cl_global();
     cl->local_laplacian = dt_local_laplacian_init_cl_global();
+    cl->histogram = dt_histogram_init_cl_global();
 
     char checksum[64];
     snprintf(checksum, sizeof(checksum), "%u", cl->crc);
@@ -717,47 +901,8 @@ finally:
     {
       // store new checksum value in config
       dt_conf_set_string("opencl_checksum", checksum);
-      // do CPU bencharking
-      float tcpu = dt_opencl_benchmark_cpu(1024, 1024, 5, 100.0f);
-      // get best benchmarking value of all detected OpenCL devices
-      float tgpumin = INFINITY;
-      for(int n = 0; n < cl->num_devs; n++)
-      {
-        float tgpu = cl->dev[n].benchmark = dt_opencl_benchmark_gpu(n, 1024, 1024, 5, 100.0f);
-        tgpumin = fmin(tgpu, tgpumin);
-      }
-      dt_print(DT_DEBUG_OPENCL, "[opencl_init] benchmarking results: %f seconds for fastest GPU versus %f seconds for CPU.\n",
-           tgpumin, tcpu);
-
-      if(tcpu <= 1.5f * tgpumin)
-      {
-        // de-activate opencl for darktable in case of too slow GPU(s). user can always manually overrule this later.
-        cl->enabled = FALSE;
-        dt_conf_set_bool("opencl", FALSE);
-        dt_print(DT_DEBUG_OPENCL, "[opencl_init] due to a slow GPU the opencl flag has been set to OFF.\n");
-        dt_control_log(_("due to a slow GPU hardware acceleration via opencl has been de-activated."));
-      }
-      else if(cl->num_devs >= 2)
-      {
-        // set scheduling profile to "multiple GPUs" if more than one device has been found
-        dt_conf_set_string("opencl_scheduling_profile", "multiple GPUs");
-        dt_print(DT_DEBUG_OPENCL, "[opencl_init] set scheduling profile for multipe GPUs.\n");
-        dt_control_log(_("multiple GPUs detected - opencl scheduling profile has been set accordingly."));
-      }
-      else if(tcpu >= 6.0f * tgpumin)
-      {
-        // set scheduling profile to "very fast GPU" if CPU is way too slow
-        dt_conf_set_string("opencl_scheduling_profile", "very fast GPU");
-        dt_print(DT_DEBUG_OPENCL, "[opencl_init] set scheduling profile for very fast GPU.\n");
-        dt_control_log(_("very fast GPU detected - opencl scheduling profile has been set accordingly."));
-      }
-      else
-      {
-        // set scheduling profile to "default"
-        dt_conf_set_string("opencl_scheduling_profile", "default");
-        dt_print(DT_DEBUG_OPENCL, "[opencl_init] set scheduling profile to default.\n");
-        dt_control_log(_("opencl scheduling profile set to default."));
-      }
+      // benchmark once the programs are there
+      cl->benchmark = !dt_pthread_create(&cl->benchmark_thread, _opencl_benchmark_thread, NULL);
     }
     g_free(oldchecksum);
 
@@ -771,7 +916,8 @@ finally:
     {
       dt_pthread_mutex_destroy(&cl->dev[i].lock);
       for(int k = 0; k < DT_OPENCL_MAX_KERNELS; k++)
-        if(cl->dev[i].kernel_used[k]) (cl->dlocl->symbols->dt_clReleaseKernel)(cl->dev[i].kernel[k]);
+        if(cl->dev[i].kernel_used[k] && cl->dev[i].kernel[k])
+          (cl->dlocl->symbols->dt_clReleaseKernel)(cl->dev[i].kernel[k]);
       for(int k = 0; k < DT_OPENCL_MAX_PROGRAMS; k++)
         if(cl->dev[i].program_used[k]) (cl->dlocl->symbols->dt_clReleaseProgram)(cl->dev[i].program[k]);
       (cl->dlocl->symbols->dt_clReleaseCommandQueue)(cl->dev[i].cmd_queue);
@@ -786,6 +932,7 @@ finally:
       free((void *)(cl->dev[i].name));
       free((void *)(cl->dev[i].cname));
       free((void *)(cl->dev[i].options));
+      free((void *)(cl->dev[i].cachedir));
     }
   }
 
@@ -800,19 +947,62 @@ finally:
   return;
 }
 
+static gint _module_peak_compare(gconstpointer a, gconstpointer b, gpointer user_data)
+{
+  GHashTable *peaks = (GHashTable *)user_data;
+  const size_t pa = *(size_t *)g_hash_table_lookup(peaks, a);
+  const size_t pb = *(size_t *)g_hash_table_lookup(peaks, b);
+  return pa < pb ? 1 : pa > pb ? -1 : strcmp((const char *)a, (const char *)b);
+}
+
+/** the modules that needed the most device memory, and how much was left */
+static void _opencl_print_module_peaks(const dt_opencl_device_t *dev, const int devid)
+{
+  GList *ops = g_list_sort_with_data(g_hash_table_get_keys(dev->module_peaks), _module_peak_compare,
+                                     dev->module_peaks);
+  const int headroom = dt_conf_get_int("opencl_memory_headroom");
+  dt_print(DT_DEBUG_OPENCL, "[opencl_summary_statistics] device '%s' (%d): least headroom %.1f MB of %.1f MB, "
+                            "with opencl_memory_headroom at %d MB\n",
+           dev->name, devid, (dev->max_global_mem - MIN(dev->peak_memory, dev->max_global_mem)) / 1048576.0,
+           dev->max_global_mem / 1048576.0, headroom);
+  for(const GList *l = ops; l; l = g_list_next(l))
+  {
+    const size_t peak = *(size_t *)g_hash_table_lookup(dev->module_peaks, l->data);
+    dt_print(DT_DEBUG_OPENCL, "[opencl_summary_statistics]   %-20s peak %9.1f MB, headroom %9.1f MB\n",
+             (const char *)l->data, peak / 1048576.0,
+             (dev->max_global_mem - MIN(peak, dev->max_global_mem)) / 1048576.0);
+  }
+  g_list_free(ops);
+}
+
 void dt_opencl_cleanup(dt_opencl_t *cl)
 {
   if(cl->inited)
   {
+    // builds stop after the current program
+    cl->shutdown = 1;
+    if(cl->benchmark) pthread_join(cl->benchmark_thread, NULL);
+    for(int i = 0; i < cl->num_devs; i++)
+      if(cl->dev[i].building) pthread_join(cl->dev[i].builder, NULL);
+    for(int k = 0; k < DT_OPENCL_MAX_KERNELS; k++) free((void *)cl->kernel_name[k]);
+
     dt_develop_blend_free_cl_global(cl->blendop);
     dt_bilateral_free_cl_global(cl->bilateral);
     dt_gaussian_free_cl_global(cl->gaussian);
     dt_interpolation_free_cl_global(cl->interpolation);
+    dt_histogram_free_cl_global(cl->histogram);
     for(int i = 0; i < cl->num_devs; i++)
     {
+      _pool_flush(i);
+      if(cl->print_statistics && (cl->dev[i].pool_hits || cl->dev[i].pool_misses))
+        dt_print(DT_DEBUG_OPENCL, "[opencl_summary_statistics] device '%s' (%d): %d of %d allocations served "
+                                  "by the memory pool, at most %zu bytes pooled\n",
+                 cl->dev[i].name, i, cl->dev[i].pool_hits, cl->dev[i].pool_hits + cl->dev[i].pool_misses,
+                 cl->dev[i].pool_peak);
       dt_pthread_mutex_destroy(&cl->dev[i].lock);
       for(int k = 0; k < DT_OPENCL_MAX_KERNELS; k++)
-        if(cl->dev[i].kernel_used[k]) (cl->dlocl->symbols->dt_clReleaseKernel)(cl->dev[i].kernel[k]);
+        if(cl->dev[i].kernel_used[k] && cl->dev[i].kernel[k])
+          (cl->dlocl->symbols->dt_clReleaseKernel)(cl->dev[i].kernel[k]);
       for(int k = 0; k < DT_OPENCL_MAX_PROGRAMS; k++)
         if(cl->dev[i].program_used[k]) (cl->dlocl->symbols->dt_clReleaseProgram)(cl->dev[i].program[k]);
       (cl->dlocl->symbols->dt_clReleaseCommandQueue)(cl->dev[i].cmd_queue);
@@ -822,7 +1012,10 @@ void dt_opencl_cleanup(dt_opencl_t *cl)
       {
         dt_print(DT_DEBUG_OPENCL, "[opencl_summary_statistics] device '%s' (%d): peak memory usage %zu bytes\n",
                    cl->dev[i].name, i, cl->dev[i].peak_memory);
+        if(cl->dev[i].module_peaks) _opencl_print_module_peaks(&cl->dev[i], i);
       }
+      if(cl->dev[i].module_peaks) g_hash_table_destroy(cl->dev[i].module_peaks);
+      cl->dev[i].module_peaks = NULL;
 
       if(cl->print_statistics && cl->use_events)
       {
@@ -851,7 +1044,21 @@ void dt_opencl_cleanup(dt_opencl_t *cl)
       free((void *)(cl->dev[i].name));
       free((void *)(cl->dev[i].cname));
       free((void *)(cl->dev[i].options));
+      free((void *)(cl->dev[i].cachedir));
+    }
+    if(cl->print_statistics)
+    {
+      static const char *pipe_names[4] = { "full", "preview", "export", "thumbnail" };
+      for(int k = 0; k < 4; k++)
+      {
+        const dt_opencl_lock_stats_t *stats = cl->lock_stats + k;
+        if(!stats->locks && !stats->cpu) continue;
+        dt_print(DT_DEBUG_OPENCL, "[opencl_summary_statistics] %s pipe: %d device locks, %d waits for %.3f "
+                                  "seconds in total, %d times without a device, %d from a batch\n",
+                 pipe_names[k], stats->locks, stats->waits, stats->wait_time, stats->cpu, stats->batched);
+      }
     }
+
     free(cl->dev_priority_image);
     free(cl->dev_priority_preview);
     free(cl->dev_priority_export);
@@ -866,6 +1073,16 @@ void dt_opencl_cleanup(dt_opencl_t *cl)
   }
 
   free(cl->dev);
+  if(cl->pool_objects)
+  {
+    // entries of objects that were still in use
+    GHashTableIter iter;
+    gpointer value;
+    g_hash_table_iter_init(&iter, cl->pool_objects);
+    while(g_hash_table_iter_next(&iter, NULL, &value)) free(value);
+    g_hash_table_destroy(cl->pool_objects);
+  }
+  dt_pthread_mutex_destroy(&cl->pool_lock);
   dt_pthread_mutex_destroy(&cl->lock);
 }
 
@@ -1321,11 +1538,121 @@ static void dt_opencl_update_priorities(const char *configstr)
              cl->mandatory[1], cl->mandatory[2], cl->mandatory[3]);
 }
 
+// index of pipetype in mandatory, last_device and lock_stats, -1 for unknown types
+static int _opencl_pipe_index(const int pipetype)
+{
+  switch(pipetype)
+  {
+    case DT_DEV_PIXELPIPE_FULL:
+      return 0;
+    case DT_DEV_PIXELPIPE_PREVIEW:
+      return 1;
+    case DT_DEV_PIXELPIPE_EXPORT:
+      return 2;
+    case DT_DEV_PIXELPIPE_THUMBNAIL:
+      return 3;
+    default:
+      return -1;
+  }
+}
+
+// seconds until a busy device is expected to be free for one more pipe: what's left of its average hold time
+// and a full one for each pipe waiting for it already. cl->lock has to be held.
+static double _opencl_expected_wait(const dt_opencl_device_t *dev, const double now)
+{
+  return MAX(0.0, dev->hold_time - (now - dev->lock_time)) + dev->waiting * dev->hold_time;
+}
+
+// fraction of the last DT_OPENCL_SHARE_WINDOW seconds thumbnail pipes held dev, counting the current hold.
+// cl->lock has to be held.
+static double _opencl_thumbnail_share(const dt_opencl_device_t *dev, const double now)
+{
+  double busy = dev->thumbnail_busy * exp(-(now - dev->thumbnail_time) / DT_OPENCL_SHARE_WINDOW);
+  if(dev->locked && dev->locked_type == 3) busy += now - dev->lock_time;
+  return busy / DT_OPENCL_SHARE_WINDOW;
+}
+
+// adaptive scheduling: of the free devices in priority, take the one this pipe type ran on last (its cached
+// buffers might still be there), else the least loaded one. exports and thumbnails don't take the last free
+// device while the darkroom is in use, and stand back while an interactive pipe waits. if no device is
+// taken, *wait is the shortest expected wait for one and *best the device it's for.
+static int _opencl_trylock_adaptive(dt_opencl_t *cl, const int *priority, const int type, double *wait,
+                                    int *best)
+{
+  const int background = type == 2 || type == 3;
+  const double now = dt_get_wtime();
+  int devid = -1, allowed = 0, free_devs = 0;
+  *wait = DBL_MAX;
+  *best = -1;
+
+  dt_pthread_mutex_lock(&cl->lock);
+  for(const int *prio = priority; *prio != -1; prio++)
+  {
+    const dt_opencl_device_t *dev = cl->dev + *prio;
+    if(dev->ready != 1) continue;
+    allowed++;
+    if(dev->locked)
+    {
+      const double t = _opencl_expected_wait(dev, now);
+      if(t < *wait)
+      {
+        *wait = t;
+        *best = *prio;
+      }
+      continue;
+    }
+    free_devs++;
+    if(devid == -1 || *prio == cl->last_device[type]
+       || (devid != cl->last_device[type] && dev->load < cl->dev[devid].load))
+      devid = *prio;
+  }
+  const int interactive_active = now - cl->interactive_time < DT_OPENCL_INTERACTIVE_WINDOW;
+  if(background
+     && (cl->interactive_waiting > 0 || (allowed > 1 && free_devs == 1 && interactive_active)))
+    devid = -1;
+  if(devid != -1 && dt_pthread_mutex_trylock(&cl->dev[devid].lock)) devid = -1;
+  if(devid == -1 && *best == -1 && free_devs)
+  {
+    // held back or raced for a free device: try again soon
+    *wait = 0.0;
+  }
+  dt_pthread_mutex_unlock(&cl->lock);
+  return devid;
+}
+
+// like trylocking the device, but one that is still building its programs counts as busy
+static int _opencl_trylock_ready(dt_opencl_t *cl, const int devid)
+{
+  return cl->dev[devid].ready != 1 || dt_pthread_mutex_trylock(&cl->dev[devid].lock);
+}
+
+// static priorities: the first free device in the list
+static int _opencl_trylock(dt_opencl_t *cl, const int *priority)
+{
+  for(const int *prio = priority; *prio != -1; prio++)
+    if(!_opencl_trylock_ready(cl, *prio)) return *prio;
+  return -1;
+}
+
 int dt_opencl_lock_device(const int pipetype)
 {
   dt_opencl_t *cl = darktable.opencl;
   if(!cl->inited) return -1;
 
+  if(_batch.pipetype == pipetype && !_batch.in_use)
+  {
+    dt_opencl_batch_yield();
+    if(_batch.devid != -1)
+    {
+      dt_pthread_mutex_lock(&cl->lock);
+      cl->lock_stats[_opencl_pipe_index(pipetype)].batched++;
+      dt_pthread_mutex_unlock(&cl->lock);
+      _batch.in_use = 1;
+      return _batch.devid;
+    }
+  }
+
+  const int64_t trace_start = dt_trace_now();
 
   dt_pthread_mutex_lock(&cl->lock);
 
@@ -1356,38 +1683,89 @@ int dt_opencl_lock_device(const int pipetype)
       priority = NULL;
       mandatory = 0;
   }
+  const int adaptive = cl->scheduling_profile == OPENCL_PROFILE_ADAPTIVE;
+
+  // thumbnails leave the devices they had their share of to the others, and run on the cpu if need be
+  const float share = CLAMP(dt_conf_get_int("opencl_thumbnail_share"), 0, 100) / 100.0f;
+  if(priority && pipetype == DT_DEV_PIXELPIPE_THUMBNAIL && !mandatory && share < 1.0f)
+  {
+    const double now = dt_get_wtime();
+    int *out = priority;
+    for(const int *prio = priority; *prio != -1; prio++)
+      if(_opencl_thumbnail_share(cl->dev + *prio, now) < share) *out++ = *prio;
+    *out = -1;
+  }
 
   dt_pthread_mutex_unlock(&cl->lock);
 
   if(priority)
   {
+    const int type = _opencl_pipe_index(pipetype);
+    const int interactive = type == 0 || type == 1;
     const int usec = 5000;
     const int nloop = MAX(0, dt_conf_get_int("opencl_mandatory_timeout"));
+    int devid = -1, queued = -1;
+    double wait_start = 0.0;
 
-    // check for free opencl device repeatedly if mandatory is TRUE, else give up after first try
+    // check for free opencl device repeatedly if mandatory is TRUE, else give up after first try.
+    // the adaptive scheduler waits as long as a device is expected to come free within the timeout.
     for(int n = 0; n < nloop; n++)
     {
-      const int *prio = priority;
+      double wait = 0.0;
+      int best = -1;
+      devid = adaptive ? _opencl_trylock_adaptive(cl, priority, type, &wait, &best)
+                       : _opencl_trylock(cl, priority);
+      if(devid != -1) break;
 
-      while(*prio != -1)
-      {
-        if(!dt_pthread_mutex_trylock(&cl->dev[*prio].lock))
-        {
-          int devid = *prio;
-          free(priority);
-          return devid;
-        }
-        prio++;
-      }
+      if(adaptive ? (!mandatory && wait > (nloop - n) * usec * 1e-6) : !mandatory) break;
 
-      if(!mandatory)
+      if(n == 0)
       {
-        free(priority);
-        return -1;
+        wait_start = dt_get_wtime();
+        dt_pthread_mutex_lock(&cl->lock);
+        if(interactive) cl->interactive_waiting++;
+        if(best != -1) cl->dev[queued = best].waiting++;
+        dt_pthread_mutex_unlock(&cl->lock);
       }
-
       dt_iop_nap(usec);
     }
+
+    const double now = dt_get_wtime();
+    dt_pthread_mutex_lock(&cl->lock);
+    if(wait_start > 0.0)
+    {
+      if(interactive) cl->interactive_waiting--;
+      if(queued != -1) cl->dev[queued].waiting--;
+      cl->lock_stats[type].waits++;
+      cl->lock_stats[type].wait_time += now - wait_start;
+    }
+    if(devid != -1)
+    {
+      cl->dev[devid].locked = 1;
+      cl->dev[devid].lock_time = now;
+      cl->dev[devid].locked_type = type;
+      cl->last_device[type] = devid;
+      cl->lock_stats[type].locks++;
+      if(interactive) cl->interactive_time = now;
+    }
+    else
+      cl->lock_stats[type].cpu++;
+    dt_pthread_mutex_unlock(&cl->lock);
+
+    if(wait_start > 0.0 && dt_trace_enabled())
+    {
+      gchar *detail = devid != -1 ? g_strdup_printf("device %d", devid) : g_strdup("cpu");
+      dt_trace_span("opencl", "wait for device", trace_start, detail);
+      g_free(detail);
+    }
+
+    free(priority);
+    if(devid != -1 && _batch.pipetype == pipetype && !_batch.in_use)
+    {
+      _batch.devid = devid;
+      _batch.in_use = 1;
+    }
+    return devid;
   }
   else
   {
@@ -1395,25 +1773,122 @@ int dt_opencl_lock_device(const int pipetype)
     for(int try_dev = 0; try_dev < cl->num_devs; try_dev++)
     {
       // get first currently unused processor
-      if(!dt_pthread_mutex_trylock(&cl->dev[try_dev].lock)) return try_dev;
+      if(!_opencl_trylock_ready(cl, try_dev))
+      {
+        dt_pthread_mutex_lock(&cl->lock);
+        cl->dev[try_dev].locked = 1;
+        cl->dev[try_dev].lock_time = dt_get_wtime();
+        cl->dev[try_dev].locked_type = -1;
+        dt_pthread_mutex_unlock(&cl->lock);
+        return try_dev;
+      }
     }
   }
 
-  free(priority);
-
   // no free GPU :(
   // use CPU processing, if no free device:
   return -1;
 }
 
+static void _opencl_release_device(dt_opencl_t *cl, const int dev);
+
 void dt_opencl_unlock_device(const int dev)
 {
   dt_opencl_t *cl = darktable.opencl;
   if(!cl->inited) return;
   if(dev < 0 || dev >= cl->num_devs) return;
+
+  // the batch keeps it for its next pipe
+  if(dev == _batch.devid && _batch.in_use)
+  {
+    _batch.in_use = 0;
+    return;
+  }
+  _opencl_release_device(cl, dev);
+}
+
+static void _opencl_release_device(dt_opencl_t *cl, const int dev)
+{
+  // feed the running averages of the adaptive scheduler
+  dt_pthread_mutex_lock(&cl->lock);
+  dt_opencl_device_t *device = cl->dev + dev;
+  const double now = dt_get_wtime();
+  const double hold = now - device->lock_time;
+  const double period = now - device->release_time;
+  device->hold_time = device->hold_time > 0.0 ? .75 * device->hold_time + .25 * hold : hold;
+  device->load = .75 * device->load + .25 * (period > 0.0 ? MIN(1.0, hold / period) : 1.0);
+  device->release_time = now;
+  if(device->locked_type == 3)
+  {
+    device->thumbnail_busy = device->thumbnail_busy * exp(-(now - device->thumbnail_time) / DT_OPENCL_SHARE_WINDOW)
+                             + hold;
+    device->thumbnail_time = now;
+  }
+  device->locked = 0;
+  device->locked_type = -1;
+  dt_pthread_mutex_unlock(&cl->lock);
+
   dt_pthread_mutex_BAD_unlock(&cl->dev[dev].lock);
 }
 
+void dt_opencl_batch_begin(const int pipetype)
+{
+  dt_opencl_batch_end();
+  _batch.pipetype = pipetype;
+}
+
+void dt_opencl_batch_yield(void)
+{
+  dt_opencl_t *cl = darktable.opencl;
+  if(_batch.devid == -1 || _batch.in_use || !cl->inited) return;
+
+  const float share = CLAMP(dt_conf_get_int("opencl_thumbnail_share"), 0, 100) / 100.0f;
+  const double now = dt_get_wtime();
+  dt_pthread_mutex_lock(&cl->lock);
+  const dt_opencl_device_t *dev = cl->dev + _batch.devid;
+  const int yield = cl->interactive_waiting > 0 || dev->waiting > 0 || now - dev->lock_time > DT_OPENCL_BATCH_SLICE
+                    || (_batch.pipetype == DT_DEV_PIXELPIPE_THUMBNAIL && share < 1.0f
+                        && _opencl_thumbnail_share(dev, now) >= share);
+  dt_pthread_mutex_unlock(&cl->lock);
+  if(!yield) return;
+
+  _opencl_release_device(cl, _batch.devid);
+  _batch.devid = -1;
+}
+
+void dt_opencl_batch_end(void)
+{
+  if(_batch.devid != -1 && !_batch.in_use) _opencl_release_device(darktable.opencl, _batch.devid);
+  _batch.pipetype = -1;
+  _batch.devid = -1;
+  _batch.in_use = 0;
+}
+
+int dt_opencl_lock_idle_devices(const int devid, int *devids, const int max)
+{
+  dt_opencl_t *cl = darktable.opencl;
+  if(!cl->inited || devid < 0 || devid >= cl->num_devs) return 0;
+
+  const dt_opencl_device_t *ref = cl->dev + devid;
+  int num = 0;
+  dt_pthread_mutex_lock(&cl->lock);
+  // interactive pipes waiting for a device come first
+  if(cl->interactive_waiting == 0)
+    for(const int *prio = cl->dev_priority_export; *prio != -1 && num < max; prio++)
+    {
+      dt_opencl_device_t *dev = cl->dev + *prio;
+      if(*prio == devid || dev->max_global_mem < ref->max_global_mem || dev->max_mem_alloc < ref->max_mem_alloc
+         || dev->max_image_width < ref->max_image_width || dev->max_image_height < ref->max_image_height)
+        continue;
+      if(_opencl_trylock_ready(cl, *prio)) continue;
+      dev->locked = 1;
+      dev->lock_time = dt_get_wtime();
+      devids[num++] = *prio;
+    }
+  dt_pthread_mutex_unlock(&cl->lock);
+  return num;
+}
+
 static FILE *fopen_stat(const char *filename, struct stat *st)
 {
   FILE *f = g_fopen(filename, "rb");
@@ -1791,35 +2266,36 @@ int dt_opencl_create_kernel(const int prog, const char *name)
   if(prog < 0 || prog >= DT_OPENCL_MAX_PROGRAMS) return -1;
   dt_pthread_mutex_lock(&cl->lock);
   int k = 0;
+  while(k < DT_OPENCL_MAX_KERNELS && cl->kernel_name[k]) k++;
+  if(k == DT_OPENCL_MAX_KERNELS)
+  {
+    dt_print(DT_DEBUG_OPENCL, "[opencl_create_kernel] too many kernels! can't create kernel `%s'\n", name);
+    goto error;
+  }
   for(int dev = 0; dev < cl->num_devs; dev++)
   {
+    cl->dev[dev].kernel_used[k] = 1;
+    cl->dev[dev].kernel[k] = NULL;
+    // devices still building their programs create it once they are done
+    if(cl->dev[dev].ready != 1) continue;
     cl_int err;
-    for(; k < DT_OPENCL_MAX_KERNELS; k++)
-      if(!cl->dev[dev].kernel_used[k])
+    cl->dev[dev].kernel[k] = (cl->dlocl->symbols->dt_clCreateKernel)(cl->dev[dev].program[prog], name, &err);
+    if(err != CL_SUCCESS)
+    {
+      dt_print(DT_DEBUG_OPENCL, "[opencl_create_kernel] could not create kernel `%s'! (%d)\n", name, err);
+      for(int d = 0; d <= dev; d++)
       {
-        cl->dev[dev].kernel_used[k] = 1;
-        cl->dev[dev].kernel[k]
-            = (cl->dlocl->symbols->dt_clCreateKernel)(cl->dev[dev].program[prog], name, &err);
-        if(err != CL_SUCCESS)
-        {
-          dt_print(DT_DEBUG_OPENCL, "[opencl_create_kernel] could not create kernel `%s'! (%d)\n", name, err);
-          cl->dev[dev].kernel_used[k] = 0;
-          goto error;
-        }
-        else
-          break;
+        if(d < dev && cl->dev[d].kernel[k]) (cl->dlocl->symbols->dt_clReleaseKernel)(cl->dev[d].kernel[k]);
+        cl->dev[d].kernel[k] = NULL;
+        cl->dev[d].kernel_used[k] = 0;
       }
-    if(k < DT_OPENCL_MAX_KERNELS)
-    {
-      dt_print(DT_DEBUG_OPENCL, "[opencl_create_kernel] successfully loaded kernel `%s' (%d) for device %d\n",
-               name, k, dev);
-    }
-    else
-    {
-      dt_print(DT_DEBUG_OPENCL, "[opencl_create_kernel] too many kernels! can't create kernel `%s'\n", name);
       goto error;
     }
+    dt_print(DT_DEBUG_OPENCL, "[opencl_create_kernel] successfully loaded kernel `%s' (%d) for device %d\n", name,
+             k, dev);
   }
+  cl->kernel_name[k] = strdup(name);
+  cl->kernel_program[k] = prog;
   dt_pthread_mutex_unlock(&cl->lock);
   return k;
 error:
@@ -1836,8 +2312,11 @@ void dt_opencl_free_kernel(const int kernel)
   for(int dev = 0; dev < cl->num_devs; dev++)
   {
     cl->dev[dev].kernel_used[kernel] = 0;
-    (cl->dlocl->symbols->dt_clReleaseKernel)(cl->dev[dev].kernel[kernel]);
+    if(cl->dev[dev].kernel[kernel]) (cl->dlocl->symbols->dt_clReleaseKernel)(cl->dev[dev].kernel[kernel]);
+    cl->dev[dev].kernel[kernel] = NULL;
   }
+  free((void *)cl->kernel_name[kernel]);
+  cl->kernel_name[kernel] = NULL;
   dt_pthread_mutex_unlock(&cl->lock);
 }
 
@@ -1961,6 +2440,8 @@ int dt_opencl_read_host_from_device_raw(const int devid, void *host, void *devic
                                         const size_t *region, const int rowpitch, const int blocking)
 {
   if(!darktable.opencl->inited) return -1;
+  // for non-blocking transfers this is only the time to enqueue them
+  DT_TIMER_SCOPE(timer, blocking ? "opencl read" : "opencl read enqueue");
 
   cl_event *eventp = dt_opencl_events_get_slot(devid, "[Read Image (from device to host)]");
 
@@ -2006,6 +2487,7 @@ int dt_opencl_write_host_to_device_raw(const int devid, void *host, void *device
                                        const size_t *region, const int rowpitch, const int blocking)
 {
   if(!darktable.opencl->inited) return -1;
+  DT_TIMER_SCOPE(timer, blocking ? "opencl write" : "opencl write enqueue");
 
   cl_event *eventp = dt_opencl_events_get_slot(devid, "[Write Image (from host to device)]");
 
@@ -2140,6 +2622,134 @@ void *dt_opencl_copy_host_to_device_rowpitch(const int devid, void *host, const
 }
 
 
+// device memory pool. images of dt_opencl_alloc_device() and buffers of dt_opencl_alloc_device_buffer() are
+// kept when released and handed out again for the same size, as creating them is expensive with some drivers.
+// every device has a single in-order queue, so work still queued on a released object is done before the
+// next user of it gets to it.
+typedef struct dt_opencl_pool_entry_t
+{
+  cl_mem mem;
+  int devid;
+  int width, height, bpp; // 0 for buffers
+  size_t size;
+} dt_opencl_pool_entry_t;
+
+// four size classes per power of two for buffers, wasting at most a quarter
+static size_t _pool_size_class(const size_t size)
+{
+  size_t p = 1;
+  while(p <= size / 2) p <<= 1;
+  const size_t step = MAX(p / 4, 1);
+  return (size + step - 1) / step * step;
+}
+
+static cl_mem _pool_get(const int devid, const int width, const int height, const int bpp, const size_t size)
+{
+  dt_opencl_t *cl = darktable.opencl;
+  if(!cl->pool_limit) return NULL;
+  dt_opencl_device_t *dev = cl->dev + devid;
+  cl_mem mem = NULL;
+  dt_pthread_mutex_lock(&cl->pool_lock);
+  for(GList *l = dev->pool; l; l = g_list_next(l))
+  {
+    const dt_opencl_pool_entry_t *e = (const dt_opencl_pool_entry_t *)l->data;
+    if(e->width == width && e->height == height && e->bpp == bpp && e->size == size)
+    {
+      mem = e->mem;
+      dev->pool_memory -= e->size;
+      dev->pool = g_list_delete_link(dev->pool, l);
+      break;
+    }
+  }
+  if(mem)
+    dev->pool_hits++;
+  else
+    dev->pool_misses++;
+  dt_pthread_mutex_unlock(&cl->pool_lock);
+
+  if(mem) dt_opencl_memory_statistics(devid, mem, OPENCL_MEMORY_ADD);
+  return mem;
+}
+
+// remembers a new object to go to the pool once it is released
+static void _pool_track(const int devid, cl_mem mem, const int width, const int height, const int bpp,
+                        const size_t size)
+{
+  dt_opencl_t *cl = darktable.opencl;
+  if(!cl->pool_limit || !mem) return;
+  dt_opencl_pool_entry_t *e = (dt_opencl_pool_entry_t *)malloc(sizeof(dt_opencl_pool_entry_t));
+  if(!e) return;
+  *e = (dt_opencl_pool_entry_t){ mem, devid, width, height, bpp, size };
+  dt_pthread_mutex_lock(&cl->pool_lock);
+  g_hash_table_insert(cl->pool_objects, mem, e);
+  dt_pthread_mutex_unlock(&cl->pool_lock);
+}
+
+// really releases pooled objects of a device, oldest first, until at most keep bytes are left. expects the lock.
+static void _pool_trim(dt_opencl_device_t *dev, const size_t keep)
+{
+  dt_opencl_t *cl = darktable.opencl;
+  while(dev->pool && dev->pool_memory > keep)
+  {
+    GList *last = g_list_last(dev->pool);
+    dt_opencl_pool_entry_t *e = (dt_opencl_pool_entry_t *)last->data;
+    dev->pool = g_list_delete_link(dev->pool, last);
+    dev->pool_memory -= e->size;
+    g_hash_table_remove(cl->pool_objects, e->mem);
+    (cl->dlocl->symbols->dt_clReleaseMemObject)(e->mem);
+    free(e);
+  }
+}
+
+// drops the pool of a device, e.g. to make room when an allocation failed
+static void _pool_flush(const int devid)
+{
+  dt_opencl_t *cl = darktable.opencl;
+  if(!cl->pool_limit) return;
+  dt_pthread_mutex_lock(&cl->pool_lock);
+  _pool_trim(cl->dev + devid, 0);
+  dt_pthread_mutex_unlock(&cl->pool_lock);
+}
+
+// parks a released object in the pool. returns 0 if the caller has to release it.
+static int _pool_put(cl_mem mem)
+{
+  dt_opencl_t *cl = darktable.opencl;
+  if(!cl->pool_limit) return 0;
+  dt_pthread_mutex_lock(&cl->pool_lock);
+  dt_opencl_pool_entry_t *e = (dt_opencl_pool_entry_t *)g_hash_table_lookup(cl->pool_objects, mem);
+  if(!e)
+  {
+    dt_pthread_mutex_unlock(&cl->pool_lock);
+    return 0;
+  }
+  // somebody else holds a reference: only drop ours
+  cl_uint refs = 0;
+  (cl->dlocl->symbols->dt_clGetMemObjectInfo)(mem, CL_MEM_REFERENCE_COUNT, sizeof(refs), &refs, NULL);
+  if(refs != 1)
+  {
+    dt_pthread_mutex_unlock(&cl->pool_lock);
+    return 0;
+  }
+  dt_opencl_device_t *dev = cl->dev + e->devid;
+  if(e->size > cl->pool_limit)
+  {
+    g_hash_table_remove(cl->pool_objects, mem);
+    dt_pthread_mutex_unlock(&cl->pool_lock);
+    free(e);
+    return 0;
+  }
+  dev->pool = g_list_prepend(dev->pool, e);
+  dev->pool_memory += e->size;
+  _pool_trim(dev, cl->pool_limit);
+  dev->pool_peak = MAX(dev->pool_peak, dev->pool_memory);
+  const int devid = e->devid;
+  dt_pthread_mutex_unlock(&cl->pool_lock);
+
+  dt_opencl_memory_statistics(devid, mem, OPENCL_MEMORY_SUB);
+  return 1;
+}
+
 void dt_opencl_release_mem_object(cl_mem mem)
 {
   if(!darktable.opencl->inited) return;
@@ -2148,6 +2758,8 @@ void dt_opencl_release_mem_object(cl_mem mem)
   // case in a centralized way at this place
   if(mem == NULL) return;
 
+  if(_pool_put(mem)) return;
+
   dt_opencl_memory_statistics(-1, mem, OPENCL_MEMORY_SUB);
 
   (darktable.opencl->dlocl->symbols->dt_clReleaseMemObject)(mem);
@@ -2193,11 +2805,24 @@ void *dt_opencl_alloc_device(const int devid, const int width, const int height,
   else
     return NULL;
 
-  cl_mem dev = (darktable.opencl->dlocl->symbols->dt_clCreateImage2D)(
-      darktable.opencl->dev[devid].context, CL_MEM_READ_WRITE, &fmt, width, height, 0, NULL, &err);
+  const size_t size = (size_t)width * height * bpp;
+  cl_mem dev = _pool_get(devid, width, height, bpp, size);
+  if(dev) return dev;
+
+  dev = (darktable.opencl->dlocl->symbols->dt_clCreateImage2D)(darktable.opencl->dev[devid].context,
+                                                               CL_MEM_READ_WRITE, &fmt, width, height, 0, NULL, &err);
+  if(err != CL_SUCCESS && darktable.opencl->dev[devid].pool_memory)
+  {
+    // pooled objects might be in the way
+    _pool_flush(devid);
+    dev = (darktable.opencl->dlocl->symbols->dt_clCreateImage2D)(
+        darktable.opencl->dev[devid].context, CL_MEM_READ_WRITE, &fmt, width, height, 0, NULL, &err);
+  }
   if(err != CL_SUCCESS)
     dt_print(DT_DEBUG_OPENCL, "[opencl alloc_device] could not alloc img buffer on device %d: %d\n", devid,
              err);
+  else
+    _pool_track(devid, dev, width, height, bpp, size);
 
   dt_opencl_memory_statistics(devid, dev, OPENCL_MEMORY_ADD);
 
@@ -2241,11 +2866,27 @@ void *dt_opencl_alloc_device_buffer(const int devid, const size_t size)
   if(!darktable.opencl->inited) return NULL;
   cl_int err;
 
-  cl_mem buf = (darktable.opencl->dlocl->symbols->dt_clCreateBuffer)(darktable.opencl->dev[devid].context,
-                                                                     CL_MEM_READ_WRITE, size, NULL, &err);
+  // a bit more than asked for is fine for buffers
+  const size_t sclass = _pool_size_class(size);
+  const size_t csize
+      = darktable.opencl->pool_limit && sclass <= darktable.opencl->dev[devid].max_mem_alloc ? sclass : size;
+  cl_mem buf = _pool_get(devid, 0, 0, 0, csize);
+  if(buf) return buf;
+
+  buf = (darktable.opencl->dlocl->symbols->dt_clCreateBuffer)(darktable.opencl->dev[devid].context,
+                                                              CL_MEM_READ_WRITE, csize, NULL, &err);
+  if(err != CL_SUCCESS && darktable.opencl->dev[devid].pool_memory)
+  {
+    // pooled objects might be in the way
+    _pool_flush(devid);
+    buf = (darktable.opencl->dlocl->symbols->dt_clCreateBuffer)(darktable.opencl->dev[devid].context,
+                                                                CL_MEM_READ_WRITE, csize, NULL, &err);
+  }
   if(err != CL_SUCCESS)
     dt_print(DT_DEBUG_OPENCL, "[opencl alloc_device_buffer] could not alloc buffer on device %d: %d\n", devid,
              err);
+  else
+    _pool_track(devid, buf, 0, 0, 0, csize);
 
   dt_opencl_memory_statistics(devid, buf, OPENCL_MEMORY_ADD);
 
@@ -2313,10 +2954,34 @@ void dt_opencl_memory_statistics(int devid, cl_mem mem, dt_opencl_memory_t actio
 
   darktable.opencl->dev[devid].peak_memory = MAX(darktable.opencl->dev[devid].peak_memory,
                                                  darktable.opencl->dev[devid].memory_in_use);
+  darktable.opencl->dev[devid].module_peak = MAX(darktable.opencl->dev[devid].module_peak,
+                                                 darktable.opencl->dev[devid].memory_in_use);
 
   if(darktable.unmuted & DT_DEBUG_MEMORY)
-    dt_print(DT_DEBUG_OPENCL,
-              "[opencl memory] device %d: %zu bytes in use\n", devid, darktable.opencl->dev[devid].memory_in_use);
+    dt_print(DT_DEBUG_OPENCL, "[opencl memory] device %d: %zu bytes in use, %zu bytes pooled\n", devid,
+             darktable.opencl->dev[devid].memory_in_use, darktable.opencl->dev[devid].pool_memory);
+}
+
+void dt_opencl_memory_module_begin(const int devid)
+{
+  if(!darktable.opencl->inited || devid < 0) return;
+  darktable.opencl->dev[devid].module_peak = darktable.opencl->dev[devid].memory_in_use;
+}
+
+size_t dt_opencl_memory_module_end(const int devid, const char *op)
+{
+  if(!darktable.opencl->inited || devid < 0) return 0;
+  dt_opencl_device_t *dev = &darktable.opencl->dev[devid];
+  const size_t peak = MAX(dev->module_peak, dev->memory_in_use);
+  if(!dev->module_peaks) dev->module_peaks = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+  size_t *known = (size_t *)g_hash_table_lookup(dev->module_peaks, op);
+  if(!known)
+  {
+    known = (size_t *)g_malloc0(sizeof(size_t));
+    g_hash_table_insert(dev->module_peaks, g_strdup(op), known);
+  }
+  *known = MAX(*known, peak);
+  return peak;
 }
 
 /** check if image size fit into limits given by OpenCL runtime */
@@ -2382,6 +3047,15 @@ int dt_opencl_is_inited(void)
 
 
 /** check if opencl is enabled */
+int dt_opencl_is_ready(void)
+{
+  dt_opencl_t *cl = darktable.opencl;
+  if(!cl->inited) return 0;
+  for(int n = 0; n < cl->num_devs; n++)
+    if(cl->dev[n].ready == 0) return 0;
+  return 1;
+}
+
 int dt_opencl_is_enabled(void)
 {
   if(!darktable.opencl->inited) return FALSE;
@@ -2437,6 +3111,8 @@ static dt_opencl_scheduling_profile_t dt_opencl_get_scheduling_profile(void)
     profile = OPENCL_PROFILE_MULTIPLE_GPUS;
   else if(!strcmp(pstr, "very fast GPU"))
     profile = OPENCL_PROFILE_VERYFAST_GPU;
+  else if(!strcmp(pstr, "adaptive"))
+    profile = OPENCL_PROFILE_ADAPTIVE;
 
   g_free(pstr);
 
@@ -2468,6 +3144,11 @@ static void dt_opencl_apply_scheduling_profile(dt_opencl_scheduling_profile_t pr
       dt_opencl_update_priorities("+*/+*/+*/+*");
       dt_opencl_set_synchronization_timeout(0);
       break;
+    case OPENCL_PROFILE_ADAPTIVE:
+      // all devices for every pipe, dt_opencl_lock_device() decides by load
+      dt_opencl_update_priorities("*/*/*/*");
+      dt_opencl_set_synchronization_timeout(20);
+      break;
     case OPENCL_PROFILE_DEFAULT:
     default:
       str = dt_conf_get_string("opencl_device_priority");
@@ -2655,6 +3336,24 @@ void dt_opencl_events_wait_for(const int devid)
 }
 
 
+// hand the kernels just waited for to the trace. the device clock has no known relation to ours,
+// so the last of them is taken to have ended right now.
+static void _opencl_events_trace(const int devid, const int first)
+{
+  const dt_opencl_eventtag_t *eventtags = darktable.opencl->dev[devid].eventtags;
+  const int last = darktable.opencl->dev[devid].eventsconsolidated;
+  cl_ulong end = 0;
+  for(int k = first; k < last; k++)
+    if(eventtags[k].started) end = MAX(end, eventtags[k].started + eventtags[k].timelapsed);
+  if(!end) return;
+
+  const double offset = dt_trace_now() - end * 1e-3;
+  for(int k = first; k < last; k++)
+    if(eventtags[k].started)
+      dt_trace_device_span(devid, eventtags[k].tag[0] ? eventtags[k].tag : "<?>",
+                           offset + eventtags[k].started * 1e-3, eventtags[k].timelapsed * 1e-3);
+}
+
 /** Wait for events in eventlist to terminate, check for return status and profiling
 info of events.
 If "reset" is TRUE report summary info (would be CL_COMPLETE or last error code) and
@@ -2680,6 +3379,7 @@ cl_int dt_opencl_events_flush(const int devid, const int reset)
 
   // Wait for command queue to terminate (side effect: might adjust *numevents)
   dt_opencl_events_wait_for(devid);
+  const int first_new = *eventsconsolidated;
 
   // now check return status and profiling data of all newly terminated events
   for(int k = *eventsconsolidated; k < *numevents; k++)
@@ -2705,9 +3405,9 @@ cl_int dt_opencl_events_flush(const int devid, const int reset)
     else
       (*totalsuccess)++;
 
-    if(darktable.unmuted & DT_DEBUG_PERF)
+    if(cl->profiling)
     {
-      // get profiling info of event (only if darktable was called with '-d perf')
+      // get profiling info of event (only if darktable was called with '-d perf' or reports pipe runs)
       cl_ulong start;
       cl_ulong end;
       cl_int errs = (cl->dlocl->symbols->dt_clGetEventProfilingInfo)(
@@ -2717,21 +3417,25 @@ cl_int dt_opencl_events_flush(const int devid, const int reset)
       if(errs == CL_SUCCESS && erre == CL_SUCCESS)
       {
         (*eventtags)[k].timelapsed = end - start;
+        (*eventtags)[k].started = start;
       }
       else
       {
         (*eventtags)[k].timelapsed = 0;
+        (*eventtags)[k].started = 0;
         (*lostevents)++;
       }
     }
     else
-      (*eventtags)[k].timelapsed = 0;
+      (*eventtags)[k].timelapsed = (*eventtags)[k].started = 0;
 
     // finally release event to be re-used by driver
     (cl->dlocl->symbols->dt_clReleaseEvent)((*eventlist)[k]);
     (*eventsconsolidated)++;
   }
 
+  if(cl->profiling && dt_trace_enabled()) _opencl_events_trace(devid, first_new);
+
   cl_int result = *summary;
 
   // do we want to get rid of all stored info?
@@ -2748,6 +3452,26 @@ cl_int dt_opencl_events_flush(const int devid, const int reset)
 }
 
 
+int dt_opencl_events_count(const int devid)
+{
+  dt_opencl_t *cl = darktable.opencl;
+  if(!cl->inited || devid < 0 || !cl->use_events) return 0;
+  return cl->dev[devid].numevents;
+}
+
+double dt_opencl_events_time(const int devid, const int first, const int last)
+{
+  dt_opencl_t *cl = darktable.opencl;
+  if(!cl->inited || devid < 0 || !cl->use_events || !cl->profiling) return -1.0;
+  const dt_opencl_eventtag_t *eventtags = cl->dev[devid].eventtags;
+  if(!eventtags) return 0.0;
+
+  double time = 0.0;
+  for(int k = MAX(first, 0); k < MIN(last, cl->dev[devid].eventsconsolidated); k++)
+    time += eventtags[k].timelapsed * 1e-9;
+  return time;
+}
+
 /** display OpenCL profiling information. If "aggregated" is TRUE, try to generate summarized info for each
  * kernel */
 void dt_opencl_events_profiling(const int devid, const int aggregated)
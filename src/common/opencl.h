@@ -57,9 +57,22 @@ typedef enum dt_opencl_scheduling_profile_t
 {
   OPENCL_PROFILE_DEFAULT,
   OPENCL_PROFILE_MULTIPLE_GPUS,
-  OPENCL_PROFILE_VERYFAST_GPU
+  OPENCL_PROFILE_VERYFAST_GPU,
+  OPENCL_PROFILE_ADAPTIVE
 } dt_opencl_scheduling_profile_t;
 
+/**
+ * per pipe type counters of dt_opencl_lock_device().
+ */
+typedef struct dt_opencl_lock_stats_t
+{
+  int locks;        // devices handed out
+  int waits;        // calls that didn't get a device right away
+  int cpu;          // calls that ended up without a device
+  int batched;      // calls served by the device held for a batch, see dt_opencl_batch_begin()
+  double wait_time; // seconds spent waiting in total
+} dt_opencl_lock_stats_t;
+
 /**
  * Accounting information used for OpenCL events.
  */
@@ -67,6 +80,7 @@ typedef struct dt_opencl_eventtag_t
 {
   cl_int retval;
   cl_ulong timelapsed;
+  cl_ulong started; // device clock, only kept for -d trace
   char tag[DT_OPENCL_EVENTNAMELENGTH];
 } dt_opencl_eventtag_t;
 
@@ -86,6 +100,7 @@ typedef struct dt_opencl_device_t
   cl_ulong max_mem_alloc;
   cl_ulong max_global_mem;
   cl_ulong used_global_mem;
+  size_t cache_memory_in_use; // bytes held by pixelpipe cache lines living on this device
   cl_program program[DT_OPENCL_MAX_PROGRAMS];
   cl_kernel kernel[DT_OPENCL_MAX_KERNELS];
   int program_used[DT_OPENCL_MAX_PROGRAMS];
@@ -104,14 +119,41 @@ typedef struct dt_opencl_device_t
   const char *name;
   const char *cname;
   const char *options;
+  const char *cachedir; // of the compiled programs
+  // 0 while the programs are built in the background, 1 once the device can be used, -1 if that failed.
+  // written under the lock of dt_opencl_t.
+  int ready;
+  int building;
+  pthread_t builder;
   cl_int summary;
   float benchmark;
   size_t memory_in_use;
   size_t peak_memory;
+  // attribution of memory_in_use to the modules of the pipe holding the device, see dt_opencl_memory_module_begin()
+  size_t module_peak;
+  GHashTable *module_peaks; // op -> the most memory in use while it ran, over all runs
+  // released images and buffers for reuse, most recent first, guarded by pool_lock of dt_opencl_t
+  GList *pool;
+  size_t pool_memory;
+  size_t pool_peak;
+  int pool_hits;
+  int pool_misses;
+  // load as seen by the adaptive scheduler, guarded by the lock of dt_opencl_t
+  int locked;
+  int waiting;         // pipes expected to get this device next
+  double lock_time;    // when it was handed out last
+  double release_time; // when it was given back last
+  double hold_time;    // running average of how long a pipe keeps it
+  double load;         // running average of the fraction of time it's in use
+  int locked_type;     // index of the pipe type holding it, as in lock_stats
+  // seconds thumbnail pipes held it, decaying away over DT_OPENCL_SHARE_WINDOW, and when that was last updated
+  double thumbnail_busy;
+  double thumbnail_time;
 } dt_opencl_device_t;
 
 struct dt_bilateral_cl_global_t;
 struct dt_local_laplacian_cl_global_t;
+struct dt_histogram_cl_global_t;
 /**
  * main struct, stored in darktable.opencl.
  * holds pointers to all
@@ -125,10 +167,12 @@ typedef struct dt_opencl_t
   int async_pixelpipe;
   int number_event_handles;
   int print_statistics;
+  int profiling; // command queues collect timings, for -d perf and the pixelpipe report
   int synch_cache;
   int micro_nap;
   int enabled;
   int stopped;
+  int shutdown; // tells the background builds to stop
   int num_devs;
   int error_count;
   int opencl_synchronization_timeout;
@@ -139,8 +183,24 @@ typedef struct dt_opencl_t
   int *dev_priority_preview;
   int *dev_priority_export;
   int *dev_priority_thumbnail;
+  // by pipe type, in the order of mandatory: the device it ran on last and the lock counters
+  int last_device[4];
+  dt_opencl_lock_stats_t lock_stats[4];
+  // when an interactive pipe last got a device, and how many of them are waiting for one
+  double interactive_time;
+  int interactive_waiting;
   dt_opencl_device_t *dev;
   dt_dlopencl_t *dlocl;
+  // name and program by kernel id, for devices creating their kernels when their programs are built
+  const char *kernel_name[DT_OPENCL_MAX_KERNELS];
+  int kernel_program[DT_OPENCL_MAX_KERNELS];
+  // device memory pool: all objects that go back to it when released, and the bytes kept per device
+  dt_pthread_mutex_t pool_lock;
+  GHashTable *pool_objects;
+  size_t pool_limit;
+  // comparing devices and cpu after a change of the device setup
+  int benchmark;
+  pthread_t benchmark_thread;
 
   // global kernels for blending operations.
   struct dt_blendop_cl_global_t *blendop;
@@ -156,6 +216,9 @@ typedef struct dt_opencl_t
 
   // global kernels for local laplacian filter.
   struct dt_local_laplacian_cl_global_t *local_laplacian;
+
+  // global kernels for the histograms of the pixelpipe.
+  struct dt_histogram_cl_global_t *histogram;
 } dt_opencl_t;
 
 /** description of memory requirements of local buffer
@@ -197,6 +260,19 @@ int dt_opencl_lock_device(const int pipetype);
 /** done with your command queue. */
 void dt_opencl_unlock_device(const int dev);
 
+/** starts a batch of pipes of pipetype on this thread: the device the first of them gets stays locked for the
+ * following ones, instead of going back and forth to the scheduler for every one. is given back by
+ * dt_opencl_batch_yield() when it is wanted elsewhere, and by dt_opencl_batch_end(). */
+void dt_opencl_batch_begin(const int pipetype);
+/** between the pipes of a batch: gives the device back if an interactive pipe or another pipe waits for it,
+ * the batch held it for long enough already or thumbnails have taken their share of it. */
+void dt_opencl_batch_yield(void);
+void dt_opencl_batch_end(void);
+
+/** locks up to max more free devices of the export list that are at least as big as devid, to share its
+ * tiles with. returns how many were stored in devids, each to be released by dt_opencl_unlock_device(). */
+int dt_opencl_lock_idle_devices(const int devid, int *devids, const int max);
+
 /** calculates md5sums for a list of CL include files. */
 void dt_opencl_md5sum(const char **files, char **md5sums);
 
@@ -238,6 +314,10 @@ int dt_opencl_enqueue_kernel_2d_with_local(const int dev, const int kernel, cons
 /** check if opencl is inited */
 int dt_opencl_is_inited(void);
 
+/** non-zero once no device is building its programs anymore. until then pipes run on the devices that are
+ * done, or on the cpu. */
+int dt_opencl_is_ready(void);
+
 /** check if opencl is enabled */
 int dt_opencl_is_enabled(void);
 
@@ -331,6 +411,12 @@ int dt_opencl_get_mem_context_id(cl_mem mem);
 
 void dt_opencl_memory_statistics(int devid, cl_mem mem, dt_opencl_memory_t action);
 
+/** to be called by the pipe holding the device before a module starts processing, tiling and cpu fallbacks
+ * included. dt_opencl_memory_module_end() then returns the most memory it had in use on the device since. */
+void dt_opencl_memory_module_begin(const int devid);
+/** ends what module op started, keeps its peak for the summary at exit and returns it. */
+size_t dt_opencl_memory_module_end(const int devid, const char *op);
+
 /** check if image size fit into limits given by OpenCL runtime */
 int dt_opencl_image_fits_device(const int devid, const size_t width, const size_t height, const unsigned bpp,
                                 const float factor, const size_t overhead);
@@ -358,6 +444,12 @@ cl_int dt_opencl_events_flush(const int devid, const int reset);
 /** display OpenCL profiling information. If summary is not 0, try to generate summarized info for kernels */
 void dt_opencl_events_profiling(const int devid, const int aggregated);
 
+/** number of events in the eventlist so far, to tell which ones a part of the work added */
+int dt_opencl_events_count(const int devid);
+
+/** seconds spent in the terminated events first to last - 1, negative if profiling is off */
+double dt_opencl_events_time(const int devid, const int first, const int last);
+
 /** utility function to calculate optimal work group dimensions for a given kernel */
 int dt_opencl_local_buffer_opt(const int devid, const int kernel, dt_opencl_local_buffer_t *factors);
 
@@ -398,6 +490,19 @@ static inline int dt_opencl_lock_device(const int dev)
 static inline void dt_opencl_unlock_device(const int dev)
 {
 }
+static inline void dt_opencl_batch_begin(const int pipetype)
+{
+}
+static inline void dt_opencl_batch_yield(void)
+{
+}
+static inline void dt_opencl_batch_end(void)
+{
+}
+static inline int dt_opencl_lock_idle_devices(const int devid, int *devids, const int max)
+{
+  return 0;
+}
 static inline int dt_opencl_load_program(const int dev, const char *filename)
 {
   return -1;
@@ -444,6 +549,10 @@ static inline int dt_opencl_is_inited(void)
 {
   return 0;
 }
+static inline int dt_opencl_is_ready(void)
+{
+  return 0;
+}
 static inline int dt_opencl_is_enabled(void)
 {
   return 0;
@@ -464,6 +573,13 @@ static inline int dt_opencl_get_max_global_mem(const int devid)
 {
   return 0;
 }
+static inline void dt_opencl_memory_module_begin(const int devid)
+{
+}
+static inline size_t dt_opencl_memory_module_end(const int devid, const char *op)
+{
+  return 0;
+}
 static inline void dt_opencl_release_mem_object(void *mem)
 {
 }
@@ -484,6 +600,14 @@ static inline int dt_opencl_events_flush(const int devid, const int reset)
 static inline void dt_opencl_events_profiling(const int devid, const int aggregated)
 {
 }
+static inline int dt_opencl_events_count(const int devid)
+{
+  return 0;
+}
+static inline double dt_opencl_events_time(const int devid, const int first, const int last)
+{
+  return -1.0;
+}
 #endif
 
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
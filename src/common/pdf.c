@@ -54,6 +54,11 @@
 
 #define SKIP_SPACES(s)  {while(*(s) == ' ')(s)++;}
 
+// images are deflated in chunks of this size in parallel
+#define DT_PDF_DEFLATE_CHUNK ((size_t)1 << 18)
+// the window of deflate, a chunk is primed with that much of what comes before it
+#define DT_PDF_DEFLATE_WINDOW ((size_t)1 << 15)
+
 // puts the length as described in str as pdf points into *length
 // returns 0 on error
 // a length has a number, followed by a unit if it's != 0.0
@@ -194,6 +199,14 @@ end:
 
 static const char *stream_encoder_filters[] = {"/ASCIIHexDecode", "/FlateDecode"};
 
+// the state of a deflated image between its rows
+typedef struct _pdf_deflate_t
+{
+  uLong adler; // of everything fed so far
+  unsigned char window[DT_PDF_DEFLATE_WINDOW]; // the last bytes fed
+  size_t window_size;
+} _pdf_deflate_t;
+
 static void _pdf_set_offset(dt_pdf_t *pdf, int id, size_t offset)
 {
   id--; // object ids start at 1
@@ -269,43 +282,6 @@ static size_t _pdf_stream_encoder_ASCIIHex(dt_pdf_t *pdf, const unsigned char *d
   return len * 2;
 }
 
-// using zlib we get quite small files, but it's slow
-static size_t _pdf_stream_encoder_Flate(dt_pdf_t *pdf, const unsigned char *data, size_t len)
-{
-  int result;
-  uLongf destLen = compressBound(len);
-  unsigned char *buffer = (unsigned char *)malloc(destLen);
-
-  result = compress(buffer, &destLen, data, len);
-
-  if(result != Z_OK)
-  {
-    free(buffer);
-    return 0;
-  }
-
-  fwrite(buffer, 1, destLen, pdf->fd);
-
-  free(buffer);
-  return destLen;
-}
-
-static size_t _pdf_write_stream(dt_pdf_t *pdf, dt_pdf_stream_encoder_t encoder, const unsigned char *data, size_t len)
-{
-  size_t stream_size = 0;
-  switch(encoder)
-  {
-    case DT_PDF_STREAM_ENCODER_ASCII_HEX:
-      stream_size = _pdf_stream_encoder_ASCIIHex(pdf, data, len);
-      break;
-    case DT_PDF_STREAM_ENCODER_FLATE:
-      stream_size = _pdf_stream_encoder_Flate(pdf, data, len);
-      break;
-  }
-  pdf->bytes_written += stream_size;
-  return stream_size;
-}
-
 int dt_pdf_add_icc(dt_pdf_t *pdf, const char *filename)
 {
   FILE *in = g_fopen(filename, "rb");
@@ -383,15 +359,27 @@ int dt_pdf_add_icc_from_data(dt_pdf_t *pdf, const unsigned char *data, size_t si
 // if image == NULL only the outline can be shown later
 dt_pdf_image_t *dt_pdf_add_image(dt_pdf_t *pdf, const unsigned char *image, int width, int height, int bpp, int icc_id, float border)
 {
-  size_t stream_size = 0;
-  size_t bytes_written = 0;
+  dt_pdf_image_t *pdf_image = dt_pdf_add_image_begin(pdf, image == NULL, width, height, bpp, icc_id, border);
+  if(!pdf_image || pdf_image->outline_mode) return pdf_image;
 
+  const int res = dt_pdf_add_image_rows(pdf, pdf_image, image, height);
+  if(dt_pdf_add_image_end(pdf, pdf_image) || res)
+  {
+    free(pdf_image);
+    return NULL;
+  }
+  return pdf_image;
+}
+
+dt_pdf_image_t *dt_pdf_add_image_begin(dt_pdf_t *pdf, gboolean outline_mode, int width, int height, int bpp,
+                                       int icc_id, float border)
+{
   dt_pdf_image_t *pdf_image = calloc(1, sizeof(dt_pdf_image_t));
   if(!pdf_image) return NULL;
 
   pdf_image->width = width;
   pdf_image->height = height;
-  pdf_image->outline_mode = (image == NULL);
+  pdf_image->outline_mode = outline_mode;
   // no need to do fancy math here:
   pdf_image->bb_x = border;
   pdf_image->bb_y = border;
@@ -403,8 +391,22 @@ dt_pdf_image_t *dt_pdf_add_image(dt_pdf_t *pdf, const unsigned char *image, int
 
   pdf_image->object_id = pdf->next_id++;
   pdf_image->name_id = pdf->next_image++;
+  pdf_image->length_id = pdf->next_id++;
+  pdf_image->bpp = bpp;
 
-  int length_id = pdf->next_id++;
+  if(pdf->default_encoder == DT_PDF_STREAM_ENCODER_FLATE)
+  {
+    _pdf_deflate_t *encoder = calloc(1, sizeof(_pdf_deflate_t));
+    if(!encoder)
+    {
+      free(pdf_image);
+      return NULL;
+    }
+    encoder->adler = adler32(0L, Z_NULL, 0);
+    pdf_image->encoder = encoder;
+  }
+
+  size_t bytes_written = 0;
 
   // the image
   //start
@@ -431,17 +433,146 @@ dt_pdf_image_t *dt_pdf_add_image(dt_pdf_t *pdf, const unsigned char *image, int
     "/Length %d 0 R\n"
     ">>\n"
     "stream\n",
-    bpp, length_id
+    bpp, pdf_image->length_id
   );
 
-  // the stream
-  stream_size = _pdf_write_stream(pdf, pdf->default_encoder, image, width * height * 3 * (bpp / 8));
-  if(stream_size == 0)
+  pdf->bytes_written += bytes_written;
+  pdf_image->size = bytes_written;
+
+  if(pdf_image->encoder)
   {
-    free(pdf_image);
-    return NULL;
+    // the zlib header: deflate with a 32k window and the default level
+    const unsigned char header[2] = { 0x78, 0x9c };
+    fwrite(header, 1, sizeof(header), pdf->fd);
+    pdf_image->stream_size = sizeof(header);
   }
-  bytes_written += stream_size;
+
+  return pdf_image;
+}
+
+// using zlib we get quite small files, but it's slow. so the data is cut into chunks that are deflated in
+// parallel, each primed with the window before it and ending on a byte boundary with a sync flush, like pigz
+// does it. written one after the other they are a single deflate stream.
+static int _pdf_image_deflate(dt_pdf_t *pdf, dt_pdf_image_t *pdf_image, const unsigned char *data, size_t len)
+{
+  _pdf_deflate_t *encoder = (_pdf_deflate_t *)pdf_image->encoder;
+  const size_t n_chunks = (len + DT_PDF_DEFLATE_CHUNK - 1) / DT_PDF_DEFLATE_CHUNK;
+  unsigned char **out = calloc(n_chunks, sizeof(unsigned char *));
+  size_t *out_len = calloc(n_chunks, sizeof(size_t));
+  uLong *adler = calloc(n_chunks, sizeof(uLong));
+  if(!out || !out_len || !adler)
+  {
+    free(out);
+    free(out_len);
+    free(adler);
+    return 1;
+  }
+
+  int failed = 0;
+#ifdef _OPENMP
+  #pragma omp parallel for schedule(dynamic) default(none) shared(encoder, data, len, out, out_len, adler) \
+    reduction(| : failed)
+#endif
+  for(size_t k = 0; k < n_chunks; k++)
+  {
+    const size_t start = k * DT_PDF_DEFLATE_CHUNK;
+    const size_t chunk = MIN(DT_PDF_DEFLATE_CHUNK, len - start);
+    adler[k] = adler32(adler32(0L, Z_NULL, 0), data + start, chunk);
+
+    z_stream zs = { 0 };
+    if(deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+    {
+      failed = 1;
+      continue;
+    }
+    if(start)
+    {
+      const size_t window = MIN(start, DT_PDF_DEFLATE_WINDOW);
+      deflateSetDictionary(&zs, data + start - window, window);
+    }
+    else if(encoder->window_size)
+      deflateSetDictionary(&zs, encoder->window, encoder->window_size);
+
+    // room for the sync flush, too
+    const size_t bound = deflateBound(&zs, chunk) + 16;
+    out[k] = malloc(bound);
+    if(out[k])
+    {
+      zs.next_in = (Bytef *)data + start;
+      zs.avail_in = chunk;
+      zs.next_out = out[k];
+      zs.avail_out = bound;
+      if(deflate(&zs, Z_SYNC_FLUSH) == Z_STREAM_ERROR || zs.avail_in || !zs.avail_out) failed = 1;
+      out_len[k] = bound - zs.avail_out;
+    }
+    else
+      failed = 1;
+    deflateEnd(&zs);
+  }
+
+  for(size_t k = 0; k < n_chunks; k++)
+  {
+    if(!failed)
+    {
+      if(fwrite(out[k], 1, out_len[k], pdf->fd) != out_len[k]) failed = 1;
+      pdf_image->stream_size += out_len[k];
+      encoder->adler
+          = adler32_combine(encoder->adler, adler[k], MIN(DT_PDF_DEFLATE_CHUNK, len - k * DT_PDF_DEFLATE_CHUNK));
+    }
+    free(out[k]);
+  }
+  free(out);
+  free(out_len);
+  free(adler);
+
+  // the window for the first chunk of the next rows
+  if(len >= DT_PDF_DEFLATE_WINDOW)
+  {
+    memcpy(encoder->window, data + len - DT_PDF_DEFLATE_WINDOW, DT_PDF_DEFLATE_WINDOW);
+    encoder->window_size = DT_PDF_DEFLATE_WINDOW;
+  }
+  else
+  {
+    const size_t keep = MIN(encoder->window_size, DT_PDF_DEFLATE_WINDOW - len);
+    memmove(encoder->window, encoder->window + encoder->window_size - keep, keep);
+    memcpy(encoder->window + keep, data, len);
+    encoder->window_size = keep + len;
+  }
+
+  return failed;
+}
+
+// an empty final block and the adler32 of everything that went in end the zlib stream
+static int _pdf_image_deflate_finish(dt_pdf_t *pdf, dt_pdf_image_t *pdf_image)
+{
+  const uLong adler = ((_pdf_deflate_t *)pdf_image->encoder)->adler;
+  const unsigned char trailer[6] = { 0x03, 0x00, (adler >> 24) & 0xff, (adler >> 16) & 0xff, (adler >> 8) & 0xff,
+                                     adler & 0xff };
+  pdf_image->stream_size += sizeof(trailer);
+  return fwrite(trailer, 1, sizeof(trailer), pdf->fd) != sizeof(trailer);
+}
+
+int dt_pdf_add_image_rows(dt_pdf_t *pdf, dt_pdf_image_t *pdf_image, const unsigned char *data, int rows)
+{
+  const size_t len = pdf_image->width * rows * 3 * (pdf_image->bpp / 8);
+  if(pdf_image->encoder) return _pdf_image_deflate(pdf, pdf_image, data, len);
+
+  // every byte is two hex digits, so the stream can be cut anywhere
+  pdf_image->stream_size += _pdf_stream_encoder_ASCIIHex(pdf, data, len);
+  return 0;
+}
+
+int dt_pdf_add_image_end(dt_pdf_t *pdf, dt_pdf_image_t *pdf_image)
+{
+  int res = 0;
+  if(pdf_image->encoder)
+  {
+    res = _pdf_image_deflate_finish(pdf, pdf_image);
+    free(pdf_image->encoder);
+    pdf_image->encoder = NULL;
+  }
+
+  size_t bytes_written = pdf_image->stream_size;
 
   //end
   bytes_written += fprintf(pdf->fd,
@@ -451,16 +582,16 @@ dt_pdf_image_t *dt_pdf_add_image(dt_pdf_t *pdf, const unsigned char *image, int
   );
 
   // length of the last stream
-  _pdf_set_offset(pdf, length_id, pdf->bytes_written + bytes_written);
+  _pdf_set_offset(pdf, pdf_image->length_id, pdf->bytes_written + bytes_written);
   bytes_written += fprintf(pdf->fd, "%d 0 obj\n"
                                     "%zu\n"
                                     "endobj\n",
-                           length_id, stream_size);
+                           pdf_image->length_id, pdf_image->stream_size);
 
   pdf->bytes_written += bytes_written;
-  pdf_image->size = bytes_written;
+  pdf_image->size += bytes_written;
 
-  return pdf_image;
+  return res;
 }
 
 dt_pdf_page_t *dt_pdf_add_page(dt_pdf_t *pdf, dt_pdf_image_t **images, int n_images)
@@ -957,6 +1088,9 @@ int main(int argc, char *argv[])
 
 #endif // STANDALONE
 
+#undef DT_PDF_DEFLATE_CHUNK
+#undef DT_PDF_DEFLATE_WINDOW
+
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
 // kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
@@ -71,6 +71,12 @@ typedef struct dt_pdf_image_t
 
   gboolean  outline_mode; // set to 1 to only draw a box instead of the image
   gboolean  show_bb; // set to 1 to draw the bounding box. useful for debugging
+
+  // while the image data is being written
+  int       length_id;
+  int       bpp;
+  size_t    stream_size;
+  void     *encoder;
 } dt_pdf_image_t;
 
 typedef struct dt_pdf_page_t
@@ -117,6 +123,13 @@ dt_pdf_t *dt_pdf_start(const char *filename, float width, float height, float dp
 int dt_pdf_add_icc(dt_pdf_t *pdf, const char *filename);
 int dt_pdf_add_icc_from_data(dt_pdf_t *pdf, const unsigned char *data, size_t size);
 dt_pdf_image_t *dt_pdf_add_image(dt_pdf_t *pdf, const unsigned char *image, int bpp, int width, int height, int icc_id, float border);
+// the same, with the pixels written a few rows at a time between begin and end. nothing else may be added to the
+// pdf meanwhile, and end has to be called also after rows failed. with the flate encoder the rows of one call are
+// deflated in parallel, so it pays to hand over a few megabytes at a time.
+dt_pdf_image_t *dt_pdf_add_image_begin(dt_pdf_t *pdf, gboolean outline_mode, int width, int height, int bpp,
+                                       int icc_id, float border);
+int dt_pdf_add_image_rows(dt_pdf_t *pdf, dt_pdf_image_t *image, const unsigned char *data, int rows);
+int dt_pdf_add_image_end(dt_pdf_t *pdf, dt_pdf_image_t *image);
 dt_pdf_page_t *dt_pdf_add_page(dt_pdf_t *pdf, dt_pdf_image_t **images, int n_images);
 void dt_pdf_finish(dt_pdf_t *pdf, dt_pdf_page_t **pages, int n_pages);
 
@@ -18,6 +18,8 @@
 
 #include "common/printprof.h"
 #include "common/colorspaces.h"
+#include "common/lut3d.h"
+#include "control/conf.h"
 #include "lcms2.h"
 #include <glib.h>
 #include <unistd.h>
@@ -107,6 +109,70 @@ int dt_apply_printer_profile(int imgid, void **in, uint32_t width, uint32_t heig
   return 0;
 }
 
+dt_printer_transform_t *dt_printer_transform_new(int imgid, cmsHPROFILE hOutProfile, int intent,
+                                                 gboolean black_point_compensation)
+{
+  if(!hOutProfile) return NULL;
+
+  const dt_colorspaces_color_profile_t *in_profile = dt_colorspaces_get_output_profile(imgid);
+  if(!in_profile || !in_profile->profile)
+  {
+    fprintf(stderr, "error getting output profile for image %d\n", imgid);
+    return NULL;
+  }
+
+  const cmsUInt32Number flags = black_point_compensation ? cmsFLAGS_BLACKPOINTCOMPENSATION : 0;
+  dt_printer_transform_t *t = (dt_printer_transform_t *)calloc(1, sizeof(dt_printer_transform_t));
+  t->xform = cmsCreateTransform(in_profile->profile, TYPE_RGBA_FLT, hOutProfile, TYPE_RGBA_FLT, intent, flags);
+  if(!t->xform)
+  {
+    fprintf(stderr, "error printer profile may be corrupted\n");
+    free(t);
+    return NULL;
+  }
+
+  const int lut3d_size = dt_conf_get_int("plugins/darkroom/lcms2_lut_size");
+  if(lut3d_size > 0)
+  {
+    const float min[3] = { 0.0f, 0.0f, 0.0f };
+    const float max[3] = { 1.0f, 1.0f, 1.0f };
+    gchar *key = dt_lut3d_cache_key(in_profile->profile, hOutProfile, NULL, intent, flags, "print", lut3d_size);
+    t->lut3d = dt_lut3d_cache_get(key, lut3d_size, min, max, dt_lut3d_eval_transform, t->xform);
+    g_free(key);
+  }
+
+  return t;
+}
+
+void dt_printer_transform_apply(const dt_printer_transform_t *t, float *in, uint8_t *out, size_t npixels)
+{
+  const size_t chunk = 1024;
+  const size_t nchunks = (npixels + chunk - 1) / chunk;
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static) default(none) shared(in, out, t)
+#endif
+  for(size_t c = 0; c < nchunks; c++)
+  {
+    float *const px = in + 4 * c * chunk;
+    const size_t n = MIN(chunk, npixels - c * chunk);
+    if(t->lut3d)
+      dt_lut3d_apply(t->lut3d, px, px, n);
+    else
+      cmsDoTransform(t->xform, px, px, n);
+    uint8_t *const o = out + 3 * c * chunk;
+    for(size_t k = 0; k < n; k++)
+      for(int i = 0; i < 3; i++) o[3 * k + i] = CLAMP(px[4 * k + i] * 0xff, 0, 0xff);
+  }
+}
+
+void dt_printer_transform_free(dt_printer_transform_t *t)
+{
+  if(!t) return;
+  dt_lut3d_cache_release(t->lut3d);
+  cmsDeleteTransform(t->xform);
+  free(t);
+}
+
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
 // kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
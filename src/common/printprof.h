@@ -28,6 +28,22 @@ int dt_apply_printer_profile(int imgid, void **in, uint32_t width, uint32_t heig
 // this routines takes as input an image of 8 or 16 bpp but always return a 8 bpp result. It is indeed better to
 // apply the profile to a 16bit input but we do not need this for printing.
 
+struct dt_lut3d_t;
+
+// the same transform for float rgba input, applied a few rows at a time as the image comes out of the pipe. it
+// is baked into a lookup table when plugins/darkroom/lcms2_lut_size asks for one.
+typedef struct dt_printer_transform_t
+{
+  cmsHTRANSFORM xform;
+  struct dt_lut3d_t *lut3d;
+} dt_printer_transform_t;
+
+dt_printer_transform_t *dt_printer_transform_new(int imgid, cmsHPROFILE hOutProfile, int intent,
+                                                 gboolean black_point_compensation);
+// in is 16 byte aligned and gets overwritten, out gets 8 bit rgb
+void dt_printer_transform_apply(const dt_printer_transform_t *t, float *in, uint8_t *out, size_t npixels);
+void dt_printer_transform_free(dt_printer_transform_t *t);
+
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
 // kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
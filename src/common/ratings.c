@@ -24,16 +24,24 @@
 #include "gui/gtk.h"
 
 
-void dt_ratings_apply_to_image(int imgid, int rating)
+typedef struct dt_ratings_apply_t
 {
-  dt_image_t *image = dt_image_cache_get(darktable.image_cache, imgid, 'w');
-  // one star is a toggle, so you can easily reject images by removing the last star:
-  if(((image->flags & 0x7) == 1) && !dt_conf_get_bool("rating_one_double_tap") && (rating == 1))
-  {
-    rating = 0;
-  }
+  int rating;
+  gboolean toggle; // one star is a toggle, so you can easily reject images by removing the last star
+} dt_ratings_apply_t;
 
+static void _ratings_apply(dt_image_t *image, void *data)
+{
+  const dt_ratings_apply_t *r = (dt_ratings_apply_t *)data;
+  const int rating = (r->toggle && (image->flags & 0x7) == 1) ? 0 : r->rating;
   image->flags = (image->flags & ~0x7) | (0x7 & rating);
+}
+
+void dt_ratings_apply_to_image(int imgid, int rating)
+{
+  dt_image_t *image = dt_image_cache_get(darktable.image_cache, imgid, 'w');
+  dt_ratings_apply_t r = { rating, rating == 1 && !dt_conf_get_bool("rating_one_double_tap") };
+  _ratings_apply(image, &r);
   // synch through:
   dt_image_cache_write_release(darktable.image_cache, image, DT_IMAGE_CACHE_SAFE);
 
@@ -50,23 +58,40 @@ void dt_ratings_apply_to_selection(int rating)
     else
       dt_control_log(ngettext("applying rating %d to %d image", "applying rating %d to %d images", count),
                      rating, count);
-#if 0 // not updating cache
-    gchar query[1024]= {0};
-    g_snprintf(query,sizeof(query), "UPDATE main.images SET flags=(flags & ~7) | (7 & %d) WHERE id IN "
-                                    "(SELECT imgid FROM main.selected_images)", rating);
-    DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), query, NULL, NULL, NULL);
-#endif
-
-    /* for each selected image update rating */
+
+    sqlite3 *db = dt_database_get(darktable.db);
+    dt_ratings_apply_t r = { rating, rating == 1 && !dt_conf_get_bool("rating_one_double_tap") };
+    GArray *imgids = g_array_new(FALSE, FALSE, sizeof(int));
     sqlite3_stmt *stmt;
-    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "SELECT imgid FROM main.selected_images", -1, &stmt,
-                                NULL);
+    DT_DEBUG_SQLITE3_PREPARE_V2(db, "SELECT imgid FROM main.selected_images", -1, &stmt, NULL);
     while(sqlite3_step(stmt) == SQLITE_ROW)
     {
-      dt_ratings_apply_to_image(sqlite3_column_int(stmt, 0), rating);
+      const int imgid = sqlite3_column_int(stmt, 0);
+      g_array_append_val(imgids, imgid);
     }
     sqlite3_finalize(stmt);
 
+    /* the cached images first, an image written back meanwhile takes the new rating to the database, then all
+     * of them in one statement instead of a write through per image */
+    dt_image_cache_update_cached(darktable.image_cache, imgids, _ratings_apply, &r);
+
+    sqlite3_exec(db, "BEGIN TRANSACTION", NULL, NULL, NULL);
+    DT_DEBUG_SQLITE3_PREPARE_V2(db, "UPDATE main.images SET flags = (flags & ~7) | (7 & CASE WHEN ?2 AND "
+                                    "(flags & 7) = 1 THEN 0 ELSE ?1 END) WHERE id IN "
+                                    "(SELECT imgid FROM main.selected_images)",
+                                -1, &stmt, NULL);
+    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, r.rating);
+    DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, r.toggle);
+    sqlite3_step(stmt);
+    sqlite3_finalize(stmt);
+    sqlite3_exec(db, "COMMIT", NULL, NULL, NULL);
+
+    /* the sidecars are queued for the background writers */
+    for(guint i = 0; i < imgids->len; i++) dt_image_write_sidecar_file(g_array_index(imgids, int, i));
+    g_array_free(imgids, TRUE);
+
+    dt_collection_hint_message(darktable.collection);
+
     /* redraw view */
     /* dt_control_queue_redraw_center() */
     /* needs to be called in the caller function */
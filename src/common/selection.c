@@ -29,8 +29,25 @@ typedef struct dt_selection_t
   /* this stores the last single clicked image id indicating
      the start of a selection range */
   uint32_t last_single_id;
+
+  /* the selected images, fetched again once the database changed. drawing asks for every thumbnail, and
+     selected_images is written from many places besides this file */
+  GHashTable *ids;
+  int ids_changes;
 } dt_selection_t;
 
+/* all changes to selected_images of one operation in one transaction */
+static void _selection_begin(void)
+{
+  sqlite3_exec(dt_database_get(darktable.db), "BEGIN TRANSACTION", NULL, NULL, NULL);
+}
+
+static void _selection_end(void)
+{
+  sqlite3_exec(dt_database_get(darktable.db), "COMMIT", NULL, NULL, NULL);
+  dt_control_signal_raise(darktable.signals, DT_SIGNAL_SELECTION_CHANGED);
+}
+
 /* updates the internal collection of an selection */
 static void _selection_update_collection(gpointer instance, gpointer user_data);
 
@@ -69,9 +86,29 @@ const dt_selection_t *dt_selection_new()
 
 void dt_selection_free(dt_selection_t *selection)
 {
+  if(selection->ids) g_hash_table_destroy(selection->ids);
   g_free(selection);
 }
 
+gboolean dt_selection_is_selected(dt_selection_t *selection, const int imgid)
+{
+  sqlite3 *db = dt_database_get(darktable.db);
+  if(!selection->ids || selection->ids_changes != sqlite3_total_changes(db))
+  {
+    if(selection->ids)
+      g_hash_table_remove_all(selection->ids);
+    else
+      selection->ids = g_hash_table_new(NULL, NULL);
+    sqlite3_stmt *stmt;
+    DT_DEBUG_SQLITE3_PREPARE_CACHED(darktable.db, "SELECT imgid FROM main.selected_images", &stmt);
+    while(sqlite3_step(stmt) == SQLITE_ROW)
+      g_hash_table_add(selection->ids, GINT_TO_POINTER(sqlite3_column_int(stmt, 0)));
+    dt_database_release_cached(darktable.db, stmt);
+    selection->ids_changes = sqlite3_total_changes(db);
+  }
+  return g_hash_table_contains(selection->ids, GINT_TO_POINTER(imgid));
+}
+
 void dt_selection_invert(dt_selection_t *selection)
 {
   gchar *fullq = NULL;
@@ -81,6 +118,7 @@ void dt_selection_invert(dt_selection_t *selection)
   fullq = dt_util_dstrcat(fullq, "%s", "INSERT OR IGNORE INTO main.selected_images ");
   fullq = dt_util_dstrcat(fullq, "%s", dt_collection_get_query(selection->collection));
 
+  _selection_begin();
   DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db),
                         "INSERT INTO memory.tmp_selection SELECT imgid FROM main.selected_images", NULL, NULL,
                         NULL);
@@ -90,6 +128,7 @@ void dt_selection_invert(dt_selection_t *selection)
                         "DELETE FROM main.selected_images WHERE imgid IN (SELECT imgid FROM memory.tmp_selection)",
                         NULL, NULL, NULL);
   DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), "DELETE FROM memory.tmp_selection", NULL, NULL, NULL);
+  _selection_end();
 
   g_free(fullq);
 
@@ -99,7 +138,9 @@ void dt_selection_invert(dt_selection_t *selection)
 
 void dt_selection_clear(const dt_selection_t *selection)
 {
+  _selection_begin();
   DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), "DELETE FROM main.selected_images", NULL, NULL, NULL);
+  _selection_end();
 
   /* update hint message */
   dt_collection_hint_message(darktable.collection);
@@ -109,6 +150,7 @@ void dt_selection_select_single(dt_selection_t *selection, uint32_t imgid)
 {
   gchar *query = NULL;
   selection->last_single_id = imgid;
+  _selection_begin();
   DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), "DELETE FROM main.selected_images", NULL, NULL, NULL);
 
   if(imgid != -1)
@@ -117,6 +159,7 @@ void dt_selection_select_single(dt_selection_t *selection, uint32_t imgid)
     DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), query, NULL, NULL, NULL);
     g_free(query);
   }
+  _selection_end();
 
   /* update hint message */
   dt_collection_hint_message(darktable.collection);
@@ -125,20 +168,10 @@ void dt_selection_select_single(dt_selection_t *selection, uint32_t imgid)
 void dt_selection_toggle(dt_selection_t *selection, uint32_t imgid)
 {
   gchar *query = NULL;
-  sqlite3_stmt *stmt;
-  gboolean exists = FALSE;
 
   if(imgid == -1) return;
 
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                              "SELECT imgid FROM main.selected_images WHERE imgid=?1", -1, &stmt, NULL);
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
-
-  if(sqlite3_step(stmt) == SQLITE_ROW) exists = TRUE;
-
-  sqlite3_finalize(stmt);
-
-  if(exists)
+  if(dt_selection_is_selected(selection, imgid))
   {
     selection->last_single_id = -1;
     query = dt_util_dstrcat(query, "DELETE FROM main.selected_images WHERE imgid = %d", imgid);
@@ -150,6 +183,7 @@ void dt_selection_toggle(dt_selection_t *selection, uint32_t imgid)
   }
 
   sqlite3_exec(dt_database_get(darktable.db), query, NULL, NULL, NULL);
+  dt_control_signal_raise(darktable.signals, DT_SIGNAL_SELECTION_CHANGED);
 
   g_free(query);
 
@@ -166,8 +200,10 @@ void dt_selection_select_all(dt_selection_t *selection)
   fullq = dt_util_dstrcat(fullq, "%s", "INSERT OR IGNORE INTO main.selected_images ");
   fullq = dt_util_dstrcat(fullq, "%s", dt_collection_get_query(selection->collection));
 
+  _selection_begin();
   DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), "DELETE FROM main.selected_images", NULL, NULL, NULL);
   DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), fullq, NULL, NULL, NULL);
+  _selection_end();
 
   selection->last_single_id = -1;
 
@@ -221,6 +257,8 @@ void dt_selection_select_range(dt_selection_t *selection, uint32_t imgid)
 
   sqlite3_step(stmt);
   sqlite3_finalize(stmt);
+  g_free(fullq);
+  dt_control_signal_raise(darktable.signals, DT_SIGNAL_SELECTION_CHANGED);
 
   /* reset filter */
   dt_collection_set_query_flags(selection->collection, old_flags);
@@ -230,6 +268,7 @@ void dt_selection_select_range(dt_selection_t *selection, uint32_t imgid)
 
 void dt_selection_select_filmroll(dt_selection_t *selection)
 {
+  _selection_begin();
   // clear at start, too, just to be sure:
   DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), "DELETE FROM memory.tmp_selection", NULL, NULL, NULL);
   DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db),
@@ -242,6 +281,7 @@ void dt_selection_select_filmroll(dt_selection_t *selection)
                         "b ON a.id = b.imgid)",
                         NULL, NULL, NULL);
   DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), "DELETE FROM memory.tmp_selection", NULL, NULL, NULL);
+  _selection_end();
   selection->last_single_id = -1;
 }
 
@@ -263,8 +303,10 @@ void dt_selection_select_unaltered(dt_selection_t *selection)
 
 
   /* clean current selection and select unaltered images */
+  _selection_begin();
   DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), "DELETE FROM main.selected_images", NULL, NULL, NULL);
   DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), fullq, NULL, NULL, NULL);
+  _selection_end();
 
   /* restore collection filter and update query */
   dt_collection_set_filter_flags(selection->collection, old_filter_flags);
@@ -279,29 +321,21 @@ void dt_selection_select_unaltered(dt_selection_t *selection)
 void dt_selection_select_list(struct dt_selection_t *selection, GList *list)
 {
   if(!list) return;
-  while(list)
-  {
-    int count = 1;
-    gchar *query = NULL;
 
-    int imgid = GPOINTER_TO_INT(list->data);
+  sqlite3_stmt *stmt;
+  _selection_begin();
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "INSERT OR IGNORE INTO main.selected_images VALUES (?1)",
+                              -1, &stmt, NULL);
+  for(; list; list = g_list_next(list))
+  {
+    const int imgid = GPOINTER_TO_INT(list->data);
     selection->last_single_id = imgid;
-    query = dt_util_dstrcat(query, "INSERT OR IGNORE INTO main.selected_images VALUES (%d)", imgid);
-    list = g_list_next(list);
-    while(list && count < 400)
-    {
-      imgid = GPOINTER_TO_INT(list->data);
-      count++;
-      selection->last_single_id = imgid;
-      query = dt_util_dstrcat(query, ",(%d)", imgid);
-      list = g_list_next(list);
-    }
-    char *result = NULL;
-
-    sqlite3_exec(dt_database_get(darktable.db), query, NULL, NULL, &result);
-
-    g_free(query);
+    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
+    sqlite3_step(stmt);
+    sqlite3_reset(stmt);
   }
+  sqlite3_finalize(stmt);
+  _selection_end();
 
   /* update hint message */
   dt_collection_hint_message(darktable.collection);
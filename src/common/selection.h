@@ -26,6 +26,9 @@ struct dt_selection_t;
 struct dt_selection_t *dt_selection_new();
 void dt_selection_free(struct dt_selection_t *selection);
 
+/** whether imgid is selected, without a query as long as the database didn't change */
+gboolean dt_selection_is_selected(struct dt_selection_t *selection, const int imgid);
+
 /** inverts the current selection */
 void dt_selection_invert(struct dt_selection_t *selection);
 /** clears the selection */
@@ -0,0 +1,223 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2017 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+/*
+ * the sse intrinsics the sse2 code paths are written in. on x86 these are the compiler's own, on 64 bit arm
+ * the subset the ported code paths use is implemented with neon, so the same source serves both.
+ *
+ * DT_SIMD_SSE is defined wherever the intrinsics of this header work, DT_SIMD_NEON when they are the neon
+ * ones. code guarded by DT_SIMD_SSE has to stick to what is defined below for arm; the rest of the sse code
+ * stays behind __SSE__. differences to sse: _mm_min_ps() and _mm_max_ps() return nan if either argument is
+ * nan, _mm_stream_ps() is a plain store and _mm_sfence() only a compiler barrier.
+ */
+
+#if defined(__SSE2__)
+
+#include <emmintrin.h>
+#include <xmmintrin.h>
+#define DT_SIMD_SSE 1
+
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+
+#include <arm_neon.h>
+#define DT_SIMD_SSE 1
+#define DT_SIMD_NEON 1
+
+typedef float32x4_t __m128;
+typedef int32x4_t __m128i;
+
+#define _MM_SHUFFLE(fp3, fp2, fp1, fp0) (((fp3) << 6) | ((fp2) << 4) | ((fp1) << 2) | (fp0))
+
+// the lanes of a and b picked by an _MM_SHUFFLE() constant, two from a for the low half, two from b for the
+// high one
+#if defined(__clang__)
+#define _mm_shuffle_ps(a, b, imm)                                                                            \
+  __builtin_shufflevector((__m128)(a), (__m128)(b), (imm)&3, ((imm) >> 2) & 3, 4 + (((imm) >> 4) & 3),      \
+                          4 + (((imm) >> 6) & 3))
+#else
+#define _mm_shuffle_ps(a, b, imm)                                                                            \
+  __builtin_shuffle((__m128)(a), (__m128)(b),                                                                \
+                    (__m128i){ (imm)&3, ((imm) >> 2) & 3, 4 + (((imm) >> 4) & 3), 4 + (((imm) >> 6) & 3) })
+#endif
+
+static inline __m128 _mm_setzero_ps(void)
+{
+  return vdupq_n_f32(0.0f);
+}
+
+static inline __m128 _mm_set1_ps(const float a)
+{
+  return vdupq_n_f32(a);
+}
+
+static inline __m128 _mm_set_ps(const float e3, const float e2, const float e1, const float e0)
+{
+  return (__m128){ e0, e1, e2, e3 };
+}
+
+static inline __m128 _mm_setr_ps(const float e0, const float e1, const float e2, const float e3)
+{
+  return (__m128){ e0, e1, e2, e3 };
+}
+
+static inline __m128 _mm_load_ps(const float *const p)
+{
+  return vld1q_f32(p);
+}
+
+static inline void _mm_store_ps(float *const p, const __m128 a)
+{
+  vst1q_f32(p, a);
+}
+
+static inline void _mm_stream_ps(float *const p, const __m128 a)
+{
+  vst1q_f32(p, a);
+}
+
+static inline void _mm_sfence(void)
+{
+  __asm__ __volatile__("" ::: "memory");
+}
+
+static inline __m128 _mm_add_ps(const __m128 a, const __m128 b)
+{
+  return vaddq_f32(a, b);
+}
+
+static inline __m128 _mm_sub_ps(const __m128 a, const __m128 b)
+{
+  return vsubq_f32(a, b);
+}
+
+static inline __m128 _mm_mul_ps(const __m128 a, const __m128 b)
+{
+  return vmulq_f32(a, b);
+}
+
+static inline __m128 _mm_div_ps(const __m128 a, const __m128 b)
+{
+  return vdivq_f32(a, b);
+}
+
+static inline __m128 _mm_min_ps(const __m128 a, const __m128 b)
+{
+  return vminq_f32(a, b);
+}
+
+static inline __m128 _mm_max_ps(const __m128 a, const __m128 b)
+{
+  return vmaxq_f32(a, b);
+}
+
+static inline __m128 _mm_and_ps(const __m128 a, const __m128 b)
+{
+  return vreinterpretq_f32_u32(vandq_u32(vreinterpretq_u32_f32(a), vreinterpretq_u32_f32(b)));
+}
+
+static inline __m128 _mm_andnot_ps(const __m128 a, const __m128 b)
+{
+  return vreinterpretq_f32_u32(vbicq_u32(vreinterpretq_u32_f32(b), vreinterpretq_u32_f32(a)));
+}
+
+static inline __m128 _mm_or_ps(const __m128 a, const __m128 b)
+{
+  return vreinterpretq_f32_u32(vorrq_u32(vreinterpretq_u32_f32(a), vreinterpretq_u32_f32(b)));
+}
+
+static inline __m128 _mm_cmpgt_ps(const __m128 a, const __m128 b)
+{
+  return vreinterpretq_f32_u32(vcgtq_f32(a, b));
+}
+
+static inline __m128 _mm_cmple_ps(const __m128 a, const __m128 b)
+{
+  return vreinterpretq_f32_u32(vcleq_f32(a, b));
+}
+
+static inline __m128 _mm_unpacklo_ps(const __m128 a, const __m128 b)
+{
+  return vzip1q_f32(a, b);
+}
+
+static inline __m128 _mm_unpackhi_ps(const __m128 a, const __m128 b)
+{
+  return vzip2q_f32(a, b);
+}
+
+static inline __m128 _mm_movelh_ps(const __m128 a, const __m128 b)
+{
+  return vcombine_f32(vget_low_f32(a), vget_low_f32(b));
+}
+
+static inline __m128 _mm_movehl_ps(const __m128 a, const __m128 b)
+{
+  return vcombine_f32(vget_high_f32(b), vget_high_f32(a));
+}
+
+static inline __m128i _mm_set1_epi32(const int a)
+{
+  return vdupq_n_s32(a);
+}
+
+static inline __m128i _mm_add_epi32(const __m128i a, const __m128i b)
+{
+  return vaddq_s32(a, b);
+}
+
+static inline __m128i _mm_sub_epi32(const __m128i a, const __m128i b)
+{
+  return vsubq_s32(a, b);
+}
+
+static inline __m128i _mm_and_si128(const __m128i a, const __m128i b)
+{
+  return vandq_s32(a, b);
+}
+
+#define _mm_slli_epi32(a, imm) vshlq_n_s32((a), (imm))
+#define _mm_srli_epi32(a, imm) vreinterpretq_s32_u32(vshrq_n_u32(vreinterpretq_u32_s32(a), (imm)))
+
+static inline __m128 _mm_castsi128_ps(const __m128i a)
+{
+  return vreinterpretq_f32_s32(a);
+}
+
+static inline __m128i _mm_castps_si128(const __m128 a)
+{
+  return vreinterpretq_s32_f32(a);
+}
+
+static inline __m128 _mm_cvtepi32_ps(const __m128i a)
+{
+  return vcvtq_f32_s32(a);
+}
+
+// rounds to nearest even, as sse does in the default rounding mode
+static inline __m128i _mm_cvtps_epi32(const __m128 a)
+{
+  return vcvtnq_s32_f32(a);
+}
+
+#endif
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
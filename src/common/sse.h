@@ -14,7 +14,7 @@
 */
 #pragma once
 
-#include <xmmintrin.h>
+#include "common/simd.h"
 
 /*
  * Fast SSE2 implementation of special math functions.
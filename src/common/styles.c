@@ -18,12 +18,14 @@
 
 #include "common/styles.h"
 #include "common/darktable.h"
+#include "common/collection.h"
 #include "common/debug.h"
 #include "common/exif.h"
 #include "common/file_location.h"
 #include "common/history.h"
 #include "common/image_cache.h"
 #include "common/imageio.h"
+#include "common/mipmap_cache.h"
 #include "common/tags.h"
 #include "control/control.h"
 #include "develop/develop.h"
@@ -477,17 +479,20 @@ void dt_styles_apply_to_selection(const char *name, gboolean duplicate)
   const dt_view_t *cv = dt_view_manager_get_current_view(darktable.view_manager);
   if(cv->view((dt_view_t *)cv) == DT_VIEW_DARKROOM) dt_dev_write_history(darktable.develop);
 
-  /* for each selected image apply style */
+  /* apply the style to all selected images at once */
+  GList *list = NULL;
   sqlite3_stmt *stmt;
   DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "SELECT imgid FROM main.selected_images",
                               -1, &stmt, NULL);
   while(sqlite3_step(stmt) == SQLITE_ROW)
   {
-    int imgid = sqlite3_column_int(stmt, 0);
-    dt_styles_apply_to_image(name, duplicate, imgid);
+    list = g_list_prepend(list, GINT_TO_POINTER(sqlite3_column_int(stmt, 0)));
     selected = TRUE;
   }
   sqlite3_finalize(stmt);
+  list = g_list_reverse(list);
+  dt_styles_apply_to_list(name, list, duplicate);
+  g_list_free(list);
 
   if(!selected) dt_control_log(_("no image selected!"));
 }
@@ -510,80 +515,114 @@ void dt_styles_create_from_selection()
   if(!selected) dt_control_log(_("no image selected!"));
 }
 
-void dt_styles_apply_to_image(const char *name, gboolean duplicate, int32_t imgid)
+void dt_styles_apply_to_list(const char *name, GList *list, gboolean duplicate)
 {
-  int id = 0;
-  sqlite3_stmt *stmt;
-  int32_t newimgid;
+  const int id = dt_styles_get_id_by_name(name);
+  if(id == 0 || !list) return;
 
-  if((id = dt_styles_get_id_by_name(name)) != 0)
+  GList *images = NULL;
+  for(GList *iter = list; iter; iter = g_list_next(iter))
   {
+    const int32_t imgid = GPOINTER_TO_INT(iter->data);
+    int32_t newimgid = imgid;
     /* check if we should make a duplicate before applying style */
     if(duplicate)
     {
       newimgid = dt_image_duplicate(imgid);
-      if(newimgid != -1) dt_history_copy_and_paste_on_image(imgid, newimgid, FALSE, NULL);
+      if(newimgid == -1) continue;
+      dt_history_copy_and_paste_on_image(imgid, newimgid, FALSE, NULL);
     }
-    else
-      newimgid = imgid;
+    images = g_list_prepend(images, GINT_TO_POINTER(newimgid));
+  }
+  if(!images) return;
 
-    /* merge onto history stack, let's find history offest in destination image */
-    /* first trim the stack to get rid of whatever is above the selected entry */
-    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                                "DELETE FROM main.history WHERE imgid = ?1 AND num >= (SELECT history_end "
-                                "FROM main.images WHERE id = imgid)", -1, &stmt, NULL);
-    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, newimgid);
+  guint style_tagid = 0, changed_tagid = 0;
+  gchar ntag[512] = { 0 };
+  g_snprintf(ntag, sizeof(ntag), "darktable|style|%s", name);
+  const gboolean style_tag = dt_tag_new(ntag, &style_tagid);
+  const gboolean changed_tag = dt_tag_new("darktable|changed", &changed_tagid);
+
+  sqlite3 *db = dt_database_get(darktable.db);
+  sqlite3_stmt *stmt;
+  sqlite3_exec(db, "BEGIN TRANSACTION", NULL, NULL, NULL);
+
+  /* the images to apply the style to */
+  DT_DEBUG_SQLITE3_EXEC(db, "DELETE FROM memory.style_images", NULL, NULL, NULL);
+  DT_DEBUG_SQLITE3_PREPARE_V2(db, "INSERT OR IGNORE INTO memory.style_images (imgid) VALUES (?1)", -1, &stmt,
+                              NULL);
+  for(GList *iter = images; iter; iter = g_list_next(iter))
+  {
+    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, GPOINTER_TO_INT(iter->data));
     sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
+    sqlite3_reset(stmt);
+  }
+  sqlite3_finalize(stmt);
 
-    /* in sqlite ROWID starts at 1, while our num column starts at 0 */
-    int32_t offs = -1;
-    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                                "SELECT IFNULL(MAX(num), -1) FROM main.history WHERE imgid = ?1", -1, &stmt, NULL);
-    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, newimgid);
-    if(sqlite3_step(stmt) == SQLITE_ROW) offs = sqlite3_column_int(stmt, 0);
-    sqlite3_finalize(stmt);
+  /* merge onto history stack, first trim the stack to get rid of whatever is above the selected entry */
+  DT_DEBUG_SQLITE3_EXEC(db, "DELETE FROM main.history WHERE imgid IN (SELECT imgid FROM memory.style_images) "
+                            "AND num >= (SELECT history_end FROM main.images WHERE id = history.imgid)",
+                        NULL, NULL, NULL);
 
-    /* delete all items from the temp styles_items, this table is used only to get a ROWNUM of the results */
-    DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), "DELETE FROM memory.style_items", NULL, NULL, NULL);
+  /* the history offset of every image. in sqlite ROWID starts at 1, while our num column starts at 0 */
+  DT_DEBUG_SQLITE3_EXEC(db, "UPDATE memory.style_images SET offs = (SELECT IFNULL(MAX(num), -1) "
+                            "FROM main.history WHERE history.imgid = style_images.imgid)",
+                        NULL, NULL, NULL);
 
-    /* copy history items from styles onto temp table */
-    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "INSERT INTO memory.style_items SELECT * FROM "
-                                                               "data.style_items WHERE styleid=?1 ORDER BY "
-                                                               "multi_priority DESC",
-                                -1, &stmt, NULL);
-    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, id);
-    sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
+  /* delete all items from the temp styles_items, this table is used only to get a ROWNUM of the results */
+  DT_DEBUG_SQLITE3_EXEC(db, "DELETE FROM memory.style_items", NULL, NULL, NULL);
 
-    /* copy the style items into the history */
-    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                                "INSERT INTO main.history "
-                                "(imgid,num,module,operation,op_params,enabled,blendop_params,blendop_"
-                                "version,multi_priority,multi_name) SELECT "
-                                "?1,?2+rowid,module,operation,op_params,enabled,blendop_params,blendop_"
-                                "version,multi_priority,multi_name FROM memory.style_items",
-                                -1, &stmt, NULL);
-    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, newimgid);
-    DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, offs);
-    sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
+  /* copy history items from styles onto temp table */
+  DT_DEBUG_SQLITE3_PREPARE_V2(db, "INSERT INTO memory.style_items SELECT * FROM "
+                                  "data.style_items WHERE styleid=?1 ORDER BY "
+                                  "multi_priority DESC",
+                              -1, &stmt, NULL);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, id);
+  sqlite3_step(stmt);
+  sqlite3_finalize(stmt);
 
-    /* always make the whole stack active */
-    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                                "UPDATE main.images SET history_end = (SELECT MAX(num) + 1 FROM main.history "
-                                "WHERE imgid = ?1) WHERE id = ?1",
-                                -1, &stmt, NULL);
-    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, newimgid);
+  /* copy the style items into the history of all images */
+  DT_DEBUG_SQLITE3_EXEC(db, "INSERT INTO main.history "
+                            "(imgid,num,module,operation,op_params,enabled,blendop_params,blendop_"
+                            "version,multi_priority,multi_name) SELECT "
+                            "i.imgid,i.offs+s.rowid,s.module,s.operation,s.op_params,s.enabled,s.blendop_params,"
+                            "s.blendop_version,s.multi_priority,s.multi_name "
+                            "FROM memory.style_images AS i, memory.style_items AS s",
+                        NULL, NULL, NULL);
+
+  /* always make the whole stack active */
+  DT_DEBUG_SQLITE3_EXEC(db, "UPDATE main.images SET history_end = (SELECT MAX(num) + 1 FROM main.history "
+                            "WHERE imgid = images.id) WHERE id IN (SELECT imgid FROM memory.style_images)",
+                        NULL, NULL, NULL);
+
+  /* add tags */
+  DT_DEBUG_SQLITE3_PREPARE_V2(db, "INSERT OR REPLACE INTO main.tagged_images (imgid, tagid) "
+                                  "SELECT imgid, ?1 FROM memory.style_images",
+                              -1, &stmt, NULL);
+  if(style_tag)
+  {
+    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, style_tagid);
     sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
+    sqlite3_reset(stmt);
+  }
+  if(changed_tag)
+  {
+    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, changed_tagid);
+    sqlite3_step(stmt);
+  }
+  sqlite3_finalize(stmt);
 
-    /* add tag */
-    guint tagid = 0;
-    gchar ntag[512] = { 0 };
-    g_snprintf(ntag, sizeof(ntag), "darktable|style|%s", name);
-    if(dt_tag_new(ntag, &tagid)) dt_tag_attach(tagid, newimgid);
-    if(dt_tag_new("darktable|changed", &tagid)) dt_tag_attach(tagid, newimgid);
+  DT_DEBUG_SQLITE3_EXEC(db, "DELETE FROM memory.style_images", NULL, NULL, NULL);
+  sqlite3_exec(db, "COMMIT", NULL, NULL, NULL);
+
+  if(style_tag || changed_tag)
+  {
+    dt_tag_update_used_tags();
+    dt_collection_update_query(darktable.collection);
+  }
+
+  for(GList *iter = images; iter; iter = g_list_next(iter))
+  {
+    const int32_t newimgid = GPOINTER_TO_INT(iter->data);
 
     /* if current image in develop reload history */
     if(dt_dev_is_current_image(darktable.develop, newimgid))
@@ -592,18 +631,26 @@ void dt_styles_apply_to_image(const char *name, gboolean duplicate, int32_t imgi
       dt_dev_modulegroups_set(darktable.develop, dt_dev_modulegroups_get(darktable.develop));
     }
 
-    /* update xmp file */
+    /* update xmp file, the sidecar writers take care of it in the background */
     dt_image_synch_xmp(newimgid);
 
-    /* remove old obsolete thumbnails */
-    dt_mipmap_cache_remove(darktable.mipmap_cache, newimgid);
+    /* remove old obsolete thumbnails, the ones shown are regenerated in the background */
+    dt_mipmap_cache_invalidate(darktable.mipmap_cache, newimgid);
+  }
+  g_list_free(images);
 
-    /* if we have created a duplicate, reset collected images */
-    if(duplicate) dt_control_signal_raise(darktable.signals, DT_SIGNAL_COLLECTION_CHANGED);
+  /* if we have created a duplicate, reset collected images */
+  if(duplicate) dt_control_signal_raise(darktable.signals, DT_SIGNAL_COLLECTION_CHANGED);
 
-    /* redraw center view to update visible mipmaps */
-    dt_control_queue_redraw_center();
-  }
+  /* redraw center view to update visible mipmaps */
+  dt_control_queue_redraw_center();
+}
+
+void dt_styles_apply_to_image(const char *name, gboolean duplicate, int32_t imgid)
+{
+  GList *list = g_list_append(NULL, GINT_TO_POINTER(imgid));
+  dt_styles_apply_to_list(name, list, duplicate);
+  g_list_free(list);
 }
 
 void dt_styles_delete_by_name(const char *name)
@@ -68,6 +68,9 @@ void dt_styles_update(const char *name, const char *newname, const char *descrip
 /** applies the style to selection of images */
 void dt_styles_apply_to_selection(const char *name, gboolean duplicate);
 
+/** applies the style to the images of list, in one transaction for all of them */
+void dt_styles_apply_to_list(const char *name, GList *list, gboolean duplicate);
+
 /** applies the style to image by imgid*/
 void dt_styles_apply_to_image(const char *name, gboolean dulpicate, int32_t imgid);
 
@@ -22,11 +22,198 @@
 #include "common/debug.h"
 #include "control/conf.h"
 #include "control/control.h"
+#include "control/jobs.h"
 #include <glib.h>
 #if defined (_WIN32)
 #include "win/getdelim.h"
 #endif // defined (_WIN32)
 
+/*
+ * the names of all tags and how many images they are attached to, for the suggestions of the tagging ui. the
+ * search is on the beginnings of the hierarchy levels: every tag has a key per level, the rest of its name from
+ * there, casefolded, in one sorted array, so the tags starting with what was typed are found by a binary
+ * search. new and removed tags are put into the index right away, everything else marks it stale and it is
+ * rebuilt in the background.
+ */
+typedef struct dt_tag_index_entry_t
+{
+  guint id;
+  guint count;
+  gchar *name;
+  gchar *folded;
+  gboolean removed;
+} dt_tag_index_entry_t;
+
+typedef struct dt_tag_index_key_t
+{
+  const gchar *key; // into folded of entry
+  dt_tag_index_entry_t *entry;
+} dt_tag_index_key_t;
+
+typedef struct dt_tag_index_t
+{
+  GHashTable *entries; // id -> entry
+  GArray *keys;        // sorted by key
+} dt_tag_index_t;
+
+static GMutex _index_lock;
+static dt_tag_index_t *_index = NULL;
+static gboolean _index_stale = FALSE;
+static gboolean _index_building = FALSE;
+static gboolean _index_enabled = FALSE;
+
+static gchar *_index_fold(const gchar *name)
+{
+  gchar *normalized = g_utf8_normalize(name, -1, G_NORMALIZE_ALL);
+  gchar *folded = normalized ? g_utf8_casefold(normalized, -1) : g_strdup(name);
+  g_free(normalized);
+  return folded;
+}
+
+static void _index_entry_free(gpointer data)
+{
+  dt_tag_index_entry_t *entry = (dt_tag_index_entry_t *)data;
+  g_free(entry->name);
+  g_free(entry->folded);
+  free(entry);
+}
+
+static void _index_free(dt_tag_index_t *index)
+{
+  if(!index) return;
+  g_array_free(index->keys, TRUE);
+  g_hash_table_destroy(index->entries);
+  free(index);
+}
+
+static gint _index_key_cmp(gconstpointer a, gconstpointer b)
+{
+  return strcmp(((const dt_tag_index_key_t *)a)->key, ((const dt_tag_index_key_t *)b)->key);
+}
+
+// the first key not sorting before prefix
+static guint _index_lower_bound(const dt_tag_index_t *index, const gchar *prefix)
+{
+  guint lo = 0, hi = index->keys->len;
+  while(lo < hi)
+  {
+    const guint mid = lo + (hi - lo) / 2;
+    if(strcmp(g_array_index(index->keys, dt_tag_index_key_t, mid).key, prefix) < 0)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+// sorted tells whether to insert the keys in order right away, or leave sorting to the caller
+static void _index_add(dt_tag_index_t *index, const guint id, const gchar *name, const guint count,
+                       const gboolean sorted)
+{
+  dt_tag_index_entry_t *entry = (dt_tag_index_entry_t *)calloc(1, sizeof(dt_tag_index_entry_t));
+  entry->id = id;
+  entry->count = count;
+  entry->name = g_strdup(name);
+  entry->folded = _index_fold(name);
+  g_hash_table_insert(index->entries, GUINT_TO_POINTER(id), entry);
+
+  for(const gchar *level = entry->folded; level; level = strchr(level, '|'))
+  {
+    if(*level == '|') level++;
+    dt_tag_index_key_t key = { level, entry };
+    if(sorted)
+      g_array_insert_val(index->keys, _index_lower_bound(index, level), key);
+    else
+      g_array_append_val(index->keys, key);
+  }
+}
+
+static dt_tag_index_t *_index_build(void)
+{
+  dt_tag_index_t *index = (dt_tag_index_t *)calloc(1, sizeof(dt_tag_index_t));
+  index->entries = g_hash_table_new_full(NULL, NULL, NULL, _index_entry_free);
+  index->keys = g_array_new(FALSE, FALSE, sizeof(dt_tag_index_key_t));
+
+  sqlite3_stmt *stmt;
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                              "SELECT t.id, t.name, COUNT(i.tagid) FROM data.tags AS t "
+                              "LEFT JOIN main.tagged_images AS i ON i.tagid = t.id GROUP BY t.id",
+                              -1, &stmt, NULL);
+  while(sqlite3_step(stmt) == SQLITE_ROW)
+  {
+    const gchar *name = (const gchar *)sqlite3_column_text(stmt, 1);
+    if(name) _index_add(index, sqlite3_column_int(stmt, 0), name, sqlite3_column_int(stmt, 2), FALSE);
+  }
+  sqlite3_finalize(stmt);
+  g_array_sort(index->keys, _index_key_cmp);
+  return index;
+}
+
+static int32_t _index_job_run(dt_job_t *job)
+{
+  g_mutex_lock(&_index_lock);
+  while(_index_stale)
+  {
+    _index_stale = FALSE;
+    g_mutex_unlock(&_index_lock);
+    dt_tag_index_t *index = _index_build();
+    g_mutex_lock(&_index_lock);
+    dt_tag_index_t *old = _index;
+    _index = index;
+    _index_free(old);
+  }
+  _index_building = FALSE;
+  g_mutex_unlock(&_index_lock);
+  return 0;
+}
+
+// to be called with _index_lock held
+static void _index_invalidate_locked(void)
+{
+  if(!_index_enabled) return;
+  _index_stale = TRUE;
+  if(_index_building) return;
+
+  dt_job_t *job = dt_control_job_create(&_index_job_run, "build tag index");
+  if(!job) return;
+  _index_building = TRUE;
+  dt_control_add_job(darktable.control, DT_JOB_QUEUE_SYSTEM_BG, job);
+}
+
+static void _index_invalidate(void)
+{
+  g_mutex_lock(&_index_lock);
+  _index_invalidate_locked();
+  g_mutex_unlock(&_index_lock);
+}
+
+static void _index_tag_changed_callback(gpointer instance, gpointer user_data)
+{
+  _index_invalidate();
+}
+
+void dt_tag_init(void)
+{
+  g_mutex_lock(&_index_lock);
+  _index_enabled = TRUE;
+  _index_invalidate_locked();
+  g_mutex_unlock(&_index_lock);
+
+  dt_control_signal_connect(darktable.signals, DT_SIGNAL_TAG_CHANGED, G_CALLBACK(_index_tag_changed_callback),
+                            NULL);
+}
+
+void dt_tag_cleanup(void)
+{
+  dt_control_signal_disconnect(darktable.signals, G_CALLBACK(_index_tag_changed_callback), NULL);
+
+  g_mutex_lock(&_index_lock);
+  _index_enabled = FALSE;
+  _index_free(_index);
+  _index = NULL;
+  g_mutex_unlock(&_index_lock);
+}
+
 gboolean dt_tag_new(const char *name, guint *tagid)
 {
   int rt;
@@ -53,15 +240,20 @@ gboolean dt_tag_new(const char *name, guint *tagid)
   sqlite3_step(stmt);
   sqlite3_finalize(stmt);
 
-  if(tagid != NULL)
-  {
-    *tagid = 0;
-    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "SELECT id FROM data.tags WHERE name = ?1", -1,
-                                &stmt, NULL);
-    DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 1, name, -1, SQLITE_TRANSIENT);
-    if(sqlite3_step(stmt) == SQLITE_ROW) *tagid = sqlite3_column_int(stmt, 0);
-    sqlite3_finalize(stmt);
-  }
+  guint id = 0;
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "SELECT id FROM data.tags WHERE name = ?1", -1,
+                              &stmt, NULL);
+  DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 1, name, -1, SQLITE_TRANSIENT);
+  if(sqlite3_step(stmt) == SQLITE_ROW) id = sqlite3_column_int(stmt, 0);
+  sqlite3_finalize(stmt);
+  if(tagid != NULL) *tagid = id;
+
+  // suggest it right away, a rebuild running might have missed it
+  g_mutex_lock(&_index_lock);
+  if(_index && id && !g_hash_table_contains(_index->entries, GUINT_TO_POINTER(id)))
+    _index_add(_index, id, name, 0, TRUE);
+  if(_index_building) _index_stale = TRUE;
+  g_mutex_unlock(&_index_lock);
 
   return TRUE;
 }
@@ -107,6 +299,13 @@ guint dt_tag_remove(const guint tagid, gboolean final)
     sqlite3_step(stmt);
     sqlite3_finalize(stmt);
 
+    // its keys stay until the rebuild, skip it until then
+    g_mutex_lock(&_index_lock);
+    dt_tag_index_entry_t *entry = _index ? g_hash_table_lookup(_index->entries, GUINT_TO_POINTER(tagid)) : NULL;
+    if(entry) entry->removed = TRUE;
+    _index_invalidate_locked();
+    g_mutex_unlock(&_index_lock);
+
     /* raise signal of tags change to refresh keywords module */
     dt_control_signal_raise(darktable.signals, DT_SIGNAL_TAG_CHANGED);
   }
@@ -168,6 +367,8 @@ void dt_tag_reorganize(const gchar *source, const gchar *dest)
   g_free(source_expr);
   g_free(new_expr);
 
+  _index_invalidate();
+
   /* raise signal of tags change to refresh keywords module */
   // dt_control_signal_raise(darktable.signals, DT_SIGNAL_TAG_CHANGED);
 }
@@ -176,20 +377,19 @@ gboolean dt_tag_exists(const char *name, guint *tagid)
 {
   int rt;
   sqlite3_stmt *stmt;
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "SELECT id FROM data.tags WHERE name = ?1", -1, &stmt,
-                              NULL);
+  DT_DEBUG_SQLITE3_PREPARE_CACHED(darktable.db, "SELECT id FROM data.tags WHERE name = ?1", &stmt);
   DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 1, name, -1, SQLITE_TRANSIENT);
   rt = sqlite3_step(stmt);
 
   if(rt == SQLITE_ROW)
   {
     if(tagid != NULL) *tagid = sqlite3_column_int64(stmt, 0);
-    sqlite3_finalize(stmt);
+    dt_database_release_cached(darktable.db, stmt);
     return TRUE;
   }
 
   *tagid = -1;
-  sqlite3_finalize(stmt);
+  dt_database_release_cached(darktable.db, stmt);
   return FALSE;
 }
 
@@ -199,24 +399,23 @@ static void _attach_tag(guint tagid, gint imgid)
   sqlite3_stmt *stmt;
   if(imgid > 0)
   {
-    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                                "INSERT OR REPLACE INTO main.tagged_images (imgid, tagid) VALUES (?1, ?2)", -1,
-                                &stmt, NULL);
+    DT_DEBUG_SQLITE3_PREPARE_CACHED(darktable.db,
+                                    "INSERT OR REPLACE INTO main.tagged_images (imgid, tagid) VALUES (?1, ?2)",
+                                    &stmt);
     DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
     DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, tagid);
     sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
+    dt_database_release_cached(darktable.db, stmt);
   }
   else
   {
     // insert into tagged_images if not there already.
-    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                                "INSERT OR REPLACE INTO main.tagged_images SELECT imgid, ?1 "
-                                "FROM main.selected_images",
-                                -1, &stmt, NULL);
+    DT_DEBUG_SQLITE3_PREPARE_CACHED(darktable.db,
+                                    "INSERT OR REPLACE INTO main.tagged_images SELECT imgid, ?1 "
+                                    "FROM main.selected_images", &stmt);
     DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, tagid);
     sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
+    dt_database_release_cached(darktable.db, stmt);
   }
 }
 
@@ -278,23 +477,22 @@ void dt_tag_detach(guint tagid, gint imgid)
   if(imgid > 0)
   {
     // remove from tagged_images
-    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                                "DELETE FROM main.tagged_images WHERE tagid = ?1 AND imgid = ?2", -1, &stmt, NULL);
+    DT_DEBUG_SQLITE3_PREPARE_CACHED(darktable.db,
+                                    "DELETE FROM main.tagged_images WHERE tagid = ?1 AND imgid = ?2", &stmt);
     DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, tagid);
     DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, imgid);
     sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
+    dt_database_release_cached(darktable.db, stmt);
   }
   else
   {
     // remove from tagged_images
-    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                                "DELETE FROM main.tagged_images WHERE tagid = ?1 AND imgid IN "
-                                "(SELECT imgid FROM main.selected_images)",
-                                -1, &stmt, NULL);
+    DT_DEBUG_SQLITE3_PREPARE_CACHED(darktable.db,
+                                    "DELETE FROM main.tagged_images WHERE tagid = ?1 AND imgid IN "
+                                    "(SELECT imgid FROM main.selected_images)", &stmt);
     DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, tagid);
     sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
+    dt_database_release_cached(darktable.db, stmt);
   }
 
   dt_tag_update_used_tags();
@@ -305,14 +503,13 @@ void dt_tag_detach(guint tagid, gint imgid)
 void dt_tag_detach_by_string(const char *name, gint imgid)
 {
   sqlite3_stmt *stmt;
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                              "DELETE FROM main.tagged_images WHERE tagid IN (SELECT id FROM "
-                              "data.tags WHERE name LIKE ?1) AND imgid = ?2;",
-                              -1, &stmt, NULL);
+  DT_DEBUG_SQLITE3_PREPARE_CACHED(darktable.db,
+                                  "DELETE FROM main.tagged_images WHERE tagid IN (SELECT id FROM "
+                                  "data.tags WHERE name LIKE ?1) AND imgid = ?2;", &stmt);
   DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 1, name, -1, SQLITE_TRANSIENT);
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, imgid);
   sqlite3_step(stmt);
-  sqlite3_finalize(stmt);
+  dt_database_release_cached(darktable.db, stmt);
 
   dt_tag_update_used_tags();
 
@@ -481,38 +678,72 @@ uint32_t dt_tag_get_suggestions(const gchar *keyword, GList **result)
   /* Quick sanity check - is keyword empty? If so .. return 0 */
   if(keyword == 0) return 0;
 
-  gchar *keyword_expr = g_strdup_printf("%%%s%%", keyword);
+  g_mutex_lock(&_index_lock);
+  if(_index)
+  {
+    /* Tags with a hierarchy level starting with the keyword, used ones first */
+    gchar *prefix = _index_fold(keyword);
+    const size_t len = strlen(prefix);
+    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                                "INSERT INTO memory.taglist (id, count) VALUES (?1, ?2)", -1, &stmt, NULL);
+    for(guint k = _index_lower_bound(_index, prefix); k < _index->keys->len; k++)
+    {
+      const dt_tag_index_key_t *key = &g_array_index(_index->keys, dt_tag_index_key_t, k);
+      if(strncmp(key->key, prefix, len)) break;
+      if(key->entry->removed) continue;
+      DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, key->entry->id);
+      DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, 1000000 + key->entry->count);
+      sqlite3_step(stmt);
+      sqlite3_reset(stmt);
+    }
+    sqlite3_finalize(stmt);
+    g_mutex_unlock(&_index_lock);
+    g_free(prefix);
+
+    /* Select tags from tagged images when at least one tag matches the keyword and insert in temp table*/
+    DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db),
+                          "INSERT INTO memory.tagq (id) SELECT tagid FROM main.tagged_images WHERE "
+                          "imgid IN (SELECT DISTINCT imgid FROM main.tagged_images WHERE tagid IN "
+                          "(SELECT id FROM memory.taglist)) ",
+                          NULL, NULL, NULL);
+  }
+  else
+  {
+    /* The index isn't built yet, search the database */
+    g_mutex_unlock(&_index_lock);
+    gchar *keyword_expr = g_strdup_printf("%%%s%%", keyword);
 
-  /* Select tags that are similar to the keyword and are actually used to tag images*/
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                              "INSERT INTO memory.taglist (id, count) SELECT tagid, 1000000+COUNT(*) "
-                              "FROM main.tagged_images "
-                              "WHERE tagid IN (SELECT id FROM data.tags WHERE name LIKE ?1) GROUP BY tagid ",
-                              -1, &stmt, NULL);
-  DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 1, keyword_expr, -1, SQLITE_TRANSIENT);
-  sqlite3_step(stmt);
-  sqlite3_finalize(stmt);
+    /* Select tags that are similar to the keyword and are actually used to tag images*/
+    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                                "INSERT INTO memory.taglist (id, count) SELECT tagid, 1000000+COUNT(*) "
+                                "FROM main.tagged_images "
+                                "WHERE tagid IN (SELECT id FROM data.tags WHERE name LIKE ?1) GROUP BY tagid ",
+                                -1, &stmt, NULL);
+    DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 1, keyword_expr, -1, SQLITE_TRANSIENT);
+    sqlite3_step(stmt);
+    sqlite3_finalize(stmt);
 
-  /* Select tags that are similar to the keyword but were not used to tag any image*/
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                              "INSERT INTO memory.taglist (id, count) SELECT id,1000000 FROM data.tags WHERE "
-                              "name LIKE ?1 AND id NOT IN (SELECT id FROM memory.taglist)",
-                              -1, &stmt, NULL);
-  DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 1, keyword_expr, -1, SQLITE_TRANSIENT);
-  sqlite3_step(stmt);
-  sqlite3_finalize(stmt);
+    /* Select tags that are similar to the keyword but were not used to tag any image*/
+    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                                "INSERT INTO memory.taglist (id, count) SELECT id,1000000 FROM data.tags WHERE "
+                                "name LIKE ?1 AND id NOT IN (SELECT id FROM memory.taglist)",
+                                -1, &stmt, NULL);
+    DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 1, keyword_expr, -1, SQLITE_TRANSIENT);
+    sqlite3_step(stmt);
+    sqlite3_finalize(stmt);
 
-  /* Select tags from tagged images when at least one tag is similar to the keyword and insert in temp table*/
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                              "INSERT INTO memory.tagq (id) SELECT tagid FROM main.tagged_images WHERE "
-                              "imgid IN (SELECT DISTINCT imgid FROM main.tagged_images WHERE tagid IN "
-                              "(SELECT id FROM data.tags WHERE name LIKE ?1)) ",
-                              -1, &stmt, NULL);
-  DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 1, keyword_expr, -1, SQLITE_TRANSIENT);
-  sqlite3_step(stmt);
-  sqlite3_finalize(stmt);
+    /* Select tags from tagged images when at least one tag is similar to the keyword and insert in temp table*/
+    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                                "INSERT INTO memory.tagq (id) SELECT tagid FROM main.tagged_images WHERE "
+                                "imgid IN (SELECT DISTINCT imgid FROM main.tagged_images WHERE tagid IN "
+                                "(SELECT id FROM data.tags WHERE name LIKE ?1)) ",
+                                -1, &stmt, NULL);
+    DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 1, keyword_expr, -1, SQLITE_TRANSIENT);
+    sqlite3_step(stmt);
+    sqlite3_finalize(stmt);
 
-  g_free(keyword_expr);
+    g_free(keyword_expr);
+  }
 
   /* Select tags from temp table that are not similar to the keyword */
   DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), "INSERT INTO memory.taglist (id, count) SELECT id, "
@@ -724,6 +955,9 @@ ssize_t dt_tag_export(const char *filename)
 
 void dt_tag_update_used_tags()
 {
+  // the counts of attached images changed
+  _index_invalidate();
+
   DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), "DELETE FROM main.used_tags WHERE id NOT IN "
                                                        "(SELECT tagid FROM main.tagged_images GROUP BY tagid)",
                         NULL, NULL, NULL);
@@ -28,6 +28,10 @@ typedef struct dt_tag_t
   gchar *tag;
 } dt_tag_t;
 
+/** builds the index of tag names the suggestions are searched in, in the background, and keeps it up to date */
+void dt_tag_init(void);
+void dt_tag_cleanup(void);
+
 /** creates a new tag, returns tagid \param[in] name the tag name. \param[in] tagid a pointer to tagid of new
  * tag, this can be NULL \return false if failed to create a tag and indicates that tagid is invalid to use.
  * \note If tag already exists the existing tag id is returned. */
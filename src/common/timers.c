@@ -0,0 +1,283 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2017 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "common/timers.h"
+#include "common/darktable.h"
+#include "control/conf.h"
+
+#include <stdio.h>
+#include <string.h>
+
+// four buckets per doubling, the last one takes everything from about an hour on
+#define DT_TIMERS_BUCKETS 128
+// per thread cache of the nodes looked up last, has to be a power of two
+#define DT_TIMERS_LOOKUP 64
+
+typedef struct dt_timers_node_t
+{
+  char *name;
+  struct dt_timers_node_t *parent;
+  GPtrArray *children; // in the order they showed up, only changed with the lock held
+  // updated atomically by dt_timer_end():
+  uint64_t count;
+  int64_t total, min, max;
+  uint32_t histogram[DT_TIMERS_BUCKETS];
+} dt_timers_node_t;
+
+int dt_timers_enabled = 0;
+
+static struct
+{
+  int initialized;
+  dt_pthread_mutex_t lock; // protects the tree structure
+  dt_timers_node_t root;
+  int64_t interval;     // between summaries, in microseconds, 0 to print at exit only
+  int64_t next_summary;
+} _timers = { 0 };
+
+static __thread dt_timers_node_t *_current = NULL;
+static __thread struct
+{
+  const dt_timers_node_t *parent;
+  const char *name;
+  dt_timers_node_t *node;
+} _lookup[DT_TIMERS_LOOKUP];
+
+static inline int _bucket(const int64_t us)
+{
+  if(us < 4) return MAX(us, 0);
+  const int msb = 63 - __builtin_clzll((unsigned long long)us);
+  return MIN(4 * (msb - 1) + (int)((us >> (msb - 2)) & 3), DT_TIMERS_BUCKETS - 1);
+}
+
+// the middle of what falls into bucket b
+static inline int64_t _bucket_value(const int b)
+{
+  if(b < 4) return b;
+  const int msb = b / 4 + 1;
+  const int64_t lower = (int64_t)(4 + b % 4) << (msb - 2);
+  return lower + ((int64_t)1 << (msb - 2)) / 2;
+}
+
+static void _node_clear(dt_timers_node_t *node)
+{
+  node->count = 0;
+  node->total = 0;
+  node->min = INT64_MAX;
+  node->max = 0;
+  memset(node->histogram, 0, sizeof(node->histogram));
+}
+
+static void _node_free(dt_timers_node_t *node)
+{
+  for(guint k = 0; k < node->children->len; k++)
+  {
+    dt_timers_node_t *child = (dt_timers_node_t *)g_ptr_array_index(node->children, k);
+    _node_free(child);
+    g_free(child->name);
+    g_free(child);
+  }
+  g_ptr_array_free(node->children, TRUE);
+  node->children = NULL;
+}
+
+void dt_timers_init(void)
+{
+  dt_pthread_mutex_init(&_timers.lock, NULL);
+  _timers.root.name = (char *)"";
+  _timers.root.parent = NULL;
+  _timers.root.children = g_ptr_array_new();
+  _node_clear(&_timers.root);
+  _timers.interval = (int64_t)MAX(dt_conf_get_int("timers_summary_interval"), 0) * 1000000;
+  _timers.next_summary = g_get_monotonic_time() + _timers.interval;
+  _timers.initialized = 1;
+  dt_timers_set_enabled(darktable.unmuted & DT_DEBUG_TIMERS);
+}
+
+void dt_timers_cleanup(void)
+{
+  if(!_timers.initialized) return;
+  dt_timers_set_enabled(0);
+  dt_timers_print();
+  _timers.initialized = 0;
+  _node_free(&_timers.root);
+  dt_pthread_mutex_destroy(&_timers.lock);
+}
+
+void dt_timers_set_enabled(const int enabled)
+{
+  dt_timers_enabled = enabled && _timers.initialized;
+}
+
+static dt_timers_node_t *_child(dt_timers_node_t *parent, const char *name)
+{
+  const int slot = (((uintptr_t)parent >> 4) ^ ((uintptr_t)name >> 3)) & (DT_TIMERS_LOOKUP - 1);
+  // the name might be a buffer that is reused with something else in it
+  if(_lookup[slot].parent == parent && _lookup[slot].name == name && !strcmp(_lookup[slot].node->name, name))
+    return _lookup[slot].node;
+
+  dt_timers_node_t *node = NULL;
+  dt_pthread_mutex_lock(&_timers.lock);
+  for(guint k = 0; k < parent->children->len && !node; k++)
+  {
+    dt_timers_node_t *child = (dt_timers_node_t *)g_ptr_array_index(parent->children, k);
+    if(!strcmp(child->name, name)) node = child;
+  }
+  if(!node)
+  {
+    node = (dt_timers_node_t *)g_malloc(sizeof(dt_timers_node_t));
+    node->name = g_strdup(name);
+    node->parent = parent;
+    node->children = g_ptr_array_new();
+    _node_clear(node);
+    g_ptr_array_add(parent->children, node);
+  }
+  dt_pthread_mutex_unlock(&_timers.lock);
+
+  _lookup[slot].parent = parent;
+  _lookup[slot].name = name;
+  _lookup[slot].node = node;
+  return node;
+}
+
+void dt_timer_begin_real(dt_timer_scope_t *scope, const char *name)
+{
+  scope->parent = _current;
+  scope->node = _child(_current ? _current : &_timers.root, name);
+  _current = scope->node;
+  scope->start = g_get_monotonic_time();
+}
+
+void dt_timer_end_real(dt_timer_scope_t *scope)
+{
+  const int64_t now = g_get_monotonic_time();
+  const int64_t us = now - scope->start;
+  dt_timers_node_t *node = scope->node;
+  _current = scope->parent;
+  scope->node = NULL;
+
+  __sync_fetch_and_add(&node->count, 1);
+  __sync_fetch_and_add(&node->total, us);
+  __sync_fetch_and_add(&node->histogram[_bucket(us)], 1);
+  for(int64_t min = node->min; us < min && !__sync_bool_compare_and_swap(&node->min, min, us);)
+    min = node->min;
+  for(int64_t max = node->max; us > max && !__sync_bool_compare_and_swap(&node->max, max, us);)
+    max = node->max;
+
+  // one thread gets to print the summary
+  const int64_t next = _timers.next_summary;
+  if(_timers.interval && now >= next
+     && __sync_bool_compare_and_swap(&_timers.next_summary, next, now + _timers.interval))
+    dt_timers_print();
+}
+
+static int64_t _percentile(const dt_timers_node_t *node, const uint64_t count, const double p)
+{
+  const uint64_t rank = MAX(1, (uint64_t)(p * count + 0.5));
+  uint64_t seen = 0;
+  for(int b = 0; b < DT_TIMERS_BUCKETS; b++)
+  {
+    seen += node->histogram[b];
+    if(seen >= rank) return CLAMP(_bucket_value(b), node->min, node->max);
+  }
+  return node->max;
+}
+
+static void _collect(const dt_timers_node_t *node, const char *path, const int depth, GArray *stats)
+{
+  for(guint k = 0; k < node->children->len; k++)
+  {
+    const dt_timers_node_t *child = (const dt_timers_node_t *)g_ptr_array_index(node->children, k);
+    dt_timers_stat_t s;
+    s.path = path ? g_strconcat(path, "/", child->name, NULL) : g_strdup(child->name);
+    s.depth = depth;
+    s.count = child->count;
+    s.total = child->total;
+    s.min = s.count ? child->min : 0;
+    s.max = child->max;
+    s.p50 = s.count ? _percentile(child, s.count, 0.5) : 0;
+    s.p95 = s.count ? _percentile(child, s.count, 0.95) : 0;
+    g_array_append_val(stats, s);
+    _collect(child, s.path, depth + 1, stats);
+  }
+}
+
+int dt_timers_get_stats(dt_timers_stat_t **stats)
+{
+  *stats = NULL;
+  if(!_timers.initialized) return 0;
+  GArray *a = g_array_new(FALSE, FALSE, sizeof(dt_timers_stat_t));
+  dt_pthread_mutex_lock(&_timers.lock);
+  _collect(&_timers.root, NULL, 0, a);
+  dt_pthread_mutex_unlock(&_timers.lock);
+  const int count = a->len;
+  *stats = (dt_timers_stat_t *)g_array_free(a, FALSE);
+  return count;
+}
+
+void dt_timers_free_stats(dt_timers_stat_t *stats, const int count)
+{
+  for(int k = 0; k < count; k++) g_free(stats[k].path);
+  g_free(stats);
+}
+
+static void _reset(dt_timers_node_t *node)
+{
+  for(guint k = 0; k < node->children->len; k++)
+  {
+    dt_timers_node_t *child = (dt_timers_node_t *)g_ptr_array_index(node->children, k);
+    _node_clear(child);
+    _reset(child);
+  }
+}
+
+void dt_timers_reset(void)
+{
+  if(!_timers.initialized) return;
+  // the nodes stay, threads might be in the middle of a timer
+  dt_pthread_mutex_lock(&_timers.lock);
+  _reset(&_timers.root);
+  dt_pthread_mutex_unlock(&_timers.lock);
+}
+
+void dt_timers_print(void)
+{
+  if(!(darktable.unmuted & DT_DEBUG_TIMERS)) return;
+  dt_timers_stat_t *stats = NULL;
+  const int count = dt_timers_get_stats(&stats);
+  if(!count) return;
+  dt_print(DT_DEBUG_TIMERS, "[timers] %-40s %8s %10s %9s %9s %9s %9s\n", "name", "count", "total ms", "min ms",
+           "p50 ms", "p95 ms", "max ms");
+  for(int k = 0; k < count; k++)
+  {
+    const dt_timers_stat_t *s = stats + k;
+    const char *name = strrchr(s->path, '/');
+    name = name ? name + 1 : s->path;
+    dt_print(DT_DEBUG_TIMERS, "[timers] %*s%-*s %8" PRIu64 " %10.2f %9.3f %9.3f %9.3f %9.3f\n", 2 * s->depth, "",
+             MAX(40 - 2 * s->depth, 1), name, s->count, s->total / 1000.0, s->min / 1000.0, s->p50 / 1000.0,
+             s->p95 / 1000.0, s->max / 1000.0);
+  }
+  dt_timers_free_stats(stats, count);
+}
+
+#undef DT_TIMERS_BUCKETS
+#undef DT_TIMERS_LOOKUP
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
@@ -0,0 +1,86 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2017 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <inttypes.h>
+
+/**
+ * nestable timers aggregated per name for `-d timers`. a timer started while another one runs on the same thread
+ * is counted as its child, so the same name shows up separately in every place it is used from. every node
+ * keeps count, total, min, max and a log scale histogram for the median and 95th percentile. the tree is
+ * printed every timers_summary_interval seconds and at exit, and lua can read it through darktable.perf.
+ * while disabled a timer costs one branch.
+ */
+
+struct dt_timers_node_t;
+
+typedef struct dt_timer_scope_t
+{
+  struct dt_timers_node_t *node, *parent; // NULL if timers were off when it started
+  int64_t start;
+} dt_timer_scope_t;
+
+/** one line of the summary, times in microseconds. */
+typedef struct dt_timers_stat_t
+{
+  char *path; // names from the root, separated by '/'
+  int depth;
+  uint64_t count;
+  int64_t total, min, max, p50, p95;
+} dt_timers_stat_t;
+
+extern int dt_timers_enabled;
+
+void dt_timers_init(void);
+void dt_timers_cleanup(void);
+
+/** switches collecting on or off, what was collected is kept. */
+void dt_timers_set_enabled(const int enabled);
+
+void dt_timer_begin_real(dt_timer_scope_t *scope, const char *name);
+void dt_timer_end_real(dt_timer_scope_t *scope);
+
+/** name has to stay valid until dt_timer_end(), it is copied when it shows up for the first time. */
+static inline void dt_timer_begin(dt_timer_scope_t *scope, const char *name)
+{
+  scope->node = 0;
+  if(dt_timers_enabled) dt_timer_begin_real(scope, name);
+}
+
+static inline void dt_timer_end(dt_timer_scope_t *scope)
+{
+  if(scope->node) dt_timer_end_real(scope);
+}
+
+/** times the rest of the enclosing block. */
+#define DT_TIMER_SCOPE(scope, name)                                                                               \
+  dt_timer_scope_t scope __attribute__((cleanup(dt_timer_end)));                                                 \
+  dt_timer_begin(&scope, name)
+
+/** the whole tree in depth first order, to be freed with dt_timers_free_stats(). returns the number of lines. */
+int dt_timers_get_stats(dt_timers_stat_t **stats);
+void dt_timers_free_stats(dt_timers_stat_t *stats, const int count);
+/** forgets everything collected so far. */
+void dt_timers_reset(void);
+/** prints the tree with `-d timers`. */
+void dt_timers_print(void);
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
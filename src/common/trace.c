@@ -0,0 +1,201 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2017 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "common/trace.h"
+#include "common/darktable.h"
+#include "common/file_location.h"
+
+#include <glib/gstdio.h>
+#include <stdio.h>
+#include <string.h>
+
+// opencl devices get tracks of their own, far away from the thread ids
+#define DT_TRACE_DEVICE_TID 1000
+
+static struct
+{
+  GMutex lock; // serializes writing the file
+  FILE *f;
+  int enabled;
+  int events;
+  int next_tid;
+  uint64_t named_devices;
+} _trace = { { 0 } };
+
+static __thread int _tid = 0;
+static __thread char _thread_name[32] = { 0 };
+
+// json string, escaping what has to be
+static void _write_string(const char *str)
+{
+  fputc('"', _trace.f);
+  for(const unsigned char *c = (const unsigned char *)str; *c; c++)
+  {
+    if(*c == '"' || *c == '\\')
+      fprintf(_trace.f, "\\%c", *c);
+    else if(*c < 0x20)
+      fprintf(_trace.f, "\\u%04x", *c);
+    else
+      fputc(*c, _trace.f);
+  }
+  fputc('"', _trace.f);
+}
+
+// starts a new event object, expects the lock to be held
+static void _begin_event()
+{
+  fputs(_trace.events++ ? ",\n{" : "{", _trace.f);
+}
+
+static void _write_thread_name(const int tid, const char *name)
+{
+  _begin_event();
+  fprintf(_trace.f, "\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":", tid);
+  _write_string(name);
+  fputs("}}", _trace.f);
+}
+
+// id of the current thread's track, expects the lock to be held
+static int _thread_id()
+{
+  if(!_tid)
+  {
+    _tid = ++_trace.next_tid;
+    if(_thread_name[0]) _write_thread_name(_tid, _thread_name);
+  }
+  return _tid;
+}
+
+static void _write_time(const char *key, const double usec)
+{
+  char buf[G_ASCII_DTOSTR_BUF_SIZE];
+  fprintf(_trace.f, ",\"%s\":%s", key, g_ascii_formatd(buf, sizeof(buf), "%.3f", usec));
+}
+
+void dt_trace_init(void)
+{
+  if(!(darktable.unmuted & DT_DEBUG_TRACE)) return;
+
+  g_mutex_init(&_trace.lock);
+  char cachedir[PATH_MAX] = { 0 };
+  dt_loc_get_user_cache_dir(cachedir, sizeof(cachedir));
+  gchar *filename = g_build_filename(cachedir, "darktable-trace.json", NULL);
+  _trace.f = g_fopen(filename, "wb");
+  if(!_trace.f)
+  {
+    fprintf(stderr, "[trace] could not open `%s' for writing\n", filename);
+    g_free(filename);
+    return;
+  }
+  fprintf(stderr, "[trace] writing trace events to `%s'\n", filename);
+  g_free(filename);
+
+  fputs("[\n", _trace.f);
+  _begin_event();
+  fputs("\"ph\":\"M\",\"name\":\"process_name\",\"pid\":1,\"args\":{\"name\":\"darktable\"}}", _trace.f);
+  _trace.enabled = 1;
+}
+
+void dt_trace_cleanup(void)
+{
+  if(!_trace.f) return;
+
+  g_mutex_lock(&_trace.lock);
+  _trace.enabled = 0;
+  fputs("\n]\n", _trace.f);
+  fclose(_trace.f);
+  _trace.f = NULL;
+  g_mutex_unlock(&_trace.lock);
+}
+
+int dt_trace_enabled(void)
+{
+  return _trace.enabled;
+}
+
+int64_t dt_trace_now(void)
+{
+  return g_get_monotonic_time();
+}
+
+void dt_trace_span(const char *category, const char *name, const int64_t start, const char *detail)
+{
+  if(!_trace.enabled) return;
+  const int64_t end = dt_trace_now();
+
+  g_mutex_lock(&_trace.lock);
+  if(_trace.enabled)
+  {
+    const int tid = _thread_id();
+    _begin_event();
+    fputs("\"ph\":\"X\",\"cat\":", _trace.f);
+    _write_string(category);
+    fputs(",\"name\":", _trace.f);
+    _write_string(name);
+    fprintf(_trace.f, ",\"pid\":1,\"tid\":%d,\"ts\":%" PRId64 ",\"dur\":%" PRId64, tid, start, end - start);
+    if(detail)
+    {
+      fputs(",\"args\":{\"detail\":", _trace.f);
+      _write_string(detail);
+      fputc('}', _trace.f);
+    }
+    fputc('}', _trace.f);
+  }
+  g_mutex_unlock(&_trace.lock);
+}
+
+void dt_trace_device_span(const int devid, const char *name, const double start, const double duration)
+{
+  if(!_trace.enabled || devid < 0) return;
+
+  g_mutex_lock(&_trace.lock);
+  if(_trace.enabled)
+  {
+    const int tid = DT_TRACE_DEVICE_TID + devid;
+    if(devid < 64 && !(_trace.named_devices & ((uint64_t)1 << devid)))
+    {
+      _trace.named_devices |= (uint64_t)1 << devid;
+      gchar *track = g_strdup_printf("opencl device %d", devid);
+      _write_thread_name(tid, track);
+      g_free(track);
+    }
+    _begin_event();
+    fputs("\"ph\":\"X\",\"cat\":\"opencl\",\"name\":", _trace.f);
+    _write_string(name);
+    fprintf(_trace.f, ",\"pid\":1,\"tid\":%d", tid);
+    _write_time("ts", start);
+    _write_time("dur", duration);
+    fputc('}', _trace.f);
+  }
+  g_mutex_unlock(&_trace.lock);
+}
+
+void dt_trace_thread_name(const char *name)
+{
+  g_strlcpy(_thread_name, name, sizeof(_thread_name));
+  if(!_trace.enabled || !_tid) return;
+
+  // the track exists already, rename it
+  g_mutex_lock(&_trace.lock);
+  if(_trace.enabled) _write_thread_name(_tid, _thread_name);
+  g_mutex_unlock(&_trace.lock);
+}
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
@@ -0,0 +1,51 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2017 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <inttypes.h>
+
+/**
+ * timeline of control jobs, pixelpipe runs and modules, mipmap loads, opencl device waits
+ * and kernels for `-d trace`. written in the trace event format to darktable-trace.json in
+ * the user cache dir, to be opened in chrome://tracing or perfetto. cpu spans go to the
+ * track of the thread they ran on, opencl kernels to one track per device.
+ */
+
+/** opens the trace file if `-d trace` was given. */
+void dt_trace_init(void);
+void dt_trace_cleanup(void);
+
+/** non-zero while a trace is written. */
+int dt_trace_enabled(void);
+
+/** monotonic timestamp in microseconds, the time base of all spans. */
+int64_t dt_trace_now(void);
+
+/** a span from start until now on the current thread. detail is optional and shows up as argument. */
+void dt_trace_span(const char *category, const char *name, const int64_t start, const char *detail);
+
+/** a span of known duration on the track of an opencl device, in microseconds as well. */
+void dt_trace_device_span(const int devid, const char *name, const double start, const double duration);
+
+/** names the track of the current thread, see dt_pthread_setname(). */
+void dt_trace_thread_name(const char *name);
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
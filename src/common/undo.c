@@ -18,12 +18,28 @@
 
 #include "common/darktable.h"
 #include "common/undo.h"
+#include "control/conf.h"
 #include <glib.h>    // for GList, gpointer, g_list_first, g_list_prepend
 #include <stdlib.h>  // for NULL, malloc, free
+#include <string.h>  // for memcmp
 #include <sys/time.h>
 
 const double MAX_TIME_PERIOD = 0.5; // in second
 
+//  the bytes in front of the data of a blob, which keep its data 16 byte aligned
+typedef union dt_undo_blob_header_t
+{
+  struct
+  {
+    size_t size;
+    int refs;
+  } b;
+  char align[16];
+} dt_undo_blob_header_t;
+
+//  the memory all blobs take
+static size_t _blob_memory = 0;
+
 typedef struct dt_undo_item_t
 {
   gpointer user_data;
@@ -56,6 +72,20 @@ static void _free_undo_data(void *p)
   free(item);
 }
 
+//  drops the oldest undo items while the blobs take more than undo_memory. the first one holds the current state
+//  and always stays.
+static void _undo_compact(dt_undo_t *self)
+{
+  const size_t budget = (size_t)MAX(0, dt_conf_get_int("undo_memory")) << 20;
+  while(__sync_fetch_and_add(&_blob_memory, 0) > budget)
+  {
+    GList *last = g_list_last(self->undo_list);
+    if(!last || last == self->undo_list) break;
+    _free_undo_data(last->data);
+    self->undo_list = g_list_delete_link(self->undo_list, last);
+  }
+}
+
 void dt_undo_record(dt_undo_t *self, gpointer user_data, dt_undo_type_t type, dt_undo_data_t *data,
                     void (*undo)(gpointer user_data, dt_undo_type_t type, dt_undo_data_t *item),
                     void (*free_data)(gpointer data))
@@ -77,6 +107,8 @@ void dt_undo_record(dt_undo_t *self, gpointer user_data, dt_undo_type_t type, dt
   // recording an undo data invalidate all the redo
   g_list_free_full(self->redo_list, _free_undo_data);
   self->redo_list = NULL;
+
+  _undo_compact(self);
   dt_pthread_mutex_unlock(&self->mutex);
 }
 
@@ -245,6 +277,45 @@ void dt_undo_iterate(dt_undo_t *self, uint32_t filter, gpointer user_data,
   dt_pthread_mutex_unlock(&self->mutex);
 }
 
+void *dt_undo_blob_new(const size_t size)
+{
+  dt_undo_blob_header_t *header = (dt_undo_blob_header_t *)malloc(sizeof(dt_undo_blob_header_t) + size);
+  if(!header) return NULL;
+  header->b.size = size;
+  header->b.refs = 1;
+  __sync_fetch_and_add(&_blob_memory, sizeof(dt_undo_blob_header_t) + size);
+  return header + 1;
+}
+
+void *dt_undo_blob_ref(void *blob)
+{
+  if(blob) __sync_fetch_and_add(&((dt_undo_blob_header_t *)blob - 1)->b.refs, 1);
+  return blob;
+}
+
+void dt_undo_blob_unref(void *blob)
+{
+  if(!blob) return;
+  dt_undo_blob_header_t *header = (dt_undo_blob_header_t *)blob - 1;
+  if(__sync_sub_and_fetch(&header->b.refs, 1)) return;
+  __sync_fetch_and_sub(&_blob_memory, sizeof(dt_undo_blob_header_t) + header->b.size);
+  free(header);
+}
+
+size_t dt_undo_blob_size(const void *blob)
+{
+  return ((const dt_undo_blob_header_t *)blob - 1)->b.size;
+}
+
+void *dt_undo_blob_share(void *blob, void *other)
+{
+  if(!blob || !other || blob == other) return blob;
+  const size_t size = dt_undo_blob_size(blob);
+  if(dt_undo_blob_size(other) != size || memcmp(blob, other, size)) return blob;
+  dt_undo_blob_unref(blob);
+  return dt_undo_blob_ref(other);
+}
+
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
 // kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
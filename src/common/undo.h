@@ -20,6 +20,7 @@
 
 #include "common/dtpthread.h"  // for dt_pthread_mutex_t
 #include <glib.h>              // for gpointer, GList
+#include <stddef.h>            // for size_t
 #include <stdint.h>            // for uint32_t
 
 //  types that are known by the undo module
@@ -64,6 +65,21 @@ void dt_undo_iterate_internal(dt_undo_t *self, uint32_t filter, gpointer user_da
 void dt_undo_iterate(dt_undo_t *self, uint32_t filter, gpointer user_data,
                      void (*apply)(gpointer user_data, dt_undo_type_t type, dt_undo_data_t *item));
 
+//  reference counted buffers for the data of undo items, so that an item can share the parts that did not
+//  change with the one before instead of holding a copy of everything. their contents must not change once
+//  they are recorded. while all of them together take more than undo_memory, dt_undo_record() drops the
+//  oldest undo items.
+
+//  a new buffer of size bytes with one reference, its contents are undefined
+void *dt_undo_blob_new(const size_t size);
+void *dt_undo_blob_ref(void *blob);
+//  drops a reference, blob may be NULL
+void dt_undo_blob_unref(void *blob);
+size_t dt_undo_blob_size(const void *blob);
+//  other with a new reference if it holds the same bytes as blob, which is then unreferenced. blob otherwise.
+//  other may be NULL.
+void *dt_undo_blob_share(void *blob, void *other);
+
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
 // kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
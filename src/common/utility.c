@@ -32,8 +32,19 @@
   #include <FileAPI.h>
 #endif
 
+#ifdef __linux__
+  #include <errno.h>
+  #include <fcntl.h>
+  #include <linux/fs.h>
+  #include <sys/ioctl.h>
+  #include <sys/syscall.h>
+  #include <unistd.h>
+#endif
+
 #include <math.h>
+#include <gio/gio.h>
 #include <glib/gi18n.h>
+#include <glib/gstdio.h>
 
 #include <sys/stat.h>
 
@@ -281,6 +292,86 @@ off_t dt_util_get_file_size(const char *filename)
   return -1;
 }
 
+#ifdef __linux__
+// the kernel side of dt_util_copy_file(): a reflink, or copy_file_range() which copies within the kernel and
+// lets nfs and smb copy on the server. 0 on success, 1 on failure with errno set, -1 if the file systems can do
+// neither, nothing is left behind then.
+static int _util_copy_file_kernel(const char *src, const char *dest, const gboolean overwrite)
+{
+  const int in = g_open(src, O_RDONLY | O_CLOEXEC, 0);
+  if(in < 0) return 1;
+  struct stat st;
+  if(fstat(in, &st) || !S_ISREG(st.st_mode))
+  {
+    close(in);
+    return -1;
+  }
+  const int out = g_open(dest, O_WRONLY | O_CREAT | O_CLOEXEC | (overwrite ? O_TRUNC : O_EXCL), st.st_mode & 0777);
+  if(out < 0)
+  {
+    const int err = errno;
+    close(in);
+    errno = err;
+    return 1;
+  }
+
+  int res = 0;
+#ifdef FICLONE
+  if(ioctl(out, FICLONE, in) == 0) goto done;
+#endif
+#ifdef __NR_copy_file_range
+  for(off_t copied = 0; copied < st.st_size;)
+  {
+    const size_t len = MIN(st.st_size - copied, 1 << 30);
+    const ssize_t n = syscall(__NR_copy_file_range, in, NULL, out, NULL, len, 0);
+    if(n < 0 && errno == EINTR) continue;
+    if(n <= 0)
+    {
+      // older kernels don't copy across file systems, some file systems not at all
+      const int unsupported = n == 0 || errno == ENOSYS || errno == EXDEV || errno == EINVAL
+                              || errno == EOPNOTSUPP || errno == EPERM;
+      res = copied == 0 && unsupported ? -1 : 1;
+      break;
+    }
+    copied += n;
+  }
+#else
+  res = -1;
+#endif
+
+#ifdef FICLONE
+done:
+#endif
+  if(close(out) && res == 0) res = 1;
+  const int err = errno;
+  close(in);
+  if(res) g_unlink(dest);
+  errno = err;
+  return res;
+}
+#endif
+
+gboolean dt_util_copy_file(const char *src, const char *dest, const gboolean overwrite, GError **error)
+{
+#ifdef __linux__
+  const int res = _util_copy_file_kernel(src, dest, overwrite);
+  if(res == 0) return TRUE;
+  if(res > 0)
+  {
+    const int err = errno;
+    g_set_error(error, G_IO_ERROR, g_io_error_from_errno(err), "%s: %s", dest, g_strerror(err));
+    return FALSE;
+  }
+#endif
+  GFile *gsrc = g_file_new_for_path(src);
+  GFile *gdest = g_file_new_for_path(dest);
+  const gboolean ok
+      = g_file_copy(gsrc, gdest, overwrite ? G_FILE_COPY_OVERWRITE : G_FILE_COPY_NONE, NULL, NULL, NULL, error);
+  g_object_unref(gdest);
+  g_object_unref(gsrc);
+  return ok;
+}
+
 gboolean dt_util_is_dir_empty(const char *dirname)
 {
   int n = 0;
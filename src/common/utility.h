@@ -37,6 +37,12 @@ gchar *dt_util_fix_path(const gchar *path);
 size_t dt_utf8_strlcpy(char *dest, const char *src, size_t n);
 /** get the size of a file in bytes */
 off_t dt_util_get_file_size(const char *filename);
+/**
+ * copies the file src to dest, failing with G_IO_ERROR_EXISTS if that exists and overwrite isn't set. on linux
+ * the copy shares the data with src where the file system can (a reflink), or the kernel copies it without
+ * going through user space. anything else goes through g_file_copy().
+ */
+gboolean dt_util_copy_file(const char *src, const char *dest, const gboolean overwrite, GError **error);
 /** returns true if dirname is empty */
 gboolean dt_util_is_dir_empty(const char *dirname);
 /** returns a valid UTF-8 string for the given char array. has to be freed with g_free(). */
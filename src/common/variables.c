@@ -19,6 +19,8 @@
 #include "common/variables.h"
 #include "common/colorlabels.h"
 #include "common/darktable.h"
+#include "common/database.h"
+#include "common/debug.h"
 #include "common/file_location.h"
 #include "common/image.h"
 #include "common/image_cache.h"
@@ -29,6 +31,115 @@
 #include <string.h>
 #include <time.h>
 
+// what the variables of a template need to have looked up before they can be expanded
+typedef enum dt_variables_needs_t
+{
+  DT_VARIABLES_NEEDS_FOLDERS = 1 << 0,  // home and pictures folder
+  DT_VARIABLES_NEEDS_IMAGE = 1 << 1,    // the image from the image cache
+  DT_VARIABLES_NEEDS_METADATA = 1 << 2, // meta_data and color labels from the database
+} dt_variables_needs_t;
+
+typedef enum dt_variable_t
+{
+  DT_VAR_TEXT = 0, // not a variable but text to copy
+  DT_VAR_UNKNOWN,
+  DT_VAR_YEAR,
+  DT_VAR_MONTH,
+  DT_VAR_DAY,
+  DT_VAR_HOUR,
+  DT_VAR_MINUTE,
+  DT_VAR_SECOND,
+  DT_VAR_EXIF_YEAR,
+  DT_VAR_EXIF_MONTH,
+  DT_VAR_EXIF_DAY,
+  DT_VAR_EXIF_HOUR,
+  DT_VAR_EXIF_MINUTE,
+  DT_VAR_EXIF_SECOND,
+  DT_VAR_EXIF_ISO,
+  DT_VAR_MAKER,
+  DT_VAR_MODEL,
+  DT_VAR_ID,
+  DT_VAR_VERSION,
+  DT_VAR_JOBCODE,
+  DT_VAR_ROLL_NAME,
+  DT_VAR_FILE_FOLDER,
+  DT_VAR_FILE_NAME,
+  DT_VAR_FILE_EXTENSION,
+  DT_VAR_SEQUENCE,
+  DT_VAR_USERNAME,
+  DT_VAR_HOME,
+  DT_VAR_PICTURES_FOLDER,
+  DT_VAR_DESKTOP,
+  DT_VAR_STARS,
+  DT_VAR_LABELS,
+  DT_VAR_TITLE,
+  DT_VAR_CREATOR,
+  DT_VAR_PUBLISHER,
+  DT_VAR_RIGHTS,
+} dt_variable_t;
+
+// the names are matched as prefixes in this order, so a name has to come before the names it starts with
+static const struct
+{
+  const char *name;
+  dt_variable_t var;
+  int needs;
+} _variables[] = {
+  { "YEAR", DT_VAR_YEAR, 0 },
+  { "MONTH", DT_VAR_MONTH, 0 },
+  { "DAY", DT_VAR_DAY, 0 },
+  { "HOUR", DT_VAR_HOUR, 0 },
+  { "MINUTE", DT_VAR_MINUTE, 0 },
+  { "SECOND", DT_VAR_SECOND, 0 },
+  { "EXIF_YEAR", DT_VAR_EXIF_YEAR, DT_VARIABLES_NEEDS_IMAGE },
+  { "EXIF_MONTH", DT_VAR_EXIF_MONTH, DT_VARIABLES_NEEDS_IMAGE },
+  { "EXIF_DAY", DT_VAR_EXIF_DAY, DT_VARIABLES_NEEDS_IMAGE },
+  { "EXIF_HOUR", DT_VAR_EXIF_HOUR, DT_VARIABLES_NEEDS_IMAGE },
+  { "EXIF_MINUTE", DT_VAR_EXIF_MINUTE, DT_VARIABLES_NEEDS_IMAGE },
+  { "EXIF_SECOND", DT_VAR_EXIF_SECOND, DT_VARIABLES_NEEDS_IMAGE },
+  { "EXIF_ISO", DT_VAR_EXIF_ISO, DT_VARIABLES_NEEDS_IMAGE },
+  { "MAKER", DT_VAR_MAKER, DT_VARIABLES_NEEDS_IMAGE },
+  { "MODEL", DT_VAR_MODEL, DT_VARIABLES_NEEDS_IMAGE },
+  { "ID", DT_VAR_ID, 0 },
+  { "VERSION", DT_VAR_VERSION, DT_VARIABLES_NEEDS_IMAGE },
+  { "JOBCODE", DT_VAR_JOBCODE, 0 },
+  { "ROLL_NAME", DT_VAR_ROLL_NAME, 0 },
+  { "FILE_DIRECTORY", DT_VAR_FILE_FOLDER, 0 }, // undocumented : backward compatibility
+  { "FILE_FOLDER", DT_VAR_FILE_FOLDER, 0 },
+  { "FILE_NAME", DT_VAR_FILE_NAME, 0 },
+  { "FILE_EXTENSION", DT_VAR_FILE_EXTENSION, 0 },
+  { "SEQUENCE", DT_VAR_SEQUENCE, 0 },
+  { "USERNAME", DT_VAR_USERNAME, 0 },
+  { "HOME_FOLDER", DT_VAR_HOME, DT_VARIABLES_NEEDS_FOLDERS }, // undocumented : backward compatibility
+  { "HOME", DT_VAR_HOME, DT_VARIABLES_NEEDS_FOLDERS },
+  { "PICTURES_FOLDER", DT_VAR_PICTURES_FOLDER, DT_VARIABLES_NEEDS_FOLDERS },
+  { "DESKTOP_FOLDER", DT_VAR_DESKTOP, 0 }, // undocumented : backward compatibility
+  { "DESKTOP", DT_VAR_DESKTOP, 0 },
+  { "STARS", DT_VAR_STARS, DT_VARIABLES_NEEDS_IMAGE },
+  { "LABELS", DT_VAR_LABELS, DT_VARIABLES_NEEDS_METADATA },
+  { "TITLE", DT_VAR_TITLE, DT_VARIABLES_NEEDS_METADATA },
+  { "CREATOR", DT_VAR_CREATOR, DT_VARIABLES_NEEDS_METADATA },
+  { "PUBLISHER", DT_VAR_PUBLISHER, DT_VARIABLES_NEEDS_METADATA },
+  { "RIGHTS", DT_VAR_RIGHTS, DT_VARIABLES_NEEDS_METADATA },
+};
+
+typedef struct dt_variables_token_t
+{
+  dt_variable_t var;
+  char *text;             // of DT_VAR_TEXT
+  char operation;         // the bash style manipulation of the value, see variable_get_value()
+  char mode;              // the character after '/', '^' and ',' if it changes what they do, else '\0'
+  int offset, length;     // of ':'
+  gboolean has_length;
+  dt_variables_template_t *pattern, *replacement; // the argument of '-', '+', '#' and '%' is the pattern
+} dt_variables_token_t;
+
+struct dt_variables_template_t
+{
+  GArray *tokens;
+  int needs; // of all variables in there, nested ones included
+};
+
 typedef struct dt_variables_data_t
 {
   /** cached values that shouldn't change between variables in the same expansion process */
@@ -48,21 +159,79 @@ typedef struct dt_variables_data_t
   int stars;
   struct tm exif_tm;
 
+  // from the one query for all metadata of the image
+  char *title, *creator, *publisher, *rights;
+  char *labels;
+
+  /** the template last passed to dt_variables_expand(), a job passes the same one for all its images */
+  char *source;
+  dt_variables_template_t *tmpl;
+
 } dt_variables_data_t;
 
-static char *expand(dt_variables_params_t *params, char **source, char extra_stop);
+static char *expand(dt_variables_params_t *params, const dt_variables_template_t *tmpl);
+
+static void _metadata_fetch(dt_variables_params_t *params)
+{
+  dt_variables_data_t *d = params->data;
+  GList *labels = NULL;
+  // everything in one go, ordered like dt_metadata_get() returns it. the first value of a key is used.
+  sqlite3_stmt *stmt;
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                              "SELECT key, value FROM main.meta_data WHERE id = ?1"
+                              " UNION ALL SELECT -1, color FROM main.color_labels WHERE imgid = ?1"
+                              " ORDER BY 1, 2",
+                              -1, &stmt, NULL);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, params->imgid);
+  while(sqlite3_step(stmt) == SQLITE_ROW)
+  {
+    const int key = sqlite3_column_int(stmt, 0);
+    char **value = NULL;
+    switch(key)
+    {
+      case -1:
+        labels = g_list_append(labels, (char *)(_(dt_colorlabels_to_string(sqlite3_column_int(stmt, 1)))));
+        break;
+      case DT_METADATA_XMP_DC_TITLE:
+        value = &d->title;
+        break;
+      case DT_METADATA_XMP_DC_CREATOR:
+        value = &d->creator;
+        break;
+      case DT_METADATA_XMP_DC_PUBLISHER:
+        value = &d->publisher;
+        break;
+      case DT_METADATA_XMP_DC_RIGHTS:
+        value = &d->rights;
+        break;
+    }
+    if(value && !*value) *value = g_strdup((const char *)sqlite3_column_text(stmt, 1));
+  }
+  sqlite3_finalize(stmt);
+
+  // TODO: currently we concatenate all the color labels with a ',' as a separator. Maybe it's better to
+  // only use the first/last label?
+  if(labels) d->labels = dt_util_glist_to_str(",", labels);
+  g_list_free(labels);
+}
 
 // gather some data that might be used for variable expansion
-static void init_expansion(dt_variables_params_t *params, gboolean iterate)
+static void init_expansion(dt_variables_params_t *params, const int needs, gboolean iterate)
 {
   if(iterate) params->data->sequence++;
 
-  params->data->homedir = dt_loc_get_home_dir(NULL);
+  params->data->homedir = NULL;
+  params->data->pictures_folder = NULL;
+  if(needs & DT_VARIABLES_NEEDS_FOLDERS)
+  {
+    params->data->homedir = dt_loc_get_home_dir(NULL);
 
-  if(g_get_user_special_dir(G_USER_DIRECTORY_PICTURES) == NULL)
-    params->data->pictures_folder = g_build_path(G_DIR_SEPARATOR_S, params->data->homedir, "Pictures", (char *)NULL);
-  else
-    params->data->pictures_folder = g_strdup(g_get_user_special_dir(G_USER_DIRECTORY_PICTURES));
+    if(g_get_user_special_dir(G_USER_DIRECTORY_PICTURES) == NULL)
+      params->data->pictures_folder
+          = g_build_path(G_DIR_SEPARATOR_S, params->data->homedir, "Pictures", (char *)NULL);
+    else
+      params->data->pictures_folder = g_strdup(g_get_user_special_dir(G_USER_DIRECTORY_PICTURES));
+  }
 
   if(params->filename)
   {
@@ -81,27 +250,35 @@ static void init_expansion(dt_variables_params_t *params, gboolean iterate)
   params->data->stars = 0;
   if(params->imgid)
   {
-    const dt_image_t *img = dt_image_cache_get(darktable.image_cache, params->imgid, 'r');
-    if(sscanf(img->exif_datetime_taken, "%d:%d:%d %d:%d:%d", &params->data->exif_tm.tm_year, &params->data->exif_tm.tm_mon,
-      &params->data->exif_tm.tm_mday, &params->data->exif_tm.tm_hour, &params->data->exif_tm.tm_min, &params->data->exif_tm.tm_sec) == 6)
+    if(needs & DT_VARIABLES_NEEDS_IMAGE)
     {
-      params->data->exif_tm.tm_year -= 1900;
-      params->data->exif_tm.tm_mon--;
-      params->data->have_exif_tm = TRUE;
+      const dt_image_t *img = dt_image_cache_get(darktable.image_cache, params->imgid, 'r');
+      struct tm *tm = &params->data->exif_tm;
+      if(sscanf(img->exif_datetime_taken, "%d:%d:%d %d:%d:%d", &tm->tm_year, &tm->tm_mon, &tm->tm_mday,
+                &tm->tm_hour, &tm->tm_min, &tm->tm_sec) == 6)
+      {
+        params->data->exif_tm.tm_year -= 1900;
+        params->data->exif_tm.tm_mon--;
+        params->data->have_exif_tm = TRUE;
+      }
+      params->data->exif_iso = img->exif_iso;
+      params->data->camera_maker = g_strdup(img->camera_maker);
+      params->data->camera_alias = g_strdup(img->camera_alias);
+      params->data->version = img->version;
+      params->data->stars = (img->flags & 0x7);
+      if(params->data->stars == 6) params->data->stars = -1;
+
+      dt_image_cache_read_release(darktable.image_cache, img);
     }
-    params->data->exif_iso = img->exif_iso;
-    params->data->camera_maker = g_strdup(img->camera_maker);
-    params->data->camera_alias = g_strdup(img->camera_alias);
-    params->data->version = img->version;
-    params->data->stars = (img->flags & 0x7);
-    if(params->data->stars == 6) params->data->stars = -1;
-
-    dt_image_cache_read_release(darktable.image_cache, img);
   }
   else if (params->data->exif_time) {
     localtime_r(&params->data->exif_time, &params->data->exif_tm);
     params->data->have_exif_tm = TRUE;
   }
+
+  params->data->title = params->data->creator = params->data->publisher = params->data->rights = NULL;
+  params->data->labels = NULL;
+  if(params->imgid && (needs & DT_VARIABLES_NEEDS_METADATA)) _metadata_fetch(params);
 }
 
 static void cleanup_expansion(dt_variables_params_t *params)
@@ -110,167 +287,133 @@ static void cleanup_expansion(dt_variables_params_t *params)
   g_free(params->data->pictures_folder);
   g_free(params->data->camera_maker);
   g_free(params->data->camera_alias);
+  g_free(params->data->title);
+  g_free(params->data->creator);
+  g_free(params->data->publisher);
+  g_free(params->data->rights);
+  g_free(params->data->labels);
 }
 
-static inline gboolean has_prefix(char **str, const char *prefix)
-{
-  gboolean res = g_str_has_prefix(*str, prefix);
-  if(res) *str += strlen(prefix);
-  return res;
-}
-
-static char *get_base_value(dt_variables_params_t *params, char **variable)
+static char *get_base_value(dt_variables_params_t *params, const dt_variables_token_t *token)
 {
   char *result = NULL;
 
   struct tm exif_tm = params->data->have_exif_tm ? params->data->exif_tm : params->data->time;
 
-  if(has_prefix(variable, "YEAR"))
-    result = g_strdup_printf("%.4d", params->data->time.tm_year + 1900);
-  else if(has_prefix(variable, "MONTH"))
-    result = g_strdup_printf("%.2d", params->data->time.tm_mon + 1);
-  else if(has_prefix(variable, "DAY"))
-    result = g_strdup_printf("%.2d", params->data->time.tm_mday);
-  else if(has_prefix(variable, "HOUR"))
-    result = g_strdup_printf("%.2d", params->data->time.tm_hour);
-  else if(has_prefix(variable, "MINUTE"))
-    result = g_strdup_printf("%.2d", params->data->time.tm_min);
-  else if(has_prefix(variable, "SECOND"))
-    result = g_strdup_printf("%.2d", params->data->time.tm_sec);
-
-  else if(has_prefix(variable, "EXIF_YEAR"))
-    result = g_strdup_printf("%.4d", exif_tm.tm_year + 1900);
-  else if(has_prefix(variable, "EXIF_MONTH"))
-    result = g_strdup_printf("%.2d", exif_tm.tm_mon + 1);
-  else if(has_prefix(variable, "EXIF_DAY"))
-    result = g_strdup_printf("%.2d", exif_tm.tm_mday);
-  else if(has_prefix(variable, "EXIF_HOUR"))
-    result = g_strdup_printf("%.2d", exif_tm.tm_hour);
-  else if(has_prefix(variable, "EXIF_MINUTE"))
-    result = g_strdup_printf("%.2d", exif_tm.tm_min);
-  else if(has_prefix(variable, "EXIF_SECOND"))
-    result = g_strdup_printf("%.2d", exif_tm.tm_sec);
-  else if(has_prefix(variable, "EXIF_ISO"))
-    result = g_strdup_printf("%d", params->data->exif_iso);
-  else if(has_prefix(variable, "MAKER"))
-    result = g_strdup(params->data->camera_maker);
-  else if(has_prefix(variable, "MODEL"))
-    result = g_strdup(params->data->camera_alias);
-  else if(has_prefix(variable, "ID"))
-    result = g_strdup_printf("%d", params->imgid);
-  else if(has_prefix(variable, "VERSION"))
-    result = g_strdup_printf("%d", params->data->version);
-  else if(has_prefix(variable, "JOBCODE"))
-    result = g_strdup(params->jobcode);
-  else if(has_prefix(variable, "ROLL_NAME"))
-  {
-    if(params->filename)
-    {
-      gchar *dirname = g_path_get_dirname(params->filename);
-      result = g_path_get_basename(dirname);
-      g_free(dirname);
-    }
-  }
-  else if(has_prefix(variable, "FILE_DIRECTORY"))
-  {
-    // undocumented : backward compatibility
-    if(params->filename)
-      result = g_path_get_dirname(params->filename);
-  }
-  else if(has_prefix(variable, "FILE_FOLDER"))
-  {
-    if(params->filename)
-      result = g_path_get_dirname(params->filename);
-  }
-  else if(has_prefix(variable, "FILE_NAME"))
-  {
-    if(params->filename)
-    {
-      result = g_path_get_basename(params->filename);
-      char *dot = g_strrstr(result, ".");
-      if(dot) *dot = '\0';
-    }
-  }
-  else if(has_prefix(variable, "FILE_EXTENSION"))
-    result = g_strdup(params->data->file_ext);
-  else if(has_prefix(variable, "SEQUENCE"))
-    result = g_strdup_printf("%.4d", params->sequence >= 0 ? params->sequence : params->data->sequence);
-  else if(has_prefix(variable, "USERNAME"))
-    result = g_strdup(g_get_user_name());
-  else if(has_prefix(variable, "HOME_FOLDER"))
-    result = g_strdup(params->data->homedir); // undocumented : backward compatibility
-  else if(has_prefix(variable, "HOME"))
-    result = g_strdup(params->data->homedir);
-  else if(has_prefix(variable, "PICTURES_FOLDER"))
-    result = g_strdup(params->data->pictures_folder);
-  else if(has_prefix(variable, "DESKTOP_FOLDER"))
-    result = g_strdup(g_get_user_special_dir(G_USER_DIRECTORY_DESKTOP)); // undocumented : backward compatibility
-  else if(has_prefix(variable, "DESKTOP"))
-    result = g_strdup(g_get_user_special_dir(G_USER_DIRECTORY_DESKTOP));
-  else if(has_prefix(variable, "STARS"))
-    result = g_strdup_printf("%d", params->data->stars);
-  else if(has_prefix(variable, "LABELS"))
+  switch(token->var)
   {
-    // TODO: currently we concatenate all the color labels with a ',' as a separator. Maybe it's better to
-    // only use the first/last label?
-    GList *res = dt_metadata_get(params->imgid, "Xmp.darktable.colorlabels", NULL);
-    res = g_list_first(res);
-    if(res != NULL)
-    {
-      GList *labels = NULL;
-      do
+    case DT_VAR_YEAR:
+      result = g_strdup_printf("%.4d", params->data->time.tm_year + 1900);
+      break;
+    case DT_VAR_MONTH:
+      result = g_strdup_printf("%.2d", params->data->time.tm_mon + 1);
+      break;
+    case DT_VAR_DAY:
+      result = g_strdup_printf("%.2d", params->data->time.tm_mday);
+      break;
+    case DT_VAR_HOUR:
+      result = g_strdup_printf("%.2d", params->data->time.tm_hour);
+      break;
+    case DT_VAR_MINUTE:
+      result = g_strdup_printf("%.2d", params->data->time.tm_min);
+      break;
+    case DT_VAR_SECOND:
+      result = g_strdup_printf("%.2d", params->data->time.tm_sec);
+      break;
+    case DT_VAR_EXIF_YEAR:
+      result = g_strdup_printf("%.4d", exif_tm.tm_year + 1900);
+      break;
+    case DT_VAR_EXIF_MONTH:
+      result = g_strdup_printf("%.2d", exif_tm.tm_mon + 1);
+      break;
+    case DT_VAR_EXIF_DAY:
+      result = g_strdup_printf("%.2d", exif_tm.tm_mday);
+      break;
+    case DT_VAR_EXIF_HOUR:
+      result = g_strdup_printf("%.2d", exif_tm.tm_hour);
+      break;
+    case DT_VAR_EXIF_MINUTE:
+      result = g_strdup_printf("%.2d", exif_tm.tm_min);
+      break;
+    case DT_VAR_EXIF_SECOND:
+      result = g_strdup_printf("%.2d", exif_tm.tm_sec);
+      break;
+    case DT_VAR_EXIF_ISO:
+      result = g_strdup_printf("%d", params->data->exif_iso);
+      break;
+    case DT_VAR_MAKER:
+      result = g_strdup(params->data->camera_maker);
+      break;
+    case DT_VAR_MODEL:
+      result = g_strdup(params->data->camera_alias);
+      break;
+    case DT_VAR_ID:
+      result = g_strdup_printf("%d", params->imgid);
+      break;
+    case DT_VAR_VERSION:
+      result = g_strdup_printf("%d", params->data->version);
+      break;
+    case DT_VAR_JOBCODE:
+      result = g_strdup(params->jobcode);
+      break;
+    case DT_VAR_ROLL_NAME:
+      if(params->filename)
       {
-        labels = g_list_append(labels, (char *)(_(dt_colorlabels_to_string(GPOINTER_TO_INT(res->data)))));
-      } while((res = g_list_next(res)) != NULL);
-      result = dt_util_glist_to_str(",", labels);
-      g_list_free(labels);
-    }
-    g_list_free(res);
-  }
-  else if(has_prefix(variable, "TITLE"))
-  {
-    GList *res = dt_metadata_get(params->imgid, "Xmp.dc.title", NULL);
-    res = g_list_first(res);
-    if(res != NULL)
-    {
-      result = g_strdup((char *)res->data);
-    }
-    g_list_free_full(res, &g_free);
-  }
-  else if(has_prefix(variable, "CREATOR"))
-  {
-    GList *res = dt_metadata_get(params->imgid, "Xmp.dc.creator", NULL);
-    res = g_list_first(res);
-    if(res != NULL)
-    {
-      result = g_strdup((char *)res->data);
-    }
-    g_list_free_full(res, &g_free);
-  }
-  else if(has_prefix(variable, "PUBLISHER"))
-  {
-    GList *res = dt_metadata_get(params->imgid, "Xmp.dc.publisher", NULL);
-    res = g_list_first(res);
-    if(res != NULL)
-    {
-      result = g_strdup((char *)res->data);
-    }
-    g_list_free_full(res, &g_free);
-  }
-  else if(has_prefix(variable, "RIGHTS"))
-  {
-    GList *res = dt_metadata_get(params->imgid, "Xmp.dc.rights", NULL);
-    res = g_list_first(res);
-    if(res != NULL)
-    {
-      result = g_strdup((char *)res->data);
-    }
-    g_list_free_full(res, &g_free);
-  }
-  else
-  {
-    // go past what looks like an invalid variable. we only expect to see [a-zA-Z]* in a variable name.
-    while(g_ascii_isalpha(**variable)) (*variable)++;
+        gchar *dirname = g_path_get_dirname(params->filename);
+        result = g_path_get_basename(dirname);
+        g_free(dirname);
+      }
+      break;
+    case DT_VAR_FILE_FOLDER:
+      if(params->filename) result = g_path_get_dirname(params->filename);
+      break;
+    case DT_VAR_FILE_NAME:
+      if(params->filename)
+      {
+        result = g_path_get_basename(params->filename);
+        char *dot = g_strrstr(result, ".");
+        if(dot) *dot = '\0';
+      }
+      break;
+    case DT_VAR_FILE_EXTENSION:
+      result = g_strdup(params->data->file_ext);
+      break;
+    case DT_VAR_SEQUENCE:
+      result = g_strdup_printf("%.4d", params->sequence >= 0 ? params->sequence : params->data->sequence);
+      break;
+    case DT_VAR_USERNAME:
+      result = g_strdup(g_get_user_name());
+      break;
+    case DT_VAR_HOME:
+      result = g_strdup(params->data->homedir);
+      break;
+    case DT_VAR_PICTURES_FOLDER:
+      result = g_strdup(params->data->pictures_folder);
+      break;
+    case DT_VAR_DESKTOP:
+      result = g_strdup(g_get_user_special_dir(G_USER_DIRECTORY_DESKTOP));
+      break;
+    case DT_VAR_STARS:
+      result = g_strdup_printf("%d", params->data->stars);
+      break;
+    case DT_VAR_LABELS:
+      result = g_strdup(params->data->labels);
+      break;
+    case DT_VAR_TITLE:
+      result = g_strdup(params->data->title);
+      break;
+    case DT_VAR_CREATOR:
+      result = g_strdup(params->data->creator);
+      break;
+    case DT_VAR_PUBLISHER:
+      result = g_strdup(params->data->publisher);
+      break;
+    case DT_VAR_RIGHTS:
+      result = g_strdup(params->data->rights);
+      break;
+    case DT_VAR_TEXT:
+    case DT_VAR_UNKNOWN:
+      break;
   }
 
   if(!result) result = g_strdup("");
@@ -283,18 +426,14 @@ static char *get_base_value(dt_variables_params_t *params, char **variable)
 // http://www.tldp.org/LDP/abs/html/parameter-substitution.html
 // https://www.gnu.org/software/bash/manual/html_node/Shell-Parameter-Expansion.html
 // the descriptions in the comments are refering to the bash behaviour, dt doesn't do it 100% like that!
-static char *variable_get_value(dt_variables_params_t *params, char **variable)
+static char *variable_get_value(dt_variables_params_t *params, const dt_variables_token_t *token)
 {
-  // invariant: the variable starts with "$(" which we can skip
-  (*variable) += 2;
-
   // first get the value of the variable
-  char *base_value = get_base_value(params, variable); // this is never going to be NULL!
+  char *base_value = get_base_value(params, token); // this is never going to be NULL!
   const size_t base_value_length = strlen(base_value);
 
   // ... and now see if we have to change it
-  const char operation = **variable;
-  if(operation != '\0' && operation != ')') (*variable)++;
+  const char operation = token->operation;
   switch(operation)
   {
     case '-':
@@ -303,7 +442,7 @@ static char *variable_get_value(dt_variables_params_t *params, char **variable)
           If parameter not set, use default.
       */
       {
-        char *replacement = expand(params, variable, ')');
+        char *replacement = expand(params, token->pattern);
         if(!base_value || !*base_value)
         {
           g_free(base_value);
@@ -319,7 +458,7 @@ static char *variable_get_value(dt_variables_params_t *params, char **variable)
           If parameter set, use alt_value, else use null string.
       */
       {
-        char *replacement = expand(params, variable, ')');
+        char *replacement = expand(params, token->pattern);
         if(*base_value)
         {
           g_free(base_value);
@@ -344,7 +483,7 @@ static char *variable_get_value(dt_variables_params_t *params, char **variable)
       */
       {
         const size_t base_value_utf8_length = g_utf8_strlen(base_value, -1);
-        const int offset = strtol(*variable, variable, 10);
+        const int offset = token->offset;
 
         // find where to start
         char *start; // from where to copy ...
@@ -355,11 +494,10 @@ static char *variable_get_value(dt_variables_params_t *params, char **variable)
 
         // now find the end if there is a length provided
         char *end = base_value + base_value_length; // ... and until where
-        if(start && **variable == ':')
+        if(start && token->has_length)
         {
-          (*variable)++;
           const size_t start_utf8_length = g_utf8_strlen(start, -1);
-          const int length = strtol(*variable, variable, 10);
+          const int length = token->length;
           if(length >= 0)
             end = g_utf8_offset_to_pointer(start, MIN(length, start_utf8_length));
           else
@@ -377,7 +515,7 @@ static char *variable_get_value(dt_variables_params_t *params, char **variable)
           Remove from $var the shortest part of $Pattern that matches the front end of $var.
       */
       {
-        char *pattern = expand(params, variable, ')');
+        char *pattern = expand(params, token->pattern);
         const size_t pattern_length = strlen(pattern);
         if(!strncmp(base_value, pattern, pattern_length))
         {
@@ -394,9 +532,10 @@ static char *variable_get_value(dt_variables_params_t *params, char **variable)
           Remove from $var the shortest part of $Pattern that matches the back end of $var.
       */
       {
-        char *pattern = expand(params, variable, ')');
+        char *pattern = expand(params, token->pattern);
         const size_t pattern_length = strlen(pattern);
-        if(!strncmp(base_value + base_value_length - pattern_length, pattern, pattern_length))
+        if(pattern_length <= base_value_length
+           && !strncmp(base_value + base_value_length - pattern_length, pattern, pattern_length))
           base_value[base_value_length - pattern_length] = '\0';
         g_free(pattern);
       }
@@ -420,13 +559,11 @@ static char *variable_get_value(dt_variables_params_t *params, char **variable)
           If suffix of var matches Pattern, then substitute Replacement for Pattern.
       */
       {
-        const char mode = **variable;
+        const char mode = token->mode;
 
-        if(mode == '/' || mode == '#' || mode == '%') (*variable)++;
-        char *pattern = expand(params, variable, '/');
+        char *pattern = expand(params, token->pattern);
         const size_t pattern_length = strlen(pattern);
-        (*variable)++;
-        char *replacement = expand(params, variable, ')');
+        char *replacement = expand(params, token->replacement);
         const size_t replacement_length = strlen(replacement);
 
         switch(mode)
@@ -455,7 +592,8 @@ static char *variable_get_value(dt_variables_params_t *params, char **variable)
           }
           case '%':
           {
-            if(!strncmp(base_value + base_value_length - pattern_length, pattern, pattern_length))
+            if(pattern_length <= base_value_length
+               && !strncmp(base_value + base_value_length - pattern_length, pattern, pattern_length))
             {
               char *_base_value = g_malloc(base_value_length - pattern_length + replacement_length + 1);
               base_value[base_value_length - pattern_length] = '\0';
@@ -505,18 +643,14 @@ static char *variable_get_value(dt_variables_params_t *params, char **variable)
           the ‘^’ and ‘,’ expansions convert only the first character in the expanded value.
       */
       {
-        const char mode = **variable;
+        // an empty value has no first character to change
+        if(!*base_value) break;
+        const char mode = token->mode;
         char *_base_value = NULL;
         if(operation == '^' && mode == '^')
-        {
           _base_value = g_utf8_strup (base_value, -1);
-          (*variable)++;
-        }
         else if(operation == ',' && mode == ',')
-        {
           _base_value = g_utf8_strdown(base_value, -1);
-          (*variable)++;
-        }
         else
         {
           gunichar changed = g_utf8_get_char(base_value);
@@ -533,36 +667,114 @@ static char *variable_get_value(dt_variables_params_t *params, char **variable)
       break;
   }
 
-  if(**variable == ')')
-    (*variable)++;
-  else
+  return base_value;
+}
+
+static char *expand(dt_variables_params_t *params, const dt_variables_template_t *tmpl)
+{
+  GString *result = g_string_new(NULL);
+  for(guint k = 0; k < tmpl->tokens->len; k++)
   {
-    // error case
-    g_free(base_value);
-    base_value = NULL;
+    const dt_variables_token_t *token = &g_array_index(tmpl->tokens, dt_variables_token_t, k);
+    if(token->var == DT_VAR_TEXT)
+      g_string_append(result, token->text);
+    else
+    {
+      char *value = variable_get_value(params, token);
+      g_string_append(result, value);
+      g_free(value);
+    }
   }
+  return g_string_free(result, FALSE);
+}
 
-  return base_value;
+static inline gboolean has_prefix(const char **str, const char *prefix)
+{
+  gboolean res = g_str_has_prefix(*str, prefix);
+  if(res) *str += strlen(prefix);
+  return res;
 }
 
-static void grow_buffer(char **result, char **result_iter, size_t *result_length, size_t extra_space)
+static void _token_clear(dt_variables_token_t *token)
 {
-  const size_t used_length = *result_iter - *result;
-  if(used_length + extra_space > *result_length)
+  g_free(token->text);
+  dt_variables_template_free(token->pattern);
+  dt_variables_template_free(token->replacement);
+}
+
+static dt_variables_template_t *_compile(const char **source, char extra_stop);
+
+// parses "$(VARIABLE<operation>)" into token. returns FALSE if the closing ')' is missing.
+static gboolean _compile_variable(const char **variable, dt_variables_token_t *token, int *needs)
+{
+  // invariant: the variable starts with "$(" which we can skip
+  (*variable) += 2;
+
+  token->var = DT_VAR_UNKNOWN;
+  for(int k = 0; k < G_N_ELEMENTS(_variables); k++)
+    if(has_prefix(variable, _variables[k].name))
+    {
+      token->var = _variables[k].var;
+      *needs |= _variables[k].needs;
+      break;
+    }
+  // go past what looks like an invalid variable. we only expect to see [a-zA-Z]* in a variable name.
+  if(token->var == DT_VAR_UNKNOWN)
+    while(g_ascii_isalpha(**variable)) (*variable)++;
+
+  const char operation = **variable;
+  if(operation != '\0' && operation != ')') (*variable)++;
+  token->operation = operation;
+  switch(operation)
   {
-    *result_length = used_length + extra_space;
-    *result = g_realloc(*result, *result_length + 1);
-    *result_iter = *result + used_length;
+    case '-':
+    case '+':
+    case '#':
+    case '%':
+      token->pattern = _compile(variable, ')');
+      break;
+    case ':':
+      token->offset = strtol(*variable, (char **)variable, 10);
+      if(**variable == ':')
+      {
+        (*variable)++;
+        token->has_length = TRUE;
+        token->length = strtol(*variable, (char **)variable, 10);
+      }
+      break;
+    case '/':
+      if(**variable == '/' || **variable == '#' || **variable == '%') token->mode = *(*variable)++;
+      token->pattern = _compile(variable, '/');
+      if(**variable) (*variable)++;
+      token->replacement = _compile(variable, ')');
+      break;
+    case '^':
+    case ',':
+      if(**variable == operation) token->mode = *(*variable)++;
+      break;
   }
+
+  if(**variable != ')') return FALSE;
+  (*variable)++;
+  if(token->pattern) *needs |= token->pattern->needs;
+  if(token->replacement) *needs |= token->replacement->needs;
+  return TRUE;
+}
+
+static void _append_text(dt_variables_template_t *tmpl, GString *text)
+{
+  if(!text->len) return;
+  dt_variables_token_t token = { .var = DT_VAR_TEXT, .text = g_strndup(text->str, text->len) };
+  g_array_append_val(tmpl->tokens, token);
+  g_string_truncate(text, 0);
 }
 
-static char *expand(dt_variables_params_t *params, char **source, char extra_stop)
+static dt_variables_template_t *_compile(const char **source, char extra_stop)
 {
-  char *result = g_strdup("");
-  char *result_iter = result;
-  size_t result_length = 0;
-  char *source_iter = *source;
-  const size_t source_length = strlen(*source);
+  dt_variables_template_t *tmpl = g_malloc0(sizeof(dt_variables_template_t));
+  tmpl->tokens = g_array_new(FALSE, FALSE, sizeof(dt_variables_token_t));
+  GString *text = g_string_new(NULL);
+  const char *source_iter = *source;
 
   while(*source_iter && *source_iter != extra_stop)
   {
@@ -575,54 +787,79 @@ static char *expand(dt_variables_params_t *params, char **source, char extra_sto
       else if(c == '$' && source_iter[1] == '(')
         break;
 
-      if(result_iter - result >= result_length)
-        grow_buffer(&result, &result_iter, &result_length, source_length - (source_iter - *source));
-      *result_iter = c;
-      result_iter++;
+      g_string_append_c(text, c);
       source_iter++;
-
     }
 
     // it seems we have a variable here
     if(*source_iter == '$')
     {
-      char *old_source_iter = source_iter;
-      char *replacement = variable_get_value(params, &source_iter);
-      if(replacement)
+      const char *old_source_iter = source_iter;
+      dt_variables_token_t token = { 0 };
+      int needs = 0;
+      if(_compile_variable(&source_iter, &token, &needs))
       {
-        const size_t replacement_length = strlen(replacement);
-        grow_buffer(&result, &result_iter, &result_length, replacement_length);
-        memcpy(result_iter, replacement, replacement_length);
-        result_iter += replacement_length;
-        g_free(replacement);
+        _append_text(tmpl, text);
+        g_array_append_val(tmpl->tokens, token);
+        tmpl->needs |= needs;
       }
       else
       {
         // the error case of missing closing ')' -- try to recover
+        _token_clear(&token);
         source_iter = old_source_iter;
-        grow_buffer(&result, &result_iter, &result_length, source_length - (source_iter - *source));
-        *result_iter++ = *source_iter++;
+        g_string_append_c(text, *source_iter++);
       }
     }
   }
 
-  *result_iter = '\0';
+  _append_text(tmpl, text);
+  g_string_free(text, TRUE);
   *source = source_iter;
 
-  return result;
+  return tmpl;
 }
 
-char *dt_variables_expand(dt_variables_params_t *params, gchar *source, gboolean iterate)
+dt_variables_template_t *dt_variables_template_new(const gchar *source)
+{
+  return _compile(&source, '\0');
+}
+
+void dt_variables_template_free(dt_variables_template_t *tmpl)
+{
+  if(!tmpl) return;
+  for(guint k = 0; k < tmpl->tokens->len; k++)
+    _token_clear(&g_array_index(tmpl->tokens, dt_variables_token_t, k));
+  g_array_free(tmpl->tokens, TRUE);
+  g_free(tmpl);
+}
+
+char *dt_variables_expand_template(dt_variables_params_t *params, const dt_variables_template_t *tmpl,
+                                   gboolean iterate)
 {
-  init_expansion(params, iterate);
+  init_expansion(params, tmpl->needs, iterate);
 
-  char *result = expand(params, &source, '\0');
+  char *result = expand(params, tmpl);
 
   cleanup_expansion(params);
 
   return result;
 }
 
+char *dt_variables_expand(dt_variables_params_t *params, gchar *source, gboolean iterate)
+{
+  // storages pass the same pattern for every image of an export, it only has to be parsed once
+  if(!params->data->tmpl || g_strcmp0(params->data->source, source))
+  {
+    dt_variables_template_free(params->data->tmpl);
+    g_free(params->data->source);
+    params->data->source = g_strdup(source);
+    params->data->tmpl = dt_variables_template_new(source);
+  }
+
+  return dt_variables_expand_template(params, params->data->tmpl, iterate);
+}
+
 void dt_variables_params_init(dt_variables_params_t **params)
 {
   *params = g_malloc0(sizeof(dt_variables_params_t));
@@ -635,6 +872,8 @@ void dt_variables_params_init(dt_variables_params_t **params)
 
 void dt_variables_params_destroy(dt_variables_params_t *params)
 {
+  dt_variables_template_free(params->data->tmpl);
+  g_free(params->data->source);
   g_free(params->data);
   g_free(params);
 }
@@ -41,6 +41,9 @@ typedef struct dt_variables_params_t
 
 } dt_variables_params_t;
 
+/** a parsed pattern, to be expanded for many images without parsing it again. */
+typedef struct dt_variables_template_t dt_variables_template_t;
+
 /** allocate and initializes a dt_variables_params_t. */
 void dt_variables_params_init(dt_variables_params_t **params);
 /** destroys an initialized dt_variables_params_t, pointer is garbage after this call. */
@@ -52,6 +55,12 @@ void dt_variables_set_exif_time(dt_variables_params_t *params, time_t time);
 
 /** expands variables in string. the result should be freed with g_free(). */
 char *dt_variables_expand(dt_variables_params_t *params, gchar *source, gboolean iterate);
+/** parses source once. dt_variables_expand() keeps the last pattern of params parsed by itself already. */
+dt_variables_template_t *dt_variables_template_new(const gchar *source);
+void dt_variables_template_free(dt_variables_template_t *tmpl);
+/** like dt_variables_expand(), with a pattern parsed by dt_variables_template_new(). */
+char *dt_variables_expand_template(dt_variables_params_t *params, const dt_variables_template_t *tmpl,
+                                   gboolean iterate);
 /** reset sequence number */
 void dt_variables_reset_sequence(dt_variables_params_t *params);
 
@@ -165,10 +165,16 @@ typedef struct dt_control_t
   pthread_cond_t cond;
   int32_t num_threads;
   pthread_t *thread, kick_on_workers_thread;
-  dt_job_t **job;
 
-  GList *queues[DT_JOB_QUEUE_MAX];
-  size_t queue_length[DT_JOB_QUEUE_MAX];
+  struct dt_control_deque_t *deques; // one per worker thread
+  uint32_t next_deque;
+  int32_t busy_workers; // workers running a job
+  int queued[DT_JOB_QUEUE_MAX];      // jobs waiting per queue, over all deques
+  GHashTable *queued_jobs, *running_jobs; // system foreground jobs, for deduping. protected by queue_mutex
+
+  dt_pthread_mutex_t stats_mutex;
+  GHashTable *job_stats; // job type -> dt_control_job_stats_t, protected by stats_mutex
+  double stats_start;
 
   dt_pthread_mutex_t res_mutex;
   dt_job_t *job_res[DT_CTL_WORKER_RESERVED];
@@ -21,12 +21,14 @@
 #include <sqlite3.h>
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
 
 #include "common/darktable.h"
 #include "common/database.h"
 #include "common/history.h"
 #include "common/image.h"
 #include "control/conf.h"
+#include "control/jobs.h"
 #include "crawler.h"
 #include "gui/gtk.h"
 
@@ -51,133 +53,251 @@ typedef struct dt_control_crawler_result_t
 } dt_control_crawler_result_t;
 
 
+// how many files are looked at at once. the time goes into waiting for the file system, on network shares much
+// longer than on local disks, so this is not bound to the number of cores.
+#define DT_CONTROL_CRAWLER_THREADS 8
+
+typedef struct dt_control_crawler_item_t
+{
+  int id, film_id, version, flags, new_flags;
+  time_t timestamp, timestamp_xmp;
+  gchar *image_path;
+  gchar *xmp_path; // NULL if there is no xmp file to look at
+} dt_control_crawler_item_t;
+
+typedef struct dt_control_crawler_film_t
+{
+  time_t mtime; // of the folder when it was looked at, 0 if it couldn't be
+  gboolean newer_xmp;
+} dt_control_crawler_film_t;
+
+// the state of the files of one image
+static void _crawler_check_item(dt_control_crawler_item_t *item, const gboolean look_for_xmp)
+{
+  item->new_flags = item->flags;
+
+  // no need to look for xmp files if none get written anyway.
+  if(look_for_xmp)
+  {
+    // construct the xmp filename for this image
+    gchar xmp_path[PATH_MAX] = { 0 };
+    g_strlcpy(xmp_path, item->image_path, sizeof(xmp_path));
+    dt_image_path_append_version_no_db(item->version, xmp_path, sizeof(xmp_path));
+    size_t len = strlen(xmp_path);
+    if(len + 4 >= PATH_MAX) return;
+    xmp_path[len++] = '.';
+    xmp_path[len++] = 'x';
+    xmp_path[len++] = 'm';
+    xmp_path[len++] = 'p';
+    xmp_path[len] = '\0';
+
+    struct stat statbuf;
+    if(stat(xmp_path, &statbuf) == -1) return; // TODO: shall we report these?
+    item->xmp_path = g_strdup(xmp_path);
+    item->timestamp_xmp = statbuf.st_mtime;
+  }
+
+  // check if the image has associated files (.txt, .wav)
+  gchar *image_path = g_strdup(item->image_path);
+  size_t len = strlen(image_path);
+  char *c = image_path + len;
+  while((c > image_path) && (*c != '.')) *c-- = '\0';
+  len = c - image_path + 1;
+
+  char *extra_path = g_strndup(image_path, len + 3);
+
+  extra_path[len] = 't';
+  extra_path[len + 1] = 'x';
+  extra_path[len + 2] = 't';
+  gboolean has_txt = g_file_test(extra_path, G_FILE_TEST_EXISTS);
+
+  if(!has_txt)
+  {
+    extra_path[len] = 'T';
+    extra_path[len + 1] = 'X';
+    extra_path[len + 2] = 'T';
+    has_txt = g_file_test(extra_path, G_FILE_TEST_EXISTS);
+  }
+
+  extra_path[len] = 'w';
+  extra_path[len + 1] = 'a';
+  extra_path[len + 2] = 'v';
+  gboolean has_wav = g_file_test(extra_path, G_FILE_TEST_EXISTS);
+
+  if(!has_wav)
+  {
+    extra_path[len] = 'W';
+    extra_path[len + 1] = 'A';
+    extra_path[len + 2] = 'V';
+    has_wav = g_file_test(extra_path, G_FILE_TEST_EXISTS);
+  }
+
+  // TODO: decide if we want to remove the flag for images that lost their extra file. currently we do (the
+  // else cases)
+  if(has_txt)
+    item->new_flags |= DT_IMAGE_HAS_TXT;
+  else
+    item->new_flags &= ~DT_IMAGE_HAS_TXT;
+  if(has_wav)
+    item->new_flags |= DT_IMAGE_HAS_WAV;
+  else
+    item->new_flags &= ~DT_IMAGE_HAS_WAV;
+
+  g_free(extra_path);
+  g_free(image_path);
+}
+
 GList *dt_control_crawler_run()
 {
-  sqlite3_stmt *stmt, *inner_stmt;
+  sqlite3_stmt *stmt;
   GList *result = NULL;
-  gboolean look_for_xmp = dt_conf_get_bool("write_sidecar_files");
+  const gboolean look_for_xmp = dt_conf_get_bool("write_sidecar_files");
+  const time_t start = time(NULL);
+
+  // the folders that changed since they were looked at last. files are added, removed and replaced by renaming
+  // them over the old ones, all of which touches the folder. folders that stayed the same are skipped.
+  GHashTable *films = g_hash_table_new_full(NULL, NULL, NULL, g_free);
+  sqlite3 *reader = dt_database_get_reader(darktable.db);
+  sqlite3_prepare_v2(reader, "SELECT id, folder, crawl_timestamp FROM main.film_rolls", -1, &stmt, NULL);
+  while(sqlite3_step(stmt) == SQLITE_ROW)
+  {
+    dt_control_crawler_film_t *film = g_malloc0(sizeof(dt_control_crawler_film_t));
+    struct stat statbuf;
+    if(stat((const char *)sqlite3_column_text(stmt, 1), &statbuf) == 0) film->mtime = statbuf.st_mtime;
+    if(film->mtime && film->mtime == sqlite3_column_int64(stmt, 2))
+      g_free(film);
+    else
+      g_hash_table_insert(films, GINT_TO_POINTER(sqlite3_column_int(stmt, 0)), film);
+  }
+  sqlite3_finalize(stmt);
 
-  sqlite3_prepare_v2(dt_database_get(darktable.db),
-                     "SELECT i.id, write_timestamp, version, folder || '/' || filename, flags "
+  GArray *items = g_array_new(FALSE, TRUE, sizeof(dt_control_crawler_item_t));
+  sqlite3_prepare_v2(reader,
+                     "SELECT i.id, write_timestamp, version, folder || '/' || filename, flags, film_id "
                      "FROM main.images i, main.film_rolls f ON i.film_id = f.id ORDER BY f.id, filename",
                      -1, &stmt, NULL);
-  sqlite3_prepare_v2(dt_database_get(darktable.db), "UPDATE main.images SET flags = ?1 WHERE id = ?2", -1,
-                     &inner_stmt, NULL);
-
-  // let's wrap this into a transaction, it might make it a little faster.
-  sqlite3_exec(dt_database_get(darktable.db), "BEGIN TRANSACTION", NULL, NULL, NULL);
-
   while(sqlite3_step(stmt) == SQLITE_ROW)
   {
-    const int id = sqlite3_column_int(stmt, 0);
-    const time_t timestamp = sqlite3_column_int(stmt, 1);
-    const int version = sqlite3_column_int(stmt, 2);
-    gchar *image_path = (gchar *)sqlite3_column_text(stmt, 3);
-    int flags = sqlite3_column_int(stmt, 4);
-
-    // no need to look for xmp files if none get written anyway.
-    if(look_for_xmp)
-    {
-      // construct the xmp filename for this image
-      gchar xmp_path[PATH_MAX] = { 0 };
-      g_strlcpy(xmp_path, image_path, sizeof(xmp_path));
-      dt_image_path_append_version_no_db(version, xmp_path, sizeof(xmp_path));
-      size_t len = strlen(xmp_path);
-      if(len + 4 >= PATH_MAX) continue;
-      xmp_path[len++] = '.';
-      xmp_path[len++] = 'x';
-      xmp_path[len++] = 'm';
-      xmp_path[len++] = 'p';
-      xmp_path[len] = '\0';
-
-      struct stat statbuf;
-      if(stat(xmp_path, &statbuf) == -1) continue; // TODO: shall we report these?
-
-      // step 1: check if the xmp is newer than our db entry
-      // FIXME: allow for a few seconds difference?
-      if(timestamp < statbuf.st_mtime)
-      {
-        dt_control_crawler_result_t *item
-            = (dt_control_crawler_result_t *)malloc(sizeof(dt_control_crawler_result_t));
-        item->id = id;
-        item->timestamp_xmp = statbuf.st_mtime;
-        item->timestamp_db = timestamp;
-        item->image_path = g_strdup(image_path);
-        item->xmp_path = g_strdup(xmp_path);
-
-        result = g_list_append(result, item);
-        dt_print(DT_DEBUG_CONTROL, "[crawler] `%s' (id: %d) is a newer xmp file.\n", xmp_path, id);
-      }
-      // older timestamps are the case for all images after the db upgrade. better not report these
-      //       else if(timestamp > statbuf.st_mtime)
-      //         printf("`%s' (%d) has an older xmp file.\n", image_path, id);
-    }
+    const int film_id = sqlite3_column_int(stmt, 5);
+    if(!g_hash_table_contains(films, GINT_TO_POINTER(film_id))) continue;
+    dt_control_crawler_item_t item = { 0 };
+    item.id = sqlite3_column_int(stmt, 0);
+    item.timestamp = sqlite3_column_int(stmt, 1);
+    item.version = sqlite3_column_int(stmt, 2);
+    item.image_path = g_strdup((const gchar *)sqlite3_column_text(stmt, 3));
+    item.flags = sqlite3_column_int(stmt, 4);
+    item.film_id = film_id;
+    g_array_append_val(items, item);
+  }
+  sqlite3_finalize(stmt);
+  dt_database_release_reader(darktable.db, reader);
 
-    // step 2: check if the image has associated files (.txt, .wav)
-    size_t len = strlen(image_path);
-    char *c = image_path + len;
-    while((c > image_path) && (*c != '.')) *c-- = '\0';
-    len = c - image_path + 1;
+  dt_print(DT_DEBUG_CONTROL, "[crawler] looking at %u images in %u changed folders\n", items->len,
+           g_hash_table_size(films));
 
-    char *extra_path = g_strndup(image_path, len + 3);
+  const int count = items->len;
+  dt_control_crawler_item_t *const all = (dt_control_crawler_item_t *)items->data;
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic, 16) default(none) num_threads(DT_CONTROL_CRAWLER_THREADS)
+#endif
+  for(int k = 0; k < count; k++) _crawler_check_item(&all[k], look_for_xmp);
 
-    extra_path[len] = 't';
-    extra_path[len + 1] = 'x';
-    extra_path[len + 2] = 't';
-    gboolean has_txt = g_file_test(extra_path, G_FILE_TEST_EXISTS);
+  sqlite3_stmt *inner_stmt;
+  sqlite3_prepare_v2(dt_database_get(darktable.db), "UPDATE main.images SET flags = ?1 WHERE id = ?2", -1,
+                     &inner_stmt, NULL);
 
-    if(!has_txt)
-    {
-      extra_path[len] = 'T';
-      extra_path[len + 1] = 'X';
-      extra_path[len + 2] = 'T';
-      has_txt = g_file_test(extra_path, G_FILE_TEST_EXISTS);
-    }
+  // let's wrap this into a transaction, it might make it a little faster.
+  sqlite3_exec(dt_database_get(darktable.db), "BEGIN TRANSACTION", NULL, NULL, NULL);
 
-    extra_path[len] = 'w';
-    extra_path[len + 1] = 'a';
-    extra_path[len + 2] = 'v';
-    gboolean has_wav = g_file_test(extra_path, G_FILE_TEST_EXISTS);
+  for(int k = 0; k < count; k++)
+  {
+    dt_control_crawler_item_t *const item = &all[k];
 
-    if(!has_wav)
+    // check if the xmp is newer than our db entry
+    // FIXME: allow for a few seconds difference?
+    if(item->xmp_path && item->timestamp < item->timestamp_xmp)
     {
-      extra_path[len] = 'W';
-      extra_path[len + 1] = 'A';
-      extra_path[len + 2] = 'V';
-      has_wav = g_file_test(extra_path, G_FILE_TEST_EXISTS);
+      dt_control_crawler_result_t *res
+          = (dt_control_crawler_result_t *)malloc(sizeof(dt_control_crawler_result_t));
+      res->id = item->id;
+      res->timestamp_xmp = item->timestamp_xmp;
+      res->timestamp_db = item->timestamp;
+      res->image_path = g_strdup(item->image_path);
+      res->xmp_path = item->xmp_path;
+      item->xmp_path = NULL;
+
+      result = g_list_prepend(result, res);
+      dt_print(DT_DEBUG_CONTROL, "[crawler] `%s' (id: %d) is a newer xmp file.\n", res->xmp_path, item->id);
+
+      // keep asking about it on every start until the user decides
+      dt_control_crawler_film_t *film = g_hash_table_lookup(films, GINT_TO_POINTER(item->film_id));
+      film->newer_xmp = TRUE;
     }
+    // older timestamps are the case for all images after the db upgrade. better not report these
 
-    // TODO: decide if we want to remove the flag for images that lost their extra file. currently we do (the
-    // else cases)
-    int new_flags = flags;
-    if(has_txt)
-      new_flags |= DT_IMAGE_HAS_TXT;
-    else
-      new_flags &= ~DT_IMAGE_HAS_TXT;
-    if(has_wav)
-      new_flags |= DT_IMAGE_HAS_WAV;
-    else
-      new_flags &= ~DT_IMAGE_HAS_WAV;
-    if(flags != new_flags)
+    if(item->flags != item->new_flags)
     {
-      sqlite3_bind_int(inner_stmt, 1, new_flags);
-      sqlite3_bind_int(inner_stmt, 2, id);
+      sqlite3_bind_int(inner_stmt, 1, item->new_flags);
+      sqlite3_bind_int(inner_stmt, 2, item->id);
       sqlite3_step(inner_stmt);
       sqlite3_reset(inner_stmt);
       sqlite3_clear_bindings(inner_stmt);
     }
 
-    g_free(extra_path);
+    g_free(item->image_path);
+    g_free(item->xmp_path);
+  }
+  sqlite3_finalize(inner_stmt);
+
+  // remember the folders as they were. ones changed within the second the crawler started might change again
+  // unnoticed within the same timestamp, so they are looked at next time, too.
+  sqlite3_prepare_v2(dt_database_get(darktable.db), "UPDATE main.film_rolls SET crawl_timestamp = ?1 WHERE id = ?2",
+                     -1, &inner_stmt, NULL);
+  GHashTableIter iter;
+  gpointer key, value;
+  g_hash_table_iter_init(&iter, films);
+  while(g_hash_table_iter_next(&iter, &key, &value))
+  {
+    const dt_control_crawler_film_t *film = (dt_control_crawler_film_t *)value;
+    if(!film->mtime || film->newer_xmp || film->mtime >= start) continue;
+    sqlite3_bind_int64(inner_stmt, 1, film->mtime);
+    sqlite3_bind_int(inner_stmt, 2, GPOINTER_TO_INT(key));
+    sqlite3_step(inner_stmt);
+    sqlite3_reset(inner_stmt);
+    sqlite3_clear_bindings(inner_stmt);
   }
+  sqlite3_finalize(inner_stmt);
 
   sqlite3_exec(dt_database_get(darktable.db), "COMMIT", NULL, NULL, NULL);
 
-  sqlite3_finalize(stmt);
-  sqlite3_finalize(inner_stmt);
+  g_array_free(items, TRUE);
+  g_hash_table_destroy(films);
+
+  return g_list_reverse(result);
+}
 
-  return result;
+static gboolean _crawler_show_idle(gpointer user_data)
+{
+  dt_control_crawler_show_image_list((GList *)user_data);
+  return FALSE;
+}
+
+static int32_t _crawler_job_run(dt_job_t *job)
+{
+  GList *images = dt_control_crawler_run();
+  // the popup asks the user about images whose xmp files are newer than the db entry
+  if(images) g_idle_add(_crawler_show_idle, images);
+  return 0;
 }
 
+void dt_control_crawler_run_job()
+{
+  dt_job_t *job = dt_control_job_create(&_crawler_job_run, "crawl xmp files");
+  if(job) dt_control_add_job(darktable.control, DT_JOB_QUEUE_SYSTEM_BG, job);
+}
+
+#undef DT_CONTROL_CRAWLER_THREADS
+
 
 /********************* the gui stuff *********************/
 
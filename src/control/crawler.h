@@ -20,19 +20,20 @@
 
 #include <glib.h>
 
-/** this isn't a background job on purpose. it has to be really fast so it shouldn't
- *  require locking from image cache or anything like that.
- *  should we find out that we want to have a background job that crawls over all images
- *  we can maybe refactor this, but for now it's good the way it is.
+/** this doesn't need locking from image cache or anything like that, it only talks to the database and the
+ *  file system. the files are looked at in parallel, as on network shares waiting for them makes up the time.
  */
 
-// this function iterates over ALL images from the database and checks whether
+// this function iterates over the images of all folders that changed since it last ran and checks whether
 // - the XMP file on disk is newer than the timestamp from db
 // - there is a .txt or .wav file associated with the image and mark so in the db
 //   or if such a file no longer exists
 // it returns the list of images with a (supposedly) updated xmp file to let the user decide
 GList *dt_control_crawler_run();
 
+// runs the crawler in a background job and shows the popup from the gui thread if it found anything
+void dt_control_crawler_run_job();
+
 // show a popup with the images, let the user decide what to do and free the list afterwards
 void dt_control_crawler_show_image_list(GList *images);
 
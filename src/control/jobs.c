@@ -22,9 +22,28 @@
 
 #include "control/jobs.h"
 #include "control/control.h"
+#include "common/trace.h"
 
+// after this many foreground jobs in a row a waiting background job gets its turn
 #define DT_CONTROL_FG_PRIORITY 4
-#define DT_CONTROL_MAX_JOBS 30
+
+/* jobs are kept in one deque per worker, each with a fifo or stack per dt_job_queue_t.
+   a worker takes from its own deque first and steals from the others when it runs dry.
+   which queue gets served is decided by the priority class, see _job_class(). */
+typedef enum dt_job_class_t
+{
+  DT_JOB_CLASS_INTERACTIVE = 0, // user foreground, always served first
+  DT_JOB_CLASS_FOREGROUND = 1,  // system foreground
+  DT_JOB_CLASS_BACKGROUND = 2,  // everything else, gets a turn every DT_CONTROL_FG_PRIORITY jobs
+} dt_job_class_t;
+
+typedef struct dt_control_deque_t
+{
+  dt_pthread_mutex_t lock;
+  GQueue queue[DT_JOB_QUEUE_MAX];
+  int fg_streak; // foreground jobs run by the owner while background jobs were waiting
+  int bg_next;   // round robin over the background queues
+} dt_control_deque_t;
 
 /* the queue can have scheduled jobs but all
     the workers are sleeping, so this kicks the workers
@@ -48,13 +67,18 @@ typedef struct _dt_job_t
   dt_pthread_mutex_t wait_mutex;
 
   dt_job_state_t state;
-  unsigned char priority;
   dt_job_queue_t queue;
+  int deque;  // index of the worker deque the job is queued in
+  GList *link; // position in that deque, NULL once taken out
 
   dt_job_state_change_callback state_changed_cb;
 
   dt_progress_t *progress;
 
+  const char *type;   // what the statistics are collected under, see dt_control_job_create()
+  double queued_time; // wall time the job was added
+  double start_time;  // wall time it started running
+
   char description[DT_CONTROL_DESCRIPTION_LEN];
 } _dt_job_t;
 
@@ -74,6 +98,35 @@ static inline int dt_control_job_equal(_dt_job_t *j1, _dt_job_t *j2)
           && (g_strcmp0(j1->description, j2->description) == 0));
 }
 
+// hash matching dt_control_job_equal(), for the index of queued and running system foreground jobs
+static guint dt_control_job_hash(gconstpointer key)
+{
+  const _dt_job_t *job = (const _dt_job_t *)key;
+  guint hash = 5381;
+  hash = ((hash << 5) + hash) ^ (guint)(size_t)job->execute;
+  hash = ((hash << 5) + hash) ^ (guint)(size_t)job->state_changed_cb;
+  hash = ((hash << 5) + hash) ^ (guint)job->queue;
+  if(job->params_size != 0)
+  {
+    const unsigned char *params = (const unsigned char *)job->params;
+    for(size_t k = 0; k < job->params_size; k++) hash = ((hash << 5) + hash) ^ params[k];
+    return hash;
+  }
+  return ((hash << 5) + hash) ^ g_str_hash(job->description);
+}
+
+static gboolean dt_control_job_equal_func(gconstpointer a, gconstpointer b)
+{
+  return dt_control_job_equal((_dt_job_t *)a, (_dt_job_t *)b);
+}
+
+static inline dt_job_class_t _job_class(const dt_job_queue_t queue)
+{
+  if(queue == DT_JOB_QUEUE_USER_FG) return DT_JOB_CLASS_INTERACTIVE;
+  if(queue == DT_JOB_QUEUE_SYSTEM_FG) return DT_JOB_CLASS_FOREGROUND;
+  return DT_JOB_CLASS_BACKGROUND;
+}
+
 static void dt_control_job_set_state(_dt_job_t *job, dt_job_state_t state)
 {
   if(!job) return;
@@ -133,6 +186,8 @@ dt_job_t *dt_control_job_create(dt_job_execute_callback execute, const char *msg
 
   job->execute = execute;
   job->state = DT_JOB_STATE_INITIALIZED;
+  // the format string names the kind of job, unless it only passes through a message
+  job->type = strcmp(msg, "%s") ? msg : job->description;
 
   dt_pthread_mutex_init(&job->state_mutex, NULL);
   dt_pthread_mutex_init(&job->wait_mutex, NULL);
@@ -160,10 +215,194 @@ void dt_control_job_set_state_callback(_dt_job_t *job, dt_job_state_change_callb
 }
 
 
+static inline int _stats_bucket(const double seconds)
+{
+  const double ms = seconds * 1000.0;
+  if(ms < 1.0) return 0;
+  return MIN(DT_CONTROL_JOB_STATS_BUCKETS - 1, 1 + (int)log2(ms));
+}
+
+// forget the throughput of the seconds that dropped out of the window
+static void _stats_advance(dt_control_job_stats_t *stats, const int64_t second)
+{
+  if(second <= stats->second) return;
+  const int64_t stale = MIN(second - stats->second, DT_CONTROL_JOB_STATS_WINDOW);
+  for(int64_t s = second - stale + 1; s <= second; s++) stats->finished[s % DT_CONTROL_JOB_STATS_WINDOW] = 0;
+  stats->second = second;
+}
+
+static void _stats_free(gpointer data)
+{
+  dt_control_job_stats_t *stats = (dt_control_job_stats_t *)data;
+  g_free(stats->type);
+  free(stats);
+}
+
+static void _stats_record(dt_control_t *control, const _dt_job_t *job)
+{
+  const double now = dt_get_wtime();
+  const double wait = MAX(0.0, job->start_time - job->queued_time);
+  const double run = MAX(0.0, now - job->start_time);
+  if(!control->job_stats) return; // a synchronous job after shutdown
+
+  dt_pthread_mutex_lock(&control->stats_mutex);
+  dt_control_job_stats_t *stats = (dt_control_job_stats_t *)g_hash_table_lookup(control->job_stats, job->type);
+  if(!stats)
+  {
+    stats = (dt_control_job_stats_t *)calloc(1, sizeof(dt_control_job_stats_t));
+    stats->type = g_strdup(job->type);
+    stats->second = (int64_t)now;
+    g_hash_table_insert(control->job_stats, stats->type, stats);
+  }
+  stats->count++;
+  stats->wait_sum += wait;
+  stats->wait_max = MAX(stats->wait_max, wait);
+  stats->run_sum += run;
+  stats->run_max = MAX(stats->run_max, run);
+  stats->wait_histogram[_stats_bucket(wait)]++;
+  stats->run_histogram[_stats_bucket(run)]++;
+  _stats_advance(stats, (int64_t)now);
+  stats->finished[stats->second % DT_CONTROL_JOB_STATS_WINDOW]++;
+  dt_pthread_mutex_unlock(&control->stats_mutex);
+}
+
+static gint _stats_cmp(gconstpointer a, gconstpointer b)
+{
+  return g_strcmp0(((const dt_control_job_stats_t *)a)->type, ((const dt_control_job_stats_t *)b)->type);
+}
+
+GList *dt_control_jobs_stats_get(dt_control_t *control)
+{
+  GList *list = NULL;
+  const int64_t now = (int64_t)dt_get_wtime();
+  dt_pthread_mutex_lock(&control->stats_mutex);
+  GHashTableIter iter;
+  gpointer value;
+  g_hash_table_iter_init(&iter, control->job_stats);
+  while(g_hash_table_iter_next(&iter, NULL, &value))
+  {
+    dt_control_job_stats_t *stats = (dt_control_job_stats_t *)value;
+    _stats_advance(stats, now);
+    dt_control_job_stats_t *copy = (dt_control_job_stats_t *)malloc(sizeof(dt_control_job_stats_t));
+    *copy = *stats;
+    copy->type = g_strdup(stats->type);
+    list = g_list_prepend(list, copy);
+  }
+  dt_pthread_mutex_unlock(&control->stats_mutex);
+  return g_list_sort(list, _stats_cmp);
+}
+
+void dt_control_jobs_stats_free(gpointer stats)
+{
+  _stats_free(stats);
+}
+
+double dt_control_jobs_stats_rate(const dt_control_job_stats_t *stats)
+{
+  uint32_t finished = 0;
+  for(int k = 0; k < DT_CONTROL_JOB_STATS_WINDOW; k++) finished += stats->finished[k];
+  return finished / (double)DT_CONTROL_JOB_STATS_WINDOW;
+}
+
+int dt_control_jobs_queued(dt_control_t *control, dt_job_queue_t queue)
+{
+  if(((unsigned int)queue) >= DT_JOB_QUEUE_MAX) return 0;
+  return __sync_fetch_and_add(&control->queued[queue], 0);
+}
+
+const char *dt_control_jobs_queue_name(dt_job_queue_t queue)
+{
+  switch(queue)
+  {
+    case DT_JOB_QUEUE_USER_FG:
+      return "user_fg";
+    case DT_JOB_QUEUE_SYSTEM_FG:
+      return "system_fg";
+    case DT_JOB_QUEUE_USER_BG:
+      return "user_bg";
+    case DT_JOB_QUEUE_USER_EXPORT:
+      return "user_export";
+    case DT_JOB_QUEUE_SYSTEM_BG:
+      return "system_bg";
+    default:
+      return "unknown";
+  }
+}
+
+static void _json_string(GString *json, const char *str)
+{
+  g_string_append_c(json, '"');
+  for(const char *c = str; *c; c++)
+  {
+    if(*c == '"' || *c == '\\')
+      g_string_append_printf(json, "\\%c", *c);
+    else if((unsigned char)*c < 0x20)
+      g_string_append_printf(json, "\\u%04x", (unsigned char)*c);
+    else
+      g_string_append_c(json, *c);
+  }
+  g_string_append_c(json, '"');
+}
+
+static void _json_timing(GString *json, const char *name, const uint64_t count, const double sum,
+                         const double max, const uint32_t *histogram)
+{
+  g_string_append_printf(json, "\"%s\": {\"mean\": %f, \"max\": %f, \"histogram\": [", name,
+                         count ? sum / count : 0.0, max);
+  for(int k = 0; k < DT_CONTROL_JOB_STATS_BUCKETS; k++)
+    g_string_append_printf(json, "%s%u", k ? ", " : "", histogram[k]);
+  g_string_append(json, "]}");
+}
+
+gchar *dt_control_jobs_stats_json(dt_control_t *control)
+{
+  GList *list = dt_control_jobs_stats_get(control);
+  GString *json = g_string_new("{\n");
+
+  g_string_append_printf(json, "  \"uptime\": %f,\n", dt_get_wtime() - control->stats_start);
+  g_string_append_printf(json, "  \"workers\": %d,\n", control->num_threads);
+  g_string_append_printf(json, "  \"busy_workers\": %d,\n", __sync_fetch_and_add(&control->busy_workers, 0));
+
+  g_string_append(json, "  \"queues\": {");
+  for(int q = 0; q < DT_JOB_QUEUE_MAX; q++)
+    g_string_append_printf(json, "%s\"%s\": %d", q ? ", " : "", dt_control_jobs_queue_name(q),
+                           dt_control_jobs_queued(control, q));
+  g_string_append(json, "},\n");
+
+  double rate = 0.0;
+  for(GList *iter = list; iter; iter = g_list_next(iter))
+    rate += dt_control_jobs_stats_rate((dt_control_job_stats_t *)iter->data);
+  g_string_append_printf(json, "  \"jobs_per_second\": %f,\n", rate);
+
+  // upper bounds of the histogram buckets in ms, the last bucket has none
+  g_string_append(json, "  \"histogram_ms\": [");
+  for(int k = 0; k < DT_CONTROL_JOB_STATS_BUCKETS - 1; k++)
+    g_string_append_printf(json, "%s%d", k ? ", " : "", 1 << k);
+  g_string_append(json, "],\n");
+
+  g_string_append(json, "  \"types\": [");
+  for(GList *iter = list; iter; iter = g_list_next(iter))
+  {
+    const dt_control_job_stats_t *stats = (dt_control_job_stats_t *)iter->data;
+    g_string_append_printf(json, "%s\n    {\"type\": ", iter == list ? "" : ",");
+    _json_string(json, stats->type);
+    g_string_append_printf(json, ", \"count\": %" PRIu64 ", \"jobs_per_second\": %f, ", stats->count,
+                           dt_control_jobs_stats_rate(stats));
+    _json_timing(json, "wait", stats->count, stats->wait_sum, stats->wait_max, stats->wait_histogram);
+    g_string_append(json, ", ");
+    _json_timing(json, "run", stats->count, stats->run_sum, stats->run_max, stats->run_histogram);
+    g_string_append(json, "}");
+  }
+  g_string_append(json, list ? "\n  ]\n}\n" : "]\n}\n");
+
+  g_list_free_full(list, dt_control_jobs_stats_free);
+  return g_string_free(json, FALSE);
+}
+
 static void dt_control_job_print(_dt_job_t *job)
 {
   if(!job) return;
-  dt_print(DT_DEBUG_CONTROL, "%s | queue: %d | priority: %d", job->description, job->queue, job->priority);
+  dt_print(DT_DEBUG_CONTROL, "%s | queue: %d | class: %d", job->description, job->queue, _job_class(job->queue));
 }
 
 void dt_control_job_cancel(_dt_job_t *job)
@@ -216,7 +455,11 @@ static int32_t dt_control_run_job_res(dt_control_t *control, int32_t res)
     dt_control_job_set_state(job, DT_JOB_STATE_RUNNING);
 
     /* execute job */
+    const int64_t trace_start = dt_trace_now();
+    job->start_time = dt_get_wtime();
     job->result = job->execute(job);
+    _stats_record(control, job);
+    dt_trace_span("job", job->type, trace_start, job->description);
 
     dt_control_job_set_state(job, DT_JOB_STATE_FINISHED);
     dt_print(DT_DEBUG_CONTROL, "[run_job-] %02d %f ", res, dt_get_wtime());
@@ -228,67 +471,95 @@ static int32_t dt_control_run_job_res(dt_control_t *control, int32_t res)
   return 0;
 }
 
+// take the first job of queue from deque d, NULL if there is none. system foreground jobs
+// move from the queued to the running index, so the caller needs to hold queue_mutex for those.
+static _dt_job_t *_deque_pop(dt_control_t *control, const int d, const dt_job_queue_t queue)
+{
+  dt_control_deque_t *deque = &control->deques[d];
+  dt_pthread_mutex_lock(&deque->lock);
+  _dt_job_t *job = (_dt_job_t *)g_queue_pop_head(&deque->queue[queue]);
+  if(job) job->link = NULL;
+  dt_pthread_mutex_unlock(&deque->lock);
+  if(!job) return NULL;
+
+  __sync_fetch_and_sub(&control->queued[queue], 1);
+  if(queue == DT_JOB_QUEUE_SYSTEM_FG)
+  {
+    g_hash_table_remove(control->queued_jobs, job);
+    g_hash_table_add(control->running_jobs, job);
+  }
+  return job;
+}
+
+// look for a job in queue, starting with our own deque
+static _dt_job_t *_steal(dt_control_t *control, const int self, const dt_job_queue_t queue)
+{
+  if(!__sync_fetch_and_add(&control->queued[queue], 0)) return NULL;
+
+  const int locked = (queue == DT_JOB_QUEUE_SYSTEM_FG || queue == DT_JOB_QUEUE_USER_EXPORT);
+  if(locked) dt_pthread_mutex_lock(&control->queue_mutex);
+
+  // only one export at a time is allowed
+  _dt_job_t *job = NULL;
+  if(queue != DT_JOB_QUEUE_USER_EXPORT || !control->export_scheduled)
+  {
+    for(int k = 0; k < control->num_threads && !job; k++)
+      job = _deque_pop(control, (self + k) % control->num_threads, queue);
+    if(job && queue == DT_JOB_QUEUE_USER_EXPORT) control->export_scheduled = TRUE;
+  }
+
+  if(locked) dt_pthread_mutex_unlock(&control->queue_mutex);
+  return job;
+}
+
 static _dt_job_t *dt_control_schedule_job(dt_control_t *control)
 {
   /*
    * job scheduling works like this:
-   * - when there is a single job in the queue head with a maximal priority -> pick it
-   * - otherwise pick among the ones with the maximal priority in the following order:
-   *   * user foreground
-   *   * system foreground
-   *   * user background
-   *   * system background
-   * - the jobs that didn't get picked this round get their priority incremented
+   * - interactive jobs (user foreground) always go first
+   * - then system foreground jobs, newest first
+   * - background jobs (user background, export, system background) take turns with each other.
+   *   they are picked before system foreground once DT_CONTROL_FG_PRIORITY foreground jobs in a row
+   *   ran on this worker while they were waiting, so they can't starve.
+   * every queue is searched in our own deque first, then in the ones of the other workers.
    */
+  const int self = CLAMP(dt_control_get_threadid(), 0, control->num_threads - 1);
+  dt_control_deque_t *deque = &control->deques[self];
 
-  dt_pthread_mutex_lock(&control->queue_mutex);
+  static const dt_job_queue_t background[] = { DT_JOB_QUEUE_USER_BG, DT_JOB_QUEUE_USER_EXPORT,
+                                               DT_JOB_QUEUE_SYSTEM_BG };
+  const int n_background = sizeof(background) / sizeof(background[0]);
 
-  // find the job
-  _dt_job_t *job = NULL;
-  int winner_queue = DT_JOB_QUEUE_MAX;
-  int max_priority = -1;
-  for(int i = 0; i < DT_JOB_QUEUE_MAX; i++)
+  _dt_job_t *job = _steal(control, self, DT_JOB_QUEUE_USER_FG);
+  if(job) return job;
+
+  int bg_waiting = 0;
+  for(int k = 0; k < n_background; k++) bg_waiting += __sync_fetch_and_add(&control->queued[background[k]], 0);
+
+  if(!bg_waiting || deque->fg_streak < DT_CONTROL_FG_PRIORITY)
   {
-    if(control->queues[i] == NULL) continue;
-    if(control->export_scheduled && i == DT_JOB_QUEUE_USER_EXPORT) continue;
-    _dt_job_t *_job = (_dt_job_t *)control->queues[i]->data;
-    if(_job->priority > max_priority)
+    job = _steal(control, self, DT_JOB_QUEUE_SYSTEM_FG);
+    if(job)
     {
-      max_priority = _job->priority;
-      job = _job;
-      winner_queue = i;
+      if(bg_waiting) deque->fg_streak++;
+      return job;
     }
   }
 
-  if(!job)
+  for(int k = 0; k < n_background && !job; k++)
   {
-    dt_pthread_mutex_unlock(&control->queue_mutex);
-    return NULL;
+    const int i = (deque->bg_next + k) % n_background;
+    job = _steal(control, self, background[i]);
+    if(job) deque->bg_next = (i + 1) % n_background;
   }
-
-  // the order of the queues in control->queues matches our priority, and we only update job when the priority
-  // is strictly bigger
-  // invariant -> job is the one we are looking for
-
-  // remove the to be scheduled job from its queue
-  GList **queue = &control->queues[winner_queue];
-  *queue = g_list_delete_link(*queue, *queue);
-  control->queue_length[winner_queue]--;
-  if(winner_queue == DT_JOB_QUEUE_USER_EXPORT) control->export_scheduled = TRUE;
-
-  // and place it in scheduled job array (for job deduping)
-  control->job[dt_control_get_threadid()] = job;
-
-  // increment the priorities of the others
-  for(int i = 0; i < DT_JOB_QUEUE_MAX; i++)
+  if(job)
   {
-    if(i == winner_queue || control->queues[i] == NULL) continue;
-    ((_dt_job_t *)control->queues[i]->data)->priority++;
+    deque->fg_streak = 0;
+    return job;
   }
 
-  dt_pthread_mutex_unlock(&control->queue_mutex);
-
-  return job;
+  // the background jobs we were waiting for got taken by someone else
+  return _steal(control, self, DT_JOB_QUEUE_SYSTEM_FG);
 }
 
 static void dt_control_job_execute(_dt_job_t *job)
@@ -301,7 +572,11 @@ static void dt_control_job_execute(_dt_job_t *job)
   dt_control_job_set_state(job, DT_JOB_STATE_RUNNING);
 
   /* execute job */
+  const int64_t trace_start = dt_trace_now();
+  job->start_time = dt_get_wtime();
   job->result = job->execute(job);
+  _stats_record(darktable.control, job);
+  dt_trace_span("job", job->type, trace_start, job->description);
 
   dt_control_job_set_state(job, DT_JOB_STATE_FINISHED);
 
@@ -311,6 +586,10 @@ static void dt_control_job_execute(_dt_job_t *job)
   dt_print(DT_DEBUG_CONTROL, "\n");
 }
 
+static __thread int threadid = -1;
+// cpus this worker may use for openmp, those of its numa node if it got pinned to one
+static __thread int omp_budget = 1;
+
 static int32_t dt_control_run_job(dt_control_t *control)
 {
   _dt_job_t *job = dt_control_schedule_job(control);
@@ -320,15 +599,30 @@ static int32_t dt_control_run_job(dt_control_t *control)
   /* change state to running */
   dt_pthread_mutex_lock(&job->wait_mutex);
   if(dt_control_job_get_state(job) == DT_JOB_STATE_QUEUED)
+  {
+    // all workers draw from the same cores: split them among the ones busy right now, instead of
+    // every one of them starting a full set of openmp threads. rawspeed follows along, see
+    // rawspeed_get_number_of_processor_cores().
+#ifdef _OPENMP
+    const int busy = __sync_add_and_fetch(&control->busy_workers, 1);
+    omp_set_num_threads(MAX(1, MIN(omp_budget, darktable.num_openmp_threads / busy)));
+#endif
     dt_control_job_execute(job);
+#ifdef _OPENMP
+    __sync_fetch_and_sub(&control->busy_workers, 1);
+#endif
+  }
 
   dt_pthread_mutex_unlock(&job->wait_mutex);
 
-  // remove the job from scheduled job array (for job deduping)
-  dt_pthread_mutex_lock(&control->queue_mutex);
-  control->job[dt_control_get_threadid()] = NULL;
-  if(job->queue == DT_JOB_QUEUE_USER_EXPORT) control->export_scheduled = FALSE;
-  dt_pthread_mutex_unlock(&control->queue_mutex);
+  // remove the job from the index of running jobs (for job deduping)
+  if(job->queue == DT_JOB_QUEUE_SYSTEM_FG || job->queue == DT_JOB_QUEUE_USER_EXPORT)
+  {
+    dt_pthread_mutex_lock(&control->queue_mutex);
+    if(job->queue == DT_JOB_QUEUE_SYSTEM_FG) g_hash_table_remove(control->running_jobs, job);
+    if(job->queue == DT_JOB_QUEUE_USER_EXPORT) control->export_scheduled = FALSE;
+    dt_pthread_mutex_unlock(&control->queue_mutex);
+  }
 
   // and free it
   dt_control_job_dispose(job);
@@ -354,6 +648,8 @@ int32_t dt_control_add_job_res(dt_control_t *control, _dt_job_t *job, int32_t re
     dt_control_job_dispose(control->job_res[res]);
   }
 
+  job->queued_time = dt_get_wtime();
+
   dt_print(DT_DEBUG_CONTROL, "[add_job_res] %d | ", res);
   dt_control_job_print(job);
   dt_print(DT_DEBUG_CONTROL, "\n");
@@ -379,6 +675,8 @@ int dt_control_add_job(dt_control_t *control, dt_job_queue_t queue_id, _dt_job_t
     return 1;
   }
 
+  job->queued_time = dt_get_wtime();
+
   if(!control->running)
   {
     // whatever we are adding here won't be scheduled as the system isn't running. execute it synchronous instead.
@@ -392,91 +690,82 @@ int dt_control_add_job(dt_control_t *control, dt_job_queue_t queue_id, _dt_job_t
 
   job->queue = queue_id;
 
-  _dt_job_t *job_for_disposal = NULL;
-
-  dt_pthread_mutex_lock(&control->queue_mutex);
-
-  GList **queue = &control->queues[queue_id];
-  size_t length = control->queue_length[queue_id];
+  // the fifos keep their order by living in a single deque. everything else is spread over the
+  // workers, and a job added by a worker goes to its own deque as it likely works on the same data.
+  const int self = dt_control_get_threadid();
+  if(queue_id != DT_JOB_QUEUE_USER_FG && queue_id != DT_JOB_QUEUE_SYSTEM_FG)
+    job->deque = queue_id % control->num_threads;
+  else if(self < control->num_threads)
+    job->deque = self;
+  else
+    job->deque = __sync_fetch_and_add(&control->next_deque, 1) % control->num_threads;
+  dt_control_deque_t *deque = &control->deques[job->deque];
 
-  dt_print(DT_DEBUG_CONTROL, "[add_job] %zu | ", length);
+  dt_print(DT_DEBUG_CONTROL, "[add_job] %d | ", __sync_fetch_and_add(&control->queued[queue_id], 0));
   dt_control_job_print(job);
   dt_print(DT_DEBUG_CONTROL, "\n");
 
+  _dt_job_t *job_for_disposal = NULL;
+
   if(queue_id == DT_JOB_QUEUE_SYSTEM_FG)
   {
-    // this is a stack with limited size and bubble up and all that stuff
-    job->priority = DT_CONTROL_FG_PRIORITY;
+    // this is a stack: the newest job runs first, and a job already queued moves back to the top
+    dt_pthread_mutex_lock(&control->queue_mutex);
 
     // check if we have already scheduled the job
-    for(int k = 0; k < control->num_threads; k++)
+    _dt_job_t *other_job = (_dt_job_t *)g_hash_table_lookup(control->running_jobs, job);
+    if(other_job)
     {
-      _dt_job_t *other_job = (_dt_job_t *)control->job[k];
-      if(dt_control_job_equal(job, other_job))
-      {
-        dt_print(DT_DEBUG_CONTROL, "[add_job] found job already in scheduled: ");
-        dt_control_job_print(other_job);
-        dt_print(DT_DEBUG_CONTROL, "\n");
+      dt_print(DT_DEBUG_CONTROL, "[add_job] found job already in scheduled: ");
+      dt_control_job_print(other_job);
+      dt_print(DT_DEBUG_CONTROL, "\n");
 
-        dt_pthread_mutex_unlock(&control->queue_mutex);
+      dt_pthread_mutex_unlock(&control->queue_mutex);
 
-        dt_control_job_set_state(job, DT_JOB_STATE_DISCARDED);
-        dt_control_job_dispose(job);
+      dt_control_job_set_state(job, DT_JOB_STATE_DISCARDED);
+      dt_control_job_dispose(job);
 
-        return 0; // there can't be any further copy
-      }
+      return 0; // there can't be any further copy
     }
 
-    // if the job is already in the queue -> move it to the top
-    for(GList *iter = *queue; iter; iter = g_list_next(iter))
+    other_job = (_dt_job_t *)g_hash_table_lookup(control->queued_jobs, job);
+    if(other_job)
     {
-      _dt_job_t *other_job = (_dt_job_t *)iter->data;
-      if(dt_control_job_equal(job, other_job))
-      {
-        dt_print(DT_DEBUG_CONTROL, "[add_job] found job already in queue: ");
-        dt_control_job_print(other_job);
-        dt_print(DT_DEBUG_CONTROL, "\n");
-
-        *queue = g_list_delete_link(*queue, iter);
-        length--;
+      dt_print(DT_DEBUG_CONTROL, "[add_job] found job already in queue: ");
+      dt_control_job_print(other_job);
+      dt_print(DT_DEBUG_CONTROL, "\n");
 
-        job_for_disposal = job;
+      dt_control_deque_t *other_deque = &control->deques[other_job->deque];
+      dt_pthread_mutex_lock(&other_deque->lock);
+      g_queue_unlink(&other_deque->queue[queue_id], other_job->link);
+      g_queue_push_head_link(&other_deque->queue[queue_id], other_job->link);
+      dt_pthread_mutex_unlock(&other_deque->lock);
 
-        job = other_job;
-        break; // there can't be any further copy in the list
-      }
+      job_for_disposal = job;
     }
-
-    // now we can add the new job to the list
-    *queue = g_list_prepend(*queue, job);
-    length++;
-
-    // and take care of the maximal queue size
-    if(length > DT_CONTROL_MAX_JOBS)
+    else
     {
-      GList *last = g_list_last(*queue);
-      dt_control_job_set_state((_dt_job_t *)last->data, DT_JOB_STATE_DISCARDED);
-      dt_control_job_dispose((_dt_job_t *)last->data);
-      *queue = g_list_delete_link(*queue, last);
-      length--;
+      g_hash_table_add(control->queued_jobs, job);
+      dt_control_job_set_state(job, DT_JOB_STATE_QUEUED);
+      dt_pthread_mutex_lock(&deque->lock);
+      g_queue_push_head(&deque->queue[queue_id], job);
+      job->link = deque->queue[queue_id].head;
+      dt_pthread_mutex_unlock(&deque->lock);
+      __sync_fetch_and_add(&control->queued[queue_id], 1);
     }
 
-    control->queue_length[queue_id] = length;
+    dt_pthread_mutex_unlock(&control->queue_mutex);
   }
   else
   {
     // the rest are FIFOs
-    if(queue_id == DT_JOB_QUEUE_USER_BG ||
-       queue_id == DT_JOB_QUEUE_USER_EXPORT ||
-       queue_id == DT_JOB_QUEUE_SYSTEM_BG)
-      job->priority = 0;
-    else
-      job->priority = DT_CONTROL_FG_PRIORITY;
-    *queue = g_list_append(*queue, job);
-    control->queue_length[queue_id]++;
+    dt_control_job_set_state(job, DT_JOB_STATE_QUEUED);
+    dt_pthread_mutex_lock(&deque->lock);
+    g_queue_push_tail(&deque->queue[queue_id], job);
+    job->link = deque->queue[queue_id].tail;
+    dt_pthread_mutex_unlock(&deque->lock);
+    __sync_fetch_and_add(&control->queued[queue_id], 1);
   }
-  dt_control_job_set_state(job, DT_JOB_STATE_QUEUED);
-  dt_pthread_mutex_unlock(&control->queue_mutex);
 
   // notify workers
   dt_pthread_mutex_lock(&control->cond_mutex);
@@ -490,8 +779,6 @@ int dt_control_add_job(dt_control_t *control, dt_job_queue_t queue_id, _dt_job_t
   return 0;
 }
 
-static __thread int threadid = -1;
-
 int32_t dt_control_get_threadid()
 {
   if(threadid > -1) return threadid;
@@ -561,6 +848,10 @@ static void *dt_control_work(void *ptr)
   snprintf(name, sizeof(name), "worker %d", threadid);
   dt_pthread_setname(name);
   free(params);
+  // on numa machines, keep the worker and the openmp threads it spawns on one node, next to the
+  // memory they allocate
+  const int node_cpus = dt_pthread_set_numa_node(threadid);
+  omp_budget = node_cpus > 0 ? MIN(node_cpus, darktable.num_openmp_threads) : darktable.num_openmp_threads;
   // int32_t threadid = dt_control_get_threadid();
   while(dt_control_running())
   {
@@ -611,7 +902,23 @@ void dt_control_jobs_init(dt_control_t *control)
   // start threads
   control->num_threads = CLAMP(dt_conf_get_int("worker_threads"), 1, 8);
   control->thread = (pthread_t *)calloc(control->num_threads, sizeof(pthread_t));
-  control->job = (dt_job_t **)calloc(control->num_threads, sizeof(dt_job_t *));
+  control->deques = (dt_control_deque_t *)calloc(control->num_threads, sizeof(dt_control_deque_t));
+  for(int k = 0; k < control->num_threads; k++)
+  {
+    dt_pthread_mutex_init(&control->deques[k].lock, NULL);
+    for(int q = 0; q < DT_JOB_QUEUE_MAX; q++) g_queue_init(&control->deques[k].queue[q]);
+  }
+  control->queued_jobs = g_hash_table_new(dt_control_job_hash, dt_control_job_equal_func);
+  control->running_jobs = g_hash_table_new(dt_control_job_hash, dt_control_job_equal_func);
+  control->next_deque = 0;
+  control->busy_workers = 0;
+  dt_pthread_mutex_init(&control->stats_mutex, NULL);
+  control->job_stats = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, _stats_free);
+  control->stats_start = dt_get_wtime();
+  if(dt_pthread_numa_nodes() > 1)
+    dt_print(DT_DEBUG_CONTROL, "[dt_control_jobs_init] spreading workers over %d numa nodes\n",
+             dt_pthread_numa_nodes());
+  for(int q = 0; q < DT_JOB_QUEUE_MAX; q++) control->queued[q] = 0;
   dt_pthread_mutex_lock(&control->run_mutex);
   control->running = 1;
   dt_pthread_mutex_unlock(&control->run_mutex);
@@ -641,7 +948,23 @@ void dt_control_jobs_init(dt_control_t *control)
 
 void dt_control_jobs_cleanup(dt_control_t *control)
 {
-  free(control->job);
+  for(int k = 0; k < control->num_threads; k++)
+  {
+    for(int q = 0; q < DT_JOB_QUEUE_MAX; q++) g_queue_clear(&control->deques[k].queue[q]);
+    dt_pthread_mutex_destroy(&control->deques[k].lock);
+  }
+  free(control->deques);
+  g_hash_table_destroy(control->queued_jobs);
+  g_hash_table_destroy(control->running_jobs);
+  if(darktable.unmuted & DT_DEBUG_CONTROL)
+  {
+    gchar *json = dt_control_jobs_stats_json(control);
+    dt_print(DT_DEBUG_CONTROL, "[dt_control_jobs_cleanup] job statistics:\n%s", json);
+    g_free(json);
+  }
+  g_hash_table_destroy(control->job_stats);
+  control->job_stats = NULL;
+  dt_pthread_mutex_destroy(&control->stats_mutex);
   free(control->thread);
 }
 
@@ -44,7 +44,7 @@ typedef enum dt_job_state_t
 typedef enum dt_job_queue_t
 {
   DT_JOB_QUEUE_USER_FG = 0,     // gui actions, ...
-  DT_JOB_QUEUE_SYSTEM_FG = 1,   // thumbnail creation, ..., may be pushed out of the queue
+  DT_JOB_QUEUE_SYSTEM_FG = 1,   // thumbnail creation, ..., newest first, duplicates are dropped
   DT_JOB_QUEUE_USER_BG = 2,     // imports, ...
   DT_JOB_QUEUE_USER_EXPORT = 3, // exports. only one of these jobs will ever be scheduled at a time
   DT_JOB_QUEUE_SYSTEM_BG = 4,   // some lua stuff that may not be pushed out of the queue, ...
@@ -91,6 +91,34 @@ int32_t dt_control_add_job_res(struct dt_control_t *s, dt_job_t *job, int32_t re
 
 int32_t dt_control_get_threadid();
 
+#define DT_CONTROL_JOB_STATS_BUCKETS 16 // bucket k > 0 holds durations of [2^(k-1), 2^k) ms, 0 the shorter ones
+#define DT_CONTROL_JOB_STATS_WINDOW 10  // seconds throughput is averaged over
+
+/** timings of all jobs created with the same format string (or the same message, for a plain "%s"). */
+typedef struct dt_control_job_stats_t
+{
+  char *type;
+  uint64_t count;
+  double wait_sum, wait_max; // seconds between being queued and starting to run
+  double run_sum, run_max;   // seconds spent running
+  uint32_t wait_histogram[DT_CONTROL_JOB_STATS_BUCKETS];
+  uint32_t run_histogram[DT_CONTROL_JOB_STATS_BUCKETS];
+  int64_t second; // wall time second of the newest entry in finished
+  uint32_t finished[DT_CONTROL_JOB_STATS_WINDOW];
+} dt_control_job_stats_t;
+
+/** a snapshot of the statistics of all job types. free with g_list_free_full(list, dt_control_job_stats_free). */
+GList *dt_control_jobs_stats_get(struct dt_control_t *control);
+void dt_control_jobs_stats_free(gpointer stats);
+/** jobs finished per second over the last DT_CONTROL_JOB_STATS_WINDOW seconds. */
+double dt_control_jobs_stats_rate(const dt_control_job_stats_t *stats);
+/** jobs currently waiting in queue. */
+int dt_control_jobs_queued(struct dt_control_t *control, dt_job_queue_t queue);
+/** name of a queue, as used in the json dump and by lua. */
+const char *dt_control_jobs_queue_name(dt_job_queue_t queue);
+/** queue depths, throughput and the per type statistics as a json object. free with g_free(). */
+gchar *dt_control_jobs_stats_json(struct dt_control_t *control);
+
 #ifdef HAVE_GPHOTO2
 #include "control/jobs/camera_jobs.h"
 #endif
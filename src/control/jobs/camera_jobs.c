@@ -17,6 +17,9 @@
 */
 #include "control/jobs/camera_jobs.h"
 #include "common/darktable.h"
+#include "common/database.h"
+#include "common/exif.h"
+#include "common/image.h"
 #include "common/import_session.h"
 #include "common/utility.h"
 #include "control/conf.h"
@@ -56,6 +59,29 @@ typedef struct dt_camera_get_previews_t
   void *data;
 } dt_camera_get_previews_t;
 
+// the downloaded images are put into the database in transactions of at most this many
+#define DT_CAMERA_IMPORT_BATCH 64
+
+/* the files downloaded from the camera are handed on to a few threads reading their metadata, and from there
+ * to one thread putting them into the database. that way the next download starts right after the last one is
+ * written, and the transfer doesn't wait for the library. */
+typedef struct dt_camera_import_queue_t
+{
+  dt_pthread_mutex_t lock;
+  pthread_cond_t cond;  // something got queued, or the download is done
+  GQueue *downloaded;   // filenames waiting to be read
+  GQueue *read;         // dt_camera_import_file_t waiting to be imported
+  int reading;          // files being read right now
+  int readers;          // threads reading, 0 if the import thread reads the files itself
+  int done;             // the download is over, nothing more will be queued
+} dt_camera_import_queue_t;
+
+typedef struct dt_camera_import_file_t
+{
+  gchar *filename;
+  dt_exif_prefetch_t *exif; // NULL if nobody read ahead
+} dt_camera_import_file_t;
+
 typedef struct dt_camera_import_t
 {
   dt_camera_shared_t shared;
@@ -65,6 +91,7 @@ typedef struct dt_camera_import_t
   dt_job_t *job;
   double fraction;
   uint32_t import_count;
+  dt_camera_import_queue_t queue;
 } dt_camera_import_t;
 
 void *dt_camera_previews_job_get_data(const dt_job_t *job)
@@ -270,23 +297,109 @@ dt_job_t *dt_camera_get_previews_job_create(dt_camera_t *camera, dt_camctl_liste
   return job;
 }
 
-/** Listener interface for import job */
-void _camera_import_image_downloaded(const dt_camera_t *camera, const char *filename, void *data)
+static void *_camera_import_reader(void *data)
+{
+  dt_camera_import_queue_t *queue = (dt_camera_import_queue_t *)data;
+  dt_pthread_setname("camera read");
+  dt_pthread_mutex_lock(&queue->lock);
+  while(1)
+  {
+    while(!queue->done && g_queue_is_empty(queue->downloaded)) dt_pthread_cond_wait(&queue->cond, &queue->lock);
+    if(g_queue_is_empty(queue->downloaded)) break;
+    dt_camera_import_file_t *file = (dt_camera_import_file_t *)g_malloc(sizeof(dt_camera_import_file_t));
+    file->filename = (gchar *)g_queue_pop_head(queue->downloaded);
+    queue->reading++;
+    dt_pthread_mutex_unlock(&queue->lock);
+
+    file->exif = dt_exif_prefetch(file->filename);
+
+    dt_pthread_mutex_lock(&queue->lock);
+    g_queue_push_tail(queue->read, file);
+    queue->reading--;
+    pthread_cond_broadcast(&queue->cond);
+  }
+  dt_pthread_mutex_unlock(&queue->lock);
+  return NULL;
+}
+
+/* the next file to import, waiting for it if need be. NULL once everything is imported. */
+static dt_camera_import_file_t *_camera_import_take(dt_camera_import_queue_t *queue)
+{
+  dt_camera_import_file_t *file = NULL;
+  dt_pthread_mutex_lock(&queue->lock);
+  while(1)
+  {
+    file = (dt_camera_import_file_t *)g_queue_pop_head(queue->read);
+    if(file) break;
+    if(!queue->readers && !g_queue_is_empty(queue->downloaded))
+    {
+      file = (dt_camera_import_file_t *)g_malloc0(sizeof(dt_camera_import_file_t));
+      file->filename = (gchar *)g_queue_pop_head(queue->downloaded);
+      break;
+    }
+    if(queue->done && !queue->reading && g_queue_is_empty(queue->downloaded)) break;
+    dt_pthread_cond_wait(&queue->cond, &queue->lock);
+  }
+  dt_pthread_mutex_unlock(&queue->lock);
+  return file;
+}
+
+/* nothing is ready to be imported right now */
+static int _camera_import_idle(dt_camera_import_queue_t *queue)
+{
+  dt_pthread_mutex_lock(&queue->lock);
+  const int idle = g_queue_is_empty(queue->read) && (queue->readers || g_queue_is_empty(queue->downloaded));
+  dt_pthread_mutex_unlock(&queue->lock);
+  return idle;
+}
+
+static void *_camera_import_importer(void *data)
 {
-  // Import downloaded image to import filmroll
   dt_camera_import_t *t = (dt_camera_import_t *)data;
-  dt_image_import(dt_import_session_film_id(t->shared.session), filename, FALSE);
-  dt_control_queue_redraw_center();
-  gchar *basename = g_path_get_basename(filename);
-  dt_control_log(ngettext("%d/%d imported to %s", "%d/%d imported to %s", t->import_count + 1),
-                 t->import_count + 1, g_list_length(t->images), basename);
-  g_free(basename);
+  dt_pthread_setname("camera import");
+  const guint total = g_list_length(t->images);
+  int batch = 0;
+  dt_camera_import_file_t *file;
+  while((file = _camera_import_take(&t->queue)))
+  {
+    // don't keep the database locked while waiting for the camera
+    if(!batch) sqlite3_exec(dt_database_get(darktable.db), "BEGIN TRANSACTION", NULL, NULL, NULL);
+    dt_image_import_prefetched(dt_import_session_film_id(t->shared.session), file->filename, FALSE, file->exif);
+    if(++batch == DT_CAMERA_IMPORT_BATCH || _camera_import_idle(&t->queue))
+    {
+      sqlite3_exec(dt_database_get(darktable.db), "COMMIT", NULL, NULL, NULL);
+      batch = 0;
+    }
+
+    dt_control_queue_redraw_center();
+    gchar *basename = g_path_get_basename(file->filename);
+    dt_control_log(ngettext("%d/%d imported to %s", "%d/%d imported to %s", t->import_count + 1),
+                   t->import_count + 1, total, basename);
+    g_free(basename);
 
-  t->fraction += 1.0 / g_list_length(t->images);
+    t->fraction += 1.0 / total;
 
-  dt_control_job_set_progress(t->job, t->fraction);
+    dt_control_job_set_progress(t->job, t->fraction);
 
-  t->import_count++;
+    t->import_count++;
+
+    if(file->exif) dt_exif_prefetch_free(file->exif);
+    g_free(file->filename);
+    g_free(file);
+  }
+  if(batch) sqlite3_exec(dt_database_get(darktable.db), "COMMIT", NULL, NULL, NULL);
+  return NULL;
+}
+
+/** Listener interface for import job */
+void _camera_import_image_downloaded(const dt_camera_t *camera, const char *filename, void *data)
+{
+  // queue the downloaded image for import to the filmroll, the camera goes on with the next one
+  dt_camera_import_t *t = (dt_camera_import_t *)data;
+  dt_pthread_mutex_lock(&t->queue.lock);
+  g_queue_push_tail(t->queue.downloaded, g_strdup(filename));
+  pthread_cond_broadcast(&t->queue.cond);
+  dt_pthread_mutex_unlock(&t->queue.lock);
 }
 
 static const char *_camera_request_image_filename(const dt_camera_t *camera, const char *filename,
@@ -345,11 +458,47 @@ static int32_t dt_camera_import_job_run(dt_job_t *job)
   listener.request_image_path = _camera_request_image_path;
   listener.request_image_filename = _camera_request_image_filename;
 
+  // start the threads importing what got downloaded
+  dt_camera_import_queue_t *queue = &params->queue;
+  const int num_readers = CLAMP(dt_conf_get_int("plugins/lighttable/import/parallel"), 0, (int)total);
+  pthread_t *readers = (pthread_t *)calloc(MAX(num_readers, 1), sizeof(pthread_t));
+  pthread_t importer;
+  dt_pthread_mutex_init(&queue->lock, NULL);
+  pthread_cond_init(&queue->cond, NULL);
+  queue->downloaded = g_queue_new();
+  queue->read = g_queue_new();
+  if(readers)
+    for(; queue->readers < num_readers; queue->readers++)
+      if(dt_pthread_create(&readers[queue->readers], _camera_import_reader, queue)) break;
+  const int threaded = !dt_pthread_create(&importer, _camera_import_importer, params);
+  dt_print(DT_DEBUG_CONTROL, "[camera_import] reading metadata with %d threads\n", queue->readers);
+
   // start download of images
   dt_camctl_register_listener(darktable.camctl, &listener);
   dt_camctl_import(darktable.camctl, params->camera, params->images);
   dt_camctl_unregister_listener(darktable.camctl, &listener);
 
+  // let the threads finish what is queued
+  dt_pthread_mutex_lock(&queue->lock);
+  queue->done = 1;
+  pthread_cond_broadcast(&queue->cond);
+  dt_pthread_mutex_unlock(&queue->lock);
+  if(threaded)
+    pthread_join(importer, NULL);
+  else
+  {
+    // threads couldn't be started, import here
+    for(int k = 0; k < queue->readers; k++) pthread_join(readers[k], NULL);
+    queue->readers = 0;
+    _camera_import_importer(params);
+  }
+  for(int k = 0; k < queue->readers; k++) pthread_join(readers[k], NULL);
+  free(readers);
+  g_queue_free(queue->downloaded);
+  g_queue_free(queue->read);
+  pthread_cond_destroy(&queue->cond);
+  dt_pthread_mutex_destroy(&queue->lock);
+
   // notify the user via the window manager
   dt_ui_notify_user();
 
@@ -403,6 +552,8 @@ dt_job_t *dt_camera_import_job_create(const char *jobcode, GList *images, struct
   return job;
 }
 
+#undef DT_CAMERA_IMPORT_BATCH
+
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
 // kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
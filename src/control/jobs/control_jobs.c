@@ -30,9 +30,11 @@
 #include "common/imageio_dng.h"
 #include "common/imageio_module.h"
 #include "common/mipmap_cache.h"
+#include "common/opencl.h"
 #include "common/tags.h"
 #include "control/conf.h"
 #include "develop/imageop_math.h"
+#include "develop/tiling.h"
 
 #include "gui/gtk.h"
 
@@ -243,6 +245,12 @@ typedef struct dt_control_merge_hdr_t
   float whitelevel;
   float epsw;
 
+  // the frame being merged: its calibration, the first row not merged yet and the last three rows its export
+  // pipe handed over, for the blocks reaching into the next band
+  float cal, photoncnt;
+  int next_row;
+  float *carry;
+
   // 0 - ok; 1 - errors, abort
   gboolean abort;
 } dt_control_merge_hdr_t;
@@ -288,9 +296,93 @@ static float envelope(const float xx)
   }
 }
 
-static int dt_control_merge_hdr_process(dt_imageio_module_data_t *datai, const char *filename,
-                                        const void *const ivoid, void *exif, int exif_len, int imgid, int num,
-                                        int total)
+// merges rows [y0, y1) of the frame whose rows from first_row on are in, the three rows above come from carry
+static void _merge_hdr_rows(dt_control_merge_hdr_t *d, const float *const buf, const int first_row, const int y0,
+                            const int y1)
+{
+  const float photoncnt = d->photoncnt;
+  const float cal = d->cal;
+  const float saturation = 1.0f;
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static) default(none) shared(d)
+#endif
+  for(int y = y0; y < y1; y++)
+  {
+    // cannot do an envelope based on single pixel values here, need to get
+    // maximum value of all color channels. to find that, go through the
+    // pattern block (we conservatively do a 3x3 for bayer or xtrans):
+    const int yy = y & ~1;
+    const float *block[3] = { NULL };
+    if(yy < d->ht - 2)
+      for(int j = 0; j < 3; j++)
+        block[j] = yy + j >= first_row ? buf + (size_t)d->wd * (yy + j - first_row)
+                                       : d->carry + (size_t)d->wd * (yy + j - first_row + 3);
+    const float *const row = y >= first_row ? buf + (size_t)d->wd * (y - first_row)
+                                            : d->carry + (size_t)d->wd * (y - first_row + 3);
+    float *const pixels = d->pixels + (size_t)d->wd * y;
+    float *const weight = d->weight + (size_t)d->wd * y;
+    for(int x = 0; x < d->wd; x++)
+    {
+      // read unclamped raw value with subtracted black and rescaled to 1.0 saturation.
+      // this is the output of the rawprepare iop.
+      const float in = row[x];
+      // weights based on siggraph 12 poster
+      // zijian zhu, zhengguo li, susanto rahardja, pasi fraenti
+      // 2d denoising factor for high dynamic range imaging
+      float w = photoncnt;
+
+      // need some safety margin due to upsampling and 16-bit quantization + dithering?
+      const float offset = 3000.0f / (float)UINT16_MAX;
+
+      const int xx = x & ~1;
+      float M = 0.0f, m = FLT_MAX;
+      if(xx < d->wd - 2 && block[0])
+      {
+        for(int i = 0; i < 3; i++)
+          for(int j = 0; j < 3; j++)
+          {
+            M = MAX(M, block[j][xx + i]);
+            m = MIN(m, block[j][xx + i]);
+          }
+        // move envelope a little to allow non-zero weight even for clipped regions.
+        // this is because even if the 2x2 block is clipped somewhere, the other channels
+        // might still prove useful. we'll check for individual channel saturation below.
+        w *= d->epsw + envelope((M + offset) / saturation);
+      }
+
+      if(M + offset >= saturation)
+      {
+        if(weight[x] <= 0.0f)
+        { // only consider saturated pixels in case we have nothing better:
+          if(weight[x] == 0 || m < -weight[x])
+          {
+            if(m + offset >= saturation)
+              pixels[x] = 1.0f; // let's admit we were completely clipped, too
+            else
+              pixels[x] = in * cal / d->whitelevel;
+            weight[x] = -m; // could use -cal here, but m is per pixel and safer for varying illumination conditions
+          }
+        }
+        // else silently ignore, others have filled in a better color here already
+      }
+      else
+      {
+        if(weight[x] <= 0.0)
+        { // cleanup potentially blown highlights from earlier images
+          pixels[x] = 0.0f;
+          weight[x] = 0.0f;
+        }
+        pixels[x] += w * in * cal;
+        weight[x] += w;
+      }
+    }
+  }
+}
+
+// the frames are merged as their export pipes hand them over, in bands of rows when the export streams. the
+// accumulation buffers are all that is kept at full size then.
+static void *dt_control_merge_hdr_begin(dt_imageio_module_data_t *datai, const char *filename, void *exif,
+                                        int exif_len, const char *xmp, int imgid, int num, int total)
 {
   dt_control_merge_hdr_format_t *data = (dt_control_merge_hdr_format_t *)datai;
   dt_control_merge_hdr_t *d = data->d;
@@ -314,25 +406,32 @@ static int dt_control_merge_hdr_process(dt_imageio_module_data_t *datai, const c
     roi.y = image.crop_y;
     for(int j=0;j<6;j++)
       for(int i = 0; i < 6; i++) d->first_xtrans[j][i] = FCxtrans(j, i, &roi, image.buf_dsc.xtrans);
-    d->pixels = calloc(datai->width * datai->height, sizeof(float));
-    d->weight = calloc(datai->width * datai->height, sizeof(float));
+    d->pixels = calloc((size_t)datai->width * datai->height, sizeof(float));
+    d->weight = calloc((size_t)datai->width * datai->height, sizeof(float));
+    d->carry = calloc((size_t)3 * datai->width, sizeof(float));
     d->wd = datai->width;
     d->ht = datai->height;
     d->orientation = image.orientation;
   }
 
-  if(image.buf_dsc.filters == 0u || image.buf_dsc.channels != 1 || image.buf_dsc.datatype != TYPE_UINT16)
+  if(!d->pixels || !d->weight || !d->carry)
+  {
+    dt_control_log(_("failed to allocate memory for merging the images."));
+    d->abort = TRUE;
+    return d;
+  }
+  else if(image.buf_dsc.filters == 0u || image.buf_dsc.channels != 1 || image.buf_dsc.datatype != TYPE_UINT16)
   {
     dt_control_log(_("exposure bracketing only works on raw images."));
     d->abort = TRUE;
-    return 1;
+    return d;
   }
   else if(datai->width != d->wd || datai->height != d->ht || d->first_filter != image.buf_dsc.filters
           || d->orientation != image.orientation)
   {
     dt_control_log(_("images have to be of same size and orientation!"));
     d->abort = TRUE;
-    return 1;
+    return d;
   }
 
   // if no valid exif data can be found, assume peleng fisheye at f/16, 8mm, with half of the light lost in
@@ -343,76 +442,56 @@ static int dt_control_merge_hdr_process(dt_imageio_module_data_t *datai, const c
   const float aperture = M_PI * rad * rad;
   const float iso = image.exif_iso > 0.0f ? image.exif_iso : 100.0f;
   const float exp = image.exif_exposure > 0.0f ? image.exif_exposure : 1.0f;
-  const float cal = 100.0f / (aperture * exp * iso);
+  d->cal = 100.0f / (aperture * exp * iso);
   // about proportional to how many photons we can expect from this shot:
-  const float photoncnt = 100.0f * aperture * exp / iso;
-  float saturation = 1.0f;
-  d->whitelevel = fmaxf(d->whitelevel, saturation * cal);
-#ifdef _OPENMP
-#pragma omp parallel for schedule(static) default(none) shared(d, saturation)
-#endif
-  for(int y = 0; y < d->ht; y++)
-    for(int x = 0; x < d->wd; x++)
-    {
-      // read unclamped raw value with subtracted black and rescaled to 1.0 saturation.
-      // this is the output of the rawprepare iop.
-      const float in = ((float *)ivoid)[x + d->wd * y];
-      // weights based on siggraph 12 poster
-      // zijian zhu, zhengguo li, susanto rahardja, pasi fraenti
-      // 2d denoising factor for high dynamic range imaging
-      float w = photoncnt;
-
-      // need some safety margin due to upsampling and 16-bit quantization + dithering?
-      float offset = 3000.0f / (float)UINT16_MAX;
+  d->photoncnt = 100.0f * aperture * exp / iso;
+  const float saturation = 1.0f;
+  d->whitelevel = fmaxf(d->whitelevel, saturation * d->cal);
+  d->next_row = 0;
+  return d;
+}
 
-      // cannot do an envelope based on single pixel values here, need to get
-      // maximum value of all color channels. to find that, go through the
-      // pattern block (we conservatively do a 3x3 for bayer or xtrans):
-      int xx = x & ~1, yy = y & ~1;
-      float M = 0.0f, m = FLT_MAX;
-      if(xx < d->wd - 2 && yy < d->ht - 2)
-      {
-        for(int i = 0; i < 3; i++)
-          for(int j = 0; j < 3; j++)
-          {
-            M = MAX(M, ((float *)ivoid)[xx + i + d->wd * (yy + j)]);
-            m = MIN(m, ((float *)ivoid)[xx + i + d->wd * (yy + j)]);
-          }
-        // move envelope a little to allow non-zero weight even for clipped regions.
-        // this is because even if the 2x2 block is clipped somewhere, the other channels
-        // might still prove useful. we'll check for individual channel saturation below.
-        w *= d->epsw + envelope((M + offset) / saturation);
-      }
+static int dt_control_merge_hdr_rows(dt_imageio_module_data_t *datai, void *handle, const void *const ivoid,
+                                     int first_row, int rows)
+{
+  dt_control_merge_hdr_t *d = (dt_control_merge_hdr_t *)handle;
+  if(d->abort) return 1;
+
+  // the 3x3 blocks of a row reach two rows down, the last ones of a band wait for the next one
+  const int end_row = first_row + rows;
+  const int y1 = end_row >= d->ht ? d->ht : MAX(d->next_row, end_row - 2);
+  _merge_hdr_rows(d, (const float *)ivoid, first_row, d->next_row, y1);
+  d->next_row = y1;
+
+  // keep the last three rows the next band's blocks may need, moving the ones still in carry up if the band
+  // was too small to replace them
+  for(int j = MAX(0, end_row - 3); j < end_row; j++)
+  {
+    const float *const src = j >= first_row ? (const float *)ivoid + (size_t)d->wd * (j - first_row)
+                                            : d->carry + (size_t)d->wd * (j - first_row + 3);
+    memmove(d->carry + (size_t)d->wd * (j - end_row + 3), src, sizeof(float) * d->wd);
+  }
+  return 0;
+}
 
-      if(M + offset >= saturation)
-      {
-        if(d->weight[x + d->wd * y] <= 0.0f)
-        { // only consider saturated pixels in case we have nothing better:
-          if(d->weight[x + d->wd * y] == 0 || m < -d->weight[x + d->wd * y])
-          {
-            if(m + offset >= saturation)
-              d->pixels[x + d->wd * y] = 1.0f; // let's admit we were completely clipped, too
-            else
-              d->pixels[x + d->wd * y] = in * cal / d->whitelevel;
-            d->weight[x + d->wd * y]
-                = -m; // could use -cal here, but m is per pixel and safer for varying illumination conditions
-          }
-        }
-        // else silently ignore, others have filled in a better color here already
-      }
-      else
-      {
-        if(d->weight[x + d->wd * y] <= 0.0)
-        { // cleanup potentially blown highlights from earlier images
-          d->pixels[x + d->wd * y] = 0.0f;
-          d->weight[x + d->wd * y] = 0.0f;
-        }
-        d->pixels[x + d->wd * y] += w * in * cal;
-        d->weight[x + d->wd * y] += w;
-      }
-    }
+static int dt_control_merge_hdr_end(dt_imageio_module_data_t *datai, void *handle, int failed)
+{
+  dt_control_merge_hdr_t *d = (dt_control_merge_hdr_t *)handle;
+  if(failed && !d->abort)
+  {
+    dt_control_log(_("failed to process the images to merge."));
+    d->abort = TRUE;
+  }
+  return d->abort;
+}
 
-  return 0;
+static int dt_control_merge_hdr_process(dt_imageio_module_data_t *datai, const char *filename,
+                                        const void *const ivoid, void *exif, int exif_len, const char *xmp,
+                                        int imgid, int num, int total)
+{
+  void *handle = dt_control_merge_hdr_begin(datai, filename, exif, exif_len, xmp, imgid, num, total);
+  const int failed = dt_control_merge_hdr_rows(datai, handle, ivoid, 0, datai->height);
+  return dt_control_merge_hdr_end(datai, handle, failed);
 }
 
 static int32_t dt_control_merge_hdr_job_run(dt_job_t *job)
@@ -431,7 +510,10 @@ static int32_t dt_control_merge_hdr_job_run(dt_job_t *job)
   dt_imageio_module_format_t buf = (dt_imageio_module_format_t){.mime = dt_control_merge_hdr_mime,
                                                                 .levels = dt_control_merge_hdr_levels,
                                                                 .bpp = dt_control_merge_hdr_bpp,
-                                                                .write_image = dt_control_merge_hdr_process };
+                                                                .write_image = dt_control_merge_hdr_process,
+                                                                .write_image_begin = dt_control_merge_hdr_begin,
+                                                                .write_image_rows = dt_control_merge_hdr_rows,
+                                                                .write_image_end = dt_control_merge_hdr_end };
 
   dt_control_merge_hdr_format_t dat = (dt_control_merge_hdr_format_t){.parent = { 0 }, .d = &d };
 
@@ -495,6 +577,7 @@ static int32_t dt_control_merge_hdr_job_run(dt_job_t *job)
 end:
   free(d.pixels);
   free(d.weight);
+  free(d.carry);
 
   dt_control_queue_redraw_center();
   return 0;
@@ -537,6 +620,8 @@ static int32_t dt_control_flip_images_job_run(dt_job_t *job)
   char message[512] = { 0 };
   snprintf(message, sizeof(message), ngettext("flipping %d image", "flipping %d images", total), total);
   dt_control_job_set_progress_message(job, message);
+  // the history rows of all images in one go
+  sqlite3_exec(dt_database_get(darktable.db), "BEGIN TRANSACTION", NULL, NULL, NULL);
   while(t)
   {
     imgid = GPOINTER_TO_INT(t->data);
@@ -545,6 +630,7 @@ static int32_t dt_control_flip_images_job_run(dt_job_t *job)
     fraction = 1.0 / total;
     dt_control_job_set_progress(job, fraction);
   }
+  sqlite3_exec(dt_database_get(darktable.db), "COMMIT", NULL, NULL, NULL);
   params->index = NULL;
   dt_control_queue_redraw_center();
   return 0;
@@ -1088,6 +1174,7 @@ static int32_t dt_control_gpx_apply_job_run(dt_job_t *job)
 
   } while((t = g_list_next(t)) != NULL);
 
+  dt_image_cache_flush(darktable.image_cache);
   dt_control_log(ngettext("applied matched GPX location onto %d image", "applied matched GPX location onto %d images", cntr), cntr);
 
   g_time_zone_unref(tz_camera);
@@ -1160,9 +1247,142 @@ static int32_t dt_control_local_copy_images_job_run(dt_job_t *job)
   return 0;
 }
 
-static int32_t dt_control_export_job_run(dt_job_t *job)
+// state shared by all threads of one export job
+typedef struct dt_control_export_queue_t
+{
+  dt_pthread_mutex_t lock;
+  dt_job_t *job;
+  dt_control_export_t *settings;
+  dt_imageio_module_format_t *mformat;
+  dt_imageio_module_storage_t *mstorage;
+  dt_imageio_module_data_t *sdata;
+  GList *images;
+  guint total, num;
+  double fraction;
+  // Invariant: the tagid for 'darktable|changed' will not change while this function runs. Is this a
+  // sensible assumption?
+  guint tagid, etagid;
+} dt_control_export_queue_t;
+
+typedef struct dt_control_export_thread_t
+{
+  dt_control_export_queue_t *queue;
+  dt_imageio_module_data_t *fdata; // one per thread
+  int num_openmp_threads;
+} dt_control_export_thread_t;
+
+// takes the next image off the list. the sequence number is assigned here, so it follows the order of the
+// list no matter which thread ends up exporting the image. returns 0 when done or cancelled.
+static int _export_next(dt_control_export_queue_t *queue, int *imgid, guint *num)
+{
+  int res = 0;
+  dt_pthread_mutex_lock(&queue->lock);
+  if(queue->images && dt_control_job_get_state(queue->job) != DT_JOB_STATE_CANCELLED)
+  {
+    *imgid = GPOINTER_TO_INT(queue->images->data);
+    queue->images = g_list_delete_link(queue->images, queue->images);
+    *num = ++queue->num;
+
+    // remove 'changed' tag from image
+    dt_tag_detach(queue->tagid, *imgid);
+    // make sure the 'exported' tag is set on the image
+    dt_tag_attach(queue->etagid, *imgid);
+    res = 1;
+  }
+  dt_pthread_mutex_unlock(&queue->lock);
+  return res;
+}
+
+static void _export_image(dt_control_export_queue_t *queue, dt_imageio_module_data_t *fdata, const int imgid,
+                          const guint num)
+{
+  dt_control_export_t *settings = queue->settings;
+  // check if image still exists:
+  char imgfilename[PATH_MAX] = { 0 };
+  const dt_image_t *image = dt_image_cache_get(darktable.image_cache, (int32_t)imgid, 'r');
+  if(image)
+  {
+    gboolean from_cache = TRUE;
+    dt_image_full_path(image->id, imgfilename, sizeof(imgfilename), &from_cache);
+    if(!g_file_test(imgfilename, G_FILE_TEST_IS_REGULAR))
+    {
+      dt_control_log(_("image `%s' is currently unavailable"), image->filename);
+      fprintf(stderr, "image `%s' is currently unavailable\n", imgfilename);
+      // dt_image_remove(imgid);
+      dt_image_cache_read_release(darktable.image_cache, image);
+    }
+    else
+    {
+      dt_image_cache_read_release(darktable.image_cache, image);
+      if(queue->mstorage->store(queue->mstorage, queue->sdata, imgid, queue->mformat, fdata, num, queue->total,
+                                settings->high_quality, settings->upscale) != 0)
+        dt_control_job_cancel(queue->job);
+    }
+  }
+
+  dt_pthread_mutex_lock(&queue->lock);
+  queue->fraction += 1.0 / queue->total;
+  if(queue->fraction > 1.0) queue->fraction = 1.0;
+  dt_control_job_set_progress(queue->job, queue->fraction);
+  dt_pthread_mutex_unlock(&queue->lock);
+}
+
+static void _export_loop(dt_control_export_thread_t *thread)
 {
   int imgid = -1;
+  guint num = 0;
+  dt_imageio_export_pool_begin();
+  while(_export_next(thread->queue, &imgid, &num)) _export_image(thread->queue, thread->fdata, imgid, num);
+  dt_imageio_export_pool_end();
+}
+
+static void *_export_thread(void *data)
+{
+  dt_control_export_thread_t *thread = (dt_control_export_thread_t *)data;
+#ifdef _OPENMP // need to do this in every thread
+  omp_set_num_threads(thread->num_openmp_threads);
+#endif
+  dt_pthread_setname("export");
+  _export_loop(thread);
+  return NULL;
+}
+
+// how many images to export at once. every export pipe needs memory for a few full size buffers of its
+// image, and beyond one pipe per opencl device plus one on the cpu they would only compete for the same
+// hardware.
+static int _export_num_threads(const dt_control_export_queue_t *queue)
+{
+  const int max_threads = dt_conf_get_int("plugins/lighttable/export/parallel");
+  if(max_threads <= 1 || !queue->mstorage->parallel || !queue->mstorage->parallel(queue->mstorage)) return 1;
+
+  size_t width = 0, height = 0;
+  for(const GList *iter = queue->images; iter; iter = g_list_next(iter))
+  {
+    const dt_image_t *image = dt_image_cache_get(darktable.image_cache, GPOINTER_TO_INT(iter->data), 'r');
+    if(!image) continue;
+    if((size_t)image->width * image->height > width * height)
+    {
+      width = image->width;
+      height = image->height;
+    }
+    dt_image_cache_read_release(darktable.image_cache, image);
+  }
+
+#ifdef HAVE_OPENCL
+  const int devices = dt_opencl_is_enabled() ? darktable.opencl->num_devs : 0;
+#else
+  const int devices = 0;
+#endif
+  int threads = MIN(max_threads, MAX(devices + 1, 2));
+  threads = MIN(threads, g_list_length(queue->images));
+  // input, output and one intermediate buffer of 4 floats per pixel and pipe
+  while(threads > 1 && !dt_tiling_piece_fits_host_memory(width, height, 4 * sizeof(float), 3.0f * threads, 0))
+    threads--;
+  return MAX(threads, 1);
+}
+
+static int32_t dt_control_export_job_run(dt_job_t *job)
+{
   dt_control_image_enumerator_t *params = (dt_control_image_enumerator_t *)dt_control_job_get_params(job);
   dt_control_export_t *settings = (dt_control_export_t *)params->data;
   GList *t = params->index;
@@ -1210,61 +1430,78 @@ static int32_t dt_control_export_job_run(dt_job_t *job)
   // update the message. initialize_store() might have changed the number of images
   dt_control_job_set_progress_message(job, message);
 
-  double fraction = 0;
-
   // set up the fdata struct
   fdata->max_width = (settings->max_width != 0 && w != 0) ? MIN(w, settings->max_width) : MAX(w, settings->max_width);
   fdata->max_height = (settings->max_height != 0 && h != 0) ? MIN(h, settings->max_height) : MAX(h, settings->max_height);
   g_strlcpy(fdata->style, settings->style, sizeof(fdata->style));
   fdata->style_append = settings->style_append;
-  guint num = 0;
-  // Invariant: the tagid for 'darktable|changed' will not change while this function runs. Is this a
-  // sensible assumption?
-  guint tagid = 0, etagid = 0;
-  dt_tag_new("darktable|changed", &tagid);
-  dt_tag_new("darktable|exported", &etagid);
 
-  while(t && dt_control_job_get_state(job) != DT_JOB_STATE_CANCELLED)
+  dt_control_export_queue_t queue = { .job = job,
+                                      .settings = settings,
+                                      .mformat = mformat,
+                                      .mstorage = mstorage,
+                                      .sdata = sdata,
+                                      .images = t,
+                                      .total = total,
+                                      .num = 0,
+                                      .fraction = 0.0 };
+  dt_pthread_mutex_init(&queue.lock, NULL);
+  dt_tag_new("darktable|changed", &queue.tagid);
+  dt_tag_new("darktable|exported", &queue.etagid);
+
+  // storages which can take several images at once get one export pipe per thread, the
+  // calling thread being one of them.
+  const int num_threads = _export_num_threads(&queue);
+#ifdef _OPENMP
+  // share the cores this worker got
+  const int worker_openmp_threads = omp_get_max_threads();
+  const int num_openmp_threads = MAX(1, worker_openmp_threads / num_threads);
+#else
+  const int num_openmp_threads = 1;
+#endif
+  dt_control_export_thread_t main_thread = { &queue, fdata, num_openmp_threads };
+  dt_control_export_thread_t *threads
+      = (dt_control_export_thread_t *)calloc(num_threads, sizeof(dt_control_export_thread_t));
+  pthread_t *thread_ids = (pthread_t *)calloc(num_threads, sizeof(pthread_t));
+  int started = 0;
+  for(int k = 0; threads && thread_ids && k < num_threads - 1; k++)
   {
-    if(!t)
-      imgid = 0;
-    else
+    // the format settings have been set up by now, so this yields the same parameters
+    dt_imageio_module_data_t *thread_fdata = mformat->get_params(mformat);
+    if(!thread_fdata) break;
+    thread_fdata->max_width = fdata->max_width;
+    thread_fdata->max_height = fdata->max_height;
+    g_strlcpy(thread_fdata->style, fdata->style, sizeof(thread_fdata->style));
+    thread_fdata->style_append = fdata->style_append;
+    threads[started] = (dt_control_export_thread_t){ &queue, thread_fdata, num_openmp_threads };
+    if(dt_pthread_create(&thread_ids[started], _export_thread, &threads[started]))
     {
-      imgid = GPOINTER_TO_INT(t->data);
-      t = g_list_delete_link(t, t);
-      num = total - g_list_length(t);
+      mformat->free_params(mformat, thread_fdata);
+      break;
     }
+    started++;
+  }
+  dt_print(DT_DEBUG_CONTROL, "[export_job] exporting %d images at once\n", started + 1);
 
-    // remove 'changed' tag from image
-    dt_tag_detach(tagid, imgid);
-    // make sure the 'exported' tag is set on the image
-    dt_tag_attach(etagid, imgid);
-    // check if image still exists:
-    char imgfilename[PATH_MAX] = { 0 };
-    const dt_image_t *image = dt_image_cache_get(darktable.image_cache, (int32_t)imgid, 'r');
-    if(image)
-    {
-      gboolean from_cache = TRUE;
-      dt_image_full_path(image->id, imgfilename, sizeof(imgfilename), &from_cache);
-      if(!g_file_test(imgfilename, G_FILE_TEST_IS_REGULAR))
-      {
-        dt_control_log(_("image `%s' is currently unavailable"), image->filename);
-        fprintf(stderr, "image `%s' is currently unavailable\n", imgfilename);
-        // dt_image_remove(imgid);
-        dt_image_cache_read_release(darktable.image_cache, image);
-      }
-      else
-      {
-        dt_image_cache_read_release(darktable.image_cache, image);
-        if(mstorage->store(mstorage, sdata, imgid, mformat, fdata, num, total, settings->high_quality, settings->upscale) != 0)
-          dt_control_job_cancel(job);
-      }
-    }
+#ifdef _OPENMP
+  omp_set_num_threads(num_openmp_threads);
+#endif
+  _export_loop(&main_thread);
+#ifdef _OPENMP
+  omp_set_num_threads(worker_openmp_threads);
+#endif
 
-    fraction += 1.0 / total;
-    if(fraction > 1.0) fraction = 1.0;
-    dt_control_job_set_progress(job, fraction);
+  for(int k = 0; k < started; k++)
+  {
+    pthread_join(thread_ids[k], NULL);
+    mformat->free_params(mformat, threads[k].fdata);
   }
+  free(threads);
+  free(thread_ids);
+
+  // whatever is left after a cancellation
+  g_list_free(queue.images);
+  dt_pthread_mutex_destroy(&queue.lock);
   params->index = NULL;
 
   if(mstorage->finalize_store) mstorage->finalize_store(mstorage, sdata);
@@ -1673,6 +1910,7 @@ static int32_t dt_control_time_offset_job_run(dt_job_t *job)
     dt_control_job_set_progress(job, fraction);
   } while((t = g_list_next(t)) != NULL);
 
+  dt_image_cache_flush(darktable.image_cache);
   dt_control_log(ngettext("added time offset to %d image", "added time offset to %d images", cntr), cntr);
 
   return 0;
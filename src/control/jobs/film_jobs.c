@@ -16,21 +16,37 @@
     along with darktable.  If not, see <http://www.gnu.org/licenses/>.
 */
 #include "control/jobs/film_jobs.h"
+#include "common/collection.h"
 #include "common/darktable.h"
+#include "common/database.h"
+#include "common/debug.h"
+#include "common/exif.h"
 #include "common/film.h"
+#include "common/image.h"
+#include "common/mipmap_cache.h"
 #include <stdlib.h>
 
 typedef struct dt_film_import1_t
 {
   dt_film_t *film;
+  GList *files, *removed; // of an incremental import, the whole folder is imported otherwise
+  gboolean incremental;
 } dt_film_import1_t;
 
 static void dt_film_import1(dt_job_t *job, dt_film_t *film);
+static void _film_import_files(dt_job_t *job, dt_film_t *film, GList *images, const gboolean incremental);
+static void _film_import_changes(dt_job_t *job, dt_film_t *film, GList *files, GList *removed);
 
 static int32_t dt_film_import1_run(dt_job_t *job)
 {
   dt_film_import1_t *params = dt_control_job_get_params(job);
-  dt_film_import1(job, params->film);
+  if(params->incremental)
+  {
+    _film_import_changes(job, params->film, params->files, params->removed);
+    params->files = params->removed = NULL;
+  }
+  else
+    dt_film_import1(job, params->film);
   dt_pthread_mutex_lock(&params->film->images_mutex);
   params->film->ref--;
   dt_pthread_mutex_unlock(&params->film->images_mutex);
@@ -52,6 +68,8 @@ static void dt_film_import1_cleanup(void *p)
 {
   dt_film_import1_t *params = p;
 
+  g_list_free_full(params->files, g_free);
+  g_list_free_full(params->removed, g_free);
   dt_film_cleanup(params->film);
   free(params->film);
 
@@ -77,6 +95,22 @@ dt_job_t *dt_film_import1_create(dt_film_t *film)
   return job;
 }
 
+dt_job_t *dt_film_import_files_create(dt_film_t *film, GList *files, GList *removed)
+{
+  dt_job_t *job = dt_film_import1_create(film);
+  if(!job)
+  {
+    g_list_free_full(files, g_free);
+    g_list_free_full(removed, g_free);
+    return NULL;
+  }
+  dt_film_import1_t *params = dt_control_job_get_params(job);
+  params->files = files;
+  params->removed = removed;
+  params->incremental = TRUE;
+  return job;
+}
+
 static GList *_film_recursive_get_files(const gchar *path, gboolean recursive, GList **result)
 {
   gchar *fullname;
@@ -133,6 +167,63 @@ int _film_filename_cmp(gchar *a, gchar *b)
   return ret;
 }
 
+// the images are put into the database in transactions of this many
+#define DT_FILM_IMPORT_BATCH 64
+
+/* the metadata of the files to import is read by a few threads ahead of the one putting them into the
+ * database. reading is what takes the time on card readers and network shares, and it doesn't touch the
+ * database. */
+typedef struct dt_film_import_queue_t
+{
+  dt_pthread_mutex_t lock;
+  pthread_cond_t cond;       // a file got read, or the import moved on
+  gchar **files;
+  dt_exif_prefetch_t **exif; // read ahead metadata of the files
+  int *ready;                // exif[k] got read, it might still be NULL
+  int total;
+  int next;                  // the next file to be read
+  int imported;              // the files imported so far
+  int ahead;                 // how many files may be read ahead of the import
+  int readers;               // threads reading
+} dt_film_import_queue_t;
+
+static void *_film_import_reader(void *data)
+{
+  dt_film_import_queue_t *queue = (dt_film_import_queue_t *)data;
+  dt_pthread_setname("import");
+  dt_pthread_mutex_lock(&queue->lock);
+  while(1)
+  {
+    while(queue->next < queue->total && queue->next >= queue->imported + queue->ahead)
+      dt_pthread_cond_wait(&queue->cond, &queue->lock);
+    if(queue->next >= queue->total) break;
+    const int k = queue->next++;
+    dt_pthread_mutex_unlock(&queue->lock);
+
+    dt_exif_prefetch_t *exif = dt_exif_prefetch(queue->files[k]);
+
+    dt_pthread_mutex_lock(&queue->lock);
+    queue->exif[k] = exif;
+    queue->ready[k] = 1;
+    pthread_cond_broadcast(&queue->cond);
+  }
+  dt_pthread_mutex_unlock(&queue->lock);
+  return NULL;
+}
+
+/* the read ahead metadata of file k once it is there, to be freed by the caller. NULL if nobody reads ahead. */
+static dt_exif_prefetch_t *_film_import_take(dt_film_import_queue_t *queue, const int k)
+{
+  dt_pthread_mutex_lock(&queue->lock);
+  while(queue->readers && !queue->ready[k]) dt_pthread_cond_wait(&queue->cond, &queue->lock);
+  dt_exif_prefetch_t *exif = queue->exif[k];
+  queue->exif[k] = NULL;
+  queue->imported = k + 1;
+  pthread_cond_broadcast(&queue->cond);
+  dt_pthread_mutex_unlock(&queue->lock);
+  return exif;
+}
+
 static void dt_film_import1(dt_job_t *job, dt_film_t *film)
 {
   gboolean recursive = dt_conf_get_bool("ui_last/import_recursive");
@@ -146,6 +237,13 @@ static void dt_film_import1(dt_job_t *job, dt_film_t *film)
     return;
   }
 
+  _film_import_files(job, film, images, FALSE);
+}
+
+/* puts the images of the files into the library, reading their metadata ahead. the whole folder of the film or,
+ * when incremental, some newly found files in it. takes ownership of images. */
+static void _film_import_files(dt_job_t *job, dt_film_t *film, GList *images, const gboolean incremental)
+{
 #ifdef USE_LUA
   /* pre-sort image list for easier handling in Lua code */
   images = g_list_sort(images, (GCompareFunc)_film_filename_cmp);
@@ -200,9 +298,30 @@ static void dt_film_import1(dt_job_t *job, dt_film_t *film)
   dt_control_job_set_progress_message(job, message);
 
 
+  /* start reading the metadata ahead */
+  const int num_readers = MAX(0, MIN(dt_conf_get_int("plugins/lighttable/import/parallel"), (int)total));
+  dt_film_import_queue_t queue = { .total = total, .ahead = 4 * MAX(num_readers, 1) };
+  dt_pthread_mutex_init(&queue.lock, NULL);
+  pthread_cond_init(&queue.cond, NULL);
+  queue.files = (gchar **)calloc(total, sizeof(gchar *));
+  queue.exif = (dt_exif_prefetch_t **)calloc(total, sizeof(dt_exif_prefetch_t *));
+  queue.ready = (int *)calloc(total, sizeof(int));
+  pthread_t *readers = (pthread_t *)calloc(MAX(num_readers, 1), sizeof(pthread_t));
+  if(queue.files && queue.exif && queue.ready && readers)
+  {
+    int k = 0;
+    for(GList *iter = images; iter; iter = g_list_next(iter)) queue.files[k++] = (gchar *)iter->data;
+    for(; queue.readers < num_readers; queue.readers++)
+      if(dt_pthread_create(&readers[queue.readers], _film_import_reader, &queue)) break;
+  }
+  dt_print(DT_DEBUG_CONTROL, "[film_import] reading metadata with %d threads\n", queue.readers);
+
+  sqlite3_exec(dt_database_get(darktable.db), "BEGIN TRANSACTION", NULL, NULL, NULL);
+
   /* loop thru the images and import to current film roll */
   dt_film_t *cfr = film;
   GList *image = g_list_first(images);
+  int num = 0;
   do
   {
     gchar *cdn = g_path_get_dirname((const gchar *)image->data);
@@ -253,7 +372,15 @@ static void dt_film_import1(dt_job_t *job, dt_film_t *film)
     g_free(cdn);
 
     /* import image */
-    dt_image_import(cfr->id, (const gchar *)image->data, FALSE);
+    dt_exif_prefetch_t *exif = queue.readers ? _film_import_take(&queue, num) : NULL;
+    dt_image_import_prefetched(cfr->id, (const gchar *)image->data, FALSE, exif);
+    if(exif) dt_exif_prefetch_free(exif);
+
+    if(++num % DT_FILM_IMPORT_BATCH == 0)
+    {
+      sqlite3_exec(dt_database_get(darktable.db), "COMMIT", NULL, NULL, NULL);
+      sqlite3_exec(dt_database_get(darktable.db), "BEGIN TRANSACTION", NULL, NULL, NULL);
+    }
 
     fraction += 1.0 / total;
     dt_control_job_set_progress(job, fraction);
@@ -261,16 +388,34 @@ static void dt_film_import1(dt_job_t *job, dt_film_t *film)
 
   } while((image = g_list_next(image)) != NULL);
 
+  sqlite3_exec(dt_database_get(darktable.db), "COMMIT", NULL, NULL, NULL);
+
+  for(int k = 0; k < queue.readers; k++) pthread_join(readers[k], NULL);
+  free(readers);
+  free(queue.files);
+  free(queue.exif);
+  free(queue.ready);
+  pthread_cond_destroy(&queue.cond);
+  dt_pthread_mutex_destroy(&queue.lock);
+
   g_list_free_full(images, g_free);
 
   // only redraw at the end, to not spam the cpu with exposure events
   dt_control_queue_redraw_center();
   dt_control_signal_raise(darktable.signals, DT_SIGNAL_TAG_CHANGED);
 
-  dt_control_signal_raise(darktable.signals, DT_SIGNAL_FILMROLLS_IMPORTED, film->id);
+  if(incremental)
+  {
+    // the film is already shown the way the user wants it, only its images changed. the gpx files got
+    // applied when the folder was imported.
+    dt_collection_update_query(darktable.collection);
+    dt_control_signal_raise(darktable.signals, DT_SIGNAL_FILMROLLS_CHANGED);
+  }
+  else
+    dt_control_signal_raise(darktable.signals, DT_SIGNAL_FILMROLLS_IMPORTED, film->id);
 
   // FIXME: maybe refactor into function and call it?
-  if(cfr && cfr->dir)
+  if(!incremental && cfr && cfr->dir)
   {
     /* check if we can find a gpx data file to be auto applied
        to images in the just imported filmroll */
@@ -299,6 +444,56 @@ static void dt_film_import1(dt_job_t *job, dt_film_t *film)
   }
 }
 
+/* the files of film that showed up or changed, and the ones that went away. changed files that are in the library
+ * already only need new thumbnails, the others are imported. */
+static void _film_import_changes(dt_job_t *job, dt_film_t *film, GList *files, GList *removed)
+{
+  sqlite3_stmt *stmt;
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                              "SELECT id FROM main.images WHERE film_id = ?1 AND filename = ?2", -1, &stmt, NULL);
+  for(GList *iter = removed; iter; iter = g_list_next(iter))
+  {
+    gchar *filename = g_path_get_basename((const gchar *)iter->data);
+    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, film->id);
+    DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 2, filename, -1, SQLITE_TRANSIENT);
+    const int imgid = sqlite3_step(stmt) == SQLITE_ROW ? sqlite3_column_int(stmt, 0) : -1;
+    sqlite3_reset(stmt);
+    sqlite3_clear_bindings(stmt);
+    g_free(filename);
+    // the edits stay in the xmp file, if there is one, for the file coming back
+    if(imgid > 0) dt_image_remove(imgid);
+  }
+  g_list_free_full(removed, g_free);
+
+  GList *images = NULL;
+  for(GList *iter = files; iter; iter = g_list_next(iter))
+  {
+    gchar *filename = g_path_get_basename((const gchar *)iter->data);
+    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, film->id);
+    DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 2, filename, -1, SQLITE_TRANSIENT);
+    const int imgid = sqlite3_step(stmt) == SQLITE_ROW ? sqlite3_column_int(stmt, 0) : -1;
+    sqlite3_reset(stmt);
+    sqlite3_clear_bindings(stmt);
+    g_free(filename);
+    if(imgid > 0)
+    {
+      dt_mipmap_cache_remove(darktable.mipmap_cache, imgid);
+      g_free(iter->data);
+    }
+    else
+      images = g_list_prepend(images, iter->data);
+  }
+  sqlite3_finalize(stmt);
+  g_list_free(files);
+
+  if(images)
+    _film_import_files(job, film, images, TRUE);
+  else
+    dt_control_queue_redraw_center();
+}
+
+#undef DT_FILM_IMPORT_BATCH
+
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
 // kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
@@ -23,6 +23,9 @@
 #include <inttypes.h>
 
 dt_job_t *dt_film_import1_create(dt_film_t *film);
+/** imports files newly found in the folder of film and refreshes changed ones, removes the images of the removed
+ * files from the library. takes ownership of both lists of full paths. */
+dt_job_t *dt_film_import_files_create(dt_film_t *film, GList *files, GList *removed);
 
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
@@ -36,6 +36,9 @@ typedef struct _blend_buffer_desc_t
 typedef void(_blend_row_func)(const _blend_buffer_desc_t *bd, const float *a, float *b, const float *mask,
                               int flag);
 
+/* the row functions are inlined into copies built for avx2 and avx-512 as well, see _blend_row_variants_t */
+#define _BLEND_ROW DT_ALWAYS_INLINE
+
 static inline void _RGB_2_HSL(const float *RGB, float *HSL)
 {
   float H, S, L;
@@ -243,122 +246,155 @@ static inline void _PX_COPY(const float *src, float *dst)
   dst[2] = src[2];
 }
 
-static inline float _blendif_factor(dt_iop_colorspace_type_t cst, const float *input, const float *output,
-                                    const unsigned int blendif, const float *parameters,
-                                    const unsigned int mask_mode, const unsigned int mask_combine)
+/* the channels of a conditional mask that need to be looked at, worked out once per module run */
+typedef struct _blendif_plan_t
 {
-  float result = 1.0f;
-  float scaled[DEVELOP_BLENDIF_SIZE] = { 0.5f };
-  unsigned int channel_mask = 0;
-
-  if(!(mask_mode & DEVELOP_MASK_CONDITIONAL)) return (mask_combine & DEVELOP_COMBINE_INCL) ? 0.0f : 1.0f;
+  int constant;                         // the factor is the same for every pixel, it is value
+  float value;
+  int derived;                          // some channel comes from LCh or HSL
+  int incl;                             // mask_combine & DEVELOP_COMBINE_INCL
+  int n;                                // number of channels with limited sliders
+  int ch[DEVELOP_BLENDIF_SIZE];         // and their indices in scaled
+  int inverted[DEVELOP_BLENDIF_SIZE];
+  float p[DEVELOP_BLENDIF_SIZE][4];     // the four slider positions
+  float up[DEVELOP_BLENDIF_SIZE];       // fmax(0.01f, p[1] - p[0])
+  float down[DEVELOP_BLENDIF_SIZE];     // fmax(0.01f, p[3] - p[2])
+} _blendif_plan_t;
+
+static void _blendif_make_plan(dt_iop_colorspace_type_t cst, const unsigned int blendif, const float *parameters,
+                               const unsigned int mask_mode, const unsigned int mask_combine,
+                               _blendif_plan_t *plan)
+{
+  memset(plan, 0, sizeof(_blendif_plan_t));
+  plan->incl = (mask_combine & DEVELOP_COMBINE_INCL) ? 1 : 0;
 
-  switch(cst)
+  unsigned int channel_mask = 0;
+  if(mask_mode & DEVELOP_MASK_CONDITIONAL)
   {
-    case iop_cs_Lab:
-      scaled[DEVELOP_BLENDIF_L_in] = CLAMP_RANGE(input[0] / 100.0f, 0.0f, 1.0f); // L scaled to 0..1
-      scaled[DEVELOP_BLENDIF_A_in]
-          = CLAMP_RANGE((input[1] + 128.0f) / 256.0f, 0.0f, 1.0f); // a scaled to 0..1
-      scaled[DEVELOP_BLENDIF_B_in]
-          = CLAMP_RANGE((input[2] + 128.0f) / 256.0f, 0.0f, 1.0f);                 // b scaled to 0..1
-      scaled[DEVELOP_BLENDIF_L_out] = CLAMP_RANGE(output[0] / 100.0f, 0.0f, 1.0f); // L scaled to 0..1
-      scaled[DEVELOP_BLENDIF_A_out]
-          = CLAMP_RANGE((output[1] + 128.0f) / 256.0f, 0.0f, 1.0f); // a scaled to 0..1
-      scaled[DEVELOP_BLENDIF_B_out]
-          = CLAMP_RANGE((output[2] + 128.0f) / 256.0f, 0.0f, 1.0f); // b scaled to 0..1
-
-      if(blendif & 0x7f00) // do we need to consider LCh ?
-      {
-        float LCH_input[3];
-        float LCH_output[3];
-        _Lab_2_LCH(input, LCH_input);
-        _Lab_2_LCH(output, LCH_output);
-
-        scaled[DEVELOP_BLENDIF_C_in] = CLAMP_RANGE(LCH_input[1] / (128.0f * sqrtf(2.0f)), 0.0f,
-                                                   1.0f);                     // C scaled to 0..1
-        scaled[DEVELOP_BLENDIF_h_in] = CLAMP_RANGE(LCH_input[2], 0.0f, 1.0f); // h scaled to 0..1
-
-        scaled[DEVELOP_BLENDIF_C_out] = CLAMP_RANGE(LCH_output[1] / (128.0f * sqrtf(2.0f)), 0.0f,
-                                                    1.0f);                      // C scaled to 0..1
-        scaled[DEVELOP_BLENDIF_h_out] = CLAMP_RANGE(LCH_output[2], 0.0f, 1.0f); // h scaled to 0..1
-      }
-
+    if(cst == iop_cs_Lab)
       channel_mask = DEVELOP_BLENDIF_Lab_MASK;
-
-      break;
-    case iop_cs_rgb:
-      scaled[DEVELOP_BLENDIF_GRAY_in]
-          = CLAMP_RANGE(0.3f * input[0] + 0.59f * input[1] + 0.11f * input[2], 0.0f,
-                        1.0f);                                              // Gray scaled to 0..1
-      scaled[DEVELOP_BLENDIF_RED_in] = CLAMP_RANGE(input[0], 0.0f, 1.0f);   // Red
-      scaled[DEVELOP_BLENDIF_GREEN_in] = CLAMP_RANGE(input[1], 0.0f, 1.0f); // Green
-      scaled[DEVELOP_BLENDIF_BLUE_in] = CLAMP_RANGE(input[2], 0.0f, 1.0f);  // Blue
-      scaled[DEVELOP_BLENDIF_GRAY_out] = CLAMP_RANGE(0.3f * output[0] + 0.59f * output[1] + 0.11f * output[2],
-                                                     0.0f, 1.0f);             // Gray scaled to 0..1
-      scaled[DEVELOP_BLENDIF_RED_out] = CLAMP_RANGE(output[0], 0.0f, 1.0f);   // Red
-      scaled[DEVELOP_BLENDIF_GREEN_out] = CLAMP_RANGE(output[1], 0.0f, 1.0f); // Green
-      scaled[DEVELOP_BLENDIF_BLUE_out] = CLAMP_RANGE(output[2], 0.0f, 1.0f);  // Blue
-
-      if(blendif & 0x7f00) // do we need to consider HSL ?
-      {
-        float HSL_input[3];
-        float HSL_output[3];
-        _RGB_2_HSL(input, HSL_input);
-        _RGB_2_HSL(output, HSL_output);
-
-        scaled[DEVELOP_BLENDIF_H_in] = CLAMP_RANGE(HSL_input[0], 0.0f, 1.0f); // H scaled to 0..1
-        scaled[DEVELOP_BLENDIF_S_in] = CLAMP_RANGE(HSL_input[1], 0.0f, 1.0f); // S scaled to 0..1
-        scaled[DEVELOP_BLENDIF_l_in] = CLAMP_RANGE(HSL_input[2], 0.0f, 1.0f); // L scaled to 0..1
-
-        scaled[DEVELOP_BLENDIF_H_out] = CLAMP_RANGE(HSL_output[0], 0.0f, 1.0f); // H scaled to 0..1
-        scaled[DEVELOP_BLENDIF_S_out] = CLAMP_RANGE(HSL_output[1], 0.0f, 1.0f); // S scaled to 0..1
-        scaled[DEVELOP_BLENDIF_l_out] = CLAMP_RANGE(HSL_output[2], 0.0f, 1.0f); // L scaled to 0..1
-      }
-
+    else if(cst == iop_cs_rgb)
       channel_mask = DEVELOP_BLENDIF_RGB_MASK;
-
-      break;
-    default:
-      return (mask_combine & DEVELOP_COMBINE_INCL) ? 0.0f : 1.0f; // not implemented for other color spaces
+  }
+  // not conditional, or not implemented for other color spaces
+  if(!channel_mask)
+  {
+    plan->constant = 1;
+    plan->value = plan->incl ? 0.0f : 1.0f;
+    return;
   }
 
+  float result = 1.0f;
   for(int ch = 0; ch <= DEVELOP_BLENDIF_MAX; ch++)
   {
     if((channel_mask & (1 << ch)) == 0) continue; // skip blendif channels not used in this color space
 
+    const int inverted = (blendif & (1 << (ch + 16))) != 0;
     if((blendif & (1 << ch)) == 0) // deal with channels where sliders span the whole range
     {
-      result *= !(blendif & (1 << (ch + 16))) == !(mask_combine & DEVELOP_COMBINE_INCL) ? 1.0f : 0.0f;
+      result *= !inverted == !plan->incl ? 1.0f : 0.0f;
       continue;
     }
 
-    if(result <= 0.000001f) break; // no need to continue if we are already at or close to zero
+    const int k = plan->n++;
+    plan->ch[k] = ch;
+    plan->inverted[k] = inverted;
+    for(int i = 0; i < 4; i++) plan->p[k][i] = parameters[4 * ch + i];
+    plan->up[k] = fmax(0.01f, parameters[4 * ch + 1] - parameters[4 * ch + 0]);
+    plan->down[k] = fmax(0.01f, parameters[4 * ch + 3] - parameters[4 * ch + 2]);
+    if(ch >= 8) plan->derived = 1;
+  }
 
-    float factor;
-    if(scaled[ch] >= parameters[4 * ch + 1] && scaled[ch] <= parameters[4 * ch + 2])
-    {
-      factor = 1.0f;
-    }
-    else if(scaled[ch] > parameters[4 * ch + 0] && scaled[ch] < parameters[4 * ch + 1])
+  // the channels spanning the whole range only give 0 or 1, the limited ones come after a 0 to no avail
+  if(result == 0.0f || plan->n == 0)
+  {
+    plan->constant = 1;
+    plan->value = plan->incl ? 1.0f - result : result;
+  }
+}
+
+static inline float _blendif_factor(const _blendif_plan_t *const plan, dt_iop_colorspace_type_t cst,
+                                    const float *input, const float *output)
+{
+  if(plan->constant) return plan->value;
+
+  float scaled[DEVELOP_BLENDIF_SIZE] = { 0.5f };
+
+  if(cst == iop_cs_Lab)
+  {
+    scaled[DEVELOP_BLENDIF_L_in] = CLAMP_RANGE(input[0] / 100.0f, 0.0f, 1.0f); // L scaled to 0..1
+    scaled[DEVELOP_BLENDIF_A_in] = CLAMP_RANGE((input[1] + 128.0f) / 256.0f, 0.0f, 1.0f); // a scaled to 0..1
+    scaled[DEVELOP_BLENDIF_B_in] = CLAMP_RANGE((input[2] + 128.0f) / 256.0f, 0.0f, 1.0f); // b scaled to 0..1
+    scaled[DEVELOP_BLENDIF_L_out] = CLAMP_RANGE(output[0] / 100.0f, 0.0f, 1.0f); // L scaled to 0..1
+    scaled[DEVELOP_BLENDIF_A_out] = CLAMP_RANGE((output[1] + 128.0f) / 256.0f, 0.0f, 1.0f); // a scaled to 0..1
+    scaled[DEVELOP_BLENDIF_B_out] = CLAMP_RANGE((output[2] + 128.0f) / 256.0f, 0.0f, 1.0f); // b scaled to 0..1
+
+    if(plan->derived) // do we need to consider LCh ?
     {
-      factor = (scaled[ch] - parameters[4 * ch + 0])
-               / fmax(0.01f, parameters[4 * ch + 1] - parameters[4 * ch + 0]);
+      float LCH_input[3];
+      float LCH_output[3];
+      _Lab_2_LCH(input, LCH_input);
+      _Lab_2_LCH(output, LCH_output);
+
+      scaled[DEVELOP_BLENDIF_C_in] = CLAMP_RANGE(LCH_input[1] / (128.0f * sqrtf(2.0f)), 0.0f,
+                                                 1.0f);                     // C scaled to 0..1
+      scaled[DEVELOP_BLENDIF_h_in] = CLAMP_RANGE(LCH_input[2], 0.0f, 1.0f); // h scaled to 0..1
+
+      scaled[DEVELOP_BLENDIF_C_out] = CLAMP_RANGE(LCH_output[1] / (128.0f * sqrtf(2.0f)), 0.0f,
+                                                  1.0f);                      // C scaled to 0..1
+      scaled[DEVELOP_BLENDIF_h_out] = CLAMP_RANGE(LCH_output[2], 0.0f, 1.0f); // h scaled to 0..1
     }
-    else if(scaled[ch] > parameters[4 * ch + 2] && scaled[ch] < parameters[4 * ch + 3])
+  }
+  else
+  {
+    scaled[DEVELOP_BLENDIF_GRAY_in]
+        = CLAMP_RANGE(0.3f * input[0] + 0.59f * input[1] + 0.11f * input[2], 0.0f,
+                      1.0f);                                              // Gray scaled to 0..1
+    scaled[DEVELOP_BLENDIF_RED_in] = CLAMP_RANGE(input[0], 0.0f, 1.0f);   // Red
+    scaled[DEVELOP_BLENDIF_GREEN_in] = CLAMP_RANGE(input[1], 0.0f, 1.0f); // Green
+    scaled[DEVELOP_BLENDIF_BLUE_in] = CLAMP_RANGE(input[2], 0.0f, 1.0f);  // Blue
+    scaled[DEVELOP_BLENDIF_GRAY_out] = CLAMP_RANGE(0.3f * output[0] + 0.59f * output[1] + 0.11f * output[2],
+                                                   0.0f, 1.0f);             // Gray scaled to 0..1
+    scaled[DEVELOP_BLENDIF_RED_out] = CLAMP_RANGE(output[0], 0.0f, 1.0f);   // Red
+    scaled[DEVELOP_BLENDIF_GREEN_out] = CLAMP_RANGE(output[1], 0.0f, 1.0f); // Green
+    scaled[DEVELOP_BLENDIF_BLUE_out] = CLAMP_RANGE(output[2], 0.0f, 1.0f);  // Blue
+
+    if(plan->derived) // do we need to consider HSL ?
     {
-      factor = 1.0f
-               - (scaled[ch] - parameters[4 * ch + 2])
-                 / fmax(0.01f, parameters[4 * ch + 3] - parameters[4 * ch + 2]);
+      float HSL_input[3];
+      float HSL_output[3];
+      _RGB_2_HSL(input, HSL_input);
+      _RGB_2_HSL(output, HSL_output);
+
+      scaled[DEVELOP_BLENDIF_H_in] = CLAMP_RANGE(HSL_input[0], 0.0f, 1.0f); // H scaled to 0..1
+      scaled[DEVELOP_BLENDIF_S_in] = CLAMP_RANGE(HSL_input[1], 0.0f, 1.0f); // S scaled to 0..1
+      scaled[DEVELOP_BLENDIF_l_in] = CLAMP_RANGE(HSL_input[2], 0.0f, 1.0f); // L scaled to 0..1
+
+      scaled[DEVELOP_BLENDIF_H_out] = CLAMP_RANGE(HSL_output[0], 0.0f, 1.0f); // H scaled to 0..1
+      scaled[DEVELOP_BLENDIF_S_out] = CLAMP_RANGE(HSL_output[1], 0.0f, 1.0f); // S scaled to 0..1
+      scaled[DEVELOP_BLENDIF_l_out] = CLAMP_RANGE(HSL_output[2], 0.0f, 1.0f); // L scaled to 0..1
     }
-    else
-      factor = 0.0f;
+  }
+
+  // only the channels with limited sliders, the others multiply by 1
+  float result = 1.0f;
+  for(int k = 0; k < plan->n; k++)
+  {
+    if(result <= 0.000001f) break; // no need to continue if we are already at or close to zero
+
+    const float v = scaled[plan->ch[k]];
+    const float *const p = plan->p[k];
+    float factor = (v >= p[1] && v <= p[2]) ? 1.0f
+                 : (v > p[0] && v < p[1])   ? (v - p[0]) / plan->up[k]
+                 : (v > p[2] && v < p[3])   ? 1.0f - (v - p[2]) / plan->down[k]
+                                            : 0.0f;
 
-    if((blendif & (1 << (ch + 16))) != 0) factor = 1.0f - factor; // inverted channel?
+    if(plan->inverted[k]) factor = 1.0f - factor; // inverted channel?
 
-    result *= ((mask_combine & DEVELOP_COMBINE_INCL) ? 1.0f - factor : factor);
+    result *= (plan->incl ? 1.0f - factor : factor);
   }
 
-  return (mask_combine & DEVELOP_COMBINE_INCL) ? 1.0f - result : result;
+  return plan->incl ? 1.0f - result : result;
 }
 
 static inline void _blend_colorspace_channel_range(dt_iop_colorspace_type_t cst, float *min, float *max)
@@ -415,16 +451,14 @@ static inline void _blend_noop(const _blend_buffer_desc_t *bd, const float *a, f
 
 
 /* generate blend mask */
-static void _blend_make_mask(const _blend_buffer_desc_t *bd, const unsigned int blendif,
-                             const float *blendif_parameters, const unsigned int mask_mode,
-                             const unsigned int mask_combine, const float gopacity, const float *a,
-                             const float *b, float *mask)
+_BLEND_ROW void _blend_make_mask(const _blend_buffer_desc_t *bd, const _blendif_plan_t *plan,
+                                 const unsigned int mask_combine, const float gopacity, const float *a,
+                                 const float *b, float *mask)
 {
   for(size_t i = 0, j = 0; j < bd->stride; i++, j += bd->ch)
   {
     float form = mask[i];
-    float conditional
-        = _blendif_factor(bd->cst, &a[j], &b[j], blendif, blendif_parameters, mask_mode, mask_combine);
+    float conditional = _blendif_factor(plan, bd->cst, &a[j], &b[j]);
     float opacity = (mask_combine & DEVELOP_COMBINE_INCL) ? 1.0f - (1.0f - form) * (1.0f - conditional)
                                                           : form * conditional;
     opacity = (mask_combine & DEVELOP_COMBINE_INV) ? 1.0f - opacity : opacity;
@@ -433,8 +467,8 @@ static void _blend_make_mask(const _blend_buffer_desc_t *bd, const unsigned int
 }
 
 /* normal blend with clamping */
-static void _blend_normal_bounded(const _blend_buffer_desc_t *bd, const float *a, float *b, const float *mask,
-                                  int flag)
+_BLEND_ROW void _blend_normal_bounded(const _blend_buffer_desc_t *bd, const float *a, float *b, const float *mask,
+                                      int flag)
 {
   float max[4] = { 0 }, min[4] = { 0 };
   _blend_colorspace_channel_range(bd->cst, min, max);
@@ -489,8 +523,8 @@ static void _blend_normal_bounded(const _blend_buffer_desc_t *bd, const float *a
 }
 
 /* normal blend without any clamping */
-static void _blend_normal_unbounded(const _blend_buffer_desc_t *bd, const float *a, float *b,
-                                    const float *mask, int flag)
+_BLEND_ROW void _blend_normal_unbounded(const _blend_buffer_desc_t *bd, const float *a, float *b,
+                                        const float *mask, int flag)
 {
   float max[4] = { 0 }, min[4] = { 0 };
   _blend_colorspace_channel_range(bd->cst, min, max);
@@ -543,8 +577,8 @@ static void _blend_normal_unbounded(const _blend_buffer_desc_t *bd, const float
 }
 
 /* lighten */
-static void _blend_lighten(const _blend_buffer_desc_t *bd, const float *a, float *b, const float *mask,
-                           int flag)
+_BLEND_ROW void _blend_lighten(const _blend_buffer_desc_t *bd, const float *a, float *b, const float *mask,
+                               int flag)
 {
   float max[4] = { 0 }, min[4] = { 0 };
   _blend_colorspace_channel_range(bd->cst, min, max);
@@ -603,8 +637,8 @@ static void _blend_lighten(const _blend_buffer_desc_t *bd, const float *a, float
 }
 
 /* darken */
-static void _blend_darken(const _blend_buffer_desc_t *bd, const float *a, float *b, const float *mask,
-                          int flag)
+_BLEND_ROW void _blend_darken(const _blend_buffer_desc_t *bd, const float *a, float *b, const float *mask,
+                              int flag)
 {
   float max[4] = { 0 }, min[4] = { 0 };
   _blend_colorspace_channel_range(bd->cst, min, max);
@@ -664,8 +698,8 @@ static void _blend_darken(const _blend_buffer_desc_t *bd, const float *a, float
 }
 
 /* multiply */
-static void _blend_multiply(const _blend_buffer_desc_t *bd, const float *a, float *b, const float *mask,
-                            int flag)
+_BLEND_ROW void _blend_multiply(const _blend_buffer_desc_t *bd, const float *a, float *b, const float *mask,
+                                int flag)
 {
   float max[4] = { 0 }, min[4] = { 0 };
   _blend_colorspace_channel_range(bd->cst, min, max);
@@ -744,8 +778,8 @@ static void _blend_multiply(const _blend_buffer_desc_t *bd, const float *a, floa
 }
 
 /* average */
-static void _blend_average(const _blend_buffer_desc_t *bd, const float *a, float *b, const float *mask,
-                           int flag)
+_BLEND_ROW void _blend_average(const _blend_buffer_desc_t *bd, const float *a, float *b, const float *mask,
+                               int flag)
 {
   float max[4] = { 0 }, min[4] = { 0 };
   _blend_colorspace_channel_range(bd->cst, min, max);
@@ -805,7 +839,7 @@ static void _blend_average(const _blend_buffer_desc_t *bd, const float *a, float
 }
 
 /* add */
-static void _blend_add(const _blend_buffer_desc_t *bd, const float *a, float *b, const float *mask, int flag)
+_BLEND_ROW void _blend_add(const _blend_buffer_desc_t *bd, const float *a, float *b, const float *mask, int flag)
 {
   float max[4] = { 0 }, min[4] = { 0 };
   _blend_colorspace_channel_range(bd->cst, min, max);
@@ -868,8 +902,8 @@ static void _blend_add(const _blend_buffer_desc_t *bd, const float *a, float *b,
 }
 
 /* substract */
-static void _blend_substract(const _blend_buffer_desc_t *bd, const float *a, float *b, const float *mask,
-                             int flag)
+_BLEND_ROW void _blend_substract(const _blend_buffer_desc_t *bd, const float *a, float *b, const float *mask,
+                                 int flag)
 {
   float max[4] = { 0 }, min[4] = { 0 };
   _blend_colorspace_channel_range(bd->cst, min, max);
@@ -937,8 +971,8 @@ static void _blend_substract(const _blend_buffer_desc_t *bd, const float *a, flo
 }
 
 /* difference (deprecated) */
-static void _blend_difference(const _blend_buffer_desc_t *bd, const float *a, float *b, const float *mask,
-                              int flag)
+_BLEND_ROW void _blend_difference(const _blend_buffer_desc_t *bd, const float *a, float *b, const float *mask,
+                                  int flag)
 {
   float max[4] = { 0 }, min[4] = { 0 };
   _blend_colorspace_channel_range(bd->cst, min, max);
@@ -1021,8 +1055,8 @@ static void _blend_difference(const _blend_buffer_desc_t *bd, const float *a, fl
 }
 
 /* difference 2 (new) */
-static void _blend_difference2(const _blend_buffer_desc_t *bd, const float *a, float *b, const float *mask,
-                               int flag)
+_BLEND_ROW void _blend_difference2(const _blend_buffer_desc_t *bd, const float *a, float *b, const float *mask,
+                                   int flag)
 {
   float max[4] = { 0 }, min[4] = { 0 };
   _blend_colorspace_channel_range(bd->cst, min, max);
@@ -1098,8 +1132,8 @@ static void _blend_difference2(const _blend_buffer_desc_t *bd, const float *a, f
 }
 
 /* screen */
-static void _blend_screen(const _blend_buffer_desc_t *bd, const float *a, float *b, const float *mask,
-                          int flag)
+_BLEND_ROW void _blend_screen(const _blend_buffer_desc_t *bd, const float *a, float *b, const float *mask,
+                              int flag)
 {
   float max[4] = { 0 }, min[4] = { 0 };
   _blend_colorspace_channel_range(bd->cst, min, max);
@@ -1197,8 +1231,8 @@ static void _blend_screen(const _blend_buffer_desc_t *bd, const float *a, float
 }
 
 /* overlay */
-static void _blend_overlay(const _blend_buffer_desc_t *bd, const float *a, float *b, const float *mask,
-                           int flag)
+_BLEND_ROW void _blend_overlay(const _blend_buffer_desc_t *bd, const float *a, float *b, const float *mask,
+                               int flag)
 {
   float max[4] = { 0 }, min[4] = { 0 };
   _blend_colorspace_channel_range(bd->cst, min, max);
@@ -1311,8 +1345,8 @@ static void _blend_overlay(const _blend_buffer_desc_t *bd, const float *a, float
 }
 
 /* softlight */
-static void _blend_softlight(const _blend_buffer_desc_t *bd, const float *a, float *b, const float *mask,
-                             int flag)
+_BLEND_ROW void _blend_softlight(const _blend_buffer_desc_t *bd, const float *a, float *b, const float *mask,
+                                 int flag)
 {
 
   float max[4] = { 0 }, min[4] = { 0 };
@@ -1422,8 +1456,8 @@ static void _blend_softlight(const _blend_buffer_desc_t *bd, const float *a, flo
 }
 
 /* hardlight */
-static void _blend_hardlight(const _blend_buffer_desc_t *bd, const float *a, float *b, const float *mask,
-                             int flag)
+_BLEND_ROW void _blend_hardlight(const _blend_buffer_desc_t *bd, const float *a, float *b, const float *mask,
+                                 int flag)
 {
   float max[4] = { 0 }, min[4] = { 0 };
   _blend_colorspace_channel_range(bd->cst, min, max);
@@ -1536,8 +1570,8 @@ static void _blend_hardlight(const _blend_buffer_desc_t *bd, const float *a, flo
 }
 
 /* vividlight */
-static void _blend_vividlight(const _blend_buffer_desc_t *bd, const float *a, float *b, const float *mask,
-                              int flag)
+_BLEND_ROW void _blend_vividlight(const _blend_buffer_desc_t *bd, const float *a, float *b, const float *mask,
+                                  int flag)
 {
   float max[4] = { 0 }, min[4] = { 0 };
   _blend_colorspace_channel_range(bd->cst, min, max);
@@ -1654,8 +1688,8 @@ static void _blend_vividlight(const _blend_buffer_desc_t *bd, const float *a, fl
 }
 
 /* linearlight */
-static void _blend_linearlight(const _blend_buffer_desc_t *bd, const float *a, float *b, const float *mask,
-                               int flag)
+_BLEND_ROW void _blend_linearlight(const _blend_buffer_desc_t *bd, const float *a, float *b, const float *mask,
+                                   int flag)
 {
   float max[4] = { 0 }, min[4] = { 0 };
   _blend_colorspace_channel_range(bd->cst, min, max);
@@ -1760,8 +1794,8 @@ static void _blend_linearlight(const _blend_buffer_desc_t *bd, const float *a, f
 }
 
 /* pinlight */
-static void _blend_pinlight(const _blend_buffer_desc_t *bd, const float *a, float *b, const float *mask,
-                            int flag)
+_BLEND_ROW void _blend_pinlight(const _blend_buffer_desc_t *bd, const float *a, float *b, const float *mask,
+                                int flag)
 {
   float max[4] = { 0 }, min[4] = { 0 };
   _blend_colorspace_channel_range(bd->cst, min, max);
@@ -1849,8 +1883,8 @@ static void _blend_pinlight(const _blend_buffer_desc_t *bd, const float *a, floa
 }
 
 /* lightness blend */
-static void _blend_lightness(const _blend_buffer_desc_t *bd, const float *a, float *b, const float *mask,
-                             int flag)
+_BLEND_ROW void _blend_lightness(const _blend_buffer_desc_t *bd, const float *a, float *b, const float *mask,
+                                 int flag)
 {
   float max[4] = { 0 }, min[4] = { 0 };
   _blend_colorspace_channel_range(bd->cst, min, max);
@@ -1903,8 +1937,8 @@ static void _blend_lightness(const _blend_buffer_desc_t *bd, const float *a, flo
 }
 
 /* chroma blend */
-static void _blend_chroma(const _blend_buffer_desc_t *bd, const float *a, float *b, const float *mask,
-                          int flag)
+_BLEND_ROW void _blend_chroma(const _blend_buffer_desc_t *bd, const float *a, float *b, const float *mask,
+                              int flag)
 {
   float max[4] = { 0 }, min[4] = { 0 };
   _blend_colorspace_channel_range(bd->cst, min, max);
@@ -1964,7 +1998,7 @@ static void _blend_chroma(const _blend_buffer_desc_t *bd, const float *a, float
 }
 
 /* hue blend */
-static void _blend_hue(const _blend_buffer_desc_t *bd, const float *a, float *b, const float *mask, int flag)
+_BLEND_ROW void _blend_hue(const _blend_buffer_desc_t *bd, const float *a, float *b, const float *mask, int flag)
 {
   float max[4] = { 0 }, min[4] = { 0 };
   _blend_colorspace_channel_range(bd->cst, min, max);
@@ -2030,7 +2064,7 @@ static void _blend_hue(const _blend_buffer_desc_t *bd, const float *a, float *b,
 }
 
 /* color blend; blend hue and chroma, but not lightness */
-static void _blend_color(const _blend_buffer_desc_t *bd, const float *a, float *b, const float *mask, int flag)
+_BLEND_ROW void _blend_color(const _blend_buffer_desc_t *bd, const float *a, float *b, const float *mask, int flag)
 {
   float max[4] = { 0 }, min[4] = { 0 };
   _blend_colorspace_channel_range(bd->cst, min, max);
@@ -2099,8 +2133,8 @@ static void _blend_color(const _blend_buffer_desc_t *bd, const float *a, float *
 }
 
 /* color adjustment; blend hue and chroma; take lightness from module output */
-static void _blend_coloradjust(const _blend_buffer_desc_t *bd, const float *a, float *b, const float *mask,
-                               int flag)
+_BLEND_ROW void _blend_coloradjust(const _blend_buffer_desc_t *bd, const float *a, float *b, const float *mask,
+                                   int flag)
 {
   float max[4] = { 0 }, min[4] = { 0 };
   _blend_colorspace_channel_range(bd->cst, min, max);
@@ -2168,8 +2202,8 @@ static void _blend_coloradjust(const _blend_buffer_desc_t *bd, const float *a, f
 }
 
 /* inverse blend */
-static void _blend_inverse(const _blend_buffer_desc_t *bd, const float *a, float *b, const float *mask,
-                           int flag)
+_BLEND_ROW void _blend_inverse(const _blend_buffer_desc_t *bd, const float *a, float *b, const float *mask,
+                               int flag)
 {
   float max[4] = { 0 }, min[4] = { 0 };
   _blend_colorspace_channel_range(bd->cst, min, max);
@@ -2225,8 +2259,8 @@ static void _blend_inverse(const _blend_buffer_desc_t *bd, const float *a, float
 
 /* blend only lightness in Lab color space without any clamping (a noop for
  * other color spaces) */
-static void _blend_Lab_lightness(const _blend_buffer_desc_t *bd, const float *a, float *b, const float *mask,
-                                 int flag)
+_BLEND_ROW void _blend_Lab_lightness(const _blend_buffer_desc_t *bd, const float *a, float *b, const float *mask,
+                                     int flag)
 {
   if(bd->cst == iop_cs_Lab)
   {
@@ -2251,8 +2285,8 @@ static void _blend_Lab_lightness(const _blend_buffer_desc_t *bd, const float *a,
 
 /* blend only a-channel in Lab color space without any clamping (a noop for
  * other color spaces) */
-static void _blend_Lab_a(const _blend_buffer_desc_t *bd, const float *a, float *b, const float *mask,
-                         int flag)
+_BLEND_ROW void _blend_Lab_a(const _blend_buffer_desc_t *bd, const float *a, float *b, const float *mask,
+                             int flag)
 {
   if(bd->cst == iop_cs_Lab)
   {
@@ -2277,8 +2311,8 @@ static void _blend_Lab_a(const _blend_buffer_desc_t *bd, const float *a, float *
 
 /* blend only b-channel in Lab color space without any clamping (a noop for
  * other color spaces) */
-static void _blend_Lab_b(const _blend_buffer_desc_t *bd, const float *a, float *b, const float *mask,
-                         int flag)
+_BLEND_ROW void _blend_Lab_b(const _blend_buffer_desc_t *bd, const float *a, float *b, const float *mask,
+                             int flag)
 {
   if(bd->cst == iop_cs_Lab)
   {
@@ -2304,8 +2338,8 @@ static void _blend_Lab_b(const _blend_buffer_desc_t *bd, const float *a, float *
 
 /* blend only color in Lab color space without any clamping (a noop for other
  * color spaces) */
-static void _blend_Lab_color(const _blend_buffer_desc_t *bd, const float *a, float *b, const float *mask,
-                             int flag)
+_BLEND_ROW void _blend_Lab_color(const _blend_buffer_desc_t *bd, const float *a, float *b, const float *mask,
+                                 int flag)
 {
   if(bd->cst == iop_cs_Lab)
   {
@@ -2336,8 +2370,8 @@ static void _blend_Lab_color(const _blend_buffer_desc_t *bd, const float *a, flo
 
 /* blend only lightness in HSV color space without any clamping (a noop for
  * other color spaces) */
-static void _blend_HSV_lightness(const _blend_buffer_desc_t *bd, const float *a, float *b, const float *mask,
-                                 int flag)
+_BLEND_ROW void _blend_HSV_lightness(const _blend_buffer_desc_t *bd, const float *a, float *b, const float *mask,
+                                     int flag)
 {
   if(bd->cst == iop_cs_rgb)
   {
@@ -2365,8 +2399,8 @@ static void _blend_HSV_lightness(const _blend_buffer_desc_t *bd, const float *a,
 
 /* blend only color in HSV color space without any clamping (a noop for other
  * color spaces) */
-static void _blend_HSV_color(const _blend_buffer_desc_t *bd, const float *a, float *b, const float *mask,
-                             int flag)
+_BLEND_ROW void _blend_HSV_color(const _blend_buffer_desc_t *bd, const float *a, float *b, const float *mask,
+                                 int flag)
 {
   if(bd->cst == iop_cs_rgb)
   {
@@ -2404,8 +2438,8 @@ static void _blend_HSV_color(const _blend_buffer_desc_t *bd, const float *a, flo
 
 /* blend only R-channel in RGB color space without any clamping (a noop for
  * other color spaces) */
-static void _blend_RGB_R(const _blend_buffer_desc_t *bd, const float *a, float *b, const float *mask,
-                         int flag)
+_BLEND_ROW void _blend_RGB_R(const _blend_buffer_desc_t *bd, const float *a, float *b, const float *mask,
+                             int flag)
 {
   if(bd->cst == iop_cs_rgb)
   {
@@ -2426,8 +2460,8 @@ static void _blend_RGB_R(const _blend_buffer_desc_t *bd, const float *a, float *
 
 /* blend only R-channel in RGB color space without any clamping (a noop for
  * other color spaces) */
-static void _blend_RGB_G(const _blend_buffer_desc_t *bd, const float *a, float *b, const float *mask,
-                         int flag)
+_BLEND_ROW void _blend_RGB_G(const _blend_buffer_desc_t *bd, const float *a, float *b, const float *mask,
+                             int flag)
 {
   if(bd->cst == iop_cs_rgb)
   {
@@ -2447,8 +2481,8 @@ static void _blend_RGB_G(const _blend_buffer_desc_t *bd, const float *a, float *
 
 /* blend only R-channel in RGB color space without any clamping (a noop for
  * other color spaces) */
-static void _blend_RGB_B(const _blend_buffer_desc_t *bd, const float *a, float *b, const float *mask,
-                         int flag)
+_BLEND_ROW void _blend_RGB_B(const _blend_buffer_desc_t *bd, const float *a, float *b, const float *mask,
+                             int flag)
 {
   if(bd->cst == iop_cs_rgb)
   {
@@ -2677,118 +2711,209 @@ static void display_channel(const _blend_buffer_desc_t *bd, const float *a, floa
 }
 
 
+/* the same row functions compiled for the wider instruction sets, picked by darktable.codepath */
+typedef struct _blend_row_variants_t
+{
+  _blend_row_func *plain;
+  _blend_row_func *avx2;
+  _blend_row_func *avx512;
+} _blend_row_variants_t;
+
+#ifdef DT_TARGET_AVX2
+#define _BLEND_ROW_VARIANTS(name)                                                                            \
+  static DT_TARGET_AVX2 void name##_avx2(const _blend_buffer_desc_t *bd, const float *a, float *b,           \
+                                         const float *mask, int flag)                                       \
+  {                                                                                                          \
+    name(bd, a, b, mask, flag);                                                                              \
+  }                                                                                                          \
+  static DT_TARGET_AVX512 void name##_avx512(const _blend_buffer_desc_t *bd, const float *a, float *b,       \
+                                             const float *mask, int flag)                                   \
+  {                                                                                                          \
+    name(bd, a, b, mask, flag);                                                                              \
+  }                                                                                                          \
+  static const _blend_row_variants_t name##_variants = { name, name##_avx2, name##_avx512 };
+#else
+#define _BLEND_ROW_VARIANTS(name) static const _blend_row_variants_t name##_variants = { name, name, name };
+#endif
+
+_BLEND_ROW_VARIANTS(_blend_lighten)
+_BLEND_ROW_VARIANTS(_blend_darken)
+_BLEND_ROW_VARIANTS(_blend_multiply)
+_BLEND_ROW_VARIANTS(_blend_average)
+_BLEND_ROW_VARIANTS(_blend_add)
+_BLEND_ROW_VARIANTS(_blend_substract)
+_BLEND_ROW_VARIANTS(_blend_difference)
+_BLEND_ROW_VARIANTS(_blend_difference2)
+_BLEND_ROW_VARIANTS(_blend_screen)
+_BLEND_ROW_VARIANTS(_blend_overlay)
+_BLEND_ROW_VARIANTS(_blend_softlight)
+_BLEND_ROW_VARIANTS(_blend_hardlight)
+_BLEND_ROW_VARIANTS(_blend_vividlight)
+_BLEND_ROW_VARIANTS(_blend_linearlight)
+_BLEND_ROW_VARIANTS(_blend_pinlight)
+_BLEND_ROW_VARIANTS(_blend_lightness)
+_BLEND_ROW_VARIANTS(_blend_chroma)
+_BLEND_ROW_VARIANTS(_blend_hue)
+_BLEND_ROW_VARIANTS(_blend_color)
+_BLEND_ROW_VARIANTS(_blend_inverse)
+_BLEND_ROW_VARIANTS(_blend_normal_bounded)
+_BLEND_ROW_VARIANTS(_blend_coloradjust)
+_BLEND_ROW_VARIANTS(_blend_Lab_lightness)
+_BLEND_ROW_VARIANTS(_blend_Lab_a)
+_BLEND_ROW_VARIANTS(_blend_Lab_b)
+_BLEND_ROW_VARIANTS(_blend_Lab_color)
+_BLEND_ROW_VARIANTS(_blend_HSV_lightness)
+_BLEND_ROW_VARIANTS(_blend_HSV_color)
+_BLEND_ROW_VARIANTS(_blend_RGB_R)
+_BLEND_ROW_VARIANTS(_blend_RGB_G)
+_BLEND_ROW_VARIANTS(_blend_RGB_B)
+_BLEND_ROW_VARIANTS(_blend_normal_unbounded)
+#undef _BLEND_ROW_VARIANTS
+
+typedef void(_blend_mask_func)(const _blend_buffer_desc_t *bd, const _blendif_plan_t *plan,
+                               const unsigned int mask_combine, const float gopacity, const float *a,
+                               const float *b, float *mask);
+
+#ifdef DT_TARGET_AVX2
+static DT_TARGET_AVX2 void _blend_make_mask_avx2(const _blend_buffer_desc_t *bd, const _blendif_plan_t *plan,
+                                                 const unsigned int mask_combine, const float gopacity,
+                                                 const float *a, const float *b, float *mask)
+{
+  _blend_make_mask(bd, plan, mask_combine, gopacity, a, b, mask);
+}
+
+static DT_TARGET_AVX512 void _blend_make_mask_avx512(const _blend_buffer_desc_t *bd, const _blendif_plan_t *plan,
+                                                     const unsigned int mask_combine, const float gopacity,
+                                                     const float *a, const float *b, float *mask)
+{
+  _blend_make_mask(bd, plan, mask_combine, gopacity, a, b, mask);
+}
+#endif
+
+static _blend_mask_func *_blend_choose_mask_func(void)
+{
+#ifdef DT_TARGET_AVX2
+  if(darktable.codepath.AVX512) return _blend_make_mask_avx512;
+  if(darktable.codepath.AVX2) return _blend_make_mask_avx2;
+#endif
+  return _blend_make_mask;
+}
+
+
 _blend_row_func *dt_develop_choose_blend_func(const unsigned int blend_mode)
 {
-  _blend_row_func *blend = NULL;
+  const _blend_row_variants_t *blend = NULL;
 
   /* select the blend operator */
   switch(blend_mode)
   {
     case DEVELOP_BLEND_LIGHTEN:
-      blend = _blend_lighten;
+      blend = &_blend_lighten_variants;
       break;
     case DEVELOP_BLEND_DARKEN:
-      blend = _blend_darken;
+      blend = &_blend_darken_variants;
       break;
     case DEVELOP_BLEND_MULTIPLY:
-      blend = _blend_multiply;
+      blend = &_blend_multiply_variants;
       break;
     case DEVELOP_BLEND_AVERAGE:
-      blend = _blend_average;
+      blend = &_blend_average_variants;
       break;
     case DEVELOP_BLEND_ADD:
-      blend = _blend_add;
+      blend = &_blend_add_variants;
       break;
     case DEVELOP_BLEND_SUBSTRACT:
-      blend = _blend_substract;
+      blend = &_blend_substract_variants;
       break;
     case DEVELOP_BLEND_DIFFERENCE:
-      blend = _blend_difference;
+      blend = &_blend_difference_variants;
       break;
     case DEVELOP_BLEND_DIFFERENCE2:
-      blend = _blend_difference2;
+      blend = &_blend_difference2_variants;
       break;
     case DEVELOP_BLEND_SCREEN:
-      blend = _blend_screen;
+      blend = &_blend_screen_variants;
       break;
     case DEVELOP_BLEND_OVERLAY:
-      blend = _blend_overlay;
+      blend = &_blend_overlay_variants;
       break;
     case DEVELOP_BLEND_SOFTLIGHT:
-      blend = _blend_softlight;
+      blend = &_blend_softlight_variants;
       break;
     case DEVELOP_BLEND_HARDLIGHT:
-      blend = _blend_hardlight;
+      blend = &_blend_hardlight_variants;
       break;
     case DEVELOP_BLEND_VIVIDLIGHT:
-      blend = _blend_vividlight;
+      blend = &_blend_vividlight_variants;
       break;
     case DEVELOP_BLEND_LINEARLIGHT:
-      blend = _blend_linearlight;
+      blend = &_blend_linearlight_variants;
       break;
     case DEVELOP_BLEND_PINLIGHT:
-      blend = _blend_pinlight;
+      blend = &_blend_pinlight_variants;
       break;
     case DEVELOP_BLEND_LIGHTNESS:
-      blend = _blend_lightness;
+      blend = &_blend_lightness_variants;
       break;
     case DEVELOP_BLEND_CHROMA:
-      blend = _blend_chroma;
+      blend = &_blend_chroma_variants;
       break;
     case DEVELOP_BLEND_HUE:
-      blend = _blend_hue;
+      blend = &_blend_hue_variants;
       break;
     case DEVELOP_BLEND_COLOR:
-      blend = _blend_color;
+      blend = &_blend_color_variants;
       break;
     case DEVELOP_BLEND_INVERSE:
-      blend = _blend_inverse;
+      blend = &_blend_inverse_variants;
       break;
     case DEVELOP_BLEND_NORMAL:
     case DEVELOP_BLEND_BOUNDED:
-      blend = _blend_normal_bounded;
+      blend = &_blend_normal_bounded_variants;
       break;
     case DEVELOP_BLEND_COLORADJUST:
-      blend = _blend_coloradjust;
+      blend = &_blend_coloradjust_variants;
       break;
     case DEVELOP_BLEND_LAB_LIGHTNESS:
     case DEVELOP_BLEND_LAB_L:
-      blend = _blend_Lab_lightness;
+      blend = &_blend_Lab_lightness_variants;
       break;
     case DEVELOP_BLEND_LAB_A:
-      blend = _blend_Lab_a;
+      blend = &_blend_Lab_a_variants;
       break;
     case DEVELOP_BLEND_LAB_B:
-      blend = _blend_Lab_b;
+      blend = &_blend_Lab_b_variants;
       break;
     case DEVELOP_BLEND_LAB_COLOR:
-      blend = _blend_Lab_color;
+      blend = &_blend_Lab_color_variants;
       break;
     case DEVELOP_BLEND_HSV_LIGHTNESS:
-      blend = _blend_HSV_lightness;
+      blend = &_blend_HSV_lightness_variants;
       break;
     case DEVELOP_BLEND_HSV_COLOR:
-      blend = _blend_HSV_color;
+      blend = &_blend_HSV_color_variants;
       break;
     case DEVELOP_BLEND_RGB_R:
-      blend = _blend_RGB_R;
+      blend = &_blend_RGB_R_variants;
       break;
     case DEVELOP_BLEND_RGB_G:
-      blend = _blend_RGB_G;
+      blend = &_blend_RGB_G_variants;
       break;
     case DEVELOP_BLEND_RGB_B:
-      blend = _blend_RGB_B;
+      blend = &_blend_RGB_B_variants;
       break;
 
     /* fallback to normal blend */
     case DEVELOP_BLEND_NORMAL2:
     case DEVELOP_BLEND_UNBOUNDED:
     default:
-      blend = _blend_normal_unbounded;
+      blend = &_blend_normal_unbounded_variants;
       break;
   }
 
-  return blend;
+  if(darktable.codepath.AVX512) return blend->avx512;
+  if(darktable.codepath.AVX2) return blend->avx2;
+  return blend->plain;
 }
 
 void dt_develop_blend_process(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece,
@@ -2833,6 +2958,7 @@ void dt_develop_blend_process(struct dt_iop_module_t *self, struct dt_dev_pixelp
 
   /* select the blend operator */
   _blend_row_func *const blend = dt_develop_choose_blend_func(d->blend_mode);
+  _blend_mask_func *const make_mask = _blend_choose_mask_func();
 
   /* get the clipped opacity value  0 - 1 */
   const float opacity = fmin(fmax(0, (d->opacity / 100.0f)), 1.0f);
@@ -2852,8 +2978,35 @@ void dt_develop_blend_process(struct dt_iop_module_t *self, struct dt_dev_pixelp
   /* get channel max values depending on colorspace */
   const dt_iop_colorspace_type_t cst = dt_iop_module_colorspace(self);
 
-  /* allocate space for blend mask */
-  float *_mask = dt_alloc_align(64, (size_t)roi_out->width * roi_out->height * sizeof(float));
+  /* which channels of the conditional mask have to be looked at */
+  _blendif_plan_t plan;
+  _blendif_make_plan(cst, d->blendif, d->blendif_parameters, mask_mode, d->mask_combine, &plan);
+
+  /* the drawn mask, if there is one in use */
+  dt_masks_form_t *form = NULL;
+  const int drawn = !(self->flags() & IOP_FLAGS_NO_MASKS) && (mask_mode & DEVELOP_MASK_MASK);
+  if(drawn) form = dt_masks_get_from_id(self->dev, d->mask_id);
+
+  /* without a drawn mask and with a constant conditional one the opacity is the same for all pixels. the
+   * blend then reads a single row of it for every row, a blur wouldn't change it. */
+  const int uniform = mask_mode == DEVELOP_MASK_ENABLED || (!form && plan.constant);
+  float uniform_opacity = opacity;
+  if(uniform && mask_mode != DEVELOP_MASK_ENABLED)
+  {
+    const float fill = drawn ? ((d->mask_combine & DEVELOP_COMBINE_MASKS_POS) ? 0.0f : 1.0f)
+                             : ((d->mask_combine & DEVELOP_COMBINE_INCL) ? 0.0f : 1.0f);
+    const _blend_buffer_desc_t bd = { .cst = cst, .stride = ch, .ch = ch, .bch = bch };
+    const float zero[4] = { 0.0f };
+    uniform_opacity = fill;
+    _blend_make_mask(&bd, &plan, d->mask_combine, opacity, zero, zero, &uniform_opacity);
+  }
+  if(uniform && self->suppress_mask && self->dev->gui_attached && (self == self->dev->gui_module)
+     && (piece->pipe == self->dev->pipe) && (mask_mode & DEVELOP_MASK_BOTH))
+    uniform_opacity = opacity;
+
+  /* allocate space for blend mask, a single row if it is uniform */
+  const size_t mask_stride = uniform ? 0 : roi_out->width;
+  float *_mask = dt_alloc_align(64, (size_t)roi_out->width * (uniform ? 1 : roi_out->height) * sizeof(float));
   if(!_mask)
   {
     dt_control_log(_("could not allocate buffer for blending"));
@@ -2862,24 +3015,16 @@ void dt_develop_blend_process(struct dt_iop_module_t *self, struct dt_dev_pixelp
 
   float *const mask = _mask;
 
-  if(mask_mode == DEVELOP_MASK_ENABLED)
+  if(uniform)
   {
-    /* blend uniformly (no drawn or parametric mask) */
-
-    const size_t buffsize = (size_t)roi_out->width * roi_out->height;
-#ifdef _OPENMP
-#pragma omp parallel for default(none)
-#endif
-    for(size_t i = 0; i < buffsize; i++) mask[i] = opacity;
+    /* blend uniformly (no drawn or varying parametric mask) */
+    for(size_t i = 0; i < roi_out->width; i++) mask[i] = uniform_opacity;
   }
   else
   {
     /* we blend with a drawn and/or parametric mask */
 
-    /* get the drawn mask if there is one */
-    dt_masks_form_t *form = dt_masks_get_from_id(self->dev, d->mask_id);
-
-    if(form && (!(self->flags() & IOP_FLAGS_NO_MASKS)) && (d->mask_mode & DEVELOP_MASK_MASK))
+    if(form)
     {
       dt_masks_group_render_roi(self, piece, form, roi_out, mask);
 
@@ -2893,7 +3038,7 @@ void dt_develop_blend_process(struct dt_iop_module_t *self, struct dt_dev_pixelp
         for(size_t i = 0; i < buffsize; i++) mask[i] = 1.0f - mask[i];
       }
     }
-    else if((!(self->flags() & IOP_FLAGS_NO_MASKS)) && (d->mask_mode & DEVELOP_MASK_MASK))
+    else if(drawn)
     {
       // no form defined but drawn mask active
       // we fill the buffer with 1.0f or 0.0f depending on mask_combine
@@ -2916,7 +3061,7 @@ void dt_develop_blend_process(struct dt_iop_module_t *self, struct dt_dev_pixelp
     }
 
 #ifdef _OPENMP
-#pragma omp parallel for default(none)
+#pragma omp parallel for default(none) shared(plan)
 #endif
     for(size_t y = 0; y < roi_out->height; y++)
     {
@@ -2927,8 +3072,7 @@ void dt_develop_blend_process(struct dt_iop_module_t *self, struct dt_dev_pixelp
       float *in = (float *)ivoid + iindex;
       float *out = (float *)ovoid + oindex;
       float *m = (float *)mask + y * roi_out->width;
-      _blend_make_mask(&bd, d->blendif, d->blendif_parameters, d->mask_mode, d->mask_combine, opacity, in,
-                       out, m);
+      make_mask(&bd, &plan, d->mask_combine, opacity, in, out, m);
     }
 
     const int maskblur = fabs(d->radius) <= 0.1f ? 0 : 1;
@@ -2983,7 +3127,7 @@ void dt_develop_blend_process(struct dt_iop_module_t *self, struct dt_dev_pixelp
     _blend_buffer_desc_t bd = { .cst = cst, .stride = (size_t)roi_out->width * ch, .ch = ch, .bch = bch };
     float *in = (float *)ivoid + iindex;
     float *out = (float *)ovoid + oindex;
-    float *m = (float *)mask + y * roi_out->width;
+    float *m = (float *)mask + y * mask_stride;
 
     if(request_mask_display & DT_DEV_PIXELPIPE_DISPLAY_ANY)
       display_channel(&bd, in, out, m, request_mask_display);
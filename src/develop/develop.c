@@ -40,6 +40,7 @@
 #include "develop/imageop.h"
 #include "develop/lightroom.h"
 #include "develop/masks.h"
+#include "gui/draw.h"
 #include "gui/gtk.h"
 #include "gui/presets.h"
 
@@ -75,9 +76,16 @@ void dt_dev_init(dt_develop_t *dev, int32_t gui_attached)
   dev->preview_input_changed = 0;
 
   dev->pipe = dev->preview_pipe = NULL;
+  dev->pipe_cache = NULL;
+  dev->masks_cache = NULL;
+  memset(&dev->progressive, 0, sizeof(dev->progressive));
+  dev->history_change_time = 0.0;
   dt_pthread_mutex_init(&dev->pipe_mutex, NULL);
   dt_pthread_mutex_init(&dev->preview_pipe_mutex, NULL);
-  //   dt_pthread_mutex_init(&dev->histogram_waveform_mutex, NULL);
+  dt_pthread_mutex_init(&dev->histogram_waveform_mutex, NULL);
+  dev->histogram_request_width = dev->histogram_request_height = 0;
+  dev->histogram_channels = 7;
+  dev->histogram_surface = NULL;
   dev->histogram = NULL;
   dev->histogram_pre_tonecurve = NULL;
   dev->histogram_pre_levels = NULL;
@@ -95,6 +103,17 @@ void dt_dev_init(dt_develop_t *dev, int32_t gui_attached)
   dev->form_gui = NULL;
   dev->allforms = NULL;
 
+  const int64_t masks_cache_memory = dt_conf_get_int64("cache_masks_memory");
+  if(masks_cache_memory > 0)
+  {
+    dev->masks_cache = (dt_masks_cache_t *)malloc(sizeof(dt_masks_cache_t));
+    if(dev->masks_cache && !dt_masks_cache_init(dev->masks_cache, masks_cache_memory))
+    {
+      free(dev->masks_cache);
+      dev->masks_cache = NULL;
+    }
+  }
+
   if(dev->gui_attached)
   {
     dev->pipe = (dt_dev_pixelpipe_t *)malloc(sizeof(dt_dev_pixelpipe_t));
@@ -102,6 +121,18 @@ void dt_dev_init(dt_develop_t *dev, int32_t gui_attached)
     dt_dev_pixelpipe_init(dev->pipe);
     dt_dev_pixelpipe_init_preview(dev->preview_pipe);
 
+    // buffers dropped by either pipe are kept in a shared store, so they survive image switches
+    const int64_t pipe_cache_memory = dt_conf_get_int64("cache_pixelpipe_memory");
+    if(pipe_cache_memory > 0)
+    {
+      dev->pipe_cache = (dt_dev_pixelpipe_cache_store_t *)malloc(sizeof(dt_dev_pixelpipe_cache_store_t));
+      if(dev->pipe_cache && dt_dev_pixelpipe_cache_store_init(dev->pipe_cache, pipe_cache_memory))
+      {
+        dev->pipe->cache.store = dev->preview_pipe->cache.store = dev->pipe_cache;
+        dev->preview_pipe->cache.half_store = dt_conf_get_bool("cache_pixelpipe_half_float");
+      }
+    }
+
     dev->histogram = (uint32_t *)calloc(4 * 256, sizeof(uint32_t));
     dev->histogram_pre_tonecurve = (uint32_t *)calloc(4 * 256, sizeof(uint32_t));
     dev->histogram_pre_levels = (uint32_t *)calloc(4 * 256, sizeof(uint32_t));
@@ -133,7 +164,8 @@ void dt_dev_cleanup(dt_develop_t *dev)
   // image_cache does not have to be unref'd, this is done outside develop module.
   dt_pthread_mutex_destroy(&dev->pipe_mutex);
   dt_pthread_mutex_destroy(&dev->preview_pipe_mutex);
-  //   dt_pthread_mutex_destroy(&dev->histogram_waveform_mutex);
+  dt_pthread_mutex_destroy(&dev->histogram_waveform_mutex);
+  if(dev->histogram_surface) cairo_surface_destroy(dev->histogram_surface);
   if(dev->pipe)
   {
     dt_dev_pixelpipe_cleanup(dev->pipe);
@@ -144,6 +176,17 @@ void dt_dev_cleanup(dt_develop_t *dev)
     dt_dev_pixelpipe_cleanup(dev->preview_pipe);
     free(dev->preview_pipe);
   }
+  if(dev->pipe_cache)
+  {
+    dt_dev_pixelpipe_cache_store_cleanup(dev->pipe_cache);
+    free(dev->pipe_cache);
+  }
+  if(dev->masks_cache)
+  {
+    dt_masks_cache_cleanup(dev->masks_cache);
+    free(dev->masks_cache);
+  }
+  dt_free_align(dev->progressive.buf);
   while(dev->history)
   {
     dt_dev_free_history_item(((dt_dev_history_item_t *)dev->history->data));
@@ -296,6 +339,272 @@ restart:
   dt_mipmap_cache_release(darktable.mipmap_cache, &buf);
 }
 
+// progressive rendering: size of the refined tiles in pixels of the view
+#define DT_DEV_PROGRESSIVE_TILE 256
+// minimum border around refined tiles, for the small neighbourhoods modules don't report to the tiling code
+#define DT_DEV_PROGRESSIVE_MIN_OVERLAP 16
+
+typedef struct dt_dev_progressive_tile_t
+{
+  int x, y;
+  float dist;
+} dt_dev_progressive_tile_t;
+
+static int _progressive_tile_cmp(const void *a, const void *b)
+{
+  const float da = ((const dt_dev_progressive_tile_t *)a)->dist;
+  const float db = ((const dt_dev_progressive_tile_t *)b)->dist;
+  return (da > db) - (da < db);
+}
+
+static void _progressive_invalidate(dt_develop_t *dev)
+{
+  dt_pthread_mutex_lock(&dev->pipe->backbuf_mutex);
+  dev->progressive.valid = 0;
+  dt_pthread_mutex_unlock(&dev->pipe->backbuf_mutex);
+}
+
+// blows the backbuf of a run at 1/factor of the scale up to the view and shows it. returns 0 if out of memory.
+static int _progressive_show_coarse(dt_develop_t *dev, const int wd, const int ht, const int factor)
+{
+  dt_dev_pixelpipe_t *pipe = dev->pipe;
+  dt_pthread_mutex_lock(&pipe->backbuf_mutex);
+  const size_t size = (size_t)4 * wd * ht;
+  if(size > dev->progressive.size)
+  {
+    dt_free_align(dev->progressive.buf);
+    dev->progressive.buf = (uint8_t *)dt_alloc_align(64, size);
+    dev->progressive.size = dev->progressive.buf ? size : 0;
+  }
+  if(!dev->progressive.buf)
+  {
+    dt_pthread_mutex_unlock(&pipe->backbuf_mutex);
+    return 0;
+  }
+  const uint32_t *const coarse = (const uint32_t *)pipe->backbuf;
+  const int cwd = pipe->backbuf_width, cht = pipe->backbuf_height;
+  uint32_t *const out = (uint32_t *)dev->progressive.buf;
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static) default(none) shared(out)
+#endif
+  for(int j = 0; j < ht; j++)
+  {
+    const uint32_t *const row = coarse + (size_t)MIN(j / factor, cht - 1) * cwd;
+    for(int i = 0; i < wd; i++) out[(size_t)j * wd + i] = row[MIN(i / factor, cwd - 1)];
+  }
+  dev->progressive.width = wd;
+  dev->progressive.height = ht;
+  dev->progressive.valid = 1;
+  dt_pthread_mutex_unlock(&pipe->backbuf_mutex);
+  dt_control_queue_redraw_center();
+  return 1;
+}
+
+// only panning and zooming start from scratch, edits are faster through the cached module outputs and the
+// patching of local edits. modules that need the whole view at once would show the seams of the tiles.
+static int _progressive_wanted(dt_develop_t *dev, const dt_dev_pixelpipe_change_t pipe_changed, const int wd,
+                               const int ht)
+{
+  if(!dev->gui_attached || !dt_conf_get_bool("plugins/darkroom/progressive_rendering")) return 0;
+  if(pipe_changed != DT_DEV_PIPE_ZOOMED && !dev->image_loading) return 0;
+  if(wd < 2 * DT_DEV_PROGRESSIVE_TILE && ht < 2 * DT_DEV_PROGRESSIVE_TILE) return 0;
+  return dt_dev_pixelpipe_streaming_barriers(dev->pipe, dev) == 0;
+}
+
+// renders the view at a quarter of the scale, then refines it in tiles, starting with the ones closest to the
+// pointer or else the center. each pass is published through dev->progressive. returns 1 if interrupted.
+static int _dev_process_image_progressive(dt_develop_t *dev, const int x, const int y, const int wd,
+                                          const int ht, const float scale)
+{
+  dt_dev_pixelpipe_t *pipe = dev->pipe;
+  if(dt_dev_pixelpipe_process(pipe, dev, x / 4, y / 4, MAX(1, wd / 4), MAX(1, ht / 4), scale / 4.0f)) return 1;
+
+  const int nx = (wd + DT_DEV_PROGRESSIVE_TILE - 1) / DT_DEV_PROGRESSIVE_TILE;
+  const int ny = (ht + DT_DEV_PROGRESSIVE_TILE - 1) / DT_DEV_PROGRESSIVE_TILE;
+  dt_dev_progressive_tile_t *tiles = (dt_dev_progressive_tile_t *)malloc(sizeof(dt_dev_progressive_tile_t) * nx * ny);
+  if(!tiles || !_progressive_show_coarse(dev, wd, ht, 4))
+  {
+    free(tiles);
+    return dt_dev_pixelpipe_process(pipe, dev, x, y, wd, ht, scale);
+  }
+
+  float fx = .5f * wd, fy = .5f * ht;
+  if(dev->progressive.focus)
+  {
+    fx = scale * pipe->processed_width * (.5f + dev->progressive.focus_x) - x;
+    fy = scale * pipe->processed_height * (.5f + dev->progressive.focus_y) - y;
+  }
+  for(int j = 0; j < ny; j++)
+    for(int i = 0; i < nx; i++)
+    {
+      dt_dev_progressive_tile_t *tile = tiles + (size_t)j * nx + i;
+      tile->x = i * DT_DEV_PROGRESSIVE_TILE;
+      tile->y = j * DT_DEV_PROGRESSIVE_TILE;
+      const float dx = tile->x + .5f * MIN(DT_DEV_PROGRESSIVE_TILE, wd - tile->x) - fx;
+      const float dy = tile->y + .5f * MIN(DT_DEV_PROGRESSIVE_TILE, ht - tile->y) - fy;
+      tile->dist = dx * dx + dy * dy;
+    }
+  qsort(tiles, (size_t)nx * ny, sizeof(dt_dev_progressive_tile_t), _progressive_tile_cmp);
+
+  const int overlap = DT_DEV_PROGRESSIVE_MIN_OVERLAP + dt_dev_pixelpipe_streaming_overlap(pipe, dev, scale);
+  for(int k = 0; k < nx * ny; k++)
+  {
+    const int tx = tiles[k].x, ty = tiles[k].y;
+    // the tile with its border, clipped to the view like a run on the whole view would be
+    const int x0 = MAX(0, tx - overlap), y0 = MAX(0, ty - overlap);
+    const int w = MIN(wd, tx + DT_DEV_PROGRESSIVE_TILE + overlap) - x0;
+    const int h = MIN(ht, ty + DT_DEV_PROGRESSIVE_TILE + overlap) - y0;
+    if(pipe->changed != DT_DEV_PIPE_UNCHANGED || dev->gui_leaving
+       || dt_dev_pixelpipe_process(pipe, dev, x + x0, y + y0, w, h, scale))
+    {
+      free(tiles);
+      return 1;
+    }
+
+    const int cp_width = MIN(DT_DEV_PROGRESSIVE_TILE, wd - tx);
+    const int cp_height = MIN(DT_DEV_PROGRESSIVE_TILE, ht - ty);
+    dt_pthread_mutex_lock(&pipe->backbuf_mutex);
+    const uint8_t *const in = pipe->backbuf;
+    uint8_t *const buf = dev->progressive.buf;
+    for(int j = 0; j < cp_height; j++)
+      memcpy(buf + (size_t)4 * ((size_t)(ty + j) * wd + tx), in + (size_t)4 * ((size_t)(ty - y0 + j) * w + tx - x0),
+             (size_t)4 * cp_width);
+    dt_pthread_mutex_unlock(&pipe->backbuf_mutex);
+    dt_control_queue_redraw_center();
+  }
+  free(tiles);
+  return 0;
+}
+
+// parameter changes closer together than this, in seconds, go into one run of the pipe
+#define DT_DEV_COALESCE_INTERVAL 0.016
+// but a run doesn't wait longer than this for them to settle
+#define DT_DEV_COALESCE_MAX 0.05
+// while parameters keep changing, the center view is rendered at 1/DT_DEV_INTERACTIVE_FACTOR of the scale
+#define DT_DEV_INTERACTIVE_FACTOR 2
+// and redone at full scale once they didn't change for this long
+#define DT_DEV_INTERACTIVE_SETTLE 0.25
+
+// gives a slider drag a moment to send its next change, instead of starting a run it would supersede
+static void _coalesce_changes(dt_develop_t *dev)
+{
+  if(!dev->gui_attached) return;
+  const double start = dt_get_wtime();
+  for(double now = start; now - dev->history_change_time < DT_DEV_COALESCE_INTERVAL
+                          && now - start < DT_DEV_COALESCE_MAX && !dev->gui_leaving;
+      now = dt_get_wtime())
+    dt_iop_nap(2000);
+}
+
+static int _interactive_wanted(dt_develop_t *dev, const dt_dev_pixelpipe_change_t pipe_changed)
+{
+  if(!dev->gui_attached || dev->image_loading || !dt_conf_get_bool("plugins/darkroom/interactive_downscale"))
+    return 0;
+  if(!(pipe_changed & (DT_DEV_PIPE_TOP_CHANGED | DT_DEV_PIPE_SYNCH))) return 0;
+  return dt_get_wtime() - dev->history_change_time < DT_DEV_INTERACTIVE_SETTLE;
+}
+
+// renders the view at reduced scale and shows it blown up. returns 1 if interrupted.
+static int _dev_process_image_interactive(dt_develop_t *dev, const int x, const int y, const int wd,
+                                          const int ht, const float scale)
+{
+  const int f = DT_DEV_INTERACTIVE_FACTOR;
+  if(dt_dev_pixelpipe_process(dev->pipe, dev, x / f, y / f, MAX(1, wd / f), MAX(1, ht / f), scale / f))
+    return 1;
+  if(!_progressive_show_coarse(dev, wd, ht, f)) return dt_dev_pixelpipe_process(dev->pipe, dev, x, y, wd, ht, scale);
+  return 0;
+}
+
+// the preview pipe renders the whole image as well. when the view shows all of it and the preview has at least
+// this fraction of the resolution an interactive run would, the preview is blown up instead of running the pipe.
+#define DT_DEV_SHARE_TOLERANCE 0.9f
+// how long, in seconds, an interactive run waits for the preview of the same edit
+#define DT_DEV_SHARE_WAIT 0.1
+
+static int _share_preview_wanted(dt_develop_t *dev, const int x, const int y, const int wd, const int ht,
+                                 const float scale)
+{
+  if(!dt_conf_get_bool("plugins/darkroom/share_preview")) return 0;
+  // the whole image, as the preview has it
+  if(x > 0 || y > 0 || wd + 1 < (int)(dev->pipe->processed_width * scale)
+     || ht + 1 < (int)(dev->pipe->processed_height * scale))
+    return 0;
+  const int f = DT_DEV_INTERACTIVE_FACTOR;
+  dt_pthread_mutex_lock(&dev->preview_pipe->backbuf_mutex);
+  const int bw = dev->preview_pipe->backbuf_width, bh = dev->preview_pipe->backbuf_height;
+  dt_pthread_mutex_unlock(&dev->preview_pipe->backbuf_mutex);
+  return bw * f >= DT_DEV_SHARE_TOLERANCE * wd && bh * f >= DT_DEV_SHARE_TOLERANCE * ht;
+}
+
+static int _share_preview_ready(dt_develop_t *dev)
+{
+  return dev->preview_status == DT_DEV_PIXELPIPE_VALID && dev->preview_pipe->input_timestamp == dev->timestamp
+         && dev->preview_pipe->changed == DT_DEV_PIPE_UNCHANGED;
+}
+
+// shows the output of the preview pipe for the current edit scaled to the view, in place of an interactive run.
+// returns 0 if the preview didn't catch up in time.
+static int _progressive_show_preview(dt_develop_t *dev, const int wd, const int ht)
+{
+  const double start = dt_get_wtime();
+  while(!_share_preview_ready(dev))
+  {
+    if(dt_get_wtime() - start > DT_DEV_SHARE_WAIT || dev->pipe->changed != DT_DEV_PIPE_UNCHANGED
+       || dev->gui_leaving)
+      return 0;
+    dt_iop_nap(2000);
+  }
+
+  dt_dev_pixelpipe_t *pipe = dev->pipe;
+  dt_pthread_mutex_lock(&pipe->backbuf_mutex);
+  const size_t size = (size_t)4 * wd * ht;
+  if(size > dev->progressive.size)
+  {
+    dt_free_align(dev->progressive.buf);
+    dev->progressive.buf = (uint8_t *)dt_alloc_align(64, size);
+    dev->progressive.size = dev->progressive.buf ? size : 0;
+  }
+  if(!dev->progressive.buf)
+  {
+    dt_pthread_mutex_unlock(&pipe->backbuf_mutex);
+    return 0;
+  }
+  dt_pthread_mutex_lock(&dev->preview_pipe->backbuf_mutex);
+  // it might have moved on while we waited for the lock
+  if(!_share_preview_ready(dev) || !dev->preview_pipe->backbuf)
+  {
+    dt_pthread_mutex_unlock(&dev->preview_pipe->backbuf_mutex);
+    dt_pthread_mutex_unlock(&pipe->backbuf_mutex);
+    return 0;
+  }
+  const uint32_t *const preview = (const uint32_t *)dev->preview_pipe->backbuf;
+  const int pwd = dev->preview_pipe->backbuf_width, pht = dev->preview_pipe->backbuf_height;
+  uint32_t *const out = (uint32_t *)dev->progressive.buf;
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static) default(none) shared(out)
+#endif
+  for(int j = 0; j < ht; j++)
+  {
+    const uint32_t *const row = preview + (size_t)MIN((int)((j + .5f) * pht / ht), pht - 1) * pwd;
+    for(int i = 0; i < wd; i++) out[(size_t)j * wd + i] = row[MIN((int)((i + .5f) * pwd / wd), pwd - 1)];
+  }
+  dt_pthread_mutex_unlock(&dev->preview_pipe->backbuf_mutex);
+  dev->progressive.width = wd;
+  dev->progressive.height = ht;
+  dev->progressive.valid = 1;
+  dt_pthread_mutex_unlock(&pipe->backbuf_mutex);
+  dt_control_queue_redraw_center();
+  return 1;
+}
+
+// waits for the parameters to settle after an interactive run, or for the next change
+static void _interactive_settle(dt_develop_t *dev)
+{
+  while(dt_get_wtime() - dev->history_change_time < DT_DEV_INTERACTIVE_SETTLE
+        && dev->pipe->changed == DT_DEV_PIPE_UNCHANGED && !dev->gui_leaving)
+    dt_iop_nap(5000);
+}
+
 void dt_dev_process_image_job(dt_develop_t *dev)
 {
   dt_pthread_mutex_lock(&dev->pipe_mutex);
@@ -350,6 +659,8 @@ void dt_dev_process_image_job(dt_develop_t *dev)
   float zoom_x, zoom_y, scale;
   int window_width, window_height, x, y, closeup;
   dt_dev_pixelpipe_change_t pipe_changed;
+  // the reduced view of the last run stays up while the same edit renders at full scale
+  int keep_coarse = 0;
 
 // adjust pipeline according to changed flag set by {add,pop}_history_item.
 restart:
@@ -361,6 +672,7 @@ restart:
     dt_pthread_mutex_unlock(&dev->pipe_mutex);
     return;
   }
+  _coalesce_changes(dev);
   dev->pipe->input_timestamp = dev->timestamp;
   // dt_dev_pixelpipe_change() will clear the changed value
   pipe_changed = dev->pipe->changed;
@@ -394,8 +706,21 @@ restart:
   x = MAX(0, scale * dev->pipe->processed_width  * (.5 + zoom_x) - wd / 2);
   y = MAX(0, scale * dev->pipe->processed_height * (.5 + zoom_y) - ht / 2);
 
+  // whatever was composed for the old view doesn't fit anymore
+  if(pipe_changed != DT_DEV_PIPE_UNCHANGED) keep_coarse = 0;
+  if(!keep_coarse) _progressive_invalidate(dev);
+  const int progressive = _progressive_wanted(dev, pipe_changed, wd, ht);
+  const int interactive = !progressive && _interactive_wanted(dev, pipe_changed);
+
+  // while editing a fitted view, the preview of the same edit takes the place of the reduced run
+  const int shared = interactive && _share_preview_wanted(dev, x, y, wd, ht, scale)
+                     && _progressive_show_preview(dev, wd, ht);
+
   dt_get_times(&start);
-  if(dt_dev_pixelpipe_process(dev->pipe, dev, x, y, wd, ht, scale))
+  if(shared ? 0
+            : progressive ? _dev_process_image_progressive(dev, x, y, wd, ht, scale)
+                          : interactive ? _dev_process_image_interactive(dev, x, y, wd, ht, scale)
+                                        : dt_dev_pixelpipe_process(dev->pipe, dev, x, y, wd, ht, scale))
   {
     // interrupted because image changed?
     if(dev->image_force_reload)
@@ -410,12 +735,24 @@ restart:
     else
       goto restart;
   }
-  dt_show_times(&start, "[dev_process_image] pixel pipeline processing", NULL);
-  dt_dev_average_delay_update(&start, &dev->average_delay);
+  if(!shared)
+  {
+    dt_show_times(&start, "[dev_process_image] pixel pipeline processing", NULL);
+    dt_dev_average_delay_update(&start, &dev->average_delay);
+  }
 
   // maybe we got zoomed/panned in the meantime?
   if(dev->pipe->changed != DT_DEV_PIPE_UNCHANGED) goto restart;
 
+  // the reduced view stays up until the next change, or is replaced by the full one once things settle
+  if(interactive)
+  {
+    _interactive_settle(dev);
+    keep_coarse = 1;
+    goto restart;
+  }
+  if(keep_coarse) _progressive_invalidate(dev);
+
   // cool, we got a new image!
   dev->image_status = DT_DEV_PIXELPIPE_VALID;
   dev->image_loading = 0;
@@ -452,6 +789,53 @@ void dt_dev_reload_image(dt_develop_t *dev, const uint32_t imgid)
   dt_dev_invalidate(dev); // only invalidate image, preview will follow once it's loaded.
 }
 
+void dt_dev_load_next_image(dt_develop_t *dev, const uint32_t imgid)
+{
+  while(dev->history)
+  {
+    dt_dev_free_history_item(dev->history->data);
+    dev->history = g_list_delete_link(dev->history, dev->history);
+  }
+  dev->history_end = 0;
+
+  _dt_dev_load_raw(dev, imgid);
+
+  // like the darkroom switching images: of every module the instance with the highest multi_priority is
+  // kept as the base one, the history of the new image makes the others again if it has them
+  GList *drop = NULL;
+  for(GList *modules = dev->iop; modules; modules = g_list_next(modules))
+  {
+    dt_iop_module_t *module = (dt_iop_module_t *)modules->data;
+    for(const GList *others = dev->iop; others; others = g_list_next(others))
+    {
+      const dt_iop_module_t *other = (const dt_iop_module_t *)others->data;
+      if(other != module && !strcmp(other->op, module->op) && other->multi_priority > module->multi_priority)
+      {
+        drop = g_list_prepend(drop, module);
+        break;
+      }
+    }
+  }
+  for(GList *d = drop; d; d = g_list_next(d))
+  {
+    dt_iop_module_t *module = (dt_iop_module_t *)d->data;
+    dev->iop = g_list_remove(dev->iop, module);
+    dt_iop_cleanup_module(module);
+    free(module);
+  }
+  g_list_free(drop);
+  for(GList *modules = dev->iop; modules; modules = g_list_next(modules))
+  {
+    dt_iop_module_t *module = (dt_iop_module_t *)modules->data;
+    module->multi_priority = 0;
+    module->multi_name[0] = '\0';
+    dt_iop_reload_defaults(module);
+  }
+
+  dt_masks_read_forms(dev);
+  dt_dev_read_history(dev);
+}
+
 float dt_dev_get_zoom_scale(dt_develop_t *dev, dt_dev_zoom_t zoom, int closeup_factor, int preview)
 {
   float zoom_scale;
@@ -667,6 +1051,7 @@ void dt_dev_add_history_item(dt_develop_t *dev, dt_iop_module_t *module, gboolea
 #endif
 
   // invalidate buffers and force redraw of darkroom
+  dev->history_change_time = dt_get_wtime();
   dt_dev_invalidate_all(dev);
   dt_pthread_mutex_unlock(&dev->history_mutex);
 
@@ -1020,13 +1405,15 @@ void dt_dev_read_history(dt_develop_t *dev)
   auto_apply_presets(dev);
 
   sqlite3_stmt *stmt;
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "SELECT imgid, num, module, operation, "
-                                                             "op_params, enabled, blendop_params, "
-                                                             "blendop_version, multi_priority, multi_name "
-                                                             "FROM main.history WHERE imgid = ?1 ORDER BY num",
-                              -1, &stmt, NULL);
+  DT_DEBUG_SQLITE3_PREPARE_CACHED(darktable.db, "SELECT imgid, num, module, operation, "
+                                                "op_params, enabled, blendop_params, "
+                                                "blendop_version, multi_priority, multi_name "
+                                                "FROM main.history WHERE imgid = ?1 ORDER BY num",
+                                  &stmt);
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, dev->image_storage.id);
   dev->history_end = 0;
+  // prepended and reversed once all are there, appending would walk the whole stack for every item
+  GList *items = NULL;
   while(sqlite3_step(stmt) == SQLITE_ROW)
   {
     // db record:
@@ -1187,13 +1574,13 @@ void dt_dev_read_history(dt_develop_t *dev)
     // printf("[dev read history] img %d number %d for operation %d - %s params %f %f\n",
     // sqlite3_column_int(stmt, 0), sqlite3_column_int(stmt, 1), instance, hist->module->op, *(float
     // *)hist->params, *(((float*)hist->params)+1));
-    dev->history = g_list_append(dev->history, hist);
+    items = g_list_prepend(items, hist);
     dev->history_end++;
   }
-  sqlite3_finalize(stmt);
+  dt_database_release_cached(darktable.db, stmt);
+  dev->history = g_list_concat(dev->history, g_list_reverse(items));
 
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "SELECT history_end FROM main.images WHERE id = ?1",
-                              -1, &stmt, NULL);
+  DT_DEBUG_SQLITE3_PREPARE_CACHED(darktable.db, "SELECT history_end FROM main.images WHERE id = ?1", &stmt);
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, dev->image_storage.id);
   if(sqlite3_step(stmt) == SQLITE_ROW) // seriously, this should never fail
   {
@@ -1210,7 +1597,7 @@ void dt_dev_read_history(dt_develop_t *dev)
     /* signal history changed */
     dt_control_signal_raise(darktable.signals, DT_SIGNAL_DEVELOP_HISTORY_CHANGE);
   }
-  sqlite3_finalize(stmt);
+  dt_database_release_cached(darktable.db, stmt);
 }
 
 
@@ -1232,6 +1619,23 @@ void dt_dev_reprocess_all(dt_develop_t *dev)
   }
 }
 
+void dt_dev_set_interacting(dt_develop_t *dev, dt_iop_module_t *module)
+{
+  if(!dev || !dev->gui_attached) return;
+  if(module && (module->dev != dev || !dt_conf_get_bool("plugins/darkroom/draft_interaction"))) module = NULL;
+  if(dev->interacting == module) return;
+  dev->interacting = module;
+
+  // commit all pieces again, the ones from the module on change their quality and so their hash. the drag
+  // itself changes the parameters, after it the center view has to be rendered again in full quality.
+  dev->pipe->changed |= DT_DEV_PIPE_SYNCH;
+  if(!module)
+  {
+    dt_dev_invalidate(dev);
+    dt_control_queue_redraw_center();
+  }
+}
+
 void dt_dev_reprocess_center(dt_develop_t *dev)
 {
   if(darktable.gui->reset) return;
@@ -1337,6 +1741,58 @@ void dt_dev_get_pointer_zoom_pos(dt_develop_t *dev, const float px, const float
   *zoom_y = zoom2_y;
 }
 
+void dt_dev_histogram_render(dt_develop_t *dev)
+{
+  dt_pthread_mutex_lock(&dev->histogram_waveform_mutex);
+  cairo_surface_t *surface = NULL;
+  const int width = dev->histogram_request_width, height = dev->histogram_request_height;
+  const int channels = dev->histogram_channels;
+  const uint32_t hist_max = dev->histogram_max;
+  if(width > 0 && height > 0 && hist_max > 0 && hist_max != (uint32_t)-1 && dev->histogram)
+  {
+    if(dev->histogram_type == DT_DEV_HISTOGRAM_WAVEFORM)
+    {
+      // in the bytes of the waveform, blue comes first
+      const int wd = dev->histogram_waveform_width, ht = dev->histogram_waveform_height;
+      if(dev->histogram_waveform && wd > 0 && ht > 0)
+      {
+        surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, wd, ht);
+        cairo_surface_flush(surface);
+        uint8_t *const out = cairo_image_surface_get_data(surface);
+        const int stride = cairo_image_surface_get_stride(surface);
+        const uint8_t *const in = (const uint8_t *)dev->histogram_waveform;
+        const uint8_t mask[4] = { channels & 4 ? 0xff : 0, channels & 2 ? 0xff : 0, channels & 1 ? 0xff : 0, 0 };
+        for(int y = 0; y < ht; y++)
+          for(int x = 0; x < 4 * wd; x++)
+            out[(size_t)y * stride + x] = in[(size_t)y * dev->histogram_waveform_stride + x] & mask[x & 3];
+        cairo_surface_mark_dirty(surface);
+      }
+    }
+    else
+    {
+      const int linear = dev->histogram_type == DT_DEV_HISTOGRAM_LINEAR;
+      const float max = linear ? hist_max : logf(1.0 + hist_max);
+      surface = dt_cairo_image_surface_create(CAIRO_FORMAT_ARGB32, width, height);
+      cairo_t *cr = cairo_create(surface);
+      cairo_translate(cr, 0, height);
+      cairo_scale(cr, width / 255.0, -(height - 10) / max);
+      cairo_set_operator(cr, CAIRO_OPERATOR_ADD);
+      cairo_set_line_width(cr, 1.);
+      for(int k = 0; k < 3; k++)
+      {
+        if(!(channels & (1 << k))) continue;
+        cairo_set_source_rgba(cr, k == 0, k == 1, k == 2, 0.2);
+        dt_draw_histogram_8(cr, dev->histogram, k, linear);
+      }
+      cairo_destroy(cr);
+    }
+  }
+  cairo_surface_t *old = dev->histogram_surface;
+  dev->histogram_surface = surface;
+  dt_pthread_mutex_unlock(&dev->histogram_waveform_mutex);
+  if(old) cairo_surface_destroy(old);
+}
+
 void dt_dev_get_history_item_label(dt_dev_history_item_t *hist, char *label, const int cnt)
 {
   gchar *module_label = dt_history_item_get_name(hist->module);
@@ -1483,9 +1939,8 @@ void dt_dev_masks_selection_change(dt_develop_t *dev, int selectid, int throw_ev
     dev->proxy.masks.selection_change(dev->proxy.masks.module, selectid, throw_event);
 }
 
-void dt_dev_snapshot_request(dt_develop_t *dev, const char *filename)
+void dt_dev_snapshot_request(dt_develop_t *dev)
 {
-  dev->proxy.snapshot.filename = filename;
   dev->proxy.snapshot.request = TRUE;
   dt_control_queue_redraw_center();
 }
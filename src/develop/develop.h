@@ -125,6 +125,7 @@ typedef struct dt_develop_t
   uint32_t average_delay;
   uint32_t preview_average_delay;
   struct dt_iop_module_t *gui_module; // this module claims gui expose/event callbacks.
+  struct dt_iop_module_t *interacting; // a slider of this module is being dragged, see dt_dev_set_interacting()
   float preview_downsampling;         // < 1.0: optionally downsample preview
 
   // width, height: dimensions of window
@@ -132,8 +133,27 @@ typedef struct dt_develop_t
 
   // image processing pipeline with caching
   struct dt_dev_pixelpipe_t *pipe, *preview_pipe;
+  // buffers evicted from the caches of the pipes above, shared between them
+  struct dt_dev_pixelpipe_cache_store_t *pipe_cache;
+  // rasterized drawn forms, shared by the pipes and module instances of this develop
+  struct dt_masks_cache_t *masks_cache;
   dt_pthread_mutex_t pipe_mutex, preview_pipe_mutex; // these are locked while the pipes are still in use
 
+  // progressive rendering of the center view: the coarse pass and the refined tiles are composed in buf,
+  // which is drawn instead of the backbuf of pipe while valid. guarded by the backbuf_mutex of pipe.
+  struct
+  {
+    uint8_t *buf;
+    size_t size;
+    int width, height;
+    int valid;
+    // last pointer position over the center view, in zoom coordinates, refined first if set
+    int focus;
+    float focus_x, focus_y;
+  } progressive;
+  // dt_get_wtime() of the last dt_dev_add_history_item(), to merge the changes of a slider drag
+  double history_change_time;
+
   // image under consideration, which
   // is copied each time an image is changed. this means we have some information
   // always cached (might be out of sync, so stars are not reliable), but for the iops
@@ -156,9 +176,13 @@ typedef struct dt_develop_t
   uint32_t histogram_max, histogram_pre_tonecurve_max, histogram_pre_levels_max;
   uint32_t *histogram_waveform, histogram_waveform_width, histogram_waveform_height,
       histogram_waveform_stride;
-  // we should process the waveform histogram in the correct size to make it not look like crap. since this
-  // requires gui knowledge we need this mutex
-  //   dt_pthread_mutex_t histogram_waveform_mutex;
+  // the histogram lib asks for its drawing size here, the preview pipe processes the waveform to fit it. the
+  // curves or the waveform of the channels shown are rendered into histogram_surface, which the lib blits.
+  int histogram_request_width, histogram_request_height;
+  int histogram_channels; // 1 << k for the channels shown, red first
+  cairo_surface_t *histogram_surface;
+  // guards histogram_waveform and histogram_surface
+  dt_pthread_mutex_t histogram_waveform_mutex;
   dt_dev_histogram_type_t histogram_type;
 
   // list of forms iop can use for masks or whatever
@@ -200,9 +224,10 @@ typedef struct dt_develop_t
     struct
     {
       // this flag is set by snapshot plugin to signal that expose of darkroom
-      // should store cairo surface as snapshot to disk using filename.
+      // should hand the cairo surface shown to taken(), which keeps a copy of it.
       gboolean request;
-      const gchar *filename;
+      struct dt_lib_module_t *module;
+      void (*taken)(struct dt_lib_module_t *self, cairo_surface_t *surface);
     } snapshot;
 
     // masks plugin hooks
@@ -263,6 +288,9 @@ void dt_dev_process_preview(dt_develop_t *dev);
 
 void dt_dev_load_image(dt_develop_t *dev, const uint32_t imgid);
 void dt_dev_reload_image(dt_develop_t *dev, const uint32_t imgid);
+/** loads another image into a dev without gui that had one already, keeping the module instances: the base
+ * instance of every module stays with its defaults reloaded, the others go. */
+void dt_dev_load_next_image(dt_develop_t *dev, const uint32_t imgid);
 /** checks if provided imgid is the image currently in develop */
 int dt_dev_is_current_image(dt_develop_t *dev, uint32_t imgid);
 void dt_dev_add_history_item(dt_develop_t *dev, struct dt_iop_module_t *module, gboolean enable);
@@ -278,9 +306,17 @@ void dt_dev_invalidate(dt_develop_t *dev);
 void dt_dev_invalidate_all(dt_develop_t *dev);
 void dt_dev_set_histogram(dt_develop_t *dev);
 void dt_dev_set_histogram_pre(dt_develop_t *dev);
+/** renders histogram_surface anew from the last histogram and waveform, in any thread */
+void dt_dev_histogram_render(dt_develop_t *dev);
 void dt_dev_get_history_item_label(dt_dev_history_item_t *hist, char *label, const int cnt);
 void dt_dev_reprocess_all(dt_develop_t *dev);
 void dt_dev_reprocess_center(dt_develop_t *dev);
+/**
+ * a slider of module is dragged from now on, or none is any more if module is NULL. meanwhile the center view
+ * renders module and the ones after it in draft quality, see dt_dev_pixelpipe_iop_t.draft, and once the
+ * interaction has ended in full quality again.
+ */
+void dt_dev_set_interacting(dt_develop_t *dev, struct dt_iop_module_t *module);
 
 void dt_dev_get_processed_size(const dt_develop_t *dev, int *procw, int *proch);
 void dt_dev_check_zoom_bounds(dt_develop_t *dev, float *zoom_x, float *zoom_y, dt_dev_zoom_t zoom,
@@ -327,7 +363,7 @@ uint32_t dt_dev_modulegroups_get(dt_develop_t *dev);
 gboolean dt_dev_modulegroups_test(dt_develop_t *dev, uint32_t group, uint32_t iop_group);
 
 /** request snapshot */
-void dt_dev_snapshot_request(dt_develop_t *dev, const char *filename);
+void dt_dev_snapshot_request(dt_develop_t *dev);
 
 /** update gliding average for pixelpipe delay */
 void dt_dev_average_delay_update(const dt_times_t *start, uint32_t *average_delay);
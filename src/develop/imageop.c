@@ -26,6 +26,7 @@
 #include "common/interpolation.h"
 #include "common/module.h"
 #include "common/opencl.h"
+#include "common/simd.h"
 #include "control/control.h"
 #include "develop/blend.h"
 #include "develop/develop.h"
@@ -176,6 +177,12 @@ static void default_process(struct dt_iop_module_t *self, struct dt_dev_pixelpip
                             const void *const i, void *const o, const struct dt_iop_roi_t *const roi_in,
                             const struct dt_iop_roi_t *const roi_out)
 {
+#if defined(DT_SIMD_NEON)
+  // the plain code is forced on arm, that's only meant for the modules without neon
+  if(darktable.codepath.NEON && self->process_sse2)
+    self->process_sse2(self, piece, i, o, roi_in, roi_out);
+  else
+#endif
   if(darktable.codepath.OPENMP_SIMD && self->process_plain)
     self->process_plain(self, piece, i, o, roi_in, roi_out);
 #if defined(__SSE__)
@@ -534,7 +541,7 @@ static void dt_iop_gui_delete_callback(GtkButton *button, dt_iop_module_t *modul
     gtk_box_reorder_child(dt_ui_get_container(darktable.gui->ui, DT_UI_CONTAINER_PANEL_RIGHT_CENTER),
                           module->expander, -1);
 
-    gtk_widget_destroy(module->widget);
+    if(module->widget) gtk_widget_destroy(module->widget);
     dt_iop_gui_cleanup_module(module);
   }
 
@@ -921,6 +928,8 @@ static void dt_iop_gui_multiinstance_callback(GtkButton *button, GdkEventButton
 static void dt_iop_gui_off_callback(GtkToggleButton *togglebutton, gpointer user_data)
 {
   dt_iop_module_t *module = (dt_iop_module_t *)user_data;
+  // a module switched on processes, and might look at its gui while doing so
+  if(gtk_toggle_button_get_active(togglebutton)) dt_iop_gui_init_deferred(module);
   if(!darktable.gui->reset)
   {
     if(gtk_toggle_button_get_active(togglebutton))
@@ -1372,6 +1381,7 @@ void dt_iop_commit_params(dt_iop_module_t *module, dt_iop_params_t *params,
                           dt_dev_pixelpipe_iop_t *piece)
 {
   uint64_t hash = 5381;
+  const uint64_t old_hash = piece->hash;
   piece->hash = 0;
   if(piece->enabled)
   {
@@ -1402,29 +1412,65 @@ void dt_iop_commit_params(dt_iop_module_t *module, dt_iop_params_t *params,
     // register if module allows tiling, commit_params can overwrite this.
     if(module->flags() & IOP_FLAGS_ALLOW_TILING) piece->process_tiling_ready = 1;
 
+    // draft quality while a slider of this module or one before it is dragged in the center view
+    const dt_iop_module_t *interacting = module->dev->interacting;
+    piece->draft = interacting && pipe == module->dev->pipe && module->priority >= interacting->priority;
+
     module->commit_params(module, params, pipe, piece);
     for(int i = 0; i < length; i++) hash = ((hash << 5) + hash) ^ str[i];
+    hash = ((hash << 5) + hash) ^ piece->draft;
     piece->hash = hash;
 
     free(str);
   }
+  if(piece->hash != old_hash) dt_dev_pixelpipe_cache_hash_invalidate(pipe, piece);
   // printf("commit params hash += module %s: %lu, enabled = %d\n", piece->module->op, piece->hash,
   // piece->enabled);
 }
 
 void dt_iop_gui_cleanup_module(dt_iop_module_t *module)
 {
-  module->gui_cleanup(module);
+  if(!module->gui_deferred) module->gui_cleanup(module);
+  module->gui_deferred = FALSE;
   dt_iop_gui_cleanup_blending(module);
 }
 
+void dt_iop_gui_init_deferred(dt_iop_module_t *module)
+{
+  if(!module->gui_deferred) return;
+  module->gui_deferred = FALSE;
+
+  int reset = darktable.gui->reset;
+  darktable.gui->reset = 1;
+  module->gui_init(module);
+
+  // the widget goes above the blending ui, where dt_iop_gui_get_expander() would have put it
+  GtkWidget *iopw = dt_iop_gui_get_widget(module);
+  gtk_box_pack_start(GTK_BOX(iopw), module->widget, TRUE, TRUE, 0);
+  gtk_box_reorder_child(GTK_BOX(iopw), module->widget, 0);
+  gtk_widget_set_hexpand(module->widget, FALSE);
+  gtk_widget_set_vexpand(module->widget, FALSE);
+  gtk_widget_show_all(module->widget);
+
+  if(module->connect_key_accels) module->connect_key_accels(module);
+  darktable.gui->reset = reset;
+
+  dt_iop_gui_update(module);
+}
+
 void dt_iop_gui_update(dt_iop_module_t *module)
 {
+  // the params of a module that is switched on have to show, the others can wait until it is expanded
+  if(module->gui_deferred && module->enabled)
+  {
+    dt_iop_gui_init_deferred(module);
+    return;
+  }
   int reset = darktable.gui->reset;
   darktable.gui->reset = 1;
   if(!dt_iop_is_hidden(module))
   {
-    module->gui_update(module);
+    if(!module->gui_deferred) module->gui_update(module);
     dt_iop_gui_update_blending(module);
     dt_iop_gui_update_expanded(module);
     _iop_gui_update_label(module);
@@ -1437,7 +1483,7 @@ void dt_iop_gui_reset(dt_iop_module_t *module)
 {
   int reset = darktable.gui->reset;
   darktable.gui->reset = 1;
-  if(module->gui_reset && !dt_iop_is_hidden(module)) module->gui_reset(module);
+  if(module->gui_reset && !module->gui_deferred && !dt_iop_is_hidden(module)) module->gui_reset(module);
   darktable.gui->reset = reset;
 }
 
@@ -1570,6 +1616,7 @@ void dt_iop_request_focus(dt_iop_module_t *module)
   /* set the focus on module */
   if(module)
   {
+    dt_iop_gui_init_deferred(module);
     gtk_widget_set_state_flags(dt_iop_gui_get_pluginui(module), GTK_STATE_FLAG_SELECTED, TRUE);
 
     // gtk_widget_set_state(module->widget,    GTK_STATE_NORMAL);
@@ -1627,6 +1674,8 @@ static void dt_iop_gui_set_single_expanded(dt_iop_module_t *module, gboolean exp
   /* show / hide plugin widget */
   if(expanded)
   {
+    dt_iop_gui_init_deferred(module);
+
     /* set this module to receive focus / draw events*/
     dt_iop_request_focus(module);
 
@@ -1922,7 +1971,7 @@ got_image:
   dtgtk_icon_set_paint(hw[0], dtgtk_cairo_paint_solid_arrow, CPF_DIRECTION_LEFT);
 
   /* add the blending ui if supported */
-  gtk_box_pack_start(GTK_BOX(iopw), module->widget, TRUE, TRUE, 0);
+  if(!module->gui_deferred) gtk_box_pack_start(GTK_BOX(iopw), module->widget, TRUE, TRUE, 0);
   dt_iop_gui_init_blending(iopw, module);
 
 
@@ -1940,9 +1989,11 @@ got_image:
   dt_dev_module_update_multishow(module->dev, module);
   _iop_gui_update_header(module);
 
-  gtk_widget_set_hexpand(module->widget, FALSE);
-  gtk_widget_set_vexpand(module->widget, FALSE);
-
+  if(!module->gui_deferred)
+  {
+    gtk_widget_set_hexpand(module->widget, FALSE);
+    gtk_widget_set_vexpand(module->widget, FALSE);
+  }
 
   return module->expander;
 }
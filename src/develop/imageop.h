@@ -91,7 +91,12 @@ typedef enum dt_iop_flags_t
   IOP_FLAGS_PREVIEW_NON_OPENCL
   = 1 << 8, // Preview pixelpipe of this module must not run on GPU but always on CPU
   IOP_FLAGS_NO_HISTORY_STACK = 1 << 9, // This iop will never show up in the history stack
-  IOP_FLAGS_NO_MASKS = 1 << 10         // The module doesn't support masks (used with SUPPORT_BLENDING)
+  IOP_FLAGS_NO_MASKS = 1 << 10,        // The module doesn't support masks (used with SUPPORT_BLENDING)
+  IOP_FLAGS_NO_TILE_STREAMING = 1 << 11, // Needs its whole input at once, tile streaming exports run it in one piece
+  IOP_FLAGS_POINTWISE = 1 << 12,         // Output pixel depends only on the input pixel at the same position
+  IOP_FLAGS_GEOMETRIC = 1 << 13,         // Output pixel is the input interpolated at its distort_backtransform()
+  IOP_FLAGS_EAGER_GUI = 1 << 14,         // gui_init() hooks up proxies or signals, it can't wait for the expander
+  IOP_FLAGS_POINTWISE_CROP = 1 << 15     // Pointwise but for the borders it crops off, roi_in is only larger
 } dt_iop_flags_t;
 
 /** status of a module*/
@@ -304,6 +309,8 @@ typedef struct dt_iop_module_t
   /** expander containing the widget and flag to store expanded state */
   GtkWidget *expander;
   gboolean expanded;
+  /** gui_init() is still to run, the expander holds only the header and blending ui so far */
+  gboolean gui_deferred;
   /** reset parameters button */
   GtkWidget *reset_button;
   /** show preset menu button */
@@ -477,6 +484,8 @@ void dt_iop_gui_cleanup_module(dt_iop_module_t *module);
 void dt_iop_gui_update(dt_iop_module_t *module);
 /** reset the ui to its defaults */
 void dt_iop_gui_reset(dt_iop_module_t *module);
+/** runs gui_init() of a module whose gui was deferred, once it is shown, focused or switched on */
+void dt_iop_gui_init_deferred(dt_iop_module_t *module);
 /** set expanded state of iop */
 void dt_iop_gui_set_expanded(dt_iop_module_t *module, gboolean expanded, gboolean collapse_others);
 /** refresh iop according to set expanded state */
@@ -26,14 +26,136 @@
 #endif
 #include <glib.h> // for MIN, MAX, CLAMP, inline
 #include <math.h> // for round, floorf, fmaxf
+#include <string.h> // for memset
 #ifdef __SSE__
 #include <xmmintrin.h> // for _mm_set_ps, _mm_mul_ps, _mm_set...
 #endif
 #include "common/darktable.h"        // for darktable, darktable_t, dt_code...
 #include "common/imageio.h"          // for FILTERS_ARE_4BAYER
 #include "common/interpolation.h"    // for dt_interpolation_new, dt_interp...
+#include "common/simd.h"             // for DT_SIMD_SSE, DT_SIMD_NEON
 #include "develop/imageop.h"         // for dt_iop_roi_t
 
+// area filter along one axis of the 8-bit zooms: output pixel k averages the input pixels it covers, the ones
+// at its borders weighted by how much of them is inside. count[k] of the taps weights are used, from input
+// pixel first[k] on.
+static void _zoom_8_weights(const int32_t n, const int32_t len, const float scale, const int taps,
+                            int32_t *const first, int32_t *const count, float *const weight)
+{
+  for(int k = 0; k < n; k++)
+  {
+    const float x0 = k * scale, x1 = MIN((k + 1) * scale, (float)len);
+    const int32_t f = MIN((int32_t)x0, len - 1);
+    float *const w = weight + (size_t)taps * k;
+    float sum = 0.0f;
+    int t = 0;
+    for(; t < taps && f + t < len; t++)
+    {
+      w[t] = MAX(0.0f, MIN(f + t + 1.0f, x1) - MAX((float)(f + t), x0));
+      sum += w[t];
+    }
+    first[k] = f;
+    count[k] = MAX(t, 1);
+    // when upscaling the footprint can end up below one pixel, it then takes the pixel under it
+    if(sum > 0.0f)
+      for(int s = 0; s < t; s++) w[s] /= sum;
+    else
+      w[0] = 1.0f;
+  }
+}
+
+// adds wy times the horizontally filtered input row to acc. written for the compiler to vectorize over the
+// four channels of a pixel.
+DT_ALWAYS_INLINE void _zoom_8_row_plain(const uint8_t *const in, const int32_t *const first,
+                                        const int32_t *const count, const float *const weight, const int taps,
+                                        const float wy, const int32_t ow, float *const acc)
+{
+  for(int i = 0; i < ow; i++)
+  {
+    const uint8_t *const px = in + (size_t)4 * first[i];
+    const float *const w = weight + (size_t)taps * i;
+    float sum[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+    for(int t = 0; t < count[i]; t++)
+      for(int c = 0; c < 4; c++) sum[c] += w[t] * px[4 * t + c];
+    for(int c = 0; c < 4; c++) acc[4 * i + c] += wy * sum[c];
+  }
+}
+
+typedef void(zoom_8_row_func)(const uint8_t *const in, const int32_t *const first, const int32_t *const count,
+                              const float *const weight, const int taps, const float wy, const int32_t ow,
+                              float *const acc);
+
+#ifdef DT_TARGET_AVX2
+static DT_TARGET_AVX2 void _zoom_8_row_avx2(const uint8_t *const in, const int32_t *const first,
+                                            const int32_t *const count, const float *const weight,
+                                            const int taps, const float wy, const int32_t ow, float *const acc)
+{
+  _zoom_8_row_plain(in, first, count, weight, taps, wy, ow, acc);
+}
+
+static DT_TARGET_AVX512 void _zoom_8_row_avx512(const uint8_t *const in, const int32_t *const first,
+                                                const int32_t *const count, const float *const weight,
+                                                const int taps, const float wy, const int32_t ow,
+                                                float *const acc)
+{
+  _zoom_8_row_plain(in, first, count, weight, taps, wy, ow, acc);
+}
+#endif
+
+static void _zoom_8_row_plain_func(const uint8_t *const in, const int32_t *const first,
+                                   const int32_t *const count, const float *const weight, const int taps,
+                                   const float wy, const int32_t ow, float *const acc)
+{
+  _zoom_8_row_plain(in, first, count, weight, taps, wy, ow, acc);
+}
+
+static zoom_8_row_func *_zoom_8_row_function(void)
+{
+#ifdef DT_TARGET_AVX2
+  if(darktable.codepath.AVX512) return _zoom_8_row_avx512;
+  if(darktable.codepath.AVX2) return _zoom_8_row_avx2;
+#endif
+  return _zoom_8_row_plain_func;
+}
+
+// separable area filter from the iw x ih rgba pixels at in to the ow x oh ones at out, strides in pixels.
+// only the color channels of out are written.
+static void _zoom_8(const uint8_t *const in, const int32_t in_stride, const int32_t iw, const int32_t ih,
+                    const float scalex, const float scaley, uint8_t *const out, const int32_t out_stride,
+                    const int32_t ow, const int32_t oh)
+{
+  if(ow <= 0 || oh <= 0 || iw <= 0 || ih <= 0) return;
+  const int tx = (int)ceilf(scalex) + 1, ty = (int)ceilf(scaley) + 1;
+  int32_t *const xi = dt_alloc_align(64, sizeof(int32_t) * 2 * ow);
+  int32_t *const yi = dt_alloc_align(64, sizeof(int32_t) * 2 * oh);
+  float *const xw = dt_alloc_align(64, sizeof(float) * tx * ow);
+  float *const yw = dt_alloc_align(64, sizeof(float) * ty * oh);
+  float *const rows = dt_alloc_align(64, sizeof(float) * 4 * ow * dt_get_num_threads());
+  _zoom_8_weights(ow, iw, scalex, tx, xi, xi + ow, xw);
+  _zoom_8_weights(oh, ih, scaley, ty, yi, yi + oh, yw);
+  zoom_8_row_func *const zoom_row = _zoom_8_row_function();
+
+#ifdef _OPENMP
+#pragma omp parallel for default(none) schedule(static)
+#endif
+  for(int j = 0; j < oh; j++)
+  {
+    float *const acc = rows + (size_t)4 * ow * dt_get_thread_num();
+    memset(acc, 0, sizeof(float) * 4 * ow);
+    for(int t = 0; t < yi[oh + j]; t++)
+      zoom_row(in + (size_t)4 * in_stride * (yi[j] + t), xi, xi + ow, xw, tx, yw[(size_t)ty * j + t], ow, acc);
+    uint8_t *const o = out + (size_t)4 * out_stride * j;
+    for(int i = 0; i < ow; i++)
+      for(int c = 0; c < 3; c++) o[4 * i + c] = CLAMP((int)(acc[4 * i + c] + 0.5f), 0, 255);
+  }
+
+  dt_free_align(rows);
+  dt_free_align(yw);
+  dt_free_align(xw);
+  dt_free_align(yi);
+  dt_free_align(xi);
+}
+
 void dt_iop_flip_and_zoom_8(const uint8_t *in, int32_t iw, int32_t ih, uint8_t *out, int32_t ow, int32_t oh,
                             const dt_image_orientation_t orientation, uint32_t *width, uint32_t *height)
 {
@@ -45,16 +167,24 @@ void dt_iop_flip_and_zoom_8(const uint8_t *in, int32_t iw, int32_t ih, uint8_t *
   const uint32_t wd = *width = MIN(ow, iwd / scale);
   const uint32_t ht = *height = MIN(oh, iht / scale);
   const int bpp = 4; // bytes per pixel
+
+  // zoom first, in the orientation of the input, and flip the small result
+  const int32_t tw = (orientation & ORIENTATION_SWAP_XY) ? ht : wd;
+  const int32_t th = (orientation & ORIENTATION_SWAP_XY) ? wd : ht;
+  uint8_t *const tmp = dt_alloc_align(64, (size_t)bpp * tw * th);
+  if(!tmp) return;
+  _zoom_8(in, iw, iw, ih, scale, scale, tmp, tw, tw, th);
+
   int32_t ii = 0, jj = 0;
-  int32_t si = 1, sj = iw;
+  int32_t si = 1, sj = tw;
   if(orientation & ORIENTATION_FLIP_X)
   {
-    jj = ih - jj - 1;
+    jj = th - jj - 1;
     sj = -sj;
   }
   if(orientation & ORIENTATION_FLIP_Y)
   {
-    ii = iw - ii - 1;
+    ii = tw - ii - 1;
     si = -si;
   }
   if(orientation & ORIENTATION_SWAP_XY)
@@ -63,37 +193,21 @@ void dt_iop_flip_and_zoom_8(const uint8_t *in, int32_t iw, int32_t ih, uint8_t *
     sj = si;
     si = t;
   }
-  const int32_t half_pixel = .5f * scale;
-  const int32_t offm = half_pixel * bpp * MIN(MIN(0, si), MIN(sj, si + sj));
-  const int32_t offM = half_pixel * bpp * MAX(MAX(0, si), MAX(sj, si + sj));
 #ifdef _OPENMP
-#pragma omp parallel for schedule(static) default(none) shared(in, out, jj, ii, sj, si, iw, ih)
+#pragma omp parallel for schedule(static) default(none) shared(out, jj, ii, sj, si)
 #endif
   for(uint32_t j = 0; j < ht; j++)
   {
-    uint8_t *out2 = out + bpp * wd * j;
-    const uint8_t *in2 = in + bpp * (iw * jj + ii + sj * (int32_t)(scale * j));
-    float stepi = 0.0f;
+    uint8_t *out2 = out + (size_t)bpp * wd * j;
+    const uint8_t *in2 = tmp + bpp * (tw * jj + ii + sj * (int32_t)j);
     for(uint32_t i = 0; i < wd; i++)
     {
-      const uint8_t *in3 = in2 + ((int32_t)stepi) * si * bpp;
-      // this should always be within the bounds of in[], due to the way
-      // wd/ht are constructed by always just rounding down. half_pixel should never
-      // add up to one pixel difference.
-      // we have this check with the hope the branch predictor will get rid of it:
-      if(in3 + offm >= in && in3 + offM < in + bpp * iw * ih)
-      {
-        for(int k = 0; k < 3; k++)
-          out2[k] = // in3[k];
-              CLAMP(((int32_t)in3[bpp * half_pixel * sj + k] + (int32_t)in3[bpp * half_pixel * (si + sj) + k]
-                     + (int32_t)in3[bpp * half_pixel * si + k] + (int32_t)in3[k])
-                        / 4,
-                    0, 255);
-      }
+      for(int k = 0; k < 3; k++) out2[k] = in2[k];
       out2 += bpp;
-      stepi += scale;
+      in2 += bpp * si;
     }
   }
+  dt_free_align(tmp);
 }
 
 void dt_iop_clip_and_zoom_8(const uint8_t *i, int32_t ix, int32_t iy, int32_t iw, int32_t ih, int32_t ibw,
@@ -113,26 +227,8 @@ void dt_iop_clip_and_zoom_8(const uint8_t *i, int32_t ix, int32_t iy, int32_t iw
   assert(ox2 + ow2 <= obw);
   assert(oy2 + oh2 <= obh);
   assert(ix2 >= 0 && iy2 >= 0 && ox2 >= 0 && oy2 >= 0);
-  float x = ix2, y = iy2;
-  for(int s = 0; s < oh2; s++)
-  {
-    int idx = ox2 + obw * (oy2 + s);
-    for(int t = 0; t < ow2; t++)
-    {
-      for(int k = 0; k < 3; k++)
-        o[4 * idx + k] = // i[3*(ibw* (int)y +             (int)x             ) + k)];
-            CLAMP(((int32_t)i[(4 * (ibw * (int32_t)y + (int32_t)(x + .5f * scalex)) + k)]
-                   + (int32_t)i[(4 * (ibw * (int32_t)(y + .5f * scaley) + (int32_t)(x + .5f * scalex)) + k)]
-                   + (int32_t)i[(4 * (ibw * (int32_t)(y + .5f * scaley) + (int32_t)(x)) + k)]
-                   + (int32_t)i[(4 * (ibw * (int32_t)y + (int32_t)(x)) + k)])
-                      / 4,
-                  0, 255);
-      x += scalex;
-      idx++;
-    }
-    y += scaley;
-    x = ix2;
-  }
+  _zoom_8(i + (size_t)4 * (ibw * iy2 + ix2), ibw, ibw - ix2, ibh - iy2, scalex, scaley,
+          o + (size_t)4 * (obw * oy2 + ox2), obw, ow2, oh2);
 }
 
 // apply clip and zoom on parts of a supplied full image.
@@ -247,7 +343,7 @@ void dt_iop_clip_and_zoom_mosaic_half_size_plain(uint16_t *const out, const uint
   }
 }
 
-#if defined(__SSE__)
+#if defined(DT_SIMD_SSE)
 void dt_iop_clip_and_zoom_mosaic_half_size_sse2(uint16_t *const out, const uint16_t *const in,
                                                 const dt_iop_roi_t *const roi_out,
                                                 const dt_iop_roi_t *const roi_in, const int32_t out_stride,
@@ -449,8 +545,8 @@ void dt_iop_clip_and_zoom_mosaic_half_size(uint16_t *const out, const uint16_t *
 {
   if(1)//(darktable.codepath.OPENMP_SIMD)
     return dt_iop_clip_and_zoom_mosaic_half_size_plain(out, in, roi_out, roi_in, out_stride, in_stride, filters);
-#if defined(__SSE__)
-  else if(darktable.codepath.SSE2)
+#if defined(DT_SIMD_SSE)
+  else if(darktable.codepath.SSE2 || darktable.codepath.NEON)
     return dt_iop_clip_and_zoom_mosaic_half_size_sse2(out, in, roi_out, roi_in, out_stride, in_stride, filters);
 #endif
   else
@@ -1500,7 +1596,7 @@ void dt_iop_clip_and_zoom_demosaic_half_size_f_plain(float *out, const float *co
   }
 }
 
-#if defined(__SSE__)
+#if defined(DT_SIMD_SSE)
 void dt_iop_clip_and_zoom_demosaic_half_size_f_sse2(float *out, const float *const in,
                                                     const dt_iop_roi_t *const roi_out,
                                                     const dt_iop_roi_t *const roi_in, const int32_t out_stride,
@@ -1683,10 +1779,15 @@ void dt_iop_clip_and_zoom_demosaic_half_size_f(float *out, const float *const in
                                                const int32_t out_stride, const int32_t in_stride,
                                                const uint32_t filters)
 {
+#if defined(DT_SIMD_NEON)
+  // checked before OPENMP_SIMD, which is always on for arm, see dt_codepaths_init()
+  if(darktable.codepath.NEON)
+    return dt_iop_clip_and_zoom_demosaic_half_size_f_sse2(out, in, roi_out, roi_in, out_stride, in_stride, filters);
+#endif
   if(darktable.codepath.OPENMP_SIMD)
     return dt_iop_clip_and_zoom_demosaic_half_size_f_plain(out, in, roi_out, roi_in, out_stride, in_stride,
                                                            filters);
-#if defined(__SSE__)
+#if defined(DT_SIMD_SSE)
   else if(darktable.codepath.SSE2)
     return dt_iop_clip_and_zoom_demosaic_half_size_f_sse2(out, in, roi_out, roi_in, out_stride, in_stride, filters);
 #endif
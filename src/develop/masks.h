@@ -18,6 +18,7 @@
 
 #pragma once
 
+#include "common/dtpthread.h"
 #include "common/opencl.h"
 #include "develop/pixelpipe.h"
 #include "dtgtk/button.h"
@@ -224,6 +225,21 @@ typedef struct dt_masks_form_gui_t
   uint64_t pipe_hash;
 } dt_masks_form_gui_t;
 
+/** rasterized forms, keyed by their geometry, the distortions before the module and the region. shared by all
+ * pipes and module instances of a develop and kept up to a budget of bytes, least recently used first out. */
+typedef struct dt_masks_cache_t
+{
+  dt_pthread_mutex_t lock;
+  GHashTable *entries; // by their hash
+  GQueue lru;          // least recently used first
+  size_t cost;         // bytes of all masks
+  size_t cost_quota;
+} dt_masks_cache_t;
+
+/** returns 0 on failure */
+int dt_masks_cache_init(dt_masks_cache_t *cache, const size_t cost_quota);
+void dt_masks_cache_cleanup(dt_masks_cache_t *cache);
+
 /** get points in real space with respect of distortion dx and dy are used to eventually move the center of
  * the circle */
 int dt_masks_get_points_border(dt_develop_t *dev, dt_masks_form_t *form, float **points, int *points_count,
@@ -2515,9 +2515,13 @@ static int dt_brush_get_area(dt_iop_module_t *module, dt_dev_pixelpipe_iop_t *pi
   return 1;
 }
 
-/** we write a falloff segment */
-static void _brush_falloff(float **buffer, int *p0, int *p1, int posx, int posy, int bw, float hardness,
-                           float density)
+// the falloff segments are drawn in parallel, by bands of this many rows of the mask. every band draws the
+// parts of the segments crossing it, so the result is the same as drawing them one after the other.
+#define DT_BRUSH_BAND_HEIGHT 32
+
+/** we write the part of a falloff segment in the rows [y0, y1) */
+static void _brush_falloff(float *buffer, int *p0, int *p1, int bw, float hardness, float density, const int y0,
+                           const int y1)
 {
   // segment length
   const int l = sqrt((p1[0] - p0[0]) * (p1[0] - p0[0]) + (p1[1] - p0[1]) * (p1[1] - p0[1])) + 1;
@@ -2530,19 +2534,91 @@ static void _brush_falloff(float **buffer, int *p0, int *p1, int posx, int posy,
   for(int i = 0; i < l; i++)
   {
     // position
-    const int x = (int)((float)i * lx / (float)l) + p0[0] - posx;
-    const int y = (int)((float)i * ly / (float)l) + p0[1] - posy;
+    const int x = (int)((float)i * lx / (float)l) + p0[0];
+    const int y = (int)((float)i * ly / (float)l) + p0[1];
+    if(y < y0 || y > y1) continue;
     const float op = density * ((i <= solid) ? 1.0f : 1.0 - (float)(i - solid) / (float)soft);
-    (*buffer)[y * bw + x] = fmaxf((*buffer)[y * bw + x], op);
-    if(x > 0)
-      (*buffer)[y * bw + x - 1]
-          = fmaxf((*buffer)[y * bw + x - 1], op); // this one is to avoid gap due to int rounding
-    if(y > 0)
-      (*buffer)[(y - 1) * bw + x]
-          = fmaxf((*buffer)[(y - 1) * bw + x], op); // this one is to avoid gap due to int rounding
+    if(y < y1)
+    {
+      buffer[y * bw + x] = fmaxf(buffer[y * bw + x], op);
+      if(x > 0)
+        buffer[y * bw + x - 1] = fmaxf(buffer[y * bw + x - 1], op); // this one is to avoid gap due to int rounding
+    }
+    if(y > y0)
+      buffer[(y - 1) * bw + x]
+          = fmaxf(buffer[(y - 1) * bw + x], op); // this one is to avoid gap due to int rounding
   }
 }
 
+/** bands of the rows [0, height) a falloff segment and the pixels next to it touch, 0 if none */
+static inline int _brush_segment_bands(const int *p0, const int *p1, const int height, int *b0, int *b1)
+{
+  const int ymin = MAX(MIN(p0[1], p1[1]) - 1, 0);
+  const int ymax = MIN(MAX(p0[1], p1[1]) + 1, height - 1);
+  if(ymin > ymax) return 0;
+  *b0 = ymin / DT_BRUSH_BAND_HEIGHT;
+  *b1 = ymax / DT_BRUSH_BAND_HEIGHT;
+  return 1;
+}
+
+static inline void _brush_segment(const float *points, const float *border, const int i, const int posx,
+                                  const int posy, int *p0, int *p1)
+{
+  p0[0] = (int)points[i * 2] - posx;
+  p0[1] = (int)points[i * 2 + 1] - posy;
+  p1[0] = (int)border[i * 2] - posx;
+  p1[1] = (int)border[i * 2 + 1] - posy;
+}
+
+/**
+ * bins the falloff segments [start, count) by the bands of the rows [0, height) of the mask they touch,
+ * relative to posx, posy. band b draws the segments (*index)[(*first)[b]] to (*index)[(*first)[b + 1] - 1].
+ * returns 0 if out of memory.
+ */
+static int _brush_bin_segments(const float *points, const float *border, const int start, const int count,
+                               const int posx, const int posy, const int height, int **first, int **index)
+{
+  const int nbands = (height + DT_BRUSH_BAND_HEIGHT - 1) / DT_BRUSH_BAND_HEIGHT;
+  int *f = calloc(nbands + 1, sizeof(int));
+  int *cursor = malloc(sizeof(int) * (nbands + 1));
+  if(!f || !cursor)
+  {
+    free(f);
+    free(cursor);
+    return 0;
+  }
+
+  int p0[2], p1[2], b0, b1;
+  for(int i = start; i < count; i++)
+  {
+    _brush_segment(points, border, i, posx, posy, p0, p1);
+    if(!_brush_segment_bands(p0, p1, height, &b0, &b1)) continue;
+    for(int b = b0; b <= b1; b++) f[b + 1]++;
+  }
+  for(int b = 0; b < nbands; b++) f[b + 1] += f[b];
+
+  int *idx = malloc(sizeof(int) * MAX(f[nbands], 1));
+  if(!idx)
+  {
+    free(f);
+    free(cursor);
+    return 0;
+  }
+  memcpy(cursor, f, sizeof(int) * (nbands + 1));
+  // in the order of the segments, so that every band draws them as the single threaded loop did
+  for(int i = start; i < count; i++)
+  {
+    _brush_segment(points, border, i, posx, posy, p0, p1);
+    if(!_brush_segment_bands(p0, p1, height, &b0, &b1)) continue;
+    for(int b = b0; b <= b1; b++) idx[cursor[b]++] = i;
+  }
+
+  free(cursor);
+  *first = f;
+  *index = idx;
+  return 1;
+}
+
 static int dt_brush_get_mask(dt_iop_module_t *module, dt_dev_pixelpipe_iop_t *piece, dt_masks_form_t *form,
                              float **buffer, int *width, int *height, int *posx, int *posy)
 {
@@ -2605,19 +2681,43 @@ static int dt_brush_get_mask(dt_iop_module_t *module, dt_dev_pixelpipe_iop_t *pi
   // we allocate the buffer
   *buffer = calloc((size_t)(*width) * (*height), sizeof(float));
 
-  // now we fill the falloff
-  int p0[2], p1[2];
-
-  for(int i = nb_corner * 3; i < border_count; i++)
+  int *first = NULL, *index = NULL;
+  if(!*buffer
+     || !_brush_bin_segments(points, border, nb_corner * 3, border_count, *posx, *posy, *height, &first, &index))
   {
-    p0[0] = points[i * 2];
-    p0[1] = points[i * 2 + 1];
-    p1[0] = border[i * 2];
-    p1[1] = border[i * 2 + 1];
+    free(*buffer);
+    *buffer = NULL;
+    free(points);
+    free(border);
+    free(payload);
+    return 0;
+  }
 
-    _brush_falloff(buffer, p0, p1, *posx, *posy, *width, payload[i * 2], payload[i * 2 + 1]);
+  // now we fill the falloff
+  float *const buf = *buffer;
+  const int bw = *width, bh = *height, bx = *posx, by = *posy;
+  const int nbands = (bh + DT_BRUSH_BAND_HEIGHT - 1) / DT_BRUSH_BAND_HEIGHT;
+#ifdef _OPENMP
+#if !defined(__SUNOS__) && !defined(__NetBSD__)
+#pragma omp parallel for default(none) shared(points, border, payload, first, index) schedule(dynamic)
+#else
+#pragma omp parallel for shared(points, border, payload, first, index) schedule(dynamic)
+#endif
+#endif
+  for(int b = 0; b < nbands; b++)
+  {
+    const int y0 = b * DT_BRUSH_BAND_HEIGHT, y1 = MIN(bh, y0 + DT_BRUSH_BAND_HEIGHT);
+    int p0[2], p1[2];
+    for(int k = first[b]; k < first[b + 1]; k++)
+    {
+      const int i = index[k];
+      _brush_segment(points, border, i, bx, by, p0, p1);
+      _brush_falloff(buf, p0, p1, bw, payload[i * 2], payload[i * 2 + 1], y0, y1);
+    }
   }
 
+  free(first);
+  free(index);
   free(points);
   free(border);
   free(payload);
@@ -2629,9 +2729,9 @@ static int dt_brush_get_mask(dt_iop_module_t *module, dt_dev_pixelpipe_iop_t *pi
   return 1;
 }
 
-/** we write a falloff segment respecting limits of buffer */
+/** we write the part of a falloff segment in the rows [y0, y1), respecting limits of buffer */
 static inline void _brush_falloff_roi(float *buffer, int *p0, int *p1, int bw, int bh, float hardness,
-                                      float density)
+                                      float density, const int y0, const int y1)
 {
   // segment length (increase by 1 to avoid division-by-zero special case handling)
   const int l = sqrt((p1[0] - p0[0]) * (p1[0] - p0[0]) + (p1[1] - p0[1]) * (p1[1] - p0[1])) + 1;
@@ -2664,10 +2764,13 @@ static inline void _brush_falloff_roi(float *buffer, int *p0, int *p1, int bw, i
 
     float *buf = buffer + (size_t)y * bw + x;
 
-    *buf = fmaxf(*buf, op);
-    if(x + dx >= 0 && x + dx < bw)
-      buf[dpx] = fmaxf(buf[dpx], op); // this one is to avoid gaps due to int rounding
-    if(y + dy >= 0 && y + dy < bh)
+    if(y >= y0 && y < y1)
+    {
+      *buf = fmaxf(*buf, op);
+      if(x + dx >= 0 && x + dx < bw)
+        buf[dpx] = fmaxf(buf[dpx], op); // this one is to avoid gaps due to int rounding
+    }
+    if(y + dy >= y0 && y + dy < y1)
       buf[dpy] = fmaxf(buf[dpy], op); // this one is to avoid gaps due to int rounding
   }
 }
@@ -2764,22 +2867,39 @@ static int dt_brush_get_mask_roi(dt_iop_module_t *module, dt_dev_pixelpipe_iop_t
     return 1;
   }
 
-  // now we fill the falloff
-  int p0[2], p1[2];
-  for(int i = nb_corner * 3; i < border_count; i++)
+  // now we fill the falloff. the segments outside of roi are not binned.
+  int *first = NULL, *index = NULL;
+  if(!_brush_bin_segments(points, border, nb_corner * 3, border_count, 0, 0, height, &first, &index))
   {
-    p0[0] = points[i * 2];
-    p0[1] = points[i * 2 + 1];
-    p1[0] = border[i * 2];
-    p1[1] = border[i * 2 + 1];
-
-    if(MAX(p0[0], p1[0]) < 0 || MIN(p0[0], p1[0]) >= width || MAX(p0[1], p1[1]) < 0
-       || MIN(p0[1], p1[1]) >= height)
-      continue;
+    free(points);
+    free(border);
+    free(payload);
+    return 0;
+  }
 
-    _brush_falloff_roi(buffer, p0, p1, width, height, payload[i * 2], payload[i * 2 + 1]);
+  const int nbands = (height + DT_BRUSH_BAND_HEIGHT - 1) / DT_BRUSH_BAND_HEIGHT;
+#ifdef _OPENMP
+#if !defined(__SUNOS__) && !defined(__NetBSD__)
+#pragma omp parallel for default(none) shared(buffer, points, border, payload, first, index) schedule(dynamic)
+#else
+#pragma omp parallel for shared(buffer, points, border, payload, first, index) schedule(dynamic)
+#endif
+#endif
+  for(int b = 0; b < nbands; b++)
+  {
+    const int y0 = b * DT_BRUSH_BAND_HEIGHT, y1 = MIN(height, y0 + DT_BRUSH_BAND_HEIGHT);
+    int p0[2], p1[2];
+    for(int k = first[b]; k < first[b + 1]; k++)
+    {
+      const int i = index[k];
+      _brush_segment(points, border, i, 0, 0, p0, p1);
+      if(MAX(p0[0], p1[0]) < 0 || MIN(p0[0], p1[0]) >= width) continue;
+      _brush_falloff_roi(buffer, p0, p1, width, height, payload[i * 2], payload[i * 2 + 1], y0, y1);
+    }
   }
 
+  free(first);
+  free(index);
   free(points);
   free(border);
   free(payload);
@@ -2791,6 +2911,8 @@ static int dt_brush_get_mask_roi(dt_iop_module_t *module, dt_dev_pixelpipe_iop_t
   return 1;
 }
 
+#undef DT_BRUSH_BAND_HEIGHT
+
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
 // kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
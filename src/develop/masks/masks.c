@@ -38,16 +38,31 @@
 
 typedef struct _masks_undo_data_t
 {
-  GList *forms;
+  GList *forms; // blobs of _masks_form_serialize(), shared with the snapshots before while the form is the same
   dt_masks_form_t *form;
 } _masks_undo_data_t;
 
+// the blobs of the last snapshot by formid, the next one shares the forms that did not change since
+static GHashTable *_undo_last_forms = NULL;
+
 static void _masks_write_form_db(dt_masks_form_t *form, dt_develop_t *dev);
 // write a form into the database
 
 static void _masks_write_forms_db(dt_develop_t *dev, gboolean undo);
 // write all masks form into the database. record an undo if undo is true
 
+// size of the point structures of forms of type
+static size_t _masks_point_size(const dt_masks_type_t type)
+{
+  if(type & DT_MASKS_CIRCLE) return sizeof(struct dt_masks_point_circle_t);
+  if(type & DT_MASKS_ELLIPSE) return sizeof(struct dt_masks_point_ellipse_t);
+  if(type & DT_MASKS_GRADIENT) return sizeof(struct dt_masks_point_gradient_t);
+  if(type & DT_MASKS_BRUSH) return sizeof(struct dt_masks_point_brush_t);
+  if(type & DT_MASKS_GROUP) return sizeof(struct dt_masks_point_group_t);
+  if(type & DT_MASKS_PATH) return sizeof(struct dt_masks_point_path_t);
+  return 0;
+}
+
 static dt_masks_form_t *_dup_masks_form(const dt_masks_form_t *form)
 {
   if (!form) return NULL;
@@ -59,70 +74,84 @@ static dt_masks_form_t *_dup_masks_form(const dt_masks_form_t *form)
 
   new_form->points = NULL;
 
-  if (form->points)
+  const size_t size_item = _masks_point_size(form->type);
+  if (size_item != 0)
   {
-    int size_item;
-
-    switch (form->type)
-    {
-    case DT_MASKS_CIRCLE:
-      size_item = sizeof(struct dt_masks_point_circle_t);
-      break;
-    case DT_MASKS_ELLIPSE:
-      size_item = sizeof(struct dt_masks_point_ellipse_t);
-      break;
-    case DT_MASKS_GRADIENT:
-      size_item = sizeof(struct dt_masks_point_gradient_t);
-      break;
-    case DT_MASKS_BRUSH:
-      size_item = sizeof(struct dt_masks_point_brush_t);
-      break;
-    case DT_MASKS_GROUP:
-      size_item = sizeof(struct dt_masks_point_group_t);
-      break;
-    case DT_MASKS_PATH:
-      size_item = sizeof(struct dt_masks_point_path_t);
-      break;
-    default:
-      size_item = 0;
-    }
-
-    if (size_item != 0)
+    GList *pt = g_list_first(form->points);
+    while (pt)
     {
-      GList *pt = g_list_first(form->points);
-      while (pt)
-      {
-        void *item = malloc(size_item);
-        memcpy(item, pt->data, size_item);
-        new_form->points = g_list_append(new_form->points, item);
-        pt = g_list_next(pt);
-      }
+      void *item = malloc(size_item);
+      memcpy(item, pt->data, size_item);
+      new_form->points = g_list_append(new_form->points, item);
+      pt = g_list_next(pt);
     }
   }
 
   return new_form;
 }
 
-static void *_dup_masks_form_cb(const void *formdata, gpointer user_data)
+// the form followed by its points in one undo blob
+static void *_masks_form_serialize(const dt_masks_form_t *form)
 {
-  // duplicate the main form struct
-  dt_masks_form_t *form = (dt_masks_form_t *)formdata;
-  dt_masks_form_t *uform = (dt_masks_form_t *)user_data;
-  const dt_masks_form_t *f = uform == NULL || form->formid != uform->formid ? form : uform;
-  return (void *)_dup_masks_form(f);
+  const size_t size_item = _masks_point_size(form->type);
+  const size_t count = size_item ? g_list_length(form->points) : 0;
+  uint8_t *blob = dt_undo_blob_new(sizeof(struct dt_masks_form_t) + count * size_item);
+  if(!blob) return NULL;
+
+  memcpy(blob, form, sizeof(struct dt_masks_form_t));
+  ((dt_masks_form_t *)blob)->points = NULL;
+  uint8_t *pos = blob + sizeof(struct dt_masks_form_t);
+  for(GList *pt = g_list_first(form->points); pt && size_item; pt = g_list_next(pt))
+  {
+    memcpy(pos, pt->data, size_item);
+    pos += size_item;
+  }
+  return blob;
 }
 
-// duplicate the list of forms, replace item in the list with form is the same formid
-static GList *_dup_masks_forms_deep(GList *forms, dt_masks_form_t *form)
+static dt_masks_form_t *_masks_form_deserialize(const void *blob)
 {
-  return (GList *)g_list_copy_deep(forms, _dup_masks_form_cb, (gpointer)form);
+  dt_masks_form_t *form = malloc(sizeof(struct dt_masks_form_t));
+  memcpy(form, blob, sizeof(struct dt_masks_form_t));
+
+  const size_t size_item = _masks_point_size(form->type);
+  const size_t count = size_item ? (dt_undo_blob_size(blob) - sizeof(struct dt_masks_form_t)) / size_item : 0;
+  const uint8_t *pos = (const uint8_t *)blob + sizeof(struct dt_masks_form_t);
+  for(size_t k = 0; k < count; k++, pos += size_item)
+  {
+    void *item = malloc(size_item);
+    memcpy(item, pos, size_item);
+    form->points = g_list_prepend(form->points, item);
+  }
+  form->points = g_list_reverse(form->points);
+  return form;
 }
 
+// snapshot of the list of forms, with form in place of the one with its formid. only the forms changed since the
+// last snapshot take new memory.
 static _masks_undo_data_t *_create_snapshot(GList *forms, dt_masks_form_t *form, dt_develop_t *dev)
 {
   _masks_undo_data_t *data = malloc(sizeof(struct _masks_undo_data_t));
-  data->forms = _dup_masks_forms_deep(forms, form);
+  data->forms = NULL;
   data->form  = dev->form_visible ? _dup_masks_form(dev->form_visible) : NULL;
+
+  GHashTable *last = g_hash_table_new_full(NULL, NULL, NULL, dt_undo_blob_unref);
+  for(GList *l = g_list_first(forms); l; l = g_list_next(l))
+  {
+    const dt_masks_form_t *f = (dt_masks_form_t *)l->data;
+    if(form && f->formid == form->formid) f = form;
+
+    void *blob = _masks_form_serialize(f);
+    if(!blob) continue;
+    if(_undo_last_forms)
+      blob = dt_undo_blob_share(blob, g_hash_table_lookup(_undo_last_forms, GINT_TO_POINTER(f->formid)));
+    data->forms = g_list_prepend(data->forms, blob);
+    g_hash_table_insert(last, GINT_TO_POINTER(f->formid), dt_undo_blob_ref(blob));
+  }
+  data->forms = g_list_reverse(data->forms);
+
+  if(_undo_last_forms) g_hash_table_destroy(_undo_last_forms);
+  _undo_last_forms = last;
   return data;
 }
 
@@ -130,7 +159,7 @@ void _masks_free_undo(gpointer data)
 {
   _masks_undo_data_t *udata = (_masks_undo_data_t *)data;
 
-  g_list_free_full(udata->forms, (void (*)(void *))dt_masks_free_form);
+  g_list_free_full(udata->forms, dt_undo_blob_unref);
   udata->forms = NULL;
   dt_masks_free_form((dt_masks_form_t *)udata->form);
   free(udata);
@@ -141,7 +170,10 @@ void _masks_do_undo(gpointer user_data, dt_undo_type_t type, dt_undo_data_t *ite
   dt_develop_t *dev = (dt_develop_t *)user_data;
   _masks_undo_data_t *udata = (_masks_undo_data_t *)item;
 
-  dev->forms = _dup_masks_forms_deep(udata->forms, NULL);
+  dev->forms = NULL;
+  for(GList *l = g_list_first(udata->forms); l; l = g_list_next(l))
+    dev->forms = g_list_prepend(dev->forms, _masks_form_deserialize(l->data));
+  dev->forms = g_list_reverse(dev->forms);
   dev->form_gui->creation = FALSE;
 
   dt_masks_clear_form_gui(dev);
@@ -593,8 +625,8 @@ int dt_masks_get_source_area(dt_iop_module_t *module, dt_dev_pixelpipe_iop_t *pi
   return 0;
 }
 
-int dt_masks_get_mask(dt_iop_module_t *module, dt_dev_pixelpipe_iop_t *piece, dt_masks_form_t *form,
-                      float **buffer, int *width, int *height, int *posx, int *posy)
+static int _get_mask(dt_iop_module_t *module, dt_dev_pixelpipe_iop_t *piece, dt_masks_form_t *form,
+                     float **buffer, int *width, int *height, int *posx, int *posy)
 {
   if(form->type & DT_MASKS_CIRCLE)
   {
@@ -623,8 +655,8 @@ int dt_masks_get_mask(dt_iop_module_t *module, dt_dev_pixelpipe_iop_t *piece, dt
   return 0;
 }
 
-int dt_masks_get_mask_roi(dt_iop_module_t *module, dt_dev_pixelpipe_iop_t *piece, dt_masks_form_t *form,
-                          const dt_iop_roi_t *roi, float *buffer)
+static int _get_mask_roi(dt_iop_module_t *module, dt_dev_pixelpipe_iop_t *piece, dt_masks_form_t *form,
+                         const dt_iop_roi_t *roi, float *buffer)
 {
   if(form->type & DT_MASKS_CIRCLE)
   {
@@ -653,6 +685,202 @@ int dt_masks_get_mask_roi(dt_iop_module_t *module, dt_dev_pixelpipe_iop_t *piece
   return 0;
 }
 
+typedef struct dt_masks_cache_entry_t
+{
+  uint64_t hash;
+  int width, height, posx, posy;
+  float *mask;
+  size_t cost;
+  GList *link; // in the lru queue
+} dt_masks_cache_entry_t;
+
+static void _cache_entry_free(gpointer data)
+{
+  dt_masks_cache_entry_t *entry = (dt_masks_cache_entry_t *)data;
+  dt_free_align(entry->mask);
+  free(entry);
+}
+
+int dt_masks_cache_init(dt_masks_cache_t *cache, const size_t cost_quota)
+{
+  cache->entries = g_hash_table_new_full(g_int64_hash, g_int64_equal, NULL, _cache_entry_free);
+  if(!cache->entries) return 0;
+  dt_pthread_mutex_init(&cache->lock, NULL);
+  g_queue_init(&cache->lru);
+  cache->cost = 0;
+  cache->cost_quota = cost_quota;
+  return 1;
+}
+
+void dt_masks_cache_cleanup(dt_masks_cache_t *cache)
+{
+  g_queue_clear(&cache->lru);
+  g_hash_table_destroy(cache->entries);
+  dt_pthread_mutex_destroy(&cache->lock);
+}
+
+static inline uint64_t _cache_hash_bytes(uint64_t hash, const void *data, const size_t size)
+{
+  const char *str = (const char *)data;
+  for(size_t i = 0; i < size; i++) hash = ((hash << 5) + hash) ^ str[i];
+  return hash;
+}
+
+// size of the points of the forms that are rasterized themselves, 0 for groups
+static size_t _cache_point_size(const dt_masks_type_t type)
+{
+  if(type & DT_MASKS_CIRCLE) return sizeof(dt_masks_point_circle_t);
+  if(type & DT_MASKS_PATH) return sizeof(dt_masks_point_path_t);
+  if(type & DT_MASKS_GROUP) return 0;
+  if(type & DT_MASKS_GRADIENT) return sizeof(dt_masks_point_gradient_t);
+  if(type & DT_MASKS_ELLIPSE) return sizeof(dt_masks_point_ellipse_t);
+  if(type & DT_MASKS_BRUSH) return sizeof(dt_masks_point_brush_t);
+  return 0;
+}
+
+// everything the rasterization of form depends on: its geometry, the input of the pipe, the modules
+// distorting the form on its way to module and the region, NULL for the area of dt_masks_get_mask().
+// the opacity of the form is applied by its group afterwards.
+static uint64_t _cache_hash(dt_iop_module_t *module, dt_dev_pixelpipe_iop_t *piece, dt_masks_form_t *form,
+                            const dt_iop_roi_t *roi)
+{
+  const dt_dev_pixelpipe_t *pipe = piece->pipe;
+  const dt_develop_t *dev = module->dev;
+  uint64_t hash = 5381;
+  const int input[5] = { pipe->image.id, pipe->iwidth, pipe->iheight, pipe->type == DT_DEV_PIXELPIPE_PREVIEW,
+                         roi != NULL };
+  hash = _cache_hash_bytes(hash, input, sizeof(input));
+  hash = _cache_hash_bytes(hash, &pipe->iscale, sizeof(pipe->iscale));
+  if(roi) hash = _cache_hash_bytes(hash, roi, sizeof(dt_iop_roi_t));
+
+  for(const GList *nodes = pipe->nodes; nodes; nodes = g_list_next(nodes))
+  {
+    const dt_dev_pixelpipe_iop_t *p = (const dt_dev_pixelpipe_iop_t *)nodes->data;
+    const dt_iop_module_t *m = p->module;
+    if(m->priority > module->priority) break;
+    if(!p->enabled || !(m->operation_tags() & IOP_TAG_DISTORT)
+       || (dev->gui_module && dev->gui_module->operation_tags_filter() & m->operation_tags()))
+      continue;
+    // some distortions change while their module has the focus
+    const int state[4] = { m->priority, m == dev->gui_module, p->buf_in.width, p->buf_in.height };
+    hash = _cache_hash_bytes(hash, state, sizeof(state));
+    hash = _cache_hash_bytes(hash, &p->hash, sizeof(p->hash));
+  }
+
+  const int type[2] = { form->type, form->version };
+  hash = _cache_hash_bytes(hash, type, sizeof(type));
+  hash = _cache_hash_bytes(hash, form->source, sizeof(form->source));
+  const size_t point_size = _cache_point_size(form->type);
+  for(const GList *points = form->points; points; points = g_list_next(points))
+    hash = _cache_hash_bytes(hash, points->data, point_size);
+  return hash;
+}
+
+// looks up the mask of hash and marks it used. cache->lock has to be held.
+static dt_masks_cache_entry_t *_cache_find(dt_masks_cache_t *cache, const uint64_t hash)
+{
+  dt_masks_cache_entry_t *entry = (dt_masks_cache_entry_t *)g_hash_table_lookup(cache->entries, &hash);
+  if(entry)
+  {
+    g_queue_unlink(&cache->lru, entry->link);
+    g_queue_push_tail_link(&cache->lru, entry->link);
+  }
+  return entry;
+}
+
+// keeps a copy of mask, evicting the least recently used ones until it fits
+static void _cache_insert(dt_masks_cache_t *cache, const uint64_t hash, const float *mask, const int width,
+                          const int height, const int posx, const int posy)
+{
+  const size_t cost = sizeof(float) * width * height;
+  // one this large would push out everything else
+  if(cost == 0 || cost > cache->cost_quota / 2) return;
+  dt_masks_cache_entry_t *entry = (dt_masks_cache_entry_t *)malloc(sizeof(dt_masks_cache_entry_t));
+  float *copy = dt_alloc_align(64, cost);
+  if(!entry || !copy)
+  {
+    free(entry);
+    dt_free_align(copy);
+    return;
+  }
+  memcpy(copy, mask, cost);
+  *entry = (dt_masks_cache_entry_t){ hash, width, height, posx, posy, copy, cost, NULL };
+
+  dt_pthread_mutex_lock(&cache->lock);
+  // another pipe might have rasterized it at the same time
+  if(g_hash_table_contains(cache->entries, &hash))
+  {
+    dt_pthread_mutex_unlock(&cache->lock);
+    _cache_entry_free(entry);
+    return;
+  }
+  while(cache->cost + cost > cache->cost_quota && !g_queue_is_empty(&cache->lru))
+  {
+    dt_masks_cache_entry_t *old = (dt_masks_cache_entry_t *)g_queue_pop_head(&cache->lru);
+    cache->cost -= old->cost;
+    g_hash_table_remove(cache->entries, &old->hash);
+  }
+  g_queue_push_tail(&cache->lru, entry);
+  entry->link = g_queue_peek_tail_link(&cache->lru);
+  g_hash_table_insert(cache->entries, &entry->hash, entry);
+  cache->cost += cost;
+  dt_pthread_mutex_unlock(&cache->lock);
+}
+
+int dt_masks_get_mask(dt_iop_module_t *module, dt_dev_pixelpipe_iop_t *piece, dt_masks_form_t *form,
+                      float **buffer, int *width, int *height, int *posx, int *posy)
+{
+  dt_masks_cache_t *cache = module->dev->masks_cache;
+  if(!cache || !_cache_point_size(form->type))
+    return _get_mask(module, piece, form, buffer, width, height, posx, posy);
+
+  const uint64_t hash = _cache_hash(module, piece, form, NULL);
+  dt_pthread_mutex_lock(&cache->lock);
+  const dt_masks_cache_entry_t *entry = _cache_find(cache, hash);
+  if(entry)
+  {
+    // the callers free the buffer
+    *buffer = malloc(entry->cost);
+    if(*buffer)
+    {
+      memcpy(*buffer, entry->mask, entry->cost);
+      *width = entry->width;
+      *height = entry->height;
+      *posx = entry->posx;
+      *posy = entry->posy;
+      dt_pthread_mutex_unlock(&cache->lock);
+      return 1;
+    }
+  }
+  dt_pthread_mutex_unlock(&cache->lock);
+
+  const int ok = _get_mask(module, piece, form, buffer, width, height, posx, posy);
+  if(ok) _cache_insert(cache, hash, *buffer, *width, *height, *posx, *posy);
+  return ok;
+}
+
+int dt_masks_get_mask_roi(dt_iop_module_t *module, dt_dev_pixelpipe_iop_t *piece, dt_masks_form_t *form,
+                          const dt_iop_roi_t *roi, float *buffer)
+{
+  dt_masks_cache_t *cache = module->dev->masks_cache;
+  if(!cache || !_cache_point_size(form->type)) return _get_mask_roi(module, piece, form, roi, buffer);
+
+  const uint64_t hash = _cache_hash(module, piece, form, roi);
+  dt_pthread_mutex_lock(&cache->lock);
+  const dt_masks_cache_entry_t *entry = _cache_find(cache, hash);
+  if(entry)
+  {
+    memcpy(buffer, entry->mask, entry->cost);
+    dt_pthread_mutex_unlock(&cache->lock);
+    return 1;
+  }
+  dt_pthread_mutex_unlock(&cache->lock);
+
+  const int ok = _get_mask_roi(module, piece, form, roi, buffer);
+  if(ok) _cache_insert(cache, hash, buffer, roi->width, roi->height, 0, 0);
+  return ok;
+}
+
 int dt_masks_version(void)
 {
   return DEVELOP_MASKS_VERSION;
@@ -1013,7 +1241,7 @@ void dt_masks_read_forms(dt_develop_t *dev)
     {
       dt_masks_point_circle_t *circle = (dt_masks_point_circle_t *)malloc(sizeof(dt_masks_point_circle_t));
       memcpy(circle, sqlite3_column_blob(stmt, 5), sizeof(dt_masks_point_circle_t));
-      form->points = g_list_append(form->points, circle);
+      form->points = g_list_prepend(form->points, circle);
     }
     else if(form->type & DT_MASKS_PATH)
     {
@@ -1022,7 +1250,7 @@ void dt_masks_read_forms(dt_develop_t *dev)
       {
         dt_masks_point_path_t *point = (dt_masks_point_path_t *)malloc(sizeof(dt_masks_point_path_t));
         memcpy(point, ptbuf + i, sizeof(dt_masks_point_path_t));
-        form->points = g_list_append(form->points, point);
+        form->points = g_list_prepend(form->points, point);
       }
     }
     else if(form->type & DT_MASKS_GROUP)
@@ -1032,7 +1260,7 @@ void dt_masks_read_forms(dt_develop_t *dev)
       {
         dt_masks_point_group_t *point = (dt_masks_point_group_t *)malloc(sizeof(dt_masks_point_group_t));
         memcpy(point, ptbuf + i, sizeof(dt_masks_point_group_t));
-        form->points = g_list_append(form->points, point);
+        form->points = g_list_prepend(form->points, point);
       }
     }
     else if(form->type & DT_MASKS_GRADIENT)
@@ -1040,14 +1268,14 @@ void dt_masks_read_forms(dt_develop_t *dev)
       dt_masks_point_gradient_t *gradient
           = (dt_masks_point_gradient_t *)malloc(sizeof(dt_masks_point_gradient_t));
       memcpy(gradient, sqlite3_column_blob(stmt, 5), sizeof(dt_masks_point_gradient_t));
-      form->points = g_list_append(form->points, gradient);
+      form->points = g_list_prepend(form->points, gradient);
     }
     else if(form->type & DT_MASKS_ELLIPSE)
     {
       dt_masks_point_ellipse_t *ellipse
           = (dt_masks_point_ellipse_t *)malloc(sizeof(dt_masks_point_ellipse_t));
       memcpy(ellipse, sqlite3_column_blob(stmt, 5), sizeof(dt_masks_point_ellipse_t));
-      form->points = g_list_append(form->points, ellipse);
+      form->points = g_list_prepend(form->points, ellipse);
     }
     else if(form->type & DT_MASKS_BRUSH)
     {
@@ -1056,10 +1284,13 @@ void dt_masks_read_forms(dt_develop_t *dev)
       {
         dt_masks_point_brush_t *point = (dt_masks_point_brush_t *)malloc(sizeof(dt_masks_point_brush_t));
         memcpy(point, ptbuf + i, sizeof(dt_masks_point_brush_t));
-        form->points = g_list_append(form->points, point);
+        form->points = g_list_prepend(form->points, point);
       }
     }
 
+    // prepended above, appending would walk the whole list for every point of a long brush stroke
+    form->points = g_list_reverse(form->points);
+
     if(form->version != dt_masks_version())
     {
       if(dt_masks_legacy_params(dev, form, form->version, dt_masks_version()))
@@ -1078,10 +1309,11 @@ void dt_masks_read_forms(dt_develop_t *dev)
     }
 
     // and we can add the form to the list
-    dev->forms = g_list_append(dev->forms, form);
+    dev->forms = g_list_prepend(dev->forms, form);
   }
 
   sqlite3_finalize(stmt);
+  dev->forms = g_list_reverse(dev->forms);
   dt_dev_masks_list_change(dev);
 }
 
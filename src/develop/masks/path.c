@@ -2045,7 +2045,12 @@ static int dt_path_get_area(dt_iop_module_t *module, dt_dev_pixelpipe_iop_t *pie
 }
 
 /** we write a falloff segment */
-static void _path_falloff(float **buffer, int *p0, int *p1, int posx, int posy, int bw)
+// the falloff segments are drawn in parallel, by bands of this many rows of the mask. every band draws the
+// parts of the segments crossing it, so the result is the same as drawing them one after the other.
+#define DT_PATH_BAND_HEIGHT 32
+
+/** we write the part of a falloff segment in the rows [y0, y1) */
+static void _path_falloff(float *buffer, int *p0, int *p1, int bw, const int y0, const int y1)
 {
   // segment length
   int l = sqrt((p1[0] - p0[0]) * (p1[0] - p0[0]) + (p1[1] - p0[1]) * (p1[1] - p0[1])) + 1;
@@ -2056,16 +2061,52 @@ static void _path_falloff(float **buffer, int *p0, int *p1, int posx, int posy,
   for(int i = 0; i < l; i++)
   {
     // position
-    int x = (int)((float)i * lx / (float)l) + p0[0] - posx;
-    int y = (int)((float)i * ly / (float)l) + p0[1] - posy;
+    int x = (int)((float)i * lx / (float)l) + p0[0];
+    int y = (int)((float)i * ly / (float)l) + p0[1];
+    if(y < y0 || y > y1) continue;
     float op = 1.0 - (float)i / (float)l;
-    (*buffer)[y * bw + x] = fmaxf((*buffer)[y * bw + x], op);
-    if(x > 0)
-      (*buffer)[y * bw + x - 1]
-          = fmaxf((*buffer)[y * bw + x - 1], op); // this one is to avoid gap due to int rounding
-    if(y > 0)
-      (*buffer)[(y - 1) * bw + x]
-          = fmaxf((*buffer)[(y - 1) * bw + x], op); // this one is to avoid gap due to int rounding
+    if(y < y1)
+    {
+      buffer[y * bw + x] = fmaxf(buffer[y * bw + x], op);
+      if(x > 0)
+        buffer[y * bw + x - 1] = fmaxf(buffer[y * bw + x - 1], op); // this one is to avoid gap due to int rounding
+    }
+    if(y > y0)
+      buffer[(y - 1) * bw + x]
+          = fmaxf(buffer[(y - 1) * bw + x], op); // this one is to avoid gap due to int rounding
+  }
+}
+
+static void _path_falloff_roi(float *buffer, int *p0, int *p1, int bw, int bh, const int y0, const int y1);
+
+/**
+ * draws the falloff segments seg[4 * k] to seg[4 * k + 3], start and end point, into the rows [0, bh) of
+ * buffer. with roi they are clipped to the buffer, else they have to lie inside of it.
+ */
+static void _path_falloff_bands(float *buffer, const int *seg, const int nseg, const int bw, const int bh,
+                                const int roi)
+{
+  const int nbands = (bh + DT_PATH_BAND_HEIGHT - 1) / DT_PATH_BAND_HEIGHT;
+#ifdef _OPENMP
+#if !defined(__SUNOS__) && !defined(__NetBSD__)
+#pragma omp parallel for default(none) shared(buffer) schedule(dynamic)
+#else
+#pragma omp parallel for shared(buffer) schedule(dynamic)
+#endif
+#endif
+  for(int b = 0; b < nbands; b++)
+  {
+    const int y0 = b * DT_PATH_BAND_HEIGHT, y1 = MIN(bh, y0 + DT_PATH_BAND_HEIGHT);
+    for(int k = 0; k < nseg; k++)
+    {
+      int p0[2] = { seg[4 * k], seg[4 * k + 1] }, p1[2] = { seg[4 * k + 2], seg[4 * k + 3] };
+      // the segment and the pixels next to it
+      if(MAX(p0[1], p1[1]) + 1 < y0 || MIN(p0[1], p1[1]) - 1 >= y1) continue;
+      if(roi)
+        _path_falloff_roi(buffer, p0, p1, bw, bh, y0, y1);
+      else
+        _path_falloff(buffer, p0, p1, bw, y0, y1);
+    }
   }
 }
 
@@ -2245,14 +2286,23 @@ static int dt_path_get_mask(dt_iop_module_t *module, dt_dev_pixelpipe_iop_t *pie
              dt_get_wtime() - start2);
   start2 = dt_get_wtime();
 
+  float *const buf = *buffer;
+  // every row is filled on its own
+#ifdef _OPENMP
+#if !defined(__SUNOS__) && !defined(__NetBSD__)
+#pragma omp parallel for default(none) schedule(static)
+#else
+#pragma omp parallel for schedule(static)
+#endif
+#endif
   for(int yy = 0; yy < hb; yy++)
   {
     int state = 0;
     for(int xx = 0; xx < wb; xx++)
     {
-      float v = (*buffer)[yy * wb + xx];
+      float v = buf[yy * wb + xx];
       if(v == 1.0f) state = !state;
-      if(state) (*buffer)[yy * wb + xx] = 1.0f;
+      if(state) buf[yy * wb + xx] = 1.0f;
     }
   }
 
@@ -2261,7 +2311,17 @@ static int dt_path_get_mask(dt_iop_module_t *module, dt_dev_pixelpipe_iop_t *pie
              dt_get_wtime() - start2);
   start2 = dt_get_wtime();
 
-  // now we fill the falloff
+  // now we fill the falloff, we first collect the segments
+  int *seg = malloc(sizeof(int) * 4 * MAX(border_count, 1));
+  if(!seg)
+  {
+    free(*buffer);
+    *buffer = NULL;
+    free(points);
+    free(border);
+    return 0;
+  }
+  int nseg = 0;
   int p0[2], p1[2];
   float pf1[2];
   int last0[2] = { -100, -100 }, last1[2] = { -100, -100 };
@@ -2286,14 +2346,18 @@ static int dt_path_get_mask(dt_iop_module_t *module, dt_dev_pixelpipe_iop_t *pie
       p1[0] = pf1[0] = border[next * 2], p1[1] = pf1[1] = border[next * 2 + 1];
     }
 
-    // and we draw the falloff
+    // and we store the falloff
     if(last0[0] != p0[0] || last0[1] != p0[1] || last1[0] != p1[0] || last1[1] != p1[1])
     {
-      _path_falloff(buffer, p0, p1, *posx, *posy, *width);
+      seg[4 * nseg] = p0[0] - *posx, seg[4 * nseg + 1] = p0[1] - *posy;
+      seg[4 * nseg + 2] = p1[0] - *posx, seg[4 * nseg + 3] = p1[1] - *posy;
+      nseg++;
       last0[0] = p0[0], last0[1] = p0[1];
       last1[0] = p1[0], last1[1] = p1[1];
     }
   }
+  _path_falloff_bands(buf, seg, nseg, wb, hb, 0);
+  free(seg);
 
   if(darktable.unmuted & DT_DEBUG_PERF)
     dt_print(DT_DEBUG_MASKS, "[masks %s] path_fill fill falloff took %0.04f sec\n", form->name,
@@ -2452,7 +2516,8 @@ static int _path_crop_to_roi(float *path, const int point_count, float xmin, flo
 }
 
 /** we write a falloff segment respecting limits of buffer */
-static void _path_falloff_roi(float *buffer, int *p0, int *p1, int bw, int bh)
+/** we write the part of a falloff segment in the rows [y0, y1), respecting limits of buffer */
+static void _path_falloff_roi(float *buffer, int *p0, int *p1, int bw, int bh, const int y0, const int y1)
 {
   // segment length
   const int l = sqrt((p1[0] - p0[0]) * (p1[0] - p0[0]) + (p1[1] - p0[1]) * (p1[1] - p0[1])) + 1;
@@ -2471,10 +2536,10 @@ static void _path_falloff_roi(float *buffer, int *p0, int *p1, int bw, int bh)
     const int y = (int)((float)i * ly / (float)l) + p0[1];
     const float op = 1.0 - (float)i / (float)l;
     float *buf = buffer + (size_t)y * bw + x;
-    if(x >= 0 && x < bw && y >= 0 && y < bh) buf[0] = fmaxf(buf[0], op);
-    if(x + dx >= 0 && x + dx < bw && y >= 0 && y < bh)
+    if(x >= 0 && x < bw && y >= y0 && y < y1) buf[0] = fmaxf(buf[0], op);
+    if(x + dx >= 0 && x + dx < bw && y >= y0 && y < y1)
       buf[dx] = fmaxf(buf[dx], op); // this one is to avoid gap due to int rounding
-    if(x >= 0 && x < bw && y + dy >= 0 && y + dy < bh)
+    if(x >= 0 && x < bw && y + dy >= y0 && y + dy < y1)
       buf[dpy] = fmaxf(buf[dpy], op); // this one is to avoid gap due to int rounding
   }
 }
@@ -2721,15 +2786,21 @@ static int dt_path_get_mask_roi(dt_iop_module_t *module, dt_dev_pixelpipe_iop_t
 
       // we fill the inside plain
       // we don't need to deal with parts of shape outside of roi
-      xmin = fmaxf(xmin, 0);
-      xmax = fminf(xmax, width - 1);
-      ymin = fmaxf(ymin, 0);
-      ymax = fminf(ymax, height - 1);
-
-      for(int yy = ymin; yy <= ymax; yy++)
+      const int fx0 = fmaxf(xmin, 0), fx1 = floorf(fminf(xmax, width - 1));
+      const int fy0 = fmaxf(ymin, 0), fy1 = floorf(fminf(ymax, height - 1));
+
+      // every row is filled on its own
+#ifdef _OPENMP
+#if !defined(__SUNOS__) && !defined(__NetBSD__)
+#pragma omp parallel for default(none) shared(buffer) schedule(static)
+#else
+#pragma omp parallel for shared(buffer) schedule(static)
+#endif
+#endif
+      for(int yy = fy0; yy <= fy1; yy++)
       {
         int state = 0;
-        for(int xx = xmin; xx <= xmax; xx++)
+        for(int xx = fx0; xx <= fx1; xx++)
         {
           size_t index = (size_t)yy * width + xx;
           float v = buffer[index];
@@ -2749,6 +2820,15 @@ static int dt_path_get_mask_roi(dt_iop_module_t *module, dt_dev_pixelpipe_iop_t
   // deal with feather if it does not lie outside of roi
   if(!path_encircles_roi)
   {
+    // we first collect the segments
+    int *seg = malloc(sizeof(int) * 4 * MAX(border_count, 1));
+    if(!seg)
+    {
+      free(points);
+      free(border);
+      return 0;
+    }
+    int nseg = 0;
     int p0[2], p1[2];
     float pf1[2];
     int last0[2] = { -100, -100 };
@@ -2781,16 +2861,20 @@ static int dt_path_get_mask_roi(dt_iop_module_t *module, dt_dev_pixelpipe_iop_t
         p1[1] = pf1[1] = border[next * 2 + 1];
       }
 
-      // and we draw the falloff
+      // and we store the falloff
       if(last0[0] != p0[0] || last0[1] != p0[1] || last1[0] != p1[0] || last1[1] != p1[1])
       {
-        _path_falloff_roi(buffer, p0, p1, width, height);
+        memcpy(seg + 4 * nseg, p0, sizeof(p0));
+        memcpy(seg + 4 * nseg + 2, p1, sizeof(p1));
+        nseg++;
         last0[0] = p0[0];
         last0[1] = p0[1];
         last1[0] = p1[0];
         last1[1] = p1[1];
       }
     }
+    _path_falloff_bands(buffer, seg, nseg, width, height, 1);
+    free(seg);
 
     if(darktable.unmuted & DT_DEBUG_PERF)
       dt_print(DT_DEBUG_MASKS, "[masks %s] path_fill fill falloff took %0.04f sec\n", form->name,
@@ -2807,6 +2891,8 @@ static int dt_path_get_mask_roi(dt_iop_module_t *module, dt_dev_pixelpipe_iop_t
   return 1;
 }
 
+#undef DT_PATH_BAND_HEIGHT
+
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
 // kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
@@ -52,6 +52,8 @@ typedef struct dt_dev_histogram_collection_params_t
   uint32_t bins_count;
   /** in most cases, bins_count-1. */
   float mul;
+  /** sample only every step-th row and column of the roi, 0 for all of them. */
+  uint32_t step;
 } dt_dev_histogram_collection_params_t;
 
 // params used to collect histogram during last histogram capture
@@ -17,20 +17,401 @@
 */
 
 #include "develop/pixelpipe_cache.h"
+#include "common/buffer_pool.h"
+#include "common/opencl.h"
 #include "develop/format.h"
 #include "develop/pixelpipe_hb.h"
 #include "libs/lib.h"
 #include <stdlib.h>
+#include <string.h>
+#if defined(__F16C__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+
+typedef struct dt_dev_pixelpipe_cache_line_t
+{
+  uint64_t key;
+  void *data;
+  size_t size; // of the float buffer handed out again
+  size_t cost; // what data takes up in the store
+  int half;    // float data is stored as half floats
+  dt_iop_buffer_dsc_t dsc;
+  GList *link;
+} dt_dev_pixelpipe_cache_line_t;
+
+// ieee half floats, rounding to nearest even. out of range values become inf.
+static inline uint16_t _float_to_half(const float f)
+{
+  union { float f; uint32_t i; } u = { .f = f };
+  const uint32_t sign = u.i & 0x80000000u;
+  u.i ^= sign;
+  uint16_t h;
+  if(u.i >= (127 + 16) << 23)
+    h = u.i > 255u << 23 ? 0x7e00 : 0x7c00;
+  else if(u.i < 113u << 23)
+  {
+    // denormal: let the fpu do the rounding
+    const union { float f; uint32_t i; } magic = { .i = ((127 - 15) + (23 - 10) + 1) << 23 };
+    u.f += magic.f;
+    h = u.i - magic.i;
+  }
+  else
+  {
+    const uint32_t mant_odd = (u.i >> 13) & 1;
+    u.i += ((uint32_t)(15 - 127) << 23) + 0xfff + mant_odd;
+    h = u.i >> 13;
+  }
+  return h | (sign >> 16);
+}
+
+static inline float _half_to_float(const uint16_t h)
+{
+  const union { float f; uint32_t i; } magic = { .i = 113 << 23 };
+  const uint32_t shifted_exp = 0x7c00 << 13;
+  union { float f; uint32_t i; } u = { .i = (h & 0x7fff) << 13 };
+  const uint32_t exp = shifted_exp & u.i;
+  u.i += (127 - 15) << 23;
+  if(exp == shifted_exp)
+    u.i += (128 - 16) << 23; // inf, nan
+  else if(exp == 0)
+  {
+    u.i += 1 << 23; // denormal
+    u.f -= magic.f;
+  }
+  u.i |= (uint32_t)(h & 0x8000) << 16;
+  return u.f;
+}
+
+static void _floats_to_halfs(uint16_t *const out, const float *const in, const size_t n)
+{
+  const size_t n4 = n & ~(size_t)3;
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+  for(size_t k = 0; k < n4; k += 4)
+  {
+#if defined(__F16C__)
+    _mm_storel_epi64((__m128i *)(out + k), _mm_cvtps_ph(_mm_loadu_ps(in + k), _MM_FROUND_TO_NEAREST_INT));
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    vst1_u16(out + k, vreinterpret_u16_f16(vcvt_f16_f32(vld1q_f32(in + k))));
+#else
+    for(int c = 0; c < 4; c++) out[k + c] = _float_to_half(in[k + c]);
+#endif
+  }
+  for(size_t k = n4; k < n; k++) out[k] = _float_to_half(in[k]);
+}
+
+static void _halfs_to_floats(float *const out, const uint16_t *const in, const size_t n)
+{
+  const size_t n4 = n & ~(size_t)3;
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+  for(size_t k = 0; k < n4; k += 4)
+  {
+#if defined(__F16C__)
+    _mm_storeu_ps(out + k, _mm_cvtph_ps(_mm_loadl_epi64((const __m128i *)(in + k))));
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    vst1q_f32(out + k, vcvt_f32_f16(vreinterpret_f16_u16(vld1_u16(in + k))));
+#else
+    for(int c = 0; c < 4; c++) out[k + c] = _half_to_float(in[k + c]);
+#endif
+  }
+  for(size_t k = n4; k < n; k++) out[k] = _half_to_float(in[k]);
+}
+
+static void _store_line_free(gpointer data)
+{
+  dt_dev_pixelpipe_cache_line_t *line = (dt_dev_pixelpipe_cache_line_t *)data;
+  dt_buffer_pool_free(line->data);
+  free(line);
+}
+
+static size_t _store_memory_usage(void *data)
+{
+  const dt_dev_pixelpipe_cache_store_t *store = (const dt_dev_pixelpipe_cache_store_t *)data;
+  return store->cost;
+}
+
+static void _store_remove_line(dt_dev_pixelpipe_cache_store_t *store, dt_dev_pixelpipe_cache_line_t *line);
+
+static size_t _store_memory_reclaim(void *data, size_t wanted)
+{
+  dt_dev_pixelpipe_cache_store_t *store = (dt_dev_pixelpipe_cache_store_t *)data;
+  size_t freed = 0;
+  dt_pthread_mutex_lock(&store->lock);
+  while(freed < wanted && !g_queue_is_empty(store->lru))
+  {
+    dt_dev_pixelpipe_cache_line_t *lru = (dt_dev_pixelpipe_cache_line_t *)g_queue_peek_tail(store->lru);
+    freed += lru->cost;
+    _store_remove_line(store, lru);
+    store->evictions++;
+  }
+  dt_pthread_mutex_unlock(&store->lock);
+  return freed;
+}
+
+static void _store_memory_limit(void *data, float fraction)
+{
+  dt_dev_pixelpipe_cache_store_t *store = (dt_dev_pixelpipe_cache_store_t *)data;
+  dt_pthread_mutex_lock(&store->lock);
+  store->cost_quota = store->cost_quota_configured * fraction;
+  while(store->cost > store->cost_quota && !g_queue_is_empty(store->lru))
+  {
+    _store_remove_line(store, (dt_dev_pixelpipe_cache_line_t *)g_queue_peek_tail(store->lru));
+    store->evictions++;
+  }
+  dt_pthread_mutex_unlock(&store->lock);
+}
+
+int dt_dev_pixelpipe_cache_store_init(dt_dev_pixelpipe_cache_store_t *store, size_t cost_quota)
+{
+  dt_pthread_mutex_init(&store->lock, NULL);
+  store->lines = g_hash_table_new_full(g_int64_hash, g_int64_equal, NULL, _store_line_free);
+  store->lru = g_queue_new();
+  store->cost = 0;
+  store->cost_quota = store->cost_quota_configured = cost_quota;
+  store->queries = store->hits = store->evictions = 0;
+  // before the thumbnails are gone, the darkroom would rather recompute than stall on a reload
+  store->memory = (dt_memory_consumer_t){ .name = "pixelpipe cache",
+                                          .usage = _store_memory_usage,
+                                          .reclaim = _store_memory_reclaim,
+                                          .limit = _store_memory_limit,
+                                          .data = store,
+                                          .priority = 1 };
+  dt_memory_register(darktable.memory, &store->memory);
+  return store->lines && store->lru;
+}
+
+void dt_dev_pixelpipe_cache_store_cleanup(dt_dev_pixelpipe_cache_store_t *store)
+{
+  dt_memory_unregister(darktable.memory, &store->memory);
+  g_queue_free(store->lru);
+  g_hash_table_destroy(store->lines);
+  dt_pthread_mutex_destroy(&store->lock);
+}
+
+void dt_dev_pixelpipe_cache_store_flush(dt_dev_pixelpipe_cache_store_t *store)
+{
+  dt_pthread_mutex_lock(&store->lock);
+  g_queue_clear(store->lru);
+  g_hash_table_remove_all(store->lines);
+  store->cost = 0;
+  dt_pthread_mutex_unlock(&store->lock);
+}
+
+// store lock has to be held.
+static void _store_remove_line(dt_dev_pixelpipe_cache_store_t *store, dt_dev_pixelpipe_cache_line_t *line)
+{
+  g_queue_delete_link(store->lru, line->link);
+  store->cost -= line->cost;
+  g_hash_table_remove(store->lines, &line->key);
+}
+
+// hands data over to the store, which frees the least recently used buffers to stay within budget.
+// with half set, float buffers are kept at half precision and take half the space.
+static void _store_put(dt_dev_pixelpipe_cache_store_t *store, const uint64_t key, void *data, const size_t size,
+                       const dt_iop_buffer_dsc_t *dsc, const int half)
+{
+  size_t cost = size;
+  int halfs = 0;
+  if(half && dsc->datatype == TYPE_FLOAT)
+  {
+    uint16_t *packed = (uint16_t *)dt_buffer_pool_alloc(NULL, size / 2);
+    if(packed)
+    {
+      _floats_to_halfs(packed, (const float *)data, size / sizeof(float));
+      dt_buffer_pool_free(data);
+      data = packed;
+      cost = size / 2;
+      halfs = 1;
+    }
+  }
+
+  if(cost > store->cost_quota)
+  {
+    dt_buffer_pool_free(data);
+    return;
+  }
+
+  dt_dev_pixelpipe_cache_line_t *line
+      = (dt_dev_pixelpipe_cache_line_t *)malloc(sizeof(dt_dev_pixelpipe_cache_line_t));
+  if(!line)
+  {
+    dt_buffer_pool_free(data);
+    return;
+  }
+  line->key = key;
+  line->data = data;
+  line->size = size;
+  line->cost = cost;
+  line->half = halfs;
+  line->dsc = *dsc;
+  ASAN_POISON_MEMORY_REGION(data, cost);
+
+  dt_pthread_mutex_lock(&store->lock);
+  dt_dev_pixelpipe_cache_line_t *old = (dt_dev_pixelpipe_cache_line_t *)g_hash_table_lookup(store->lines, &key);
+  if(old) _store_remove_line(store, old);
+
+  g_queue_push_head(store->lru, line);
+  line->link = g_queue_peek_head_link(store->lru);
+  g_hash_table_insert(store->lines, &line->key, line);
+  store->cost += cost;
+
+  while(store->cost > store->cost_quota)
+  {
+    dt_dev_pixelpipe_cache_line_t *lru = (dt_dev_pixelpipe_cache_line_t *)g_queue_peek_tail(store->lru);
+    _store_remove_line(store, lru);
+    store->evictions++;
+  }
+  dt_pthread_mutex_unlock(&store->lock);
+}
+
+// takes the buffer for key out of the store, if it is there and large enough. returns 1 on success.
+static int _store_take(dt_dev_pixelpipe_cache_store_t *store, const uint64_t key, const size_t size, void **data,
+                       size_t *data_size, dt_iop_buffer_dsc_t *dsc)
+{
+  dt_pthread_mutex_lock(&store->lock);
+  store->queries++;
+  dt_dev_pixelpipe_cache_line_t *line = (dt_dev_pixelpipe_cache_line_t *)g_hash_table_lookup(store->lines, &key);
+  if(line && line->size >= size)
+  {
+    *data = line->data;
+    *data_size = line->size;
+    *dsc = line->dsc;
+    const int half = line->half;
+    line->data = NULL;
+    _store_remove_line(store, line);
+    store->hits++;
+    dt_pthread_mutex_unlock(&store->lock);
+    if(!half) return 1;
+
+    // back to full floats, outside the lock
+    float *unpacked = (float *)dt_buffer_pool_alloc(NULL, *data_size);
+    if(unpacked)
+    {
+      ASAN_UNPOISON_MEMORY_REGION(*data, *data_size / 2);
+      _halfs_to_floats(unpacked, (const uint16_t *)*data, *data_size / sizeof(float));
+    }
+    dt_buffer_pool_free(*data);
+    *data = unpacked;
+    return unpacked != NULL;
+  }
+  dt_pthread_mutex_unlock(&store->lock);
+  return 0;
+}
+
+static inline uint64_t _store_key(const dt_dev_pixelpipe_cache_t *cache, const uint64_t hash)
+{
+  return ((hash << 5) + hash) ^ cache->store_salt;
+}
+
+#ifdef HAVE_OPENCL
+static void _cache_release_gpu(dt_dev_pixelpipe_cache_t *cache, const int k)
+{
+  if(!cache->gpu_mem[k]) return;
+  const size_t size = (size_t)cache->gpu_width[k] * cache->gpu_height[k] * cache->gpu_bpp[k];
+  __sync_fetch_and_sub(&darktable.opencl->dev[cache->gpu_devid[k]].cache_memory_in_use, size);
+  dt_opencl_release_mem_object(cache->gpu_mem[k]);
+  cache->gpu_mem[k] = NULL;
+}
+
+// bring the host copy of line k up to date and drop the device copy. on failure the line is invalidated.
+static int _cache_download_gpu(dt_dev_pixelpipe_cache_t *cache, const int k)
+{
+  cl_int err = CL_SUCCESS;
+  if(cache->host_stale[k] && cache->gpu_mem[k])
+    err = dt_opencl_copy_device_to_host(cache->gpu_devid[k], cache->data[k], cache->gpu_mem[k],
+                                        cache->gpu_width[k], cache->gpu_height[k], cache->gpu_bpp[k]);
+  _cache_release_gpu(cache, k);
+  if(err != CL_SUCCESS) cache->hash[k] = -1;
+  cache->host_stale[k] = 0;
+  return err != CL_SUCCESS;
+}
+
+static inline int _line_is_usable(const dt_dev_pixelpipe_cache_t *cache, const int k)
+{
+  // a stale line whose device buffer is lent out is in flight
+  return !cache->host_stale[k] || cache->gpu_mem[k];
+}
+#else
+static inline int _line_is_usable(const dt_dev_pixelpipe_cache_t *cache, const int k)
+{
+  return 1;
+}
+#endif
 
+// only lines filled by a completed run, or by the running one (those are done by the time they
+// are evicted), hold valid data. the one on screen is still in use.
+static inline int _line_is_complete(const dt_dev_pixelpipe_cache_t *cache, const int k)
+{
+#ifdef HAVE_OPENCL
+  if(cache->host_stale[k]) return 0;
+#endif
+  return cache->hash[k] != (uint64_t)-1 && cache->data[k] && cache->data[k] != cache->backbuf
+         && (cache->generation[k] == 0 || cache->generation[k] == cache->current_generation);
+}
 
-// TODO: make cache global (needs to be thread safe then)
-// plan:
-// - look at mipmap_cache.c, for the full buffer allocs
-// - do that, but for `large' and `regular' buffers (full + export/dr mode), so 2 caches
-//   (in fact, maybe 3, one for preview pipes?)
-// - have at most 3 read locks all the time per pipe, get them at create time
-//   ping, pong, and priority buffer (focused plugin)
-// - drop read by the time another is requested (with priority, drop that, or alternating ping and pong?)
+// cache line k is about to be reused. hand its contents over to the store if they are worth keeping,
+// in which case the line is left without buffer.
+static void _cache_retire_line(dt_dev_pixelpipe_cache_t *cache, const int k)
+{
+  const int donate = cache->store && _line_is_complete(cache, k);
+#ifdef HAVE_OPENCL
+  _cache_release_gpu(cache, k);
+  cache->host_stale[k] = 0;
+#endif
+  if(!donate) return;
+  _store_put(cache->store, _store_key(cache, cache->hash[k]), cache->data[k], cache->size[k], &cache->dsc[k],
+             cache->half_store);
+  cache->data[k] = NULL;
+  cache->size[k] = 0;
+  cache->hash[k] = -1;
+}
+
+static int _cache_lru_line(const dt_dev_pixelpipe_cache_t *cache)
+{
+  int max_used = -1, max = 0;
+  for(int k = 0; k < cache->entries; k++)
+  {
+    if(cache->used[k] > max_used)
+    {
+      max_used = cache->used[k];
+      max = k;
+    }
+  }
+  return max;
+}
+
+// moves the buffer for hash from the store into cache line k. returns 1 on success.
+static int _cache_fetch_line(dt_dev_pixelpipe_cache_t *cache, const int k, const uint64_t hash, const size_t size)
+{
+  void *data = NULL;
+  size_t data_size = 0;
+  dt_iop_buffer_dsc_t dsc;
+  if(!cache->store || !_store_take(cache->store, _store_key(cache, hash), size, &data, &data_size, &dsc))
+    return 0;
+
+  _cache_retire_line(cache, k);
+  dt_buffer_pool_free(cache->data[k]);
+  cache->data[k] = data;
+  cache->size[k] = data_size;
+  cache->dsc[k] = dsc;
+  cache->hash[k] = hash;
+  cache->generation[k] = 0;
+  return 1;
+}
+
+static size_t _cache_memory_usage(void *data)
+{
+  const dt_dev_pixelpipe_cache_t *cache = (const dt_dev_pixelpipe_cache_t *)data;
+  size_t used = 0;
+  for(int k = 0; k < cache->entries; k++) used += cache->size[k];
+  return used;
+}
 
 int dt_dev_pixelpipe_cache_init(dt_dev_pixelpipe_cache_t *cache, int entries, size_t size)
 {
@@ -43,12 +424,28 @@ int dt_dev_pixelpipe_cache_init(dt_dev_pixelpipe_cache_t *cache, int entries, si
 #endif
   cache->hash = (uint64_t *)calloc(entries, sizeof(uint64_t));
   cache->used = (int32_t *)calloc(entries, sizeof(int32_t));
+  cache->generation = (uint32_t *)calloc(entries, sizeof(uint32_t));
+#ifdef HAVE_OPENCL
+  cache->gpu_mem = (void **)calloc(entries, sizeof(void *));
+  cache->gpu_devid = (int32_t *)calloc(entries, sizeof(int32_t));
+  cache->gpu_width = (int32_t *)calloc(entries, sizeof(int32_t));
+  cache->gpu_height = (int32_t *)calloc(entries, sizeof(int32_t));
+  cache->gpu_bpp = (int32_t *)calloc(entries, sizeof(int32_t));
+  cache->host_stale = (int32_t *)calloc(entries, sizeof(int32_t));
+#endif
+  cache->current_generation = 1;
+  cache->store = NULL;
+  cache->store_salt = 0;
+  cache->backbuf = NULL;
+  cache->half_store = 0;
+  cache->memory = (dt_memory_consumer_t){ .name = "pixelpipes", .usage = _cache_memory_usage, .data = cache };
+  dt_memory_register(darktable.memory, &cache->memory);
   for(int k = 0; k < entries; k++)
   {
     cache->size[k] = size;
     if(size)
     { // allow 0 initial buffer size (yet unknown dimensions)
-      cache->data[k] = (void *)dt_alloc_align(16, size);
+      cache->data[k] = (void *)dt_buffer_pool_alloc(NULL, size);
       if(!cache->data[k]) goto alloc_memory_fail;
 #ifdef _DEBUG
       memset(cache->data[k], 0x5d, size);
@@ -69,55 +466,160 @@ alloc_memory_fail:
 
 void dt_dev_pixelpipe_cache_cleanup(dt_dev_pixelpipe_cache_t *cache)
 {
-  for(int k = 0; k < cache->entries; k++) dt_free_align(cache->data[k]);
+  dt_memory_unregister(darktable.memory, &cache->memory);
+#ifdef HAVE_OPENCL
+  if(cache->gpu_mem)
+    for(int k = 0; k < cache->entries; k++) _cache_release_gpu(cache, k);
+  free(cache->gpu_mem);
+  free(cache->gpu_devid);
+  free(cache->gpu_width);
+  free(cache->gpu_height);
+  free(cache->gpu_bpp);
+  free(cache->host_stale);
+#endif
+  for(int k = 0; k < cache->entries; k++) dt_buffer_pool_free(cache->data[k]);
   free(cache->data);
   free(cache->dsc);
   free(cache->hash);
   free(cache->used);
   free(cache->size);
+  free(cache->generation);
 }
 
-uint64_t dt_dev_pixelpipe_cache_hash(int imgid, const dt_iop_roi_t *roi, dt_dev_pixelpipe_t *pipe, int module)
+void dt_dev_pixelpipe_cache_begin(dt_dev_pixelpipe_cache_t *cache, const uint64_t salt)
 {
-  // bernstein hash (djb2)
-  uint64_t hash = 5381 + imgid;
-  // go through all modules up to module and compute a weird hash using the operation and params.
-  GList *pieces = pipe->nodes;
-  for(int k = 0; k < module && pieces; k++)
+  if(salt == cache->store_salt) return;
+  // the input changed, nothing in the working set is valid for it any more.
+  for(int k = 0; k < cache->entries; k++)
+  {
+    _cache_retire_line(cache, k);
+    cache->hash[k] = -1;
+  }
+  cache->store_salt = salt;
+}
+
+void dt_dev_pixelpipe_cache_end(dt_dev_pixelpipe_cache_t *cache, const int success)
+{
+  if(success)
+    for(int k = 0; k < cache->entries; k++)
+      if(cache->generation[k] == cache->current_generation) cache->generation[k] = 0;
+  // lines filled by a failed run keep a stale generation and never make it into the store.
+  if(++cache->current_generation == 0) cache->current_generation = 1;
+}
+
+// a module hidden by the focused one leaves no trace
+static int _piece_filtered(const dt_dev_pixelpipe_iop_t *piece)
+{
+  const dt_develop_t *dev = piece->module->dev;
+  return dev->gui_module && (dev->gui_module->operation_tags_filter() & piece->module->operation_tags());
+}
+
+static uint64_t _hash_color_picker(uint64_t hash, const dt_dev_pixelpipe_iop_t *piece)
+{
+  if(piece->module->request_color_pick == DT_REQUEST_COLORPICK_OFF) return hash;
+  if(darktable.lib->proxy.colorpicker.size)
+  {
+    const char *str = (const char *)piece->module->color_picker_box;
+    for(size_t i = 0; i < sizeof(float) * 4; i++) hash = ((hash << 5) + hash) ^ str[i];
+  }
+  else
+  {
+    const char *str = (const char *)piece->module->color_picker_point;
+    for(size_t i = 0; i < sizeof(float) * 2; i++) hash = ((hash << 5) + hash) ^ str[i];
+  }
+  return hash;
+}
+
+static uint64_t _hash_piece(uint64_t hash, const dt_dev_pixelpipe_iop_t *piece)
+{
+  if(_piece_filtered(piece)) return hash;
+  hash = ((hash << 5) + hash) ^ piece->hash;
+  return _hash_color_picker(hash, piece);
+}
+
+// hash of the first module pieces, extending the running hashes as far as needed
+static uint64_t _prefix_hash(dt_dev_pixelpipe_t *pipe, const int imgid, const int module)
+{
+  if(imgid != pipe->prefix.imgid)
+  {
+    pipe->prefix.imgid = imgid;
+    pipe->prefix.valid = 0;
+  }
+  if(module >= pipe->prefix.size)
   {
-    dt_dev_pixelpipe_iop_t *piece = (dt_dev_pixelpipe_iop_t *)pieces->data;
-    dt_develop_t *dev = piece->module->dev;
-    if(!(dev->gui_module && (dev->gui_module->operation_tags_filter() & piece->module->operation_tags())))
+    const int size = MAX(module + 1, 2 * pipe->prefix.size);
+    uint64_t *hash = (uint64_t *)realloc(pipe->prefix.hash, sizeof(uint64_t) * size);
+    if(!hash)
     {
-      hash = ((hash << 5) + hash) ^ piece->hash;
-      if(piece->module->request_color_pick != DT_REQUEST_COLORPICK_OFF)
-      {
-        if(darktable.lib->proxy.colorpicker.size)
-        {
-          const char *str = (const char *)piece->module->color_picker_box;
-          for(size_t i = 0; i < sizeof(float) * 4; i++) hash = ((hash << 5) + hash) ^ str[i];
-        }
-        else
-        {
-          const char *str = (const char *)piece->module->color_picker_point;
-          for(size_t i = 0; i < sizeof(float) * 2; i++) hash = ((hash << 5) + hash) ^ str[i];
-        }
-      }
+      // bernstein hash (djb2)
+      uint64_t h = 5381 + imgid;
+      GList *pieces = pipe->nodes;
+      for(int k = 0; k < module && pieces; k++, pieces = g_list_next(pieces))
+        h = _hash_piece(h, (dt_dev_pixelpipe_iop_t *)pieces->data);
+      return h;
     }
-    pieces = g_list_next(pieces);
+    pipe->prefix.hash = hash;
+    pipe->prefix.size = size;
   }
+  if(!pipe->prefix.valid)
+  {
+    // bernstein hash (djb2)
+    pipe->prefix.hash[0] = 5381 + imgid;
+    pipe->prefix.valid = 1;
+  }
+  if(module >= pipe->prefix.valid)
+  {
+    GList *pieces = g_list_nth(pipe->nodes, pipe->prefix.valid - 1);
+    for(; pieces && pipe->prefix.valid <= module; pieces = g_list_next(pieces), pipe->prefix.valid++)
+      pipe->prefix.hash[pipe->prefix.valid]
+          = _hash_piece(pipe->prefix.hash[pipe->prefix.valid - 1], (dt_dev_pixelpipe_iop_t *)pieces->data);
+    // fewer pieces than asked for
+    if(module >= pipe->prefix.valid) return pipe->prefix.hash[pipe->prefix.valid - 1];
+  }
+  return pipe->prefix.hash[module];
+}
+
+uint64_t dt_dev_pixelpipe_cache_hash(int imgid, const dt_iop_roi_t *roi, dt_dev_pixelpipe_t *pipe, int module)
+{
+  // go through all modules up to module and compute a weird hash using the operation and params.
+  uint64_t hash = _prefix_hash(pipe, imgid, module);
   // also add scale, x and y:
   const char *str = (const char *)roi;
   for(size_t i = 0; i < sizeof(dt_iop_roi_t); i++) hash = ((hash << 5) + hash) ^ str[i];
   return hash;
 }
 
+void dt_dev_pixelpipe_cache_hash_invalidate(dt_dev_pixelpipe_t *pipe, const dt_dev_pixelpipe_iop_t *piece)
+{
+  const int pos = g_list_index(pipe->nodes, (gconstpointer)piece);
+  // the hashes up to and including the one of pos don't cover piece
+  pipe->prefix.valid = pos < 0 ? 0 : MIN(pipe->prefix.valid, pos + 1);
+}
+
+void dt_dev_pixelpipe_cache_hash_check(dt_dev_pixelpipe_t *pipe)
+{
+  uint64_t state = 5381;
+  for(GList *pieces = pipe->nodes; pieces; pieces = g_list_next(pieces))
+  {
+    const dt_dev_pixelpipe_iop_t *piece = (dt_dev_pixelpipe_iop_t *)pieces->data;
+    const int filtered = _piece_filtered(piece);
+    state = ((state << 5) + state) ^ filtered;
+    if(!filtered) state = _hash_color_picker(state, piece);
+  }
+  if(state != pipe->prefix.state)
+  {
+    pipe->prefix.state = state;
+    pipe->prefix.valid = 0;
+  }
+}
+
 int dt_dev_pixelpipe_cache_available(dt_dev_pixelpipe_cache_t *cache, const uint64_t hash)
 {
   // search for hash in cache
   for(int32_t k = 0; k < cache->entries; k++)
-    if(cache->hash[k] == hash) return 1;
-  return 0;
+    if(cache->hash[k] == hash && _line_is_usable(cache, k)) return 1;
+  // pull it back from the shared store, the lru line goes there in exchange.
+  return _cache_fetch_line(cache, _cache_lru_line(cache), hash, 0);
 }
 
 int dt_dev_pixelpipe_cache_get_important(dt_dev_pixelpipe_cache_t *cache, const uint64_t hash, const size_t size,
@@ -148,7 +650,7 @@ int dt_dev_pixelpipe_cache_get_weighted(dt_dev_pixelpipe_cache_t *cache, const u
       max = k;
     }
     cache->used[k]++; // age all entries
-    if(cache->hash[k] == hash)
+    if(cache->hash[k] == hash && _line_is_usable(cache, k))
     {
       assert(cache->size[k] >= size);
 
@@ -162,15 +664,27 @@ int dt_dev_pixelpipe_cache_get_weighted(dt_dev_pixelpipe_cache_t *cache, const u
     }
   }
 
+  if((!*data || sz < size) && _cache_fetch_line(cache, max, hash, size))
+  {
+    *data = cache->data[max];
+    *dsc = &cache->dsc[max];
+    cache->used[max] = weight;
+
+    ASAN_POISON_MEMORY_REGION(*data, cache->size[max]);
+    ASAN_UNPOISON_MEMORY_REGION(*data, size);
+    return 0;
+  }
+
   if(!*data || sz < size)
   {
     // kill LRU entry
     // printf("[pixelpipe_cache_get] hash not found, returning slot %d/%d age %d\n", max, cache->entries,
     // weight);
+    _cache_retire_line(cache, max);
     if(cache->size[max] < size)
     {
-      dt_free_align(cache->data[max]);
-      cache->data[max] = (void *)dt_alloc_align(16, size);
+      dt_buffer_pool_free(cache->data[max]);
+      cache->data[max] = (void *)dt_buffer_pool_alloc(NULL, size);
       cache->size[max] = size;
     }
     *data = cache->data[max];
@@ -185,6 +699,7 @@ int dt_dev_pixelpipe_cache_get_weighted(dt_dev_pixelpipe_cache_t *cache, const u
 
     cache->hash[max] = hash;
     cache->used[max] = weight;
+    cache->generation[max] = cache->current_generation;
     cache->misses++;
     return 1;
   }
@@ -198,6 +713,10 @@ void dt_dev_pixelpipe_cache_flush(dt_dev_pixelpipe_cache_t *cache)
   {
     cache->hash[k] = -1;
     cache->used[k] = 0;
+#ifdef HAVE_OPENCL
+    _cache_release_gpu(cache, k);
+    cache->host_stale[k] = 0;
+#endif
     ASAN_POISON_MEMORY_REGION(cache->data[k], cache->size[k]);
   }
 }
@@ -220,11 +739,109 @@ void dt_dev_pixelpipe_cache_invalidate(dt_dev_pixelpipe_cache_t *cache, void *da
     if(cache->data[k] == data)
     {
       cache->hash[k] = -1;
+#ifdef HAVE_OPENCL
+      _cache_release_gpu(cache, k);
+      cache->host_stale[k] = 0;
+#endif
       ASAN_POISON_MEMORY_REGION(cache->data[k], cache->size[k]);
     }
   }
 }
 
+#ifdef HAVE_OPENCL
+static int _cache_find_line(const dt_dev_pixelpipe_cache_t *cache, const void *data)
+{
+  if(!data) return -1;
+  for(int k = 0; k < cache->entries; k++)
+    if(cache->data[k] == data && cache->hash[k] != (uint64_t)-1) return k;
+  return -1;
+}
+
+int dt_dev_pixelpipe_cache_keep_gpu(dt_dev_pixelpipe_cache_t *cache, void *data, void *mem, const int devid,
+                                    const int width, const int height, const int bpp)
+{
+  const int k = _cache_find_line(cache, data);
+  if(k < 0 || !mem || devid < 0) return 0;
+
+  // every device gets its own budget, so lines don't crowd out the buffers modules need to run.
+  // make room by moving our least recently used lines on that device back to the host.
+  const size_t size = (size_t)width * height * bpp;
+  const size_t budget = dt_opencl_get_max_global_mem(devid) / 4;
+  dt_opencl_device_t *dev = &darktable.opencl->dev[devid];
+  while(dev->cache_memory_in_use + size > budget)
+  {
+    int lru = -1;
+    for(int j = 0; j < cache->entries; j++)
+      if(j != k && cache->gpu_mem[j] && cache->gpu_devid[j] == devid
+         && (lru < 0 || cache->used[j] > cache->used[lru]))
+        lru = j;
+    if(lru < 0) break;
+    _cache_download_gpu(cache, lru);
+  }
+  if(dev->cache_memory_in_use + size > budget) return 0;
+
+  _cache_release_gpu(cache, k);
+  cache->gpu_mem[k] = mem;
+  cache->gpu_devid[k] = devid;
+  cache->gpu_width[k] = width;
+  cache->gpu_height[k] = height;
+  cache->gpu_bpp[k] = bpp;
+  cache->host_stale[k] = 1;
+  __sync_fetch_and_add(&dev->cache_memory_in_use, size);
+  return 1;
+}
+
+int dt_dev_pixelpipe_cache_take_gpu(dt_dev_pixelpipe_cache_t *cache, void *data, const int devid, void **mem)
+{
+  *mem = NULL;
+  const int k = _cache_find_line(cache, data);
+  if(k < 0 || !cache->host_stale[k] || !cache->gpu_mem[k]) return 0;
+
+  if(devid >= 0 && cache->gpu_devid[k] == devid)
+  {
+    // lend it out, the line stays stale until it is handed back
+    const size_t size = (size_t)cache->gpu_width[k] * cache->gpu_height[k] * cache->gpu_bpp[k];
+    __sync_fetch_and_sub(&darktable.opencl->dev[devid].cache_memory_in_use, size);
+    *mem = cache->gpu_mem[k];
+    cache->gpu_mem[k] = NULL;
+    return 0;
+  }
+  return _cache_download_gpu(cache, k);
+}
+
+void dt_dev_pixelpipe_cache_host_valid(dt_dev_pixelpipe_cache_t *cache, void *data)
+{
+  const int k = _cache_find_line(cache, data);
+  if(k < 0 || !cache->host_stale[k]) return;
+  _cache_release_gpu(cache, k);
+  cache->host_stale[k] = 0;
+}
+#endif
+
+void dt_dev_pixelpipe_cache_get_stats(const dt_dev_pixelpipe_cache_t *cache, dt_cache_stats_t *stats,
+                                      const char *name)
+{
+  memset(stats, 0, sizeof(*stats));
+  stats->name = name;
+  stats->unit = "bytes";
+  for(int k = 0; k < cache->entries; k++) stats->used += cache->size[k];
+  stats->quota = stats->used;
+  stats->hits = cache->queries - cache->misses;
+  stats->misses = cache->misses;
+}
+
+void dt_dev_pixelpipe_cache_store_get_stats(const dt_dev_pixelpipe_cache_store_t *store, dt_cache_stats_t *stats)
+{
+  memset(stats, 0, sizeof(*stats));
+  stats->name = "pixelpipe store";
+  stats->unit = "bytes";
+  stats->used = store->cost;
+  stats->quota = store->cost_quota;
+  stats->hits = store->hits;
+  stats->misses = store->queries - store->hits;
+  stats->evictions = store->evictions;
+}
+
 void dt_dev_pixelpipe_cache_print(dt_dev_pixelpipe_cache_t *cache)
 {
   for(int k = 0; k < cache->entries; k++)
@@ -234,6 +851,15 @@ void dt_dev_pixelpipe_cache_print(dt_dev_pixelpipe_cache_t *cache)
     printf("\n");
   }
   printf("cache hit rate so far: %.3f\n", (cache->queries - cache->misses) / (float)cache->queries);
+  if(cache->store)
+  {
+    dt_pthread_mutex_lock(&cache->store->lock);
+    printf("shared store: %u lines, %.1f/%.1f MB, hit rate so far: %.3f\n",
+           g_hash_table_size(cache->store->lines), cache->store->cost / (1024.0 * 1024.0),
+           cache->store->cost_quota / (1024.0 * 1024.0),
+           cache->store->hits / (float)MAX(cache->store->queries, 1));
+    dt_pthread_mutex_unlock(&cache->store->lock);
+  }
 }
 
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
@@ -18,7 +18,12 @@
 
 #pragma once
 
+#include "common/cache.h"
+#include "common/dtpthread.h"
+#include "common/memory.h"
+#include <glib.h>
 #include <inttypes.h>
+#include <stddef.h>
 
 struct dt_dev_pixelpipe_t;
 struct dt_iop_buffer_dsc_t;
@@ -28,8 +33,29 @@ struct dt_iop_roi_t;
  * implements a simple pixel cache suitable for caching float images
  * corresponding to history items and zoom/pan settings in the develop module.
  * it is optimized for very few entries (~5), so most operations are O(N).
+ *
+ * these few lines are the private working set of one pipe. they can be backed by
+ * a shared, byte-budgeted store (see below): lines evicted from the working set are
+ * handed over to the store instead of being overwritten, and a miss in the working
+ * set pulls the buffer back from the store if it is there.
  */
 
+/** shared by all pipes of a dt_develop_t, keyed by dt_dev_pixelpipe_cache_hash() and the pipe input. */
+typedef struct dt_dev_pixelpipe_cache_store_t
+{
+  dt_pthread_mutex_t lock;
+  GHashTable *lines; // key -> parked buffer, owned by the store and never referenced by a pipe
+  GQueue *lru;       // most recently used first
+  size_t cost;
+  size_t cost_quota;
+  size_t cost_quota_configured; // cost_quota shrinks while the system is short on memory
+  dt_memory_consumer_t memory; // gives back the least recently used buffers when memory runs out
+  // profiling:
+  uint64_t queries;
+  uint64_t hits;
+  uint64_t evictions; // lines dropped for space, not those taken back by a pipe
+} dt_dev_pixelpipe_cache_store_t;
+
 typedef struct dt_dev_pixelpipe_cache_t
 {
   int32_t entries;
@@ -38,9 +64,25 @@ typedef struct dt_dev_pixelpipe_cache_t
   struct dt_iop_buffer_dsc_t *dsc;
   uint64_t *hash;
   int32_t *used;
+  // run in which a line has been filled, 0 if its contents are known to be complete
+  uint32_t *generation;
+  uint32_t current_generation;
+  // optional shared backing store, and what identifies the input of the pipe in there
+  dt_dev_pixelpipe_cache_store_t *store;
+  uint64_t store_salt;
+  // hand float lines to the store as half floats, for pipes that don't need the precision
+  int half_store;
+  // buffer still shown on screen, never handed over to the store
+  const void *backbuf;
 #ifdef HAVE_OPENCL
+  // device copy of a line, and where it lives. if host_stale is set, only the device copy is valid.
   void **gpu_mem;
+  int32_t *gpu_devid;
+  int32_t *gpu_width, *gpu_height, *gpu_bpp;
+  int32_t *host_stale;
 #endif
+  // the host buffers of the lines in the memory budget
+  dt_memory_consumer_t memory;
   // profiling:
   uint64_t queries;
   uint64_t misses;
@@ -52,9 +94,28 @@ typedef struct dt_dev_pixelpipe_cache_t
 int dt_dev_pixelpipe_cache_init(dt_dev_pixelpipe_cache_t *cache, int entries, size_t size);
 void dt_dev_pixelpipe_cache_cleanup(dt_dev_pixelpipe_cache_t *cache);
 
-/** creates a hopefully unique hash from the complete module stack up to the module-th. */
+/** marks the start of a pipe run on the given input. salt identifies the input buffer, lines are shared
+ * through the store only between pipes with the same salt. */
+void dt_dev_pixelpipe_cache_begin(dt_dev_pixelpipe_cache_t *cache, const uint64_t salt);
+/** marks the end of a pipe run. if it succeeded, all lines filled during the run become eligible for the store. */
+void dt_dev_pixelpipe_cache_end(dt_dev_pixelpipe_cache_t *cache, const int success);
+
+/** constructs a shared store holding at most cost_quota bytes of buffers. returns 0 on failure. */
+int dt_dev_pixelpipe_cache_store_init(dt_dev_pixelpipe_cache_store_t *store, size_t cost_quota);
+void dt_dev_pixelpipe_cache_store_cleanup(dt_dev_pixelpipe_cache_store_t *store);
+/** drops all buffers in the store. */
+void dt_dev_pixelpipe_cache_store_flush(dt_dev_pixelpipe_cache_store_t *store);
+
+/** creates a hopefully unique hash from the complete module stack up to the module-th. the running hashes of
+ * the stack are kept in the pipe, so this is cheap except for the first call after a change. */
 uint64_t dt_dev_pixelpipe_cache_hash(int imgid, const struct dt_iop_roi_t *roi,
                                      struct dt_dev_pixelpipe_t *pipe, int module);
+/** drops the running hashes from piece on, after its params changed. */
+void dt_dev_pixelpipe_cache_hash_invalidate(struct dt_dev_pixelpipe_t *pipe,
+                                            const struct dt_dev_pixelpipe_iop_t *piece);
+/** drops the running hashes if the focused module or a color picker changed, which happens without a
+ * commit of params. called once per run of the pipe, before the hashes are used. */
+void dt_dev_pixelpipe_cache_hash_check(struct dt_dev_pixelpipe_t *pipe);
 
 /** returns the float data buffer for the given hash from the cache. if the hash does not match any
   * cache line, the least recently used cache line will be cleared and an empty buffer is returned
@@ -66,7 +127,8 @@ int dt_dev_pixelpipe_cache_get_important(dt_dev_pixelpipe_cache_t *cache, const
 int dt_dev_pixelpipe_cache_get_weighted(dt_dev_pixelpipe_cache_t *cache, const uint64_t hash, const size_t size,
                                         void **data, struct dt_iop_buffer_dsc_t **dsc, int weight);
 
-/** test availability of a cache line without destroying another, if it is not found. */
+/** test availability of a cache line without destroying another, if it is not found.
+ * if the line is only found in the shared store, it is moved back into the working set. */
 int dt_dev_pixelpipe_cache_available(dt_dev_pixelpipe_cache_t *cache, const uint64_t hash);
 
 /** invalidates all cachelines. */
@@ -78,6 +140,26 @@ void dt_dev_pixelpipe_cache_reweight(dt_dev_pixelpipe_cache_t *cache, void *data
 /** mark the given cache line pointer as invalid. */
 void dt_dev_pixelpipe_cache_invalidate(dt_dev_pixelpipe_cache_t *cache, void *data);
 
+#ifdef HAVE_OPENCL
+/** hands the device buffer holding the contents of the cache line at data over to the cache, instead of
+ * copying it back to host memory. returns non-zero if the cache took ownership of mem. */
+int dt_dev_pixelpipe_cache_keep_gpu(dt_dev_pixelpipe_cache_t *cache, void *data, void *mem, const int devid,
+                                    const int width, const int height, const int bpp);
+/** to be called after a cache hit on data. if the line is only valid on a device, either passes the device
+ * buffer on to the caller through *mem (if it lives on devid, the caller has to hand it back with
+ * dt_dev_pixelpipe_cache_keep_gpu() or mark the host copy valid), or copies it to host memory. returns
+ * non-zero on opencl errors. */
+int dt_dev_pixelpipe_cache_take_gpu(dt_dev_pixelpipe_cache_t *cache, void *data, const int devid, void **mem);
+/** the host copy of the cache line at data has been brought up to date. */
+void dt_dev_pixelpipe_cache_host_valid(dt_dev_pixelpipe_cache_t *cache, void *data);
+#endif
+
+/** fills stats with the current numbers of the working set, read without locking. */
+void dt_dev_pixelpipe_cache_get_stats(const dt_dev_pixelpipe_cache_t *cache, dt_cache_stats_t *stats,
+                                      const char *name);
+/** same for the shared store. */
+void dt_dev_pixelpipe_cache_store_get_stats(const dt_dev_pixelpipe_cache_store_t *store, dt_cache_stats_t *stats);
+
 /** print out cache lines/hashes (debug). */
 void dt_dev_pixelpipe_cache_print(dt_dev_pixelpipe_cache_t *cache);
 
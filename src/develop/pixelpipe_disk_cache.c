@@ -0,0 +1,265 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2017 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "develop/pixelpipe_disk_cache.h"
+#include "common/darktable.h"
+#include "common/file_location.h"
+#include "common/image.h"
+#include "control/conf.h"
+#include "control/jobs.h"
+#include "develop/format.h"
+#include "develop/imageop.h"
+#include "develop/pixelpipe_hb.h"
+
+#include <glib/gstdio.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#define DT_PIXELPIPE_DISK_CACHE_MAGIC 0x31707464u // "dtp1"
+
+typedef struct dt_dev_pixelpipe_disk_cache_header_t
+{
+  uint32_t magic;
+  uint32_t dsc_size; // sizeof(dt_iop_buffer_dsc_t) of the writer
+  uint64_t size;
+  dt_iop_buffer_dsc_t dsc;
+} dt_dev_pixelpipe_disk_cache_header_t;
+
+typedef struct dt_dev_pixelpipe_disk_cache_job_t
+{
+  uint64_t key;
+  void *data;
+  size_t size;
+  dt_iop_buffer_dsc_t dsc;
+} dt_dev_pixelpipe_disk_cache_job_t;
+
+typedef struct dt_dev_pixelpipe_disk_cache_file_t
+{
+  gchar *filename;
+  off_t size;
+  time_t mtime;
+} dt_dev_pixelpipe_disk_cache_file_t;
+
+// configuration needs a restart, so read it once.
+static struct
+{
+  char op[20];
+  char dir[PATH_MAX];
+  size_t budget;
+  GMutex lock; // serializes eviction
+} _disk_cache = { { 0 } };
+
+static void _disk_cache_setup()
+{
+  static gsize done = 0;
+  if(!g_once_init_enter(&done)) return;
+
+  g_mutex_init(&_disk_cache.lock);
+  gchar *op = dt_conf_get_string("cache_pixelpipe_checkpoint");
+  const int64_t budget = dt_conf_get_int64("cache_pixelpipe_disk_budget");
+  char cachedir[PATH_MAX] = { 0 };
+  dt_loc_get_user_cache_dir(cachedir, sizeof(cachedir));
+  snprintf(_disk_cache.dir, sizeof(_disk_cache.dir), "%s/pixelpipe", cachedir);
+  if(op && *op && budget > 0 && g_mkdir_with_parents(_disk_cache.dir, 0750) == 0)
+  {
+    g_strlcpy(_disk_cache.op, op, sizeof(_disk_cache.op));
+    _disk_cache.budget = budget;
+  }
+  g_free(op);
+
+  g_once_init_leave(&done, 1);
+}
+
+static void _disk_cache_filename(const uint64_t key, char *filename, const size_t len)
+{
+  snprintf(filename, len, "%s/%016" PRIx64 ".dtpc", _disk_cache.dir, key);
+}
+
+int dt_dev_pixelpipe_disk_cache_is_checkpoint(const dt_dev_pixelpipe_t *pipe, const dt_iop_module_t *module)
+{
+  if(!module || (pipe->type != DT_DEV_PIXELPIPE_FULL && pipe->type != DT_DEV_PIXELPIPE_PREVIEW)) return 0;
+  _disk_cache_setup();
+  return _disk_cache.budget && !strcmp(module->op, _disk_cache.op);
+}
+
+uint64_t dt_dev_pixelpipe_disk_cache_key(const dt_dev_pixelpipe_t *pipe, const uint64_t hash)
+{
+  // a changed or replaced raw must not pick up old buffers
+  char filename[PATH_MAX] = { 0 };
+  gboolean from_cache = FALSE;
+  dt_image_full_path(pipe->image.id, filename, sizeof(filename), &from_cache);
+  struct stat st = { 0 };
+  if(g_stat(filename, &st)) st.st_mtime = 0;
+
+  uint64_t key = ((hash << 5) + hash) ^ pipe->cache.store_salt;
+  key = ((key << 5) + key) ^ (uint64_t)st.st_mtime;
+  return key;
+}
+
+int dt_dev_pixelpipe_disk_cache_read(const uint64_t key, void *data, const size_t size, dt_iop_buffer_dsc_t *dsc)
+{
+  _disk_cache_setup();
+  if(!_disk_cache.budget) return 1;
+
+  char filename[PATH_MAX] = { 0 };
+  _disk_cache_filename(key, filename, sizeof(filename));
+  FILE *f = g_fopen(filename, "rb");
+  if(!f) return 1;
+
+  int res = 1;
+  dt_dev_pixelpipe_disk_cache_header_t header;
+  if(fread(&header, sizeof(header), 1, f) == 1 && header.magic == DT_PIXELPIPE_DISK_CACHE_MAGIC
+     && header.dsc_size == sizeof(dt_iop_buffer_dsc_t) && header.size == size
+     && fread(data, 1, size, f) == size)
+  {
+    *dsc = header.dsc;
+    res = 0;
+  }
+  fclose(f);
+
+  if(res)
+    g_unlink(filename);
+  else
+    g_utime(filename, NULL); // mark as recently used
+  return res;
+}
+
+static gint _disk_cache_file_cmp(gconstpointer a, gconstpointer b)
+{
+  const dt_dev_pixelpipe_disk_cache_file_t *fa = (const dt_dev_pixelpipe_disk_cache_file_t *)a;
+  const dt_dev_pixelpipe_disk_cache_file_t *fb = (const dt_dev_pixelpipe_disk_cache_file_t *)b;
+  return (fa->mtime > fb->mtime) - (fa->mtime < fb->mtime);
+}
+
+static void _disk_cache_file_free(gpointer data)
+{
+  dt_dev_pixelpipe_disk_cache_file_t *file = (dt_dev_pixelpipe_disk_cache_file_t *)data;
+  g_free(file->filename);
+  free(file);
+}
+
+// drop least recently used files until we're within budget
+static void _disk_cache_evict()
+{
+  GDir *dir = g_dir_open(_disk_cache.dir, 0, NULL);
+  if(!dir) return;
+
+  GList *files = NULL;
+  size_t total = 0;
+  const gchar *name;
+  while((name = g_dir_read_name(dir)))
+  {
+    if(!g_str_has_suffix(name, ".dtpc")) continue;
+    gchar *filename = g_build_filename(_disk_cache.dir, name, NULL);
+    struct stat st;
+    if(g_stat(filename, &st))
+    {
+      g_free(filename);
+      continue;
+    }
+    dt_dev_pixelpipe_disk_cache_file_t *file
+        = (dt_dev_pixelpipe_disk_cache_file_t *)malloc(sizeof(dt_dev_pixelpipe_disk_cache_file_t));
+    file->filename = filename;
+    file->size = st.st_size;
+    file->mtime = st.st_mtime;
+    files = g_list_prepend(files, file);
+    total += st.st_size;
+  }
+  g_dir_close(dir);
+
+  files = g_list_sort(files, _disk_cache_file_cmp);
+  for(GList *f = files; f && total > _disk_cache.budget; f = g_list_next(f))
+  {
+    dt_dev_pixelpipe_disk_cache_file_t *file = (dt_dev_pixelpipe_disk_cache_file_t *)f->data;
+    if(!g_unlink(file->filename)) total -= file->size;
+  }
+  g_list_free_full(files, _disk_cache_file_free);
+}
+
+static void _disk_cache_job_free(void *data)
+{
+  dt_dev_pixelpipe_disk_cache_job_t *params = (dt_dev_pixelpipe_disk_cache_job_t *)data;
+  dt_free_align(params->data);
+  free(params);
+}
+
+static int32_t _disk_cache_write_job_run(dt_job_t *job)
+{
+  dt_dev_pixelpipe_disk_cache_job_t *params = (dt_dev_pixelpipe_disk_cache_job_t *)dt_control_job_get_params(job);
+
+  char filename[PATH_MAX] = { 0 }, tmpname[PATH_MAX] = { 0 };
+  _disk_cache_filename(params->key, filename, sizeof(filename));
+  snprintf(tmpname, sizeof(tmpname), "%s.tmp", filename);
+
+  FILE *f = g_fopen(tmpname, "wb");
+  if(!f) return 1;
+  dt_dev_pixelpipe_disk_cache_header_t header = { DT_PIXELPIPE_DISK_CACHE_MAGIC, sizeof(dt_iop_buffer_dsc_t),
+                                                  params->size, params->dsc };
+  const int ok = fwrite(&header, sizeof(header), 1, f) == 1
+                 && fwrite(params->data, 1, params->size, f) == params->size;
+  if(fclose(f) || !ok || g_rename(tmpname, filename))
+  {
+    g_unlink(tmpname);
+    return 1;
+  }
+
+  g_mutex_lock(&_disk_cache.lock);
+  _disk_cache_evict();
+  g_mutex_unlock(&_disk_cache.lock);
+  return 0;
+}
+
+void dt_dev_pixelpipe_disk_cache_write(const uint64_t key, const void *data, const size_t size,
+                                       const dt_iop_buffer_dsc_t *dsc)
+{
+  _disk_cache_setup();
+  if(!_disk_cache.budget || size > _disk_cache.budget || !darktable.control) return;
+
+  char filename[PATH_MAX] = { 0 };
+  _disk_cache_filename(key, filename, sizeof(filename));
+  if(g_file_test(filename, G_FILE_TEST_EXISTS)) return;
+
+  dt_dev_pixelpipe_disk_cache_job_t *params
+      = (dt_dev_pixelpipe_disk_cache_job_t *)calloc(1, sizeof(dt_dev_pixelpipe_disk_cache_job_t));
+  if(!params) return;
+  params->data = dt_alloc_align(64, size);
+  if(!params->data)
+  {
+    free(params);
+    return;
+  }
+  memcpy(params->data, data, size);
+  params->key = key;
+  params->size = size;
+  params->dsc = *dsc;
+
+  dt_job_t *job = dt_control_job_create(&_disk_cache_write_job_run, "write pixelpipe checkpoint");
+  if(!job)
+  {
+    _disk_cache_job_free(params);
+    return;
+  }
+  dt_control_job_set_params(job, params, _disk_cache_job_free);
+  dt_control_add_job(darktable.control, DT_JOB_QUEUE_SYSTEM_BG, job);
+}
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
@@ -0,0 +1,53 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2017 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <inttypes.h>
+#include <stddef.h>
+
+struct dt_dev_pixelpipe_t;
+struct dt_iop_buffer_dsc_t;
+struct dt_iop_module_t;
+
+/**
+ * persistent tier underneath the pixelpipe cache. the output of one expensive
+ * "checkpoint" module (conf key cache_pixelpipe_checkpoint, e.g. demosaic) of the
+ * darkroom pipes is written to the user cache dir, so reopening an image can start
+ * processing right after it. files are evicted in lru order to stay within
+ * cache_pixelpipe_disk_budget bytes.
+ */
+
+/** non-zero if the output of module in pipe should go to the disk cache. */
+int dt_dev_pixelpipe_disk_cache_is_checkpoint(const struct dt_dev_pixelpipe_t *pipe,
+                                              const struct dt_iop_module_t *module);
+
+/** combines the pixelpipe cache hash with pipe input and the modification time of the image file. */
+uint64_t dt_dev_pixelpipe_disk_cache_key(const struct dt_dev_pixelpipe_t *pipe, const uint64_t hash);
+
+/** reads the buffer for key into data, which has to hold size bytes. returns 0 on success. */
+int dt_dev_pixelpipe_disk_cache_read(const uint64_t key, void *data, const size_t size,
+                                     struct dt_iop_buffer_dsc_t *dsc);
+
+/** copies data and writes it to disk in the background. */
+void dt_dev_pixelpipe_disk_cache_write(const uint64_t key, const void *data, const size_t size,
+                                       const struct dt_iop_buffer_dsc_t *dsc);
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
@@ -17,17 +17,26 @@
     You should have received a copy of the GNU General Public License
     along with darktable.  If not, see <http://www.gnu.org/licenses/>.
 */
+#include "common/buffer_pool.h"
 #include "common/color_picker.h"
 #include "common/colorspaces.h"
+#include "common/compute.h"
 #include "common/histogram.h"
 #include "common/imageio.h"
+#include "common/interpolation.h"
+#include "common/memory.h"
 #include "common/opencl.h"
+#include "common/timers.h"
+#include "common/trace.h"
+#include "control/conf.h"
 #include "control/control.h"
 #include "control/signal.h"
 #include "develop/blend.h"
 #include "develop/format.h"
 #include "develop/imageop_math.h"
 #include "develop/pixelpipe.h"
+#include "develop/pixelpipe_disk_cache.h"
+#include "develop/pixelpipe_routing.h"
 #include "develop/tiling.h"
 #include "gui/gtk.h"
 #include "libs/colorpicker.h"
@@ -97,6 +106,17 @@ int dt_dev_pixelpipe_init_export(dt_dev_pixelpipe_t *pipe, int32_t width, int32_
   return res;
 }
 
+int dt_dev_pixelpipe_init_export_streaming(dt_dev_pixelpipe_t *pipe, int levels)
+{
+  // lines are tile sized and allocated on demand. two are working set, the rest keep the full outputs of
+  // the barrier modules.
+  int res = dt_dev_pixelpipe_init_cached(pipe, 0, 2 + DT_DEV_PIXELPIPE_STREAMING_MAX_BARRIERS);
+  pipe->type = DT_DEV_PIXELPIPE_EXPORT;
+  pipe->levels = levels;
+  pipe->tile_streaming = 1;
+  return res;
+}
+
 int dt_dev_pixelpipe_init_thumbnail(dt_dev_pixelpipe_t *pipe, int32_t width, int32_t height)
 {
   int res = dt_dev_pixelpipe_init_cached(pipe, 4 * sizeof(float) * width * height, 2);
@@ -144,6 +164,10 @@ int dt_dev_pixelpipe_init_cached(dt_dev_pixelpipe_t *pipe, size_t size, int32_t
   pipe->shutdown = 0;
   pipe->opencl_error = 0;
   pipe->tiling = 0;
+  pipe->tile_streaming = 0;
+  memset(&pipe->dirty, 0, sizeof(pipe->dirty));
+  memset(&pipe->report, 0, sizeof(pipe->report));
+  memset(&pipe->prefix, 0, sizeof(pipe->prefix));
   pipe->mask_display = DT_DEV_PIXELPIPE_DISPLAY_NONE;
   pipe->input_timestamp = 0;
   pipe->levels = IMAGEIO_RGB | IMAGEIO_INT8;
@@ -167,10 +191,15 @@ void dt_dev_pixelpipe_cleanup(dt_dev_pixelpipe_t *pipe)
 {
   dt_pthread_mutex_lock(&pipe->backbuf_mutex);
   pipe->backbuf = NULL;
+  pipe->cache.backbuf = NULL;
   // blocks while busy and sets shutdown bit:
   dt_dev_pixelpipe_cleanup_nodes(pipe);
   // so now it's safe to clean up cache:
   dt_dev_pixelpipe_cache_cleanup(&(pipe->cache));
+  dt_dev_pixelpipe_report_cleanup(pipe);
+  free(pipe->prefix.hash);
+  pipe->prefix.hash = NULL;
+  pipe->prefix.size = pipe->prefix.valid = 0;
   dt_pthread_mutex_unlock(&pipe->backbuf_mutex);
   dt_pthread_mutex_destroy(&(pipe->backbuf_mutex));
   dt_pthread_mutex_destroy(&(pipe->busy_mutex));
@@ -198,6 +227,7 @@ void dt_dev_pixelpipe_cleanup_nodes(dt_dev_pixelpipe_t *pipe)
   }
   g_list_free(pipe->nodes);
   pipe->nodes = NULL;
+  pipe->prefix.valid = 0;
   dt_pthread_mutex_unlock(&pipe->busy_mutex);
 }
 
@@ -205,6 +235,7 @@ void dt_dev_pixelpipe_create_nodes(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev)
 {
   dt_pthread_mutex_lock(&pipe->busy_mutex);
   pipe->shutdown = 0;
+  pipe->dirty.valid = 0;
   g_assert(pipe->nodes == NULL);
   // for all modules in dev:
   GList *modules = dev->iop;
@@ -218,6 +249,7 @@ void dt_dev_pixelpipe_create_nodes(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev)
       piece->request_histogram = DT_REQUEST_ONLY_IN_GUI;
       piece->histogram_params.roi = NULL;
       piece->histogram_params.bins_count = 256;
+      piece->histogram_params.step = 0;
       piece->histogram_stats.bins_count = 0;
       piece->histogram_stats.pixels = 0;
       piece->colors
@@ -239,6 +271,44 @@ void dt_dev_pixelpipe_create_nodes(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev)
   dt_pthread_mutex_unlock(&pipe->busy_mutex);
 }
 
+int dt_dev_pixelpipe_renew_nodes(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev)
+{
+  GList *nodes = pipe->nodes;
+  const GList *modules = dev->iop;
+  while(nodes && modules && ((dt_dev_pixelpipe_iop_t *)nodes->data)->module == modules->data)
+  {
+    nodes = g_list_next(nodes);
+    modules = g_list_next(modules);
+  }
+  if(nodes || modules || !pipe->nodes)
+  {
+    dt_dev_pixelpipe_cleanup_nodes(pipe);
+    dt_dev_pixelpipe_create_nodes(pipe, dev);
+    return 0;
+  }
+
+  // what create_nodes() takes from the image, the params come with the next synch
+  dt_pthread_mutex_lock(&pipe->busy_mutex);
+  pipe->shutdown = 0;
+  pipe->dirty.valid = 0;
+  pipe->prefix.valid = 0;
+  for(nodes = pipe->nodes; nodes; nodes = g_list_next(nodes))
+  {
+    dt_dev_pixelpipe_iop_t *piece = (dt_dev_pixelpipe_iop_t *)nodes->data;
+    piece->enabled = piece->module->enabled;
+    piece->colors
+        = ((dt_iop_module_colorspace(piece->module) == iop_cs_RAW) && (pipe->image.flags & DT_IMAGE_RAW)) ? 1 : 4;
+    piece->iscale = pipe->iscale;
+    piece->iwidth = pipe->iwidth;
+    piece->iheight = pipe->iheight;
+    piece->hash = 0;
+    piece->process_cl_ready = 0;
+    piece->process_tiling_ready = 0;
+  }
+  dt_pthread_mutex_unlock(&pipe->busy_mutex);
+  return 1;
+}
+
 // helper
 void dt_dev_pixelpipe_synch(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, GList *history)
 {
@@ -266,7 +336,6 @@ void dt_dev_pixelpipe_synch_all(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev)
   while(nodes)
   {
     dt_dev_pixelpipe_iop_t *piece = (dt_dev_pixelpipe_iop_t *)nodes->data;
-    piece->hash = 0;
     piece->enabled = piece->module->default_enabled;
     dt_iop_commit_params(piece->module, piece->module->default_params, piece->module->default_blendop_params,
                          pipe, piece);
@@ -342,24 +411,35 @@ static void get_output_format(dt_iop_module_t *module, dt_dev_pixelpipe_t *pipe,
 }
 
 
-// helper to get per module histogram
-static void histogram_collect(dt_dev_pixelpipe_iop_t *piece, const void *pixel, const dt_iop_roi_t *roi,
-                              uint32_t **histogram, uint32_t *histogram_max)
+// parameters of a histogram of roi, sampling a part of the pixels in the preview pipe
+static void histogram_params_roi(const dt_dev_pixelpipe_iop_t *piece, const dt_iop_roi_t *roi,
+                                 dt_dev_histogram_collection_params_t *histogram_params,
+                                 dt_histogram_roi_t *histogram_roi)
 {
-  dt_dev_histogram_collection_params_t histogram_params = piece->histogram_params;
-
-  dt_histogram_roi_t histogram_roi;
-
   // if the current module does did not specified its own ROI, use the full ROI
-  if(histogram_params.roi == NULL)
+  if(histogram_params->roi == NULL)
   {
-    histogram_roi = (dt_histogram_roi_t){
+    *histogram_roi = (dt_histogram_roi_t){
       .width = roi->width, .height = roi->height, .crop_x = 0, .crop_y = 0, .crop_width = 0, .crop_height = 0
     };
 
-    histogram_params.roi = &histogram_roi;
+    histogram_params->roi = histogram_roi;
   }
 
+  // the histograms of the preview pipe are drawn, their shape is all that counts
+  if(piece->pipe->type == DT_DEV_PIXELPIPE_PREVIEW && histogram_params->step == 0)
+    histogram_params->step = dt_histogram_preview_step(histogram_params->roi, histogram_params->bins_count);
+}
+
+// helper to get per module histogram
+static void histogram_collect(dt_dev_pixelpipe_iop_t *piece, const void *pixel, const dt_iop_roi_t *roi,
+                              uint32_t **histogram, uint32_t *histogram_max)
+{
+  dt_dev_histogram_collection_params_t histogram_params = piece->histogram_params;
+
+  dt_histogram_roi_t histogram_roi;
+  histogram_params_roi(piece, roi, &histogram_params, &histogram_roi);
+
   const dt_iop_colorspace_type_t cst = dt_iop_module_colorspace(piece->module);
 
   dt_histogram_helper(&histogram_params, &piece->histogram_stats, cst, pixel, histogram);
@@ -369,50 +449,45 @@ static void histogram_collect(dt_dev_pixelpipe_iop_t *piece, const void *pixel,
 #ifdef HAVE_OPENCL
 // helper to get per module histogram for OpenCL
 //
-// this algorithm is inefficient as hell when it comes to larger images. it's only acceptable
-// as long as we work on small image sizes like in image preview
+// the bins are counted on the device. only if it can't do that the image is copied to the host, which is
+// inefficient as hell for larger images.
 static void histogram_collect_cl(int devid, dt_dev_pixelpipe_iop_t *piece, cl_mem img,
                                  const dt_iop_roi_t *roi, uint32_t **histogram, uint32_t *histogram_max,
                                  float *buffer, size_t bufsize)
 {
-  float *tmpbuf = NULL;
-  float *pixel;
+  dt_dev_histogram_collection_params_t histogram_params = piece->histogram_params;
 
-  // if buffer is supplied and if size fits let's use it
-  if(buffer && bufsize >= (size_t)roi->width * roi->height * 4 * sizeof(float))
-    pixel = buffer;
-  else
-    pixel = tmpbuf = dt_alloc_align(64, (size_t)roi->width * roi->height * 4 * sizeof(float));
+  dt_histogram_roi_t histogram_roi;
+  histogram_params_roi(piece, roi, &histogram_params, &histogram_roi);
 
-  if(!pixel) return;
+  const dt_iop_colorspace_type_t cst = dt_iop_module_colorspace(piece->module);
 
-  cl_int err = dt_opencl_copy_device_to_host(devid, pixel, img, roi->width, roi->height, 4 * sizeof(float));
-  if(err != CL_SUCCESS)
+  if(!dt_histogram_helper_cl(devid, &histogram_params, &piece->histogram_stats, cst, img, histogram))
   {
-    if(tmpbuf) dt_free_align(tmpbuf);
-    return;
-  }
+    float *tmpbuf = NULL;
+    float *pixel;
 
-  dt_dev_histogram_collection_params_t histogram_params = piece->histogram_params;
+    // if buffer is supplied and if size fits let's use it
+    if(buffer && bufsize >= (size_t)roi->width * roi->height * 4 * sizeof(float))
+      pixel = buffer;
+    else
+      pixel = tmpbuf = dt_alloc_align(64, (size_t)roi->width * roi->height * 4 * sizeof(float));
 
-  dt_histogram_roi_t histogram_roi;
+    if(!pixel) return;
 
-  // if the current module does did not specified its own ROI, use the full ROI
-  if(histogram_params.roi == NULL)
-  {
-    histogram_roi = (dt_histogram_roi_t){
-      .width = roi->width, .height = roi->height, .crop_x = 0, .crop_y = 0, .crop_width = 0, .crop_height = 0
-    };
+    cl_int err = dt_opencl_copy_device_to_host(devid, pixel, img, roi->width, roi->height, 4 * sizeof(float));
+    if(err != CL_SUCCESS)
+    {
+      if(tmpbuf) dt_free_align(tmpbuf);
+      return;
+    }
 
-    histogram_params.roi = &histogram_roi;
-  }
+    dt_histogram_helper(&histogram_params, &piece->histogram_stats, cst, pixel, histogram);
 
-  const dt_iop_colorspace_type_t cst = dt_iop_module_colorspace(piece->module);
+    if(tmpbuf) dt_free_align(tmpbuf);
+  }
 
-  dt_histogram_helper(&histogram_params, &piece->histogram_stats, cst, pixel, histogram);
   dt_histogram_max_helper(&piece->histogram_stats, cst, histogram, histogram_max);
-
-  if(tmpbuf) dt_free_align(tmpbuf);
 }
 #endif
 
@@ -561,6 +636,607 @@ error:
 
 
 // recursive helper for process:
+static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, void **output,
+                                        void **cl_mem_output, dt_iop_buffer_dsc_t **out_format,
+                                        const dt_iop_roi_t *roi_out, GList *modules, GList *pieces, int pos);
+static int dt_dev_pixelpipe_process_rec_and_backcopy(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, void **output,
+                                                     void **cl_mem_output, dt_iop_buffer_dsc_t **out_format,
+                                                     const dt_iop_roi_t *roi_out, GList *modules, GList *pieces,
+                                                     int pos);
+
+static inline int _streaming_barrier(const dt_dev_pixelpipe_t *pipe, const dt_iop_module_t *module)
+{
+  return pipe->tile_streaming && module && (module->flags() & IOP_FLAGS_NO_TILE_STREAMING);
+}
+
+// copies the part of in that overlaps roi_out to out, clears the rest.
+static void _copy_roi(void *out, const dt_iop_roi_t *roi_out, const void *in, const dt_iop_roi_t *roi_in,
+                      const size_t bpp)
+{
+  const int x = roi_out->x - roi_in->x, y = roi_out->y - roi_in->y;
+  const int cp_x = MAX(x, 0), cp_y = MAX(y, 0);
+  const int cp_width = MIN(roi_out->width - (cp_x - x), roi_in->width - cp_x);
+  const int cp_height = MIN(roi_out->height - (cp_y - y), roi_in->height - cp_y);
+  memset(out, 0, bpp * roi_out->width * roi_out->height);
+  if(cp_width <= 0) return;
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static) default(none) shared(out, in, roi_out, roi_in)
+#endif
+  for(int j = 0; j < cp_height; j++)
+    memcpy((char *)out + bpp * ((size_t)(cp_y - y + j) * roi_out->width + (cp_x - x)),
+           (const char *)in + bpp * ((size_t)(cp_y + j) * roi_in->width + cp_x), bpp * cp_width);
+}
+
+// tile streaming: the module needs to see all of its input. run it once on the full region, keep that
+// output in the cache for good and cut the tile out of it.
+static int _process_streaming_barrier(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, void **output,
+                                      void **cl_mem_output, dt_iop_buffer_dsc_t **out_format,
+                                      const dt_iop_roi_t *roi_out, const dt_iop_roi_t *roi_full,
+                                      GList *modules, GList *pieces, int pos)
+{
+  void *full = NULL;
+  if(dt_dev_pixelpipe_process_rec_and_backcopy(pipe, dev, &full, cl_mem_output, out_format, roi_full, modules,
+                                               pieces, pos))
+    return 1;
+  const dt_iop_buffer_dsc_t format = **out_format;
+  const size_t bpp = dt_iop_buffer_dsc_to_bpp(&format);
+
+  dt_pthread_mutex_lock(&pipe->busy_mutex);
+  if(pipe->shutdown)
+  {
+    dt_pthread_mutex_unlock(&pipe->busy_mutex);
+    return 1;
+  }
+  // the full line must outlive all the tiles: a weight this low never ages into eviction
+  const uint64_t full_hash = dt_dev_pixelpipe_cache_hash(pipe->image.id, roi_full, pipe, pos);
+  dt_iop_buffer_dsc_t *full_format = NULL;
+  (void)dt_dev_pixelpipe_cache_get_weighted(&(pipe->cache), full_hash, bpp * roi_full->width * roi_full->height,
+                                            &full, &full_format, -(1 << 30));
+
+  const uint64_t hash = dt_dev_pixelpipe_cache_hash(pipe->image.id, roi_out, pipe, pos);
+  const size_t bufsize = bpp * roi_out->width * roi_out->height;
+  (void)dt_dev_pixelpipe_cache_get(&(pipe->cache), hash, bufsize, output, out_format);
+  **out_format = format;
+  _copy_roi(*output, roi_out, full, roi_full, bpp);
+  dt_pthread_mutex_unlock(&pipe->busy_mutex);
+  return 0;
+}
+
+// gets a cache line by hash without knowing its size. busy_mutex has to be held.
+static int _cache_get_line(dt_dev_pixelpipe_t *pipe, const uint64_t hash, const int width, const int height,
+                           void **data, dt_iop_buffer_dsc_t **format)
+{
+  if(!dt_dev_pixelpipe_cache_available(&(pipe->cache), hash)) return 1;
+  (void)dt_dev_pixelpipe_cache_get(&(pipe->cache), hash, 0, data, format);
+  (void)dt_dev_pixelpipe_cache_get(&(pipe->cache), hash, dt_iop_buffer_dsc_to_bpp(*format) * width * height,
+                                   data, format);
+#ifdef HAVE_OPENCL
+  void *mem = NULL;
+  if(dt_dev_pixelpipe_cache_take_gpu(&(pipe->cache), *data, -1, &mem)) return 1;
+#endif
+  return 0;
+}
+
+// patching after a local edit: the input of the edited module is cut out of what the last complete run gave
+// it, if that's still cached. returns 1 if output holds the input now.
+static int _process_patch_source(dt_dev_pixelpipe_t *pipe, void **output, dt_iop_buffer_dsc_t **out_format,
+                                 const dt_iop_roi_t *roi_out, const uint64_t hash)
+{
+  const dt_iop_roi_t *src = &pipe->dirty.src_roi;
+  if(roi_out->scale != src->scale || roi_out->x < src->x || roi_out->y < src->y
+     || roi_out->x + roi_out->width > src->x + src->width || roi_out->y + roi_out->height > src->y + src->height)
+    return 0;
+
+  dt_pthread_mutex_lock(&pipe->busy_mutex);
+  void *full = NULL;
+  dt_iop_buffer_dsc_t *full_format = NULL;
+  if(pipe->shutdown || _cache_get_line(pipe, pipe->dirty.src_hash, src->width, src->height, &full, &full_format))
+  {
+    dt_pthread_mutex_unlock(&pipe->busy_mutex);
+    return 0;
+  }
+  const dt_iop_buffer_dsc_t format = *full_format;
+  const size_t bpp = dt_iop_buffer_dsc_to_bpp(&format);
+  (void)dt_dev_pixelpipe_cache_get(&(pipe->cache), hash, bpp * roi_out->width * roi_out->height, output,
+                                   out_format);
+  **out_format = format;
+  _copy_roi(*output, roi_out, full, src, bpp);
+  dt_pthread_mutex_unlock(&pipe->busy_mutex);
+  return 1;
+}
+
+#define DT_DEV_PIXELPIPE_FUSION_MAX 16
+// bytes of the widest buffer per thread processed by one fused block, about what stays in l2
+#define DT_DEV_PIXELPIPE_FUSION_BLOCK (256 << 10)
+
+// can module run inside a fused run of pointwise modules? the focused module picks colors and keeps its
+// input cached, histograms, blending and the checkpoint need the whole buffer between two modules.
+// returns 2 for a module that crops, like rawprepare on the mosaic. it can only start the run: it reads the
+// rows of the larger roi_in at its own offset, and the modules before it see other coordinates.
+static int _fusable(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, dt_iop_module_t *module,
+                    dt_dev_pixelpipe_iop_t *piece, const dt_iop_roi_t *roi, dt_iop_roi_t *roi_in)
+{
+  const int flags = module->flags();
+  if(!(flags & (IOP_FLAGS_POINTWISE | IOP_FLAGS_POINTWISE_CROP))) return 0;
+  if(module == dev->gui_module || (piece->request_histogram & DT_REQUEST_ON)) return 0;
+  const dt_develop_blend_params_t *const bp = (const dt_develop_blend_params_t *)piece->blendop_data;
+  if(bp && (bp->mask_mode & DEVELOP_MASK_ENABLED)) return 0;
+  if(dt_dev_pixelpipe_disk_cache_is_checkpoint(pipe, module) || _streaming_barrier(pipe, module)) return 0;
+  *roi_in = *roi;
+  module->modify_roi_in(module, piece, roi, roi_in);
+  if(!memcmp(roi_in, roi, sizeof(dt_iop_roi_t))) return 1;
+  return (flags & IOP_FLAGS_POINTWISE_CROP) && roi_in->x == roi->x && roi_in->y == roi->y
+                 && roi_in->scale == roi->scale && roi_in->width >= roi->width && roi_in->height >= roi->height
+             ? 2
+             : 0;
+}
+
+// walks back from the current module and collects the run of fusable modules ending in it, in pipe order.
+// leaves modules, pieces and pos at the place the input of the run comes from, and roi_in at its region.
+static int _fusion_run(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, const dt_iop_roi_t *roi, GList **modules,
+                       GList **pieces, int *pos, dt_iop_module_t **run_modules, dt_dev_pixelpipe_iop_t **run_pieces,
+                       dt_iop_roi_t *roi_in)
+{
+  dt_iop_module_t *rev_modules[DT_DEV_PIXELPIPE_FUSION_MAX];
+  dt_dev_pixelpipe_iop_t *rev_pieces[DT_DEV_PIXELPIPE_FUSION_MAX];
+  int n = 0;
+  int cropped = 0;
+  *roi_in = *roi;
+  while(*modules && n < DT_DEV_PIXELPIPE_FUSION_MAX && !cropped)
+  {
+    dt_iop_module_t *module = (dt_iop_module_t *)(*modules)->data;
+    dt_dev_pixelpipe_iop_t *piece = (dt_dev_pixelpipe_iop_t *)(*pieces)->data;
+    if(piece->enabled
+       && !(dev->gui_module && dev->gui_module->operation_tags_filter() & module->operation_tags()))
+    {
+      dt_iop_roi_t module_roi_in;
+      const int fusable = _fusable(pipe, dev, module, piece, roi, &module_roi_in);
+      if(!fusable) break;
+      // better start from an output we still have
+      if(n && dt_dev_pixelpipe_cache_available(&(pipe->cache),
+                                               dt_dev_pixelpipe_cache_hash(pipe->image.id, roi, pipe, *pos)))
+        break;
+      rev_modules[n] = module;
+      rev_pieces[n] = piece;
+      n++;
+      if(fusable == 2)
+      {
+        *roi_in = module_roi_in;
+        cropped = 1;
+      }
+    }
+    *modules = g_list_previous(*modules);
+    *pieces = g_list_previous(*pieces);
+    (*pos)--;
+  }
+  for(int k = 0; k < n; k++)
+  {
+    run_modules[k] = rev_modules[n - 1 - k];
+    run_pieces[k] = rev_pieces[n - 1 - k];
+  }
+  return n;
+}
+
+// runs all modules of the run on one block of rows before going on to the next, so the intermediate
+// buffers stay in cache. the modules still parallelize inside the block. a first module that crops gets the
+// rows of roi_in from the one of the block on, it skips the cropped ones itself.
+static int _process_fused_cpu(dt_dev_pixelpipe_t *pipe, const void *input, const dt_iop_buffer_dsc_t *input_format,
+                              void *output, const dt_iop_roi_t *roi_in, const dt_iop_roi_t *roi_out,
+                              dt_iop_module_t **run_modules, dt_dev_pixelpipe_iop_t **run_pieces, const int n,
+                              const size_t max_bpp)
+{
+  const size_t row_size = max_bpp * roi_out->width;
+  const int rows
+      = MAX(1, (int)MIN((size_t)roi_out->height,
+                        (size_t)DT_DEV_PIXELPIPE_FUSION_BLOCK * dt_get_num_threads() / row_size));
+  void *tmp[2] = { dt_alloc_align(64, row_size * rows), dt_alloc_align(64, row_size * rows) };
+  if(!tmp[0] || !tmp[1])
+  {
+    dt_free_align(tmp[0]);
+    dt_free_align(tmp[1]);
+    return 1;
+  }
+
+  // modules scale processed_maximum of pipe->dsc in process(), every block has to start from the same
+  dt_iop_buffer_dsc_t pre[DT_DEV_PIXELPIPE_FUSION_MAX], post[DT_DEV_PIXELPIPE_FUSION_MAX];
+  size_t bpp[DT_DEV_PIXELPIPE_FUSION_MAX + 1];
+  bpp[0] = dt_iop_buffer_dsc_to_bpp(input_format);
+  int res = 0;
+  for(int row = 0; row < roi_out->height && !res; row += rows)
+  {
+    dt_iop_roi_t roi = *roi_out;
+    roi.y += row;
+    roi.height = MIN(rows, roi_out->height - row);
+    dt_iop_roi_t block_in = *roi_in;
+    block_in.y += row;
+    block_in.height = roi.height + roi_in->height - roi_out->height;
+    const void *in = (const char *)input + bpp[0] * row * roi_in->width;
+    for(int k = 0; k < n; k++)
+    {
+      dt_iop_module_t *module = run_modules[k];
+      dt_dev_pixelpipe_iop_t *piece = run_pieces[k];
+      if(row == 0)
+      {
+        piece->dsc_out = piece->dsc_in = k ? post[k - 1] : *input_format;
+        module->output_format(module, pipe, piece, &piece->dsc_out);
+        pre[k] = piece->dsc_out;
+        bpp[k + 1] = dt_iop_buffer_dsc_to_bpp(&pre[k]);
+      }
+      void *out = (k == n - 1) ? (char *)output + bpp[n] * row * roi_out->width : tmp[k & 1];
+      pipe->dsc = pre[k];
+      module->process(module, piece, in, out, k ? &roi : &block_in, &roi);
+      if(row == 0) post[k] = pipe->dsc;
+      in = out;
+    }
+    if(dt_dev_pixelpipe_cancelled(pipe)) res = 1;
+  }
+
+  for(int k = 0; k < n; k++) run_pieces[k]->dsc_out = post[k];
+  pipe->dsc = post[n - 1];
+  dt_free_align(tmp[0]);
+  dt_free_align(tmp[1]);
+  return res;
+}
+
+#ifdef HAVE_OPENCL
+// chains process_cl of the run through device buffers. returns 1 if the output is in *cl_mem_output, 0 if
+// the run has to go to the cpu (the input is then valid in host memory) and -1 on a late opencl error.
+static int _process_fused_cl(dt_dev_pixelpipe_t *pipe, void *input, void *cl_mem_input,
+                             const dt_iop_buffer_dsc_t *input_format, void **cl_mem_output,
+                             const dt_iop_roi_t *roi_in, const dt_iop_roi_t *roi_out, dt_iop_module_t **run_modules,
+                             dt_dev_pixelpipe_iop_t **run_pieces, const int n, const size_t max_bpp)
+{
+  const int devid = pipe->devid;
+  const size_t in_bpp = dt_iop_buffer_dsc_to_bpp(input_format);
+  const int valid_input_on_gpu_only = (cl_mem_input != NULL);
+
+  int success_opencl = TRUE;
+  dt_develop_tiling_t run_tiling = { 0 };
+  for(int k = 0; k < n; k++)
+  {
+    dt_iop_module_t *module = run_modules[k];
+    if(!module->process_cl || !run_pieces[k]->process_cl_ready || run_pieces[k]->plan_cpu
+       || ((pipe->type == DT_DEV_PIXELPIPE_PREVIEW) && (module->flags() & IOP_FLAGS_PREVIEW_NON_OPENCL)))
+      success_opencl = FALSE;
+    dt_develop_tiling_t tiling = { 0 };
+    module->tiling_callback(module, run_pieces[k], k ? roi_out : roi_in, roi_out, &tiling);
+    run_tiling.factor = fmax(run_tiling.factor, tiling.factor);
+    run_tiling.overhead = MAX(run_tiling.overhead, tiling.overhead);
+  }
+  // roi_in is never smaller than roi_out
+  success_opencl = success_opencl
+                   && dt_opencl_image_fits_device(devid, roi_in->width, roi_in->height, max_bpp,
+                                                  run_tiling.factor, run_tiling.overhead);
+
+  cl_mem in = (cl_mem)cl_mem_input;
+  if(success_opencl && in == NULL)
+  {
+    in = dt_opencl_alloc_device(devid, roi_in->width, roi_in->height, in_bpp);
+    success_opencl = in != NULL
+                     && dt_opencl_write_host_to_device(devid, input, in, roi_in->width, roi_in->height, in_bpp)
+                            == CL_SUCCESS;
+  }
+
+  cl_mem current = in;
+  dt_iop_buffer_dsc_t format = *input_format;
+  for(int k = 0; k < n && success_opencl; k++)
+  {
+    dt_iop_module_t *module = run_modules[k];
+    dt_dev_pixelpipe_iop_t *piece = run_pieces[k];
+    piece->dsc_out = piece->dsc_in = format;
+    module->output_format(module, pipe, piece, &piece->dsc_out);
+    pipe->dsc = piece->dsc_out;
+
+    // indirectly give gpu some air to breathe (and to do display related stuff)
+    dt_iop_nap(darktable.opencl->micro_nap);
+
+    cl_mem out = dt_opencl_alloc_device(devid, roi_out->width, roi_out->height,
+                                        dt_iop_buffer_dsc_to_bpp(&piece->dsc_out));
+    success_opencl
+        = out != NULL && module->process_cl(module, piece, current, out, k ? roi_out : roi_in, roi_out);
+    if(current != in) dt_opencl_release_mem_object(current);
+    current = out;
+    format = piece->dsc_out = pipe->dsc;
+  }
+
+  /* synchronization point for opencl pipe */
+  if(success_opencl && (!darktable.opencl->async_pixelpipe || pipe->type == DT_DEV_PIXELPIPE_EXPORT))
+    success_opencl = dt_opencl_finish(devid);
+
+  if(!success_opencl)
+  {
+    dt_print(DT_DEBUG_OPENCL, "[opencl_pixelpipe] could not run fused modules on gpu. falling back to cpu path\n");
+    if(current != in) dt_opencl_release_mem_object(current);
+    if(valid_input_on_gpu_only)
+    {
+      const cl_int err
+          = dt_opencl_copy_device_to_host(devid, input, in, roi_in->width, roi_in->height, in_bpp);
+      (void)dt_opencl_finish(devid);
+      dt_opencl_release_mem_object(in);
+      if(err != CL_SUCCESS)
+      {
+        dt_print(DT_DEBUG_OPENCL,
+                 "[opencl_pixelpipe (f)] late opencl error detected while copying back to cpu buffer: %d\n", err);
+        return -1;
+      }
+    }
+    else
+      dt_opencl_release_mem_object(in);
+    return 0;
+  }
+
+  *cl_mem_output = current;
+  if(valid_input_on_gpu_only && pipe->type != DT_DEV_PIXELPIPE_EXPORT && pipe->type != DT_DEV_PIXELPIPE_THUMBNAIL
+     && dt_dev_pixelpipe_cache_keep_gpu(&(pipe->cache), input, in, devid, roi_in->width, roi_in->height, in_bpp))
+    return 1;
+
+  dt_opencl_release_mem_object(in);
+  if(valid_input_on_gpu_only)
+    dt_dev_pixelpipe_cache_invalidate(&(pipe->cache), input);
+  else
+    dt_dev_pixelpipe_cache_host_valid(&(pipe->cache), input);
+  return 1;
+}
+#endif
+
+// processes a run of pointwise modules in one go. modules, pieces and pos are where its input comes from,
+// roi_in is its region. only the output of the last module of the run ends up in the cache.
+static int _process_fused(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, void **output, void **cl_mem_output,
+                          dt_iop_buffer_dsc_t **out_format, const dt_iop_roi_t *roi_out,
+                          const dt_iop_roi_t *roi_in, GList *modules, GList *pieces, int pos,
+                          dt_iop_module_t **run_modules, dt_dev_pixelpipe_iop_t **run_pieces, const int n,
+                          const uint64_t hash)
+{
+  void *input = NULL;
+  void *cl_mem_input = NULL;
+  dt_iop_buffer_dsc_t _input_format = { 0 };
+  dt_iop_buffer_dsc_t *input_format = &_input_format;
+  if(dt_dev_pixelpipe_process_rec(pipe, dev, &input, &cl_mem_input, &input_format, roi_in, modules, pieces, pos))
+    return 1;
+
+  // formats along the run, to find the largest buffer
+  dt_iop_buffer_dsc_t format = *input_format;
+  size_t max_bpp = dt_iop_buffer_dsc_to_bpp(&format);
+  for(int k = 0; k < n; k++)
+  {
+    run_pieces[k]->dsc_out = run_pieces[k]->dsc_in = format;
+    run_modules[k]->output_format(run_modules[k], pipe, run_pieces[k], &run_pieces[k]->dsc_out);
+    format = run_pieces[k]->dsc_out;
+    max_bpp = MAX(max_bpp, dt_iop_buffer_dsc_to_bpp(&format));
+  }
+  const size_t bufsize = dt_iop_buffer_dsc_to_bpp(&format) * roi_out->width * roi_out->height;
+
+  dt_pthread_mutex_lock(&pipe->busy_mutex);
+  if(pipe->shutdown)
+  {
+    dt_pthread_mutex_unlock(&pipe->busy_mutex);
+    return 1;
+  }
+  (void)dt_dev_pixelpipe_cache_get(&(pipe->cache), hash, bufsize, output, out_format);
+
+  dt_times_t start;
+  dt_get_times(&start);
+  const int64_t trace_start = dt_trace_now();
+  DT_TIMER_SCOPE(fused_timer, "fused modules");
+  const int report_events = dt_dev_pixelpipe_report_module_begin(pipe);
+
+  int on_gpu = 0;
+#ifdef HAVE_OPENCL
+  if(dt_opencl_is_inited() && pipe->opencl_enabled && pipe->devid >= 0)
+  {
+    on_gpu = _process_fused_cl(pipe, input, cl_mem_input, input_format, cl_mem_output, roi_in, roi_out,
+                               run_modules, run_pieces, n, max_bpp);
+    if(on_gpu < 0)
+    {
+      pipe->opencl_error = 1;
+      dt_pthread_mutex_unlock(&pipe->busy_mutex);
+      return 1;
+    }
+  }
+#endif
+  const int failed = !on_gpu && _process_fused_cpu(pipe, input, input_format, *output, roi_in, roi_out,
+                                                   run_modules, run_pieces, n, max_bpp);
+
+  gchar *first_label = dt_history_item_get_name(run_modules[0]);
+  gchar *last_label = dt_history_item_get_name(run_modules[n - 1]);
+  dt_show_times(&start, "[dev_pixelpipe]", "processed %d fused modules `%s' to `%s' on %s [%s]", n, first_label,
+                last_label, on_gpu ? "GPU" : "CPU", _pipe_type_to_str(pipe->type));
+  if(dt_trace_enabled())
+  {
+    gchar *name = g_strdup_printf("%s .. %s", run_modules[0]->op, run_modules[n - 1]->op);
+    dt_trace_span("module", name, trace_start, _pipe_type_to_str(pipe->type));
+    g_free(name);
+  }
+  g_free(first_label);
+  g_free(last_label);
+  dt_dev_pixelpipe_report_add(pipe, run_modules[0], n, on_gpu ? pipe->devid : -1, roi_out, 0, start.clock,
+                              on_gpu ? 2 * max_bpp * roi_out->width * roi_out->height : bufsize,
+                              report_events);
+
+  // same as for a single module: a superseded run leaves an incomplete output
+  if(failed || dt_dev_pixelpipe_cancelled(pipe))
+  {
+    dt_print(DT_DEBUG_DEV, "[dev_pixelpipe] cancelled fused run ending in `%s' [%s]\n", run_modules[n - 1]->op,
+             _pipe_type_to_str(pipe->type));
+    dt_dev_pixelpipe_cache_invalidate(&(pipe->cache), *output);
+#ifdef HAVE_OPENCL
+    dt_opencl_release_mem_object(*cl_mem_output);
+    *cl_mem_output = NULL;
+#endif
+    dt_pthread_mutex_unlock(&pipe->busy_mutex);
+    return 1;
+  }
+
+  **out_format = pipe->dsc;
+  dt_pthread_mutex_unlock(&pipe->busy_mutex);
+  return 0;
+}
+
+// output rows of a geometric run mapped back at once. the distort functions of some modules keep state in
+// their piece, so the mapping runs on one thread and only the sampling in parallel.
+#define DT_DEV_PIXELPIPE_GEOMETRY_BLOCK 32
+
+// can module be sampled as part of a run of geometric modules? the same as for pointwise runs holds, and the
+// sampler only knows 4 channel buffers.
+static int _geometric(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, dt_iop_module_t *module,
+                      dt_dev_pixelpipe_iop_t *piece)
+{
+  if(!(module->flags() & IOP_FLAGS_GEOMETRIC) || piece->colors != 4) return 0;
+  if(module == dev->gui_module || (piece->request_histogram & DT_REQUEST_ON)) return 0;
+  const dt_develop_blend_params_t *const bp = (const dt_develop_blend_params_t *)piece->blendop_data;
+  if(bp && (bp->mask_mode & DEVELOP_MASK_ENABLED)) return 0;
+  return !dt_dev_pixelpipe_disk_cache_is_checkpoint(pipe, module) && !_streaming_barrier(pipe, module);
+}
+
+// as _fusion_run() for adjacent geometric modules. rois are the output regions of the modules of the run,
+// roi_in the region the first one needs.
+static int _geometry_run(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, const dt_iop_roi_t *roi, GList **modules,
+                         GList **pieces, int *pos, dt_iop_module_t **run_modules,
+                         dt_dev_pixelpipe_iop_t **run_pieces, dt_iop_roi_t *rois, dt_iop_roi_t *roi_in)
+{
+  dt_iop_module_t *rev_modules[DT_DEV_PIXELPIPE_FUSION_MAX];
+  dt_dev_pixelpipe_iop_t *rev_pieces[DT_DEV_PIXELPIPE_FUSION_MAX];
+  dt_iop_roi_t rev_rois[DT_DEV_PIXELPIPE_FUSION_MAX];
+  dt_iop_roi_t current = *roi;
+  int n = 0;
+  while(*modules && n < DT_DEV_PIXELPIPE_FUSION_MAX)
+  {
+    dt_iop_module_t *module = (dt_iop_module_t *)(*modules)->data;
+    dt_dev_pixelpipe_iop_t *piece = (dt_dev_pixelpipe_iop_t *)(*pieces)->data;
+    if(piece->enabled
+       && !(dev->gui_module && dev->gui_module->operation_tags_filter() & module->operation_tags()))
+    {
+      if(!_geometric(pipe, dev, module, piece)) break;
+      if(n && dt_dev_pixelpipe_cache_available(&(pipe->cache),
+                                               dt_dev_pixelpipe_cache_hash(pipe->image.id, &current, pipe, *pos)))
+        break;
+      rev_modules[n] = module;
+      rev_pieces[n] = piece;
+      rev_rois[n] = current;
+      dt_iop_roi_t in = current;
+      module->modify_roi_in(module, piece, &rev_rois[n], &in);
+      current = in;
+      n++;
+    }
+    *modules = g_list_previous(*modules);
+    *pieces = g_list_previous(*pieces);
+    (*pos)--;
+  }
+  for(int k = 0; k < n; k++)
+  {
+    run_modules[k] = rev_modules[n - 1 - k];
+    run_pieces[k] = rev_pieces[n - 1 - k];
+    rois[k] = rev_rois[n - 1 - k];
+  }
+  *roi_in = current;
+  return n;
+}
+
+// samples the input of a run of geometric modules once, at the composition of their distort_backtransform(),
+// instead of every module interpolating the output of the one before. modules, pieces and pos are where the
+// input comes from, roi_in is its region.
+static int _process_geometry(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, void **output,
+                             dt_iop_buffer_dsc_t **out_format, const dt_iop_roi_t *roi_out,
+                             const dt_iop_roi_t *roi_in, GList *modules, GList *pieces, int pos,
+                             dt_iop_module_t **run_modules, dt_dev_pixelpipe_iop_t **run_pieces,
+                             const dt_iop_roi_t *rois, const int n, const uint64_t hash)
+{
+  void *input = NULL;
+  void *cl_mem_input = NULL;
+  dt_iop_buffer_dsc_t _input_format = { 0 };
+  dt_iop_buffer_dsc_t *input_format = &_input_format;
+  if(dt_dev_pixelpipe_process_rec(pipe, dev, &input, &cl_mem_input, &input_format, roi_in, modules, pieces, pos))
+    return 1;
+
+  dt_iop_buffer_dsc_t format = *input_format;
+  for(int k = 0; k < n; k++)
+  {
+    dt_dev_pixelpipe_iop_t *piece = run_pieces[k];
+    piece->dsc_out = piece->dsc_in = format;
+    run_modules[k]->output_format(run_modules[k], pipe, piece, &piece->dsc_out);
+    format = piece->dsc_out;
+    if(!pipe->dirty.patching) piece->last_roi = rois[k];
+  }
+  const size_t bufsize = dt_iop_buffer_dsc_to_bpp(&format) * roi_out->width * roi_out->height;
+
+  dt_pthread_mutex_lock(&pipe->busy_mutex);
+  if(pipe->shutdown)
+  {
+    dt_pthread_mutex_unlock(&pipe->busy_mutex);
+    return 1;
+  }
+  (void)dt_dev_pixelpipe_cache_get(&(pipe->cache), hash, bufsize, output, out_format);
+
+  dt_times_t start;
+  dt_get_times(&start);
+  const int64_t trace_start = dt_trace_now();
+  DT_TIMER_SCOPE(fused_timer, "fused resampling");
+  const int report_events = dt_dev_pixelpipe_report_module_begin(pipe);
+
+  const struct dt_interpolation *itor = dt_interpolation_new(DT_INTERPOLATION_USERPREF);
+  const float scale = roi_out->scale / roi_in->scale;
+  const int rows = MIN(DT_DEV_PIXELPIPE_GEOMETRY_BLOCK, roi_out->height);
+  float *const points = dt_alloc_align(64, sizeof(float) * 2 * roi_out->width * rows);
+  const float *const in = (const float *)input;
+  float *const out = (float *)*output;
+  int failed = (points == NULL);
+  for(int row = 0; row < roi_out->height && !failed; row += rows)
+  {
+    // output pixel centers at full scale, back through the run
+    const int height = MIN(rows, roi_out->height - row);
+    const size_t npoints = (size_t)roi_out->width * height;
+    for(int j = 0; j < height; j++)
+      for(int i = 0; i < roi_out->width; i++)
+      {
+        float *const p = points + 2 * ((size_t)j * roi_out->width + i);
+        p[0] = (roi_out->x + i + 0.5f) / roi_out->scale;
+        p[1] = (roi_out->y + row + j + 0.5f) / roi_out->scale;
+      }
+    for(int k = n - 1; k >= 0; k--)
+      run_modules[k]->distort_backtransform(run_modules[k], run_pieces[k], points, npoints);
+
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static) default(none) shared(itor, row, roi_in, roi_out)
+#endif
+    for(size_t k = 0; k < npoints; k++)
+    {
+      const float x = points[2 * k] * roi_in->scale - roi_in->x - 0.5f;
+      const float y = points[2 * k + 1] * roi_in->scale - roi_in->y - 0.5f;
+      dt_interpolation_compute_pixel4c_scaled(itor, in, out + 4 * ((size_t)row * roi_out->width + k), x, y,
+                                              scale, roi_in->width, roi_in->height, 4 * roi_in->width);
+    }
+    if(dt_dev_pixelpipe_cancelled(pipe)) failed = 1;
+  }
+  dt_free_align(points);
+
+  gchar *first_label = dt_history_item_get_name(run_modules[0]);
+  gchar *last_label = dt_history_item_get_name(run_modules[n - 1]);
+  dt_show_times(&start, "[dev_pixelpipe]", "resampled %d fused modules `%s' to `%s' on CPU [%s]", n,
+                first_label, last_label, _pipe_type_to_str(pipe->type));
+  if(dt_trace_enabled())
+  {
+    gchar *name = g_strdup_printf("%s .. %s", run_modules[0]->op, run_modules[n - 1]->op);
+    dt_trace_span("module", name, trace_start, _pipe_type_to_str(pipe->type));
+    g_free(name);
+  }
+  g_free(first_label);
+  g_free(last_label);
+  dt_dev_pixelpipe_report_add(pipe, run_modules[0], n, -1, roi_out, 0, start.clock, bufsize, report_events);
+
+  if(failed || dt_dev_pixelpipe_cancelled(pipe))
+  {
+    dt_print(DT_DEBUG_DEV, "[dev_pixelpipe] cancelled geometric run ending in `%s' [%s]\n",
+             run_modules[n - 1]->op, _pipe_type_to_str(pipe->type));
+    dt_dev_pixelpipe_cache_invalidate(&(pipe->cache), *output);
+    dt_pthread_mutex_unlock(&pipe->busy_mutex);
+    return 1;
+  }
+
+  **out_format = pipe->dsc = format;
+  dt_pthread_mutex_unlock(&pipe->busy_mutex);
+  return 0;
+}
+
 static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, void **output,
                                         void **cl_mem_output, dt_iop_buffer_dsc_t **out_format,
                                         const dt_iop_roi_t *roi_out, GList *modules, GList *pieces, int pos)
@@ -577,11 +1253,21 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
   {
     module = (dt_iop_module_t *)modules->data;
     piece = (dt_dev_pixelpipe_iop_t *)pieces->data;
+    if(!pipe->dirty.patching) piece->last_roi = *roi_out;
     // skip this module?
     if(!piece->enabled
        || (dev->gui_module && dev->gui_module->operation_tags_filter() & module->operation_tags()))
       return dt_dev_pixelpipe_process_rec(pipe, dev, output, cl_mem_output, out_format, &roi_in,
                                           g_list_previous(modules), g_list_previous(pieces), pos - 1);
+
+    if(_streaming_barrier(pipe, module))
+    {
+      const dt_iop_roi_t roi_full = { 0, 0, piece->buf_out.width * roi_out->scale + .5f,
+                                      piece->buf_out.height * roi_out->scale + .5f, roi_out->scale };
+      if(memcmp(&roi_full, roi_out, sizeof(dt_iop_roi_t)))
+        return _process_streaming_barrier(pipe, dev, output, cl_mem_output, out_format, roi_out, &roi_full,
+                                          modules, pieces, pos);
+    }
   }
 
   if(module) g_strlcpy(module_name, module->op, MIN(sizeof(module_name), sizeof(module->op)));
@@ -604,6 +1290,18 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
 
     (void)dt_dev_pixelpipe_cache_get(&(pipe->cache), hash, bufsize, output, out_format);
 
+#ifdef HAVE_OPENCL
+    // the line might only be valid on a device: go on from there, or bring it back to host memory
+    if(dt_dev_pixelpipe_cache_take_gpu(&(pipe->cache), *output,
+                                       (dt_opencl_is_inited() && pipe->opencl_enabled) ? pipe->devid : -1,
+                                       cl_mem_output))
+    {
+      pipe->opencl_error = 1;
+      dt_pthread_mutex_unlock(&pipe->busy_mutex);
+      return 1;
+    }
+#endif
+
     dt_pthread_mutex_unlock(&pipe->busy_mutex);
     if(!modules) return 0;
     // go to post-collect directly:
@@ -612,6 +1310,34 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
   else
     dt_pthread_mutex_unlock(&pipe->busy_mutex);
 
+  // 1a) patching a local edit, this is the input of the edited module
+  if(pipe->dirty.patching && pos == pipe->dirty.src_pos
+     && _process_patch_source(pipe, output, out_format, roi_out, hash))
+    return 0;
+
+  // 1b) the output of the checkpoint module may still be on disk from an earlier run
+  const int checkpoint = dt_dev_pixelpipe_disk_cache_is_checkpoint(pipe, module);
+  const uint64_t disk_key = checkpoint ? dt_dev_pixelpipe_disk_cache_key(pipe, hash) : 0;
+  if(checkpoint)
+  {
+    dt_pthread_mutex_lock(&pipe->busy_mutex);
+    if(pipe->shutdown)
+    {
+      dt_pthread_mutex_unlock(&pipe->busy_mutex);
+      return 1;
+    }
+    dt_iop_buffer_dsc_t disk_format;
+    (void)dt_dev_pixelpipe_cache_get(&(pipe->cache), hash, bufsize, output, out_format);
+    if(!dt_dev_pixelpipe_disk_cache_read(disk_key, *output, bufsize, &disk_format))
+    {
+      **out_format = pipe->dsc = piece->dsc_out = disk_format;
+      dt_pthread_mutex_unlock(&pipe->busy_mutex);
+      goto post_process_collect_info;
+    }
+    dt_dev_pixelpipe_cache_invalidate(&(pipe->cache), *output);
+    dt_pthread_mutex_unlock(&pipe->busy_mutex);
+  }
+
   // 2) if history changed or exit event, abort processing?
   // preview pipe: abort on all but zoom events (same buffer anyways)
   if(dt_iop_breakpoint(dev, pipe)) return 1;
@@ -620,6 +1346,48 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
   if(pipe == dev->preview_pipe && dev->preview_loading) return 1;
   if(dev->gui_leaving) return 1;
 
+  // 2b) a run of pointwise modules ending here goes through all of them at once
+  if(modules && !(pipe->mask_display & DT_DEV_PIXELPIPE_DISPLAY_ANY))
+  {
+    dt_iop_module_t *run_modules[DT_DEV_PIXELPIPE_FUSION_MAX];
+    dt_dev_pixelpipe_iop_t *run_pieces[DT_DEV_PIXELPIPE_FUSION_MAX];
+    dt_iop_roi_t run_roi_in = *roi_out;
+    GList *in_modules = modules, *in_pieces = pieces;
+    int in_pos = pos;
+    dt_pthread_mutex_lock(&pipe->busy_mutex);
+    const int n = pipe->shutdown ? 0 : _fusion_run(pipe, dev, roi_out, &in_modules, &in_pieces, &in_pos,
+                                                   run_modules, run_pieces, &run_roi_in);
+    dt_pthread_mutex_unlock(&pipe->busy_mutex);
+    if(n > 1)
+      return _process_fused(pipe, dev, output, cl_mem_output, out_format, roi_out, &run_roi_in, in_modules,
+                            in_pieces, in_pos, run_modules, run_pieces, n, hash);
+  }
+
+  // 2c) and a run of geometric modules is sampled once. not on a device, the modules resample there and the
+  // input would have to come back to the host. distort_backtransform() of the preview pipe is called by the
+  // gui at the same time.
+  int geometry = modules && !(pipe->mask_display & DT_DEV_PIXELPIPE_DISPLAY_ANY)
+                 && pipe->type != DT_DEV_PIXELPIPE_PREVIEW;
+#ifdef HAVE_OPENCL
+  geometry = geometry && !(dt_opencl_is_inited() && pipe->opencl_enabled && pipe->devid >= 0);
+#endif
+  if(geometry)
+  {
+    dt_iop_module_t *run_modules[DT_DEV_PIXELPIPE_FUSION_MAX];
+    dt_dev_pixelpipe_iop_t *run_pieces[DT_DEV_PIXELPIPE_FUSION_MAX];
+    dt_iop_roi_t rois[DT_DEV_PIXELPIPE_FUSION_MAX];
+    dt_iop_roi_t run_roi_in = *roi_out;
+    GList *in_modules = modules, *in_pieces = pieces;
+    int in_pos = pos;
+    dt_pthread_mutex_lock(&pipe->busy_mutex);
+    const int n = pipe->shutdown ? 0 : _geometry_run(pipe, dev, roi_out, &in_modules, &in_pieces, &in_pos,
+                                                     run_modules, run_pieces, rois, &run_roi_in);
+    dt_pthread_mutex_unlock(&pipe->busy_mutex);
+    // beyond the widest footprint of the sampler each module keeps its own filtering
+    if(n > 1 && roi_out->scale * DT_INTERPOLATION_MAX_DOWNSCALE >= run_roi_in.scale)
+      return _process_geometry(pipe, dev, output, out_format, roi_out, &run_roi_in, in_modules, in_pieces,
+                               in_pos, run_modules, run_pieces, rois, n, hash);
+  }
 
   // 3) input -> output
   if(!modules)
@@ -633,12 +1401,15 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
     }
     dt_times_t start;
     dt_get_times(&start);
+    const int64_t trace_start = dt_trace_now();
+    DT_TIMER_SCOPE(input_timer, "input");
     // we're looking for the full buffer
     {
-      if(roi_out->scale == 1.0 && roi_out->x == 0 && roi_out->y == 0 && pipe->iwidth == roi_out->width
-         && pipe->iheight == roi_out->height)
+      // whole rows at full scale are contiguous in the input, so the first module reads them in place
+      if(roi_out->scale == 1.0 && roi_out->x == 0 && pipe->iwidth == roi_out->width && roi_out->y >= 0
+         && roi_out->y + roi_out->height <= pipe->iheight)
       {
-        *output = pipe->input;
+        *output = ((char *)pipe->input) + (size_t)bpp * roi_out->y * pipe->iwidth;
       }
       else if(dt_dev_pixelpipe_cache_get(&(pipe->cache), hash, bufsize, output, out_format))
       {
@@ -676,6 +1447,7 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
     }
 
     dt_show_times(&start, "[dev_pixelpipe]", "initing base buffer [%s]", _pipe_type_to_str(pipe->type));
+    dt_trace_span("module", "input", trace_start, _pipe_type_to_str(pipe->type));
     dt_pthread_mutex_unlock(&pipe->busy_mutex);
   }
   else
@@ -740,6 +1512,9 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
 
     dt_times_t start;
     dt_get_times(&start);
+    const int64_t trace_start = dt_trace_now();
+    DT_TIMER_SCOPE(module_timer, module->op);
+    const int report_events = dt_dev_pixelpipe_report_module_begin(pipe);
 
     dt_pixelpipe_flow_t pixelpipe_flow = (PIXELPIPE_FLOW_NONE | PIXELPIPE_FLOW_HISTOGRAM_NONE);
 
@@ -817,6 +1592,8 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
 
       /* if input is on gpu memory only, remember this fact to later take appropriate action */
       int valid_input_on_gpu_only = (cl_mem_input != NULL);
+      /* set if the cache holds on to the device copy of the input instead */
+      int input_kept_on_gpu = FALSE;
 
       /* pre-check if there is enough space on device for non-tiled processing */
       const int fits_on_device = dt_opencl_image_fits_device(pipe->devid, MAX(roi_in.width, roi_out->width),
@@ -831,9 +1608,11 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
          are treated in the same manner. */
 
       /* try to enter opencl path after checking some module specific pre-requisites */
-      if(module->process_cl && piece->process_cl_ready
+      if(module->process_cl && piece->process_cl_ready && !piece->plan_cpu
          && !((pipe->type == DT_DEV_PIXELPIPE_PREVIEW) && (module->flags() & IOP_FLAGS_PREVIEW_NON_OPENCL))
-         && (fits_on_device || piece->process_tiling_ready))
+         && (fits_on_device || piece->process_tiling_ready)
+         && !(fits_on_device && dt_dev_pixelpipe_routing_prefer_cpu(pipe, module, &roi_in, roi_out, in_bpp, bpp,
+                                                                     cl_mem_input != NULL)))
       {
 
         // fprintf(stderr, "[opencl_pixelpipe 0] factor %f, overhead %d, width %d, height %d, bpp %d\n",
@@ -863,6 +1642,7 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
 
             if(success_opencl)
             {
+              const double transfer_start = dt_get_wtime();
               cl_int err = dt_opencl_write_host_to_device(pipe->devid, input, cl_mem_input,
                                                                        roi_in.width, roi_in.height, in_bpp);
               if(err != CL_SUCCESS)
@@ -872,6 +1652,9 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
                          module->op);
                 success_opencl = FALSE;
               }
+              else
+                dt_dev_pixelpipe_routing_record_transfer(pipe->devid, (size_t)roi_in.width * roi_in.height * in_bpp,
+                                                         dt_get_wtime() - transfer_start);
             }
           }
 
@@ -936,6 +1719,11 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
             return 1;
           }
 
+          /* timing the module for the learned routing needs it to start on an empty queue and be waited for */
+          const int route_sample = dt_dev_pixelpipe_routing_wants_sample(pipe, module, &roi_in, roi_out);
+          if(success_opencl && route_sample) success_opencl = dt_opencl_finish(pipe->devid);
+          const double route_start = dt_get_wtime();
+
           /* now call process_cl of module; module should emit meaningful messages in case of error */
           if(success_opencl)
           {
@@ -993,9 +1781,12 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
           }
 
           /* synchronization point for opencl pipe */
-          if(success_opencl && (!darktable.opencl->async_pixelpipe || pipe->type == DT_DEV_PIXELPIPE_EXPORT))
+          if(success_opencl
+             && (!darktable.opencl->async_pixelpipe || pipe->type == DT_DEV_PIXELPIPE_EXPORT || route_sample))
             success_opencl = dt_opencl_finish(pipe->devid);
-
+          if(success_opencl && route_sample)
+            dt_dev_pixelpipe_routing_record(pipe, module, pipe->devid, &roi_in, roi_out,
+                                            dt_get_wtime() - route_start);
 
           if(pipe->shutdown)
           {
@@ -1194,8 +1985,18 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
             }
           }
 
-          /* we can now release cl_mem_input */
-          dt_opencl_release_mem_object(cl_mem_input);
+          /* we can now release cl_mem_input, unless the cache line can live on the device. then nothing is
+             copied back until a cpu module or the backbuf needs it. */
+          if(valid_input_on_gpu_only && pipe->type != DT_DEV_PIXELPIPE_EXPORT
+             && pipe->type != DT_DEV_PIXELPIPE_THUMBNAIL
+             && dt_dev_pixelpipe_cache_keep_gpu(&(pipe->cache), input, cl_mem_input, pipe->devid, roi_in.width,
+                                                roi_in.height, in_bpp))
+          {
+            valid_input_on_gpu_only = FALSE;
+            input_kept_on_gpu = TRUE;
+          }
+          else
+            dt_opencl_release_mem_object(cl_mem_input);
           cl_mem_input = NULL;
           // we speculate on the next plug-in to possibly copy back cl_mem_output to output,
           // so we're not just yet invalidating the (empty) output cache line.
@@ -1293,7 +2094,11 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
           }
           else
           {
+            const double route_start = dt_get_wtime();
             module->process(module, piece, input, *output, &roi_in, roi_out);
+            if(module->process_cl)
+              dt_dev_pixelpipe_routing_record(pipe, module, -1, &roi_in, roi_out,
+                                              dt_get_wtime() - route_start);
             pixelpipe_flow |= (PIXELPIPE_FLOW_PROCESSED_ON_CPU);
             pixelpipe_flow &= ~(PIXELPIPE_FLOW_PROCESSED_ON_GPU | PIXELPIPE_FLOW_PROCESSED_WITH_TILING);
           }
@@ -1426,7 +2231,10 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
         }
         else
         {
+          const double route_start = dt_get_wtime();
           module->process(module, piece, input, *output, &roi_in, roi_out);
+          if(module->process_cl)
+            dt_dev_pixelpipe_routing_record(pipe, module, -1, &roi_in, roi_out, dt_get_wtime() - route_start);
           pixelpipe_flow |= (PIXELPIPE_FLOW_PROCESSED_ON_CPU);
           pixelpipe_flow &= ~(PIXELPIPE_FLOW_PROCESSED_ON_GPU | PIXELPIPE_FLOW_PROCESSED_WITH_TILING);
         }
@@ -1475,7 +2283,10 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
       }
 
       /* input is still only on GPU? Let's invalidate CPU input buffer then */
-      if(valid_input_on_gpu_only) dt_dev_pixelpipe_cache_invalidate(&(pipe->cache), input);
+      if(valid_input_on_gpu_only)
+        dt_dev_pixelpipe_cache_invalidate(&(pipe->cache), input);
+      else if(!input_kept_on_gpu)
+        dt_dev_pixelpipe_cache_host_valid(&(pipe->cache), input);
     }
     else
     {
@@ -1524,7 +2335,10 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
       }
       else
       {
+        const double route_start = dt_get_wtime();
         module->process(module, piece, input, *output, &roi_in, roi_out);
+        if(module->process_cl)
+          dt_dev_pixelpipe_routing_record(pipe, module, -1, &roi_in, roi_out, dt_get_wtime() - route_start);
         pixelpipe_flow |= (PIXELPIPE_FLOW_PROCESSED_ON_CPU);
         pixelpipe_flow &= ~(PIXELPIPE_FLOW_PROCESSED_ON_GPU | PIXELPIPE_FLOW_PROCESSED_WITH_TILING);
       }
@@ -1675,6 +2489,28 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
         _pipe_type_to_str(pipe->type));
     g_free(module_label);
     module_label = NULL;
+    const size_t report_memory = tiling.factor * MAX(in_bpp, out_bpp) * MAX(roi_in.width, roi_out->width)
+                                     * MAX(roi_in.height, roi_out->height) + tiling.overhead;
+    dt_dev_pixelpipe_report_add(pipe, module, 1,
+                                pixelpipe_flow & PIXELPIPE_FLOW_PROCESSED_ON_GPU ? pipe->devid : -1, roi_out,
+                                (pixelpipe_flow & PIXELPIPE_FLOW_PROCESSED_WITH_TILING) != 0, start.clock,
+                                report_memory, report_events);
+    dt_trace_span("module", module->op, trace_start, _pipe_type_to_str(pipe->type));
+    dt_timer_end(&module_timer);
+
+    // the run got superseded while the module was busy, which may have stopped early. the output is
+    // incomplete and must not be found in the cache later on.
+    if(dt_dev_pixelpipe_cancelled(pipe))
+    {
+      dt_print(DT_DEBUG_DEV, "[dev_pixelpipe] cancelled `%s' [%s]\n", module->op, _pipe_type_to_str(pipe->type));
+      dt_dev_pixelpipe_cache_invalidate(&(pipe->cache), *output);
+#ifdef HAVE_OPENCL
+      dt_opencl_release_mem_object(*cl_mem_output);
+      *cl_mem_output = NULL;
+#endif
+      dt_pthread_mutex_unlock(&pipe->busy_mutex);
+      return 1;
+    }
 
     // in case we get this buffer from the cache in the future, cache some stuff:
     **out_format = piece->dsc_out = pipe->dsc;
@@ -1686,6 +2522,22 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
       // the user is likely to change that one soon, so keep it in cache.
       dt_dev_pixelpipe_cache_reweight(&(pipe->cache), input);
     }
+
+    // keep the output of the checkpoint module for later runs
+    if(checkpoint)
+    {
+      dt_pthread_mutex_lock(&pipe->busy_mutex);
+      if(!pipe->shutdown)
+      {
+#ifdef HAVE_OPENCL
+        if(*cl_mem_output != NULL)
+          dt_opencl_copy_device_to_host(pipe->devid, *output, *cl_mem_output, roi_out->width, roi_out->height,
+                                        dt_iop_buffer_dsc_to_bpp(*out_format));
+#endif
+        dt_dev_pixelpipe_disk_cache_write(disk_key, *output, bufsize, *out_format);
+      }
+      dt_pthread_mutex_unlock(&pipe->busy_mutex);
+    }
 #ifndef _DEBUG
     if(darktable.unmuted & DT_DEBUG_NAN)
 #endif
@@ -1804,6 +2656,17 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
       if(darktable.color_profiles->display_type == DT_COLORSPACE_DISPLAY)
         pthread_rwlock_unlock(&darktable.color_profiles->xprofile_lock);
 
+      // with several boxes to sample, a table of the output answers all of them without going over each box
+      int boxes = 0;
+      for(GSList *s = samples; s; s = g_slist_next(s))
+      {
+        const dt_colorpicker_sample_t *const smp = s->data;
+        if(!smp->locked && smp->size == DT_COLORPICKER_SIZE_BOX) boxes++;
+      }
+      dt_color_picker_table_t *table
+          = boxes > 1 ? dt_color_picker_table_new((const uint8_t *)*output, roi_out->width, roi_out->height)
+                      : NULL;
+
       while(samples)
       {
         sample = samples->data;
@@ -1829,7 +2692,20 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
         point[0] = MIN(roi_out->width - 1, MAX(0, sample->point[0] * roi_out->width));
         point[1] = MIN(roi_out->height - 1, MAX(0, sample->point[1] * roi_out->height));
         const float w = 1.0 / ((box[3] - box[1] + 1) * (box[2] - box[0] + 1));
-        if(sample->size == DT_COLORPICKER_SIZE_BOX)
+        if(sample->size == DT_COLORPICKER_SIZE_BOX && table)
+        {
+          // the output is bgra
+          float mean[3];
+          uint8_t min[3], max[3];
+          dt_color_picker_table_sample(table, box, mean, min, max);
+          for(int k = 0; k < 3; k++)
+          {
+            sample->picked_color_rgb_mean[k] = mean[2 - k];
+            sample->picked_color_rgb_min[k] = min[2 - k];
+            sample->picked_color_rgb_max[k] = max[2 - k];
+          }
+        }
+        else if(sample->size == DT_COLORPICKER_SIZE_BOX)
         {
           for(int j = box[1]; j <= box[3]; j++)
             for(int i = box[0]; i <= box[2]; i++)
@@ -1877,6 +2753,7 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
         samples = g_slist_next(samples);
       }
 
+      dt_color_picker_table_free(table);
       cmsDeleteTransform(xform);
     }
     // Picking RGB for primary colorpicker output and converting to Lab
@@ -2039,23 +2916,22 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
       for(int k = 19; k < 4 * 256; k += 4)
         dev->histogram_max = dev->histogram_max > dev->histogram[k] ? dev->histogram_max : dev->histogram[k];
 
-      // calculate the waveform histogram. since this is drawn pixel by pixel we have to do it in the correct
-      // size (thus the weird gui stuff :().
+      // calculate the waveform histogram. since this is drawn pixel by pixel we have to do it in the size the
+      // histogram lib draws it in, at the scope resolution set.
       // this HAS to be done on the float input data, otherwise we get really ugly artefacts due to rounding
       // issues when putting colors into the bins.
-      //       dt_pthread_mutex_lock(&dev->histogram_waveform_mutex);
-      if(dev->histogram_waveform_width != 0 && input)
+      const float resolution
+          = CLAMP(dt_conf_get_int("plugins/darkroom/histogram/scope_resolution"), 10, 100) / 100.0f;
+      const int wf_width = dev->histogram_request_width * darktable.gui->ppd * resolution;
+      const int wf_height = dev->histogram_request_height * darktable.gui->ppd * resolution;
+      if(wf_width > 0 && wf_height > 0 && input)
       {
-        uint32_t *buf = (uint32_t *)calloc(dev->histogram_waveform_height * dev->histogram_waveform_width * 3,
-                                           sizeof(uint32_t));
-        memset(dev->histogram_waveform, 0,
-               sizeof(uint32_t) * dev->histogram_waveform_height * dev->histogram_waveform_stride / 4);
+        uint32_t *waveform = (uint32_t *)calloc((size_t)wf_height * wf_width, sizeof(uint32_t));
+        uint32_t *buf = (uint32_t *)calloc((size_t)wf_height * wf_width * 3, sizeof(uint32_t));
 
         // 1.0 is at 8/9 of the height!
-        const double bin_width = (double)(roi_in.width) / (double)dev->histogram_waveform_width,
-                     _height = (double)(dev->histogram_waveform_height - 1);
+        const double bin_width = (double)(roi_in.width) / (double)wf_width, _height = (double)(wf_height - 1);
         float *pixel = (float *)input;
-        //         uint32_t mincol[3] = {UINT32_MAX,UINT32_MAX,UINT32_MAX}, maxcol[3] = {0,0,0};
 
         // count the colors into buf ...
         for(int y = 0; y < roi_in.height; y++)
@@ -2065,53 +2941,50 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
             float rgb[3];
             for(int k = 0; k < 3; k++) rgb[k] = pixel[4 * y * roi_in.width + 4 * x + 2 - k];
 
-            const int out_x = MIN(x / bin_width, dev->histogram_waveform_width - 1);
+            const int out_x = MIN(x / bin_width, wf_width - 1);
             for(int k = 0; k < 3; k++)
             {
               const float v = isnan(rgb[k]) ? 0.0f
                                             : rgb[k]; // catch NaNs as they don't convert well to integers
               const int out_y = CLAMP(1.0 - (8.0 / 9.0) * v, 0.0, 1.0) * _height;
-              uint32_t *const out = buf + (out_y * dev->histogram_waveform_width * 3 + out_x * 3 + k);
+              uint32_t *const out = buf + (out_y * wf_width * 3 + out_x * 3 + k);
               (*out)++;
-              //               mincol[k] = MIN(mincol[k], *out);
-              //               maxcol[k] = MAX(maxcol[k], *out);
             }
           }
         }
 
-        // TODO: Find a nicer function to map buf -> image than just clipping
-        //         float factor[3];
-        //         for(int k = 0; k < 3; k++)
-        //           factor[k] = 255.0 / (float)(maxcol[k] - mincol[k]); // leave some clipping
-
         // ... and scale that into a nice image. putting the pixels into the image directly gets too
         // saturated/clips.
         // new scale factor to do about the same as the old one for 1MP views, but scale to hidpi
         const float scale = 0.5 * 1e6f/(roi_in.height*roi_in.width) *
-          (dev->histogram_waveform_width*dev->histogram_waveform_height) / (350.0f*233.);
-        for(int y = 0; y < dev->histogram_waveform_height; y++)
+          (wf_width*wf_height) / (350.0f*233.);
+        for(int y = 0; y < wf_height; y++)
         {
-          for(int x = 0; x < dev->histogram_waveform_width; x++)
+          for(int x = 0; x < wf_width; x++)
           {
-            uint32_t *const in = buf + (y * dev->histogram_waveform_width + x) * 3;
-            uint8_t *const out
-                = (uint8_t *)(dev->histogram_waveform + (y * dev->histogram_waveform_width + x));
+            uint32_t *const in = buf + (y * wf_width + x) * 3;
+            uint8_t *const out = (uint8_t *)(waveform + (y * wf_width + x));
             for(int k = 0; k < 3; k++)
             {
               if(in[k] == 0) continue;
               out[k] = CLAMP(in[k] * scale, 5, 255);
-              //               if(in[k] == 0)
-              //                 out[k] = 0;
-              //               else
-              //                 out[k] = (float)(in[k] - mincol[k]) * factor[k];
             }
           }
         }
 
         free(buf);
+
+        dt_pthread_mutex_lock(&dev->histogram_waveform_mutex);
+        free(dev->histogram_waveform);
+        dev->histogram_waveform = waveform;
+        dev->histogram_waveform_width = wf_width;
+        dev->histogram_waveform_height = wf_height;
+        dev->histogram_waveform_stride = 4 * wf_width;
+        dt_pthread_mutex_unlock(&dev->histogram_waveform_mutex);
       }
-      //       dt_pthread_mutex_unlock(&dev->histogram_waveform_mutex);
 
+      // so all the histogram lib does when drawing is to blit this
+      dt_dev_histogram_render(dev);
 
       dt_pthread_mutex_unlock(&pipe->busy_mutex);
 
@@ -2215,6 +3088,8 @@ static int dt_dev_pixelpipe_process_rec_and_backcopy(dt_dev_pixelpipe_t *pipe, d
         pipe->opencl_error = 1;
         ret = 1;
       }
+      else
+        dt_dev_pixelpipe_cache_host_valid(&(pipe->cache), *output);
     }
   }
   dt_pthread_mutex_unlock(&pipe->busy_mutex);
@@ -2226,13 +3101,301 @@ static int dt_dev_pixelpipe_process_rec_and_backcopy(dt_dev_pixelpipe_t *pipe, d
 }
 
 
+void dt_dev_pixelpipe_dirty_region(dt_dev_pixelpipe_t *pipe, const dt_iop_module_t *module, const int *area)
+{
+  if(pipe->type != DT_DEV_PIXELPIPE_FULL) return;
+  if(!area || (pipe->dirty.module && pipe->dirty.module != module))
+  {
+    pipe->dirty.untracked = 1;
+    return;
+  }
+  const int x0 = area[0], y0 = area[1], x1 = area[0] + area[2], y1 = area[1] + area[3];
+  if(!pipe->dirty.module)
+  {
+    pipe->dirty.module = module;
+    pipe->dirty.area[0] = x0;
+    pipe->dirty.area[1] = y0;
+    pipe->dirty.area[2] = x1;
+    pipe->dirty.area[3] = y1;
+    return;
+  }
+  pipe->dirty.area[0] = MIN(pipe->dirty.area[0], x0);
+  pipe->dirty.area[1] = MIN(pipe->dirty.area[1], y0);
+  pipe->dirty.area[2] = MAX(pipe->dirty.area[2], x1);
+  pipe->dirty.area[3] = MAX(pipe->dirty.area[3], y1);
+}
+
+// remembers what the run that just completed did, and forgets about the changes that led to it.
+static void _dirty_snapshot(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, const dt_iop_roi_t *roi, const int pos)
+{
+  for(GList *nodes = pipe->nodes; nodes; nodes = g_list_next(nodes))
+  {
+    dt_dev_pixelpipe_iop_t *piece = (dt_dev_pixelpipe_iop_t *)nodes->data;
+    piece->last_hash = piece->hash;
+    piece->last_enabled = piece->enabled;
+  }
+  pipe->dirty.module = NULL;
+  pipe->dirty.untracked = 0;
+  pipe->dirty.roi = *roi;
+  pipe->dirty.hash = dt_dev_pixelpipe_cache_hash(pipe->image.id, roi, pipe, pos);
+  pipe->dirty.gui_module = dev->gui_module;
+  pipe->dirty.valid = 1;
+}
+
+// after a local edit, only part of the output might have changed since the last run. if so, that part is
+// computed on its own and pasted into a copy of the last output. returns 0 if the full pipe has to run
+// instead, otherwise the result of the run goes to err.
+static int _process_patch(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, void **output, void **cl_mem_output,
+                          dt_iop_buffer_dsc_t **out_format, const dt_iop_roi_t *roi, GList *modules,
+                          GList *pieces, int pos, int *err)
+{
+  if(pipe->type != DT_DEV_PIXELPIPE_FULL || !pipe->dirty.valid || !pipe->dirty.module || pipe->dirty.untracked
+     || memcmp(roi, &pipe->dirty.roi, sizeof(dt_iop_roi_t)) || dev->gui_module != pipe->dirty.gui_module
+     || (dev->gui_module && dev->gui_module->request_mask_display))
+    return 0;
+
+  // nothing but the edited module may have changed, and it and everything after it must work on regions:
+  // no histograms, pickers or modules that need all of their input.
+  dt_dev_pixelpipe_iop_t *src = NULL;
+  int src_pos = 0, after = 0, overlap = 0, k = 0;
+  for(GList *nodes = pipe->nodes; nodes; nodes = g_list_next(nodes), k++)
+  {
+    dt_dev_pixelpipe_iop_t *piece = (dt_dev_pixelpipe_iop_t *)nodes->data;
+    dt_iop_module_t *module = piece->module;
+    if(module->request_color_pick != DT_REQUEST_COLORPICK_OFF) return 0;
+    if(module == pipe->dirty.module)
+    {
+      if(!piece->enabled || !piece->last_enabled) return 0;
+      after = 1;
+    }
+    else if(piece->hash != piece->last_hash || piece->enabled != piece->last_enabled)
+      return 0;
+
+    if(!piece->enabled || (dev->gui_module && dev->gui_module->operation_tags_filter() & module->operation_tags()))
+      continue;
+    if(!after)
+    {
+      // the output of the last module that runs before the edited one is cached at the next position
+      src = piece;
+      src_pos = k + 1;
+      continue;
+    }
+    if((module->flags() & IOP_FLAGS_NO_TILE_STREAMING) || (piece->request_histogram & DT_REQUEST_ON)) return 0;
+    dt_develop_tiling_t tiling = { 0 };
+    module->tiling_callback(module, piece, &piece->last_roi, &piece->last_roi, &tiling);
+    overlap += tiling.overlap;
+  }
+  if(!after) return 0;
+
+  // where the area ends up in the output, grown by what the modules after the edit look at around a pixel
+  const int *area = pipe->dirty.area;
+  float points[8] = { area[0], area[1], area[2], area[1], area[0], area[3], area[2], area[3] };
+  if(!dt_dev_distort_transform_plus(dev, pipe, pipe->dirty.module->priority, 99999, points, 4)) return 0;
+  float x0 = FLT_MAX, y0 = FLT_MAX, x1 = -FLT_MAX, y1 = -FLT_MAX;
+  for(int i = 0; i < 4; i++)
+  {
+    x0 = fminf(x0, points[2 * i]);
+    x1 = fmaxf(x1, points[2 * i]);
+    y0 = fminf(y0, points[2 * i + 1]);
+    y1 = fmaxf(y1, points[2 * i + 1]);
+  }
+  const int px0 = CLAMP((int)floorf(x0 * roi->scale) - roi->x - overlap - 1, 0, roi->width);
+  const int py0 = CLAMP((int)floorf(y0 * roi->scale) - roi->y - overlap - 1, 0, roi->height);
+  const int px1 = CLAMP((int)ceilf(x1 * roi->scale) - roi->x + overlap + 1, 0, roi->width);
+  const int py1 = CLAMP((int)ceilf(y1 * roi->scale) - roi->y + overlap + 1, 0, roi->height);
+  // not worth it for large parts of the view
+  if((size_t)(px1 - px0) * (py1 - py0) * 4 > (size_t)roi->width * roi->height) return 0;
+
+  // keep a copy of the last output, its cache line might get reused while patching
+  dt_pthread_mutex_lock(&pipe->busy_mutex);
+  void *last = NULL;
+  dt_iop_buffer_dsc_t *last_format = NULL;
+  if(pipe->shutdown || _cache_get_line(pipe, pipe->dirty.hash, roi->width, roi->height, &last, &last_format))
+  {
+    dt_pthread_mutex_unlock(&pipe->busy_mutex);
+    return 0;
+  }
+  dt_iop_buffer_dsc_t format = *last_format;
+  const size_t bpp = dt_iop_buffer_dsc_to_bpp(&format);
+  const size_t bufsize = bpp * roi->width * roi->height;
+  void *copy = dt_buffer_pool_alloc(NULL, bufsize);
+  if(copy) memcpy(copy, last, bufsize);
+  dt_pthread_mutex_unlock(&pipe->busy_mutex);
+  if(!copy) return 0;
+
+  dt_times_t start;
+  dt_get_times(&start);
+
+  const dt_iop_roi_t roi_patch = { roi->x + px0, roi->y + py0, px1 - px0, py1 - py0, roi->scale };
+  void *patch = NULL;
+  dt_iop_buffer_dsc_t _patch_format = { 0 };
+  dt_iop_buffer_dsc_t *patch_format = &_patch_format;
+  if(roi_patch.width > 0 && roi_patch.height > 0)
+  {
+    pipe->dirty.patching = 1;
+    pipe->dirty.src_pos = src ? src_pos : -1;
+    if(src)
+    {
+      pipe->dirty.src_roi = src->last_roi;
+      pipe->dirty.src_hash = dt_dev_pixelpipe_cache_hash(pipe->image.id, &src->last_roi, pipe, src_pos);
+    }
+    const int res = dt_dev_pixelpipe_process_rec_and_backcopy(pipe, dev, &patch, cl_mem_output, &patch_format,
+                                                              &roi_patch, modules, pieces, pos);
+    pipe->dirty.patching = 0;
+    if(res || dt_iop_buffer_dsc_to_bpp(patch_format) != bpp)
+    {
+      dt_buffer_pool_free(copy);
+      *err = res;
+      return res;
+    }
+    format = *patch_format;
+  }
+
+  dt_pthread_mutex_lock(&pipe->busy_mutex);
+  if(pipe->shutdown)
+  {
+    dt_pthread_mutex_unlock(&pipe->busy_mutex);
+    dt_buffer_pool_free(copy);
+    *err = 1;
+    return 1;
+  }
+  const uint64_t hash = dt_dev_pixelpipe_cache_hash(pipe->image.id, roi, pipe, pos);
+  (void)dt_dev_pixelpipe_cache_get_important(&(pipe->cache), hash, bufsize, output, out_format);
+  memcpy(*output, copy, bufsize);
+  for(int j = 0; j < roi_patch.height; j++)
+    memcpy((char *)*output + bpp * ((size_t)(py0 + j) * roi->width + px0),
+           (char *)patch + bpp * (size_t)j * roi_patch.width, bpp * roi_patch.width);
+  **out_format = format;
+  dt_pthread_mutex_unlock(&pipe->busy_mutex);
+  dt_buffer_pool_free(copy);
+
+  dt_show_times(&start, "[dev_pixelpipe]", "patched %dx%d of the output after a change in `%s' [%s]",
+                roi_patch.width, roi_patch.height, pipe->dirty.module->op, _pipe_type_to_str(pipe->type));
+  *err = 0;
+  return 1;
+}
+
+typedef struct dt_dev_pixelpipe_plan_t
+{
+  dt_iop_module_t *module;
+  dt_dev_pixelpipe_iop_t *piece;
+  int width, height; // larger of input and output
+  size_t bpp;
+  dt_develop_tiling_t tiling;
+  int process_cl, fits_device, fits_host;
+} dt_dev_pixelpipe_plan_t;
+
+static size_t _plan_bpp(const dt_iop_buffer_dsc_t *dsc)
+{
+  // not processed yet: assume the widest buffers
+  return dsc->channels ? dt_iop_buffer_dsc_to_bpp(dsc) : 4 * sizeof(float);
+}
+
+// memory planner: before processing, walk the pipe backwards from roi like process_rec does and collect the
+// tiling requirements of all modules. the ones that can't run on the device (no usable process_cl, or too
+// large for the device and no tiling) force the cpu. so does everything between the first and the last of
+// them, as moving a buffer between host and device costs more than a module on the cpu usually does. the
+// decision is left in piece->plan_cpu, and printed with -d tiling.
+static void _plan_pipe(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, const dt_iop_roi_t *roi, GList *modules,
+                       GList *pieces)
+{
+  for(GList *p = pipe->nodes; p; p = g_list_next(p)) ((dt_dev_pixelpipe_iop_t *)p->data)->plan_cpu = 0;
+  if(pipe->devid < 0) return;
+
+  const int count = g_list_length(pipe->nodes);
+  dt_dev_pixelpipe_plan_t *plan
+      = (dt_dev_pixelpipe_plan_t *)calloc(MAX(count, 1), sizeof(dt_dev_pixelpipe_plan_t));
+  if(!plan) return;
+
+  // from the end of the pipe, so plan[] is in reverse order
+  int n = 0;
+  dt_iop_roi_t roi_out = *roi;
+  dt_pthread_mutex_lock(&pipe->busy_mutex);
+  for(; modules && pieces && n < count && !pipe->shutdown;
+      modules = g_list_previous(modules), pieces = g_list_previous(pieces))
+  {
+    dt_iop_module_t *module = (dt_iop_module_t *)modules->data;
+    dt_dev_pixelpipe_iop_t *piece = (dt_dev_pixelpipe_iop_t *)pieces->data;
+    if(!piece->enabled
+       || (dev->gui_module && dev->gui_module->operation_tags_filter() & module->operation_tags()))
+      continue;
+
+    dt_iop_roi_t roi_in = roi_out;
+    module->modify_roi_in(module, piece, &roi_out, &roi_in);
+
+    dt_dev_pixelpipe_plan_t *p = plan + n++;
+    p->module = module;
+    p->piece = piece;
+    p->width = MAX(roi_in.width, roi_out.width);
+    p->height = MAX(roi_in.height, roi_out.height);
+    p->bpp = MAX(_plan_bpp(&piece->dsc_in), _plan_bpp(&piece->dsc_out));
+    module->tiling_callback(module, piece, &roi_in, &roi_out, &p->tiling);
+    if(piece->blendop_data && (dt_develop_blend_params_t *)piece->blendop_data != DEVELOP_MASK_DISABLED)
+    {
+      dt_develop_tiling_t tiling_blendop = { 0 };
+      tiling_callback_blendop(module, piece, &roi_in, &roi_out, &tiling_blendop);
+      p->tiling.factor = fmax(p->tiling.factor, tiling_blendop.factor);
+      p->tiling.maxbuf = fmax(p->tiling.maxbuf, tiling_blendop.maxbuf);
+      p->tiling.overhead = MAX(p->tiling.overhead, tiling_blendop.overhead);
+    }
+    p->process_cl = module->process_cl && piece->process_cl_ready
+                    && !((pipe->type == DT_DEV_PIXELPIPE_PREVIEW)
+                         && (module->flags() & IOP_FLAGS_PREVIEW_NON_OPENCL));
+    p->fits_device = dt_opencl_image_fits_device(pipe->devid, p->width, p->height, p->bpp, p->tiling.factor,
+                                                 p->tiling.overhead);
+    p->fits_host = dt_tiling_piece_fits_host_memory(p->width, p->height, p->bpp, p->tiling.factor,
+                                                    p->tiling.overhead);
+    roi_out = roi_in;
+  }
+  dt_pthread_mutex_unlock(&pipe->busy_mutex);
+
+  // first and last module in the pipe that can't go to the device
+  int first = -1, last = -1;
+  for(int k = n - 1; k >= 0; k--)
+  {
+    const dt_dev_pixelpipe_plan_t *p = plan + k;
+    if(p->process_cl && (p->fits_device || p->piece->process_tiling_ready)) continue;
+    if(first == -1) first = k;
+    last = k;
+  }
+  for(int k = last; k >= 0 && k <= first; k++) plan[k].piece->plan_cpu = 1;
+
+  if(darktable.unmuted & DT_DEBUG_TILING)
+  {
+    dt_print(DT_DEBUG_TILING, "[pixelpipe_plan] [%s] %dx%d scale %.3f on device %d: %s\n",
+             _pipe_type_to_str(pipe->type), roi->width, roi->height, roi->scale, pipe->devid,
+             first == -1 ? "all modules on the device" : "some modules on the cpu");
+    for(int k = n - 1; k >= 0; k--)
+    {
+      const dt_dev_pixelpipe_plan_t *p = plan + k;
+      const int cpu = p->piece->plan_cpu;
+      const char *reason = "";
+      if(cpu && !p->process_cl)
+        reason = ", no opencl for it";
+      else if(cpu && !p->fits_device && !p->piece->process_tiling_ready)
+        reason = ", too large for the device";
+      else if(cpu)
+        reason = ", between modules on the cpu";
+      dt_print(DT_DEBUG_TILING,
+               "[pixelpipe_plan] [%s]   %-20s %5dx%-5d %2zu bpp factor %.2f overhead %u: %s%s%s\n",
+               _pipe_type_to_str(pipe->type), p->module->op, p->width, p->height, p->bpp, p->tiling.factor,
+               p->tiling.overhead, cpu ? "cpu" : "device",
+               (cpu ? !p->fits_host : !p->fits_device) ? " with tiling" : "", reason);
+    }
+  }
+  free(plan);
+}
+
 int dt_dev_pixelpipe_process(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, int x, int y, int width, int height,
                              float scale)
 {
+  const int64_t trace_start = dt_trace_now();
+  DT_TIMER_SCOPE(pipe_timer, "pixelpipe");
+  DT_TIMER_SCOPE(pipe_type_timer, _pipe_type_to_str(pipe->type));
   pipe->processing = 1;
   pipe->opencl_enabled = dt_opencl_update_settings(); // update enabled flag and profile from preferences
-  pipe->devid = (pipe->opencl_enabled) ? dt_opencl_lock_device(pipe->type)
-                                       : -1; // try to get/lock opencl resource
+  pipe->devid = (pipe->opencl_enabled) ? dt_compute_lock_device(pipe->type)
+                                       : -1; // try to get/lock a device
 
   dt_print(DT_DEBUG_OPENCL, "[pixelpipe_process] [%s] using device %d\n", _pipe_type_to_str(pipe->type),
            pipe->devid);
@@ -2241,14 +3404,21 @@ int dt_dev_pixelpipe_process(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, int x,
   {
     fprintf(stderr, "[memory] before pixelpipe process\n");
     dt_print_mem_usage();
+    dt_memory_print(darktable.memory);
   }
 
-  if(pipe->devid >= 0) dt_opencl_events_reset(pipe->devid);
+  if(pipe->devid >= 0) dt_compute_events_reset(pipe->devid);
 
   dt_iop_roi_t roi = (dt_iop_roi_t){ x, y, width, height, scale };
   // printf("pixelpipe homebrew process start\n");
   if(darktable.unmuted & DT_DEBUG_DEV) dt_dev_pixelpipe_cache_print(&pipe->cache);
 
+  // lines are shared with other pipes working on the same input only
+  uint64_t salt = 5381;
+  const int input_dims[3] = { pipe->iwidth, pipe->iheight, (int)(pipe->iscale * 1000.0f) };
+  for(int k = 0; k < 3; k++) salt = ((salt << 5) + salt) ^ input_dims[k];
+  dt_dev_pixelpipe_cache_begin(&pipe->cache, salt);
+
   //  go through list of modules from the end:
   guint pos = g_list_length(dev->iop);
   GList *modules = g_list_last(dev->iop);
@@ -2258,8 +3428,15 @@ int dt_dev_pixelpipe_process(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, int x,
 restart:
 
   // check if we should obsolete caches
-  if(pipe->cache_obsolete) dt_dev_pixelpipe_cache_flush(&(pipe->cache));
+  if(pipe->cache_obsolete)
+  {
+    dt_dev_pixelpipe_cache_flush(&(pipe->cache));
+    // whatever made the cache obsolete is not part of the hash, so the shared lines are stale as well.
+    if(pipe->cache.store) dt_dev_pixelpipe_cache_store_flush(pipe->cache.store);
+  }
   pipe->cache_obsolete = 0;
+  dt_dev_pixelpipe_report_begin(pipe);
+  dt_dev_pixelpipe_cache_hash_check(pipe);
 
   // mask display off as a starting point
   pipe->mask_display = DT_DEV_PIXELPIPE_DISPLAY_NONE;
@@ -2270,12 +3447,19 @@ restart:
   dt_iop_buffer_dsc_t _out_format = { 0 };
   dt_iop_buffer_dsc_t *out_format = &_out_format;
 
-  // run pixelpipe recursively and get error status
-  int err = dt_dev_pixelpipe_process_rec_and_backcopy(pipe, dev, &buf, &cl_mem_out, &out_format, &roi, modules,
-                                                      pieces, pos);
+  // decide where the modules run before any of them does
+  _plan_pipe(pipe, dev, &roi, modules, pieces);
+
+  // run pixelpipe recursively and get error status, unless a local edit can be patched into the last output
+  int err = 0;
+  if(!_process_patch(pipe, dev, &buf, &cl_mem_out, &out_format, &roi, modules, pieces, pos, &err))
+    err = dt_dev_pixelpipe_process_rec_and_backcopy(pipe, dev, &buf, &cl_mem_out, &out_format, &roi, modules,
+                                                    pieces, pos);
+
+  if(!err) dt_dev_pixelpipe_report_kernel_times(pipe);
 
   // get status summary of opencl queue by checking the eventlist
-  int oclerr = (pipe->devid >= 0) ? (dt_opencl_events_flush(pipe->devid, 1) != 0) : 0;
+  int oclerr = (pipe->devid >= 0) ? (dt_compute_events_flush(pipe->devid, 1) != 0) : 0;
 
   // Check if we had opencl errors ....
   // remark: opencl errors can come in two ways: pipe->opencl_error is TRUE (and err is TRUE) OR oclerr is
@@ -2284,7 +3468,7 @@ restart:
   {
     // Well, there were errors -> we might need to free an invalid opencl memory object
     dt_opencl_release_mem_object(cl_mem_out);
-    dt_opencl_unlock_device(pipe->devid); // release opencl resource
+    dt_compute_unlock_device(pipe->devid); // release opencl resource
     dt_pthread_mutex_lock(&pipe->busy_mutex);
     pipe->opencl_enabled = 0; // disable opencl for this pipe
     pipe->opencl_error = 0;   // reset error status
@@ -2315,20 +3499,26 @@ restart:
   // release resources:
   if(pipe->devid >= 0)
   {
-    dt_opencl_unlock_device(pipe->devid);
+    dt_compute_unlock_device(pipe->devid);
     pipe->devid = -1;
   }
   // ... and in case of other errors ...
   if(err)
   {
+    dt_dev_pixelpipe_cache_end(&pipe->cache, 0);
     pipe->processing = 0;
     return 1;
   }
 
   // terminate
+  dt_dev_pixelpipe_cache_end(&pipe->cache, 1);
+  _dirty_snapshot(pipe, dev, &roi, pos);
+  dt_dev_pixelpipe_report_end(pipe, &roi);
+  dt_trace_span("pixelpipe", _pipe_type_to_str(pipe->type), trace_start, NULL);
   dt_pthread_mutex_lock(&pipe->backbuf_mutex);
   pipe->backbuf_hash = dt_dev_pixelpipe_cache_hash(pipe->image.id, &roi, pipe, 0);
   pipe->backbuf = buf;
+  pipe->cache.backbuf = buf;
   pipe->backbuf_width = width;
   pipe->backbuf_height = height;
   dt_pthread_mutex_unlock(&pipe->backbuf_mutex);
@@ -2381,6 +3571,44 @@ void dt_dev_pixelpipe_get_dimensions(dt_dev_pixelpipe_t *pipe, struct dt_develop
   dt_pthread_mutex_unlock(&pipe->busy_mutex);
 }
 
+int dt_dev_pixelpipe_streaming_barriers(dt_dev_pixelpipe_t *pipe, struct dt_develop_t *dev)
+{
+  int barriers = 0;
+  GList *pieces = pipe->nodes;
+  for(GList *modules = dev->iop; modules && pieces; modules = g_list_next(modules), pieces = g_list_next(pieces))
+  {
+    dt_iop_module_t *module = (dt_iop_module_t *)modules->data;
+    dt_dev_pixelpipe_iop_t *piece = (dt_dev_pixelpipe_iop_t *)pieces->data;
+    if(piece->enabled && (module->flags() & IOP_FLAGS_NO_TILE_STREAMING)) barriers++;
+  }
+  return barriers;
+}
+
+int dt_dev_pixelpipe_streaming_overlap(dt_dev_pixelpipe_t *pipe, struct dt_develop_t *dev, const float scale)
+{
+  // the overlaps are in input pixels of each module, close enough to output pixels at the export scale.
+  // the barriers see their full input, so the ones before the last of them don't count.
+  int overlap = 0;
+  GList *pieces = pipe->nodes;
+  for(GList *modules = dev->iop; modules && pieces; modules = g_list_next(modules), pieces = g_list_next(pieces))
+  {
+    dt_iop_module_t *module = (dt_iop_module_t *)modules->data;
+    dt_dev_pixelpipe_iop_t *piece = (dt_dev_pixelpipe_iop_t *)pieces->data;
+    if(!piece->enabled) continue;
+    if(module->flags() & IOP_FLAGS_NO_TILE_STREAMING)
+    {
+      overlap = 0;
+      continue;
+    }
+    const dt_iop_roi_t roi_in = { 0, 0, piece->buf_in.width * scale, piece->buf_in.height * scale, scale };
+    const dt_iop_roi_t roi_out = { 0, 0, piece->buf_out.width * scale, piece->buf_out.height * scale, scale };
+    dt_develop_tiling_t tiling = { 0 };
+    module->tiling_callback(module, piece, &roi_in, &roi_out, &tiling);
+    overlap += tiling.overlap;
+  }
+  return overlap;
+}
+
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
 // kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
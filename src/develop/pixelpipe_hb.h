@@ -24,6 +24,7 @@
 #include "develop/develop.h"
 #include "develop/imageop.h"
 #include "develop/pixelpipe_cache.h"
+#include "develop/pixelpipe_report.h"
 
 /**
  * struct used by iop modules to connect to pixelpipe.
@@ -55,9 +56,16 @@ typedef struct dt_dev_pixelpipe_iop_t
       buf_out;                // theoretical full buffer regions of interest, as passed through modify_roi_out
   int process_cl_ready;       // set this to 0 in commit_params to temporarily disable the use of process_cl
   int process_tiling_ready;   // set this to 0 in commit_params to temporarily disable tiling
+  int plan_cpu;               // set by the memory planner of the pipe: stay on the cpu with this one
+  int draft;                  // set while a slider of this or an earlier module is dragged in the center view,
+                              // commit_params and process may trade quality for speed then
 
   // the following are used  internally for caching:
   dt_iop_buffer_dsc_t dsc_in, dsc_out;
+  // state in the last complete run of the pipe, to tell what changed since
+  uint64_t last_hash;
+  int last_enabled;
+  dt_iop_roi_t last_roi; // region of interest of the output
 } dt_dev_pixelpipe_iop_t;
 
 typedef enum dt_dev_pixelpipe_change_t
@@ -115,6 +123,8 @@ typedef struct dt_dev_pixelpipe_t
   int opencl_error;
   // running in a tiling context?
   int tiling;
+  // processing one tile of the output at a time, see dt_dev_pixelpipe_init_export_streaming()
+  int tile_streaming;
   // should this pixelpipe display a mask in the end?
   int mask_display;
   // input data based on this timestamp:
@@ -124,12 +134,57 @@ typedef struct dt_dev_pixelpipe_t
   dt_imageio_levels_t levels;
   // opencl device that has been locked for this pipe.
   int devid;
+  // per module timings of the current run, see pixelpipe_report.h
+  dt_dev_pixelpipe_report_t report;
   // image struct as it was when the pixelpipe was initialized. copied to avoid race conditions.
   dt_image_t image;
+  // what local edits touched since the last complete run, see dt_dev_pixelpipe_dirty_region()
+  struct
+  {
+    const struct dt_iop_module_t *module; // the one module that reported a region
+    int untracked;                        // something changed that can't be narrowed down to a region
+    int area[4];                          // x0, y0, x1, y1 in full resolution input coordinates of module
+    // the last complete run: its output and the focused module at the time
+    int valid;
+    dt_iop_roi_t roi;
+    uint64_t hash;
+    const struct dt_iop_module_t *gui_module;
+    // while patching: the input of module can be cut out of this cache line
+    int patching;
+    int src_pos;
+    uint64_t src_hash;
+    dt_iop_roi_t src_roi;
+  } dirty;
+  // running hashes of the module stack, see dt_dev_pixelpipe_cache_hash()
+  struct
+  {
+    uint64_t *hash; // hash[k] covers the first k pieces
+    int size;
+    int valid;      // hash[0] .. hash[valid - 1] are up to date
+    int imgid;
+    uint64_t state; // focused module and color pickers they were computed with
+  } prefix;
 } dt_dev_pixelpipe_t;
 
+/** cancellation token of the current run of pipe: non-zero once the run got superseded by a change that
+ * will restart the pipe, or the pipe shuts down. cheap enough to be polled from process() per block of
+ * rows or per tile, which can then stop early. dt_dev_pixelpipe_process_rec() throws the output away. */
+static inline int dt_dev_pixelpipe_cancelled(const dt_dev_pixelpipe_t *pipe)
+{
+  // written from other threads
+  if(*(const volatile int *)&pipe->shutdown) return 1;
+  const dt_dev_pixelpipe_change_t changed = *(const volatile dt_dev_pixelpipe_change_t *)&pipe->changed;
+  // zooming only matters to the full pipe, the preview always covers the whole image
+  if(pipe->type == DT_DEV_PIXELPIPE_PREVIEW)
+    return changed != DT_DEV_PIPE_UNCHANGED && changed != DT_DEV_PIPE_ZOOMED;
+  return changed != DT_DEV_PIPE_UNCHANGED;
+}
+
 struct dt_develop_t;
 
+// most modules flagged IOP_FLAGS_NO_TILE_STREAMING a tile streaming pipe can handle
+#define DT_DEV_PIXELPIPE_STREAMING_MAX_BARRIERS 4
+
 // inits the pixelpipe with plain passthrough input/output and empty input and default caching settings.
 int dt_dev_pixelpipe_init(dt_dev_pixelpipe_t *pipe);
 // inits the preview pixelpipe with plain passthrough input/output and empty input and default caching
@@ -137,6 +192,10 @@ int dt_dev_pixelpipe_init(dt_dev_pixelpipe_t *pipe);
 int dt_dev_pixelpipe_init_preview(dt_dev_pixelpipe_t *pipe);
 // inits the pixelpipe with settings optimized for full-image export (no history stack cache)
 int dt_dev_pixelpipe_init_export(dt_dev_pixelpipe_t *pipe, int32_t width, int32_t height, int levels);
+// inits the pixelpipe for exports that process the output in tiles, so no full size buffers are needed
+// between modules. modules flagged IOP_FLAGS_NO_TILE_STREAMING still see their whole input: their full
+// output is computed once and kept, the tiles are cut from that.
+int dt_dev_pixelpipe_init_export_streaming(dt_dev_pixelpipe_t *pipe, int levels);
 // inits the pixelpipe with settings optimized for thumbnail export (no history stack cache)
 int dt_dev_pixelpipe_init_thumbnail(dt_dev_pixelpipe_t *pipe, int32_t width, int32_t height);
 // inits all but the pixel caches, so you can't actually process an image (just get dimensions and
@@ -144,7 +203,8 @@ int dt_dev_pixelpipe_init_thumbnail(dt_dev_pixelpipe_t *pipe, int32_t width, int
 int dt_dev_pixelpipe_init_dummy(dt_dev_pixelpipe_t *pipe, int32_t width, int32_t height);
 // inits the pixelpipe with given cacheline size and number of entries.
 int dt_dev_pixelpipe_init_cached(dt_dev_pixelpipe_t *pipe, size_t size, int32_t entries);
-// constructs a new input buffer from given RGB float array.
+// constructs a new input buffer from given RGB float array. it is read in place where possible, so it has to
+// stay valid (the mipmap buffer locked) while the pipe runs, and nothing may write to it.
 void dt_dev_pixelpipe_set_input(dt_dev_pixelpipe_t *pipe, struct dt_develop_t *dev, float *input, int width,
                                 int height, float iscale);
 
@@ -152,6 +212,19 @@ void dt_dev_pixelpipe_set_input(dt_dev_pixelpipe_t *pipe, struct dt_develop_t *d
 void dt_dev_pixelpipe_get_dimensions(dt_dev_pixelpipe_t *pipe, struct dt_develop_t *dev, int width_in,
                                      int height_in, int *width, int *height);
 
+// number of enabled modules that need their full input when tile streaming. needs the dimensions.
+int dt_dev_pixelpipe_streaming_barriers(dt_dev_pixelpipe_t *pipe, struct dt_develop_t *dev);
+// border in output pixels a streamed tile needs around it to come out the same as in one piece, summed
+// over the overlaps the modules report to the tiling code. needs the dimensions.
+int dt_dev_pixelpipe_streaming_overlap(dt_dev_pixelpipe_t *pipe, struct dt_develop_t *dev, const float scale);
+
+// a local edit in module only changed the given area (x, y, width and height, in full resolution input
+// coordinates of the module) since the last run of pipe, NULL if the change isn't local. if only this module
+// changed, the next run of the full pipe recomputes just the part of the output the area reaches and patches
+// it into the previous output.
+void dt_dev_pixelpipe_dirty_region(dt_dev_pixelpipe_t *pipe, const struct dt_iop_module_t *module,
+                                   const int *area);
+
 // destroys all allocated data.
 void dt_dev_pixelpipe_cleanup(dt_dev_pixelpipe_t *pipe);
 
@@ -165,6 +238,9 @@ void dt_dev_pixelpipe_change(dt_dev_pixelpipe_t *pipe, struct dt_develop_t *dev)
 void dt_dev_pixelpipe_cleanup_nodes(dt_dev_pixelpipe_t *pipe);
 // sync with develop_t history stack from scratch (new node added, have to pop old ones)
 void dt_dev_pixelpipe_create_nodes(dt_dev_pixelpipe_t *pipe, struct dt_develop_t *dev);
+// for a pipe processing another image: keeps the nodes if they were made for the modules dev has now, else
+// creates them again. returns 1 if they were kept.
+int dt_dev_pixelpipe_renew_nodes(dt_dev_pixelpipe_t *pipe, struct dt_develop_t *dev);
 // sync with develop_t history stack by just copying the top item params (same op, new params on top)
 void dt_dev_pixelpipe_synch_all(dt_dev_pixelpipe_t *pipe, struct dt_develop_t *dev);
 // adjust output node according to history stack (history pop event)
@@ -0,0 +1,213 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2017 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "develop/pixelpipe_report.h"
+#include "common/compute.h"
+#include "common/darktable.h"
+#include "common/opencl.h"
+#include "control/conf.h"
+#include "develop/imageop.h"
+#include "develop/pixelpipe_hb.h"
+
+#include <glib/gstdio.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// reports of all pipes, for lua
+static struct
+{
+  GMutex lock; // also serializes writing the file
+  gchar *lines[DT_DEV_PIXELPIPE_REPORT_RING];
+  int next;
+} _reports = { { 0 } };
+
+static const char *_pipe_type_name(const dt_dev_pixelpipe_type_t type)
+{
+  switch(type)
+  {
+    case DT_DEV_PIXELPIPE_PREVIEW:
+      return "preview";
+    case DT_DEV_PIXELPIPE_FULL:
+      return "full";
+    case DT_DEV_PIXELPIPE_THUMBNAIL:
+      return "thumbnail";
+    case DT_DEV_PIXELPIPE_EXPORT:
+      return "export";
+    default:
+      return "unknown";
+  }
+}
+
+void dt_dev_pixelpipe_report_begin(dt_dev_pixelpipe_t *pipe)
+{
+  dt_dev_pixelpipe_report_t *report = &pipe->report;
+  report->enabled = dt_conf_get_bool("pixelpipe_report");
+  report->count = 0;
+  report->start = dt_get_wtime();
+  report->device_peak = 0;
+  report->device_peak_op[0] = '\0';
+}
+
+int dt_dev_pixelpipe_report_module_begin(const dt_dev_pixelpipe_t *pipe)
+{
+  if(pipe->devid < 0) return 0;
+  dt_opencl_memory_module_begin(pipe->devid);
+  if(!pipe->report.enabled) return 0;
+  return dt_compute_events_count(pipe->devid);
+}
+
+void dt_dev_pixelpipe_report_add(dt_dev_pixelpipe_t *pipe, const dt_iop_module_t *module, const int fused,
+                                 const int device, const dt_iop_roi_t *roi_out, const int tiling,
+                                 const double start, const size_t memory, const int event_first)
+{
+  dt_dev_pixelpipe_report_t *report = &pipe->report;
+  // the device of the pipe even if the module ran on the cpu, a failed allocation might have sent it there
+  const size_t device_peak = pipe->devid >= 0 ? dt_opencl_memory_module_end(pipe->devid, module->op) : 0;
+  if(device_peak > report->device_peak)
+  {
+    report->device_peak = device_peak;
+    g_strlcpy(report->device_peak_op, module->op, sizeof(report->device_peak_op));
+  }
+  if(!report->enabled) return;
+  if(report->count == report->size)
+  {
+    const int size = MAX(32, 2 * report->size);
+    dt_dev_pixelpipe_report_entry_t *entries = (dt_dev_pixelpipe_report_entry_t *)realloc(
+        report->entries, sizeof(dt_dev_pixelpipe_report_entry_t) * size);
+    if(!entries) return;
+    report->entries = entries;
+    report->size = size;
+  }
+  dt_dev_pixelpipe_report_entry_t *entry = report->entries + report->count++;
+  g_strlcpy(entry->op, module->op, sizeof(entry->op));
+  entry->instance = module->multi_priority;
+  entry->fused = fused;
+  entry->device = device;
+  entry->width = roi_out->width;
+  entry->height = roi_out->height;
+  entry->tiling = tiling;
+  entry->wall = dt_get_wtime() - start;
+  entry->kernel = device < 0 ? 0.0 : -1.0;
+  entry->memory = memory;
+  entry->device_peak = device_peak;
+  entry->event_first = event_first;
+  entry->event_last = device < 0 ? event_first : dt_compute_events_count(device);
+}
+
+void dt_dev_pixelpipe_report_kernel_times(dt_dev_pixelpipe_t *pipe)
+{
+  dt_dev_pixelpipe_report_t *report = &pipe->report;
+  if(!report->enabled || pipe->devid < 0) return;
+  // have the events finish and their profiling info read, without resetting them
+  (void)dt_compute_events_flush(pipe->devid, 0);
+  for(int k = 0; k < report->count; k++)
+  {
+    dt_dev_pixelpipe_report_entry_t *entry = report->entries + k;
+    if(entry->device == pipe->devid)
+      entry->kernel = dt_compute_events_time(pipe->devid, entry->event_first, entry->event_last);
+  }
+}
+
+static void _append_double(GString *json, const char *key, const double value)
+{
+  char buf[G_ASCII_DTOSTR_BUF_SIZE];
+  g_string_append_printf(json, ",\"%s\":%s", key, g_ascii_formatd(buf, sizeof(buf), "%.6f", value));
+}
+
+void dt_dev_pixelpipe_report_end(dt_dev_pixelpipe_t *pipe, const dt_iop_roi_t *roi)
+{
+  dt_dev_pixelpipe_report_t *report = &pipe->report;
+  const size_t max_global_mem = dt_opencl_get_max_global_mem(pipe->devid);
+  if(pipe->devid >= 0 && report->device_peak && (darktable.unmuted & DT_DEBUG_MEMORY))
+    dt_print(DT_DEBUG_OPENCL, "[opencl memory] %s pipe on device %d: peak %.1f MB in `%s', headroom %.1f MB of "
+                              "%.1f MB\n",
+             _pipe_type_name(pipe->type), pipe->devid, report->device_peak / 1048576.0, report->device_peak_op,
+             (max_global_mem - MIN(report->device_peak, max_global_mem)) / 1048576.0, max_global_mem / 1048576.0);
+  if(!report->enabled) return;
+
+  GString *json = g_string_new(NULL);
+  g_string_append_printf(json, "{\"pipe\":\"%s\",\"imgid\":%d,\"width\":%d,\"height\":%d",
+                         _pipe_type_name(pipe->type), pipe->image.id, roi->width, roi->height);
+  _append_double(json, "scale", roi->scale);
+  g_string_append_printf(json, ",\"device\":%d", pipe->devid);
+  _append_double(json, "wall", dt_get_wtime() - report->start);
+  g_string_append(json, ",\"modules\":[");
+  for(int k = 0; k < report->count; k++)
+  {
+    const dt_dev_pixelpipe_report_entry_t *entry = report->entries + k;
+    g_string_append_printf(json, "%s{\"module\":\"%s\",\"instance\":%d,\"fused\":%d,\"device\":%d,"
+                                 "\"width\":%d,\"height\":%d,\"tiling\":%s",
+                           k ? "," : "", entry->op, entry->instance, entry->fused, entry->device, entry->width,
+                           entry->height, entry->tiling ? "true" : "false");
+    _append_double(json, "wall", entry->wall);
+    if(entry->kernel >= 0.0)
+      _append_double(json, "kernel", entry->kernel);
+    else
+      g_string_append(json, ",\"kernel\":null");
+    g_string_append_printf(json, ",\"peak_memory\":%zu", entry->memory);
+    if(pipe->devid >= 0)
+      g_string_append_printf(json, ",\"device_peak\":%zu,\"device_headroom\":%zu}", entry->device_peak,
+                             max_global_mem - MIN(entry->device_peak, max_global_mem));
+    else
+      g_string_append(json, "}");
+  }
+  g_string_append(json, "]}");
+
+  gchar *filename = dt_conf_get_string("pixelpipe_report_file");
+  g_mutex_lock(&_reports.lock);
+  if(filename && *filename)
+  {
+    FILE *f = g_fopen(filename, "a");
+    if(f)
+    {
+      fprintf(f, "%s\n", json->str);
+      fclose(f);
+    }
+  }
+  g_free(_reports.lines[_reports.next]);
+  _reports.lines[_reports.next] = g_string_free(json, FALSE);
+  _reports.next = (_reports.next + 1) % DT_DEV_PIXELPIPE_REPORT_RING;
+  g_mutex_unlock(&_reports.lock);
+  g_free(filename);
+}
+
+void dt_dev_pixelpipe_report_cleanup(dt_dev_pixelpipe_t *pipe)
+{
+  free(pipe->report.entries);
+  pipe->report.entries = NULL;
+  pipe->report.count = pipe->report.size = 0;
+}
+
+gchar **dt_dev_pixelpipe_report_get_recent(void)
+{
+  gchar **lines = g_new0(gchar *, DT_DEV_PIXELPIPE_REPORT_RING + 1);
+  int n = 0;
+  g_mutex_lock(&_reports.lock);
+  for(int k = 0; k < DT_DEV_PIXELPIPE_REPORT_RING; k++)
+  {
+    const gchar *line = _reports.lines[(_reports.next + k) % DT_DEV_PIXELPIPE_REPORT_RING];
+    if(line) lines[n++] = g_strdup(line);
+  }
+  g_mutex_unlock(&_reports.lock);
+  return lines;
+}
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
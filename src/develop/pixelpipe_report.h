@@ -0,0 +1,93 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2017 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <glib.h>
+#include <stddef.h>
+
+struct dt_dev_pixelpipe_t;
+struct dt_iop_module_t;
+struct dt_iop_roi_t;
+
+/**
+ * structured performance report of pixelpipe runs. with the conf key pixelpipe_report set, every complete run
+ * of a pipe is turned into one line of json listing its modules with device, region of interest, tiling,
+ * wall time, time spent in opencl kernels, memory needed and the peak of opencl memory in use on the device of
+ * the pipe while the module ran, with the headroom left against dt_opencl_get_max_global_mem(). the lines are
+ * appended to the file named by pixelpipe_report_file, if any, and the last DT_DEV_PIXELPIPE_REPORT_RING of
+ * them are kept in memory for lua (darktable.perf.pixelpipe_reports()).
+ */
+
+#define DT_DEV_PIXELPIPE_REPORT_RING 64
+
+typedef struct dt_dev_pixelpipe_report_entry_t
+{
+  char op[20];
+  int instance;
+  int fused;                   // number of modules processed in one go, starting with this one
+  int device;                  // opencl device, -1 for the cpu
+  int width, height;           // output region of interest
+  int tiling;
+  double wall;                 // seconds
+  double kernel;               // seconds in opencl kernels, negative if unknown
+  size_t memory;               // peak memory as given by the tiling requirements, in bytes
+  size_t device_peak;          // most memory in use on the opencl device of the pipe, 0 without one
+  int event_first, event_last; // opencl events the module added
+} dt_dev_pixelpipe_report_entry_t;
+
+typedef struct dt_dev_pixelpipe_report_t
+{
+  int enabled;
+  double start;
+  int count, size;
+  dt_dev_pixelpipe_report_entry_t *entries;
+  // kept even with reports disabled, for the summary of `-d opencl -d memory`
+  size_t device_peak;
+  char device_peak_op[20];
+} dt_dev_pixelpipe_report_t;
+
+/** starts collecting for a run of pipe, if reports are enabled. */
+void dt_dev_pixelpipe_report_begin(struct dt_dev_pixelpipe_t *pipe);
+
+/** marks the start of a module and returns the opencl event index to pass to dt_dev_pixelpipe_report_add() as
+ * event_first. from here on the opencl memory used on the device of the pipe is attributed to the module. */
+int dt_dev_pixelpipe_report_module_begin(const struct dt_dev_pixelpipe_t *pipe);
+
+/** adds the processing of module (and fused - 1 modules after it) that started at start to the run. */
+void dt_dev_pixelpipe_report_add(struct dt_dev_pixelpipe_t *pipe, const struct dt_iop_module_t *module,
+                                 const int fused, const int device, const struct dt_iop_roi_t *roi_out,
+                                 const int tiling, const double start, const size_t memory,
+                                 const int event_first);
+
+/** fetches the kernel times of the run from the opencl events, before they are reset. */
+void dt_dev_pixelpipe_report_kernel_times(struct dt_dev_pixelpipe_t *pipe);
+
+/** completes the report of a successful run over roi and publishes it. the entries stay in the pipe until
+ * the next run begins. with `-d opencl -d memory` prints which module needed the most device memory. */
+void dt_dev_pixelpipe_report_end(struct dt_dev_pixelpipe_t *pipe, const struct dt_iop_roi_t *roi);
+
+/** frees what the pipe collected. */
+void dt_dev_pixelpipe_report_cleanup(struct dt_dev_pixelpipe_t *pipe);
+
+/** copies of the reports kept in memory, oldest first, NULL terminated. free with g_strfreev(). */
+gchar **dt_dev_pixelpipe_report_get_recent(void);
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
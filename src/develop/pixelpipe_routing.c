@@ -0,0 +1,276 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2017 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "develop/pixelpipe_routing.h"
+#include "common/darktable.h"
+#include "common/database.h"
+#include "common/debug.h"
+#include "common/opencl.h"
+#include "control/conf.h"
+#include "develop/imageop.h"
+#include "develop/pixelpipe_hb.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+// timings count once there are this many samples. device runs get synchronized until then, and every
+// DT_ROUTING_RESAMPLE runs after that to follow changes.
+#define DT_ROUTING_MIN_SAMPLES 3
+#define DT_ROUTING_RESAMPLE 64
+// the running average forgets older samples at this rate
+#define DT_ROUTING_AVERAGE 8
+// the cpu has to be this much faster, so modules don't flip between devices on noise
+#define DT_ROUTING_MARGIN 0.8
+// not a module name, holds the transfer times of a device in seconds per megabyte
+#define DT_ROUTING_TRANSFER "_transfer"
+
+typedef struct dt_dev_pixelpipe_routing_entry_t
+{
+  char op[20];
+  char device[64];
+  int bucket;
+  double time; // seconds per megapixel, or per megabyte for transfers
+  int count;
+  int runs;
+  int dirty;
+} dt_dev_pixelpipe_routing_entry_t;
+
+static struct
+{
+  GMutex lock;
+  GHashTable *entries; // "op|device|bucket" -> dt_dev_pixelpipe_routing_entry_t
+} _routing = { { 0 } };
+
+static const char *_device_name(const int devid)
+{
+#ifdef HAVE_OPENCL
+  if(devid >= 0 && darktable.opencl && darktable.opencl->inited && devid < darktable.opencl->num_devs)
+    return darktable.opencl->dev[devid].cname;
+#endif
+  return devid < 0 ? "cpu" : NULL;
+}
+
+// regions of interest grow by a factor of 4 from one bucket to the next
+static int _bucket(const dt_iop_roi_t *roi_in, const dt_iop_roi_t *roi_out, double *mpix)
+{
+  const double pixels = (double)MAX(roi_in->width, roi_out->width) * MAX(roi_in->height, roi_out->height);
+  *mpix = pixels * 1e-6;
+  return MAX(0, (int)(log2(MAX(pixels, 1.0)) / 2.0));
+}
+
+static void _load()
+{
+  static gsize done = 0;
+  if(!g_once_init_enter(&done)) return;
+
+  g_mutex_init(&_routing.lock);
+  _routing.entries = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, free);
+  if(darktable.db)
+  {
+    sqlite3_stmt *stmt;
+    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                                "SELECT operation, device, bucket, time, count FROM data.module_timings", -1,
+                                &stmt, NULL);
+    while(sqlite3_step(stmt) == SQLITE_ROW)
+    {
+      const char *op = (const char *)sqlite3_column_text(stmt, 0);
+      const char *device = (const char *)sqlite3_column_text(stmt, 1);
+      if(!op || !device) continue;
+      dt_dev_pixelpipe_routing_entry_t *e
+          = (dt_dev_pixelpipe_routing_entry_t *)calloc(1, sizeof(dt_dev_pixelpipe_routing_entry_t));
+      if(!e) break;
+      g_strlcpy(e->op, op, sizeof(e->op));
+      g_strlcpy(e->device, device, sizeof(e->device));
+      e->bucket = sqlite3_column_int(stmt, 2);
+      e->time = sqlite3_column_double(stmt, 3);
+      e->count = sqlite3_column_int(stmt, 4);
+      g_hash_table_insert(_routing.entries, g_strdup_printf("%s|%s|%d", e->op, e->device, e->bucket), e);
+    }
+    sqlite3_finalize(stmt);
+  }
+
+  g_once_init_leave(&done, 1);
+}
+
+// expects the lock
+static dt_dev_pixelpipe_routing_entry_t *_lookup(const char *op, const char *device, const int bucket,
+                                                 const int create)
+{
+  if(!_routing.entries) return NULL; // after cleanup
+  gchar *key = g_strdup_printf("%s|%s|%d", op, device, bucket);
+  dt_dev_pixelpipe_routing_entry_t *e
+      = (dt_dev_pixelpipe_routing_entry_t *)g_hash_table_lookup(_routing.entries, key);
+  if(e || !create || !(e = (dt_dev_pixelpipe_routing_entry_t *)calloc(1, sizeof(*e))))
+  {
+    g_free(key);
+    return e;
+  }
+  g_strlcpy(e->op, op, sizeof(e->op));
+  g_strlcpy(e->device, device, sizeof(e->device));
+  e->bucket = bucket;
+  g_hash_table_insert(_routing.entries, key, e);
+  return e;
+}
+
+static void _add_sample(const char *op, const char *device, const int bucket, const double time)
+{
+  g_mutex_lock(&_routing.lock);
+  dt_dev_pixelpipe_routing_entry_t *e = _lookup(op, device, bucket, 1);
+  if(e)
+  {
+    e->count++;
+    e->time += (time - e->time) / MIN(e->count, DT_ROUTING_AVERAGE);
+    e->dirty = 1;
+  }
+  g_mutex_unlock(&_routing.lock);
+}
+
+static int _enabled(const dt_dev_pixelpipe_t *pipe)
+{
+  return pipe->devid >= 0 && dt_conf_get_bool("opencl_learned_routing");
+}
+
+int dt_dev_pixelpipe_routing_prefer_cpu(const dt_dev_pixelpipe_t *pipe, const dt_iop_module_t *module,
+                                        const dt_iop_roi_t *roi_in, const dt_iop_roi_t *roi_out,
+                                        const size_t in_bpp, const size_t out_bpp, const int input_on_device)
+{
+  if(!_enabled(pipe)) return 0;
+  const char *device = _device_name(pipe->devid);
+  if(!device) return 0;
+  _load();
+
+  double mpix;
+  const int bucket = _bucket(roi_in, roi_out, &mpix);
+  int cpu = 0, explore = 0;
+  double cpu_cost = 0.0, gpu_cost = 0.0;
+  g_mutex_lock(&_routing.lock);
+  const dt_dev_pixelpipe_routing_entry_t *c = _lookup(module->op, "cpu", bucket, 0);
+  const dt_dev_pixelpipe_routing_entry_t *g = _lookup(module->op, device, bucket, 0);
+  const dt_dev_pixelpipe_routing_entry_t *t = _lookup(DT_ROUTING_TRANSFER, device, 0, 0);
+  if(g && t && g->count >= DT_ROUTING_MIN_SAMPLES && t->count >= DT_ROUTING_MIN_SAMPLES)
+  {
+    if(c && c->count >= DT_ROUTING_MIN_SAMPLES)
+    {
+      // going to the cpu means copying the input back, and most likely the output to the device again
+      const double in_mb = (double)in_bpp * roi_in->width * roi_in->height * 1e-6;
+      const double out_mb = (double)out_bpp * roi_out->width * roi_out->height * 1e-6;
+      gpu_cost = g->time * mpix + (input_on_device ? 0.0 : in_mb * t->time);
+      cpu_cost = c->time * mpix + (input_on_device ? in_mb * t->time : 0.0) + out_mb * t->time;
+      cpu = cpu_cost < DT_ROUTING_MARGIN * gpu_cost;
+    }
+    else if(pipe->type == DT_DEV_PIXELPIPE_THUMBNAIL)
+    {
+      // learn the cpu side where it is cheap to try, without the user waiting for it
+      cpu = explore = 1;
+    }
+  }
+  g_mutex_unlock(&_routing.lock);
+
+  if(cpu)
+  {
+    if(explore)
+      dt_print(DT_DEBUG_PERF, "[pixelpipe_routing] trying `%s' at %.2f MP on the cpu\n", module->op, mpix);
+    else
+      dt_print(DT_DEBUG_PERF, "[pixelpipe_routing] `%s' at %.2f MP on the cpu: %.4f secs instead of %.4f\n",
+               module->op, mpix, cpu_cost, gpu_cost);
+  }
+  return cpu;
+}
+
+int dt_dev_pixelpipe_routing_wants_sample(const dt_dev_pixelpipe_t *pipe, const dt_iop_module_t *module,
+                                          const dt_iop_roi_t *roi_in, const dt_iop_roi_t *roi_out)
+{
+  if(!_enabled(pipe)) return 0;
+  const char *device = _device_name(pipe->devid);
+  if(!device) return 0;
+  _load();
+
+  double mpix;
+  const int bucket = _bucket(roi_in, roi_out, &mpix);
+  g_mutex_lock(&_routing.lock);
+  dt_dev_pixelpipe_routing_entry_t *e = _lookup(module->op, device, bucket, 1);
+  const int sample = !e || e->count < DT_ROUTING_MIN_SAMPLES || (++e->runs % DT_ROUTING_RESAMPLE) == 0;
+  g_mutex_unlock(&_routing.lock);
+  return sample;
+}
+
+void dt_dev_pixelpipe_routing_record(const dt_dev_pixelpipe_t *pipe, const dt_iop_module_t *module,
+                                     const int devid, const dt_iop_roi_t *roi_in, const dt_iop_roi_t *roi_out,
+                                     const double seconds)
+{
+  if(!dt_conf_get_bool("opencl_learned_routing")) return;
+  const char *device = _device_name(devid);
+  if(!device) return;
+  _load();
+
+  double mpix;
+  const int bucket = _bucket(roi_in, roi_out, &mpix);
+  if(mpix > 0.0) _add_sample(module->op, device, bucket, seconds / mpix);
+}
+
+void dt_dev_pixelpipe_routing_record_transfer(const int devid, const size_t bytes, const double seconds)
+{
+  if(!dt_conf_get_bool("opencl_learned_routing") || devid < 0 || !bytes) return;
+  const char *device = _device_name(devid);
+  if(!device) return;
+  _load();
+
+  _add_sample(DT_ROUTING_TRANSFER, device, 0, seconds / (bytes * 1e-6));
+}
+
+void dt_dev_pixelpipe_routing_cleanup(void)
+{
+  if(!_routing.entries) return;
+
+  g_mutex_lock(&_routing.lock);
+  if(darktable.db)
+  {
+    sqlite3 *db = dt_database_get(darktable.db);
+    sqlite3_stmt *stmt;
+    sqlite3_exec(db, "BEGIN TRANSACTION", NULL, NULL, NULL);
+    DT_DEBUG_SQLITE3_PREPARE_V2(db, "INSERT OR REPLACE INTO data.module_timings (operation, device, bucket, "
+                                    "time, count) VALUES (?1, ?2, ?3, ?4, ?5)",
+                                -1, &stmt, NULL);
+    GHashTableIter iter;
+    gpointer value;
+    g_hash_table_iter_init(&iter, _routing.entries);
+    while(g_hash_table_iter_next(&iter, NULL, &value))
+    {
+      const dt_dev_pixelpipe_routing_entry_t *e = (const dt_dev_pixelpipe_routing_entry_t *)value;
+      if(!e->dirty) continue;
+      DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 1, e->op, -1, SQLITE_TRANSIENT);
+      DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 2, e->device, -1, SQLITE_TRANSIENT);
+      DT_DEBUG_SQLITE3_BIND_INT(stmt, 3, e->bucket);
+      DT_DEBUG_SQLITE3_BIND_DOUBLE(stmt, 4, e->time);
+      DT_DEBUG_SQLITE3_BIND_INT(stmt, 5, MIN(e->count, DT_ROUTING_AVERAGE));
+      sqlite3_step(stmt);
+      sqlite3_reset(stmt);
+      sqlite3_clear_bindings(stmt);
+    }
+    sqlite3_finalize(stmt);
+    sqlite3_exec(db, "COMMIT", NULL, NULL, NULL);
+  }
+  g_hash_table_destroy(_routing.entries);
+  _routing.entries = NULL;
+  g_mutex_unlock(&_routing.lock);
+}
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
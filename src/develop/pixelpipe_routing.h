@@ -0,0 +1,59 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2017 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <stddef.h>
+
+struct dt_dev_pixelpipe_t;
+struct dt_iop_module_t;
+struct dt_iop_roi_t;
+
+/**
+ * learned cpu/gpu routing. the pixelpipe records how long every module takes on the cpu and on the opencl
+ * device, per size bucket of the region of interest, and how fast buffers move to the device. with conf key
+ * opencl_learned_routing set, a module that could run on the device goes to the cpu instead once the timings
+ * say that is faster, the transfers it causes included. the timings are kept in data.module_timings.
+ */
+
+/** non-zero if module should stay on the cpu although it could run on the device of pipe. input_on_device
+ * tells where its input is now. */
+int dt_dev_pixelpipe_routing_prefer_cpu(const struct dt_dev_pixelpipe_t *pipe,
+                                        const struct dt_iop_module_t *module, const struct dt_iop_roi_t *roi_in,
+                                        const struct dt_iop_roi_t *roi_out, const size_t in_bpp,
+                                        const size_t out_bpp, const int input_on_device);
+
+/** non-zero if the device run of module should be synchronized, so its time can be recorded. */
+int dt_dev_pixelpipe_routing_wants_sample(const struct dt_dev_pixelpipe_t *pipe,
+                                          const struct dt_iop_module_t *module, const struct dt_iop_roi_t *roi_in,
+                                          const struct dt_iop_roi_t *roi_out);
+
+/** records seconds module took on devid (-1 for the cpu), without transfers. */
+void dt_dev_pixelpipe_routing_record(const struct dt_dev_pixelpipe_t *pipe, const struct dt_iop_module_t *module,
+                                     const int devid, const struct dt_iop_roi_t *roi_in,
+                                     const struct dt_iop_roi_t *roi_out, const double seconds);
+
+/** records a blocking copy of bytes to devid. */
+void dt_dev_pixelpipe_routing_record_transfer(const int devid, const size_t bytes, const double seconds);
+
+/** writes what changed to the database. */
+void dt_dev_pixelpipe_routing_cleanup(void);
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
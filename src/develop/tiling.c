@@ -18,6 +18,8 @@
 
 
 #include "develop/tiling.h"
+#include "common/buffer_pool.h"
+#include "common/memory.h"
 #include "common/opencl.h"
 #include "control/control.h"
 #include "develop/blend.h"
@@ -43,6 +45,9 @@
    Needs to be increased if tiling fails due to insufficient buffer sizes. */
 #define RESERVE 5
 
+/* how many more opencl devices a single export may share its tiles with. */
+#define CL_MAX_HELPERS 8
+
 
 /* greatest common divisor */
 static unsigned _gcd(unsigned a, unsigned b)
@@ -75,6 +80,21 @@ static inline int _max(int a, int b)
 }
 
 
+/* memory a piece that wants the given amount may use: host_memory_limit, or less if the memory governor can't
+   make that much room. never less than the 500MB host_memory_limit is clamped to. */
+static float _host_memory_available(const float wanted)
+{
+  const float limit = dt_conf_get_float("host_memory_limit") * 1024.0f * 1024.0f;
+  const float room = dt_memory_make_room(darktable.memory, fminf(limit, wanted));
+  return fmaxf(fminf(limit, room), 500.0f * 1024.0f * 1024.0f);
+}
+
+/* host tile buffers come from the buffer pool and count against the memory budget while they are around */
+static void *_tiling_alloc(const size_t size)
+{
+  return dt_buffer_pool_alloc(darktable.memory ? &darktable.memory->tiling : NULL, size);
+}
+
 static inline int _align_up(int n, int a)
 {
   return n % a != 0 ? (n / a + 1) * a : n;
@@ -610,7 +630,8 @@ static void _default_process_tiling_ptp(struct dt_iop_module_t *self, struct dt_
   }
 
   /* calculate optimal size of tiles */
-  float available = dt_conf_get_float("host_memory_limit") * 1024.0f * 1024.0f;
+  float available = _host_memory_available(tiling.factor * roi_in->width * roi_in->height * max_bpp
+                                           + tiling.overhead);
   assert(available >= 500.0f * 1024.0f * 1024.0f);
   /* correct for size of ivoid and ovoid which are needed on top of tiling */
   available = fmax(available - ((float)roi_out->width * roi_out->height * out_bpp)
@@ -701,14 +722,14 @@ static void _default_process_tiling_ptp(struct dt_iop_module_t *self, struct dt_
            tiles_x, tiles_y, width, height, overlap);
 
   /* reserve input and output buffers for tiles */
-  input = dt_alloc_align(64, (size_t)width * height * in_bpp);
+  input = _tiling_alloc((size_t)width * height * in_bpp);
   if(input == NULL)
   {
     dt_print(DT_DEBUG_DEV, "[default_process_tiling_ptp] could not alloc input buffer for module '%s'\n",
              self->op);
     goto error;
   }
-  output = dt_alloc_align(64, (size_t)width * height * out_bpp);
+  output = _tiling_alloc((size_t)width * height * out_bpp);
   if(output == NULL)
   {
     dt_print(DT_DEBUG_DEV, "[default_process_tiling_ptp] could not alloc output buffer for module '%s'\n",
@@ -728,6 +749,9 @@ static void _default_process_tiling_ptp(struct dt_iop_module_t *self, struct dt_
     {
       piece->pipe->tiling = 1;
 
+      // no point in doing the remaining tiles, the output will be thrown away
+      if(dt_dev_pixelpipe_cancelled(piece->pipe)) goto cancelled;
+
       size_t wd = tx * tile_wd + width > roi_in->width ? roi_in->width - tx * tile_wd : width;
       size_t ht = ty * tile_ht + height > roi_in->height ? roi_in->height - ty * tile_ht : height;
 
@@ -800,11 +824,12 @@ static void _default_process_tiling_ptp(struct dt_iop_module_t *self, struct dt_
                (char *)output + ((j + origin[1]) * wd + origin[0]) * out_bpp, (size_t)region[0] * out_bpp);
     }
 
+cancelled:
   /* copy back final processed_maximum */
   for(int k = 0; k < 4; k++) piece->pipe->dsc.processed_maximum[k] = processed_maximum_new[k];
 
-  if(input != NULL) dt_free_align(input);
-  if(output != NULL) dt_free_align(output);
+  dt_buffer_pool_free(input);
+  dt_buffer_pool_free(output);
   piece->pipe->tiling = 0;
   return;
 
@@ -813,8 +838,8 @@ error:
 // fall through
 
 fallback:
-  if(input != NULL) dt_free_align(input);
-  if(output != NULL) dt_free_align(output);
+  dt_buffer_pool_free(input);
+  dt_buffer_pool_free(output);
   piece->pipe->tiling = 0;
   dt_print(DT_DEBUG_DEV, "[default_process_tiling_ptp] fall back to standard processing for module '%s'\n",
            self->op);
@@ -869,7 +894,8 @@ static void _default_process_tiling_roi(struct dt_iop_module_t *self, struct dt_
   }
 
   /* calculate optimal size of tiles */
-  float available = dt_conf_get_float("host_memory_limit") * 1024.0f * 1024.0f;
+  float available = _host_memory_available(tiling.factor * roi_in->width * roi_in->height * max_bpp
+                                           + tiling.overhead);
   assert(available >= 500.0f * 1024.0f * 1024.0f);
   /* correct for size of ivoid and ovoid which are needed on top of tiling */
   available = fmax(available - ((float)roi_out->width * roi_out->height * out_bpp)
@@ -986,6 +1012,9 @@ static void _default_process_tiling_roi(struct dt_iop_module_t *self, struct dt_
     {
       piece->pipe->tiling = 1;
 
+      // no point in doing the remaining tiles, the output will be thrown away
+      if(dt_dev_pixelpipe_cancelled(piece->pipe)) goto cancelled;
+
       /* the output dimensions of the good part of this specific tile */
       size_t wd = (tx + 1) * tile_wd > roi_out->width ? roi_out->width - tx * tile_wd : tile_wd;
       size_t ht = (ty + 1) * tile_ht > roi_out->height ? roi_out->height - ty * tile_ht : tile_ht;
@@ -1078,14 +1107,14 @@ static void _default_process_tiling_roi(struct dt_iop_module_t *self, struct dt_
 
 
       /* prepare input tile buffer */
-      input = dt_alloc_align(64, (size_t)iroi_full.width * iroi_full.height * in_bpp);
+      input = _tiling_alloc((size_t)iroi_full.width * iroi_full.height * in_bpp);
       if(input == NULL)
       {
         dt_print(DT_DEBUG_DEV, "[default_process_tiling_roi] could not alloc input buffer for module '%s'\n",
                  self->op);
         goto error;
       }
-      output = dt_alloc_align(64, (size_t)oroi_full.width * oroi_full.height * out_bpp);
+      output = _tiling_alloc((size_t)oroi_full.width * oroi_full.height * out_bpp);
       if(output == NULL)
       {
         dt_print(DT_DEBUG_DEV, "[default_process_tiling_roi] could not alloc output buffer for module '%s'\n",
@@ -1130,16 +1159,17 @@ static void _default_process_tiling_roi(struct dt_iop_module_t *self, struct dt_
                (char *)output + ((j + origin_y) * oroi_full.width + origin_x) * out_bpp,
                (size_t)oroi_good.width * out_bpp);
 
-      dt_free_align(input);
-      dt_free_align(output);
+      dt_buffer_pool_free(input);
+      dt_buffer_pool_free(output);
       input = output = NULL;
     }
 
+cancelled:
   /* copy back final processed_maximum */
   for(int k = 0; k < 4; k++) piece->pipe->dsc.processed_maximum[k] = processed_maximum_new[k];
 
-  if(input != NULL) dt_free_align(input);
-  if(output != NULL) dt_free_align(output);
+  dt_buffer_pool_free(input);
+  dt_buffer_pool_free(output);
   piece->pipe->tiling = 0;
   return;
 
@@ -1148,8 +1178,8 @@ error:
 // fall through
 
 fallback:
-  if(input != NULL) dt_free_align(input);
-  if(output != NULL) dt_free_align(output);
+  dt_buffer_pool_free(input);
+  dt_buffer_pool_free(output);
   piece->pipe->tiling = 0;
   dt_print(DT_DEBUG_DEV, "[default_process_tiling_roi] fall back to standard processing for module '%s'\n",
            self->op);
@@ -1178,18 +1208,292 @@ void default_process_tiling(struct dt_iop_module_t *self, struct dt_dev_pixelpip
 
 
 #ifdef HAVE_OPENCL
+/* tile layout of _default_process_tiling_cl_ptp(), shared by all devices working on it */
+typedef struct dt_tiling_cl_ptp_t
+{
+  struct dt_iop_module_t *self;
+  struct dt_dev_pixelpipe_t *pipe; // the one processed, to check for cancellation
+  const void *ivoid;
+  void *ovoid;
+  const dt_iop_roi_t *roi_in, *roi_out;
+  int in_bpp, out_bpp, ipitch, opitch;
+  int width, height, overlap, tile_wd, tile_ht, tiles_x, tiles_y;
+  float processed_maximum[4]; // of the pipe before tiling
+  dt_pthread_mutex_t lock;    // protects next and failed
+  int next;
+  int failed;
+} dt_tiling_cl_ptp_t;
+
+/* a device taking tiles until none are left */
+typedef struct dt_tiling_cl_device_t
+{
+  dt_tiling_cl_ptp_t *t;
+  struct dt_dev_pixelpipe_iop_t *piece;
+  int devid;
+  void *input_buffer[2], *output_buffer; // mapped pinned memory, or NULL for direct transfers
+  float processed_maximum[4];
+  int tiles; // processed so far
+} dt_tiling_cl_device_t;
+
+/* helper devices work on copies of pipe and piece that only differ in devid. process_cl() reads nothing but
+   plain fields of the pipe, and writes only its dsc. */
+typedef struct dt_tiling_cl_helper_t
+{
+  dt_tiling_cl_device_t dev;
+  dt_dev_pixelpipe_t pipe;
+  dt_dev_pixelpipe_iop_t piece;
+  pthread_t thread;
+  int running;
+} dt_tiling_cl_helper_t;
+
+/* a tile on its way through a device */
+typedef struct dt_tiling_cl_tile_t
+{
+  size_t tx, ty, wd, ht;
+  cl_mem input, output;
+} dt_tiling_cl_tile_t;
+
+/* takes the next tile worth processing. */
+static int _next_tile_cl_ptp(dt_tiling_cl_ptp_t *t, dt_tiling_cl_tile_t *tile)
+{
+  const int width = t->width, height = t->height, overlap = t->overlap;
+  int found = 0;
+  tile->input = tile->output = NULL;
+  dt_pthread_mutex_lock(&t->lock);
+  // no point in doing the remaining tiles, the output will be thrown away
+  while(!found && !t->failed && !dt_dev_pixelpipe_cancelled(t->pipe) && t->next < t->tiles_x * t->tiles_y)
+  {
+    const size_t tx = t->next / t->tiles_y, ty = t->next % t->tiles_y;
+    t->next++;
+    tile->tx = tx;
+    tile->ty = ty;
+    tile->wd = tx * t->tile_wd + width > t->roi_in->width ? t->roi_in->width - tx * t->tile_wd : width;
+    tile->ht = ty * t->tile_ht + height > t->roi_in->height ? t->roi_in->height - ty * t->tile_ht : height;
+
+    /* no need to process (end)tiles that are smaller than the total overlap area */
+    found = !((tile->wd <= 2 * overlap && tx > 0) || (tile->ht <= 2 * overlap && ty > 0));
+  }
+  dt_pthread_mutex_unlock(&t->lock);
+  return found;
+}
+
+/* allocates the input of a tile and enqueues its transfer without waiting for it, so the host can prepare it
+   while the device is still busy with the previous tile. */
+static cl_int _upload_tile_cl_ptp(dt_tiling_cl_device_t *d, dt_tiling_cl_tile_t *tile, const int slot)
+{
+  const dt_tiling_cl_ptp_t *const t = d->t;
+  const int devid = d->devid;
+  const int in_bpp = t->in_bpp, ipitch = t->ipitch;
+  const size_t wd = tile->wd, ht = tile->ht;
+  void *input_buffer = d->input_buffer[slot];
+
+  /* origin and region of the tile */
+  size_t origin[] = { 0, 0, 0 };
+  size_t region[] = { wd, ht, 1 };
+
+  /* offset of tile into ivoid */
+  const size_t ioffs = (tile->ty * t->tile_ht) * ipitch + (tile->tx * t->tile_wd) * in_bpp;
+
+  dt_print(DT_DEBUG_OPENCL,
+           "[default_process_tiling_cl_ptp] tile (%zu, %zu) with %zu x %zu at origin [%zu, %zu] on device %d\n",
+           tile->tx, tile->ty, wd, ht, tile->tx * t->tile_wd, tile->ty * t->tile_ht, devid);
+
+  tile->input = dt_opencl_alloc_device(devid, wd, ht, in_bpp);
+  if(tile->input == NULL) return -999;
+
+  if(input_buffer)
+  {
+/* prepare pinned input tile buffer: copy part of input image. the transfer out of this slot, two tiles ago,
+   is done: the output of the tile in between has been read since. */
+#ifdef _OPENMP
+#pragma omp parallel for default(none) shared(input_buffer) schedule(static)
+#endif
+    for(size_t j = 0; j < ht; j++)
+      memcpy((char *)input_buffer + j * wd * in_bpp, (char *)t->ivoid + ioffs + j * ipitch, (size_t)wd * in_bpp);
+
+    /* non-blocking memory transfer: pinned host input buffer -> opencl/device tile */
+    return dt_opencl_write_host_to_device_raw(devid, (char *)input_buffer, tile->input, origin, region,
+                                              wd * in_bpp, CL_FALSE);
+  }
+
+  /* non-blocking direct memory transfer: host input image -> opencl/device tile. ivoid isn't touched until
+     tiling is done. */
+  return dt_opencl_write_host_to_device_raw(devid, (char *)t->ivoid + ioffs, tile->input, origin, region, ipitch,
+                                            CL_FALSE);
+}
+
+/* enqueues process_cl() of the module for a tile */
+static cl_int _run_tile_cl_ptp(dt_tiling_cl_device_t *d, dt_tiling_cl_tile_t *tile)
+{
+  const dt_tiling_cl_ptp_t *const t = d->t;
+  struct dt_iop_module_t *self = t->self;
+  struct dt_dev_pixelpipe_iop_t *piece = d->piece;
+  const dt_iop_roi_t *const roi_in = t->roi_in, *const roi_out = t->roi_out;
+  const size_t wd = tile->wd, ht = tile->ht;
+
+  tile->output = dt_opencl_alloc_device(d->devid, wd, ht, t->out_bpp);
+  if(tile->output == NULL) return -999;
+
+  /* roi_in and roi_out for process_cl on subbuffer */
+  dt_iop_roi_t iroi = { roi_in->x + tile->tx * t->tile_wd, roi_in->y + tile->ty * t->tile_ht, wd, ht, roi_in->scale };
+  dt_iop_roi_t oroi
+      = { roi_out->x + tile->tx * t->tile_wd, roi_out->y + tile->ty * t->tile_ht, wd, ht, roi_out->scale };
+
+  /* take original processed_maximum as starting point */
+  for(int k = 0; k < 4; k++) piece->pipe->dsc.processed_maximum[k] = t->processed_maximum[k];
+
+  /* call process_cl of module */
+  if(!self->process_cl(self, piece, tile->input, tile->output, &iroi, &oroi)) return -999;
+
+  /* aggregate resulting processed_maximum */
+  /* TODO: check if there really can be differences between tiles and take
+           appropriate action (calculate minimum, maximum, average, ...?) */
+  for(int k = 0; k < 4; k++)
+  {
+    if(d->tiles > 0 && fabs(d->processed_maximum[k] - piece->pipe->dsc.processed_maximum[k]) > 1.0e-6f)
+      dt_print(DT_DEBUG_OPENCL,
+               "[default_process_tiling_cl_ptp] processed_maximum[%d] differs between tiles in module '%s'\n", k,
+               self->op);
+    d->processed_maximum[k] = piece->pipe->dsc.processed_maximum[k];
+  }
+  d->tiles++;
+  return CL_SUCCESS;
+}
+
+/* waits for the output of a tile, copies its good part to ovoid and releases its buffers */
+static cl_int _store_tile_cl_ptp(dt_tiling_cl_device_t *d, dt_tiling_cl_tile_t *tile)
+{
+  const dt_tiling_cl_ptp_t *const t = d->t;
+  const int devid = d->devid;
+  const int out_bpp = t->out_bpp, opitch = t->opitch, overlap = t->overlap;
+  const int width = t->width, height = t->height, tile_wd = t->tile_wd, tile_ht = t->tile_ht;
+  const size_t tx = tile->tx, ty = tile->ty, wd = tile->wd, ht = tile->ht;
+  void *output_buffer = d->output_buffer;
+  cl_int err = CL_SUCCESS;
+
+  /* origin and region of effective part of tile, which we want to store later */
+  size_t origin[] = { 0, 0, 0 };
+  size_t region[] = { wd, ht, 1 };
+
+  /* offset of tile into ovoid */
+  size_t ooffs = (ty * tile_ht) * opitch + (tx * tile_wd) * out_bpp;
+
+  if(output_buffer)
+  {
+    /* blocking memory transfer: complete opencl/device tile -> pinned host output buffer */
+    err = dt_opencl_read_host_from_device_raw(devid, (char *)output_buffer, tile->output, origin, region,
+                                              wd * out_bpp, CL_TRUE);
+    if(err != CL_SUCCESS) goto done;
+  }
+
+  /* correct origin and region of tile for overlap.
+     makes sure that we only copy back the "good" part. */
+  if(tx > 0)
+  {
+    origin[0] += overlap;
+    region[0] -= overlap;
+    ooffs += overlap * out_bpp;
+  }
+  if(ty > 0)
+  {
+    origin[1] += overlap;
+    region[1] -= overlap;
+    ooffs += overlap * opitch;
+  }
+
+  /* the overlap to the right and bottom is the good part of the next tile. leave it to that one, as tiles
+     may finish in any order when several devices share them. */
+  if(tx + 1 < t->tiles_x && _min(width, t->roi_in->width - (int)(tx + 1) * tile_wd) > 2 * overlap)
+    region[0] = _min(wd, tile_wd + overlap) - origin[0];
+  if(ty + 1 < t->tiles_y && _min(height, t->roi_in->height - (int)(ty + 1) * tile_ht) > 2 * overlap)
+    region[1] = _min(ht, tile_ht + overlap) - origin[1];
+
+  if(output_buffer)
+  {
+/* copy "good" part of tile from pinned output buffer to output image */
+#if 0 // def _OPENMP
+#pragma omp parallel for default(none) shared(ovoid, ooffs, output_buffer, width, origin, region,            \
+                                              wd) schedule(static)
+#endif
+    for(size_t j = 0; j < region[1]; j++)
+      memcpy((char *)t->ovoid + ooffs + j * opitch,
+             (char *)output_buffer + ((j + origin[1]) * wd + origin[0]) * out_bpp, (size_t)region[0] * out_bpp);
+  }
+  else
+  {
+    /* blocking direct memory transfer: good part of opencl/device tile -> host output image */
+    err = dt_opencl_read_host_from_device_raw(devid, (char *)t->ovoid + ooffs, tile->output, origin, region,
+                                              opitch, CL_TRUE);
+    if(err != CL_SUCCESS) goto done;
+  }
+
+  /* block until opencl queue has finished to free all used event handlers */
+  if(!darktable.opencl->async_pixelpipe || d->piece->pipe->type == DT_DEV_PIXELPIPE_EXPORT)
+    dt_opencl_finish(devid);
+
+done:
+  /* release input and output buffers */
+  dt_opencl_release_mem_object(tile->input);
+  dt_opencl_release_mem_object(tile->output);
+  tile->input = tile->output = NULL;
+  return err;
+}
+
+/* double buffered: the next tile is staged and its upload enqueued while the device computes the current one */
+static void _process_tiles_cl_ptp(dt_tiling_cl_device_t *d)
+{
+  dt_tiling_cl_tile_t tile[2] = { { 0 } };
+  int cur = 0;
+  cl_int err = CL_SUCCESS;
+
+  int have = _next_tile_cl_ptp(d->t, &tile[cur]);
+  if(have) err = _upload_tile_cl_ptp(d, &tile[cur], cur);
+  while(have && err == CL_SUCCESS)
+  {
+    err = _run_tile_cl_ptp(d, &tile[cur]);
+    if(err != CL_SUCCESS) break;
+
+    const int next = !cur;
+    have = _next_tile_cl_ptp(d->t, &tile[next]);
+    if(have) err = _upload_tile_cl_ptp(d, &tile[next], next);
+    if(err == CL_SUCCESS) err = _store_tile_cl_ptp(d, &tile[cur]);
+    cur = next;
+  }
+
+  for(int k = 0; k < 2; k++)
+  {
+    dt_opencl_release_mem_object(tile[k].input);
+    dt_opencl_release_mem_object(tile[k].output);
+  }
+
+  if(err != CL_SUCCESS)
+  {
+    dt_print(DT_DEBUG_OPENCL, "[default_process_tiling_opencl_ptp] couldn't run process_cl() for module '%s' "
+                              "in tiling mode on device %d: %d\n",
+             d->t->self->op, d->devid, err);
+    dt_pthread_mutex_lock(&d->t->lock);
+    d->t->failed = 1;
+    dt_pthread_mutex_unlock(&d->t->lock);
+  }
+}
+
+static void *_tiling_cl_helper_thread(void *arg)
+{
+  dt_tiling_cl_helper_t *h = (dt_tiling_cl_helper_t *)arg;
+  dt_pthread_setname("tiling");
+  _process_tiles_cl_ptp(&h->dev);
+  return NULL;
+}
+
 /* simple tiling algorithm for roi_in == roi_out, i.e. for pixel to pixel modules/operations */
 static int _default_process_tiling_cl_ptp(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece,
                                           const void *const ivoid, void *const ovoid,
                                           const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out,
                                           const int in_bpp)
 {
-  cl_int err = -999;
-  cl_mem input = NULL;
-  cl_mem output = NULL;
-  cl_mem pinned_input = NULL;
+  cl_mem pinned_input[2] = { NULL };
   cl_mem pinned_output = NULL;
-  void *input_buffer = NULL;
+  void *input_buffer[2] = { NULL };
   void *output_buffer = NULL;
 
   dt_iop_buffer_dsc_t dsc;
@@ -1207,7 +1511,7 @@ static int _default_process_tiling_cl_ptp(struct dt_iop_module_t *self, struct d
 
   /* shall we use pinned memory transfers? */
   int use_pinned_memory = dt_conf_get_bool("opencl_use_pinned_memory");
-  const int pinned_buffer_overhead = use_pinned_memory ? 2 : 0; // add two additional pinned memory buffers
+  const int pinned_buffer_overhead = use_pinned_memory ? 3 : 0; // add three additional pinned memory buffers
                                                                 // which seemingly get allocated not only on
                                                                 // host but also on device (why???)
   const float pinned_buffer_slack
@@ -1306,30 +1610,33 @@ static int _default_process_tiling_cl_ptp(struct dt_iop_module_t *self, struct d
            tiles_x, tiles_y, width, height, overlap);
 
   /* store processed_maximum to be re-used and aggregated */
-  float processed_maximum_saved[4];
+  dt_tiling_cl_ptp_t t = { .self = self, .pipe = piece->pipe, .ivoid = ivoid, .ovoid = ovoid,
+                           .roi_in = roi_in, .roi_out = roi_out, .in_bpp = in_bpp, .out_bpp = out_bpp,
+                           .ipitch = ipitch, .opitch = opitch, .width = width, .height = height,
+                           .overlap = overlap, .tile_wd = tile_wd, .tile_ht = tile_ht, .tiles_x = tiles_x,
+                           .tiles_y = tiles_y };
   float processed_maximum_new[4] = { 1.0f };
-  for(int k = 0; k < 4; k++) processed_maximum_saved[k] = piece->pipe->dsc.processed_maximum[k];
+  for(int k = 0; k < 4; k++) t.processed_maximum[k] = piece->pipe->dsc.processed_maximum[k];
+  dt_pthread_mutex_init(&t.lock, NULL);
 
-  /* reserve pinned input and output memory for host<->device data transfer */
-  if(use_pinned_memory)
+  /* reserve pinned input and output memory for host<->device data transfer. two input buffers, so the next
+     tile can be staged while the last one is still on its way to the device. */
+  for(int k = 0; k < 2 && use_pinned_memory; k++)
   {
-    pinned_input = dt_opencl_alloc_device_buffer_with_flags(devid, (size_t)width * height * in_bpp,
-                                                            CL_MEM_READ_ONLY | CL_MEM_ALLOC_HOST_PTR);
-    if(pinned_input == NULL)
+    pinned_input[k] = dt_opencl_alloc_device_buffer_with_flags(devid, (size_t)width * height * in_bpp,
+                                                               CL_MEM_READ_ONLY | CL_MEM_ALLOC_HOST_PTR);
+    if(pinned_input[k] == NULL)
     {
       dt_print(DT_DEBUG_OPENCL,
                "[default_process_tiling_cl_ptp] could not alloc pinned input buffer for module '%s'\n",
                self->op);
       use_pinned_memory = 0;
+      break;
     }
-  }
-
-  if(use_pinned_memory)
-  {
 
-    input_buffer = dt_opencl_map_buffer(devid, pinned_input, CL_TRUE, CL_MAP_WRITE, 0,
-                                        (size_t)width * height * in_bpp);
-    if(input_buffer == NULL)
+    input_buffer[k] = dt_opencl_map_buffer(devid, pinned_input[k], CL_TRUE, CL_MAP_WRITE, 0,
+                                           (size_t)width * height * in_bpp);
+    if(input_buffer[k] == NULL)
     {
       dt_print(DT_DEBUG_OPENCL, "[default_process_tiling_cl_ptp] could not map pinned input buffer to host "
                                 "memory for module '%s'\n",
@@ -1366,165 +1673,86 @@ static int _default_process_tiling_cl_ptp(struct dt_iop_module_t *self, struct d
     }
   }
 
-  /* iterate over tiles */
-  for(size_t tx = 0; tx < tiles_x; tx++)
-    for(size_t ty = 0; ty < tiles_y; ty++)
+  /* exports share their tiles with the devices nobody else is using, each working through its own
+     command queue. helpers transfer directly, pinned memory belongs to our device. */
+  int helper_devid[CL_MAX_HELPERS];
+  int num_helpers = 0;
+  dt_tiling_cl_helper_t *helpers = NULL;
+  if(piece->pipe->type == DT_DEV_PIXELPIPE_EXPORT && tiles_x * tiles_y > 1
+     && dt_conf_get_bool("opencl_tiling_multiple_devices"))
+    num_helpers = dt_opencl_lock_idle_devices(devid, helper_devid,
+                                              _min(CL_MAX_HELPERS, tiles_x * tiles_y - 1));
+  if(num_helpers > 0)
+  {
+    helpers = (dt_tiling_cl_helper_t *)calloc(num_helpers, sizeof(dt_tiling_cl_helper_t));
+    if(!helpers)
     {
-      piece->pipe->tiling = 1;
-
-      size_t wd = tx * tile_wd + width > roi_in->width ? roi_in->width - tx * tile_wd : width;
-      size_t ht = ty * tile_ht + height > roi_in->height ? roi_in->height - ty * tile_ht : height;
-
-      /* no need to process (end)tiles that are smaller than the total overlap area */
-      if((wd <= 2 * overlap && tx > 0) || (ht <= 2 * overlap && ty > 0)) continue;
-
-      /* origin and region of effective part of tile, which we want to store later */
-      size_t origin[] = { 0, 0, 0 };
-      size_t region[] = { wd, ht, 1 };
-
-      /* roi_in and roi_out for process_cl on subbuffer */
-      dt_iop_roi_t iroi = { roi_in->x + tx * tile_wd, roi_in->y + ty * tile_ht, wd, ht, roi_in->scale };
-      dt_iop_roi_t oroi = { roi_out->x + tx * tile_wd, roi_out->y + ty * tile_ht, wd, ht, roi_out->scale };
-
-
-      /* offsets of tile into ivoid and ovoid */
-      size_t ioffs = (ty * tile_ht) * ipitch + (tx * tile_wd) * in_bpp;
-      size_t ooffs = (ty * tile_ht) * opitch + (tx * tile_wd) * out_bpp;
-
-
-      dt_print(DT_DEBUG_OPENCL,
-               "[default_process_tiling_cl_ptp] tile (%zu, %zu) with %zu x %zu at origin [%zu, %zu]\n", tx, ty, wd,
-               ht, tx * tile_wd, ty * tile_ht);
-
-      /* get input and output buffers */
-      input = dt_opencl_alloc_device(devid, wd, ht, in_bpp);
-      if(input == NULL) goto error;
-      output = dt_opencl_alloc_device(devid, wd, ht, out_bpp);
-      if(output == NULL) goto error;
-
-      if(use_pinned_memory)
-      {
-/* prepare pinned input tile buffer: copy part of input image */
-#ifdef _OPENMP
-#pragma omp parallel for default(none) shared(input_buffer, width, ioffs, wd, ht) schedule(static)
-#endif
-        for(size_t j = 0; j < ht; j++)
-          memcpy((char *)input_buffer + j * wd * in_bpp, (char *)ivoid + ioffs + j * ipitch,
-                 (size_t)wd * in_bpp);
-
-        /* blocking memory transfer: pinned host input buffer -> opencl/device tile */
-        err = dt_opencl_write_host_to_device_raw(devid, (char *)input_buffer, input, origin, region,
-                                                 wd * in_bpp, CL_TRUE);
-        if(err != CL_SUCCESS) goto error;
-      }
-      else
-      {
-        /* blocking direct memory transfer: host input image -> opencl/device tile */
-        err = dt_opencl_write_host_to_device_raw(devid, (char *)ivoid + ioffs, input, origin, region, ipitch,
-                                                 CL_TRUE);
-        if(err != CL_SUCCESS) goto error;
-      }
-
-      /* take original processed_maximum as starting point */
-      for(int k = 0; k < 4; k++) piece->pipe->dsc.processed_maximum[k] = processed_maximum_saved[k];
-
-      /* call process_cl of module */
-      if(!self->process_cl(self, piece, input, output, &iroi, &oroi)) goto error;
-
-      /* aggregate resulting processed_maximum */
-      /* TODO: check if there really can be differences between tiles and take
-               appropriate action (calculate minimum, maximum, average, ...?) */
-      for(int k = 0; k < 4; k++)
-      {
-        if(tx + ty > 0 && fabs(processed_maximum_new[k] - piece->pipe->dsc.processed_maximum[k]) > 1.0e-6f)
-          dt_print(
-              DT_DEBUG_OPENCL,
-              "[default_process_tiling_cl_ptp] processed_maximum[%d] differs between tiles in module '%s'\n",
-              k, self->op);
-        processed_maximum_new[k] = piece->pipe->dsc.processed_maximum[k];
-      }
+      for(int i = 0; i < num_helpers; i++) dt_opencl_unlock_device(helper_devid[i]);
+      num_helpers = 0;
+    }
+    else
+      dt_print(DT_DEBUG_OPENCL, "[default_process_tiling_cl_ptp] sharing tiles of module '%s' with %d more "
+                                "devices\n",
+               self->op, num_helpers);
+  }
 
-      if(use_pinned_memory)
-      {
-        /* blocking memory transfer: complete opencl/device tile -> pinned host output buffer */
-        err = dt_opencl_read_host_from_device_raw(devid, (char *)output_buffer, output, origin, region,
-                                                  wd * out_bpp, CL_TRUE);
-        if(err != CL_SUCCESS) goto error;
-      }
+  piece->pipe->tiling = 1;
+  for(int i = 0; i < num_helpers; i++)
+  {
+    dt_tiling_cl_helper_t *h = helpers + i;
+    h->pipe = *piece->pipe;
+    h->pipe.devid = helper_devid[i];
+    h->piece = *piece;
+    h->piece.pipe = &h->pipe;
+    h->dev = (dt_tiling_cl_device_t){ .t = &t, .piece = &h->piece, .devid = helper_devid[i] };
+    dt_opencl_events_reset(helper_devid[i]);
+    h->running = !dt_pthread_create(&h->thread, _tiling_cl_helper_thread, h);
+  }
 
-      /* correct origin and region of tile for overlap.
-         makes sure that we only copy back the "good" part. */
-      if(tx > 0)
-      {
-        origin[0] += overlap;
-        region[0] -= overlap;
-        ooffs += overlap * out_bpp;
-      }
-      if(ty > 0)
-      {
-        origin[1] += overlap;
-        region[1] -= overlap;
-        ooffs += overlap * opitch;
-      }
+  /* iterate over tiles */
+  dt_tiling_cl_device_t own = { .t = &t, .piece = piece, .devid = devid };
+  if(use_pinned_memory)
+  {
+    own.input_buffer[0] = input_buffer[0];
+    own.input_buffer[1] = input_buffer[1];
+    own.output_buffer = output_buffer;
+  }
+  _process_tiles_cl_ptp(&own);
 
-      if(use_pinned_memory)
-      {
-/* copy "good" part of tile from pinned output buffer to output image */
-#if 0 // def _OPENMP
-#pragma omp parallel for default(none) shared(ovoid, ooffs, output_buffer, width, origin, region,            \
-                                              wd) schedule(static)
-#endif
-        for(size_t j = 0; j < region[1]; j++)
-          memcpy((char *)ovoid + ooffs + j * opitch,
-                 (char *)output_buffer + ((j + origin[1]) * wd + origin[0]) * out_bpp,
-                 (size_t)region[0] * out_bpp);
-      }
-      else
-      {
-        /* blocking direct memory transfer: good part of opencl/device tile -> host output image */
-        err = dt_opencl_read_host_from_device_raw(devid, (char *)ovoid + ooffs, output, origin, region,
-                                                  opitch, CL_TRUE);
-        if(err != CL_SUCCESS) goto error;
-      }
+  int tiles = own.tiles;
+  if(tiles) memcpy(processed_maximum_new, own.processed_maximum, sizeof(processed_maximum_new));
+  for(int i = 0; i < num_helpers; i++)
+  {
+    dt_tiling_cl_helper_t *h = helpers + i;
+    if(h->running) pthread_join(h->thread, NULL);
+    if(dt_opencl_events_flush(helper_devid[i], 1)) t.failed = 1;
+    dt_opencl_unlock_device(helper_devid[i]);
+    if(!tiles && h->dev.tiles)
+      memcpy(processed_maximum_new, h->dev.processed_maximum, sizeof(processed_maximum_new));
+    tiles += h->dev.tiles;
+  }
+  free(helpers);
+  dt_pthread_mutex_destroy(&t.lock);
 
-      /* release input and output buffers */
-      dt_opencl_release_mem_object(input);
-      input = NULL;
-      dt_opencl_release_mem_object(output);
-      output = NULL;
+  for(int k = 0; k < 2; k++)
+  {
+    if(input_buffer[k] != NULL) dt_opencl_unmap_mem_object(devid, pinned_input[k], input_buffer[k]);
+    dt_opencl_release_mem_object(pinned_input[k]);
+  }
+  if(output_buffer != NULL) dt_opencl_unmap_mem_object(devid, pinned_output, output_buffer);
+  dt_opencl_release_mem_object(pinned_output);
+  piece->pipe->tiling = 0;
 
-      /* block until opencl queue has finished to free all used event handlers */
-      if(!darktable.opencl->async_pixelpipe || piece->pipe->type == DT_DEV_PIXELPIPE_EXPORT)
-        dt_opencl_finish(devid);
-    }
+  if(t.failed)
+  {
+    /* copy back stored processed_maximum */
+    for(int k = 0; k < 4; k++) piece->pipe->dsc.processed_maximum[k] = t.processed_maximum[k];
+    return FALSE;
+  }
 
   /* copy back final processed_maximum */
   for(int k = 0; k < 4; k++) piece->pipe->dsc.processed_maximum[k] = processed_maximum_new[k];
-
-  if(input_buffer != NULL) dt_opencl_unmap_mem_object(devid, pinned_input, input_buffer);
-  dt_opencl_release_mem_object(pinned_input);
-  if(output_buffer != NULL) dt_opencl_unmap_mem_object(devid, pinned_output, output_buffer);
-  dt_opencl_release_mem_object(pinned_output);
-  dt_opencl_release_mem_object(input);
-  dt_opencl_release_mem_object(output);
-  piece->pipe->tiling = 0;
   return TRUE;
-
-error:
-  /* copy back stored processed_maximum */
-  for(int k = 0; k < 4; k++) piece->pipe->dsc.processed_maximum[k] = processed_maximum_saved[k];
-  if(input_buffer != NULL) dt_opencl_unmap_mem_object(devid, pinned_input, input_buffer);
-  dt_opencl_release_mem_object(pinned_input);
-  if(output_buffer != NULL) dt_opencl_unmap_mem_object(devid, pinned_output, output_buffer);
-  dt_opencl_release_mem_object(pinned_output);
-  dt_opencl_release_mem_object(input);
-  dt_opencl_release_mem_object(output);
-  piece->pipe->tiling = 0;
-  dt_print(
-      DT_DEBUG_OPENCL,
-      "[default_process_tiling_opencl_ptp] couldn't run process_cl() for module '%s' in tiling mode: %d\n",
-      self->op, err);
-  return FALSE;
 }
 
 
@@ -1749,6 +1977,9 @@ static int _default_process_tiling_cl_roi(struct dt_iop_module_t *self, struct d
     {
       piece->pipe->tiling = 1;
 
+      // no point in doing the remaining tiles, the output will be thrown away
+      if(dt_dev_pixelpipe_cancelled(piece->pipe)) goto cancelled;
+
       /* the output dimensions of the good part of this specific tile */
       size_t wd = (tx + 1) * tile_wd > roi_out->width ? roi_out->width - tx * tile_wd : tile_wd;
       size_t ht = (ty + 1) * tile_ht > roi_out->height ? roi_out->height - ty * tile_ht : tile_ht;
@@ -1935,6 +2166,7 @@ static int _default_process_tiling_cl_roi(struct dt_iop_module_t *self, struct d
         dt_opencl_finish(devid);
     }
 
+cancelled:
   /* copy back final processed_maximum */
   for(int k = 0; k < 4; k++) piece->pipe->dsc.processed_maximum[k] = processed_maximum_new[k];
   if(input_buffer != NULL) dt_opencl_unmap_mem_object(devid, pinned_input, input_buffer);
@@ -2070,9 +2302,11 @@ int dt_tiling_piece_fits_host_memory(const size_t width, const size_t height, co
 
   float requirement = factor * width * height * bpp + overhead;
 
-  if(host_memory_limit == 0 || requirement <= host_memory_limit * 1024.0f * 1024.0f) return TRUE;
+  if(host_memory_limit == 0) return TRUE;
+  if(requirement > host_memory_limit * 1024.0f * 1024.0f) return FALSE;
 
-  return FALSE;
+  /* within the limit, but the caches might have to make way. if they can't, tile. */
+  return requirement <= _host_memory_available(requirement);
 }
 
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
@@ -27,7 +27,6 @@
 #include <stdio.h>   // for fprintf, stderr, snprintf, NULL, etc
 #include <stdlib.h>  // for exit, EXIT_FAILURE
 #include <string.h>  // for strcmp
-#include <unistd.h>  // for access, R_OK
 
 #include "common/darktable.h"    // for darktable, darktable_t, dt_cleanup, etc
 #include "common/database.h"     // for dt_database_get
@@ -40,11 +39,81 @@
 #include "win/main_wrapper.h"
 #endif
 
-static int generate_thumbnail_cache(const dt_mipmap_size_t min_mip, const dt_mipmap_size_t max_mip, const int32_t min_imgid, const int32_t max_imgid)
+// the images the worker threads take turns on
+typedef struct dt_generate_cache_t
+{
+  int32_t *ids;
+  size_t image_count;
+  size_t next;    // next image to take
+  size_t counter; // images done
+  dt_mipmap_size_t min_mip, max_mip;
+  double start;
+} dt_generate_cache_t;
+
+static void generate_thumbnails(const dt_generate_cache_t *const g, const int32_t imgid)
+{
+  dt_mipmap_size_t missing = DT_MIPMAP_NONE;
+  for(int k = g->max_mip; k >= (int)g->min_mip && k >= 0 && missing == DT_MIPMAP_NONE; k--)
+    if(!dt_mipmap_cache_has_disk_thumbnail(darktable.mipmap_cache, imgid, k)) missing = k;
+
+  // all there already, which is what makes an interrupted run pick up where it stopped
+  if(missing == DT_MIPMAP_NONE) return;
+
+  // the smaller sizes are downsampled from the biggest one in memory. if a bigger one than the first missing is
+  // on disk already, it's loaded instead of processing the image once more.
+  if(missing < g->max_mip)
+  {
+    dt_mipmap_buffer_t buf;
+    dt_mipmap_cache_get(darktable.mipmap_cache, &buf, imgid, g->max_mip, DT_MIPMAP_BLOCKING, 'r');
+    dt_mipmap_cache_release(darktable.mipmap_cache, &buf);
+  }
+
+  for(int k = missing; k >= (int)g->min_mip; k--)
+  {
+    // if the thumbnail is already on disc - do nothing
+    if(dt_mipmap_cache_has_disk_thumbnail(darktable.mipmap_cache, imgid, k)) continue;
+
+    // else, generate thumbnail and store in mipmap cache.
+    dt_mipmap_buffer_t buf;
+    dt_mipmap_cache_get(darktable.mipmap_cache, &buf, imgid, k, DT_MIPMAP_BLOCKING, 'r');
+    dt_mipmap_cache_release(darktable.mipmap_cache, &buf);
+  }
+
+  // and immediately write thumbs to disc and remove from mipmap cache.
+  dt_mimap_cache_evict(darktable.mipmap_cache, imgid);
+}
+
+// every worker processes its images on a thumbnail pipe of its own, which runs on an opencl device if one is
+// free and on the cpu else
+static void *generate_thread(void *data)
+{
+  dt_generate_cache_t *g = (dt_generate_cache_t *)data;
+  size_t i;
+  while((i = __sync_fetch_and_add(&g->next, 1)) < g->image_count)
+  {
+    const int32_t imgid = g->ids[i];
+    generate_thumbnails(g, imgid);
+
+    const size_t counter = __sync_add_and_fetch(&g->counter, 1);
+    const double elapsed = dt_get_wtime() - g->start;
+    const double rate = elapsed > 0.0 ? counter / elapsed : 0.0;
+    const int eta = rate > 0.0 ? (int)((g->image_count - counter) / rate) : 0;
+    fprintf(stderr, "image %zu/%zu (%.02f%%) (id:%d) %.2f images/s, %d:%02d:%02d left\n", counter,
+            g->image_count, 100.0 * counter / (float)g->image_count, imgid, rate, eta / 3600, eta / 60 % 60,
+            eta % 60);
+  }
+  return NULL;
+}
+
+static int generate_thumbnail_cache(const dt_mipmap_size_t min_mip, const dt_mipmap_size_t max_mip,
+                                    const int32_t min_imgid, const int32_t max_imgid, const int num_threads)
 {
   fprintf(stderr, _("creating cache directories\n"));
   for(dt_mipmap_size_t k = min_mip; k <= max_mip; k++)
   {
+    // the packed format keeps all thumbnails of a level in one file, created by the mipmap cache itself
+    if(darktable.mipmap_cache->pack[k]) continue;
+
     char dirname[PATH_MAX] = { 0 };
     snprintf(dirname, sizeof(dirname), "%s.d/%d", darktable.mipmap_cache->cachedir, k);
 
@@ -58,7 +127,7 @@ static int generate_thumbnail_cache(const dt_mipmap_size_t min_mip, const dt_mip
 
   // some progress counter
   sqlite3_stmt *stmt;
-  size_t image_count = 0, counter = 0;
+  size_t image_count = 0;
   DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
                               "SELECT COUNT(*) FROM main.images WHERE id >= ?1 AND id <= ?2", -1, &stmt, 0);
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, min_imgid);
@@ -82,38 +151,32 @@ static int generate_thumbnail_cache(const dt_mipmap_size_t min_mip, const dt_mip
     }
   }
 
-  // go through all images:
+  // go through all images, the workers share the database and the caches
+  dt_generate_cache_t g = { 0 };
+  g.ids = (int32_t *)malloc(sizeof(int32_t) * MAX(image_count, 1));
+  g.min_mip = min_mip;
+  g.max_mip = max_mip;
   DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                              "SELECT id FROM main.images WHERE id >= ?1 AND id <= ?2", -1, &stmt, 0);
+                              "SELECT id FROM main.images WHERE id >= ?1 AND id <= ?2 ORDER BY id", -1, &stmt, 0);
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, min_imgid);
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, max_imgid);
-  while(sqlite3_step(stmt) == SQLITE_ROW)
-  {
-    const int32_t imgid = sqlite3_column_int(stmt, 0);
-
-    counter++;
-    fprintf(stderr, "image %zu/%zu (%.02f%%) (id:%d)\n", counter, image_count, 100.0 * counter / (float)image_count, imgid);
-
-    for(int k = max_mip; k >= min_mip && k >= 0; k--)
-    {
-      char filename[PATH_MAX] = { 0 };
-      snprintf(filename, sizeof(filename), "%s.d/%d/%d.jpg", darktable.mipmap_cache->cachedir, k, imgid);
-
-      // if the thumbnail is already on disc - do nothing
-      if(!access(filename, R_OK)) continue;
-
-      // else, generate thumbnail and store in mipmap cache.
-      dt_mipmap_buffer_t buf;
-      dt_mipmap_cache_get(darktable.mipmap_cache, &buf, imgid, k, DT_MIPMAP_BLOCKING, 'r');
-      dt_mipmap_cache_release(darktable.mipmap_cache, &buf);
-    }
+  while(sqlite3_step(stmt) == SQLITE_ROW && g.image_count < image_count)
+    g.ids[g.image_count++] = sqlite3_column_int(stmt, 0);
+  sqlite3_finalize(stmt);
 
-    // and immediately write thumbs to disc and remove from mipmap cache.
-    dt_mimap_cache_evict(darktable.mipmap_cache, imgid);
-  }
+  g.start = dt_get_wtime();
+  pthread_t *threads = (pthread_t *)calloc(num_threads, sizeof(pthread_t));
+  int started = 0;
+  for(; started < num_threads - 1; started++)
+    if(dt_pthread_create(&threads[started], generate_thread, &g)) break;
+  generate_thread(&g);
+  for(int t = 0; t < started; t++) pthread_join(threads[t], NULL);
+  free(threads);
+  free(g.ids);
 
-  sqlite3_finalize(stmt);
-  fprintf(stderr, "done\n");
+  const double elapsed = dt_get_wtime() - g.start;
+  fprintf(stderr, "done, %zu images in %.1f s (%.2f images/s)\n", g.counter, elapsed,
+          elapsed > 0.0 ? g.counter / elapsed : 0.0);
 
   return 0;
 }
@@ -125,13 +188,27 @@ static void usage(const char *progname)
       "usage: %s [-h, --help; --version]\n"
       "  [--min-mip <0-7> (default = 0)] [-m, --max-mip <0-7> (default = 2)]\n"
       "  [--min-imgid <N>] [--max-imgid <N>]\n"
+      "  [--format <files|packed> (default = cache_disk_backend_format)]\n"
+      "  [-j, --jobs <N> (default = 1)]\n"
       "  [--core <darktable options>]\n"
       "\n"
       "When multiple mipmap sizes are requested, the biggest one is computed\n"
-      "while the rest are quickly downsampled.\n"
+      "while the rest are quickly downsampled. If the biggest one is on disk\n"
+      "already, it is loaded instead of processing the image again.\n"
+      "\n"
+      "Images whose thumbnails are all on disk are skipped, so an interrupted\n"
+      "run can be started again and continues where it stopped.\n"
+      "\n"
+      "The --jobs option processes that many images at the same time. Every\n"
+      "one of them runs on an OpenCL device while one is free, add\n"
+      "--core --disable-opencl to run them all on the cpu.\n"
       "\n"
       "The --min-imgid and --max-imgid specify the range of internal image ID\n"
-      "numbers to work on.\n",
+      "numbers to work on.\n"
+      "\n"
+      "The --format option writes the thumbnails either as one file each or\n"
+      "into one packed container per mipmap size. darktable will only use them\n"
+      "if cache_disk_backend_format is set to the same value.\n",
       progname);
 }
 
@@ -148,6 +225,8 @@ int main(int argc, char *arg[])
   dt_mipmap_size_t max_mip = DT_MIPMAP_2;
   int32_t min_imgid = 0;
   int32_t max_imgid = INT32_MAX;
+  const char *format = NULL;
+  int num_threads = 1;
 
   int k;
   for(k = 1; k < argc; k++)
@@ -182,6 +261,21 @@ int main(int argc, char *arg[])
       k++;
       max_imgid = (int32_t)MIN(MAX(atoi(arg[k]), 0), INT32_MAX);
     }
+    else if((!strcmp(arg[k], "-j") || !strcmp(arg[k], "--jobs")) && argc > k + 1)
+    {
+      k++;
+      num_threads = MIN(MAX(atoi(arg[k]), 1), 256);
+    }
+    else if(!strcmp(arg[k], "--format") && argc > k + 1)
+    {
+      k++;
+      if(strcmp(arg[k], "files") && strcmp(arg[k], "packed"))
+      {
+        usage(arg[0]);
+        exit(EXIT_FAILURE);
+      }
+      format = arg[k];
+    }
     else if(!strcmp(arg[k], "--core"))
     {
       // everything from here on should be passed to the core
@@ -191,10 +285,17 @@ int main(int argc, char *arg[])
   }
 
   int m_argc = 0;
-  char **m_arg = malloc((3 + argc - k + 1) * sizeof(char *));
+  char **m_arg = malloc((5 + argc - k + 1) * sizeof(char *));
   m_arg[m_argc++] = "darktable-generate-cache";
   m_arg[m_argc++] = "--conf";
   m_arg[m_argc++] = "write_sidecar_files=FALSE";
+  gchar *format_conf = NULL;
+  if(format)
+  {
+    format_conf = g_strdup_printf("cache_disk_backend_format=%s", format);
+    m_arg[m_argc++] = "--conf";
+    m_arg[m_argc++] = format_conf;
+  }
   for(; k < argc; k++) m_arg[m_argc++] = arg[k];
   m_arg[m_argc] = NULL;
 
@@ -225,7 +326,7 @@ int main(int argc, char *arg[])
 
   fprintf(stderr, _("creating complete lighttable thumbnail cache\n"));
 
-  if(generate_thumbnail_cache(min_mip, max_mip, min_imgid, max_imgid))
+  if(generate_thumbnail_cache(min_mip, max_mip, min_imgid, max_imgid, num_threads))
   {
     free(m_arg);
     exit(EXIT_FAILURE);
@@ -233,6 +334,7 @@ int main(int argc, char *arg[])
 
   dt_cleanup();
 
+  g_free(format_conf);
   free(m_arg);
 }
 
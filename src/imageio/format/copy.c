@@ -20,6 +20,7 @@
 #include "common/debug.h"
 #include "common/exif.h"
 #include "common/imageio_module.h"
+#include "common/utility.h"
 #include "imageio/format/imageio_format_api.h"
 #include <glib/gstdio.h>
 #include <inttypes.h>
@@ -30,15 +31,12 @@ DT_MODULE(1)
 
 // FIXME: we can't rely on darktable to avoid file overwriting -- it doesn't know the filename (extension).
 int write_image(dt_imageio_module_data_t *ppm, const char *filename, const void *in, void *exif, int exif_len,
-                int imgid, int num, int total)
+                const char *xmp, int imgid, int num, int total)
 {
   int status = 1;
   char *sourcefile = NULL;
   char *targetfile = NULL;
   char *xmpfile = NULL;
-  char *content = NULL;
-  FILE *fin = NULL;
-  FILE *fout = NULL;
   sqlite3_stmt *stmt;
 
   DT_DEBUG_SQLITE3_PREPARE_V2(
@@ -58,18 +56,7 @@ int write_image(dt_imageio_module_data_t *ppm, const char *filename, const void
 
   if(!strcmp(sourcefile, targetfile)) goto END;
 
-  fin = g_fopen(sourcefile, "rb");
-  fout = g_fopen(targetfile, "wb");
-  if(fin == NULL || fout == NULL) goto END;
-
-  fseek(fin, 0, SEEK_END);
-  size_t end = ftell(fin);
-  rewind(fin);
-
-  content = (char *)g_malloc_n(end, sizeof(char));
-  if(content == NULL) goto END;
-  if(fread(content, sizeof(char), end, fin) != end) goto END;
-  if(fwrite(content, sizeof(char), end, fout) != end) goto END;
+  if(!dt_util_copy_file(sourcefile, targetfile, TRUE, NULL)) goto END;
 
   // we got a copy of the file, now write the xmp data
   xmpfile = g_strconcat(targetfile, ".xmp", NULL);
@@ -86,9 +73,6 @@ END:
   g_free(sourcefile);
   g_free(targetfile);
   g_free(xmpfile);
-  g_free(content);
-  if(fin) fclose(fin);
-  if(fout) fclose(fout);
   return status;
 }
 
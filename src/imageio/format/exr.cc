@@ -29,6 +29,7 @@
 #include <OpenEXR/ImfStandardAttributes.h>
 #include <OpenEXR/ImfThreading.h>
 #include <OpenEXR/ImfTiledOutputFile.h>
+#include <OpenEXR/OpenEXRConfig.h>
 
 extern "C" {
 #include "bauhaus/bauhaus.h"
@@ -47,7 +48,12 @@ extern "C" {
 extern "C" {
 #endif
 
-DT_MODULE(4)
+DT_MODULE(5)
+
+// dwaa and dwab compression are there since openexr 2.2
+#if defined(OPENEXR_VERSION_MAJOR) && (OPENEXR_VERSION_MAJOR > 2 || OPENEXR_VERSION_MINOR >= 2)
+#define DT_EXR_HAVE_DWA 1
+#endif
 
 enum dt_imageio_exr_compression_t
 {
@@ -61,9 +67,19 @@ enum dt_imageio_exr_compression_t
                           // fixed compression rate
   B44A_COMPRESSION = 7,   // lossy 4-by-4 pixel block compression,
                           // flat fields are compressed more
+  DWAA_COMPRESSION = 8,   // lossy dct based compression, in blocks
+                          // of 32 scanlines
+  DWAB_COMPRESSION = 9,   // lossy dct based compression, in blocks
+                          // of 256 scanlines
   NUM_COMPRESSION_METHODS // number of different compression methods
 };                        // copy of Imf::Compression
 
+enum dt_imageio_exr_levels_t
+{
+  EXR_ONE_LEVEL = 0,    // full resolution only
+  EXR_MIPMAP_LEVELS = 1 // and every half size down to 1x1, for renderers which sample textures
+};
+
 typedef struct dt_imageio_exr_t
 {
   int max_width, max_height;
@@ -71,11 +87,13 @@ typedef struct dt_imageio_exr_t
   char style[128];
   gboolean style_append;
   dt_imageio_exr_compression_t compression;
+  dt_imageio_exr_levels_t levels;
 } dt_imageio_exr_t;
 
 typedef struct dt_imageio_exr_gui_t
 {
   GtkWidget *compression;
+  GtkWidget *levels;
 } dt_imageio_exr_gui_t;
 
 void init(dt_imageio_module_format_t *self)
@@ -90,9 +108,16 @@ void init(dt_imageio_module_format_t *self)
   luaA_enum_value_name(darktable.lua_state.state, dt_imageio_exr_compression_t, PXR24_COMPRESSION, "pxr24");
   luaA_enum_value_name(darktable.lua_state.state, dt_imageio_exr_compression_t, B44_COMPRESSION, "b44");
   luaA_enum_value_name(darktable.lua_state.state, dt_imageio_exr_compression_t, B44A_COMPRESSION, "b44a");
+  luaA_enum_value_name(darktable.lua_state.state, dt_imageio_exr_compression_t, DWAA_COMPRESSION, "dwaa");
+  luaA_enum_value_name(darktable.lua_state.state, dt_imageio_exr_compression_t, DWAB_COMPRESSION, "dwab");
+  luaA_enum(darktable.lua_state.state, dt_imageio_exr_levels_t);
+  luaA_enum_value_name(darktable.lua_state.state, dt_imageio_exr_levels_t, EXR_ONE_LEVEL, "one");
+  luaA_enum_value_name(darktable.lua_state.state, dt_imageio_exr_levels_t, EXR_MIPMAP_LEVELS, "mipmap");
 
   dt_lua_register_module_member(darktable.lua_state.state, self, dt_imageio_exr_t, compression,
                                 dt_imageio_exr_compression_t);
+  dt_lua_register_module_member(darktable.lua_state.state, self, dt_imageio_exr_t, levels,
+                                dt_imageio_exr_levels_t);
 #endif
   Imf::BlobAttribute::registerAttributeType();
 }
@@ -101,17 +126,45 @@ void cleanup(dt_imageio_module_format_t *self)
 {
 }
 
+// the next level of a mipmap, half the size of in rounded down and at least 1x1, averaging 2x2 pixels
+static void _exr_downscale(const float *const in, const int in_width, const int in_height, float *const out,
+                           const int out_width, const int out_height)
+{
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static) default(none)
+#endif
+  for(int j = 0; j < out_height; j++)
+  {
+    const float *const row0 = in + (size_t)4 * in_width * MIN(2 * j, in_height - 1);
+    const float *const row1 = in + (size_t)4 * in_width * MIN(2 * j + 1, in_height - 1);
+    float *const o = out + (size_t)4 * out_width * j;
+    for(int i = 0; i < out_width; i++)
+    {
+      const int i0 = 4 * MIN(2 * i, in_width - 1), i1 = 4 * MIN(2 * i + 1, in_width - 1);
+      for(int c = 0; c < 4; c++)
+        o[4 * i + c] = 0.25f * (row0[i0 + c] + row0[i1 + c] + row1[i0 + c] + row1[i1 + c]);
+    }
+  }
+}
+
 int write_image(dt_imageio_module_data_t *tmp, const char *filename, const void *in_tmp, void *exif,
-                int exif_len, int imgid, int num, int total)
+                int exif_len, const char *xmp, int imgid, int num, int total)
 {
   const dt_imageio_exr_t *exr = (dt_imageio_exr_t *)tmp;
 
-  Imf::setGlobalThreadCount(dt_get_num_threads());
+  // the tiles are compressed by a pool of that many threads, 0 for as many as darktable uses
+  const int threads = dt_conf_get_int("plugins/imageio/format/exr/threads");
+  Imf::setGlobalThreadCount(threads > 0 ? threads : dt_get_num_threads());
 
   Imf::Blob exif_blob(exif_len, (uint8_t *)exif);
 
-  Imf::Header header(exr->width, exr->height, 1, Imath::V2f(0, 0), 1, Imf::INCREASING_Y,
-                     (Imf::Compression)exr->compression);
+  Imf::Compression compression = (Imf::Compression)exr->compression;
+#ifndef DT_EXR_HAVE_DWA
+  if(exr->compression == DWAA_COMPRESSION || exr->compression == DWAB_COMPRESSION)
+    compression = Imf::PIZ_COMPRESSION;
+#endif
+
+  Imf::Header header(exr->width, exr->height, 1, Imath::V2f(0, 0), 1, Imf::INCREASING_Y, compression);
 
   char comment[1024];
   snprintf(comment, sizeof(comment), "Developed using %s", darktable_package_string);
@@ -198,25 +251,43 @@ icc_end:
   header.channels().insert("G", Imf::Channel(Imf::PixelType::FLOAT));
   header.channels().insert("B", Imf::Channel(Imf::PixelType::FLOAT));
 
-  header.setTileDescription(Imf::TileDescription(100, 100, Imf::ONE_LEVEL));
+  header.setTileDescription(
+      Imf::TileDescription(100, 100, exr->levels == EXR_MIPMAP_LEVELS ? Imf::MIPMAP_LEVELS : Imf::ONE_LEVEL));
 
   Imf::TiledOutputFile file(filename, header);
 
-  Imf::FrameBuffer data;
-
+  // every level is scaled down from the one before
+  std::unique_ptr<float[]> level, prev;
   const float *in = (const float *)in_tmp;
+  int in_width = exr->width, in_height = exr->height;
+
+  for(int l = 0; l < file.numLevels(); l++)
+  {
+    const int width = file.levelWidth(l), height = file.levelHeight(l);
+    if(l > 0)
+    {
+      prev.swap(level);
+      level.reset(new float[(size_t)4 * width * height]);
+      _exr_downscale(in, in_width, in_height, level.get(), width, height);
+      in = level.get();
+      in_width = width;
+      in_height = height;
+    }
 
-  data.insert("R", Imf::Slice(Imf::PixelType::FLOAT, (char *)(in + 0), 4 * sizeof(float),
-                              4 * sizeof(float) * exr->width));
+    Imf::FrameBuffer data;
 
-  data.insert("G", Imf::Slice(Imf::PixelType::FLOAT, (char *)(in + 1), 4 * sizeof(float),
-                              4 * sizeof(float) * exr->width));
+    data.insert("R", Imf::Slice(Imf::PixelType::FLOAT, (char *)(in + 0), 4 * sizeof(float),
+                                4 * sizeof(float) * width));
 
-  data.insert("B", Imf::Slice(Imf::PixelType::FLOAT, (char *)(in + 2), 4 * sizeof(float),
-                              4 * sizeof(float) * exr->width));
+    data.insert("G", Imf::Slice(Imf::PixelType::FLOAT, (char *)(in + 1), 4 * sizeof(float),
+                                4 * sizeof(float) * width));
 
-  file.setFrameBuffer(data);
-  file.writeTiles(0, file.numXTiles() - 1, 0, file.numYTiles() - 1);
+    data.insert("B", Imf::Slice(Imf::PixelType::FLOAT, (char *)(in + 2), 4 * sizeof(float),
+                                4 * sizeof(float) * width));
+
+    file.setFrameBuffer(data);
+    file.writeTiles(0, file.numXTiles(l) - 1, 0, file.numYTiles(l) - 1, l);
+  }
 
   return 0;
 }
@@ -230,16 +301,17 @@ void *legacy_params(dt_imageio_module_format_t *self, const void *const old_para
                     const size_t old_params_size, const int old_version, const int new_version,
                     size_t *new_size)
 {
-  if(old_version == 1 && new_version == 4)
+  if(old_version == 1 && new_version == 5)
   {
     dt_imageio_exr_t *new_params = (dt_imageio_exr_t *)malloc(sizeof(dt_imageio_exr_t));
     memcpy(new_params, old_params, old_params_size);
     new_params->compression = (dt_imageio_exr_compression_t)PIZ_COMPRESSION;
     new_params->style_append = 0;
+    new_params->levels = EXR_ONE_LEVEL;
     *new_size = self->params_size(self);
     return new_params;
   }
-  if(old_version == 2 && new_version == 4)
+  if(old_version == 2 && new_version == 5)
   {
     enum dt_imageio_exr_pixeltype_t
     {
@@ -265,11 +337,12 @@ void *legacy_params(dt_imageio_module_format_t *self, const void *const old_para
     memcpy(new_params, old_params, sizeof(old_params_size));
     new_params->style_append = 0;
     new_params->compression = o->compression;
+    new_params->levels = EXR_ONE_LEVEL;
 
     *new_size = self->params_size(self);
     return new_params;
   }
-  if(old_version == 3 && new_version == 4)
+  if(old_version == 3 && new_version == 5)
   {
     struct dt_imageio_exr_v3_t
     {
@@ -282,9 +355,29 @@ void *legacy_params(dt_imageio_module_format_t *self, const void *const old_para
     const dt_imageio_exr_v3_t *o = (dt_imageio_exr_v3_t *)old_params;
     dt_imageio_exr_t *new_params = (dt_imageio_exr_t *)malloc(sizeof(dt_imageio_exr_t));
 
-    memcpy(new_params, old_params, sizeof(dt_imageio_exr_t));
+    memcpy(new_params, old_params, sizeof(dt_imageio_exr_v3_t));
     new_params->style_append = 0;
     new_params->compression = o->compression;
+    new_params->levels = EXR_ONE_LEVEL;
+
+    *new_size = self->params_size(self);
+    return new_params;
+  }
+  if(old_version == 4 && new_version == 5)
+  {
+    struct dt_imageio_exr_v4_t
+    {
+      int max_width, max_height;
+      int width, height;
+      char style[128];
+      gboolean style_append;
+      dt_imageio_exr_compression_t compression;
+    };
+
+    dt_imageio_exr_t *new_params = (dt_imageio_exr_t *)malloc(sizeof(dt_imageio_exr_t));
+
+    memcpy(new_params, old_params, sizeof(dt_imageio_exr_v4_t));
+    new_params->levels = EXR_ONE_LEVEL;
 
     *new_size = self->params_size(self);
     return new_params;
@@ -296,6 +389,7 @@ void *get_params(dt_imageio_module_format_t *self)
 {
   dt_imageio_exr_t *d = (dt_imageio_exr_t *)calloc(1, sizeof(dt_imageio_exr_t));
   d->compression = (dt_imageio_exr_compression_t)dt_conf_get_int("plugins/imageio/format/exr/compression");
+  d->levels = (dt_imageio_exr_levels_t)dt_conf_get_int("plugins/imageio/format/exr/levels");
   return d;
 }
 
@@ -310,6 +404,7 @@ int set_params(dt_imageio_module_format_t *self, const void *params, const int s
   dt_imageio_exr_t *d = (dt_imageio_exr_t *)params;
   dt_imageio_exr_gui_t *g = (dt_imageio_exr_gui_t *)self->gui_data;
   dt_bauhaus_combobox_set(g->compression, d->compression);
+  dt_bauhaus_combobox_set(g->levels, d->levels);
   return 0;
 }
 
@@ -344,6 +439,12 @@ static void combobox_changed(GtkWidget *widget, gpointer user_data)
   dt_conf_set_int("plugins/imageio/format/exr/compression", compression);
 }
 
+static void levels_changed(GtkWidget *widget, gpointer user_data)
+{
+  const int levels = dt_bauhaus_combobox_get(widget);
+  dt_conf_set_int("plugins/imageio/format/exr/levels", levels);
+}
+
 void gui_init(dt_imageio_module_format_t *self)
 {
   self->gui_data = malloc(sizeof(dt_imageio_exr_gui_t));
@@ -364,9 +465,23 @@ void gui_init(dt_imageio_module_format_t *self)
   dt_bauhaus_combobox_add(gui->compression, _("PXR24 (lossy)"));
   dt_bauhaus_combobox_add(gui->compression, _("B44 (lossy)"));
   dt_bauhaus_combobox_add(gui->compression, _("B44A (lossy)"));
+#ifdef DT_EXR_HAVE_DWA
+  dt_bauhaus_combobox_add(gui->compression, _("DWAA (lossy)"));
+  dt_bauhaus_combobox_add(gui->compression, _("DWAB (lossy)"));
+#endif
   dt_bauhaus_combobox_set(gui->compression, compression_last);
   gtk_box_pack_start(GTK_BOX(self->widget), gui->compression, TRUE, TRUE, 0);
   g_signal_connect(G_OBJECT(gui->compression), "value-changed", G_CALLBACK(combobox_changed), NULL);
+
+  gui->levels = dt_bauhaus_combobox_new(NULL);
+  dt_bauhaus_widget_set_label(gui->levels, NULL, _("resolution levels"));
+  dt_bauhaus_combobox_add(gui->levels, _("single"));
+  dt_bauhaus_combobox_add(gui->levels, _("mipmap"));
+  dt_bauhaus_combobox_set(gui->levels, dt_conf_get_int("plugins/imageio/format/exr/levels"));
+  gtk_widget_set_tooltip_text(gui->levels, _("also store every half size of the image down to 1x1, for "
+                                             "renderers that sample it as a texture"));
+  gtk_box_pack_start(GTK_BOX(self->widget), gui->levels, TRUE, TRUE, 0);
+  g_signal_connect(G_OBJECT(gui->levels), "value-changed", G_CALLBACK(levels_changed), NULL);
 }
 
 void gui_cleanup(dt_imageio_module_format_t *self)
@@ -380,6 +495,8 @@ void gui_reset(dt_imageio_module_format_t *self)
 
 
 
+#undef DT_EXR_HAVE_DWA
+
 #ifdef __cplusplus
 }
 #endif
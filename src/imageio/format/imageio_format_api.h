@@ -73,9 +73,19 @@ int dimension(struct dt_imageio_module_format_t *self, struct dt_imageio_module_
 // writing functions:
 /* bits per pixel and color channel we want to write: 8: char x3, 16: uint16_t x3, 32: float x3. */
 int bpp(struct dt_imageio_module_data_t *data);
-/* write to file, with exif if not NULL, and icc profile if supported. */
+/* write to file, with exif if not NULL, and icc profile if supported. xmp is the packet to embed if not NULL,
+ * only given to formats with FORMAT_FLAGS_EMBED_XMP. */
 int write_image(struct dt_imageio_module_data_t *data, const char *filename, const void *in, void *exif,
-                int exif_len, int imgid, int num, int total);
+                int exif_len, const char *xmp, int imgid, int num, int total);
+/* optional, write the image as the export pipe produces it, in place of write_image. begin returns NULL if
+ * that's not possible with these parameters. the rows are handed over top to bottom, 8 bit with 4 channels,
+ * or for 32 bpp as the pipe writes them. exif and xmp are as for write_image and stay valid until end,
+ * which removes the file if failed != 0. */
+void *write_image_begin(struct dt_imageio_module_data_t *data, const char *filename, void *exif, int exif_len,
+                        const char *xmp, int imgid, int num, int total);
+int write_image_rows(struct dt_imageio_module_data_t *data, void *handle, const void *in, int first_row,
+                     int rows);
+int write_image_end(struct dt_imageio_module_data_t *data, void *handle, int failed);
 /* flag that describes the available precision/levels of output format. mainly used for dithering. */
 int levels(struct dt_imageio_module_data_t *data);
 
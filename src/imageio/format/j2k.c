@@ -322,7 +322,7 @@ static void cinema_setup_encoder(opj_cparameters_t *parameters, opj_image_t *ima
 }
 
 int write_image(dt_imageio_module_data_t *j2k_tmp, const char *filename, const void *in_tmp, void *exif,
-                int exif_len, int imgid, int num, int total)
+                int exif_len, const char *xmp, int imgid, int num, int total)
 {
   const float *in = (const float *)in_tmp;
   dt_imageio_j2k_t *j2k = (dt_imageio_j2k_t *)j2k_tmp;
@@ -397,12 +397,18 @@ int write_image(dt_imageio_module_data_t *j2k_tmp, const char *filename, const v
     switch(prec)
     {
       case 8:
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static) default(none) shared(in, image)
+#endif
         for(int i = 0; i < w * h; i++)
         {
           for(int k = 0; k < numcomps; k++) image->comps[k].data[i] = DOWNSAMPLE_FLOAT_TO_8BIT(in[i * 4 + k]);
         }
         break;
       case 12:
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static) default(none) shared(in, image)
+#endif
         for(int i = 0; i < w * h; i++)
         {
           for(int k = 0; k < numcomps; k++)
@@ -410,6 +416,9 @@ int write_image(dt_imageio_module_data_t *j2k_tmp, const char *filename, const v
         }
         break;
       case 16:
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static) default(none) shared(in, image)
+#endif
         for(int i = 0; i < w * h; i++)
         {
           for(int k = 0; k < numcomps; k++)
@@ -459,6 +468,11 @@ int write_image(dt_imageio_module_data_t *j2k_tmp, const char *filename, const v
   /* setup the encoder parameters using the current image and user parameters */
   opj_setup_encoder(ccodec, &parameters, image);
 
+#if defined(OPJ_VERSION_MAJOR) && (OPJ_VERSION_MAJOR > 2 || (OPJ_VERSION_MAJOR == 2 && OPJ_VERSION_MINOR >= 4))
+  // openjpeg encodes the code blocks in parallel since 2.4
+  if(opj_has_thread_support()) opj_codec_set_threads(ccodec, dt_get_num_threads());
+#endif
+
   /* open a byte stream for writing */
   /* allocate memory for all tiles */
   cstream = opj_stream_create_default_file_stream(parameters.outfile, OPJ_FALSE);
@@ -32,6 +32,7 @@
 #include <setjmp.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 // this fixes a rather annoying, long time bug in libjpeg :(
 #undef HAVE_STDLIB_H
 #undef HAVE_STDDEF_H
@@ -313,8 +314,114 @@ read_icc_profile (j_decompress_ptr cinfo,
 #undef MAX_SEQ_NO
 
 
+// rows of a band encoded in parallel, rounded to whole mcu rows
+#define DT_JPEG_BAND_ROWS 64
+
+// the compression parameters of jpg, for an image with height rows
+static void _jpeg_set_params(const dt_imageio_jpeg_t *jpg, j_compress_ptr cinfo, const int height,
+                             const int resolution)
+{
+  cinfo->image_width = jpg->width;
+  cinfo->image_height = height;
+  cinfo->input_components = 3;
+  cinfo->in_color_space = JCS_RGB;
+  jpeg_set_defaults(cinfo);
+  jpeg_set_quality(cinfo, jpg->quality, TRUE);
+  if(jpg->quality > 90) cinfo->comp_info[0].v_samp_factor = 1;
+  if(jpg->quality > 92) cinfo->comp_info[0].h_samp_factor = 1;
+  if(jpg->quality > 95) cinfo->dct_method = JDCT_FLOAT;
+  if(jpg->quality < 50) cinfo->dct_method = JDCT_IFAST;
+  if(jpg->quality < 80) cinfo->smoothing_factor = 20;
+  if(jpg->quality < 60) cinfo->smoothing_factor = 40;
+  if(jpg->quality < 40) cinfo->smoothing_factor = 60;
+  cinfo->optimize_coding = 1;
+
+  // according to specs density_unit = 0, X_density = 1, Y_density = 1 should be fine and valid since it
+  // describes an image with unknown unit and square pixels.
+  // however, some applications (like the Telekom cloud thingy) seem to be confused by that, so let's set
+  // these calues to the same as stored in exiv :/
+  if(resolution > 0)
+  {
+    cinfo->density_unit = 1;
+    cinfo->X_density = resolution;
+    cinfo->Y_density = resolution;
+  }
+  else
+  {
+    cinfo->density_unit = 0;
+    cinfo->X_density = 1;
+    cinfo->Y_density = 1;
+  }
+}
+
+static void _jpeg_write_profile(j_compress_ptr cinfo, const int imgid)
+{
+  if(imgid <= 0) return;
+  cmsHPROFILE out_profile = dt_colorspaces_get_output_profile(imgid)->profile;
+  uint32_t len = 0;
+  cmsSaveProfileToMem(out_profile, 0, &len);
+  if(len > 0)
+  {
+    unsigned char *buf = malloc(len * sizeof(unsigned char));
+    cmsSaveProfileToMem(out_profile, buf, &len);
+    write_icc_profile(cinfo, buf, len);
+    free(buf);
+  }
+}
+
+// the largest payload of a marker
+#define DT_JPEG_MARKER_MAX 65533
+// exif or xmp that don't fit into a marker, exiv2 writes them into the finished file
+#define DT_JPEG_LATE_EXIF 1
+#define DT_JPEG_LATE_XMP 2
+
+static const char _jpeg_xmp_namespace[] = "http://ns.adobe.com/xap/1.0/";
+
+static int _jpeg_metadata_late(const int exif_len, const char *xmp)
+{
+  int late = 0;
+  if(exif_len > DT_JPEG_MARKER_MAX) late |= DT_JPEG_LATE_EXIF;
+  if(xmp && sizeof(_jpeg_xmp_namespace) + strlen(xmp) > DT_JPEG_MARKER_MAX) late |= DT_JPEG_LATE_XMP;
+  return late;
+}
+
+// exif and xmp go into app1 markers, behind the jfif one and in front of the icc profile
+static void _jpeg_write_metadata(j_compress_ptr cinfo, const void *exif, const int exif_len, const char *xmp,
+                                 const int late)
+{
+  if(exif && exif_len > 0 && !(late & DT_JPEG_LATE_EXIF))
+    jpeg_write_marker(cinfo, JPEG_APP0 + 1, (const JOCTET *)exif, exif_len);
+  if(xmp && !(late & DT_JPEG_LATE_XMP))
+  {
+    const size_t len = strlen(xmp);
+    jpeg_write_m_header(cinfo, JPEG_APP0 + 1, sizeof(_jpeg_xmp_namespace) + len);
+    for(size_t k = 0; k < sizeof(_jpeg_xmp_namespace); k++) jpeg_write_m_byte(cinfo, _jpeg_xmp_namespace[k]);
+    for(size_t k = 0; k < len; k++) jpeg_write_m_byte(cinfo, xmp[k]);
+  }
+}
+
+static void _jpeg_write_late_metadata(const char *filename, void *exif, const int exif_len, const char *xmp,
+                                      const int late, const int imgid)
+{
+  if(exif && (late & DT_JPEG_LATE_EXIF)) dt_exif_write_blob(exif, exif_len, filename, 1);
+  if(xmp && (late & DT_JPEG_LATE_XMP)) dt_exif_xmp_attach(imgid, filename);
+}
+
+// feeds rows of 4 channel pixels to cinfo
+static void _jpeg_write_rows(j_compress_ptr cinfo, uint8_t *const row, const uint8_t *const in, const int rows)
+{
+  for(int j = 0; j < rows; j++)
+  {
+    const uint8_t *const buf = in + (size_t)j * cinfo->image_width * 4;
+    for(JDIMENSION i = 0; i < cinfo->image_width; i++)
+      for(int k = 0; k < 3; k++) row[3 * i + k] = buf[4 * i + k];
+    JSAMPROW tmp[1] = { row };
+    jpeg_write_scanlines(cinfo, tmp, 1);
+  }
+}
+
 int write_image(dt_imageio_module_data_t *jpg_tmp, const char *filename, const void *in_tmp, void *exif,
-                int exif_len, int imgid, int num, int total)
+                int exif_len, const char *xmp, int imgid, int num, int total)
 {
   dt_imageio_jpeg_t *jpg = (dt_imageio_jpeg_t *)jpg_tmp;
   const uint8_t *in = (const uint8_t *)in_tmp;
@@ -332,76 +439,305 @@ int write_image(dt_imageio_module_data_t *jpg_tmp, const char *filename, const v
   if(!f) return 1;
   jpeg_stdio_dest(&(jpg->cinfo), f);
 
-  jpg->cinfo.image_width = jpg->width;
-  jpg->cinfo.image_height = jpg->height;
-  jpg->cinfo.input_components = 3;
-  jpg->cinfo.in_color_space = JCS_RGB;
-  jpeg_set_defaults(&(jpg->cinfo));
-  jpeg_set_quality(&(jpg->cinfo), jpg->quality, TRUE);
-  if(jpg->quality > 90) jpg->cinfo.comp_info[0].v_samp_factor = 1;
-  if(jpg->quality > 92) jpg->cinfo.comp_info[0].h_samp_factor = 1;
-  if(jpg->quality > 95) jpg->cinfo.dct_method = JDCT_FLOAT;
-  if(jpg->quality < 50) jpg->cinfo.dct_method = JDCT_IFAST;
-  if(jpg->quality < 80) jpg->cinfo.smoothing_factor = 20;
-  if(jpg->quality < 60) jpg->cinfo.smoothing_factor = 40;
-  if(jpg->quality < 40) jpg->cinfo.smoothing_factor = 60;
-  jpg->cinfo.optimize_coding = 1;
+  _jpeg_set_params(jpg, &(jpg->cinfo), jpg->height, dt_conf_get_int("metadata/resolution"));
 
-  // according to specs density_unit = 0, X_density = 1, Y_density = 1 should be fine and valid since it
-  // describes an image with unknown unit and square pixels.
-  // however, some applications (like the Telekom cloud thingy) seem to be confused by that, so let's set
-  // these calues to the same as stored in exiv :/
-  const int resolution = dt_conf_get_int("metadata/resolution");
-  if(resolution > 0)
+  jpeg_start_compress(&(jpg->cinfo), TRUE);
+
+  const int late = _jpeg_metadata_late(exif_len, xmp);
+  _jpeg_write_metadata(&(jpg->cinfo), exif, exif_len, xmp, late);
+  _jpeg_write_profile(&(jpg->cinfo), imgid);
+
+  uint8_t *row = malloc((size_t)3 * jpg->width * sizeof(uint8_t));
+  _jpeg_write_rows(&(jpg->cinfo), row, in, jpg->height);
+  jpeg_finish_compress(&(jpg->cinfo));
+  free(row);
+  jpeg_destroy_compress(&(jpg->cinfo));
+  fclose(f);
+
+  _jpeg_write_late_metadata(filename, exif, exif_len, xmp, late, imgid);
+
+  return 0;
+}
+
+/*
+ * the export hands the image over in bands of rows as the pipe produces them. when libjpeg can compress to
+ * memory, the image is cut into bands of band_rows rows that are one restart interval each: every band is
+ * a jpeg of its own then, encoded in parallel with the same parameters, and their entropy coded data makes
+ * up the scan of the whole image, with restart markers in between. the huffman tables can't be optimized
+ * for the image that way, the bands use the standard ones. with smoothing, which would look across the
+ * band borders, or a single thread, cinfo takes the rows as they come instead.
+ */
+typedef struct dt_imageio_jpeg_stream_t
+{
+  FILE *f;
+  gchar *filename;
+  int imgid;
+  int resolution;
+  void *exif; // owned by the export, like xmp
+  int exif_len;
+  const char *xmp;
+  int late; // DT_JPEG_LATE_EXIF and DT_JPEG_LATE_XMP
+  struct jpeg_compress_struct cinfo;
+  struct dt_imageio_jpeg_error_mgr jerr;
+  uint8_t *row;
+  int band_rows;                 // 0 if cinfo compresses serially
+  unsigned int restart_interval; // mcus of a band
+  int num_bands;                 // bands encoded at a time
+  uint8_t *pending;              // rows of the next num_bands bands
+  int pending_rows;
+  int rows_done;
+  int bands_written;
+  int started;
+} dt_imageio_jpeg_stream_t;
+
+#if JPEG_LIB_VERSION >= 80 || defined(MEM_SRCDST_SUPPORTED)
+// the rows of band as a jpeg in memory, the first one with the metadata and the color profile. NULL on failure.
+static unsigned char *_jpeg_encode_band(const dt_imageio_jpeg_t *jpg, const dt_imageio_jpeg_stream_t *s,
+                                        const uint8_t *const in, const int band, const int rows,
+                                        unsigned long *size)
+{
+  struct jpeg_compress_struct cinfo;
+  struct dt_imageio_jpeg_error_mgr jerr;
+  unsigned char *out = NULL;
+  *size = 0;
+  uint8_t *row = malloc((size_t)3 * jpg->width * sizeof(uint8_t));
+  if(!row) return NULL;
+
+  cinfo.err = jpeg_std_error(&jerr.pub);
+  jerr.pub.error_exit = dt_imageio_jpeg_error_exit;
+  if(setjmp(jerr.setjmp_buffer))
   {
-    jpg->cinfo.density_unit = 1;
-    jpg->cinfo.X_density = resolution;
-    jpg->cinfo.Y_density = resolution;
+    jpeg_destroy_compress(&cinfo);
+    free(row);
+    free(out);
+    return NULL;
   }
-  else
+  jpeg_create_compress(&cinfo);
+  jpeg_mem_dest(&cinfo, &out, size);
+  _jpeg_set_params(jpg, &cinfo, rows, s->resolution);
+  cinfo.optimize_coding = 0;
+  cinfo.restart_interval = s->restart_interval;
+  jpeg_start_compress(&cinfo, TRUE);
+  if(band == 0)
   {
-    jpg->cinfo.density_unit = 0;
-    jpg->cinfo.X_density = 1;
-    jpg->cinfo.Y_density = 1;
+    _jpeg_write_metadata(&cinfo, s->exif, s->exif_len, s->xmp, s->late);
+    _jpeg_write_profile(&cinfo, s->imgid);
   }
+  _jpeg_write_rows(&cinfo, row, in, rows);
+  jpeg_finish_compress(&cinfo);
+  jpeg_destroy_compress(&cinfo);
+  free(row);
+  return out;
+}
+#endif
 
-  jpeg_start_compress(&(jpg->cinfo), TRUE);
+// offset of the entropy coded data of a jpeg in memory, right behind the header of its scan, 0 if there is
+// none. sof is set to the offset of the frame header.
+static size_t _jpeg_scan_offset(const uint8_t *const buf, const size_t size, size_t *sof)
+{
+  size_t pos = 2; // behind soi
+  while(pos + 4 <= size && buf[pos] == 0xff)
+  {
+    const int marker = buf[pos + 1];
+    if(marker == 0xc0 || marker == 0xc1) *sof = pos;
+    pos += 2 + (((size_t)buf[pos + 2] << 8) | buf[pos + 3]);
+    if(marker == 0xda) return pos <= size ? pos : 0;
+  }
+  return 0;
+}
+
+// encodes the pending rows in parallel and appends them to the file
+static int _jpeg_stream_flush(const dt_imageio_jpeg_t *jpg, dt_imageio_jpeg_stream_t *s)
+{
+#if JPEG_LIB_VERSION >= 80 || defined(MEM_SRCDST_SUPPORTED)
+  const int num_bands = (s->pending_rows + s->band_rows - 1) / s->band_rows;
+  unsigned char **out = calloc(num_bands, sizeof(unsigned char *));
+  unsigned long *size = calloc(num_bands, sizeof(unsigned long));
+  if(!out || !size)
+  {
+    free(out);
+    free(size);
+    return 1;
+  }
 
-  if(imgid > 0)
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic) default(none) shared(jpg, s, out, size)
+#endif
+  for(int b = 0; b < num_bands; b++)
   {
-    cmsHPROFILE out_profile = dt_colorspaces_get_output_profile(imgid)->profile;
-    uint32_t len = 0;
-    cmsSaveProfileToMem(out_profile, 0, &len);
-    if(len > 0)
+    const int rows = MIN(s->band_rows, s->pending_rows - b * s->band_rows);
+    const uint8_t *const in = s->pending + (size_t)4 * jpg->width * b * s->band_rows;
+    out[b] = _jpeg_encode_band(jpg, s, in, s->bands_written + b, rows, size + b);
+  }
+
+  int failed = 0;
+  for(int b = 0; b < num_bands; b++)
+  {
+    size_t sof = 0;
+    const size_t scan = out[b] ? _jpeg_scan_offset(out[b], size[b], &sof) : 0;
+    if(failed || !scan || !sof || size[b] < scan + 2)
+    {
+      failed = 1;
+      continue;
+    }
+    // all but the eoi, the first band with its header, for the height of the whole image
+    if(s->bands_written == 0)
+    {
+      out[b][sof + 5] = jpg->height >> 8;
+      out[b][sof + 6] = jpg->height & 0xff;
+      failed = fwrite(out[b], 1, size[b] - 2, s->f) != size[b] - 2;
+    }
+    else
     {
-      unsigned char *buf = malloc(len * sizeof(unsigned char));
-      cmsSaveProfileToMem(out_profile, buf, &len);
-      write_icc_profile(&(jpg->cinfo), buf, len);
-      free(buf);
+      const uint8_t rst[2] = { 0xff, 0xd0 + ((s->bands_written - 1) & 7) };
+      failed = fwrite(rst, 1, sizeof(rst), s->f) != sizeof(rst)
+               || fwrite(out[b] + scan, 1, size[b] - 2 - scan, s->f) != size[b] - 2 - scan;
     }
+    s->bands_written++;
   }
 
-  uint8_t *row = malloc((size_t)3 * jpg->width * sizeof(uint8_t));
-  const uint8_t *buf;
-  while(jpg->cinfo.next_scanline < jpg->cinfo.image_height)
+  for(int b = 0; b < num_bands; b++) free(out[b]);
+  free(out);
+  free(size);
+  s->pending_rows = 0;
+  return failed;
+#else
+  return 1;
+#endif
+}
+
+void *write_image_begin(dt_imageio_module_data_t *jpg_tmp, const char *filename, void *exif, int exif_len,
+                        const char *xmp, int imgid, int num, int total)
+{
+  dt_imageio_jpeg_t *jpg = (dt_imageio_jpeg_t *)jpg_tmp;
+  dt_imageio_jpeg_stream_t *s = (dt_imageio_jpeg_stream_t *)calloc(1, sizeof(dt_imageio_jpeg_stream_t));
+  if(!s) return NULL;
+  s->f = g_fopen(filename, "wb");
+  if(!s->f)
   {
-    JSAMPROW tmp[1];
-    buf = in + (size_t)jpg->cinfo.next_scanline * jpg->cinfo.image_width * 4;
-    for(int i = 0; i < jpg->width; i++)
-      for(int k = 0; k < 3; k++) row[3 * i + k] = buf[4 * i + k];
-    tmp[0] = row;
-    jpeg_write_scanlines(&(jpg->cinfo), tmp, 1);
+    free(s);
+    return NULL;
   }
-  jpeg_finish_compress(&(jpg->cinfo));
-  free(row);
-  jpeg_destroy_compress(&(jpg->cinfo));
-  fclose(f);
+  s->filename = g_strdup(filename);
+  s->imgid = imgid;
+  s->resolution = dt_conf_get_int("metadata/resolution");
+  s->exif = exif;
+  s->exif_len = exif_len;
+  s->xmp = xmp;
+  s->late = _jpeg_metadata_late(exif_len, xmp);
+  s->row = malloc((size_t)3 * jpg->width * sizeof(uint8_t));
+
+  s->cinfo.err = jpeg_std_error(&s->jerr.pub);
+  s->jerr.pub.error_exit = dt_imageio_jpeg_error_exit;
+  if(setjmp(s->jerr.setjmp_buffer))
+  {
+    jpeg_destroy_compress(&s->cinfo);
+    fclose(s->f);
+    g_unlink(s->filename);
+    g_free(s->filename);
+    free(s->row);
+    free(s);
+    return NULL;
+  }
+  jpeg_create_compress(&s->cinfo);
+  _jpeg_set_params(jpg, &s->cinfo, jpg->height, s->resolution);
+
+#if JPEG_LIB_VERSION >= 80 || defined(MEM_SRCDST_SUPPORTED)
+  // a restart interval can't hold more than 65535 mcus
+  const int mcu_width = 8 * s->cinfo.comp_info[0].h_samp_factor;
+  const int mcu_height = 8 * s->cinfo.comp_info[0].v_samp_factor;
+  const int mcus_per_row = (jpg->width + mcu_width - 1) / mcu_width;
+  const int mcu_rows = MAX(1, MIN(DT_JPEG_BAND_ROWS / mcu_height, 65535 / mcus_per_row));
+  s->num_bands = dt_get_num_threads();
+  if(s->num_bands > 1 && s->cinfo.smoothing_factor == 0 && jpg->height > mcu_rows * mcu_height)
+  {
+    s->band_rows = mcu_rows * mcu_height;
+    s->restart_interval = mcu_rows * mcus_per_row;
+    s->pending = malloc((size_t)4 * jpg->width * s->band_rows * s->num_bands);
+    if(!s->pending) s->band_rows = 0;
+  }
+#endif
+  if(s->band_rows)
+    jpeg_destroy_compress(&s->cinfo);
+  else
+  {
+    jpeg_stdio_dest(&s->cinfo, s->f);
+    jpeg_start_compress(&s->cinfo, TRUE);
+    _jpeg_write_metadata(&s->cinfo, exif, exif_len, xmp, s->late);
+    _jpeg_write_profile(&s->cinfo, imgid);
+    s->started = 1;
+  }
+  return s;
+}
 
-  dt_exif_write_blob(exif, exif_len, filename, 1);
+int write_image_rows(dt_imageio_module_data_t *jpg_tmp, void *handle, const void *in_tmp, int first_row, int rows)
+{
+  dt_imageio_jpeg_t *jpg = (dt_imageio_jpeg_t *)jpg_tmp;
+  dt_imageio_jpeg_stream_t *s = (dt_imageio_jpeg_stream_t *)handle;
+  const uint8_t *in = (const uint8_t *)in_tmp;
+  if(first_row != s->rows_done) return 1;
+  s->rows_done += rows;
 
+  if(!s->band_rows)
+  {
+    if(setjmp(s->jerr.setjmp_buffer)) return 1;
+    _jpeg_write_rows(&s->cinfo, s->row, in, rows);
+    return 0;
+  }
+
+  const size_t stride = (size_t)4 * jpg->width;
+  while(rows > 0)
+  {
+    const int n = MIN(rows, s->band_rows * s->num_bands - s->pending_rows);
+    memcpy(s->pending + stride * s->pending_rows, in, stride * n);
+    s->pending_rows += n;
+    in += stride * n;
+    rows -= n;
+    if((s->pending_rows == s->band_rows * s->num_bands || s->rows_done == jpg->height)
+       && _jpeg_stream_flush(jpg, s))
+      return 1;
+  }
   return 0;
 }
 
+int write_image_end(dt_imageio_module_data_t *jpg_tmp, void *handle, int failed)
+{
+  dt_imageio_jpeg_t *jpg = (dt_imageio_jpeg_t *)jpg_tmp;
+  dt_imageio_jpeg_stream_t *s = (dt_imageio_jpeg_stream_t *)handle;
+  failed = failed || s->rows_done != jpg->height;
+
+  if(s->started)
+  {
+    if(setjmp(s->jerr.setjmp_buffer))
+      failed = 1;
+    else if(!failed)
+      jpeg_finish_compress(&s->cinfo);
+    jpeg_destroy_compress(&s->cinfo);
+  }
+  else if(!failed)
+  {
+    const uint8_t eoi[2] = { 0xff, 0xd9 };
+    failed = fwrite(eoi, 1, sizeof(eoi), s->f) != sizeof(eoi);
+  }
+  if(fclose(s->f)) failed = 1;
+
+  if(failed)
+    g_unlink(s->filename);
+  else
+    _jpeg_write_late_metadata(s->filename, s->exif, s->exif_len, s->xmp, s->late, s->imgid);
+
+  g_free(s->filename);
+  free(s->pending);
+  free(s->row);
+  free(s);
+  return failed;
+}
+
+#undef DT_JPEG_BAND_ROWS
+#undef DT_JPEG_MARKER_MAX
+#undef DT_JPEG_LATE_EXIF
+#undef DT_JPEG_LATE_XMP
+
 static int __attribute__((__unused__)) read_header(const char *filename, dt_imageio_jpeg_t *jpg)
 {
   jpg->f = g_fopen(filename, "rb");
@@ -556,7 +892,7 @@ const char *extension(dt_imageio_module_data_t *data)
 
 int flags(dt_imageio_module_data_t *data)
 {
-  return FORMAT_FLAGS_SUPPORT_XMP;
+  return FORMAT_FLAGS_SUPPORT_XMP | FORMAT_FLAGS_EMBED_XMP;
 }
 
 void init(dt_imageio_module_format_t *self)
@@ -30,6 +30,9 @@
 
 DT_MODULE(1)
 
+// bytes of the converted pixels handed to the pdf library at once
+#define DT_PDF_BAND_SIZE ((size_t)16 << 20)
+
 // clang-format off
 
 // gui data
@@ -111,7 +114,7 @@ typedef struct dt_imageio_pdf_t
   dt_imageio_pdf_params_t  params;
   char                    *actual_filename;
   dt_pdf_t                *pdf;
-  GList                   *images;
+  GPtrArray               *pages; // written right after their image, only the ids are needed in the end
   GList                   *icc_profiles;
   float                    page_border;
 } dt_imageio_pdf_t;
@@ -231,7 +234,7 @@ static int _paper_size(dt_imageio_pdf_params_t *d, float *page_width, float *pag
 
 
 int write_image(dt_imageio_module_data_t *data, const char *filename, const void *in, void *exif,
-                int exif_len, int imgid, int num, int total)
+                int exif_len, const char *xmp, int imgid, int num, int total)
 {
   dt_imageio_pdf_t *d = (dt_imageio_pdf_t *)data;
 
@@ -260,6 +263,7 @@ int write_image(dt_imageio_module_data_t *data, const char *filename, const void
     pdf->title = *d->params.title ? d->params.title : NULL;
 
     d->pdf = pdf;
+    d->pages = g_ptr_array_new_with_free_func(free);
     d->actual_filename = g_strdup(filename);
     d->page_border = page_border;
   } // init the pdf
@@ -299,89 +303,84 @@ int write_image(dt_imageio_module_data_t *data, const char *filename, const void
     }
   }
 
-  void *image_data = NULL;
+  const gboolean outline_mode = d->params.mode != MODE_NORMAL;
+  const int width = d->params.parent.width, height = d->params.parent.height;
+  dt_pdf_image_t *image
+      = dt_pdf_add_image_begin(d->pdf, outline_mode, width, height, d->params.bpp, icc_id, d->page_border);
+  int failed = image == NULL;
 
-  // TODO
-  // decide if we want to push that conversion step into the pdf lib and maybe do it on the fly while writing.
-  // that would get rid of one buffer in the case of ASCII_HEX
-  if(d->params.mode == MODE_NORMAL)
+  if(image && !outline_mode)
   {
-    if(d->params.bpp == 8)
+    // the pixels go to the file a band at a time, with the interleaved 4 channels of the input made 3 and 16 bit
+    // values big endian on the way. the pdf library deflates a band in parallel, so it shouldn't be too small.
+    const size_t row_size = (size_t)width * 3 * (d->params.bpp / 8);
+    const int band_rows = CLAMP(DT_PDF_BAND_SIZE / MAX(row_size, 1), 1, height);
+    void *band = dt_alloc_align(64, row_size * band_rows);
+    if(!band) failed = 1;
+    for(int y = 0; y < height && !failed; y += band_rows)
     {
-      image_data = malloc(data->width * data->height * 3);
-      const uint8_t *in_ptr = (const uint8_t *)in;
-      uint8_t *out_ptr = (uint8_t *)image_data;
-      for(int y = 0; y < data->height; y++)
+      const int rows = MIN(band_rows, height - y);
+      if(d->params.bpp == 8)
       {
-        for(int x = 0; x < data->width; x++, in_ptr += 4, out_ptr += 3)
-          memcpy(out_ptr, in_ptr, 3);
+        const uint8_t *in_ptr = (const uint8_t *)in + (size_t)4 * width * y;
+        uint8_t *out_ptr = (uint8_t *)band;
+        for(size_t k = 0; k < (size_t)width * rows; k++, in_ptr += 4, out_ptr += 3) memcpy(out_ptr, in_ptr, 3);
       }
-    }
-    else
-    {
-      image_data = malloc(data->width * data->height * 3 * sizeof(uint16_t));
-      const uint16_t *in_ptr = (const uint16_t *)in;
-      uint16_t *out_ptr = (uint16_t *)image_data;
-      for(int y = 0; y < data->height; y++)
+      else
       {
-        for(int x = 0; x < data->width; x++, in_ptr += 4, out_ptr += 3)
+        const uint16_t *in_ptr = (const uint16_t *)in + (size_t)4 * width * y;
+        uint16_t *out_ptr = (uint16_t *)band;
+        for(size_t k = 0; k < (size_t)width * rows; k++, in_ptr += 4, out_ptr += 3)
         {
           for(int c = 0; c < 3; c++)
             out_ptr[c] = (0xff00 & (in_ptr[c] << 8)) | (in_ptr[c] >> 8);
         }
       }
+      failed = dt_pdf_add_image_rows(d->pdf, image, band, rows);
     }
+    dt_free_align(band);
+    if(dt_pdf_add_image_end(d->pdf, image)) failed = 1;
   }
 
-  dt_pdf_image_t *image = dt_pdf_add_image(d->pdf, image_data, d->params.parent.width, d->params.parent.height, d->params.bpp, icc_id, d->page_border);
-
-  free(image_data);
-
-  d->images = g_list_append(d->images, image);
-
+  // the page follows its image, so nothing but the small page struct is kept until the end
+  if(!failed)
+  {
+    image->outline_mode = outline_mode;
+    image->show_bb = d->params.mode == MODE_DEBUG;
+    image->rotate_to_fit = d->params.rotate;
+    dt_pdf_page_t *page = dt_pdf_add_page(d->pdf, &image, 1);
+    if(page)
+      g_ptr_array_add(d->pages, page);
+    else
+      failed = 1;
+  }
+  free(image);
+  if(failed)
+  {
+    fprintf(stderr, "[imageio_format_pdf] could not add image %d to `%s'!\n", num, d->actual_filename);
+    dt_control_log(_("could not export to file `%s'!"), d->actual_filename);
+  }
 
   // finish the pdf
   if(num == total)
   {
-    int n_images = g_list_length(d->images);
-    dt_pdf_page_t **pages = malloc(n_images * sizeof(dt_pdf_page_t *));
-
-    gboolean outline_mode = d->params.mode != MODE_NORMAL;
-    gboolean show_bb = d->params.mode == MODE_DEBUG;
-
-    // add a page for every image
-    GList *iter = d->images;
-    int i = 0;
-    while(iter)
-    {
-      dt_pdf_image_t *page = (dt_pdf_image_t *)iter->data;
-      page->outline_mode = outline_mode;
-      page->show_bb = show_bb;
-      page->rotate_to_fit = d->params.rotate;
-      pages[i] = dt_pdf_add_page(d->pdf, &page, 1);
-      iter = g_list_next(iter);
-      i++;
-    }
-
     // add the contact sheet(s)
     // TODO
 
-    dt_pdf_finish(d->pdf, pages, n_images);
+    dt_pdf_finish(d->pdf, (dt_pdf_page_t **)d->pages->pdata, d->pages->len);
 
-    // we allocated the images and pages. the main pdf object gets free'ed in dt_pdf_finish().
-    g_list_free_full(d->images, free);
-    for(i = 0; i < n_images; i++) free(pages[i]);
-    free(pages);
+    // we allocated the pages. the main pdf object gets free'ed in dt_pdf_finish().
+    g_ptr_array_free(d->pages, TRUE);
     g_free(d->actual_filename);
     g_list_free_full(d->icc_profiles, free);
 
     d->pdf = NULL;
-    d->images = NULL;
+    d->pages = NULL;
     d->actual_filename = NULL;
     d->icc_profiles = NULL;
   } // finish the pdf
 
-  return 0;
+  return failed;
 }
 
 int bpp(dt_imageio_module_data_t *p)
@@ -807,7 +806,7 @@ void free_params(dt_imageio_module_format_t *self, dt_imageio_module_data_t *par
   if(d->pdf)
     dt_pdf_finish(d->pdf, NULL, 0);
 
-  g_list_free_full(d->images, free);
+  if(d->pages) g_ptr_array_free(d->pages, TRUE);
 
   if(d->actual_filename)
   {
@@ -818,7 +817,7 @@ void free_params(dt_imageio_module_format_t *self, dt_imageio_module_data_t *par
   g_list_free_full(d->icc_profiles, free);
 
   d->pdf = NULL;
-  d->images = NULL;
+  d->pages = NULL;
   d->actual_filename = NULL;
   d->icc_profiles = NULL;
 
@@ -862,6 +861,8 @@ int set_params(dt_imageio_module_format_t *self, const void *params, const int s
   return 0;
 }
 
+#undef DT_PDF_BAND_SIZE
+
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
 // kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
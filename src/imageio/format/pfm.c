@@ -29,7 +29,7 @@
 DT_MODULE(1)
 
 int write_image(dt_imageio_module_data_t *data, const char *filename, const void *ivoid, void *exif,
-                int exif_len, int imgid, int num, int total)
+                int exif_len, const char *xmp, int imgid, int num, int total)
 {
   const dt_imageio_module_data_t *const pfm = data;
   int status = 0;
@@ -118,6 +118,11 @@ const char *name()
   return _("PFM (float)");
 }
 
+int flags(dt_imageio_module_data_t *data)
+{
+  return FORMAT_FLAGS_STREAMABLE;
+}
+
 void init(dt_imageio_module_format_t *self)
 {
 }
@@ -36,7 +36,22 @@
 #include "control/conf.h"
 #include "imageio/format/imageio_format_api.h"
 
-DT_MODULE(3)
+DT_MODULE(4)
+
+// the filtered rows are deflated in chunks of about this many bytes on all threads, each with the window of
+// data before it as its dictionary. the chunks together make up one zlib stream.
+#define DT_PNG_CHUNK_BYTES (1 << 17)
+#define DT_PNG_WINDOW (1 << 15)
+
+typedef enum dt_imageio_png_filter_t
+{
+  DT_PNG_FILTER_ADAPTIVE = 0, // per row the one with the smallest sum of absolute differences, as libpng does
+  DT_PNG_FILTER_NONE = 1,
+  DT_PNG_FILTER_SUB = 2,
+  DT_PNG_FILTER_UP = 3,
+  DT_PNG_FILTER_AVERAGE = 4,
+  DT_PNG_FILTER_PAETH = 5
+} dt_imageio_png_filter_t;
 
 typedef struct dt_imageio_png_t
 {
@@ -46,6 +61,7 @@ typedef struct dt_imageio_png_t
   gboolean style_append;
   int bpp;
   int compression;
+  int filter;
   FILE *f;
   png_structp png_ptr;
   png_infop info_ptr;
@@ -55,8 +71,145 @@ typedef struct dt_imageio_png_gui_t
 {
   GtkWidget *bit_depth;
   GtkWidget *compression;
+  GtkWidget *filter;
 } dt_imageio_png_gui_t;
 
+// a chunk of rows on its way to the file
+typedef struct dt_imageio_png_chunk_t
+{
+  uint8_t *rows;     // the previous and the current row without filter
+  uint8_t *scratch;  // a row tried with the adaptive filter
+  uint8_t *filtered; // the filtered rows of the dictionary, then the ones of the chunk
+  uint8_t *packed;   // 2 bytes for the zlib header, the deflated chunk, 4 for the adler32 trailer
+  size_t packed_size;
+  uLong adler;
+} dt_imageio_png_chunk_t;
+
+// row y of the pipe's output as png stores it, without the fourth channel and with big endian 16 bit samples
+static void _png_pack_row(const void *const in, uint8_t *const out, const int width, const int bpp, const int y)
+{
+  if(bpp > 8)
+  {
+    const uint16_t *const i = (const uint16_t *)in + (size_t)4 * width * y;
+    for(int x = 0; x < width; x++)
+      for(int c = 0; c < 3; c++)
+      {
+        const uint16_t v = i[4 * x + c];
+        out[6 * x + 2 * c] = v >> 8;
+        out[6 * x + 2 * c + 1] = v & 0xff;
+      }
+  }
+  else
+  {
+    const uint8_t *const i = (const uint8_t *)in + (size_t)4 * width * y;
+    for(int x = 0; x < width; x++)
+      for(int c = 0; c < 3; c++) out[3 * x + c] = i[4 * x + c];
+  }
+}
+
+static inline uint8_t _png_paeth(const int a, const int b, const int c)
+{
+  const int p = a + b - c;
+  const int pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+  return (pa <= pb && pa <= pc) ? a : (pb <= pc ? b : c);
+}
+
+// the row filtered with type (1 + filter type byte, n bytes), prev is the unfiltered row above, NULL for the
+// first one. returns the sum of the bytes as signed values, libpng's measure for picking a filter.
+static size_t _png_filter_row(const uint8_t *const row, const uint8_t *const prev, const size_t n,
+                              const int pixel, const int type, uint8_t *const out)
+{
+  out[0] = type;
+  uint8_t *const o = out + 1;
+  for(size_t i = 0; i < n; i++)
+  {
+    const int a = i >= (size_t)pixel ? row[i - pixel] : 0;
+    const int b = prev ? prev[i] : 0;
+    const int c = (prev && i >= (size_t)pixel) ? prev[i - pixel] : 0;
+    switch(type)
+    {
+      case 1:
+        o[i] = row[i] - a;
+        break;
+      case 2:
+        o[i] = row[i] - b;
+        break;
+      case 3:
+        o[i] = row[i] - ((a + b) >> 1);
+        break;
+      case 4:
+        o[i] = row[i] - _png_paeth(a, b, c);
+        break;
+      default:
+        o[i] = row[i];
+        break;
+    }
+  }
+  size_t sum = 0;
+  for(size_t i = 0; i < n; i++) sum += o[i] < 128 ? o[i] : 256 - o[i];
+  return sum;
+}
+
+// filters and deflates the rows [y0, y1), preceded by the ones filling the dictionary. 0 on success
+static int _png_deflate_chunk(const void *const in, dt_imageio_png_chunk_t *const c, const int width,
+                              const int height, const int bpp, const int filter, const int level, const int y0,
+                              const int y1, const int dict_rows, const size_t packed_cap)
+{
+  const int pixel = 3 * bpp / 8;
+  const size_t n = (size_t)pixel * width;
+  const int ys = MAX(0, y0 - dict_rows);
+  uint8_t *prev = c->rows, *cur = c->rows + n;
+  if(ys > 0) _png_pack_row(in, prev, width, bpp, ys - 1);
+  for(int y = ys; y < y1; y++)
+  {
+    _png_pack_row(in, cur, width, bpp, y);
+    const uint8_t *const above = y > 0 ? prev : NULL;
+    uint8_t *const out = c->filtered + (n + 1) * (y - ys);
+    if(filter == DT_PNG_FILTER_ADAPTIVE)
+    {
+      size_t best = _png_filter_row(cur, above, n, pixel, 0, out);
+      for(int type = 1; type < 5; type++)
+      {
+        const size_t sum = _png_filter_row(cur, above, n, pixel, type, c->scratch);
+        if(sum < best)
+        {
+          best = sum;
+          memcpy(out, c->scratch, n + 1);
+        }
+      }
+    }
+    else
+      _png_filter_row(cur, above, n, pixel, filter - DT_PNG_FILTER_NONE, out);
+    uint8_t *const t = prev;
+    prev = cur;
+    cur = t;
+  }
+
+  const size_t dict_len = (n + 1) * (y0 - ys);
+  const size_t len = (n + 1) * (y1 - y0);
+  uint8_t *const data = c->filtered + dict_len;
+  c->adler = adler32(adler32(0L, Z_NULL, 0), data, len);
+
+  z_stream strm = { 0 };
+  if(deflateInit2(&strm, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) return 1;
+  if(dict_len)
+  {
+    const size_t window = MIN(dict_len, DT_PNG_WINDOW);
+    deflateSetDictionary(&strm, data - window, window);
+  }
+  strm.next_in = data;
+  strm.avail_in = len;
+  strm.next_out = c->packed + 2;
+  strm.avail_out = packed_cap - 6;
+  // the last chunk ends the stream, the others end on a byte boundary for the next one to follow
+  const int last = y1 == height;
+  const int ret = deflate(&strm, last ? Z_FINISH : Z_SYNC_FLUSH);
+  const int ok = last ? ret == Z_STREAM_END : (ret == Z_OK && strm.avail_in == 0 && strm.avail_out > 0);
+  c->packed_size = strm.total_out;
+  deflateEnd(&strm);
+  return !ok;
+}
+
 /* Write EXIF data to PNG file.
  * Code copied from DigiKam's libs/dimg/loaders/pngloader.cpp.
  * The EXIF embedding is defined by ImageMagicK.
@@ -123,7 +276,7 @@ static void PNGwriteRawProfile(png_struct *ping, png_info *ping_info, char *prof
 }
 
 int write_image(dt_imageio_module_data_t *p_tmp, const char *filename, const void *ivoid, void *exif, int exif_len,
-                int imgid, int num, int total)
+                const char *xmp, int imgid, int num, int total)
 {
   dt_imageio_png_t *p = (dt_imageio_png_t *)p_tmp;
   const int width = p->width, height = p->height;
@@ -157,13 +310,6 @@ int write_image(dt_imageio_module_data_t *p_tmp, const char *filename, const voi
 
   png_init_io(png_ptr, f);
 
-  png_set_compression_level(png_ptr, p->compression);
-  png_set_compression_mem_level(png_ptr, 8);
-  png_set_compression_strategy(png_ptr, Z_DEFAULT_STRATEGY);
-  png_set_compression_window_bits(png_ptr, 15);
-  png_set_compression_method(png_ptr, 8);
-  png_set_compression_buffer_size(png_ptr, 8192);
-
   png_set_IHDR(png_ptr, info_ptr, width, height, p->bpp, PNG_COLOR_TYPE_RGB, PNG_INTERLACE_NONE,
                PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
 
@@ -196,36 +342,111 @@ int write_image(dt_imageio_module_data_t *p_tmp, const char *filename, const voi
   // write exif data
   PNGwriteRawProfile(png_ptr, info_ptr, "exif", exif, exif_len);
 
-  png_write_info(png_ptr, info_ptr);
+#ifdef PNG_iTXt_SUPPORTED
+  // and xmp, in the itxt chunk adobe defined for it
+  if(xmp)
+  {
+    png_text text = { 0 };
+    text.compression = PNG_ITXT_COMPRESSION_NONE;
+    text.key = (png_charp) "XML:com.adobe.xmp";
+    text.text = (png_charp)xmp;
+    text.itxt_length = strlen(xmp);
+    text.lang = (png_charp) "";
+    text.lang_key = (png_charp) "";
+    png_set_text(png_ptr, info_ptr, &text, 1);
+  }
+#endif
 
-  /*
-   * Get rid of filler (OR ALPHA) bytes, pack XRGB/RGBX/ARGB/RGBA into
-   * RGB (4 channels -> 3 channels). The second parameter is not used.
-   */
-  png_set_filler(png_ptr, 0, PNG_FILLER_AFTER);
+  png_write_info(png_ptr, info_ptr);
 
-  png_bytep *row_pointers = malloc((size_t)height * sizeof(png_bytep));
+  // the pixels are filtered and deflated here, on all threads, and written as idat chunks
+  const int level = CLAMP(p->compression, 0, 9);
+  const int filter = CLAMP(p->filter, DT_PNG_FILTER_ADAPTIVE, DT_PNG_FILTER_PAETH);
+  const size_t rowbytes = (size_t)3 * p->bpp / 8 * width + 1;
+  const int chunk_rows = MAX(1, MIN(height, DT_PNG_CHUNK_BYTES / (int)rowbytes));
+  const int dict_rows = (DT_PNG_WINDOW + rowbytes - 1) / rowbytes;
+  const int num_chunks = (height + chunk_rows - 1) / chunk_rows;
+  const size_t packed_cap = compressBound(rowbytes * chunk_rows) + 64;
+  const int num_slots = MIN(num_chunks, 2 * dt_get_num_threads());
+  int res = 0;
+
+  dt_imageio_png_chunk_t *chunks = (dt_imageio_png_chunk_t *)calloc(num_slots, sizeof(dt_imageio_png_chunk_t));
+  for(int j = 0; chunks && j < num_slots; j++)
+  {
+    chunks[j].rows = (uint8_t *)malloc(2 * rowbytes);
+    chunks[j].scratch = (uint8_t *)malloc(rowbytes);
+    chunks[j].filtered = (uint8_t *)malloc(rowbytes * (dict_rows + chunk_rows));
+    chunks[j].packed = (uint8_t *)malloc(packed_cap);
+    if(!chunks[j].rows || !chunks[j].scratch || !chunks[j].filtered || !chunks[j].packed) res = 1;
+  }
+  if(!chunks) res = 1;
 
-  if(p->bpp > 8)
+  // pigz style: the header of the zlib stream before the first chunk, the checksum of all of them after
+  // the last
+  uLong adler = adler32(0L, Z_NULL, 0);
+  for(int k0 = 0; !res && k0 < num_chunks; k0 += num_slots)
   {
-    /* swap bytes of 16 bit files to most significant bit first */
-    png_set_swap(png_ptr);
+    const int count = MIN(num_slots, num_chunks - k0);
+    int failed = 0;
+#ifdef _OPENMP
+#pragma omp parallel for default(none) shared(p, ivoid, chunks, k0) reduction(|| : failed) schedule(dynamic)
+#endif
+    for(int j = 0; j < count; j++)
+    {
+      const int y0 = (k0 + j) * chunk_rows;
+      failed = _png_deflate_chunk(ivoid, chunks + j, width, height, p->bpp, filter, level, y0,
+                                  MIN(height, y0 + chunk_rows), dict_rows, packed_cap)
+               || failed;
+    }
+    if(failed)
+    {
+      res = 1;
+      break;
+    }
 
-    for(unsigned i = 0; i < height; i++) row_pointers[i] = (png_bytep)((uint16_t *)ivoid + (size_t)4 * i * width);
+    for(int j = 0; j < count; j++)
+    {
+      dt_imageio_png_chunk_t *const c = chunks + j;
+      const int y0 = (k0 + j) * chunk_rows;
+      const int rows = MIN(height, y0 + chunk_rows) - y0;
+      adler = adler32_combine(adler, c->adler, (z_off_t)(rowbytes * rows));
+      uint8_t *data = c->packed + 2;
+      size_t size = c->packed_size;
+      if(k0 + j == 0)
+      {
+        // deflate, 32k window, the level hint zlib would put there
+        const int flevel = level < 2 ? 0 : (level < 6 ? 1 : (level == 6 ? 2 : 3));
+        data -= 2;
+        size += 2;
+        data[0] = 0x78;
+        data[1] = flevel << 6;
+        data[1] += 31 - (0x78 * 256 + data[1]) % 31;
+      }
+      if(k0 + j == num_chunks - 1)
+      {
+        data[size++] = adler >> 24;
+        data[size++] = (adler >> 16) & 0xff;
+        data[size++] = (adler >> 8) & 0xff;
+        data[size++] = adler & 0xff;
+      }
+      png_write_chunk(png_ptr, (png_bytep) "IDAT", data, size);
+    }
   }
-  else
+
+  for(int j = 0; chunks && j < num_slots; j++)
   {
-    for(unsigned i = 0; i < height; i++) row_pointers[i] = (uint8_t *)ivoid + (size_t)4 * i * width;
+    free(chunks[j].rows);
+    free(chunks[j].scratch);
+    free(chunks[j].filtered);
+    free(chunks[j].packed);
   }
+  free(chunks);
 
-  png_write_image(png_ptr, row_pointers);
-
-  free(row_pointers);
-
-  png_write_end(png_ptr, info_ptr);
+  // png_write_end() insists on idat written by libpng itself, everything else went before the pixels
+  if(!res) png_write_chunk(png_ptr, (png_bytep) "IEND", NULL, 0);
   png_destroy_write_struct(&png_ptr, &info_ptr);
   fclose(f);
-  return 0;
+  return res;
 }
 
 static int __attribute__((__unused__)) read_header(const char *filename, dt_imageio_module_data_t *p_tmp)
@@ -351,13 +572,13 @@ int read_image(dt_imageio_module_data_t *p_tmp, uint8_t *out)
 
 size_t params_size(dt_imageio_module_format_t *self)
 {
-  return sizeof(dt_imageio_module_data_t) + 2 * sizeof(int);
+  return sizeof(dt_imageio_module_data_t) + 3 * sizeof(int);
 }
 
 void *legacy_params(dt_imageio_module_format_t *self, const void *const old_params, const size_t old_params_size,
                     const int old_version, const int new_version, size_t *new_size)
 {
-  if(old_version == 1 && new_version == 3)
+  if(old_version == 1 && new_version == 4)
   {
     typedef struct dt_imageio_png_v1_t
     {
@@ -381,13 +602,14 @@ void *legacy_params(dt_imageio_module_format_t *self, const void *const old_para
     n->style_append = 0;
     n->bpp = o->bpp;
     n->compression = Z_BEST_COMPRESSION;
+    n->filter = DT_PNG_FILTER_ADAPTIVE;
     n->f = o->f;
     n->png_ptr = o->png_ptr;
     n->info_ptr = o->info_ptr;
     *new_size = self->params_size(self);
     return n;
   }
-  else if(old_version == 2 && new_version == 3)
+  else if(old_version == 2 && new_version == 4)
   {
     typedef struct dt_imageio_png_v2_t
     {
@@ -412,6 +634,40 @@ void *legacy_params(dt_imageio_module_format_t *self, const void *const old_para
     n->style_append = o->style_append;
     n->bpp = o->bpp;
     n->compression = Z_BEST_COMPRESSION;
+    n->filter = DT_PNG_FILTER_ADAPTIVE;
+    n->f = o->f;
+    n->png_ptr = o->png_ptr;
+    n->info_ptr = o->info_ptr;
+    *new_size = self->params_size(self);
+    return n;
+  }
+  else if(old_version == 3 && new_version == 4)
+  {
+    typedef struct dt_imageio_png_v3_t
+    {
+      int max_width, max_height;
+      int width, height;
+      char style[128];
+      gboolean style_append;
+      int bpp;
+      int compression;
+      FILE *f;
+      png_structp png_ptr;
+      png_infop info_ptr;
+    } dt_imageio_png_v3_t;
+
+    dt_imageio_png_v3_t *o = (dt_imageio_png_v3_t *)old_params;
+    dt_imageio_png_t *n = (dt_imageio_png_t *)malloc(sizeof(dt_imageio_png_t));
+
+    n->max_width = o->max_width;
+    n->max_height = o->max_height;
+    n->width = o->width;
+    n->height = o->height;
+    g_strlcpy(n->style, o->style, sizeof(o->style));
+    n->style_append = o->style_append;
+    n->bpp = o->bpp;
+    n->compression = o->compression;
+    n->filter = DT_PNG_FILTER_ADAPTIVE;
     n->f = o->f;
     n->png_ptr = o->png_ptr;
     n->info_ptr = o->info_ptr;
@@ -439,6 +695,9 @@ void *get_params(dt_imageio_module_format_t *self)
     if(d->compression < 0 || d->compression > 9) d->compression = 5;
   }
 
+  d->filter = dt_conf_get_int("plugins/imageio/format/png/filter");
+  if(d->filter < DT_PNG_FILTER_ADAPTIVE || d->filter > DT_PNG_FILTER_PAETH) d->filter = DT_PNG_FILTER_ADAPTIVE;
+
   return d;
 }
 
@@ -459,6 +718,8 @@ int set_params(dt_imageio_module_format_t *self, const void *params, const int s
   dt_conf_set_int("plugins/imageio/format/png/bpp", d->bpp);
   dt_bauhaus_slider_set(g->compression, d->compression);
   dt_conf_set_int("plugins/imageio/format/png/compression", d->compression);
+  dt_bauhaus_combobox_set(g->filter, d->filter);
+  dt_conf_set_int("plugins/imageio/format/png/filter", d->filter);
   return 0;
 }
 
@@ -499,6 +760,11 @@ static void compression_level_changed(GtkWidget *slider, gpointer user_data)
   dt_conf_set_int("plugins/imageio/format/png/compression", compression);
 }
 
+static void filter_changed(GtkWidget *widget, gpointer user_data)
+{
+  dt_conf_set_int("plugins/imageio/format/png/filter", dt_bauhaus_combobox_get(widget));
+}
+
 void init(dt_imageio_module_format_t *self)
 {
 #ifdef USE_LUA
@@ -537,7 +803,25 @@ void gui_init(dt_imageio_module_format_t *self)
   dt_bauhaus_widget_set_label(gui->compression, NULL, _("compression"));
   dt_bauhaus_slider_set(gui->compression, compression);
   gtk_box_pack_start(GTK_BOX(self->widget), GTK_WIDGET(gui->compression), TRUE, TRUE, 0);
+  gtk_widget_set_tooltip_text(gui->compression, _("higher levels make smaller files and take longer, "
+                                                   "0 stores the pixels uncompressed"));
   g_signal_connect(G_OBJECT(gui->compression), "value-changed", G_CALLBACK(compression_level_changed), NULL);
+
+  // Filter combo box
+  gui->filter = dt_bauhaus_combobox_new(NULL);
+  dt_bauhaus_widget_set_label(gui->filter, NULL, _("filter"));
+  dt_bauhaus_combobox_add(gui->filter, _("adaptive"));
+  dt_bauhaus_combobox_add(gui->filter, _("none"));
+  dt_bauhaus_combobox_add(gui->filter, _("sub"));
+  dt_bauhaus_combobox_add(gui->filter, _("up"));
+  dt_bauhaus_combobox_add(gui->filter, _("average"));
+  dt_bauhaus_combobox_add(gui->filter, _("paeth"));
+  dt_bauhaus_combobox_set(gui->filter, dt_conf_get_int("plugins/imageio/format/png/filter"));
+  gtk_widget_set_tooltip_text(gui->filter, _("adaptive picks the best filter for each row, which compresses "
+                                             "best. a single filter is faster, paeth or up usually do well on "
+                                             "photographs"));
+  gtk_box_pack_start(GTK_BOX(self->widget), gui->filter, TRUE, TRUE, 0);
+  g_signal_connect(G_OBJECT(gui->filter), "value-changed", G_CALLBACK(filter_changed), NULL);
 }
 
 void gui_cleanup(dt_imageio_module_format_t *self)
@@ -551,9 +835,16 @@ void gui_reset(dt_imageio_module_format_t *self)
 
 int flags(dt_imageio_module_data_t *data)
 {
-  return FORMAT_FLAGS_SUPPORT_XMP;
+#ifdef PNG_iTXt_SUPPORTED
+  return FORMAT_FLAGS_SUPPORT_XMP | FORMAT_FLAGS_STREAMABLE | FORMAT_FLAGS_EMBED_XMP;
+#else
+  return FORMAT_FLAGS_SUPPORT_XMP | FORMAT_FLAGS_STREAMABLE;
+#endif
 }
 
+#undef DT_PNG_CHUNK_BYTES
+#undef DT_PNG_WINDOW
+
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
 // kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
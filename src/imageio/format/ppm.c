@@ -34,7 +34,7 @@ void cleanup(dt_imageio_module_format_t *self)
 }
 
 int write_image(dt_imageio_module_data_t *ppm, const char *filename, const void *in_tmp, void *exif,
-                int exif_len, int imgid, int num, int total)
+                int exif_len, const char *xmp, int imgid, int num, int total)
 {
   const uint16_t *in = (const uint16_t *)in_tmp;
   int status = 0;
@@ -107,6 +107,11 @@ const char *name()
   return _("PPM (16-bit)");
 }
 
+int flags(dt_imageio_module_data_t *data)
+{
+  return FORMAT_FLAGS_STREAMABLE;
+}
+
 // TODO: some quality/compression stuff?
 void gui_init(dt_imageio_module_format_t *self)
 {
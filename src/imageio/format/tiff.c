@@ -30,8 +30,13 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <tiffio.h>
+#include <zlib.h>
 
-DT_MODULE(2)
+DT_MODULE(3)
+
+// strips are cut to about this many bytes before compression, tiles are this many pixels wide and high
+#define DT_TIFF_STRIP_BYTES (1 << 18)
+#define DT_TIFF_TILE_SIZE 256
 
 typedef struct dt_imageio_tiff_t
 {
@@ -40,7 +45,8 @@ typedef struct dt_imageio_tiff_t
   char style[128];
   gboolean style_append;
   int bpp;
-  int compress;
+  int compress; // none, deflate, deflate with predictor, deflate with float predictor, zstd with predictor
+  int tiled;
   TIFF *handle;
 } dt_imageio_tiff_t;
 
@@ -48,11 +54,109 @@ typedef struct dt_imageio_tiff_gui_t
 {
   GtkWidget *bpp;
   GtkWidget *compress;
+  GtkWidget *tiled;
 } dt_imageio_tiff_gui_t;
 
+// a strip or tile on its way to the file
+typedef struct dt_imageio_tiff_block_t
+{
+  uint8_t *raw;     // the samples as stored without compression
+  uint8_t *packed;  // compressed by us, NULL if libtiff compresses or nobody does
+  uint8_t *scratch; // a row for the float predictor
+  size_t size;      // of the data to write
+} dt_imageio_tiff_block_t;
+
+static int _tiff_zstd_available(void)
+{
+#ifdef COMPRESSION_ZSTD
+  return TIFFIsCODECConfigured(COMPRESSION_ZSTD);
+#else
+  return 0;
+#endif
+}
+
+// the block with the top left corner x0, y0 of the pipe's output without its fourth channel. tiles across the
+// right or bottom border are filled up with zeros, they are always stored in full.
+static void _tiff_fill_block(const uint8_t *const in, uint8_t *const out, const int width, const int height,
+                             const size_t bps, const int x0, const int y0, const int block_w, const int rows)
+{
+  const size_t pixel = 3 * bps;
+  for(int y = 0; y < rows; y++)
+  {
+    uint8_t *const o = out + pixel * block_w * y;
+    const int cols = (y0 + y < height) ? MIN(block_w, width - x0) : 0;
+    if(cols > 0)
+    {
+      const uint8_t *const i = in + 4 * bps * ((size_t)(y0 + y) * width + x0);
+      for(int x = 0; x < cols; x++) memcpy(o + pixel * x, i + 4 * bps * x, pixel);
+    }
+    memset(o + pixel * cols, 0, pixel * (block_w - cols));
+  }
+}
+
+// predictor 2 of the tiff spec, every sample of a row minus the one of the pixel to its left. the samples are
+// differenced as the little endian integers they are stored as.
+static void _tiff_predict_horizontal(uint8_t *const buf, const size_t bps, const int block_w, const int rows)
+{
+  const size_t n = 3 * block_w;
+  for(int y = 0; y < rows; y++)
+  {
+    if(bps == 2)
+    {
+      uint16_t *const r = (uint16_t *)buf + n * y;
+      for(size_t i = n - 1; i >= 3; i--) r[i] -= r[i - 3];
+    }
+    else
+    {
+      uint8_t *const r = buf + n * y;
+      for(size_t i = n - 1; i >= 3; i--) r[i] -= r[i - 3];
+    }
+  }
+}
+
+// predictor 3, the floating point one of adobe's tech note 3: the bytes of a row are regrouped by
+// significance, the most significant ones of all samples first, then differenced along the row
+static void _tiff_predict_float(uint8_t *const buf, uint8_t *const scratch, const int block_w, const int rows)
+{
+  const size_t wc = 3 * block_w;
+  const size_t cc = 4 * wc;
+  for(int y = 0; y < rows; y++)
+  {
+    uint8_t *const r = buf + cc * y;
+    memcpy(scratch, r, cc);
+    for(size_t i = 0; i < wc; i++)
+      for(int b = 0; b < 4; b++) r[(3 - b) * wc + i] = scratch[4 * i + b];
+    for(size_t i = cc - 1; i >= 3; i--) r[i] -= r[i - 3];
+  }
+}
+
+// gathers block k, and compresses it with its predictor if deflate is set. 0 on success
+static int _tiff_encode_block(const dt_imageio_tiff_t *const d, const void *const in,
+                              dt_imageio_tiff_block_t *const b, const int k, const int blocks_x, const int block_w,
+                              const int block_h, const int predictor, const int deflate)
+{
+  const size_t bps = d->bpp / 8;
+  const int x0 = (k % blocks_x) * block_w;
+  const int y0 = (k / blocks_x) * block_h;
+  const int rows = d->tiled ? block_h : MIN(block_h, d->height - y0);
+  _tiff_fill_block((const uint8_t *)in, b->raw, d->width, d->height, bps, x0, y0, block_w, rows);
+  b->size = 3 * bps * block_w * rows;
+  if(!deflate) return 0;
+
+  if(predictor == 2)
+    _tiff_predict_horizontal(b->raw, bps, block_w, rows);
+  else if(predictor == 3)
+    _tiff_predict_float(b->raw, b->scratch, block_w, rows);
+
+  uLongf packed_size = compressBound(b->size);
+  if(compress2(b->packed, &packed_size, b->raw, b->size, 9) != Z_OK) return 1;
+  b->size = packed_size;
+  return 0;
+}
+
 
 int write_image(dt_imageio_module_data_t *d_tmp, const char *filename, const void *in_void, void *exif,
-                int exif_len, int imgid, int num, int total)
+                int exif_len, const char *xmp, int imgid, int num, int total)
 {
   const dt_imageio_tiff_t *d = (dt_imageio_tiff_t *)d_tmp;
 
@@ -61,7 +165,8 @@ int write_image(dt_imageio_module_data_t *d_tmp, const char *filename, const voi
 
   TIFF *tif = NULL;
 
-  void *rowdata = NULL;
+  dt_imageio_tiff_block_t *blocks = NULL;
+  int num_slots = 0;
 
   int rc = 1; // default to error
 
@@ -96,37 +201,39 @@ int write_image(dt_imageio_module_data_t *d_tmp, const char *filename, const voi
   // "write the official compression code (0x0008)."
   // http://www.awaresystems.be/imaging/tiff/tifftags/compression.html
   // http://www.awaresystems.be/imaging/tiff/tifftags/predictor.html
+  uint16_t compression = COMPRESSION_NONE;
+  uint16_t predictor = 1;
   if(d->compress == 1)
   {
-    TIFFSetField(tif, TIFFTAG_COMPRESSION, (uint16_t)COMPRESSION_ADOBE_DEFLATE);
-    TIFFSetField(tif, TIFFTAG_PREDICTOR, (uint16_t)1);
-    TIFFSetField(tif, TIFFTAG_ZIPQUALITY, (uint16_t)9);
+    compression = COMPRESSION_ADOBE_DEFLATE;
   }
   else if(d->compress == 2)
   {
-    TIFFSetField(tif, TIFFTAG_COMPRESSION, (uint16_t)COMPRESSION_ADOBE_DEFLATE);
-    TIFFSetField(tif, TIFFTAG_PREDICTOR, (uint16_t)2);
-    TIFFSetField(tif, TIFFTAG_ZIPQUALITY, (uint16_t)9);
-  }
-  else if(d->compress == 3)
-  {
-    TIFFSetField(tif, TIFFTAG_COMPRESSION, (uint16_t)COMPRESSION_ADOBE_DEFLATE);
-    if(d->bpp == 32)
-      TIFFSetField(tif, TIFFTAG_PREDICTOR, (uint16_t)3);
-    else
-      TIFFSetField(tif, TIFFTAG_PREDICTOR, (uint16_t)2);
-    TIFFSetField(tif, TIFFTAG_ZIPQUALITY, (uint16_t)9);
+    compression = COMPRESSION_ADOBE_DEFLATE;
+    predictor = 2;
   }
-  else // (d->compress == 0)
+  else if(d->compress >= 3)
   {
-    TIFFSetField(tif, TIFFTAG_COMPRESSION, COMPRESSION_NONE);
+    // zstd falls back to deflate where libtiff doesn't have it
+#ifdef COMPRESSION_ZSTD
+    compression = (d->compress == 4 && _tiff_zstd_available()) ? COMPRESSION_ZSTD : COMPRESSION_ADOBE_DEFLATE;
+#else
+    compression = COMPRESSION_ADOBE_DEFLATE;
+#endif
+    predictor = (d->bpp == 32) ? 3 : 2;
   }
 
+  TIFFSetField(tif, TIFFTAG_COMPRESSION, compression);
+  if(compression != COMPRESSION_NONE) TIFFSetField(tif, TIFFTAG_PREDICTOR, predictor);
+  if(compression == COMPRESSION_ADOBE_DEFLATE) TIFFSetField(tif, TIFFTAG_ZIPQUALITY, (uint16_t)9);
+
   TIFFSetField(tif, TIFFTAG_FILLORDER, (uint16_t)FILLORDER_MSB2LSB);
   if(profile != NULL)
   {
     TIFFSetField(tif, TIFFTAG_ICCPROFILE, (uint32_t)profile_len, profile);
   }
+  // exiv2 keeps the xmp packet when it adds the exif below
+  if(xmp) TIFFSetField(tif, TIFFTAG_XMLPACKET, (uint32_t)strlen(xmp), xmp);
   TIFFSetField(tif, TIFFTAG_SAMPLESPERPIXEL, (uint16_t)3);
   TIFFSetField(tif, TIFFTAG_BITSPERSAMPLE, (uint16_t)d->bpp);
   TIFFSetField(tif, TIFFTAG_SAMPLEFORMAT, (uint16_t)(d->bpp == 32 ? SAMPLEFORMAT_IEEEFP : SAMPLEFORMAT_UINT));
@@ -134,9 +241,23 @@ int write_image(dt_imageio_module_data_t *d_tmp, const char *filename, const voi
   TIFFSetField(tif, TIFFTAG_IMAGELENGTH, (uint32_t)d->height);
   TIFFSetField(tif, TIFFTAG_PHOTOMETRIC, (uint16_t)PHOTOMETRIC_RGB);
   TIFFSetField(tif, TIFFTAG_PLANARCONFIG, (uint16_t)PLANARCONFIG_CONTIG);
-  TIFFSetField(tif, TIFFTAG_ROWSPERSTRIP, (uint32_t)1);
   TIFFSetField(tif, TIFFTAG_ORIENTATION, (uint16_t)ORIENTATION_TOPLEFT);
 
+  // the image is written in strips of several rows or in tiles, which are all compressed independently
+  const size_t rowsize = (size_t)3 * d->bpp / 8 * d->width;
+  const int block_w = d->tiled ? DT_TIFF_TILE_SIZE : d->width;
+  const int block_h = d->tiled ? DT_TIFF_TILE_SIZE : MAX(1, MIN(d->height, DT_TIFF_STRIP_BYTES / (int)rowsize));
+  const int blocks_x = (d->width + block_w - 1) / block_w;
+  const int blocks_y = (d->height + block_h - 1) / block_h;
+  const int num_blocks = blocks_x * blocks_y;
+  if(d->tiled)
+  {
+    TIFFSetField(tif, TIFFTAG_TILEWIDTH, (uint32_t)block_w);
+    TIFFSetField(tif, TIFFTAG_TILELENGTH, (uint32_t)block_h);
+  }
+  else
+    TIFFSetField(tif, TIFFTAG_ROWSPERSTRIP, (uint32_t)block_h);
+
   int resolution = dt_conf_get_int("metadata/resolution");
   if(resolution > 0)
   {
@@ -145,64 +266,63 @@ int write_image(dt_imageio_module_data_t *d_tmp, const char *filename, const voi
     TIFFSetField(tif, TIFFTAG_RESOLUTIONUNIT, (uint16_t)RESUNIT_INCH);
   }
 
-  const size_t rowsize = (d->width * 3) * d->bpp / 8;
-  if((rowdata = malloc(rowsize)) == NULL)
+  // deflate is compressed here, a batch of blocks at a time on all threads, and the blocks are written as they
+  // are in the file. zstd is left to libtiff, as is everything on big endian hosts, where the samples would
+  // need swapping to the little endian file.
+  const int raw_write = (G_BYTE_ORDER == G_LITTLE_ENDIAN) && compression != COMPRESSION_ZSTD;
+  const int deflate = raw_write && compression == COMPRESSION_ADOBE_DEFLATE;
+  const size_t block_size = (size_t)3 * d->bpp / 8 * block_w * block_h;
+  num_slots = MIN(num_blocks, 2 * dt_get_num_threads());
+  blocks = (dt_imageio_tiff_block_t *)calloc(num_slots, sizeof(dt_imageio_tiff_block_t));
+  if(!blocks)
   {
     rc = 1;
     goto exit;
   }
-
-  if(d->bpp == 32)
+  for(int j = 0; j < num_slots; j++)
   {
-    for(int y = 0; y < d->height; y++)
+    blocks[j].raw = (uint8_t *)malloc(block_size);
+    if(deflate)
     {
-      float *in = (float *)in_void + (size_t)4 * y * d->width;
-      float *out = (float *)rowdata;
-
-      for(int x = 0; x < d->width; x++, in += 4, out += 3)
-      {
-        memcpy(out, in, 3 * sizeof(float));
-      }
-
-      if(TIFFWriteScanline(tif, rowdata, y, 0) == -1)
-      {
-        rc = 1;
-        goto exit;
-      }
+      blocks[j].packed = (uint8_t *)malloc(compressBound(block_size));
+      blocks[j].scratch = (uint8_t *)malloc((size_t)3 * d->bpp / 8 * block_w);
     }
-  }
-  else if(d->bpp == 16)
-  {
-    for(int y = 0; y < d->height; y++)
+    if(!blocks[j].raw || (deflate && (!blocks[j].packed || !blocks[j].scratch)))
     {
-      uint16_t *in = (uint16_t *)in_void + (size_t)4 * y * d->width;
-      uint16_t *out = (uint16_t *)rowdata;
-
-      for(int x = 0; x < d->width; x++, in += 4, out += 3)
-      {
-        memcpy(out, in, 3 * sizeof(uint16_t));
-      }
-
-      if(TIFFWriteScanline(tif, rowdata, y, 0) == -1)
-      {
-        rc = 1;
-        goto exit;
-      }
+      rc = 1;
+      goto exit;
     }
   }
-  else
+
+  for(int k0 = 0; k0 < num_blocks; k0 += num_slots)
   {
-    for(int y = 0; y < d->height; y++)
+    const int count = MIN(num_slots, num_blocks - k0);
+    int failed = 0;
+#ifdef _OPENMP
+#pragma omp parallel for default(none) shared(d, in_void, blocks, k0, predictor) reduction(|| : failed) \
+    schedule(dynamic)
+#endif
+    for(int j = 0; j < count; j++)
+      failed = _tiff_encode_block(d, in_void, blocks + j, k0 + j, blocks_x, block_w, block_h, predictor, deflate)
+               || failed;
+    if(failed)
     {
-      uint8_t *in = (uint8_t *)in_void + (size_t)4 * y * d->width;
-      uint8_t *out = (uint8_t *)rowdata;
-
-      for(int x = 0; x < d->width; x++, in += 4, out += 3)
-      {
-        memcpy(out, in, 3 * sizeof(uint8_t));
-      }
+      rc = 1;
+      goto exit;
+    }
 
-      if(TIFFWriteScanline(tif, rowdata, y, 0) == -1)
+    for(int j = 0; j < count; j++)
+    {
+      const dt_imageio_tiff_block_t *const b = blocks + j;
+      void *const data = deflate ? b->packed : b->raw;
+      tmsize_t written;
+      if(raw_write)
+        written = d->tiled ? TIFFWriteRawTile(tif, k0 + j, data, b->size)
+                           : TIFFWriteRawStrip(tif, k0 + j, data, b->size);
+      else
+        written = d->tiled ? TIFFWriteEncodedTile(tif, k0 + j, data, b->size)
+                           : TIFFWriteEncodedStrip(tif, k0 + j, data, b->size);
+      if(written == -1)
       {
         rc = 1;
         goto exit;
@@ -228,8 +348,14 @@ exit:
   }
   free(profile);
   profile = NULL;
-  free(rowdata);
-  rowdata = NULL;
+  for(int j = 0; blocks && j < num_slots; j++)
+  {
+    free(blocks[j].raw);
+    free(blocks[j].packed);
+    free(blocks[j].scratch);
+  }
+  free(blocks);
+  blocks = NULL;
 
   return rc;
 }
@@ -262,7 +388,7 @@ void *legacy_params(dt_imageio_module_format_t *self, const void *const old_para
                     const size_t old_params_size, const int old_version, const int new_version,
                     size_t *new_size)
 {
-  if(old_version == 1 && new_version == 2)
+  if(old_version == 1 && new_version == 3)
   {
     typedef struct dt_imageio_tiff_v1_t
     {
@@ -285,6 +411,36 @@ void *legacy_params(dt_imageio_module_format_t *self, const void *const old_para
     n->style_append = 0;
     n->bpp = o->bpp;
     n->compress = o->compress;
+    n->tiled = 0;
+    n->handle = o->handle;
+    *new_size = self->params_size(self);
+    return n;
+  }
+  else if(old_version == 2 && new_version == 3)
+  {
+    typedef struct dt_imageio_tiff_v2_t
+    {
+      int max_width, max_height;
+      int width, height;
+      char style[128];
+      gboolean style_append;
+      int bpp;
+      int compress;
+      TIFF *handle;
+    } dt_imageio_tiff_v2_t;
+
+    const dt_imageio_tiff_v2_t *o = (dt_imageio_tiff_v2_t *)old_params;
+    dt_imageio_tiff_t *n = (dt_imageio_tiff_t *)malloc(sizeof(dt_imageio_tiff_t));
+
+    n->max_width = o->max_width;
+    n->max_height = o->max_height;
+    n->width = o->width;
+    n->height = o->height;
+    g_strlcpy(n->style, o->style, sizeof(o->style));
+    n->style_append = o->style_append;
+    n->bpp = o->bpp;
+    n->compress = o->compress;
+    n->tiled = 0;
     n->handle = o->handle;
     *new_size = self->params_size(self);
     return n;
@@ -303,6 +459,7 @@ void *get_params(dt_imageio_module_format_t *self)
   else
     d->bpp = 8;
   d->compress = dt_conf_get_int("plugins/imageio/format/tiff/compress");
+  d->tiled = dt_conf_get_bool("plugins/imageio/format/tiff/tiled");
   return d;
 }
 
@@ -325,6 +482,7 @@ int set_params(dt_imageio_module_format_t *self, const void *params, const int s
     dt_bauhaus_combobox_set(g->bpp, 0);
 
   dt_bauhaus_combobox_set(g->compress, d->compress);
+  dt_bauhaus_combobox_set(g->tiled, d->tiled ? 1 : 0);
 
   return 0;
 }
@@ -381,6 +539,11 @@ static void compress_combobox_changed(GtkWidget *widget, gpointer user_data)
   dt_conf_set_int("plugins/imageio/format/tiff/compress", compress);
 }
 
+static void tiled_combobox_changed(GtkWidget *widget, gpointer user_data)
+{
+  dt_conf_set_bool("plugins/imageio/format/tiff/tiled", dt_bauhaus_combobox_get(widget) == 1);
+}
+
 void init(dt_imageio_module_format_t *self)
 {
 #ifdef USE_LUA
@@ -423,9 +586,18 @@ void gui_init(dt_imageio_module_format_t *self)
   dt_bauhaus_combobox_add(gui->compress, _("deflate"));
   dt_bauhaus_combobox_add(gui->compress, _("deflate with predictor"));
   dt_bauhaus_combobox_add(gui->compress, _("deflate with predictor (float)"));
+  if(_tiff_zstd_available()) dt_bauhaus_combobox_add(gui->compress, _("zstd with predictor"));
   dt_bauhaus_combobox_set(gui->compress, compress);
   gtk_box_pack_start(GTK_BOX(self->widget), gui->compress, TRUE, TRUE, 0);
   g_signal_connect(G_OBJECT(gui->compress), "value-changed", G_CALLBACK(compress_combobox_changed), NULL);
+
+  gui->tiled = dt_bauhaus_combobox_new(NULL);
+  dt_bauhaus_widget_set_label(gui->tiled, NULL, _("layout"));
+  dt_bauhaus_combobox_add(gui->tiled, _("strips"));
+  dt_bauhaus_combobox_add(gui->tiled, _("tiles"));
+  dt_bauhaus_combobox_set(gui->tiled, dt_conf_get_bool("plugins/imageio/format/tiff/tiled") ? 1 : 0);
+  gtk_box_pack_start(GTK_BOX(self->widget), gui->tiled, TRUE, TRUE, 0);
+  g_signal_connect(G_OBJECT(gui->tiled), "value-changed", G_CALLBACK(tiled_combobox_changed), NULL);
 }
 
 void gui_cleanup(dt_imageio_module_format_t *self)
@@ -440,9 +612,12 @@ void gui_reset(dt_imageio_module_format_t *self)
 
 int flags(dt_imageio_module_data_t *data)
 {
-  return FORMAT_FLAGS_SUPPORT_XMP;
+  return FORMAT_FLAGS_SUPPORT_XMP | FORMAT_FLAGS_EMBED_XMP;
 }
 
+#undef DT_TIFF_STRIP_BYTES
+#undef DT_TIFF_TILE_SIZE
+
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
 // kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
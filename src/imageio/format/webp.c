@@ -28,10 +28,11 @@
 #include "imageio/format/imageio_format_api.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include <webp/encode.h>
 
-DT_MODULE(2)
+DT_MODULE(3)
 
 typedef enum
 {
@@ -48,6 +49,14 @@ typedef enum
   hint_graphic
 } hint_t;
 
+// how much time the encoder spends on making the file smaller, as its method 0 (fastest) to 6
+typedef enum
+{
+  preset_fast,
+  preset_default,
+  preset_smallest
+} preset_t;
+
 
 typedef struct dt_imageio_webp_t
 {
@@ -58,6 +67,7 @@ typedef struct dt_imageio_webp_t
   int comp_type;
   int quality;
   int hint;
+  int preset;
 } dt_imageio_webp_t;
 
 typedef struct dt_imageio_webp_gui_data_t
@@ -65,6 +75,7 @@ typedef struct dt_imageio_webp_gui_data_t
   GtkWidget *compression;
   GtkWidget *quality;
   GtkWidget *hint;
+  GtkWidget *preset;
 } dt_imageio_webp_gui_data_t;
 
 static const char *const EncoderError[] = {
@@ -96,6 +107,11 @@ void init(dt_imageio_module_format_t *self)
   luaA_enum_value(darktable.lua_state.state, hint_t, hint_photo);
   luaA_enum_value(darktable.lua_state.state, hint_t, hint_graphic);
   dt_lua_register_module_member(darktable.lua_state.state, self, dt_imageio_webp_t, hint, hint_t);
+  luaA_enum(darktable.lua_state.state, preset_t);
+  luaA_enum_value(darktable.lua_state.state, preset_t, preset_fast);
+  luaA_enum_value(darktable.lua_state.state, preset_t, preset_default);
+  luaA_enum_value(darktable.lua_state.state, preset_t, preset_smallest);
+  dt_lua_register_module_member(darktable.lua_state.state, self, dt_imageio_webp_t, preset, preset_t);
 #endif
 }
 void cleanup(dt_imageio_module_format_t *self)
@@ -109,7 +125,7 @@ static int FileWriter(const uint8_t *data, size_t data_size, const WebPPicture *
 }
 
 int write_image(dt_imageio_module_data_t *webp, const char *filename, const void *in_tmp, void *exif,
-                int exif_len, int imgid, int num, int total)
+                int exif_len, const char *xmp, int imgid, int num, int total)
 {
   dt_imageio_webp_t *webp_data = (dt_imageio_webp_t *)webp;
   FILE *out = g_fopen(filename, "wb");
@@ -120,6 +136,12 @@ int write_image(dt_imageio_module_data_t *webp, const char *filename, const void
   // TODO(jinxos): expose more config options in the UI
   config.lossless = webp_data->comp_type;
   config.image_hint = webp_data->hint;
+  if(webp_data->preset == preset_fast)
+    config.method = 1;
+  else if(webp_data->preset == preset_smallest)
+    config.method = 6;
+  // analysis and entropy coding run in threads of their own
+  config.thread_level = 1;
 
   // these are to allow for large image export.
   // TODO(jinxos): these values should be adjusted as needed and ideally determined at runtime.
@@ -130,6 +152,8 @@ int write_image(dt_imageio_module_data_t *webp, const char *filename, const void
   if(!WebPPictureInit(&pic)) goto Error;
   pic.width = webp_data->width;
   pic.height = webp_data->height;
+  // lossless is coded from argb, lossy from yuv. the pipe output goes straight into the one the encoder uses.
+  pic.use_argb = config.lossless;
   if(!out)
   {
     fprintf(stderr, "[webp export] error saving to %s\n", filename);
@@ -141,15 +165,10 @@ int write_image(dt_imageio_module_data_t *webp, const char *filename, const void
     pic.custom_ptr = out;
   }
 
-  WebPPictureImportRGBX(&pic, (const uint8_t *)in_tmp, webp_data->width * 4);
-  if(!config.lossless)
+  if(!WebPPictureImportRGBX(&pic, (const uint8_t *)in_tmp, webp_data->width * 4))
   {
-    WebPPictureARGBToYUVA(&pic, WEBP_YUV420A);
-  }
-  else
-  {
-    WebPCleanupTransparentArea(&pic);
-    WebPPictureYUVAToARGB(&pic);
+    fprintf(stderr, "[webp export] error importing the image\n");
+    goto Error;
   }
   if(!WebPValidateConfig(&config))
   {
@@ -184,7 +203,7 @@ void *legacy_params(dt_imageio_module_format_t *self, const void *const old_para
                     const size_t old_params_size, const int old_version, const int new_version,
                     size_t *new_size)
 {
-  if(old_version == 1 && new_version == 2)
+  if(old_version == 1 && new_version == 3)
   {
     typedef struct dt_imageio_webp_v1_t
     {
@@ -208,6 +227,26 @@ void *legacy_params(dt_imageio_module_format_t *self, const void *const old_para
     n->comp_type = o->comp_type;
     n->quality = o->quality;
     n->hint = o->hint;
+    n->preset = preset_default;
+    *new_size = self->params_size(self);
+    return n;
+  }
+  if(old_version == 2 && new_version == 3)
+  {
+    typedef struct dt_imageio_webp_v2_t
+    {
+      int max_width, max_height;
+      int width, height;
+      char style[128];
+      gboolean style_append;
+      int comp_type;
+      int quality;
+      int hint;
+    } dt_imageio_webp_v2_t;
+
+    dt_imageio_webp_t *n = (dt_imageio_webp_t *)malloc(sizeof(dt_imageio_webp_t));
+    memcpy(n, old_params, sizeof(dt_imageio_webp_v2_t));
+    n->preset = preset_default;
     *new_size = self->params_size(self);
     return n;
   }
@@ -223,6 +262,7 @@ void *get_params(dt_imageio_module_format_t *self)
   else
     d->quality = 100;
   d->hint = dt_conf_get_int("plugins/imageio/format/webp/hint");
+  d->preset = dt_conf_get_int("plugins/imageio/format/webp/preset");
   return d;
 }
 
@@ -234,6 +274,7 @@ int set_params(dt_imageio_module_format_t *self, const void *params, const int s
   dt_bauhaus_combobox_set(g->compression, d->comp_type);
   dt_bauhaus_slider_set(g->quality, d->quality);
   dt_bauhaus_combobox_set(g->hint, d->hint);
+  dt_bauhaus_combobox_set(g->preset, d->preset);
   return 0;
 }
 
@@ -286,6 +327,12 @@ static void hint_combobox_changed(GtkWidget *widget, gpointer user_data)
   dt_conf_set_int("plugins/imageio/format/webp/hint", hint);
 }
 
+static void preset_combobox_changed(GtkWidget *widget, gpointer user_data)
+{
+  const int preset = dt_bauhaus_combobox_get(widget);
+  dt_conf_set_int("plugins/imageio/format/webp/preset", preset);
+}
+
 void gui_init(dt_imageio_module_format_t *self)
 {
   dt_imageio_webp_gui_data_t *gui = (dt_imageio_webp_gui_data_t *)malloc(sizeof(dt_imageio_webp_gui_data_t));
@@ -293,6 +340,7 @@ void gui_init(dt_imageio_module_format_t *self)
   const int comp_type = dt_conf_get_int("plugins/imageio/format/webp/comp_type");
   const int quality = dt_conf_get_int("plugins/imageio/format/webp/quality");
   const int hint = dt_conf_get_int("plugins/imageio/format/webp/hint");
+  const int preset = dt_conf_get_int("plugins/imageio/format/webp/preset");
 
   self->widget = gtk_box_new(GTK_ORIENTATION_VERTICAL, DT_PIXEL_APPLY_DPI(5));
 
@@ -328,6 +376,16 @@ void gui_init(dt_imageio_module_format_t *self)
   dt_bauhaus_combobox_set(gui->hint, hint);
   gtk_box_pack_start(GTK_BOX(self->widget), gui->hint, TRUE, TRUE, 0);
   g_signal_connect(G_OBJECT(gui->hint), "value-changed", G_CALLBACK(hint_combobox_changed), NULL);
+
+  gui->preset = dt_bauhaus_combobox_new(NULL);
+  dt_bauhaus_widget_set_label(gui->preset, NULL, _("encoder speed"));
+  gtk_widget_set_tooltip_text(gui->preset, _("the slower the encoder, the smaller the file at the same quality"));
+  dt_bauhaus_combobox_add(gui->preset, _("fast"));
+  dt_bauhaus_combobox_add(gui->preset, _("default"));
+  dt_bauhaus_combobox_add(gui->preset, _("slow, smallest files"));
+  dt_bauhaus_combobox_set(gui->preset, preset);
+  gtk_box_pack_start(GTK_BOX(self->widget), gui->preset, TRUE, TRUE, 0);
+  g_signal_connect(G_OBJECT(gui->preset), "value-changed", G_CALLBACK(preset_combobox_changed), NULL);
 }
 
 void gui_cleanup(dt_imageio_module_format_t *self)
@@ -342,7 +400,7 @@ void gui_reset(dt_imageio_module_format_t *self)
 int flags(dt_imageio_module_data_t *data)
 {
   // TODO(jinxos): support embedded XMP/ICC
-  return 0;
+  return FORMAT_FLAGS_STREAMABLE;
 }
 
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
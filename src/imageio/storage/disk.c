@@ -32,10 +32,12 @@
 #include "gui/gtk.h"
 #include "gui/gtkentry.h"
 #include "imageio/storage/imageio_storage_api.h"
+#include <fcntl.h>
 #include <glib.h>
 #include <glib/gstdio.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <unistd.h>
 
 DT_MODULE(2)
 
@@ -290,16 +292,59 @@ try_again:
           seq++;
         } while(g_file_test(filename, G_FILE_TEST_EXISTS));
       }
+      // reserve the name, another image exported at the same time could end up with it otherwise
+      if(!fail)
+      {
+        const int fd = g_open(filename, O_WRONLY | O_CREAT | O_EXCL, 0644);
+        if(fd >= 0) close(fd);
+      }
     }
   } // end of critical block
   dt_pthread_mutex_unlock(&darktable.plugin_threadsafe);
   if(fail) return 1;
 
+  /* more sizes of the same export, named after it */
+  dt_imageio_export_target_t *targets = NULL;
+  int num_targets = 0;
+  gchar *extra_sizes = strcmp(format->mime(fdata), "x-copy")
+                           ? dt_conf_get_string("plugins/imageio/storage/disk/extra_sizes")
+                           : NULL;
+  gchar **sizes = extra_sizes && *extra_sizes ? g_strsplit(extra_sizes, ",", -1) : NULL;
+  if(sizes)
+  {
+    const char *ext = format->extension(fdata);
+    const char *dot = strrchr(filename, '.');
+    const int base = dot && !strchr(dot, '/') ? dot - filename : strlen(filename);
+    targets = (dt_imageio_export_target_t *)calloc(g_strv_length(sizes), sizeof(dt_imageio_export_target_t));
+    for(int k = 0; targets && sizes[k]; k++)
+    {
+      const int size = atoi(sizes[k]);
+      if(size <= 0) continue;
+      gchar *target = g_strdup_printf("%.*s_%d.%s", base, filename, size, ext);
+      for(int seq = 1; !d->overwrite && g_file_test(target, G_FILE_TEST_EXISTS); seq++)
+      {
+        g_free(target);
+        target = g_strdup_printf("%.*s_%d_%.2d.%s", base, filename, size, seq, ext);
+      }
+      targets[num_targets++] = (dt_imageio_export_target_t){ target, NULL, NULL, size, size, 0, 0 };
+    }
+  }
+  g_strfreev(sizes);
+  g_free(extra_sizes);
+
   /* export image to file */
-  if(dt_imageio_export(imgid, filename, format, fdata, high_quality, upscale, TRUE, self, sdata, num, total) != 0)
+  const int res
+      = num_targets ? dt_imageio_export_multi(imgid, filename, format, fdata, high_quality, upscale, TRUE, self,
+                                              sdata, num, total, targets, num_targets)
+                    : dt_imageio_export(imgid, filename, format, fdata, high_quality, upscale, TRUE, self, sdata,
+                                        num, total);
+  for(int k = 0; k < num_targets; k++) g_free((gchar *)targets[k].filename);
+  free(targets);
+  if(res != 0)
   {
     fprintf(stderr, "[imageio_storage_disk] could not export to file: `%s'!\n", filename);
     dt_control_log(_("could not export to file `%s'!"), filename);
+    if(!d->overwrite) g_unlink(filename);
     return 1;
   }
 
@@ -311,6 +356,11 @@ try_again:
   return 0;
 }
 
+int parallel(dt_imageio_module_storage_t *self)
+{
+  return 1;
+}
+
 size_t params_size(dt_imageio_module_storage_t *self)
 {
   return sizeof(dt_imageio_disk_t) - sizeof(void *);
@@ -218,51 +218,59 @@ int store(dt_imageio_module_storage_t *self, dt_imageio_module_data_t *sdata, co
 
   char tmp_dir[PATH_MAX] = { 0 };
 
-  d->vp->filename = dirname;
-  d->vp->jobcode = "export";
-  d->vp->imgid = imgid;
-  d->vp->sequence = num;
-
-  gchar *result_tmp_dir = dt_variables_expand(d->vp, d->filename, TRUE);
-  g_strlcpy(tmp_dir, result_tmp_dir, sizeof(tmp_dir));
-  g_free(result_tmp_dir);
-
-  // if filenamepattern is a directory just let att ${FILE_NAME} as default..
-  if(g_file_test(tmp_dir, G_FILE_TEST_EXISTS | G_FILE_TEST_IS_DIR)
-     || ((d->filename + strlen(d->filename) - 1)[0] == '/'
-         || (d->filename + strlen(d->filename) - 1)[0] == '\\'))
-    snprintf(d->filename + strlen(d->filename), sizeof(d->filename) - strlen(d->filename), "/$(FILE_NAME)");
-
-  // avoid braindead export which is bound to overwrite at random:
-  if(total > 1 && !g_strrstr(d->filename, "$"))
+  const char *ext = format->extension(fdata);
+  char *c;
+
+  // we're potentially called in parallel. have sequence number synchronized:
+  dt_pthread_mutex_lock(&darktable.plugin_threadsafe);
   {
-    snprintf(d->filename + strlen(d->filename), sizeof(d->filename) - strlen(d->filename), "_$(SEQUENCE)");
-  }
+    d->vp->filename = dirname;
+    d->vp->jobcode = "export";
+    d->vp->imgid = imgid;
+    d->vp->sequence = num;
+
+    gchar *result_tmp_dir = dt_variables_expand(d->vp, d->filename, TRUE);
+    g_strlcpy(tmp_dir, result_tmp_dir, sizeof(tmp_dir));
+    g_free(result_tmp_dir);
+
+    // if filenamepattern is a directory just let att ${FILE_NAME} as default..
+    if(g_file_test(tmp_dir, G_FILE_TEST_EXISTS | G_FILE_TEST_IS_DIR)
+       || ((d->filename + strlen(d->filename) - 1)[0] == '/'
+           || (d->filename + strlen(d->filename) - 1)[0] == '\\'))
+      snprintf(d->filename + strlen(d->filename), sizeof(d->filename) - strlen(d->filename), "/$(FILE_NAME)");
+
+    // avoid braindead export which is bound to overwrite at random:
+    if(total > 1 && !g_strrstr(d->filename, "$"))
+    {
+      snprintf(d->filename + strlen(d->filename), sizeof(d->filename) - strlen(d->filename), "_$(SEQUENCE)");
+    }
 
-  gchar *fixed_path = dt_util_fix_path(d->filename);
-  g_strlcpy(d->filename, fixed_path, sizeof(d->filename));
-  g_free(fixed_path);
+    gchar *fixed_path = dt_util_fix_path(d->filename);
+    g_strlcpy(d->filename, fixed_path, sizeof(d->filename));
+    g_free(fixed_path);
 
-  gchar *result_filename = dt_variables_expand(d->vp, d->filename, TRUE);
-  g_strlcpy(filename, result_filename, sizeof(filename));
-  g_free(result_filename);
+    gchar *result_filename = dt_variables_expand(d->vp, d->filename, TRUE);
+    g_strlcpy(filename, result_filename, sizeof(filename));
+    g_free(result_filename);
 
-  g_strlcpy(dirname, filename, sizeof(dirname));
+    g_strlcpy(dirname, filename, sizeof(dirname));
 
-  const char *ext = format->extension(fdata);
-  char *c = dirname + strlen(dirname);
-  for(; c > dirname && *c != '/'; c--)
-    ;
-  if(*c == '/') *c = '\0';
-  if(g_mkdir_with_parents(dirname, 0755))
-  {
-    fprintf(stderr, "[imageio_storage_gallery] could not create directory: `%s'!\n", dirname);
-    dt_control_log(_("could not create directory `%s'!"), dirname);
-    return 1;
-  }
+    c = dirname + strlen(dirname);
+    for(; c > dirname && *c != '/'; c--)
+      ;
+    if(*c == '/') *c = '\0';
+    if(g_mkdir_with_parents(dirname, 0755))
+    {
+      fprintf(stderr, "[imageio_storage_gallery] could not create directory: `%s'!\n", dirname);
+      dt_control_log(_("could not create directory `%s'!"), dirname);
+      dt_pthread_mutex_unlock(&darktable.plugin_threadsafe);
+      return 1;
+    }
 
-  // store away dir.
-  snprintf(d->cached_dirname, sizeof(d->cached_dirname), "%s", dirname);
+    // store away dir.
+    snprintf(d->cached_dirname, sizeof(d->cached_dirname), "%s", dirname);
+  } // end of critical block
+  dt_pthread_mutex_unlock(&darktable.plugin_threadsafe);
 
   c = filename + strlen(filename);
   for(; c > filename && *c != '.' && *c != '/'; c--)
@@ -271,6 +279,15 @@ int store(dt_imageio_module_storage_t *self, dt_imageio_module_data_t *sdata, co
 
   sprintf(c, ".%s", ext);
 
+  // alter filename with -thumb:
+  char thumbfilename[PATH_MAX] = { 0 };
+  g_strlcpy(thumbfilename, filename, sizeof(thumbfilename));
+  c = thumbfilename + strlen(thumbfilename);
+  for(; c > thumbfilename && *c != '.' && *c != '/'; c--)
+    ;
+  if(c <= thumbfilename || *c == '/') c = thumbfilename + strlen(thumbfilename);
+  sprintf(c, "-thumb.%s", ext);
+
   // save image to list, in order:
   pair_t *pair = malloc(sizeof(pair_t));
 
@@ -303,12 +320,6 @@ int store(dt_imageio_module_storage_t *self, dt_imageio_module_data_t *sdata, co
   if(c <= relthumbfilename) c = relthumbfilename + strlen(relthumbfilename);
   sprintf(c, "-thumb.%s", ext);
 
-  char subfilename[PATH_MAX] = { 0 }, relsubfilename[PATH_MAX] = { 0 };
-  snprintf(subfilename, sizeof(subfilename), "%s", d->cached_dirname);
-  char *sc = subfilename + strlen(subfilename);
-  sprintf(sc, "/img_%d.html", num);
-  snprintf(relsubfilename, sizeof(relsubfilename), "img_%d.html", num);
-
   snprintf(pair->line, sizeof(pair->line),
            "\n"
            "      <div><div class=\"dia\">\n"
@@ -317,13 +328,18 @@ int store(dt_imageio_module_storage_t *self, dt_imageio_module_data_t *sdata, co
            "      %s</div>\n",
            relthumbfilename,
            num, num-1, title ? title : "&nbsp;", description ? description : "&nbsp;");
+  if(res_title) g_list_free_full(res_title, &g_free);
+  if(res_desc) g_list_free_full(res_desc, &g_free);
 
-  // export image to file. need this to be able to access meaningful
+  // export image and its thumbnail from one run of the pipe. need this to be able to access meaningful
   // fdata->width and height below.
-  if(dt_imageio_export(imgid, filename, format, fdata, high_quality, upscale, FALSE, self, sdata, num, total) != 0)
+  dt_imageio_export_target_t thumb = { thumbfilename, NULL, NULL, 200, 200, 0, 0 };
+  if(dt_imageio_export_multi(imgid, filename, format, fdata, high_quality, upscale, FALSE, self, sdata, num, total,
+                             &thumb, 1) != 0)
   {
     fprintf(stderr, "[imageio_storage_gallery] could not export to file: `%s'!\n", filename);
     dt_control_log(_("could not export to file `%s'!"), filename);
+    free(pair);
     return 1;
   }
 
@@ -337,32 +353,9 @@ int store(dt_imageio_module_storage_t *self, dt_imageio_module_data_t *sdata, co
            relfilename, fdata->width, fdata->height, relthumbfilename);
 
   pair->pos = num;
-  if(res_title) g_list_free_full(res_title, &g_free);
-  if(res_desc) g_list_free_full(res_desc, &g_free);
+  dt_pthread_mutex_lock(&darktable.plugin_threadsafe);
   d->l = g_list_insert_sorted(d->l, pair, (GCompareFunc)sort_pos);
-
-  /* also export thumbnail: */
-  // write with reduced resolution:
-  const int max_width = fdata->max_width;
-  const int max_height = fdata->max_height;
-  fdata->max_width = 200;
-  fdata->max_height = 200;
-  // alter filename with -thumb:
-  c = filename + strlen(filename);
-  for(; c > filename && *c != '.' && *c != '/'; c--)
-    ;
-  if(c <= filename || *c == '/') c = filename + strlen(filename);
-  ext = format->extension(fdata);
-  sprintf(c, "-thumb.%s", ext);
-  if(dt_imageio_export(imgid, filename, format, fdata, FALSE, TRUE, FALSE, self, sdata, num, total) != 0)
-  {
-    fprintf(stderr, "[imageio_storage_gallery] could not export to file: `%s'!\n", filename);
-    dt_control_log(_("could not export to file `%s'!"), filename);
-    return 1;
-  }
-  // restore for next image:
-  fdata->max_width = max_width;
-  fdata->max_height = max_height;
+  dt_pthread_mutex_unlock(&darktable.plugin_threadsafe);
 
   printf("[export_job] exported to `%s'\n", filename);
   char *trunc = filename + strlen(filename) - 32;
@@ -545,6 +538,11 @@ void finalize_store(dt_imageio_module_storage_t *self, dt_imageio_module_data_t
   fclose(f);
 }
 
+int parallel(dt_imageio_module_storage_t *self)
+{
+  return 1;
+}
+
 size_t params_size(dt_imageio_module_storage_t *self)
 {
   return sizeof(dt_imageio_gallery_t) - 2 * sizeof(void *) - DT_MAX_PATH_FOR_PARAMS;
@@ -421,6 +421,11 @@ void finalize_store(dt_imageio_module_storage_t *self, dt_imageio_module_data_t
   fclose(f);
 }
 
+int parallel(dt_imageio_module_storage_t *self)
+{
+  return 1;
+}
+
 size_t params_size(dt_imageio_module_storage_t *self)
 {
   return sizeof(dt_imageio_latex_t) - 2 * sizeof(void *) - DT_MAX_PATH_FOR_PARAMS;
@@ -73,6 +73,14 @@ public:
     delete[] values;
   }
 
+  // Forgets all vectors but keeps the storage.
+  void clear()
+  {
+    for(size_t i = 0; i < capacity; i++) entries[i] = Entry();
+    memset(values, 0, sizeof(float) * VD * filled);
+    filled = 0;
+  }
+
   // Returns the number of vectors stored.
   int size()
   {
@@ -100,8 +108,9 @@ public:
   int lookupOffset(const short *key, size_t h, bool create = true)
   {
 
-    // Double hash table size if necessary
-    if(filled >= (capacity / 2) - 1)
+    // Double hash table size if necessary. Lookups without create run concurrently during blur() and must
+    // not touch the table.
+    if(create && filled >= (capacity / 2) - 1)
     {
       grow();
     }
@@ -230,7 +239,8 @@ public:
    *    vd_ : dimensionality of value vectors
    * nData_ : number of points in the input
    */
-  PermutohedralLattice(size_t nData_, int nThreads_ = 1) : nData(nData_), nThreads(nThreads_)
+  PermutohedralLattice(size_t nData_, int nThreads_ = 1)
+    : nData(nData_), replayCapacity(nData_), nThreads(nThreads_), blurValues(NULL), blurCapacity(0)
   {
 
     // Allocate storage for various arrays
@@ -281,6 +291,25 @@ public:
     delete[] replay;
     delete[] canonical;
     delete[] hashTables;
+    delete[] blurValues;
+  }
+
+  /* Empties the lattice for nData_ new points, keeping the storage of the last use if it is large enough. */
+  void reset(size_t nData_)
+  {
+    if(nData_ > replayCapacity)
+    {
+      delete[] replay;
+      replay = new ReplayEntry[nData_ * (D + 1)];
+      replayCapacity = nData_;
+    }
+    nData = nData_;
+    for(int i = 0; i < nThreads; i++) hashTables[i].clear();
+  }
+
+  int threads() const
+  {
+    return nThreads;
   }
 
 
@@ -412,8 +441,13 @@ public:
       }
     }
 
-    /* Rewrite the offsets in the replay structure from the above generated table. */
-    for(int i = 0; i < nData * (D + 1); i++)
+    /* Rewrite the offsets in the replay structure from the above generated table. The entries are
+     * independent of each other, so this runs over all threads. */
+    const size_t nReplay = nData * (D + 1);
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static) shared(offset_remap)
+#endif
+    for(size_t i = 0; i < nReplay; i++)
       if(replay[i].table > 0) replay[i].offset = offset_remap[replay[i].table][replay[i].offset / VD];
 
     for(int i = 1; i < nThreads; i++) delete[] offset_remap[i];
@@ -443,7 +477,14 @@ public:
   void blur()
   {
     // Prepare arrays
-    float *newValue = new float[VD * hashTables[0].size()];
+    const size_t nValues = (size_t)VD * hashTables[0].size();
+    if(nValues > blurCapacity)
+    {
+      delete[] blurValues;
+      blurValues = new float[nValues];
+      blurCapacity = nValues;
+    }
+    float *newValue = blurValues;
     float *oldValue = hashTables[0].getValues();
     float *hashTableBase = oldValue;
 
@@ -497,19 +538,11 @@ public:
     }
 
     // depending where we ended up, we may have to copy data
-    if(oldValue != hashTableBase)
-    {
-      memcpy(hashTableBase, oldValue, hashTables[0].size() * VD * sizeof(float));
-      delete[] oldValue;
-    }
-    else
-    {
-      delete[] newValue;
-    }
+    if(oldValue != hashTableBase) memcpy(hashTableBase, oldValue, hashTables[0].size() * VD * sizeof(float));
   }
 
 private:
-  int nData;
+  size_t nData, replayCapacity;
   int nThreads;
   const float *scaleFactor;
   const int *canonical;
@@ -523,6 +556,10 @@ private:
   } *replay;
 
   HashTablePermutohedral<D, VD> *hashTables;
+
+  // scratch space of blur(), kept for the next use
+  float *blurValues;
+  size_t blurCapacity;
 };
 
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
@@ -471,6 +471,9 @@ void amaze_demosaic_RT(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *pie
     {
       for(int left = winx - 16; left < winx + width; left += ts - 32)
       {
+        // skip the remaining tiles, the output will be thrown away
+        if(dt_dev_pixelpipe_cancelled(piece->pipe)) continue;
+
         memset(&nyquist[3 * tsh], 0, sizeof(unsigned char) * (ts - 6) * tsh);
         // location of tile bottom edge
         int bottom = MIN(top + ts, winy + height + 16);
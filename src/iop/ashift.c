@@ -25,6 +25,7 @@
 #include "common/debug.h"
 #include "common/interpolation.h"
 #include "common/opencl.h"
+#include "control/conf.h"
 #include "control/control.h"
 #include "develop/develop.h"
 #include "develop/imageop.h"
@@ -1298,12 +1299,19 @@ static int line_detect(float *in, const int width, const int height, const int x
     (void)edge_enhance(greyscale, greyscale, width, height);
   }
 
+  // LSD subsamples the image with a gaussian to the analysis size configured, if any, and gives the
+  // lines in coordinates of the full image
+  const int analysis_size = dt_conf_get_int("plugins/darkroom/ashift/analysis_size");
+  const int max_dim = MAX(width, height);
+  const double lsd_scale
+      = (analysis_size > 0 && max_dim > analysis_size) ? LSD_SCALE * analysis_size / max_dim : LSD_SCALE;
+
   // call the line segment detector LSD;
   // LSD stores the number of found lines in lines_count.
   // it returns structural details as vector 'double lines[7 * lines_count]'
   int lines_count;
   lsd_lines = LineSegmentDetection(&lines_count, greyscale, width, height,
-                                   LSD_SCALE, LSD_SIGMA_SCALE, LSD_QUANT,
+                                   lsd_scale, LSD_SIGMA_SCALE, LSD_QUANT,
                                    LSD_ANG_TH, LSD_LOG_EPS, LSD_DENSITY_TH,
                                    LSD_N_BINS, NULL, NULL, NULL);
 
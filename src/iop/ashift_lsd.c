@@ -25,6 +25,8 @@
  *      catch (unlikely) division by zero near line 2035
  *      rename rad1 and rad2 to radius1 and radius2 in reduce_region_radius()
  *        to avoid naming conflict in windows build
+ *      run the passes of gaussian_sampler() and the gradient of ll_angle()
+ *        in parallel with openmp, the gradient row by row
  *
  */
 
@@ -690,13 +692,23 @@ static image_double gaussian_sampler( image_double in, double scale,
   prec = 3.0;
   h = (unsigned int) ceil( sigma * sqrt( 2.0 * prec * log(10.0) ) );
   n = 1+2*h; /* kernel size */
-  kernel = new_ntuple_list(n);
 
   /* auxiliary double image size variables */
   double_x_size = (int) (2 * in->xsize);
   double_y_size = (int) (2 * in->ysize);
 
+  /* the columns and rows of each pass are independent, every thread
+     computes its kernels in a list of its own. */
+#ifdef _OPENMP
+#pragma omp parallel default(shared) private(x,y,i,j,xx,yy,xc,yc,sum,kernel)
+#endif
+  {
+  kernel = new_ntuple_list(n);
+
   /* First subsampling: x axis */
+#ifdef _OPENMP
+#pragma omp for schedule(static)
+#endif
   for(x=0;x<aux->xsize;x++)
     {
       /*
@@ -731,6 +743,9 @@ static image_double gaussian_sampler( image_double in, double scale,
     }
 
   /* Second subsampling: y axis */
+#ifdef _OPENMP
+#pragma omp for schedule(static)
+#endif
   for(y=0;y<out->ysize;y++)
     {
       /*
@@ -764,8 +779,10 @@ static image_double gaussian_sampler( image_double in, double scale,
         }
     }
 
-  /* free memory */
   free_ntuple_list(kernel);
+  }
+
+  /* free memory */
   free_image_double(aux);
 
   return out;
@@ -845,8 +862,12 @@ static image_double ll_angle( image_double in, double threshold,
   for(y=0;y<n;y++) g->data[p*y+p-1]   = NOTDEF;
 
   /* compute gradient on the remaining pixels */
-  for(x=0;x<p-1;x++)
-    for(y=0;y<n-1;y++)
+#ifdef _OPENMP
+#pragma omp parallel for default(shared) private(x,adr,com1,com2,gx,gy,norm,norm2) \
+  reduction(max:max_grad) schedule(static)
+#endif
+  for(y=0;y<n-1;y++)
+    for(x=0;x<p-1;x++)
       {
         adr = y*p+x;
 
@@ -28,6 +28,8 @@
  *      initialize i and j to avoid compiler warnings
  *      comment out printing of status inormation
  *      reformat according to darktable's clang standards
+ *      evaluate the vertices of the initial simplex and the two of a shrink step in parallel,
+ *        objfunc has to be reentrant
  */
 
 /*==================================================================================
@@ -150,9 +152,12 @@ static int simplex(double (*objfunc)(double[], void *params), double start[], in
     constrain(v[j], n);
   }
   /* find the initial function values */
-  for(j = 0; j <= n; j++)
+#ifdef _OPENMP
+#pragma omp parallel for default(none) shared(v, f, params, objfunc, n) schedule(static)
+#endif
+  for(int jj = 0; jj <= n; jj++)
   {
-    f[j] = objfunc(v[j], params);
+    f[jj] = objfunc(v[jj], params);
   }
 
   k = n + 1;
@@ -338,14 +343,19 @@ static int simplex(double (*objfunc)(double[], void *params), double start[], in
         {
           constrain(v[vg], n);
         }
-        f[vg] = objfunc(v[vg], params);
-        k++;
         if(constrain != NULL)
         {
           constrain(v[vh], n);
         }
-        f[vh] = objfunc(v[vh], params);
-        k++;
+#ifdef _OPENMP
+#pragma omp parallel for default(none) shared(v, f, params, objfunc, vg, vh) schedule(static)
+#endif
+        for(int jj = 0; jj < 2; jj++)
+        {
+          const int vx = jj ? vh : vg;
+          f[vx] = objfunc(v[vx], params);
+        }
+        k += 2;
       }
     }
 #if 0
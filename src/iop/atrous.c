@@ -100,7 +100,6 @@ typedef struct dt_iop_atrous_gui_data_t
 typedef struct dt_iop_atrous_global_data_t
 {
   int kernel_decompose;
-  int kernel_synthesize;
 } dt_iop_atrous_global_data_t;
 
 typedef struct dt_iop_atrous_data_t
@@ -269,14 +268,14 @@ static inline __m128 weight_sse2(const __m128 *c1, const __m128 *c2, const float
 #define ROW_PROLOGUE                                                                                         \
   const float *px = ((float *)in) + (size_t)4 * j * width;                                                   \
   const float *px2;                                                                                          \
-  float *pdetail = detail + (size_t)4 * j * width;                                                           \
+  float *paccum = accum + (size_t)4 * j * width;                                                             \
   float *pcoarse = out + (size_t)4 * j * width;
 
 #if defined(__SSE2__)
 #define ROW_PROLOGUE_SSE                                                                                     \
   const __m128 *px = ((__m128 *)in) + (size_t)j * width;                                                     \
   const __m128 *px2;                                                                                         \
-  float *pdetail = detail + (size_t)4 * j * width;                                                           \
+  float *paccum = accum + (size_t)4 * j * width;                                                             \
   float *pcoarse = out + (size_t)4 * j * width;
 #endif
 
@@ -290,31 +289,58 @@ static inline __m128 weight_sse2(const __m128 *c1, const __m128 *c2, const float
   __m128 wgt = _mm_setzero_ps();
 #endif
 
+// the detail of the pixel is thresholded and boosted right away and added to the ones of the finer scales in
+// accum, the first scale starts the sum. the last one adds it to its coarse buffer, which is the output then.
+// so the details are never stored.
 #define SUM_PIXEL_EPILOGUE                                                                                   \
   for(int c = 0; c < 4; c++) sum[c] /= wgt[c];                                                               \
                                                                                                              \
-  for(int c = 0; c < 4; c++) pdetail[c] = (px[c] - sum[c]);                                                  \
-  for(int c = 0; c < 4; c++) pcoarse[c] = sum[c];                                                            \
+  for(int c = 0; c < 4; c++)                                                                                 \
+  {                                                                                                          \
+    const float det = px[c] - sum[c];                                                                        \
+    const float amount = copysignf(MAX(0.0f, fabsf(det) - thrsf[c]), det);                                   \
+    const float acc = (first ? 0.0f : paccum[c]) + boostf[c] * amount;                                       \
+    if(last)                                                                                                 \
+      pcoarse[c] = sum[c] + acc;                                                                             \
+    else                                                                                                     \
+    {                                                                                                        \
+      pcoarse[c] = sum[c];                                                                                   \
+      paccum[c] = acc;                                                                                       \
+    }                                                                                                        \
+  }                                                                                                          \
   px += 4;                                                                                                   \
-  pdetail += 4;                                                                                              \
+  paccum += 4;                                                                                               \
   pcoarse += 4;
 
 #if defined(__SSE2__)
 #define SUM_PIXEL_EPILOGUE_SSE                                                                               \
   sum = _mm_mul_ps(sum, _mm_rcp_ps(wgt));                                                                    \
                                                                                                              \
-  _mm_stream_ps(pdetail, _mm_sub_ps(*px, sum));                                                              \
-  _mm_stream_ps(pcoarse, sum);                                                                               \
+  {                                                                                                          \
+    const __m128 det = _mm_sub_ps(*px, sum);                                                                 \
+    const __m128 absamt = _mm_max_ps(_mm_setzero_ps(), _mm_sub_ps(_mm_andnot_ps(signmask, det), threshold)); \
+    const __m128 amount = _mm_or_ps(_mm_and_ps(det, signmask), absamt);                                      \
+    const __m128 acc = _mm_add_ps(first ? _mm_setzero_ps() : _mm_load_ps(paccum), _mm_mul_ps(boost, amount)); \
+    if(last)                                                                                                 \
+      _mm_stream_ps(pcoarse, _mm_add_ps(sum, acc));                                                          \
+    else                                                                                                     \
+    {                                                                                                        \
+      _mm_stream_ps(pcoarse, sum);                                                                           \
+      _mm_store_ps(paccum, acc);                                                                             \
+    }                                                                                                        \
+  }                                                                                                          \
   px++;                                                                                                      \
-  pdetail += 4;                                                                                              \
+  paccum += 4;                                                                                               \
   pcoarse += 4;
 #endif
 
-typedef void((*eaw_decompose_t)(float *const out, const float *const in, float *const detail, const int scale,
-                                const float sharpen, const int32_t width, const int32_t height));
+typedef void((*eaw_decompose_t)(float *const out, const float *const in, float *const accum, const int scale,
+                                const float sharpen, const float *const thrsf, const float *const boostf,
+                                const int first, const int last, const int32_t width, const int32_t height));
 
-static void eaw_decompose(float *const out, const float *const in, float *const detail, const int scale,
-                          const float sharpen, const int32_t width, const int32_t height)
+static void eaw_decompose(float *const out, const float *const in, float *const accum, const int scale,
+                          const float sharpen, const float *const thrsf, const float *const boostf,
+                          const int first, const int last, const int32_t width, const int32_t height)
 {
   const int mult = 1 << scale;
   static const float filter[5] = { 1.0f / 16.0f, 4.0f / 16.0f, 6.0f / 16.0f, 4.0f / 16.0f, 1.0f / 16.0f };
@@ -428,10 +454,14 @@ static void eaw_decompose(float *const out, const float *const in, float *const
 #undef SUM_PIXEL_EPILOGUE
 
 #if defined(__SSE2__)
-static void eaw_decompose_sse2(float *const out, const float *const in, float *const detail, const int scale,
-                               const float sharpen, const int32_t width, const int32_t height)
+static void eaw_decompose_sse2(float *const out, const float *const in, float *const accum, const int scale,
+                               const float sharpen, const float *const thrsf, const float *const boostf,
+                               const int first, const int last, const int32_t width, const int32_t height)
 {
   const int mult = 1 << scale;
+  const __m128 threshold = _mm_set_ps(thrsf[3], thrsf[2], thrsf[1], thrsf[0]);
+  const __m128 boost = _mm_set_ps(boostf[3], boostf[2], boostf[1], boostf[0]);
+  const __m128 signmask = _mm_castsi128_ps(_mm_set1_epi32(0x80000000u));
   static const float filter[5] = { 1.0f / 16.0f, 4.0f / 16.0f, 6.0f / 16.0f, 4.0f / 16.0f, 1.0f / 16.0f };
 
 /* The first "2*mult" lines use the macro with tests because the 5x5 kernel
@@ -545,64 +575,6 @@ static void eaw_decompose_sse2(float *const out, const float *const in, float *c
 #undef SUM_PIXEL_EPILOGUE_SSE
 #endif
 
-typedef void((*eaw_synthesize_t)(float *const out, const float *const in, const float *const detail,
-                                 const float *thrsf, const float *boostf, const int32_t width,
-                                 const int32_t height));
-
-static void eaw_synthesize(float *const out, const float *const in, const float *const detail,
-                           const float *thrsf, const float *boostf, const int32_t width, const int32_t height)
-{
-  const float threshold[4] = { thrsf[0], thrsf[1], thrsf[2], thrsf[3] };
-  const float boost[4] = { boostf[0], boostf[1], boostf[2], boostf[3] };
-
-#ifdef _OPENMP
-#pragma omp parallel for SIMD() default(none) schedule(static) collapse(2)
-#endif
-  for(size_t k = 0; k < (size_t)4 * width * height; k += 4)
-  {
-    for(size_t c = 0; c < 4; c++)
-    {
-      const float absamt = MAX(0.0f, (fabsf(detail[k + c]) - threshold[c]));
-      const float amount = copysignf(absamt, detail[k + c]);
-      out[k + c] = in[k + c] + (boost[c] * amount);
-    }
-  }
-}
-
-#if defined(__SSE2__)
-static void eaw_synthesize_sse2(float *const out, const float *const in, const float *const detail,
-                                const float *thrsf, const float *boostf, const int32_t width,
-                                const int32_t height)
-{
-  const __m128 threshold = _mm_set_ps(thrsf[3], thrsf[2], thrsf[1], thrsf[0]);
-  const __m128 boost = _mm_set_ps(boostf[3], boostf[2], boostf[1], boostf[0]);
-
-#ifdef _OPENMP
-#pragma omp parallel for default(none) schedule(static)
-#endif
-  for(int j = 0; j < height; j++)
-  {
-    // TODO: prefetch? _mm_prefetch()
-    const __m128 *pin = (__m128 *)in + (size_t)j * width;
-    __m128 *pdetail = (__m128 *)detail + (size_t)j * width;
-    float *pout = out + (size_t)4 * j * width;
-    for(int i = 0; i < width; i++)
-    {
-      const __m128i maski = _mm_set1_epi32(0x80000000u);
-      const __m128 *mask = (__m128 *)&maski;
-      const __m128 absamt
-          = _mm_max_ps(_mm_setzero_ps(), _mm_sub_ps(_mm_andnot_ps(*mask, *pdetail), threshold));
-      const __m128 amount = _mm_or_ps(_mm_and_ps(*pdetail, *mask), absamt);
-      _mm_stream_ps(pout, _mm_add_ps(*pin, _mm_mul_ps(boost, amount)));
-      pdetail++;
-      pin++;
-      pout += 4;
-    }
-  }
-  _mm_sfence();
-}
-#endif
-
 static int get_samples(float *t, const dt_iop_atrous_data_t *const d, const dt_iop_roi_t *roi_in,
                        const dt_dev_pixelpipe_iop_t *const piece)
 {
@@ -671,8 +643,7 @@ static int get_scales(float (*thrs)[4], float (*boost)[4], float *sharp, const d
 /* just process the supplied image buffer, upstream default_process_tiling() does the rest */
 static void process_wavelets(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece,
                              const void *const i, void *const o, const dt_iop_roi_t *const roi_in,
-                             const dt_iop_roi_t *const roi_out, const eaw_decompose_t decompose,
-                             const eaw_synthesize_t synthesize)
+                             const dt_iop_roi_t *const roi_out, const eaw_decompose_t decompose)
 {
   dt_iop_atrous_data_t *d = (dt_iop_atrous_data_t *)piece->data;
   float thrs[MAX_NUM_SCALES][4];
@@ -688,77 +659,54 @@ static void process_wavelets(struct dt_iop_module_t *self, struct dt_dev_pixelpi
     // dt_control_queue_draw(GTK_WIDGET(g->area));
   }
 
-  float *detail[MAX_NUM_SCALES] = { NULL };
-  float *tmp = NULL;
-  float *buf2 = NULL;
-  float *buf1 = NULL;
-
   const int width = roi_out->width;
   const int height = roi_out->height;
 
-  tmp = (float *)dt_alloc_align(64, (size_t)sizeof(float) * 4 * width * height);
-  if(tmp == NULL)
+  if(max_scale == 0)
   {
-    fprintf(stderr, "[atrous] failed to allocate coarse buffer!\n");
-    goto error;
+    memcpy(o, i, (size_t)sizeof(float) * 4 * width * height);
+    return;
   }
 
-  for(int k = 0; k < max_scale; k++)
+  // every scale synthesizes its detail on the fly while decomposing, so besides the coarse buffers only the
+  // sum of the boosted details is kept, instead of one detail buffer per scale.
+  float *tmp = (float *)dt_alloc_align(64, (size_t)sizeof(float) * 4 * width * height);
+  float *accum = (float *)dt_alloc_align(64, (size_t)sizeof(float) * 4 * width * height);
+  if(tmp == NULL || accum == NULL)
   {
-    detail[k] = (float *)dt_alloc_align(64, (size_t)sizeof(float) * 4 * width * height);
-    if(detail[k] == NULL)
-    {
-      fprintf(stderr, "[atrous] failed to allocate one of the detail buffers!\n");
-      goto error;
-    }
+    fprintf(stderr, "[atrous] failed to allocate coarse or detail buffer!\n");
+    dt_free_align(tmp);
+    dt_free_align(accum);
+    return;
   }
 
-  buf1 = (float *)i;
-  buf2 = tmp;
-
+  // the coarse buffers ping-pong between tmp and (float *)o such that the last scale writes to the output
+  const float *buf1 = (const float *)i;
   for(int scale = 0; scale < max_scale; scale++)
   {
-    decompose(buf2, buf1, detail[scale], scale, sharp[scale], width, height);
-    if(scale == 0) buf1 = (float *)o; // now switch to (float *)o for buffer ping-pong between buf1 and buf2
-    float *buf3 = buf2;
-    buf2 = buf1;
-    buf1 = buf3;
-  }
-
-  for(int scale = max_scale - 1; scale >= 0; scale--)
-  {
-    synthesize(buf2, buf1, detail[scale], thrs[scale], boost[scale], width, height);
-    float *buf3 = buf2;
-    buf2 = buf1;
-    buf1 = buf3;
+    float *buf2 = ((max_scale - 1 - scale) & 1) ? tmp : (float *)o;
+    decompose(buf2, buf1, accum, scale, sharp[scale], thrs[scale], boost[scale], scale == 0,
+              scale == max_scale - 1, width, height);
+    buf1 = buf2;
   }
-  /* due to symmetric processing, output will be left in (float *)o */
 
-  for(int k = 0; k < max_scale; k++) dt_free_align(detail[k]);
+  dt_free_align(accum);
   dt_free_align(tmp);
 
   if(piece->pipe->mask_display & DT_DEV_PIXELPIPE_DISPLAY_MASK) dt_iop_alpha_copy(i, o, width, height);
-
-  return;
-
-error:
-  for(int k = 0; k < max_scale; k++)
-    if(detail[k] != NULL) dt_free_align(detail[k]);
-  if(tmp != NULL) dt_free_align(tmp);
-  return;
 }
 
 void process(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece, const void *const i,
              void *const o, const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
 {
-  process_wavelets(self, piece, i, o, roi_in, roi_out, eaw_decompose, eaw_synthesize);
+  process_wavelets(self, piece, i, o, roi_in, roi_out, eaw_decompose);
 }
 
 #if defined(__SSE2__)
 void process_sse2(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece, const void *const i,
                   void *const o, const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
 {
-  process_wavelets(self, piece, i, o, roi_in, roi_out, eaw_decompose_sse2, eaw_synthesize_sse2);
+  process_wavelets(self, piece, i, o, roi_in, roi_out, eaw_decompose_sse2);
 }
 #endif
 
@@ -788,7 +736,20 @@ int process_cl(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, cl_m
   cl_int err = -999;
   cl_mem dev_filter = NULL;
   cl_mem dev_tmp = NULL;
-  cl_mem *dev_detail = calloc(max_scale, sizeof(cl_mem));
+  cl_mem dev_accum[2] = { NULL, NULL };
+
+  const int width = roi_out->width;
+  const int height = roi_out->height;
+  size_t sizes[] = { ROUNDUPWD(width), ROUNDUPHT(height), 1 };
+  size_t origin[] = { 0, 0, 0 };
+  size_t region[] = { width, height, 1 };
+
+  if(max_scale == 0)
+  {
+    err = dt_opencl_enqueue_copy_image(devid, dev_in, dev_out, origin, origin, region);
+    if(err != CL_SUCCESS) goto error;
+    return TRUE;
+  }
 
   float m[] = { 0.0625f, 0.25f, 0.375f, 0.25f, 0.0625f }; // 1/16, 4/16, 6/16, 4/16, 1/16
   float mm[5][5];
@@ -803,81 +764,47 @@ int process_cl(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, cl_m
   dev_tmp = dt_opencl_alloc_device(devid, roi_out->width, roi_out->height, 4 * sizeof(float));
   if(dev_tmp == NULL) goto error;
 
-  /* allocate space to store detail information. Requires a number of additional buffers, each with full image
-   * size */
-  for(int k = 0; k < max_scale; k++)
+  /* the details are synthesized in the same pass that decomposes them, so instead of one buffer per scale only
+   * their running sum is kept. an image can't be read and written by the same kernel, so two of them take
+   * turns. with a single scale none is needed, the kernel doesn't touch them then. */
+  if(max_scale > 1)
   {
-    dev_detail[k] = dt_opencl_alloc_device(devid, roi_out->width, roi_out->height, 4 * sizeof(float));
-    if(dev_detail[k] == NULL) goto error;
+    for(int k = 0; k < 2; k++)
+    {
+      dev_accum[k] = dt_opencl_alloc_device(devid, roi_out->width, roi_out->height, 4 * sizeof(float));
+      if(dev_accum[k] == NULL) goto error;
+    }
   }
 
-  const int width = roi_out->width;
-  const int height = roi_out->height;
-  size_t sizes[] = { ROUNDUPWD(width), ROUNDUPHT(height), 1 };
-  size_t origin[] = { 0, 0, 0 };
-  size_t region[] = { width, height, 1 };
-
-  // copy original input from dev_in -> dev_out as starting point
-  err = dt_opencl_enqueue_copy_image(devid, dev_in, dev_out, origin, origin, region);
-  if(err != CL_SUCCESS) goto error;
-
-  /* decompose image into detail scales and coarse (the latter is left in dev_tmp or dev_out) */
+  /* decompose and synthesize one scale per pass, the first reads dev_in and the last leaves the result in
+   * dev_out */
+  cl_mem dev_src = dev_in;
   for(int s = 0; s < max_scale; s++)
   {
     const int scale = s;
-
-    if(s & 1)
-    {
-      dt_opencl_set_kernel_arg(devid, gd->kernel_decompose, 0, sizeof(cl_mem), (void *)&dev_tmp);
-      dt_opencl_set_kernel_arg(devid, gd->kernel_decompose, 1, sizeof(cl_mem), (void *)&dev_out);
-    }
-    else
-    {
-      dt_opencl_set_kernel_arg(devid, gd->kernel_decompose, 0, sizeof(cl_mem), (void *)&dev_out);
-      dt_opencl_set_kernel_arg(devid, gd->kernel_decompose, 1, sizeof(cl_mem), (void *)&dev_tmp);
-    }
-    dt_opencl_set_kernel_arg(devid, gd->kernel_decompose, 2, sizeof(cl_mem), (void *)&dev_detail[s]);
-    dt_opencl_set_kernel_arg(devid, gd->kernel_decompose, 3, sizeof(int), (void *)&width);
-    dt_opencl_set_kernel_arg(devid, gd->kernel_decompose, 4, sizeof(int), (void *)&height);
-    dt_opencl_set_kernel_arg(devid, gd->kernel_decompose, 5, sizeof(unsigned int), (void *)&scale);
-    dt_opencl_set_kernel_arg(devid, gd->kernel_decompose, 6, sizeof(float), (void *)&sharp[s]);
-    dt_opencl_set_kernel_arg(devid, gd->kernel_decompose, 7, sizeof(cl_mem), (void *)&dev_filter);
+    const int first = (s == 0);
+    const int last = (s == max_scale - 1);
+    cl_mem dev_coarse = ((max_scale - 1 - s) & 1) ? dev_tmp : dev_out;
+    cl_mem dev_acc_in = max_scale > 1 ? dev_accum[(s + 1) & 1] : dev_in;
+    cl_mem dev_acc_out = max_scale > 1 ? dev_accum[s & 1] : dev_tmp;
+
+    dt_opencl_set_kernel_arg(devid, gd->kernel_decompose, 0, sizeof(cl_mem), (void *)&dev_src);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_decompose, 1, sizeof(cl_mem), (void *)&dev_coarse);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_decompose, 2, sizeof(cl_mem), (void *)&dev_acc_in);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_decompose, 3, sizeof(cl_mem), (void *)&dev_acc_out);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_decompose, 4, sizeof(int), (void *)&width);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_decompose, 5, sizeof(int), (void *)&height);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_decompose, 6, sizeof(unsigned int), (void *)&scale);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_decompose, 7, sizeof(float), (void *)&sharp[s]);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_decompose, 8, sizeof(cl_mem), (void *)&dev_filter);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_decompose, 9, 4 * sizeof(float), (void *)thrs[s]);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_decompose, 10, 4 * sizeof(float), (void *)boost[s]);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_decompose, 11, sizeof(int), (void *)&first);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_decompose, 12, sizeof(int), (void *)&last);
 
     err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_decompose, sizes);
     if(err != CL_SUCCESS) goto error;
-
-    // indirectly give gpu some air to breathe (and to do display related stuff)
-    dt_iop_nap(darktable.opencl->micro_nap);
-  }
-
-  /* now synthesize again */
-  for(int scale = max_scale - 1; scale >= 0; scale--)
-  {
-    if(scale & 1)
-    {
-      dt_opencl_set_kernel_arg(devid, gd->kernel_synthesize, 0, sizeof(cl_mem), (void *)&dev_tmp);
-      dt_opencl_set_kernel_arg(devid, gd->kernel_synthesize, 1, sizeof(cl_mem), (void *)&dev_out);
-    }
-    else
-    {
-      dt_opencl_set_kernel_arg(devid, gd->kernel_synthesize, 0, sizeof(cl_mem), (void *)&dev_out);
-      dt_opencl_set_kernel_arg(devid, gd->kernel_synthesize, 1, sizeof(cl_mem), (void *)&dev_tmp);
-    }
-
-    dt_opencl_set_kernel_arg(devid, gd->kernel_synthesize, 2, sizeof(cl_mem), (void *)&dev_detail[scale]);
-    dt_opencl_set_kernel_arg(devid, gd->kernel_synthesize, 3, sizeof(int), (void *)&width);
-    dt_opencl_set_kernel_arg(devid, gd->kernel_synthesize, 4, sizeof(int), (void *)&height);
-    dt_opencl_set_kernel_arg(devid, gd->kernel_synthesize, 5, sizeof(float), (void *)&thrs[scale][0]);
-    dt_opencl_set_kernel_arg(devid, gd->kernel_synthesize, 6, sizeof(float), (void *)&thrs[scale][1]);
-    dt_opencl_set_kernel_arg(devid, gd->kernel_synthesize, 7, sizeof(float), (void *)&thrs[scale][2]);
-    dt_opencl_set_kernel_arg(devid, gd->kernel_synthesize, 8, sizeof(float), (void *)&thrs[scale][3]);
-    dt_opencl_set_kernel_arg(devid, gd->kernel_synthesize, 9, sizeof(float), (void *)&boost[scale][0]);
-    dt_opencl_set_kernel_arg(devid, gd->kernel_synthesize, 10, sizeof(float), (void *)&boost[scale][1]);
-    dt_opencl_set_kernel_arg(devid, gd->kernel_synthesize, 11, sizeof(float), (void *)&boost[scale][2]);
-    dt_opencl_set_kernel_arg(devid, gd->kernel_synthesize, 12, sizeof(float), (void *)&boost[scale][3]);
-
-    err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_synthesize, sizes);
-    if(err != CL_SUCCESS) goto error;
+    dev_src = dev_coarse;
 
     // indirectly give gpu some air to breathe (and to do display related stuff)
     dt_iop_nap(darktable.opencl->micro_nap);
@@ -888,17 +815,13 @@ int process_cl(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, cl_m
 
   dt_opencl_release_mem_object(dev_filter);
   dt_opencl_release_mem_object(dev_tmp);
-  for(int k = 0; k < max_scale; k++)
-    dt_opencl_release_mem_object(dev_detail[k]);
-  free(dev_detail);
+  for(int k = 0; k < 2; k++) dt_opencl_release_mem_object(dev_accum[k]);
   return TRUE;
 
 error:
   dt_opencl_release_mem_object(dev_filter);
   dt_opencl_release_mem_object(dev_tmp);
-  for(int k = 0; k < max_scale; k++)
-    dt_opencl_release_mem_object(dev_detail[k]);
-  free(dev_detail);
+  for(int k = 0; k < 2; k++) dt_opencl_release_mem_object(dev_accum[k]);
   dt_print(DT_DEBUG_OPENCL, "[opencl_atrous] couldn't enqueue kernel! %d\n", err);
   return FALSE;
 }
@@ -915,7 +838,7 @@ void tiling_callback(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t
   const int max_scale = get_scales(thrs, boost, sharp, d, roi_in, piece);
   const int max_filter_radius = (1 << max_scale); // 2 * 2^max_scale
 
-  tiling->factor = 3.0f + max_scale; // in + out + tmp + scale buffers
+  tiling->factor = 3.0f + MIN(max_scale, 2); // in + out + tmp + detail sums
   tiling->maxbuf = 1.0f;
   tiling->overhead = 0;
   tiling->overlap = max_filter_radius;
@@ -951,8 +874,7 @@ void init_global(dt_iop_module_so_t *module)
   dt_iop_atrous_global_data_t *gd
       = (dt_iop_atrous_global_data_t *)malloc(sizeof(dt_iop_atrous_global_data_t));
   module->data = gd;
-  gd->kernel_decompose = dt_opencl_create_kernel(program, "eaw_decompose");
-  gd->kernel_synthesize = dt_opencl_create_kernel(program, "eaw_synthesize");
+  gd->kernel_decompose = dt_opencl_create_kernel(program, "eaw_decompose_synthesize");
 }
 
 void cleanup(dt_iop_module_t *module)
@@ -965,7 +887,6 @@ void cleanup_global(dt_iop_module_so_t *module)
 {
   dt_iop_atrous_global_data_t *gd = (dt_iop_atrous_global_data_t *)module->data;
   dt_opencl_free_kernel(gd->kernel_decompose);
-  dt_opencl_free_kernel(gd->kernel_synthesize);
   free(module->data);
   module->data = NULL;
 }
@@ -469,29 +469,31 @@ int process_cl_fusion(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piec
   const int height = roi_in->height;
   const int rad = MIN(width, ceilf(256 * roi_in->scale / piece->iscale));
 
-  cl_mem *dev_col = calloc(num_levels_max, sizeof(cl_mem));
   cl_mem *dev_comb = calloc(num_levels_max, sizeof(cl_mem));
 
-  cl_mem dev_tmp1 = NULL;
-  cl_mem dev_tmp2 = NULL;
+  // as on the cpu the gaussian pyramid of an exposure is blended into dev_comb[] level by level, two buffers
+  // take turns on the even and the odd levels. dev_out is free until the very end and serves as the second
+  // temporary buffer.
+  cl_mem dev_col[2] = { NULL, NULL };
+  cl_mem dev_tmp = NULL;
   cl_mem dev_m = NULL;
   cl_mem dev_coeffs = NULL;
 
   int num_levels = num_levels_max;
 
-  dev_tmp1 = dt_opencl_alloc_device(devid, width, height, 4 * sizeof(float));
-  if(dev_tmp1 == NULL) goto error;
+  dev_tmp = dt_opencl_alloc_device(devid, width, height, 4 * sizeof(float));
+  if(dev_tmp == NULL) goto error;
 
-  dev_tmp2 = dt_opencl_alloc_device(devid, width, height, 4 * sizeof(float));
-  if(dev_tmp2 == NULL) goto error;
+  dev_col[0] = dt_opencl_alloc_device(devid, width, height, 4 * sizeof(float));
+  if(dev_col[0] == NULL) goto error;
+
+  dev_col[1] = dt_opencl_alloc_device(devid, (width - 1) / 2 + 1, (height - 1) / 2 + 1, 4 * sizeof(float));
+  if(dev_col[1] == NULL) goto error;
 
   // allocate buffers for wavelet transform and blending
   for(int k = 0, step = 1, w = width, h = height; k < num_levels; k++)
   {
     // coarsest step is some % of image width.
-    dev_col[k]  = dt_opencl_alloc_device(devid, w, h, 4 * sizeof(float));
-    if(dev_col[k] == NULL) goto error;
-
     dev_comb[k] = dt_opencl_alloc_device(devid, w, h, 4 * sizeof(float));
     if(dev_comb[k] == NULL) goto error;
 
@@ -529,7 +531,7 @@ int process_cl_fusion(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piec
 
       size_t sizes[] = { ROUNDUPWD(width), ROUNDUPHT(height), 1 };
       dt_opencl_set_kernel_arg(devid, gd->kernel_basecurve_ev_lut, 0, sizeof(cl_mem), (void *)&dev_in);
-      dt_opencl_set_kernel_arg(devid, gd->kernel_basecurve_ev_lut, 1, sizeof(cl_mem), (void *)&dev_tmp1);
+      dt_opencl_set_kernel_arg(devid, gd->kernel_basecurve_ev_lut, 1, sizeof(cl_mem), (void *)&dev_tmp);
       dt_opencl_set_kernel_arg(devid, gd->kernel_basecurve_ev_lut, 2, sizeof(int), (void *)&width);
       dt_opencl_set_kernel_arg(devid, gd->kernel_basecurve_ev_lut, 3, sizeof(int), (void *)&height);
       dt_opencl_set_kernel_arg(devid, gd->kernel_basecurve_ev_lut, 4, sizeof(float), (void *)&ev);
@@ -538,7 +540,7 @@ int process_cl_fusion(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piec
       err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_basecurve_ev_lut, sizes);
       if(err != CL_SUCCESS) goto error;
 
-      dt_opencl_set_kernel_arg(devid, gd->kernel_basecurve_compute_features, 0, sizeof(cl_mem), (void *)&dev_tmp1);
+      dt_opencl_set_kernel_arg(devid, gd->kernel_basecurve_compute_features, 0, sizeof(cl_mem), (void *)&dev_tmp);
       dt_opencl_set_kernel_arg(devid, gd->kernel_basecurve_compute_features, 1, sizeof(cl_mem), (void *)&dev_col[0]);
       dt_opencl_set_kernel_arg(devid, gd->kernel_basecurve_compute_features, 2, sizeof(int), (void *)&width);
       dt_opencl_set_kernel_arg(devid, gd->kernel_basecurve_compute_features, 3, sizeof(int), (void *)&height);
@@ -546,8 +548,8 @@ int process_cl_fusion(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piec
       if(err != CL_SUCCESS) goto error;
     } while(0);
 
-    // create gaussian pyramid of color buffer
-    if(!gauss_reduce_cl(self, piece, dev_col[0], dev_col[1], dev_out, dev_tmp1, dev_tmp2, width, height))
+    // local contrast from the finest laplacian, dev_out doubles as scratch of the blur before it holds it
+    if(!gauss_reduce_cl(self, piece, dev_col[0], dev_col[1], dev_out, dev_tmp, dev_out, width, height))
       goto error;
 
     // adjust features
@@ -556,7 +558,7 @@ int process_cl_fusion(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piec
       size_t sizes[] = { ROUNDUPWD(width), ROUNDUPHT(height), 1 };
       dt_opencl_set_kernel_arg(devid, gd->kernel_basecurve_adjust_features, 0, sizeof(cl_mem), (void *)&dev_col[0]);
       dt_opencl_set_kernel_arg(devid, gd->kernel_basecurve_adjust_features, 1, sizeof(cl_mem), (void *)&dev_out);
-      dt_opencl_set_kernel_arg(devid, gd->kernel_basecurve_adjust_features, 2, sizeof(cl_mem), (void *)&dev_tmp1);
+      dt_opencl_set_kernel_arg(devid, gd->kernel_basecurve_adjust_features, 2, sizeof(cl_mem), (void *)&dev_tmp);
       dt_opencl_set_kernel_arg(devid, gd->kernel_basecurve_adjust_features, 3, sizeof(int), (void *)&width);
       dt_opencl_set_kernel_arg(devid, gd->kernel_basecurve_adjust_features, 4, sizeof(int), (void *)&height);
       err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_basecurve_adjust_features, sizes);
@@ -564,73 +566,56 @@ int process_cl_fusion(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piec
 
       size_t origin[] = { 0, 0, 0 };
       size_t region[] = { width, height, 1 };
-      err = dt_opencl_enqueue_copy_image(devid, dev_tmp1, dev_col[0], origin, origin, region);
+      err = dt_opencl_enqueue_copy_image(devid, dev_tmp, dev_col[0], origin, origin, region);
       if(err != CL_SUCCESS) goto error;
     } while(0);
 
-
-    for(int k = 1, w = width, h = height; k < num_levels; k++)
+    // create gaussian pyramid of color buffer and update output pyramid, fine to coarse
+    for(int k = 0, w = width, h = height; k < num_levels; k++)
     {
-      if(!gauss_reduce_cl(self, piece, dev_col[k-1], dev_col[k], NULL, dev_tmp1, dev_tmp2, w, h))
-        goto error;
-
-      w = (w - 1) / 2 + 1;
-      h = (h - 1) / 2 + 1;
-    }
-
-    // update pyramid coarse to fine
-    for(int k = num_levels - 1; k >= 0; k--)
-    {
-      int w = width;
-      int h = height;
-
-      for(int i = 0; i < k; i++)
-      {
-        w = (w - 1) / 2 + 1;
-        h = (h - 1) / 2 + 1;
-      }
+      cl_mem dev_cur = dev_col[k & 1];
+      cl_mem dev_next = dev_col[(k + 1) & 1];
 
-      // dev_col[k+1] -> dev_tmp2[k]
-      if(k != num_levels - 1)
-        if(!gauss_expand_cl(self, piece, dev_col[k+1], dev_tmp2, dev_tmp1, w, h))
-          goto error;
+      size_t sizes[] = { ROUNDUPWD(w), ROUNDUPHT(h), 1 };
+      size_t origin[] = { 0, 0, 0 };
+      size_t region[] = { w, h, 1 };
 
       // blend images into output pyramid
       if(k == num_levels - 1)
       {
         // blend gaussian base
-        size_t sizes[] = { ROUNDUPWD(w), ROUNDUPHT(h), 1 };
         dt_opencl_set_kernel_arg(devid, gd->kernel_basecurve_blend_gaussian, 0, sizeof(cl_mem), (void *)&dev_comb[k]);
-        dt_opencl_set_kernel_arg(devid, gd->kernel_basecurve_blend_gaussian, 1, sizeof(cl_mem), (void *)&dev_col[k]);
-        dt_opencl_set_kernel_arg(devid, gd->kernel_basecurve_blend_gaussian, 2, sizeof(cl_mem), (void *)&dev_tmp1);
+        dt_opencl_set_kernel_arg(devid, gd->kernel_basecurve_blend_gaussian, 1, sizeof(cl_mem), (void *)&dev_cur);
+        dt_opencl_set_kernel_arg(devid, gd->kernel_basecurve_blend_gaussian, 2, sizeof(cl_mem), (void *)&dev_tmp);
         dt_opencl_set_kernel_arg(devid, gd->kernel_basecurve_blend_gaussian, 3, sizeof(int), (void *)&w);
         dt_opencl_set_kernel_arg(devid, gd->kernel_basecurve_blend_gaussian, 4, sizeof(int), (void *)&h);
         err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_basecurve_blend_gaussian, sizes);
         if(err != CL_SUCCESS) goto error;
-
-        size_t origin[] = { 0, 0, 0 };
-        size_t region[] = { w, h, 1 };
-        err = dt_opencl_enqueue_copy_image(devid, dev_tmp1, dev_comb[k], origin, origin, region);
-        if(err != CL_SUCCESS) goto error;
       }
       else
       {
+        // dev_cur -> dev_next -> dev_out
+        if(!gauss_reduce_cl(self, piece, dev_cur, dev_next, NULL, dev_tmp, dev_out, w, h))
+          goto error;
+        if(!gauss_expand_cl(self, piece, dev_next, dev_out, dev_tmp, w, h))
+          goto error;
+
         // blend laplacian
-        size_t sizes[] = { ROUNDUPWD(w), ROUNDUPHT(h), 1 };
         dt_opencl_set_kernel_arg(devid, gd->kernel_basecurve_blend_laplacian, 0, sizeof(cl_mem), (void *)&dev_comb[k]);
-        dt_opencl_set_kernel_arg(devid, gd->kernel_basecurve_blend_laplacian, 1, sizeof(cl_mem), (void *)&dev_col[k]);
-        dt_opencl_set_kernel_arg(devid, gd->kernel_basecurve_blend_laplacian, 2, sizeof(cl_mem), (void *)&dev_tmp2);
-        dt_opencl_set_kernel_arg(devid, gd->kernel_basecurve_blend_laplacian, 3, sizeof(cl_mem), (void *)&dev_tmp1);
+        dt_opencl_set_kernel_arg(devid, gd->kernel_basecurve_blend_laplacian, 1, sizeof(cl_mem), (void *)&dev_cur);
+        dt_opencl_set_kernel_arg(devid, gd->kernel_basecurve_blend_laplacian, 2, sizeof(cl_mem), (void *)&dev_out);
+        dt_opencl_set_kernel_arg(devid, gd->kernel_basecurve_blend_laplacian, 3, sizeof(cl_mem), (void *)&dev_tmp);
         dt_opencl_set_kernel_arg(devid, gd->kernel_basecurve_blend_laplacian, 4, sizeof(int), (void *)&w);
         dt_opencl_set_kernel_arg(devid, gd->kernel_basecurve_blend_laplacian, 5, sizeof(int), (void *)&h);
         err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_basecurve_blend_laplacian, sizes);
         if(err != CL_SUCCESS) goto error;
-
-        size_t origin[] = { 0, 0, 0 };
-        size_t region[] = { w, h, 1 };
-        err = dt_opencl_enqueue_copy_image(devid, dev_tmp1, dev_comb[k], origin, origin, region);
-        if(err != CL_SUCCESS) goto error;
       }
+
+      err = dt_opencl_enqueue_copy_image(devid, dev_tmp, dev_comb[k], origin, origin, region);
+      if(err != CL_SUCCESS) goto error;
+
+      w = (w - 1) / 2 + 1;
+      h = (h - 1) / 2 + 1;
     }
   }
 
@@ -651,16 +636,16 @@ int process_cl_fusion(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piec
       // normalize both gaussian base and laplacian
       size_t sizes[] = { ROUNDUPWD(w), ROUNDUPHT(h), 1 };
       dt_opencl_set_kernel_arg(devid, gd->kernel_basecurve_normalize, 0, sizeof(cl_mem), (void *)&dev_comb[k]);
-      dt_opencl_set_kernel_arg(devid, gd->kernel_basecurve_normalize, 1, sizeof(cl_mem), (void *)&dev_tmp1);
+      dt_opencl_set_kernel_arg(devid, gd->kernel_basecurve_normalize, 1, sizeof(cl_mem), (void *)&dev_tmp);
       dt_opencl_set_kernel_arg(devid, gd->kernel_basecurve_normalize, 2, sizeof(int), (void *)&w);
       dt_opencl_set_kernel_arg(devid, gd->kernel_basecurve_normalize, 3, sizeof(int), (void *)&h);
       err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_basecurve_normalize, sizes);
       if(err != CL_SUCCESS) goto error;
 
-      // dev_tmp1[k] -> dev_comb[k]
+      // dev_tmp[k] -> dev_comb[k]
       size_t origin[] = { 0, 0, 0 };
       size_t region[] = { w, h, 1 };
-      err = dt_opencl_enqueue_copy_image(devid, dev_tmp1, dev_comb[k], origin, origin, region);
+      err = dt_opencl_enqueue_copy_image(devid, dev_tmp, dev_comb[k], origin, origin, region);
       if(err != CL_SUCCESS) goto error;
     } while(0);
 
@@ -669,24 +654,24 @@ int process_cl_fusion(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piec
     {
       // reconstruct output image
 
-      // dev_comb[k+1] -> dev_tmp1
-      if(!gauss_expand_cl(self, piece, dev_comb[k+1], dev_tmp1, dev_tmp2, w, h))
+      // dev_comb[k+1] -> dev_tmp
+      if(!gauss_expand_cl(self, piece, dev_comb[k+1], dev_tmp, dev_out, w, h))
         goto error;
 
-      // dev_comb[k] + dev_tmp1 -> dev_tmp2
+      // dev_comb[k] + dev_tmp -> dev_out
       size_t sizes[] = { ROUNDUPWD(w), ROUNDUPHT(h), 1 };
       dt_opencl_set_kernel_arg(devid, gd->kernel_basecurve_reconstruct, 0, sizeof(cl_mem), (void *)&dev_comb[k]);
-      dt_opencl_set_kernel_arg(devid, gd->kernel_basecurve_reconstruct, 1, sizeof(cl_mem), (void *)&dev_tmp1);
-      dt_opencl_set_kernel_arg(devid, gd->kernel_basecurve_reconstruct, 2, sizeof(cl_mem), (void *)&dev_tmp2);
+      dt_opencl_set_kernel_arg(devid, gd->kernel_basecurve_reconstruct, 1, sizeof(cl_mem), (void *)&dev_tmp);
+      dt_opencl_set_kernel_arg(devid, gd->kernel_basecurve_reconstruct, 2, sizeof(cl_mem), (void *)&dev_out);
       dt_opencl_set_kernel_arg(devid, gd->kernel_basecurve_reconstruct, 3, sizeof(int), (void *)&w);
       dt_opencl_set_kernel_arg(devid, gd->kernel_basecurve_reconstruct, 4, sizeof(int), (void *)&h);
       err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_basecurve_reconstruct, sizes);
       if(err != CL_SUCCESS) goto error;
 
-      // dev_tmp2 -> dev_comb[k]
+      // dev_out -> dev_comb[k]
       size_t origin[] = { 0, 0, 0 };
       size_t region[] = { w, h, 1 };
-      err = dt_opencl_enqueue_copy_image(devid, dev_tmp2, dev_comb[k], origin, origin, region);
+      err = dt_opencl_enqueue_copy_image(devid, dev_out, dev_comb[k], origin, origin, region);
       if(err != CL_SUCCESS) goto error;
     }
   }
@@ -706,30 +691,24 @@ int process_cl_fusion(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piec
 
 
   for(int k = 0; k < num_levels_max; k++)
-  {
-    dt_opencl_release_mem_object(dev_col[k]);
     dt_opencl_release_mem_object(dev_comb[k]);
-  }
+  dt_opencl_release_mem_object(dev_col[0]);
+  dt_opencl_release_mem_object(dev_col[1]);
   dt_opencl_release_mem_object(dev_m);
   dt_opencl_release_mem_object(dev_coeffs);
-  dt_opencl_release_mem_object(dev_tmp1);
-  dt_opencl_release_mem_object(dev_tmp2);
+  dt_opencl_release_mem_object(dev_tmp);
   free(dev_comb);
-  free(dev_col);
   return TRUE;
 
 error:
   for(int k = 0; k < num_levels_max; k++)
-  {
-    dt_opencl_release_mem_object(dev_col[k]);
     dt_opencl_release_mem_object(dev_comb[k]);
-  }
+  dt_opencl_release_mem_object(dev_col[0]);
+  dt_opencl_release_mem_object(dev_col[1]);
   dt_opencl_release_mem_object(dev_m);
   dt_opencl_release_mem_object(dev_coeffs);
-  dt_opencl_release_mem_object(dev_tmp1);
-  dt_opencl_release_mem_object(dev_tmp2);
+  dt_opencl_release_mem_object(dev_tmp);
   free(dev_comb);
-  free(dev_col);
   dt_print(DT_DEBUG_OPENCL, "[opencl_basecurve_fusion] couldn't enqueue kernel! %d\n", err);
   return FALSE;
 }
@@ -796,7 +775,7 @@ void tiling_callback(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t
   {
     const int rad = MIN(roi_in->width, ceilf(256 * roi_in->scale / piece->iscale));
 
-    tiling->factor = 6.666f;                 // in + out + col[] + comb[] + 2*tmp
+    tiling->factor = 5.6f;                   // in + out + comb[] + two levels of col[] + tmp
     tiling->maxbuf = 1.0f;
     tiling->overhead = 0;
     tiling->xalign = 1;
@@ -875,71 +854,51 @@ static inline void compute_features(
   }
 }
 
-static inline void gauss_blur(
-    const float *const input,
-    float *const output,
-    const size_t wd,
-    const size_t ht)
+// mirrored index into [0, n), as the blur kernels of basecurve.cl have it
+static inline int mirror(const int x, const int n)
 {
-  const float w[5] = {1./16., 4./16., 6./16., 4./16., 1./16.};
-  float *tmp = dt_alloc_align(64, (size_t)wd*ht*4*sizeof(float));
-  memset(tmp, 0, 4*wd*ht*sizeof(float));
-#ifdef _OPENMP
-#pragma omp parallel for default(none) schedule(static) shared(tmp)
-#endif
-  for(int j=0;j<ht;j++)
-  { // horizontal pass
-    // left borders
-    for(int i=0;i<2;i++) for(int c=0;c<4;c++)
-      for(int ii=-2;ii<=2;ii++)
-        tmp[4*(j*wd+i)+c] += input[4*(j*wd+MAX(-i-ii,i+ii))+c] * w[ii+2];
-    // most pixels
-    for(int i=2;i<wd-2;i++) for(int c=0;c<4;c++)
-      for(int ii=-2;ii<=2;ii++)
-        tmp[4*(j*wd+i)+c] += input[4*(j*wd+i+ii)+c] * w[ii+2];
-    // right borders
-    for(int i=wd-2;i<wd;i++) for(int c=0;c<4;c++)
-      for(int ii=-2;ii<=2;ii++)
-        tmp[4*(j*wd+i)+c] += input[4*(j*wd+MIN(i+ii, wd-(i+ii-wd+1) ))+c] * w[ii+2];
-  }
-  memset(output, 0, 4*wd*ht*sizeof(float));
-#ifdef _OPENMP
-#pragma omp parallel for default(none) schedule(static) shared(tmp)
-#endif
-  for(int i=0;i<wd;i++)
-  { // vertical pass
-    for(int j=0;j<2;j++) for(int c=0;c<4;c++)
-      for(int jj=-2;jj<=2;jj++)
-        output[4*(j*wd+i)+c] += tmp[4*(MAX(-j-jj,j+jj)*wd+i)+c] * w[jj+2];
-    for(int j=2;j<ht-2;j++) for(int c=0;c<4;c++)
-      for(int jj=-2;jj<=2;jj++)
-        output[4*(j*wd+i)+c] += tmp[4*((j+jj)*wd+i)+c] * w[jj+2];
-    for(int j=ht-2;j<ht;j++) for(int c=0;c<4;c++)
-      for(int jj=-2;jj<=2;jj++)
-        output[4*(j*wd+i)+c] += tmp[4*(MIN(j+jj, ht-(j+jj-ht+1))*wd+i)+c] * w[jj+2];
-  }
-  dt_free_align(tmp);
+  return MIN(MAX(-x, x), n - (x - n + 1));
 }
 
 static inline void gauss_expand(
     const float *const input, // coarse input
     float *const fine,        // upsampled, blurry output
+    float *const tmp,         // scratch of 4 * wd * ((ht-1)/2+1) floats
     const size_t wd,          // fine res
     const size_t ht)
 {
-  const size_t cw = (wd-1)/2+1;
-  // fill numbers in even pixels, zero odd ones
-  memset(fine, 0, 4*wd*ht*sizeof(float));
+  const float w[5] = {1./16., 4./16., 6./16., 4./16., 1./16.};
+  const size_t cw = (wd-1)/2+1, ch = (ht-1)/2+1;
+  // upsample by filling in the even pixels and zeroing the odd ones, then convolve with the kernel weights
+  // mul by 4. the zeros are skipped, so the horizontal pass only runs over the even rows.
 #ifdef _OPENMP
-#pragma omp parallel for default(none) schedule(static) collapse(2)
+#pragma omp parallel for default(none) schedule(static)
 #endif
-  for(int j=0;j<ht;j+=2)
-    for(int i=0;i<wd;i+=2)
-      for(int c=0;c<4;c++)
-        fine[4*(j*wd+i)+c] = 4.0f * input[4*(j/2*cw + i/2)+c];
-
-  // convolve with same kernel weights mul by 4:
-  gauss_blur(fine, fine, wd, ht);
+  for(int j=0;j<ch;j++) for(int i=0;i<wd;i++)
+  {
+    float sum[4] = { 0.0f };
+    for(int ii=-2;ii<=2;ii++)
+    {
+      const int m = mirror(i+ii, wd);
+      if(m & 1) continue;
+      for(int c=0;c<4;c++) sum[c] += 4.0f * input[4*(j*cw+m/2)+c] * w[ii+2];
+    }
+    for(int c=0;c<4;c++) tmp[4*(j*wd+i)+c] = sum[c];
+  }
+#ifdef _OPENMP
+#pragma omp parallel for default(none) schedule(static)
+#endif
+  for(int j=0;j<ht;j++) for(int i=0;i<wd;i++)
+  {
+    float sum[4] = { 0.0f };
+    for(int jj=-2;jj<=2;jj++)
+    {
+      const int m = mirror(j+jj, ht);
+      if(m & 1) continue;
+      for(int c=0;c<4;c++) sum[c] += tmp[4*(m/2*wd+i)+c] * w[jj+2];
+    }
+    for(int c=0;c<4;c++) fine[4*(j*wd+i)+c] = sum[c];
+  }
 }
 
 // XXX FIXME: we'll need to pad up the image to get a good boundary condition!
@@ -950,23 +909,46 @@ static inline void gauss_reduce(
     const float *const input, // fine input buffer
     float *const coarse,      // coarse scale, blurred input buf
     float *const detail,      // detail/laplacian, fine scale, or 0
+    float *const tmp,         // scratch of 4 * max((wd-1)/2+1 * ht, wd * ((ht-1)/2+1)) floats
     const size_t wd,
     const size_t ht)
 {
-  // blur, store only coarse res
+  const float w[5] = {1./16., 4./16., 6./16., 4./16., 1./16.};
+  // blur, store only coarse res: the horizontal pass is done for the even columns, the vertical one for the
+  // even rows
   const size_t cw = (wd-1)/2+1, ch = (ht-1)/2+1;
-
-  float *blurred = dt_alloc_align(64, (size_t)wd*ht*4*sizeof(float));
-  gauss_blur(input, blurred, wd, ht);
-  for(size_t j=0;j<ch;j++) for(size_t i=0;i<cw;i++)
-    for(int c=0;c<4;c++) coarse[4*(j*cw+i)+c] = blurred[4*(2*j*wd+2*i)+c];
-  dt_free_align(blurred);
+#ifdef _OPENMP
+#pragma omp parallel for default(none) schedule(static)
+#endif
+  for(int j=0;j<ht;j++) for(int i=0;i<cw;i++)
+  {
+    float sum[4] = { 0.0f };
+    for(int ii=-2;ii<=2;ii++)
+    {
+      const int m = mirror(2*i+ii, wd);
+      for(int c=0;c<4;c++) sum[c] += input[4*(j*wd+m)+c] * w[ii+2];
+    }
+    for(int c=0;c<4;c++) tmp[4*(j*cw+i)+c] = sum[c];
+  }
+#ifdef _OPENMP
+#pragma omp parallel for default(none) schedule(static)
+#endif
+  for(int j=0;j<ch;j++) for(int i=0;i<cw;i++)
+  {
+    float sum[4] = { 0.0f };
+    for(int jj=-2;jj<=2;jj++)
+    {
+      const int m = mirror(2*j+jj, ht);
+      for(int c=0;c<4;c++) sum[c] += tmp[4*(m*cw+i)+c] * w[jj+2];
+    }
+    for(int c=0;c<4;c++) coarse[4*(j*cw+i)+c] = sum[c];
+  }
 
   if(detail)
   {
     // compute laplacian/details: expand coarse buffer into detail
     // buffer subtract expanded buffer from input in place
-    gauss_expand(coarse, detail, wd, ht);
+    gauss_expand(coarse, detail, tmp, wd, ht);
     for(size_t k=0;k<wd*ht*4;k++)
       detail[k] = input[k] - detail[k];
   }
@@ -986,7 +968,6 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
     // allocate temporary buffer for wavelet transform + blending
     const int wd = roi_in->width, ht = roi_in->height;
     int num_levels = 8;
-    float **col  = malloc(num_levels * sizeof(float*));
     float **comb = malloc(num_levels * sizeof(float*));
     int w = wd, h = ht;
     const int rad = MIN(wd, ceilf(256 * roi_in->scale / piece->iscale));
@@ -994,7 +975,6 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
     for(int k=0;k<num_levels;k++)
     {
       // coarsest step is some % of image width.
-      col[k]  = dt_alloc_align(64, sizeof(float)*4ul*w*h);
       comb[k] = dt_alloc_align(64, sizeof(float)*4ul*w*h);
       memset(comb[k], 0, sizeof(float)*4*w*h);
       w = (w-1)/2+1; h = (h-1)/2+1;
@@ -1006,6 +986,15 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
       }
     }
 
+    // the gaussian pyramid of an exposure is not kept, every level is blended into the output pyramid as soon
+    // as the next coarser one is there. so two buffers take turns on the levels, holding the even and the odd
+    // ones. the scratch of the reduce and expand passes is half the image.
+    const size_t cw = (wd-1)/2+1, ch = (ht-1)/2+1;
+    float *col[2];
+    col[0] = dt_alloc_align(64, sizeof(float)*4ul*wd*ht);
+    col[1] = dt_alloc_align(64, sizeof(float)*4ul*cw*ch);
+    float *const tmp = dt_alloc_align(64, sizeof(float)*4ul*MAX(cw*ht, wd*ch));
+
     for(int e=0;e<d->exposure_fusion+1;e++)
     { // for every exposure fusion image:
       // push by some ev, apply base curve:
@@ -1016,9 +1005,9 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
       // compute features
       compute_features(col[0], wd, ht);
 
-      // create gaussian pyramid of colour buffer
+      // local contrast from the finest laplacian
       w = wd; h = ht;
-      gauss_reduce(col[0], col[1], out, w, h);
+      gauss_reduce(col[0], col[1], out, tmp, w, h);
 #ifdef _OPENMP
 #pragma omp parallel for default(none) shared(col) schedule(static)
 #endif
@@ -1038,39 +1027,39 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
       continue;
 #endif
 
-      for(int k=1;k<num_levels;k++)
-      {
-        gauss_reduce(col[k-1], col[k], 0, w, h);
-        w = (w-1)/2+1; h = (h-1)/2+1;
-      }
-
-      // update pyramid coarse to fine
-      for(int k=num_levels-1;k>=0;k--)
+      // create gaussian pyramid of colour buffer and update output pyramid, fine to coarse
+      for(int k=0;k<num_levels;k++)
       {
-        w = wd; h = ht;
-        for(int i=0;i<k;i++) { w = (w-1)/2+1; h = (h-1)/2+1; }
-        // abuse output buffer as temporary memory:
-        if(k!=num_levels-1)
-          gauss_expand(col[k+1], out, w, h);
+        const float *const cur = col[k&1];
+        float *const next = col[(k+1)&1];
+        float *const cmb = comb[k];
+        const int last = k == num_levels-1;
+        if(!last)
+        {
+          gauss_reduce(cur, next, 0, tmp, w, h);
+          // abuse output buffer as temporary memory:
+          gauss_expand(next, out, tmp, w, h);
+        }
 #ifdef _OPENMP
-#pragma omp parallel for default(none) shared(col,comb,w,h,num_levels,k) schedule(static)
+#pragma omp parallel for default(none) shared(w,h) schedule(static)
 #endif
         for(int j=0;j<h;j++) for(int i=0;i<w;i++)
         {
           const size_t x = 4ul*(w*j+i);
           // blend images into output pyramid
-          if(k == num_levels-1) // blend gaussian base
+          if(last) // blend gaussian base
 #ifdef DEBUG_VIS2
             ;
 #else
             for(int c=0;c<3;c++)
-              comb[k][x+c] += col[k][x+3] * col[k][x+c];
+              cmb[x+c] += cur[x+3] * cur[x+c];
 #endif
           else // laplacian
-            for(int c=0;c<3;c++) comb[k][x+c] +=
-              col[k][x+3] * (col[k][x+c] - out[x+c]);
-          comb[k][x+3] += col[k][x+3];
+            for(int c=0;c<3;c++) cmb[x+c] +=
+              cur[x+3] * (cur[x+c] - out[x+c]);
+          cmb[x+3] += cur[x+3];
         }
+        w = (w-1)/2+1; h = (h-1)/2+1;
       }
     }
 
@@ -1091,7 +1080,7 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
 
       if(k < num_levels-1)
       { // reconstruct output image
-        gauss_expand(comb[k+1], out, w, h);
+        gauss_expand(comb[k+1], out, tmp, w, h);
 #ifdef _OPENMP
 #pragma omp parallel for default(none) shared(comb,w,h,k) schedule(static)
 #endif
@@ -1118,11 +1107,10 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
 
     // free temp buffers
     for(int k=0;k<num_levels;k++)
-    {
-      dt_free_align(col[k]);
       dt_free_align(comb[k]);
-    }
-    free(col);
+    dt_free_align(col[0]);
+    dt_free_align(col[1]);
+    dt_free_align(tmp);
     free(comb);
     return;
   }
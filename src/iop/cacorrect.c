@@ -19,6 +19,7 @@
 #include "config.h"
 #endif
 #include "common/darktable.h"
+#include "common/opencl.h"
 #include "develop/imageop.h"
 #include "develop/imageop_math.h"
 #include "gui/gtk.h"
@@ -48,6 +49,10 @@ typedef struct dt_iop_cacorrect_data_t
 
 typedef struct dt_iop_cacorrect_global_data_t
 {
+  int kernel_cacorrect_green;
+  int kernel_cacorrect_coeffs;
+  int kernel_cacorrect_blocks;
+  int kernel_cacorrect_apply;
 } dt_iop_cacorrect_global_data_t;
 
 // this returns a translatable name
@@ -64,7 +69,7 @@ int groups()
 
 int flags()
 {
-  return IOP_FLAGS_ONE_INSTANCE;
+  return IOP_FLAGS_ONE_INSTANCE | IOP_FLAGS_NO_TILE_STREAMING;
 }
 
 /** modify regions of interest (optional, per pixel ops don't need this) */
@@ -300,6 +305,271 @@ static inline void pixSort(float *a, float *b)
   }
 }
 
+// shift of one block from the sums of its pixels in coeff[vert/hor][k][colour], and its contribution to
+// the statistics over all blocks
+static void _ca_tile_shifts(const float coeff[2][3][2], float *const blockwt, float (*const blockshift)[2],
+                            float blockave[2][2], float blocksqave[2][2], float blockdenom[2][2])
+{
+  const float eps = 1e-5f, eps2 = 1e-10f; // tolerance to avoid dividing by zero
+
+  for(int c = 0; c < 2; c++)
+  {
+    for(int dir = 0; dir < 2; dir++)
+    { // vert/hor
+      float CAshift;
+
+      // CAshift are the locations
+      // that minimize colour difference variances;
+      // This is the approximate _optical_ location of the R/B pixels
+      if(coeff[dir][2][c] > eps2)
+      {
+        CAshift = coeff[dir][1][c] / coeff[dir][2][c];
+        *blockwt = coeff[dir][2][c] / (eps + coeff[dir][0][c]);
+      }
+      else
+      {
+        CAshift = 17.0;
+        *blockwt = 0;
+      }
+
+      // offset gives NW corner of square containing the min; dir : 0=vert, 1=hor
+      if(fabsf(CAshift) < 2.0f)
+      {
+        blockave[dir][c] += CAshift;
+        blocksqave[dir][c] += SQR(CAshift);
+        blockdenom[dir][c] += 1;
+      }
+      // evaluate the shifts to the location that minimizes CA within the tile
+      blockshift[c][dir] = CAshift; // vert/hor CA shift for R/B
+
+    } // vert/hor
+  }   // colour
+}
+
+// fits a polynomial in the block position to the shifts of all blocks, leaving out the outliers. returns FALSE if
+// there is not enough to go on. fitparams[c][dir][polyord * i + j] are the coefficients of vblock^i hblock^j.
+static gboolean _ca_fit_shifts(float *const blockwt, float (*const blockshifts)[2][2], const float blockave[2][2],
+                               const float blocksqave[2][2], const float blockdenom[2][2], const int vblsz,
+                               const int hblsz, const double caautostrength, double fitparams[2][2][16],
+                               int *const polyord_out)
+{
+  gboolean processpasstwo = TRUE;
+  float blockvar[2][2];
+  // order of 2d polynomial fit (polyord), and numpar=polyord^2
+  int polyord = 4, numpar = 16;
+
+  for(int dir = 0; dir < 2; dir++)
+    for(int c = 0; c < 2; c++)
+    {
+      if(blockdenom[dir][c])
+      {
+        blockvar[dir][c]
+            = blocksqave[dir][c] / blockdenom[dir][c] - SQR(blockave[dir][c] / blockdenom[dir][c]);
+      }
+      else
+      {
+        processpasstwo = FALSE;
+        printf("blockdenom vanishes \n");
+        break;
+      }
+    }
+
+  // %%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+
+  // now prepare for CA correction pass
+  // first, fill border blocks of blockshift array
+  if(processpasstwo)
+  {
+    for(int vblock = 1; vblock < vblsz - 1; vblock++)
+    { // left and right sides
+      for(int c = 0; c < 2; c++)
+      {
+        for(int i = 0; i < 2; i++)
+        {
+          blockshifts[vblock * hblsz][c][i] = blockshifts[(vblock)*hblsz + 2][c][i];
+          blockshifts[vblock * hblsz + hblsz - 1][c][i] = blockshifts[(vblock)*hblsz + hblsz - 3][c][i];
+        }
+      }
+    }
+
+    for(int hblock = 0; hblock < hblsz; hblock++)
+    { // top and bottom sides
+      for(int c = 0; c < 2; c++)
+      {
+        for(int i = 0; i < 2; i++)
+        {
+          blockshifts[hblock][c][i] = blockshifts[2 * hblsz + hblock][c][i];
+          blockshifts[(vblsz - 1) * hblsz + hblock][c][i]
+              = blockshifts[(vblsz - 3) * hblsz + hblock][c][i];
+        }
+      }
+    }
+
+    // end of filling border pixels of blockshift array
+
+    // initialize fit arrays
+    double polymat[2][2][256], shiftmat[2][2][16];
+
+    for(int i = 0; i < 256; i++)
+    {
+      polymat[0][0][i] = polymat[0][1][i] = polymat[1][0][i] = polymat[1][1][i] = 0;
+    }
+
+    for(int i = 0; i < 16; i++)
+    {
+      shiftmat[0][0][i] = shiftmat[0][1][i] = shiftmat[1][0][i] = shiftmat[1][1][i] = 0;
+    }
+
+    int numblox[2] = { 0, 0 };
+
+    for(int vblock = 1; vblock < vblsz - 1; vblock++)
+      for(int hblock = 1; hblock < hblsz - 1; hblock++)
+      {
+        // block 3x3 median of blockshifts for robustness
+        for(int c = 0; c < 2; c++)
+        {
+          float bstemp[2];
+          for(int dir = 0; dir < 2; dir++)
+          {
+            // temporary storage for median filter
+            float p[9];
+            p[0] = blockshifts[(vblock - 1) * hblsz + hblock - 1][c][dir];
+            p[1] = blockshifts[(vblock - 1) * hblsz + hblock][c][dir];
+            p[2] = blockshifts[(vblock - 1) * hblsz + hblock + 1][c][dir];
+            p[3] = blockshifts[(vblock)*hblsz + hblock - 1][c][dir];
+            p[4] = blockshifts[(vblock)*hblsz + hblock][c][dir];
+            p[5] = blockshifts[(vblock)*hblsz + hblock + 1][c][dir];
+            p[6] = blockshifts[(vblock + 1) * hblsz + hblock - 1][c][dir];
+            p[7] = blockshifts[(vblock + 1) * hblsz + hblock][c][dir];
+            p[8] = blockshifts[(vblock + 1) * hblsz + hblock + 1][c][dir];
+            pixSort(&p[1], &p[2]);
+            pixSort(&p[4], &p[5]);
+            pixSort(&p[7], &p[8]);
+            pixSort(&p[0], &p[1]);
+            pixSort(&p[3], &p[4]);
+            pixSort(&p[6], &p[7]);
+            pixSort(&p[1], &p[2]);
+            pixSort(&p[4], &p[5]);
+            pixSort(&p[7], &p[8]);
+            pixSort(&p[0], &p[3]);
+            pixSort(&p[5], &p[8]);
+            pixSort(&p[4], &p[7]);
+            pixSort(&p[3], &p[6]);
+            pixSort(&p[1], &p[4]);
+            pixSort(&p[2], &p[5]);
+            pixSort(&p[4], &p[7]);
+            pixSort(&p[4], &p[2]);
+            pixSort(&p[6], &p[4]);
+            pixSort(&p[4], &p[2]);
+            bstemp[dir] = p[4];
+          }
+
+          // now prepare coefficient matrix; use only data points within caautostrength/2 std devs of
+          // zero
+          if(SQR(bstemp[0]) > caautostrength * blockvar[0][c]
+             || SQR(bstemp[1]) > caautostrength * blockvar[1][c])
+          {
+            continue;
+          }
+
+          numblox[c]++;
+
+          for(int dir = 0; dir < 2; dir++)
+          {
+            double powVblockInit = 1.0;
+            for(int i = 0; i < polyord; i++)
+            {
+              double powHblockInit = 1.0;
+              for(int j = 0; j < polyord; j++)
+              {
+                double powVblock = powVblockInit;
+                for(int m = 0; m < polyord; m++)
+                {
+                  double powHblock = powHblockInit;
+                  for(int n = 0; n < polyord; n++)
+                  {
+                    polymat[c][dir][numpar * (polyord * i + j) + (polyord * m + n)]
+                        += powVblock * powHblock * blockwt[vblock * hblsz + hblock];
+                    powHblock *= hblock;
+                  }
+                  powVblock *= vblock;
+                }
+                shiftmat[c][dir][(polyord * i + j)]
+                    += powVblockInit * powHblockInit * bstemp[dir] * blockwt[vblock * hblsz + hblock];
+                powHblockInit *= hblock;
+              }
+              powVblockInit *= vblock;
+            } // monomials
+          }   // dir
+        }     // c
+      }       // blocks
+
+    numblox[1] = MIN(numblox[0], numblox[1]);
+
+    // if too few data points, restrict the order of the fit to linear
+    if(numblox[1] < 32)
+    {
+      polyord = 2;
+      numpar = 4;
+
+      if(numblox[1] < 10)
+      {
+
+        printf("numblox = %d \n", numblox[1]);
+        processpasstwo = FALSE;
+      }
+    }
+
+    if(processpasstwo)
+
+      // fit parameters to blockshifts
+      for(int c = 0; c < 2; c++)
+        for(int dir = 0; dir < 2; dir++)
+        {
+          if(!LinEqSolve(numpar, polymat[c][dir], shiftmat[c][dir], fitparams[c][dir]))
+          {
+            printf("CA correction pass failed -- can't solve linear equations for colour %d direction "
+                   "%d...\n",
+                   c, dir);
+            processpasstwo = FALSE;
+          }
+        }
+  }
+
+  // fitparams[polyord*i+j] gives the coefficients of (vblock^i hblock^j) in a polynomial fit for i,j<=4
+
+  *polyord_out = polyord;
+  return processpasstwo;
+}
+
+// evaluates the fit for one block, lblockshifts[colour][vert/hor]
+static void _ca_block_shifts(const double fitparams[2][2][16], const int polyord, const int vblock,
+                             const int hblock, float lblockshifts[2][2])
+{
+  lblockshifts[0][0] = lblockshifts[0][1] = 0;
+  lblockshifts[1][0] = lblockshifts[1][1] = 0;
+  double powVblock = 1.0;
+  for(int i = 0; i < polyord; i++)
+  {
+    double powHblock = powVblock;
+    for(int j = 0; j < polyord; j++)
+    {
+      // printf("i= %d j= %d polycoeff= %f \n",i,j,fitparams[0][0][polyord*i+j]);
+      lblockshifts[0][0] += powHblock * fitparams[0][0][polyord * i + j];
+      lblockshifts[0][1] += powHblock * fitparams[0][1][polyord * i + j];
+      lblockshifts[1][0] += powHblock * fitparams[1][0][polyord * i + j];
+      lblockshifts[1][1] += powHblock * fitparams[1][1][polyord * i + j];
+      powHblock *= hblock;
+    }
+    powVblock *= vblock;
+  }
+  const float bslim = 3.99; // max allowed CA shift
+  lblockshifts[0][0] = LIM(lblockshifts[0][0], -bslim, bslim);
+  lblockshifts[0][1] = LIM(lblockshifts[0][1], -bslim, bslim);
+  lblockshifts[1][0] = LIM(lblockshifts[1][0], -bslim, bslim);
+  lblockshifts[1][1] = LIM(lblockshifts[1][1], -bslim, bslim);
+}
+
 // void RawImageSource::CA_correct_RT(const double cared, const double cablue, const double caautostrength)
 static void CA_correct(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const float *const in2,
                        float *out, const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
@@ -345,7 +615,7 @@ static void CA_correct(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *pie
   float *RawDataTmp = (float *)malloc(height * width * sizeof(float) / 2 + 4);
 
   float blockave[2][2] = { { 0, 0 }, { 0, 0 } }, blocksqave[2][2] = { { 0, 0 }, { 0, 0 } },
-        blockdenom[2][2] = { { 0, 0 }, { 0, 0 } }, blockvar[2][2];
+        blockdenom[2][2] = { { 0, 0 }, { 0, 0 } };
 
   // Because we can't break parallel processing, we need a switch do handle the errors
   gboolean processpasstwo = TRUE;
@@ -366,10 +636,10 @@ static void CA_correct(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *pie
 
   double fitparams[2][2][16];
 
-  // order of 2d polynomial fit (polyord), and numpar=polyord^2
-  int polyord = 4, numpar = 16;
+  // order of 2d polynomial fit, set by _ca_fit_shifts()
+  int polyord = 4;
 
-  const float eps = 1e-5f, eps2 = 1e-10f; // tolerance to avoid dividing by zero
+  const float eps = 1e-5f; // tolerance to avoid dividing by zero
 
 #ifdef _OPENMP
 #pragma omp parallel
@@ -384,8 +654,6 @@ static void CA_correct(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *pie
 
     // local quadratic fit to shift data within a tile
     float coeff[2][3][2];
-    // measured CA shift parameters for a tile
-    float CAshift[2][2];
     // polynomial fit coefficients
     // residual CA shift amount within a plaquette
     float shifthfrac[3], shiftvfrac[3];
@@ -814,40 +1082,8 @@ static void CA_correct(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *pie
             }
           }
 
-          for(int c = 0; c < 2; c++)
-          {
-            for(int dir = 0; dir < 2; dir++)
-            { // vert/hor
-
-              // CAshift[dir][c] are the locations
-              // that minimize colour difference variances;
-              // This is the approximate _optical_ location of the R/B pixels
-              if(coeff[dir][2][c] > eps2)
-              {
-                CAshift[dir][c] = coeff[dir][1][c] / coeff[dir][2][c];
-                blockwt[vblock * hblsz + hblock] = coeff[dir][2][c] / (eps + coeff[dir][0][c]);
-              }
-              else
-              {
-                CAshift[dir][c] = 17.0;
-                blockwt[vblock * hblsz + hblock] = 0;
-              }
-
-              // data structure = CAshift[vert/hor][colour]
-              // dir : 0=vert, 1=hor
-
-              // offset gives NW corner of square containing the min; dir : 0=vert, 1=hor
-              if(fabsf(CAshift[dir][c]) < 2.0f)
-              {
-                blockavethr[dir][c] += CAshift[dir][c];
-                blocksqavethr[dir][c] += SQR(CAshift[dir][c]);
-                blockdenomthr[dir][c] += 1;
-              }
-              // evaluate the shifts to the location that minimizes CA within the tile
-              blockshifts[vblock * hblsz + hblock][c][dir] = CAshift[dir][c]; // vert/hor CA shift for R/B
-
-            } // vert/hor
-          }   // colour
+          _ca_tile_shifts(coeff, blockwt + vblock * hblsz + hblock, blockshifts[vblock * hblsz + hblock],
+                          blockavethr, blocksqavethr, blockdenomthr);
 
           //           if(plistener)
           //           {
@@ -889,185 +1125,8 @@ static void CA_correct(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *pie
 #pragma omp single
 #endif
       {
-        for(int dir = 0; dir < 2; dir++)
-          for(int c = 0; c < 2; c++)
-          {
-            if(blockdenom[dir][c])
-            {
-              blockvar[dir][c]
-                  = blocksqave[dir][c] / blockdenom[dir][c] - SQR(blockave[dir][c] / blockdenom[dir][c]);
-            }
-            else
-            {
-              processpasstwo = FALSE;
-              printf("blockdenom vanishes \n");
-              break;
-            }
-          }
-
-        // %%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
-
-        // now prepare for CA correction pass
-        // first, fill border blocks of blockshift array
-        if(processpasstwo)
-        {
-          for(int vblock = 1; vblock < vblsz - 1; vblock++)
-          { // left and right sides
-            for(int c = 0; c < 2; c++)
-            {
-              for(int i = 0; i < 2; i++)
-              {
-                blockshifts[vblock * hblsz][c][i] = blockshifts[(vblock)*hblsz + 2][c][i];
-                blockshifts[vblock * hblsz + hblsz - 1][c][i] = blockshifts[(vblock)*hblsz + hblsz - 3][c][i];
-              }
-            }
-          }
-
-          for(int hblock = 0; hblock < hblsz; hblock++)
-          { // top and bottom sides
-            for(int c = 0; c < 2; c++)
-            {
-              for(int i = 0; i < 2; i++)
-              {
-                blockshifts[hblock][c][i] = blockshifts[2 * hblsz + hblock][c][i];
-                blockshifts[(vblsz - 1) * hblsz + hblock][c][i]
-                    = blockshifts[(vblsz - 3) * hblsz + hblock][c][i];
-              }
-            }
-          }
-
-          // end of filling border pixels of blockshift array
-
-          // initialize fit arrays
-          double polymat[2][2][256], shiftmat[2][2][16];
-
-          for(int i = 0; i < 256; i++)
-          {
-            polymat[0][0][i] = polymat[0][1][i] = polymat[1][0][i] = polymat[1][1][i] = 0;
-          }
-
-          for(int i = 0; i < 16; i++)
-          {
-            shiftmat[0][0][i] = shiftmat[0][1][i] = shiftmat[1][0][i] = shiftmat[1][1][i] = 0;
-          }
-
-          int numblox[2] = { 0, 0 };
-
-          for(int vblock = 1; vblock < vblsz - 1; vblock++)
-            for(int hblock = 1; hblock < hblsz - 1; hblock++)
-            {
-              // block 3x3 median of blockshifts for robustness
-              for(int c = 0; c < 2; c++)
-              {
-                float bstemp[2];
-                for(int dir = 0; dir < 2; dir++)
-                {
-                  // temporary storage for median filter
-                  float p[9];
-                  p[0] = blockshifts[(vblock - 1) * hblsz + hblock - 1][c][dir];
-                  p[1] = blockshifts[(vblock - 1) * hblsz + hblock][c][dir];
-                  p[2] = blockshifts[(vblock - 1) * hblsz + hblock + 1][c][dir];
-                  p[3] = blockshifts[(vblock)*hblsz + hblock - 1][c][dir];
-                  p[4] = blockshifts[(vblock)*hblsz + hblock][c][dir];
-                  p[5] = blockshifts[(vblock)*hblsz + hblock + 1][c][dir];
-                  p[6] = blockshifts[(vblock + 1) * hblsz + hblock - 1][c][dir];
-                  p[7] = blockshifts[(vblock + 1) * hblsz + hblock][c][dir];
-                  p[8] = blockshifts[(vblock + 1) * hblsz + hblock + 1][c][dir];
-                  pixSort(&p[1], &p[2]);
-                  pixSort(&p[4], &p[5]);
-                  pixSort(&p[7], &p[8]);
-                  pixSort(&p[0], &p[1]);
-                  pixSort(&p[3], &p[4]);
-                  pixSort(&p[6], &p[7]);
-                  pixSort(&p[1], &p[2]);
-                  pixSort(&p[4], &p[5]);
-                  pixSort(&p[7], &p[8]);
-                  pixSort(&p[0], &p[3]);
-                  pixSort(&p[5], &p[8]);
-                  pixSort(&p[4], &p[7]);
-                  pixSort(&p[3], &p[6]);
-                  pixSort(&p[1], &p[4]);
-                  pixSort(&p[2], &p[5]);
-                  pixSort(&p[4], &p[7]);
-                  pixSort(&p[4], &p[2]);
-                  pixSort(&p[6], &p[4]);
-                  pixSort(&p[4], &p[2]);
-                  bstemp[dir] = p[4];
-                }
-
-                // now prepare coefficient matrix; use only data points within caautostrength/2 std devs of
-                // zero
-                if(SQR(bstemp[0]) > caautostrength * blockvar[0][c]
-                   || SQR(bstemp[1]) > caautostrength * blockvar[1][c])
-                {
-                  continue;
-                }
-
-                numblox[c]++;
-
-                for(int dir = 0; dir < 2; dir++)
-                {
-                  double powVblockInit = 1.0;
-                  for(int i = 0; i < polyord; i++)
-                  {
-                    double powHblockInit = 1.0;
-                    for(int j = 0; j < polyord; j++)
-                    {
-                      double powVblock = powVblockInit;
-                      for(int m = 0; m < polyord; m++)
-                      {
-                        double powHblock = powHblockInit;
-                        for(int n = 0; n < polyord; n++)
-                        {
-                          polymat[c][dir][numpar * (polyord * i + j) + (polyord * m + n)]
-                              += powVblock * powHblock * blockwt[vblock * hblsz + hblock];
-                          powHblock *= hblock;
-                        }
-                        powVblock *= vblock;
-                      }
-                      shiftmat[c][dir][(polyord * i + j)]
-                          += powVblockInit * powHblockInit * bstemp[dir] * blockwt[vblock * hblsz + hblock];
-                      powHblockInit *= hblock;
-                    }
-                    powVblockInit *= vblock;
-                  } // monomials
-                }   // dir
-              }     // c
-            }       // blocks
-
-          numblox[1] = MIN(numblox[0], numblox[1]);
-
-          // if too few data points, restrict the order of the fit to linear
-          if(numblox[1] < 32)
-          {
-            polyord = 2;
-            numpar = 4;
-
-            if(numblox[1] < 10)
-            {
-
-              printf("numblox = %d \n", numblox[1]);
-              processpasstwo = FALSE;
-            }
-          }
-
-          if(processpasstwo)
-
-            // fit parameters to blockshifts
-            for(int c = 0; c < 2; c++)
-              for(int dir = 0; dir < 2; dir++)
-              {
-                if(!LinEqSolve(numpar, polymat[c][dir], shiftmat[c][dir], fitparams[c][dir]))
-                {
-                  printf("CA correction pass failed -- can't solve linear equations for colour %d direction "
-                         "%d...\n",
-                         c, dir);
-                  processpasstwo = FALSE;
-                }
-              }
-        }
-
-        // fitparams[polyord*i+j] gives the coefficients of (vblock^i hblock^j) in a polynomial fit for i,j<=4
+        processpasstwo = _ca_fit_shifts(blockwt, blockshifts, blockave, blocksqave, blockdenom, vblsz, hblsz,
+                                        caautostrength, fitparams, &polyord);
       }
       // end of initialization for CA correction pass
       // only executed if cared and cablue are zero
@@ -1258,28 +1317,7 @@ static void CA_correct(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *pie
           else
           {
             // CA auto correction; use CA diagnostic pass to set shift parameters
-            lblockshifts[0][0] = lblockshifts[0][1] = 0;
-            lblockshifts[1][0] = lblockshifts[1][1] = 0;
-            double powVblock = 1.0;
-            for(int i = 0; i < polyord; i++)
-            {
-              double powHblock = powVblock;
-              for(int j = 0; j < polyord; j++)
-              {
-                // printf("i= %d j= %d polycoeff= %f \n",i,j,fitparams[0][0][polyord*i+j]);
-                lblockshifts[0][0] += powHblock * fitparams[0][0][polyord * i + j];
-                lblockshifts[0][1] += powHblock * fitparams[0][1][polyord * i + j];
-                lblockshifts[1][0] += powHblock * fitparams[1][0][polyord * i + j];
-                lblockshifts[1][1] += powHblock * fitparams[1][1][polyord * i + j];
-                powHblock *= hblock;
-              }
-              powVblock *= vblock;
-            }
-            const float bslim = 3.99; // max allowed CA shift
-            lblockshifts[0][0] = LIM(lblockshifts[0][0], -bslim, bslim);
-            lblockshifts[0][1] = LIM(lblockshifts[0][1], -bslim, bslim);
-            lblockshifts[1][0] = LIM(lblockshifts[1][0], -bslim, bslim);
-            lblockshifts[1][1] = LIM(lblockshifts[1][1], -bslim, bslim);
+            _ca_block_shifts(fitparams, polyord, vblock, hblock, lblockshifts);
           } // end of setting CA shift parameters
 
 
@@ -1485,6 +1523,186 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
   CA_correct(self, piece, (float *)i, (float *)o, roi_in, roi_out);
 }
 
+#ifdef HAVE_OPENCL
+int process_cl(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, cl_mem dev_in, cl_mem dev_out,
+               const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
+{
+  dt_iop_cacorrect_global_data_t *gd = (dt_iop_cacorrect_global_data_t *)self->data;
+
+  const int devid = piece->pipe->devid;
+  const int width = roi_in->width;
+  const int height = roi_in->height;
+  const uint32_t filters = piece->pipe->dsc.filters;
+
+  cl_mem dev_green = NULL;
+  cl_mem dev_rows = NULL;
+  cl_mem dev_blocks = NULL;
+  cl_mem dev_shifts = NULL;
+  float *blocks = NULL;
+  float *shifts = NULL;
+  char *buffer1 = NULL;
+  cl_int err = -999;
+
+  size_t origin[] = { 0, 0, 0 };
+  size_t region[] = { width, height, 1 };
+
+  // same as CA_correct(): only rgb colour filter arrays, and the (fitted) shifts of the 112 pixels inside of
+  // every cpu tile. the gpu blocks start at the image origin, block (i, j) is the tile (vblock j + 1,
+  // hblock i + 1) there.
+  gboolean rgb_cfa = TRUE;
+  for(int i = 0; i < 2; i++)
+    for(int j = 0; j < 2; j++)
+      if(FC(i, j, filters) == 3) rgb_cfa = FALSE;
+
+  const int ts = 128, border2 = 16;
+  const int blocks_h = (width + border2 / 2 + ts - border2 - 1) / (ts - border2);
+  const int blocks_v = (height + border2 / 2 + ts - border2 - 1) / (ts - border2);
+  const int vz1 = (height + border2) % (ts - border2) == 0 ? 1 : 0;
+  const int hz1 = (width + border2) % (ts - border2) == 0 ? 1 : 0;
+  const int vblsz = ceil((float)(height + border2) / (ts - border2) + 2 + vz1);
+  const int hblsz = ceil((float)(width + border2) / (ts - border2) + 2 + hz1);
+
+  if(!rgb_cfa)
+  {
+    err = dt_opencl_enqueue_copy_image(devid, dev_in, dev_out, origin, origin, region);
+    if(err != CL_SUCCESS) goto error;
+    return TRUE;
+  }
+
+  dev_green = dt_opencl_alloc_device(devid, width, height, sizeof(float));
+  if(dev_green == NULL) goto error;
+  dev_rows = dt_opencl_alloc_device_buffer(devid, sizeof(float) * 12 * blocks_h * height);
+  if(dev_rows == NULL) goto error;
+  dev_blocks = dt_opencl_alloc_device_buffer(devid, sizeof(float) * 12 * blocks_h * blocks_v);
+  if(dev_blocks == NULL) goto error;
+
+  size_t sizes[] = { ROUNDUPWD(width), ROUNDUPHT(height), 1 };
+  dt_opencl_set_kernel_arg(devid, gd->kernel_cacorrect_green, 0, sizeof(cl_mem), (void *)&dev_in);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_cacorrect_green, 1, sizeof(cl_mem), (void *)&dev_green);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_cacorrect_green, 2, sizeof(int), (void *)&width);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_cacorrect_green, 3, sizeof(int), (void *)&height);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_cacorrect_green, 4, sizeof(uint32_t), (void *)&filters);
+  err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_cacorrect_green, sizes);
+  if(err != CL_SUCCESS) goto error;
+
+  size_t sizes_rows[] = { ROUNDUPWD(blocks_h), ROUNDUPHT(height), 1 };
+  dt_opencl_set_kernel_arg(devid, gd->kernel_cacorrect_coeffs, 0, sizeof(cl_mem), (void *)&dev_in);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_cacorrect_coeffs, 1, sizeof(cl_mem), (void *)&dev_green);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_cacorrect_coeffs, 2, sizeof(cl_mem), (void *)&dev_rows);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_cacorrect_coeffs, 3, sizeof(int), (void *)&width);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_cacorrect_coeffs, 4, sizeof(int), (void *)&height);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_cacorrect_coeffs, 5, sizeof(uint32_t), (void *)&filters);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_cacorrect_coeffs, 6, sizeof(int), (void *)&blocks_h);
+  err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_cacorrect_coeffs, sizes_rows);
+  if(err != CL_SUCCESS) goto error;
+
+  size_t sizes_blocks[] = { ROUNDUPWD(blocks_h), ROUNDUPHT(blocks_v), 1 };
+  dt_opencl_set_kernel_arg(devid, gd->kernel_cacorrect_blocks, 0, sizeof(cl_mem), (void *)&dev_rows);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_cacorrect_blocks, 1, sizeof(cl_mem), (void *)&dev_blocks);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_cacorrect_blocks, 2, sizeof(int), (void *)&height);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_cacorrect_blocks, 3, sizeof(int), (void *)&blocks_h);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_cacorrect_blocks, 4, sizeof(int), (void *)&blocks_v);
+  err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_cacorrect_blocks, sizes_blocks);
+  if(err != CL_SUCCESS) goto error;
+
+  dt_opencl_release_mem_object(dev_rows);
+  dev_rows = NULL;
+
+  // the fit over all blocks is tiny and branchy, it runs here on the sums read back from the device
+  blocks = dt_alloc_align(64, sizeof(float) * 12 * blocks_h * blocks_v);
+  shifts = dt_alloc_align(64, sizeof(float) * 4 * blocks_h * blocks_v);
+  buffer1 = (char *)calloc(vblsz * hblsz * (2 * 2 + 1), sizeof(float));
+  if(blocks == NULL || shifts == NULL || buffer1 == NULL) goto error;
+
+  err = dt_opencl_read_buffer_from_device(devid, (void *)blocks, dev_blocks, 0,
+                                          sizeof(float) * 12 * blocks_h * blocks_v, CL_TRUE);
+  if(err != CL_SUCCESS) goto error;
+
+  float *blockwt = (float *)buffer1;
+  float(*blockshifts)[2][2] = (float(*)[2][2])(buffer1 + (vblsz * hblsz * sizeof(float)));
+  float blockave[2][2] = { { 0, 0 }, { 0, 0 } }, blocksqave[2][2] = { { 0, 0 }, { 0, 0 } },
+        blockdenom[2][2] = { { 0, 0 }, { 0, 0 } };
+  for(int j = 0; j < blocks_v; j++)
+    for(int i = 0; i < blocks_h; i++)
+    {
+      const int block = (j + 1) * hblsz + i + 1;
+      _ca_tile_shifts((const float(*)[3][2])(blocks + 12 * (j * blocks_h + i)), blockwt + block,
+                      blockshifts[block], blockave, blocksqave, blockdenom);
+    }
+
+  double fitparams[2][2][16];
+  int polyord = 4;
+  if(!_ca_fit_shifts(blockwt, blockshifts, blockave, blocksqave, blockdenom, vblsz, hblsz, 4.0, fitparams,
+                     &polyord))
+  {
+    err = dt_opencl_enqueue_copy_image(devid, dev_in, dev_out, origin, origin, region);
+    if(err != CL_SUCCESS) goto error;
+    goto finish;
+  }
+
+  for(int j = 0; j < blocks_v; j++)
+    for(int i = 0; i < blocks_h; i++)
+    {
+      float lblockshifts[2][2];
+      _ca_block_shifts(fitparams, polyord, j + 1, i + 1, lblockshifts);
+      float *s = shifts + 4 * (j * blocks_h + i);
+      s[0] = lblockshifts[0][0];
+      s[1] = lblockshifts[0][1];
+      s[2] = lblockshifts[1][0];
+      s[3] = lblockshifts[1][1];
+    }
+
+  dev_shifts = dt_opencl_copy_host_to_device_constant(devid, sizeof(float) * 4 * blocks_h * blocks_v, shifts);
+  if(dev_shifts == NULL) goto error;
+
+  dt_opencl_set_kernel_arg(devid, gd->kernel_cacorrect_apply, 0, sizeof(cl_mem), (void *)&dev_in);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_cacorrect_apply, 1, sizeof(cl_mem), (void *)&dev_green);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_cacorrect_apply, 2, sizeof(cl_mem), (void *)&dev_out);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_cacorrect_apply, 3, sizeof(int), (void *)&width);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_cacorrect_apply, 4, sizeof(int), (void *)&height);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_cacorrect_apply, 5, sizeof(uint32_t), (void *)&filters);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_cacorrect_apply, 6, sizeof(cl_mem), (void *)&dev_shifts);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_cacorrect_apply, 7, sizeof(int), (void *)&blocks_h);
+  err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_cacorrect_apply, sizes);
+  if(err != CL_SUCCESS) goto error;
+
+finish:
+  dt_opencl_release_mem_object(dev_shifts);
+  dt_opencl_release_mem_object(dev_blocks);
+  dt_opencl_release_mem_object(dev_green);
+  free(buffer1);
+  dt_free_align(shifts);
+  dt_free_align(blocks);
+  return TRUE;
+
+error:
+  if(dev_shifts != NULL) dt_opencl_release_mem_object(dev_shifts);
+  if(dev_blocks != NULL) dt_opencl_release_mem_object(dev_blocks);
+  if(dev_rows != NULL) dt_opencl_release_mem_object(dev_rows);
+  if(dev_green != NULL) dt_opencl_release_mem_object(dev_green);
+  free(buffer1);
+  dt_free_align(shifts);
+  dt_free_align(blocks);
+  dt_print(DT_DEBUG_OPENCL, "[opencl_cacorrect] couldn't enqueue kernel! %d\n", err);
+  return FALSE;
+}
+#endif
+
+void tiling_callback(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece,
+                     const dt_iop_roi_t *roi_in, const dt_iop_roi_t *roi_out, struct dt_develop_tiling_t *tiling)
+{
+  // the shift fit is global, so the image is never split, but the pipe still needs to know what fits where:
+  // in + out + Gtmp + RawDataTmp on the cpu (on the device: in + out + green + the row sums), plus the tile
+  // buffers of every thread.
+  const int ts = 128, tsh = ts / 2;
+  tiling->factor = 3.5f;
+  tiling->maxbuf = 1.0f;
+  tiling->overhead = (size_t)dt_get_num_threads() * (3 * sizeof(float) * ts * ts + 6 * sizeof(float) * ts * tsh);
+  tiling->overlap = 0;
+  tiling->xalign = 2;
+  tiling->yalign = 2;
+}
+
 void reload_defaults(dt_iop_module_t *module)
 {
   // init defaults:
@@ -1508,8 +1726,6 @@ end:
 /** init, cleanup, commit to pipeline */
 void init(dt_iop_module_t *module)
 {
-  // we don't need global data:
-  module->data = NULL; // malloc(sizeof(dt_iop_cacorrect_global_data_t));
   module->params = calloc(1, sizeof(dt_iop_cacorrect_params_t));
   module->default_params = calloc(1, sizeof(dt_iop_cacorrect_params_t));
   // our module is disabled by default
@@ -1526,7 +1742,28 @@ void cleanup(dt_iop_module_t *module)
 {
   free(module->params);
   module->params = NULL;
-  free(module->data); // just to be sure
+}
+
+void init_global(dt_iop_module_so_t *module)
+{
+  const int program = 20; // cacorrect.cl, from programs.conf
+  module->data = malloc(sizeof(dt_iop_cacorrect_global_data_t));
+
+  dt_iop_cacorrect_global_data_t *gd = module->data;
+  gd->kernel_cacorrect_green = dt_opencl_create_kernel(program, "cacorrect_green");
+  gd->kernel_cacorrect_coeffs = dt_opencl_create_kernel(program, "cacorrect_coeffs");
+  gd->kernel_cacorrect_blocks = dt_opencl_create_kernel(program, "cacorrect_blocks");
+  gd->kernel_cacorrect_apply = dt_opencl_create_kernel(program, "cacorrect_apply");
+}
+
+void cleanup_global(dt_iop_module_so_t *module)
+{
+  dt_iop_cacorrect_global_data_t *gd = (dt_iop_cacorrect_global_data_t *)module->data;
+  dt_opencl_free_kernel(gd->kernel_cacorrect_apply);
+  dt_opencl_free_kernel(gd->kernel_cacorrect_blocks);
+  dt_opencl_free_kernel(gd->kernel_cacorrect_coeffs);
+  dt_opencl_free_kernel(gd->kernel_cacorrect_green);
+  free(module->data);
   module->data = NULL;
 }
 
@@ -21,6 +21,7 @@
 #include "bauhaus/bauhaus.h"
 #include "common/colorspaces.h"
 #include "common/darktable.h"
+#include "common/opencl.h"
 #include "control/control.h"
 #include "develop/develop.h"
 #include "develop/imageop.h"
@@ -59,6 +60,13 @@ typedef struct dt_iop_rlce_data_t
   double slope;
 } dt_iop_rlce_data_t;
 
+typedef struct dt_iop_rlce_global_data_t
+{
+  int kernel_clahe_luminance;
+  int kernel_clahe_histogram;
+  int kernel_clahe_apply;
+} dt_iop_rlce_global_data_t;
+
 const char *name()
 {
   return _("local contrast");
@@ -71,7 +79,7 @@ int groups()
 
 int flags()
 {
-  return IOP_FLAGS_INCLUDE_IN_STYLES | IOP_FLAGS_DEPRECATED;
+  return IOP_FLAGS_INCLUDE_IN_STYLES | IOP_FLAGS_DEPRECATED | IOP_FLAGS_NO_TILE_STREAMING | IOP_FLAGS_ALLOW_TILING;
 }
 
 void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *const ivoid,
@@ -236,6 +244,112 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
 #undef BINS
 }
 
+// the opencl path evaluates the window cdf only every step pixels and interpolates in between
+static inline int _grid_step(const int rad)
+{
+  return MAX(8, (rad + 1) / 2);
+}
+
+#ifdef HAVE_OPENCL
+int process_cl(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, cl_mem dev_in, cl_mem dev_out,
+               const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
+{
+  dt_iop_rlce_data_t *d = (dt_iop_rlce_data_t *)piece->data;
+  dt_iop_rlce_global_data_t *gd = (dt_iop_rlce_global_data_t *)self->data;
+
+  const int devid = piece->pipe->devid;
+  const int width = roi_out->width;
+  const int height = roi_out->height;
+  const int rad = d->radius * roi_in->scale / piece->iscale;
+  const float slope = d->slope;
+  const int step = _grid_step(rad);
+  const int grid_w = (width - 1 + step - 1) / step + 1;
+  const int grid_h = (height - 1 + step - 1) / step + 1;
+
+  cl_mem dev_luminance = NULL;
+  cl_mem dev_luts = NULL;
+  cl_int err = -999;
+
+  dt_opencl_local_buffer_t locopt
+    = (dt_opencl_local_buffer_t){ .xoffset = 0, .xfactor = 1, .yoffset = 0, .yfactor = 1,
+                                  .cellsize = 0, .overhead = (256 + 1) * sizeof(int),
+                                  .sizex = 1 << 8, .sizey = 1 };
+
+  if(!dt_opencl_local_buffer_opt(devid, gd->kernel_clahe_histogram, &locopt))
+  {
+    dt_print(DT_DEBUG_OPENCL, "[opencl_clahe] can not identify resource limits for device %d\n", devid);
+    goto error;
+  }
+
+  dev_luminance = dt_opencl_alloc_device(devid, width, height, sizeof(float));
+  if(dev_luminance == NULL) goto error;
+  dev_luts = dt_opencl_alloc_device_buffer(devid, sizeof(float) * (256 + 1) * grid_w * grid_h);
+  if(dev_luts == NULL) goto error;
+
+  size_t sizes[] = { ROUNDUPWD(width), ROUNDUPHT(height), 1 };
+  dt_opencl_set_kernel_arg(devid, gd->kernel_clahe_luminance, 0, sizeof(cl_mem), (void *)&dev_in);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_clahe_luminance, 1, sizeof(cl_mem), (void *)&dev_luminance);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_clahe_luminance, 2, sizeof(int), (void *)&width);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_clahe_luminance, 3, sizeof(int), (void *)&height);
+  err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_clahe_luminance, sizes);
+  if(err != CL_SUCCESS) goto error;
+
+  // one work group per grid point
+  size_t sizes_hist[] = { locopt.sizex, grid_w * grid_h, 1 };
+  size_t local_hist[] = { locopt.sizex, 1, 1 };
+  dt_opencl_set_kernel_arg(devid, gd->kernel_clahe_histogram, 0, sizeof(cl_mem), (void *)&dev_luminance);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_clahe_histogram, 1, sizeof(cl_mem), (void *)&dev_luts);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_clahe_histogram, 2, sizeof(int), (void *)&width);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_clahe_histogram, 3, sizeof(int), (void *)&height);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_clahe_histogram, 4, sizeof(int), (void *)&rad);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_clahe_histogram, 5, sizeof(float), (void *)&slope);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_clahe_histogram, 6, sizeof(int), (void *)&step);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_clahe_histogram, 7, sizeof(int), (void *)&grid_w);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_clahe_histogram, 8, sizeof(int), (void *)&grid_h);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_clahe_histogram, 9, (256 + 1) * sizeof(int), NULL);
+  err = dt_opencl_enqueue_kernel_2d_with_local(devid, gd->kernel_clahe_histogram, sizes_hist, local_hist);
+  if(err != CL_SUCCESS) goto error;
+
+  dt_opencl_set_kernel_arg(devid, gd->kernel_clahe_apply, 0, sizeof(cl_mem), (void *)&dev_in);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_clahe_apply, 1, sizeof(cl_mem), (void *)&dev_luminance);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_clahe_apply, 2, sizeof(cl_mem), (void *)&dev_out);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_clahe_apply, 3, sizeof(int), (void *)&width);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_clahe_apply, 4, sizeof(int), (void *)&height);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_clahe_apply, 5, sizeof(cl_mem), (void *)&dev_luts);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_clahe_apply, 6, sizeof(int), (void *)&step);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_clahe_apply, 7, sizeof(int), (void *)&grid_w);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_clahe_apply, 8, sizeof(int), (void *)&grid_h);
+  err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_clahe_apply, sizes);
+  if(err != CL_SUCCESS) goto error;
+
+  dt_opencl_release_mem_object(dev_luts);
+  dt_opencl_release_mem_object(dev_luminance);
+  return TRUE;
+
+error:
+  if(dev_luts != NULL) dt_opencl_release_mem_object(dev_luts);
+  if(dev_luminance != NULL) dt_opencl_release_mem_object(dev_luminance);
+  dt_print(DT_DEBUG_OPENCL, "[opencl_clahe] couldn't enqueue kernel! %d\n", err);
+  return FALSE;
+}
+#endif
+
+void tiling_callback(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece,
+                     const dt_iop_roi_t *roi_in, const dt_iop_roi_t *roi_out, struct dt_develop_tiling_t *tiling)
+{
+  dt_iop_rlce_data_t *d = (dt_iop_rlce_data_t *)piece->data;
+  const int rad = d->radius * roi_in->scale / piece->iscale;
+  const int step = _grid_step(rad);
+
+  // in + out + luminance, and on the device the cdfs of the grid points
+  tiling->factor = 2.25f + (256 + 1) / (4.0f * step * step);
+  tiling->maxbuf = 1.0f;
+  tiling->overhead = (size_t)roi_out->width * sizeof(float) * dt_get_num_threads();
+  tiling->overlap = rad;
+  tiling->xalign = 1;
+  tiling->yalign = 1;
+}
+
 static void radius_callback(GtkWidget *slider, gpointer user_data)
 {
   dt_iop_module_t *self = (dt_iop_module_t *)user_data;
@@ -306,6 +420,26 @@ void cleanup(dt_iop_module_t *module)
   module->params = NULL;
 }
 
+void init_global(dt_iop_module_so_t *module)
+{
+  const int program = 21; // clahe.cl, from programs.conf
+  dt_iop_rlce_global_data_t *gd = (dt_iop_rlce_global_data_t *)malloc(sizeof(dt_iop_rlce_global_data_t));
+  module->data = gd;
+  gd->kernel_clahe_luminance = dt_opencl_create_kernel(program, "clahe_luminance");
+  gd->kernel_clahe_histogram = dt_opencl_create_kernel(program, "clahe_histogram");
+  gd->kernel_clahe_apply = dt_opencl_create_kernel(program, "clahe_apply");
+}
+
+void cleanup_global(dt_iop_module_so_t *module)
+{
+  dt_iop_rlce_global_data_t *gd = (dt_iop_rlce_global_data_t *)module->data;
+  dt_opencl_free_kernel(gd->kernel_clahe_apply);
+  dt_opencl_free_kernel(gd->kernel_clahe_histogram);
+  dt_opencl_free_kernel(gd->kernel_clahe_luminance);
+  free(module->data);
+  module->data = NULL;
+}
+
 void gui_init(struct dt_iop_module_t *self)
 {
   self->gui_data = malloc(sizeof(dt_iop_rlce_gui_data_t));
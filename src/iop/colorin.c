@@ -24,7 +24,10 @@
 #include "common/colorspaces.h"
 #include "common/colorspaces_inline_conversions.h"
 #include "common/image_cache.h"
+#include "common/lut3d.h"
 #include "common/opencl.h"
+#include "common/simd.h"
+#include "control/conf.h"
 #include "control/control.h"
 #include "develop/develop.h"
 #include "gui/gtk.h"
@@ -38,9 +41,6 @@
 #include "iop/iop_api.h"
 
 #include "external/adobe_coeff.c"
-#if defined(__SSE__)
-#include <xmmintrin.h>
-#endif
 #include <assert.h>
 #include <math.h>
 #include <stdlib.h>
@@ -86,6 +86,7 @@ typedef struct dt_iop_colorin_global_data_t
 {
   int kernel_colorin_unbound;
   int kernel_colorin_clipping;
+  int kernel_lut3d;
 } dt_iop_colorin_global_data_t;
 
 typedef struct dt_iop_colorin_data_t
@@ -96,6 +97,7 @@ typedef struct dt_iop_colorin_data_t
   cmsHTRANSFORM *xform_cam_Lab;
   cmsHTRANSFORM *xform_cam_nrgb;
   cmsHTRANSFORM *xform_nrgb_Lab;
+  dt_lut3d_t *lut3d; // the xforms baked into a lut, applied instead of them if not NULL
   float lut[3][LUT_SAMPLES];
   float cmatrix[9];
   float nmatrix[9];
@@ -118,7 +120,7 @@ int groups()
 
 int flags()
 {
-  return IOP_FLAGS_ALLOW_TILING | IOP_FLAGS_ONE_INSTANCE;
+  return IOP_FLAGS_ALLOW_TILING | IOP_FLAGS_ONE_INSTANCE | IOP_FLAGS_POINTWISE;
 }
 
 int legacy_params(dt_iop_module_t *self, const void *const old_params, const int old_version,
@@ -287,6 +289,7 @@ void init_global(dt_iop_module_so_t *module)
   module->data = gd;
   gd->kernel_colorin_unbound = dt_opencl_create_kernel(program, "colorin_unbound");
   gd->kernel_colorin_clipping = dt_opencl_create_kernel(program, "colorin_clipping");
+  gd->kernel_lut3d = dt_opencl_create_kernel(program, "lut3d_tetrahedral");
 }
 
 void cleanup_global(dt_iop_module_so_t *module)
@@ -294,6 +297,7 @@ void cleanup_global(dt_iop_module_so_t *module)
   dt_iop_colorin_global_data_t *gd = (dt_iop_colorin_global_data_t *)module->data;
   dt_opencl_free_kernel(gd->kernel_colorin_unbound);
   dt_opencl_free_kernel(gd->kernel_colorin_clipping);
+  dt_opencl_free_kernel(gd->kernel_lut3d);
   free(module->data);
   module->data = NULL;
 }
@@ -402,6 +406,13 @@ int process_cl(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, cl_m
     return TRUE;
   }
 
+  if(d->lut3d)
+  {
+    err = dt_lut3d_apply_cl(devid, gd->kernel_lut3d, d->lut3d, dev_in, dev_out, width, height);
+    if(err != CL_SUCCESS) goto error;
+    return TRUE;
+  }
+
   size_t sizes[] = { ROUNDUPWD(width), ROUNDUPHT(height), 1 };
   dev_m = dt_opencl_copy_host_to_device_constant(devid, sizeof(float) * 9, cmat);
   if(dev_m == NULL) goto error;
@@ -767,7 +778,11 @@ static void process_lcms2_bm(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_
     }
 
     // convert to (L,a/L,b/L) to be able to change L without changing saturation.
-    if(!d->nrgb)
+    if(d->lut3d)
+    {
+      dt_lut3d_apply(d->lut3d, out, out, roi_out->width);
+    }
+    else if(!d->nrgb)
     {
       cmsDoTransform(d->xform_cam_Lab, out, out, roi_out->width);
     }
@@ -806,7 +821,11 @@ static void process_lcms2_proper(struct dt_iop_module_t *self, dt_dev_pixelpipe_
     float *out = (float *)ovoid + (size_t)ch * k * roi_out->width;
 
     // convert to (L,a/L,b/L) to be able to change L without changing saturation.
-    if(!d->nrgb)
+    if(d->lut3d)
+    {
+      dt_lut3d_apply(d->lut3d, in, out, roi_out->width);
+    }
+    else if(!d->nrgb)
     {
       cmsDoTransform(d->xform_cam_Lab, in, out, roi_out->width);
     }
@@ -866,7 +885,7 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
   if(piece->pipe->mask_display & DT_DEV_PIXELPIPE_DISPLAY_MASK) dt_iop_alpha_copy(ivoid, ovoid, roi_out->width, roi_out->height);
 }
 
-#if defined(__SSE2__)
+#if defined(DT_SIMD_SSE)
 static void process_sse2_cmatrix_bm(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece,
                                     const void *const ivoid, void *const ovoid, const dt_iop_roi_t *const roi_in,
                                     const dt_iop_roi_t *const roi_out)
@@ -1143,7 +1162,11 @@ static void process_sse2_lcms2_bm(struct dt_iop_module_t *self, dt_dev_pixelpipe
     }
 
     // convert to (L,a/L,b/L) to be able to change L without changing saturation.
-    if(!d->nrgb)
+    if(d->lut3d)
+    {
+      dt_lut3d_apply(d->lut3d, out, out, roi_out->width);
+    }
+    else if(!d->nrgb)
     {
       cmsDoTransform(d->xform_cam_Lab, out, out, roi_out->width);
     }
@@ -1185,7 +1208,11 @@ static void process_sse2_lcms2_proper(struct dt_iop_module_t *self, dt_dev_pixel
     float *out = ((float *)ovoid) + (size_t)ch * k * roi_out->width;
 
     // convert to (L,a/L,b/L) to be able to change L without changing saturation.
-    if(!d->nrgb)
+    if(d->lut3d)
+    {
+      dt_lut3d_apply(d->lut3d, in, out, roi_out->width);
+    }
+    else if(!d->nrgb)
     {
       cmsDoTransform(d->xform_cam_Lab, in, out, roi_out->width);
     }
@@ -1249,6 +1276,16 @@ void process_sse2(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, c
 }
 #endif
 
+// the lcms2 path with clipping to the normalization profile as one function, to bake it into a lut
+static void _eval_clipping(const float *const in, float *const out, const size_t npixels, void *data)
+{
+  const dt_iop_colorin_data_t *const d = (dt_iop_colorin_data_t *)data;
+  cmsDoTransform(d->xform_cam_nrgb, in, out, npixels);
+  for(size_t k = 0; k < 4 * npixels; k += 4)
+    for(int c = 0; c < 3; c++) out[k + c] = CLAMP(out[k + c], 0.0f, 1.0f);
+  cmsDoTransform(d->xform_nrgb_Lab, out, out, npixels);
+}
+
 static void mat3mul(float *dst, const float *const m1, const float *const m2)
 {
   for(int k = 0; k < 3; k++)
@@ -1326,6 +1363,8 @@ void commit_params(struct dt_iop_module_t *self, dt_iop_params_t *p1, dt_dev_pix
     cmsDeleteTransform(d->xform_nrgb_Lab);
     d->xform_nrgb_Lab = NULL;
   }
+  dt_lut3d_cache_release(d->lut3d);
+  d->lut3d = NULL;
 
   d->cmatrix[0] = d->nmatrix[0] = d->lmatrix[0] = NAN;
   d->lut[0][0] = -1.0f;
@@ -1526,9 +1565,27 @@ void commit_params(struct dt_iop_module_t *self, dt_iop_params_t *p1, dt_dev_pix
       piece->process_cl_ready = 0;
       d->cmatrix[0] = NAN;
       d->xform_cam_Lab = cmsCreateTransform(d->input, TYPE_RGBA_FLT, Lab, TYPE_LabA_FLT, p->intent, 0);
+      input_format = TYPE_RGBA_FLT;
     }
   }
 
+  // bake the lcms2 path into a lut if the user wants that, with the clipping to the normalization profile
+  const int lut3d_size = dt_conf_get_int("plugins/darkroom/lcms2_lut_size");
+  if(isnan(d->cmatrix[0]) && d->xform_cam_Lab && lut3d_size > 0)
+  {
+    const float min[3] = { 0.0f, 0.0f, 0.0f };
+    const float max[3] = { 1.0f, 1.0f, 1.0f };
+    gchar *key = dt_lut3d_cache_key(d->input, d->nrgb ? d->nrgb : Lab, NULL, p->intent, input_format,
+                                    d->nrgb ? "colorin clipping" : "colorin", lut3d_size);
+    if(d->nrgb)
+      d->lut3d = dt_lut3d_cache_get(key, lut3d_size, min, max, _eval_clipping, d);
+    else
+      d->lut3d = dt_lut3d_cache_get(key, lut3d_size, min, max, dt_lut3d_eval_transform, d->xform_cam_Lab);
+    g_free(key);
+    // the kernel doesn't do the blue mapping in front of the lut
+    if(d->lut3d && !(d->blue_mapping && pipe->image.flags & DT_IMAGE_RAW)) piece->process_cl_ready = 1;
+  }
+
   d->nonlinearlut = 0;
 
   // now try to initialize unbounded mode:
@@ -1561,6 +1618,7 @@ void init_pipe(struct dt_iop_module_t *self, dt_dev_pixelpipe_t *pipe, dt_dev_pi
   d->xform_cam_Lab = NULL;
   d->xform_cam_nrgb = NULL;
   d->xform_nrgb_Lab = NULL;
+  d->lut3d = NULL;
   self->commit_params(self, self->default_params, pipe, piece);
 }
 
@@ -1583,6 +1641,7 @@ void cleanup_pipe(struct dt_iop_module_t *self, dt_dev_pixelpipe_t *pipe, dt_dev
     cmsDeleteTransform(d->xform_nrgb_Lab);
     d->xform_nrgb_Lab = NULL;
   }
+  dt_lut3d_cache_release(d->lut3d);
 
   free(piece->data);
   piece->data = NULL;
@@ -58,6 +58,9 @@ DT_MODULE_INTROSPECTION(1, dt_iop_colormapping_params_t)
 
 #define HISTN (1 << 11)
 #define MAXN 5
+// at most this many pixels are clustered, and clustering stops once no mean moves further than that in a and b
+#define KMEANS_SAMPLES 100000
+#define KMEANS_CONVERGED 1.0e-3f
 
 typedef enum dt_iop_colormapping_flags_t
 {
@@ -111,6 +114,15 @@ typedef struct dt_iop_colormapping_params_t
 typedef struct dt_iop_colormapping_params_t dt_iop_colormapping_data_t;
 
 
+// clusters of an acquired buffer, acquiring the same again doesn't have to cluster it again
+typedef struct dt_iop_colormapping_clusters_t
+{
+  uint64_t hash; // of image, buffer size, number of clusters, histogram and some colors, 0 if unset
+  float mean[MAXN][2];
+  float var[MAXN][2];
+  float weight[MAXN];
+} dt_iop_colormapping_clusters_t;
+
 typedef struct dt_iop_colormapping_gui_data_t
 {
   int flag;
@@ -129,6 +141,7 @@ typedef struct dt_iop_colormapping_gui_data_t
   GtkWidget *equalization;
   cmsHTRANSFORM xform;
   dt_pthread_mutex_t lock;
+  dt_iop_colormapping_clusters_t cached_source, cached_target;
 } dt_iop_colormapping_gui_data_t;
 
 typedef struct dt_iop_colormapping_global_data_t
@@ -150,7 +163,7 @@ int groups()
 
 int flags()
 {
-  return IOP_FLAGS_ONE_INSTANCE | IOP_FLAGS_SUPPORTS_BLENDING;
+  return IOP_FLAGS_ONE_INSTANCE | IOP_FLAGS_SUPPORTS_BLENDING | IOP_FLAGS_NO_TILE_STREAMING;
 }
 
 
@@ -295,28 +308,43 @@ static int get_cluster(const float *col, const int n, float mean[n][2])
 static void kmeans(const float *col, const int width, const int height, const int n, float mean_out[n][2],
                    float var_out[n][2], float weight_out[n])
 {
-  const int nit = 40;                       // number of iterations
-  const int samples = width * height * 0.2; // samples: only a fraction of the buffer.
-
-  float(*const mean)[2] = malloc(2 * n * sizeof(float));
-  float(*const var)[2] = malloc(2 * n * sizeof(float));
-  int *const cnt = malloc(n * sizeof(int));
-  int count;
-
-  float a_min = FLT_MAX, b_min = FLT_MAX, a_max = FLT_MIN, b_max = FLT_MIN;
+  const int nit = 40; // maximum number of iterations
+  // samples: only a fraction of the buffer, drawn once so that the iterations converge
+  const int samples = MIN(width * height * 0.2, KMEANS_SAMPLES);
+  const int nthreads = dt_get_num_threads();
+  // per thread sums of count, a, b, a^2 and b^2 for every cluster, padded to keep threads off each other's lines
+  const int stride = (5 * n + 7) & ~7;
+
+  float(*const sample)[2] = malloc((size_t)2 * samples * sizeof(float));
+  double *const sums = malloc((size_t)stride * nthreads * sizeof(double));
+  if(!sample || !sums)
+  {
+    free(sample);
+    free(sums);
+    for(int k = 0; k < n; k++)
+      mean_out[k][0] = mean_out[k][1] = var_out[k][0] = var_out[k][1] = weight_out[k] = 0.0f;
+    return;
+  }
 
+  // randomly sample col positions inside roi
+#ifdef _OPENMP
+#pragma omp parallel for default(none) schedule(static) shared(col)
+#endif
   for(int s = 0; s < samples; s++)
   {
     const int j = CLAMP(dt_points_get() * height, 0, height - 1);
     const int i = CLAMP(dt_points_get() * width, 0, width - 1);
+    sample[s][0] = col[4 * ((size_t)width * j + i) + 1];
+    sample[s][1] = col[4 * ((size_t)width * j + i) + 2];
+  }
 
-    const float a = col[4 * (width * j + i) + 1];
-    const float b = col[4 * (width * j + i) + 2];
-
-    a_min = fmin(a, a_min);
-    a_max = fmax(a, a_max);
-    b_min = fmin(b, b_min);
-    b_max = fmax(b, b_max);
+  float a_min = FLT_MAX, b_min = FLT_MAX, a_max = FLT_MIN, b_max = FLT_MIN;
+  for(int s = 0; s < samples; s++)
+  {
+    a_min = fmin(sample[s][0], a_min);
+    a_max = fmax(sample[s][0], a_max);
+    b_min = fmin(sample[s][1], b_min);
+    b_max = fmax(sample[s][1], b_max);
   }
 
   // init n clusters for a, b channels at random
@@ -325,73 +353,59 @@ static void kmeans(const float *col, const int width, const int height, const in
     mean_out[k][0] = 0.9f * (a_min + (a_max - a_min) * dt_points_get());
     mean_out[k][1] = 0.9f * (b_min + (b_max - b_min) * dt_points_get());
     var_out[k][0] = var_out[k][1] = weight_out[k] = 0.0f;
-    mean[k][0] = mean[k][1] = var[k][0] = var[k][1] = 0.0f;
   }
   for(int it = 0; it < nit; it++)
   {
-    for(int k = 0; k < n; k++) cnt[k] = 0;
-// randomly sample col positions inside roi
+    memset(sums, 0, (size_t)stride * nthreads * sizeof(double));
 #ifdef _OPENMP
-#pragma omp parallel for default(none) schedule(static) shared(col, mean_out)
+#pragma omp parallel for default(none) schedule(static) shared(mean_out)
 #endif
     for(int s = 0; s < samples; s++)
     {
-      const int j = CLAMP(dt_points_get() * height, 0, height - 1);
-      const int i = CLAMP(dt_points_get() * width, 0, width - 1);
       // for each sample: determine cluster, update new mean, update var
-      for(int k = 0; k < n; k++)
-      {
-        const float L = col[4 * (width * j + i)];
-        const float Lab[3] = { L, col[4 * (width * j + i) + 1], col[4 * (width * j + i) + 2] };
-        // determine dist to mean_out
-        const int c = get_cluster(Lab, n, mean_out);
-#ifdef _OPENMP
-#pragma omp atomic
-#endif
-        cnt[c]++;
-// update mean, var
-#ifdef _OPENMP
-#pragma omp atomic
-#endif
-        var[c][0] += Lab[1] * Lab[1];
-#ifdef _OPENMP
-#pragma omp atomic
-#endif
-        var[c][1] += Lab[2] * Lab[2];
-#ifdef _OPENMP
-#pragma omp atomic
-#endif
-        mean[c][0] += Lab[1];
-#ifdef _OPENMP
-#pragma omp atomic
-#endif
-        mean[c][1] += Lab[2];
-      }
+      const float Lab[3] = { 0.0f, sample[s][0], sample[s][1] };
+      const int c = get_cluster(Lab, n, mean_out);
+      double *const sum = sums + (size_t)stride * dt_get_thread_num() + 5 * c;
+      sum[0] += 1.0;
+      sum[1] += Lab[1];
+      sum[2] += Lab[2];
+      sum[3] += Lab[1] * Lab[1];
+      sum[4] += Lab[2] * Lab[2];
     }
+
     // swap old/new means
+    int count = 0;
+    float shift = 0.0f;
     for(int k = 0; k < n; k++)
     {
-      if(cnt[k] == 0) continue;
-      mean_out[k][0] = mean[k][0] / cnt[k];
-      mean_out[k][1] = mean[k][1] / cnt[k];
-      var_out[k][0] = var[k][0] / cnt[k] - mean_out[k][0] * mean_out[k][0];
-      var_out[k][1] = var[k][1] / cnt[k] - mean_out[k][1] * mean_out[k][1];
-      mean[k][0] = mean[k][1] = var[k][0] = var[k][1] = 0.0f;
+      double sum[5] = { 0.0 };
+      for(int t = 0; t < nthreads; t++)
+        for(int m = 0; m < 5; m++) sum[m] += sums[(size_t)stride * t + 5 * k + m];
+      const int cnt = sum[0];
+      weight_out[k] = cnt;
+      count += cnt;
+      if(cnt == 0) continue;
+      const float a = sum[1] / cnt, b = sum[2] / cnt;
+      shift = fmaxf(shift, fabsf(a - mean_out[k][0]) + fabsf(b - mean_out[k][1]));
+      mean_out[k][0] = a;
+      mean_out[k][1] = b;
+      var_out[k][0] = sum[3] / cnt - a * a;
+      var_out[k][1] = sum[4] / cnt - b * b;
     }
 
     // determine weight of clusters
-    count = 0;
-    for(int k = 0; k < n; k++) count += cnt[k];
-    for(int k = 0; k < n; k++) weight_out[k] = (count > 0) ? (float)cnt[k] / count : 0.0f;
+    for(int k = 0; k < n; k++) weight_out[k] = (count > 0) ? weight_out[k] / count : 0.0f;
 
     // printf("it %d  %d means:\n", it, n);
     // for(int k=0;k<n;k++) printf("mean %f %f -- var %f %f -- weight %f\n", mean_out[k][0], mean_out[k][1],
     // var_out[k][0], var_out[k][1], weight_out[k]);
+
+    // the same samples land in the same clusters again
+    if(shift < KMEANS_CONVERGED) break;
   }
 
-  free(cnt);
-  free(var);
-  free(mean);
+  free(sums);
+  free(sample);
 
   for(int k = 0; k < n; k++)
   {
@@ -432,6 +446,37 @@ static void kmeans(const float *col, const int width, const int height, const in
   }
 }
 
+// kmeans() through the last result, cached for this image, buffer size, cluster count and contents
+static void kmeans_cached(dt_iop_colormapping_clusters_t *cached, const float *col, const int width,
+                          const int height, const int n, const int *hist, const int imgid, float mean_out[n][2],
+                          float var_out[n][2], float weight_out[n])
+{
+  uint64_t hash = 5381;
+  hash = ((hash << 5) + hash) ^ imgid;
+  hash = ((hash << 5) + hash) ^ width;
+  hash = ((hash << 5) + hash) ^ height;
+  hash = ((hash << 5) + hash) ^ n;
+  for(int k = 0; k < HISTN; k++) hash = ((hash << 5) + hash) ^ hist[k];
+  // the histogram only covers L, a sparse grid of a and b catches changes of the colors
+  for(size_t k = 0; k < (size_t)width * height; k += 97)
+  {
+    uint32_t ab[2];
+    memcpy(ab, col + 4 * k + 1, sizeof(ab));
+    hash = ((hash << 5) + hash) ^ ab[0];
+    hash = ((hash << 5) + hash) ^ ab[1];
+  }
+  hash = MAX(hash, 1);
+
+  if(cached->hash != hash)
+  {
+    kmeans(col, width, height, n, cached->mean, cached->var, cached->weight);
+    cached->hash = hash;
+  }
+  memcpy(mean_out, cached->mean, sizeof(float) * 2 * n);
+  memcpy(var_out, cached->var, sizeof(float) * 2 * n);
+  memcpy(weight_out, cached->weight, sizeof(float) * n);
+}
+
 #pragma GCC diagnostic pop
 
 void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *const ivoid,
@@ -1026,7 +1071,8 @@ static void process_clusters(gpointer instance, gpointer user_data)
     invert_histogram(hist, p->source_ihist);
 
     // get n color clusters
-    kmeans(buffer, width, height, p->n, p->source_mean, p->source_var, p->source_weight);
+    kmeans_cached(&g->cached_source, buffer, width, height, p->n, hist, self->dev->image_storage.id,
+                  p->source_mean, p->source_var, p->source_weight);
 
     p->flag |= HAS_SOURCE;
     new_source_clusters = 1;
@@ -1039,7 +1085,8 @@ static void process_clusters(gpointer instance, gpointer user_data)
     capture_histogram(buffer, width, height, p->target_hist);
 
     // get n color clusters
-    kmeans(buffer, width, height, p->n, p->target_mean, p->target_var, p->target_weight);
+    kmeans_cached(&g->cached_target, buffer, width, height, p->n, p->target_hist, self->dev->image_storage.id,
+                  p->target_mean, p->target_var, p->target_weight);
 
     p->flag |= HAS_TARGET;
 
@@ -1086,6 +1133,7 @@ void gui_init(struct dt_iop_module_t *self)
   cmsHPROFILE hLab = dt_colorspaces_get_profile(DT_COLORSPACE_LAB, "", DT_PROFILE_DIRECTION_ANY)->profile;
   g->xform = cmsCreateTransform(hLab, TYPE_Lab_DBL, hsRGB, TYPE_RGB_DBL, INTENT_PERCEPTUAL, 0);
   g->buffer = NULL;
+  g->cached_source.hash = g->cached_target.hash = 0;
 
   dt_pthread_mutex_init(&g->lock, NULL);
 
@@ -22,6 +22,7 @@
 #include "bauhaus/bauhaus.h"
 #include "common/colorspaces.h"
 #include "common/colorspaces_inline_conversions.h"
+#include "common/lut3d.h"
 #include "common/opencl.h"
 #include "control/conf.h"
 #include "control/control.h"
@@ -53,12 +54,14 @@ typedef struct dt_iop_colorout_data_t
   float lut[3][LUT_SAMPLES];
   float cmatrix[9];
   cmsHTRANSFORM *xform;
+  dt_lut3d_t *lut3d; // xform baked into a lut, applied instead of it if not NULL
   float unbounded_coeffs[3][3]; // for extrapolation of shaper curves
 } dt_iop_colorout_data_t;
 
 typedef struct dt_iop_colorout_global_data_t
 {
   int kernel_colorout;
+  int kernel_lut3d;
 } dt_iop_colorout_global_data_t;
 
 typedef struct dt_iop_colorout_params_t
@@ -86,7 +89,7 @@ int groups()
 
 int flags()
 {
-  return IOP_FLAGS_ALLOW_TILING | IOP_FLAGS_ONE_INSTANCE;
+  return IOP_FLAGS_ALLOW_TILING | IOP_FLAGS_ONE_INSTANCE | IOP_FLAGS_POINTWISE;
 }
 
 int legacy_params(dt_iop_module_t *self, const void *const old_params, const int old_version,
@@ -149,12 +152,14 @@ void init_global(dt_iop_module_so_t *module)
       = (dt_iop_colorout_global_data_t *)malloc(sizeof(dt_iop_colorout_global_data_t));
   module->data = gd;
   gd->kernel_colorout = dt_opencl_create_kernel(program, "colorout");
+  gd->kernel_lut3d = dt_opencl_create_kernel(program, "lut3d_tetrahedral");
 }
 
 void cleanup_global(dt_iop_module_so_t *module)
 {
   dt_iop_colorout_global_data_t *gd = (dt_iop_colorout_global_data_t *)module->data;
   dt_opencl_free_kernel(gd->kernel_colorout);
+  dt_opencl_free_kernel(gd->kernel_lut3d);
   free(module->data);
   module->data = NULL;
 }
@@ -232,6 +237,13 @@ int process_cl(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, cl_m
     return TRUE;
   }
 
+  if(d->lut3d)
+  {
+    err = dt_lut3d_apply_cl(devid, gd->kernel_lut3d, d->lut3d, dev_in, dev_out, width, height);
+    if(err != CL_SUCCESS) goto error;
+    return TRUE;
+  }
+
   size_t sizes[] = { ROUNDUPWD(width), ROUNDUPHT(height), 1 };
 
   dev_m = dt_opencl_copy_host_to_device_constant(devid, sizeof(float) * 9, d->cmatrix);
@@ -341,20 +353,24 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
 #ifdef _OPENMP
 #pragma omp parallel for schedule(static) default(none)
 #endif
-    for(size_t k = 0; k < (size_t)ch * roi_out->width * roi_out->height; k += ch)
+    for(int j = 0; j < roi_out->height; j++)
     {
-      const float *const in = (const float *const)ivoid + (size_t)k;
-      float *out = (float *)ovoid + (size_t)k;
+      const float *const in = (const float *const)ivoid + (size_t)ch * roi_out->width * j;
+      float *out = (float *)ovoid + (size_t)ch * roi_out->width * j;
 
-      float xyz[3];
-      dt_Lab_to_XYZ(in, xyz);
+      // out holds XYZ before the matrix
+      dt_Lab_to_XYZ_array(in, out, roi_out->width);
 
-      for(int c = 0; c < 3; c++)
+      for(int k = 0; k < roi_out->width; k++, out += ch)
       {
-        out[c] = 0.0f;
-        for(int i = 0; i < 3; i++)
+        const float xyz[3] = { out[0], out[1], out[2] };
+        for(int c = 0; c < 3; c++)
         {
-          out[c] += d->cmatrix[3 * c + i] * xyz[i];
+          out[c] = 0.0f;
+          for(int i = 0; i < 3; i++)
+          {
+            out[c] += d->cmatrix[3 * c + i] * xyz[i];
+          }
         }
       }
     }
@@ -372,7 +388,10 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
       const float *in = ((float *)ivoid) + (size_t)ch * k * roi_out->width;
       float *out = ((float *)ovoid) + (size_t)ch * k * roi_out->width;
 
-      cmsDoTransform(d->xform, in, out, roi_out->width);
+      if(d->lut3d)
+        dt_lut3d_apply(d->lut3d, in, out, roi_out->width);
+      else
+        cmsDoTransform(d->xform, in, out, roi_out->width);
 
       if(gamutcheck)
       {
@@ -447,7 +466,10 @@ void process_sse2(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, c
       const float *in = ((float *)ivoid) + (size_t)ch * k * roi_out->width;
       float *out = ((float *)ovoid) + (size_t)ch * k * roi_out->width;
 
-      cmsDoTransform(d->xform, in, out, roi_out->width);
+      if(d->lut3d)
+        dt_lut3d_apply(d->lut3d, in, out, roi_out->width);
+      else
+        cmsDoTransform(d->xform, in, out, roi_out->width);
 
       if(gamutcheck)
       {
@@ -521,6 +543,8 @@ void commit_params(struct dt_iop_module_t *self, dt_iop_params_t *p1, dt_dev_pix
     cmsDeleteTransform(d->xform);
     d->xform = NULL;
   }
+  dt_lut3d_cache_release(d->lut3d);
+  d->lut3d = NULL;
   d->cmatrix[0] = NAN;
   d->lut[0][0] = -1.0f;
   d->lut[1][0] = -1.0f;
@@ -655,6 +679,20 @@ void commit_params(struct dt_iop_module_t *self, dt_iop_params_t *p1, dt_dev_pix
     }
   }
 
+  // bake the transform into a lut if the user wants that. not for gamut checks, lcms marks the pixels out of
+  // gamut and the interpolation would smear that over the cells at the gamut boundary.
+  const int lut3d_size = dt_conf_get_int("plugins/darkroom/lcms2_lut_size");
+  if(d->xform && lut3d_size > 0 && !force_lcms2 && d->mode != DT_PROFILE_GAMUTCHECK)
+  {
+    const float min[3] = { 0.0f, -128.0f, -128.0f };
+    const float max[3] = { 100.0f, 128.0f, 128.0f };
+    gchar *key = dt_lut3d_cache_key(Lab, output, softproof, out_intent, transformFlags, "colorout", lut3d_size);
+    d->lut3d = dt_lut3d_cache_get(key, lut3d_size, min, max, dt_lut3d_eval_transform, d->xform);
+    g_free(key);
+    // the lut is a plain kernel on the gpu
+    if(d->lut3d) piece->process_cl_ready = 1;
+  }
+
   if(out_type == DT_COLORSPACE_DISPLAY) pthread_rwlock_unlock(&darktable.color_profiles->xprofile_lock);
 
   // now try to initialize unbounded mode:
@@ -687,6 +725,7 @@ void init_pipe(struct dt_iop_module_t *self, dt_dev_pixelpipe_t *pipe, dt_dev_pi
   piece->data = calloc(1, sizeof(dt_iop_colorout_data_t));
   dt_iop_colorout_data_t *d = (dt_iop_colorout_data_t *)piece->data;
   d->xform = NULL;
+  d->lut3d = NULL;
   self->commit_params(self, self->default_params, pipe, piece);
 }
 
@@ -698,6 +737,7 @@ void cleanup_pipe(struct dt_iop_module_t *self, dt_dev_pixelpipe_t *pipe, dt_dev
     cmsDeleteTransform(d->xform);
     d->xform = NULL;
   }
+  dt_lut3d_cache_release(d->lut3d);
 
   free(piece->data);
   piece->data = NULL;
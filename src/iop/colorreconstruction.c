@@ -131,7 +131,7 @@ int flags()
 {
   // we do not allow tiling. reason: this module needs to see the full surrounding of highlights.
   // if we would split into tiles, each tile would result in different color corrections
-  return IOP_FLAGS_INCLUDE_IN_STYLES | IOP_FLAGS_SUPPORTS_BLENDING;
+  return IOP_FLAGS_INCLUDE_IN_STYLES | IOP_FLAGS_SUPPORTS_BLENDING | IOP_FLAGS_NO_TILE_STREAMING;
 }
 
 int groups()
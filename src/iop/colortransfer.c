@@ -19,6 +19,7 @@
 #include "config.h"
 #endif
 #include "common/colorspaces.h"
+#include "common/opencl.h"
 #include "common/points.h"
 #include "control/control.h"
 #include "develop/develop.h"
@@ -50,6 +51,9 @@ DT_MODULE_INTROSPECTION(1, dt_iop_colortransfer_params_t)
 
 #define HISTN (1 << 11)
 #define MAXN 5
+// at most this many pixels are clustered, and clustering stops once no mean moves further than that in a and b
+#define KMEANS_SAMPLES 100000
+#define KMEANS_CONVERGED 1.0e-3f
 
 typedef enum dt_iop_colortransfer_flag_t
 {
@@ -92,8 +96,17 @@ typedef struct dt_iop_colortransfer_data_t
   float mean[MAXN][2];
   float var[MAXN][2];
   int n;
+  // clusters of the last input, reused while image, size, histogram and a sparse grid of colors stay the same
+  uint64_t input_hash; // 0 if unset
+  float input_mean[MAXN][2];
+  float input_var[MAXN][2];
 } dt_iop_colortransfer_data_t;
 
+typedef struct dt_iop_colortransfer_global_data_t
+{
+  int kernel_colortransfer_apply;
+} dt_iop_colortransfer_global_data_t;
+
 const char *name()
 {
   return _("color transfer");
@@ -106,7 +119,7 @@ int groups()
 
 int flags()
 {
-  return IOP_FLAGS_DEPRECATED | IOP_FLAGS_ONE_INSTANCE | IOP_FLAGS_PREVIEW_NON_OPENCL;
+  return IOP_FLAGS_DEPRECATED | IOP_FLAGS_ONE_INSTANCE | IOP_FLAGS_PREVIEW_NON_OPENCL | IOP_FLAGS_NO_TILE_STREAMING;
 }
 
 #if 0
@@ -238,12 +251,12 @@ static void kmeans(const float *col, const dt_iop_roi_t *const roi, const int n,
                    float var_out[n][2])
 {
   // TODO: check params here:
-  const int nit = 10;                                 // number of iterations
-  const int samples = roi->width * roi->height * 0.2; // samples: only a fraction of the buffer.
-
-  float(*const mean)[2] = malloc(2 * n * sizeof(float));
-  float(*const var)[2] = malloc(2 * n * sizeof(float));
-  int *const cnt = malloc(n * sizeof(int));
+  const int nit = 10; // maximum number of iterations
+  // samples: only a fraction of the buffer, drawn once so that the iterations converge
+  const int samples = MIN(roi->width * roi->height * 0.2, KMEANS_SAMPLES);
+  const int nthreads = dt_get_num_threads();
+  // per thread sums of count, a, b, a^2 and b^2 for every cluster, padded to keep threads off each other's lines
+  const int stride = (5 * n + 7) & ~7;
 
   // init n clusters for a, b channels at random
   for(int k = 0; k < n; k++)
@@ -251,65 +264,72 @@ static void kmeans(const float *col, const dt_iop_roi_t *const roi, const int n,
     mean_out[k][0] = 20.0f - 40.0f * dt_points_get();
     mean_out[k][1] = 20.0f - 40.0f * dt_points_get();
     var_out[k][0] = var_out[k][1] = 0.0f;
-    mean[k][0] = mean[k][1] = var[k][0] = var[k][1] = 0.0f;
   }
-  for(int it = 0; it < nit; it++)
+
+  float(*const sample)[2] = malloc((size_t)2 * samples * sizeof(float));
+  double *const sums = malloc((size_t)stride * nthreads * sizeof(double));
+  if(!sample || !sums)
   {
-    for(int k = 0; k < n; k++) cnt[k] = 0;
+    free(sample);
+    free(sums);
+    return;
+  }
+
 // randomly sample col positions inside roi
 #ifdef _OPENMP
-#pragma omp parallel for default(none) schedule(static) shared(col, mean_out)
+#pragma omp parallel for default(none) schedule(static) shared(col)
+#endif
+  for(int s = 0; s < samples; s++)
+  {
+    const int j = dt_points_get() * roi->height, i = dt_points_get() * roi->width;
+    sample[s][0] = col[3 * (roi->width * j + i) + 1];
+    sample[s][1] = col[3 * (roi->width * j + i) + 2];
+  }
+
+  for(int it = 0; it < nit; it++)
+  {
+    memset(sums, 0, (size_t)stride * nthreads * sizeof(double));
+#ifdef _OPENMP
+#pragma omp parallel for default(none) schedule(static) shared(mean_out)
 #endif
     for(int s = 0; s < samples; s++)
     {
-      const int j = dt_points_get() * roi->height, i = dt_points_get() * roi->width;
       // for each sample: determine cluster, update new mean, update var
-      for(int k = 0; k < n; k++)
-      {
-        const float L = col[3 * (roi->width * j + i)];
-        const float Lab[3] = { L, col[3 * (roi->width * j + i) + 1], col[3 * (roi->width * j + i) + 2] };
-        // determine dist to mean_out
-        const int c = get_cluster(Lab, n, mean_out);
-#ifdef _OPENMP
-#pragma omp atomic
-#endif
-        cnt[c]++;
-// update mean, var
-#ifdef _OPENMP
-#pragma omp atomic
-#endif
-        var[c][0] += Lab[1] * Lab[1];
-#ifdef _OPENMP
-#pragma omp atomic
-#endif
-        var[c][1] += Lab[2] * Lab[2];
-#ifdef _OPENMP
-#pragma omp atomic
-#endif
-        mean[c][0] += Lab[1];
-#ifdef _OPENMP
-#pragma omp atomic
-#endif
-        mean[c][1] += Lab[2];
-      }
+      const float Lab[3] = { 0.0f, sample[s][0], sample[s][1] };
+      const int c = get_cluster(Lab, n, mean_out);
+      double *const sum = sums + (size_t)stride * dt_get_thread_num() + 5 * c;
+      sum[0] += 1.0;
+      sum[1] += Lab[1];
+      sum[2] += Lab[2];
+      sum[3] += Lab[1] * Lab[1];
+      sum[4] += Lab[2] * Lab[2];
     }
+
     // swap old/new means
+    float shift = 0.0f;
     for(int k = 0; k < n; k++)
     {
-      if(cnt[k] == 0) continue;
-      mean_out[k][0] = mean[k][0] / cnt[k];
-      mean_out[k][1] = mean[k][1] / cnt[k];
-      var_out[k][0] = var[k][0] / cnt[k] - mean_out[k][0] * mean_out[k][0];
-      var_out[k][1] = var[k][1] / cnt[k] - mean_out[k][1] * mean_out[k][1];
-      mean[k][0] = mean[k][1] = var[k][0] = var[k][1] = 0.0f;
+      double sum[5] = { 0.0 };
+      for(int t = 0; t < nthreads; t++)
+        for(int m = 0; m < 5; m++) sum[m] += sums[(size_t)stride * t + 5 * k + m];
+      const int cnt = sum[0];
+      if(cnt == 0) continue;
+      const float a = sum[1] / cnt, b = sum[2] / cnt;
+      shift = fmaxf(shift, fabsf(a - mean_out[k][0]) + fabsf(b - mean_out[k][1]));
+      mean_out[k][0] = a;
+      mean_out[k][1] = b;
+      var_out[k][0] = sum[3] / cnt - a * a;
+      var_out[k][1] = sum[4] / cnt - b * b;
     }
     // printf("it %d  %d means:\n", it, n);
     // for(int k=0;k<n;k++) printf("%f %f -- var %f %f\n", mean_out[k][0], mean_out[k][1], var_out[k][0],
     // var_out[k][1]);
+
+    // the same samples land in the same clusters again
+    if(shift < KMEANS_CONVERGED) break;
   }
-  free(cnt);
-  free(var);
-  free(mean);
+  free(sums);
+  free(sample);
   for(int k = 0; k < n; k++)
   {
     // we actually want the std deviation.
@@ -318,6 +338,36 @@ static void kmeans(const float *col, const dt_iop_roi_t *const roi, const int n,
   }
 }
 
+// kmeans() of the input, cached in data
+static void kmeans_input(dt_iop_colortransfer_data_t *data, const float *col, const dt_iop_roi_t *const roi,
+                         const int *hist, const int imgid, float mean_out[][2], float var_out[][2])
+{
+  const int n = data->n;
+  uint64_t hash = 5381;
+  hash = ((hash << 5) + hash) ^ imgid;
+  hash = ((hash << 5) + hash) ^ roi->width;
+  hash = ((hash << 5) + hash) ^ roi->height;
+  hash = ((hash << 5) + hash) ^ n;
+  for(int k = 0; k < HISTN; k++) hash = ((hash << 5) + hash) ^ hist[k];
+  // the histogram only covers L, a sparse grid of a and b catches changes of the colors
+  for(size_t k = 0; k < (size_t)roi->width * roi->height; k += 97)
+  {
+    uint32_t ab[2];
+    memcpy(ab, col + 3 * k + 1, sizeof(ab));
+    hash = ((hash << 5) + hash) ^ ab[0];
+    hash = ((hash << 5) + hash) ^ ab[1];
+  }
+  hash = MAX(hash, 1);
+
+  if(data->input_hash != hash)
+  {
+    kmeans(col, roi, n, data->input_mean, data->input_var);
+    data->input_hash = hash;
+  }
+  memcpy(mean_out, data->input_mean, sizeof(float) * 2 * n);
+  memcpy(var_out, data->input_var, sizeof(float) * 2 * n);
+}
+
 #pragma GCC diagnostic pop
 
 void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *const ivoid,
@@ -374,7 +424,7 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
     float(*const mean)[2] = malloc(2 * data->n * sizeof(float));
     float(*const var)[2] = malloc(2 * data->n * sizeof(float));
 
-    kmeans(in, roi_in, data->n, mean, var);
+    kmeans_input(data, in, roi_in, hist, piece->pipe->image.id, mean, var);
 
     // get mapping from input clusters to target clusters
     int *const mapio = malloc(data->n * sizeof(int));
@@ -424,6 +474,95 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
   }
 }
 
+#ifdef HAVE_OPENCL
+int process_cl(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, cl_mem dev_in, cl_mem dev_out,
+               const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
+{
+  dt_iop_colortransfer_data_t *data = (dt_iop_colortransfer_data_t *)piece->data;
+  dt_iop_colortransfer_global_data_t *gd = (dt_iop_colortransfer_global_data_t *)self->data;
+
+  cl_int err = -999;
+  const int devid = piece->pipe->devid;
+  const int width = roi_out->width;
+  const int height = roi_out->height;
+  float *in = NULL;
+  cl_mem dev_hist = NULL;
+  cl_mem dev_target_hist = NULL;
+  cl_mem dev_clusters = NULL;
+
+  // acquiring writes back to the params, leave that to the cpu (the preview pipe never runs it here anyway)
+  if(data->flag == ACQUIRE && piece->pipe->type == DT_DEV_PIXELPIPE_PREVIEW) return FALSE;
+
+  if(data->flag != APPLY)
+  {
+    size_t origin[] = { 0, 0, 0 };
+    size_t region[] = { width, height, 1 };
+    err = dt_opencl_enqueue_copy_image(devid, dev_in, dev_out, origin, origin, region);
+    if(err != CL_SUCCESS) goto error;
+    return TRUE;
+  }
+
+  // histogram and clusters of the input are gathered on the host, as in process()
+  in = dt_alloc_align(64, (size_t)width * height * 4 * sizeof(float));
+  if(in == NULL) goto error;
+  err = dt_opencl_copy_device_to_host(devid, in, dev_in, width, height, 4 * sizeof(float));
+  if(err != CL_SUCCESS) goto error;
+
+  int hist[HISTN];
+  capture_histogram(in, roi_in, hist);
+
+  float mean[MAXN][2], var[MAXN][2];
+  int mapio[MAXN];
+  kmeans_input(data, in, roi_in, hist, piece->pipe->image.id, mean, var);
+  get_cluster_mapping(data->n, mean, data->mean, mapio);
+
+  float clusters[8 * MAXN];
+  for(int c = 0; c < data->n; c++)
+  {
+    float *k = clusters + 8 * c;
+    k[0] = mean[c][0];
+    k[1] = mean[c][1];
+    k[2] = var[c][0];
+    k[3] = var[c][1];
+    k[4] = data->mean[mapio[c]][0];
+    k[5] = data->mean[mapio[c]][1];
+    k[6] = data->var[mapio[c]][0];
+    k[7] = data->var[mapio[c]][1];
+  }
+
+  dev_hist = dt_opencl_copy_host_to_device_constant(devid, sizeof(int) * HISTN, hist);
+  dev_target_hist = dt_opencl_copy_host_to_device_constant(devid, sizeof(float) * HISTN, data->hist);
+  dev_clusters = dt_opencl_copy_host_to_device_constant(devid, sizeof(float) * 8 * MAXN, clusters);
+  if(dev_hist == NULL || dev_target_hist == NULL || dev_clusters == NULL) goto error;
+
+  size_t sizes[] = { ROUNDUPWD(width), ROUNDUPHT(height), 1 };
+  dt_opencl_set_kernel_arg(devid, gd->kernel_colortransfer_apply, 0, sizeof(cl_mem), (void *)&dev_in);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_colortransfer_apply, 1, sizeof(cl_mem), (void *)&dev_out);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_colortransfer_apply, 2, sizeof(int), (void *)&width);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_colortransfer_apply, 3, sizeof(int), (void *)&height);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_colortransfer_apply, 4, sizeof(cl_mem), (void *)&dev_hist);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_colortransfer_apply, 5, sizeof(cl_mem), (void *)&dev_target_hist);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_colortransfer_apply, 6, sizeof(cl_mem), (void *)&dev_clusters);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_colortransfer_apply, 7, sizeof(int), (void *)&data->n);
+  err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_colortransfer_apply, sizes);
+  if(err != CL_SUCCESS) goto error;
+
+  dt_opencl_release_mem_object(dev_hist);
+  dt_opencl_release_mem_object(dev_target_hist);
+  dt_opencl_release_mem_object(dev_clusters);
+  dt_free_align(in);
+  return TRUE;
+
+error:
+  if(dev_hist != NULL) dt_opencl_release_mem_object(dev_hist);
+  if(dev_target_hist != NULL) dt_opencl_release_mem_object(dev_target_hist);
+  if(dev_clusters != NULL) dt_opencl_release_mem_object(dev_clusters);
+  dt_free_align(in);
+  dt_print(DT_DEBUG_OPENCL, "[opencl_colortransfer] couldn't enqueue kernel! %d\n", err);
+  return FALSE;
+}
+#endif
+
 #if 0
 static void
 spinbutton_changed (GtkSpinButton *button, dt_iop_module_t *self)
@@ -532,6 +671,7 @@ void init_pipe(struct dt_iop_module_t *self, dt_dev_pixelpipe_t *pipe, dt_dev_pi
   piece->data = malloc(sizeof(dt_iop_colortransfer_data_t));
   dt_iop_colortransfer_data_t *d = (dt_iop_colortransfer_data_t *)piece->data;
   d->flag = NEUTRAL;
+  d->input_hash = 0;
   self->commit_params(self, self->default_params, pipe, piece);
 }
 
@@ -578,6 +718,23 @@ void cleanup(dt_iop_module_t *module)
   module->params = NULL;
 }
 
+void init_global(dt_iop_module_so_t *module)
+{
+  const int program = 31; // colortransfer.cl, from programs.conf
+  dt_iop_colortransfer_global_data_t *gd
+      = (dt_iop_colortransfer_global_data_t *)malloc(sizeof(dt_iop_colortransfer_global_data_t));
+  module->data = gd;
+  gd->kernel_colortransfer_apply = dt_opencl_create_kernel(program, "colortransfer_apply");
+}
+
+void cleanup_global(dt_iop_module_so_t *module)
+{
+  dt_iop_colortransfer_global_data_t *gd = (dt_iop_colortransfer_global_data_t *)module->data;
+  dt_opencl_free_kernel(gd->kernel_colortransfer_apply);
+  free(module->data);
+  module->data = NULL;
+}
+
 #if 0
 static gboolean
 cluster_preview_draw (GtkWidget *widget, cairo_t *crf, dt_iop_module_t *self)
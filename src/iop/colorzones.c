@@ -100,6 +100,11 @@ typedef struct dt_iop_colorzones_data_t
   dt_draw_curve_t *curve[3];
   dt_iop_colorzones_channel_t channel;
   float lut[4][DT_IOP_COLORZONES_LUT_RES];
+  // for selection by L or C, where nothing blends the curves: the factor for L and the rotation and scale
+  // of a and b, cos and sin times chroma factor, so process() needs neither powf() nor trigonometry
+  float lut_L[DT_IOP_COLORZONES_LUT_RES], lut_ab[2][DT_IOP_COLORZONES_LUT_RES];
+  dt_iop_colorzones_params_t params; // the luts were computed from, if params_valid
+  int params_valid;
 } dt_iop_colorzones_data_t;
 
 typedef struct dt_iop_colorzones_global_data_t
@@ -199,6 +204,28 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
 {
   dt_iop_colorzones_data_t *d = (dt_iop_colorzones_data_t *)(piece->data);
   const int ch = piece->colors;
+
+  if(d->channel == DT_IOP_COLORZONES_L || d->channel == DT_IOP_COLORZONES_C)
+  {
+    const int by_L = d->channel == DT_IOP_COLORZONES_L;
+#ifdef _OPENMP
+#pragma omp parallel for default(none) schedule(static) shared(d)
+#endif
+    for(size_t k = 0; k < (size_t)roi_out->width * roi_out->height; k++)
+    {
+      const float *in = (const float *)i + ch * k;
+      float *out = (float *)o + ch * k;
+      const float a = in[1], b = in[2];
+      const float select = by_L ? fminf(1.0f, in[0] / 100.0f) : fminf(1.0f, sqrtf(b * b + a * a) / 128.0f);
+      const float c = lookup(d->lut_ab[0], select), s = lookup(d->lut_ab[1], select);
+      out[0] = in[0] * lookup(d->lut_L, select);
+      out[1] = a * c - b * s;
+      out[2] = a * s + b * c;
+      out[3] = in[3];
+    }
+    return;
+  }
+
 #ifdef _OPENMP
 #pragma omp parallel for default(none) schedule(static) shared(d)
 #endif
@@ -230,7 +257,7 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
     blend *= blend; // saturation isn't as prone to artifacts:
     // const float Cm = 2.0 * (blend*.5f + (1.0f-blend)*lookup(d->lut[1], select));
     const float Cm = 2.0 * lookup(d->lut[1], select);
-    const float L = in[0] * powf(2.0f, 4.0f * Lm);
+    const float L = in[0] * exp2f(4.0f * Lm);
     out[0] = L;
     out[1] = cosf(2.0 * M_PI * (h + hm)) * Cm * C;
     out[2] = sinf(2.0 * M_PI * (h + hm)) * Cm * C;
@@ -306,6 +333,9 @@ void commit_params(struct dt_iop_module_t *self, dt_iop_params_t *p1, dt_dev_pix
   dt_iop_colorzones_data_t *d = (dt_iop_colorzones_data_t *)(piece->data);
   dt_iop_colorzones_params_t *p = (dt_iop_colorzones_params_t *)p1;
 
+  // the pipe commits all modules on many occasions, the curves only change with the parameters
+  if(d->params_valid && !memcmp(&d->params, p, sizeof(dt_iop_colorzones_params_t))) return;
+
 #if 0 // print new preset
   printf("p.channel = %d;\n", p->channel);
   for(int k=0; k<3; k++) for(int i=0; i<DT_IOP_COLORZONES_BANDS; i++)
@@ -334,6 +364,19 @@ void commit_params(struct dt_iop_module_t *self, dt_iop_params_t *p1, dt_dev_pix
                               strength(p->equalizer_y[ch][DT_IOP_COLORZONES_BANDS - 1], p->strength));
     dt_draw_curve_calc_values(d->curve[ch], 0.0, 1.0, DT_IOP_COLORZONES_LUT_RES, d->lut[3], d->lut[ch]);
   }
+
+  // out = in * 2^(4 (lut_L - 1/2)) and (a, b) rotated by 2 pi (lut_h - 1/2) and scaled by 2 lut_C
+  for(int k = 0; k < DT_IOP_COLORZONES_LUT_RES; k++)
+  {
+    const float hm = d->lut[2][k] - .5f;
+    const float Cm = 2.0f * d->lut[1][k];
+    d->lut_L[k] = exp2f(4.0f * (d->lut[0][k] - .5f));
+    d->lut_ab[0][k] = Cm * cosf(2.0f * M_PI * hm);
+    d->lut_ab[1][k] = Cm * sinf(2.0f * M_PI * hm);
+  }
+
+  d->params = *p;
+  d->params_valid = 1;
 }
 
 void init_pipe(struct dt_iop_module_t *self, dt_dev_pixelpipe_t *pipe, dt_dev_pixelpipe_iop_t *piece)
@@ -354,6 +397,7 @@ void init_pipe(struct dt_iop_module_t *self, dt_dev_pixelpipe_t *pipe, dt_dev_pi
                                   default_params->equalizer_y[ch][1]);
   }
   d->channel = (dt_iop_colorzones_channel_t)default_params->channel;
+  d->params_valid = 0;
 }
 
 void cleanup_pipe(struct dt_iop_module_t *self, dt_dev_pixelpipe_t *pipe, dt_dev_pixelpipe_iop_t *piece)
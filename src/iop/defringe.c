@@ -21,6 +21,7 @@
 #include "bauhaus/bauhaus.h"
 #include "common/darktable.h"
 #include "common/gaussian.h"
+#include "common/opencl.h"
 #include "develop/imageop.h"
 #include "develop/imageop_math.h"
 #include "gui/gtk.h"
@@ -28,6 +29,9 @@
 #include <gtk/gtk.h>
 #include <math.h>
 #include <stdlib.h>
+#if defined(__SSE__)
+#include <xmmintrin.h>
+#endif
 
 DT_MODULE_INTROSPECTION(1, dt_iop_defringe_params_t)
 
@@ -55,12 +59,12 @@ typedef struct dt_iop_defringe_gui_data_t
   GtkWidget *thresh_scale;
 } dt_iop_defringe_gui_data_t;
 
-// would be nice to be able to precompute this only once for an image
-// typedef struct dt_iop_defringe_global_data_t
-//{
-//  float avg_edge_chroma;
-//}
-// dt_iop_defringe_global_data_t;
+typedef struct dt_iop_defringe_global_data_t
+{
+  int kernel_defringe_edge;
+  int kernel_defringe_rowsum;
+  int kernel_defringe_apply;
+} dt_iop_defringe_global_data_t;
 
 const char *name()
 {
@@ -75,33 +79,33 @@ int groups()
 int flags()
 {
   // a second instance might help to reduce artifacts when thick fringe needs to be removed
-  return IOP_FLAGS_SUPPORTS_BLENDING;
+  // the global average mode needs the whole image
+  return IOP_FLAGS_SUPPORTS_BLENDING | IOP_FLAGS_NO_TILE_STREAMING;
 }
 
 // try without clipping for now, usually it should be fine
 //#define CLIP(x,y,z)  if (x < y) x = y; if (x > z) x = z;
 
-// Verify before actually using this
-/*
-void tiling_callback  (dt_iop_module_t *module, dt_dev_pixelpipe_iop_t *piece, const dt_iop_roi_t *roi_in,
-const dt_iop_roi_t *roi_out, dt_develop_tiling_t *tiling)
+void tiling_callback(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece,
+                     const dt_iop_roi_t *roi_in, const dt_iop_roi_t *roi_out, struct dt_develop_tiling_t *tiling)
 {
-  dt_iop_defringe_data_t *p = (dt_iop_defringe_data_t *)piece->data;
+  dt_iop_defringe_data_t *d = (dt_iop_defringe_data_t *)piece->data;
 
   const int width = roi_in->width;
   const int height = roi_in->height;
   const int channels = piece->colors;
-  const size_t basebuffer = width*height*channels*sizeof(float);
+  const size_t basebuffer = (size_t)width * height * channels * sizeof(float);
+  const float sigma = fmax(0.1f, fabs(d->radius)) * roi_in->scale / piece->iscale;
+  const int radius = ceil(2.0 * ceilf(sigma));
 
-  tiling->factor = 2.0f + (float)dt_gaussian_memory_use(width, height, channels)/basebuffer;
-  tiling->maxbuf = fmax(1.0f, (float)dt_gaussian_singlebuffer_size(width, height, channels)/basebuffer);
+  // in + out, and on the device the blurred copy and the edge plane
+  tiling->factor = 3.25f + (float)dt_gaussian_memory_use(width, height, channels) / basebuffer;
+  tiling->maxbuf = fmax(1.0f, (float)dt_gaussian_singlebuffer_size(width, height, channels) / basebuffer);
   tiling->overhead = 0;
-  tiling->overlap = p->window;
+  tiling->overlap = 24 + radius * 4;
   tiling->xalign = 1;
   tiling->yalign = 1;
-  return;
 }
-*/
 
 // fibonacci lattice to select surrounding pixels for different cases
 static const float fib[] = { 0, 1, 1, 2, 3, 5, 8, 13, 21, 34, 55, 89, 144, 233 };
@@ -126,6 +130,118 @@ static inline void fib_latt(int *const x, int *const y, float radius, int step,
 
 #define MAGIC_THRESHOLD_COEFF 33.0
 
+// number of the fibonacci lattice for the local average, the small one uses the one before
+static int _lattice_index(const int radius)
+{
+  const int samples_wish = radius * radius;
+  // select samples by fibonacci number
+  if(samples_wish > 89)
+    return 12; // 144 samples
+  else if(samples_wish > 55)
+    return 11; // 89 samples
+  else if(samples_wish > 34)
+    return 10; // ..you get the idea
+  else if(samples_wish > 21)
+    return 9;
+  else if(samples_wish > 13)
+    return 8;
+  else // don't use less than 13 samples
+    return 7;
+}
+
+// offsets dx, dy of the fib[idx] samples of a lattice scaled to radius, NULL if out of memory
+static int *_lattice(const int idx, const int radius)
+{
+  int *xy = malloc((size_t)2 * sizeof(int) * fib[idx]);
+  if(!xy)
+  {
+    fprintf(stderr, "Error allocating memory for fibonacci lattice in: defringe module\n");
+    return NULL;
+  }
+  int *tmp = xy;
+  for(int u = 0; u < fib[idx]; u++)
+  {
+    int dx, dy;
+    fib_latt(&dx, &dy, radius, u, idx);
+    *tmp++ = dx;
+    *tmp++ = dy;
+  }
+  return xy;
+}
+
+// edge-detect on color channels. method: difference of original to gaussian blurred image, the squared
+// chroma difference is saved in out[.. +3] for the comparison with the threshold later. returns its sum.
+static float _edge_chroma(const float *const in, float *const out, const int width, const int height,
+                          const int ch)
+{
+  float sum = 0.0f;
+#ifdef _OPENMP
+#pragma omp parallel for reduction(+ : sum) schedule(static)
+#endif
+  for(int v = 0; v < height; v++)
+  {
+    for(int t = 0; t < width; t++)
+    {
+      float a = in[(size_t)v * width * ch + t * ch + 1] - out[(size_t)v * width * ch + t * ch + 1];
+      float b = in[(size_t)v * width * ch + t * ch + 2] - out[(size_t)v * width * ch + t * ch + 2];
+
+      float edge = (a * a + b * b); // range up to 2*(256)^2 -> approx. 0 to 131072
+      out[(size_t)v * width * ch + t * ch + 3] = edge;
+      sum += edge;
+    }
+  }
+  return sum;
+}
+
+#if defined(__SSE__)
+// same as above, four pixels at a time: transposed, the registers hold L, a, b and the edge of all four
+static float _edge_chroma_sse2(const float *const in, float *const out, const int width, const int height,
+                               const int ch)
+{
+  float sum = 0.0f;
+#ifdef _OPENMP
+#pragma omp parallel for reduction(+ : sum) schedule(static)
+#endif
+  for(int v = 0; v < height; v++)
+  {
+    const float *inp = in + (size_t)v * width * ch;
+    float *outp = out + (size_t)v * width * ch;
+    __m128 rowsum = _mm_setzero_ps();
+    int t = 0;
+    for(; t + 4 <= width; t += 4, inp += 4 * ch, outp += 4 * ch)
+    {
+      __m128 i0 = _mm_load_ps(inp), i1 = _mm_load_ps(inp + ch), i2 = _mm_load_ps(inp + 2 * ch),
+             i3 = _mm_load_ps(inp + 3 * ch);
+      __m128 o0 = _mm_load_ps(outp), o1 = _mm_load_ps(outp + ch), o2 = _mm_load_ps(outp + 2 * ch),
+             o3 = _mm_load_ps(outp + 3 * ch);
+      _MM_TRANSPOSE4_PS(i0, i1, i2, i3);
+      _MM_TRANSPOSE4_PS(o0, o1, o2, o3);
+      const __m128 a = _mm_sub_ps(i1, o1);
+      const __m128 b = _mm_sub_ps(i2, o2);
+      o3 = _mm_add_ps(_mm_mul_ps(a, a), _mm_mul_ps(b, b));
+      rowsum = _mm_add_ps(rowsum, o3);
+      _MM_TRANSPOSE4_PS(o0, o1, o2, o3);
+      _mm_store_ps(outp, o0);
+      _mm_store_ps(outp + ch, o1);
+      _mm_store_ps(outp + 2 * ch, o2);
+      _mm_store_ps(outp + 3 * ch, o3);
+    }
+    float sums[4];
+    _mm_storeu_ps(sums, rowsum);
+    float edges = sums[0] + sums[1] + sums[2] + sums[3];
+    for(; t < width; t++, inp += ch, outp += ch)
+    {
+      const float a = inp[1] - outp[1];
+      const float b = inp[2] - outp[2];
+      outp[3] = a * a + b * b;
+      edges += outp[3];
+    }
+    sum += edges;
+  }
+  return sum;
+}
+#endif
+
 // the basis of how the following algorithm works comes from rawtherapee (http://rawtherapee.com/)
 // defringe -- thanks to Emil Martinec <ejmartin@uchicago.edu> for that
 // quite some modifications were done though:
@@ -138,8 +254,9 @@ static inline void fib_latt(int *const x, int *const y, float radius, int step,
 // most are chosen arbitrarily and/or by experiment/trial+error ... I am sorry ;-)
 // and having everything user-defineable would be just too much
 // -----------------------------------------------------------------------------------------
-void process(struct dt_iop_module_t *module, dt_dev_pixelpipe_iop_t *piece, const void *const i,
-             void *const o, const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
+static void _defringe(struct dt_iop_module_t *module, dt_dev_pixelpipe_iop_t *piece, const void *const i,
+                      void *const o, const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out,
+                      const gboolean use_sse2)
 {
   dt_iop_defringe_data_t *d = (dt_iop_defringe_data_t *)piece->data;
   assert(dt_iop_module_colorspace(module) == iop_cs_Lab);
@@ -176,33 +293,7 @@ void process(struct dt_iop_module_t *module, dt_dev_pixelpipe_iop_t *piece, cons
   dt_gaussian_blur_4c(gauss, in, out);
   dt_gaussian_free(gauss);
 
-  int samples_wish = radius * radius;
-  int sampleidx_avg;
-  // select samples by fibonacci number
-  if(samples_wish > 89)
-  {
-    sampleidx_avg = 12; // 144 samples
-  }
-  else if(samples_wish > 55)
-  {
-    sampleidx_avg = 11; // 89 samples
-  }
-  else if(samples_wish > 34)
-  {
-    sampleidx_avg = 10; // ..you get the idea
-  }
-  else if(samples_wish > 21)
-  {
-    sampleidx_avg = 9;
-  }
-  else if(samples_wish > 13)
-  {
-    sampleidx_avg = 8;
-  }
-  else
-  { // don't use less than 13 samples
-    sampleidx_avg = 7;
-  }
+  const int sampleidx_avg = _lattice_index(radius);
   const int sampleidx_small = sampleidx_avg - 1;
 
   const int small_radius = MAX(radius, 3);
@@ -211,64 +302,16 @@ void process(struct dt_iop_module_t *module, dt_dev_pixelpipe_iop_t *piece, cons
   const int samples_small = fib[sampleidx_small];
   const int samples_avg = fib[sampleidx_avg];
 
-  // Pre-Compute Fibonacci Lattices
-
   // precompute all required fibonacci lattices:
-  if((xy_avg = malloc((size_t)2 * sizeof(int) * samples_avg)))
-  {
-    int *tmp = xy_avg;
-    for(int u = 0; u < samples_avg; u++)
-    {
-      int dx, dy;
-      fib_latt(&dx, &dy, avg_radius, u, sampleidx_avg);
-      *tmp++ = dx;
-      *tmp++ = dy;
-    }
-  }
-  else
-  {
-    fprintf(stderr, "Error allocating memory for fibonacci lattice in: defringe module\n");
-    goto ERROR_EXIT;
-  }
+  if(!(xy_avg = _lattice(sampleidx_avg, avg_radius))) goto ERROR_EXIT;
+  if(!(xy_small = _lattice(sampleidx_small, small_radius))) goto ERROR_EXIT;
 
-  if((xy_small = malloc((size_t)2 * sizeof(int) * samples_small)))
-  {
-    int *tmp = xy_small;
-    for(int u = 0; u < samples_small; u++)
-    {
-      int dx, dy;
-      fib_latt(&dx, &dy, small_radius, u, sampleidx_small);
-      *tmp++ = dx;
-      *tmp++ = dy;
-    }
-  }
+#if defined(__SSE__)
+  if(use_sse2)
+    avg_edge_chroma = _edge_chroma_sse2(in, out, width, height, ch);
   else
-  {
-    fprintf(stderr, "Error allocating memory for fibonacci lattice in: defringe module\n");
-    goto ERROR_EXIT;
-  }
-
-#ifdef _OPENMP
-#pragma omp parallel for default(none) shared(width, height,                                                 \
-                                              d) reduction(+ : avg_edge_chroma) schedule(static)
 #endif
-  for(int v = 0; v < height; v++)
-  {
-    for(int t = 0; t < width; t++)
-    {
-      // edge-detect on color channels
-      // method: difference of original to gaussian blurred image:
-      float a = in[(size_t)v * width * ch + t * ch + 1] - out[(size_t)v * width * ch + t * ch + 1];
-      float b = in[(size_t)v * width * ch + t * ch + 2] - out[(size_t)v * width * ch + t * ch + 2];
-
-      float edge = (a * a + b * b); // range up to 2*(256)^2 -> approx. 0 to 131072
-
-      // save local edge chroma in out[.. +3] , this is later compared with threshold
-      out[(size_t)v * width * ch + t * ch + 3] = edge;
-      // the average chroma of the edge-layer in the roi
-      if(MODE_GLOBAL_AVERAGE == d->op_mode) avg_edge_chroma += edge;
-    }
-  }
+    avg_edge_chroma = _edge_chroma(in, out, width, height, ch);
 
   float thresh;
   if(MODE_GLOBAL_AVERAGE == d->op_mode)
@@ -382,6 +425,162 @@ FINISH_PROCESS:
   free(xy_avg);
 }
 
+void process(struct dt_iop_module_t *module, dt_dev_pixelpipe_iop_t *piece, const void *const i,
+             void *const o, const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
+{
+  _defringe(module, piece, i, o, roi_in, roi_out, FALSE);
+}
+
+#if defined(__SSE__)
+void process_sse2(struct dt_iop_module_t *module, dt_dev_pixelpipe_iop_t *piece, const void *const i,
+                  void *const o, const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
+{
+  _defringe(module, piece, i, o, roi_in, roi_out, TRUE);
+}
+#endif
+
+#ifdef HAVE_OPENCL
+int process_cl(struct dt_iop_module_t *module, dt_dev_pixelpipe_iop_t *piece, cl_mem dev_in, cl_mem dev_out,
+               const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
+{
+  dt_iop_defringe_data_t *d = (dt_iop_defringe_data_t *)piece->data;
+  dt_iop_defringe_global_data_t *gd = (dt_iop_defringe_global_data_t *)module->data;
+
+  const int devid = piece->pipe->devid;
+  const int width = roi_in->width;
+  const int height = roi_in->height;
+  const int order = 1;
+  const float sigma = fmax(0.1f, fabs(d->radius)) * roi_in->scale / piece->iscale;
+  const float Labmax[] = { 100.0f, 128.0f, 128.0f, 1.0f };
+  const float Labmin[] = { 0.0f, -128.0f, -128.0f, 0.0f };
+  const int radius = ceil(2.0 * ceilf(sigma));
+
+  dt_gaussian_cl_t *g = NULL;
+  cl_mem dev_blurred = NULL;
+  cl_mem dev_edge = NULL;
+  cl_mem dev_rows = NULL;
+  cl_mem dev_xy_small = NULL;
+  cl_mem dev_xy_avg = NULL;
+  int *xy_small = NULL;
+  int *xy_avg = NULL;
+  float *rows = NULL;
+  cl_int err = -999;
+
+  size_t origin[] = { 0, 0, 0 };
+  size_t region[] = { width, height, 1 };
+  if(roi_out->width < 2 * radius + 1 || roi_out->height < 2 * radius + 1)
+  {
+    err = dt_opencl_enqueue_copy_image(devid, dev_in, dev_out, origin, origin, region);
+    if(err != CL_SUCCESS) goto error;
+    return TRUE;
+  }
+
+  const int sampleidx_avg = _lattice_index(radius);
+  const int sampleidx_small = sampleidx_avg - 1;
+  const int samples_small = fib[sampleidx_small];
+  const int samples_avg = fib[sampleidx_avg];
+  if(!(xy_avg = _lattice(sampleidx_avg, 24 + radius * 4))) goto error;
+  if(!(xy_small = _lattice(sampleidx_small, MAX(radius, 3)))) goto error;
+
+  dev_xy_avg = dt_opencl_copy_host_to_device_constant(devid, (size_t)2 * sizeof(int) * samples_avg, xy_avg);
+  if(dev_xy_avg == NULL) goto error;
+  dev_xy_small = dt_opencl_copy_host_to_device_constant(devid, (size_t)2 * sizeof(int) * samples_small, xy_small);
+  if(dev_xy_small == NULL) goto error;
+
+  // the blurred copy only serves the edge detection, dev_out holds it for the time being
+  g = dt_gaussian_init_cl(devid, width, height, 4, Labmax, Labmin, sigma, order);
+  if(!g) goto error;
+  err = dt_gaussian_blur_cl(g, dev_in, dev_out);
+  if(err != CL_SUCCESS) goto error;
+  dt_gaussian_free_cl(g);
+  g = NULL;
+
+  dev_blurred = dev_out;
+  dev_edge = dt_opencl_alloc_device(devid, width, height, sizeof(float));
+  if(dev_edge == NULL) goto error;
+
+  size_t sizes[] = { ROUNDUPWD(width), ROUNDUPHT(height), 1 };
+  dt_opencl_set_kernel_arg(devid, gd->kernel_defringe_edge, 0, sizeof(cl_mem), (void *)&dev_in);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_defringe_edge, 1, sizeof(cl_mem), (void *)&dev_blurred);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_defringe_edge, 2, sizeof(cl_mem), (void *)&dev_edge);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_defringe_edge, 3, sizeof(int), (void *)&width);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_defringe_edge, 4, sizeof(int), (void *)&height);
+  err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_defringe_edge, sizes);
+  if(err != CL_SUCCESS) goto error;
+
+  float avg_edge_chroma, thresh;
+  if(MODE_GLOBAL_AVERAGE == d->op_mode)
+  {
+    dev_rows = dt_opencl_alloc_device_buffer(devid, sizeof(float) * height);
+    if(dev_rows == NULL) goto error;
+    rows = dt_alloc_align(64, sizeof(float) * height);
+    if(rows == NULL) goto error;
+
+    size_t sizes_rows[] = { ROUNDUPWD(height), 1, 1 };
+    dt_opencl_set_kernel_arg(devid, gd->kernel_defringe_rowsum, 0, sizeof(cl_mem), (void *)&dev_edge);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_defringe_rowsum, 1, sizeof(cl_mem), (void *)&dev_rows);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_defringe_rowsum, 2, sizeof(int), (void *)&width);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_defringe_rowsum, 3, sizeof(int), (void *)&height);
+    err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_defringe_rowsum, sizes_rows);
+    if(err != CL_SUCCESS) goto error;
+
+    err = dt_opencl_read_buffer_from_device(devid, (void *)rows, dev_rows, 0, sizeof(float) * height, CL_TRUE);
+    if(err != CL_SUCCESS) goto error;
+
+    float sum = 0.0f;
+    for(int k = 0; k < height; k++) sum += rows[k];
+    avg_edge_chroma = sum / (width * height) + 10.0 * FLT_EPSILON;
+    thresh = fmax(0.1f, 4.0 * d->thresh * avg_edge_chroma / MAGIC_THRESHOLD_COEFF);
+  }
+  else
+  {
+    // in local average mode the cpu keeps the average of the last pixel over the threshold in its row for
+    // the pixels below it, here they get this fixed value
+    avg_edge_chroma = MAGIC_THRESHOLD_COEFF;
+    thresh = fmax(0.1f, d->thresh);
+  }
+
+  const int local_average = (MODE_LOCAL_AVERAGE == d->op_mode);
+  const float user_thresh = d->thresh;
+  dt_opencl_set_kernel_arg(devid, gd->kernel_defringe_apply, 0, sizeof(cl_mem), (void *)&dev_in);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_defringe_apply, 1, sizeof(cl_mem), (void *)&dev_edge);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_defringe_apply, 2, sizeof(cl_mem), (void *)&dev_out);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_defringe_apply, 3, sizeof(int), (void *)&width);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_defringe_apply, 4, sizeof(int), (void *)&height);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_defringe_apply, 5, sizeof(int), (void *)&local_average);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_defringe_apply, 6, sizeof(float), (void *)&thresh);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_defringe_apply, 7, sizeof(float), (void *)&avg_edge_chroma);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_defringe_apply, 8, sizeof(float), (void *)&user_thresh);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_defringe_apply, 9, sizeof(cl_mem), (void *)&dev_xy_small);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_defringe_apply, 10, sizeof(int), (void *)&samples_small);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_defringe_apply, 11, sizeof(cl_mem), (void *)&dev_xy_avg);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_defringe_apply, 12, sizeof(int), (void *)&samples_avg);
+  err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_defringe_apply, sizes);
+  if(err != CL_SUCCESS) goto error;
+
+  dt_opencl_release_mem_object(dev_rows);
+  dt_opencl_release_mem_object(dev_edge);
+  dt_opencl_release_mem_object(dev_xy_small);
+  dt_opencl_release_mem_object(dev_xy_avg);
+  dt_free_align(rows);
+  free(xy_small);
+  free(xy_avg);
+  return TRUE;
+
+error:
+  if(g) dt_gaussian_free_cl(g);
+  dt_opencl_release_mem_object(dev_rows);
+  dt_opencl_release_mem_object(dev_edge);
+  dt_opencl_release_mem_object(dev_xy_small);
+  dt_opencl_release_mem_object(dev_xy_avg);
+  dt_free_align(rows);
+  free(xy_small);
+  free(xy_avg);
+  dt_print(DT_DEBUG_OPENCL, "[opencl_defringe] couldn't enqueue kernel! %d\n", err);
+  return FALSE;
+}
+#endif
+
 void reload_defaults(dt_iop_module_t *module)
 {
   module->default_enabled = 0;
@@ -398,7 +597,6 @@ void init(dt_iop_module_t *module)
   module->priority = 397; // module order created by iop_dependencies.py, do not edit!
   module->params_size = sizeof(dt_iop_defringe_params_t);
   module->gui_data = NULL;
-  module->data = NULL;
 }
 
 void cleanup(dt_iop_module_t *module)
@@ -407,6 +605,27 @@ void cleanup(dt_iop_module_t *module)
   module->params = NULL;
 }
 
+void init_global(dt_iop_module_so_t *module)
+{
+  const int program = 22; // defringe.cl, from programs.conf
+  dt_iop_defringe_global_data_t *gd
+      = (dt_iop_defringe_global_data_t *)malloc(sizeof(dt_iop_defringe_global_data_t));
+  module->data = gd;
+  gd->kernel_defringe_edge = dt_opencl_create_kernel(program, "defringe_edge");
+  gd->kernel_defringe_rowsum = dt_opencl_create_kernel(program, "defringe_rowsum");
+  gd->kernel_defringe_apply = dt_opencl_create_kernel(program, "defringe_apply");
+}
+
+void cleanup_global(dt_iop_module_so_t *module)
+{
+  dt_iop_defringe_global_data_t *gd = (dt_iop_defringe_global_data_t *)module->data;
+  dt_opencl_free_kernel(gd->kernel_defringe_apply);
+  dt_opencl_free_kernel(gd->kernel_defringe_rowsum);
+  dt_opencl_free_kernel(gd->kernel_defringe_edge);
+  free(module->data);
+  module->data = NULL;
+}
+
 static void radius_slider_callback(GtkWidget *w, dt_iop_module_t *module)
 {
   if(darktable.gui->reset) return;
@@ -136,6 +136,23 @@ typedef struct dt_iop_demosaic_global_data_t
   int kernel_markesteijn_zero;
   int kernel_markesteijn_accu;
   int kernel_markesteijn_final;
+  int kernel_amaze_init;
+  int kernel_amaze_gradients;
+  int kernel_amaze_colour_differences;
+  int kernel_amaze_variances;
+  int kernel_amaze_hvwt;
+  int kernel_amaze_nyquist_test;
+  int kernel_amaze_nyquist_vote;
+  int kernel_amaze_nyquist_area;
+  int kernel_amaze_populate_green;
+  int kernel_amaze_nyquist_refine;
+  int kernel_amaze_diagonal_gradients;
+  int kernel_amaze_diagonal_interpolate;
+  int kernel_amaze_rbint;
+  int kernel_amaze_diagonal_green;
+  int kernel_amaze_chroma_split;
+  int kernel_amaze_chroma;
+  int kernel_amaze_output;
 } dt_iop_demosaic_global_data_t;
 
 typedef struct dt_iop_demosaic_data_t
@@ -520,6 +537,449 @@ static inline const short *const hexmap(const int row, const int col,
 /*
    Frank Markesteijn's algorithm for Fuji X-Trans sensors
  */
+/* one TSxTS tile of xtrans_markesteijn_interpolate(), at top/left of the image. the buffer holds the
+   TSxTS * (ndir * 4 + 3) floats of the thread. */
+DT_ALWAYS_INLINE void markesteijn_tile(float *out, const float *const in, const dt_iop_roi_t *const roi_in,
+                                       const uint8_t (*const xtrans)[6], short (*const allhex)[3][8],
+                                       const unsigned short sgrow, const unsigned short sgcol,
+                                       const int passes, const int width, const int height, const int top,
+                                       const int left, char *const buffer)
+{
+  static const short dir[4] = { 1, TS, TS + 1, TS - 1 };
+  const int ndir = 4 << (passes > 1);
+  const int pad_tile = (passes == 1) ? 12 : 17;
+
+  // rgb points to ndir TSxTS tiles of 3 channels (R, G, and B)
+  float(*rgb)[TS][TS][3] = (float(*)[TS][TS][3])buffer;
+  // yuv points to 3 channel (Y, u, and v) TSxTS tiles
+  // note that channels come before tiles to allow for a
+  // vectorization optimization when building drv[] from yuv[]
+  float (*const yuv)[TS][TS] = (float(*)[TS][TS])(buffer + TS * TS * (ndir * 3) * sizeof(float));
+  // drv points to ndir TSxTS tiles, each a single chanel of derivatives
+  float (*const drv)[TS][TS] = (float(*)[TS][TS])(buffer + TS * TS * (ndir * 3 + 3) * sizeof(float));
+  // gmin and gmax reuse memory which is used later by yuv buffer;
+  // each points to a TSxTS tile of single channel data
+  float (*const gmin)[TS] = (float(*)[TS])(buffer + TS * TS * (ndir * 3) * sizeof(float));
+  float (*const gmax)[TS] = (float(*)[TS])(buffer + TS * TS * (ndir * 3 + 1) * sizeof(float));
+  // homo and homosum reuse memory which is used earlier in the
+  // loop; each points to ndir single-channel TSxTS tiles
+  uint8_t (*const homo)[TS][TS] = (uint8_t(*)[TS][TS])(buffer + TS * TS * (ndir * 3) * sizeof(float));
+  uint8_t (*const homosum)[TS][TS] = (uint8_t(*)[TS][TS])(buffer + TS * TS * (ndir * 3) * sizeof(float)
+                                                          + TS * TS * ndir * sizeof(uint8_t));
+
+  int mrow = MIN(top + TS, height + pad_tile);
+  int mcol = MIN(left + TS, width + pad_tile);
+
+  // Copy current tile from in to image buffer. If border goes
+  // beyond edges of image, fill with mirrored/interpolated edges.
+  // The extra border avoids discontinuities at image edges.
+  for(int row = top; row < mrow; row++)
+    for(int col = left; col < mcol; col++)
+    {
+      float(*const pix) = rgb[0][row - top][col - left];
+      if((col >= 0) && (row >= 0) && (col < width) && (row < height))
+      {
+        const int f = FCxtrans(row, col, roi_in, xtrans);
+        for(int c = 0; c < 3; c++) pix[c] = (c == f) ? in[roi_in->width * row + col] : 0.f;
+      }
+      else
+      {
+        // mirror a border pixel if beyond image edge
+        const int c = FCxtrans(row, col, roi_in, xtrans);
+        for(int cc = 0; cc < 3; cc++)
+          if(cc != c)
+            pix[cc] = 0.0f;
+          else
+          {
+#define TRANSLATE(n, size) ((n >= size) ? (2 * size - n - 2) : abs(n))
+            const int cy = TRANSLATE(row, height), cx = TRANSLATE(col, width);
+            if(c == FCxtrans(cy, cx, roi_in, xtrans))
+              pix[c] = in[roi_in->width * cy + cx];
+            else
+            {
+              // interpolate if mirror pixel is a different color
+              float sum = 0.0f;
+              uint8_t count = 0;
+              for(int y = row - 1; y <= row + 1; y++)
+                for(int x = col - 1; x <= col + 1; x++)
+                {
+                  const int yy = TRANSLATE(y, height), xx = TRANSLATE(x, width);
+                  const int ff = FCxtrans(yy, xx, roi_in, xtrans);
+                  if(ff == c)
+                  {
+                    sum += in[roi_in->width * yy + xx];
+                    count++;
+                  }
+                }
+              pix[c] = sum / count;
+            }
+          }
+      }
+    }
+
+  // duplicate rgb[0] to rgb[1], rgb[2], and rgb[3]
+  for(int c = 1; c <= 3; c++) memcpy(rgb[c], rgb[0], sizeof(*rgb));
+
+  // note that successive calculations are inset within the tile
+  // so as to give enough border data, and there needs to be a 6
+  // pixel border initially to allow allhex to find neighboring
+  // pixels
+
+  /* Set green1 and green3 to the minimum and maximum allowed values:   */
+  // Run through each red/blue or blue/red pair, setting their g1
+  // and g3 values to the min/max of green pixels surrounding the
+  // pair. Use a 3 pixel border as gmin/gmax is used by
+  // interpolate green which has a 3 pixel border.
+  const int pad_g1_g3 = 3;
+  for(int row = top + pad_g1_g3; row < mrow - pad_g1_g3; row++)
+  {
+    // setting max to 0.0f signifies that this is a new pair, which
+    // requires a new min/max calculation of its neighboring greens
+    float min = FLT_MAX, max = 0.0f;
+    for(int col = left + pad_g1_g3; col < mcol - pad_g1_g3; col++)
+    {
+      // if in row of horizontal red & blue pairs (or processing
+      // vertical red & blue pairs near image bottom), reset min/max
+      // between each pair
+      if(FCxtrans(row, col, roi_in, xtrans) == 1)
+      {
+        min = FLT_MAX, max = 0.0f;
+        continue;
+      }
+      // if at start of red & blue pair, calculate min/max of green
+      // pixels surrounding it; note that while normally using == to
+      // compare floats is suspect, here the check is if 0.0f has
+      // explicitly been assigned to max (which signifies a new
+      // red/blue pair)
+      if(max == 0.0f)
+      {
+        float (*const pix)[3] = &rgb[0][row - top][col - left];
+        const short *const hex = hexmap(row,col,allhex);
+        for(int c = 0; c < 6; c++)
+        {
+          const float val = pix[hex[c]][1];
+          if(min > val) min = val;
+          if(max < val) max = val;
+        }
+      }
+      gmin[row - top][col - left] = min;
+      gmax[row - top][col - left] = max;
+      // handle vertical red/blue pairs
+      switch((row - sgrow) % 3)
+      {
+        // hop down a row to second pixel in vertical pair
+        case 1:
+          if(row < mrow - 4) row++, col--;
+          break;
+        // then if not done with the row hop up and right to next
+        // vertical red/blue pair, resetting min/max
+        case 2:
+          min = FLT_MAX, max = 0.0f;
+          if((col += 2) < mcol - 4 && row > top + 3) row--;
+      }
+    }
+  }
+
+  /* Interpolate green horizontally, vertically, and along both diagonals: */
+  // need a 3 pixel border here as 3*hex[] can have a 3 unit offset
+  const int pad_g_interp = 3;
+  for(int row = top + pad_g_interp; row < mrow - pad_g_interp; row++)
+    for(int col = left + pad_g_interp; col < mcol - pad_g_interp; col++)
+    {
+      float color[8];
+      int f = FCxtrans(row, col, roi_in, xtrans);
+      if(f == 1) continue;
+      float (*const pix)[3] = &rgb[0][row - top][col - left];
+      const short *const hex = hexmap(row,col,allhex);
+      // TODO: these constants come from integer math constants in
+      // dcraw -- calculate them instead from interpolation math
+      color[0] = 0.6796875f * (pix[hex[1]][1] + pix[hex[0]][1])
+                 - 0.1796875f * (pix[2 * hex[1]][1] + pix[2 * hex[0]][1]);
+      color[1] = 0.87109375f * pix[hex[3]][1] + pix[hex[2]][1] * 0.13f
+                 + 0.359375f * (pix[0][f] - pix[-hex[2]][f]);
+      for(int c = 0; c < 2; c++)
+        color[2 + c] = 0.640625f * pix[hex[4 + c]][1] + 0.359375f * pix[-2 * hex[4 + c]][1]
+                       + 0.12890625f * (2 * pix[0][f] - pix[3 * hex[4 + c]][f] - pix[-3 * hex[4 + c]][f]);
+      for(int c = 0; c < 4; c++)
+        rgb[c ^ !((row - sgrow) % 3)][row - top][col - left][1]
+            = CLAMPS(color[c], gmin[row - top][col - left], gmax[row - top][col - left]);
+    }
+
+  for(int pass = 0; pass < passes; pass++)
+  {
+    if(pass == 1)
+    {
+      // if on second pass, copy rgb[0] to [3] into rgb[4] to [7],
+      // and process that second set of buffers
+      memcpy(rgb + 4, rgb, (size_t)4 * sizeof(*rgb));
+      rgb += 4;
+    }
+
+    /* Recalculate green from interpolated values of closer pixels: */
+    if(pass)
+    {
+      const int pad_g_recalc = 6;
+      for(int row = top + pad_g_recalc; row < mrow - pad_g_recalc; row++)
+        for(int col = left + pad_g_recalc; col < mcol - pad_g_recalc; col++)
+        {
+          int f = FCxtrans(row, col, roi_in, xtrans);
+          if(f == 1) continue;
+          const short *const hex = hexmap(row,col,allhex);
+          for(int d = 3; d < 6; d++)
+          {
+            float(*rfx)[3] = &rgb[(d - 2) ^ !((row - sgrow) % 3)][row - top][col - left];
+            float val = rfx[-2 * hex[d]][1] + 2 * rfx[hex[d]][1] - rfx[-2 * hex[d]][f]
+                        - 2 * rfx[hex[d]][f] + 3 * rfx[0][f];
+            rfx[0][1] = CLAMPS(val / 3.0f, gmin[row - top][col - left], gmax[row - top][col - left]);
+          }
+        }
+    }
+
+    /* Interpolate red and blue values for solitary green pixels:   */
+    const int pad_rb_g = (passes == 1) ? 6 : 5;
+    for(int row = (top - sgrow + pad_rb_g + 2) / 3 * 3 + sgrow; row < mrow - pad_rb_g; row += 3)
+      for(int col = (left - sgcol + pad_rb_g + 2) / 3 * 3 + sgcol; col < mcol - pad_rb_g; col += 3)
+      {
+        float(*rfx)[3] = &rgb[0][row - top][col - left];
+        int h = FCxtrans(row, col + 1, roi_in, xtrans);
+        float diff[6] = { 0.0f };
+        // interplated color: first index is red/blue, second is
+        // pass, is double actual result
+        float color[2][6];
+        // Six passes, alternating hori/vert interp (i),
+        // starting with R or B (h) depending on which is closest.
+        // Passes 0,1 to rgb[0], rgb[1] of hori/vert interp. Pass
+        // 3,5 to rgb[2], rgb[3] of best of interp hori/vert
+        // results. Each pass which outputs moves on to the next
+        // rgb[] for input of interp greens.
+        for(int i = 1, d = 0; d < 6; d++, i ^= TS ^ 1, h ^= 2)
+        {
+          // look 1 and 2 pixels distance from solitary green to
+          // red then blue or blue then red
+          for(int c = 0; c < 2; c++, h ^= 2)
+          {
+            // rate of change in greens between current pixel and
+            // interpolated pixels 1 or 2 distant: a quick
+            // derivative which will be divided by two later to be
+            // rate of luminance change for red/blue between known
+            // red/blue neighbors and the current unknown pixel
+            float g = 2 * rfx[0][1] - rfx[i << c][1] - rfx[-(i << c)][1];
+            // color is halved before being stored in rgb, hence
+            // this becomes green rate of change plus the average
+            // of the near red or blue pixels on current axis
+            color[h != 0][d] = g + rfx[i << c][h] + rfx[-(i << c)][h];
+            // Note that diff will become the slope for both red
+            // and blue differentials in the current direction.
+            // For 2nd and 3rd hori+vert passes, create a sum of
+            // steepness for both cardinal directions.
+            if(d > 1)
+              diff[d] += SQR(rfx[i << c][1] - rfx[-(i << c)][1] - rfx[i << c][h] + rfx[-(i << c)][h])
+                         + SQR(g);
+          }
+          if((d < 2) || (d & 1))
+          { // output for passes 0, 1, 3, 5
+            // for 0, 1 just use hori/vert, for 3, 5 use best of x/y dir
+            const int d_out = d - ((d > 1) && (diff[d-1] < diff[d]));
+            rfx[0][0] = color[0][d_out] / 2.f;
+            rfx[0][2] = color[1][d_out] / 2.f;
+            rfx += TS * TS;
+          }
+        }
+      }
+
+    /* Interpolate red for blue pixels and vice versa:              */
+    const int pad_rb_br = (passes == 1) ? 6 : 5;
+    for(int row = top + pad_rb_br; row < mrow - pad_rb_br; row++)
+      for(int col = left + pad_rb_br; col < mcol - pad_rb_br; col++)
+      {
+        int f = 2 - FCxtrans(row, col, roi_in, xtrans);
+        if(f == 1) continue;
+        float(*rfx)[3] = &rgb[0][row - top][col - left];
+        int c = (row - sgrow) % 3 ? TS : 1;
+        int h = 3 * (c ^ TS ^ 1);
+        for(int d = 0; d < 4; d++, rfx += TS * TS)
+        {
+          int i = d > 1 || ((d ^ c) & 1) ||
+            ((fabsf(rfx[0][1]-rfx[c][1]) + fabsf(rfx[0][1]-rfx[-c][1])) <
+             2.f*(fabsf(rfx[0][1]-rfx[h][1]) + fabsf(rfx[0][1]-rfx[-h][1]))) ? c:h;
+          rfx[0][f] = (rfx[i][f] + rfx[-i][f] + 2.f * rfx[0][1] - rfx[i][1] - rfx[-i][1]) / 2.f;
+        }
+      }
+
+    /* Fill in red and blue for 2x2 blocks of green:                */
+    const int pad_g22 = (passes == 1) ? 8 : 4;
+    for(int row = top + pad_g22; row < mrow - pad_g22; row++)
+      if((row - sgrow) % 3)
+        for(int col = left + pad_g22; col < mcol - pad_g22; col++)
+          if((col - sgcol) % 3)
+          {
+            float(*rfx)[3] = &rgb[0][row - top][col - left];
+            const short *const hex = hexmap(row,col,allhex);
+            for(int d = 0; d < ndir; d += 2, rfx += TS * TS)
+              if(hex[d] + hex[d + 1])
+              {
+                float g = 3.f * rfx[0][1] - 2.f * rfx[hex[d]][1] - rfx[hex[d + 1]][1];
+                for(int c = 0; c < 4; c += 2)
+                  rfx[0][c] = (g + 2.f * rfx[hex[d]][c] + rfx[hex[d + 1]][c]) / 3.f;
+              }
+              else
+              {
+                float g = 2.f * rfx[0][1] - rfx[hex[d]][1] - rfx[hex[d + 1]][1];
+                for(int c = 0; c < 4; c += 2)
+                  rfx[0][c] = (g + rfx[hex[d]][c] + rfx[hex[d + 1]][c]) / 2.f;
+              }
+          }
+  } // end of multipass loop
+
+  // jump back to the first set of rgb buffers (this is a nop
+  // unless on the second pass)
+  rgb = (float(*)[TS][TS][3])buffer;
+  // from here on out, mainly are working within the current tile
+  // rather than in reference to the image, so don't offset
+  // mrow/mcol by top/left of tile
+  mrow -= top;
+  mcol -= left;
+
+  /* Convert to perceptual colorspace and differentiate in all directions:  */
+  // Original dcraw algorithm uses CIELab as perceptual space
+  // (presumably coming from original AHD) and converts taking
+  // camera matrix into account. Now use YPbPr which requires much
+  // less code and is nearly indistinguishable. It assumes the
+  // camera RGB is roughly linear.
+  for(int d = 0; d < ndir; d++)
+  {
+    const int pad_yuv = (passes == 1) ? 8 : 13;
+    for(int row = pad_yuv; row < mrow - pad_yuv; row++)
+      for(int col = pad_yuv; col < mcol - pad_yuv; col++)
+      {
+        float *rx = rgb[d][row][col];
+        // use ITU-R BT.2020 YPbPr, which is great, but could use
+        // a better/simpler choice? note that imageop.h provides
+        // dt_iop_RGB_to_YCbCr which uses Rec. 601 conversion,
+        // which appears less good with specular highlights
+        float y = 0.2627f * rx[0] + 0.6780f * rx[1] + 0.0593f * rx[2];
+        yuv[0][row][col] = y;
+        yuv[1][row][col] = (rx[2] - y) * 0.56433f;
+        yuv[2][row][col] = (rx[0] - y) * 0.67815f;
+      }
+    // Note that f can offset by a column (-1 or +1) and by a row
+    // (-TS or TS). The row-wise offsets cause the undefined
+    // behavior sanitizer to warn of an out of bounds index, but
+    // as yfx is multi-dimensional and there is sufficient
+    // padding, that is not actually so.
+    const int f = dir[d & 3];
+    const int pad_drv = (passes == 1) ? 9 : 14;
+    for(int row = pad_drv; row < mrow - pad_drv; row++)
+      for(int col = pad_drv; col < mcol - pad_drv; col++)
+      {
+        float(*yfx)[TS][TS] = (float(*)[TS][TS]) & yuv[0][row][col];
+        drv[d][row][col] = SQR(2 * yfx[0][0][0] - yfx[0][0][f] - yfx[0][0][-f])
+                           + SQR(2 * yfx[1][0][0] - yfx[1][0][f] - yfx[1][0][-f])
+                           + SQR(2 * yfx[2][0][0] - yfx[2][0][f] - yfx[2][0][-f]);
+      }
+  }
+
+  /* Build homogeneity maps from the derivatives:                   */
+  memset(homo, 0, (size_t)ndir * TS * TS * sizeof(uint8_t));
+  const int pad_homo = (passes == 1) ? 10 : 15;
+  for(int row = pad_homo; row < mrow - pad_homo; row++)
+  {
+    // eight times the smallest derivative, then the neighbours under it one direction after the other, so
+    // all loops run along the row
+    float tr[TS];
+    for(int col = pad_homo; col < mcol - pad_homo; col++) tr[col] = drv[0][row][col];
+    for(int d = 1; d < ndir; d++)
+      for(int col = pad_homo; col < mcol - pad_homo; col++) tr[col] = MIN(tr[col], drv[d][row][col]);
+    for(int col = pad_homo; col < mcol - pad_homo; col++) tr[col] *= 8;
+    for(int d = 0; d < ndir; d++)
+      for(int v = -1; v <= 1; v++)
+        for(int h = -1; h <= 1; h++)
+          for(int col = pad_homo; col < mcol - pad_homo; col++)
+            homo[d][row][col] += ((drv[d][row + v][col + h] <= tr[col]) ? 1 : 0);
+  }
+
+  /* Build 5x5 sum of homogeneity maps for each pixel & direction */
+  for(int d = 0; d < ndir; d++)
+    for(int row = pad_tile; row < mrow - pad_tile; row++)
+    {
+      // vertical sums of 5 first, then horizontal ones of those. pad_homo is 2 pixels less than pad_tile, so
+      // the 5x5 windows stay within the homogeneity map.
+      uint8_t v5sum[TS];
+      for(int col = pad_tile - 2; col < mcol - pad_tile + 2; col++)
+        v5sum[col] = homo[d][row - 2][col] + homo[d][row - 1][col] + homo[d][row][col] + homo[d][row + 1][col]
+                     + homo[d][row + 2][col];
+      for(int col = pad_tile; col < mcol - pad_tile; col++)
+        homosum[d][row][col] = v5sum[col - 2] + v5sum[col - 1] + v5sum[col] + v5sum[col + 1] + v5sum[col + 2];
+    }
+
+  /* Average the most homogenous pixels for the final result:       */
+  for(int row = pad_tile; row < mrow - pad_tile; row++)
+    for(int col = pad_tile; col < mcol - pad_tile; col++)
+    {
+      uint8_t hm[8] = { 0 };
+      uint8_t maxval = 0;
+      for(int d = 0; d < ndir; d++)
+      {
+        hm[d] = homosum[d][row][col];
+        maxval = (maxval < hm[d] ? hm[d] : maxval);
+      }
+      maxval -= maxval >> 3;
+      for(int d = 0; d < ndir - 4; d++)
+        if(hm[d] < hm[d + 4])
+          hm[d] = 0;
+        else if(hm[d] > hm[d + 4])
+          hm[d + 4] = 0;
+      float avg[4] = { 0.0f };
+      for(int d = 0; d < ndir; d++)
+        if(hm[d] >= maxval)
+        {
+          for(int c = 0; c < 3; c++) avg[c] += rgb[d][row][col][c];
+          avg[3]++;
+        }
+      for(int c = 0; c < 3; c++)
+        out[4 * (width * (row + top) + col + left) + c] =
+          avg[c]/avg[3];
+    }
+}
+
+typedef void(markesteijn_tile_func)(float *out, const float *const in, const dt_iop_roi_t *const roi_in,
+                                    const uint8_t (*const xtrans)[6], short (*const allhex)[3][8],
+                                    const unsigned short sgrow, const unsigned short sgcol, const int passes,
+                                    const int width, const int height, const int top, const int left,
+                                    char *const buffer);
+
+#ifdef DT_TARGET_AVX2
+static DT_TARGET_AVX2 void markesteijn_tile_avx2(float *out, const float *const in,
+                                                 const dt_iop_roi_t *const roi_in,
+                                                 const uint8_t (*const xtrans)[6], short (*const allhex)[3][8],
+                                                 const unsigned short sgrow, const unsigned short sgcol,
+                                                 const int passes, const int width, const int height,
+                                                 const int top, const int left, char *const buffer)
+{
+  markesteijn_tile(out, in, roi_in, xtrans, allhex, sgrow, sgcol, passes, width, height, top, left, buffer);
+}
+
+static DT_TARGET_AVX512 void markesteijn_tile_avx512(float *out, const float *const in,
+                                                     const dt_iop_roi_t *const roi_in,
+                                                     const uint8_t (*const xtrans)[6],
+                                                     short (*const allhex)[3][8], const unsigned short sgrow,
+                                                     const unsigned short sgcol, const int passes,
+                                                     const int width, const int height, const int top,
+                                                     const int left, char *const buffer)
+{
+  markesteijn_tile(out, in, roi_in, xtrans, allhex, sgrow, sgcol, passes, width, height, top, left, buffer);
+}
+#endif
+
+static markesteijn_tile_func *markesteijn_choose_tile_func(void)
+{
+#ifdef DT_TARGET_AVX2
+  if(darktable.codepath.AVX512) return markesteijn_tile_avx512;
+  if(darktable.codepath.AVX2) return markesteijn_tile_avx2;
+#endif
+  return markesteijn_tile;
+}
+
 static void xtrans_markesteijn_interpolate(float *out, const float *const in,
                                            const dt_iop_roi_t *const roi_out,
                                            const dt_iop_roi_t *const roi_in,
@@ -527,8 +987,7 @@ static void xtrans_markesteijn_interpolate(float *out, const float *const in,
 {
   static const short orth[12] = { 1, 0, 0, 1, -1, 0, 0, -1, 1, 0, 0, 1 },
                      patt[2][16] = { { 0, 1, 0, -1, 2, 0, -1, 0, 1, 1, 1, -1, 0, 0, 0, 0 },
-                                     { 0, 1, 0, -2, 1, 0, -2, 0, 1, 1, -2, -2, 1, -1, -1, 1 } },
-                     dir[4] = { 1, TS, TS + 1, TS - 1 };
+                                     { 0, 1, 0, -2, 1, 0, -2, 0, 1, 1, -2, -2, 1, -1, -1, 1 } };
 
   short allhex[3][3][8];
   // sgrow/sgcol is the offset in the sensor matrix of the solitary
@@ -576,6 +1035,7 @@ static void xtrans_markesteijn_interpolate(float *out, const float *const in,
 
   // extra passes propagates out errors at edges, hence need more padding
   const int pad_tile = (passes == 1) ? 12 : 17;
+  markesteijn_tile_func *const tile = markesteijn_choose_tile_func();
 #ifdef _OPENMP
 #pragma omp parallel for default(none) shared(sgrow, sgcol, allhex, out) schedule(dynamic)
 #endif
@@ -584,401 +1044,8 @@ static void xtrans_markesteijn_interpolate(float *out, const float *const in,
   for(int top = -pad_tile; top < height - pad_tile; top += TS - (pad_tile*2))
   {
     char *const buffer = all_buffers + dt_get_thread_num() * buffer_size;
-    // rgb points to ndir TSxTS tiles of 3 channels (R, G, and B)
-    float(*rgb)[TS][TS][3] = (float(*)[TS][TS][3])buffer;
-    // yuv points to 3 channel (Y, u, and v) TSxTS tiles
-    // note that channels come before tiles to allow for a
-    // vectorization optimization when building drv[] from yuv[]
-    float (*const yuv)[TS][TS] = (float(*)[TS][TS])(buffer + TS * TS * (ndir * 3) * sizeof(float));
-    // drv points to ndir TSxTS tiles, each a single chanel of derivatives
-    float (*const drv)[TS][TS] = (float(*)[TS][TS])(buffer + TS * TS * (ndir * 3 + 3) * sizeof(float));
-    // gmin and gmax reuse memory which is used later by yuv buffer;
-    // each points to a TSxTS tile of single channel data
-    float (*const gmin)[TS] = (float(*)[TS])(buffer + TS * TS * (ndir * 3) * sizeof(float));
-    float (*const gmax)[TS] = (float(*)[TS])(buffer + TS * TS * (ndir * 3 + 1) * sizeof(float));
-    // homo and homosum reuse memory which is used earlier in the
-    // loop; each points to ndir single-channel TSxTS tiles
-    uint8_t (*const homo)[TS][TS] = (uint8_t(*)[TS][TS])(buffer + TS * TS * (ndir * 3) * sizeof(float));
-    uint8_t (*const homosum)[TS][TS] = (uint8_t(*)[TS][TS])(buffer + TS * TS * (ndir * 3) * sizeof(float)
-                                                            + TS * TS * ndir * sizeof(uint8_t));
-
     for(int left = -pad_tile; left < width - pad_tile; left += TS - (pad_tile*2))
-    {
-      int mrow = MIN(top + TS, height + pad_tile);
-      int mcol = MIN(left + TS, width + pad_tile);
-
-      // Copy current tile from in to image buffer. If border goes
-      // beyond edges of image, fill with mirrored/interpolated edges.
-      // The extra border avoids discontinuities at image edges.
-      for(int row = top; row < mrow; row++)
-        for(int col = left; col < mcol; col++)
-        {
-          float(*const pix) = rgb[0][row - top][col - left];
-          if((col >= 0) && (row >= 0) && (col < width) && (row < height))
-          {
-            const int f = FCxtrans(row, col, roi_in, xtrans);
-            for(int c = 0; c < 3; c++) pix[c] = (c == f) ? in[roi_in->width * row + col] : 0.f;
-          }
-          else
-          {
-            // mirror a border pixel if beyond image edge
-            const int c = FCxtrans(row, col, roi_in, xtrans);
-            for(int cc = 0; cc < 3; cc++)
-              if(cc != c)
-                pix[cc] = 0.0f;
-              else
-              {
-#define TRANSLATE(n, size) ((n >= size) ? (2 * size - n - 2) : abs(n))
-                const int cy = TRANSLATE(row, height), cx = TRANSLATE(col, width);
-                if(c == FCxtrans(cy, cx, roi_in, xtrans))
-                  pix[c] = in[roi_in->width * cy + cx];
-                else
-                {
-                  // interpolate if mirror pixel is a different color
-                  float sum = 0.0f;
-                  uint8_t count = 0;
-                  for(int y = row - 1; y <= row + 1; y++)
-                    for(int x = col - 1; x <= col + 1; x++)
-                    {
-                      const int yy = TRANSLATE(y, height), xx = TRANSLATE(x, width);
-                      const int ff = FCxtrans(yy, xx, roi_in, xtrans);
-                      if(ff == c)
-                      {
-                        sum += in[roi_in->width * yy + xx];
-                        count++;
-                      }
-                    }
-                  pix[c] = sum / count;
-                }
-              }
-          }
-        }
-
-      // duplicate rgb[0] to rgb[1], rgb[2], and rgb[3]
-      for(int c = 1; c <= 3; c++) memcpy(rgb[c], rgb[0], sizeof(*rgb));
-
-      // note that successive calculations are inset within the tile
-      // so as to give enough border data, and there needs to be a 6
-      // pixel border initially to allow allhex to find neighboring
-      // pixels
-
-      /* Set green1 and green3 to the minimum and maximum allowed values:   */
-      // Run through each red/blue or blue/red pair, setting their g1
-      // and g3 values to the min/max of green pixels surrounding the
-      // pair. Use a 3 pixel border as gmin/gmax is used by
-      // interpolate green which has a 3 pixel border.
-      const int pad_g1_g3 = 3;
-      for(int row = top + pad_g1_g3; row < mrow - pad_g1_g3; row++)
-      {
-        // setting max to 0.0f signifies that this is a new pair, which
-        // requires a new min/max calculation of its neighboring greens
-        float min = FLT_MAX, max = 0.0f;
-        for(int col = left + pad_g1_g3; col < mcol - pad_g1_g3; col++)
-        {
-          // if in row of horizontal red & blue pairs (or processing
-          // vertical red & blue pairs near image bottom), reset min/max
-          // between each pair
-          if(FCxtrans(row, col, roi_in, xtrans) == 1)
-          {
-            min = FLT_MAX, max = 0.0f;
-            continue;
-          }
-          // if at start of red & blue pair, calculate min/max of green
-          // pixels surrounding it; note that while normally using == to
-          // compare floats is suspect, here the check is if 0.0f has
-          // explicitly been assigned to max (which signifies a new
-          // red/blue pair)
-          if(max == 0.0f)
-          {
-            float (*const pix)[3] = &rgb[0][row - top][col - left];
-            const short *const hex = hexmap(row,col,allhex);
-            for(int c = 0; c < 6; c++)
-            {
-              const float val = pix[hex[c]][1];
-              if(min > val) min = val;
-              if(max < val) max = val;
-            }
-          }
-          gmin[row - top][col - left] = min;
-          gmax[row - top][col - left] = max;
-          // handle vertical red/blue pairs
-          switch((row - sgrow) % 3)
-          {
-            // hop down a row to second pixel in vertical pair
-            case 1:
-              if(row < mrow - 4) row++, col--;
-              break;
-            // then if not done with the row hop up and right to next
-            // vertical red/blue pair, resetting min/max
-            case 2:
-              min = FLT_MAX, max = 0.0f;
-              if((col += 2) < mcol - 4 && row > top + 3) row--;
-          }
-        }
-      }
-
-      /* Interpolate green horizontally, vertically, and along both diagonals: */
-      // need a 3 pixel border here as 3*hex[] can have a 3 unit offset
-      const int pad_g_interp = 3;
-      for(int row = top + pad_g_interp; row < mrow - pad_g_interp; row++)
-        for(int col = left + pad_g_interp; col < mcol - pad_g_interp; col++)
-        {
-          float color[8];
-          int f = FCxtrans(row, col, roi_in, xtrans);
-          if(f == 1) continue;
-          float (*const pix)[3] = &rgb[0][row - top][col - left];
-          const short *const hex = hexmap(row,col,allhex);
-          // TODO: these constants come from integer math constants in
-          // dcraw -- calculate them instead from interpolation math
-          color[0] = 0.6796875f * (pix[hex[1]][1] + pix[hex[0]][1])
-                     - 0.1796875f * (pix[2 * hex[1]][1] + pix[2 * hex[0]][1]);
-          color[1] = 0.87109375f * pix[hex[3]][1] + pix[hex[2]][1] * 0.13f
-                     + 0.359375f * (pix[0][f] - pix[-hex[2]][f]);
-          for(int c = 0; c < 2; c++)
-            color[2 + c] = 0.640625f * pix[hex[4 + c]][1] + 0.359375f * pix[-2 * hex[4 + c]][1]
-                           + 0.12890625f * (2 * pix[0][f] - pix[3 * hex[4 + c]][f] - pix[-3 * hex[4 + c]][f]);
-          for(int c = 0; c < 4; c++)
-            rgb[c ^ !((row - sgrow) % 3)][row - top][col - left][1]
-                = CLAMPS(color[c], gmin[row - top][col - left], gmax[row - top][col - left]);
-        }
-
-      for(int pass = 0; pass < passes; pass++)
-      {
-        if(pass == 1)
-        {
-          // if on second pass, copy rgb[0] to [3] into rgb[4] to [7],
-          // and process that second set of buffers
-          memcpy(rgb + 4, rgb, (size_t)4 * sizeof(*rgb));
-          rgb += 4;
-        }
-
-        /* Recalculate green from interpolated values of closer pixels: */
-        if(pass)
-        {
-          const int pad_g_recalc = 6;
-          for(int row = top + pad_g_recalc; row < mrow - pad_g_recalc; row++)
-            for(int col = left + pad_g_recalc; col < mcol - pad_g_recalc; col++)
-            {
-              int f = FCxtrans(row, col, roi_in, xtrans);
-              if(f == 1) continue;
-              const short *const hex = hexmap(row,col,allhex);
-              for(int d = 3; d < 6; d++)
-              {
-                float(*rfx)[3] = &rgb[(d - 2) ^ !((row - sgrow) % 3)][row - top][col - left];
-                float val = rfx[-2 * hex[d]][1] + 2 * rfx[hex[d]][1] - rfx[-2 * hex[d]][f]
-                            - 2 * rfx[hex[d]][f] + 3 * rfx[0][f];
-                rfx[0][1] = CLAMPS(val / 3.0f, gmin[row - top][col - left], gmax[row - top][col - left]);
-              }
-            }
-        }
-
-        /* Interpolate red and blue values for solitary green pixels:   */
-        const int pad_rb_g = (passes == 1) ? 6 : 5;
-        for(int row = (top - sgrow + pad_rb_g + 2) / 3 * 3 + sgrow; row < mrow - pad_rb_g; row += 3)
-          for(int col = (left - sgcol + pad_rb_g + 2) / 3 * 3 + sgcol; col < mcol - pad_rb_g; col += 3)
-          {
-            float(*rfx)[3] = &rgb[0][row - top][col - left];
-            int h = FCxtrans(row, col + 1, roi_in, xtrans);
-            float diff[6] = { 0.0f };
-            // interplated color: first index is red/blue, second is
-            // pass, is double actual result
-            float color[2][6];
-            // Six passes, alternating hori/vert interp (i),
-            // starting with R or B (h) depending on which is closest.
-            // Passes 0,1 to rgb[0], rgb[1] of hori/vert interp. Pass
-            // 3,5 to rgb[2], rgb[3] of best of interp hori/vert
-            // results. Each pass which outputs moves on to the next
-            // rgb[] for input of interp greens.
-            for(int i = 1, d = 0; d < 6; d++, i ^= TS ^ 1, h ^= 2)
-            {
-              // look 1 and 2 pixels distance from solitary green to
-              // red then blue or blue then red
-              for(int c = 0; c < 2; c++, h ^= 2)
-              {
-                // rate of change in greens between current pixel and
-                // interpolated pixels 1 or 2 distant: a quick
-                // derivative which will be divided by two later to be
-                // rate of luminance change for red/blue between known
-                // red/blue neighbors and the current unknown pixel
-                float g = 2 * rfx[0][1] - rfx[i << c][1] - rfx[-(i << c)][1];
-                // color is halved before being stored in rgb, hence
-                // this becomes green rate of change plus the average
-                // of the near red or blue pixels on current axis
-                color[h != 0][d] = g + rfx[i << c][h] + rfx[-(i << c)][h];
-                // Note that diff will become the slope for both red
-                // and blue differentials in the current direction.
-                // For 2nd and 3rd hori+vert passes, create a sum of
-                // steepness for both cardinal directions.
-                if(d > 1)
-                  diff[d] += SQR(rfx[i << c][1] - rfx[-(i << c)][1] - rfx[i << c][h] + rfx[-(i << c)][h])
-                             + SQR(g);
-              }
-              if((d < 2) || (d & 1))
-              { // output for passes 0, 1, 3, 5
-                // for 0, 1 just use hori/vert, for 3, 5 use best of x/y dir
-                const int d_out = d - ((d > 1) && (diff[d-1] < diff[d]));
-                rfx[0][0] = color[0][d_out] / 2.f;
-                rfx[0][2] = color[1][d_out] / 2.f;
-                rfx += TS * TS;
-              }
-            }
-          }
-
-        /* Interpolate red for blue pixels and vice versa:              */
-        const int pad_rb_br = (passes == 1) ? 6 : 5;
-        for(int row = top + pad_rb_br; row < mrow - pad_rb_br; row++)
-          for(int col = left + pad_rb_br; col < mcol - pad_rb_br; col++)
-          {
-            int f = 2 - FCxtrans(row, col, roi_in, xtrans);
-            if(f == 1) continue;
-            float(*rfx)[3] = &rgb[0][row - top][col - left];
-            int c = (row - sgrow) % 3 ? TS : 1;
-            int h = 3 * (c ^ TS ^ 1);
-            for(int d = 0; d < 4; d++, rfx += TS * TS)
-            {
-              int i = d > 1 || ((d ^ c) & 1) ||
-                ((fabsf(rfx[0][1]-rfx[c][1]) + fabsf(rfx[0][1]-rfx[-c][1])) <
-                 2.f*(fabsf(rfx[0][1]-rfx[h][1]) + fabsf(rfx[0][1]-rfx[-h][1]))) ? c:h;
-              rfx[0][f] = (rfx[i][f] + rfx[-i][f] + 2.f * rfx[0][1] - rfx[i][1] - rfx[-i][1]) / 2.f;
-            }
-          }
-
-        /* Fill in red and blue for 2x2 blocks of green:                */
-        const int pad_g22 = (passes == 1) ? 8 : 4;
-        for(int row = top + pad_g22; row < mrow - pad_g22; row++)
-          if((row - sgrow) % 3)
-            for(int col = left + pad_g22; col < mcol - pad_g22; col++)
-              if((col - sgcol) % 3)
-              {
-                float(*rfx)[3] = &rgb[0][row - top][col - left];
-                const short *const hex = hexmap(row,col,allhex);
-                for(int d = 0; d < ndir; d += 2, rfx += TS * TS)
-                  if(hex[d] + hex[d + 1])
-                  {
-                    float g = 3.f * rfx[0][1] - 2.f * rfx[hex[d]][1] - rfx[hex[d + 1]][1];
-                    for(int c = 0; c < 4; c += 2)
-                      rfx[0][c] = (g + 2.f * rfx[hex[d]][c] + rfx[hex[d + 1]][c]) / 3.f;
-                  }
-                  else
-                  {
-                    float g = 2.f * rfx[0][1] - rfx[hex[d]][1] - rfx[hex[d + 1]][1];
-                    for(int c = 0; c < 4; c += 2)
-                      rfx[0][c] = (g + rfx[hex[d]][c] + rfx[hex[d + 1]][c]) / 2.f;
-                  }
-              }
-      } // end of multipass loop
-
-      // jump back to the first set of rgb buffers (this is a nop
-      // unless on the second pass)
-      rgb = (float(*)[TS][TS][3])buffer;
-      // from here on out, mainly are working within the current tile
-      // rather than in reference to the image, so don't offset
-      // mrow/mcol by top/left of tile
-      mrow -= top;
-      mcol -= left;
-
-      /* Convert to perceptual colorspace and differentiate in all directions:  */
-      // Original dcraw algorithm uses CIELab as perceptual space
-      // (presumably coming from original AHD) and converts taking
-      // camera matrix into account. Now use YPbPr which requires much
-      // less code and is nearly indistinguishable. It assumes the
-      // camera RGB is roughly linear.
-      for(int d = 0; d < ndir; d++)
-      {
-        const int pad_yuv = (passes == 1) ? 8 : 13;
-        for(int row = pad_yuv; row < mrow - pad_yuv; row++)
-          for(int col = pad_yuv; col < mcol - pad_yuv; col++)
-          {
-            float *rx = rgb[d][row][col];
-            // use ITU-R BT.2020 YPbPr, which is great, but could use
-            // a better/simpler choice? note that imageop.h provides
-            // dt_iop_RGB_to_YCbCr which uses Rec. 601 conversion,
-            // which appears less good with specular highlights
-            float y = 0.2627f * rx[0] + 0.6780f * rx[1] + 0.0593f * rx[2];
-            yuv[0][row][col] = y;
-            yuv[1][row][col] = (rx[2] - y) * 0.56433f;
-            yuv[2][row][col] = (rx[0] - y) * 0.67815f;
-          }
-        // Note that f can offset by a column (-1 or +1) and by a row
-        // (-TS or TS). The row-wise offsets cause the undefined
-        // behavior sanitizer to warn of an out of bounds index, but
-        // as yfx is multi-dimensional and there is sufficient
-        // padding, that is not actually so.
-        const int f = dir[d & 3];
-        const int pad_drv = (passes == 1) ? 9 : 14;
-        for(int row = pad_drv; row < mrow - pad_drv; row++)
-          for(int col = pad_drv; col < mcol - pad_drv; col++)
-          {
-            float(*yfx)[TS][TS] = (float(*)[TS][TS]) & yuv[0][row][col];
-            drv[d][row][col] = SQR(2 * yfx[0][0][0] - yfx[0][0][f] - yfx[0][0][-f])
-                               + SQR(2 * yfx[1][0][0] - yfx[1][0][f] - yfx[1][0][-f])
-                               + SQR(2 * yfx[2][0][0] - yfx[2][0][f] - yfx[2][0][-f]);
-          }
-      }
-
-      /* Build homogeneity maps from the derivatives:                   */
-      memset(homo, 0, (size_t)ndir * TS * TS * sizeof(uint8_t));
-      const int pad_homo = (passes == 1) ? 10 : 15;
-      for(int row = pad_homo; row < mrow - pad_homo; row++)
-        for(int col = pad_homo; col < mcol - pad_homo; col++)
-        {
-          float tr = FLT_MAX;
-          for(int d = 0; d < ndir; d++)
-            if(tr > drv[d][row][col]) tr = drv[d][row][col];
-          tr *= 8;
-          for(int d = 0; d < ndir; d++)
-            for(int v = -1; v <= 1; v++)
-              for(int h = -1; h <= 1; h++) homo[d][row][col] += ((drv[d][row + v][col + h] <= tr) ? 1 : 0);
-        }
-
-      /* Build 5x5 sum of homogeneity maps for each pixel & direction */
-      for(int d = 0; d < ndir; d++)
-        for(int row = pad_tile; row < mrow - pad_tile; row++)
-        {
-          // start before first column where homo[d][row][col+2] != 0,
-          // so can know v5sum and homosum[d][row][col] will be 0
-          int col = pad_tile-5;
-          uint8_t v5sum[5] = { 0 };
-          homosum[d][row][col] = 0;
-          // calculate by rolling through column sums
-          for(col++; col < mcol - pad_tile; col++)
-          {
-            uint8_t colsum = 0;
-            for(int v = -2; v <= 2; v++) colsum += homo[d][row + v][col + 2];
-            homosum[d][row][col] = homosum[d][row][col - 1] - v5sum[col % 5] + colsum;
-            v5sum[col % 5] = colsum;
-          }
-        }
-
-      /* Average the most homogenous pixels for the final result:       */
-      for(int row = pad_tile; row < mrow - pad_tile; row++)
-        for(int col = pad_tile; col < mcol - pad_tile; col++)
-        {
-          uint8_t hm[8] = { 0 };
-          uint8_t maxval = 0;
-          for(int d = 0; d < ndir; d++)
-          {
-            hm[d] = homosum[d][row][col];
-            maxval = (maxval < hm[d] ? hm[d] : maxval);
-          }
-          maxval -= maxval >> 3;
-          for(int d = 0; d < ndir - 4; d++)
-            if(hm[d] < hm[d + 4])
-              hm[d] = 0;
-            else if(hm[d] > hm[d + 4])
-              hm[d + 4] = 0;
-          float avg[4] = { 0.0f };
-          for(int d = 0; d < ndir; d++)
-            if(hm[d] >= maxval)
-            {
-              for(int c = 0; c < 3; c++) avg[c] += rgb[d][row][col][c];
-              avg[3]++;
-            }
-          for(int c = 0; c < 3; c++)
-            out[4 * (width * (row + top) + col + left) + c] =
-              avg[c]/avg[3];
-        }
-    }
+      tile(out, in, roi_in, xtrans, allhex, sgrow, sgcol, passes, width, height, top, left, buffer);
   }
   dt_free_align(all_buffers);
 }
@@ -1105,6 +1172,105 @@ static void lin_interpolate(float *out, const float *const in, const dt_iop_roi_
    I've extended the basic idea to work with non-Bayer filter arrays.
    Gradients are numbered clockwise from NW=0 to W=7.
  */
+#define VNG_CHUNK 64
+
+/* gradients and interpolation of columns [col_start, col_end) of one row of vng_interpolate() into buf */
+DT_ALWAYS_INLINE void vng_interpolate_row(const float *const out, float (*const buf)[4], int *(*const code)[16],
+                                          const int row, const int col_start, const int col_end,
+                                          const int width, const int prow, const int pcol, const int colors,
+                                          const uint32_t filters4, const uint8_t (*const xtrans)[6],
+                                          const dt_iop_roi_t *const roi_in)
+{
+  for(int col = col_start; col < col_end; col++)
+  {
+    int g;
+    float gval[8] = { 0.0f };
+    const float *pix = out + 4 * (row * width + col);
+    const int *ip = code[(row + roi_in->y) % prow][(col + roi_in->x) % pcol];
+    while((g = ip[0]) != INT_MAX) /* Calculate gradients */
+    {
+      float diff = fabsf(pix[g] - pix[ip[1]]) * ip[2];
+      gval[ip[3]] += diff;
+      ip += 5;
+      if((g = ip[-1]) == -1) continue;
+      gval[g] += diff;
+      while((g = *ip++) != -1) gval[g] += diff;
+    }
+    ip++;
+    float gmin = gval[0], gmax = gval[0]; /* Choose a threshold */
+    for(g = 1; g < 8; g++)
+    {
+      if(gmin > gval[g]) gmin = gval[g];
+      if(gmax < gval[g]) gmax = gval[g];
+    }
+    if(gmax == 0)
+    {
+      memcpy(buf[col], pix, (size_t)4 * sizeof(*out));
+      continue;
+    }
+    float thold = gmin + (gmax * 0.5f);
+    float sum[4] = { 0.0f };
+    int color = fcol(row + roi_in->y, col + roi_in->x, filters4, xtrans);
+    int num = 0;
+    for(g = 0; g < 8; g++, ip += 2) /* Average the neighbors */
+    {
+      if(gval[g] <= thold)
+      {
+        for(int c = 0; c < colors; c++)
+          if(c == color && ip[1])
+            sum[c] += (pix[c] + pix[ip[1]]) * 0.5f;
+          else
+            sum[c] += pix[ip[0] + c];
+        num++;
+      }
+    }
+    for(int c = 0; c < colors; c++) /* Save to buffer */
+    {
+      float tot = pix[color];
+      if(c != color) tot += (sum[c] - sum[color]) / num;
+      buf[col][c] = tot;
+    }
+  }
+}
+
+typedef void(vng_row_func)(const float *const out, float (*const buf)[4], int *(*const code)[16], const int row,
+                           const int col_start, const int col_end, const int width, const int prow,
+                           const int pcol, const int colors, const uint32_t filters4,
+                           const uint8_t (*const xtrans)[6], const dt_iop_roi_t *const roi_in);
+
+#ifdef DT_TARGET_AVX2
+static DT_TARGET_AVX2 void vng_interpolate_row_avx2(const float *const out, float (*const buf)[4],
+                                                    int *(*const code)[16], const int row, const int col_start,
+                                                    const int col_end, const int width, const int prow,
+                                                    const int pcol, const int colors, const uint32_t filters4,
+                                                    const uint8_t (*const xtrans)[6],
+                                                    const dt_iop_roi_t *const roi_in)
+{
+  vng_interpolate_row(out, buf, code, row, col_start, col_end, width, prow, pcol, colors, filters4, xtrans,
+                      roi_in);
+}
+
+static DT_TARGET_AVX512 void vng_interpolate_row_avx512(const float *const out, float (*const buf)[4],
+                                                        int *(*const code)[16], const int row,
+                                                        const int col_start, const int col_end, const int width,
+                                                        const int prow, const int pcol, const int colors,
+                                                        const uint32_t filters4, const uint8_t (*const xtrans)[6],
+                                                        const dt_iop_roi_t *const roi_in)
+{
+  vng_interpolate_row(out, buf, code, row, col_start, col_end, width, prow, pcol, colors, filters4, xtrans,
+                      roi_in);
+}
+#endif
+
+static vng_row_func *vng_choose_row_func(void)
+{
+#ifdef DT_TARGET_AVX2
+  if(darktable.codepath.AVX512) return vng_interpolate_row_avx512;
+  if(darktable.codepath.AVX2) return vng_interpolate_row_avx2;
+#endif
+  return vng_interpolate_row;
+}
+
 static void vng_interpolate(float *out, const float *const in,
                             const dt_iop_roi_t *const roi_out, const dt_iop_roi_t *const roi_in,
                             const uint32_t filters, const uint8_t (*const xtrans)[6], const int only_vng_linear)
@@ -1200,65 +1366,28 @@ static void vng_interpolate(float *out, const float *const in,
       }
     }
 
+  vng_row_func *const vng_row = vng_choose_row_func();
+#ifdef _OPENMP
+#pragma omp parallel default(none) shared(code, brow, out, filters4)
+#endif
   for(int row = 2; row < height - 2; row++) /* Do VNG interpolation */
   {
+    // one team for all rows, chunks of a row go to its threads and one of them moves the buffer on
+#ifdef _OPENMP
+#pragma omp for schedule(static)
+#endif
+    for(int col = 2; col < width - 2; col += VNG_CHUNK)
+      vng_row(out, brow[2], code, row, col, MIN(col + VNG_CHUNK, width - 2), width, prow, pcol, colors, filters4,
+              xtrans, roi_in);
 #ifdef _OPENMP
-#pragma omp parallel for default(none) shared(row, code, brow, out, filters4) private(ip) schedule(static)
+#pragma omp single
 #endif
-    for(int col = 2; col < width - 2; col++)
     {
-      int g;
-      float gval[8] = { 0.0f };
-      float *pix = out + 4 * (row * width + col);
-      ip = code[(row + roi_in->y) % prow][(col + roi_in->x) % pcol];
-      while((g = ip[0]) != INT_MAX) /* Calculate gradients */
-      {
-        float diff = fabsf(pix[g] - pix[ip[1]]) * ip[2];
-        gval[ip[3]] += diff;
-        ip += 5;
-        if((g = ip[-1]) == -1) continue;
-        gval[g] += diff;
-        while((g = *ip++) != -1) gval[g] += diff;
-      }
-      ip++;
-      float gmin = gval[0], gmax = gval[0]; /* Choose a threshold */
-      for(g = 1; g < 8; g++)
-      {
-        if(gmin > gval[g]) gmin = gval[g];
-        if(gmax < gval[g]) gmax = gval[g];
-      }
-      if(gmax == 0)
-      {
-        memcpy(brow[2][col], pix, (size_t)4 * sizeof(*out));
-        continue;
-      }
-      float thold = gmin + (gmax * 0.5f);
-      float sum[4] = { 0.0f };
-      int color = fcol(row + roi_in->y, col + roi_in->x, filters4, xtrans);
-      int num = 0;
-      for(g = 0; g < 8; g++, ip += 2) /* Average the neighbors */
-      {
-        if(gval[g] <= thold)
-        {
-          for(int c = 0; c < colors; c++)
-            if(c == color && ip[1])
-              sum[c] += (pix[c] + pix[ip[1]]) * 0.5f;
-            else
-              sum[c] += pix[ip[0] + c];
-          num++;
-        }
-      }
-      for(int c = 0; c < colors; c++) /* Save to buffer */
-      {
-        float tot = pix[color];
-        if(c != color) tot += (sum[c] - sum[color]) / num;
-        brow[2][col][c] = tot;
-      }
+      if(row > 3) /* Write buffer to image */
+        memcpy(out + 4 * ((row - 2) * width + 2), brow[0] + 2, (size_t)(width - 4) * 4 * sizeof(*out));
+      // rotate ring buffer
+      for(int g = 0; g < 4; g++) brow[(g - 1) & 3] = brow[g];
     }
-    if(row > 3) /* Write buffer to image */
-      memcpy(out + 4 * ((row - 2) * width + 2), brow[0] + 2, (size_t)(width - 4) * 4 * sizeof(*out));
-    // rotate ring buffer
-    for(int g = 0; g < 4; g++) brow[(g - 1) & 3] = brow[g];
   }
   // copy the final two rows to the image
   memcpy(out + (4 * ((height - 4) * width + 2)), brow[0] + 2, (size_t)(width - 4) * 4 * sizeof(*out));
@@ -2026,6 +2155,282 @@ error:
 }
 
 
+// AMaZE on the whole image, see data/kernels/demosaic_amaze.cl. the kernels work on buffers padded by 16
+// pixels, like the tiles of amaze_demosaic_RT(); their intermediate planes share 14 device buffers.
+static cl_int amaze_demosaic_cl(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, cl_mem dev_in,
+                                cl_mem dev_out, const int width, const int height)
+{
+  dt_iop_demosaic_global_data_t *gd = (dt_iop_demosaic_global_data_t *)self->data;
+  const int devid = piece->pipe->devid;
+  const uint32_t filters = piece->pipe->dsc.filters;
+  const float clip_pt = fminf(piece->pipe->dsc.processed_maximum[0],
+                              fminf(piece->pipe->dsc.processed_maximum[1], piece->pipe->dsc.processed_maximum[2]));
+  const float clip_pt8 = 0.8f * clip_pt;
+
+  // padded size, with an even stride so that every pair of columns holds one red or blue site
+  const int W = width + 32;
+  const int H = height + 32;
+  const int pw = W + (W & 1);
+
+  // row of the red sites
+  const int ey = (FC(0, 0, filters) == 1) ? (FC(0, 1, filters) == 0 ? 0 : 1) : (FC(0, 0, filters) == 0 ? 0 : 1);
+
+  cl_mem dev_buf[14] = { NULL };
+  cl_int err = -999;
+
+  for(int k = 0; k < 14; k++)
+  {
+    dev_buf[k] = dt_opencl_alloc_device_buffer(devid, (size_t)pw * H * sizeof(float));
+    if(dev_buf[k] == NULL) goto error;
+  }
+
+  cl_mem cfa = dev_buf[0], rgbgreen = dev_buf[1], dirwts0 = dev_buf[2], dirwts1 = dev_buf[3];
+  cl_mem delhvsqsum = dev_buf[4];
+
+  size_t sizes[3] = { ROUNDUPWD(pw), ROUNDUPHT(H), 1 };
+  size_t hsizes[3] = { ROUNDUPWD(pw / 2), ROUNDUPHT(H), 1 };
+
+  // mirrored copy of the input, and green where it has been sampled
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_init, 0, sizeof(cl_mem), (void *)&dev_in);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_init, 1, sizeof(cl_mem), (void *)&cfa);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_init, 2, sizeof(cl_mem), (void *)&rgbgreen);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_init, 3, sizeof(int), (void *)&width);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_init, 4, sizeof(int), (void *)&height);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_init, 5, sizeof(int), (void *)&W);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_init, 6, sizeof(int), (void *)&H);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_init, 7, sizeof(int), (void *)&pw);
+  err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_amaze_init, sizes);
+  if(err != CL_SUCCESS) goto error;
+
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_gradients, 0, sizeof(cl_mem), (void *)&cfa);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_gradients, 1, sizeof(cl_mem), (void *)&dirwts0);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_gradients, 2, sizeof(cl_mem), (void *)&dirwts1);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_gradients, 3, sizeof(cl_mem), (void *)&delhvsqsum);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_gradients, 4, sizeof(int), (void *)&W);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_gradients, 5, sizeof(int), (void *)&H);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_gradients, 6, sizeof(int), (void *)&pw);
+  err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_amaze_gradients, sizes);
+  if(err != CL_SUCCESS) goto error;
+
+  cl_mem vcd = dev_buf[5], hcd = dev_buf[6], vcdalt = dev_buf[7], hcdalt = dev_buf[8];
+  cl_mem dgintv = dev_buf[9], dginth = dev_buf[10];
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_colour_differences, 0, sizeof(cl_mem), (void *)&cfa);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_colour_differences, 1, sizeof(cl_mem), (void *)&dirwts0);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_colour_differences, 2, sizeof(cl_mem), (void *)&dirwts1);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_colour_differences, 3, sizeof(cl_mem), (void *)&vcd);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_colour_differences, 4, sizeof(cl_mem), (void *)&hcd);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_colour_differences, 5, sizeof(cl_mem), (void *)&vcdalt);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_colour_differences, 6, sizeof(cl_mem), (void *)&hcdalt);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_colour_differences, 7, sizeof(cl_mem), (void *)&dgintv);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_colour_differences, 8, sizeof(cl_mem), (void *)&dginth);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_colour_differences, 9, sizeof(int), (void *)&W);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_colour_differences, 10, sizeof(int), (void *)&H);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_colour_differences, 11, sizeof(int), (void *)&pw);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_colour_differences, 12, sizeof(uint32_t), (void *)&filters);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_colour_differences, 13, sizeof(float), (void *)&clip_pt8);
+  err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_amaze_colour_differences, sizes);
+  if(err != CL_SUCCESS) goto error;
+
+  // the variance choice between the colour differences goes into fresh buffers
+  cl_mem vcd2 = dev_buf[12], hcd2 = dev_buf[13], cddiffsq = dev_buf[11];
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_variances, 0, sizeof(cl_mem), (void *)&cfa);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_variances, 1, sizeof(cl_mem), (void *)&vcd);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_variances, 2, sizeof(cl_mem), (void *)&hcd);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_variances, 3, sizeof(cl_mem), (void *)&vcdalt);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_variances, 4, sizeof(cl_mem), (void *)&hcdalt);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_variances, 5, sizeof(cl_mem), (void *)&vcd2);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_variances, 6, sizeof(cl_mem), (void *)&hcd2);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_variances, 7, sizeof(cl_mem), (void *)&cddiffsq);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_variances, 8, sizeof(int), (void *)&W);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_variances, 9, sizeof(int), (void *)&H);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_variances, 10, sizeof(int), (void *)&pw);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_variances, 11, sizeof(uint32_t), (void *)&filters);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_variances, 12, sizeof(float), (void *)&clip_pt);
+  err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_amaze_variances, sizes);
+  if(err != CL_SUCCESS) goto error;
+  vcd = vcd2;
+  hcd = hcd2;
+
+  cl_mem hvwt = dev_buf[5];
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_hvwt, 0, sizeof(cl_mem), (void *)&vcd);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_hvwt, 1, sizeof(cl_mem), (void *)&hcd);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_hvwt, 2, sizeof(cl_mem), (void *)&dirwts0);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_hvwt, 3, sizeof(cl_mem), (void *)&dirwts1);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_hvwt, 4, sizeof(cl_mem), (void *)&dgintv);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_hvwt, 5, sizeof(cl_mem), (void *)&dginth);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_hvwt, 6, sizeof(cl_mem), (void *)&hvwt);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_hvwt, 7, sizeof(int), (void *)&W);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_hvwt, 8, sizeof(int), (void *)&H);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_hvwt, 9, sizeof(int), (void *)&pw);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_hvwt, 10, sizeof(uint32_t), (void *)&filters);
+  err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_amaze_hvwt, sizes);
+  if(err != CL_SUCCESS) goto error;
+
+  // nyquist texture test and vote, and area interpolation where it is found
+  cl_mem nyquist = dev_buf[6], nyquist2 = dev_buf[7];
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_nyquist_test, 0, sizeof(cl_mem), (void *)&cddiffsq);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_nyquist_test, 1, sizeof(cl_mem), (void *)&delhvsqsum);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_nyquist_test, 2, sizeof(cl_mem), (void *)&nyquist);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_nyquist_test, 3, sizeof(int), (void *)&W);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_nyquist_test, 4, sizeof(int), (void *)&H);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_nyquist_test, 5, sizeof(int), (void *)&pw);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_nyquist_test, 6, sizeof(uint32_t), (void *)&filters);
+  err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_amaze_nyquist_test, sizes);
+  if(err != CL_SUCCESS) goto error;
+
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_nyquist_vote, 0, sizeof(cl_mem), (void *)&nyquist);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_nyquist_vote, 1, sizeof(cl_mem), (void *)&nyquist2);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_nyquist_vote, 2, sizeof(int), (void *)&W);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_nyquist_vote, 3, sizeof(int), (void *)&H);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_nyquist_vote, 4, sizeof(int), (void *)&pw);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_nyquist_vote, 5, sizeof(uint32_t), (void *)&filters);
+  err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_amaze_nyquist_vote, sizes);
+  if(err != CL_SUCCESS) goto error;
+
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_nyquist_area, 0, sizeof(cl_mem), (void *)&cfa);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_nyquist_area, 1, sizeof(cl_mem), (void *)&nyquist2);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_nyquist_area, 2, sizeof(cl_mem), (void *)&hvwt);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_nyquist_area, 3, sizeof(int), (void *)&W);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_nyquist_area, 4, sizeof(int), (void *)&H);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_nyquist_area, 5, sizeof(int), (void *)&pw);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_nyquist_area, 6, sizeof(uint32_t), (void *)&filters);
+  err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_amaze_nyquist_area, sizes);
+  if(err != CL_SUCCESS) goto error;
+
+  // green at the red and blue sites, with the refined weights in a fresh buffer
+  cl_mem hvwt2 = dev_buf[8], Dgrb0 = dev_buf[9], Dgrb2h = dev_buf[10], Dgrb2v = dev_buf[11];
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_populate_green, 0, sizeof(cl_mem), (void *)&cfa);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_populate_green, 1, sizeof(cl_mem), (void *)&vcd);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_populate_green, 2, sizeof(cl_mem), (void *)&hcd);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_populate_green, 3, sizeof(cl_mem), (void *)&hvwt);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_populate_green, 4, sizeof(cl_mem), (void *)&hvwt2);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_populate_green, 5, sizeof(cl_mem), (void *)&nyquist2);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_populate_green, 6, sizeof(cl_mem), (void *)&Dgrb0);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_populate_green, 7, sizeof(cl_mem), (void *)&Dgrb2h);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_populate_green, 8, sizeof(cl_mem), (void *)&Dgrb2v);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_populate_green, 9, sizeof(cl_mem), (void *)&rgbgreen);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_populate_green, 10, sizeof(int), (void *)&W);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_populate_green, 11, sizeof(int), (void *)&H);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_populate_green, 12, sizeof(int), (void *)&pw);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_populate_green, 13, sizeof(uint32_t), (void *)&filters);
+  err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_amaze_populate_green, sizes);
+  if(err != CL_SUCCESS) goto error;
+  hvwt = hvwt2;
+
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_nyquist_refine, 0, sizeof(cl_mem), (void *)&cfa);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_nyquist_refine, 1, sizeof(cl_mem), (void *)&vcd);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_nyquist_refine, 2, sizeof(cl_mem), (void *)&hcd);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_nyquist_refine, 3, sizeof(cl_mem), (void *)&nyquist2);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_nyquist_refine, 4, sizeof(cl_mem), (void *)&Dgrb2h);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_nyquist_refine, 5, sizeof(cl_mem), (void *)&Dgrb2v);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_nyquist_refine, 6, sizeof(cl_mem), (void *)&Dgrb0);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_nyquist_refine, 7, sizeof(cl_mem), (void *)&rgbgreen);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_nyquist_refine, 8, sizeof(int), (void *)&W);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_nyquist_refine, 9, sizeof(int), (void *)&H);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_nyquist_refine, 10, sizeof(int), (void *)&pw);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_nyquist_refine, 11, sizeof(uint32_t), (void *)&filters);
+  err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_amaze_nyquist_refine, sizes);
+  if(err != CL_SUCCESS) goto error;
+
+  // diagonal interpolation correction
+  cl_mem delp = dev_buf[5], delm = dev_buf[6], Dgrbsq1p = dev_buf[7], Dgrbsq1m = dev_buf[10];
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_diagonal_gradients, 0, sizeof(cl_mem), (void *)&cfa);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_diagonal_gradients, 1, sizeof(cl_mem), (void *)&delp);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_diagonal_gradients, 2, sizeof(cl_mem), (void *)&delm);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_diagonal_gradients, 3, sizeof(cl_mem), (void *)&Dgrbsq1p);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_diagonal_gradients, 4, sizeof(cl_mem), (void *)&Dgrbsq1m);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_diagonal_gradients, 5, sizeof(int), (void *)&W);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_diagonal_gradients, 6, sizeof(int), (void *)&H);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_diagonal_gradients, 7, sizeof(int), (void *)&pw);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_diagonal_gradients, 8, sizeof(uint32_t), (void *)&filters);
+  err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_amaze_diagonal_gradients, hsizes);
+  if(err != CL_SUCCESS) goto error;
+
+  cl_mem rbm = dev_buf[11], rbp = dev_buf[12], pmwt = dev_buf[13];
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_diagonal_interpolate, 0, sizeof(cl_mem), (void *)&cfa);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_diagonal_interpolate, 1, sizeof(cl_mem), (void *)&delp);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_diagonal_interpolate, 2, sizeof(cl_mem), (void *)&delm);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_diagonal_interpolate, 3, sizeof(cl_mem), (void *)&Dgrbsq1p);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_diagonal_interpolate, 4, sizeof(cl_mem), (void *)&Dgrbsq1m);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_diagonal_interpolate, 5, sizeof(cl_mem), (void *)&rbm);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_diagonal_interpolate, 6, sizeof(cl_mem), (void *)&rbp);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_diagonal_interpolate, 7, sizeof(cl_mem), (void *)&pmwt);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_diagonal_interpolate, 8, sizeof(int), (void *)&W);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_diagonal_interpolate, 9, sizeof(int), (void *)&H);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_diagonal_interpolate, 10, sizeof(int), (void *)&pw);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_diagonal_interpolate, 11, sizeof(uint32_t), (void *)&filters);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_diagonal_interpolate, 12, sizeof(float), (void *)&clip_pt);
+  err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_amaze_diagonal_interpolate, sizes);
+  if(err != CL_SUCCESS) goto error;
+
+  cl_mem pmwt2 = dev_buf[4], rbint = dev_buf[7];
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_rbint, 0, sizeof(cl_mem), (void *)&cfa);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_rbint, 1, sizeof(cl_mem), (void *)&rbm);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_rbint, 2, sizeof(cl_mem), (void *)&rbp);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_rbint, 3, sizeof(cl_mem), (void *)&pmwt);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_rbint, 4, sizeof(cl_mem), (void *)&pmwt2);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_rbint, 5, sizeof(cl_mem), (void *)&rbint);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_rbint, 6, sizeof(int), (void *)&W);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_rbint, 7, sizeof(int), (void *)&H);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_rbint, 8, sizeof(int), (void *)&pw);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_rbint, 9, sizeof(uint32_t), (void *)&filters);
+  err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_amaze_rbint, sizes);
+  if(err != CL_SUCCESS) goto error;
+  pmwt = pmwt2;
+
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_diagonal_green, 0, sizeof(cl_mem), (void *)&cfa);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_diagonal_green, 1, sizeof(cl_mem), (void *)&dirwts0);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_diagonal_green, 2, sizeof(cl_mem), (void *)&dirwts1);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_diagonal_green, 3, sizeof(cl_mem), (void *)&hvwt);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_diagonal_green, 4, sizeof(cl_mem), (void *)&pmwt);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_diagonal_green, 5, sizeof(cl_mem), (void *)&rbint);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_diagonal_green, 6, sizeof(cl_mem), (void *)&rgbgreen);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_diagonal_green, 7, sizeof(cl_mem), (void *)&Dgrb0);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_diagonal_green, 8, sizeof(int), (void *)&W);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_diagonal_green, 9, sizeof(int), (void *)&H);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_diagonal_green, 10, sizeof(int), (void *)&pw);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_diagonal_green, 11, sizeof(uint32_t), (void *)&filters);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_diagonal_green, 12, sizeof(float), (void *)&clip_pt);
+  err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_amaze_diagonal_green, sizes);
+  if(err != CL_SUCCESS) goto error;
+
+  // fancy chrominance interpolation
+  cl_mem Dgrb1 = dev_buf[5];
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_chroma_split, 0, sizeof(cl_mem), (void *)&Dgrb0);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_chroma_split, 1, sizeof(cl_mem), (void *)&Dgrb1);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_chroma_split, 2, sizeof(int), (void *)&W);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_chroma_split, 3, sizeof(int), (void *)&H);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_chroma_split, 4, sizeof(int), (void *)&pw);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_chroma_split, 5, sizeof(int), (void *)&ey);
+  err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_amaze_chroma_split, hsizes);
+  if(err != CL_SUCCESS) goto error;
+
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_chroma, 0, sizeof(cl_mem), (void *)&Dgrb0);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_chroma, 1, sizeof(cl_mem), (void *)&Dgrb1);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_chroma, 2, sizeof(int), (void *)&W);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_chroma, 3, sizeof(int), (void *)&H);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_chroma, 4, sizeof(int), (void *)&pw);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_chroma, 5, sizeof(uint32_t), (void *)&filters);
+  err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_amaze_chroma, sizes);
+  if(err != CL_SUCCESS) goto error;
+
+  size_t osizes[3] = { ROUNDUPWD(width), ROUNDUPHT(height), 1 };
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_output, 0, sizeof(cl_mem), (void *)&rgbgreen);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_output, 1, sizeof(cl_mem), (void *)&hvwt);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_output, 2, sizeof(cl_mem), (void *)&Dgrb0);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_output, 3, sizeof(cl_mem), (void *)&Dgrb1);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_output, 4, sizeof(cl_mem), (void *)&dev_out);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_output, 5, sizeof(int), (void *)&width);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_output, 6, sizeof(int), (void *)&height);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_output, 7, sizeof(int), (void *)&pw);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_output, 8, sizeof(uint32_t), (void *)&filters);
+  err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_amaze_output, osizes);
+
+error:
+  for(int k = 0; k < 14; k++) dt_opencl_release_mem_object(dev_buf[k]);
+  return err;
+}
+
 static int process_default_cl(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, cl_mem dev_in,
                               cl_mem dev_out, const dt_iop_roi_t *const roi_in,
                               const dt_iop_roi_t *const roi_out)
@@ -2036,7 +2441,10 @@ static int process_default_cl(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop
 
   const int devid = piece->pipe->devid;
   const int qual_flags = demosaic_qual_flags(piece, img, roi_out);
-  const int demosaicing_method = data->demosaicing_method;
+  int demosaicing_method = data->demosaicing_method;
+  // amaze is too slow for a lower quality preview, fall back to ppg as on the cpu
+  if((qual_flags & DEMOSAIC_MEDIUM_QUAL) && demosaicing_method == DT_IOP_DEMOSAIC_AMAZE)
+    demosaicing_method = DT_IOP_DEMOSAIC_PPG;
 
   cl_mem dev_aux = NULL;
   cl_mem dev_tmp = NULL;
@@ -2181,6 +2589,11 @@ static int process_default_cl(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop
         if(err != CL_SUCCESS) goto error;
       } while(0);
     }
+    else if(demosaicing_method == DT_IOP_DEMOSAIC_AMAZE)
+    {
+      err = amaze_demosaic_cl(self, piece, dev_in, dev_aux, width, height);
+      if(err != CL_SUCCESS) goto error;
+    }
 
     if(scaled)
     {
@@ -3441,7 +3854,8 @@ int process_cl(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, cl_m
   const int demosaicing_method = data->demosaicing_method;
   const int qual_flags = demosaic_qual_flags(piece, &self->dev->image_storage, roi_out);
 
-  if(demosaicing_method == DT_IOP_DEMOSAIC_PASSTHROUGH_MONOCHROME || demosaicing_method == DT_IOP_DEMOSAIC_PPG)
+  if(demosaicing_method == DT_IOP_DEMOSAIC_PASSTHROUGH_MONOCHROME || demosaicing_method == DT_IOP_DEMOSAIC_PPG
+     || demosaicing_method == DT_IOP_DEMOSAIC_AMAZE)
   {
     return process_default_cl(self, piece, dev_in, dev_out, roi_in, roi_out);
   }
@@ -3499,11 +3913,17 @@ void tiling_callback(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t
     else
       tiling->factor += smooth;                        // + smooth
 
+    // amaze keeps 14 planes of the input padded by 16 pixels on the device
+    if(full_scale_demosaicing && demosaicing_method == DT_IOP_DEMOSAIC_AMAZE)
+      tiling->factor += 3.5f * (roi_in->width + 33.0f) * (roi_in->height + 32.0f)
+                        / ((float)roi_in->width * roi_in->height);
+
     tiling->maxbuf = 1.0f;
     tiling->overhead = 0;
     tiling->xalign = 2;
     tiling->yalign = 2;
-    tiling->overlap = 5; // take care of border handling
+    // take care of border handling, amaze reaches 16 pixels out
+    tiling->overlap = (demosaicing_method == DT_IOP_DEMOSAIC_AMAZE) ? 16 : 5;
   }
   else if(((demosaicing_method ==  DT_IOP_DEMOSAIC_MARKESTEIJN) ||
            (demosaicing_method ==  DT_IOP_DEMOSAIC_MARKESTEIJN_3)) &&
@@ -3615,6 +4035,25 @@ void init_global(dt_iop_module_so_t *module)
   gd->kernel_markesteijn_zero = dt_opencl_create_kernel(markesteijn, "markesteijn_zero");
   gd->kernel_markesteijn_accu = dt_opencl_create_kernel(markesteijn, "markesteijn_accu");
   gd->kernel_markesteijn_final = dt_opencl_create_kernel(markesteijn, "markesteijn_final");
+
+  const int amaze = 27; // from programs.conf
+  gd->kernel_amaze_init = dt_opencl_create_kernel(amaze, "amaze_init");
+  gd->kernel_amaze_gradients = dt_opencl_create_kernel(amaze, "amaze_gradients");
+  gd->kernel_amaze_colour_differences = dt_opencl_create_kernel(amaze, "amaze_colour_differences");
+  gd->kernel_amaze_variances = dt_opencl_create_kernel(amaze, "amaze_variances");
+  gd->kernel_amaze_hvwt = dt_opencl_create_kernel(amaze, "amaze_hvwt");
+  gd->kernel_amaze_nyquist_test = dt_opencl_create_kernel(amaze, "amaze_nyquist_test");
+  gd->kernel_amaze_nyquist_vote = dt_opencl_create_kernel(amaze, "amaze_nyquist_vote");
+  gd->kernel_amaze_nyquist_area = dt_opencl_create_kernel(amaze, "amaze_nyquist_area");
+  gd->kernel_amaze_populate_green = dt_opencl_create_kernel(amaze, "amaze_populate_green");
+  gd->kernel_amaze_nyquist_refine = dt_opencl_create_kernel(amaze, "amaze_nyquist_refine");
+  gd->kernel_amaze_diagonal_gradients = dt_opencl_create_kernel(amaze, "amaze_diagonal_gradients");
+  gd->kernel_amaze_diagonal_interpolate = dt_opencl_create_kernel(amaze, "amaze_diagonal_interpolate");
+  gd->kernel_amaze_rbint = dt_opencl_create_kernel(amaze, "amaze_rbint");
+  gd->kernel_amaze_diagonal_green = dt_opencl_create_kernel(amaze, "amaze_diagonal_green");
+  gd->kernel_amaze_chroma_split = dt_opencl_create_kernel(amaze, "amaze_chroma_split");
+  gd->kernel_amaze_chroma = dt_opencl_create_kernel(amaze, "amaze_chroma");
+  gd->kernel_amaze_output = dt_opencl_create_kernel(amaze, "amaze_output");
 }
 
 void cleanup(dt_iop_module_t *module)
@@ -3662,6 +4101,23 @@ void cleanup_global(dt_iop_module_so_t *module)
   dt_opencl_free_kernel(gd->kernel_markesteijn_zero);
   dt_opencl_free_kernel(gd->kernel_markesteijn_accu);
   dt_opencl_free_kernel(gd->kernel_markesteijn_final);
+  dt_opencl_free_kernel(gd->kernel_amaze_init);
+  dt_opencl_free_kernel(gd->kernel_amaze_gradients);
+  dt_opencl_free_kernel(gd->kernel_amaze_colour_differences);
+  dt_opencl_free_kernel(gd->kernel_amaze_variances);
+  dt_opencl_free_kernel(gd->kernel_amaze_hvwt);
+  dt_opencl_free_kernel(gd->kernel_amaze_nyquist_test);
+  dt_opencl_free_kernel(gd->kernel_amaze_nyquist_vote);
+  dt_opencl_free_kernel(gd->kernel_amaze_nyquist_area);
+  dt_opencl_free_kernel(gd->kernel_amaze_populate_green);
+  dt_opencl_free_kernel(gd->kernel_amaze_nyquist_refine);
+  dt_opencl_free_kernel(gd->kernel_amaze_diagonal_gradients);
+  dt_opencl_free_kernel(gd->kernel_amaze_diagonal_interpolate);
+  dt_opencl_free_kernel(gd->kernel_amaze_rbint);
+  dt_opencl_free_kernel(gd->kernel_amaze_diagonal_green);
+  dt_opencl_free_kernel(gd->kernel_amaze_chroma_split);
+  dt_opencl_free_kernel(gd->kernel_amaze_chroma);
+  dt_opencl_free_kernel(gd->kernel_amaze_output);
   free(module->data);
   module->data = NULL;
 }
@@ -3691,6 +4147,12 @@ void commit_params(struct dt_iop_module_t *self, dt_iop_params_t *params, dt_dev
     d->median_thrs = 0.0f;
   }
 
+  // the cheaper sibling while a slider is dragged
+  if(piece->draft && d->demosaicing_method == DT_IOP_DEMOSAIC_AMAZE)
+    d->demosaicing_method = DT_IOP_DEMOSAIC_PPG;
+  else if(piece->draft && d->demosaicing_method == DT_IOP_DEMOSAIC_MARKESTEIJN_3)
+    d->demosaicing_method = DT_IOP_DEMOSAIC_MARKESTEIJN;
+
   // OpenCL only supported by some of the demosaicing methods
   switch(d->demosaicing_method)
   {
@@ -3698,7 +4160,7 @@ void commit_params(struct dt_iop_module_t *self, dt_iop_params_t *params, dt_dev
       piece->process_cl_ready = 1;
       break;
     case DT_IOP_DEMOSAIC_AMAZE:
-      piece->process_cl_ready = 0;
+      piece->process_cl_ready = 1;
       break;
     case DT_IOP_DEMOSAIC_VNG4:
       piece->process_cl_ready = 1;
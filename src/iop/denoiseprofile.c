@@ -19,8 +19,10 @@
 #include "config.h"
 #endif
 #include "bauhaus/bauhaus.h"
+#include "common/nlmeans_core.h"
 #include "common/noiseprofiles.h"
 #include "common/opencl.h"
+#include "common/simd.h"
 #include "control/control.h"
 #include "develop/imageop.h"
 #include "develop/imageop_math.h"
@@ -33,9 +35,6 @@
 #include <gtk/gtk.h>
 #include <math.h>
 #include <stdlib.h>
-#if defined(__SSE__)
-#include <xmmintrin.h>
-#endif
 
 #define REDUCESIZE 64
 #define MAX_PROFILES 30
@@ -162,6 +161,14 @@ static inline float fast_mexp2f(const float x)
   return k.f;
 }
 
+// with this many scales the wavelet decomposition doesn't keep the detail buffers of all scales. instead each
+// one is thresholded and added to an accumulator as soon as it is done, which needs two buffers regardless of
+// the number of scales but sums them up in the opposite order.
+static inline int wavelets_streamed(const int max_scale)
+{
+  return max_scale > 2;
+}
+
 void tiling_callback(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece,
                      const dt_iop_roi_t *roi_in, const dt_iop_roi_t *roi_out,
                      struct dt_develop_tiling_t *tiling)
@@ -172,7 +179,8 @@ void tiling_callback(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t
   {
     const int P
         = ceilf(d->radius * fmin(roi_in->scale, 2.0f) / fmax(piece->iscale, 1.0f)); // pixel filter size
-    const int K = ceilf(7 * fmin(roi_in->scale, 2.0f) / fmax(piece->iscale, 1.0f)); // nbhood
+    const int K = ceilf(dt_nlmeans_search_radius(piece) * fmin(roi_in->scale, 2.0f)
+                        / fmax(piece->iscale, 1.0f)); // nbhood
 
     tiling->factor = 4.0f + 0.25f * NUM_BUCKETS; // in + out + (2 + NUM_BUCKETS * 0.25) tmp
     tiling->maxbuf = 1.0f;
@@ -205,7 +213,10 @@ void tiling_callback(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t
 
     const int max_filter_radius = (1 << max_scale); // 2 * 2^max_scale
 
-    tiling->factor = 3.5f + max_scale; // in + out + tmp + reducebuffer + scale buffers
+    // on the cpu the scales are streamed once they are many, see process_wavelets()
+    const int scale_buffers
+        = (piece->pipe->devid < 0 && wavelets_streamed(max_scale)) ? 2 : max_scale; // detail + accumulator
+    tiling->factor = 3.5f + scale_buffers; // in + out + tmp + reducebuffer + scale buffers
     tiling->maxbuf = 1.0f;
     tiling->overhead = 0;
     tiling->overlap = max_filter_radius;
@@ -302,7 +313,7 @@ static inline float weight(const float *c1, const float *c2, const float inv_sig
 #endif
 }
 
-#if defined(__SSE__)
+#if defined(DT_SIMD_SSE)
 static inline __m128 weight_sse(const __m128 *c1, const __m128 *c2, const float inv_sigma2)
 {
 // return _mm_set1_ps(1.0f);
@@ -332,7 +343,7 @@ static inline __m128 weight_sse(const __m128 *c1, const __m128 *c2, const float
     for(int c = 0; c < 4; c++) wgt[c] += w;                                                                  \
   } while(0)
 
-#if defined(__SSE__)
+#if defined(DT_SIMD_SSE)
 #define SUM_PIXEL_CONTRIBUTION_COMMON_SSE(ii, jj)                                                            \
   do                                                                                                         \
   {                                                                                                          \
@@ -363,7 +374,7 @@ static inline __m128 weight_sse(const __m128 *c1, const __m128 *c2, const float
     SUM_PIXEL_CONTRIBUTION_COMMON(ii, jj);                                                                   \
   } while(0)
 
-#if defined(__SSE__)
+#if defined(DT_SIMD_SSE)
 #define SUM_PIXEL_CONTRIBUTION_WITH_TEST_SSE(ii, jj)                                                         \
   do                                                                                                         \
   {                                                                                                          \
@@ -389,7 +400,7 @@ static inline __m128 weight_sse(const __m128 *c1, const __m128 *c2, const float
   float *pdetail = detail + (size_t)4 * j * width;                                                           \
   float *pcoarse = out + (size_t)4 * j * width;
 
-#if defined(__SSE__)
+#if defined(DT_SIMD_SSE)
 #define ROW_PROLOGUE_SSE                                                                                     \
   const __m128 *px = ((__m128 *)in) + (size_t)j * width;                                                     \
   const __m128 *px2;                                                                                         \
@@ -401,7 +412,7 @@ static inline __m128 weight_sse(const __m128 *c1, const __m128 *c2, const float
   float sum[4] = { 0.0f, 0.0f, 0.0f, 0.0f };                                                                 \
   float wgt[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
 
-#if defined(__SSE__)
+#if defined(DT_SIMD_SSE)
 #define SUM_PIXEL_PROLOGUE_SSE                                                                               \
   __m128 sum = _mm_setzero_ps();                                                                             \
   __m128 wgt = _mm_setzero_ps();
@@ -416,7 +427,7 @@ static inline __m128 weight_sse(const __m128 *c1, const __m128 *c2, const float
   pdetail += 4;                                                                                              \
   pcoarse += 4;
 
-#if defined(__SSE__)
+#if defined(DT_SIMD_SSE)
 #define SUM_PIXEL_EPILOGUE_SSE                                                                               \
   sum = _mm_div_ps(sum, wgt);                                                                                \
                                                                                                              \
@@ -544,7 +555,7 @@ static void eaw_decompose(float *const out, const float *const in, float *const
 #undef SUM_PIXEL_PROLOGUE
 #undef SUM_PIXEL_EPILOGUE
 
-#if defined(__SSE2__)
+#if defined(DT_SIMD_SSE)
 static void eaw_decompose_sse(float *const out, const float *const in, float *const detail, const int scale,
                               const float inv_sigma2, const int32_t width, const int32_t height)
 {
@@ -686,7 +697,7 @@ static void eaw_synthesize(float *const out, const float *const in, const float
   }
 }
 
-#if defined(__SSE2__)
+#if defined(DT_SIMD_SSE)
 static void eaw_synthesize_sse2(float *const out, const float *const in, const float *const detail,
                                 const float *thrsf, const float *boostf, const int32_t width,
                                 const int32_t height)
@@ -725,6 +736,34 @@ static void eaw_synthesize_sse2(float *const out, const float *const in, const f
 
 // =====================================================================================
 
+// thresholds of the detail coefficients of a scale
+static void wavelet_thresholds(const float *const detail, const size_t npixels, const int scale, float thrs[4])
+{
+  // variance stabilizing transform maps sigma to unity.
+  const float sigma = 1.0f;
+  // it is then transformed by wavelet scales via the 5 tap a-trous filter:
+  const float varf = sqrtf(2.0f + 2.0f * 4.0f * 4.0f + 6.0f * 6.0f) / 16.0f; // about 0.5
+  const float sigma_band = powf(varf, scale) * sigma;
+  // determine thrs as bayesshrink
+  // TODO: parallelize!
+  float sum_y2[3] = { 0.0f };
+  for(size_t k = 0; k < npixels; k++)
+    for(int c = 0; c < 3; c++) sum_y2[c] += detail[4 * k + c] * detail[4 * k + c];
+
+  const float sb2 = sigma_band * sigma_band;
+  const float var_y[3] = { sum_y2[0] / (npixels - 1.0f), sum_y2[1] / (npixels - 1.0f), sum_y2[2] / (npixels - 1.0f) };
+  const float std_x[3] = { sqrtf(MAX(1e-6f, var_y[0] - sb2)), sqrtf(MAX(1e-6f, var_y[1] - sb2)),
+                           sqrtf(MAX(1e-6f, var_y[2] - sb2)) };
+  // add 8.0 here because it seemed a little weak
+  const float adjt = 8.0f;
+  for(int c = 0; c < 3; c++) thrs[c] = adjt * sb2 / std_x[c];
+  thrs[3] = 0.0f;
+// const float std = (std_x[0] + std_x[1] + std_x[2])/3.0f;
+// const float thrs[4] = { adjt*sigma*sigma/std, adjt*sigma*sigma/std, adjt*sigma*sigma/std, 0.0f};
+// fprintf(stderr, "scale %d thrs %f %f %f = %f / %f %f %f \n", scale, thrs[0], thrs[1], thrs[2], sb2,
+// std_x[0], std_x[1], std_x[2]);
+}
+
 static void process_wavelets(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece,
                              const void *const ivoid, void *const ovoid, const dt_iop_roi_t *const roi_in,
                              const dt_iop_roi_t *const roi_out, const eaw_decompose_t decompose,
@@ -765,12 +804,16 @@ static void process_wavelets(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_
     return;
   }
 
+  // when streamed, buf[0] is the detail of the current scale and buf[1] the sum of the thresholded details
+  const int streamed = wavelets_streamed(max_scale);
+  const int num_buf = streamed ? 2 : max_scale;
   float *buf[MAX_MAX_SCALE];
   float *tmp = NULL;
   float *buf1 = NULL, *buf2 = NULL;
-  for(int k = 0; k < max_scale; k++)
+  for(int k = 0; k < num_buf; k++)
     buf[k] = dt_alloc_align(64, (size_t)4 * sizeof(float) * npixels);
   tmp = dt_alloc_align(64, (size_t)4 * sizeof(float) * npixels);
+  if(streamed) memset(buf[1], 0, (size_t)4 * sizeof(float) * npixels);
 
   const float wb[3] = { // twice as many samples in green channel:
                         2.0f * piece->pipe->dsc.processed_maximum[0] * d->strength * (in_scale * in_scale),
@@ -804,7 +847,8 @@ static void process_wavelets(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_
     const float sigma = 1.0f;
     const float varf = sqrtf(2.0f + 2.0f * 4.0f * 4.0f + 6.0f * 6.0f) / 16.0f; // about 0.5
     const float sigma_band = powf(varf, scale) * sigma;
-    decompose(buf2, buf1, buf[scale], scale, 1.0f / (sigma_band * sigma_band), width, height);
+    float *const detail = streamed ? buf[0] : buf[scale];
+    decompose(buf2, buf1, detail, scale, 1.0f / (sigma_band * sigma_band), width, height);
 // DEBUG: clean out temporary memory:
 // memset(buf1, 0, sizeof(float)*4*width*height);
 #if 0 // DEBUG: print wavelet scales:
@@ -821,56 +865,56 @@ static void process_wavelets(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_
       f = g_fopen(filename, "wb");
       fprintf(f, "PF\n%d %d\n-1.0\n", width, height);
       for(size_t k = 0; k < npixels; k++)
-        fwrite(buf[scale]+4*k, sizeof(float), 3, f);
+        fwrite(detail+4*k, sizeof(float), 3, f);
       fclose(f);
     }
 #endif
+    if(streamed)
+    {
+      // threshold this scale right away and add it to the others
+      float thrs[4];
+      wavelet_thresholds(detail, npixels, scale, thrs);
+      const float boost[4] = { 1.0f, 1.0f, 1.0f, 1.0f };
+      synthesize(buf[1], buf[1], detail, thrs, boost, width, height);
+    }
     float *buf3 = buf2;
     buf2 = buf1;
     buf1 = buf3;
   }
 
-  // now do everything backwards, so the result will end up in *ovoid
-  for(int scale = max_scale - 1; scale >= 0; scale--)
+  if(streamed)
   {
-#if 1
-    // variance stabilizing transform maps sigma to unity.
-    const float sigma = 1.0f;
-    // it is then transformed by wavelet scales via the 5 tap a-trous filter:
-    const float varf = sqrtf(2.0f + 2.0f * 4.0f * 4.0f + 6.0f * 6.0f) / 16.0f; // about 0.5
-    const float sigma_band = powf(varf, scale) * sigma;
-    // determine thrs as bayesshrink
-    // TODO: parallelize!
-    float sum_y2[3] = { 0.0f };
-    for(size_t k = 0; k < npixels; k++)
-      for(int c = 0; c < 3; c++) sum_y2[c] += buf[scale][4 * k + c] * buf[scale][4 * k + c];
-
-    const float sb2 = sigma_band * sigma_band;
-    const float var_y[3] = { sum_y2[0] / (npixels - 1.0f), sum_y2[1] / (npixels - 1.0f), sum_y2[2] / (npixels - 1.0f) };
-    const float std_x[3] = { sqrtf(MAX(1e-6f, var_y[0] - sb2)), sqrtf(MAX(1e-6f, var_y[1] - sb2)),
-                             sqrtf(MAX(1e-6f, var_y[2] - sb2)) };
-    // add 8.0 here because it seemed a little weak
-    const float adjt = 8.0f;
-    const float thrs[4] = { adjt * sb2 / std_x[0], adjt * sb2 / std_x[1], adjt * sb2 / std_x[2], 0.0f };
-// const float std = (std_x[0] + std_x[1] + std_x[2])/3.0f;
-// const float thrs[4] = { adjt*sigma*sigma/std, adjt*sigma*sigma/std, adjt*sigma*sigma/std, 0.0f};
-// fprintf(stderr, "scale %d thrs %f %f %f = %f / %f %f %f \n", scale, thrs[0], thrs[1], thrs[2], sb2,
-// std_x[0], std_x[1], std_x[2]);
+    // the coarsest scale plus all the details
+    float *const out = (float *)ovoid;
+    const float *const coarse = buf1;
+    const float *const sum = buf[1];
+#ifdef _OPENMP
+#pragma omp parallel for SIMD() default(none) schedule(static)
 #endif
-    const float boost[4] = { 1.0f, 1.0f, 1.0f, 1.0f };
-    // const float thrs[4] = { 0.0, 0.0, 0.0, 0.0 };
-    synthesize(buf2, buf1, buf[scale], thrs, boost, width, height);
-    // DEBUG: clean out temporary memory:
-    // memset(buf1, 0, sizeof(float)*4*width*height);
-
-    float *buf3 = buf2;
-    buf2 = buf1;
-    buf1 = buf3;
+    for(size_t k = 0; k < (size_t)4 * npixels; k++) out[k] = coarse[k] + sum[k];
+  }
+  else
+  {
+    // now do everything backwards, so the result will end up in *ovoid
+    for(int scale = max_scale - 1; scale >= 0; scale--)
+    {
+      float thrs[4];
+      wavelet_thresholds(buf[scale], npixels, scale, thrs);
+      const float boost[4] = { 1.0f, 1.0f, 1.0f, 1.0f };
+      // const float thrs[4] = { 0.0, 0.0, 0.0, 0.0 };
+      synthesize(buf2, buf1, buf[scale], thrs, boost, width, height);
+      // DEBUG: clean out temporary memory:
+      // memset(buf1, 0, sizeof(float)*4*width*height);
+
+      float *buf3 = buf2;
+      buf2 = buf1;
+      buf1 = buf3;
+    }
   }
 
   backtransform((float *)ovoid, width, height, aa, bb);
 
-  for(int k = 0; k < max_scale; k++) dt_free_align(buf[k]);
+  for(int k = 0; k < num_buf; k++) dt_free_align(buf[k]);
   dt_free_align(tmp);
 
   if(piece->pipe->mask_display & DT_DEV_PIXELPIPE_DISPLAY_MASK) dt_iop_alpha_copy(ivoid, ovoid, width, height);
@@ -892,13 +936,10 @@ static void process_nlmeans(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t
   // adjust to zoom size:
   const float scale = fmin(roi_in->scale, 2.0f) / fmax(piece->iscale, 1.0f);
   const int P = ceilf(d->radius * scale); // pixel filter size
-  const int K = ceilf(7 * scale);         // nbhood
+  const int K = ceilf(dt_nlmeans_search_radius(piece) * scale); // nbhood
 
   // P == 0 : this will degenerate to a (fast) bilateral filter.
 
-  float *Sa = dt_alloc_align(64, (size_t)sizeof(float) * roi_out->width * dt_get_num_threads());
-  // we want to sum up weights in col[3], so need to init to 0:
-  memset(ovoid, 0x0, (size_t)sizeof(float) * roi_out->width * roi_out->height * 4);
   float *in = dt_alloc_align(64, (size_t)4 * sizeof(float) * roi_in->width * roi_in->height);
 
   const float wb[3] = { piece->pipe->dsc.processed_maximum[0] * d->strength * (scale * scale),
@@ -908,101 +949,15 @@ static void process_nlmeans(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t
   const float bb[3] = { d->b[1] * wb[0], d->b[1] * wb[1], d->b[1] * wb[2] };
   precondition((float *)ivoid, in, roi_in->width, roi_in->height, aa, bb);
 
-  // for each shift vector
-  for(int kj = -K; kj <= K; kj++)
-  {
-    for(int ki = -K; ki <= K; ki++)
-    {
-      // TODO: adaptive K tests here!
-      // TODO: expf eval for real bilateral experience :)
-
-      int inited_slide = 0;
-// don't construct summed area tables but use sliding window! (applies to cpu version res < 1k only, or else
-// we will add up errors)
-// do this in parallel with a little threading overhead. could parallelize the outer loops with a bit more
-// memory
-#ifdef _OPENMP
-#pragma omp parallel for schedule(static) default(none) firstprivate(inited_slide) shared(kj, ki, in, Sa)
-#endif
-      for(int j = 0; j < roi_out->height; j++)
-      {
-        if(j + kj < 0 || j + kj >= roi_out->height) continue;
-        float *S = Sa + dt_get_thread_num() * roi_out->width;
-        const float *ins = in + 4l * ((size_t)roi_in->width * (j + kj) + ki);
-        float *out = ((float *)ovoid) + (size_t)4 * roi_out->width * j;
-
-        const int Pm = MIN(MIN(P, j + kj), j);
-        const int PM = MIN(MIN(P, roi_out->height - 1 - j - kj), roi_out->height - 1 - j);
-        // first line of every thread
-        // TODO: also every once in a while to assert numerical precision!
-        if(!inited_slide)
-        {
-          // sum up a line
-          memset(S, 0x0, sizeof(float) * roi_out->width);
-          for(int jj = -Pm; jj <= PM; jj++)
-          {
-            int i = MAX(0, -ki);
-            float *s = S + i;
-            const float *inp = in + 4 * i + (size_t)4 * roi_in->width * (j + jj);
-            const float *inps = in + 4 * i + 4l * ((size_t)roi_in->width * (j + jj + kj) + ki);
-            const int last = roi_out->width + MIN(0, -ki);
-            for(; i < last; i++, inp += 4, inps += 4, s++)
-            {
-              for(int k = 0; k < 3; k++) s[0] += (inp[k] - inps[k]) * (inp[k] - inps[k]);
-            }
-          }
-          // only reuse this if we had a full stripe
-          if(Pm == P && PM == P) inited_slide = 1;
-        }
-
-        // sliding window for this line:
-        float *s = S;
-        float slide = 0.0f;
-        // sum up the first -P..P
-        for(int i = 0; i < 2 * P + 1; i++) slide += s[i];
-        for(int i = 0; i < roi_out->width; i++, s++, ins += 4, out += 4)
-        {
-          // FIXME: the comment above is actually relevant even for 1000 px width already.
-          // XXX    numerical precision will not forgive us:
-          if(i - P > 0 && i + P < roi_out->width) slide += s[P] - s[-P - 1];
-          if(i + ki >= 0 && i + ki < roi_out->width)
-          {
-            // TODO: could put that outside the loop.
-            // DEBUG XXX bring back to computable range:
-            const float norm = .015f / (2 * P + 1);
-            const float iv[4] = { ins[0], ins[1], ins[2], 1.0f };
-#if defined(_OPENMP) && defined(OPENMP_SIMD_)
-#pragma omp SIMD()
-#endif
-            for(size_t c = 0; c < 4; c++)
-            {
-              out[c] += iv[c] * fast_mexp2f(fmaxf(0.0f, slide * norm - 2.0f));
-            }
-          }
-        }
-        if(inited_slide && j + P + 1 + MAX(0, kj) < roi_out->height)
-        {
-          // sliding window in j direction:
-          int i = MAX(0, -ki);
-          s = S + i;
-          const float *inp = in + 4 * i + 4l * (size_t)roi_in->width * (j + P + 1);
-          const float *inps = in + 4 * i + 4l * ((size_t)roi_in->width * (j + P + 1 + kj) + ki);
-          const float *inm = in + 4 * i + 4l * (size_t)roi_in->width * (j - P);
-          const float *inms = in + 4 * i + 4l * ((size_t)roi_in->width * (j - P + kj) + ki);
-          const int last = roi_out->width + MIN(0, -ki);
-          for(; i < last; i++, inp += 4, inps += 4, inm += 4, inms += 4, s++)
-          {
-            float stmp = s[0];
-            for(int k = 0; k < 3; k++)
-              stmp += ((inp[k] - inps[k]) * (inp[k] - inps[k]) - (inm[k] - inms[k]) * (inm[k] - inms[k]));
-            s[0] = stmp;
-          }
-        }
-        else
-          inited_slide = 0;
-      }
-    }
-  }
+  // DEBUG XXX bring back to computable range:
+  const float norm = .015f / (2 * P + 1);
+  const dt_nlmeans_param_t params = { .patch_radius = P,
+                                      .search_radius = K,
+                                      .norm = { 1.0f, 1.0f, 1.0f },
+                                      .scale = norm,
+                                      .bias = -2.0f,
+                                      .pipe = piece->pipe };
+  dt_nlmeans_denoise(in, (float *)ovoid, roi_out->width, roi_out->height, &params);
 
   float *const out = ((float *const)ovoid);
 
@@ -1020,14 +975,13 @@ static void process_nlmeans(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t
   }
 
   // free shared tmp memory:
-  dt_free_align(Sa);
   dt_free_align(in);
   backtransform((float *)ovoid, roi_in->width, roi_in->height, aa, bb);
 
   if(piece->pipe->mask_display & DT_DEV_PIXELPIPE_DISPLAY_MASK) dt_iop_alpha_copy(ivoid, ovoid, roi_out->width, roi_out->height);
 }
 
-#if defined(__SSE2__)
+#if defined(DT_SIMD_SSE)
 static void process_nlmeans_sse(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece,
                                 const void *const ivoid, void *const ovoid, const dt_iop_roi_t *const roi_in,
                                 const dt_iop_roi_t *const roi_out)
@@ -1040,13 +994,10 @@ static void process_nlmeans_sse(struct dt_iop_module_t *self, dt_dev_pixelpipe_i
   // adjust to zoom size:
   const float scale = fmin(roi_in->scale, 2.0f) / fmax(piece->iscale, 1.0f);
   const int P = ceilf(d->radius * scale); // pixel filter size
-  const int K = ceilf(7 * scale);         // nbhood
+  const int K = ceilf(dt_nlmeans_search_radius(piece) * scale); // nbhood
 
   // P == 0 : this will degenerate to a (fast) bilateral filter.
 
-  float *Sa = dt_alloc_align(64, (size_t)sizeof(float) * roi_out->width * dt_get_num_threads());
-  // we want to sum up weights in col[3], so need to init to 0:
-  memset(ovoid, 0x0, (size_t)sizeof(float) * roi_out->width * roi_out->height * 4);
   float *in = dt_alloc_align(64, (size_t)4 * sizeof(float) * roi_in->width * roi_in->height);
 
   const float wb[3] = { piece->pipe->dsc.processed_maximum[0] * d->strength * (scale * scale),
@@ -1056,151 +1007,16 @@ static void process_nlmeans_sse(struct dt_iop_module_t *self, dt_dev_pixelpipe_i
   const float bb[3] = { d->b[1] * wb[0], d->b[1] * wb[1], d->b[1] * wb[2] };
   precondition((float *)ivoid, in, roi_in->width, roi_in->height, aa, bb);
 
-  // for each shift vector
-  for(int kj = -K; kj <= K; kj++)
-  {
-    for(int ki = -K; ki <= K; ki++)
-    {
-      // TODO: adaptive K tests here!
-      // TODO: expf eval for real bilateral experience :)
-
-      int inited_slide = 0;
-// don't construct summed area tables but use sliding window! (applies to cpu version res < 1k only, or else
-// we will add up errors)
-// do this in parallel with a little threading overhead. could parallelize the outer loops with a bit more
-// memory
-#ifdef _OPENMP
-#pragma omp parallel for schedule(static) default(none) firstprivate(inited_slide) shared(kj, ki, in, Sa)
-#endif
-      for(int j = 0; j < roi_out->height; j++)
-      {
-        if(j + kj < 0 || j + kj >= roi_out->height) continue;
-        float *S = Sa + dt_get_thread_num() * roi_out->width;
-        const float *ins = in + 4l * ((size_t)roi_in->width * (j + kj) + ki);
-        float *out = ((float *)ovoid) + (size_t)4 * roi_out->width * j;
-
-        const int Pm = MIN(MIN(P, j + kj), j);
-        const int PM = MIN(MIN(P, roi_out->height - 1 - j - kj), roi_out->height - 1 - j);
-        // first line of every thread
-        // TODO: also every once in a while to assert numerical precision!
-        if(!inited_slide)
-        {
-          // sum up a line
-          memset(S, 0x0, sizeof(float) * roi_out->width);
-          for(int jj = -Pm; jj <= PM; jj++)
-          {
-            int i = MAX(0, -ki);
-            float *s = S + i;
-            const float *inp = in + 4 * i + (size_t)4 * roi_in->width * (j + jj);
-            const float *inps = in + 4 * i + 4l * ((size_t)roi_in->width * (j + jj + kj) + ki);
-            const int last = roi_out->width + MIN(0, -ki);
-            for(; i < last; i++, inp += 4, inps += 4, s++)
-            {
-              for(int k = 0; k < 3; k++) s[0] += (inp[k] - inps[k]) * (inp[k] - inps[k]);
-            }
-          }
-          // only reuse this if we had a full stripe
-          if(Pm == P && PM == P) inited_slide = 1;
-        }
+  // DEBUG XXX bring back to computable range:
+  const float norm = .015f / (2 * P + 1);
+  const dt_nlmeans_param_t params = { .patch_radius = P,
+                                      .search_radius = K,
+                                      .norm = { 1.0f, 1.0f, 1.0f },
+                                      .scale = norm,
+                                      .bias = -2.0f,
+                                      .pipe = piece->pipe };
+  dt_nlmeans_denoise(in, (float *)ovoid, roi_out->width, roi_out->height, &params);
 
-        // sliding window for this line:
-        float *s = S;
-        float slide = 0.0f;
-        // sum up the first -P..P
-        for(int i = 0; i < 2 * P + 1; i++) slide += s[i];
-        for(int i = 0; i < roi_out->width; i++)
-        {
-          // FIXME: the comment above is actually relevant even for 1000 px width already.
-          // XXX    numerical precision will not forgive us:
-          if(i - P > 0 && i + P < roi_out->width) slide += s[P] - s[-P - 1];
-          if(i + ki >= 0 && i + ki < roi_out->width)
-          {
-            // TODO: could put that outside the loop.
-            // DEBUG XXX bring back to computable range:
-            const float norm = .015f / (2 * P + 1);
-            const __m128 iv = { ins[0], ins[1], ins[2], 1.0f };
-            _mm_store_ps(out,
-                         _mm_load_ps(out) + iv * _mm_set1_ps(fast_mexp2f(fmaxf(0.0f, slide * norm - 2.0f))));
-            // _mm_store_ps(out, _mm_load_ps(out) + iv * _mm_set1_ps(fast_mexp2f(fmaxf(0.0f, slide*norm))));
-          }
-          s++;
-          ins += 4;
-          out += 4;
-        }
-        if(inited_slide && j + P + 1 + MAX(0, kj) < roi_out->height)
-        {
-          // sliding window in j direction:
-          int i = MAX(0, -ki);
-          s = S + i;
-          const float *inp = in + 4 * i + 4l * (size_t)roi_in->width * (j + P + 1);
-          const float *inps = in + 4 * i + 4l * ((size_t)roi_in->width * (j + P + 1 + kj) + ki);
-          const float *inm = in + 4 * i + 4l * (size_t)roi_in->width * (j - P);
-          const float *inms = in + 4 * i + 4l * ((size_t)roi_in->width * (j - P + kj) + ki);
-          const int last = roi_out->width + MIN(0, -ki);
-          for(; ((intptr_t)s & 0xf) != 0 && i < last; i++, inp += 4, inps += 4, inm += 4, inms += 4, s++)
-          {
-            float stmp = s[0];
-            for(int k = 0; k < 3; k++)
-              stmp += ((inp[k] - inps[k]) * (inp[k] - inps[k]) - (inm[k] - inms[k]) * (inm[k] - inms[k]));
-            s[0] = stmp;
-          }
-          /* Process most of the line 4 pixels at a time */
-          for(; i < last - 4; i += 4, inp += 16, inps += 16, inm += 16, inms += 16, s += 4)
-          {
-            __m128 sv = _mm_load_ps(s);
-            const __m128 inp1 = _mm_sub_ps(_mm_load_ps(inp), _mm_load_ps(inps));
-            const __m128 inp2 = _mm_sub_ps(_mm_load_ps(inp + 4), _mm_load_ps(inps + 4));
-            const __m128 inp3 = _mm_sub_ps(_mm_load_ps(inp + 8), _mm_load_ps(inps + 8));
-            const __m128 inp4 = _mm_sub_ps(_mm_load_ps(inp + 12), _mm_load_ps(inps + 12));
-
-            const __m128 inp12lo = _mm_unpacklo_ps(inp1, inp2);
-            const __m128 inp34lo = _mm_unpacklo_ps(inp3, inp4);
-            const __m128 inp12hi = _mm_unpackhi_ps(inp1, inp2);
-            const __m128 inp34hi = _mm_unpackhi_ps(inp3, inp4);
-
-            const __m128 inpv0 = _mm_movelh_ps(inp12lo, inp34lo);
-            sv += inpv0 * inpv0;
-
-            const __m128 inpv1 = _mm_movehl_ps(inp34lo, inp12lo);
-            sv += inpv1 * inpv1;
-
-            const __m128 inpv2 = _mm_movelh_ps(inp12hi, inp34hi);
-            sv += inpv2 * inpv2;
-
-            const __m128 inm1 = _mm_sub_ps(_mm_load_ps(inm), _mm_load_ps(inms));
-            const __m128 inm2 = _mm_sub_ps(_mm_load_ps(inm + 4), _mm_load_ps(inms + 4));
-            const __m128 inm3 = _mm_sub_ps(_mm_load_ps(inm + 8), _mm_load_ps(inms + 8));
-            const __m128 inm4 = _mm_sub_ps(_mm_load_ps(inm + 12), _mm_load_ps(inms + 12));
-
-            const __m128 inm12lo = _mm_unpacklo_ps(inm1, inm2);
-            const __m128 inm34lo = _mm_unpacklo_ps(inm3, inm4);
-            const __m128 inm12hi = _mm_unpackhi_ps(inm1, inm2);
-            const __m128 inm34hi = _mm_unpackhi_ps(inm3, inm4);
-
-            const __m128 inmv0 = _mm_movelh_ps(inm12lo, inm34lo);
-            sv -= inmv0 * inmv0;
-
-            const __m128 inmv1 = _mm_movehl_ps(inm34lo, inm12lo);
-            sv -= inmv1 * inmv1;
-
-            const __m128 inmv2 = _mm_movelh_ps(inm12hi, inm34hi);
-            sv -= inmv2 * inmv2;
-
-            _mm_store_ps(s, sv);
-          }
-          for(; i < last; i++, inp += 4, inps += 4, inm += 4, inms += 4, s++)
-          {
-            float stmp = s[0];
-            for(int k = 0; k < 3; k++)
-              stmp += ((inp[k] - inps[k]) * (inp[k] - inps[k]) - (inm[k] - inms[k]) * (inm[k] - inms[k]));
-            s[0] = stmp;
-          }
-        }
-        else
-          inited_slide = 0;
-      }
-    }
-  }
 // normalize
 #ifdef _OPENMP
 #pragma omp parallel for default(none) schedule(static) shared(d)
@@ -1217,7 +1033,6 @@ static void process_nlmeans_sse(struct dt_iop_module_t *self, dt_dev_pixelpipe_i
     }
   }
   // free shared tmp memory:
-  dt_free_align(Sa);
   dt_free_align(in);
   backtransform((float *)ovoid, roi_in->width, roi_in->height, aa, bb);
 
@@ -1261,7 +1076,7 @@ static int process_nlmeans_cl(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop
 
   const float scale = fmin(roi_in->scale, 2.0f) / fmax(piece->iscale, 1.0f);
   const int P = ceilf(d->radius * scale); // pixel filter size
-  const int K = ceilf(7 * scale);         // nbhood
+  const int K = ceilf(dt_nlmeans_search_radius(piece) * scale); // nbhood
   const float norm = 0.015f / (2 * P + 1);
 
 
@@ -1771,7 +1586,7 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
     process_wavelets(self, piece, ivoid, ovoid, roi_in, roi_out, eaw_decompose, eaw_synthesize);
 }
 
-#if defined(__SSE2__)
+#if defined(DT_SIMD_SSE)
 void process_sse2(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *const ivoid,
                   void *const ovoid, const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
 {
@@ -21,6 +21,7 @@
 #include "bauhaus/bauhaus.h"
 #include "common/imageio.h"
 #include "common/opencl.h"
+#include "common/simd.h"
 #include "control/control.h"
 #include "develop/develop.h"
 #include "develop/imageop.h"
@@ -45,6 +46,11 @@
 #define CLIP(x) ((x < 0) ? 0.0 : (x > 1.0) ? 1.0 : x)
 #define TEA_ROUNDS 8
 
+// side of the tileable threshold mask of the blue noise mode, a power of two, and the support of the gaussian
+// its void and cluster construction measures the density of the pattern with
+#define BLUENOISE_SIZE 64
+#define BLUENOISE_RADIUS 8
+
 DT_MODULE_INTROSPECTION(1, dt_iop_dither_params_t)
 
 typedef void(_find_nearest_color)(float *val, float *err, const float f, const float rf);
@@ -60,7 +66,8 @@ typedef enum dt_iop_dither_type_t
   DITHER_FS4BIT_GRAY,
   DITHER_FS8BIT,
   DITHER_FS16BIT,
-  DITHER_FSAUTO
+  DITHER_FSAUTO,
+  DITHER_BLUENOISE_AUTO
 } dt_iop_dither_type_t;
 
 
@@ -97,6 +104,12 @@ typedef struct dt_iop_dither_data_t
   } random;
 } dt_iop_dither_data_t;
 
+typedef struct dt_iop_dither_global_data_t
+{
+  int kernel_dither_bluenoise;
+  float *mask; // BLUENOISE_SIZE^2 offsets in (-0.5, 0.5) added before rounding to the nearest level
+} dt_iop_dither_global_data_t;
+
 const char *name()
 {
   return _("dithering");
@@ -110,7 +123,7 @@ int groups()
 
 int flags()
 {
-  return IOP_FLAGS_ONE_INSTANCE;
+  return IOP_FLAGS_ONE_INSTANCE | IOP_FLAGS_NO_TILE_STREAMING;
 }
 
 
@@ -299,8 +312,9 @@ static void process_floyd_steinberg(struct dt_iop_module_t *self, dt_dev_pixelpi
         nearest_color = NULL;
       break;
     case DITHER_RANDOM:
-      // this function won't ever be called for that type
-      // instead, process_random() will be called
+    case DITHER_BLUENOISE_AUTO:
+      // this function won't ever be called for these types
+      // instead, process_random() or process_bluenoise() will be called
       __builtin_unreachable();
       break;
   }
@@ -465,8 +479,9 @@ static void process_floyd_steinberg_sse2(struct dt_iop_module_t *self, dt_dev_pi
         nearest_color = NULL;
       break;
     case DITHER_RANDOM:
-      // this function won't ever be called for that type
-      // instead, process_random() will be called
+    case DITHER_BLUENOISE_AUTO:
+      // this function won't ever be called for these types
+      // instead, process_random() or process_bluenoise() will be called
       __builtin_unreachable();
       break;
   }
@@ -627,6 +642,249 @@ static void process_random(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t
   if(piece->pipe->mask_display & DT_DEV_PIXELPIPE_DISPLAY_MASK) dt_iop_alpha_copy(ivoid, ovoid, width, height);
 }
 
+// adds (sign 1) or removes (sign -1) the energy of a pixel of the pattern to its toroidal neighbourhood
+static void _bluenoise_update(float *const energy, const float *const filter, const int p, const float sign)
+{
+  const int px = p % BLUENOISE_SIZE, py = p / BLUENOISE_SIZE;
+  const int w = 2 * BLUENOISE_RADIUS + 1;
+  for(int dy = -BLUENOISE_RADIUS; dy <= BLUENOISE_RADIUS; dy++)
+    for(int dx = -BLUENOISE_RADIUS; dx <= BLUENOISE_RADIUS; dx++)
+    {
+      const int x = (px + dx) & (BLUENOISE_SIZE - 1), y = (py + dy) & (BLUENOISE_SIZE - 1);
+      energy[y * BLUENOISE_SIZE + x] += sign * filter[(dy + BLUENOISE_RADIUS) * w + dx + BLUENOISE_RADIUS];
+    }
+}
+
+// the tightest cluster of the pattern (the set pixel of most energy) or its largest void (the free one of least)
+static int _bluenoise_find(const float *const energy, const uint8_t *const pattern, const int cluster)
+{
+  int best = -1;
+  for(int k = 0; k < BLUENOISE_SIZE * BLUENOISE_SIZE; k++)
+    if(pattern[k] == cluster
+       && (best < 0 || (cluster ? energy[k] > energy[best] : energy[k] < energy[best])))
+      best = k;
+  return best;
+}
+
+// ulichney's void and cluster method: every pixel of the mask is ranked by the order it gets into an ever
+// denser, evenly spread pattern. thresholding by the ranks keeps the noise at high frequencies, and the mask
+// tiles without seams as the energy wraps around its borders.
+static void _bluenoise_mask(float *const mask)
+{
+  const int n = BLUENOISE_SIZE * BLUENOISE_SIZE;
+  const int w = 2 * BLUENOISE_RADIUS + 1;
+  const float sigma = 1.5f;
+  float filter[(2 * BLUENOISE_RADIUS + 1) * (2 * BLUENOISE_RADIUS + 1)];
+  for(int dy = -BLUENOISE_RADIUS; dy <= BLUENOISE_RADIUS; dy++)
+    for(int dx = -BLUENOISE_RADIUS; dx <= BLUENOISE_RADIUS; dx++)
+      filter[(dy + BLUENOISE_RADIUS) * w + dx + BLUENOISE_RADIUS]
+          = expf(-(dx * dx + dy * dy) / (2.0f * sigma * sigma));
+
+  uint8_t *const initial = calloc(n, sizeof(uint8_t));
+  uint8_t *const pattern = malloc(n * sizeof(uint8_t));
+  float *const initial_energy = calloc(n, sizeof(float));
+  float *const energy = malloc(n * sizeof(float));
+
+  // a tenth of the pixels at random, from a fixed seed so that every run builds the same mask
+  uint32_t seed = 0x2545f491u;
+  int ones = 0;
+  while(ones < n / 10)
+  {
+    seed = seed * 1664525u + 1013904223u;
+    const int p = (seed >> 8) % n;
+    if(initial[p]) continue;
+    initial[p] = 1;
+    _bluenoise_update(initial_energy, filter, p, 1.0f);
+    ones++;
+  }
+
+  // spread them evenly, moving the tightest cluster into the largest void until it stays where it is
+  for(int it = 0; it < n; it++)
+  {
+    const int c = _bluenoise_find(initial_energy, initial, 1);
+    initial[c] = 0;
+    _bluenoise_update(initial_energy, filter, c, -1.0f);
+    const int v = _bluenoise_find(initial_energy, initial, 0);
+    initial[v] = 1;
+    _bluenoise_update(initial_energy, filter, v, 1.0f);
+    if(v == c) break;
+  }
+
+  // the pixels of the initial pattern are ranked below it by taking out the tightest clusters
+  memcpy(pattern, initial, n * sizeof(uint8_t));
+  memcpy(energy, initial_energy, n * sizeof(float));
+  for(int r = ones - 1; r >= 0; r--)
+  {
+    const int c = _bluenoise_find(energy, pattern, 1);
+    pattern[c] = 0;
+    _bluenoise_update(energy, filter, c, -1.0f);
+    mask[c] = r;
+  }
+
+  // and the others above it by filling the largest voids. past half the mask the largest void among the free
+  // pixels is the tightest cluster of these, so this holds up to the last one.
+  memcpy(pattern, initial, n * sizeof(uint8_t));
+  memcpy(energy, initial_energy, n * sizeof(float));
+  for(int r = ones; r < n; r++)
+  {
+    const int v = _bluenoise_find(energy, pattern, 0);
+    pattern[v] = 1;
+    _bluenoise_update(energy, filter, v, 1.0f);
+    mask[v] = r;
+  }
+
+  for(int k = 0; k < n; k++) mask[k] = (mask[k] + 0.5f) / n - 0.5f;
+
+  free(initial);
+  free(pattern);
+  free(initial_energy);
+  free(energy);
+}
+
+// levels of the output the blue noise mode rounds to, and whether it is gray, as for floyd-steinberg auto. 0 if
+// there is nothing to dither.
+static unsigned int _bluenoise_levels(const dt_dev_pixelpipe_iop_t *const piece, int *const gray)
+{
+  // no automatic dithering for preview and thumbnail
+  if(piece->pipe->type == DT_DEV_PIXELPIPE_PREVIEW || piece->pipe->type == DT_DEV_PIXELPIPE_THUMBNAIL) return 0;
+
+  switch(piece->pipe->levels & IMAGEIO_CHANNEL_MASK)
+  {
+    case IMAGEIO_RGB:
+      *gray = 0;
+      break;
+    case IMAGEIO_GRAY:
+      *gray = 1;
+      break;
+    default:
+      return 0;
+  }
+
+  switch(piece->pipe->levels & IMAGEIO_PREC_MASK)
+  {
+    case IMAGEIO_INT8:
+      return 256;
+    case IMAGEIO_INT12:
+      return 4096;
+    case IMAGEIO_INT16:
+      return 65536;
+    case IMAGEIO_BW:
+      return 2;
+    case IMAGEIO_INT32:
+    case IMAGEIO_FLOAT:
+    default:
+      return 0;
+  }
+}
+
+// ordered dithering: every pixel is rounded to the nearest level after adding the threshold of its position in
+// the tiled blue noise mask. unlike error diffusion the pixels don't depend on each other.
+static void process_bluenoise(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece,
+                              const void *const ivoid, void *const ovoid, const dt_iop_roi_t *const roi_in,
+                              const dt_iop_roi_t *const roi_out)
+{
+  const dt_iop_dither_global_data_t *const gd = (dt_iop_dither_global_data_t *)self->data;
+
+  const int width = roi_in->width;
+  const int height = roi_in->height;
+  const int ch = piece->colors;
+
+  int gray = 0;
+  const unsigned int levels = _bluenoise_levels(piece, &gray);
+  // f = 0 only clips
+  const float f = levels ? levels - 1 : 0.0f;
+  const float rf = levels ? 1.0f / f : 0.0f;
+  const float *const mask = gd->mask;
+
+#ifdef _OPENMP
+#pragma omp parallel for default(none) shared(gray) schedule(static)
+#endif
+  for(int j = 0; j < height; j++)
+  {
+    const float *in = (const float *)ivoid + (size_t)ch * width * j;
+    float *out = (float *)ovoid + (size_t)ch * width * j;
+    const float *const row = mask + ((j + roi_in->y) & (BLUENOISE_SIZE - 1)) * BLUENOISE_SIZE;
+    int i = 0;
+#if defined(DT_SIMD_SSE)
+    if(!gray && ch == 4)
+    {
+      const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.0f), half = _mm_set1_ps(0.5f);
+      const __m128 inf = _mm_set1_ps(INFINITY), vf = _mm_set1_ps(f), vrf = _mm_set1_ps(rf);
+      for(; i < width; i++, in += ch, out += ch)
+      {
+        // clipnan(): nan to 0.5, the rest clamped to [0, 1]
+        __m128 v = _mm_load_ps(in);
+        const __m128 valid = _mm_cmple_ps(v, inf);
+        v = _mm_or_ps(_mm_and_ps(valid, v), _mm_andnot_ps(valid, half));
+        v = _mm_min_ps(_mm_max_ps(v, zero), one);
+        const __m128 d = _mm_set1_ps(row[(i + roi_in->x) & (BLUENOISE_SIZE - 1)]);
+        const __m128 q = _mm_cvtepi32_ps(_mm_cvtps_epi32(_mm_add_ps(_mm_mul_ps(v, vf), d)));
+        _mm_store_ps(out, _mm_mul_ps(_mm_min_ps(_mm_max_ps(q, zero), vf), vrf));
+      }
+    }
+#endif
+    for(; i < width; i++, in += ch, out += ch)
+    {
+      const float d = row[(i + roi_in->x) & (BLUENOISE_SIZE - 1)];
+      if(gray)
+      {
+        const float g = 0.30f * clipnan(in[0]) + 0.59f * clipnan(in[1]) + 0.11f * clipnan(in[2]); // RGB -> GRAY
+        const float new = CLAMPS(nearbyintf(g * f + d), 0.0f, f) * rf;
+        for(int c = 0; c < 4; c++) out[c] = new;
+      }
+      else
+        for(int c = 0; c < 4; c++) out[c] = CLAMPS(nearbyintf(clipnan(in[c]) * f + d), 0.0f, f) * rf;
+    }
+  }
+
+  if(piece->pipe->mask_display & DT_DEV_PIXELPIPE_DISPLAY_MASK) dt_iop_alpha_copy(ivoid, ovoid, width, height);
+}
+
+#ifdef HAVE_OPENCL
+int process_cl(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, cl_mem dev_in, cl_mem dev_out,
+               const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
+{
+  const dt_iop_dither_global_data_t *const gd = (dt_iop_dither_global_data_t *)self->data;
+
+  cl_int err = -999;
+  const int devid = piece->pipe->devid;
+  const int width = roi_in->width;
+  const int height = roi_in->height;
+  const int size = BLUENOISE_SIZE;
+
+  int gray = 0;
+  const unsigned int levels = _bluenoise_levels(piece, &gray);
+  const float f = levels ? levels - 1 : 0.0f;
+  const float rf = levels ? 1.0f / f : 0.0f;
+
+  cl_mem dev_mask = dt_opencl_copy_host_to_device_constant(devid, sizeof(float) * size * size, gd->mask);
+  if(dev_mask == NULL) goto error;
+
+  size_t sizes[] = { ROUNDUPWD(width), ROUNDUPHT(height), 1 };
+  dt_opencl_set_kernel_arg(devid, gd->kernel_dither_bluenoise, 0, sizeof(cl_mem), (void *)&dev_in);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_dither_bluenoise, 1, sizeof(cl_mem), (void *)&dev_out);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_dither_bluenoise, 2, sizeof(int), (void *)&width);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_dither_bluenoise, 3, sizeof(int), (void *)&height);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_dither_bluenoise, 4, sizeof(cl_mem), (void *)&dev_mask);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_dither_bluenoise, 5, sizeof(int), (void *)&size);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_dither_bluenoise, 6, sizeof(int), (void *)&roi_in->x);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_dither_bluenoise, 7, sizeof(int), (void *)&roi_in->y);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_dither_bluenoise, 8, sizeof(float), (void *)&f);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_dither_bluenoise, 9, sizeof(float), (void *)&rf);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_dither_bluenoise, 10, sizeof(int), (void *)&gray);
+  err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_dither_bluenoise, sizes);
+  if(err != CL_SUCCESS) goto error;
+
+  dt_opencl_release_mem_object(dev_mask);
+  return TRUE;
+
+error:
+  dt_opencl_release_mem_object(dev_mask);
+  dt_print(DT_DEBUG_OPENCL, "[opencl_dither] couldn't enqueue kernel! %d\n", err);
+  return FALSE;
+}
+#endif
+
 
 void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *const ivoid,
              void *const ovoid, const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
@@ -635,6 +893,8 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
 
   if(data->dither_type == DITHER_RANDOM)
     process_random(self, piece, ivoid, ovoid, roi_in, roi_out);
+  else if(data->dither_type == DITHER_BLUENOISE_AUTO)
+    process_bluenoise(self, piece, ivoid, ovoid, roi_in, roi_out);
   else
     process_floyd_steinberg(self, piece, ivoid, ovoid, roi_in, roi_out);
 }
@@ -647,6 +907,8 @@ void process_sse2(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, c
 
   if(data->dither_type == DITHER_RANDOM)
     process_random(self, piece, ivoid, ovoid, roi_in, roi_out);
+  else if(data->dither_type == DITHER_BLUENOISE_AUTO)
+    process_bluenoise(self, piece, ivoid, ovoid, roi_in, roi_out);
   else
     process_floyd_steinberg_sse2(self, piece, ivoid, ovoid, roi_in, roi_out);
 }
@@ -714,6 +976,9 @@ void commit_params(struct dt_iop_module_t *self, dt_iop_params_t *p1, dt_dev_pix
   memcpy(&(d->random.range), &(p->random.range), sizeof(p->random.range));
   d->random.radius = p->random.radius;
   d->random.damping = p->random.damping;
+
+  // error diffusion runs on the cpu only
+  piece->process_cl_ready = (d->dither_type == DITHER_BLUENOISE_AUTO);
 }
 
 void init_pipe(struct dt_iop_module_t *self, dt_dev_pixelpipe_t *pipe, dt_dev_pixelpipe_iop_t *piece)
@@ -773,6 +1038,25 @@ void cleanup(dt_iop_module_t *module)
   module->params = NULL;
 }
 
+void init_global(dt_iop_module_so_t *module)
+{
+  const int program = 2; // basic.cl, from programs.conf
+  dt_iop_dither_global_data_t *gd = (dt_iop_dither_global_data_t *)malloc(sizeof(dt_iop_dither_global_data_t));
+  module->data = gd;
+  gd->kernel_dither_bluenoise = dt_opencl_create_kernel(program, "dither_bluenoise");
+  gd->mask = malloc(sizeof(float) * BLUENOISE_SIZE * BLUENOISE_SIZE);
+  _bluenoise_mask(gd->mask);
+}
+
+void cleanup_global(dt_iop_module_so_t *module)
+{
+  dt_iop_dither_global_data_t *gd = (dt_iop_dither_global_data_t *)module->data;
+  dt_opencl_free_kernel(gd->kernel_dither_bluenoise);
+  free(gd->mask);
+  free(module->data);
+  module->data = NULL;
+}
+
 void gui_init(struct dt_iop_module_t *self)
 {
   self->gui_data = malloc(sizeof(dt_iop_dither_gui_data_t));
@@ -789,6 +1073,7 @@ void gui_init(struct dt_iop_module_t *self)
   dt_bauhaus_combobox_add(g->dither_type, _("floyd-steinberg 8-bit RGB"));
   dt_bauhaus_combobox_add(g->dither_type, _("floyd-steinberg 16-bit RGB"));
   dt_bauhaus_combobox_add(g->dither_type, _("floyd-steinberg auto"));
+  dt_bauhaus_combobox_add(g->dither_type, _("blue noise auto"));
   dt_bauhaus_widget_set_label(g->dither_type, NULL, _("method"));
 
 #if 0
@@ -20,9 +20,11 @@
 #endif
 #include "common/darktable.h"
 #include "common/debug.h"
+#include "common/opencl.h"
 #include "control/control.h"
 #include "develop/develop.h"
 #include "develop/imageop.h"
+#include "develop/tiling.h"
 #include "gui/draw.h"
 #include "gui/gtk.h"
 #include "gui/presets.h"
@@ -82,6 +84,14 @@ typedef struct dt_iop_equalizer_data_t
   int num_levels;
 } dt_iop_equalizer_data_t;
 
+typedef struct dt_iop_equalizer_global_data_t
+{
+  int kernel_equalizer_weights;
+  int kernel_equalizer_predict;
+  int kernel_equalizer_update;
+  int kernel_equalizer_scale;
+} dt_iop_equalizer_global_data_t;
+
 
 const char *name()
 {
@@ -96,7 +106,7 @@ int groups()
 
 int flags()
 {
-  return IOP_FLAGS_DEPRECATED;
+  return IOP_FLAGS_DEPRECATED | IOP_FLAGS_NO_TILE_STREAMING;
 }
 
 
@@ -214,6 +224,152 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
 #endif
 }
 
+#ifdef HAVE_OPENCL
+// one predict or update step of level l along all rows (horizontal) or columns of dev_buf
+static cl_int equalizer_lift_cl(const int devid, cl_mem dev_buf, cl_mem dev_weight, const int kernel,
+                                const int odd, const int width, const int height, const int l,
+                                const int horizontal, const float sign)
+{
+  const int step = 1 << l;
+  const int n = horizontal ? width : height;
+  const int samples = odd ? (n - step / 2 + step - 1) / step : (n + step - 1) / step;
+  const int wd = (int)(1 + (width >> (l - 1)));
+  size_t sizes[] = { ROUNDUPWD(samples), ROUNDUPHT(horizontal ? height : width), 1 };
+  dt_opencl_set_kernel_arg(devid, kernel, 0, sizeof(cl_mem), (void *)&dev_buf);
+  dt_opencl_set_kernel_arg(devid, kernel, 1, sizeof(cl_mem), (void *)&dev_weight);
+  dt_opencl_set_kernel_arg(devid, kernel, 2, sizeof(int), (void *)&width);
+  dt_opencl_set_kernel_arg(devid, kernel, 3, sizeof(int), (void *)&height);
+  dt_opencl_set_kernel_arg(devid, kernel, 4, sizeof(int), (void *)&wd);
+  dt_opencl_set_kernel_arg(devid, kernel, 5, sizeof(int), (void *)&l);
+  dt_opencl_set_kernel_arg(devid, kernel, 6, sizeof(int), (void *)&horizontal);
+  dt_opencl_set_kernel_arg(devid, kernel, 7, sizeof(float), (void *)&sign);
+  return dt_opencl_enqueue_kernel_2d(devid, kernel, sizes);
+}
+
+int process_cl(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, cl_mem dev_in, cl_mem dev_out,
+               const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
+{
+  dt_iop_equalizer_data_t *d = (dt_iop_equalizer_data_t *)piece->data;
+  dt_iop_equalizer_global_data_t *gd = (dt_iop_equalizer_global_data_t *)self->data;
+
+  cl_int err = -999;
+  const int devid = piece->pipe->devid;
+  const int width = roi_in->width, height = roi_in->height;
+  const float scale = roi_in->scale;
+  cl_mem dev_buf = NULL;
+  cl_mem dev_weight[DT_IOP_EQUALIZER_MAX_LEVEL + 1] = { NULL };
+
+  // same levels as in process()
+  const float l1 = 1.0f + dt_log2f(piece->iscale / scale); // finest level
+  float lm = 0;
+  for(int k = MIN(width, height) * piece->iscale / scale; k; k >>= 1) lm++; // coarsest level
+  lm = MIN(DT_IOP_EQUALIZER_MAX_LEVEL, l1 + lm);
+  int numl = 0;
+  for(int k = MIN(width, height); k; k >>= 1) numl++;
+  const int numl_cap = MIN(DT_IOP_EQUALIZER_MAX_LEVEL - l1 + 1.5, numl);
+
+  size_t origin[] = { 0, 0, 0 };
+  size_t region[] = { width, height, 1 };
+  size_t sizes[] = { ROUNDUPWD(width), ROUNDUPHT(height), 1 };
+
+  dev_buf = dt_opencl_alloc_device_buffer(devid, (size_t)width * height * 4 * sizeof(float));
+  if(dev_buf == NULL) goto error;
+  for(int k = 1; k < numl_cap; k++)
+  {
+    const int wd = (int)(1 + (width >> (k - 1))), ht = (int)(1 + (height >> (k - 1)));
+    dev_weight[k] = dt_opencl_alloc_device_buffer(devid, (size_t)wd * ht * sizeof(float));
+    if(dev_weight[k] == NULL) goto error;
+  }
+
+  err = dt_opencl_enqueue_copy_image_to_buffer(devid, dev_in, dev_buf, origin, region, 0);
+  if(err != CL_SUCCESS) goto error;
+
+  // forward transform
+  for(int l = 1; l < numl_cap; l++)
+  {
+    const int wd = (int)(1 + (width >> (l - 1))), ht = (int)(1 + (height >> (l - 1)));
+    size_t wsizes[] = { ROUNDUPWD(wd), ROUNDUPHT(ht), 1 };
+    dt_opencl_set_kernel_arg(devid, gd->kernel_equalizer_weights, 0, sizeof(cl_mem), (void *)&dev_buf);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_equalizer_weights, 1, sizeof(cl_mem), (void *)&dev_weight[l]);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_equalizer_weights, 2, sizeof(int), (void *)&width);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_equalizer_weights, 3, sizeof(int), (void *)&wd);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_equalizer_weights, 4, sizeof(int), (void *)&ht);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_equalizer_weights, 5, sizeof(int), (void *)&l);
+    err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_equalizer_weights, wsizes);
+    if(err != CL_SUCCESS) goto error;
+
+    for(int horizontal = 1; horizontal >= 0; horizontal--)
+    {
+      err = equalizer_lift_cl(devid, dev_buf, dev_weight[l], gd->kernel_equalizer_predict, 1, width, height, l,
+                              horizontal, -1.0f);
+      if(err != CL_SUCCESS) goto error;
+      err = equalizer_lift_cl(devid, dev_buf, dev_weight[l], gd->kernel_equalizer_update, 0, width, height, l,
+                              horizontal, 1.0f);
+      if(err != CL_SUCCESS) goto error;
+    }
+  }
+
+  for(int l = 1; l < numl_cap; l++)
+  {
+    const float lv = (lm - l1) * (l - 1) / (float)(numl_cap - 1) + l1; // appr level in real image.
+    const float band = CLAMP((1.0 - lv / d->num_levels), 0, 1.0);
+    // coefficients in range [0, 2], 1 being neutral.
+    const float cL = 2 * dt_draw_curve_calc_value(d->curve[0], band);
+    const float cab = 2 * dt_draw_curve_calc_value(d->curve[1], band);
+    const float coeff[4] = { cL, cab, cab, 1.0f };
+    dt_opencl_set_kernel_arg(devid, gd->kernel_equalizer_scale, 0, sizeof(cl_mem), (void *)&dev_buf);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_equalizer_scale, 1, sizeof(int), (void *)&width);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_equalizer_scale, 2, sizeof(int), (void *)&height);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_equalizer_scale, 3, sizeof(int), (void *)&l);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_equalizer_scale, 4, 4 * sizeof(float), (void *)coeff);
+    err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_equalizer_scale, sizes);
+    if(err != CL_SUCCESS) goto error;
+  }
+
+  // inverse transform, columns first
+  for(int l = numl_cap - 1; l > 0; l--)
+  {
+    for(int horizontal = 0; horizontal <= 1; horizontal++)
+    {
+      err = equalizer_lift_cl(devid, dev_buf, dev_weight[l], gd->kernel_equalizer_update, 0, width, height, l,
+                              horizontal, -1.0f);
+      if(err != CL_SUCCESS) goto error;
+      err = equalizer_lift_cl(devid, dev_buf, dev_weight[l], gd->kernel_equalizer_predict, 1, width, height, l,
+                              horizontal, 1.0f);
+      if(err != CL_SUCCESS) goto error;
+    }
+  }
+
+  err = dt_opencl_enqueue_copy_buffer_to_image(devid, dev_buf, dev_out, 0, origin, region);
+  if(err != CL_SUCCESS) goto error;
+
+  for(int k = 1; k < numl_cap; k++) dt_opencl_release_mem_object(dev_weight[k]);
+  dt_opencl_release_mem_object(dev_buf);
+  return TRUE;
+
+error:
+  for(int k = 1; k <= DT_IOP_EQUALIZER_MAX_LEVEL; k++)
+    if(dev_weight[k] != NULL) dt_opencl_release_mem_object(dev_weight[k]);
+  if(dev_buf != NULL) dt_opencl_release_mem_object(dev_buf);
+  dt_print(DT_DEBUG_OPENCL, "[opencl_equalizer] couldn't enqueue kernel! %d\n", err);
+  return FALSE;
+}
+#endif
+
+void tiling_callback(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece,
+                     const dt_iop_roi_t *roi_in, const dt_iop_roi_t *roi_out,
+                     struct dt_develop_tiling_t *tiling)
+{
+  // input, output and the transformed buffer. the luma weights of all levels add less than a
+  // quarter buffer.
+  tiling->factor = 3.25f;
+  tiling->maxbuf = 1.0f;
+  tiling->overhead = 0;
+  tiling->overlap = 0;
+  tiling->xalign = 1;
+  tiling->yalign = 1;
+}
+
 void commit_params(struct dt_iop_module_t *self, dt_iop_params_t *p1, dt_dev_pixelpipe_t *pipe,
                    dt_dev_pixelpipe_iop_t *piece)
 {
@@ -287,6 +443,29 @@ void cleanup(dt_iop_module_t *module)
   module->params = NULL;
 }
 
+void init_global(dt_iop_module_so_t *module)
+{
+  const int program = 29; // equalizer.cl, from programs.conf
+  dt_iop_equalizer_global_data_t *gd
+      = (dt_iop_equalizer_global_data_t *)malloc(sizeof(dt_iop_equalizer_global_data_t));
+  module->data = gd;
+  gd->kernel_equalizer_weights = dt_opencl_create_kernel(program, "equalizer_weights");
+  gd->kernel_equalizer_predict = dt_opencl_create_kernel(program, "equalizer_predict");
+  gd->kernel_equalizer_update = dt_opencl_create_kernel(program, "equalizer_update");
+  gd->kernel_equalizer_scale = dt_opencl_create_kernel(program, "equalizer_scale");
+}
+
+void cleanup_global(dt_iop_module_so_t *module)
+{
+  dt_iop_equalizer_global_data_t *gd = (dt_iop_equalizer_global_data_t *)module->data;
+  dt_opencl_free_kernel(gd->kernel_equalizer_weights);
+  dt_opencl_free_kernel(gd->kernel_equalizer_predict);
+  dt_opencl_free_kernel(gd->kernel_equalizer_update);
+  dt_opencl_free_kernel(gd->kernel_equalizer_scale);
+  free(module->data);
+  module->data = NULL;
+}
+
 #if 0
 void init_presets (dt_iop_module_so_t *self)
 {
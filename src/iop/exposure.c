@@ -111,7 +111,7 @@ int groups()
 
 int flags()
 {
-  return IOP_FLAGS_ALLOW_TILING | IOP_FLAGS_SUPPORTS_BLENDING;
+  return IOP_FLAGS_ALLOW_TILING | IOP_FLAGS_SUPPORTS_BLENDING | IOP_FLAGS_POINTWISE | IOP_FLAGS_EAGER_GUI;
 }
 
 void init_key_accels(dt_iop_module_so_t *self)
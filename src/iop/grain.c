@@ -24,6 +24,7 @@
 #include <string.h>
 
 #include "bauhaus/bauhaus.h"
+#include "common/opencl.h"
 #include "control/control.h"
 #include "develop/develop.h"
 #include "develop/imageop.h"
@@ -48,6 +49,9 @@
 #define GRAIN_LUT_PAPER_GAMMA 1.0
 
 #define CLIP(x) ((x < 0) ? 0.0 : (x > 1.0) ? 1.0 : x)
+
+// the simplex noise repeats itself after this many units along x and y
+#define GRAIN_NOISE_PERIOD 768.0
 DT_MODULE_INTROSPECTION(2, dt_iop_grain_params_t)
 
 
@@ -83,6 +87,11 @@ typedef struct dt_iop_grain_data_t
   float grain_lut[GRAIN_LUT_SIZE * GRAIN_LUT_SIZE];
 } dt_iop_grain_data_t;
 
+typedef struct dt_iop_grain_global_data_t
+{
+  int kernel_grain;
+} dt_iop_grain_global_data_t;
+
 
 int legacy_params(dt_iop_module_t *self, const void *const old_params, const int old_version, void *new_params,
                   const int new_version)
@@ -348,17 +357,19 @@ static double _perlin_2d_noise(double x,double y,uint32_t octaves,double persist
   return total;
 }*/
 
+// parametrization of octaves to match power spectrum of real grain scans
+// (the amplitudes are repeated in grain.cl)
+static const double _simplex_octave_f[] = {0.4910, 0.9441, 1.7280};
+static const double _simplex_octave_a[] = {0.2340, 0.7850, 1.2150};
+
 static double _simplex_2d_noise(double x, double y, uint32_t octaves, double persistance, double z)
 {
   double total = 0;
 
-  // parametrization of octaves to match power spectrum of real grain scans
-  static double f[] = {0.4910, 0.9441, 1.7280};
-  static double a[] = {0.2340, 0.7850, 1.2150};
-
   for(uint32_t o = 0; o < octaves; o++)
   {
-    total += (_simplex_noise(x * f[o] / z, y * f[o] / z, o) * a[o]);
+    total += (_simplex_noise(x * _simplex_octave_f[o] / z, y * _simplex_octave_f[o] / z, o)
+              * _simplex_octave_a[o]);
   }
   return total;
 }
@@ -522,6 +533,67 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
   }
 }
 
+#ifdef HAVE_OPENCL
+int process_cl(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, cl_mem dev_in, cl_mem dev_out,
+               const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
+{
+  dt_iop_grain_data_t *data = (dt_iop_grain_data_t *)piece->data;
+  dt_iop_grain_global_data_t *gd = (dt_iop_grain_global_data_t *)self->data;
+
+  cl_int err = -999;
+  cl_mem dev_lut = NULL;
+  const int devid = piece->pipe->devid;
+  const int width = roi_out->width;
+  const int height = roi_out->height;
+
+  const unsigned int hash = _hash_string(piece->pipe->image.filename) % (int)fmax(roi_out->width * 0.3, 1.0);
+  const float strength = (data->strength / 100.0) * GRAIN_LIGHTNESS_STRENGTH_SCALE;
+  const double wd = fminf(piece->buf_in.width, piece->buf_in.height);
+  const double zoom = (1.0 + 8 * data->scale / 100) / 800.0;
+  const int filter = fabsf(roi_out->scale - 1.0f) > 0.01;
+  const float filtermul = filter ? piece->iscale / (roi_out->scale * wd) : 0.0f;
+  const float step = 1.0 / (roi_out->scale * wd);
+
+  // noise coordinates of the roi origin, per octave. they are far too large for single precision on the
+  // device, but as the noise is periodic only their remainder matters.
+  float ox[4] = { 0.0f }, oy[4] = { 0.0f }, mul[4] = { 0.0f };
+  for(int o = 0; o < 3; o++)
+  {
+    const double m = _simplex_octave_f[o] / zoom;
+    ox[o] = fmod((roi_out->x / roi_out->scale / wd + hash) * m, GRAIN_NOISE_PERIOD);
+    oy[o] = fmod(roi_out->y / roi_out->scale / wd * m, GRAIN_NOISE_PERIOD);
+    mul[o] = m;
+  }
+
+  dev_lut = dt_opencl_copy_host_to_device_constant(devid, sizeof(float) * GRAIN_LUT_SIZE * GRAIN_LUT_SIZE,
+                                                   data->grain_lut);
+  if(dev_lut == NULL) goto error;
+
+  size_t sizes[] = { ROUNDUPWD(width), ROUNDUPHT(height), 1 };
+  dt_opencl_set_kernel_arg(devid, gd->kernel_grain, 0, sizeof(cl_mem), (void *)&dev_in);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_grain, 1, sizeof(cl_mem), (void *)&dev_out);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_grain, 2, sizeof(int), (void *)&width);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_grain, 3, sizeof(int), (void *)&height);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_grain, 4, 4 * sizeof(float), (void *)ox);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_grain, 5, 4 * sizeof(float), (void *)oy);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_grain, 6, 4 * sizeof(float), (void *)mul);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_grain, 7, sizeof(float), (void *)&step);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_grain, 8, sizeof(float), (void *)&filtermul);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_grain, 9, sizeof(float), (void *)&strength);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_grain, 10, sizeof(cl_mem), (void *)&dev_lut);
+  err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_grain, sizes);
+  if(err != CL_SUCCESS) goto error;
+
+  dt_opencl_release_mem_object(dev_lut);
+  return TRUE;
+
+error:
+  if(dev_lut != NULL) dt_opencl_release_mem_object(dev_lut);
+  dt_print(DT_DEBUG_OPENCL, "[opencl_grain] couldn't enqueue kernel! %d\n", err);
+  return FALSE;
+}
+#endif
+
 static void scale_callback(GtkWidget *slider, gpointer user_data)
 {
   dt_iop_module_t *self = (dt_iop_module_t *)user_data;
@@ -607,6 +679,22 @@ void cleanup(dt_iop_module_t *module)
   module->params = NULL;
 }
 
+void init_global(dt_iop_module_so_t *module)
+{
+  const int program = 30; // grain.cl, from programs.conf
+  dt_iop_grain_global_data_t *gd = (dt_iop_grain_global_data_t *)malloc(sizeof(dt_iop_grain_global_data_t));
+  module->data = gd;
+  gd->kernel_grain = dt_opencl_create_kernel(program, "grain");
+}
+
+void cleanup_global(dt_iop_module_so_t *module)
+{
+  dt_iop_grain_global_data_t *gd = (dt_iop_grain_global_data_t *)module->data;
+  dt_opencl_free_kernel(gd->kernel_grain);
+  free(module->data);
+  module->data = NULL;
+}
+
 void gui_init(struct dt_iop_module_t *self)
 {
   self->gui_data = malloc(sizeof(dt_iop_grain_gui_data_t));
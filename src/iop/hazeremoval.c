@@ -37,6 +37,7 @@
 
 #include "bauhaus/bauhaus.h"
 #include "common/darktable.h"
+#include "common/opencl.h"
 #include "develop/imageop.h"
 #include "gui/gtk.h"
 #include "iop/iop_api.h"
@@ -77,6 +78,15 @@ typedef struct dt_iop_hazeremoval_gui_data_t
 
 typedef struct dt_iop_hazeremoval_global_data_t
 {
+  int kernel_hazeremoval_dark_channel;
+  int kernel_hazeremoval_transition_map;
+  int kernel_hazeremoval_box_min_max;
+  int kernel_hazeremoval_box_mean;
+  int kernel_hazeremoval_guided_products;
+  int kernel_hazeremoval_guided_coeffs;
+  int kernel_hazeremoval_apply;
+  int kernel_hazeremoval_histogram;
+  int kernel_hazeremoval_ambient_light;
 } dt_iop_hazeremoval_global_data_t;
 
 const char *name()
@@ -86,7 +96,7 @@ const char *name()
 
 int flags()
 {
-  return IOP_FLAGS_INCLUDE_IN_STYLES | IOP_FLAGS_SUPPORTS_BLENDING;
+  return IOP_FLAGS_INCLUDE_IN_STYLES | IOP_FLAGS_SUPPORTS_BLENDING | IOP_FLAGS_NO_TILE_STREAMING;
 }
 
 int groups()
@@ -108,11 +118,34 @@ void cleanup_pipe(struct dt_iop_module_t *self, dt_dev_pixelpipe_t *pipe, dt_dev
 
 void init_global(dt_iop_module_so_t *self)
 {
-  self->data = NULL;
+  const int program = 23; // hazeremoval.cl, from programs.conf
+  dt_iop_hazeremoval_global_data_t *gd = malloc(sizeof(dt_iop_hazeremoval_global_data_t));
+  self->data = gd;
+  gd->kernel_hazeremoval_dark_channel = dt_opencl_create_kernel(program, "hazeremoval_dark_channel");
+  gd->kernel_hazeremoval_transition_map = dt_opencl_create_kernel(program, "hazeremoval_transition_map");
+  gd->kernel_hazeremoval_box_min_max = dt_opencl_create_kernel(program, "hazeremoval_box_min_max");
+  gd->kernel_hazeremoval_box_mean = dt_opencl_create_kernel(program, "hazeremoval_box_mean");
+  gd->kernel_hazeremoval_guided_products = dt_opencl_create_kernel(program, "hazeremoval_guided_products");
+  gd->kernel_hazeremoval_guided_coeffs = dt_opencl_create_kernel(program, "hazeremoval_guided_coeffs");
+  gd->kernel_hazeremoval_apply = dt_opencl_create_kernel(program, "hazeremoval_apply");
+  gd->kernel_hazeremoval_histogram = dt_opencl_create_kernel(program, "hazeremoval_histogram");
+  gd->kernel_hazeremoval_ambient_light = dt_opencl_create_kernel(program, "hazeremoval_ambient_light");
 }
 
 void cleanup_global(dt_iop_module_so_t *self)
 {
+  dt_iop_hazeremoval_global_data_t *gd = (dt_iop_hazeremoval_global_data_t *)self->data;
+  dt_opencl_free_kernel(gd->kernel_hazeremoval_ambient_light);
+  dt_opencl_free_kernel(gd->kernel_hazeremoval_histogram);
+  dt_opencl_free_kernel(gd->kernel_hazeremoval_apply);
+  dt_opencl_free_kernel(gd->kernel_hazeremoval_guided_coeffs);
+  dt_opencl_free_kernel(gd->kernel_hazeremoval_guided_products);
+  dt_opencl_free_kernel(gd->kernel_hazeremoval_box_mean);
+  dt_opencl_free_kernel(gd->kernel_hazeremoval_box_min_max);
+  dt_opencl_free_kernel(gd->kernel_hazeremoval_transition_map);
+  dt_opencl_free_kernel(gd->kernel_hazeremoval_dark_channel);
+  free(self->data);
+  self->data = NULL;
 }
 
 void init(dt_iop_module_t *self)
@@ -792,40 +825,20 @@ static float ambient_light(const const_rgb_image img, int w1, rgb_pixel *pA0)
   return -1.125f * logf(crit_haze_level); // return the maximal depth
 }
 
-void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *const ivoid,
-             void *const ovoid, const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
+// hazeremoval module needs the color and the haziness (which yields
+// distance_max) of the most hazy region of the image.  In pixelpipe
+// FULL we can not reliably get this value as the pixelpipe might
+// only see part of the image (region of interest).  Therefore, we
+// try to get A0 and distance_max from the PREVIEW pixelpipe which
+// luckily stores it for us. returns NAN if the caller has to calculate them.
+static float _fetch_ambient_light(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, rgb_pixel A0)
 {
   dt_iop_hazeremoval_gui_data_t *g = (dt_iop_hazeremoval_gui_data_t *)self->gui_data;
-  dt_iop_hazeremoval_params_t *d = (dt_iop_hazeremoval_params_t *)piece->data;
-
-  const int ch = piece->colors;
-  const int width = roi_in->width;
-  const int height = roi_in->height;
-  const size_t size = (size_t)width * height;
-  const int w1 = 6; // window size (positive integer) for determing the dark channel and the transition map
-  const int w2 = 9; // window size (positive integer) for the guided filter
-
-  // module parameters
-  const float strength = d->strength; // strength of haze removal
-  const float distance = d->distance; // maximal distance from camera to remove haze
-  const float eps = 0.025f;           // regularization parameter for guided filter
-
-  const const_rgb_image img_in = (const_rgb_image){ ivoid, width, height, ch };
-  const rgb_image img_out = (rgb_image){ ovoid, width, height, ch };
-
-  // estimate diffusive ambient light and image depth
-  rgb_pixel A0;
   A0[0] = NAN;
   A0[1] = NAN;
   A0[2] = NAN;
   float distance_max = NAN;
 
-  // hazeremoval module needs the color and the haziness (which yields
-  // distance_max) of the most hazy region of the image.  In pixelpipe
-  // FULL we can not reliably get this value as the pixelpipe might
-  // only see part of the image (region of interest).  Therefore, we
-  // try to get A0 and distance_max from the PREVIEW pixelpipe which
-  // luckily stores it for us.
   if(self->dev->gui_attached && g && piece->pipe->type == DT_DEV_PIXELPIPE_FULL)
   {
     dt_pthread_mutex_lock(&g->lock);
@@ -846,12 +859,14 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
     distance_max = g->distance_max;
     dt_pthread_mutex_unlock(&g->lock);
   }
-  // In all other cases we calculate distance_max and A0 here.
-  if(isnan(distance_max))
-  {
-    distance_max = ambient_light(img_in, w1, &A0);
-  }
-  // PREVIEW pixelpipe stores values.
+  return distance_max;
+}
+
+// PREVIEW pixelpipe stores values.
+static void _store_ambient_light(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const rgb_pixel A0,
+                                 const float distance_max)
+{
+  dt_iop_hazeremoval_gui_data_t *g = (dt_iop_hazeremoval_gui_data_t *)self->gui_data;
   if(self->dev->gui_attached && g && piece->pipe->type == DT_DEV_PIXELPIPE_PREVIEW)
   {
     uint64_t hash = dt_dev_hash_plus(self->dev, piece->pipe, 0, self->priority);
@@ -863,6 +878,34 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
     g->hash = hash;
     dt_pthread_mutex_unlock(&g->lock);
   }
+}
+
+void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *const ivoid,
+             void *const ovoid, const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
+{
+  dt_iop_hazeremoval_params_t *d = (dt_iop_hazeremoval_params_t *)piece->data;
+
+  const int ch = piece->colors;
+  const int width = roi_in->width;
+  const int height = roi_in->height;
+  const size_t size = (size_t)width * height;
+  const int w1 = 6; // window size (positive integer) for determing the dark channel and the transition map
+  const int w2 = 9; // window size (positive integer) for the guided filter
+
+  // module parameters
+  const float strength = d->strength; // strength of haze removal
+  const float distance = d->distance; // maximal distance from camera to remove haze
+  const float eps = 0.025f;           // regularization parameter for guided filter
+
+  const const_rgb_image img_in = (const_rgb_image){ ivoid, width, height, ch };
+  const rgb_image img_out = (rgb_image){ ovoid, width, height, ch };
+
+  // estimate diffusive ambient light and image depth
+  rgb_pixel A0;
+  float distance_max = _fetch_ambient_light(self, piece, A0);
+  // In all other cases we calculate distance_max and A0 here.
+  if(isnan(distance_max)) distance_max = ambient_light(img_in, w1, &A0);
+  _store_ambient_light(self, piece, A0, distance_max);
 
   // calculate the transition map
   gray_image trans_map = new_gray_image(width, height);
@@ -907,6 +950,324 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
   free_gray_image(&trans_map_filtered);
 }
 
+#ifdef HAVE_OPENCL
+#define HAZEREMOVAL_BINS 4096
+
+// value below which the fraction q of all entries of the histogram over [lo, hi) lies, to bin precision
+static float _histogram_quantile(const int *const hist, const float lo, const float hi, const float q)
+{
+  size_t total = 0;
+  for(int b = 0; b < HAZEREMOVAL_BINS; b++) total += hist[b];
+  const size_t p = total * q;
+  size_t count = 0;
+  for(int b = 0; b < HAZEREMOVAL_BINS; b++)
+  {
+    count += hist[b];
+    if(count > p) return lo + (hi - lo) * b / HAZEREMOVAL_BINS;
+  }
+  return hi;
+}
+
+// moving minimum or maximum over a box of size (2*w+1) x (2*w+1), dev_tmp is a scratch image of the same size
+static cl_int _box_min_max_cl(const int devid, dt_iop_hazeremoval_global_data_t *gd, cl_mem dev_img,
+                              cl_mem dev_tmp, const int width, const int height, const int w, const int maximum)
+{
+  size_t sizes[] = { ROUNDUPWD(width), ROUNDUPHT(height), 1 };
+  const int kernel = gd->kernel_hazeremoval_box_min_max;
+  for(int pass = 0; pass < 2; pass++)
+  {
+    cl_mem src = pass ? dev_tmp : dev_img, dst = pass ? dev_img : dev_tmp;
+    const int dx = pass ? 0 : 1, dy = pass ? 1 : 0;
+    dt_opencl_set_kernel_arg(devid, kernel, 0, sizeof(cl_mem), (void *)&src);
+    dt_opencl_set_kernel_arg(devid, kernel, 1, sizeof(cl_mem), (void *)&dst);
+    dt_opencl_set_kernel_arg(devid, kernel, 2, sizeof(int), (void *)&width);
+    dt_opencl_set_kernel_arg(devid, kernel, 3, sizeof(int), (void *)&height);
+    dt_opencl_set_kernel_arg(devid, kernel, 4, sizeof(int), (void *)&w);
+    dt_opencl_set_kernel_arg(devid, kernel, 5, sizeof(int), (void *)&dx);
+    dt_opencl_set_kernel_arg(devid, kernel, 6, sizeof(int), (void *)&dy);
+    dt_opencl_set_kernel_arg(devid, kernel, 7, sizeof(int), (void *)&maximum);
+    const cl_int err = dt_opencl_enqueue_kernel_2d(devid, kernel, sizes);
+    if(err != CL_SUCCESS) return err;
+  }
+  return CL_SUCCESS;
+}
+
+// moving average of the four channels over a box of size (2*w+1) x (2*w+1)
+static cl_int _box_mean_cl(const int devid, dt_iop_hazeremoval_global_data_t *gd, cl_mem dev_img, cl_mem dev_tmp,
+                           const int width, const int height, const int w)
+{
+  size_t sizes[] = { ROUNDUPWD(width), ROUNDUPHT(height), 1 };
+  const int kernel = gd->kernel_hazeremoval_box_mean;
+  for(int pass = 0; pass < 2; pass++)
+  {
+    cl_mem src = pass ? dev_tmp : dev_img, dst = pass ? dev_img : dev_tmp;
+    const int dx = pass ? 0 : 1, dy = pass ? 1 : 0;
+    dt_opencl_set_kernel_arg(devid, kernel, 0, sizeof(cl_mem), (void *)&src);
+    dt_opencl_set_kernel_arg(devid, kernel, 1, sizeof(cl_mem), (void *)&dst);
+    dt_opencl_set_kernel_arg(devid, kernel, 2, sizeof(int), (void *)&width);
+    dt_opencl_set_kernel_arg(devid, kernel, 3, sizeof(int), (void *)&height);
+    dt_opencl_set_kernel_arg(devid, kernel, 4, sizeof(int), (void *)&w);
+    dt_opencl_set_kernel_arg(devid, kernel, 5, sizeof(int), (void *)&dx);
+    dt_opencl_set_kernel_arg(devid, kernel, 6, sizeof(int), (void *)&dy);
+    const cl_int err = dt_opencl_enqueue_kernel_2d(devid, kernel, sizes);
+    if(err != CL_SUCCESS) return err;
+  }
+  return CL_SUCCESS;
+}
+
+// histogram of dev_img over [lo, hi), or of the brightness of the pixels of dev_img where dev_guide >= lo_guide
+static cl_int _histogram_cl(const int devid, dt_iop_hazeremoval_global_data_t *gd, cl_mem dev_img,
+                            cl_mem dev_guide, cl_mem dev_hist, int *const hist, const int width, const int height,
+                            const float lo, const float hi, const int brightness, const float lo_guide)
+{
+  memset(hist, 0, sizeof(int) * HAZEREMOVAL_BINS);
+  cl_int err = dt_opencl_write_buffer_to_device(devid, hist, dev_hist, 0, sizeof(int) * HAZEREMOVAL_BINS, CL_TRUE);
+  if(err != CL_SUCCESS) return err;
+
+  size_t sizes[] = { ROUNDUPWD(width), ROUNDUPHT(height), 1 };
+  const int kernel = gd->kernel_hazeremoval_histogram;
+  const int bins = HAZEREMOVAL_BINS;
+  dt_opencl_set_kernel_arg(devid, kernel, 0, sizeof(cl_mem), (void *)&dev_img);
+  dt_opencl_set_kernel_arg(devid, kernel, 1, sizeof(cl_mem), (void *)&dev_guide);
+  dt_opencl_set_kernel_arg(devid, kernel, 2, sizeof(cl_mem), (void *)&dev_hist);
+  dt_opencl_set_kernel_arg(devid, kernel, 3, sizeof(int), (void *)&width);
+  dt_opencl_set_kernel_arg(devid, kernel, 4, sizeof(int), (void *)&height);
+  dt_opencl_set_kernel_arg(devid, kernel, 5, sizeof(float), (void *)&lo);
+  dt_opencl_set_kernel_arg(devid, kernel, 6, sizeof(float), (void *)&hi);
+  dt_opencl_set_kernel_arg(devid, kernel, 7, sizeof(int), (void *)&bins);
+  dt_opencl_set_kernel_arg(devid, kernel, 8, sizeof(int), (void *)&brightness);
+  dt_opencl_set_kernel_arg(devid, kernel, 9, sizeof(float), (void *)&lo_guide);
+  err = dt_opencl_enqueue_kernel_2d(devid, kernel, sizes);
+  if(err != CL_SUCCESS) return err;
+
+  return dt_opencl_read_buffer_from_device(devid, hist, dev_hist, 0, sizeof(int) * HAZEREMOVAL_BINS, CL_TRUE);
+}
+
+// same as ambient_light(), but the quantiles come from histograms instead of selecting them from a copy of the
+// whole image. dev_dark holds the dark channel.
+static cl_int _ambient_light_cl(const int devid, dt_iop_hazeremoval_global_data_t *gd, cl_mem dev_in,
+                                cl_mem dev_dark, const int width, const int height, rgb_pixel A0,
+                                float *const distance_max)
+{
+  const float dark_channel_quantil = 0.95f; // quantil for determing the most hazy pixels
+  const float bright_quantil = 0.95f; // quantil for determing the brightest pixels among the most hazy pixels
+  cl_int err = -999;
+  cl_mem dev_hist = NULL;
+  cl_mem dev_rows = NULL;
+  int *hist = NULL;
+  float *rows = NULL;
+
+  dev_hist = dt_opencl_alloc_device_buffer(devid, sizeof(int) * HAZEREMOVAL_BINS);
+  if(dev_hist == NULL) goto cleanup;
+  dev_rows = dt_opencl_alloc_device_buffer(devid, sizeof(float) * 4 * height);
+  if(dev_rows == NULL) goto cleanup;
+  hist = malloc(sizeof(int) * HAZEREMOVAL_BINS);
+  rows = dt_alloc_align(64, sizeof(float) * 4 * height);
+  if(hist == NULL || rows == NULL) goto cleanup;
+
+  err = _histogram_cl(devid, gd, dev_dark, dev_dark, dev_hist, hist, width, height, 0.0f, 1.0f, 0, 0.0f);
+  if(err != CL_SUCCESS) goto cleanup;
+  const float crit_haze_level = _histogram_quantile(hist, 0.0f, 1.0f, dark_channel_quantil);
+
+  err = _histogram_cl(devid, gd, dev_in, dev_dark, dev_hist, hist, width, height, 0.0f, 3.0f, 1,
+                      crit_haze_level);
+  if(err != CL_SUCCESS) goto cleanup;
+  const float crit_brightness = _histogram_quantile(hist, 0.0f, 3.0f, bright_quantil);
+
+  size_t sizes[] = { ROUNDUPWD(height), 1, 1 };
+  const int kernel = gd->kernel_hazeremoval_ambient_light;
+  dt_opencl_set_kernel_arg(devid, kernel, 0, sizeof(cl_mem), (void *)&dev_in);
+  dt_opencl_set_kernel_arg(devid, kernel, 1, sizeof(cl_mem), (void *)&dev_dark);
+  dt_opencl_set_kernel_arg(devid, kernel, 2, sizeof(cl_mem), (void *)&dev_rows);
+  dt_opencl_set_kernel_arg(devid, kernel, 3, sizeof(int), (void *)&width);
+  dt_opencl_set_kernel_arg(devid, kernel, 4, sizeof(int), (void *)&height);
+  dt_opencl_set_kernel_arg(devid, kernel, 5, sizeof(float), (void *)&crit_haze_level);
+  dt_opencl_set_kernel_arg(devid, kernel, 6, sizeof(float), (void *)&crit_brightness);
+  err = dt_opencl_enqueue_kernel_2d(devid, kernel, sizes);
+  if(err != CL_SUCCESS) goto cleanup;
+  err = dt_opencl_read_buffer_from_device(devid, rows, dev_rows, 0, sizeof(float) * 4 * height, CL_TRUE);
+  if(err != CL_SUCCESS) goto cleanup;
+
+  float A0_r = 0, A0_g = 0, A0_b = 0, N_bright_hazy = 0;
+  for(int k = 0; k < height; k++)
+  {
+    A0_r += rows[4 * k];
+    A0_g += rows[4 * k + 1];
+    A0_b += rows[4 * k + 2];
+    N_bright_hazy += rows[4 * k + 3];
+  }
+  A0[0] = A0_r / N_bright_hazy;
+  A0[1] = A0_g / N_bright_hazy;
+  A0[2] = A0_b / N_bright_hazy;
+  // see ambient_light() for the factor
+  *distance_max = -1.125f * logf(crit_haze_level);
+
+cleanup:
+  dt_opencl_release_mem_object(dev_rows);
+  dt_opencl_release_mem_object(dev_hist);
+  dt_free_align(rows);
+  free(hist);
+  return err;
+}
+
+int process_cl(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, cl_mem dev_in, cl_mem dev_out,
+               const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
+{
+  dt_iop_hazeremoval_params_t *d = (dt_iop_hazeremoval_params_t *)piece->data;
+  dt_iop_hazeremoval_global_data_t *gd = (dt_iop_hazeremoval_global_data_t *)self->data;
+
+  const int devid = piece->pipe->devid;
+  const int width = roi_in->width;
+  const int height = roi_in->height;
+  const int w1 = 6; // window size (positive integer) for determing the dark channel and the transition map
+  const int w2 = 9; // window size (positive integer) for the guided filter
+  const float strength = d->strength;
+  const float distance = d->distance;
+  const float eps = 0.025f; // regularization parameter for guided filter
+
+  cl_mem dev_dark = NULL;
+  cl_mem dev_trans = NULL;
+  cl_mem dev_mean = NULL;
+  cl_mem dev_cov = NULL;
+  cl_mem dev_var_rgb = NULL;
+  cl_mem dev_var_gb = NULL;
+  cl_mem dev_tmp = NULL;
+  cl_int err = -999;
+
+  dev_dark = dt_opencl_alloc_device(devid, width, height, sizeof(float));
+  if(dev_dark == NULL) goto error;
+  dev_trans = dt_opencl_alloc_device(devid, width, height, sizeof(float));
+  if(dev_trans == NULL) goto error;
+
+  size_t sizes[] = { ROUNDUPWD(width), ROUNDUPHT(height), 1 };
+
+  rgb_pixel A0;
+  float distance_max = _fetch_ambient_light(self, piece, A0);
+  if(isnan(distance_max))
+  {
+    dt_opencl_set_kernel_arg(devid, gd->kernel_hazeremoval_dark_channel, 0, sizeof(cl_mem), (void *)&dev_in);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_hazeremoval_dark_channel, 1, sizeof(cl_mem), (void *)&dev_dark);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_hazeremoval_dark_channel, 2, sizeof(int), (void *)&width);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_hazeremoval_dark_channel, 3, sizeof(int), (void *)&height);
+    err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_hazeremoval_dark_channel, sizes);
+    if(err != CL_SUCCESS) goto error;
+    err = _box_min_max_cl(devid, gd, dev_dark, dev_trans, width, height, w1, FALSE);
+    if(err != CL_SUCCESS) goto error;
+    err = _ambient_light_cl(devid, gd, dev_in, dev_dark, width, height, A0, &distance_max);
+    if(err != CL_SUCCESS) goto error;
+  }
+  _store_ambient_light(self, piece, A0, distance_max);
+
+  // calculate and refine the transition map
+  const float A0_cl[4] = { A0[0], A0[1], A0[2], 1.0f };
+  dt_opencl_set_kernel_arg(devid, gd->kernel_hazeremoval_transition_map, 0, sizeof(cl_mem), (void *)&dev_in);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_hazeremoval_transition_map, 1, sizeof(cl_mem), (void *)&dev_trans);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_hazeremoval_transition_map, 2, sizeof(int), (void *)&width);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_hazeremoval_transition_map, 3, sizeof(int), (void *)&height);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_hazeremoval_transition_map, 4, sizeof(float), (void *)&strength);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_hazeremoval_transition_map, 5, 4 * sizeof(float), (void *)&A0_cl);
+  err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_hazeremoval_transition_map, sizes);
+  if(err != CL_SUCCESS) goto error;
+  err = _box_min_max_cl(devid, gd, dev_trans, dev_dark, width, height, w1, TRUE);
+  if(err != CL_SUCCESS) goto error;
+  err = _box_min_max_cl(devid, gd, dev_trans, dev_dark, width, height, w1, FALSE);
+  if(err != CL_SUCCESS) goto error;
+
+  dt_opencl_release_mem_object(dev_dark);
+  dev_dark = NULL;
+
+  // guided filter of the transition map with the input image as guide
+  dev_mean = dt_opencl_alloc_device(devid, width, height, 4 * sizeof(float));
+  if(dev_mean == NULL) goto error;
+  dev_cov = dt_opencl_alloc_device(devid, width, height, 4 * sizeof(float));
+  if(dev_cov == NULL) goto error;
+  dev_var_rgb = dt_opencl_alloc_device(devid, width, height, 4 * sizeof(float));
+  if(dev_var_rgb == NULL) goto error;
+  dev_var_gb = dt_opencl_alloc_device(devid, width, height, 4 * sizeof(float));
+  if(dev_var_gb == NULL) goto error;
+  dev_tmp = dt_opencl_alloc_device(devid, width, height, 4 * sizeof(float));
+  if(dev_tmp == NULL) goto error;
+
+  const int products = gd->kernel_hazeremoval_guided_products;
+  dt_opencl_set_kernel_arg(devid, products, 0, sizeof(cl_mem), (void *)&dev_in);
+  dt_opencl_set_kernel_arg(devid, products, 1, sizeof(cl_mem), (void *)&dev_trans);
+  dt_opencl_set_kernel_arg(devid, products, 2, sizeof(cl_mem), (void *)&dev_mean);
+  dt_opencl_set_kernel_arg(devid, products, 3, sizeof(cl_mem), (void *)&dev_cov);
+  dt_opencl_set_kernel_arg(devid, products, 4, sizeof(cl_mem), (void *)&dev_var_rgb);
+  dt_opencl_set_kernel_arg(devid, products, 5, sizeof(cl_mem), (void *)&dev_var_gb);
+  dt_opencl_set_kernel_arg(devid, products, 6, sizeof(int), (void *)&width);
+  dt_opencl_set_kernel_arg(devid, products, 7, sizeof(int), (void *)&height);
+  err = dt_opencl_enqueue_kernel_2d(devid, products, sizes);
+  if(err != CL_SUCCESS) goto error;
+
+  cl_mem means[] = { dev_mean, dev_cov, dev_var_rgb, dev_var_gb };
+  for(int k = 0; k < 4; k++)
+  {
+    err = _box_mean_cl(devid, gd, means[k], dev_tmp, width, height, w2);
+    if(err != CL_SUCCESS) goto error;
+  }
+
+  const int coeffs = gd->kernel_hazeremoval_guided_coeffs;
+  dt_opencl_set_kernel_arg(devid, coeffs, 0, sizeof(cl_mem), (void *)&dev_mean);
+  dt_opencl_set_kernel_arg(devid, coeffs, 1, sizeof(cl_mem), (void *)&dev_cov);
+  dt_opencl_set_kernel_arg(devid, coeffs, 2, sizeof(cl_mem), (void *)&dev_var_rgb);
+  dt_opencl_set_kernel_arg(devid, coeffs, 3, sizeof(cl_mem), (void *)&dev_var_gb);
+  dt_opencl_set_kernel_arg(devid, coeffs, 4, sizeof(cl_mem), (void *)&dev_tmp);
+  dt_opencl_set_kernel_arg(devid, coeffs, 5, sizeof(int), (void *)&width);
+  dt_opencl_set_kernel_arg(devid, coeffs, 6, sizeof(int), (void *)&height);
+  dt_opencl_set_kernel_arg(devid, coeffs, 7, sizeof(float), (void *)&eps);
+  err = dt_opencl_enqueue_kernel_2d(devid, coeffs, sizes);
+  if(err != CL_SUCCESS) goto error;
+  err = _box_mean_cl(devid, gd, dev_tmp, dev_mean, width, height, w2);
+  if(err != CL_SUCCESS) goto error;
+
+  // finally, calculate the haze-free image
+  const float t_min = expf(-distance * distance_max); // minimum allowed value for transition map
+  dt_opencl_set_kernel_arg(devid, gd->kernel_hazeremoval_apply, 0, sizeof(cl_mem), (void *)&dev_in);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_hazeremoval_apply, 1, sizeof(cl_mem), (void *)&dev_tmp);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_hazeremoval_apply, 2, sizeof(cl_mem), (void *)&dev_out);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_hazeremoval_apply, 3, sizeof(int), (void *)&width);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_hazeremoval_apply, 4, sizeof(int), (void *)&height);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_hazeremoval_apply, 5, sizeof(float), (void *)&t_min);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_hazeremoval_apply, 6, 4 * sizeof(float), (void *)&A0_cl);
+  err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_hazeremoval_apply, sizes);
+  if(err != CL_SUCCESS) goto error;
+
+  dt_opencl_release_mem_object(dev_tmp);
+  dt_opencl_release_mem_object(dev_var_gb);
+  dt_opencl_release_mem_object(dev_var_rgb);
+  dt_opencl_release_mem_object(dev_cov);
+  dt_opencl_release_mem_object(dev_mean);
+  dt_opencl_release_mem_object(dev_trans);
+  return TRUE;
+
+error:
+  dt_opencl_release_mem_object(dev_tmp);
+  dt_opencl_release_mem_object(dev_var_gb);
+  dt_opencl_release_mem_object(dev_var_rgb);
+  dt_opencl_release_mem_object(dev_cov);
+  dt_opencl_release_mem_object(dev_mean);
+  dt_opencl_release_mem_object(dev_trans);
+  dt_opencl_release_mem_object(dev_dark);
+  dt_print(DT_DEBUG_OPENCL, "[opencl_hazeremoval] couldn't enqueue kernel! %d\n", err);
+  return FALSE;
+}
+
+#undef HAZEREMOVAL_BINS
+#endif
+
+void tiling_callback(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece,
+                     const dt_iop_roi_t *roi_in, const dt_iop_roi_t *roi_out, struct dt_develop_tiling_t *tiling)
+{
+  // in + out with two gray images on the cpu, on the device two gray and five four channel images on top
+  tiling->factor = 7.5f;
+  tiling->maxbuf = 1.0f;
+  tiling->overhead = 0;
+  tiling->overlap = 0;
+  tiling->xalign = 1;
+  tiling->yalign = 1;
+}
+
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
 // kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
@@ -70,6 +70,7 @@ typedef struct dt_iop_highlights_global_data_t
   int kernel_highlights_1f_lch_bayer;
   int kernel_highlights_1f_lch_xtrans;
   int kernel_highlights_4f_clip;
+  int kernel_highlights_1f_inpaint;
 } dt_iop_highlights_global_data_t;
 
 const char *name()
@@ -109,6 +110,7 @@ int process_cl(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, cl_m
 
   cl_int err = -999;
   cl_mem dev_xtrans = NULL;
+  cl_mem dev_tmp = NULL;
 
   const int devid = piece->pipe->devid;
   const int width = roi_in->width;
@@ -201,6 +203,39 @@ int process_cl(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, cl_m
     err = dt_opencl_enqueue_kernel_2d_with_local(devid, gd->kernel_highlights_1f_lch_xtrans, sizes, local);
     if(err != CL_SUCCESS) goto error;
   }
+  else if(d->mode == DT_IOP_HIGHLIGHTS_INPAINT)
+  {
+    // raw images with color reconstruction (both bayer and xtrans). every row and then every column is a
+    // work item scanning it in both directions, dev_tmp collects the guesses of the first three passes.
+    const float clips[4] = { 0.987 * d->clip * piece->pipe->dsc.processed_maximum[0],
+                             0.987 * d->clip * piece->pipe->dsc.processed_maximum[1],
+                             0.987 * d->clip * piece->pipe->dsc.processed_maximum[2], clip };
+
+    dev_xtrans
+        = dt_opencl_copy_host_to_device_constant(devid, sizeof(piece->pipe->dsc.xtrans), piece->pipe->dsc.xtrans);
+    if(dev_xtrans == NULL) goto error;
+
+    dev_tmp = dt_opencl_alloc_device_buffer(devid, sizeof(float) * width * height);
+    if(dev_tmp == NULL) goto error;
+
+    for(int dim = 0; dim < 2; dim++)
+    {
+      size_t sizes[] = { ROUNDUPWD(dim ? width : height), 1, 1 };
+      dt_opencl_set_kernel_arg(devid, gd->kernel_highlights_1f_inpaint, 0, sizeof(cl_mem), (void *)&dev_in);
+      dt_opencl_set_kernel_arg(devid, gd->kernel_highlights_1f_inpaint, 1, sizeof(cl_mem), (void *)&dev_tmp);
+      dt_opencl_set_kernel_arg(devid, gd->kernel_highlights_1f_inpaint, 2, sizeof(cl_mem), (void *)&dev_out);
+      dt_opencl_set_kernel_arg(devid, gd->kernel_highlights_1f_inpaint, 3, sizeof(int), (void *)&width);
+      dt_opencl_set_kernel_arg(devid, gd->kernel_highlights_1f_inpaint, 4, sizeof(int), (void *)&height);
+      dt_opencl_set_kernel_arg(devid, gd->kernel_highlights_1f_inpaint, 5, 4 * sizeof(float), (void *)clips);
+      dt_opencl_set_kernel_arg(devid, gd->kernel_highlights_1f_inpaint, 6, sizeof(int), (void *)&roi_out->x);
+      dt_opencl_set_kernel_arg(devid, gd->kernel_highlights_1f_inpaint, 7, sizeof(int), (void *)&roi_out->y);
+      dt_opencl_set_kernel_arg(devid, gd->kernel_highlights_1f_inpaint, 8, sizeof(int), (void *)&filters);
+      dt_opencl_set_kernel_arg(devid, gd->kernel_highlights_1f_inpaint, 9, sizeof(cl_mem), (void *)&dev_xtrans);
+      dt_opencl_set_kernel_arg(devid, gd->kernel_highlights_1f_inpaint, 10, sizeof(int), (void *)&dim);
+      err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_highlights_1f_inpaint, sizes);
+      if(err != CL_SUCCESS) goto error;
+    }
+  }
 
   // update processed maximum
   const float m = fmaxf(fmaxf(piece->pipe->dsc.processed_maximum[0], piece->pipe->dsc.processed_maximum[1]),
@@ -208,10 +243,12 @@ int process_cl(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, cl_m
   for(int k = 0; k < 3; k++) piece->pipe->dsc.processed_maximum[k] = m;
 
   dt_opencl_release_mem_object(dev_xtrans);
+  dt_opencl_release_mem_object(dev_tmp);
   return TRUE;
 
 error:
   dt_opencl_release_mem_object(dev_xtrans);
+  dt_opencl_release_mem_object(dev_tmp);
   dt_print(DT_DEBUG_OPENCL, "[opencl_highlights] couldn't enqueue kernel! %d\n", err);
   return FALSE;
 }
@@ -224,7 +261,7 @@ void tiling_callback(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t
   dt_iop_highlights_data_t *d = (dt_iop_highlights_data_t *)piece->data;
   const uint32_t filters = piece->pipe->dsc.filters;
 
-  tiling->factor = 2.0f;  // in + out
+  tiling->factor = (d->mode == DT_IOP_HIGHLIGHTS_INPAINT) ? 3.0f : 2.0f;  // in + out (+ tmp of opencl)
   tiling->maxbuf = 1.0f;
   tiling->overhead = 0;
 
@@ -279,13 +316,17 @@ static inline float interp_pix_xtrans(const int ratio_next,
   }
 }
 
-static inline void interpolate_color_xtrans(const void *const ivoid, void *const ovoid,
-                                            const dt_iop_roi_t *const roi_in,
-                                            const dt_iop_roi_t *const roi_out,
-                                            int dim, int dir, int other,
-                                            const float *const clip,
-                                            const uint8_t (*const xtrans)[6],
-                                            const int pass)
+// the color reconstruction walks the columns in strips of this many next to each other, row by row, so they
+// share the cache lines they read instead of fetching a line per pixel for every single column.
+#define INPAINT_STRIP 16
+
+DT_ALWAYS_INLINE void interpolate_color_xtrans(const void *const ivoid, void *const ovoid,
+                                               const dt_iop_roi_t *const roi_in,
+                                               const dt_iop_roi_t *const roi_out,
+                                               int dim, int dir, int other, int num,
+                                               const float *const clip,
+                                               const uint8_t (*const xtrans)[6],
+                                               const int pass)
 {
   // In Bayer each row/col has only green/red or green/blue
   // transitions, hence can reconstruct color by single ratio per
@@ -301,14 +342,15 @@ static inline void interpolate_color_xtrans(const void *const ivoid, void *const
   const int roff[3][3] = {{ 0, -1, -2},
                           { 1,  0, -3},
                           { 2,  3,  0}};
-  // record ratios of color transitions 0:unused, 1:RG, 2:RB, and 3:GB
-  float ratios[4] = {1.0f, 1.0f, 1.0f, 1.0f};
+  // record ratios of color transitions 0:unused, 1:RG, 2:RB, and 3:GB,
+  // for each of the num lines [other, other + num) processed side by side
+  float ratios[INPAINT_STRIP][4];
+  for(int l = 0; l < num; l++)
+    for(int r = 0; r < 4; r++) ratios[l][r] = 1.0f;
 
   // passes are 0:+x, 1:-x, 2:+y, 3:-y
   // dims are 0:traverse a row, 1:traverse a column
   // dir is 1:left to right, -1: right to left
-  int i = (dim == 0) ? 0 : other;
-  int j = (dim == 0) ? other : 0;
   const ssize_t offs = (dim ? roi_out->width : 1) * ((dir < 0) ? -1 : 1);
   const ssize_t offl = offs - (dim ? 1 : roi_out->width);
   const ssize_t offr = offs + (dim ? 1 : roi_out->width);
@@ -323,100 +365,83 @@ static inline void interpolate_color_xtrans(const void *const ivoid, void *const
     beg = ((dim == 0) ? roi_out->width : roi_out->height) - 1;
     end = -1;
   }
-
-  float *in, *out;
-  if(dim == 1)
-  {
-    out = (float *)ovoid + (size_t)i + (size_t)beg * roi_out->width;
-    in = (float *)ivoid + (size_t)i + (size_t)beg * roi_in->width;
-  }
-  else
-  {
-    out = (float *)ovoid + (size_t)beg + (size_t)j * roi_out->width;
-    in = (float *)ivoid + (size_t)beg + (size_t)j * roi_in->width;
-  }
+  const float clip_max = fmaxf(fmaxf(clip[0], clip[1]), clip[2]);
 
   for(int k = beg; k != end; k += dir)
-  {
-    if(dim == 1)
-      j = k;
-    else
-      i = k;
-
-    const uint8_t f0 = FCxtrans(j, i, roi_in, xtrans);
-    const uint8_t f1 = FCxtrans(dim ? (j + dir) : j, dim ? i : (i + dir), roi_in, xtrans);
-    const uint8_t fl = FCxtrans(dim ? (j + dir) : (j - 1), dim ? (i - 1) : (i + dir), roi_in, xtrans);
-    const uint8_t fr = FCxtrans(dim ? (j + dir) : (j + 1), dim ? (i + 1) : (i + dir), roi_in, xtrans);
-    const float clip0 = clip[f0];
-    const float clip1 = clip[f1];
-    const float clipl = clip[fl];
-    const float clipr = clip[fr];
-    const float clip_max = fmaxf(fmaxf(clip[0], clip[1]), clip[2]);
-
-    if(i == 0 || i == roi_out->width - 1 || j == 0 || j == roi_out->height - 1)
+    for(int l = 0; l < num; l++)
     {
-      if(pass == 3) out[0] = fminf(clip_max, in[0]);
-    }
-    else
-    {
-      // ratio to next pixel if this & next are unclamped and not in
-      // 2x2 green block
-      if ((f0 != f1) &&
-          (in[0] < clip0 && in[0] > 1e-5f) &&
-          (in[offs] < clip1 && in[offs] > 1e-5f))
+      const int i = dim ? other + l : k;
+      const int j = dim ? k : other + l;
+      float *const out = (float *)ovoid + (size_t)i + (size_t)j * roi_out->width;
+      const float *const in = (const float *)ivoid + (size_t)i + (size_t)j * roi_in->width;
+
+      const uint8_t f0 = FCxtrans(j, i, roi_in, xtrans);
+      const uint8_t f1 = FCxtrans(dim ? (j + dir) : j, dim ? i : (i + dir), roi_in, xtrans);
+      const uint8_t fl = FCxtrans(dim ? (j + dir) : (j - 1), dim ? (i - 1) : (i + dir), roi_in, xtrans);
+      const uint8_t fr = FCxtrans(dim ? (j + dir) : (j + 1), dim ? (i + 1) : (i + dir), roi_in, xtrans);
+      const float clip0 = clip[f0];
+      const float clip1 = clip[f1];
+      const float clipl = clip[fl];
+      const float clipr = clip[fr];
+
+      if(i == 0 || i == roi_out->width - 1 || j == 0 || j == roi_out->height - 1)
       {
-        const int r = roff[f0][f1];
-        assert(r != 0);
-        if (r > 0)
-          ratios[r] = (3.f * ratios[r] + (in[offs] / in[0])) / 4.f;
-        else
-          ratios[-r] = (3.f * ratios[-r] + (in[0] / in[offs])) / 4.f;
-      }
-
-      if(in[0] >= clip0 - 1e-5f)
-      {
-        // interplate color for clipped pixel
-        float add;
-        if(f0 != f1)
-          // next pixel is different color
-          add =
-            interp_pix_xtrans(roff[f0][f1], offs, clip0, clip1, in, ratios);
-        else
-          // at start of 2x2 green block, look diagonally
-          add = (fl != f0) ?
-            interp_pix_xtrans(roff[f0][fl], offl, clip0, clipl, in, ratios) :
-            interp_pix_xtrans(roff[f0][fr], offr, clip0, clipr, in, ratios);
-
-        if(pass == 0)
-          out[0] = add;
-        else if(pass == 3)
-          out[0] = fminf(clip_max, (out[0] + add) / 4.0f);
-        else
-          out[0] += add;
+        if(pass == 3) out[0] = fminf(clip_max, in[0]);
       }
       else
       {
-        // pixel is not clipped
-        if(pass == 3) out[0] = in[0];
+        // ratio to next pixel if this & next are unclamped and not in
+        // 2x2 green block
+        if ((f0 != f1) &&
+            (in[0] < clip0 && in[0] > 1e-5f) &&
+            (in[offs] < clip1 && in[offs] > 1e-5f))
+        {
+          const int r = roff[f0][f1];
+          assert(r != 0);
+          if (r > 0)
+            ratios[l][r] = (3.f * ratios[l][r] + (in[offs] / in[0])) / 4.f;
+          else
+            ratios[l][-r] = (3.f * ratios[l][-r] + (in[0] / in[offs])) / 4.f;
+        }
+
+        if(in[0] >= clip0 - 1e-5f)
+        {
+          // interplate color for clipped pixel
+          float add;
+          if(f0 != f1)
+            // next pixel is different color
+            add =
+              interp_pix_xtrans(roff[f0][f1], offs, clip0, clip1, in, ratios[l]);
+          else
+            // at start of 2x2 green block, look diagonally
+            add = (fl != f0) ?
+              interp_pix_xtrans(roff[f0][fl], offl, clip0, clipl, in, ratios[l]) :
+              interp_pix_xtrans(roff[f0][fr], offr, clip0, clipr, in, ratios[l]);
+
+          if(pass == 0)
+            out[0] = add;
+          else if(pass == 3)
+            out[0] = fminf(clip_max, (out[0] + add) / 4.0f);
+          else
+            out[0] += add;
+        }
+        else
+        {
+          // pixel is not clipped
+          if(pass == 3) out[0] = in[0];
+        }
       }
     }
-    out += offs;
-    in += offs;
-  }
 }
 
-static inline void interpolate_color(const void *const ivoid, void *const ovoid,
-                                     const dt_iop_roi_t *const roi_out, int dim, int dir, int other,
-                                     const float *clip, const uint32_t filters, const int pass)
+DT_ALWAYS_INLINE void interpolate_color(const void *const ivoid, void *const ovoid,
+                                        const dt_iop_roi_t *const roi_out, int dim, int dir, int other, int num,
+                                        const float *clip, const uint32_t filters, const int pass)
 {
-  float ratio = 1.0f;
-  float *in, *out;
+  // one ratio for each of the num lines [other, other + num) processed side by side
+  float ratio[INPAINT_STRIP];
+  for(int l = 0; l < num; l++) ratio[l] = 1.0f;
 
-  int i = 0, j = 0;
-  if(dim == 0)
-    j = other;
-  else
-    i = other;
   ssize_t offs = dim ? roi_out->width : 1;
   if(dir < 0) offs = -offs;
   int beg, end;
@@ -443,66 +468,56 @@ static inline void interpolate_color(const void *const ivoid, void *const ovoid,
   else
     return;
 
-  if(dim == 1)
-  {
-    out = (float *)ovoid + i + (size_t)beg * roi_out->width;
-    in = (float *)ivoid + i + (size_t)beg * roi_out->width;
-  }
-  else
-  {
-    out = (float *)ovoid + beg + (size_t)j * roi_out->width;
-    in = (float *)ivoid + beg + (size_t)j * roi_out->width;
-  }
   for(int k = beg; k != end; k += dir)
-  {
-    if(dim == 1)
-      j = k;
-    else
-      i = k;
-    const float clip0 = clip[FC(j, i, filters)];
-    const float clip1 = clip[FC(dim ? (j + 1) : j, dim ? i : (i + 1), filters)];
-    if(i == 0 || i == roi_out->width - 1 || j == 0 || j == roi_out->height - 1)
+    for(int l = 0; l < num; l++)
     {
-      if(pass == 3) out[0] = in[0];
-    }
-    else
-    {
-      if(in[0] < clip0 && in[0] > 1e-5f)
-      { // both are not clipped
-        if(in[offs] < clip1 && in[offs] > 1e-5f)
-        { // update ratio, exponential decay. ratio = in[odd]/in[even]
-          if(k & 1)
-            ratio = (3.0f * ratio + in[0] / in[offs]) / 4.0f;
-          else
-            ratio = (3.0f * ratio + in[offs] / in[0]) / 4.0f;
-        }
+      const int i = dim ? other + l : k;
+      const int j = dim ? k : other + l;
+      float *const out = (float *)ovoid + i + (size_t)j * roi_out->width;
+      const float *const in = (const float *)ivoid + i + (size_t)j * roi_out->width;
+
+      const float clip0 = clip[FC(j, i, filters)];
+      const float clip1 = clip[FC(dim ? (j + 1) : j, dim ? i : (i + 1), filters)];
+      if(i == 0 || i == roi_out->width - 1 || j == 0 || j == roi_out->height - 1)
+      {
+        if(pass == 3) out[0] = in[0];
       }
+      else
+      {
+        if(in[0] < clip0 && in[0] > 1e-5f)
+        { // both are not clipped
+          if(in[offs] < clip1 && in[offs] > 1e-5f)
+          { // update ratio, exponential decay. ratio = in[odd]/in[even]
+            if(k & 1)
+              ratio[l] = (3.0f * ratio[l] + in[0] / in[offs]) / 4.0f;
+            else
+              ratio[l] = (3.0f * ratio[l] + in[offs] / in[0]) / 4.0f;
+          }
+        }
 
-      if(in[0] >= clip0 - 1e-5f)
-      { // in[0] is clipped, restore it as in[1] adjusted according to ratio
-        float add = 0.0f;
-        if(in[offs] >= clip1 - 1e-5f)
-          add = fmaxf(clip0, clip1);
-        else if(k & 1)
-          add = in[offs] * ratio;
-        else
-          add = in[offs] / ratio;
+        if(in[0] >= clip0 - 1e-5f)
+        { // in[0] is clipped, restore it as in[1] adjusted according to ratio
+          float add = 0.0f;
+          if(in[offs] >= clip1 - 1e-5f)
+            add = fmaxf(clip0, clip1);
+          else if(k & 1)
+            add = in[offs] * ratio[l];
+          else
+            add = in[offs] / ratio[l];
 
-        if(pass == 0)
-          out[0] = add;
-        else if(pass == 3)
-          out[0] = (out[0] + add) / 4.0f;
+          if(pass == 0)
+            out[0] = add;
+          else if(pass == 3)
+            out[0] = (out[0] + add) / 4.0f;
+          else
+            out[0] += add;
+        }
         else
-          out[0] += add;
-      }
-      else
-      {
-        if(pass == 3) out[0] = in[0];
+        {
+          if(pass == 3) out[0] = in[0];
+        }
       }
     }
-    out += offs;
-    in += offs;
-  }
 }
 
 /*
@@ -870,16 +885,17 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
 #endif
         for(int j = 0; j < roi_out->height; j++)
         {
-          interpolate_color_xtrans(ivoid, ovoid, roi_in, roi_out, 0, 1, j, clips, xtrans, 0);
-          interpolate_color_xtrans(ivoid, ovoid, roi_in, roi_out, 0, -1, j, clips, xtrans, 1);
+          interpolate_color_xtrans(ivoid, ovoid, roi_in, roi_out, 0, 1, j, 1, clips, xtrans, 0);
+          interpolate_color_xtrans(ivoid, ovoid, roi_in, roi_out, 0, -1, j, 1, clips, xtrans, 1);
         }
 #ifdef _OPENMP
 #pragma omp parallel for schedule(dynamic) default(none)
 #endif
-        for(int i = 0; i < roi_out->width; i++)
+        for(int i = 0; i < roi_out->width; i += INPAINT_STRIP)
         {
-          interpolate_color_xtrans(ivoid, ovoid, roi_in, roi_out, 1, 1, i, clips, xtrans, 2);
-          interpolate_color_xtrans(ivoid, ovoid, roi_in, roi_out, 1, -1, i, clips, xtrans, 3);
+          const int num = MIN(INPAINT_STRIP, roi_out->width - i);
+          interpolate_color_xtrans(ivoid, ovoid, roi_in, roi_out, 1, 1, i, num, clips, xtrans, 2);
+          interpolate_color_xtrans(ivoid, ovoid, roi_in, roi_out, 1, -1, i, num, clips, xtrans, 3);
         }
       }
       else
@@ -889,18 +905,19 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
 #endif
         for(int j = 0; j < roi_out->height; j++)
         {
-          interpolate_color(ivoid, ovoid, roi_out, 0, 1, j, clips, filters, 0);
-          interpolate_color(ivoid, ovoid, roi_out, 0, -1, j, clips, filters, 1);
+          interpolate_color(ivoid, ovoid, roi_out, 0, 1, j, 1, clips, filters, 0);
+          interpolate_color(ivoid, ovoid, roi_out, 0, -1, j, 1, clips, filters, 1);
         }
 
-// up/down directions
+// up/down directions, in strips of columns
 #ifdef _OPENMP
 #pragma omp parallel for schedule(dynamic) default(none) shared(data, piece)
 #endif
-        for(int i = 0; i < roi_out->width; i++)
+        for(int i = 0; i < roi_out->width; i += INPAINT_STRIP)
         {
-          interpolate_color(ivoid, ovoid, roi_out, 1, 1, i, clips, filters, 2);
-          interpolate_color(ivoid, ovoid, roi_out, 1, -1, i, clips, filters, 3);
+          const int num = MIN(INPAINT_STRIP, roi_out->width - i);
+          interpolate_color(ivoid, ovoid, roi_out, 1, 1, i, num, clips, filters, 2);
+          interpolate_color(ivoid, ovoid, roi_out, 1, -1, i, num, clips, filters, 3);
         }
       }
       break;
@@ -949,9 +966,6 @@ void commit_params(struct dt_iop_module_t *self, dt_iop_params_t *p1, dt_dev_pix
   memcpy(d, p, sizeof(*p));
 
   piece->process_cl_ready = 1;
-
-  // no OpenCL for DT_IOP_HIGHLIGHTS_INPAINT yet.
-  if(d->mode == DT_IOP_HIGHLIGHTS_INPAINT) piece->process_cl_ready = 0;
 }
 
 void init_global(dt_iop_module_so_t *module)
@@ -964,11 +978,13 @@ void init_global(dt_iop_module_so_t *module)
   gd->kernel_highlights_1f_lch_bayer = dt_opencl_create_kernel(program, "highlights_1f_lch_bayer");
   gd->kernel_highlights_1f_lch_xtrans = dt_opencl_create_kernel(program, "highlights_1f_lch_xtrans");
   gd->kernel_highlights_4f_clip = dt_opencl_create_kernel(program, "highlights_4f_clip");
+  gd->kernel_highlights_1f_inpaint = dt_opencl_create_kernel(program, "highlights_1f_inpaint");
 }
 
 void cleanup_global(dt_iop_module_so_t *module)
 {
   dt_iop_highlights_global_data_t *gd = (dt_iop_highlights_global_data_t *)module->data;
+  dt_opencl_free_kernel(gd->kernel_highlights_1f_inpaint);
   dt_opencl_free_kernel(gd->kernel_highlights_4f_clip);
   dt_opencl_free_kernel(gd->kernel_highlights_1f_lch_bayer);
   dt_opencl_free_kernel(gd->kernel_highlights_1f_lch_xtrans);
@@ -26,6 +26,7 @@ extern "C" {
 #endif
 
 #include "common/introspection.h"
+#include "common/simd.h"
 
 #include <cairo/cairo.h>
 #include <glib.h>
@@ -161,9 +162,9 @@ void process_tiling(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t
                     void *const o, const struct dt_iop_roi_t *const roi_in,
                     const struct dt_iop_roi_t *const roi_out, const int bpp);
 
-#if defined(__SSE__)
+#if defined(DT_SIMD_SSE)
 /** a variant process(), that can contain SSE2 intrinsics. */
-/** can be provided by each IOP. */
+/** can be provided by each IOP. on arm only those of common/simd.h are available. */
 void process_sse2(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece, const void *const i,
                   void *const o, const struct dt_iop_roi_t *const roi_in,
                   const struct dt_iop_roi_t *const roi_out);
@@ -125,6 +125,10 @@ typedef struct dt_iop_lensfun_data_t
   float distance;
   lfLensType target_geom;
   gboolean do_nan_checks;
+  // lensfun coordinates of the last region processed by an interactive pipe, see _distortion_map()
+  float *map;
+  dt_iop_roi_t map_roi;
+  float map_orig_w, map_orig_h;
 } dt_iop_lensfun_data_t;
 
 const char *name()
@@ -329,14 +333,111 @@ static char *_lens_sanitize(const char *orig_lens)
   }
 }
 
+static void _free_distortion_map(dt_iop_lensfun_data_t *d)
+{
+  dt_free_align(d->map);
+  d->map = NULL;
+}
+
+/* lensfun's coordinates of all pixels of roi_out, x and y for red, green and blue. the full and preview pipes
+ * keep the last map as long as the parameters and the region stay the same, so edits of other modules don't
+ * pay for the lens geometry again. *cached tells whether the map belongs to the piece data now, otherwise the
+ * caller frees it. */
+static float *_distortion_map(dt_iop_lensfun_data_t *d, const dt_dev_pixelpipe_iop_t *piece,
+                              lfModifier *modifier, const dt_iop_roi_t *const roi_out, const float orig_w,
+                              const float orig_h, gboolean *cached)
+{
+  const gboolean cache
+      = piece->pipe->type == DT_DEV_PIXELPIPE_FULL || piece->pipe->type == DT_DEV_PIXELPIPE_PREVIEW;
+  *cached = cache;
+  if(cache && d->map && d->map_orig_w == orig_w && d->map_orig_h == orig_h && d->map_roi.x == roi_out->x
+     && d->map_roi.y == roi_out->y && d->map_roi.width == roi_out->width && d->map_roi.height == roi_out->height
+     && d->map_roi.scale == roi_out->scale)
+    return d->map;
+
+  const size_t mapwidth = (size_t)roi_out->width * 2 * 3;
+  float *const map = dt_alloc_align(16, mapwidth * roi_out->height * sizeof(float));
+  if(!map) return NULL;
+
+#ifdef _OPENMP
+#pragma omp parallel for default(none) shared(modifier) schedule(static)
+#endif
+  for(int y = 0; y < roi_out->height; y++)
+    lf_modifier_apply_subpixel_geometry_distortion(modifier, roi_out->x, roi_out->y + y, roi_out->width, 1,
+                                                   map + mapwidth * y);
+
+  if(cache)
+  {
+    _free_distortion_map(d);
+    d->map = map;
+    d->map_roi = *roi_out;
+    d->map_orig_w = orig_w;
+    d->map_orig_h = orig_h;
+  }
+  return map;
+}
+
+/* one line of the corrected image from the coordinates of the map. without tca all channels come from the same
+ * place, then one interpolation of the whole pixel does. */
+static void _distort_line(const dt_iop_lensfun_data_t *const d, const struct dt_interpolation *const interpolation,
+                          const float *const in, const dt_iop_roi_t *const roi_in, const int ch,
+                          const float *map, float *out, const int width, const int tca, const int mask_display)
+{
+  const int ch_width = ch * roi_in->width;
+  for(int x = 0; x < width; x++, map += 6, out += ch)
+  {
+    if(!tca && ch == 4)
+    {
+      if(d->do_nan_checks && (!isfinite(map[2]) || !isfinite(map[3])))
+      {
+        for(int c = 0; c < 4; c++) out[c] = 0.0f;
+        continue;
+      }
+      // the sse code writes all four channels, so out[3] is the interpolated alpha then
+      dt_interpolation_compute_pixel4c(interpolation, in, out, map[2] - roi_in->x, map[3] - roi_in->y,
+                                       roi_in->width, roi_in->height, ch_width);
+    }
+    else
+      for(int c = 0; c < 3; c++)
+      {
+        if(d->do_nan_checks && (!isfinite(map[c * 2]) || !isfinite(map[c * 2 + 1])))
+        {
+          out[c] = 0.0f;
+          continue;
+        }
+
+        const float *const inptr = in + (size_t)c;
+        const float pi0 = map[c * 2] - roi_in->x;
+        const float pi1 = map[c * 2 + 1] - roi_in->y;
+        out[c] = dt_interpolation_compute_sample(interpolation, inptr, pi0, pi1, roi_in->width, roi_in->height,
+                                                 ch, ch_width);
+      }
+
+    if(mask_display & DT_DEV_PIXELPIPE_DISPLAY_MASK)
+    {
+      if(d->do_nan_checks && (!isfinite(map[2]) || !isfinite(map[3])))
+      {
+        out[3] = 0.0f;
+        continue;
+      }
+
+      // take green channel distortion also for alpha channel
+      const float *const inptr = in + (size_t)3;
+      const float pi0 = map[2] - roi_in->x;
+      const float pi1 = map[3] - roi_in->y;
+      out[3] = dt_interpolation_compute_sample(interpolation, inptr, pi0, pi1, roi_in->width, roi_in->height,
+                                               ch, ch_width);
+    }
+  }
+}
+
 void process(dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *const ivoid, void *const ovoid,
              const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
 {
-  const dt_iop_lensfun_data_t *const d = (dt_iop_lensfun_data_t *)piece->data;
+  dt_iop_lensfun_data_t *const d = (dt_iop_lensfun_data_t *)piece->data;
   dt_iop_lensfun_gui_data_t *g = (dt_iop_lensfun_gui_data_t *)self->gui_data;
 
   const int ch = piece->colors;
-  const int ch_width = ch * roi_in->width;
   const int mask_display = piece->pipe->mask_display;
 
   const unsigned int pixelformat = ch == 3 ? LF_CR_3(RED, GREEN, BLUE) : LF_CR_4(RED, GREEN, BLUE, UNKNOWN);
@@ -363,56 +464,26 @@ void process(dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *c
     // reverse direction (useful for renderings)
     if(modflags & (LF_MODIFY_TCA | LF_MODIFY_DISTORTION | LF_MODIFY_GEOMETRY | LF_MODIFY_SCALE))
     {
-      // acquire temp memory for distorted pixel coords
-      const size_t bufsize = (size_t)roi_out->width * 2 * 3;
-      void *buf = dt_alloc_align(16, bufsize * dt_get_num_threads() * sizeof(float));
+      gboolean cached;
+      const float *const map = _distortion_map(d, piece, modifier, roi_out, orig_w, orig_h, &cached);
+      const size_t mapwidth = (size_t)roi_out->width * 2 * 3;
+      const int tca = modflags & LF_MODIFY_TCA;
 
+      if(map)
+      {
 #ifdef _OPENMP
-#pragma omp parallel for default(none) shared(buf, modifier) schedule(static)
+#pragma omp parallel for default(none) schedule(static)
 #endif
-      for(int y = 0; y < roi_out->height; y++)
-      {
-        float *bufptr = ((float *)buf) + (size_t)bufsize * dt_get_thread_num();
-        lf_modifier_apply_subpixel_geometry_distortion(modifier, roi_out->x, roi_out->y + y, roi_out->width,
-                                                       1, bufptr);
-
-        // reverse transform the global coords from lf to our buffer
-        float *out = ((float *)ovoid) + (size_t)y * roi_out->width * ch;
-        for(int x = 0; x < roi_out->width; x++, bufptr += 6, out += ch)
+        for(int y = 0; y < roi_out->height; y++)
         {
-          for(int c = 0; c < 3; c++)
-          {
-            if(d->do_nan_checks && (!isfinite(bufptr[c * 2]) || !isfinite(bufptr[c * 2 + 1])))
-            {
-              out[c] = 0.0f;
-              continue;
-            }
-
-            const float *const inptr = (const float *const)ivoid + (size_t)c;
-            const float pi0 = bufptr[c * 2] - roi_in->x;
-            const float pi1 = bufptr[c * 2 + 1] - roi_in->y;
-            out[c] = dt_interpolation_compute_sample(interpolation, inptr, pi0, pi1, roi_in->width,
-                                                     roi_in->height, ch, ch_width);
-          }
-
-          if(mask_display & DT_DEV_PIXELPIPE_DISPLAY_MASK)
-          {
-            if(d->do_nan_checks && (!isfinite(bufptr[2]) || !isfinite(bufptr[3])))
-            {
-              out[3] = 0.0f;
-              continue;
-            }
-
-            // take green channel distortion also for alpha channel
-            const float *const inptr = (const float *const)ivoid + (size_t)3;
-            const float pi0 = bufptr[2] - roi_in->x;
-            const float pi1 = bufptr[3] - roi_in->y;
-            out[3] = dt_interpolation_compute_sample(interpolation, inptr, pi0, pi1, roi_in->width,
-                                                     roi_in->height, ch, ch_width);
-          }
+          float *out = ((float *)ovoid) + (size_t)y * roi_out->width * ch;
+          _distort_line(d, interpolation, (const float *)ivoid, roi_in, ch, map + mapwidth * y, out,
+                        roi_out->width, tca, mask_display);
         }
+        if(!cached) dt_free_align((void *)map);
       }
-      dt_free_align(buf);
+      else
+        memcpy(ovoid, ivoid, (size_t)ch * sizeof(float) * roi_out->width * roi_out->height);
     }
     else
     {
@@ -458,55 +529,26 @@ void process(dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *c
 
     if(modflags & (LF_MODIFY_TCA | LF_MODIFY_DISTORTION | LF_MODIFY_GEOMETRY | LF_MODIFY_SCALE))
     {
-      // acquire temp memory for distorted pixel coords
-      const size_t buf2size = (size_t)roi_out->width * 2 * 3;
-      void *buf2 = dt_alloc_align(16, buf2size * sizeof(float) * dt_get_num_threads());
+      gboolean cached;
+      const float *const map = _distortion_map(d, piece, modifier, roi_out, orig_w, orig_h, &cached);
+      const size_t mapwidth = (size_t)roi_out->width * 2 * 3;
+      const int tca = modflags & LF_MODIFY_TCA;
 
+      if(map)
+      {
 #ifdef _OPENMP
-#pragma omp parallel for default(none) shared(buf2, buf, modifier) schedule(static)
+#pragma omp parallel for default(none) shared(buf) schedule(static)
 #endif
-      for(int y = 0; y < roi_out->height; y++)
-      {
-        float *buf2ptr = ((float *)buf2) + (size_t)buf2size * dt_get_thread_num();
-        lf_modifier_apply_subpixel_geometry_distortion(modifier, roi_out->x, roi_out->y + y, roi_out->width,
-                                                       1, buf2ptr);
-        // reverse transform the global coords from lf to our buffer
-        float *out = ((float *)ovoid) + (size_t)y * roi_out->width * ch;
-        for(int x = 0; x < roi_out->width; x++, buf2ptr += 6, out += ch)
+        for(int y = 0; y < roi_out->height; y++)
         {
-          for(int c = 0; c < 3; c++)
-          {
-            if(d->do_nan_checks && (!isfinite(buf2ptr[c * 2]) || !isfinite(buf2ptr[c * 2 + 1])))
-            {
-              out[c] = 0.0f;
-              continue;
-            }
-
-            float *bufptr = ((float *)buf) + c;
-            const float pi0 = buf2ptr[c * 2] - roi_in->x;
-            const float pi1 = buf2ptr[c * 2 + 1] - roi_in->y;
-            out[c] = dt_interpolation_compute_sample(interpolation, bufptr, pi0, pi1, roi_in->width,
-                                                     roi_in->height, ch, ch_width);
-          }
-
-          if(mask_display & DT_DEV_PIXELPIPE_DISPLAY_MASK)
-          {
-            if(d->do_nan_checks && (!isfinite(buf2ptr[2]) || !isfinite(buf2ptr[3])))
-            {
-              out[3] = 0.0f;
-              continue;
-            }
-
-            // take green channel distortion also for alpha channel
-            float *bufptr = ((float *)buf) + 3;
-            const float pi0 = buf2ptr[2] - roi_in->x;
-            const float pi1 = buf2ptr[3] - roi_in->y;
-            out[3] = dt_interpolation_compute_sample(interpolation, bufptr, pi0, pi1, roi_in->width,
-                                                     roi_in->height, ch, ch_width);
-          }
+          float *out = ((float *)ovoid) + (size_t)y * roi_out->width * ch;
+          _distort_line(d, interpolation, (const float *)buf, roi_in, ch, map + mapwidth * y, out,
+                        roi_out->width, tca, mask_display);
         }
+        if(!cached) dt_free_align((void *)map);
       }
-      dt_free_align(buf2);
+      else
+        memcpy(ovoid, buf, bufsize);
     }
     else
     {
@@ -549,7 +591,6 @@ int process_cl(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, cl_m
   const int width = MAX(iwidth, owidth);
   const int height = MAX(iheight, oheight);
   const int ch = piece->colors;
-  const int tmpbufwidth = owidth * 2 * 3;
   const size_t tmpbuflen = d->inverse ? (size_t)oheight * owidth * 2 * 3 * sizeof(float)
                                       : MAX((size_t)oheight * owidth * 2 * 3, (size_t)iheight * iwidth * ch)
                                         * sizeof(float);
@@ -613,19 +654,14 @@ int process_cl(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, cl_m
     // reverse direction (useful for renderings)
     if(modflags & (LF_MODIFY_TCA | LF_MODIFY_DISTORTION | LF_MODIFY_GEOMETRY | LF_MODIFY_SCALE))
     {
-#ifdef _OPENMP
-#pragma omp parallel for default(none) shared(tmpbuf, d, modifier) schedule(static)
-#endif
-      for(int y = 0; y < roi_out->height; y++)
-      {
-        float *pi = tmpbuf + (size_t)y * tmpbufwidth;
-        lf_modifier_apply_subpixel_geometry_distortion(modifier, roi_out->x, roi_out->y + y, roi_out->width,
-                                                       1, pi);
-      }
+      gboolean cached;
+      float *map = _distortion_map(d, piece, modifier, roi_out, orig_w, orig_h, &cached);
+      if(map == NULL) goto error;
 
-      /* _blocking_ memory transfer: host tmpbuf buffer -> opencl dev_tmpbuf */
-      err = dt_opencl_write_buffer_to_device(devid, tmpbuf, dev_tmpbuf, 0,
+      /* _blocking_ memory transfer: host map -> opencl dev_tmpbuf */
+      err = dt_opencl_write_buffer_to_device(devid, map, dev_tmpbuf, 0,
                                              (size_t)owidth * oheight * 2 * 3 * sizeof(float), CL_TRUE);
+      if(!cached) dt_free_align(map);
       if(err != CL_SUCCESS) goto error;
 
       dt_opencl_set_kernel_arg(devid, ldkernel, 0, sizeof(cl_mem), (void *)&dev_in);
@@ -722,19 +758,14 @@ int process_cl(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, cl_m
 
     if(modflags & (LF_MODIFY_TCA | LF_MODIFY_DISTORTION | LF_MODIFY_GEOMETRY | LF_MODIFY_SCALE))
     {
-#ifdef _OPENMP
-#pragma omp parallel for default(none) shared(tmpbuf, d, modifier) schedule(static)
-#endif
-      for(int y = 0; y < roi_out->height; y++)
-      {
-        float *pi = tmpbuf + (size_t)y * tmpbufwidth;
-        lf_modifier_apply_subpixel_geometry_distortion(modifier, roi_out->x, roi_out->y + y, roi_out->width,
-                                                       1, pi);
-      }
+      gboolean cached;
+      float *map = _distortion_map(d, piece, modifier, roi_out, orig_w, orig_h, &cached);
+      if(map == NULL) goto error;
 
-      /* _blocking_ memory transfer: host tmpbuf buffer -> opencl dev_tmpbuf */
-      err = dt_opencl_write_buffer_to_device(devid, tmpbuf, dev_tmpbuf, 0,
+      /* _blocking_ memory transfer: host map -> opencl dev_tmpbuf */
+      err = dt_opencl_write_buffer_to_device(devid, map, dev_tmpbuf, 0,
                                              (size_t)owidth * oheight * 2 * 3 * sizeof(float), CL_TRUE);
+      if(!cached) dt_free_align(map);
       if(err != CL_SUCCESS) goto error;
 
       dt_opencl_set_kernel_arg(devid, ldkernel, 0, sizeof(cl_mem), (void *)&dev_tmp);
@@ -1026,6 +1057,7 @@ void commit_params(struct dt_iop_module_t *self, dt_iop_params_t *p1, dt_dev_pix
   d->distance = p->distance;
   d->target_geom = p->target_geom;
   d->do_nan_checks = TRUE;
+  _free_distortion_map(d);
 
   /*
    * there are certain situations when LensFun can return NAN coordinated.
@@ -1056,6 +1088,7 @@ void cleanup_pipe(struct dt_iop_module_t *self, dt_dev_pixelpipe_t *pipe, dt_dev
     lf_lens_destroy(d->lens);
     d->lens = NULL;
   }
+  _free_distortion_map(d);
   free(piece->data);
   piece->data = NULL;
 }
@@ -238,6 +238,23 @@ typedef struct {
   int warp_kernel;
 } dt_iop_liquify_global_data_t;
 
+// the distortion map built last time and the warps it was built from. the next map is only
+// rebuilt where the warps changed or the extent grew.
+
+typedef struct {
+  dt_pthread_mutex_t lock;
+  cairo_rectangle_int_t extent;
+  float complex *map;
+  dt_liquify_warp_t *warps;
+  int num_warps;
+} dt_liquify_map_cache_t;
+
+typedef struct {
+  dt_iop_liquify_params_t params; // first, so piece->data can be used as the params
+  dt_liquify_map_cache_t process_map;  // piece coordinates, for process() and process_cl()
+  dt_liquify_map_cache_t distort_map;  // raw coordinates, for the distort_*() of the masks
+} dt_iop_liquify_data_t;
+
 typedef struct {
   dt_pthread_mutex_t lock;
   dt_iop_liquify_params_t params;
@@ -930,7 +947,8 @@ static void build_round_stamp (float complex **pstamp,
   Applies a stamp at a specified position.
 
   Applies a stamp at the position specified by @a point and adds the
-  resulting vector field to the global distortion map @a global_map.
+  resulting vector field to the global distortion map @a global_map,
+  inside of @a clip only.
 
   The global distortion map is a map of relative pixel displacements
   encompassing all our paths.
@@ -938,6 +956,7 @@ static void build_round_stamp (float complex **pstamp,
 
 static void add_to_global_distortion_map (float complex *global_map,
                                           const cairo_rectangle_int_t *global_map_extent,
+                                          const cairo_rectangle_int_t *clip,
                                           const dt_liquify_warp_t *warp,
                                           const float complex *stamp,
                                           const cairo_rectangle_int_t *stamp_extent)
@@ -948,8 +967,9 @@ static void add_to_global_distortion_map (float complex *global_map,
   cairo_rectangle_int_t cmmext = mmext;
   cairo_region_t *mmreg = cairo_region_create_rectangle (&mmext);
   cairo_region_intersect_rectangle (mmreg, global_map_extent);
+  cairo_region_intersect_rectangle (mmreg, clip);
   cairo_region_get_extents (mmreg, &cmmext);
-  free (mmreg);
+  cairo_region_destroy (mmreg);
 
   #ifdef _OPENMP
   #pragma omp parallel for schedule (static) default (shared)
@@ -1055,25 +1075,157 @@ static void _get_map_extent (const dt_iop_roi_t *roi_out,
   cairo_region_destroy (roi_out_region);
 }
 
-static float complex *create_global_distortion_map (const cairo_rectangle_int_t *map_extent,
-                                                    GList *interpolated,
-                                                    gboolean inverted)
+// the part of the map the stamp of a warp is added to, as in add_to_global_distortion_map().
+
+static void _get_stamp_footprint (cairo_rectangle_int_t *footprint, const dt_liquify_warp_t *warp)
 {
-  // allocate distortion map big enough to contain all paths
-  const int mapsize = map_extent->width * map_extent->height;
-  float complex * map = dt_alloc_align (16, mapsize * sizeof (float complex));
-  memset (map, 0, mapsize * sizeof (float complex));
+  const int iradius = round (cabs (warp->radius - warp->point));
+  footprint->x = (int) round (creal (warp->point)) - iradius;
+  footprint->y = (int) round (cimag (warp->point)) - iradius;
+  footprint->width = footprint->height = 2 * iradius + 1;
+}
+
+static void _free_map_cache (dt_liquify_map_cache_t *cache)
+{
+  dt_free_align ((void *) cache->map);
+  free (cache->warps);
+  cache->map = NULL;
+  cache->warps = NULL;
+  cache->num_warps = 0;
+}
+
+// brings the cached map up to date with the warps in interpolated and the extent, and returns it. the
+// warps that changed are found as the ones between the common start and end of the old and the new
+// list, their stamps and the part of the extent the old map lacks are rebuilt. every point of the map
+// sums up the same stamps in the same order as when building it from scratch.
 
-  // build map
+static const float complex *_update_distortion_map (dt_liquify_map_cache_t *cache,
+                                                    const cairo_rectangle_int_t *map_extent,
+                                                    GList *interpolated)
+{
+  const int num_warps = g_list_length (interpolated);
+  dt_liquify_warp_t *warps = num_warps ? malloc (sizeof (dt_liquify_warp_t) * num_warps) : NULL;
+  int n = 0;
   for (GList *i = interpolated; i != NULL; i = i->next)
+    warps[n++] = *((dt_liquify_warp_t *) i->data);
+
+  const size_t mapsize = (size_t) map_extent->width * map_extent->height;
+  const gboolean same_extent = cache->map
+    && memcmp (&cache->extent, map_extent, sizeof (cairo_rectangle_int_t)) == 0;
+  float complex *map = same_extent ? cache->map : dt_alloc_align (16, mapsize * sizeof (float complex));
+  if (map == NULL)
+  {
+    free (warps);
+    _free_map_cache (cache);
+    return NULL;
+  }
+
+  cairo_region_t *dirty = NULL;
+  if (cache->map == NULL)
+    dirty = cairo_region_create_rectangle (map_extent);
+  else
+  {
+    dirty = cairo_region_create ();
+
+    int first = 0, last_old = cache->num_warps, last_new = num_warps;
+    while (first < last_old && first < last_new
+           && memcmp (&warps[first], &cache->warps[first], sizeof (dt_liquify_warp_t)) == 0)
+      first++;
+    while (last_old > first && last_new > first
+           && memcmp (&warps[last_new - 1], &cache->warps[last_old - 1], sizeof (dt_liquify_warp_t)) == 0)
+    {
+      last_old--;
+      last_new--;
+    }
+
+    cairo_rectangle_int_t r;
+    for (int k = first; k < last_old; k++)
+    {
+      _get_stamp_footprint (&r, &cache->warps[k]);
+      cairo_region_union_rectangle (dirty, &r);
+    }
+    for (int k = first; k < last_new; k++)
+    {
+      _get_stamp_footprint (&r, &warps[k]);
+      cairo_region_union_rectangle (dirty, &r);
+    }
+
+    if (!same_extent)
+    {
+      // keep what the old map has of the new extent, the rest is new
+      cairo_region_t *overlap = cairo_region_create_rectangle (map_extent);
+      cairo_region_intersect_rectangle (overlap, &cache->extent);
+      cairo_region_get_extents (overlap, &r);
+      for (int y = r.y; y < r.y + r.height; y++)
+        memcpy (map + (size_t) (y - map_extent->y) * map_extent->width + r.x - map_extent->x,
+                cache->map + (size_t) (y - cache->extent.y) * cache->extent.width + r.x - cache->extent.x,
+                sizeof (float complex) * r.width);
+
+      cairo_region_t *fresh = cairo_region_create_rectangle (map_extent);
+      cairo_region_subtract (fresh, overlap);
+      cairo_region_union (dirty, fresh);
+      cairo_region_destroy (fresh);
+      cairo_region_destroy (overlap);
+      dt_free_align ((void *) cache->map);
+    }
+    cairo_region_intersect_rectangle (dirty, map_extent);
+  }
+
+  // clear the dirty part and add the stamps reaching into it
+  const int num_rects = cairo_region_num_rectangles (dirty);
+  for (int k = 0; k < num_rects; k++)
   {
-    const dt_liquify_warp_t *warp = ((dt_liquify_warp_t *) i->data);
-    float complex *stamp = NULL;
     cairo_rectangle_int_t r;
-    build_round_stamp (&stamp, &r, warp);
-    add_to_global_distortion_map (map, map_extent, warp, stamp, &r);
+    cairo_region_get_rectangle (dirty, k, &r);
+    for (int y = r.y; y < r.y + r.height; y++)
+      memset (map + (size_t) (y - map_extent->y) * map_extent->width + r.x - map_extent->x, 0,
+              sizeof (float complex) * r.width);
+  }
+
+  for (int k = 0; k < num_warps && num_rects; k++)
+  {
+    cairo_rectangle_int_t r;
+    _get_stamp_footprint (&r, &warps[k]);
+    if (cairo_region_contains_rectangle (dirty, &r) == CAIRO_REGION_OVERLAP_OUT)
+      continue;
+
+    float complex *stamp = NULL;
+    build_round_stamp (&stamp, &r, &warps[k]);
+    for (int j = 0; j < num_rects; j++)
+    {
+      cairo_rectangle_int_t clip;
+      cairo_region_get_rectangle (dirty, j, &clip);
+      add_to_global_distortion_map (map, map_extent, &clip, &warps[k], stamp, &r);
+    }
     free ((void *) stamp);
   }
+  cairo_region_destroy (dirty);
+
+  free (cache->warps);
+  cache->warps = warps;
+  cache->num_warps = num_warps;
+  cache->extent = *map_extent;
+  cache->map = map;
+  return map;
+}
+
+static float complex *create_global_distortion_map (dt_liquify_map_cache_t *cache,
+                                                    const cairo_rectangle_int_t *map_extent,
+                                                    GList *interpolated,
+                                                    gboolean inverted)
+{
+  // the distortion map big enough to contain all paths, the caller gets its own copy
+  const int mapsize = map_extent->width * map_extent->height;
+
+  dt_pthread_mutex_lock (&cache->lock);
+  const float complex *cmap = _update_distortion_map (cache, map_extent, interpolated);
+  if (cmap == NULL)
+  {
+    dt_pthread_mutex_unlock (&cache->lock);
+    return NULL;
+  }
+
+  float complex *map = NULL;
 
   if (inverted)
   {
@@ -1089,7 +1241,7 @@ static float complex *create_global_distortion_map (const cairo_rectangle_int_t
 
     for (int y = 0; y <  map_extent->height; y++)
     {
-      const float complex *row = map + y * map_extent->width;
+      const float complex *row = cmap + y * map_extent->width;
       for (int x = 0; x < map_extent->width; x++)
       {
         const float complex d = *(row + x);
@@ -1103,8 +1255,6 @@ static float complex *create_global_distortion_map (const cairo_rectangle_int_t
       }
     }
 
-    dt_free_align ((void *) map);
-
     // now just do a pass to avoid gap with a displacement of zero, note that we do not need high
     // precision here as the inverted distortion mask is only used to compute a final displacement
     // of points.
@@ -1132,7 +1282,13 @@ static float complex *create_global_distortion_map (const cairo_rectangle_int_t
 
     map = imap;
   }
+  else
+  {
+    map = dt_alloc_align (16, mapsize * sizeof (float complex));
+    if (map) memcpy (map, cmap, mapsize * sizeof (float complex));
+  }
 
+  dt_pthread_mutex_unlock (&cache->lock);
   return map;
 }
 
@@ -1152,7 +1308,8 @@ static float complex *build_global_distortion_map (struct dt_iop_module_t *modul
 
   _get_map_extent (roi_out, interpolated, map_extent);
 
-  float complex *map = create_global_distortion_map(map_extent, interpolated, FALSE);
+  dt_iop_liquify_data_t *d = (dt_iop_liquify_data_t *)piece->data;
+  float complex *map = create_global_distortion_map (&d->process_map, map_extent, interpolated, FALSE);
 
   g_list_free_full (interpolated, free);
   return map;
@@ -1256,7 +1413,8 @@ static int _distort_xtransform(dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *pi
     dt_iop_roi_t roi_in = { .x = extent.x, .y = extent.y, .width = extent.width, .height = extent.height };
     _get_map_extent (&roi_in, interpolated, &extent);
 
-    float complex *map = create_global_distortion_map (&extent, interpolated, inverted);
+    dt_iop_liquify_data_t *d = (dt_iop_liquify_data_t *)piece->data;
+    float complex *map = create_global_distortion_map (&d->distort_map, &extent, interpolated, inverted);
     g_list_free_full (interpolated, free);
 
     if (map == NULL) return 0;
@@ -1551,12 +1709,20 @@ void cleanup (dt_iop_module_t *module)
 
 void init_pipe (struct dt_iop_module_t *module, dt_dev_pixelpipe_t *pipe, dt_dev_pixelpipe_iop_t *piece)
 {
-  piece->data = malloc (module->params_size);
+  dt_iop_liquify_data_t *d = (dt_iop_liquify_data_t *) calloc (1, sizeof (dt_iop_liquify_data_t));
+  dt_pthread_mutex_init (&d->process_map.lock, NULL);
+  dt_pthread_mutex_init (&d->distort_map.lock, NULL);
+  piece->data = d;
   module->commit_params (module, module->default_params, pipe, piece);
 }
 
 void cleanup_pipe (struct dt_iop_module_t *module, dt_dev_pixelpipe_t *pipe, dt_dev_pixelpipe_iop_t *piece)
 {
+  dt_iop_liquify_data_t *d = (dt_iop_liquify_data_t *) piece->data;
+  _free_map_cache (&d->process_map);
+  _free_map_cache (&d->distort_map);
+  dt_pthread_mutex_destroy (&d->process_map.lock);
+  dt_pthread_mutex_destroy (&d->distort_map.lock);
   free (piece->data);
   piece->data = NULL;
 }
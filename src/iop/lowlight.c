@@ -86,7 +86,8 @@ const char *name()
 
 int flags()
 {
-  return IOP_FLAGS_INCLUDE_IN_STYLES | IOP_FLAGS_SUPPORTS_BLENDING | IOP_FLAGS_ALLOW_TILING;
+  return IOP_FLAGS_INCLUDE_IN_STYLES | IOP_FLAGS_SUPPORTS_BLENDING | IOP_FLAGS_ALLOW_TILING
+         | IOP_FLAGS_POINTWISE;
 }
 
 int groups()
@@ -133,45 +134,51 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
 #ifdef _OPENMP
 #pragma omp parallel for default(none) schedule(static) shared(d, XYZ_sw)
 #endif
-  for(size_t k = 0; k < (size_t)roi_out->width * roi_out->height; k++)
+  for(int j = 0; j < roi_out->height; j++)
   {
-    float *in = (float *)i + ch * k;
-    float *out = (float *)o + ch * k;
-    float XYZ[3], XYZ_s[3];
-    float V;
-    float w;
+    const float *in = (float *)i + (size_t)ch * roi_out->width * j;
+    float *out = (float *)o + (size_t)ch * roi_out->width * j;
 
-    dt_Lab_to_XYZ(in, XYZ);
+    // out holds XYZ until the whole line is converted back
+    dt_Lab_to_XYZ_array(in, out, roi_out->width);
 
-    // calculate scotopic luminance
-    if(XYZ[0] > threshold)
+    for(int k = 0; k < roi_out->width; k++)
     {
-      // normal flow
-      V = XYZ[1] * (1.33f * (1.0f + (XYZ[1] + XYZ[2]) / XYZ[0]) - 1.68f);
-    }
-    else
-    {
-      // low red flow, avoids "snow" on dark noisy areas
-      V = XYZ[1] * (1.33f * (1.0f + (XYZ[1] + XYZ[2]) / threshold) - 1.68f);
-    }
+      float *XYZ = out + ch * k;
+      float XYZ_s[3];
+      float V;
+      float w;
+
+      // calculate scotopic luminance
+      if(XYZ[0] > threshold)
+      {
+        // normal flow
+        V = XYZ[1] * (1.33f * (1.0f + (XYZ[1] + XYZ[2]) / XYZ[0]) - 1.68f);
+      }
+      else
+      {
+        // low red flow, avoids "snow" on dark noisy areas
+        V = XYZ[1] * (1.33f * (1.0f + (XYZ[1] + XYZ[2]) / threshold) - 1.68f);
+      }
 
-    // scale using empiric coefficient and fit inside limits
-    V = fminf(1.0f, fmaxf(0.0f, c * V));
+      // scale using empiric coefficient and fit inside limits
+      V = fminf(1.0f, fmaxf(0.0f, c * V));
 
-    // blending coefficient from curve
-    w = lookup(d->lut, in[0] / 100.f);
+      // blending coefficient from curve
+      w = lookup(d->lut, in[ch * k] / 100.f);
 
-    XYZ_s[0] = V * XYZ_sw[0];
-    XYZ_s[1] = V * XYZ_sw[1];
-    XYZ_s[2] = V * XYZ_sw[2];
+      XYZ_s[0] = V * XYZ_sw[0];
+      XYZ_s[1] = V * XYZ_sw[1];
+      XYZ_s[2] = V * XYZ_sw[2];
 
-    XYZ[0] = w * XYZ[0] + (1.0f - w) * XYZ_s[0];
-    XYZ[1] = w * XYZ[1] + (1.0f - w) * XYZ_s[1];
-    XYZ[2] = w * XYZ[2] + (1.0f - w) * XYZ_s[2];
+      XYZ[0] = w * XYZ[0] + (1.0f - w) * XYZ_s[0];
+      XYZ[1] = w * XYZ[1] + (1.0f - w) * XYZ_s[1];
+      XYZ[2] = w * XYZ[2] + (1.0f - w) * XYZ_s[2];
+    }
 
-    dt_XYZ_to_Lab(XYZ, out);
+    dt_XYZ_to_Lab_array(out, out, roi_out->width);
 
-    out[3] = in[3];
+    for(int k = 0; k < roi_out->width; k++) out[ch * k + 3] = in[ch * k + 3];
   }
 }
 
@@ -396,10 +396,18 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
 
   if(data->lowpass_algo == LOWPASS_ALGO_GAUSSIAN)
   {
-    dt_gaussian_t *g = dt_gaussian_init(width, height, ch, Labmax, Labmin, sigma, order);
-    if(!g) return;
-    dt_gaussian_blur_4c(g, in, out);
-    dt_gaussian_free(g);
+    // large radii are blurred at reduced resolution, which looks the same and is a lot cheaper
+    if(order == DT_IOP_GAUSSIAN_ZERO)
+    {
+      if(dt_gaussian_pyramid_blur_once_4c(in, out, width, height, sigma, Labmax, Labmin)) return;
+    }
+    else
+    {
+      dt_gaussian_t *g = dt_gaussian_init(width, height, ch, Labmax, Labmin, sigma, order);
+      if(!g) return;
+      dt_gaussian_blur_4c(g, in, out);
+      dt_gaussian_free(g);
+    }
   }
   else
   {
@@ -22,6 +22,7 @@
 #endif
 #include "bauhaus/bauhaus.h"
 #include "common/darktable.h"
+#include "common/opencl.h"
 #include "control/control.h"
 #include "develop/imageop.h"
 #include "develop/imageop_math.h"
@@ -55,6 +56,12 @@ typedef struct dt_iop_rawdenoise_data_t
 
 typedef struct dt_iop_rawdenoise_global_data_t
 {
+  int kernel_rawdenoise_split_bayer;
+  int kernel_rawdenoise_split_xtrans;
+  int kernel_rawdenoise_hat;
+  int kernel_rawdenoise_detail;
+  int kernel_rawdenoise_merge_bayer;
+  int kernel_rawdenoise_merge_xtrans;
 } dt_iop_rawdenoise_global_data_t;
 
 const char *name()
@@ -64,7 +71,7 @@ const char *name()
 
 int flags()
 {
-  return IOP_FLAGS_SUPPORTS_BLENDING;
+  return IOP_FLAGS_SUPPORTS_BLENDING | IOP_FLAGS_NO_TILE_STREAMING;
 }
 
 int groups()
@@ -366,6 +373,201 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
   }
 }
 
+#ifdef HAVE_OPENCL
+// the five wavelet scales of one color plane of width x height: dev_plane holds the square root of the raw
+// values on entry and the coarsest scale on return, the detail is accumulated in dev_detail.
+static cl_int wavelet_denoise_cl(dt_iop_rawdenoise_global_data_t *gd, const int devid, cl_mem *dev_plane,
+                                 cl_mem *dev_coarse, cl_mem dev_tmp, cl_mem dev_detail, const int width,
+                                 const int height, const float threshold)
+{
+  static const float noise[] = { 0.8002, 0.2735, 0.1202, 0.0585, 0.0291, 0.0152, 0.0080, 0.0044 };
+  const int zero = 0, one = 1;
+  size_t sizes[] = { ROUNDUPWD(width), ROUNDUPHT(height), 1 };
+  cl_int err = CL_SUCCESS;
+
+  for(int lev = 0; lev < 5; lev++)
+  {
+    const int scale = 1 << lev;
+
+    // filter horizontally, then vertically
+    dt_opencl_set_kernel_arg(devid, gd->kernel_rawdenoise_hat, 0, sizeof(cl_mem), (void *)dev_plane);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_rawdenoise_hat, 1, sizeof(cl_mem), (void *)&dev_tmp);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_rawdenoise_hat, 2, sizeof(int), (void *)&width);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_rawdenoise_hat, 3, sizeof(int), (void *)&height);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_rawdenoise_hat, 4, sizeof(int), (void *)&scale);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_rawdenoise_hat, 5, sizeof(int), (void *)&one);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_rawdenoise_hat, 6, sizeof(int), (void *)&zero);
+    err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_rawdenoise_hat, sizes);
+    if(err != CL_SUCCESS) return err;
+
+    dt_opencl_set_kernel_arg(devid, gd->kernel_rawdenoise_hat, 0, sizeof(cl_mem), (void *)&dev_tmp);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_rawdenoise_hat, 1, sizeof(cl_mem), (void *)dev_coarse);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_rawdenoise_hat, 5, sizeof(int), (void *)&zero);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_rawdenoise_hat, 6, sizeof(int), (void *)&one);
+    err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_rawdenoise_hat, sizes);
+    if(err != CL_SUCCESS) return err;
+
+    const float thold = threshold * noise[lev];
+    dt_opencl_set_kernel_arg(devid, gd->kernel_rawdenoise_detail, 0, sizeof(cl_mem), (void *)&dev_detail);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_rawdenoise_detail, 1, sizeof(cl_mem), (void *)dev_plane);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_rawdenoise_detail, 2, sizeof(cl_mem), (void *)dev_coarse);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_rawdenoise_detail, 3, sizeof(int), (void *)&width);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_rawdenoise_detail, 4, sizeof(int), (void *)&height);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_rawdenoise_detail, 5, sizeof(float), (void *)&thold);
+    err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_rawdenoise_detail, sizes);
+    if(err != CL_SUCCESS) return err;
+
+    // the coarser scale is the input of the next level
+    cl_mem t = *dev_plane;
+    *dev_plane = *dev_coarse;
+    *dev_coarse = t;
+  }
+  return err;
+}
+
+int process_cl(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, cl_mem dev_in, cl_mem dev_out,
+               const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
+{
+  dt_iop_rawdenoise_data_t *d = (dt_iop_rawdenoise_data_t *)piece->data;
+  dt_iop_rawdenoise_global_data_t *gd = (dt_iop_rawdenoise_global_data_t *)self->data;
+
+  const int devid = piece->pipe->devid;
+  const int width = roi_in->width;
+  const int height = roi_in->height;
+  const gboolean xtrans = (piece->pipe->dsc.filters == 9u);
+
+  cl_mem dev_plane = NULL;
+  cl_mem dev_coarse = NULL;
+  cl_mem dev_tmp = NULL;
+  cl_mem dev_detail = NULL;
+  cl_mem dev_xtrans = NULL;
+  cl_int err = -999;
+
+  if(!(d->threshold > 0.0f))
+  {
+    size_t origin[] = { 0, 0, 0 };
+    size_t region[] = { width, height, 1 };
+    err = dt_opencl_enqueue_copy_image(devid, dev_in, dev_out, origin, origin, region);
+    if(err != CL_SUCCESS) goto error;
+    return TRUE;
+  }
+
+  // a plane per color is a quarter of the image for bayer, all of it for x-trans
+  const size_t size = xtrans ? (size_t)width * height : (size_t)(width / 2 + 1) * (height / 2 + 1);
+  dev_plane = dt_opencl_alloc_device_buffer(devid, size * sizeof(float));
+  if(dev_plane == NULL) goto error;
+  dev_coarse = dt_opencl_alloc_device_buffer(devid, size * sizeof(float));
+  if(dev_coarse == NULL) goto error;
+  dev_tmp = dt_opencl_alloc_device_buffer(devid, size * sizeof(float));
+  if(dev_tmp == NULL) goto error;
+  dev_detail = dt_opencl_alloc_device_buffer(devid, size * sizeof(float));
+  if(dev_detail == NULL) goto error;
+
+  if(xtrans)
+  {
+    dev_xtrans
+        = dt_opencl_copy_host_to_device_constant(devid, sizeof(piece->pipe->dsc.xtrans), piece->pipe->dsc.xtrans);
+    if(dev_xtrans == NULL) goto error;
+
+    for(int c = 0; c < 3; c++)
+    {
+      size_t sizes[] = { ROUNDUPWD(width), ROUNDUPHT(height), 1 };
+      dt_opencl_set_kernel_arg(devid, gd->kernel_rawdenoise_split_xtrans, 0, sizeof(cl_mem), (void *)&dev_in);
+      dt_opencl_set_kernel_arg(devid, gd->kernel_rawdenoise_split_xtrans, 1, sizeof(cl_mem), (void *)&dev_plane);
+      dt_opencl_set_kernel_arg(devid, gd->kernel_rawdenoise_split_xtrans, 2, sizeof(cl_mem), (void *)&dev_detail);
+      dt_opencl_set_kernel_arg(devid, gd->kernel_rawdenoise_split_xtrans, 3, sizeof(int), (void *)&width);
+      dt_opencl_set_kernel_arg(devid, gd->kernel_rawdenoise_split_xtrans, 4, sizeof(int), (void *)&height);
+      dt_opencl_set_kernel_arg(devid, gd->kernel_rawdenoise_split_xtrans, 5, sizeof(int), (void *)&c);
+      dt_opencl_set_kernel_arg(devid, gd->kernel_rawdenoise_split_xtrans, 6, sizeof(int), (void *)&roi_in->x);
+      dt_opencl_set_kernel_arg(devid, gd->kernel_rawdenoise_split_xtrans, 7, sizeof(int), (void *)&roi_in->y);
+      dt_opencl_set_kernel_arg(devid, gd->kernel_rawdenoise_split_xtrans, 8, sizeof(cl_mem), (void *)&dev_xtrans);
+      err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_rawdenoise_split_xtrans, sizes);
+      if(err != CL_SUCCESS) goto error;
+
+      err = wavelet_denoise_cl(gd, devid, &dev_plane, &dev_coarse, dev_tmp, dev_detail, width, height,
+                               d->threshold);
+      if(err != CL_SUCCESS) goto error;
+
+      dt_opencl_set_kernel_arg(devid, gd->kernel_rawdenoise_merge_xtrans, 0, sizeof(cl_mem), (void *)&dev_detail);
+      dt_opencl_set_kernel_arg(devid, gd->kernel_rawdenoise_merge_xtrans, 1, sizeof(cl_mem), (void *)&dev_plane);
+      dt_opencl_set_kernel_arg(devid, gd->kernel_rawdenoise_merge_xtrans, 2, sizeof(cl_mem), (void *)&dev_out);
+      dt_opencl_set_kernel_arg(devid, gd->kernel_rawdenoise_merge_xtrans, 3, sizeof(int), (void *)&width);
+      dt_opencl_set_kernel_arg(devid, gd->kernel_rawdenoise_merge_xtrans, 4, sizeof(int), (void *)&height);
+      dt_opencl_set_kernel_arg(devid, gd->kernel_rawdenoise_merge_xtrans, 5, sizeof(int), (void *)&c);
+      dt_opencl_set_kernel_arg(devid, gd->kernel_rawdenoise_merge_xtrans, 6, sizeof(int), (void *)&roi_in->x);
+      dt_opencl_set_kernel_arg(devid, gd->kernel_rawdenoise_merge_xtrans, 7, sizeof(int), (void *)&roi_in->y);
+      dt_opencl_set_kernel_arg(devid, gd->kernel_rawdenoise_merge_xtrans, 8, sizeof(cl_mem), (void *)&dev_xtrans);
+      err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_rawdenoise_merge_xtrans, sizes);
+      if(err != CL_SUCCESS) goto error;
+    }
+  }
+  else
+  {
+    for(int c = 0; c < 4; c++) /* denoise R,G1,B,G3 individually */
+    {
+      // adjust for odd width and height, as on the cpu
+      const int halfwidth = width / 2 + (width & (~(c >> 1)) & 1);
+      const int halfheight = height / 2 + (height & (~c) & 1);
+      const int xoff = (c & 2) >> 1;
+      const int yoff = c & 1;
+      size_t sizes[] = { ROUNDUPWD(halfwidth), ROUNDUPHT(halfheight), 1 };
+
+      dt_opencl_set_kernel_arg(devid, gd->kernel_rawdenoise_split_bayer, 0, sizeof(cl_mem), (void *)&dev_in);
+      dt_opencl_set_kernel_arg(devid, gd->kernel_rawdenoise_split_bayer, 1, sizeof(cl_mem), (void *)&dev_plane);
+      dt_opencl_set_kernel_arg(devid, gd->kernel_rawdenoise_split_bayer, 2, sizeof(cl_mem), (void *)&dev_detail);
+      dt_opencl_set_kernel_arg(devid, gd->kernel_rawdenoise_split_bayer, 3, sizeof(int), (void *)&halfwidth);
+      dt_opencl_set_kernel_arg(devid, gd->kernel_rawdenoise_split_bayer, 4, sizeof(int), (void *)&halfheight);
+      dt_opencl_set_kernel_arg(devid, gd->kernel_rawdenoise_split_bayer, 5, sizeof(int), (void *)&xoff);
+      dt_opencl_set_kernel_arg(devid, gd->kernel_rawdenoise_split_bayer, 6, sizeof(int), (void *)&yoff);
+      err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_rawdenoise_split_bayer, sizes);
+      if(err != CL_SUCCESS) goto error;
+
+      err = wavelet_denoise_cl(gd, devid, &dev_plane, &dev_coarse, dev_tmp, dev_detail, halfwidth, halfheight,
+                               d->threshold);
+      if(err != CL_SUCCESS) goto error;
+
+      dt_opencl_set_kernel_arg(devid, gd->kernel_rawdenoise_merge_bayer, 0, sizeof(cl_mem), (void *)&dev_detail);
+      dt_opencl_set_kernel_arg(devid, gd->kernel_rawdenoise_merge_bayer, 1, sizeof(cl_mem), (void *)&dev_plane);
+      dt_opencl_set_kernel_arg(devid, gd->kernel_rawdenoise_merge_bayer, 2, sizeof(cl_mem), (void *)&dev_out);
+      dt_opencl_set_kernel_arg(devid, gd->kernel_rawdenoise_merge_bayer, 3, sizeof(int), (void *)&halfwidth);
+      dt_opencl_set_kernel_arg(devid, gd->kernel_rawdenoise_merge_bayer, 4, sizeof(int), (void *)&halfheight);
+      dt_opencl_set_kernel_arg(devid, gd->kernel_rawdenoise_merge_bayer, 5, sizeof(int), (void *)&xoff);
+      dt_opencl_set_kernel_arg(devid, gd->kernel_rawdenoise_merge_bayer, 6, sizeof(int), (void *)&yoff);
+      err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_rawdenoise_merge_bayer, sizes);
+      if(err != CL_SUCCESS) goto error;
+    }
+  }
+
+  dt_opencl_release_mem_object(dev_xtrans);
+  dt_opencl_release_mem_object(dev_detail);
+  dt_opencl_release_mem_object(dev_tmp);
+  dt_opencl_release_mem_object(dev_coarse);
+  dt_opencl_release_mem_object(dev_plane);
+  return TRUE;
+
+error:
+  dt_opencl_release_mem_object(dev_xtrans);
+  dt_opencl_release_mem_object(dev_detail);
+  dt_opencl_release_mem_object(dev_tmp);
+  dt_opencl_release_mem_object(dev_coarse);
+  dt_opencl_release_mem_object(dev_plane);
+  dt_print(DT_DEBUG_OPENCL, "[opencl_rawdenoise] couldn't enqueue kernel! %d\n", err);
+  return FALSE;
+}
+#endif
+
+void tiling_callback(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece,
+                     const dt_iop_roi_t *roi_in, const dt_iop_roi_t *roi_out, struct dt_develop_tiling_t *tiling)
+{
+  // in + out, and four color planes which are a quarter of the image for bayer
+  tiling->factor = (piece->pipe->dsc.filters == 9u) ? 6.0f : 3.0f;
+  tiling->maxbuf = 1.0f;
+  tiling->overhead = 0;
+  tiling->overlap = 0;
+  tiling->xalign = 1;
+  tiling->yalign = 1;
+}
+
 void reload_defaults(dt_iop_module_t *module)
 {
   // init defaults:
@@ -386,9 +588,35 @@ end:
   memcpy(module->default_params, &tmp, sizeof(dt_iop_rawdenoise_params_t));
 }
 
-void init(dt_iop_module_t *module)
+void init_global(dt_iop_module_so_t *module)
+{
+  const int program = 25; // rawdenoise.cl, from programs.conf
+  dt_iop_rawdenoise_global_data_t *gd
+      = (dt_iop_rawdenoise_global_data_t *)malloc(sizeof(dt_iop_rawdenoise_global_data_t));
+  module->data = gd;
+  gd->kernel_rawdenoise_split_bayer = dt_opencl_create_kernel(program, "rawdenoise_split_bayer");
+  gd->kernel_rawdenoise_split_xtrans = dt_opencl_create_kernel(program, "rawdenoise_split_xtrans");
+  gd->kernel_rawdenoise_hat = dt_opencl_create_kernel(program, "rawdenoise_hat");
+  gd->kernel_rawdenoise_detail = dt_opencl_create_kernel(program, "rawdenoise_detail");
+  gd->kernel_rawdenoise_merge_bayer = dt_opencl_create_kernel(program, "rawdenoise_merge_bayer");
+  gd->kernel_rawdenoise_merge_xtrans = dt_opencl_create_kernel(program, "rawdenoise_merge_xtrans");
+}
+
+void cleanup_global(dt_iop_module_so_t *module)
 {
+  dt_iop_rawdenoise_global_data_t *gd = (dt_iop_rawdenoise_global_data_t *)module->data;
+  dt_opencl_free_kernel(gd->kernel_rawdenoise_merge_xtrans);
+  dt_opencl_free_kernel(gd->kernel_rawdenoise_merge_bayer);
+  dt_opencl_free_kernel(gd->kernel_rawdenoise_detail);
+  dt_opencl_free_kernel(gd->kernel_rawdenoise_hat);
+  dt_opencl_free_kernel(gd->kernel_rawdenoise_split_xtrans);
+  dt_opencl_free_kernel(gd->kernel_rawdenoise_split_bayer);
+  free(module->data);
   module->data = NULL;
+}
+
+void init(dt_iop_module_t *module)
+{
   module->params = calloc(1, sizeof(dt_iop_rawdenoise_params_t));
   module->default_params = calloc(1, sizeof(dt_iop_rawdenoise_params_t));
   module->default_enabled = 0;
@@ -403,8 +631,6 @@ void cleanup(dt_iop_module_t *module)
 {
   free(module->params);
   module->params = NULL;
-  free(module->data);
-  module->data = NULL;
 }
 
 void commit_params(struct dt_iop_module_t *self, dt_iop_params_t *params, dt_dev_pixelpipe_t *pipe,
@@ -103,7 +103,7 @@ int operation_tags()
 
 int flags()
 {
-  return IOP_FLAGS_ALLOW_TILING | IOP_FLAGS_TILING_FULL_ROI | IOP_FLAGS_ONE_INSTANCE;
+  return IOP_FLAGS_ALLOW_TILING | IOP_FLAGS_TILING_FULL_ROI | IOP_FLAGS_ONE_INSTANCE | IOP_FLAGS_POINTWISE_CROP;
 }
 
 int groups()
@@ -424,9 +424,10 @@ void process_sse2(dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const vo
         flo = _mm_div_ps(_mm_sub_ps(flo, sub), div);
         fhi = _mm_div_ps(_mm_sub_ps(fhi, sub), div);
 
-        _mm_stream_ps(out, flo);
+        // no streaming stores, in a fused run the next module reads this from the cache
+        _mm_store_ps(out, flo);
         out += 4;
-        _mm_stream_ps(out, fhi);
+        _mm_store_ps(out, fhi);
         out += 4;
       }
 
@@ -476,7 +477,7 @@ void process_sse2(dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const vo
 
         const __m128 scaled = _mm_div_ps(_mm_sub_ps(input, sub), div);
 
-        _mm_stream_ps(out, scaled);
+        _mm_store_ps(out, scaled);
       }
 
       // process the rest
@@ -510,14 +511,12 @@ void process_sse2(dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const vo
 
         const __m128 scaled = _mm_div_ps(_mm_sub_ps(input, sub), div);
 
-        _mm_stream_ps(out, scaled);
+        _mm_store_ps(out, scaled);
       }
     }
   }
 
   for(int k = 0; k < 4; k++) piece->pipe->dsc.processed_maximum[k] = 1.0f;
-
-  _mm_sfence();
 }
 #endif
 
@@ -21,6 +21,7 @@
 #endif
 #include "bauhaus/bauhaus.h"
 #include "common/interpolation.h"
+#include "common/opencl.h"
 #include "develop/develop.h"
 #include "develop/imageop.h"
 #include "develop/tiling.h"
@@ -44,6 +45,14 @@ typedef struct dt_iop_rotatepixels_data_t
   float m[4];      // rotation matrix
 } dt_iop_rotatepixels_data_t;
 
+typedef struct dt_iop_rotatepixels_global_data_t
+{
+  int kernel_clip_rotate_bilinear;
+  int kernel_clip_rotate_bicubic;
+  int kernel_clip_rotate_lanczos2;
+  int kernel_clip_rotate_lanczos3;
+} dt_iop_rotatepixels_global_data_t;
+
 static void mul_mat_vec_2(const float *m, const float *p, float *o)
 {
   o[0] = p[0] * m[0] + p[1] * m[1];
@@ -84,16 +93,6 @@ int operation_tags()
   return IOP_TAG_DISTORT;
 }
 
-static void transform(const dt_dev_pixelpipe_iop_t *const piece, const float scale, const float *const x,
-                      float *o)
-{
-  dt_iop_rotatepixels_data_t *d = (dt_iop_rotatepixels_data_t *)piece->data;
-
-  float pi[2] = { x[0] - d->rx * scale, x[1] - d->ry * scale };
-
-  mul_mat_vec_2(d->m, pi, o);
-}
-
 static void backtransform(const dt_dev_pixelpipe_iop_t *const piece, const float scale, const float *const x,
                           float *o)
 {
@@ -108,19 +107,21 @@ static void backtransform(const dt_dev_pixelpipe_iop_t *const piece, const float
 
 int distort_transform(dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, float *points, size_t points_count)
 {
+  const dt_iop_rotatepixels_data_t *d = (dt_iop_rotatepixels_data_t *)piece->data;
   const float scale = piece->buf_in.scale / piece->iscale;
 
+  // rotation around the center, spelled out so the loop vectorizes
+  const float m0 = d->m[0], m1 = d->m[1], m2 = d->m[2], m3 = d->m[3];
+  const float cx = d->rx * scale, cy = d->ry * scale;
+
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static) default(none) shared(points, points_count)
+#endif
   for(size_t i = 0; i < points_count * 2; i += 2)
   {
-    float pi[2], po[2];
-
-    pi[0] = points[i];
-    pi[1] = points[i + 1];
-
-    transform(piece, scale, pi, po);
-
-    points[i] = po[0];
-    points[i + 1] = po[1];
+    const float x = points[i] - cx, y = points[i + 1] - cy;
+    points[i] = x * m0 + y * m1;
+    points[i + 1] = x * m2 + y * m3;
   }
 
   return 1;
@@ -129,19 +130,21 @@ int distort_transform(dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, floa
 int distort_backtransform(dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, float *points,
                           size_t points_count)
 {
+  const dt_iop_rotatepixels_data_t *d = (dt_iop_rotatepixels_data_t *)piece->data;
   const float scale = piece->buf_in.scale / piece->iscale;
 
+  // same as backtransform()
+  const float m0 = d->m[0], m1 = -d->m[1], m2 = -d->m[2], m3 = d->m[3];
+  const float cx = d->rx * scale, cy = d->ry * scale;
+
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static) default(none) shared(points, points_count)
+#endif
   for(size_t i = 0; i < points_count * 2; i += 2)
   {
-    float pi[2], po[2];
-
-    pi[0] = points[i];
-    pi[1] = points[i + 1];
-
-    backtransform(piece, scale, pi, po);
-
-    points[i] = po[0];
-    points[i + 1] = po[1];
+    const float x = points[i], y = points[i + 1];
+    points[i] = x * m0 + y * m1 + cx;
+    points[i + 1] = x * m2 + y * m3 + cy;
   }
 
   return 1;
@@ -274,6 +277,84 @@ void process(dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *c
   }
 }
 
+#ifdef HAVE_OPENCL
+int process_cl(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, cl_mem dev_in, cl_mem dev_out,
+               const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
+{
+  dt_iop_rotatepixels_data_t *d = (dt_iop_rotatepixels_data_t *)piece->data;
+  dt_iop_rotatepixels_global_data_t *gd = (dt_iop_rotatepixels_global_data_t *)self->data;
+
+  cl_int err = -999;
+  const int devid = piece->pipe->devid;
+  const int width = roi_out->width;
+  const int height = roi_out->height;
+  const float scale = roi_in->scale / piece->iscale;
+
+  int crkernel = -1;
+  const struct dt_interpolation *interpolation = dt_interpolation_new(DT_INTERPOLATION_USERPREF);
+  switch(interpolation->id)
+  {
+    case DT_INTERPOLATION_BILINEAR:
+      crkernel = gd->kernel_clip_rotate_bilinear;
+      break;
+    case DT_INTERPOLATION_BICUBIC:
+      crkernel = gd->kernel_clip_rotate_bicubic;
+      break;
+    case DT_INTERPOLATION_LANCZOS2:
+      crkernel = gd->kernel_clip_rotate_lanczos2;
+      break;
+    case DT_INTERPOLATION_LANCZOS3:
+      crkernel = gd->kernel_clip_rotate_lanczos3;
+      break;
+    default:
+      return FALSE;
+  }
+
+  // the clip&rotate kernels of basic.cl, without flip, keystone and perspective. they rotate the pixel
+  // centers around t, so with the rotation center in roo and half a pixel added to t they sample at
+  // exactly the positions backtransform() gives process().
+  const int noflip = 0;
+  const float fone = 1.0f;
+  int roi[2] = { roi_in->x, roi_in->y };
+  float roo[2] = { roi_out->x + d->rx * scale, roi_out->y + d->ry * scale };
+  float t[2] = { d->rx * scale + 0.5f, d->ry * scale + 0.5f };
+  float k[2] = { 0.0f, 0.0f };
+  float m[4] = { d->m[0], -d->m[1], -d->m[2], d->m[3] };
+  float k_space[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+  float ka[2] = { 0.0f, 0.0f };
+  float maa[4] = { 1.0f, 0.0f, 0.0f, 1.0f };
+  float mbb[2] = { 0.0f, 0.0f };
+
+  size_t sizes[] = { ROUNDUPWD(width), ROUNDUPHT(height), 1 };
+  dt_opencl_set_kernel_arg(devid, crkernel, 0, sizeof(cl_mem), &dev_in);
+  dt_opencl_set_kernel_arg(devid, crkernel, 1, sizeof(cl_mem), &dev_out);
+  dt_opencl_set_kernel_arg(devid, crkernel, 2, sizeof(int), &width);
+  dt_opencl_set_kernel_arg(devid, crkernel, 3, sizeof(int), &height);
+  dt_opencl_set_kernel_arg(devid, crkernel, 4, sizeof(int), &roi_in->width);
+  dt_opencl_set_kernel_arg(devid, crkernel, 5, sizeof(int), &roi_in->height);
+  dt_opencl_set_kernel_arg(devid, crkernel, 6, 2 * sizeof(int), &roi);
+  dt_opencl_set_kernel_arg(devid, crkernel, 7, 2 * sizeof(float), &roo);
+  dt_opencl_set_kernel_arg(devid, crkernel, 8, sizeof(float), &fone);
+  dt_opencl_set_kernel_arg(devid, crkernel, 9, sizeof(float), &fone);
+  dt_opencl_set_kernel_arg(devid, crkernel, 10, sizeof(int), &noflip);
+  dt_opencl_set_kernel_arg(devid, crkernel, 11, 2 * sizeof(float), &t);
+  dt_opencl_set_kernel_arg(devid, crkernel, 12, 2 * sizeof(float), &k);
+  dt_opencl_set_kernel_arg(devid, crkernel, 13, 4 * sizeof(float), &m);
+  dt_opencl_set_kernel_arg(devid, crkernel, 14, 4 * sizeof(float), &k_space);
+  dt_opencl_set_kernel_arg(devid, crkernel, 15, 2 * sizeof(float), &ka);
+  dt_opencl_set_kernel_arg(devid, crkernel, 16, 4 * sizeof(float), &maa);
+  dt_opencl_set_kernel_arg(devid, crkernel, 17, 2 * sizeof(float), &mbb);
+  err = dt_opencl_enqueue_kernel_2d(devid, crkernel, sizes);
+  if(err != CL_SUCCESS) goto error;
+
+  return TRUE;
+
+error:
+  dt_print(DT_DEBUG_OPENCL, "[opencl_rotatepixels] couldn't enqueue kernel! %d\n", err);
+  return FALSE;
+}
+#endif
+
 void commit_params(dt_iop_module_t *self, dt_iop_params_t *p1, dt_dev_pixelpipe_t *pipe,
                    dt_dev_pixelpipe_iop_t *piece)
 {
@@ -350,6 +431,29 @@ void cleanup(dt_iop_module_t *self)
   self->params = NULL;
 }
 
+void init_global(dt_iop_module_so_t *module)
+{
+  const int program = 2; // basic.cl from programs.conf
+  dt_iop_rotatepixels_global_data_t *gd
+      = (dt_iop_rotatepixels_global_data_t *)malloc(sizeof(dt_iop_rotatepixels_global_data_t));
+  module->data = gd;
+  gd->kernel_clip_rotate_bilinear = dt_opencl_create_kernel(program, "clip_rotate_bilinear");
+  gd->kernel_clip_rotate_bicubic = dt_opencl_create_kernel(program, "clip_rotate_bicubic");
+  gd->kernel_clip_rotate_lanczos2 = dt_opencl_create_kernel(program, "clip_rotate_lanczos2");
+  gd->kernel_clip_rotate_lanczos3 = dt_opencl_create_kernel(program, "clip_rotate_lanczos3");
+}
+
+void cleanup_global(dt_iop_module_so_t *module)
+{
+  dt_iop_rotatepixels_global_data_t *gd = (dt_iop_rotatepixels_global_data_t *)module->data;
+  dt_opencl_free_kernel(gd->kernel_clip_rotate_bilinear);
+  dt_opencl_free_kernel(gd->kernel_clip_rotate_bicubic);
+  dt_opencl_free_kernel(gd->kernel_clip_rotate_lanczos2);
+  dt_opencl_free_kernel(gd->kernel_clip_rotate_lanczos3);
+  free(module->data);
+  module->data = NULL;
+}
+
 void gui_init(dt_iop_module_t *self)
 {
   self->widget = gtk_label_new("");
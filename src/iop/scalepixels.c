@@ -20,6 +20,7 @@
 #endif
 #include "bauhaus/bauhaus.h"
 #include "common/interpolation.h"
+#include "common/opencl.h"
 #include "develop/imageop.h"
 #include "develop/tiling.h"
 #include "gui/accelerators.h"
@@ -50,6 +51,14 @@ typedef struct dt_iop_scalepixels_data_t {
   float y_scale;
 } dt_iop_scalepixels_data_t;
 
+typedef struct dt_iop_scalepixels_global_data_t
+{
+  int kernel_clip_rotate_bilinear;
+  int kernel_clip_rotate_bicubic;
+  int kernel_clip_rotate_lanczos2;
+  int kernel_clip_rotate_lanczos3;
+} dt_iop_scalepixels_global_data_t;
+
 const char *name()
 {
   return C_("modulename", "scale pixels");
@@ -98,12 +107,17 @@ static void precalculate_scale(dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *pi
 int distort_transform(dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, float *points, size_t points_count)
 {
   precalculate_scale(self, piece);
-  dt_iop_scalepixels_data_t *d = piece->data;
+  const dt_iop_scalepixels_data_t *const d = piece->data;
+  // local copies, points could alias the data and keep the loop from vectorizing
+  const float x_scale = d->x_scale, y_scale = d->y_scale;
 
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static) default(none) shared(points, points_count)
+#endif
   for(size_t i = 0; i < points_count * 2; i += 2)
   {
-    points[i] /= d->x_scale;
-    points[i+1] /= d->y_scale;
+    points[i] /= x_scale;
+    points[i+1] /= y_scale;
   }
 
   return 1;
@@ -113,12 +127,17 @@ int distort_backtransform(dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece,
                           size_t points_count)
 {
   precalculate_scale(self, piece);
-  dt_iop_scalepixels_data_t *d = piece->data;
+  const dt_iop_scalepixels_data_t *const d = piece->data;
+  // local copies, points could alias the data and keep the loop from vectorizing
+  const float x_scale = d->x_scale, y_scale = d->y_scale;
 
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static) default(none) shared(points, points_count)
+#endif
   for(size_t i = 0; i < points_count * 2; i += 2)
   {
-    points[i] *= d->x_scale;
-    points[i+1] *= d->y_scale;
+    points[i] *= x_scale;
+    points[i+1] *= y_scale;
   }
 
   return 1;
@@ -201,6 +220,83 @@ void process(dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *c
   }
 }
 
+#ifdef HAVE_OPENCL
+int process_cl(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, cl_mem dev_in, cl_mem dev_out,
+               const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
+{
+  const dt_iop_scalepixels_data_t *const d = piece->data;
+  dt_iop_scalepixels_global_data_t *gd = (dt_iop_scalepixels_global_data_t *)self->data;
+
+  cl_int err = -999;
+  const int devid = piece->pipe->devid;
+  const int width = roi_out->width;
+  const int height = roi_out->height;
+
+  int crkernel = -1;
+  const struct dt_interpolation *interpolation = dt_interpolation_new(DT_INTERPOLATION_USERPREF);
+  switch(interpolation->id)
+  {
+    case DT_INTERPOLATION_BILINEAR:
+      crkernel = gd->kernel_clip_rotate_bilinear;
+      break;
+    case DT_INTERPOLATION_BICUBIC:
+      crkernel = gd->kernel_clip_rotate_bicubic;
+      break;
+    case DT_INTERPOLATION_LANCZOS2:
+      crkernel = gd->kernel_clip_rotate_lanczos2;
+      break;
+    case DT_INTERPOLATION_LANCZOS3:
+      crkernel = gd->kernel_clip_rotate_lanczos3;
+      break;
+    default:
+      return FALSE;
+  }
+
+  // x and y are scaled differently, which dt_interpolation_resample_roi_cl() can't do. the clip&rotate
+  // kernels of basic.cl can, with the scales as matrix: the half pixel in t cancels the one they add to the
+  // pixel centers, so they sample at (i * x_scale, j * y_scale) of the input like process().
+  const int noflip = 0;
+  const float fone = 1.0f;
+  int roi[2] = { 0, 0 };
+  float roo[2] = { 0.0f, 0.0f };
+  float t[2] = { 0.5f, 0.5f };
+  float k[2] = { 0.0f, 0.0f };
+  float m[4] = { d->x_scale, 0.0f, 0.0f, d->y_scale };
+  float k_space[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+  float ka[2] = { 0.0f, 0.0f };
+  float maa[4] = { 1.0f, 0.0f, 0.0f, 1.0f };
+  float mbb[2] = { 0.0f, 0.0f };
+
+  size_t sizes[] = { ROUNDUPWD(width), ROUNDUPHT(height), 1 };
+  dt_opencl_set_kernel_arg(devid, crkernel, 0, sizeof(cl_mem), &dev_in);
+  dt_opencl_set_kernel_arg(devid, crkernel, 1, sizeof(cl_mem), &dev_out);
+  dt_opencl_set_kernel_arg(devid, crkernel, 2, sizeof(int), &width);
+  dt_opencl_set_kernel_arg(devid, crkernel, 3, sizeof(int), &height);
+  dt_opencl_set_kernel_arg(devid, crkernel, 4, sizeof(int), &roi_in->width);
+  dt_opencl_set_kernel_arg(devid, crkernel, 5, sizeof(int), &roi_in->height);
+  dt_opencl_set_kernel_arg(devid, crkernel, 6, 2 * sizeof(int), &roi);
+  dt_opencl_set_kernel_arg(devid, crkernel, 7, 2 * sizeof(float), &roo);
+  dt_opencl_set_kernel_arg(devid, crkernel, 8, sizeof(float), &fone);
+  dt_opencl_set_kernel_arg(devid, crkernel, 9, sizeof(float), &fone);
+  dt_opencl_set_kernel_arg(devid, crkernel, 10, sizeof(int), &noflip);
+  dt_opencl_set_kernel_arg(devid, crkernel, 11, 2 * sizeof(float), &t);
+  dt_opencl_set_kernel_arg(devid, crkernel, 12, 2 * sizeof(float), &k);
+  dt_opencl_set_kernel_arg(devid, crkernel, 13, 4 * sizeof(float), &m);
+  dt_opencl_set_kernel_arg(devid, crkernel, 14, 4 * sizeof(float), &k_space);
+  dt_opencl_set_kernel_arg(devid, crkernel, 15, 2 * sizeof(float), &ka);
+  dt_opencl_set_kernel_arg(devid, crkernel, 16, 4 * sizeof(float), &maa);
+  dt_opencl_set_kernel_arg(devid, crkernel, 17, 2 * sizeof(float), &mbb);
+  err = dt_opencl_enqueue_kernel_2d(devid, crkernel, sizes);
+  if(err != CL_SUCCESS) goto error;
+
+  return TRUE;
+
+error:
+  dt_print(DT_DEBUG_OPENCL, "[opencl_scalepixels] couldn't enqueue kernel! %d\n", err);
+  return FALSE;
+}
+#endif
+
 void commit_params(dt_iop_module_t *self, dt_iop_params_t *params, dt_dev_pixelpipe_t *pipe,
                    dt_dev_pixelpipe_iop_t *piece)
 {
@@ -277,6 +373,29 @@ void cleanup(dt_iop_module_t *self)
   self->params = NULL;
 }
 
+void init_global(dt_iop_module_so_t *module)
+{
+  const int program = 2; // basic.cl from programs.conf
+  dt_iop_scalepixels_global_data_t *gd
+      = (dt_iop_scalepixels_global_data_t *)malloc(sizeof(dt_iop_scalepixels_global_data_t));
+  module->data = gd;
+  gd->kernel_clip_rotate_bilinear = dt_opencl_create_kernel(program, "clip_rotate_bilinear");
+  gd->kernel_clip_rotate_bicubic = dt_opencl_create_kernel(program, "clip_rotate_bicubic");
+  gd->kernel_clip_rotate_lanczos2 = dt_opencl_create_kernel(program, "clip_rotate_lanczos2");
+  gd->kernel_clip_rotate_lanczos3 = dt_opencl_create_kernel(program, "clip_rotate_lanczos3");
+}
+
+void cleanup_global(dt_iop_module_so_t *module)
+{
+  dt_iop_scalepixels_global_data_t *gd = (dt_iop_scalepixels_global_data_t *)module->data;
+  dt_opencl_free_kernel(gd->kernel_clip_rotate_bilinear);
+  dt_opencl_free_kernel(gd->kernel_clip_rotate_bicubic);
+  dt_opencl_free_kernel(gd->kernel_clip_rotate_lanczos2);
+  dt_opencl_free_kernel(gd->kernel_clip_rotate_lanczos3);
+  free(module->data);
+  module->data = NULL;
+}
+
 void gui_init(dt_iop_module_t *self)
 {
   self->widget = gtk_label_new("");
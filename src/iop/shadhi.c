@@ -60,12 +60,18 @@
 #define CLAMPF(a, mn, mx) ((a) < (mn) ? (mn) : ((a) > (mx) ? (mx) : (a)))
 #define CLAMP_RANGE(x, y, z) (CLAMP(x, y, z))
 
+// boxes of the guided filter with a variance of L, scaled to [0, 1], above this keep their edges
+#define SHADHI_GUIDED_EPS 0.01f
+// columns the vertical box pass keeps running sums for at once
+#define SHADHI_BOX_STRIP 64
+
 DT_MODULE_INTROSPECTION(5, dt_iop_shadhi_params_t)
 
 typedef enum dt_iop_shadhi_algo_t
 {
   SHADHI_ALGO_GAUSSIAN,
-  SHADHI_ALGO_BILATERAL
+  SHADHI_ALGO_BILATERAL,
+  SHADHI_ALGO_GUIDED
 } dt_iop_shadhi_algo_t;
 
 /* legacy version 1 params */
@@ -169,6 +175,8 @@ typedef struct dt_iop_shadhi_data_t
 typedef struct dt_iop_shadhi_global_data_t
 {
   int kernel_shadows_highlights_mix;
+  int kernel_shadows_highlights_guided_rows;
+  int kernel_shadows_highlights_guided_cols;
 } dt_iop_shadhi_global_data_t;
 
 
@@ -312,6 +320,142 @@ static inline float sign(float x)
   return (x < 0 ? -1.0f : 1.0f);
 }
 
+// radius of the boxes of the guided filter. the result is a box mean of box means, which spreads about as far as
+// the gaussian of sigma when r (r + 1) = 1.5 sigma^2.
+static inline int _guided_radius(const float sigma)
+{
+  return MAX(1, (int)(sqrtf(1.5f) * sigma));
+}
+
+// moving average of the two interleaved channels of buf over (2 * r + 1) x (2 * r + 1) pixels, shrinking at the
+// borders. running sums make it cost the same for every radius. tmp is of the size of buf.
+static void _box_mean_2c(float *const buf, float *const tmp, const int width, const int height, const int r)
+{
+  // rows, from buf into tmp
+#ifdef _OPENMP
+#pragma omp parallel for default(none) schedule(static)
+#endif
+  for(int j = 0; j < height; j++)
+  {
+    const float *const in = buf + (size_t)2 * width * j;
+    float *const out = tmp + (size_t)2 * width * j;
+    float s0 = 0.0f, s1 = 0.0f;
+    for(int i = 0; i < MIN(r, width); i++)
+    {
+      s0 += in[2 * i];
+      s1 += in[2 * i + 1];
+    }
+    for(int i = 0; i < width; i++)
+    {
+      if(i + r < width)
+      {
+        s0 += in[2 * (i + r)];
+        s1 += in[2 * (i + r) + 1];
+      }
+      if(i > r)
+      {
+        s0 -= in[2 * (i - r - 1)];
+        s1 -= in[2 * (i - r - 1) + 1];
+      }
+      const float norm = 1.0f / (MIN(i + r, width - 1) - MAX(i - r, 0) + 1);
+      out[2 * i] = s0 * norm;
+      out[2 * i + 1] = s1 * norm;
+    }
+  }
+
+  // columns, from tmp back into buf, a strip at a time so that its running sums stay in cache
+  const int strips = (width + SHADHI_BOX_STRIP - 1) / SHADHI_BOX_STRIP;
+#ifdef _OPENMP
+#pragma omp parallel for default(none) schedule(static)
+#endif
+  for(int strip = 0; strip < strips; strip++)
+  {
+    const int x0 = strip * SHADHI_BOX_STRIP;
+    const int n = 2 * MIN(SHADHI_BOX_STRIP, width - x0);
+    float sum[2 * SHADHI_BOX_STRIP] = { 0.0f };
+    for(int j = 0; j < MIN(r, height); j++)
+    {
+      const float *const in = tmp + 2 * ((size_t)width * j + x0);
+      for(int k = 0; k < n; k++) sum[k] += in[k];
+    }
+    for(int j = 0; j < height; j++)
+    {
+      if(j + r < height)
+      {
+        const float *const in = tmp + 2 * ((size_t)width * (j + r) + x0);
+        for(int k = 0; k < n; k++) sum[k] += in[k];
+      }
+      if(j > r)
+      {
+        const float *const in = tmp + 2 * ((size_t)width * (j - r - 1) + x0);
+        for(int k = 0; k < n; k++) sum[k] -= in[k];
+      }
+      const float norm = 1.0f / (MIN(j + r, height - 1) - MAX(j - r, 0) + 1);
+      float *const out = buf + 2 * ((size_t)width * j + x0);
+      for(int k = 0; k < n; k++) out[k] = sum[k] * norm;
+    }
+  }
+}
+
+// edge aware smoothing of L, guided by L itself (he et al., guided image filtering). in every box the result is a
+// linear function of the guide: flat where L varies little, following it across edges. a and b are passed on
+// unchanged. returns non-zero if out of memory.
+static int _guided_filter_L(const float *const in, float *const out, const int width, const int height,
+                            const int r, const float eps)
+{
+  const size_t npixels = (size_t)width * height;
+  float *const buf = (float *)dt_alloc_align(64, sizeof(float) * 2 * npixels);
+  float *const tmp = (float *)dt_alloc_align(64, sizeof(float) * 2 * npixels);
+  if(!buf || !tmp)
+  {
+    dt_free_align(buf);
+    dt_free_align(tmp);
+    return 1;
+  }
+
+  // mean and variance of the guide
+#ifdef _OPENMP
+#pragma omp parallel for default(none) schedule(static)
+#endif
+  for(size_t k = 0; k < npixels; k++)
+  {
+    const float L = in[4 * k] / 100.0f;
+    buf[2 * k] = L;
+    buf[2 * k + 1] = L * L;
+  }
+  _box_mean_2c(buf, tmp, width, height, r);
+
+  // the coefficients of every box
+#ifdef _OPENMP
+#pragma omp parallel for default(none) schedule(static)
+#endif
+  for(size_t k = 0; k < npixels; k++)
+  {
+    const float mean = buf[2 * k];
+    const float var = fmaxf(buf[2 * k + 1] - mean * mean, 0.0f);
+    const float a = var / (var + eps);
+    buf[2 * k] = a;
+    buf[2 * k + 1] = mean - a * mean;
+  }
+  _box_mean_2c(buf, tmp, width, height, r);
+
+  // averaged over all boxes a pixel is in
+#ifdef _OPENMP
+#pragma omp parallel for default(none) schedule(static)
+#endif
+  for(size_t k = 0; k < npixels; k++)
+  {
+    out[4 * k] = 100.0f * (buf[2 * k] * in[4 * k] / 100.0f + buf[2 * k + 1]);
+    out[4 * k + 1] = in[4 * k + 1];
+    out[4 * k + 2] = in[4 * k + 2];
+    out[4 * k + 3] = in[4 * k + 3];
+  }
+
+  dt_free_align(buf);
+  dt_free_align(tmp);
+  return 0;
+}
+
 
 void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *const ivoid,
              void *const ovoid, const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
@@ -336,7 +480,7 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
   const float highlights_ccorrect = (fmin(fmax(0.0f, (data->highlights_ccorrect / 100.0f)), 1.0f) - 0.5f)
                                     * sign(-highlights) + 0.5f;
   const unsigned int flags = data->flags;
-  const int unbound_mask = ((data->shadhi_algo == SHADHI_ALGO_BILATERAL) && (flags & UNBOUND_BILATERAL))
+  const int unbound_mask = ((data->shadhi_algo != SHADHI_ALGO_GAUSSIAN) && (flags & UNBOUND_BILATERAL))
                            || ((data->shadhi_algo == SHADHI_ALGO_GAUSSIAN) && (flags & UNBOUND_GAUSSIAN));
   const float low_approximation = data->low_approximation;
 
@@ -351,10 +495,22 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
       for(int k = 0; k < 4; k++) Labmin[k] = -INFINITY;
     }
 
-    dt_gaussian_t *g = dt_gaussian_init(width, height, ch, Labmax, Labmin, sigma, order);
-    if(!g) return;
-    dt_gaussian_blur_4c(g, in, out);
-    dt_gaussian_free(g);
+    // large radii are blurred at reduced resolution, which looks the same and is a lot cheaper
+    if(order == DT_IOP_GAUSSIAN_ZERO)
+    {
+      if(dt_gaussian_pyramid_blur_once_4c(in, out, width, height, sigma, Labmax, Labmin)) return;
+    }
+    else
+    {
+      dt_gaussian_t *g = dt_gaussian_init(width, height, ch, Labmax, Labmin, sigma, order);
+      if(!g) return;
+      dt_gaussian_blur_4c(g, in, out);
+      dt_gaussian_free(g);
+    }
+  }
+  else if(data->shadhi_algo == SHADHI_ALGO_GUIDED)
+  {
+    if(_guided_filter_L(in, out, width, height, _guided_radius(sigma), SHADHI_GUIDED_EPS)) return;
   }
   else
   {
@@ -510,7 +666,7 @@ int process_cl(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, cl_m
                                     * sign(-highlights) + 0.5f;
   const float low_approximation = d->low_approximation;
   const unsigned int flags = d->flags;
-  const int unbound_mask = ((d->shadhi_algo == SHADHI_ALGO_BILATERAL) && (flags & UNBOUND_BILATERAL))
+  const int unbound_mask = ((d->shadhi_algo != SHADHI_ALGO_GAUSSIAN) && (flags & UNBOUND_BILATERAL))
                            || ((d->shadhi_algo == SHADHI_ALGO_GAUSSIAN) && (flags & UNBOUND_GAUSSIAN));
 
   size_t sizes[3];
@@ -518,6 +674,7 @@ int process_cl(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, cl_m
   dt_gaussian_cl_t *g = NULL;
   dt_bilateral_cl_t *b = NULL;
   cl_mem dev_tmp = NULL;
+  cl_mem dev_box1 = NULL, dev_box2 = NULL;
 
   if(d->shadhi_algo == SHADHI_ALGO_GAUSSIAN)
   {
@@ -537,6 +694,58 @@ int process_cl(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, cl_m
     dt_gaussian_free_cl(g);
     g = NULL;
   }
+  else if(d->shadhi_algo == SHADHI_ALGO_GUIDED)
+  {
+    const int r = _guided_radius(sigma);
+    const float eps = SHADHI_GUIDED_EPS;
+    dev_box1 = dt_opencl_alloc_device(devid, width, height, 4 * sizeof(float));
+    dev_box2 = dt_opencl_alloc_device(devid, width, height, 4 * sizeof(float));
+    if(dev_box1 == NULL || dev_box2 == NULL) goto error;
+
+    // every work item slides its box along one row or column
+    size_t rows[] = { ROUNDUPHT(height), 1, 1 };
+    size_t cols[] = { ROUNDUPWD(width), 1, 1 };
+    const int rows_kernel = gd->kernel_shadows_highlights_guided_rows;
+    const int cols_kernel = gd->kernel_shadows_highlights_guided_cols;
+
+    // means of L and L^2 in dev_box1, into coefficients in dev_box2
+    int from_Lab = 1;
+    dt_opencl_set_kernel_arg(devid, rows_kernel, 0, sizeof(cl_mem), (void *)&dev_in);
+    dt_opencl_set_kernel_arg(devid, rows_kernel, 1, sizeof(cl_mem), (void *)&dev_box1);
+    dt_opencl_set_kernel_arg(devid, rows_kernel, 2, sizeof(int), (void *)&width);
+    dt_opencl_set_kernel_arg(devid, rows_kernel, 3, sizeof(int), (void *)&height);
+    dt_opencl_set_kernel_arg(devid, rows_kernel, 4, sizeof(int), (void *)&r);
+    dt_opencl_set_kernel_arg(devid, rows_kernel, 5, sizeof(int), (void *)&from_Lab);
+    err = dt_opencl_enqueue_kernel_2d(devid, rows_kernel, rows);
+    if(err != CL_SUCCESS) goto error;
+    int apply = 0;
+    dt_opencl_set_kernel_arg(devid, cols_kernel, 0, sizeof(cl_mem), (void *)&dev_box1);
+    dt_opencl_set_kernel_arg(devid, cols_kernel, 1, sizeof(cl_mem), (void *)&dev_in);
+    dt_opencl_set_kernel_arg(devid, cols_kernel, 2, sizeof(cl_mem), (void *)&dev_box2);
+    dt_opencl_set_kernel_arg(devid, cols_kernel, 3, sizeof(int), (void *)&width);
+    dt_opencl_set_kernel_arg(devid, cols_kernel, 4, sizeof(int), (void *)&height);
+    dt_opencl_set_kernel_arg(devid, cols_kernel, 5, sizeof(int), (void *)&r);
+    dt_opencl_set_kernel_arg(devid, cols_kernel, 6, sizeof(float), (void *)&eps);
+    dt_opencl_set_kernel_arg(devid, cols_kernel, 7, sizeof(int), (void *)&apply);
+    err = dt_opencl_enqueue_kernel_2d(devid, cols_kernel, cols);
+    if(err != CL_SUCCESS) goto error;
+
+    // their means in dev_box1, applied to L into dev_out
+    from_Lab = 0;
+    dt_opencl_set_kernel_arg(devid, rows_kernel, 0, sizeof(cl_mem), (void *)&dev_box2);
+    dt_opencl_set_kernel_arg(devid, rows_kernel, 5, sizeof(int), (void *)&from_Lab);
+    err = dt_opencl_enqueue_kernel_2d(devid, rows_kernel, rows);
+    if(err != CL_SUCCESS) goto error;
+    apply = 1;
+    dt_opencl_set_kernel_arg(devid, cols_kernel, 2, sizeof(cl_mem), (void *)&dev_out);
+    dt_opencl_set_kernel_arg(devid, cols_kernel, 7, sizeof(int), (void *)&apply);
+    err = dt_opencl_enqueue_kernel_2d(devid, cols_kernel, cols);
+    if(err != CL_SUCCESS) goto error;
+
+    dt_opencl_release_mem_object(dev_box1);
+    dt_opencl_release_mem_object(dev_box2);
+    dev_box1 = dev_box2 = NULL;
+  }
   else
   {
     const float sigma_r = 100.0f; // does not depend on scale
@@ -595,6 +804,8 @@ error:
   if(g) dt_gaussian_free_cl(g);
   if(b) dt_bilateral_free_cl(b);
   dt_opencl_release_mem_object(dev_tmp);
+  dt_opencl_release_mem_object(dev_box1);
+  dt_opencl_release_mem_object(dev_box2);
   dt_print(DT_DEBUG_OPENCL, "[opencl_shadows&highlights] couldn't enqueue kernel! %d\n", err);
   return FALSE;
 }
@@ -624,6 +835,12 @@ void tiling_callback(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t
     tiling->maxbuf
         = fmax(1.0f, (float)dt_bilateral_singlebuffer_size(width, height, sigma_s, sigma_r) / basebuffer);
   }
+  else if(d->shadhi_algo == SHADHI_ALGO_GUIDED)
+  {
+    // guided filter: two planes of two floats per pixel on the cpu, two images on the gpu
+    tiling->factor = 4.0f;
+    tiling->maxbuf = 1.0f;
+  }
   else
   {
     // gaussian blur
@@ -786,6 +1003,8 @@ void init_global(dt_iop_module_so_t *module)
       = (dt_iop_shadhi_global_data_t *)malloc(sizeof(dt_iop_shadhi_global_data_t));
   module->data = gd;
   gd->kernel_shadows_highlights_mix = dt_opencl_create_kernel(program, "shadows_highlights_mix");
+  gd->kernel_shadows_highlights_guided_rows = dt_opencl_create_kernel(program, "shadows_highlights_guided_rows");
+  gd->kernel_shadows_highlights_guided_cols = dt_opencl_create_kernel(program, "shadows_highlights_guided_cols");
 }
 
 
@@ -799,6 +1018,8 @@ void cleanup_global(dt_iop_module_so_t *module)
 {
   dt_iop_shadhi_global_data_t *gd = (dt_iop_shadhi_global_data_t *)module->data;
   dt_opencl_free_kernel(gd->kernel_shadows_highlights_mix);
+  dt_opencl_free_kernel(gd->kernel_shadows_highlights_guided_rows);
+  dt_opencl_free_kernel(gd->kernel_shadows_highlights_guided_cols);
   free(module->data);
   module->data = NULL;
 }
@@ -819,6 +1040,7 @@ void gui_init(struct dt_iop_module_t *self)
   dt_bauhaus_widget_set_label(g->shadhi_algo, NULL, _("soften with"));
   dt_bauhaus_combobox_add(g->shadhi_algo, _("gaussian"));
   dt_bauhaus_combobox_add(g->shadhi_algo, _("bilateral filter"));
+  dt_bauhaus_combobox_add(g->shadhi_algo, _("guided filter"));
   g->radius = dt_bauhaus_slider_new_with_range(self, 0.1, 200.0, 2., p->radius, 2);
   g->compress = dt_bauhaus_slider_new_with_range(self, 0, 100.0, 2., p->compress, 2);
   g->shadows_ccorrect = dt_bauhaus_slider_new_with_range(self, 0, 100.0, 2., p->shadows_ccorrect, 2);
@@ -851,7 +1073,8 @@ void gui_init(struct dt_iop_module_t *self)
   gtk_widget_set_tooltip_text(g->highlights, _("correct highlights"));
   gtk_widget_set_tooltip_text(g->whitepoint, _("shift white point"));
   gtk_widget_set_tooltip_text(g->radius, _("spatial extent"));
-  gtk_widget_set_tooltip_text(g->shadhi_algo, _("filter to use for softening. bilateral avoids halos"));
+  gtk_widget_set_tooltip_text(g->shadhi_algo,
+                              _("filter to use for softening. bilateral and guided avoid halos,\nguided is faster"));
   gtk_widget_set_tooltip_text(g->compress, _("compress the effect on shadows/highlights and\npreserve midtones"));
   gtk_widget_set_tooltip_text(g->shadows_ccorrect, _("adjust saturation of shadows"));
   gtk_widget_set_tooltip_text(g->highlights_ccorrect, _("adjust saturation of highlights"));
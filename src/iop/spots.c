@@ -18,6 +18,7 @@
 #ifdef HAVE_CONFIG_H
 #include "config.h"
 #endif
+#include "common/opencl.h"
 #include "control/conf.h"
 #include "control/control.h"
 #include "develop/blend.h"
@@ -46,7 +47,22 @@ typedef struct dt_iop_spots_gui_data_t
   GtkWidget *bt_path, *bt_circle, *bt_ellipse;
 } dt_iop_spots_gui_data_t;
 
-typedef struct dt_iop_spots_params_t dt_iop_spots_data_t;
+typedef struct dt_iop_spots_data_t
+{
+  int clone_id[64];
+  int clone_algo[64];
+  // the spots as of the last commit, to tell the pipe where a change happened
+  int spots; // -1 before the first commit
+  int spot_id[64];
+  uint64_t spot_hash[64];
+  int spot_area[64][4];
+  dt_develop_blend_params_t blend;
+} dt_iop_spots_data_t;
+
+typedef struct dt_iop_spots_global_data_t
+{
+  int kernel_spots;
+} dt_iop_spots_global_data_t;
 
 // this returns a translatable name
 const char *name()
@@ -358,27 +374,27 @@ static int masks_get_delta(dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece,
   return res;
 }
 
-void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *const i, void *const o,
-             const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
+// one spot, as it gets stamped onto the output: the pixels of the destination area [x0, x1) x [y0, y1) are
+// blended with the input at (x - dx, y - dy), by the smooth circle of clone_algo 1 or by the mask of the form
+typedef struct dt_iop_spots_stamp_t
 {
-  dt_iop_spots_params_t *d = (dt_iop_spots_params_t *)piece->data;
-  dt_develop_blend_params_t *bp = self->blend_params;
+  int circle;
+  int x0, y0, x1, y1;
+  int dx, dy;
+  // origin of the filter window (circle) or of the mask
+  int ox, oy;
+  // radius of the circle, or the size of the mask
+  int rad, mask_width, mask_height;
+  float *mask;
+} dt_iop_spots_stamp_t;
 
-  const int ch = piece->colors;
-  const float *in = (float *)i;
-  float *out = (float *)o;
-
-// we don't modify most of the image:
-#ifdef _OPENMP
-#pragma omp parallel for schedule(static) default(none) shared(out, in)
-#endif
-  for(int k = 0; k < roi_out->height; k++)
-  {
-    float *outb = out + (size_t)ch * k * roi_out->width;
-    const float *inb = in + (size_t)ch * roi_in->width * (k + roi_out->y - roi_in->y)
-                       + ch * (roi_out->x - roi_in->x);
-    memcpy(outb, inb, sizeof(float) * roi_out->width * ch);
-  }
+// the stamps of all forms in the roi, in the order of the group. the caller frees their masks.
+static int _spots_stamps(dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const dt_iop_roi_t *const roi_in,
+                         const dt_iop_roi_t *const roi_out, dt_iop_spots_stamp_t stamps[64])
+{
+  dt_iop_spots_data_t *d = (dt_iop_spots_data_t *)piece->data;
+  dt_develop_blend_params_t *bp = self->blend_params;
+  int count = 0;
 
   // iterate through all forms
   dt_masks_form_t *grp = dt_masks_get_from_id(self->dev, bp->mask_id);
@@ -431,48 +447,20 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
         const int posy = points[1] - rad;
         const int posx_source = points[2] - rad;
         const int posy_source = points[3] - rad;
-        const int dx = posx - posx_source;
-        const int dy = posy - posy_source;
-        const int fw = 2 * rad, fh = 2 * rad;
-
-        float *filter = malloc((2 * rad + 1) * sizeof(float));
-
-        if(rad > 0)
-        {
-          for(int k = -rad; k <= rad; k++)
-          {
-            const float kk = 1.0f - fabsf(k / (float)rad);
-            filter[rad + k] = kk * kk * (3.0f - 2.0f * kk);
-          }
-        }
-        else
-        {
-          filter[0] = 1.0f;
-        }
-
-        for(int yy = posy; yy < posy + fh; yy++)
-        {
-          // we test if we are inside roi_out
-          if(yy < roi_out->y || yy >= roi_out->y + roi_out->height) continue;
-          // we test if the source point is inside roi_in
-          if(yy - dy < roi_in->y || yy - dy >= roi_in->y + roi_in->height) continue;
-          for(int xx = posx; xx < posx + fw; xx++)
-          {
-            // we test if we are inside roi_out
-            if(xx < roi_out->x || xx >= roi_out->x + roi_out->width) continue;
-            // we test if the source point is inside roi_in
-            if(xx - dx < roi_in->x || xx - dx >= roi_in->x + roi_in->width) continue;
-
-            const float f = filter[xx - posx + 1] * filter[yy - posy + 1];
-            for(int c = 0; c < ch; c++)
-              out[4 * ((size_t)roi_out->width * (yy - roi_out->y) + xx - roi_out->x) + c]
-                  = out[4 * ((size_t)roi_out->width * (yy - roi_out->y) + xx - roi_out->x) + c] * (1.0f - f)
-                    + in[4 * ((size_t)roi_in->width * (yy - posy + posy_source - roi_in->y) + xx - posx
-                              + posx_source - roi_in->x) + c] * f;
-          }
-        }
 
-        free(filter);
+        dt_iop_spots_stamp_t *st = stamps + count++;
+        st->circle = 1;
+        st->x0 = posx;
+        st->y0 = posy;
+        st->x1 = posx + 2 * rad;
+        st->y1 = posy + 2 * rad;
+        st->dx = posx - posx_source;
+        st->dy = posy - posy_source;
+        st->ox = posx;
+        st->oy = posy;
+        st->rad = rad;
+        st->mask_width = st->mask_height = 0;
+        st->mask = NULL;
       }
       else
       {
@@ -485,7 +473,7 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
         int dx = 0, dy = 0;
 
         // now we search the delta with the source
-        if(!masks_get_delta(self, piece, roi_in, form, &dx, &dy))
+        if(!masks_get_delta(self, piece, roi_in, form, &dx, &dy) || (dx == 0 && dy == 0))
         {
           forms = g_list_next(forms);
           pos++;
@@ -494,45 +482,220 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
           continue;
         }
 
-        if(dx != 0 || dy != 0)
-        {
-          // now we do the pixel clone
-          for(int yy = fts + 1; yy < fts + fhs - 1; yy++)
-          {
-            // we test if we are inside roi_out
-            if(yy < roi_out->y || yy >= roi_out->y + roi_out->height) continue;
-            // we test if the source point is inside roi_in
-            if(yy - dy < roi_in->y || yy - dy >= roi_in->y + roi_in->height) continue;
-            for(int xx = fls + 1; xx < fls + fws - 1; xx++)
-            {
-              // we test if we are inside roi_out
-              if(xx < roi_out->x || xx >= roi_out->x + roi_out->width) continue;
-              // we test if the source point is inside roi_in
-              if(xx - dx < roi_in->x || xx - dx >= roi_in->x + roi_in->width) continue;
-
-              float f = mask[((int)((yy - fts) / roi_in->scale)) * width
-                             + (int)((xx - fls) / roi_in->scale)]; // we can add the opacity here
-
-              for(int c = 0; c < ch; c++)
-                out[4 * ((size_t)roi_out->width * (yy - roi_out->y) + xx - roi_out->x) + c]
-                    = out[4 * ((size_t)roi_out->width * (yy - roi_out->y) + xx - roi_out->x) + c] * (1.0f - f)
-                      + in[4 * ((size_t)roi_in->width * (yy - dy - roi_in->y) + xx - dx - roi_in->x) + c] * f;
-            }
-          }
-        }
-        free(mask);
+        dt_iop_spots_stamp_t *st = stamps + count++;
+        st->circle = 0;
+        st->x0 = fls + 1;
+        st->y0 = fts + 1;
+        st->x1 = fls + fws - 1;
+        st->y1 = fts + fhs - 1;
+        st->dx = dx;
+        st->dy = dy;
+        st->ox = fls;
+        st->oy = fts;
+        st->rad = 0;
+        st->mask_width = width;
+        st->mask_height = height;
+        st->mask = mask;
       }
       pos++;
       forms = g_list_next(forms);
     }
   }
+  return count;
+}
+
+static void _spots_stamp(const dt_iop_spots_stamp_t *const st, const float *const in, float *const out,
+                         const int ch, const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
+{
+  const int rad = st->rad;
+  float *filter = NULL;
+  if(st->circle)
+  {
+    filter = malloc((2 * rad + 1) * sizeof(float));
+
+    if(rad > 0)
+    {
+      for(int k = -rad; k <= rad; k++)
+      {
+        const float kk = 1.0f - fabsf(k / (float)rad);
+        filter[rad + k] = kk * kk * (3.0f - 2.0f * kk);
+      }
+    }
+    else
+    {
+      filter[0] = 1.0f;
+    }
+  }
+
+  for(int yy = st->y0; yy < st->y1; yy++)
+  {
+    // we test if we are inside roi_out
+    if(yy < roi_out->y || yy >= roi_out->y + roi_out->height) continue;
+    // we test if the source point is inside roi_in
+    if(yy - st->dy < roi_in->y || yy - st->dy >= roi_in->y + roi_in->height) continue;
+    for(int xx = st->x0; xx < st->x1; xx++)
+    {
+      // we test if we are inside roi_out
+      if(xx < roi_out->x || xx >= roi_out->x + roi_out->width) continue;
+      // we test if the source point is inside roi_in
+      if(xx - st->dx < roi_in->x || xx - st->dx >= roi_in->x + roi_in->width) continue;
+
+      const float f = st->circle ? filter[xx - st->ox + 1] * filter[yy - st->oy + 1]
+                                 : st->mask[((int)((yy - st->oy) / roi_in->scale)) * st->mask_width
+                                            + (int)((xx - st->ox) / roi_in->scale)]; // we can add the opacity here
+
+      for(int c = 0; c < ch; c++)
+        out[4 * ((size_t)roi_out->width * (yy - roi_out->y) + xx - roi_out->x) + c]
+            = out[4 * ((size_t)roi_out->width * (yy - roi_out->y) + xx - roi_out->x) + c] * (1.0f - f)
+              + in[4 * ((size_t)roi_in->width * (yy - st->dy - roi_in->y) + xx - st->dx - roi_in->x) + c] * f;
+    }
+  }
+
+  free(filter);
+}
+
+void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *const i, void *const o,
+             const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
+{
+  const int ch = piece->colors;
+  const float *in = (float *)i;
+  float *out = (float *)o;
+
+// we don't modify most of the image:
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static) default(none) shared(out, in)
+#endif
+  for(int k = 0; k < roi_out->height; k++)
+  {
+    float *outb = out + (size_t)ch * k * roi_out->width;
+    const float *inb = in + (size_t)ch * roi_in->width * (k + roi_out->y - roi_in->y)
+                       + ch * (roi_out->x - roi_in->x);
+    memcpy(outb, inb, sizeof(float) * roi_out->width * ch);
+  }
+
+  dt_iop_spots_stamp_t stamps[64];
+  const int count = _spots_stamps(self, piece, roi_in, roi_out, stamps);
+  for(int k = 0; k < count; k++)
+  {
+    _spots_stamp(stamps + k, in, out, ch, roi_in, roi_out);
+    free(stamps[k].mask);
+  }
+}
+
+#ifdef HAVE_OPENCL
+int process_cl(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, cl_mem dev_in, cl_mem dev_out,
+               const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
+{
+  dt_iop_spots_global_data_t *gd = (dt_iop_spots_global_data_t *)self->data;
+
+  const int devid = piece->pipe->devid;
+  const int width = roi_out->width;
+  const int height = roi_out->height;
+
+  cl_mem dev_stamps = NULL;
+  cl_mem dev_masks = NULL;
+  int *params = NULL;
+  float *masks = NULL;
+  cl_int err = -999;
+
+  dt_iop_spots_stamp_t stamps[64];
+  const int count = _spots_stamps(self, piece, roi_in, roi_out, stamps);
+
+  // all the stamps and their masks go to the device in one batch, with the mask offsets in the parameters
+  size_t masks_size = 0;
+  for(int k = 0; k < count; k++) masks_size += (size_t)stamps[k].mask_width * stamps[k].mask_height;
+
+  params = malloc(sizeof(int) * 12 * MAX(count, 1));
+  masks = malloc(sizeof(float) * MAX(masks_size, 1));
+  if(params == NULL || masks == NULL) goto error;
+
+  size_t offset = 0;
+  for(int k = 0; k < count; k++)
+  {
+    const dt_iop_spots_stamp_t *st = stamps + k;
+    int *p = params + 12 * k;
+    p[0] = st->circle;
+    p[1] = st->x0;
+    p[2] = st->y0;
+    p[3] = st->x1;
+    p[4] = st->y1;
+    p[5] = st->dx;
+    p[6] = st->dy;
+    p[7] = st->ox;
+    p[8] = st->oy;
+    p[9] = st->circle ? st->rad : st->mask_width;
+    p[10] = offset;
+    p[11] = 0;
+    if(st->mask)
+    {
+      const size_t size = (size_t)st->mask_width * st->mask_height;
+      memcpy(masks + offset, st->mask, sizeof(float) * size);
+      offset += size;
+    }
+  }
+
+  dev_stamps = dt_opencl_copy_host_to_device_constant(devid, sizeof(int) * 12 * MAX(count, 1), params);
+  if(dev_stamps == NULL) goto error;
+  dev_masks = dt_opencl_copy_host_to_device_constant(devid, sizeof(float) * MAX(masks_size, 1), masks);
+  if(dev_masks == NULL) goto error;
+
+  const int in_x = roi_in->x, in_y = roi_in->y, in_width = roi_in->width, in_height = roi_in->height;
+  const float scale = roi_in->scale;
+  size_t sizes[] = { ROUNDUPWD(width), ROUNDUPHT(height), 1 };
+  dt_opencl_set_kernel_arg(devid, gd->kernel_spots, 0, sizeof(cl_mem), (void *)&dev_in);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_spots, 1, sizeof(cl_mem), (void *)&dev_out);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_spots, 2, sizeof(int), (void *)&width);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_spots, 3, sizeof(int), (void *)&height);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_spots, 4, sizeof(int), (void *)&roi_out->x);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_spots, 5, sizeof(int), (void *)&roi_out->y);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_spots, 6, sizeof(int), (void *)&in_x);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_spots, 7, sizeof(int), (void *)&in_y);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_spots, 8, sizeof(int), (void *)&in_width);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_spots, 9, sizeof(int), (void *)&in_height);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_spots, 10, sizeof(float), (void *)&scale);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_spots, 11, sizeof(cl_mem), (void *)&dev_stamps);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_spots, 12, sizeof(int), (void *)&count);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_spots, 13, sizeof(cl_mem), (void *)&dev_masks);
+  err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_spots, sizes);
+  if(err != CL_SUCCESS) goto error;
+
+  dt_opencl_release_mem_object(dev_masks);
+  dt_opencl_release_mem_object(dev_stamps);
+  for(int k = 0; k < count; k++) free(stamps[k].mask);
+  free(masks);
+  free(params);
+  return TRUE;
+
+error:
+  dt_opencl_release_mem_object(dev_masks);
+  dt_opencl_release_mem_object(dev_stamps);
+  for(int k = 0; k < count; k++) free(stamps[k].mask);
+  free(masks);
+  free(params);
+  dt_print(DT_DEBUG_OPENCL, "[opencl_spots] couldn't enqueue kernel! %d\n", err);
+  return FALSE;
 }
+#endif
 
 /** init, cleanup, commit to pipeline */
+void init_global(dt_iop_module_so_t *module)
+{
+  const int program = 26; // spots.cl, from programs.conf
+  dt_iop_spots_global_data_t *gd = (dt_iop_spots_global_data_t *)malloc(sizeof(dt_iop_spots_global_data_t));
+  module->data = gd;
+  gd->kernel_spots = dt_opencl_create_kernel(program, "spots");
+}
+
+void cleanup_global(dt_iop_module_so_t *module)
+{
+  dt_iop_spots_global_data_t *gd = (dt_iop_spots_global_data_t *)module->data;
+  dt_opencl_free_kernel(gd->kernel_spots);
+  free(module->data);
+  module->data = NULL;
+}
+
 void init(dt_iop_module_t *module)
 {
-  // we don't need global data:
-  module->data = NULL; // malloc(sizeof(dt_iop_spots_global_data_t));
   module->params = calloc(1, sizeof(dt_iop_spots_params_t));
   module->default_params = calloc(1, sizeof(dt_iop_spots_params_t));
   // our module is disabled by default
@@ -552,8 +715,6 @@ void cleanup(dt_iop_module_t *module)
 {
   free(module->params);
   module->params = NULL;
-  free(module->data); // just to be sure
-  module->data = NULL;
 }
 
 void gui_focus(struct dt_iop_module_t *self, gboolean in)
@@ -581,15 +742,94 @@ void gui_focus(struct dt_iop_module_t *self, gboolean in)
 }
 
 /** commit is the synch point between core and gui, so it copies params to pipe data. */
+// compares the spots with the last commit and reports the areas of the ones that have been added, removed
+// or changed to the pipe, so it only recomputes those.
+static void _commit_spots(dt_iop_module_t *self, dt_dev_pixelpipe_t *pipe, dt_dev_pixelpipe_iop_t *piece)
+{
+  dt_iop_spots_data_t *d = (dt_iop_spots_data_t *)piece->data;
+  // init_pipe commits before there are blend params
+  if(!piece->blendop_data) return;
+
+  int spots = 0, local = 1;
+  int spot_id[64];
+  uint64_t spot_hash[64];
+  int spot_area[64][4] = { { 0 } };
+
+  dt_masks_form_t *grp = dt_masks_get_from_id(self->dev, self->blend_params->mask_id);
+  if(grp && (grp->type & DT_MASKS_GROUP))
+  {
+    for(GList *forms = g_list_first(grp->points); forms && spots < 64; forms = g_list_next(forms), spots++)
+    {
+      dt_masks_point_group_t *grpt = (dt_masks_point_group_t *)forms->data;
+      uint64_t hash = 5381;
+      const int state[3] = { grpt->state, (int)(grpt->opacity * 1000.0f), d->clone_algo[spots] };
+      for(int k = 0; k < 3; k++) hash = ((hash << 5) + hash) ^ state[k];
+      spot_id[spots] = grpt->formid;
+
+      dt_masks_form_t *form = dt_masks_get_from_id(self->dev, grpt->formid);
+      if(form)
+      {
+        const int length = dt_masks_group_get_hash_buffer_length(form);
+        char *str = malloc(length);
+        if(str)
+        {
+          dt_masks_group_get_hash_buffer(form, str);
+          for(int k = 0; k < length; k++) hash = ((hash << 5) + hash) ^ str[k];
+          free(str);
+        }
+        else
+          local = 0;
+        int *area = spot_area[spots];
+        if(!dt_masks_get_area(self, piece, form, &area[2], &area[3], &area[0], &area[1])) local = 0;
+      }
+      spot_hash[spots] = hash;
+    }
+  }
+
+  if(d->spots >= 0)
+  {
+    if(!local || memcmp(&d->blend, piece->blendop_data, sizeof(dt_develop_blend_params_t)))
+      dt_dev_pixelpipe_dirty_region(pipe, self, NULL);
+    else
+    {
+      for(int i = 0; i < spots; i++)
+      {
+        int j = 0;
+        while(j < d->spots && d->spot_id[j] != spot_id[i]) j++;
+        if(j < d->spots && d->spot_hash[j] == spot_hash[i]) continue;
+        dt_dev_pixelpipe_dirty_region(pipe, self, spot_area[i]);
+        if(j < d->spots) dt_dev_pixelpipe_dirty_region(pipe, self, d->spot_area[j]);
+      }
+      for(int j = 0; j < d->spots; j++)
+      {
+        int i = 0;
+        while(i < spots && spot_id[i] != d->spot_id[j]) i++;
+        if(i == spots) dt_dev_pixelpipe_dirty_region(pipe, self, d->spot_area[j]);
+      }
+    }
+  }
+
+  d->spots = spots;
+  memcpy(d->spot_id, spot_id, sizeof(int) * spots);
+  memcpy(d->spot_hash, spot_hash, sizeof(uint64_t) * spots);
+  memcpy(d->spot_area, spot_area, sizeof(spot_area[0]) * spots);
+  memcpy(&d->blend, piece->blendop_data, sizeof(dt_develop_blend_params_t));
+}
+
 void commit_params(struct dt_iop_module_t *self, dt_iop_params_t *params, dt_dev_pixelpipe_t *pipe,
                    dt_dev_pixelpipe_iop_t *piece)
 {
-  memcpy(piece->data, params, sizeof(dt_iop_spots_params_t));
+  dt_iop_spots_params_t *p = (dt_iop_spots_params_t *)params;
+  dt_iop_spots_data_t *d = (dt_iop_spots_data_t *)piece->data;
+  memcpy(d->clone_id, p->clone_id, sizeof(p->clone_id));
+  memcpy(d->clone_algo, p->clone_algo, sizeof(p->clone_algo));
+  _commit_spots(self, pipe, piece);
 }
 
 void init_pipe(struct dt_iop_module_t *self, dt_dev_pixelpipe_t *pipe, dt_dev_pixelpipe_iop_t *piece)
 {
-  piece->data = malloc(sizeof(dt_iop_spots_data_t));
+  piece->data = calloc(1, sizeof(dt_iop_spots_data_t));
+  ((dt_iop_spots_data_t *)piece->data)->spots = -1;
   self->commit_params(self, self->default_params, pipe, piece);
 }
 
@@ -139,6 +139,8 @@ typedef struct dt_iop_tonecurve_data_t
   float unbounded_coeffs_ab[12]; // approximation for extrapolation of ab (left and right)
   int autoscale_ab;
   int unbound_ab;
+  dt_iop_tonecurve_params_t params; // the tables were computed from, if params_valid
+  int params_valid;
 } dt_iop_tonecurve_data_t;
 
 typedef struct dt_iop_tonecurve_global_data_t
@@ -160,7 +162,7 @@ int groups()
 
 int flags()
 {
-  return IOP_FLAGS_SUPPORTS_BLENDING | IOP_FLAGS_ALLOW_TILING;
+  return IOP_FLAGS_SUPPORTS_BLENDING | IOP_FLAGS_ALLOW_TILING | IOP_FLAGS_POINTWISE;
 }
 
 int legacy_params(dt_iop_module_t *self, const void *const old_params, const int old_version,
@@ -307,6 +309,28 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
     float *in = ((float *)i) + (size_t)k * ch * width;
     float *out = ((float *)o) + (size_t)k * ch * width;
 
+    if(autoscale_ab == s_scale_automatic_xyz || autoscale_ab == s_scale_automatic_rgb)
+    {
+      // the curve applies to the XYZ or rgb channels, convert the whole line at once with out holding those
+      if(autoscale_ab == s_scale_automatic_xyz)
+        dt_Lab_to_XYZ_array(in, out, width);
+      else
+        dt_Lab_to_prophotorgb_array(in, out, width);
+      for(int j = 0; j < width; j++)
+        for(int c = 0; c < 3; c++)
+        {
+          const float v = out[ch * j + c];
+          out[ch * j + c] = (v < xm_L) ? d->table[ch_L][CLAMP((int)(v * 0x10000ul), 0, 0xffff)]
+                                       : dt_iop_eval_exp(d->unbounded_coeffs_L, v);
+        }
+      if(autoscale_ab == s_scale_automatic_xyz)
+        dt_XYZ_to_Lab_array(out, out, width);
+      else
+        dt_prophotorgb_to_Lab_array(out, out, width);
+      for(int j = 0; j < width; j++) out[ch * j + 3] = in[ch * j + 3];
+      continue;
+    }
+
     for(int j = 0; j < width; j++, in += ch, out += ch)
     {
       const float L_in = in[0] / 100.0f;
@@ -353,24 +377,6 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
           out[2] = in[2] * low_approximation;
         }
       }
-      else if(autoscale_ab == s_scale_automatic_xyz)
-      {
-        float XYZ[3];
-        dt_Lab_to_XYZ(in, XYZ);
-        for(int c=0;c<3;c++)
-          XYZ[c] = (XYZ[c] < xm_L) ? d->table[ch_L][CLAMP((int)(XYZ[c] * 0x10000ul), 0, 0xffff)]
-                                   : dt_iop_eval_exp(d->unbounded_coeffs_L, XYZ[c]);
-        dt_XYZ_to_Lab(XYZ, out);
-      }
-      else if(autoscale_ab == s_scale_automatic_rgb)
-      {
-        float rgb[3] = {0, 0, 0};
-        dt_Lab_to_prophotorgb(in, rgb);
-        for(int c=0;c<3;c++)
-          rgb[c] = (rgb[c] < xm_L) ? d->table[ch_L][CLAMP((int)(rgb[c] * 0x10000ul), 0, 0xffff)]
-                                   : dt_iop_eval_exp(d->unbounded_coeffs_L, rgb[c]);
-        dt_prophotorgb_to_Lab(rgb, out);
-      }
 
       out[3] = in[3];
     }
@@ -498,6 +504,11 @@ void commit_params(struct dt_iop_module_t *self, dt_iop_params_t *p1, dt_dev_pix
   else
     piece->request_histogram &= ~(DT_REQUEST_ON);
 
+  piece->process_cl_ready = 1;
+
+  // the pipe commits all modules on many occasions, the tables only change with the parameters
+  if(d->params_valid && !memcmp(&d->params, p, sizeof(dt_iop_tonecurve_params_t))) return;
+
   for(int ch = 0; ch < ch_max; ch++)
   {
     // take care of possible change of curve type or number of nodes (not yet implemented in UI)
@@ -521,7 +532,6 @@ void commit_params(struct dt_iop_module_t *self, dt_iop_params_t *p1, dt_dev_pix
   for(int k = 0; k < 0x10000; k++) d->table[ch_a][k] = d->table[ch_a][k] * 256.0f - 128.0f;
   for(int k = 0; k < 0x10000; k++) d->table[ch_b][k] = d->table[ch_b][k] * 256.0f - 128.0f;
 
-  piece->process_cl_ready = 1;
   if(p->tonecurve_autoscale_ab == s_scale_automatic_xyz)
   {
     // derive curve for XYZ:
@@ -596,6 +606,9 @@ void commit_params(struct dt_iop_module_t *self, dt_iop_params_t *p1, dt_dev_pix
                           d->table[ch_b][CLAMP((int)((1.0f - x_bl[2]) * 0x10000ul), 0, 0xffff)],
                           d->table[ch_b][CLAMP((int)((1.0f - x_bl[3]) * 0x10000ul), 0, 0xffff)] };
   dt_iop_estimate_exp(x_bl, y_bl, 4, d->unbounded_coeffs_ab + 9);
+
+  d->params = *p;
+  d->params_valid = 1;
 }
 
 void init_pipe(struct dt_iop_module_t *self, dt_dev_pixelpipe_t *pipe, dt_dev_pixelpipe_iop_t *piece)
@@ -606,6 +619,7 @@ void init_pipe(struct dt_iop_module_t *self, dt_dev_pixelpipe_t *pipe, dt_dev_pi
   piece->data = (void *)d;
   d->autoscale_ab = s_scale_automatic;
   d->unbound_ab = 1;
+  d->params_valid = 0;
   for(int ch = 0; ch < ch_max; ch++)
   {
     d->curve[ch] = dt_draw_curve_new(0.0, 1.0, default_params->tonecurve_type[ch]);
@@ -38,9 +38,14 @@ extern "C" {
 #include <string.h>
 
 #include "bauhaus/bauhaus.h"
+#include "common/bilateral.h"
+#include "common/bilateralcl.h"
+#include "common/opencl.h"
+#include "control/conf.h"
 #include "control/control.h"
 #include "develop/develop.h"
 #include "develop/imageop.h"
+#include "develop/tiling.h"
 #include "gui/accelerators.h"
 #include "gui/gtk.h"
 #include "iop/iop_api.h"
@@ -66,8 +71,19 @@ typedef struct dt_iop_tonemapping_gui_data_t
 typedef struct dt_iop_tonemapping_data_t
 {
   float contrast, Fsize;
+  PermutohedralLattice<3, 2> *lattice; // of the last run, reused to not allocate it again
 } dt_iop_tonemapping_data_t;
 
+typedef struct dt_iop_tonemapping_global_data_t
+{
+  int kernel_tonemap_log;
+  int kernel_tonemap_apply;
+} dt_iop_tonemapping_global_data_t;
+
+// the opencl path filters TONEMAP_CL_SCALE * (log(L) - log(1e-6)) with the bilateral grid, which only
+// covers values in [0, 100]. the range sigma of 0.4 in log units is scaled the same way.
+#define TONEMAP_CL_SCALE 5.0f
+
 const char *name()
 {
   return _("tone mapping");
@@ -81,7 +97,7 @@ int groups()
 
 int flags()
 {
-  return IOP_FLAGS_SUPPORTS_BLENDING;
+  return IOP_FLAGS_SUPPORTS_BLENDING | IOP_FLAGS_NO_TILE_STREAMING;
 }
 
 void init_key_accels(dt_iop_module_so_t *self)
@@ -98,44 +114,103 @@ void connect_key_accels(dt_iop_module_t *self)
   dt_accel_connect_slider_iop(self, "spatial extent", GTK_WIDGET(g->Fsize));
 }
 
+// spatial sigma of the filter in pixels of the region of interest
+static float tonemap_sigma_s(const dt_iop_tonemapping_data_t *const data, dt_dev_pixelpipe_iop_t *piece,
+                             const dt_iop_roi_t *const roi_out)
+{
+  const float iw = piece->buf_in.width * roi_out->scale;
+  const float ih = piece->buf_in.height * roi_out->scale;
+  return fmaxf(3.0f, (data->Fsize / 100.0) * fminf(iw, ih));
+}
+
+// bilinear lookup in the lw x lh base layer, at x and y in its pixels
+static inline float tonemap_upsample(const float *const base, const int lw, const int lh, float x, float y)
+{
+  x = CLAMPS(x, 0.0f, lw - 1);
+  y = CLAMPS(y, 0.0f, lh - 1);
+  const int x0 = MIN((int)x, MAX(lw - 2, 0)), y0 = MIN((int)y, MAX(lh - 2, 0));
+  const int x1 = MIN(x0 + 1, lw - 1), y1 = MIN(y0 + 1, lh - 1);
+  const float fx = x - x0, fy = y - y0;
+  const float top = base[(size_t)y0 * lw + x0] + fx * (base[(size_t)y0 * lw + x1] - base[(size_t)y0 * lw + x0]);
+  const float bottom
+      = base[(size_t)y1 * lw + x0] + fx * (base[(size_t)y1 * lw + x1] - base[(size_t)y1 * lw + x0]);
+  return top + fy * (bottom - top);
+}
+
+// also process the clipping point, as good as we can without knowing
+// the local environment (i.e. assuming detail == 0)
+static void tonemap_processed_maximum(dt_dev_pixelpipe_iop_t *piece, const float contr)
+{
+  float *pmax = piece->pipe->dsc.processed_maximum;
+  float L = 0.2126 * pmax[0] + 0.7152 * pmax[1] + 0.0722 * pmax[2];
+  if(L <= 0.0) L = 1e-6;
+  L = logf(L);
+  const float Ln = expf(L * (contr - 1.0f) - 1.0f);
+  for(int k = 0; k < 3; k++) pmax[k] *= Ln;
+}
+
 void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *const ivoid,
              void *const ovoid, const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
 {
   dt_iop_tonemapping_data_t *data = (dt_iop_tonemapping_data_t *)piece->data;
   const int ch = piece->colors;
 
-  int width, height;
-  float inv_sigma_s;
+  const float inv_sigma_s = 1.0f / tonemap_sigma_s(data, piece, roi_out);
   const float inv_sigma_r = 1.0 / 0.4;
 
-  width = roi_in->width;
-  height = roi_in->height;
-  const size_t size = (size_t)width * height;
-  const float iw = piece->buf_in.width * roi_out->scale;
-  const float ih = piece->buf_in.height * roi_out->scale;
+  const int width = roi_in->width;
+  const int height = roi_in->height;
 
-  inv_sigma_s = (data->Fsize / 100.0) * fminf(iw, ih);
-  if(inv_sigma_s < 3.0) inv_sigma_s = 3.0;
-  inv_sigma_s = 1.0 / inv_sigma_s;
+  // the preview only has to look right, there the base layer is filtered at half resolution and upsampled
+  int ds = (piece->pipe->type == DT_DEV_PIXELPIPE_PREVIEW
+            && dt_conf_get_bool("plugins/darkroom/tonemap/preview_downsample")) ? 2 : 1;
+  const int lw = (width + ds - 1) / ds, lh = (height + ds - 1) / ds;
+  float *base = NULL;
+  if(ds > 1)
+  {
+    base = (float *)dt_alloc_align(64, sizeof(float) * lw * lh);
+    if(!base) ds = 1;
+  }
+  const int swidth = ds > 1 ? lw : width, sheight = ds > 1 ? lh : height;
+  const size_t size = (size_t)swidth * sheight;
 
-  PermutohedralLattice<3, 2> lattice(size, omp_get_max_threads());
+  const int nthreads = omp_get_max_threads();
+  if(data->lattice && data->lattice->threads() != nthreads)
+  {
+    delete data->lattice;
+    data->lattice = NULL;
+  }
+  if(data->lattice)
+    data->lattice->reset(size);
+  else
+    data->lattice = new PermutohedralLattice<3, 2>(size, nthreads);
+  PermutohedralLattice<3, 2> &lattice = *data->lattice;
 
 // Build I=log(L)
 // and splat into the lattice
 #ifdef _OPENMP
 #pragma omp parallel for shared(lattice)
 #endif
-  for(int j = 0; j < height; j++)
+  for(int j = 0; j < sheight; j++)
   {
-    size_t index = (size_t)j * width;
+    size_t index = (size_t)j * swidth;
     const int thread = omp_get_thread_num();
-    const float *in = (const float *)ivoid + (size_t)j * width * ch;
-    for(int i = 0; i < width; i++, index++, in += ch)
+    for(int i = 0; i < swidth; i++, index++)
     {
-      float L = 0.2126 * in[0] + 0.7152 * in[1] + 0.0722 * in[2];
-      if(L <= 0.0) L = 1e-6;
-      L = logf(L);
-      float pos[3] = { i * inv_sigma_s, j * inv_sigma_s, L * inv_sigma_r };
+      // mean of log(L) over the ds x ds block
+      float L = 0.0f;
+      int cnt = 0;
+      for(int y = j * ds; y < MIN((j + 1) * ds, height); y++)
+        for(int x = i * ds; x < MIN((i + 1) * ds, width); x++, cnt++)
+        {
+          const float *in = (const float *)ivoid + ((size_t)y * width + x) * ch;
+          float Lp = 0.2126 * in[0] + 0.7152 * in[1] + 0.0722 * in[2];
+          if(Lp <= 0.0) Lp = 1e-6;
+          L += logf(Lp);
+        }
+      L /= cnt;
+      const float x = i * ds + 0.5f * (ds - 1), y = j * ds + 0.5f * (ds - 1);
+      float pos[3] = { x * inv_sigma_s, y * inv_sigma_s, L * inv_sigma_r };
       float val[2] = { L, 1.0 };
       lattice.splat(pos, val, index, thread);
     }
@@ -146,6 +221,19 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
   // blur the lattice
   lattice.blur();
 
+  if(ds > 1)
+  {
+#ifdef _OPENMP
+#pragma omp parallel for shared(lattice)
+#endif
+    for(size_t k = 0; k < size; k++)
+    {
+      float val[2];
+      lattice.slice(val, k);
+      base[k] = val[0] / val[1];
+    }
+  }
+
   //
   // Durand process :
   // r=R/(input intensity), g=G/input intensity, B=B/input intensity
@@ -177,12 +265,18 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
     float *out = (float *)ovoid + (size_t)j * width * ch;
     for(int i = 0; i < width; i++, index++, in += ch, out += ch)
     {
-      float val[2];
-      lattice.slice(val, index);
       float L = 0.2126 * in[0] + 0.7152 * in[1] + 0.0722 * in[2];
       if(L <= 0.0) L = 1e-6;
       L = logf(L);
-      const float B = val[0] / val[1];
+      float B;
+      if(ds > 1)
+        B = tonemap_upsample(base, lw, lh, (i + 0.5f) / ds - 0.5f, (j + 0.5f) / ds - 0.5f);
+      else
+      {
+        float val[2];
+        lattice.slice(val, index);
+        B = val[0] / val[1];
+      }
       const float detail = L - B;
       const float Ln = expf(B * (contr - 1.0f) + detail - 1.0f);
 
@@ -192,14 +286,98 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
       out[3] = in[3];
     }
   }
-  // also process the clipping point, as good as we can without knowing
-  // the local environment (i.e. assuming detail == 0)
-  float *pmax = piece->pipe->dsc.processed_maximum;
-  float L = 0.2126 * pmax[0] + 0.7152 * pmax[1] + 0.0722 * pmax[2];
-  if(L <= 0.0) L = 1e-6;
-  L = logf(L);
-  const float Ln = expf(L * (contr - 1.0f) - 1.0f);
-  for(int k = 0; k < 3; k++) pmax[k] *= Ln;
+  dt_free_align(base);
+  tonemap_processed_maximum(piece, contr);
+}
+
+#ifdef HAVE_OPENCL
+int process_cl(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, cl_mem dev_in, cl_mem dev_out,
+               const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
+{
+  dt_iop_tonemapping_data_t *d = (dt_iop_tonemapping_data_t *)piece->data;
+  dt_iop_tonemapping_global_data_t *gd = (dt_iop_tonemapping_global_data_t *)self->data;
+
+  const int devid = piece->pipe->devid;
+  const int width = roi_in->width;
+  const int height = roi_in->height;
+  const float sigma_s = tonemap_sigma_s(d, piece, roi_out);
+  const float sigma_r = TONEMAP_CL_SCALE * 0.4f;
+  const float contr = 1.0f / d->contrast;
+  size_t sizes[] = { ROUNDUPWD(width), ROUNDUPHT(height), 1 };
+
+  cl_int err = -999;
+  dt_bilateral_cl_t *b = NULL;
+  cl_mem dev_log = NULL;
+  cl_mem dev_base = NULL;
+
+  dev_log = dt_opencl_alloc_device(devid, width, height, sizeof(float));
+  dev_base = dt_opencl_alloc_device(devid, width, height, sizeof(float));
+  if(dev_log == NULL || dev_base == NULL) goto error;
+
+  dt_opencl_set_kernel_arg(devid, gd->kernel_tonemap_log, 0, sizeof(cl_mem), (void *)&dev_in);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_tonemap_log, 1, sizeof(cl_mem), (void *)&dev_log);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_tonemap_log, 2, sizeof(int), (void *)&width);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_tonemap_log, 3, sizeof(int), (void *)&height);
+  err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_tonemap_log, sizes);
+  if(err != CL_SUCCESS) goto error;
+
+  // the base layer: the bilateral filtered log luminance, which is what slicing with detail -1 returns
+  b = dt_bilateral_init_cl(devid, width, height, sigma_s, sigma_r);
+  if(!b) goto error;
+  err = dt_bilateral_splat_cl(b, dev_log);
+  if(err != CL_SUCCESS) goto error;
+  err = dt_bilateral_blur_cl(b);
+  if(err != CL_SUCCESS) goto error;
+  err = dt_bilateral_slice_cl(b, dev_log, dev_base, -1.0f);
+  if(err != CL_SUCCESS) goto error;
+  dt_bilateral_free_cl(b);
+  b = NULL;
+
+  dt_opencl_set_kernel_arg(devid, gd->kernel_tonemap_apply, 0, sizeof(cl_mem), (void *)&dev_in);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_tonemap_apply, 1, sizeof(cl_mem), (void *)&dev_base);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_tonemap_apply, 2, sizeof(cl_mem), (void *)&dev_out);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_tonemap_apply, 3, sizeof(int), (void *)&width);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_tonemap_apply, 4, sizeof(int), (void *)&height);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_tonemap_apply, 5, sizeof(float), (void *)&contr);
+  err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_tonemap_apply, sizes);
+  if(err != CL_SUCCESS) goto error;
+
+  dt_opencl_release_mem_object(dev_log);
+  dt_opencl_release_mem_object(dev_base);
+  tonemap_processed_maximum(piece, contr);
+  return TRUE;
+
+error:
+  dt_bilateral_free_cl(b);
+  if(dev_log != NULL) dt_opencl_release_mem_object(dev_log);
+  if(dev_base != NULL) dt_opencl_release_mem_object(dev_base);
+  dt_print(DT_DEBUG_OPENCL, "[opencl_tonemap] couldn't enqueue kernel! %d\n", err);
+  return FALSE;
+}
+#endif
+
+void tiling_callback(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece,
+                     const dt_iop_roi_t *roi_in, const dt_iop_roi_t *roi_out,
+                     struct dt_develop_tiling_t *tiling)
+{
+  dt_iop_tonemapping_data_t *d = (dt_iop_tonemapping_data_t *)piece->data;
+  const float sigma_s = tonemap_sigma_s(d, piece, roi_out);
+  const float sigma_r = TONEMAP_CL_SCALE * 0.4f;
+
+  const int width = roi_in->width;
+  const int height = roi_in->height;
+  const int channels = piece->colors;
+
+  const size_t basebuffer = (size_t)width * height * channels * sizeof(float);
+
+  // input, output and the two single channel buffers of the opencl path, plus the grid
+  tiling->factor = 2.5f + (float)dt_bilateral_memory_use(width, height, sigma_s, sigma_r) / basebuffer;
+  tiling->maxbuf
+      = fmax(1.0f, (float)dt_bilateral_singlebuffer_size(width, height, sigma_s, sigma_r) / basebuffer);
+  tiling->overhead = 0;
+  tiling->overlap = ceilf(4 * sigma_s);
+  tiling->xalign = 1;
+  tiling->yalign = 1;
 }
 
 
@@ -230,16 +408,22 @@ void commit_params(struct dt_iop_module_t *self, dt_iop_params_t *p1, dt_dev_pix
   dt_iop_tonemapping_data_t *d = (dt_iop_tonemapping_data_t *)piece->data;
   d->contrast = p->contrast;
   d->Fsize = p->Fsize;
+
+#ifdef HAVE_OPENCL
+  piece->process_cl_ready = (piece->process_cl_ready && !(darktable.opencl->avoid_atomics));
+#endif
 }
 
 void init_pipe(struct dt_iop_module_t *self, dt_dev_pixelpipe_t *pipe, dt_dev_pixelpipe_iop_t *piece)
 {
   piece->data = malloc(sizeof(dt_iop_tonemapping_data_t));
+  ((dt_iop_tonemapping_data_t *)piece->data)->lattice = NULL;
   self->commit_params(self, self->default_params, pipe, piece);
 }
 
 void cleanup_pipe(struct dt_iop_module_t *self, dt_dev_pixelpipe_t *pipe, dt_dev_pixelpipe_iop_t *piece)
 {
+  delete ((dt_iop_tonemapping_data_t *)piece->data)->lattice;
   free(piece->data);
   piece->data = NULL;
 }
@@ -277,6 +461,25 @@ void cleanup(dt_iop_module_t *module)
   module->params = NULL;
 }
 
+void init_global(dt_iop_module_so_t *module)
+{
+  const int program = 28; // tonemap.cl, from programs.conf
+  dt_iop_tonemapping_global_data_t *gd
+      = (dt_iop_tonemapping_global_data_t *)malloc(sizeof(dt_iop_tonemapping_global_data_t));
+  module->data = gd;
+  gd->kernel_tonemap_log = dt_opencl_create_kernel(program, "tonemap_log");
+  gd->kernel_tonemap_apply = dt_opencl_create_kernel(program, "tonemap_apply");
+}
+
+void cleanup_global(dt_iop_module_so_t *module)
+{
+  dt_iop_tonemapping_global_data_t *gd = (dt_iop_tonemapping_global_data_t *)module->data;
+  dt_opencl_free_kernel(gd->kernel_tonemap_log);
+  dt_opencl_free_kernel(gd->kernel_tonemap_apply);
+  free(module->data);
+  module->data = NULL;
+}
+
 void gui_init(struct dt_iop_module_t *self)
 {
   self->gui_data = malloc(sizeof(dt_iop_tonemapping_gui_data_t));
@@ -39,10 +39,17 @@
 #endif
 
 #include "common/file_location.h"
+#include "common/memory.h"
 #include "common/metadata.h"
 #include "common/utility.h"
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 #define CLIP(x) ((x < 0) ? 0.0 : (x > 1.0) ? 1.0 : x)
+// rendered watermarks kept for reuse
+#define DT_WATERMARK_OVERLAYS 4
 DT_MODULE_INTROSPECTION(4, dt_iop_watermark_params_t)
 
 // gchar *checksum = g_compute_checksum_for_data(G_CHECKSUM_MD5,data,length);
@@ -93,6 +100,14 @@ typedef struct dt_iop_watermark_data_t
   char font[64];
 } dt_iop_watermark_data_t;
 
+typedef struct dt_iop_watermark_global_data_t
+{
+  dt_pthread_mutex_t lock; // protects the overlays
+  GList *overlays;         // dt_iop_watermark_overlay_t, most recently used first
+  size_t overlays_size;    // bytes held by them
+  dt_memory_consumer_t memory;
+} dt_iop_watermark_global_data_t;
+
 typedef struct dt_iop_watermark_gui_data_t
 {
   GtkWidget *watermarks;                             // watermark
@@ -773,22 +788,63 @@ static gchar *_watermark_get_svgdoc(dt_iop_module_t *self, dt_iop_watermark_data
   return svgdoc;
 }
 
-void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *const ivoid,
-             void *const ovoid, const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
+// the geometry a rendering depends on besides the svg text, compared with memcmp()
+typedef struct dt_iop_watermark_overlay_key_t
 {
-  dt_iop_watermark_data_t *data = (dt_iop_watermark_data_t *)piece->data;
-  float *in = (float *)ivoid;
-  float *out = (float *)ovoid;
-  const int ch = piece->colors;
-  double angle = (M_PI / 180) * -data->rotate;
+  float scale, xoffset, yoffset, rotate, roi_scale;
+  int alignment, sizeto;
+  int width, height, buf_width, buf_height, roi_x, roi_y;
+} dt_iop_watermark_overlay_key_t;
 
-  /* Load svg if not loaded */
-  gchar *svgdoc = _watermark_get_svgdoc(self, data, &piece->pipe->image);
-  if(!svgdoc)
-  {
-    memcpy(ovoid, ivoid, (size_t)sizeof(float) * ch * roi_out->width * roi_out->height);
-    return;
-  }
+// a rendered watermark, cropped to the pixels it covers
+typedef struct dt_iop_watermark_overlay_t
+{
+  dt_iop_watermark_overlay_key_t key;
+  gchar *svgdoc;
+  int x, y, width, height; // of the crop in the output
+  int stride;              // in bytes
+  guint8 *pixels;          // premultiplied cairo ARGB32, NULL if the watermark is outside the image
+} dt_iop_watermark_overlay_t;
+
+static size_t _overlay_size(const dt_iop_watermark_overlay_t *o)
+{
+  return sizeof(dt_iop_watermark_overlay_t) + strlen(o->svgdoc) + (size_t)o->stride * o->height;
+}
+
+static void _overlay_free(dt_iop_watermark_overlay_t *o)
+{
+  if(!o) return;
+  g_free(o->svgdoc);
+  g_free(o->pixels);
+  g_free(o);
+}
+
+static size_t _overlays_memory_usage(void *data)
+{
+  dt_iop_watermark_global_data_t *gd = (dt_iop_watermark_global_data_t *)data;
+  return gd->overlays_size;
+}
+
+static size_t _overlays_memory_reclaim(void *data, size_t wanted)
+{
+  dt_iop_watermark_global_data_t *gd = (dt_iop_watermark_global_data_t *)data;
+  dt_pthread_mutex_lock(&gd->lock);
+  GList *overlays = gd->overlays;
+  const size_t freed = gd->overlays_size;
+  gd->overlays = NULL;
+  gd->overlays_size = 0;
+  dt_pthread_mutex_unlock(&gd->lock);
+  g_list_free_full(overlays, (GDestroyNotify)_overlay_free);
+  return freed;
+}
+
+// renders svgdoc the way it is placed in the output and crops it to what is not transparent
+static dt_iop_watermark_overlay_t *_watermark_render(dt_dev_pixelpipe_iop_t *piece,
+                                                     const dt_iop_watermark_data_t *const data,
+                                                     const gchar *svgdoc, const dt_iop_roi_t *const roi_in,
+                                                     const dt_iop_roi_t *const roi_out)
+{
+  double angle = (M_PI / 180) * -data->rotate;
 
   /* setup stride for performance */
   int stride = cairo_format_stride_for_width(CAIRO_FORMAT_ARGB32, roi_out->width);
@@ -801,8 +857,7 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
   {
     //   fprintf(stderr,"Cairo surface error: %s\n",cairo_status_to_string(cairo_surface_status(surface)));
     g_free(image);
-    memcpy(ovoid, ivoid, (size_t)sizeof(float) * ch * roi_out->width * roi_out->height);
-    return;
+    return NULL;
   }
 
   /* create cairo context and setup transformation/scale */
@@ -814,15 +869,16 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
   /* create the rsvghandle from parsed svg data */
   GError *error = NULL;
   RsvgHandle *svg = rsvg_handle_new_from_data((const guint8 *)svgdoc, strlen(svgdoc), &error);
-  g_free(svgdoc);
   if(!svg || error)
   {
-    g_free(image);
-    memcpy(ovoid, ivoid, (size_t)sizeof(float) * ch * roi_out->width * roi_out->height);
     dt_pthread_mutex_unlock(&darktable.plugin_threadsafe);
-    fprintf(stderr, "[watermark] error processing svg file: %s\n", error->message);
-    g_error_free(error);
-    return;
+    cairo_destroy(cr);
+    cairo_surface_destroy(surface);
+    g_free(image);
+    fprintf(stderr, "[watermark] error processing svg file: %s\n", error ? error->message : "unknown error");
+    if(error) g_error_free(error);
+    if(svg) g_object_unref(svg);
+    return NULL;
   }
 
   /* get the dimension of svg */
@@ -961,35 +1017,157 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
 
   /* ensure that all operations on surface finishing up */
   cairo_surface_flush(surface);
+  cairo_surface_destroy(surface);
+  g_object_unref(svg);
 
-  /* render surface on output */
-  guint8 *sd = image;
-  float opacity = data->opacity / 100.0;
-  /*
-  #ifdef _OPENMP
-    #pragma omp parallel for default(none) shared(in, out,sd,opacity) schedule(static)
-  #endif
-  */
+  // most of a watermark is transparent, only the bounding box of the rest is kept
+  int x0 = roi_out->width, x1 = -1, y0 = roi_out->height, y1 = -1;
   for(int j = 0; j < roi_out->height; j++)
-    for(int i = 0; i < roi_out->width; i++)
+  {
+    const uint32_t *row = (const uint32_t *)(image + (size_t)stride * j);
+    int first = 0, last = roi_out->width - 1;
+    while(first <= last && !row[first]) first++;
+    if(first > last) continue;
+    while(!row[last]) last--;
+    x0 = MIN(x0, first);
+    x1 = MAX(x1, last);
+    y0 = MIN(y0, j);
+    y1 = j;
+  }
+
+  dt_iop_watermark_overlay_t *o = (dt_iop_watermark_overlay_t *)g_malloc0(sizeof(dt_iop_watermark_overlay_t));
+  if(x1 >= x0)
+  {
+    o->x = x0;
+    o->y = y0;
+    o->width = x1 - x0 + 1;
+    o->height = y1 - y0 + 1;
+    o->stride = 4 * o->width;
+    o->pixels = (guint8 *)g_malloc_n(o->height, o->stride);
+    for(int j = 0; j < o->height; j++)
+      memcpy(o->pixels + (size_t)o->stride * j, image + (size_t)stride * (y0 + j) + 4 * x0, o->stride);
+  }
+  g_free(image);
+  return o;
+}
+
+// out = (1 - alpha) * in + opacity * overlay over the crop, everything else is copied already
+static void _watermark_blend(const dt_iop_watermark_overlay_t *const o, const float *const in,
+                             float *const out, const int width, const int ch, const float opacity)
+{
+  if(!o->pixels) return;
+#ifdef _OPENMP
+#pragma omp parallel for default(none) schedule(static)
+#endif
+  for(int j = 0; j < o->height; j++)
+  {
+    const size_t offset = (size_t)ch * ((size_t)width * (o->y + j) + o->x);
+    const float *inp = in + offset;
+    float *outp = out + offset;
+    const guint8 *sd = o->pixels + (size_t)o->stride * j;
+#if defined(__SSE2__)
+    if(ch == 4)
     {
-      float alpha = (sd[3] / 255.0) * opacity;
+      const __m128i zero = _mm_setzero_si128();
       /* svg uses a premultiplied alpha, so only use opacity for the blending */
-      out[0] = ((1.0 - alpha) * in[0]) + (opacity * (sd[2] / 255.0));
-      out[1] = ((1.0 - alpha) * in[1]) + (opacity * (sd[1] / 255.0));
-      out[2] = ((1.0 - alpha) * in[2]) + (opacity * (sd[0] / 255.0));
-      out[3] = in[3];
-
-      out += ch;
-      in += ch;
-      sd += 4;
+      const __m128 scale = _mm_set_ps(0.0f, opacity / 255.0f, opacity / 255.0f, opacity / 255.0f);
+      const __m128 one = _mm_set1_ps(1.0f);
+      for(int i = 0; i < o->width; i++, inp += 4, outp += 4, sd += 4)
+      {
+        uint32_t argb;
+        memcpy(&argb, sd, sizeof(argb));
+        const __m128i b = _mm_cvtsi32_si128((int)argb);
+        // bgra to rgba
+        __m128 px = _mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_unpacklo_epi8(b, zero), zero));
+        px = _mm_shuffle_ps(px, px, _MM_SHUFFLE(3, 0, 1, 2));
+        const __m128 alpha = _mm_shuffle_ps(px, px, _MM_SHUFFLE(3, 3, 3, 3));
+        const __m128 keep = _mm_sub_ps(one, _mm_mul_ps(alpha, scale));
+        _mm_storeu_ps(outp, _mm_add_ps(_mm_mul_ps(keep, _mm_loadu_ps(inp)), _mm_mul_ps(scale, px)));
+      }
+      continue;
     }
+#endif
+    for(int i = 0; i < o->width; i++, inp += ch, outp += ch, sd += 4)
+    {
+      const float alpha = (sd[3] / 255.0f) * opacity;
+      /* svg uses a premultiplied alpha, so only use opacity for the blending */
+      outp[0] = ((1.0f - alpha) * inp[0]) + (opacity * (sd[2] / 255.0f));
+      outp[1] = ((1.0f - alpha) * inp[1]) + (opacity * (sd[1] / 255.0f));
+      outp[2] = ((1.0f - alpha) * inp[2]) + (opacity * (sd[0] / 255.0f));
+    }
+  }
+}
+
+void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *const ivoid,
+             void *const ovoid, const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
+{
+  dt_iop_watermark_data_t *data = (dt_iop_watermark_data_t *)piece->data;
+  dt_iop_watermark_global_data_t *gd = (dt_iop_watermark_global_data_t *)self->data;
+  const float *in = (const float *)ivoid;
+  float *out = (float *)ovoid;
+  const int ch = piece->colors;
+  const float opacity = data->opacity / 100.0;
 
+  memcpy(ovoid, ivoid, (size_t)sizeof(float) * ch * roi_out->width * roi_out->height);
 
-  /* clean up */
-  cairo_surface_destroy(surface);
-  g_object_unref(svg);
-  g_free(image);
+  /* Load svg if not loaded */
+  gchar *svgdoc = _watermark_get_svgdoc(self, data, &piece->pipe->image);
+  if(!svgdoc) return;
+
+  dt_iop_watermark_overlay_key_t key;
+  memset(&key, 0, sizeof(key));
+  key.scale = data->scale;
+  key.xoffset = data->xoffset;
+  key.yoffset = data->yoffset;
+  key.rotate = data->rotate;
+  key.roi_scale = roi_out->scale;
+  key.alignment = data->alignment;
+  key.sizeto = data->sizeto;
+  key.width = roi_out->width;
+  key.height = roi_out->height;
+  key.buf_width = piece->buf_in.width;
+  key.buf_height = piece->buf_in.height;
+  key.roi_x = roi_in->x;
+  key.roi_y = roi_in->y;
+
+  // exports of many images with the same watermark render it once
+  dt_pthread_mutex_lock(&gd->lock);
+  for(GList *l = gd->overlays; l; l = g_list_next(l))
+  {
+    dt_iop_watermark_overlay_t *o = (dt_iop_watermark_overlay_t *)l->data;
+    if(memcmp(&o->key, &key, sizeof(key)) || strcmp(o->svgdoc, svgdoc)) continue;
+    gd->overlays = g_list_remove_link(gd->overlays, l);
+    gd->overlays = g_list_concat(l, gd->overlays);
+    _watermark_blend(o, in, out, roi_out->width, ch, opacity);
+    dt_pthread_mutex_unlock(&gd->lock);
+    g_free(svgdoc);
+    return;
+  }
+  dt_pthread_mutex_unlock(&gd->lock);
+
+  dt_iop_watermark_overlay_t *o = _watermark_render(piece, data, svgdoc, roi_in, roi_out);
+  if(!o)
+  {
+    g_free(svgdoc);
+    return;
+  }
+  o->key = key;
+  o->svgdoc = svgdoc;
+  _watermark_blend(o, in, out, roi_out->width, ch, opacity);
+
+  GList *evicted = NULL;
+  dt_pthread_mutex_lock(&gd->lock);
+  gd->overlays = g_list_prepend(gd->overlays, o);
+  gd->overlays_size += _overlay_size(o);
+  for(GList *last; g_list_length(gd->overlays) > DT_WATERMARK_OVERLAYS;)
+  {
+    last = g_list_last(gd->overlays);
+    gd->overlays_size -= _overlay_size((dt_iop_watermark_overlay_t *)last->data);
+    gd->overlays = g_list_remove_link(gd->overlays, last);
+    evicted = g_list_concat(last, evicted);
+  }
+  dt_pthread_mutex_unlock(&gd->lock);
+  g_list_free_full(evicted, (GDestroyNotify)_overlay_free);
 }
 
 static void watermark_callback(GtkWidget *tb, gpointer user_data)
@@ -1255,6 +1433,29 @@ void gui_update(struct dt_iop_module_t *self)
   gtk_font_button_set_font_name(GTK_FONT_BUTTON(g->fontsel), p->font);
 }
 
+void init_global(dt_iop_module_so_t *module)
+{
+  dt_iop_watermark_global_data_t *gd
+      = (dt_iop_watermark_global_data_t *)calloc(1, sizeof(dt_iop_watermark_global_data_t));
+  module->data = gd;
+  dt_pthread_mutex_init(&gd->lock, NULL);
+  gd->memory = (dt_memory_consumer_t){ .name = "watermark",
+                                       .usage = _overlays_memory_usage,
+                                       .reclaim = _overlays_memory_reclaim,
+                                       .data = gd };
+  dt_memory_register(darktable.memory, &gd->memory);
+}
+
+void cleanup_global(dt_iop_module_so_t *module)
+{
+  dt_iop_watermark_global_data_t *gd = (dt_iop_watermark_global_data_t *)module->data;
+  dt_memory_unregister(darktable.memory, &gd->memory);
+  _overlays_memory_reclaim(gd, SIZE_MAX);
+  dt_pthread_mutex_destroy(&gd->lock);
+  free(module->data);
+  module->data = NULL;
+}
+
 void init(dt_iop_module_t *module)
 {
   module->params = calloc(1, sizeof(dt_iop_watermark_params_t));
@@ -52,6 +52,8 @@
 #define CLIP(x) (((x) >= 0) ? ((x) <= 1.0 ? (x) : 1.0) : 0.0)
 DT_MODULE_INTROSPECTION(1, dt_iop_zonesystem_params_t)
 #define MAX_ZONE_SYSTEM_SIZE 24
+// longer side of the lightness the preview pipe hands to the gui for the zone preview
+#define DT_ZONESYSTEM_PREVIEW_SIZE 256
 
 /** gui params. */
 typedef struct dt_iop_zonesystem_params_t
@@ -92,9 +94,21 @@ typedef struct dt_iop_zonesystem_global_data_t
 
 typedef struct dt_iop_zonesystem_gui_data_t
 {
+  // lightness of the input of the last preview pipe run, reduced to DT_ZONESYSTEM_PREVIEW_SIZE, and the sigma
+  // of the blur at that size. set by the pipe, the lock has to be held.
+  float *preview_L;
+  int preview_width, preview_height;
+  float preview_sigma;
+  uint64_t preview_serial; // counts the changes of preview_L
+
+  // the zones of preview_L before and after the module, only used by the gui thread. made again when
+  // preview_L or the params differ from what they were made from.
   guchar *in_preview_buffer;
   guchar *out_preview_buffer;
-  int preview_width, preview_height;
+  int zones_width, zones_height;
+  uint64_t zones_serial;
+  dt_iop_zonesystem_params_t zones_params;
+
   GtkWidget *preview;
   GtkWidget *zones;
   float press_x, press_y, mouse_x, mouse_y;
@@ -166,104 +180,64 @@ static inline void _iop_zonesystem_calculate_zonemap(struct dt_iop_zonesystem_pa
 
 #define GAUSS(a, b, c, x) (a * pow(2.718281828, (-pow((x - b), 2) / (pow(c, 2)))))
 
-static void process_common_setup(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece,
-                                 const void *const ivoid, void *const ovoid, const dt_iop_roi_t *const roi_in,
-                                 const dt_iop_roi_t *const roi_out)
-{
-  const int width = roi_out->width;
-  const int height = roi_out->height;
-
-  if(self->dev->gui_attached && piece->pipe->type == DT_DEV_PIXELPIPE_PREVIEW)
-  {
-    dt_iop_zonesystem_gui_data_t *g = (dt_iop_zonesystem_gui_data_t *)self->gui_data;
-    dt_pthread_mutex_lock(&g->lock);
-    if(g->in_preview_buffer == NULL || g->out_preview_buffer == NULL || g->preview_width != width
-       || g->preview_height != height)
-    {
-      g_free(g->in_preview_buffer);
-      g_free(g->out_preview_buffer);
-      g->in_preview_buffer = g_malloc_n((size_t)width * height, sizeof(guchar));
-      g->out_preview_buffer = g_malloc_n((size_t)width * height, sizeof(guchar));
-      g->preview_width = width;
-      g->preview_height = height;
-    }
-    dt_pthread_mutex_unlock(&g->lock);
-  }
-}
-
+/* hands the lightness of the input of the preview pipe to the gui, averaged down to a size the zone preview
+ * can be made from in no time. the gui blurs it and maps it to zones when it draws. */
 static void process_common_cleanup(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece,
                                    const void *const ivoid, void *const ovoid,
                                    const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
 {
-  dt_iop_zonesystem_data_t *d = (dt_iop_zonesystem_data_t *)piece->data;
   dt_iop_zonesystem_gui_data_t *g = (dt_iop_zonesystem_gui_data_t *)self->gui_data;
 
   const int width = roi_out->width;
   const int height = roi_out->height;
   const int ch = piece->colors;
-  const int size = d->params.size;
 
   if(piece->pipe->mask_display & DT_DEV_PIXELPIPE_DISPLAY_MASK) dt_iop_alpha_copy(ivoid, ovoid, width, height);
 
-  /* if gui and have buffer lets gaussblur and fill buffer with zone indexes */
-  if(self->dev->gui_attached && piece->pipe->type == DT_DEV_PIXELPIPE_PREVIEW && g && g->in_preview_buffer
-     && g->out_preview_buffer)
-  {
-    float Lmax[] = { 100.0f };
-    float Lmin[] = { 0.0f };
-
-    /* setup gaussian kernel */
-    const int radius = 8;
-    const float sigma = 2.5 * (radius * roi_in->scale / piece->iscale);
-
-    dt_gaussian_t *gauss = dt_gaussian_init(width, height, 1, Lmax, Lmin, sigma, DT_IOP_GAUSSIAN_ZERO);
+  if(!(self->dev->gui_attached && piece->pipe->type == DT_DEV_PIXELPIPE_PREVIEW && g)) return;
 
-    float *tmp = g_malloc_n((size_t)width * height, sizeof(float));
-
-    if(gauss && tmp)
-    {
-#ifdef _OPENMP
-#pragma omp parallel for default(none) shared(tmp) schedule(static)
-#endif
-      for(size_t k = 0; k < (size_t)width * height; k++) tmp[k] = ((float *)ivoid)[ch * k];
-
-      dt_gaussian_blur(gauss, tmp, tmp);
-
-      /* create zonemap preview for input */
-      dt_pthread_mutex_lock(&g->lock);
-#ifdef _OPENMP
-#pragma omp parallel for default(none) shared(tmp, g) schedule(static)
-#endif
-      for(size_t k = 0; k < (size_t)width * height; k++)
-      {
-        g->in_preview_buffer[k] = CLAMPS(tmp[k] * (size - 1) / 100.0f, 0, size - 2);
-      }
-      dt_pthread_mutex_unlock(&g->lock);
+  const int factor = MAX(1, (MAX(width, height) + DT_ZONESYSTEM_PREVIEW_SIZE - 1) / DT_ZONESYSTEM_PREVIEW_SIZE);
+  const int wd = (width + factor - 1) / factor;
+  const int ht = (height + factor - 1) / factor;
+  const int radius = 8;
+  const float sigma = 2.5 * (radius * roi_in->scale / piece->iscale) / factor;
 
+  float *L = (float *)dt_alloc_align(64, sizeof(float) * wd * ht);
+  if(!L) return;
 
 #ifdef _OPENMP
-#pragma omp parallel for default(none) shared(tmp) schedule(static)
+#pragma omp parallel for default(none) shared(L) schedule(static)
 #endif
-      for(size_t k = 0; k < (size_t)width * height; k++) tmp[k] = ((float *)ovoid)[ch * k];
-
-      dt_gaussian_blur(gauss, tmp, tmp);
-
-
-      /* create zonemap preview for output */
-      dt_pthread_mutex_lock(&g->lock);
-#ifdef _OPENMP
-#pragma omp parallel for default(none) shared(tmp, g) schedule(static)
-#endif
-      for(size_t k = 0; k < (size_t)width * height; k++)
-      {
-        g->out_preview_buffer[k] = CLAMPS(tmp[k] * (size - 1) / 100.0f, 0, size - 2);
-      }
-      dt_pthread_mutex_unlock(&g->lock);
+  for(int j = 0; j < ht; j++)
+  {
+    const int y0 = j * factor, y1 = MIN(y0 + factor, height);
+    for(int i = 0; i < wd; i++)
+    {
+      const int x0 = i * factor, x1 = MIN(x0 + factor, width);
+      float sum = 0.0f;
+      for(int y = y0; y < y1; y++)
+        for(int x = x0; x < x1; x++) sum += ((const float *)ivoid)[ch * ((size_t)y * width + x)];
+      L[(size_t)j * wd + i] = sum / ((y1 - y0) * (x1 - x0));
     }
+  }
 
-    g_free(tmp);
-    if(gauss) dt_gaussian_free(gauss);
+  // the preview pipe runs for every change anywhere in the stack, often with the same input for this module
+  dt_pthread_mutex_lock(&g->lock);
+  if(g->preview_L && g->preview_width == wd && g->preview_height == ht && g->preview_sigma == sigma
+     && !memcmp(g->preview_L, L, sizeof(float) * wd * ht))
+  {
+    dt_pthread_mutex_unlock(&g->lock);
+    dt_free_align(L);
+    return;
   }
+  float *old = g->preview_L;
+  g->preview_L = L;
+  g->preview_width = wd;
+  g->preview_height = ht;
+  g->preview_sigma = sigma;
+  g->preview_serial++;
+  dt_pthread_mutex_unlock(&g->lock);
+  dt_free_align(old);
 }
 
 void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *const ivoid,
@@ -271,8 +245,6 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
 {
   const dt_iop_zonesystem_data_t *const d = (const dt_iop_zonesystem_data_t *const)piece->data;
 
-  process_common_setup(self, piece, ivoid, ovoid, roi_in, roi_out);
-
   const int ch = piece->colors;
   const int size = d->params.size;
 
@@ -304,8 +276,6 @@ void process_sse2(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, c
 {
   const dt_iop_zonesystem_data_t *const d = (const dt_iop_zonesystem_data_t *const)piece->data;
 
-  process_common_setup(self, piece, ivoid, ovoid, roi_in, roi_out);
-
   const int ch = piece->colors;
   const int size = d->params.size;
 
@@ -555,10 +525,15 @@ void gui_init(struct dt_iop_module_t *self)
 {
   self->gui_data = malloc(sizeof(dt_iop_zonesystem_gui_data_t));
   dt_iop_zonesystem_gui_data_t *g = (dt_iop_zonesystem_gui_data_t *)self->gui_data;
+  g->preview_L = NULL;
+  g->preview_width = g->preview_height = 0;
+  g->preview_sigma = 0.0f;
+  g->preview_serial = 0;
   g->in_preview_buffer = g->out_preview_buffer = NULL;
+  g->zones_width = g->zones_height = 0;
+  g->zones_serial = 0;
   g->is_dragging = FALSE;
   g->hilite_zone = FALSE;
-  g->preview_width = g->preview_height = 0;
   g->mouse_over_output_zones = FALSE;
 
   dt_pthread_mutex_init(&g->lock, NULL);
@@ -612,6 +587,7 @@ void gui_cleanup(struct dt_iop_module_t *self)
   dt_control_signal_disconnect(darktable.signals, G_CALLBACK(_iop_zonesystem_redraw_preview_callback), self);
 
   dt_iop_zonesystem_gui_data_t *g = (dt_iop_zonesystem_gui_data_t *)self->gui_data;
+  dt_free_align(g->preview_L);
   g_free(g->in_preview_buffer);
   g_free(g->out_preview_buffer);
   if(g->image) cairo_surface_destroy(g->image);
@@ -851,6 +827,85 @@ static gboolean dt_iop_zonesystem_bar_motion_notify(GtkWidget *widget, GdkEventM
 }
 
 
+/* makes the zones of the input and output of the last preview pipe run, unless they are there already for the
+ * same input and params. returns FALSE if there is nothing to make them from yet. */
+static gboolean _iop_zonesystem_update_zones(dt_iop_module_t *self)
+{
+  dt_iop_zonesystem_gui_data_t *g = (dt_iop_zonesystem_gui_data_t *)self->gui_data;
+  dt_iop_zonesystem_params_t *p = (dt_iop_zonesystem_params_t *)self->params;
+
+  dt_pthread_mutex_lock(&g->lock);
+  if(!g->preview_L)
+  {
+    dt_pthread_mutex_unlock(&g->lock);
+    return FALSE;
+  }
+  if(g->in_preview_buffer && g->zones_serial == g->preview_serial
+     && !memcmp(&g->zones_params, p, sizeof(dt_iop_zonesystem_params_t)))
+  {
+    dt_pthread_mutex_unlock(&g->lock);
+    return TRUE;
+  }
+  const int wd = g->preview_width, ht = g->preview_height;
+  const size_t npixels = (size_t)wd * ht;
+  const float sigma = g->preview_sigma;
+  const uint64_t serial = g->preview_serial;
+  float *L = (float *)dt_alloc_align(64, sizeof(float) * npixels);
+  float *tmp = (float *)dt_alloc_align(64, sizeof(float) * npixels);
+  if(L) memcpy(L, g->preview_L, sizeof(float) * npixels);
+  dt_pthread_mutex_unlock(&g->lock);
+
+  float Lmax[] = { 100.0f };
+  float Lmin[] = { 0.0f };
+  dt_gaussian_t *gauss = dt_gaussian_init(wd, ht, 1, Lmax, Lmin, sigma, DT_IOP_GAUSSIAN_ZERO);
+  if(!L || !tmp || !gauss)
+  {
+    dt_free_align(L);
+    dt_free_align(tmp);
+    if(gauss) dt_gaussian_free(gauss);
+    return g->in_preview_buffer != NULL;
+  }
+
+  if(!g->in_preview_buffer || g->zones_width != wd || g->zones_height != ht)
+  {
+    g_free(g->in_preview_buffer);
+    g_free(g->out_preview_buffer);
+    g->in_preview_buffer = g_malloc_n(npixels, sizeof(guchar));
+    g->out_preview_buffer = g_malloc_n(npixels, sizeof(guchar));
+    g->zones_width = wd;
+    g->zones_height = ht;
+  }
+  g->zones_serial = serial;
+  g->zones_params = *p;
+  const int size = p->size;
+
+  /* zones of the input */
+  dt_gaussian_blur(gauss, L, tmp);
+  for(size_t k = 0; k < npixels; k++) g->in_preview_buffer[k] = CLAMPS(tmp[k] * (size - 1) / 100.0f, 0, size - 2);
+
+  /* and of the output, which is the lightness of the input mapped like process() does it */
+  float zonemap[MAX_ZONE_SYSTEM_SIZE] = { -1 };
+  float zonemap_offset[MAX_ZONE_SYSTEM_SIZE] = { -1 };
+  float zonemap_scale[MAX_ZONE_SYSTEM_SIZE] = { -1 };
+  _iop_zonesystem_calculate_zonemap(p, zonemap);
+  for(int k = 0; k < size - 1; k++) zonemap_scale[k] = (zonemap[k + 1] - zonemap[k]) * (size - 1);
+  for(int k = 0; k < size - 1; k++) zonemap_offset[k] = 100.0f * ((k + 1) * zonemap[k] - k * zonemap[k + 1]);
+  const float rzscale = (size - 1) / 100.0f;
+  for(size_t k = 0; k < npixels; k++)
+  {
+    const int rz = CLAMPS(L[k] * rzscale, 0, size - 2);
+    const float zs = ((rz > 0) ? (zonemap_offset[rz] / L[k]) : 0) + zonemap_scale[rz];
+    L[k] *= zs;
+  }
+  dt_gaussian_blur(gauss, L, tmp);
+  for(size_t k = 0; k < npixels; k++) g->out_preview_buffer[k] = CLAMPS(tmp[k] * (size - 1) / 100.0f, 0, size - 2);
+
+  dt_gaussian_free(gauss);
+  dt_free_align(L);
+  dt_free_align(tmp);
+  return TRUE;
+}
+
 static gboolean dt_iop_zonesystem_preview_draw(GtkWidget *widget, cairo_t *crf, dt_iop_module_t *self)
 {
   const int inset = DT_PIXEL_APPLY_DPI(2);
@@ -872,26 +927,24 @@ static gboolean dt_iop_zonesystem_preview_draw(GtkWidget *widget, cairo_t *crf,
   height -= 2 * inset;
   cairo_translate(cr, inset, inset);
 
-  dt_pthread_mutex_lock(&g->lock);
-  if(g->in_preview_buffer && g->out_preview_buffer && self->enabled)
+  if(self->enabled && _iop_zonesystem_update_zones(self))
   {
     /* calculate the zonemap */
     float zonemap[MAX_ZONE_SYSTEM_SIZE] = { -1 };
     _iop_zonesystem_calculate_zonemap(p, zonemap);
 
     /* let's generate a pixbuf from pixel zone buffer */
-    guchar *image = g_malloc_n((size_t)4 * g->preview_width * g->preview_height, sizeof(guchar));
+    guchar *image = g_malloc_n((size_t)4 * g->zones_width * g->zones_height, sizeof(guchar));
     guchar *buffer = g->mouse_over_output_zones ? g->out_preview_buffer : g->in_preview_buffer;
-    for(int k = 0; k < g->preview_width * g->preview_height; k++)
+    for(int k = 0; k < g->zones_width * g->zones_height; k++)
     {
       int zone = 255 * CLIP(((1.0 / (p->size - 1)) * buffer[k]));
       image[4 * k + 2] = (g->hilite_zone && buffer[k] == g->zone_under_mouse) ? 255 : zone;
       image[4 * k + 1] = (g->hilite_zone && buffer[k] == g->zone_under_mouse) ? 255 : zone;
       image[4 * k + 0] = (g->hilite_zone && buffer[k] == g->zone_under_mouse) ? 0 : zone;
     }
-    dt_pthread_mutex_unlock(&g->lock);
 
-    const int wd = g->preview_width, ht = g->preview_height;
+    const int wd = g->zones_width, ht = g->zones_height;
     const float scale = fminf(width / (float)wd, height / (float)ht);
     const int stride = cairo_format_stride_for_width(CAIRO_FORMAT_RGB24, wd);
     cairo_surface_t *surface = cairo_image_surface_create_for_data(image, CAIRO_FORMAT_RGB24, wd, ht, stride);
@@ -914,7 +967,6 @@ static gboolean dt_iop_zonesystem_preview_draw(GtkWidget *widget, cairo_t *crf,
   }
   else
   {
-    dt_pthread_mutex_unlock(&g->lock);
     // draw a big, subdued dt logo
     if(g->image)
     {
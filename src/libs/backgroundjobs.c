@@ -19,17 +19,21 @@
 
 #include "common/darktable.h"
 #include "common/debug.h"
+#include "common/file_location.h"
 #include "common/image_cache.h"
 #include "control/conf.h"
 #include "control/control.h"
 #include "control/progress.h"
 #include "develop/develop.h"
 #include "dtgtk/button.h"
+#include "gui/accelerators.h"
 #include "gui/draw.h"
 #include "gui/gtk.h"
 #include "libs/lib.h"
 #include "libs/lib_api.h"
 
+#include <glib/gstdio.h>
+
 DT_MODULE(1)
 
 typedef struct dt_lib_backgroundjob_element_t
@@ -74,12 +78,77 @@ int expandable(dt_lib_module_t *self)
   return 0;
 }
 
+static gboolean _lib_backgroundjobs_dump_stats(GtkAccelGroup *accel_group, GObject *acceleratable, guint keyval,
+                                               GdkModifierType modifier, gpointer data)
+{
+  char cachedir[PATH_MAX] = { 0 };
+  dt_loc_get_user_cache_dir(cachedir, sizeof(cachedir));
+  gchar *filename = g_build_filename(cachedir, "job_statistics.json", NULL);
+  gchar *json = dt_control_jobs_stats_json(darktable.control);
+
+  if(g_file_set_contents(filename, json, -1, NULL))
+    dt_control_log(_("job statistics written to `%s'"), filename);
+  else
+    dt_control_log(_("could not write job statistics to `%s'"), filename);
+
+  g_free(json);
+  g_free(filename);
+  return TRUE;
+}
+
+void init_key_accels(dt_lib_module_t *self)
+{
+  dt_accel_register_lib(self, NC_("accel", "dump job statistics"), 0, 0);
+}
+
+void connect_key_accels(dt_lib_module_t *self)
+{
+  dt_accel_connect_lib(self, "dump job statistics",
+                       g_cclosure_new(G_CALLBACK(_lib_backgroundjobs_dump_stats), self, NULL));
+}
+
+// queue depths, throughput and the slowest kinds of jobs, for a quick look while jobs are running
+static gboolean _lib_backgroundjobs_query_tooltip(GtkWidget *widget, gint x, gint y, gboolean keyboard_mode,
+                                                  GtkTooltip *tooltip, gpointer user_data)
+{
+  GList *list = dt_control_jobs_stats_get(darktable.control);
+  GString *text = g_string_new(NULL);
+
+  double rate = 0.0;
+  for(GList *iter = list; iter; iter = g_list_next(iter))
+    rate += dt_control_jobs_stats_rate((dt_control_job_stats_t *)iter->data);
+  g_string_append_printf(text, _("%.1f jobs per second"), rate);
+  g_string_append(text, "\n");
+  g_string_append_printf(text, _("queued: %d user, %d system, %d background, %d export"),
+                         dt_control_jobs_queued(darktable.control, DT_JOB_QUEUE_USER_FG),
+                         dt_control_jobs_queued(darktable.control, DT_JOB_QUEUE_SYSTEM_FG),
+                         dt_control_jobs_queued(darktable.control, DT_JOB_QUEUE_USER_BG)
+                             + dt_control_jobs_queued(darktable.control, DT_JOB_QUEUE_SYSTEM_BG),
+                         dt_control_jobs_queued(darktable.control, DT_JOB_QUEUE_USER_EXPORT));
+
+  for(GList *iter = list; iter; iter = g_list_next(iter))
+  {
+    const dt_control_job_stats_t *stats = (dt_control_job_stats_t *)iter->data;
+    if(dt_control_jobs_stats_rate(stats) == 0.0) continue;
+    g_string_append_printf(text, "\n%s: ", stats->type);
+    g_string_append_printf(text, _("%" PRIu64 " jobs, waited %.0f ms, ran %.0f ms on average"), stats->count,
+                           1000.0 * stats->wait_sum / stats->count, 1000.0 * stats->run_sum / stats->count);
+  }
+
+  gtk_tooltip_set_text(tooltip, text->str);
+  g_string_free(text, TRUE);
+  g_list_free_full(list, dt_control_jobs_stats_free);
+  return TRUE;
+}
+
 void gui_init(dt_lib_module_t *self)
 {
   /* initialize base */
   self->widget = gtk_box_new(GTK_ORIENTATION_VERTICAL, 0);
   gtk_widget_set_no_show_all(self->widget, TRUE);
   gtk_container_set_border_width(GTK_CONTAINER(self->widget), 5);
+  gtk_widget_set_has_tooltip(self->widget, TRUE);
+  g_signal_connect(G_OBJECT(self->widget), "query-tooltip", G_CALLBACK(_lib_backgroundjobs_query_tooltip), NULL);
 
   /* setup proxy */
   dt_pthread_mutex_lock(&darktable.control->progress_system.mutex);
@@ -816,7 +816,8 @@ static void tree_view(dt_lib_collect_rule_t *dr)
     const char *query = folders ? "SELECT DISTINCT folder, id FROM main.film_rolls ORDER BY UPPER(folder) DESC" :
                         tags ? "SELECT DISTINCT name, id FROM data.tags ORDER BY UPPER(name) DESC" : NULL;
 
-    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), query, -1, &stmt, NULL);
+    sqlite3 *reader = dt_database_get_reader(darktable.db);
+    DT_DEBUG_SQLITE3_PREPARE_V2(reader, query, -1, &stmt, NULL);
 
     char **last_tokens = NULL;
     int last_tokens_length = 0;
@@ -921,6 +922,7 @@ static void tree_view(dt_lib_collect_rule_t *dr)
       }
     }
     sqlite3_finalize(stmt);
+    dt_database_release_reader(darktable.db, reader);
 
     gtk_tree_view_set_tooltip_column(GTK_TREE_VIEW(d->view), DT_LIB_COLLECT_COL_TOOLTIP);
 
@@ -1102,7 +1104,8 @@ static void list_view(dt_lib_collect_rule_t *dr)
 
     if(strlen(query) > 0)
     {
-      DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), query, -1, &stmt, NULL);
+      sqlite3 *reader = dt_database_get_reader(darktable.db);
+      DT_DEBUG_SQLITE3_PREPARE_V2(reader, query, -1, &stmt, NULL);
       while(sqlite3_step(stmt) == SQLITE_ROW)
       {
         const char *folder = (const char *)sqlite3_column_text(stmt, 0);
@@ -1130,6 +1133,7 @@ static void list_view(dt_lib_collect_rule_t *dr)
         g_free(escaped_text);
       }
       sqlite3_finalize(stmt);
+      dt_database_release_reader(darktable.db, reader);
     }
 
     gtk_tree_view_set_tooltip_column(GTK_TREE_VIEW(d->view), DT_LIB_COLLECT_COL_TOOLTIP);
@@ -90,29 +90,6 @@ static void _lib_histogram_change_callback(gpointer instance, gpointer user_data
   dt_control_queue_redraw_widget(self->widget);
 }
 
-// WARNING: don't use this code as-is, it causes segfaults elsewhere!
-// static gboolean _lib_histogram_configure_callback(GtkWidget *widget, GdkEvent *event, gpointer user_data)
-// {
-//   dt_develop_t *dev = darktable.develop;
-//   dt_pthread_mutex_lock(&dev->histogram_waveform_mutex);
-//
-//   int width = allocation.width;
-//   int height = allocation.height;
-//   width -= 2 * 4 * DT_HIST_INSET;
-//   height -= 2 * DT_HIST_INSET;
-//
-//   const gint stride = cairo_format_stride_for_width(CAIRO_FORMAT_ARGB32, width);
-//
-//   free(dev->histogram_waveform);
-//   dev->histogram_waveform = (uint32_t*)calloc(height * stride / 4, sizeof(uint32_t));
-//   dev->histogram_waveform_width = width;
-//   dev->histogram_waveform_height = height;
-//   dev->histogram_waveform_stride = stride;
-//
-//   dt_pthread_mutex_unlock(&dev->histogram_waveform_mutex);
-//   return FALSE;
-// }
-
 void gui_init(dt_lib_module_t *self)
 {
   /* initialize ui widgets */
@@ -122,6 +99,7 @@ void gui_init(dt_lib_module_t *self)
   d->red = dt_conf_get_bool("plugins/darkroom/histogram/show_red");
   d->green = dt_conf_get_bool("plugins/darkroom/histogram/show_green");
   d->blue = dt_conf_get_bool("plugins/darkroom/histogram/show_blue");
+  darktable.develop->histogram_channels = d->red | d->green << 1 | d->blue << 2;
 
   /* create drawingarea */
   self->widget = gtk_drawing_area_new();
@@ -145,8 +123,6 @@ void gui_init(dt_lib_module_t *self)
   g_signal_connect(G_OBJECT(self->widget), "enter-notify-event",
                    G_CALLBACK(_lib_histogram_enter_notify_callback), self);
   g_signal_connect(G_OBJECT(self->widget), "scroll-event", G_CALLBACK(_lib_histogram_scroll_callback), self);
-  //   g_signal_connect (G_OBJECT (self->widget), "configure-event",
-  //                     G_CALLBACK (_lib_histogram_configure_callback), self);
 
   /* set size of navigation draw area */
   int panel_width = dt_conf_get_int("panel_width");
@@ -164,12 +140,17 @@ void gui_cleanup(dt_lib_module_t *self)
 
   dt_develop_t *dev = darktable.develop;
 
+  dt_pthread_mutex_lock(&dev->histogram_waveform_mutex);
   free(dev->histogram_waveform);
   dev->histogram_waveform = NULL;
 
   dev->histogram_waveform_stride = 0;
   dev->histogram_waveform_height = 0;
   dev->histogram_waveform_width = 0;
+  dev->histogram_request_width = dev->histogram_request_height = 0;
+  if(dev->histogram_surface) cairo_surface_destroy(dev->histogram_surface);
+  dev->histogram_surface = NULL;
+  dt_pthread_mutex_unlock(&dev->histogram_waveform_mutex);
 
   g_free(self->data);
   self->data = NULL;
@@ -258,9 +239,6 @@ static gboolean _lib_histogram_draw_callback(GtkWidget *widget, cairo_t *crf, gp
   dt_lib_histogram_t *d = (dt_lib_histogram_t *)self->data;
 
   dt_develop_t *dev = darktable.develop;
-  uint32_t *hist = dev->histogram;
-  float hist_max = dev->histogram_type == DT_DEV_HISTOGRAM_LINEAR ? dev->histogram_max
-                                                                  : logf(1.0 + dev->histogram_max);
   const int inset = DT_HIST_INSET;
   GtkAllocation allocation;
   gtk_widget_get_allocation(widget, &allocation);
@@ -287,19 +265,13 @@ static gboolean _lib_histogram_draw_callback(GtkWidget *widget, cairo_t *crf, gp
     d->blue_x = width - (d->color_w + d->button_spacing);
   }
 
-  // TODO: probably this should move to the configure-event callback! That would be future proof if we ever
-  // (again) allow to resize the side panels.
-  const gint stride = cairo_format_stride_for_width(CAIRO_FORMAT_ARGB32, width);
-
-  // this code assumes that the first expose comes before the first (preview) pipe is processed and that the
-  // size of the widget doesn't change!
-  if(dev->histogram_waveform_width == 0)
+  // the preview pipe renders the curves and processes the waveform in this size from its next run on, until
+  // then the last ones are scaled
+  if(dev->histogram_request_width != width || dev->histogram_request_height != height)
   {
-    dev->histogram_waveform = (uint32_t *)calloc(height * stride / 4, sizeof(uint32_t));
-    dev->histogram_waveform_stride = stride;
-    dev->histogram_waveform_height = height;
-    dev->histogram_waveform_width = width;
-    //     return TRUE; // there are enough expose events following ...
+    dev->histogram_request_width = width;
+    dev->histogram_request_height = height;
+    dt_dev_histogram_render(dev);
   }
 
 #if 1
@@ -348,59 +320,21 @@ static gboolean _lib_histogram_draw_callback(GtkWidget *widget, cairo_t *crf, gp
   else
     dt_draw_grid(cr, 4, 0, 0, width, height);
 
-  if(hist_max > 0.0f)
+  dt_pthread_mutex_lock(&dev->histogram_waveform_mutex);
+  if(dev->histogram_surface)
   {
+    double sx = 1.0, sy = 1.0;
+    cairo_surface_get_device_scale(dev->histogram_surface, &sx, &sy);
+    const double sw = cairo_image_surface_get_width(dev->histogram_surface) / sx;
+    const double sh = cairo_image_surface_get_height(dev->histogram_surface) / sy;
     cairo_save(cr);
-    if(dev->histogram_type == DT_DEV_HISTOGRAM_WAVEFORM)
-    {
-      // make the color channel selector work:
-      uint8_t *buf = (uint8_t *)malloc(sizeof(uint8_t) * height * stride);
-      uint8_t mask[3] = { d->blue, d->green, d->red };
-      memcpy(buf, dev->histogram_waveform, sizeof(uint8_t) * height * stride);
-      for(int y = 0; y < height; y++)
-        for(int x = 0; x < width; x++)
-          for(int k = 0; k < 3; k++)
-          {
-            buf[y * stride + x * 4 + k] *= mask[k];
-          }
-
-      cairo_surface_t *source
-          = cairo_image_surface_create_for_data(buf, CAIRO_FORMAT_ARGB32, width, height, stride);
-
-      cairo_set_source_surface(cr, source, 0.0, 0.0);
-      cairo_set_operator(cr, CAIRO_OPERATOR_ADD);
-      cairo_paint(cr);
-      cairo_surface_destroy(source);
-      free(buf);
-    }
-    else
-    {
-      // cairo_set_antialias(cr, CAIRO_ANTIALIAS_NONE);
-      cairo_translate(cr, 0, height);
-      cairo_scale(cr, width / 255.0, -(height - 10) / hist_max);
-      cairo_set_operator(cr, CAIRO_OPERATOR_ADD);
-      // cairo_set_operator(cr, CAIRO_OPERATOR_OVER);
-      cairo_set_line_width(cr, 1.);
-      if(d->red)
-      {
-        cairo_set_source_rgba(cr, 1., 0., 0., 0.2);
-        dt_draw_histogram_8(cr, hist, 0, dev->histogram_type == DT_DEV_HISTOGRAM_LINEAR);
-      }
-      if(d->green)
-      {
-        cairo_set_source_rgba(cr, 0., 1., 0., 0.2);
-        dt_draw_histogram_8(cr, hist, 1, dev->histogram_type == DT_DEV_HISTOGRAM_LINEAR);
-      }
-      if(d->blue)
-      {
-        cairo_set_source_rgba(cr, 0., 0., 1., 0.2);
-        dt_draw_histogram_8(cr, hist, 2, dev->histogram_type == DT_DEV_HISTOGRAM_LINEAR);
-      }
-      cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
-      // cairo_set_antialias(cr, CAIRO_ANTIALIAS_DEFAULT);
-    }
+    cairo_scale(cr, width / sw, height / sh);
+    cairo_set_source_surface(cr, dev->histogram_surface, 0.0, 0.0);
+    cairo_set_operator(cr, CAIRO_OPERATOR_ADD);
+    cairo_paint(cr);
     cairo_restore(cr);
   }
+  dt_pthread_mutex_unlock(&dev->histogram_waveform_mutex);
 
   cairo_set_source_rgb(cr, .25, .25, .25);
   cairo_set_line_join(cr, CAIRO_LINE_JOIN_ROUND);
@@ -593,6 +527,12 @@ static gboolean _lib_histogram_button_press_callback(GtkWidget *widget, GdkEvent
       d->button_down_y = event->y;
     }
   }
+  // the mode or the channels shown might have changed
+  if(d->highlight >= 3 && d->highlight <= 6 && event->type != GDK_2BUTTON_PRESS)
+  {
+    darktable.develop->histogram_channels = d->red | d->green << 1 | d->blue << 2;
+    dt_dev_histogram_render(darktable.develop);
+  }
   // update for good measure
   dt_control_queue_redraw_widget(self->widget);
 
@@ -46,6 +46,8 @@ typedef struct dt_lib_history_t
 //   GtkWidget *apply_button;
   GtkWidget *compress_button;
   gboolean record_undo;
+  /* params and blend params of the items in the last undo snapshot, to share them with the next one */
+  GPtrArray *undo_blobs;
 } dt_lib_history_t;
 
 /* compress history stack */
@@ -143,6 +145,8 @@ void gui_cleanup(dt_lib_module_t *self)
 {
   dt_control_signal_disconnect(darktable.signals, G_CALLBACK(_lib_history_change_callback), self);
   dt_control_signal_disconnect(darktable.signals, G_CALLBACK(_lib_history_module_remove_callback), self);
+  dt_lib_history_t *d = (dt_lib_history_t *)self->data;
+  if(d->undo_blobs) g_ptr_array_free(d->undo_blobs, TRUE);
   g_free(self->data);
   self->data = NULL;
 }
@@ -205,6 +209,52 @@ static GList *_duplicate_history(GList *hist)
   return result;
 }
 
+/* copy of hist for an undo snapshot, whose params and blend params are undo blobs. the ones that are the same
+   as in the last snapshot are shared with it. */
+static GList *_snapshot_history(dt_lib_history_t *d, GList *hist)
+{
+  GList *result = NULL;
+  GPtrArray *blobs = g_ptr_array_new_with_free_func(dt_undo_blob_unref);
+
+  for(GList *h = g_list_first(hist); h; h = g_list_next(h))
+  {
+    const dt_dev_history_item_t *old = (dt_dev_history_item_t *)(h->data);
+
+    dt_dev_history_item_t *new = (dt_dev_history_item_t *)malloc(sizeof(dt_dev_history_item_t));
+
+    memcpy(new, old, sizeof(dt_dev_history_item_t));
+
+    new->params = dt_undo_blob_new(old->module->params_size);
+    new->blend_params = dt_undo_blob_new(sizeof(dt_develop_blend_params_t));
+
+    memcpy(new->params, old->params, old->module->params_size);
+    memcpy(new->blend_params, old->blend_params, sizeof(dt_develop_blend_params_t));
+
+    const guint k = blobs->len;
+    if(d->undo_blobs && k + 1 < d->undo_blobs->len)
+    {
+      new->params = dt_undo_blob_share(new->params, g_ptr_array_index(d->undo_blobs, k));
+      new->blend_params = dt_undo_blob_share(new->blend_params, g_ptr_array_index(d->undo_blobs, k + 1));
+    }
+    g_ptr_array_add(blobs, dt_undo_blob_ref(new->params));
+    g_ptr_array_add(blobs, dt_undo_blob_ref(new->blend_params));
+
+    result = g_list_prepend(result, new);
+  }
+
+  if(d->undo_blobs) g_ptr_array_free(d->undo_blobs, TRUE);
+  d->undo_blobs = blobs;
+  return g_list_reverse(result);
+}
+
+static void _snapshot_history_item_free(gpointer data)
+{
+  dt_dev_history_item_t *item = (dt_dev_history_item_t *)data;
+  dt_undo_blob_unref(item->params);
+  dt_undo_blob_unref(item->blend_params);
+  free(item);
+}
+
 static dt_iop_module_t *get_base_module(dt_develop_t *dev, char *op)
 {
   dt_iop_module_t *result = NULL;
@@ -356,7 +406,7 @@ static void _history_undo_data_free(gpointer data)
 {
   dt_undo_history_t *hist = (dt_undo_history_t *)data;
   GList *snapshot = hist->snapshot;
-  g_list_free_full(snapshot, dt_dev_free_history_item);
+  g_list_free_full(snapshot, _snapshot_history_item_free);
   free(data);
 }
 
@@ -391,7 +441,7 @@ static void _lib_history_change_callback(gpointer instance, gpointer user_data)
   {
     /* record undo/redo history snapshot */
     dt_undo_history_t *hist = malloc(sizeof(dt_undo_history_t));
-    hist->snapshot = _duplicate_history(darktable.develop->history);
+    hist->snapshot = _snapshot_history(d, darktable.develop->history);
     hist->end = darktable.develop->history_end;
 
     dt_undo_record(darktable.undo, self, DT_UNDO_HISTORY, (dt_undo_data_t *)hist,
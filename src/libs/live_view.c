@@ -71,7 +71,7 @@ typedef struct dt_lib_live_view_t
   double splitline_x, splitline_y; // 0..1
   gboolean splitline_dragging;
 
-  GtkWidget *live_view, *live_view_zoom, *rotate_ccw, *rotate_cw, *flip;
+  GtkWidget *live_view, *live_view_zoom, *rotate_ccw, *rotate_cw, *flip, *frame_rate;
   GtkWidget *focus_out_small, *focus_out_big, *focus_in_small, *focus_in_big;
   GtkWidget *guide_selector, *flip_guides, *guides_widgets;
   GList *guides_widgets_list;
@@ -301,6 +301,13 @@ void gui_init(dt_lib_module_t *self)
   g_signal_connect(G_OBJECT(lib->rotate_cw), "clicked", G_CALLBACK(_rotate_cw), lib);
   g_signal_connect(G_OBJECT(lib->flip), "clicked", G_CALLBACK(_toggle_flip_clicked), lib);
 
+  // frame rate and latency, filled in while drawing the frames
+  lib->frame_rate = gtk_label_new("");
+  gtk_widget_set_halign(lib->frame_rate, GTK_ALIGN_START);
+  gtk_widget_set_tooltip_text(lib->frame_rate, _("live view frames shown per second and the time from "
+                                                 "requesting a frame from the camera to showing it"));
+  gtk_box_pack_start(GTK_BOX(self->widget), lib->frame_rate, TRUE, TRUE, 0);
+
   // focus buttons
   box = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 5);
   gtk_box_pack_start(GTK_BOX(self->widget), box, TRUE, TRUE, 0);
@@ -489,18 +496,28 @@ void gui_post_expose(dt_lib_module_t *self, cairo_t *cr, int32_t width, int32_t
   dt_camera_t *cam = (dt_camera_t *)darktable.camctl->active_camera;
   dt_lib_live_view_t *lib = self->data;
 
-  if(cam->is_live_viewing == FALSE || cam->live_view_zoom == TRUE) return;
+  if(cam->is_live_viewing == FALSE)
+  {
+    gtk_label_set_text(GTK_LABEL(lib->frame_rate), "");
+    return;
+  }
+
+  dt_pthread_mutex_lock(&cam->live_view_buffer_mutex);
+  gchar *frame_rate = g_strdup_printf(_("%.1f fps, %.0f ms latency"), cam->live_view_fps,
+                                      1000.0f * cam->live_view_latency);
+  if(g_strcmp0(frame_rate, gtk_label_get_text(GTK_LABEL(lib->frame_rate))))
+    gtk_label_set_text(GTK_LABEL(lib->frame_rate), frame_rate);
+  g_free(frame_rate);
 
-  dt_pthread_mutex_lock(&cam->live_view_pixbuf_mutex);
-  if(GDK_IS_PIXBUF(cam->live_view_pixbuf) == FALSE)
+  if(cam->live_view_zoom == TRUE || !cam->live_view_shown)
   {
-    dt_pthread_mutex_unlock(&cam->live_view_pixbuf_mutex);
+    dt_pthread_mutex_unlock(&cam->live_view_buffer_mutex);
     return;
   }
   double w = width - (MARGIN * 2.0f);
   double h = height - (MARGIN * 2.0f) - BAR_HEIGHT;
-  gint pw = gdk_pixbuf_get_width(cam->live_view_pixbuf);
-  gint ph = gdk_pixbuf_get_height(cam->live_view_pixbuf);
+  gint pw = cairo_image_surface_get_width(cam->live_view_shown);
+  gint ph = cairo_image_surface_get_height(cam->live_view_shown);
   lib->overlay_x0 = lib->overlay_x1 = lib->overlay_y0 = lib->overlay_y1 = 0.0;
 
   gboolean use_splitline = (dt_bauhaus_combobox_get(lib->overlay_splitline) == 1);
@@ -588,7 +605,7 @@ void gui_post_expose(dt_lib_module_t *self, cairo_t *cr, int32_t width, int32_t
             break;
           default:
             fprintf(stderr, "OMFG, the world will collapse, this shouldn't be reachable!\n");
-            dt_pthread_mutex_unlock(&cam->live_view_pixbuf_mutex);
+            dt_pthread_mutex_unlock(&cam->live_view_buffer_mutex);
             return;
         }
 
@@ -710,7 +727,7 @@ void gui_post_expose(dt_lib_module_t *self, cairo_t *cr, int32_t width, int32_t
     cairo_stroke(cr);
   }
   cairo_restore(cr);
-  dt_pthread_mutex_unlock(&cam->live_view_pixbuf_mutex);
+  dt_pthread_mutex_unlock(&cam->live_view_buffer_mutex);
 }
 
 int button_released(struct dt_lib_module_t *self, double x, double y, int which, uint32_t state)
@@ -215,6 +215,8 @@ static void write_metadata(dt_lib_module_t *self)
   gchar *creator = gtk_combo_box_text_get_active_text(GTK_COMBO_BOX_TEXT(d->creator));
   gchar *publisher = gtk_combo_box_text_get_active_text(GTK_COMBO_BOX_TEXT(d->publisher));
 
+  // all keys of all images in one transaction, the sidecars are queued for the background writers after it
+  sqlite3_exec(dt_database_get(darktable.db), "BEGIN TRANSACTION", NULL, NULL, NULL);
   if(title != NULL && (d->multi_title == FALSE || gtk_combo_box_get_active(GTK_COMBO_BOX(d->title)) != 0))
     dt_metadata_set(mouse_over_id, "Xmp.dc.title", title);
   if(description != NULL
@@ -228,6 +230,7 @@ static void write_metadata(dt_lib_module_t *self)
   if(publisher != NULL
      && (d->multi_publisher == FALSE || gtk_combo_box_get_active(GTK_COMBO_BOX(d->publisher)) != 0))
     dt_metadata_set(mouse_over_id, "Xmp.dc.publisher", publisher);
+  sqlite3_exec(dt_database_get(darktable.db), "COMMIT", NULL, NULL, NULL);
 
   g_free(title);
   g_free(description);
@@ -502,11 +505,13 @@ int set_params(dt_lib_module_t *self, const void *params, int size)
   if(size != title_len + description_len + rights_len + creator_len + publisher_len)
     return 1;
 
+  sqlite3_exec(dt_database_get(darktable.db), "BEGIN TRANSACTION", NULL, NULL, NULL);
   if(title != NULL && title[0] != '\0') dt_metadata_set(-1, "Xmp.dc.title", title);
   if(description != NULL && description[0] != '\0') dt_metadata_set(-1, "Xmp.dc.description", description);
   if(rights != NULL && rights[0] != '\0') dt_metadata_set(-1, "Xmp.dc.rights", rights);
   if(creator != NULL && creator[0] != '\0') dt_metadata_set(-1, "Xmp.dc.creator", creator);
   if(publisher != NULL && publisher[0] != '\0') dt_metadata_set(-1, "Xmp.dc.publisher", publisher);
+  sqlite3_exec(dt_database_get(darktable.db), "COMMIT", NULL, NULL, NULL);
 
   dt_image_synch_xmp(-1);
   update(self, FALSE);
@@ -68,7 +68,6 @@ typedef struct dt_lib_print_settings_t
   GList *paper_list;
   gboolean lock_activated;
   dt_print_info_t prt;
-  uint16_t *buf;
   int32_t image_id;
   int32_t iwidth, iheight;
   int unit;
@@ -103,7 +102,8 @@ position ()
   return 990;
 }
 
-// callbacks for in-memory export
+// callbacks for in-memory export. the image is written to the pdf spooled to cups as it comes out of the pipe,
+// through the printer profile if there is one, so the print is never held at full size on top of the pipe.
 
 typedef struct dt_print_format_t
 {
@@ -113,6 +113,13 @@ typedef struct dt_print_format_t
   gboolean style_append;
   int bpp;
   dt_lib_print_settings_t *ps;
+  // the page, in mm, and the pdf written to
+  double page_width, page_height;
+  const dt_printer_transform_t *transform;
+  dt_pdf_t *pdf;
+  dt_pdf_image_t *pdf_image;
+  uint8_t *rgb; // rows packed for the pdf
+  size_t rgb_size;
 } dt_print_format_t;
 
 static int bpp(dt_imageio_module_data_t *data)
@@ -124,7 +131,7 @@ static int bpp(dt_imageio_module_data_t *data)
 static int levels(dt_imageio_module_data_t *data)
 {
   const dt_print_format_t *d = (dt_print_format_t *)data;
-  return IMAGEIO_RGB | (d->bpp == 8 ? IMAGEIO_INT8 : IMAGEIO_INT16);
+  return IMAGEIO_RGB | (d->bpp == 8 ? IMAGEIO_INT8 : IMAGEIO_FLOAT);
 }
 
 static const char *mime(dt_imageio_module_data_t *data)
@@ -133,34 +140,123 @@ static const char *mime(dt_imageio_module_data_t *data)
 }
 
 static int write_image(dt_imageio_module_data_t *data, const char *filename, const void *in,
-                       void *exif, int exif_len, int imgid, int num, int total)
+                       void *exif, int exif_len, const char *xmp, int imgid, int num, int total)
+{
+  // only reached if the pdf couldn't be started
+  return 1;
+}
+
+static void *write_image_begin(dt_imageio_module_data_t *data, const char *filename, void *exif,
+                               int exif_len, const char *xmp, int imgid, int num, int total)
 {
   dt_print_format_t *d = (dt_print_format_t *)data;
+  dt_lib_print_settings_t *ps = d->ps;
+
+  // the export knows the real size of the image now, compute the layout
+  const int32_t width_pix = (d->page_width * ps->prt.printer.resolution) / 25.4;
+  const int32_t height_pix = (d->page_height * ps->prt.printer.resolution) / 25.4;
+
+  int32_t px=0, py=0, pwidth=0, pheight=0;
+  int32_t ax=0, ay=0, awidth=0, aheight=0;
+  int32_t ix=0, iy=0, iwidth=0, iheight=0;
+  int32_t iwpix=d->width, ihpix=d->height;
+
+  dt_get_print_layout (imgid, &ps->prt, width_pix, height_pix,
+                       &iwpix, &ihpix,
+                       &px, &py, &pwidth, &pheight,
+                       &ax, &ay, &awidth, &aheight,
+                       &ix, &iy, &iwidth, &iheight);
 
-  d->ps->buf = (uint16_t *)malloc(d->width * d->height * 3 * (d->bpp == 8?1:2));
+  const int margin_top    = iy;
+  const int margin_left   = ix;
+  const int margin_right  = pwidth - iwidth - ix;
+  const int margin_bottom = pheight - iheight - iy;
 
-  if (d->bpp == 8)
+  dt_print(DT_DEBUG_PRINT, "[print] margins top %d ; bottom %d ; left %d ; right %d\n",
+           margin_top, margin_bottom, margin_left, margin_right);
+
+  const float page_width  = dt_pdf_mm_to_point(d->page_width);
+  const float page_height = dt_pdf_mm_to_point(d->page_height);
+
+  d->pdf = dt_pdf_start(filename, page_width, page_height, ps->prt.printer.resolution, DT_PDF_STREAM_ENCODER_FLATE);
+  if(!d->pdf) return NULL;
+
+/*
+  // ??? should a profile be embedded here?
+  if (*printer_profile)
+    icc_id = dt_pdf_add_icc(pdf, printer_profile);
+*/
+  const int icc_id = 0;
+  d->pdf_image = dt_pdf_add_image_begin(d->pdf, FALSE, d->width, d->height, 8, icc_id, 0.0);
+  if(!d->pdf_image)
   {
-    const uint8_t *in_ptr = (const uint8_t *)in;
-    uint8_t *out_ptr = (uint8_t *)d->ps->buf;
-    for(int y = 0; y < d->height; y++)
-    {
-      for(int x = 0; x < d->width; x++, in_ptr += 4, out_ptr += 3)
-        memcpy(out_ptr, in_ptr, 3);
-    }
+    dt_pdf_finish(d->pdf, NULL, 0);
+    d->pdf = NULL;
+    return NULL;
   }
+
+  //  PDF bounding-box has origin on bottom-left
+  d->pdf_image->bb_x      = dt_pdf_pixel_to_point((float)margin_left, ps->prt.printer.resolution);
+  d->pdf_image->bb_y      = dt_pdf_pixel_to_point((float)margin_bottom, ps->prt.printer.resolution);
+  d->pdf_image->bb_width  = dt_pdf_pixel_to_point((float)iwidth, ps->prt.printer.resolution);
+  d->pdf_image->bb_height = dt_pdf_pixel_to_point((float)iheight, ps->prt.printer.resolution);
+
+  if (ps->prt.page.landscape && (d->width > d->height))
+    d->pdf_image->rotate_to_fit = TRUE;
   else
+    d->pdf_image->rotate_to_fit = FALSE;
+
+  return d;
+}
+
+static int write_image_rows(dt_imageio_module_data_t *data, void *handle, const void *in, int first_row,
+                            int rows)
+{
+  dt_print_format_t *d = (dt_print_format_t *)data;
+
+  const size_t npixels = (size_t)d->width * rows;
+  if(d->rgb_size < 3 * npixels)
   {
-    const uint16_t *in_ptr = (const uint16_t *)in;
-    uint16_t *out_ptr = (uint16_t *)d->ps->buf;
-    for(int y = 0; y < d->height; y++)
+    free(d->rgb);
+    d->rgb_size = 3 * npixels;
+    d->rgb = (uint8_t *)malloc(d->rgb_size);
+    if(!d->rgb)
     {
-      for(int x = 0; x < d->width; x++, in_ptr += 4, out_ptr += 3)
-        memcpy(out_ptr, in_ptr, 6);
+      d->rgb_size = 0;
+      return 1;
     }
   }
 
-  return 0;
+  if(d->transform)
+    // the rows are the scratch space of the export, the transform may work in place
+    dt_printer_transform_apply(d->transform, (float *)in, d->rgb, npixels);
+  else
+  {
+    const uint8_t *in_ptr = (const uint8_t *)in;
+    for(size_t k = 0; k < npixels; k++) memcpy(d->rgb + 3 * k, in_ptr + 4 * k, 3);
+  }
+
+  return dt_pdf_add_image_rows(d->pdf, d->pdf_image, d->rgb, rows);
+}
+
+static int write_image_end(dt_imageio_module_data_t *data, void *handle, int failed)
+{
+  dt_print_format_t *d = (dt_print_format_t *)data;
+
+  if(dt_pdf_add_image_end(d->pdf, d->pdf_image)) failed = 1;
+
+  dt_pdf_page_t *pdf_page = failed ? NULL : dt_pdf_add_page(d->pdf, &d->pdf_image, 1);
+  dt_pdf_finish(d->pdf, &pdf_page, pdf_page ? 1 : 0);
+
+  free(d->pdf_image);
+  free(pdf_page);
+  free(d->rgb);
+  d->pdf = NULL;
+  d->pdf_image = NULL;
+  d->rgb = NULL;
+  d->rgb_size = 0;
+
+  return failed || !pdf_page;
 }
 
 static void
@@ -209,9 +305,6 @@ _print_button_clicked (GtkWidget *widget, gpointer user_data)
     margin_h += ps->prt.printer.hw_margin_top + ps->prt.printer.hw_margin_bottom;
   }
 
-  const int32_t width_pix = (width * ps->prt.printer.resolution) / 25.4;
-  const int32_t height_pix = (height * ps->prt.printer.resolution) / 25.4;
-
   const double pa_width  = (width  - margin_w) / 25.4;
   const double pa_height = (height - margin_h) / 25.4;
 
@@ -224,57 +317,8 @@ _print_button_clicked (GtkWidget *widget, gpointer user_data)
 
   dt_print(DT_DEBUG_PRINT, "[print] max image size %d x %d (at resolution %d)\n", max_width, max_height, ps->prt.printer.resolution);
 
-  dt_imageio_module_format_t buf;
-  buf.mime = mime;
-  buf.levels = levels;
-  buf.bpp = bpp;
-  buf.write_image = write_image;
-
-  dt_print_format_t dat;
-  dat.max_width = max_width;
-  dat.max_height = max_height;
-  dat.style[0] = '\0';
-  dat.style_append = ps->v_style_append;
-  dat.bpp = *ps->v_piccprofile ? 16 : 8; // set to 16bit when a profile is to be applied
-  dat.ps = ps;
-
-  char* style = dt_conf_get_string("plugins/print/print/style");
-  if (style)
-  {
-    g_strlcpy(dat.style, style, sizeof(dat.style));
-    g_free(style);
-  }
-
-  // the flags are: ignore exif, display byteorder, high quality, upscale, thumbnail
-  const int high_quality = 1;
-  const int upscale = 1;
-  dt_imageio_export_with_flags(imgid, "unused", &buf, (dt_imageio_module_data_t *)&dat, 1, 0,
-                               high_quality, upscale, 0, NULL, FALSE, 0, 0, 1, 1);
-
-  // after exporting we know the real size of the image, compute the layout
-
-  // compute print-area (in inches)
-  int32_t px=0, py=0, pwidth=0, pheight=0;
-  int32_t ax=0, ay=0, awidth=0, aheight=0;
-  int32_t ix=0, iy=0, iwidth=0, iheight=0;
-  int32_t iwpix=dat.width, ihpix=dat.height;
-
-  dt_get_print_layout (imgid, &ps->prt, width_pix, height_pix,
-                       &iwpix, &ihpix,
-                       &px, &py, &pwidth, &pheight,
-                       &ax, &ay, &awidth, &aheight,
-                       &ix, &iy, &iwidth, &iheight);
-
-  const int margin_top    = iy;
-  const int margin_left   = ix;
-  const int margin_right  = pwidth - iwidth - ix;
-  const int margin_bottom = pheight - iheight - iy;
-
-  dt_print(DT_DEBUG_PRINT, "[print] margins top %d ; bottom %d ; left %d ; right %d\n",
-           margin_top, margin_bottom, margin_left, margin_right);
-
-  // we have the exported buffer, let's apply the printer profile
-
+  // the printer profile is applied to the float output of the pipe
+  dt_printer_transform_t *transform = NULL;
   if (*ps->v_piccprofile)
   {
     const dt_colorspaces_color_profile_t *pprof = dt_colorspaces_get_profile(ps->v_picctype, ps->v_piccprofile,
@@ -287,21 +331,16 @@ _print_button_clicked (GtkWidget *widget, gpointer user_data)
       dt_control_queue_redraw();
       return;
     }
-    else
-      if (dt_apply_printer_profile(imgid, (void **)&(dat.ps->buf), dat.width, dat.height, dat.bpp,
-                                   pprof->profile,
-                                   ps->v_pintent, ps->v_black_point_compensation))
-      {
-        free(dat.ps->buf);
-        dt_control_log(_("cannot apply printer profile `%s'"), ps->v_piccprofile);
-        fprintf(stderr, "cannot apply printer profile `%s'\n", ps->v_piccprofile);
-        dt_control_queue_redraw();
-        return;
-      }
-  }
 
-  const float page_width  = dt_pdf_mm_to_point(width);
-  const float page_height = dt_pdf_mm_to_point(height);
+    transform = dt_printer_transform_new(imgid, pprof->profile, ps->v_pintent, ps->v_black_point_compensation);
+    if (!transform)
+    {
+      dt_control_log(_("cannot apply printer profile `%s'"), ps->v_piccprofile);
+      fprintf(stderr, "cannot apply printer profile `%s'\n", ps->v_piccprofile);
+      dt_control_queue_redraw();
+      return;
+    }
+  }
 
   char filename[PATH_MAX] = { 0 };
   dt_loc_get_tmp_dir(filename, sizeof(filename));
@@ -310,43 +349,54 @@ _print_button_clicked (GtkWidget *widget, gpointer user_data)
   gint fd = g_mkstemp(filename);
   if(fd == -1)
   {
-    free(dat.ps->buf);
+    dt_printer_transform_free(transform);
     dt_control_log("failed to create temporary pdf for printing");
     fprintf(stderr, "failed to create temporary pdf for printing\n");
     return;
   }
   close(fd);
 
-  const int icc_id = 0;
-
-  dt_pdf_t *pdf = dt_pdf_start(filename, page_width, page_height, ps->prt.printer.resolution, DT_PDF_STREAM_ENCODER_FLATE);
-
-/*
-  // ??? should a profile be embedded here?
-  if (*printer_profile)
-    icc_id = dt_pdf_add_icc(pdf, printer_profile);
-*/
-  dt_pdf_image_t *pdf_image = dt_pdf_add_image(pdf, (uint8_t *)dat.ps->buf, dat.width, dat.height, 8, icc_id, 0.0);
-
-  //  PDF bounding-box has origin on bottom-left
-  pdf_image->bb_x      = dt_pdf_pixel_to_point((float)margin_left, ps->prt.printer.resolution);
-  pdf_image->bb_y      = dt_pdf_pixel_to_point((float)margin_bottom, ps->prt.printer.resolution);
-  pdf_image->bb_width  = dt_pdf_pixel_to_point((float)iwidth, ps->prt.printer.resolution);
-  pdf_image->bb_height = dt_pdf_pixel_to_point((float)iheight, ps->prt.printer.resolution);
+  dt_imageio_module_format_t buf;
+  buf.mime = mime;
+  buf.levels = levels;
+  buf.bpp = bpp;
+  buf.write_image = write_image;
+  buf.write_image_begin = write_image_begin;
+  buf.write_image_rows = write_image_rows;
+  buf.write_image_end = write_image_end;
 
-  if (ps->prt.page.landscape && (dat.width > dat.height))
-    pdf_image->rotate_to_fit = TRUE;
-  else
-    pdf_image->rotate_to_fit = FALSE;
+  dt_print_format_t dat = { 0 };
+  dat.max_width = max_width;
+  dat.max_height = max_height;
+  dat.style[0] = '\0';
+  dat.style_append = ps->v_style_append;
+  dat.bpp = transform ? 32 : 8;
+  dat.ps = ps;
+  dat.page_width = width;
+  dat.page_height = height;
+  dat.transform = transform;
 
-  dt_pdf_page_t *pdf_page = dt_pdf_add_page(pdf, &pdf_image, 1);
-  dt_pdf_finish(pdf, &pdf_page, 1);
+  char* style = dt_conf_get_string("plugins/print/print/style");
+  if (style)
+  {
+    g_strlcpy(dat.style, style, sizeof(dat.style));
+    g_free(style);
+  }
 
-  // free memory
+  // the flags are: ignore exif, display byteorder, high quality, upscale, thumbnail. with a streaming tile size
+  // set for exports the pipe renders the print in tiles, otherwise it hands over all rows at once.
+  const int high_quality = 1;
+  const int upscale = 1;
+  const int failed = dt_imageio_export_with_flags(imgid, filename, &buf, (dt_imageio_module_data_t *)&dat, 1, 0,
+                                                  high_quality, upscale, 0, NULL, FALSE, 0, 0, 1, 1);
+  dt_printer_transform_free(transform);
 
-  free (dat.ps->buf);
-  free (pdf_image);
-  free (pdf_page);
+  if(failed)
+  {
+    g_unlink(filename);
+    dt_control_log(_("failed to render image %d for printing"), imgid);
+    return;
+  }
 
   // send to CUPS
 
@@ -26,6 +26,11 @@
 #include "libs/lib.h"
 #include "libs/lib_api.h"
 
+#include <glib/gstdio.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <zlib.h>
+
 DT_MODULE(1)
 
 #define DT_LIB_SNAPSHOTS_COUNT 4
@@ -38,6 +43,17 @@ typedef struct dt_lib_snapshot_t
   GtkWidget *button;
   float zoom_x, zoom_y, zoom_scale;
   int32_t zoom, closeup;
+
+  /* the view, compressed by _lib_snapshots_taken(). data is NULL while it is spilled to spill_filename */
+  uint8_t *data;
+  size_t data_size;
+  int width, height, stride;
+  cairo_format_t format;
+  gboolean spilled;
+  uint32_t used; /* when the snapshot was taken or last shown, the oldest ones are spilled first */
+  char spill_filename[512];
+
+  /* png written when lua asks for it */
   char filename[512];
 } dt_lib_snapshot_t;
 
@@ -60,6 +76,9 @@ typedef struct dt_lib_snapshots_t
   /* snapshot cairo surface */
   cairo_surface_t *snapshot_image;
 
+  /* counts up every time a snapshot is used */
+  uint32_t use_count;
+
 
   /* change snapshot overlay controls */
   gboolean dragging, vertical, inverted;
@@ -72,6 +91,7 @@ typedef struct dt_lib_snapshots_t
 /* callback for take snapshot */
 static void _lib_snapshots_add_button_clicked_callback(GtkWidget *widget, gpointer user_data);
 static void _lib_snapshots_toggled_callback(GtkToggleButton *widget, gpointer user_data);
+static void _lib_snapshots_taken(dt_lib_module_t *self, cairo_surface_t *surface);
 
 
 const char *name(dt_lib_module_t *self)
@@ -107,6 +127,106 @@ void connect_key_accels(dt_lib_module_t *self)
   dt_accel_connect_button_lib(self, "take snapshot", d->take_button);
 }
 
+static void _lib_snapshot_clear(dt_lib_snapshot_t *s)
+{
+  free(s->data);
+  s->data = NULL;
+  s->data_size = 0;
+  if(s->spilled) g_unlink(s->spill_filename);
+  s->spilled = FALSE;
+}
+
+/* writes the least recently used snapshots to disk until the ones left in memory fit into its budget. keep,
+   the one just used, always stays. */
+static void _lib_snapshots_spill(dt_lib_snapshots_t *d, const dt_lib_snapshot_t *keep)
+{
+  const size_t budget = (size_t)MAX(0, dt_conf_get_int("plugins/darkroom/snapshots/memory")) << 20;
+  while(TRUE)
+  {
+    size_t memory = 0;
+    dt_lib_snapshot_t *lru = NULL;
+    for(uint32_t k = 0; k < d->size; k++)
+    {
+      dt_lib_snapshot_t *s = d->snapshot + k;
+      if(!s->data) continue;
+      memory += s->data_size;
+      if(s != keep && (!lru || s->used < lru->used)) lru = s;
+    }
+    if(!lru || memory <= budget) return;
+
+    FILE *f = g_fopen(lru->spill_filename, "wb");
+    gboolean written = f && fwrite(lru->data, 1, lru->data_size, f) == lru->data_size;
+    if(f && fclose(f)) written = FALSE;
+    if(!written)
+    {
+      /* keep it in memory then */
+      fprintf(stderr, "[snapshots] can't write snapshot to `%s'\n", lru->spill_filename);
+      g_unlink(lru->spill_filename);
+      return;
+    }
+    free(lru->data);
+    lru->data = NULL;
+    lru->spilled = TRUE;
+  }
+}
+
+/* decompresses snapshot s into a new surface, reading it back into memory first if it was spilled. NULL if
+   there is none. */
+static cairo_surface_t *_lib_snapshot_load(dt_lib_snapshots_t *d, dt_lib_snapshot_t *s)
+{
+  if(!s->data && s->spilled)
+  {
+    gchar *contents = NULL;
+    gsize length = 0;
+    if(!g_file_get_contents(s->spill_filename, &contents, &length, NULL)) return NULL;
+    s->data = (uint8_t *)malloc(length);
+    if(s->data)
+    {
+      memcpy(s->data, contents, length);
+      s->data_size = length;
+      g_unlink(s->spill_filename);
+      s->spilled = FALSE;
+    }
+    g_free(contents);
+  }
+  if(!s->data) return NULL;
+
+  s->used = ++d->use_count;
+  _lib_snapshots_spill(d, s);
+
+  cairo_surface_t *surface = cairo_image_surface_create(s->format, s->width, s->height);
+  if(cairo_surface_status(surface) != CAIRO_STATUS_SUCCESS || cairo_image_surface_get_stride(surface) != s->stride)
+  {
+    cairo_surface_destroy(surface);
+    return NULL;
+  }
+
+  uint8_t *const out = cairo_image_surface_get_data(surface);
+  const int height = s->height, stride = s->stride;
+  uLongf length = (uLongf)stride * height;
+  if(uncompress(out, &length, s->data, s->data_size) != Z_OK || length != (uLongf)stride * height)
+  {
+    fprintf(stderr, "[snapshots] can't decompress snapshot\n");
+    cairo_surface_destroy(surface);
+    return NULL;
+  }
+
+#ifdef _OPENMP
+#pragma omp parallel for default(none) schedule(static)
+#endif
+  for(int j = 0; j < height; j++)
+  {
+    uint8_t *const row = out + (size_t)stride * j;
+    for(int i = 4; i < stride; i++) row[i] += row[i - 4];
+  }
+  cairo_surface_mark_dirty(surface);
+
+#if (CAIRO_VERSION >= CAIRO_VERSION_ENCODE(1, 13, 1))
+  cairo_surface_set_device_scale(surface, darktable.gui->ppd, darktable.gui->ppd);
+#endif
+  return surface;
+}
+
 /* expose snapshot over center viewport */
 void gui_post_expose(dt_lib_module_t *self, cairo_t *cri, int32_t width, int32_t height, int32_t pointerx,
                      int32_t pointery)
@@ -237,12 +357,14 @@ void gui_reset(dt_lib_module_t *self)
 {
   dt_lib_snapshots_t *d = (dt_lib_snapshots_t *)self->data;
   d->num_snapshots = 0;
+  if(d->snapshot_image) cairo_surface_destroy(d->snapshot_image);
   d->snapshot_image = NULL;
 
   for(uint32_t k = 0; k < d->size; k++)
   {
     gtk_widget_hide(d->snapshot[k].button);
     gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(d->snapshot[k].button), FALSE);
+    _lib_snapshot_clear(d->snapshot + k);
   }
 
   dt_control_queue_redraw_center();
@@ -290,7 +412,9 @@ void gui_init(dt_lib_module_t *self)
     /* assign snapshot number to widget */
     g_object_set_data(G_OBJECT(d->snapshot[k].button), "snapshot", GINT_TO_POINTER(k + 1));
 
-    /* setup filename for snapshot */
+    /* setup filenames for snapshot */
+    snprintf(d->snapshot[k].spill_filename, sizeof(d->snapshot[k].spill_filename), "%s/dt_snapshot_%d.z",
+             localtmpdir, k);
     snprintf(d->snapshot[k].filename, sizeof(d->snapshot[k].filename), "%s/dt_snapshot_%d.png", localtmpdir,
              k);
 
@@ -304,12 +428,21 @@ void gui_init(dt_lib_module_t *self)
   /* add snapshot box and take snapshot button to widget ui*/
   gtk_box_pack_start(GTK_BOX(self->widget), d->snapshots_box, TRUE, TRUE, 0);
   gtk_box_pack_start(GTK_BOX(self->widget), button, TRUE, TRUE, 0);
+
+  /* the darkroom hands us the view once a snapshot is requested */
+  darktable.develop->proxy.snapshot.module = self;
+  darktable.develop->proxy.snapshot.taken = _lib_snapshots_taken;
 }
 
 void gui_cleanup(dt_lib_module_t *self)
 {
   dt_lib_snapshots_t *d = (dt_lib_snapshots_t *)self->data;
 
+  darktable.develop->proxy.snapshot.module = NULL;
+  darktable.develop->proxy.snapshot.taken = NULL;
+
+  if(d->snapshot_image) cairo_surface_destroy(d->snapshot_image);
+  for(uint32_t k = 0; k < d->size; k++) _lib_snapshot_clear(d->snapshot + k);
   g_free(d->snapshot);
 
   g_free(self->data);
@@ -340,6 +473,7 @@ static void _lib_snapshots_add_button_clicked_callback(GtkWidget *widget, gpoint
   GtkWidget *b = d->snapshot[0].button;
   d->snapshot[0] = last;
   d->snapshot[0].button = b;
+  _lib_snapshot_clear(d->snapshot + 0);
   const gchar *name = _("original");
   if(darktable.develop->history_end > 0)
   {
@@ -368,7 +502,64 @@ static void _lib_snapshots_add_button_clicked_callback(GtkWidget *widget, gpoint
   for(uint32_t k = 0; k < d->num_snapshots; k++) gtk_widget_show(d->snapshot[k].button);
 
   /* request a new snapshot for top slot */
-  dt_dev_snapshot_request(darktable.develop, (const char *)&d->snapshot[0].filename);
+  dt_dev_snapshot_request(darktable.develop);
+}
+
+/* rows are filtered before deflating them, every byte minus the one of the pixel to its left. smooth parts of
+   the view leave mostly small numbers, which deflate packs well even at its fastest level. */
+static void _lib_snapshots_taken(dt_lib_module_t *self, cairo_surface_t *surface)
+{
+  dt_lib_snapshots_t *d = (dt_lib_snapshots_t *)self->data;
+  dt_lib_snapshot_t *s = d->snapshot + 0;
+  _lib_snapshot_clear(s);
+
+  cairo_surface_flush(surface);
+  const int width = cairo_image_surface_get_width(surface);
+  const int height = cairo_image_surface_get_height(surface);
+  const int stride = cairo_image_surface_get_stride(surface);
+  const uint8_t *const in = cairo_image_surface_get_data(surface);
+  const size_t size = (size_t)stride * height;
+  uLongf length = compressBound(size);
+  uint8_t *filtered = (uint8_t *)malloc(size);
+  uint8_t *out = (uint8_t *)malloc(length);
+  if(!in || !filtered || !out)
+  {
+    free(filtered);
+    free(out);
+    return;
+  }
+
+#ifdef _OPENMP
+#pragma omp parallel for default(none) shared(filtered) schedule(static)
+#endif
+  for(int j = 0; j < height; j++)
+  {
+    const uint8_t *const row = in + (size_t)stride * j;
+    uint8_t *const f = filtered + (size_t)stride * j;
+    for(int i = 0; i < MIN(4, stride); i++) f[i] = row[i];
+    for(int i = 4; i < stride; i++) f[i] = row[i] - row[i - 4];
+  }
+
+  const int res = compress2(out, &length, filtered, size, 1);
+  free(filtered);
+  if(res != Z_OK)
+  {
+    fprintf(stderr, "[snapshots] can't compress snapshot\n");
+    free(out);
+    return;
+  }
+
+  uint8_t *data = (uint8_t *)realloc(out, length);
+  s->data = data ? data : out;
+  s->data_size = length;
+  s->width = width;
+  s->height = height;
+  s->stride = stride;
+  s->format = cairo_image_surface_get_format(surface);
+  s->used = ++d->use_count;
+  dt_print(DT_DEBUG_PERF, "[snapshots] %dx%d view compressed to %zu bytes\n", width, height, length);
+
+  _lib_snapshots_spill(d, s);
 }
 
 static void _lib_snapshots_toggled_callback(GtkToggleButton *widget, gpointer user_data)
@@ -404,7 +595,7 @@ static void _lib_snapshots_toggled_callback(GtkToggleButton *widget, gpointer us
 
     dt_dev_invalidate(darktable.develop);
 
-    d->snapshot_image = dt_cairo_image_surface_create_from_png(s->filename);
+    d->snapshot_image = _lib_snapshot_load(d, s);
   }
 
   /* redraw center view */
@@ -594,7 +785,14 @@ static int filename_member(lua_State *L)
   {
     return luaL_error(L, "Accessing a non-existant snapshot");
   }
-  lua_pushstring(L, d->snapshot[index].filename);
+  dt_lib_snapshot_t *s = d->snapshot + index;
+  cairo_surface_t *surface = _lib_snapshot_load(d, s);
+  if(surface)
+  {
+    cairo_surface_write_to_png(surface, s->filename);
+    cairo_surface_destroy(surface);
+  }
+  lua_pushstring(L, s->filename);
   return 1;
 }
 static int name_member(lua_State *L)
@@ -40,6 +40,9 @@
 
 DT_MODULE(1)
 
+// how many cells beyond either end of the strip get their thumbnails loaded in the background
+#define DT_LIB_FILMSTRIP_PREFETCH 4
+
 typedef enum dt_lib_filmstrip_select_t
 {
   DT_LIB_FILMSTRIP_SELECT_NONE,
@@ -69,6 +72,10 @@ typedef struct dt_lib_filmstrip_t
   dt_lib_filmstrip_select_t select;
   int32_t select_id;
 
+  // the first cell and the size the thumbnails around the strip were last requested for
+  int32_t prefetch_offset, prefetch_count;
+  dt_mipmap_size_t prefetch_mip;
+
   dt_gui_hist_dialog_t dg;
 } dt_lib_filmstrip_t;
 
@@ -290,6 +297,7 @@ void gui_init(dt_lib_module_t *self)
   d->mouse_over_id = -1;
   d->pointerx = -1;
   d->pointery = -1;
+  d->prefetch_offset = -1;
   dt_gui_hist_dialog_init(&d->dg);
 
   /* creating drawing area */
@@ -637,6 +645,44 @@ static gboolean _lib_filmstrip_button_release_callback(GtkWidget *w, GdkEventBut
   return result;
 }
 
+/* has the thumbnails of the cells next to the visible ones loaded in the background, so that they are there
+ * when the strip moves. only done again once the strip shows other images or at another size. */
+static void _lib_filmstrip_prefetch(dt_lib_filmstrip_t *strip, const int first, const int count, const float wd,
+                                    const float ht)
+{
+  if(!count) return;
+  // the size dt_view_image_expose() asks for
+  const dt_mipmap_size_t mip
+      = dt_mipmap_cache_get_matching_size(darktable.mipmap_cache, 0.9f * wd, 0.9f * ht);
+  if(first == strip->prefetch_offset && count == strip->prefetch_count && mip == strip->prefetch_mip) return;
+  strip->prefetch_offset = first;
+  strip->prefetch_count = count;
+  strip->prefetch_mip = mip;
+
+  int before[DT_LIB_FILMSTRIP_PREFETCH], after[DT_LIB_FILMSTRIP_PREFETCH];
+  const int start = MAX(first - DT_LIB_FILMSTRIP_PREFETCH, 0);
+  const int num_before = dt_collection_get_range(darktable.collection, start, first - start, before);
+  const int num_after
+      = dt_collection_get_range(darktable.collection, first + count, DT_LIB_FILMSTRIP_PREFETCH, after);
+
+  // nearest first, the jobs are run in order
+  for(int k = 0; k < DT_LIB_FILMSTRIP_PREFETCH; k++)
+  {
+    int ids[2];
+    int n = 0;
+    if(k < num_after) ids[n++] = after[k];
+    if(k < num_before) ids[n++] = before[num_before - 1 - k];
+    for(int i = 0; i < n; i++)
+    {
+      dt_mipmap_buffer_t buf;
+      dt_mipmap_cache_get(darktable.mipmap_cache, &buf, ids[i], mip, DT_MIPMAP_TESTLOCK, 'r');
+      const gboolean loaded = buf.buf != NULL;
+      dt_mipmap_cache_release(darktable.mipmap_cache, &buf);
+      if(!loaded) dt_mipmap_cache_get(darktable.mipmap_cache, NULL, ids[i], mip, DT_MIPMAP_PREFETCH, 'r');
+    }
+  }
+}
+
 static gboolean _lib_filmstrip_draw_callback(GtkWidget *widget, cairo_t *cr, gpointer user_data)
 {
   dt_lib_module_t *self = (dt_lib_module_t *)user_data;
@@ -671,9 +717,6 @@ static gboolean _lib_filmstrip_draw_callback(GtkWidget *widget, cairo_t *cr, gpo
 
   const int col_start = max_cols / 2 - strip->offset;
   const int empty_edge = (width - (max_cols * wd)) / 2;
-  int step_res = SQLITE_ROW;
-
-  sqlite3_stmt *stmt = NULL;
 
   /* mouse over image position in filmstrip */
   pointerx -= empty_edge;
@@ -685,38 +728,26 @@ static gboolean _lib_filmstrip_draw_callback(GtkWidget *widget, cairo_t *cr, gpo
   /* get the count of current collection */
   strip->collection_count = dt_collection_get_count(darktable.collection);
 
-  /* get the collection query */
-  const gchar *query = dt_collection_get_query(darktable.collection);
-  if(!query) return FALSE;
-
   if(offset < 0) strip->offset = offset = 0;
   if(offset > strip->collection_count - 1) strip->offset = offset = strip->collection_count - 1;
 
   // dt_view_set_scrollbar(self, offset, count, max_cols, 0, 1, 1);
 
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), query, -1, &stmt, NULL);
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, offset - max_cols / 2);
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, max_cols);
-
+  // only the cells on screen are looked up, in the images the collection keeps in memory. the thumbnails are
+  // taken as far as they are loaded, dt_view_image_expose() has the rest loaded and the strip redrawn then.
+  const int first = MAX(offset - max_cols / 2, 0);
+  int *ids = (int *)malloc(sizeof(int) * max_cols);
+  const int num_ids = ids ? dt_collection_get_range(darktable.collection, first, max_cols - MAX(col_start, 0), ids)
+                          : 0;
 
   cairo_save(cr);
   cairo_translate(cr, empty_edge, 0.0f);
   for(int col = 0; col < max_cols; col++)
   {
-    if(col < col_start)
+    const int k = col - MAX(col_start, 0);
+    if(k >= 0 && k < num_ids)
     {
-      cairo_translate(cr, wd, 0.0f);
-      continue;
-    }
-
-    if(step_res != SQLITE_DONE)
-    {
-      step_res = sqlite3_step(stmt);
-    }
-
-    if(step_res == SQLITE_ROW)
-    {
-      int id = sqlite3_column_int(stmt, 0);
+      const int id = ids[k];
       // set mouse over id
       if(seli == col)
       {
@@ -724,24 +755,16 @@ static gboolean _lib_filmstrip_draw_callback(GtkWidget *widget, cairo_t *cr, gpo
         dt_control_set_mouse_over_id(strip->mouse_over_id);
       }
       cairo_save(cr);
-      // FIXME find out where the y translation is done, how big the value is and use it directly instead of
-      // getting it from the matrix ...
-      cairo_matrix_t m;
-      cairo_get_matrix(cr, &m);
       dt_view_image_expose(&(strip->image_over), id, cr, wd, ht, max_cols, img_pointerx, img_pointery, FALSE, FALSE);
       cairo_restore(cr);
     }
-    else if(step_res == SQLITE_DONE)
-    {
-      /* do nothing, just add some empty thumb frames */
-    }
-    else
-      goto failure;
+    /* else just an empty thumb frame */
     cairo_translate(cr, wd, 0.0f);
   }
-failure:
   cairo_restore(cr);
-  sqlite3_finalize(stmt);
+  free(ids);
+
+  _lib_filmstrip_prefetch(strip, first, num_ids, wd, ht);
 
   if(darktable.gui->center_tooltip == 1) // set in this round
   {
@@ -768,6 +791,8 @@ failure:
 static void _lib_filmstrip_collection_changed_callback(gpointer instance, gpointer user_data)
 {
   dt_lib_module_t *self = (dt_lib_module_t *)user_data;
+  dt_lib_filmstrip_t *strip = (dt_lib_filmstrip_t *)self->data;
+  strip->prefetch_offset = -1;
   dt_control_queue_redraw_widget(self->widget);
 }
 
@@ -1070,18 +1095,13 @@ static void _lib_filmstrip_dnd_begin_callback(GtkWidget *widget, GdkDragContext
   // imgid part of selection -> do nothing
   // otherwise               -> select the current image
   strip->select = DT_LIB_FILMSTRIP_SELECT_NONE;
-  sqlite3_stmt *stmt;
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                              "SELECT imgid FROM main.selected_images WHERE imgid=?1 LIMIT 1", -1, &stmt, NULL);
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
-  if(sqlite3_step(stmt) != SQLITE_ROW)
+  if(!dt_selection_is_selected(darktable.selection, imgid))
   {
     dt_selection_select_single(darktable.selection, imgid);
     /* redraw filmstrip */
     if(darktable.view_manager->proxy.filmstrip.module)
       gtk_widget_queue_draw(darktable.view_manager->proxy.filmstrip.module->widget);
   }
-  sqlite3_finalize(stmt);
 
   // if we are dragging a single image -> use the thumbnail of that image
   // otherwise use the generic d&d icon
@@ -1115,6 +1135,8 @@ static void _lib_filmstrip_dnd_begin_callback(GtkWidget *widget, GdkDragContext
   }
 }
 
+#undef DT_LIB_FILMSTRIP_PREFETCH
+
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
 // kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
@@ -0,0 +1,393 @@
+/*
+   This file is part of darktable,
+   copyright (c) 2017 darktable developers.
+
+   darktable is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   darktable is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "lua/batch.h"
+#include "common/darktable.h"
+#include "common/imageio.h"
+#include "control/conf.h"
+#include "control/control.h"
+#include "control/jobs.h"
+#include "lua/call.h"
+#include "lua/image.h"
+#include "lua/types.h"
+
+/*
+   BATCH
+   * a batch writes a list of images from a few background jobs at once while the script goes on. every job
+     takes the next image off the batch until there are none left, with its own copy of the format parameters
+   * the batch object is the future the script gets back: it counts the images written, can be cancelled and
+     waited for. the progress and finished callbacks run on the lua thread, like events
+   * the object stays in the registry table "dt_lua_batch_running" until its finished callback ran, so the
+     jobs never point at a collected object. its __gc frees the batch
+   */
+
+typedef struct dt_lua_batch_data_t
+{
+  dt_pthread_mutex_t lock;
+  pthread_cond_t finished_cond;
+  dt_imageio_module_format_t *format;
+  gboolean high_quality, upscale;
+  gboolean has_progress; // a progress callback wants to know about every image
+  int total;
+  int32_t *images;
+  gchar **filenames;
+  int *status;           // per image: 0 if not written (yet), 1 if written, -1 if that failed
+  int next;              // index of the next image a job takes
+  int written, failed;
+  int running;           // jobs not disposed of yet
+  gboolean cancelled;
+} dt_lua_batch_data_t;
+
+typedef dt_lua_batch_data_t *dt_lua_batch_t;
+
+typedef struct dt_lua_batch_job_t
+{
+  dt_lua_batch_data_t *batch;
+  dt_imageio_module_data_t *fdata;
+} dt_lua_batch_job_t;
+
+static void _batch_free(dt_lua_batch_data_t *batch)
+{
+  dt_pthread_mutex_destroy(&batch->lock);
+  pthread_cond_destroy(&batch->finished_cond);
+  if(batch->filenames)
+    for(int k = 0; k < batch->total; k++) g_free(batch->filenames[k]);
+  free(batch->filenames);
+  free(batch->images);
+  free(batch->status);
+  free(batch);
+}
+
+static int _batch_finished(lua_State *L)
+{
+  dt_lua_batch_t batch;
+  luaA_to(L, dt_lua_batch_t, &batch, 1);
+  lua_getfield(L, LUA_REGISTRYINDEX, "dt_lua_batch_running");
+  lua_pushlightuserdata(L, batch);
+  lua_pushnil(L);
+  lua_settable(L, -3);
+  lua_pop(L, 1);
+
+  lua_getuservalue(L, 1);
+  lua_getfield(L, -1, "finished");
+  if(!lua_isnil(L, -1))
+  {
+    lua_pushvalue(L, 1);
+    lua_call(L, 1, 0);
+  }
+  else
+    lua_pop(L, 1);
+  lua_pop(L, 1);
+  return 0;
+}
+
+static int _batch_progress(lua_State *L)
+{
+  dt_lua_batch_t batch;
+  luaA_to(L, dt_lua_batch_t, &batch, 1);
+  const int k = luaL_checkinteger(L, 2);
+  lua_getuservalue(L, 1);
+  lua_getfield(L, -1, "progress");
+  dt_pthread_mutex_lock(&batch->lock);
+  const int status = batch->status[k];
+  dt_pthread_mutex_unlock(&batch->lock);
+  lua_pushvalue(L, 1);
+  luaA_push(L, dt_lua_image_t, &batch->images[k]);
+  lua_pushstring(L, batch->filenames[k]);
+  lua_pushboolean(L, status > 0);
+  lua_call(L, 4, 0);
+  lua_pop(L, 1);
+  return 0;
+}
+
+// a job is done with the batch. the last one tells the script
+static void _batch_release(dt_lua_batch_data_t *batch)
+{
+  dt_pthread_mutex_lock(&batch->lock);
+  const gboolean last = --batch->running == 0;
+  if(last) pthread_cond_broadcast(&batch->finished_cond);
+  dt_pthread_mutex_unlock(&batch->lock);
+  // the batch might be gone after this
+  if(last)
+    dt_lua_async_call_alien(_batch_finished, 0, NULL, NULL, LUA_ASYNC_TYPENAME, "dt_lua_batch_t", batch,
+                            LUA_ASYNC_DONE);
+}
+
+// index of the next image to write, -1 once there are none, the batch got cancelled or lua is shutting down
+static int _batch_next(dt_lua_batch_data_t *batch)
+{
+  int k = -1;
+  dt_pthread_mutex_lock(&batch->lock);
+  if(!batch->cancelled && batch->next < batch->total && !darktable.lua_state.ending) k = batch->next++;
+  dt_pthread_mutex_unlock(&batch->lock);
+  return k;
+}
+
+static int32_t _batch_job_run(dt_job_t *job)
+{
+  dt_lua_batch_job_t *params = (dt_lua_batch_job_t *)dt_control_job_get_params(job);
+  dt_lua_batch_data_t *batch = params->batch;
+  for(int k = _batch_next(batch); k >= 0; k = _batch_next(batch))
+  {
+    const int failed = dt_imageio_export(batch->images[k], batch->filenames[k], batch->format, params->fdata,
+                                         batch->high_quality, batch->upscale, FALSE, NULL, NULL, k + 1,
+                                         batch->total);
+    dt_pthread_mutex_lock(&batch->lock);
+    batch->status[k] = failed ? -1 : 1;
+    if(failed)
+      batch->failed++;
+    else
+      batch->written++;
+    dt_pthread_mutex_unlock(&batch->lock);
+
+    if(batch->has_progress)
+      dt_lua_async_call_alien(_batch_progress, 0, NULL, NULL, LUA_ASYNC_TYPENAME, "dt_lua_batch_t", batch,
+                              LUA_ASYNC_TYPENAME, "int32_t", GINT_TO_POINTER(k), LUA_ASYNC_DONE);
+  }
+  return 0;
+}
+
+// also called for jobs that never ran, so the batch always finishes
+static void _batch_job_destroy(void *data)
+{
+  dt_lua_batch_job_t *params = (dt_lua_batch_job_t *)data;
+  dt_lua_batch_data_t *batch = params->batch;
+  batch->format->free_params(batch->format, params->fdata);
+  free(params);
+  _batch_release(batch);
+}
+
+static void _batch_push_results(lua_State *L, dt_lua_batch_data_t *batch)
+{
+  lua_newtable(L);
+  dt_pthread_mutex_lock(&batch->lock);
+  for(int k = 0; k < batch->total; k++)
+  {
+    if(!batch->status[k]) continue;
+    lua_pushboolean(L, batch->status[k] > 0);
+    lua_seti(L, -2, k + 1);
+  }
+  dt_pthread_mutex_unlock(&batch->lock);
+}
+
+int dt_lua_batch_write_images(lua_State *L, dt_imageio_module_format_t *format, luaA_Type format_type)
+{
+  luaL_checktype(L, 2, LUA_TTABLE);
+  luaL_checktype(L, 3, LUA_TTABLE);
+  const int total = luaL_len(L, 2);
+  if(luaL_len(L, 3) != total) return luaL_argerror(L, 3, "as many file names as images expected");
+
+  int concurrency = dt_conf_get_int("plugins/lighttable/export/parallel");
+  gboolean high_quality = dt_conf_get_bool("plugins/lighttable/export/high_quality_processing");
+  gboolean upscale = FALSE;
+  if(!lua_isnoneornil(L, 4))
+  {
+    luaL_checktype(L, 4, LUA_TTABLE);
+    lua_getfield(L, 4, "concurrency");
+    if(!lua_isnil(L, -1)) concurrency = luaL_checkinteger(L, -1);
+    lua_getfield(L, 4, "high_quality");
+    if(!lua_isnil(L, -1)) high_quality = lua_toboolean(L, -1);
+    lua_getfield(L, 4, "upscale");
+    if(!lua_isnil(L, -1)) upscale = lua_toboolean(L, -1);
+    lua_getfield(L, 4, "progress");
+    luaL_argcheck(L, lua_isnil(L, -1) || lua_isfunction(L, -1), 4, "progress must be a function");
+    lua_getfield(L, 4, "finished");
+    luaL_argcheck(L, lua_isnil(L, -1) || lua_isfunction(L, -1), 4, "finished must be a function");
+    lua_pop(L, 5);
+  }
+
+  dt_lua_batch_data_t *batch = (dt_lua_batch_data_t *)calloc(1, sizeof(dt_lua_batch_data_t));
+  if(!batch) return luaL_error(L, "out of memory");
+  dt_pthread_mutex_init(&batch->lock, NULL);
+  pthread_cond_init(&batch->finished_cond, NULL);
+  batch->format = format;
+  batch->high_quality = high_quality;
+  batch->upscale = upscale;
+  batch->total = total;
+  batch->images = (int32_t *)calloc(MAX(total, 1), sizeof(int32_t));
+  batch->filenames = (gchar **)calloc(MAX(total, 1), sizeof(gchar *));
+  batch->status = (int *)calloc(MAX(total, 1), sizeof(int));
+  if(!batch->images || !batch->filenames || !batch->status)
+  {
+    _batch_free(batch);
+    return luaL_error(L, "out of memory");
+  }
+
+  // from here on the garbage collector frees the batch if any of the arguments is wrong
+  luaA_push(L, dt_lua_batch_t, &batch);
+  for(int k = 0; k < total; k++)
+  {
+    lua_geti(L, 2, k + 1);
+    luaA_to(L, dt_lua_image_t, &batch->images[k], -1);
+    lua_geti(L, 3, k + 1);
+    batch->filenames[k] = g_strdup(luaL_checkstring(L, -1));
+    lua_pop(L, 2);
+  }
+
+  if(!lua_isnoneornil(L, 4))
+  {
+    lua_getuservalue(L, -1);
+    lua_getfield(L, 4, "progress");
+    batch->has_progress = !lua_isnil(L, -1);
+    lua_setfield(L, -2, "progress");
+    lua_getfield(L, 4, "finished");
+    lua_setfield(L, -2, "finished");
+    lua_pop(L, 1);
+  }
+
+  // keep the object until the jobs are done with it
+  lua_getfield(L, LUA_REGISTRYINDEX, "dt_lua_batch_running");
+  lua_pushlightuserdata(L, batch);
+  lua_pushvalue(L, -3);
+  lua_settable(L, -3);
+  lua_pop(L, 1);
+
+  // every job holds a worker thread and a pipe for the whole batch
+  const int jobs = CLAMP(concurrency, 1, MAX(MIN(total, darktable.control->num_threads), 1));
+  batch->running = jobs;
+  for(int k = 0; k < jobs; k++)
+  {
+    dt_lua_batch_job_t *params = (dt_lua_batch_job_t *)calloc(1, sizeof(dt_lua_batch_job_t));
+    dt_imageio_module_data_t *fdata = format->get_params(format);
+    if(fdata) luaA_to_type(L, format_type, fdata, 1);
+    dt_job_t *job = params && fdata && total ? dt_control_job_create(&_batch_job_run, "lua: write images")
+                                             : NULL;
+    if(!job)
+    {
+      if(fdata) format->free_params(format, fdata);
+      free(params);
+      _batch_release(batch);
+      continue;
+    }
+    params->batch = batch;
+    params->fdata = fdata;
+    dt_control_job_set_params(job, params, _batch_job_destroy);
+    dt_control_add_job(darktable.control, DT_JOB_QUEUE_USER_BG, job);
+  }
+  dt_print(DT_DEBUG_LUA, "LUA DEBUG : writing %d images from %d jobs\n", total, jobs);
+  return 1;
+}
+
+static int total_member(lua_State *L)
+{
+  dt_lua_batch_t batch;
+  luaA_to(L, dt_lua_batch_t, &batch, 1);
+  lua_pushinteger(L, batch->total);
+  return 1;
+}
+
+static int written_member(lua_State *L)
+{
+  dt_lua_batch_t batch;
+  luaA_to(L, dt_lua_batch_t, &batch, 1);
+  dt_pthread_mutex_lock(&batch->lock);
+  lua_pushinteger(L, batch->written);
+  dt_pthread_mutex_unlock(&batch->lock);
+  return 1;
+}
+
+static int failed_member(lua_State *L)
+{
+  dt_lua_batch_t batch;
+  luaA_to(L, dt_lua_batch_t, &batch, 1);
+  dt_pthread_mutex_lock(&batch->lock);
+  lua_pushinteger(L, batch->failed);
+  dt_pthread_mutex_unlock(&batch->lock);
+  return 1;
+}
+
+static int finished_member(lua_State *L)
+{
+  dt_lua_batch_t batch;
+  luaA_to(L, dt_lua_batch_t, &batch, 1);
+  dt_pthread_mutex_lock(&batch->lock);
+  lua_pushboolean(L, batch->running == 0);
+  dt_pthread_mutex_unlock(&batch->lock);
+  return 1;
+}
+
+// true or false per image once it has been written or that failed, nil while it's pending or got cancelled
+static int results_member(lua_State *L)
+{
+  dt_lua_batch_t batch;
+  luaA_to(L, dt_lua_batch_t, &batch, 1);
+  _batch_push_results(L, batch);
+  return 1;
+}
+
+static int batch_cancel(lua_State *L)
+{
+  dt_lua_batch_t batch;
+  luaA_to(L, dt_lua_batch_t, &batch, 1);
+  dt_pthread_mutex_lock(&batch->lock);
+  batch->cancelled = TRUE;
+  dt_pthread_mutex_unlock(&batch->lock);
+  return 0;
+}
+
+// blocks until all jobs are done, the finished callback might not have run yet
+static int batch_wait(lua_State *L)
+{
+  dt_lua_batch_t batch;
+  luaA_to(L, dt_lua_batch_t, &batch, 1);
+  dt_lua_unlock();
+  dt_pthread_mutex_lock(&batch->lock);
+  while(batch->running) dt_pthread_cond_wait(&batch->finished_cond, &batch->lock);
+  dt_pthread_mutex_unlock(&batch->lock);
+  dt_lua_lock();
+  _batch_push_results(L, batch);
+  return 1;
+}
+
+static int batch_gc(lua_State *L)
+{
+  dt_lua_batch_t *batch = (dt_lua_batch_t *)lua_touserdata(L, 1);
+  if(*batch) _batch_free(*batch);
+  *batch = NULL;
+  return 0;
+}
+
+int dt_lua_init_batch(lua_State *L)
+{
+  lua_newtable(L);
+  lua_setfield(L, LUA_REGISTRYINDEX, "dt_lua_batch_running");
+
+  dt_lua_init_gpointer_type(L, dt_lua_batch_t);
+  lua_pushcfunction(L, total_member);
+  dt_lua_type_register_const(L, dt_lua_batch_t, "total");
+  lua_pushcfunction(L, written_member);
+  dt_lua_type_register_const(L, dt_lua_batch_t, "written");
+  lua_pushcfunction(L, failed_member);
+  dt_lua_type_register_const(L, dt_lua_batch_t, "failed");
+  lua_pushcfunction(L, finished_member);
+  dt_lua_type_register_const(L, dt_lua_batch_t, "finished");
+  lua_pushcfunction(L, results_member);
+  dt_lua_type_register_const(L, dt_lua_batch_t, "results");
+  lua_pushcfunction(L, batch_cancel);
+  lua_pushcclosure(L, dt_lua_type_member_common, 1);
+  dt_lua_type_register_const(L, dt_lua_batch_t, "cancel");
+  lua_pushcfunction(L, batch_wait);
+  lua_pushcclosure(L, dt_lua_type_member_common, 1);
+  dt_lua_type_register_const(L, dt_lua_batch_t, "wait");
+  lua_pushcfunction(L, batch_gc);
+  dt_lua_type_setmetafield(L, dt_lua_batch_t, "__gc");
+  return 0;
+}
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
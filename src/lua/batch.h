@@ -0,0 +1,35 @@
+/*
+   This file is part of darktable,
+   copyright (c) 2017 darktable developers.
+
+   darktable is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   darktable is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "common/imageio_module.h"
+#include <lua/lua.h>
+
+/*
+   implements format:write_images(images, filenames, options). the stack holds the format object at 1, a table
+   of images at 2, a table of as many file names at 3 and an optional table of options at 4.
+   pushes the batch object and returns 1.
+   */
+int dt_lua_batch_write_images(lua_State *L, dt_imageio_module_format_t *format, luaA_Type format_type);
+
+int dt_lua_init_batch(lua_State *L);
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
@@ -612,6 +612,71 @@ static int sleep_cb(lua_State*L)
   return 0;
 }
 
+static void push_timing(lua_State *L, const uint64_t count, const double sum, const double max,
+                        const uint32_t *histogram)
+{
+  lua_newtable(L);
+  lua_pushnumber(L, count ? sum / count : 0.0);
+  lua_setfield(L, -2, "mean");
+  lua_pushnumber(L, max);
+  lua_setfield(L, -2, "max");
+  lua_newtable(L);
+  for(int k = 0; k < DT_CONTROL_JOB_STATS_BUCKETS; k++)
+  {
+    lua_pushinteger(L, histogram[k]);
+    lua_seti(L, -2, k + 1);
+  }
+  lua_setfield(L, -2, "histogram");
+}
+
+// same layout as dt_control_jobs_stats_json(), with the job types as keys
+static int job_stats_cb(lua_State *L)
+{
+  GList *list = dt_control_jobs_stats_get(darktable.control);
+  lua_newtable(L);
+
+  lua_newtable(L);
+  for(int q = 0; q < DT_JOB_QUEUE_MAX; q++)
+  {
+    lua_pushinteger(L, dt_control_jobs_queued(darktable.control, q));
+    lua_setfield(L, -2, dt_control_jobs_queue_name(q));
+  }
+  lua_setfield(L, -2, "queues");
+
+  lua_newtable(L);
+  for(int k = 0; k < DT_CONTROL_JOB_STATS_BUCKETS - 1; k++)
+  {
+    lua_pushinteger(L, 1 << k);
+    lua_seti(L, -2, k + 1);
+  }
+  lua_setfield(L, -2, "histogram_ms");
+
+  double rate = 0.0;
+  lua_newtable(L);
+  for(GList *iter = list; iter; iter = g_list_next(iter))
+  {
+    const dt_control_job_stats_t *stats = (dt_control_job_stats_t *)iter->data;
+    rate += dt_control_jobs_stats_rate(stats);
+    lua_newtable(L);
+    lua_pushinteger(L, stats->count);
+    lua_setfield(L, -2, "count");
+    lua_pushnumber(L, dt_control_jobs_stats_rate(stats));
+    lua_setfield(L, -2, "jobs_per_second");
+    push_timing(L, stats->count, stats->wait_sum, stats->wait_max, stats->wait_histogram);
+    lua_setfield(L, -2, "wait");
+    push_timing(L, stats->count, stats->run_sum, stats->run_max, stats->run_histogram);
+    lua_setfield(L, -2, "run");
+    lua_setfield(L, -2, stats->type);
+  }
+  lua_setfield(L, -2, "types");
+
+  lua_pushnumber(L, rate);
+  lua_setfield(L, -2, "jobs_per_second");
+
+  g_list_free_full(list, dt_control_jobs_stats_free);
+  return 1;
+}
+
 #if !defined (_WIN32)
 static int read_cb(lua_State*L)
 {
@@ -709,6 +774,9 @@ int dt_lua_init_call(lua_State *L)
   lua_pushcfunction(L,sleep_cb);
   lua_pushcclosure(L, dt_lua_type_member_common, 1);
   dt_lua_type_register_const_type(L, type_id, "sleep");
+  lua_pushcfunction(L, job_stats_cb);
+  lua_pushcclosure(L, dt_lua_type_member_common, 1);
+  dt_lua_type_register_const_type(L, type_id, "job_stats");
 #if !defined (_WIN32)
   lua_pushcfunction(L,read_cb);
   lua_pushcclosure(L, dt_lua_type_member_common, 1);
@@ -244,6 +244,12 @@ int dt_lua_init_database(lua_State *L)
   lua_pushcfunction(L, dt_lua_copy_image);
   lua_pushcclosure(L, dt_lua_type_member_common, 1);
   dt_lua_type_register_const_type(L, type_id, "copy_image");
+  lua_pushcfunction(L, dt_lua_image_get_properties);
+  lua_pushcclosure(L, dt_lua_type_member_common, 1);
+  dt_lua_type_register_const_type(L, type_id, "get_properties");
+  lua_pushcfunction(L, dt_lua_image_set_properties);
+  lua_pushcclosure(L, dt_lua_type_member_common, 1);
+  dt_lua_type_register_const_type(L, type_id, "set_properties");
 
   /* database type */
   dt_lua_push_darktable_lib(L);
@@ -17,6 +17,7 @@
  */
 #include "common/imageio.h"
 #include "control/conf.h"
+#include "lua/batch.h"
 #include "lua/image.h"
 #include "lua/modules.h"
 #include "lua/types.h"
@@ -165,6 +166,21 @@ static int write_image(lua_State *L)
   return 1;
 }
 
+// like write_image, but on background jobs and for many images at once
+static int write_images(lua_State *L)
+{
+  luaL_argcheck(L, dt_lua_isa(L, 1, dt_imageio_module_format_t), -1, "dt_imageio_module_format_t expected");
+
+  lua_getmetatable(L, 1);
+  lua_getfield(L, -1, "__luaA_Type");
+  luaA_Type format_type = luaL_checkinteger(L, -1);
+  lua_pop(L, 1);
+  lua_getfield(L, -1, "__associated_object");
+  dt_imageio_module_format_t *format = lua_touserdata(L, -1);
+  lua_pop(L, 2);
+  return dt_lua_batch_write_images(L, format, format_type);
+}
+
 void dt_lua_register_format_type(lua_State *L, dt_imageio_module_format_t *module, luaA_Type type_id)
 {
   dt_lua_type_register_parent_type(L, type_id, luaA_type_find(L, "dt_imageio_module_format_t"));
@@ -204,6 +220,9 @@ int dt_lua_init_early_format(lua_State *L)
   lua_pushcfunction(L, write_image);
   lua_pushcclosure(L, dt_lua_type_member_common, 1);
   dt_lua_type_register_const(L, dt_imageio_module_format_t, "write_image");
+  lua_pushcfunction(L, write_images);
+  lua_pushcclosure(L, dt_lua_type_member_common, 1);
+  dt_lua_type_register_const(L, dt_imageio_module_format_t, "write_images");
 
   dt_lua_module_new(L, "format");
 
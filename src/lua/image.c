@@ -178,16 +178,20 @@ static int group_leader_member(lua_State *L)
 }
 
 
+static int image_rating(const dt_image_t *image)
+{
+  int score = image->flags & 0x7;
+  if(score > 6) score = 5;
+  if(score == 6) score = -1;
+  return score;
+}
+
 static int rating_member(lua_State *L)
 {
   if(lua_gettop(L) != 3)
   {
     const dt_image_t *my_image = checkreadimage(L, 1);
-    int score = my_image->flags & 0x7;
-    if(score > 6) score = 5;
-    if(score == 6) score = -1;
-
-    lua_pushinteger(L, score);
+    lua_pushinteger(L, image_rating(my_image));
     releasereadimage(L, my_image);
     return 1;
   }
@@ -498,6 +502,474 @@ static int image_luaautoc_member(lua_State *L)
   }
 }
 
+///////////////
+// bulk access
+///////////////
+typedef enum dt_lua_image_property_kind_t
+{
+  DT_LUA_IMAGE_STRUCT, // a member of dt_image_t, converted by lautoc
+  DT_LUA_IMAGE_PATH,
+  DT_LUA_IMAGE_SIDECAR,
+  DT_LUA_IMAGE_DUPLICATE_INDEX,
+  DT_LUA_IMAGE_IS_LDR,
+  DT_LUA_IMAGE_IS_HDR,
+  DT_LUA_IMAGE_IS_RAW,
+  DT_LUA_IMAGE_ID,
+  DT_LUA_IMAGE_FILM,
+  DT_LUA_IMAGE_GROUP_LEADER,
+  DT_LUA_IMAGE_RATING,
+  DT_LUA_IMAGE_HAS_TXT,
+  DT_LUA_IMAGE_LOCAL_COPY,
+  DT_LUA_IMAGE_METADATA,
+  DT_LUA_IMAGE_COLORLABEL
+} dt_lua_image_property_kind_t;
+
+typedef struct dt_lua_image_property_t
+{
+  const char *name;
+  dt_lua_image_property_kind_t kind;
+  const char *key; // of the metadata
+  int keyid;       // of the metadata, or the color label
+  gboolean writable;
+} dt_lua_image_property_t;
+
+static const struct
+{
+  const char *name;
+  dt_lua_image_property_kind_t kind;
+  gboolean writable;
+} bulk_members[] = { { "path", DT_LUA_IMAGE_PATH, FALSE },
+                     { "sidecar", DT_LUA_IMAGE_SIDECAR, FALSE },
+                     { "duplicate_index", DT_LUA_IMAGE_DUPLICATE_INDEX, FALSE },
+                     { "is_ldr", DT_LUA_IMAGE_IS_LDR, FALSE },
+                     { "is_hdr", DT_LUA_IMAGE_IS_HDR, FALSE },
+                     { "is_raw", DT_LUA_IMAGE_IS_RAW, FALSE },
+                     { "id", DT_LUA_IMAGE_ID, FALSE },
+                     { "film", DT_LUA_IMAGE_FILM, FALSE },
+                     { "group_leader", DT_LUA_IMAGE_GROUP_LEADER, FALSE },
+                     { "rating", DT_LUA_IMAGE_RATING, TRUE },
+                     { "has_txt", DT_LUA_IMAGE_HAS_TXT, TRUE },
+                     { "local_copy", DT_LUA_IMAGE_LOCAL_COPY, FALSE }, // copies files, one image at a time
+                     { NULL, 0, FALSE } };
+
+static const char *bulk_metadata[][2] = { { "creator", "Xmp.dc.creator" },
+                                          { "publisher", "Xmp.dc.publisher" },
+                                          { "title", "Xmp.dc.title" },
+                                          { "description", "Xmp.dc.description" },
+                                          { "rights", "Xmp.dc.rights" },
+                                          { NULL, NULL } };
+
+// what the property name at index is, raises an error for unknown ones
+static void bulk_property(lua_State *L, int index, dt_lua_image_property_t *prop)
+{
+  if(lua_type(L, index) != LUA_TSTRING) luaL_error(L, "image property names have to be strings");
+  const char *name = lua_tostring(L, index);
+  *prop = (dt_lua_image_property_t){ .name = name };
+  for(int k = 0; bulk_members[k].name; k++)
+    if(!strcmp(name, bulk_members[k].name))
+    {
+      prop->kind = bulk_members[k].kind;
+      prop->writable = bulk_members[k].writable;
+      return;
+    }
+  for(int k = 0; bulk_metadata[k][0]; k++)
+    if(!strcmp(name, bulk_metadata[k][0]))
+    {
+      prop->kind = DT_LUA_IMAGE_METADATA;
+      prop->key = bulk_metadata[k][1];
+      prop->keyid = dt_metadata_get_keyid(prop->key);
+      prop->writable = TRUE;
+      return;
+    }
+  for(int k = 0; dt_colorlabels_name[k]; k++)
+    if(!strcmp(name, dt_colorlabels_name[k]))
+    {
+      prop->kind = DT_LUA_IMAGE_COLORLABEL;
+      prop->keyid = k;
+      prop->writable = TRUE;
+      return;
+    }
+  if(luaA_struct_has_member_name(L, dt_image_t, name))
+  {
+    const luaA_Type member_type = luaA_struct_typeof_member_name(L, dt_image_t, name);
+    prop->kind = DT_LUA_IMAGE_STRUCT;
+    prop->writable = luaA_conversion_to_registered_type(L, member_type)
+                     || luaA_struct_registered_type(L, member_type) || luaA_enum_registered_type(L, member_type);
+    return;
+  }
+  luaL_error(L, "unknown image property : %s", name);
+}
+
+// the image ids at index, in a userdata that is collected with the stack
+static int32_t *bulk_images(lua_State *L, int index, int *num)
+{
+  luaL_checktype(L, index, LUA_TTABLE);
+  *num = luaL_len(L, index);
+  int32_t *ids = (int32_t *)lua_newuserdata(L, MAX(*num, 1) * sizeof(int32_t));
+  for(int k = 0; k < *num; k++)
+  {
+    lua_geti(L, index, k + 1);
+    luaA_to(L, dt_lua_image_t, &ids[k], -1);
+    lua_pop(L, 1);
+  }
+  return ids;
+}
+
+// puts the images into memory.lua_images, for the queries to join
+static void bulk_fill_images(sqlite3 *db, const int32_t *ids, const int num)
+{
+  sqlite3_stmt *stmt;
+  DT_DEBUG_SQLITE3_EXEC(db, "DELETE FROM memory.lua_images", NULL, NULL, NULL);
+  DT_DEBUG_SQLITE3_PREPARE_V2(db, "INSERT OR IGNORE INTO memory.lua_images (imgid) VALUES (?1)", -1, &stmt, NULL);
+  for(int k = 0; k < num; k++)
+  {
+    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, ids[k]);
+    sqlite3_step(stmt);
+    sqlite3_reset(stmt);
+  }
+  sqlite3_finalize(stmt);
+}
+
+// sets field name of the row of imgid to the value on top of the stack, which gets popped
+static void bulk_set_row(lua_State *L, int result, GHashTable *rows, const int imgid, const char *name)
+{
+  const int row = GPOINTER_TO_INT(g_hash_table_lookup(rows, GINT_TO_POINTER(imgid)));
+  if(!row)
+  {
+    lua_pop(L, 1);
+    return;
+  }
+  lua_geti(L, result, row);
+  lua_insert(L, -2);
+  lua_setfield(L, -2, name);
+  lua_pop(L, 1);
+}
+
+int dt_lua_image_get_properties(lua_State *L)
+{
+  int num_images = 0;
+  const int32_t *ids = bulk_images(L, 1, &num_images);
+  luaL_checktype(L, 2, LUA_TTABLE);
+  const int num_props = luaL_len(L, 2);
+  dt_lua_image_property_t *props
+      = (dt_lua_image_property_t *)lua_newuserdata(L, MAX(num_props, 1) * sizeof(dt_lua_image_property_t));
+  gboolean need_cache = FALSE, need_paths = FALSE, need_metadata = FALSE, need_labels = FALSE;
+  for(int p = 0; p < num_props; p++)
+  {
+    lua_geti(L, 2, p + 1);
+    bulk_property(L, -1, &props[p]);
+    // the name stays valid while the table holds it
+    lua_pop(L, 1);
+    switch(props[p].kind)
+    {
+      case DT_LUA_IMAGE_PATH:
+        need_paths = TRUE;
+        break;
+      case DT_LUA_IMAGE_SIDECAR:
+        need_paths = need_cache = TRUE; // local copies
+        break;
+      case DT_LUA_IMAGE_METADATA:
+        need_metadata = TRUE;
+        break;
+      case DT_LUA_IMAGE_COLORLABEL:
+        need_labels = TRUE;
+        break;
+      default:
+        need_cache = TRUE;
+        break;
+    }
+  }
+
+  // one row per image, the same table for an image listed twice. a row starts out with what an image without
+  // metadata and color labels has.
+  lua_newtable(L);
+  const int result = lua_gettop(L);
+  GHashTable *rows = g_hash_table_new(NULL, NULL);
+  for(int k = 0; k < num_images; k++)
+  {
+    const int row = GPOINTER_TO_INT(g_hash_table_lookup(rows, GINT_TO_POINTER(ids[k])));
+    if(row)
+    {
+      lua_geti(L, result, row);
+      lua_seti(L, result, k + 1);
+      continue;
+    }
+    g_hash_table_insert(rows, GINT_TO_POINTER(ids[k]), GINT_TO_POINTER(k + 1));
+    lua_newtable(L);
+    for(int p = 0; p < num_props; p++)
+    {
+      if(props[p].kind == DT_LUA_IMAGE_METADATA)
+        lua_pushstring(L, "");
+      else if(props[p].kind == DT_LUA_IMAGE_COLORLABEL)
+        lua_pushboolean(L, FALSE);
+      else
+        continue;
+      lua_setfield(L, -2, props[p].name);
+    }
+    lua_seti(L, result, k + 1);
+  }
+
+  if(num_images && (need_paths || need_metadata || need_labels))
+  {
+    sqlite3 *db = dt_database_get(darktable.db);
+    const gboolean transaction = sqlite3_get_autocommit(db);
+    if(transaction) sqlite3_exec(db, "BEGIN TRANSACTION", NULL, NULL, NULL);
+    bulk_fill_images(db, ids, num_images);
+    sqlite3_stmt *stmt;
+    if(need_paths)
+    {
+      DT_DEBUG_SQLITE3_PREPARE_V2(db, "SELECT i.id, f.folder, i.filename, i.version FROM main.images AS i "
+                                      "JOIN memory.lua_images AS l ON l.imgid = i.id "
+                                      "JOIN main.film_rolls AS f ON f.id = i.film_id",
+                                  -1, &stmt, NULL);
+      while(sqlite3_step(stmt) == SQLITE_ROW)
+      {
+        const int imgid = sqlite3_column_int(stmt, 0);
+        const char *folder = (const char *)sqlite3_column_text(stmt, 1);
+        const char *filename = (const char *)sqlite3_column_text(stmt, 2);
+        for(int p = 0; p < num_props; p++)
+        {
+          if(props[p].kind == DT_LUA_IMAGE_PATH)
+            lua_pushstring(L, folder);
+          else if(props[p].kind == DT_LUA_IMAGE_SIDECAR)
+          {
+            char sidecar[PATH_MAX] = { 0 };
+            snprintf(sidecar, sizeof(sidecar), "%s/%s", folder, filename);
+            dt_image_path_append_version_no_db(sqlite3_column_int(stmt, 3), sidecar, sizeof(sidecar));
+            g_strlcat(sidecar, ".xmp", sizeof(sidecar));
+            lua_pushstring(L, sidecar);
+          }
+          else
+            continue;
+          bulk_set_row(L, result, rows, imgid, props[p].name);
+        }
+      }
+      sqlite3_finalize(stmt);
+    }
+    if(need_metadata)
+    {
+      DT_DEBUG_SQLITE3_PREPARE_V2(db, "SELECT m.id, m.key, m.value FROM main.meta_data AS m "
+                                      "JOIN memory.lua_images AS l ON l.imgid = m.id",
+                                  -1, &stmt, NULL);
+      while(sqlite3_step(stmt) == SQLITE_ROW)
+        for(int p = 0; p < num_props; p++)
+          if(props[p].kind == DT_LUA_IMAGE_METADATA && props[p].keyid == sqlite3_column_int(stmt, 1))
+          {
+            lua_pushstring(L, (const char *)sqlite3_column_text(stmt, 2));
+            bulk_set_row(L, result, rows, sqlite3_column_int(stmt, 0), props[p].name);
+          }
+      sqlite3_finalize(stmt);
+    }
+    if(need_labels)
+    {
+      DT_DEBUG_SQLITE3_PREPARE_V2(db, "SELECT c.imgid, c.color FROM main.color_labels AS c "
+                                      "JOIN memory.lua_images AS l ON l.imgid = c.imgid",
+                                  -1, &stmt, NULL);
+      while(sqlite3_step(stmt) == SQLITE_ROW)
+        for(int p = 0; p < num_props; p++)
+          if(props[p].kind == DT_LUA_IMAGE_COLORLABEL && props[p].keyid == sqlite3_column_int(stmt, 1))
+          {
+            lua_pushboolean(L, TRUE);
+            bulk_set_row(L, result, rows, sqlite3_column_int(stmt, 0), props[p].name);
+          }
+      sqlite3_finalize(stmt);
+    }
+    DT_DEBUG_SQLITE3_EXEC(db, "DELETE FROM memory.lua_images", NULL, NULL, NULL);
+    if(transaction) sqlite3_exec(db, "COMMIT", NULL, NULL, NULL);
+  }
+
+  // one cache lookup per image for everything in dt_image_t
+  for(int k = 0; need_cache && k < num_images; k++)
+  {
+    if(GPOINTER_TO_INT(g_hash_table_lookup(rows, GINT_TO_POINTER(ids[k]))) != k + 1) continue;
+    const dt_image_t *image = dt_image_cache_get(darktable.image_cache, ids[k], 'r');
+    if(!image) continue;
+    lua_geti(L, result, k + 1);
+    for(int p = 0; p < num_props; p++)
+    {
+      switch(props[p].kind)
+      {
+        case DT_LUA_IMAGE_STRUCT:
+          luaA_struct_push_member_name(L, dt_image_t, props[p].name, image);
+          break;
+        case DT_LUA_IMAGE_SIDECAR:
+        {
+          if(!(image->flags & DT_IMAGE_LOCAL_COPY)) continue;
+          gboolean from_cache = TRUE;
+          char sidecar[PATH_MAX] = { 0 };
+          dt_image_full_path(image->id, sidecar, sizeof(sidecar), &from_cache);
+          dt_image_path_append_version_no_db(image->version, sidecar, sizeof(sidecar));
+          g_strlcat(sidecar, ".xmp", sizeof(sidecar));
+          lua_pushstring(L, sidecar);
+          break;
+        }
+        case DT_LUA_IMAGE_DUPLICATE_INDEX:
+          lua_pushinteger(L, image->version);
+          break;
+        case DT_LUA_IMAGE_IS_LDR:
+          lua_pushboolean(L, dt_image_is_ldr(image));
+          break;
+        case DT_LUA_IMAGE_IS_HDR:
+          lua_pushboolean(L, dt_image_is_hdr(image));
+          break;
+        case DT_LUA_IMAGE_IS_RAW:
+          lua_pushboolean(L, dt_image_is_raw(image));
+          break;
+        case DT_LUA_IMAGE_ID:
+          lua_pushinteger(L, image->id);
+          break;
+        case DT_LUA_IMAGE_FILM:
+          luaA_push(L, dt_lua_film_t, &image->film_id);
+          break;
+        case DT_LUA_IMAGE_GROUP_LEADER:
+          luaA_push(L, dt_lua_image_t, &image->group_id);
+          break;
+        case DT_LUA_IMAGE_RATING:
+          lua_pushinteger(L, image_rating(image));
+          break;
+        case DT_LUA_IMAGE_HAS_TXT:
+          lua_pushboolean(L, image->flags & DT_IMAGE_HAS_TXT);
+          break;
+        case DT_LUA_IMAGE_LOCAL_COPY:
+          lua_pushboolean(L, image->flags & DT_IMAGE_LOCAL_COPY);
+          break;
+        default:
+          continue;
+      }
+      lua_setfield(L, -2, props[p].name);
+    }
+    lua_pop(L, 1);
+    dt_image_cache_read_release(darktable.image_cache, image);
+  }
+  g_hash_table_destroy(rows);
+  return 1;
+}
+
+// raises an error if the value at index can't be written to prop, before any image gets locked
+static void bulk_check_value(lua_State *L, const dt_lua_image_property_t *prop, int index)
+{
+  if(!prop->writable) luaL_error(L, "image property %s can't be written in bulk", prop->name);
+  if(prop->kind == DT_LUA_IMAGE_STRUCT)
+  {
+    dt_image_t scratch;
+    memset(&scratch, 0, sizeof(scratch));
+    luaA_struct_to_member_name(L, dt_image_t, prop->name, &scratch, index);
+  }
+  else if(prop->kind == DT_LUA_IMAGE_RATING)
+  {
+    const int score = luaL_checkinteger(L, index);
+    if(score > 5) luaL_error(L, "rating too high : %d", score);
+    if(score < -1) luaL_error(L, "rating too low : %d", score);
+  }
+  else if(prop->kind == DT_LUA_IMAGE_METADATA && !lua_isstring(L, index))
+    luaL_error(L, "string expected for image property %s", prop->name);
+}
+
+int dt_lua_image_set_properties(lua_State *L)
+{
+  int num_images = 0;
+  const int32_t *ids = bulk_images(L, 1, &num_images);
+  luaL_checktype(L, 2, LUA_TTABLE);
+  // a list of one table of values per image, or one table for all of them
+  lua_geti(L, 2, 1);
+  const gboolean per_image = lua_istable(L, -1);
+  lua_pop(L, 1);
+  if(per_image && luaL_len(L, 2) != num_images)
+    return luaL_argerror(L, 2, "one table of values per image expected");
+
+  const int num_tables = per_image ? num_images : 1;
+  for(int k = 0; k < num_tables; k++)
+  {
+    if(per_image)
+      lua_geti(L, 2, k + 1);
+    else
+      lua_pushvalue(L, 2);
+    luaL_checktype(L, -1, LUA_TTABLE);
+    lua_pushnil(L);
+    while(lua_next(L, -2))
+    {
+      dt_lua_image_property_t prop;
+      bulk_property(L, -2, &prop);
+      bulk_check_value(L, &prop, -1);
+      lua_pop(L, 1);
+    }
+    lua_pop(L, 1);
+  }
+
+  // the images go to sql together, the changes to their sidecars get merged
+  sqlite3 *db = dt_database_get(darktable.db);
+  const gboolean transaction = sqlite3_get_autocommit(db);
+  if(transaction) sqlite3_exec(db, "BEGIN TRANSACTION", NULL, NULL, NULL);
+  GList *sidecars = NULL;
+  for(int k = 0; k < num_images; k++)
+  {
+    if(per_image)
+      lua_geti(L, 2, k + 1);
+    else
+      lua_pushvalue(L, 2);
+    dt_image_t *image = NULL;
+    gboolean sidecar = FALSE;
+    lua_pushnil(L);
+    while(lua_next(L, -2))
+    {
+      dt_lua_image_property_t prop;
+      bulk_property(L, -2, &prop);
+      if(!image && (prop.kind == DT_LUA_IMAGE_STRUCT || prop.kind == DT_LUA_IMAGE_RATING
+                    || prop.kind == DT_LUA_IMAGE_HAS_TXT))
+        image = dt_image_cache_get(darktable.image_cache, ids[k], 'w');
+      if(!image && (prop.kind == DT_LUA_IMAGE_STRUCT || prop.kind == DT_LUA_IMAGE_RATING
+                    || prop.kind == DT_LUA_IMAGE_HAS_TXT))
+        prop.kind = DT_LUA_IMAGE_ID; // gone from the library, nothing to write
+      switch(prop.kind)
+      {
+        case DT_LUA_IMAGE_STRUCT:
+          luaA_struct_to_member_name(L, dt_image_t, prop.name, image, -1);
+          break;
+        case DT_LUA_IMAGE_RATING:
+        {
+          int score = lua_tointeger(L, -1);
+          if(score == -1) score = 6;
+          image->flags = (image->flags & ~0x7) | score;
+          break;
+        }
+        case DT_LUA_IMAGE_HAS_TXT:
+          if(lua_toboolean(L, -1))
+            image->flags |= DT_IMAGE_HAS_TXT;
+          else
+            image->flags &= ~DT_IMAGE_HAS_TXT;
+          break;
+        case DT_LUA_IMAGE_METADATA:
+          dt_metadata_set(ids[k], prop.key, lua_tostring(L, -1));
+          sidecar = TRUE;
+          break;
+        case DT_LUA_IMAGE_COLORLABEL:
+          if(lua_toboolean(L, -1))
+            dt_colorlabels_set_label(ids[k], prop.keyid);
+          else
+            dt_colorlabels_remove_label(ids[k], prop.keyid);
+          sidecar = TRUE;
+          break;
+        default:
+          break;
+      }
+      lua_pop(L, 1);
+    }
+    lua_pop(L, 1);
+    // those get their sidecar with the flush
+    if(image)
+      dt_image_cache_write_release(darktable.image_cache, image, DT_IMAGE_CACHE_DEFERRED);
+    else if(sidecar)
+      sidecars = g_list_prepend(sidecars, GINT_TO_POINTER(ids[k]));
+  }
+  dt_image_cache_flush(darktable.image_cache);
+  if(transaction) sqlite3_exec(db, "COMMIT", NULL, NULL, NULL);
+
+  for(GList *iter = sidecars; iter; iter = g_list_next(iter))
+    dt_image_write_sidecar_file(GPOINTER_TO_INT(iter->data));
+  g_list_free(sidecars);
+  return 0;
+}
+
 int dt_lua_init_image(lua_State *L)
 {
   luaA_struct(L, dt_image_t);
@@ -23,6 +23,15 @@
 
 typedef int dt_lua_image_t; // wrapper for dt_image_t id
 
+/*
+   bulk access to the properties of many images at once, without a member call per image and property.
+   get_properties(images, names) returns a table with one table of the named properties per image.
+   set_properties(images, values) takes one table of name = value for all images, or a list of one such table per
+   image, and writes them in a single transaction.
+   */
+int dt_lua_image_get_properties(lua_State *L);
+int dt_lua_image_set_properties(lua_State *L);
+
 int dt_lua_init_image(lua_State *L);
 
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
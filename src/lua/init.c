@@ -20,6 +20,7 @@
 #include "common/file_location.h"
 #include "control/jobs.h"
 #include "lua/cairo.h"
+#include "lua/batch.h"
 #include "lua/call.h"
 #include "lua/configuration.h"
 #include "lua/database.h"
@@ -36,6 +37,7 @@
 #include "lua/lualib.h"
 #include "lua/luastorage.h"
 #include "lua/modules.h"
+#include "lua/perf.h"
 #include "lua/preferences.h"
 #include "lua/print.h"
 #include "lua/storage.h"
@@ -134,7 +136,7 @@ static lua_CFunction init_funcs[]
         dt_lua_init_luastorages,   dt_lua_init_tags,        dt_lua_init_film,     dt_lua_init_call,
         dt_lua_init_view,          dt_lua_init_events,      dt_lua_init_init,     dt_lua_init_widget,
         dt_lua_init_lualib,        dt_lua_init_gettext,     dt_lua_init_guides,   dt_lua_init_cairo,
-        NULL };
+        dt_lua_init_perf,          dt_lua_init_batch,       NULL };
 
 
 void dt_lua_init(lua_State *L, const char *lua_command)
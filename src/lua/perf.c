@@ -0,0 +1,204 @@
+/*
+   This file is part of darktable,
+   copyright (c) 2017 darktable developers.
+
+   darktable is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   darktable is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "lua/perf.h"
+#include "common/image_cache.h"
+#include "common/mipmap_cache.h"
+#include "common/timers.h"
+#include "develop/develop.h"
+#include "develop/pixelpipe_hb.h"
+#include "develop/pixelpipe_report.h"
+#include "lua/lua.h"
+
+// returns the json reports of the last pixelpipe runs, oldest first
+static int pixelpipe_reports(lua_State *L)
+{
+  gchar **lines = dt_dev_pixelpipe_report_get_recent();
+  lua_newtable(L);
+  for(int k = 0; lines[k]; k++)
+  {
+    lua_pushstring(L, lines[k]);
+    lua_seti(L, -2, k + 1);
+  }
+  g_strfreev(lines);
+  return 1;
+}
+
+// the aggregated timers, one table per node in depth first order, times in milliseconds
+static int timers(lua_State *L)
+{
+  dt_timers_stat_t *stats = NULL;
+  const int count = dt_timers_get_stats(&stats);
+  lua_newtable(L);
+  for(int k = 0; k < count; k++)
+  {
+    const dt_timers_stat_t *s = stats + k;
+    lua_newtable(L);
+    lua_pushstring(L, s->path);
+    lua_setfield(L, -2, "path");
+    lua_pushinteger(L, s->depth);
+    lua_setfield(L, -2, "depth");
+    lua_pushinteger(L, s->count);
+    lua_setfield(L, -2, "count");
+    lua_pushnumber(L, s->total / 1000.0);
+    lua_setfield(L, -2, "total");
+    lua_pushnumber(L, s->min / 1000.0);
+    lua_setfield(L, -2, "min");
+    lua_pushnumber(L, s->max / 1000.0);
+    lua_setfield(L, -2, "max");
+    lua_pushnumber(L, s->p50 / 1000.0);
+    lua_setfield(L, -2, "p50");
+    lua_pushnumber(L, s->p95 / 1000.0);
+    lua_setfield(L, -2, "p95");
+    lua_seti(L, -2, k + 1);
+  }
+  dt_timers_free_stats(stats, count);
+  return 1;
+}
+
+// collecting is switched on with a true argument and off with false, returns whether it is on
+static int timers_enabled(lua_State *L)
+{
+  if(lua_gettop(L) > 0) dt_timers_set_enabled(lua_toboolean(L, 1));
+  lua_pushboolean(L, dt_timers_enabled);
+  return 1;
+}
+
+static int timers_reset(lua_State *L)
+{
+  dt_timers_reset();
+  return 0;
+}
+
+static void _push_cache_stats(lua_State *L, const dt_cache_stats_t *s, const int index)
+{
+  lua_newtable(L);
+  lua_pushstring(L, s->name);
+  lua_setfield(L, -2, "name");
+  lua_pushstring(L, s->unit);
+  lua_setfield(L, -2, "unit");
+  lua_pushinteger(L, s->used);
+  lua_setfield(L, -2, "used");
+  lua_pushinteger(L, s->quota);
+  lua_setfield(L, -2, "quota");
+  lua_pushinteger(L, s->hits);
+  lua_setfield(L, -2, "hits");
+  lua_pushinteger(L, s->misses);
+  lua_setfield(L, -2, "misses");
+  lua_pushnumber(L, s->hits + s->misses ? s->hits / (double)(s->hits + s->misses) : 0.0);
+  lua_setfield(L, -2, "hit_rate");
+  lua_pushinteger(L, s->evictions);
+  lua_setfield(L, -2, "evictions");
+  lua_pushinteger(L, s->disk_reads);
+  lua_setfield(L, -2, "disk_reads");
+  lua_pushinteger(L, s->disk_misses);
+  lua_setfield(L, -2, "disk_misses");
+  lua_seti(L, -2, index);
+}
+
+// one table per cache with the counters since startup, and the time they were read at in seconds, so
+// scripts calling this periodically can turn them into rates
+static int cache_stats(lua_State *L)
+{
+  dt_cache_stats_t stats[32];
+  int n = 0;
+  if(darktable.mipmap_cache) n += dt_mipmap_cache_get_stats(darktable.mipmap_cache, stats, 28);
+  if(darktable.image_cache) dt_cache_get_stats(&darktable.image_cache->cache, stats + n++, "images", "entries");
+  dt_develop_t *dev = darktable.develop;
+  if(dev)
+  {
+    if(dev->pipe_cache) dt_dev_pixelpipe_cache_store_get_stats(dev->pipe_cache, stats + n++);
+    if(dev->pipe) dt_dev_pixelpipe_cache_get_stats(&dev->pipe->cache, stats + n++, "pixelpipe full");
+    if(dev->preview_pipe)
+      dt_dev_pixelpipe_cache_get_stats(&dev->preview_pipe->cache, stats + n++, "pixelpipe preview");
+  }
+
+  lua_newtable(L);
+  for(int k = 0; k < n; k++) _push_cache_stats(L, stats + k, k + 1);
+  lua_pushnumber(L, g_get_monotonic_time() / 1e6);
+  lua_setfield(L, -2, "time");
+  return 1;
+}
+
+// the lock profile of `-d locks`, most waited for first, times in milliseconds
+static int lock_stats(lua_State *L)
+{
+  dt_pthread_lock_stat_t *stats = NULL;
+  const int count = dt_pthread_lock_get_stats(&stats);
+  lua_newtable(L);
+  for(int k = 0; k < count; k++)
+  {
+    const dt_pthread_lock_stat_t *s = stats + k;
+    lua_newtable(L);
+    lua_pushstring(L, s->file);
+    lua_setfield(L, -2, "file");
+    lua_pushinteger(L, s->line);
+    lua_setfield(L, -2, "line");
+    lua_pushstring(L, s->function);
+    lua_setfield(L, -2, "function");
+    lua_pushstring(L, s->mode == 'm' ? "mutex" : s->mode == 'w' ? "write" : "read");
+    lua_setfield(L, -2, "type");
+    lua_pushinteger(L, s->count);
+    lua_setfield(L, -2, "count");
+    lua_pushinteger(L, s->contended);
+    lua_setfield(L, -2, "contended");
+    lua_pushnumber(L, s->wait / 1e6);
+    lua_setfield(L, -2, "wait");
+    lua_pushnumber(L, s->wait_max / 1e6);
+    lua_setfield(L, -2, "wait_max");
+    lua_pushnumber(L, s->hold / 1e6);
+    lua_setfield(L, -2, "hold");
+    lua_pushnumber(L, s->hold_max / 1e6);
+    lua_setfield(L, -2, "hold_max");
+    lua_seti(L, -2, k + 1);
+  }
+  g_free(stats);
+  return 1;
+}
+
+static int locks_reset(lua_State *L)
+{
+  dt_pthread_lock_reset();
+  return 0;
+}
+
+int dt_lua_init_perf(lua_State *L)
+{
+  dt_lua_push_darktable_lib(L);
+  dt_lua_goto_subtable(L, "perf");
+
+  lua_pushcfunction(L, pixelpipe_reports);
+  lua_setfield(L, -2, "pixelpipe_reports");
+  lua_pushcfunction(L, timers);
+  lua_setfield(L, -2, "timers");
+  lua_pushcfunction(L, timers_enabled);
+  lua_setfield(L, -2, "timers_enabled");
+  lua_pushcfunction(L, timers_reset);
+  lua_setfield(L, -2, "reset_timers");
+  lua_pushcfunction(L, cache_stats);
+  lua_setfield(L, -2, "cache_stats");
+  lua_pushcfunction(L, lock_stats);
+  lua_setfield(L, -2, "lock_stats");
+  lua_pushcfunction(L, locks_reset);
+  lua_setfield(L, -2, "reset_locks");
+
+  lua_pop(L, 1);
+  return 0;
+}
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
@@ -0,0 +1,371 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2017 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// throughput and latency of dt_cache and the mipmap cache under many threads. the keys are drawn from a zipf
+// distribution, a share of the gets takes the write lock and the quota is well below the number of keys, so
+// entries get evicted all the time. every entry holds its key, a get finding another one counts as an error.
+
+#include "common/cache.h"
+#include "common/darktable.h"
+#include "common/film.h"
+#include "common/mipmap_cache.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define DT_CACHEBENCH_ENTRY_SIZE 256
+
+typedef struct dt_cachebench_t
+{
+  int threads;
+  int ops;      // per thread
+  int keys;
+  double zipf;  // exponent of the key distribution, 0 for uniform
+  int writes;   // percent of the gets taking the write lock
+  int quota;    // entries the cache holds
+  int segments;
+  int gc;       // ops between explicit garbage collections, 0 for none
+  int max_mip;  // largest mip the mipmap run asks for
+
+  double *cdf;        // of the zipf distribution over the keys
+  uint32_t *key_map;  // the keys drawn, mipmap runs map them to image ids
+  dt_cache_t cache;
+  int misses, errors; // of the current run
+  int failed;          // errors of all runs
+} dt_cachebench_t;
+
+typedef struct dt_cachebench_thread_t
+{
+  dt_cachebench_t *b;
+  int index;
+  uint64_t rng;
+  float *latency; // ns, reads from the front, writes from the back
+  int reads, writes;
+  pthread_t thread;
+} dt_cachebench_thread_t;
+
+static double _now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+static uint64_t _rand(dt_cachebench_thread_t *t)
+{
+  // xorshift64*
+  t->rng ^= t->rng >> 12;
+  t->rng ^= t->rng << 25;
+  t->rng ^= t->rng >> 27;
+  return t->rng * 2685821657736338717ull;
+}
+
+static double _rand_unit(dt_cachebench_thread_t *t)
+{
+  return (_rand(t) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static void _zipf_init(dt_cachebench_t *b)
+{
+  b->cdf = (double *)malloc(sizeof(double) * b->keys);
+  double sum = 0.0;
+  for(int k = 0; k < b->keys; k++) b->cdf[k] = sum += pow(k + 1.0, -b->zipf);
+  for(int k = 0; k < b->keys; k++) b->cdf[k] /= sum;
+}
+
+// rank of the key drawn, 0 being the most popular one
+static int _zipf_draw(dt_cachebench_thread_t *t)
+{
+  const double u = _rand_unit(t);
+  const double *const cdf = t->b->cdf;
+  int lo = 0, hi = t->b->keys - 1;
+  while(lo < hi)
+  {
+    const int mid = (lo + hi) / 2;
+    if(cdf[mid] < u)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+static void _allocate(void *data, dt_cache_entry_t *entry)
+{
+  dt_cachebench_t *b = (dt_cachebench_t *)data;
+  __sync_fetch_and_add(&b->misses, 1);
+  entry->data_size = DT_CACHEBENCH_ENTRY_SIZE;
+  entry->data = dt_alloc_align(16, entry->data_size);
+  entry->cost = 1;
+  uint32_t *const d = (uint32_t *)entry->data;
+  d[0] = entry->key;
+  d[1] = 0;
+}
+
+static void _cleanup(void *data, dt_cache_entry_t *entry)
+{
+  dt_free_align(entry->data);
+}
+
+static void _record(dt_cachebench_thread_t *t, const int write, const double seconds)
+{
+  const int ops = t->b->ops;
+  if(write)
+    t->latency[ops - 1 - t->writes++] = 1e9 * seconds;
+  else
+    t->latency[t->reads++] = 1e9 * seconds;
+}
+
+static void *_cache_thread(void *data)
+{
+  dt_cachebench_thread_t *t = (dt_cachebench_thread_t *)data;
+  dt_cachebench_t *b = t->b;
+  for(int op = 0; op < b->ops; op++)
+  {
+    const uint32_t key = b->key_map[_zipf_draw(t)];
+    const int write = (int)(_rand(t) % 100) < b->writes;
+    const double start = _now();
+    dt_cache_entry_t *entry = dt_cache_get(&b->cache, key, write ? 'w' : 'r');
+    uint32_t *const d = (uint32_t *)entry->data;
+    if(d[0] != key) __sync_fetch_and_add(&b->errors, 1);
+    if(write) d[1]++;
+    dt_cache_release(&b->cache, entry);
+    _record(t, write, _now() - start);
+
+    if(b->gc && t->index == 0 && op % b->gc == 0) dt_cache_gc(&b->cache, 0.8f);
+  }
+  return NULL;
+}
+
+static void *_mipmap_thread(void *data)
+{
+  dt_cachebench_thread_t *t = (dt_cachebench_thread_t *)data;
+  dt_cachebench_t *b = t->b;
+  for(int op = 0; op < b->ops; op++)
+  {
+    const uint32_t imgid = b->key_map[_zipf_draw(t)];
+    const dt_mipmap_size_t mip = (dt_mipmap_size_t)(_rand(t) % (b->max_mip + 1));
+    const double start = _now();
+    dt_mipmap_buffer_t buf;
+    dt_mipmap_cache_get(darktable.mipmap_cache, &buf, imgid, mip, DT_MIPMAP_BLOCKING, 'r');
+    if(!buf.buf || buf.imgid != imgid) __sync_fetch_and_add(&b->errors, 1);
+    dt_mipmap_cache_release(darktable.mipmap_cache, &buf);
+    _record(t, 0, _now() - start);
+  }
+  return NULL;
+}
+
+static int _compare_float(const void *a, const void *b)
+{
+  const float x = *(const float *)a, y = *(const float *)b;
+  return (x > y) - (x < y);
+}
+
+static void _print_latency(const char *what, float *latency, const int count)
+{
+  if(count == 0) return;
+  qsort(latency, count, sizeof(float), _compare_float);
+  const double q[] = { 0.5, 0.9, 0.99, 0.999 };
+  printf("  %-6s %9d ops, latency", what, count);
+  for(int k = 0; k < 4; k++)
+    printf("  p%g %.0f ns", 100.0 * q[k], latency[MIN(count - 1, (int)(q[k] * count))]);
+  printf("  max %.0f ns\n", latency[count - 1]);
+}
+
+// runs func on all threads and prints the throughput and the latency percentiles of the reads and writes
+static void _run(dt_cachebench_t *b, const char *name, void *(*func)(void *), const int count_misses)
+{
+  dt_cachebench_thread_t *t = (dt_cachebench_thread_t *)calloc(b->threads, sizeof(dt_cachebench_thread_t));
+  b->misses = b->errors = 0;
+  const double start = _now();
+  for(int k = 0; k < b->threads; k++)
+  {
+    t[k].b = b;
+    t[k].index = k;
+    t[k].rng = 0x9e3779b97f4a7c15ull * (k + 1);
+    t[k].latency = (float *)malloc(sizeof(float) * b->ops);
+    dt_pthread_create(&t[k].thread, func, t + k);
+  }
+  for(int k = 0; k < b->threads; k++) pthread_join(t[k].thread, NULL);
+  const double seconds = _now() - start;
+
+  // all latencies of one kind in one array
+  const size_t total = (size_t)b->threads * b->ops;
+  float *reads = (float *)malloc(sizeof(float) * total);
+  float *writes = (float *)malloc(sizeof(float) * total);
+  int num_reads = 0, num_writes = 0;
+  for(int k = 0; k < b->threads; k++)
+  {
+    memcpy(reads + num_reads, t[k].latency, sizeof(float) * t[k].reads);
+    memcpy(writes + num_writes, t[k].latency + b->ops - t[k].writes, sizeof(float) * t[k].writes);
+    num_reads += t[k].reads;
+    num_writes += t[k].writes;
+    free(t[k].latency);
+  }
+  free(t);
+
+  printf("%s: %d threads, %.0f ops/s", name, b->threads, total / seconds);
+  if(count_misses) printf(", %d misses (%.1f%%)", b->misses, 100.0 * b->misses / total);
+  printf(", %d errors\n", b->errors);
+  b->failed += b->errors;
+  _print_latency("read", reads, num_reads);
+  _print_latency("write", writes, num_writes);
+  free(reads);
+  free(writes);
+}
+
+static void _bench_cache(dt_cachebench_t *b)
+{
+  for(int k = 0; k < b->keys; k++) b->key_map[k] = k;
+  if(b->segments > 1)
+    dt_cache_init_segmented(&b->cache, 0, b->quota, b->segments);
+  else
+    dt_cache_init(&b->cache, 0, b->quota);
+  dt_cache_set_allocate_callback(&b->cache, _allocate, b);
+  dt_cache_set_cleanup_callback(&b->cache, _cleanup, b);
+
+  gchar *name = g_strdup_printf("dt_cache (%d keys, zipf %g, %d%% writes, quota %d, %u segments)", b->keys,
+                                b->zipf, b->writes, b->quota, b->cache.num_segments);
+  _run(b, name, _cache_thread, TRUE);
+  g_free(name);
+
+  dt_cache_cleanup(&b->cache);
+}
+
+static int _bench_mipmaps(dt_cachebench_t *b, const char *folder)
+{
+  const int filmid = dt_film_import(folder);
+  GList *ids = filmid ? dt_film_get_image_ids(filmid) : NULL;
+  if(!ids)
+  {
+    fprintf(stderr, "[cachebench] no images in `%s'\n", folder);
+    return 1;
+  }
+
+  // the most popular keys are the first images of the film roll, the others repeat them
+  const int num_images = g_list_length(ids);
+  GList *iter = ids;
+  for(int k = 0; k < b->keys; k++, iter = g_list_next(iter) ? g_list_next(iter) : ids)
+    b->key_map[k] = GPOINTER_TO_INT(iter->data);
+  g_list_free(ids);
+
+  gchar *name = g_strdup_printf("mipmap cache (%d images, zipf %g, mips 0-%d)", MIN(num_images, b->keys), b->zipf,
+                                b->max_mip);
+  // the mipmap cache keeps its own statistics, printed below
+  _run(b, name, _mipmap_thread, FALSE);
+  g_free(name);
+  dt_mipmap_cache_print(darktable.mipmap_cache);
+  return 0;
+}
+
+static void usage(const char *progname)
+{
+  fprintf(stderr, "usage: %s [--threads <n>] [--ops <n per thread>] [--keys <n>] [--zipf <exponent>] "
+                  "[--writes <percent>] [--quota <entries>] [--segments <n>] [--gc <ops>] "
+                  "[--mipmaps <folder> [--max-mip <0-7>]] [--core <darktable options>]\n",
+          progname);
+}
+
+int main(int argc, char *arg[])
+{
+  dt_cachebench_t b = { .threads = 8, .ops = 200000, .keys = 10000, .zipf = 0.99, .writes = 10, .quota = 0,
+                        .segments = 1, .gc = 0, .max_mip = 2 };
+  const char *folder = NULL;
+
+  int k;
+  for(k = 1; k < argc; k++)
+  {
+    if(!strcmp(arg[k], "--threads") && argc > k + 1)
+      b.threads = CLAMP(atoi(arg[++k]), 1, 256);
+    else if(!strcmp(arg[k], "--ops") && argc > k + 1)
+      b.ops = MAX(atoi(arg[++k]), 1);
+    else if(!strcmp(arg[k], "--keys") && argc > k + 1)
+      b.keys = MAX(atoi(arg[++k]), 1);
+    else if(!strcmp(arg[k], "--zipf") && argc > k + 1)
+      b.zipf = MAX(atof(arg[++k]), 0.0);
+    else if(!strcmp(arg[k], "--writes") && argc > k + 1)
+      b.writes = CLAMP(atoi(arg[++k]), 0, 100);
+    else if(!strcmp(arg[k], "--quota") && argc > k + 1)
+      b.quota = MAX(atoi(arg[++k]), 1);
+    else if(!strcmp(arg[k], "--segments") && argc > k + 1)
+      b.segments = CLAMP(atoi(arg[++k]), 1, 1024);
+    else if(!strcmp(arg[k], "--gc") && argc > k + 1)
+      b.gc = MAX(atoi(arg[++k]), 0);
+    else if(!strcmp(arg[k], "--mipmaps") && argc > k + 1)
+      folder = arg[++k];
+    else if(!strcmp(arg[k], "--max-mip") && argc > k + 1)
+      b.max_mip = CLAMP(atoi(arg[++k]), 0, DT_MIPMAP_7);
+    else if(!strcmp(arg[k], "--core"))
+    {
+      k++;
+      break;
+    }
+    else
+    {
+      usage(arg[0]);
+      exit(1);
+    }
+  }
+  // a tenth of the keys fit, the tail of the distribution keeps evicting
+  if(b.quota == 0) b.quota = MAX(1, b.keys / 10);
+
+  _zipf_init(&b);
+  b.key_map = (uint32_t *)malloc(sizeof(uint32_t) * b.keys);
+
+  // the cache alone doesn't need darktable
+  _bench_cache(&b);
+
+  int res = 0;
+  if(folder)
+  {
+    int m_argc = 0;
+    char **m_arg = malloc((7 + argc - k + 1) * sizeof(char *));
+    m_arg[m_argc++] = "darktable-test-cachebench";
+    m_arg[m_argc++] = "--library";
+    m_arg[m_argc++] = ":memory:";
+    m_arg[m_argc++] = "--conf";
+    m_arg[m_argc++] = "write_sidecar_files=FALSE";
+    // thumbnails of a library in memory don't belong into the cache on disk
+    m_arg[m_argc++] = "--conf";
+    m_arg[m_argc++] = "cache_disk_backend=FALSE";
+    for(; k < argc; k++) m_arg[m_argc++] = arg[k];
+    m_arg[m_argc] = NULL;
+
+    if(dt_init(m_argc, m_arg, FALSE, FALSE, NULL))
+      res = 1;
+    else
+    {
+      res = _bench_mipmaps(&b, folder);
+      dt_cleanup();
+    }
+    free(m_arg);
+  }
+
+  free(b.key_map);
+  free(b.cdf);
+  return res || b.failed;
+}
+
+#undef DT_CACHEBENCH_ENTRY_SIZE
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
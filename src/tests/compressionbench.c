@@ -0,0 +1,138 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2017 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// the lossy block compression of float images as the mipmap cache uses it for DT_MIPMAP_F, next to a plain
+// memcpy of the same float buffer. if decompressing isn't a lot faster than that, keeping the compressed copy is
+// not worth it. the image is made up: a few stops of smooth gradients in changing colours with a bit of noise, to
+// look more like a photo than like either noise or a flat colour. the thread count comes from OMP_NUM_THREADS.
+
+#include "common/darktable.h"
+#include "common/image_compression.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static double _now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+static void _fill(float *rgb, const int width, const int height)
+{
+  uint32_t state = 1;
+  for(int j = 0; j < height; j++)
+    for(int i = 0; i < width; i++)
+    {
+      const float x = i / (float)width, y = j / (float)height;
+      // about eight stops from the dark corner to the highlights
+      const float luma = exp2f(8.0f * x * y - 6.0f + sinf(12.0f * x) * cosf(9.0f * y));
+      for(int c = 0; c < 3; c++)
+      {
+        state = state * 1664525u + 1013904223u;
+        const float noise = 1.0f + 0.02f * ((state >> 8) / 16777216.0f - 0.5f);
+        const float hue = 0.6f + 0.4f * sinf(3.0f * x + 2.0f * y + 2.1f * c);
+        rgb[3 * ((size_t)j * width + i) + c] = luma * hue * noise;
+      }
+    }
+}
+
+static void _report(const char *name, const double seconds, const int runs, const size_t bytes)
+{
+  printf("%-24s %8.2f ms per run, %8.2f GB/s of float data\n", name, 1e3 * seconds / runs,
+         bytes * (double)runs / seconds * 1e-9);
+}
+
+static void usage(const char *progname)
+{
+  fprintf(stderr, "usage: %s [--width <pixels>] [--height <pixels>] [--runs <n>]\n", progname);
+}
+
+int main(int argc, char *arg[])
+{
+  int width = 1920, height = 1080, runs = 20;
+
+  for(int k = 1; k < argc; k++)
+  {
+    if(!strcmp(arg[k], "--width") && argc > k + 1)
+      width = atoi(arg[++k]);
+    else if(!strcmp(arg[k], "--height") && argc > k + 1)
+      height = atoi(arg[++k]);
+    else if(!strcmp(arg[k], "--runs") && argc > k + 1)
+      runs = atoi(arg[++k]);
+    else
+    {
+      usage(arg[0]);
+      exit(1);
+    }
+  }
+
+  // the compression works on 4x4 blocks
+  width = MAX((width + 3) & ~3, 4);
+  height = MAX((height + 3) & ~3, 4);
+  runs = MAX(runs, 1);
+
+  const size_t bytes = sizeof(float) * 3 * width * height;
+  float *in = dt_alloc_align(64, bytes);
+  float *out = dt_alloc_align(64, bytes);
+  uint8_t *compressed = dt_alloc_align(64, (size_t)width * height);
+  if(!in || !out || !compressed)
+  {
+    fprintf(stderr, "[compressionbench] out of memory\n");
+    dt_free_align(in);
+    dt_free_align(out);
+    dt_free_align(compressed);
+    return 1;
+  }
+  _fill(in, width, height);
+
+  printf("%dx%d pixels, %.1f MB of floats to %.1f MB, %d runs\n", width, height, bytes * 1e-6,
+         (size_t)width * height * 1e-6, runs);
+
+  // once each to have everything paged in
+  memcpy(out, in, bytes);
+  dt_image_compress(in, compressed, width, height);
+  dt_image_uncompress(compressed, out, width, height);
+
+  double start = _now();
+  for(int k = 0; k < runs; k++) memcpy(out, in, bytes);
+  _report("memcpy", _now() - start, runs, bytes);
+
+  start = _now();
+  for(int k = 0; k < runs; k++) dt_image_compress(in, compressed, width, height);
+  _report("dt_image_compress", _now() - start, runs, bytes);
+
+  start = _now();
+  for(int k = 0; k < runs; k++) dt_image_uncompress(compressed, out, width, height);
+  _report("dt_image_uncompress", _now() - start, runs, bytes);
+
+  printf("psnr %.2f dB\n", dt_image_compression_psnr(in, out, width, height));
+
+  dt_free_align(in);
+  dt_free_align(out);
+  dt_free_align(compressed);
+  return 0;
+}
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
@@ -0,0 +1,177 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2017 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// expansion of an export filename pattern, once parsed for every image like it used to be and once parsed in
+// advance like a storage does it. without a folder there is no image and only the parsing and the variables
+// that don't look anything up are measured. with one the images of the film roll are expanded in turn, which
+// adds the image cache and the metadata query.
+
+#include "common/darktable.h"
+#include "common/film.h"
+#include "common/variables.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static const char *_default_pattern
+    = "$(FILE_FOLDER)/darktable_exported/$(EXIF_YEAR)-$(EXIF_MONTH)-$(EXIF_DAY)/$(MAKER)_$(MODEL//\\ /_)/"
+      "$(FILE_NAME:0:8)_$(SEQUENCE)$(VERSION+_v)$(VERSION)_$(TITLE-untitled)_$(CREATOR^^)_$(LABELS//,/-)"
+      "_$(STARS)stars_$(EXIF_ISO)";
+
+static double _now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+// returns the length of all results, to have something to compare between the runs
+static size_t _run(const char *name, const char *pattern, const uint32_t *ids, const int num_ids,
+                   const int images, const gboolean parsed)
+{
+  dt_variables_params_t *params;
+  dt_variables_params_init(&params);
+  params->jobcode = "export";
+  dt_variables_template_t *tmpl = parsed ? dt_variables_template_new(pattern) : NULL;
+
+  size_t length = 0;
+  const double start = _now();
+  for(int k = 0; k < images; k++)
+  {
+    params->imgid = num_ids ? ids[k % num_ids] : 0;
+    params->filename = "/home/user/Pictures/2017/roll/IMG_0001.CR2";
+    char *result;
+    if(parsed)
+      result = dt_variables_expand_template(params, tmpl, TRUE);
+    else
+    {
+      dt_variables_template_t *t = dt_variables_template_new(pattern);
+      result = dt_variables_expand_template(params, t, TRUE);
+      dt_variables_template_free(t);
+    }
+    length += strlen(result);
+    g_free(result);
+  }
+  const double seconds = _now() - start;
+
+  printf("%-24s %8d images, %8.2f us per image, %10.0f images/s\n", name, images, 1e6 * seconds / images,
+         images / seconds);
+  dt_variables_template_free(tmpl);
+  dt_variables_params_destroy(params);
+  return length;
+}
+
+static int _bench(const char *pattern, const uint32_t *ids, const int num_ids, const int images)
+{
+  printf("pattern: %s\n", pattern);
+  const size_t every = _run("parsed for every image", pattern, ids, num_ids, images, FALSE);
+  const size_t once = _run("parsed once", pattern, ids, num_ids, images, TRUE);
+  if(every != once)
+  {
+    fprintf(stderr, "[variablesbench] the results differ\n");
+    return 1;
+  }
+  return 0;
+}
+
+static void usage(const char *progname)
+{
+  fprintf(stderr, "usage: %s [--images <n>] [--pattern <pattern>] [--folder <folder>] "
+                  "[--core <darktable options>]\n",
+          progname);
+}
+
+int main(int argc, char *arg[])
+{
+  int images = 10000;
+  const char *pattern = _default_pattern;
+  const char *folder = NULL;
+
+  int k;
+  for(k = 1; k < argc; k++)
+  {
+    if(!strcmp(arg[k], "--images") && argc > k + 1)
+      images = atoi(arg[++k]);
+    else if(!strcmp(arg[k], "--pattern") && argc > k + 1)
+      pattern = arg[++k];
+    else if(!strcmp(arg[k], "--folder") && argc > k + 1)
+      folder = arg[++k];
+    else if(!strcmp(arg[k], "--core"))
+    {
+      k++;
+      break;
+    }
+    else
+    {
+      usage(arg[0]);
+      exit(1);
+    }
+  }
+
+  images = MAX(images, 1);
+
+  // the variables that don't need an image don't need darktable either
+  int res = _bench(pattern, NULL, 0, images);
+
+  if(folder)
+  {
+    int m_argc = 0;
+    char **m_arg = malloc((5 + argc - k + 1) * sizeof(char *));
+    m_arg[m_argc++] = "darktable-test-variablesbench";
+    m_arg[m_argc++] = "--library";
+    m_arg[m_argc++] = ":memory:";
+    m_arg[m_argc++] = "--conf";
+    m_arg[m_argc++] = "write_sidecar_files=FALSE";
+    for(; k < argc; k++) m_arg[m_argc++] = arg[k];
+    m_arg[m_argc] = NULL;
+
+    if(dt_init(m_argc, m_arg, FALSE, FALSE, NULL))
+      res = 1;
+    else
+    {
+      const int filmid = dt_film_import(folder);
+      GList *list = filmid ? dt_film_get_image_ids(filmid) : NULL;
+      if(!list)
+      {
+        fprintf(stderr, "[variablesbench] no images in `%s'\n", folder);
+        res = 1;
+      }
+      else
+      {
+        const int num_ids = g_list_length(list);
+        uint32_t *ids = (uint32_t *)malloc(sizeof(uint32_t) * num_ids);
+        int i = 0;
+        for(GList *l = list; l; l = g_list_next(l)) ids[i++] = GPOINTER_TO_INT(l->data);
+        g_list_free(list);
+        printf("\n%d images of `%s':\n", num_ids, folder);
+        res |= _bench(pattern, ids, num_ids, images);
+        free(ids);
+      }
+      dt_cleanup();
+    }
+    free(m_arg);
+  }
+
+  return res;
+}
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
@@ -25,6 +25,7 @@
 #include "common/image_cache.h"
 #include "common/imageio.h"
 #include "common/imageio_module.h"
+#include "common/mipmap_cache.h"
 #include "common/styles.h"
 #include "common/tags.h"
 #include "common/undo.h"
@@ -112,15 +113,6 @@ void cleanup(dt_view_t *self)
   free(dev);
 }
 
-static cairo_status_t write_snapshot_data(void *closure, const unsigned char *data, unsigned int length)
-{
-  int fd = GPOINTER_TO_INT(closure);
-  ssize_t res = write(fd, data, length);
-  if(res != length)
-    return CAIRO_STATUS_WRITE_ERROR;
-  return CAIRO_STATUS_SUCCESS;
-}
-
 void expose(
     dt_view_t *self,
     cairo_t *cri,
@@ -193,17 +185,19 @@ void expose(
     dt_view_set_scrollbar(self, zx + .5 - boxw * .5, 1.0, boxw, zy + .5 - boxh * .5, 1.0, boxh);
   }
 
-  if((dev->image_status == DT_DEV_PIXELPIPE_VALID)
+  if((dev->image_status == DT_DEV_PIXELPIPE_VALID || dev->progressive.valid)
      && dev->pipe->input_timestamp >= dev->preview_pipe->input_timestamp)
   {
-    // draw image
+    // draw image, or what a progressive run composed of it so far
     roi_hash_old = roi_hash;
     mutex = &dev->pipe->backbuf_mutex;
     dt_pthread_mutex_lock(mutex);
-    float wd = dev->pipe->backbuf_width;
-    float ht = dev->pipe->backbuf_height;
+    const int progressive = dev->progressive.valid;
+    float wd = progressive ? dev->progressive.width : dev->pipe->backbuf_width;
+    float ht = progressive ? dev->progressive.height : dev->pipe->backbuf_height;
     stride = cairo_format_stride_for_width(CAIRO_FORMAT_RGB24, wd);
-    surface = dt_cairo_image_surface_create_for_data(dev->pipe->backbuf, CAIRO_FORMAT_RGB24, wd, ht, stride);
+    surface = dt_cairo_image_surface_create_for_data(progressive ? dev->progressive.buf : dev->pipe->backbuf,
+                                                     CAIRO_FORMAT_RGB24, wd, ht, stride);
     wd /= darktable.gui->ppd;
     ht /= darktable.gui->ppd;
     if(dev->full_preview)
@@ -275,15 +269,11 @@ void expose(
     /* reset the request */
     darktable.develop->proxy.snapshot.request = FALSE;
 
-    /* validation of snapshot filename */
-    g_assert(darktable.develop->proxy.snapshot.filename != NULL);
-
-    /* Store current image surface to snapshot file.
+    /* Hand the current image surface to the snapshot plugin.
        FIXME: add checks so that we dont make snapshots of preview pipe image surface.
     */
-    int fd = g_open(darktable.develop->proxy.snapshot.filename, O_CREAT | O_WRONLY, 0600);
-    cairo_surface_write_to_png_stream(image_surface, write_snapshot_data, GINT_TO_POINTER(fd));
-    close(fd);
+    if(darktable.develop->proxy.snapshot.taken)
+      darktable.develop->proxy.snapshot.taken(darktable.develop->proxy.snapshot.module, image_surface);
   }
 
   // Displaying sample areas if enabled
@@ -510,6 +500,88 @@ static void dt_dev_cleanup_module_accels(dt_iop_module_t *module)
   dt_accel_cleanup_locals_iop(module);
 }
 
+// background decoding of the next images in the direction the user moves through the filmstrip.
+// queued prefetch jobs of an earlier request turn into no-ops once the generation moved on.
+static uint32_t _prefetch_generation = 0;
+static int _prefetch_direction = 1;
+
+typedef struct dt_darkroom_prefetch_t
+{
+  int32_t imgid;
+  uint32_t generation;
+  int preview;
+} dt_darkroom_prefetch_t;
+
+static int _prefetch_cancelled(const dt_darkroom_prefetch_t *params)
+{
+  if(params->generation != __sync_fetch_and_add(&_prefetch_generation, 0)) return 1;
+  // don't push out the buffers of the image being edited
+  const dt_cache_t *full = &darktable.mipmap_cache->mip_full.cache;
+  return full->cost > full->cost_quota / 2;
+}
+
+static int32_t _prefetch_job_run(dt_job_t *job)
+{
+  const dt_darkroom_prefetch_t *params = (dt_darkroom_prefetch_t *)dt_control_job_get_params(job);
+  dt_mipmap_buffer_t buf;
+
+  if(_prefetch_cancelled(params)) return 0;
+  dt_mipmap_cache_get(darktable.mipmap_cache, &buf, params->imgid, DT_MIPMAP_FULL, DT_MIPMAP_BLOCKING, 'r');
+  dt_mipmap_cache_release(darktable.mipmap_cache, &buf);
+
+  // and the input of the preview pipe
+  if(!params->preview || _prefetch_cancelled(params)) return 0;
+  dt_mipmap_cache_get(darktable.mipmap_cache, &buf, params->imgid, DT_MIPMAP_F, DT_MIPMAP_BLOCKING, 'r');
+  dt_mipmap_cache_release(darktable.mipmap_cache, &buf);
+  return 0;
+}
+
+static void _prefetch_neighbours(const int imgid, const int direction)
+{
+  // whatever is still queued is for a stale position or direction
+  const uint32_t generation = __sync_add_and_fetch(&_prefetch_generation, 1);
+
+  const int count = dt_conf_get_int("plugins/darkroom/prefetch/count");
+  const gchar *qin = dt_collection_get_query(darktable.collection);
+  if(count <= 0 || !qin) return;
+  const int preview = dt_conf_get_bool("plugins/darkroom/prefetch/preview");
+
+  const int offset = dt_collection_image_offset(imgid);
+  const int first = direction > 0 ? offset + 1 : MAX(offset - count, 0);
+  const int num = direction > 0 ? count : offset - first;
+  if(num <= 0) return;
+
+  int32_t *imgids = (int32_t *)calloc(num, sizeof(int32_t));
+  if(!imgids) return;
+  int found = 0;
+  sqlite3_stmt *stmt;
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), qin, -1, &stmt, NULL);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, first);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, num);
+  while(found < num && sqlite3_step(stmt) == SQLITE_ROW) imgids[found++] = sqlite3_column_int(stmt, 0);
+  sqlite3_finalize(stmt);
+
+  // nearest first
+  for(int k = 0; k < found; k++)
+  {
+    const int32_t id = imgids[direction > 0 ? k : found - 1 - k];
+    dt_job_t *job = dt_control_job_create(&_prefetch_job_run, "prefetch image %d", id);
+    if(!job) break;
+    dt_darkroom_prefetch_t *params = (dt_darkroom_prefetch_t *)calloc(1, sizeof(dt_darkroom_prefetch_t));
+    if(!params)
+    {
+      dt_control_job_dispose(job);
+      break;
+    }
+    params->imgid = id;
+    params->generation = generation;
+    params->preview = preview;
+    dt_control_job_set_params_with_size(job, params, sizeof(dt_darkroom_prefetch_t), free);
+    dt_control_add_job(darktable.control, DT_JOB_QUEUE_SYSTEM_BG, job);
+  }
+  free(imgids);
+}
+
 static void dt_dev_change_image(dt_develop_t *dev, const uint32_t imgid)
 {
   // stop crazy users from sleeping on key-repeat spacebar:
@@ -543,6 +615,11 @@ static void dt_dev_change_image(dt_develop_t *dev, const uint32_t imgid)
     dt_conf_set_string("plugins/darkroom/active", "");
   g_assert(dev->gui_attached);
 
+  // remember which way we're going through the collection
+  const int old_offset = dt_collection_image_offset(dev->image_storage.id);
+  const int new_offset = dt_collection_image_offset(imgid);
+  if(new_offset != old_offset) _prefetch_direction = new_offset > old_offset ? 1 : -1;
+
   // commit image ops to db
   dt_dev_write_history(dev);
 
@@ -550,7 +627,7 @@ static void dt_dev_change_image(dt_develop_t *dev, const uint32_t imgid)
   // TODO: only if image changed!
   // if()
   {
-    dt_mipmap_cache_remove(darktable.mipmap_cache, dev->image_storage.id);
+    dt_mipmap_cache_invalidate(darktable.mipmap_cache, dev->image_storage.id);
     dt_image_synch_xmp(dev->image_storage.id);
   }
 
@@ -609,7 +686,7 @@ static void dt_dev_change_image(dt_develop_t *dev, const uint32_t imgid)
         gtk_container_remove(
             GTK_CONTAINER(dt_ui_get_container(darktable.gui->ui, DT_UI_CONTAINER_PANEL_RIGHT_CENTER)),
             module->expander);
-        gtk_widget_destroy(module->widget);
+        if(module->widget) gtk_widget_destroy(module->widget);
         dt_iop_gui_cleanup_module(module);
       }
 
@@ -721,8 +798,8 @@ static void dt_dev_change_image(dt_develop_t *dev, const uint32_t imgid)
   // Signal develop initialize
   dt_control_signal_raise(darktable.signals, DT_SIGNAL_DEVELOP_IMAGE_CHANGED);
 
-  // prefetch next few from first selected image on.
-  dt_view_filmstrip_prefetch();
+  // prefetch next few in the direction we're moving.
+  _prefetch_neighbours(imgid, _prefetch_direction);
 
   // release pixel pipe mutices
   dt_pthread_mutex_BAD_unlock(&dev->preview_pipe_mutex);
@@ -1700,6 +1777,7 @@ void enter(dt_view_t *self)
   // avoid triggering of events before plugin is ready:
   darktable.gui->reset = 1;
   char option[1024];
+  const gboolean defer_gui = dt_conf_get_bool("plugins/darkroom/defer_gui_init");
   GList *modules = g_list_last(dev->iop);
   while(modules)
   {
@@ -1708,20 +1786,26 @@ void enter(dt_view_t *self)
     /* initialize gui if iop have one defined */
     if(!dt_iop_is_hidden(module))
     {
-      module->gui_init(module);
+      snprintf(option, sizeof(option), "plugins/darkroom/%s/expanded", module->op);
+      const gboolean expanded = dt_conf_get_bool(option);
+
+      // most modules are collapsed and switched off, they get their gui once it is needed, see
+      // dt_iop_gui_init_deferred(). the history might still switch them on in dt_dev_pop_history_items().
+      module->gui_deferred = defer_gui && !expanded && !module->enabled
+                             && !(module->flags() & IOP_FLAGS_EAGER_GUI);
+      if(!module->gui_deferred) module->gui_init(module);
       dt_iop_reload_defaults(module);
 
       /* add module to right panel */
       GtkWidget *expander = dt_iop_gui_get_expander(module);
       dt_ui_container_add_widget(darktable.gui->ui, DT_UI_CONTAINER_PANEL_RIGHT_CENTER, expander);
 
-      snprintf(option, sizeof(option), "plugins/darkroom/%s/expanded", module->op);
-      dt_iop_gui_set_expanded(module, dt_conf_get_bool(option), FALSE);
+      dt_iop_gui_set_expanded(module, expanded, FALSE);
     }
 
-    /* setup key accelerators */
+    /* setup key accelerators, the ones of a deferred gui come with it */
     module->accel_closures = NULL;
-    if(module->connect_key_accels) module->connect_key_accels(module);
+    if(module->connect_key_accels && !module->gui_deferred) module->connect_key_accels(module);
     dt_iop_connect_common_accels(module);
 
     modules = g_list_previous(modules);
@@ -1769,14 +1853,17 @@ void enter(dt_view_t *self)
   dt_control_signal_connect(darktable.signals, DT_SIGNAL_VIEWMANAGER_FILMSTRIP_ACTIVATE,
                             G_CALLBACK(_view_darkroom_filmstrip_activate_callback), self);
 
-  // prefetch next few from first selected image on.
-  dt_view_filmstrip_prefetch();
+  // prefetch next few from the current image on.
+  _prefetch_neighbours(dev->image_storage.id, _prefetch_direction);
 
   dt_collection_hint_message(darktable.collection);
 }
 
 void leave(dt_view_t *self)
 {
+  // drop prefetch jobs still in the queue
+  __sync_fetch_and_add(&_prefetch_generation, 1);
+
   /* disconnect from filmstrip image activate */
   dt_control_signal_disconnect(darktable.signals, G_CALLBACK(_view_darkroom_filmstrip_activate_callback),
                                (gpointer)self);
@@ -1807,7 +1894,7 @@ void leave(dt_view_t *self)
   // TODO: only if changed!
   // if()
   {
-    dt_mipmap_cache_remove(darktable.mipmap_cache, dev->image_storage.id);
+    dt_mipmap_cache_invalidate(darktable.mipmap_cache, dev->image_storage.id);
     // dump new xmp data
     dt_image_synch_xmp(dev->image_storage.id);
   }
@@ -1875,6 +1962,7 @@ void mouse_leave(dt_view_t *self)
   // if we are not hovering over a thumbnail in the filmstrip -> show metadata of opened image.
   dt_develop_t *dev = (dt_develop_t *)self->data;
   dt_control_set_mouse_over_id(dev->image_storage.id);
+  dev->progressive.focus = 0;
 
   // reset any changes the selected plugin might have made.
   dt_control_change_cursor(GDK_LEFT_PTR);
@@ -1904,6 +1992,9 @@ void mouse_moved(dt_view_t *self, double x, double y, double pressure, int which
   int handled = 0;
   x += offx;
   y += offy;
+  // progressive rendering refines the view under the pointer first
+  dt_dev_get_pointer_zoom_pos(dev, x, y, &dev->progressive.focus_x, &dev->progressive.focus_y);
+  dev->progressive.focus = 1;
   if(dev->gui_module && dev->gui_module->request_color_pick != DT_REQUEST_COLORPICK_OFF && ctl->button_down
      && ctl->button_down_which == 1)
   {
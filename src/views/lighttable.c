@@ -97,6 +97,12 @@ typedef struct dt_library_t
   int images_in_row;
   int max_rows;
 
+  // scroll tracking for the thumbnail prefetch
+  int32_t prefetch_row;
+  int prefetch_direction;
+  float prefetch_velocity; // rows per second
+  int64_t prefetch_time;
+
   uint8_t *full_res_thumb;
   int32_t full_res_thumb_id, full_res_thumb_wd, full_res_thumb_ht;
   dt_image_orientation_t full_res_thumb_orientation;
@@ -417,6 +423,10 @@ void init(dt_view_t *self)
   lib->full_res_thumb = 0;
   lib->full_res_thumb_id = -1;
   lib->audio_player_id = -1;
+  lib->prefetch_row = 0;
+  lib->prefetch_direction = 1;
+  lib->prefetch_velocity = 0.0f;
+  lib->prefetch_time = 0;
 
   /* setup collection listener and initialize main_query statement */
   dt_control_signal_connect(darktable.signals, DT_SIGNAL_COLLECTION_CHANGED,
@@ -464,6 +474,62 @@ grid_to_index (int row, int col, int stride, int offset)
 }
 #endif
 
+/**
+ * prefetches the thumbnails of the rows about to scroll into view. row is the topmost visible row and first
+ * the collection offset of its leftmost image, the grid has stride images per row of which cols are shown
+ * in visible_rows rows.
+ * the window ahead covers half a second of scrolling at the current speed, but at least half a screen.
+ */
+static void _prefetch_thumbnails(dt_library_t *lib, const int row, const int first, const int stride,
+                                 const int cols, const int visible_rows, const dt_mipmap_size_t mip)
+{
+  const int64_t now = g_get_monotonic_time();
+  const float dt = (now - lib->prefetch_time) * 1e-6f;
+  // a pause of more than a second starts a new scroll gesture
+  const float velocity = (dt > 0.0f && dt < 1.0f) ? (row - lib->prefetch_row) / dt : 0.0f;
+  lib->prefetch_velocity = 0.5f * (lib->prefetch_velocity + velocity);
+  if(row != lib->prefetch_row) lib->prefetch_direction = row > lib->prefetch_row ? 1 : -1;
+  lib->prefetch_row = row;
+  lib->prefetch_time = now;
+
+  // whatever is still queued is behind us or on the wrong side now
+  dt_mipmap_cache_cancel_prefetch(darktable.mipmap_cache);
+
+  const int rows = CLAMP((int)(fabsf(lib->prefetch_velocity) * 0.5f + 0.5f), visible_rows / 2 + 1,
+                         4 * visible_rows);
+  const int first_row = MAX(0, lib->prefetch_direction > 0 ? row + visible_rows : row - rows);
+  const int last_row = lib->prefetch_direction > 0 ? row + visible_rows + rows : row;
+  if(last_row <= first_row) return;
+
+  int32_t imgids_num = 0;
+  int32_t *imgids = malloc((last_row - first_row) * cols * sizeof(int32_t));
+  if(!imgids) return;
+
+  // rows are contiguous in the collection if we show all of them, so one query will do
+  const int contiguous = (cols == stride);
+  for(int r = first_row; r < last_row; r += contiguous ? last_row - first_row : 1)
+  {
+    const int count = contiguous ? (last_row - first_row) * cols : cols;
+    DT_DEBUG_SQLITE3_CLEAR_BINDINGS(lib->statements.main_query);
+    DT_DEBUG_SQLITE3_RESET(lib->statements.main_query);
+    DT_DEBUG_SQLITE3_BIND_INT(lib->statements.main_query, 1, MAX(0, first + (r - row) * stride));
+    DT_DEBUG_SQLITE3_BIND_INT(lib->statements.main_query, 2, count);
+    int n = 0;
+    while(n++ < count && sqlite3_step(lib->statements.main_query) == SQLITE_ROW)
+      imgids[imgids_num++] = sqlite3_column_int(lib->statements.main_query, 0);
+  }
+
+  // prefetch jobs in inverse order: supersede previous jobs: most important last,
+  // that is the row closest to the visible ones in the direction we're going.
+  for(int k = 0; k < imgids_num; k++)
+  {
+    const int i = lib->prefetch_direction > 0 ? imgids_num - 1 - k : k;
+    dt_mipmap_cache_get(darktable.mipmap_cache, NULL, imgids[i], mip, DT_MIPMAP_PREFETCH, 'r');
+  }
+
+  free(imgids);
+}
+
 static int expose_filemanager(dt_view_t *self, cairo_t *cr, int32_t width, int32_t height, int32_t pointerx,
                                int32_t pointery)
 {
@@ -898,32 +964,10 @@ after_drawing:
   /* check if offset was changed and we need to prefetch thumbs */
   if(offset_changed)
   {
-    int32_t imgids_num = 0;
-    const int prefetchrows = .5 * max_rows + 1;
-    int32_t *imgids = malloc(prefetchrows * iir * sizeof(int32_t));
-
-    /* clear and reset main query */
-    DT_DEBUG_SQLITE3_CLEAR_BINDINGS(lib->statements.main_query);
-    DT_DEBUG_SQLITE3_RESET(lib->statements.main_query);
-
-    /* setup offest and row for prefetch */
-    DT_DEBUG_SQLITE3_BIND_INT(lib->statements.main_query, 1, offset + max_rows * iir);
-    DT_DEBUG_SQLITE3_BIND_INT(lib->statements.main_query, 2, prefetchrows * iir);
-
-    // prefetch jobs in inverse order: supersede previous jobs: most important last
-    while(sqlite3_step(lib->statements.main_query) == SQLITE_ROW && imgids_num < prefetchrows * iir)
-      imgids[imgids_num++] = sqlite3_column_int(lib->statements.main_query, 0);
-
     float imgwd = iir == 1 ? 0.97 : 0.8;
     dt_mipmap_size_t mip = dt_mipmap_cache_get_matching_size(darktable.mipmap_cache, imgwd * wd,
                                                              imgwd * (iir == 1 ? height : ht));
-    while(imgids_num > 0)
-    {
-      imgids_num--;
-      dt_mipmap_cache_get(darktable.mipmap_cache, NULL, imgids[imgids_num], mip, DT_MIPMAP_PREFETCH, 'r');
-    }
-
-    free(imgids);
+    _prefetch_thumbnails(lib, offset / iir, offset, iir, iir, max_rows, mip);
   }
 
   lib->offset_changed = FALSE;
@@ -1194,6 +1238,14 @@ static int expose_zoomable(dt_view_t *self, cairo_t *cr, int32_t width, int32_t
   }
 failure:
 
+  // no grid to speak of in the full view
+  if(zoom > 1 && offset_j != lib->prefetch_row)
+  {
+    dt_mipmap_size_t mip = dt_mipmap_cache_get_matching_size(darktable.mipmap_cache, wd, ht);
+    _prefetch_thumbnails(lib, offset_j, MAX(0, offset_i) + DT_LIBRARY_MAX_ZOOM * offset_j, DT_LIBRARY_MAX_ZOOM,
+                         max_cols, max_rows, mip);
+  }
+
   lib->zoom_x = zoom_x;
   lib->zoom_y = zoom_y;
   lib->track = 0;
@@ -1305,7 +1357,7 @@ static int expose_full_preview(dt_view_t *self, cairo_t *cr, int32_t width, int3
       if(!dt_imageio_large_thumbnail(filename, &lib->full_res_thumb,
                                                &lib->full_res_thumb_wd,
                                                &lib->full_res_thumb_ht,
-                                               &color_space)) {
+                                               &color_space, 0, 0)) {
         lib->full_res_thumb_orientation = ORIENTATION_NONE;
         lib->full_res_thumb_id = lib->full_preview_id;
       }
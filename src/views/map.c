@@ -44,6 +44,17 @@ typedef struct dt_undo_geotag_t
   float longitude, latitude, elevation;
 } dt_undo_geotag_t;
 
+// the locations of the images are kept sorted into a grid of DT_MAP_INDEX_CELLS x DT_MAP_INDEX_CELLS cells of
+// the mercator projection, row by row. the cells of one row of the view are then one run of points.
+#define DT_MAP_INDEX_CELLS 256
+
+typedef struct dt_map_point_t
+{
+  gint imgid;
+  float latitude, longitude;
+  uint32_t cell;
+} dt_map_point_t;
+
 typedef struct dt_map_t
 {
   GtkWidget *center;
@@ -56,8 +67,12 @@ typedef struct dt_map_t
   gboolean start_drag;
   struct
   {
-    sqlite3_stmt *main_query;
-  } statements;
+    dt_map_point_t *points;
+    int count;
+    uint32_t *cell_start; // DT_MAP_INDEX_CELLS^2 + 1 offsets into points
+    gboolean stale;
+  } index;
+  GHashTable *thumbs; // imgid -> framed thumbnail with its pin
   gboolean drop_filmstrip_activated;
   gboolean filter_images_drawn;
   int max_images_drawn;
@@ -68,6 +83,8 @@ typedef struct dt_map_image_t
   gint imgid;
   OsmGpsMapImage *image;
   gint width, height;
+  gint count; // images of the cluster the thumbnail stands for
+  float latitude, longitude;
 } dt_map_image_t;
 
 static const int thumb_size = 64, thumb_border = 1, image_pin_size = 13, place_pin_size = 72;
@@ -97,6 +114,8 @@ static gboolean _view_map_remove_marker(const dt_view_t *view, dt_geo_map_displa
 static void _view_map_collection_changed(gpointer instance, gpointer user_data);
 /* callback when an image is selected in filmstrip, centers map */
 static void _view_map_filmstrip_activate_callback(gpointer instance, gpointer user_data);
+
+static void _view_map_mipmap_updated(gpointer instance, gpointer user_data);
 /* callback when an image is dropped from filmstrip */
 static void drag_and_drop_received(GtkWidget *widget, GdkDragContext *context, gint x, gint y,
                                    GtkSelectionData *selection_data, guint target_type, guint time,
@@ -122,7 +141,7 @@ static void _set_image_location(dt_view_t *self, int imgid, float longitude, flo
 static void _get_image_location(dt_view_t *self, int imgid, float *longitude, float *latitude, float *elevation);
 
 static gboolean _view_map_prefs_changed(dt_map_t *lib);
-static void _view_map_build_main_query(dt_map_t *lib);
+static void _view_map_build_index(dt_map_t *lib);
 
 const char *name(dt_view_t *self)
 {
@@ -433,9 +452,8 @@ void init(dt_view_t *self)
     g_signal_connect(GTK_WIDGET(lib->map), "drag-failed", G_CALLBACK(_view_map_dnd_failed_callback), self);
   }
 
-  /* build the query string */
-  lib->statements.main_query = NULL;
-  _view_map_build_main_query(lib);
+  lib->thumbs = g_hash_table_new_full(NULL, NULL, NULL, g_object_unref);
+  lib->index.stale = TRUE;
 
 #ifdef USE_LUA
   lua_State *L = darktable.lua_state.state;
@@ -457,6 +475,9 @@ void init(dt_view_t *self)
   /* connect preference changed signal */
   dt_control_signal_connect(darktable.signals, DT_SIGNAL_PREFERENCES_CHANGE,
                             G_CALLBACK(_view_map_check_preference_changed), (gpointer)self);
+  /* thumbnails of the markers are redone once they changed */
+  dt_control_signal_connect(darktable.signals, DT_SIGNAL_DEVELOP_MIPMAP_UPDATED,
+                            G_CALLBACK(_view_map_mipmap_updated), (gpointer)self);
 }
 
 void cleanup(dt_view_t *self)
@@ -465,6 +486,7 @@ void cleanup(dt_view_t *self)
 
   dt_control_signal_disconnect(darktable.signals, G_CALLBACK(_view_map_collection_changed), self);
   dt_control_signal_disconnect(darktable.signals, G_CALLBACK(_view_map_check_preference_changed), self);
+  dt_control_signal_disconnect(darktable.signals, G_CALLBACK(_view_map_mipmap_updated), self);
 
   if(darktable.gui)
   {
@@ -481,7 +503,9 @@ void cleanup(dt_view_t *self)
     // removing the widget can cause segfaults.
     //     g_object_unref(G_OBJECT(lib->map));
   }
-  if(lib->statements.main_query) sqlite3_finalize(lib->statements.main_query);
+  g_hash_table_destroy(lib->thumbs);
+  free(lib->index.points);
+  free(lib->index.cell_start);
   free(self->data);
 }
 
@@ -503,6 +527,220 @@ static gboolean _view_map_redraw(gpointer user_data)
   return FALSE; // remove the function again
 }
 
+static inline double _view_map_mercator_x(const double lon)
+{
+  return CLAMP((lon + 180.0) / 360.0, 0.0, 1.0);
+}
+
+static inline double _view_map_mercator_y(const double lat)
+{
+  const double l = CLAMP(lat, -85.0511, 85.0511) * M_PI / 180.0;
+  return CLAMP((1.0 - log(tan(l) + 1.0 / cos(l)) / M_PI) / 2.0, 0.0, 1.0);
+}
+
+static inline int _view_map_index_cell(const double m)
+{
+  return MIN((int)(m * DT_MAP_INDEX_CELLS), DT_MAP_INDEX_CELLS - 1);
+}
+
+typedef struct dt_map_hit_t
+{
+  int64_t cluster;
+  const dt_map_point_t *point;
+} dt_map_hit_t;
+
+typedef struct dt_map_cluster_t
+{
+  gint imgid; // shown for all of them
+  float latitude, longitude;
+  gint count;
+  double dist;
+} dt_map_cluster_t;
+
+static int _view_map_hit_cmp(const void *a, const void *b)
+{
+  const dt_map_hit_t *ha = (const dt_map_hit_t *)a, *hb = (const dt_map_hit_t *)b;
+  if(ha->cluster != hb->cluster) return ha->cluster < hb->cluster ? -1 : 1;
+  return ha->point->imgid - hb->point->imgid;
+}
+
+static int _view_map_cluster_dist_cmp(const void *a, const void *b)
+{
+  const double da = ((const dt_map_cluster_t *)a)->dist, db = ((const dt_map_cluster_t *)b)->dist;
+  return (da > db) - (da < db);
+}
+
+// the ones to the north first, so the thumbnails further south are drawn over them
+static int _view_map_cluster_draw_cmp(const void *a, const void *b)
+{
+  const dt_map_cluster_t *ca = (const dt_map_cluster_t *)a, *cb = (const dt_map_cluster_t *)b;
+  if(ca->latitude != cb->latitude) return ca->latitude > cb->latitude ? -1 : 1;
+  return ca->imgid - cb->imgid;
+}
+
+// groups the images inside the box into the cells of a grid of cells_per_world x cells_per_world over the
+// mercator projection, one thumbnail apart at the zoom of the map. every cluster is shown by its image with the
+// lowest id, so panning doesn't swap them. the max_images_drawn clusters closest to the center are returned, in
+// the order to draw them in.
+static GArray *_view_map_clusters(dt_map_t *lib, const double lon0, const double lon1, const double lat0,
+                                  const double lat1, const double center_lat, const double center_lon,
+                                  const double cells_per_world)
+{
+  GArray *hits = g_array_new(FALSE, FALSE, sizeof(dt_map_hit_t));
+  GArray *clusters = g_array_new(FALSE, FALSE, sizeof(dt_map_cluster_t));
+  if(!lib->index.count || lon0 > lon1 || lat0 > lat1) goto done;
+
+  const int x0 = _view_map_index_cell(_view_map_mercator_x(lon0));
+  const int x1 = _view_map_index_cell(_view_map_mercator_x(lon1));
+  const int y0 = _view_map_index_cell(_view_map_mercator_y(lat1));
+  const int y1 = _view_map_index_cell(_view_map_mercator_y(lat0));
+  const int64_t row = (int64_t)ceil(cells_per_world) + 1;
+  for(int y = y0; y <= y1; y++)
+  {
+    const uint32_t start = lib->index.cell_start[y * DT_MAP_INDEX_CELLS + x0];
+    const uint32_t end = lib->index.cell_start[y * DT_MAP_INDEX_CELLS + x1 + 1];
+    for(uint32_t k = start; k < end; k++)
+    {
+      const dt_map_point_t *p = lib->index.points + k;
+      if(p->longitude < lon0 || p->longitude > lon1 || p->latitude < lat0 || p->latitude > lat1) continue;
+      dt_map_hit_t hit;
+      hit.cluster = (int64_t)(_view_map_mercator_y(p->latitude) * cells_per_world) * row
+                    + (int64_t)(_view_map_mercator_x(p->longitude) * cells_per_world);
+      hit.point = p;
+      g_array_append_val(hits, hit);
+    }
+  }
+  if(!hits->len) goto done;
+  qsort(hits->data, hits->len, sizeof(dt_map_hit_t), _view_map_hit_cmp);
+
+  for(guint k = 0; k < hits->len; k++)
+  {
+    const dt_map_hit_t *hit = &g_array_index(hits, dt_map_hit_t, k);
+    if(k > 0 && g_array_index(hits, dt_map_hit_t, k - 1).cluster == hit->cluster)
+    {
+      g_array_index(clusters, dt_map_cluster_t, clusters->len - 1).count++;
+      continue;
+    }
+    dt_map_cluster_t cluster;
+    cluster.imgid = hit->point->imgid;
+    cluster.latitude = hit->point->latitude;
+    cluster.longitude = hit->point->longitude;
+    cluster.count = 1;
+    cluster.dist = fabs(cluster.latitude - center_lat) + fabs(cluster.longitude - center_lon);
+    g_array_append_val(clusters, cluster);
+  }
+
+  if(clusters->len > (guint)lib->max_images_drawn)
+  {
+    qsort(clusters->data, clusters->len, sizeof(dt_map_cluster_t), _view_map_cluster_dist_cmp);
+    g_array_set_size(clusters, lib->max_images_drawn);
+  }
+  qsort(clusters->data, clusters->len, sizeof(dt_map_cluster_t), _view_map_cluster_draw_cmp);
+
+done:
+  g_array_free(hits, TRUE);
+  return clusters;
+}
+
+// the thumbnail of imgid in its frame, with the pin below. kept until the thumbnails change, NULL if the
+// thumbnail isn't there yet.
+static GdkPixbuf *_view_map_get_thumb(dt_map_t *lib, const int imgid)
+{
+  GdkPixbuf *thumb = (GdkPixbuf *)g_hash_table_lookup(lib->thumbs, GINT_TO_POINTER(imgid));
+  if(thumb) return thumb;
+
+  const int _thumb_size = DT_PIXEL_APPLY_DPI(thumb_size);
+  dt_mipmap_size_t mip = dt_mipmap_cache_get_matching_size(darktable.mipmap_cache, _thumb_size, _thumb_size);
+  dt_mipmap_buffer_t buf;
+  dt_mipmap_cache_get(darktable.mipmap_cache, &buf, imgid, mip, DT_MIPMAP_BEST_EFFORT, 'r');
+  if(buf.buf)
+  {
+    GdkPixbuf *source = NULL;
+
+    for(size_t i = 3; i < (size_t)4 * buf.width * buf.height; i += 4) buf.buf[i] = UINT8_MAX;
+
+    int w = _thumb_size, h = _thumb_size;
+    const float _thumb_border = DT_PIXEL_APPLY_DPI(thumb_border), _pin_size = DT_PIXEL_APPLY_DPI(image_pin_size);
+    if(buf.width < buf.height)
+      w = (buf.width * _thumb_size) / buf.height; // portrait
+    else
+      h = (buf.height * _thumb_size) / buf.width; // landscape
+
+    // next we get a pixbuf for the image
+    source = gdk_pixbuf_new_from_data(buf.buf, GDK_COLORSPACE_RGB, TRUE, 8, buf.width, buf.height,
+                                      buf.width * 4, NULL, NULL);
+    if(!source) goto thumb_failure;
+
+    // now we want a slightly larger pixbuf that we can put the image on
+    thumb = gdk_pixbuf_new(GDK_COLORSPACE_RGB, TRUE, 8, w + 2 * _thumb_border, h + 2 * _thumb_border + _pin_size);
+    if(!thumb) goto thumb_failure;
+    gdk_pixbuf_fill(thumb, thumb_frame_color);
+
+    // put the image onto the frame
+    gdk_pixbuf_scale(source, thumb, _thumb_border, _thumb_border, w, h, _thumb_border, _thumb_border,
+                     (1.0 * w) / buf.width, (1.0 * h) / buf.height, GDK_INTERP_HYPER);
+
+    // and finally add the pin
+    gdk_pixbuf_copy_area(lib->image_pin, 0, 0, w + 2 * _thumb_border, _pin_size, thumb, 0, h + 2 * _thumb_border);
+    g_hash_table_insert(lib->thumbs, GINT_TO_POINTER(imgid), thumb);
+
+  thumb_failure:
+    if(source) g_object_unref(source);
+  }
+  dt_mipmap_cache_release(darktable.mipmap_cache, &buf);
+  return thumb;
+}
+
+// a copy of thumb with the number of images of its cluster in the top left corner
+static GdkPixbuf *_view_map_add_count(GdkPixbuf *thumb, const int count)
+{
+  char text[16];
+  if(count > 999)
+    g_strlcpy(text, "999+", sizeof(text));
+  else
+    snprintf(text, sizeof(text), "%d", count);
+
+  const float _thumb_border = DT_PIXEL_APPLY_DPI(thumb_border), pad = DT_PIXEL_APPLY_DPI(2);
+  cairo_surface_t *cst = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, 1, 1);
+  cairo_t *cr = cairo_create(cst);
+  cairo_set_font_size(cr, DT_PIXEL_APPLY_DPI(10));
+  cairo_text_extents_t extents;
+  cairo_text_extents(cr, text, &extents);
+  cairo_destroy(cr);
+  cairo_surface_destroy(cst);
+
+  const int w = MIN(ceil(extents.width + 2 * pad), gdk_pixbuf_get_width(thumb) - 2 * _thumb_border);
+  const int h = MIN(ceil(DT_PIXEL_APPLY_DPI(10) + 2 * pad), gdk_pixbuf_get_height(thumb) - 2 * _thumb_border);
+  if(w <= 0 || h <= 0) return g_object_ref(thumb);
+
+  cst = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, w, h);
+  cr = cairo_create(cst);
+  cairo_set_source_rgba(cr, ((pin_outer_color & 0xff000000) >> 24) / 255.0,
+                        ((pin_outer_color & 0x00ff0000) >> 16) / 255.0,
+                        ((pin_outer_color & 0x0000ff00) >> 8) / 255.0, ((pin_outer_color & 0x000000ff)) / 255.0);
+  cairo_paint(cr);
+  cairo_set_source_rgba(cr, ((pin_inner_color & 0xff000000) >> 24) / 255.0,
+                        ((pin_inner_color & 0x00ff0000) >> 16) / 255.0,
+                        ((pin_inner_color & 0x0000ff00) >> 8) / 255.0, ((pin_inner_color & 0x000000ff)) / 255.0);
+  cairo_set_font_size(cr, DT_PIXEL_APPLY_DPI(10));
+  cairo_move_to(cr, pad - extents.x_bearing, h - pad);
+  cairo_show_text(cr, text);
+  cairo_destroy(cr);
+  cairo_surface_flush(cst);
+
+  uint8_t *data = cairo_image_surface_get_data(cst);
+  const int stride = cairo_image_surface_get_stride(cst);
+  dt_draw_cairo_to_gdk_pixbuf(data, w, h);
+  GdkPixbuf *badge = gdk_pixbuf_new_from_data(data, GDK_COLORSPACE_RGB, TRUE, 8, w, h, stride, NULL, NULL);
+  GdkPixbuf *marker = gdk_pixbuf_copy(thumb);
+  if(badge && marker)
+    gdk_pixbuf_composite(badge, marker, _thumb_border, _thumb_border, w, h, _thumb_border, _thumb_border, 1.0,
+                         1.0, GDK_INTERP_NEAREST, 255);
+  if(badge) g_object_unref(badge);
+  cairo_surface_destroy(cst);
+  return marker;
+}
+
 static void _view_map_changed_callback(OsmGpsMap *map, dt_view_t *self)
 {
   dt_map_t *lib = (dt_map_t *)self->data;
@@ -535,98 +773,77 @@ static void _view_map_changed_callback(OsmGpsMap *map, dt_view_t *self)
   dt_conf_set_float("plugins/map/latitude", center_lat);
   dt_conf_set_int("plugins/map/zoom", zoom);
 
-  /* check if the prefs have changed and rebuild main_query if needed */
-  if(_view_map_prefs_changed(lib)) _view_map_build_main_query(lib);
-
-  /* let's reset and reuse the main_query statement */
-  DT_DEBUG_SQLITE3_CLEAR_BINDINGS(lib->statements.main_query);
-  DT_DEBUG_SQLITE3_RESET(lib->statements.main_query);
+  /* check if the prefs have changed and rebuild the index if needed */
+  if(lib->index.stale || _view_map_prefs_changed(lib)) _view_map_build_index(lib);
 
-  /* bind bounding box coords for the main query */
-  DT_DEBUG_SQLITE3_BIND_DOUBLE(lib->statements.main_query, 1, bb_0_lon - west_border);
-  DT_DEBUG_SQLITE3_BIND_DOUBLE(lib->statements.main_query, 2, bb_1_lon);
-  DT_DEBUG_SQLITE3_BIND_DOUBLE(lib->statements.main_query, 3, bb_0_lat);
-  DT_DEBUG_SQLITE3_BIND_DOUBLE(lib->statements.main_query, 4, bb_1_lat - south_border);
-  DT_DEBUG_SQLITE3_BIND_DOUBLE(lib->statements.main_query, 5, center_lat);
-  DT_DEBUG_SQLITE3_BIND_DOUBLE(lib->statements.main_query, 6, center_lon);
+  /* cluster the images in the box that would overlap at this zoom */
+  const int _thumb_size = DT_PIXEL_APPLY_DPI(thumb_size);
+  GArray *clusters = _view_map_clusters(lib, bb_0_lon - west_border, bb_1_lon, bb_1_lat - south_border, bb_0_lat,
+                                        center_lat, center_lon, (double)(256 << zoom) / _thumb_size);
 
-  /* remove the old images */
-  if(lib->images)
+  /* keep the markers that didn't change, remove the others */
+  GHashTable *old = g_hash_table_new(NULL, NULL);
+  for(GSList *iter = lib->images; iter; iter = g_slist_next(iter))
   {
-    // we can't use osm_gps_map_image_remove_all() because we want to keep the marker
-    for(GSList *iter = lib->images; iter; iter = g_slist_next(iter))
-    {
-      dt_map_image_t *image = (dt_map_image_t *)iter->data;
-      osm_gps_map_image_remove(map, image->image);
-    }
-    g_slist_free_full(lib->images, g_free);
-    lib->images = NULL;
+    dt_map_image_t *image = (dt_map_image_t *)iter->data;
+    g_hash_table_insert(old, GINT_TO_POINTER(image->imgid), image);
   }
+  g_slist_free(lib->images);
+  lib->images = NULL;
 
-  /* add  all images to the map */
+  /* add the thumbnails of the clusters to the map */
   gboolean needs_redraw = FALSE;
-  const int _thumb_size = DT_PIXEL_APPLY_DPI(thumb_size);
-  dt_mipmap_size_t mip = dt_mipmap_cache_get_matching_size(darktable.mipmap_cache, _thumb_size, _thumb_size);
-  while(sqlite3_step(lib->statements.main_query) == SQLITE_ROW)
+  for(guint k = 0; k < clusters->len; k++)
   {
-    int imgid = sqlite3_column_int(lib->statements.main_query, 0);
-    dt_mipmap_buffer_t buf;
-    dt_mipmap_cache_get(darktable.mipmap_cache, &buf, imgid, mip, DT_MIPMAP_BEST_EFFORT, 'r');
-
-    if(buf.buf)
+    const dt_map_cluster_t *cluster = &g_array_index(clusters, dt_map_cluster_t, k);
+    dt_map_image_t *entry = (dt_map_image_t *)g_hash_table_lookup(old, GINT_TO_POINTER(cluster->imgid));
+    if(entry && entry->image && entry->count == cluster->count && entry->latitude == cluster->latitude
+       && entry->longitude == cluster->longitude)
     {
-      GdkPixbuf *source = NULL, *thumb = NULL;
-
-      for(size_t i = 3; i < (size_t)4 * buf.width * buf.height; i += 4) buf.buf[i] = UINT8_MAX;
-
-      int w = _thumb_size, h = _thumb_size;
-      const float _thumb_border = DT_PIXEL_APPLY_DPI(thumb_border), _pin_size = DT_PIXEL_APPLY_DPI(image_pin_size);
-      if(buf.width < buf.height)
-        w = (buf.width * _thumb_size) / buf.height; // portrait
-      else
-        h = (buf.height * _thumb_size) / buf.width; // landscape
-
-      // next we get a pixbuf for the image
-      source = gdk_pixbuf_new_from_data(buf.buf, GDK_COLORSPACE_RGB, TRUE, 8, buf.width, buf.height,
-                                        buf.width * 4, NULL, NULL);
-      if(!source) goto map_changed_failure;
-
-      // now we want a slightly larger pixbuf that we can put the image on
-      thumb = gdk_pixbuf_new(GDK_COLORSPACE_RGB, TRUE, 8, w + 2 * _thumb_border,
-                             h + 2 * _thumb_border + _pin_size);
-      if(!thumb) goto map_changed_failure;
-      gdk_pixbuf_fill(thumb, thumb_frame_color);
-
-      // put the image onto the frame
-      gdk_pixbuf_scale(source, thumb, _thumb_border, _thumb_border, w, h, _thumb_border, _thumb_border,
-                       (1.0 * w) / buf.width, (1.0 * h) / buf.height, GDK_INTERP_HYPER);
-
-      // and finally add the pin
-      gdk_pixbuf_copy_area(lib->image_pin, 0, 0, w + 2 * _thumb_border, _pin_size, thumb, 0, h + 2 * _thumb_border);
-
-      const dt_image_t *cimg = dt_image_cache_get(darktable.image_cache, imgid, 'r');
-      if(!cimg) goto map_changed_failure;
-      dt_map_image_t *entry = (dt_map_image_t *)malloc(sizeof(dt_map_image_t));
-      if(!entry)
-      {
-        dt_image_cache_read_release(darktable.image_cache, cimg);
-        goto map_changed_failure;
-      }
-      entry->imgid = imgid;
-      entry->image = osm_gps_map_image_add_with_alignment(map, cimg->latitude, cimg->longitude, thumb, 0, 1);
-      entry->width = w;
-      entry->height = h;
+      g_hash_table_remove(old, GINT_TO_POINTER(cluster->imgid));
       lib->images = g_slist_prepend(lib->images, entry);
-      dt_image_cache_read_release(darktable.image_cache, cimg);
-
-    map_changed_failure:
-      if(source) g_object_unref(source);
-      if(thumb) g_object_unref(thumb);
+      continue;
     }
-    else
+
+    GdkPixbuf *thumb = _view_map_get_thumb(lib, cluster->imgid);
+    if(!thumb)
+    {
       needs_redraw = TRUE;
-    dt_mipmap_cache_release(darktable.mipmap_cache, &buf);
+      continue;
+    }
+    GdkPixbuf *marker = cluster->count > 1 ? _view_map_add_count(thumb, cluster->count) : g_object_ref(thumb);
+    if(!marker) continue;
+
+    entry = (dt_map_image_t *)malloc(sizeof(dt_map_image_t));
+    if(!entry)
+    {
+      g_object_unref(marker);
+      continue;
+    }
+    const float _thumb_border = DT_PIXEL_APPLY_DPI(thumb_border), _pin_size = DT_PIXEL_APPLY_DPI(image_pin_size);
+    entry->imgid = cluster->imgid;
+    entry->image
+        = osm_gps_map_image_add_with_alignment(map, cluster->latitude, cluster->longitude, marker, 0, 1);
+    entry->width = gdk_pixbuf_get_width(thumb) - 2 * _thumb_border;
+    entry->height = gdk_pixbuf_get_height(thumb) - 2 * _thumb_border - _pin_size;
+    entry->count = cluster->count;
+    entry->latitude = cluster->latitude;
+    entry->longitude = cluster->longitude;
+    lib->images = g_slist_prepend(lib->images, entry);
+    g_object_unref(marker);
   }
+  g_array_free(clusters, TRUE);
+
+  GHashTableIter it;
+  gpointer value;
+  g_hash_table_iter_init(&it, old);
+  while(g_hash_table_iter_next(&it, NULL, &value))
+  {
+    dt_map_image_t *image = (dt_map_image_t *)value;
+    if(image->image) osm_gps_map_image_remove(map, image->image);
+    free(image);
+  }
+  g_hash_table_destroy(old);
 
   // not exactly thread safe, but should be good enough for updating the display
   static int timeout_event_source = 0;
@@ -647,7 +864,7 @@ static void _view_map_changed_callback(OsmGpsMap *map, dt_view_t *self)
   }
 }
 
-static int _view_map_get_img_at_pos(dt_view_t *self, double x, double y)
+static dt_map_image_t *_view_map_get_entry_at_pos(dt_view_t *self, double x, double y)
 {
   dt_map_t *lib = (dt_map_t *)self->data;
   GSList *iter;
@@ -656,15 +873,16 @@ static int _view_map_get_img_at_pos(dt_view_t *self, double x, double y)
   {
     dt_map_image_t *entry = (dt_map_image_t *)iter->data;
     OsmGpsMapImage *image = entry->image;
+    if(!image) continue;
     OsmGpsMapPoint *pt = (OsmGpsMapPoint *)osm_gps_map_image_get_point(image);
     gint img_x = 0, img_y = 0;
     osm_gps_map_convert_geographic_to_screen(lib->map, pt, &img_x, &img_y);
     img_y -= DT_PIXEL_APPLY_DPI(image_pin_size);
     if(x >= img_x && x <= img_x + entry->width && y <= img_y && y >= img_y - entry->height)
-      return entry->imgid;
+      return entry;
   }
 
-  return 0;
+  return NULL;
 }
 
 static gboolean _view_map_motion_notify_callback(GtkWidget *widget, GdkEventMotion *e, dt_view_t *self)
@@ -680,6 +898,7 @@ static gboolean _view_map_motion_notify_callback(GtkWidget *widget, GdkEventMoti
       if(entry->imgid == lib->selected_image)
       {
         osm_gps_map_image_remove(lib->map, image);
+        entry->image = NULL;
         break;
       }
     }
@@ -742,7 +961,8 @@ static gboolean _view_map_button_press_callback(GtkWidget *w, GdkEventButton *e,
   if(e->button == 1)
   {
     // check if the click was on an image or just some random position
-    lib->selected_image = _view_map_get_img_at_pos(self, e->x, e->y);
+    dt_map_image_t *entry = _view_map_get_entry_at_pos(self, e->x, e->y);
+    lib->selected_image = entry ? entry->imgid : 0;
     if(e->type == GDK_BUTTON_PRESS && lib->selected_image > 0)
     {
       lib->start_drag = TRUE;
@@ -750,7 +970,14 @@ static gboolean _view_map_button_press_callback(GtkWidget *w, GdkEventButton *e,
     }
     if(e->type == GDK_2BUTTON_PRESS)
     {
-      if(lib->selected_image > 0)
+      if(entry && entry->count > 1)
+      {
+        // zoom into the cluster, until its images are apart
+        int zoom, max_zoom;
+        g_object_get(G_OBJECT(lib->map), "zoom", &zoom, "max-zoom", &max_zoom, NULL);
+        _view_map_center_on_location(self, entry->longitude, entry->latitude, MIN(zoom + 2, max_zoom));
+      }
+      else if(lib->selected_image > 0)
       {
         // open the image in darkroom
         dt_control_set_mouse_over_id(lib->selected_image);
@@ -782,6 +1009,8 @@ void enter(dt_view_t *self)
 
   lib->selected_image = 0;
   lib->start_drag = FALSE;
+  // the images might have been geotagged elsewhere
+  lib->index.stale = TRUE;
 
   /* set the correct map source */
   _view_map_set_map_source_g_object(self, lib->map_source);
@@ -1056,11 +1285,19 @@ static void _view_map_collection_changed(gpointer instance, gpointer user_data)
 
   if(dt_conf_get_bool("plugins/map/filter_images_drawn"))
   {
+    lib->index.stale = TRUE;
     /* only redraw when map mode is currently active, otherwise enter() does the magic */
     if(darktable.view_manager->proxy.map.view) g_signal_emit_by_name(lib->map, "changed");
   }
 }
 
+static void _view_map_mipmap_updated(gpointer instance, gpointer user_data)
+{
+  dt_view_t *view = (dt_view_t *)user_data;
+  dt_map_t *lib = (dt_map_t *)view->data;
+  g_hash_table_remove_all(lib->thumbs);
+}
+
 static void _view_map_filmstrip_activate_callback(gpointer instance, gpointer user_data)
 {
   dt_view_t *self = (dt_view_t *)user_data;
@@ -1138,6 +1375,7 @@ static gboolean _in_undo(int imgid)
 static void _set_image_location(dt_view_t *self, int imgid, float longitude, float latitude, float elevation,
                                 gboolean set_elevation, gboolean record_undo)
 {
+  dt_map_t *lib = (dt_map_t *)self->data;
   dt_image_t *img = dt_image_cache_get(darktable.image_cache, imgid, 'w');
 
   img->longitude = longitude;
@@ -1147,6 +1385,7 @@ static void _set_image_location(dt_view_t *self, int imgid, float longitude, flo
   if(record_undo) _push_position(self, imgid, img->longitude, img->latitude, img->elevation);
 
   dt_image_cache_write_release(darktable.image_cache, img, DT_IMAGE_CACHE_SAFE);
+  lib->index.stale = TRUE;
 
   dt_control_signal_raise(darktable.signals, DT_SIGNAL_MOUSE_OVER_IMAGE_CHANGE);
 }
@@ -1293,30 +1532,68 @@ static gboolean _view_map_prefs_changed(dt_map_t *lib)
   return prefs_changed;
 }
 
-static void _view_map_build_main_query(dt_map_t *lib)
+// loads the locations of the geotagged images, or the collected ones, into the grid
+static void _view_map_build_index(dt_map_t *lib)
 {
-  char *geo_query;
-
-  if(lib->statements.main_query) sqlite3_finalize(lib->statements.main_query);
+  const size_t cells = (size_t)DT_MAP_INDEX_CELLS * DT_MAP_INDEX_CELLS;
+  free(lib->index.points);
+  lib->index.points = NULL;
+  lib->index.count = 0;
+  if(!lib->index.cell_start) lib->index.cell_start = (uint32_t *)malloc(sizeof(uint32_t) * (cells + 1));
+  if(!lib->index.cell_start) return;
+  memset(lib->index.cell_start, 0, sizeof(uint32_t) * (cells + 1));
 
   lib->max_images_drawn = dt_conf_get_int("plugins/map/max_images_drawn");
   if(lib->max_images_drawn == 0) lib->max_images_drawn = 100;
   lib->filter_images_drawn = dt_conf_get_bool("plugins/map/filter_images_drawn");
-  geo_query = g_strdup_printf("SELECT * FROM (SELECT id, latitude FROM %s WHERE longitude >= ?1 AND "
-                              "longitude <= ?2 AND latitude <= ?3 AND latitude >= ?4 AND longitude NOT NULL AND "
-                              "latitude NOT NULL ORDER BY ABS(latitude - ?5), ABS(longitude - ?6) LIMIT 0, %d) "
-                              "ORDER BY (180 - latitude), id",
-                              lib->filter_images_drawn
-                              ? "main.images i INNER JOIN memory.collected_images c ON i.id = c.imgid"
-                              : "main.images",
-                              lib->max_images_drawn);
-
-  /* prepare the main query statement */
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), geo_query, -1, &lib->statements.main_query, NULL);
-
-  g_free(geo_query);
+  gchar *query = g_strdup_printf("SELECT id, latitude, longitude FROM %s WHERE longitude NOT NULL AND "
+                                 "latitude NOT NULL",
+                                 lib->filter_images_drawn
+                                 ? "main.images i INNER JOIN memory.collected_images c ON i.id = c.imgid"
+                                 : "main.images");
+
+  GArray *points = g_array_new(FALSE, FALSE, sizeof(dt_map_point_t));
+  sqlite3_stmt *stmt;
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), query, -1, &stmt, NULL);
+  while(sqlite3_step(stmt) == SQLITE_ROW)
+  {
+    dt_map_point_t p;
+    p.imgid = sqlite3_column_int(stmt, 0);
+    p.latitude = sqlite3_column_double(stmt, 1);
+    p.longitude = sqlite3_column_double(stmt, 2);
+    if(isnan(p.latitude) || isnan(p.longitude)) continue;
+    p.cell = _view_map_index_cell(_view_map_mercator_y(p.latitude)) * DT_MAP_INDEX_CELLS
+             + _view_map_index_cell(_view_map_mercator_x(p.longitude));
+    lib->index.cell_start[p.cell + 1]++;
+    g_array_append_val(points, p);
+  }
+  sqlite3_finalize(stmt);
+  g_free(query);
+
+  // sort them into their cells
+  for(size_t c = 0; c < cells; c++) lib->index.cell_start[c + 1] += lib->index.cell_start[c];
+  uint32_t *fill = (uint32_t *)malloc(sizeof(uint32_t) * cells);
+  lib->index.points = (dt_map_point_t *)malloc(sizeof(dt_map_point_t) * MAX(points->len, 1));
+  if(fill && lib->index.points)
+  {
+    memcpy(fill, lib->index.cell_start, sizeof(uint32_t) * cells);
+    for(guint k = 0; k < points->len; k++)
+    {
+      const dt_map_point_t *p = &g_array_index(points, dt_map_point_t, k);
+      lib->index.points[fill[p->cell]++] = *p;
+    }
+    lib->index.count = points->len;
+  }
+  else
+    memset(lib->index.cell_start, 0, sizeof(uint32_t) * (cells + 1));
+  free(fill);
+  g_array_free(points, TRUE);
+  lib->index.stale = FALSE;
+  dt_print(DT_DEBUG_CONTROL, "[map] %d geotagged images in the index\n", lib->index.count);
 }
 
+#undef DT_MAP_INDEX_CELLS
+
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
 // kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
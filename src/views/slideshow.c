@@ -34,47 +34,46 @@
 
 DT_MODULE(1)
 
-typedef enum dt_slideshow_event_t
-{
-  s_request_step,
-  s_request_step_back,
-  s_image_loaded,
-  s_blended,
-} dt_slideshow_event_t;
+// images rendered ahead on either side of the one shown, at most
+#define DT_SLIDESHOW_MAX_PREFETCH 8
+// seconds an image stays up with auto advance
+#define DT_SLIDESHOW_INTERVAL 5
 
-typedef enum dt_slideshow_state_t
+typedef struct dt_slideshow_slot_t
 {
-  s_prefetching,
-  s_waiting_for_user,
-  s_blending,
-} dt_slideshow_state_t;
+  uint32_t *buf;
+  // processed sizes might differ from screen size
+  uint32_t width, height;
+  int32_t num;   // position in the collection buf is for
+  int rendering; // a job is filling buf
+  int ready;
+} dt_slideshow_slot_t;
 
 typedef struct dt_slideshow_t
 {
-  uint32_t random_state;
   uint32_t scramble;
   uint32_t use_random;
   int32_t step;
   uint32_t width, height;
 
-
-  // double buffer
-  uint32_t *buf1, *buf2;
-  uint32_t *front, *back;
-  // processed sizes might differ from screen size
-  uint32_t front_width, front_height;
-  uint32_t back_width, back_height;
-  int32_t front_num, back_num;
+  // ring of screen sized buffers: the image shown and the ones prefetched on either side of it, filled by
+  // background jobs in the order they are due
+  dt_slideshow_slot_t slot[2 * DT_SLIDESHOW_MAX_PREFETCH + 1];
+  int num_slots, prefetch;
+  int generation;     // of the slots, the jobs of a slide show left since don't touch them
+  int front;          // slot shown, -1 until the first image is there
+  int32_t front_num;  // position of the image shown
+  int32_t target_num; // position to show, replaces front_num once its slot is ready
+  int job_queued;     // a job rendering the next slot is queued or running
+  int waiting;        // the user waits for target_num
 
   // output profile before we overwrote it:
   int old_profile_type;
 
-  // state machine stuff for image transitions:
   dt_pthread_mutex_t lock;
-  dt_slideshow_state_t state;      // global state cycle
-  uint32_t state_waiting_for_user; // user input (needed to step the cycle at one point)
 
   uint32_t auto_advance;
+  guint advance_timeout;
 
   // some magic to hide the mosue pointer
   guint mouse_timeout;
@@ -87,10 +86,12 @@ typedef struct dt_slideshow_format_t
   char style[128];
   gboolean style_append;
   dt_slideshow_t *d;
+  int slot, generation;
+  int32_t num;
 } dt_slideshow_format_t;
 
-// fwd declare state machine mechanics:
-static void _step_state(dt_slideshow_t *d, dt_slideshow_event_t event);
+static void _schedule(dt_slideshow_t *d);
+static void _request(dt_slideshow_t *d, const int32_t num);
 
 // callbacks for in-memory export
 static int bpp(dt_imageio_module_data_t *data)
@@ -108,82 +109,163 @@ static const char *mime(dt_imageio_module_data_t *data)
   return "memory";
 }
 
-static int write_image(dt_imageio_module_data_t *datai, const char *filename, const void *in, void *exif,
-                       int exif_len, int imgid, int num, int total)
+static gboolean auto_advance(gpointer user_data)
 {
-  dt_slideshow_format_t *data = (dt_slideshow_format_t *)datai;
-  dt_pthread_mutex_lock(&data->d->lock);
-  if(data->d->back)
-  { // might have been cleaned up when leaving slide show
-    memcpy(data->d->back, in, sizeof(uint32_t) * datai->width * datai->height);
-    data->d->back_width = datai->width;
-    data->d->back_height = datai->height;
+  dt_slideshow_t *d = (dt_slideshow_t *)user_data;
+  dt_pthread_mutex_lock(&d->lock);
+  d->advance_timeout = 0;
+  if(d->auto_advance && d->num_slots)
+  {
+    d->step = 1;
+    _request(d, d->front_num + 1);
   }
-  dt_pthread_mutex_unlock(&data->d->lock);
-  _step_state(data->d, s_image_loaded);
+  dt_pthread_mutex_unlock(&d->lock);
+  return FALSE;
+}
+
+// puts slot k up. call with the lock held.
+static void _show(dt_slideshow_t *d, const int k)
+{
+  d->front = k;
+  d->front_num = d->slot[k].num;
+  if(d->waiting) dt_control_log_busy_leave();
+  d->waiting = 0;
+
+  // viewing the one past the end?
+  const int32_t cnt = dt_collection_get_count(darktable.collection);
+  if(d->front_num == -1 || d->front_num == cnt)
+    dt_control_log(_("end of images. press any key to return to lighttable mode"));
+
+  // start a new one-off timer from when flipping buffers.
+  // this will show images before processing-heavy shots a little
+  // longer, but at least not result in shorter viewing times just after these
+  if(d->advance_timeout) g_source_remove(d->advance_timeout);
+  d->advance_timeout = d->auto_advance ? g_timeout_add_seconds(DT_SLIDESHOW_INTERVAL, auto_advance, d) : 0;
+
   // trigger expose
   dt_control_queue_redraw_center();
+}
+
+static int write_image(dt_imageio_module_data_t *datai, const char *filename, const void *in, void *exif,
+                       int exif_len, const char *xmp, int imgid, int num, int total)
+{
+  dt_slideshow_format_t *data = (dt_slideshow_format_t *)datai;
+  dt_slideshow_t *d = data->d;
+  dt_pthread_mutex_lock(&d->lock);
+  dt_slideshow_slot_t *slot = d->slot + data->slot;
+  // might have been cleaned up when leaving slide show
+  if(d->num_slots && d->generation == data->generation && slot->buf && slot->num == data->num)
+  {
+    memcpy(slot->buf, in, sizeof(uint32_t) * datai->width * datai->height);
+    slot->width = datai->width;
+    slot->height = datai->height;
+    slot->ready = 1;
+    slot->rendering = 0;
+    if(slot->num == d->target_num) _show(d, data->slot);
+  }
+  dt_pthread_mutex_unlock(&d->lock);
   return 0;
 }
 
-static uint32_t next_random(dt_slideshow_t *d)
+static uint32_t _bit_reverse(uint32_t i)
 {
-  uint32_t i = d->random_state++;
-  // van der corput for 32 bits. this guarantees every number will appear exactly once
   i = ((i & 0x0000ffff) << 16) | (i >> 16);
   i = ((i & 0x00ff00ff) << 8) | ((i & 0xff00ff00) >> 8);
   i = ((i & 0x0f0f0f0f) << 4) | ((i & 0xf0f0f0f0) >> 4);
   i = ((i & 0x33333333) << 2) | ((i & 0xcccccccc) >> 2);
   i = ((i & 0x55555555) << 1) | ((i & 0xaaaaaaaa) >> 1);
-  return i ^ d->scramble;
+  return i;
 }
 
-// process image
-static int process_next_image(dt_slideshow_t *d)
+// id of the image at position num of the slide show, 0 if there is none
+static int32_t _image_at(dt_slideshow_t *d, const int32_t num)
 {
-  dt_imageio_module_format_t buf;
-  dt_slideshow_format_t dat;
-  buf.mime = mime;
-  buf.levels = levels;
-  buf.bpp = bpp;
-  buf.write_image = write_image;
-  dat.max_width = d->width;
-  dat.max_height = d->height;
-  dat.style[0] = '\0';
-  dat.d = d;
-
-  // get random image id from sql
-  int32_t id = 0;
   const int32_t cnt = dt_collection_get_count(darktable.collection);
-  if(!cnt) return 1;
-  dt_pthread_mutex_lock(&d->lock);
-  d->back_num = d->front_num + d->step;
-  int32_t ran = d->back_num;
-  dt_pthread_mutex_unlock(&d->lock);
-  // enumerated all images? i.e. prefetching the one two after the limit, when viewing the one past the end.
-  if(ran == -2 || ran == cnt + 1)
-  {
-    dt_control_log(_("end of images. press any key to return to lighttable mode"));
-  }
+  if(!cnt) return 0;
+  int32_t rand = num % cnt;
+  while(rand < 0) rand += cnt;
   if(d->use_random)
   {
-    // get random number up to next power of two greater than cnt:
+    // van der corput over the next power of two greater than cnt, a permutation. walking its cycles until
+    // they land in our desired range keeps it one, so every image appears exactly once and stepping back
+    // shows the same ones.
     const uint32_t zeros = __builtin_clz(cnt);
-    // pull radical inverses only in our desired range:
+    uint32_t i = rand;
     do
-      ran = next_random(d) >> zeros;
-    while(ran >= cnt);
+      i = (_bit_reverse(i) ^ d->scramble) >> zeros;
+    while(i >= (uint32_t)cnt);
+    rand = i;
   }
-  int32_t rand = ran % cnt;
-  while(rand < 0) rand += cnt;
   const gchar *query = dt_collection_get_query(darktable.collection);
-  if(!query) return 1;
+  if(!query) return 0;
+  int32_t id = 0;
   sqlite3_stmt *stmt;
   DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), query, -1, &stmt, NULL);
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, rand);
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, rand + 1);
   if(sqlite3_step(stmt) == SQLITE_ROW) id = sqlite3_column_int(stmt, 0);
   sqlite3_finalize(stmt);
+  return id;
+}
+
+// the slot to render next into and its position, -1 if all are there. the positions are taken in the order
+// they are due: the one to show, then with auto advance the ones ahead, one interval after another, before
+// the ones behind. without, the user may go either way and the two directions take turns, ahead first.
+// slots of positions out of reach are reused. call with the lock held.
+static int _pick(dt_slideshow_t *d, int32_t *num)
+{
+  for(int o = 0; o < 2 * d->prefetch + 1; o++)
+  {
+    int offset;
+    if(d->auto_advance)
+      offset = o <= d->prefetch ? o : d->prefetch - o;
+    else
+      offset = (o + 1) / 2 * (o & 1 ? 1 : -1);
+    const int32_t want = d->target_num + offset * d->step;
+
+    int victim = -1, there = 0;
+    for(int k = 0; k < d->num_slots && !there; k++)
+    {
+      const dt_slideshow_slot_t *slot = d->slot + k;
+      if((slot->ready || slot->rendering) && slot->num == want)
+        there = 1;
+      else if(!slot->rendering && k != d->front
+              && (!slot->ready || abs(slot->num - d->target_num) > d->prefetch)
+              && (victim < 0 || d->slot[victim].ready))
+        victim = k;
+    }
+    if(there) continue;
+    if(victim < 0) return -1;
+
+    dt_slideshow_slot_t *slot = d->slot + victim;
+    slot->num = want;
+    slot->ready = 0;
+    slot->rendering = 1;
+    *num = want;
+    return victim;
+  }
+  return -1;
+}
+
+// renders position num into slot k
+static void _render(dt_slideshow_t *d, const int k, const int32_t num, const int generation)
+{
+  dt_imageio_module_format_t buf;
+  dt_slideshow_format_t dat;
+  buf.mime = mime;
+  buf.levels = levels;
+  buf.bpp = bpp;
+  buf.write_image = write_image;
+  buf.write_image_begin = NULL;
+  dat.max_width = d->width;
+  dat.max_height = d->height;
+  dat.style[0] = '\0';
+  dat.d = d;
+  dat.slot = k;
+  dat.generation = generation;
+  dat.num = num;
+
+  const int32_t id = _image_at(d, num);
 
   // this is a little slow, might be worth to do an option:
   const int high_quality = dt_conf_get_bool("plugins/slideshow/high_quality");
@@ -191,13 +273,36 @@ static int process_next_image(dt_slideshow_t *d)
     // the flags are: ignore exif, display byteorder, high quality, upscale, thumbnail
     dt_imageio_export_with_flags(id, "unused", &buf, (dt_imageio_module_data_t *)&dat, 1, 1, high_quality, 1, 0,
                                  0, 0, 0, 0, 1, 1);
-  return 0;
+
+  // nothing came out, show black instead of waiting for it forever
+  dt_pthread_mutex_lock(&d->lock);
+  dt_slideshow_slot_t *slot = d->slot + k;
+  if(d->num_slots && d->generation == generation && slot->num == num && slot->rendering)
+  {
+    slot->width = slot->height = 0;
+    slot->ready = 1;
+    slot->rendering = 0;
+    if(num == d->target_num) _show(d, k);
+  }
+  dt_pthread_mutex_unlock(&d->lock);
 }
 
 static int32_t process_job_run(dt_job_t *job)
 {
   dt_slideshow_t *d = dt_control_job_get_params(job);
-  process_next_image(d);
+  dt_pthread_mutex_lock(&d->lock);
+  int32_t num = 0;
+  const int generation = d->generation;
+  const int k = d->num_slots ? _pick(d, &num) : -1;
+  dt_pthread_mutex_unlock(&d->lock);
+
+  if(k >= 0) _render(d, k, num, generation);
+
+  // one image per job, so others get their turn in between
+  dt_pthread_mutex_lock(&d->lock);
+  d->job_queued = 0;
+  if(k >= 0 && d->num_slots) _schedule(d);
+  dt_pthread_mutex_unlock(&d->lock);
   return 0;
 }
 
@@ -209,87 +314,39 @@ static dt_job_t *process_job_create(dt_slideshow_t *d)
   return job;
 }
 
-static gboolean auto_advance(gpointer user_data)
+// queues a job for the next slot due, if there is none yet. call with the lock held.
+static void _schedule(dt_slideshow_t *d)
 {
-  dt_slideshow_t *d = (dt_slideshow_t *)user_data;
-  if(!d->auto_advance) return FALSE;
-  _step_state(d, s_request_step);
-  return FALSE;
+  if(d->job_queued) return;
+  dt_job_t *job = process_job_create(d);
+  if(!job) return;
+  d->job_queued = 1;
+  dt_control_add_job(darktable.control, DT_JOB_QUEUE_USER_BG, job);
 }
 
-// state machine stepping
-static void _step_state(dt_slideshow_t *d, dt_slideshow_event_t event)
+// shows position num, right away if it is prefetched already. call with the lock held.
+static void _request(dt_slideshow_t *d, const int32_t num)
 {
-  dt_pthread_mutex_lock(&d->lock);
-
-  if(event == s_request_step || event == s_request_step_back)
-  {
-    if(event == s_request_step) d->step = 1;
-    if(event == s_request_step_back) d->step = -1;
-    // make sure we only enter busy if really flipping the bit
-    if(d->state_waiting_for_user) dt_control_log_busy_enter();
-    d->state_waiting_for_user = 0;
-  }
+  d->target_num = num;
+  for(int k = 0; k < d->num_slots; k++)
+    if(d->slot[k].ready && d->slot[k].num == num)
+    {
+      _show(d, k);
+      _schedule(d);
+      return;
+    }
+  if(!d->waiting) dt_control_log_busy_enter();
+  d->waiting = 1;
+  _schedule(d);
+}
 
-  switch(d->state)
+static void _step(dt_slideshow_t *d, const int step)
+{
+  dt_pthread_mutex_lock(&d->lock);
+  if(d->num_slots)
   {
-    case s_prefetching:
-      if(event == s_image_loaded)
-      {
-        d->state = s_waiting_for_user;
-        // and go to next case
-      }
-      else
-        break;
-
-    case s_waiting_for_user:
-      if(d->state_waiting_for_user == 0)
-      {
-        d->state = s_blending;
-        // swap buffers, start blending cycle
-        if(d->front_num + d->step == d->back_num)
-        {
-          // if step changed, don't just swap but kick off new job
-          dt_control_log_busy_leave();
-          uint32_t *tmp = d->front;
-          d->front = d->back;
-          d->back = tmp;
-          d->front_width = d->back_width;
-          d->front_height = d->back_height;
-          int32_t tn = d->front_num;
-          d->front_num = d->back_num;
-          d->back_num = tn;
-          // start over
-          d->state_waiting_for_user = 1;
-
-          // start new one-off timer from when flipping buffers.
-          // this will show images before processing-heavy shots a little
-          // longer, but at least not result in shorter viewing times just after these
-          if(d->auto_advance) g_timeout_add_seconds(5, auto_advance, d);
-        }
-        // and execute the next case, too
-      }
-      else
-        break;
-
-    case s_blending:
-      // draw new front buf
-      dt_control_queue_redraw_center();
-
-      // TODO: wait for that once there are fancy effects:
-      // if(event == s_blended)
-      {
-        // start bgjob
-        dt_control_add_job(darktable.control, DT_JOB_QUEUE_USER_BG, process_job_create(d));
-        d->state = s_prefetching;
-      }
-      break;
-
-    default:
-      // uh. should never happen. sanitize:
-      d->state_waiting_for_user = 1;
-      d->state = s_prefetching;
-      break;
+    d->step = step;
+    _request(d, d->target_num + step);
   }
   dt_pthread_mutex_unlock(&d->lock);
 }
@@ -374,25 +431,35 @@ void enter(dt_view_t *self)
 
   d->width = rect.width * darktable.gui->ppd;
   d->height = rect.height * darktable.gui->ppd;
-  d->buf1 = dt_alloc_align(64, sizeof(uint32_t) * d->width * d->height);
-  d->buf2 = dt_alloc_align(64, sizeof(uint32_t) * d->width * d->height);
-  d->front = d->buf1;
-  d->back = d->buf2;
 
-  // start in prefetching phase, do that by initing one state before
-  // and stepping through that at the very end of this function
-  d->state = s_blending;
-  d->state_waiting_for_user = 1;
+  // alloc the screen-size ring, as much of it as fits
+  d->prefetch = CLAMP(dt_conf_get_int("plugins/slideshow/prefetch"), 1, DT_SLIDESHOW_MAX_PREFETCH);
+  d->num_slots = 0;
+  for(int k = 0; k < 2 * d->prefetch + 1; k++)
+  {
+    dt_slideshow_slot_t *slot = d->slot + d->num_slots;
+    memset(slot, 0, sizeof(dt_slideshow_slot_t));
+    slot->buf = dt_alloc_align(64, sizeof(uint32_t) * d->width * d->height);
+    if(!slot->buf) break;
+    d->num_slots++;
+  }
+  // the one shown and the next one at least
+  d->prefetch = MAX(0, MIN(d->prefetch, (d->num_slots - 1) / 2));
+  d->generation++;
+  d->front = -1;
+  d->job_queued = 0;
+  d->waiting = 0;
 
   d->auto_advance = 0;
+  d->advance_timeout = 0;
 
   // restart from beginning, will first increment counter by step and then prefetch
-  d->front_num = d->back_num = dt_view_lighttable_get_position(darktable.view_manager) - 1;
+  d->front_num = d->target_num = dt_view_lighttable_get_position(darktable.view_manager) - 1;
   d->step = 1;
   dt_pthread_mutex_unlock(&d->lock);
 
-  // start first job
-  _step_state(d, s_request_step);
+  // start the first jobs
+  _step(d, 1);
 }
 
 void leave(dt_view_t *self)
@@ -407,9 +474,17 @@ void leave(dt_view_t *self)
   dt_view_lighttable_set_position(darktable.view_manager, d->front_num);
   dt_conf_set_int("plugins/lighttable/export/icctype", d->old_profile_type);
   dt_pthread_mutex_lock(&d->lock);
-  dt_free_align(d->buf1);
-  dt_free_align(d->buf2);
-  d->buf1 = d->buf2 = d->front = d->back = 0;
+  if(d->advance_timeout) g_source_remove(d->advance_timeout);
+  d->advance_timeout = 0;
+  if(d->waiting) dt_control_log_busy_leave();
+  d->waiting = 0;
+  for(int k = 0; k < d->num_slots; k++)
+  {
+    dt_free_align(d->slot[k].buf);
+    d->slot[k].buf = NULL;
+  }
+  d->num_slots = 0;
+  d->front = -1;
   dt_pthread_mutex_unlock(&d->lock);
 }
 
@@ -425,21 +500,23 @@ void expose(dt_view_t *self, cairo_t *cr, int32_t width, int32_t height, int32_t
 
   dt_pthread_mutex_lock(&d->lock);
   cairo_paint(cr);
-  if(d->front)
+  const dt_slideshow_slot_t *front = d->front >= 0 ? d->slot + d->front : NULL;
+  if(front && front->buf && front->width && front->height)
   {
     // undo clip region/border around the image:
     cairo_restore(cr); // pop view manager
     cairo_restore(cr); // pop control
     cairo_reset_clip(cr);
     cairo_save(cr);
-    cairo_translate(cr, (d->width - d->front_width) * .5f / darktable.gui->ppd, (d->height - d->front_height) * .5f / darktable.gui->ppd);
+    cairo_translate(cr, (d->width - front->width) * .5f / darktable.gui->ppd,
+                    (d->height - front->height) * .5f / darktable.gui->ppd);
     cairo_surface_t *surface = NULL;
-    const int32_t stride = cairo_format_stride_for_width(CAIRO_FORMAT_RGB24, d->front_width);
-    surface = dt_cairo_image_surface_create_for_data((uint8_t *)d->front, CAIRO_FORMAT_RGB24, d->front_width,
-                                                  d->front_height, stride);
+    const int32_t stride = cairo_format_stride_for_width(CAIRO_FORMAT_RGB24, front->width);
+    surface = dt_cairo_image_surface_create_for_data((uint8_t *)front->buf, CAIRO_FORMAT_RGB24, front->width,
+                                                  front->height, stride);
     cairo_set_source_surface(cr, surface, 0, 0);
     cairo_pattern_set_filter(cairo_get_source(cr), CAIRO_FILTER_NEAREST);
-    cairo_rectangle(cr, 0, 0, d->front_width/darktable.gui->ppd, d->front_height/darktable.gui->ppd);
+    cairo_rectangle(cr, 0, 0, front->width/darktable.gui->ppd, front->height/darktable.gui->ppd);
     cairo_fill(cr);
     cairo_surface_destroy(surface);
     cairo_restore(cr);
@@ -479,9 +556,9 @@ int button_pressed(dt_view_t *self, double x, double y, double pressure, int whi
 {
   dt_slideshow_t *d = (dt_slideshow_t *)self->data;
   if(which == 1)
-    _step_state(d, s_request_step);
+    _step(d, 1);
   else if(which == 3)
-    _step_state(d, s_request_step_back);
+    _step(d, -1);
   else
     return 1;
 
@@ -502,7 +579,7 @@ int key_pressed(dt_view_t *self, guint key, guint state)
     if(!d->auto_advance)
     {
       d->auto_advance = 1;
-      _step_state(d, s_request_step);
+      _step(d, 1);
     }
     else
       d->auto_advance = 0;
@@ -522,6 +599,9 @@ void connect_key_accels(dt_view_t *self)
 {
 }
 
+#undef DT_SLIDESHOW_MAX_PREFETCH
+#undef DT_SLIDESHOW_INTERVAL
+
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
 // kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
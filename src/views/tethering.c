@@ -173,14 +173,18 @@ static void _expose_tethered_mode(dt_view_t *self, cairo_t *cr, int32_t width, i
 
   if(cam->is_live_viewing == TRUE) // display the preview
   {
-    dt_pthread_mutex_lock(&cam->live_view_pixbuf_mutex);
-    if(GDK_IS_PIXBUF(cam->live_view_pixbuf))
+    dt_pthread_mutex_lock(&cam->live_view_buffer_mutex);
+    float w = width - (MARGIN * 2.0f);
+    float h = height - (MARGIN * 2.0f) - BAR_HEIGHT;
+    // the frames only need to be decoded as large as they are shown
+    const float ppd = darktable.gui->ppd;
+    cam->live_view_fit_width = cam->live_view_zoom ? 0 : ppd * (cam->live_view_rotation % 2 == 0 ? w : h);
+    cam->live_view_fit_height = cam->live_view_zoom ? 0 : ppd * (cam->live_view_rotation % 2 == 0 ? h : w);
+    if(dt_camctl_camera_update_live_view(cam))
     {
-      gint pw = gdk_pixbuf_get_width(cam->live_view_pixbuf);
-      gint ph = gdk_pixbuf_get_height(cam->live_view_pixbuf);
-
-      float w = width - (MARGIN * 2.0f);
-      float h = height - (MARGIN * 2.0f) - BAR_HEIGHT;
+      cairo_surface_t *frame = cam->live_view_shown;
+      gint pw = cairo_image_surface_get_width(frame);
+      gint ph = cairo_image_surface_get_height(frame);
 
       float scale;
       if(cam->live_view_rotation % 2 == 0)
@@ -195,10 +199,10 @@ static void _expose_tethered_mode(dt_view_t *self, cairo_t *cr, int32_t width, i
       if(cam->live_view_zoom == FALSE) cairo_scale(cr, scale, scale); // scale to fit canvas
       cairo_translate(cr, -0.5 * pw, -0.5 * ph);                      // origin back to corner
 
-      gdk_cairo_set_source_pixbuf(cr, cam->live_view_pixbuf, 0, 0);
+      cairo_set_source_surface(cr, frame, 0, 0);
       cairo_paint(cr);
     }
-    dt_pthread_mutex_unlock(&cam->live_view_pixbuf_mutex);
+    dt_pthread_mutex_unlock(&cam->live_view_buffer_mutex);
   }
   else if(lib->image_id >= 0) // First of all draw image if availble
   {
@@ -27,6 +27,7 @@
 #include "common/image_cache.h"
 #include "common/mipmap_cache.h"
 #include "common/module.h"
+#include "common/selection.h"
 #include "common/undo.h"
 #include "control/conf.h"
 #include "control/control.h"
@@ -44,16 +45,20 @@
 #include <strings.h>
 
 #define DECORATION_SIZE_LIMIT 40
+// bytes of thumbnail surfaces kept for redraws
+#define DT_VIEW_THUMBS_SIZE ((size_t)128 << 20)
+// thumbnail surfaces made again per frame of the center view, if stand-ins are there for the others
+#define DT_VIEW_THUMBS_PER_FRAME 12
 
 static void dt_view_manager_load_modules(dt_view_manager_t *vm);
 static int dt_view_load_module(void *v, const char *libname, const char *module_name);
 static void dt_view_unload_module(dt_view_t *view);
+static void _view_thumb_free(gpointer data);
+static void _view_thumbs_flush(gpointer instance, gpointer user_data);
 
 void dt_view_manager_init(dt_view_manager_t *vm)
 {
   /* prepare statements */
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "SELECT imgid FROM main.selected_images "
-                              "WHERE imgid = ?1", -1, &vm->statements.is_selected, NULL);
   DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "DELETE FROM main.selected_images WHERE imgid = ?1",
                               -1, &vm->statements.delete_from_selected, NULL);
   DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
@@ -68,6 +73,15 @@ void dt_view_manager_init(dt_view_manager_t *vm)
       "SELECT id FROM main.images WHERE group_id = (SELECT group_id FROM main.images WHERE id=?1) AND id != ?2",
       -1, &vm->statements.get_grouped, NULL);
 
+  vm->thumbs.surfaces = g_hash_table_new_full(NULL, NULL, NULL, _view_thumb_free);
+  vm->thumbs.size = 0;
+  vm->thumbs.in_frame = FALSE;
+  vm->thumbs.built = vm->thumbs.deferred = 0;
+  dt_control_signal_connect(darktable.signals, DT_SIGNAL_DEVELOP_MIPMAP_UPDATED, G_CALLBACK(_view_thumbs_flush),
+                            NULL);
+  dt_control_signal_connect(darktable.signals, DT_SIGNAL_CONTROL_PROFILE_CHANGED, G_CALLBACK(_view_thumbs_flush),
+                            NULL);
+
   dt_view_manager_load_modules(vm);
 
   // Modules loaded, let's handle specific cases
@@ -96,6 +110,9 @@ void dt_view_manager_gui_init(dt_view_manager_t *vm)
 void dt_view_manager_cleanup(dt_view_manager_t *vm)
 {
   for(GList *iter = vm->views; iter; iter = g_list_next(iter)) dt_view_unload_module((dt_view_t *)iter->data);
+
+  dt_control_signal_disconnect(darktable.signals, G_CALLBACK(_view_thumbs_flush), NULL);
+  g_hash_table_destroy(vm->thumbs.surfaces);
 }
 
 const dt_view_t *dt_view_manager_get_current_view(dt_view_manager_t *vm)
@@ -512,7 +529,12 @@ void dt_view_manager_expose(dt_view_manager_t *vm, cairo_t *cr, int32_t width, i
       px = 10000.0;
       py = -1.0;
     }
+    vm->thumbs.in_frame = TRUE;
+    vm->thumbs.built = vm->thumbs.deferred = 0;
     vm->current_view->expose(vm->current_view, cr, vm->current_view->width, vm->current_view->height, px, py);
+    vm->thumbs.in_frame = FALSE;
+    // the thumbnails left for later
+    if(vm->thumbs.deferred) dt_control_queue_redraw_center();
 
     cairo_restore(cr);
     /* expose plugins */
@@ -788,20 +810,160 @@ int32_t dt_view_get_image_to_act_on()
   }
   else
   {
-    /* clear and reset statement */
-    DT_DEBUG_SQLITE3_CLEAR_BINDINGS(darktable.view_manager->statements.is_selected);
-    DT_DEBUG_SQLITE3_RESET(darktable.view_manager->statements.is_selected);
-
-    /* setup statement and iterate over rows */
-    DT_DEBUG_SQLITE3_BIND_INT(darktable.view_manager->statements.is_selected, 1, mouse_over_id);
-
-    if(mouse_over_id <= 0 || sqlite3_step(darktable.view_manager->statements.is_selected) == SQLITE_ROW)
+    if(mouse_over_id <= 0 || dt_selection_is_selected(darktable.selection, mouse_over_id))
       return -1;
     else
       return mouse_over_id;
   }
 }
 
+/* a thumbnail converted for the screen and scaled to the size it was last drawn at */
+typedef struct dt_view_thumb_t
+{
+  const uint8_t *buf;           // the mipmap buffer it was made from, to notice a new one
+  dt_mipmap_size_t mip;
+  int32_t buf_width, buf_height;
+  int32_t width, height;        // device pixels
+  cairo_surface_t *surface;
+  size_t size;
+} dt_view_thumb_t;
+
+static void _view_thumb_free(gpointer data)
+{
+  dt_view_thumb_t *thumb = (dt_view_thumb_t *)data;
+  darktable.view_manager->thumbs.size -= thumb->size;
+  cairo_surface_destroy(thumb->surface);
+  free(thumb);
+}
+
+static void _view_thumbs_flush(gpointer instance, gpointer user_data)
+{
+  g_hash_table_remove_all(darktable.view_manager->thumbs.surfaces);
+}
+
+/* the thumbnail of buf as a surface of width x height device pixels, made again only if it isn't of this
+ * buffer and size. once a frame of the center view has made DT_VIEW_THUMBS_PER_FRAME of them, the one the
+ * image had before is handed out instead if there is one, exact is FALSE then and the view is drawn again
+ * right after. destroy the reference returned with cairo_surface_destroy(). */
+static cairo_surface_t *_view_thumb_get(const uint32_t imgid, const dt_mipmap_buffer_t *buf, const int32_t width,
+                                        const int32_t height, const gboolean nearest, gboolean *exact)
+{
+  dt_view_manager_t *vm = darktable.view_manager;
+  dt_view_thumb_t *thumb = g_hash_table_lookup(vm->thumbs.surfaces, GUINT_TO_POINTER(imgid));
+  *exact = TRUE;
+  if(thumb && thumb->buf == buf->buf && thumb->mip == buf->size && thumb->buf_width == buf->width
+     && thumb->buf_height == buf->height && thumb->width == width && thumb->height == height)
+    return cairo_surface_reference(thumb->surface);
+
+  // zooming changes the size of all cells at once. making their surfaces again is spread over a few frames,
+  // the old ones scaled are fine stand-ins until then.
+  if(thumb && vm->thumbs.in_frame && vm->thumbs.built >= DT_VIEW_THUMBS_PER_FRAME)
+  {
+    vm->thumbs.deferred++;
+    *exact = FALSE;
+    return cairo_surface_reference(thumb->surface);
+  }
+  if(vm->thumbs.in_frame) vm->thumbs.built++;
+
+  uint8_t *rgbbuf = (uint8_t *)calloc(buf->width * buf->height * 4, sizeof(uint8_t));
+  if(!rgbbuf) return NULL;
+
+  gboolean have_lock = FALSE;
+  cmsHTRANSFORM transform = NULL;
+
+  if(dt_conf_get_bool("cache_color_managed"))
+  {
+    pthread_rwlock_rdlock(&darktable.color_profiles->xprofile_lock);
+    have_lock = TRUE;
+
+    // we only color manage when a thumbnail is sRGB or AdobeRGB. everything else just gets dumped to the screen
+    if(buf->color_space == DT_COLORSPACE_SRGB &&
+       darktable.color_profiles->transform_srgb_to_display)
+    {
+      transform = darktable.color_profiles->transform_srgb_to_display;
+    }
+    else if(buf->color_space == DT_COLORSPACE_ADOBERGB &&
+            darktable.color_profiles->transform_adobe_rgb_to_display)
+    {
+      transform = darktable.color_profiles->transform_adobe_rgb_to_display;
+    }
+    else
+    {
+      pthread_rwlock_unlock(&darktable.color_profiles->xprofile_lock);
+      have_lock = FALSE;
+      if(buf->color_space == DT_COLORSPACE_NONE)
+      {
+        fprintf(stderr, "oops, there seems to be a code path not setting the color space of thumbnails!\n");
+      }
+      else if(buf->color_space != DT_COLORSPACE_DISPLAY)
+      {
+        fprintf(stderr, "oops, there seems to be a code path setting an unhandled color space of thumbnails (%s)!\n",
+                dt_colorspaces_get_name(buf->color_space, "from file"));
+      }
+    }
+  }
+
+#ifdef _OPENMP
+  #pragma omp parallel for schedule(static) default(none) shared(buf, rgbbuf, transform)
+#endif
+  for(int i = 0; i < buf->height; i++)
+  {
+    const uint8_t *in = buf->buf + i * buf->width * 4;
+    uint8_t *out = rgbbuf + i * buf->width * 4;
+
+    if(transform)
+    {
+      cmsDoTransform(transform, in, out, buf->width);
+    }
+    else
+    {
+      for(int j = 0; j < buf->width; j++, in += 4, out += 4)
+      {
+        out[0] = in[2];
+        out[1] = in[1];
+        out[2] = in[0];
+      }
+    }
+  }
+  if(have_lock) pthread_rwlock_unlock(&darktable.color_profiles->xprofile_lock);
+
+  const int32_t stride = cairo_format_stride_for_width(CAIRO_FORMAT_RGB24, buf->width);
+  cairo_surface_t *source
+      = cairo_image_surface_create_for_data(rgbbuf, CAIRO_FORMAT_RGB24, buf->width, buf->height, stride);
+
+  // scale it once, drawing it is a plain copy then
+  cairo_surface_t *surface = cairo_image_surface_create(CAIRO_FORMAT_RGB24, width, height);
+  cairo_t *cr = cairo_create(surface);
+  cairo_scale(cr, width / (double)buf->width, height / (double)buf->height);
+  cairo_set_source_surface(cr, source, 0, 0);
+  if(nearest) cairo_pattern_set_filter(cairo_get_source(cr), CAIRO_FILTER_NEAREST);
+  cairo_paint(cr);
+  cairo_destroy(cr);
+  cairo_surface_destroy(source);
+  free(rgbbuf);
+
+  g_hash_table_remove(vm->thumbs.surfaces, GUINT_TO_POINTER(imgid));
+
+  // full previews and the like are drawn once in a while only, they don't push out the cells
+  const size_t size = (size_t)cairo_image_surface_get_stride(surface) * height;
+  if(size > DT_VIEW_THUMBS_SIZE / 8) return surface;
+
+  thumb = (dt_view_thumb_t *)calloc(1, sizeof(dt_view_thumb_t));
+  thumb->buf = buf->buf;
+  thumb->mip = buf->size;
+  thumb->buf_width = buf->width;
+  thumb->buf_height = buf->height;
+  thumb->width = width;
+  thumb->height = height;
+  thumb->surface = cairo_surface_reference(surface);
+  thumb->size = size;
+
+  if(vm->thumbs.size + size > DT_VIEW_THUMBS_SIZE) g_hash_table_remove_all(vm->thumbs.surfaces);
+  vm->thumbs.size += size;
+  g_hash_table_insert(vm->thumbs.surfaces, GUINT_TO_POINTER(imgid), thumb);
+  return surface;
+}
+
 int dt_view_image_expose(dt_view_image_over_t *image_over, uint32_t imgid, cairo_t *cr, int32_t width,
                          int32_t height, int32_t zoom, int32_t px, int32_t py, gboolean full_preview, gboolean image_only)
 {
@@ -829,16 +991,7 @@ int dt_view_image_expose(dt_view_image_over_t *image_over, uint32_t imgid, cairo
   // this is a gui thread only thing. no mutex required:
   const int imgsel = dt_control_get_mouse_over_id(); //  darktable.control->global_settings.lib_image_mouse_over_id;
 
-  if (draw_selected)
-  {
-    /* clear and reset statements */
-    DT_DEBUG_SQLITE3_CLEAR_BINDINGS(darktable.view_manager->statements.is_selected);
-    DT_DEBUG_SQLITE3_RESET(darktable.view_manager->statements.is_selected);
-    /* bind imgid to prepared statments */
-    DT_DEBUG_SQLITE3_BIND_INT(darktable.view_manager->statements.is_selected, 1, imgid);
-    /* lets check if imgid is selected */
-    if(sqlite3_step(darktable.view_manager->statements.is_selected) == SQLITE_ROW) selected = 1;
-  }
+  if(draw_selected) selected = dt_selection_is_selected(darktable.selection, imgid);
 
   dt_image_t buffered_image;
   const dt_image_t *img = dt_image_cache_testget(darktable.image_cache, imgid, 'r');
@@ -936,77 +1089,8 @@ int dt_view_image_expose(dt_view_image_over_t *image_over, uint32_t imgid, cairo
   {
     float scale = 1.0;
 
-    cairo_surface_t *surface = NULL;
-    uint8_t *rgbbuf = NULL;
     if(buf.buf)
     {
-      rgbbuf = (uint8_t *)calloc(buf.width * buf.height * 4, sizeof(uint8_t));
-      if(rgbbuf)
-      {
-        gboolean have_lock = FALSE;
-        cmsHTRANSFORM transform = NULL;
-
-        if(dt_conf_get_bool("cache_color_managed"))
-        {
-          pthread_rwlock_rdlock(&darktable.color_profiles->xprofile_lock);
-          have_lock = TRUE;
-
-          // we only color manage when a thumbnail is sRGB or AdobeRGB. everything else just gets dumped to the screen
-          if(buf.color_space == DT_COLORSPACE_SRGB &&
-             darktable.color_profiles->transform_srgb_to_display)
-          {
-            transform = darktable.color_profiles->transform_srgb_to_display;
-          }
-          else if(buf.color_space == DT_COLORSPACE_ADOBERGB &&
-                  darktable.color_profiles->transform_adobe_rgb_to_display)
-          {
-            transform = darktable.color_profiles->transform_adobe_rgb_to_display;
-          }
-          else
-          {
-            pthread_rwlock_unlock(&darktable.color_profiles->xprofile_lock);
-            have_lock = FALSE;
-            if(buf.color_space == DT_COLORSPACE_NONE)
-            {
-              fprintf(stderr, "oops, there seems to be a code path not setting the color space of thumbnails!\n");
-            }
-            else if(buf.color_space != DT_COLORSPACE_DISPLAY)
-            {
-              fprintf(stderr, "oops, there seems to be a code path setting an unhandled color space of thumbnails (%s)!\n",
-                      dt_colorspaces_get_name(buf.color_space, "from file"));
-            }
-          }
-        }
-
-#ifdef _OPENMP
-  #pragma omp parallel for schedule(static) default(none) shared(buf, rgbbuf, transform)
-#endif
-        for(int i = 0; i < buf.height; i++)
-        {
-          const uint8_t *in = buf.buf + i * buf.width * 4;
-          uint8_t *out = rgbbuf + i * buf.width * 4;
-
-          if(transform)
-          {
-            cmsDoTransform(transform, in, out, buf.width);
-          }
-          else
-          {
-            for(int j = 0; j < buf.width; j++, in += 4, out += 4)
-            {
-              out[0] = in[2];
-              out[1] = in[1];
-              out[2] = in[0];
-            }
-          }
-        }
-        if(have_lock) pthread_rwlock_unlock(&darktable.color_profiles->xprofile_lock);
-
-        const int32_t stride = cairo_format_stride_for_width(CAIRO_FORMAT_RGB24, buf.width);
-        surface
-          = cairo_image_surface_create_for_data(rgbbuf, CAIRO_FORMAT_RGB24, buf.width, buf.height, stride);
-      }
-
       if(zoom == 1 && !image_only)
       {
         const int32_t tb = DT_PIXEL_APPLY_DPI(dt_conf_get_int("plugins/darkroom/ui/border_size"));
@@ -1026,25 +1110,36 @@ int dt_view_image_expose(dt_view_image_over_t *image_over, uint32_t imgid, cairo
 
     cairo_scale(cr, scale, scale);
 
-    if(buf.buf && surface)
+    if(buf.buf)
     {
       if (!image_only) cairo_translate(cr, -0.5 * buf.width, -0.5 * buf.height);
-      cairo_set_source_surface(cr, surface, 0, 0);
+      // the size on screen in device pixels, the cached surface is scaled to that already so it is just copied
+      double dx = buf.width, dy = buf.height;
+      cairo_user_to_device_distance(cr, &dx, &dy);
+      const int32_t sw = MAX(1, (int32_t)(fabs(dx) + 0.5)), sh = MAX(1, (int32_t)(fabs(dy) + 0.5));
       // set filter no nearest:
       // in skull mode, we want to see big pixels.
       // in 1 iir mode for the right mip, we want to see exactly what the pipe gave us, 1:1 pixel for pixel.
       // in between, filtering just makes stuff go unsharp.
-      if((buf.width <= 8 && buf.height <= 8) || fabsf(scale - 1.0f) < 0.01f)
-        cairo_pattern_set_filter(cairo_get_source(cr), CAIRO_FILTER_NEAREST);
-      cairo_rectangle(cr, 0, 0, buf.width, buf.height);
-      cairo_fill(cr);
-      cairo_surface_destroy(surface);
+      const gboolean nearest = (buf.width <= 8 && buf.height <= 8) || fabsf(scale - 1.0f) < 0.01f;
+      gboolean exact = TRUE;
+      cairo_surface_t *surface = _view_thumb_get(imgid, &buf, sw, sh, nearest, &exact);
+      if(surface)
+      {
+        const int32_t tw = cairo_image_surface_get_width(surface), th = cairo_image_surface_get_height(surface);
+        cairo_save(cr);
+        cairo_scale(cr, buf.width / (double)tw, buf.height / (double)th);
+        cairo_set_source_surface(cr, surface, 0, 0);
+        if(exact) cairo_pattern_set_filter(cairo_get_source(cr), CAIRO_FILTER_NEAREST);
+        cairo_rectangle(cr, 0, 0, tw, th);
+        cairo_fill(cr);
+        cairo_restore(cr);
+        cairo_surface_destroy(surface);
 
-      cairo_rectangle(cr, 0, 0, buf.width, buf.height);
+        cairo_rectangle(cr, 0, 0, buf.width, buf.height);
+      }
     }
 
-    free(rgbbuf);
-
     if (image_only)
     {
       cairo_restore(cr);
@@ -1427,14 +1522,7 @@ dt_view_image_only_expose(
  */
 void dt_view_set_selection(int imgid, int value)
 {
-  /* clear and reset statement */
-  DT_DEBUG_SQLITE3_CLEAR_BINDINGS(darktable.view_manager->statements.is_selected);
-  DT_DEBUG_SQLITE3_RESET(darktable.view_manager->statements.is_selected);
-
-  /* setup statement and iterate over rows */
-  DT_DEBUG_SQLITE3_BIND_INT(darktable.view_manager->statements.is_selected, 1, imgid);
-
-  if(sqlite3_step(darktable.view_manager->statements.is_selected) == SQLITE_ROW)
+  if(dt_selection_is_selected(darktable.selection, imgid))
   {
     if(!value)
     {
@@ -1469,14 +1557,7 @@ void dt_view_set_selection(int imgid, int value)
  */
 void dt_view_toggle_selection(int imgid)
 {
-
-  /* clear and reset statement */
-  DT_DEBUG_SQLITE3_CLEAR_BINDINGS(darktable.view_manager->statements.is_selected);
-  DT_DEBUG_SQLITE3_RESET(darktable.view_manager->statements.is_selected);
-
-  /* setup statement and iterate over rows */
-  DT_DEBUG_SQLITE3_BIND_INT(darktable.view_manager->statements.is_selected, 1, imgid);
-  if(sqlite3_step(darktable.view_manager->statements.is_selected) == SQLITE_ROW)
+  if(dt_selection_is_selected(darktable.selection, imgid))
   {
     /* clear and reset statement */
     DT_DEBUG_SQLITE3_CLEAR_BINDINGS(darktable.view_manager->statements.delete_from_selected);
@@ -1584,18 +1665,13 @@ void dt_view_filmstrip_prefetch()
     offset = dt_collection_image_offset(imgid);
   }
 
-  sqlite3_stmt *stmt;
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), qin, -1, &stmt, NULL);
   // only get one more image:
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, offset + 1);
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, offset + 2);
-  if(sqlite3_step(stmt) == SQLITE_ROW)
+  const int prefetchid = dt_collection_get_nth(darktable.collection, offset + 1);
+  if(prefetchid > 0)
   {
-    const uint32_t prefetchid = sqlite3_column_int(stmt, 0);
     // dt_control_log("prefetching image %u", prefetchid);
     dt_mipmap_cache_get(darktable.mipmap_cache, NULL, prefetchid, DT_MIPMAP_FULL, DT_MIPMAP_PREFETCH, 'r');
   }
-  sqlite3_finalize(stmt);
 }
 
 void dt_view_manager_view_toolbox_add(dt_view_manager_t *vm, GtkWidget *tool, dt_view_type_flags_t views)
@@ -1693,6 +1769,9 @@ void dt_view_print_settings(const dt_view_manager_t *vm, dt_print_info_t *pinfo)
 }
 #endif
 
+#undef DT_VIEW_THUMBS_SIZE
+#undef DT_VIEW_THUMBS_PER_FRAME
+
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
 // kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
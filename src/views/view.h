@@ -175,8 +175,6 @@ typedef struct dt_view_manager_t
   {
     /* select num from history where imgid = ?1*/
     sqlite3_stmt *have_history;
-    /* select * from selected_images where imgid = ?1 */
-    sqlite3_stmt *is_selected;
     /* delete from selected_images where imgid = ?1 */
     sqlite3_stmt *delete_from_selected;
     /* insert into selected_images values (?1) */
@@ -187,6 +185,16 @@ typedef struct dt_view_manager_t
     sqlite3_stmt *get_grouped;
   } statements;
 
+  /* thumbnails converted for the screen and scaled to the size of their cell, by imgid, so redrawing a cell
+   * that didn't change only copies its surface */
+  struct
+  {
+    GHashTable *surfaces;
+    size_t size; // bytes
+    gboolean in_frame; // exposing the center view
+    int built, deferred; // surfaces made and put off in this frame
+  } thumbs;
+
 
   /*
    * Proxy
@@ -390,6 +390,17 @@ darktable.database.copy_image:add_parameter("image",types.dt_lua_image_t,[[The i
 darktable.database.copy_image:add_parameter("film",types.dt_lua_film_t,[[The film to copy to]])
 darktable.database.copy_image:add_return(types.dt_lua_image_t,[[The new image]])
 darktable.database.copy_image:set_main_parent(darktable.database)
+darktable.database.get_properties:set_text([[Reads properties of many images at once.]]..para()..
+[[The images are read with one query per kind of property and one pass over the image cache, which is much faster than reading the fields of each image separately. Names can be fields of ]]..my_tostring(types.dt_lua_image_t)..[[, the metadata fields creator, publisher, title, description and rights, or the color labels red, yellow, green, blue and purple.]])
+darktable.database.get_properties:add_parameter("images","table of "..my_tostring(types.dt_lua_image_t),[[The images to read]])
+darktable.database.get_properties:add_parameter("names","table of string",[[The names of the properties to read]])
+darktable.database.get_properties:add_return("table of table",[[One table per image, in the order of the images, mapping each name to its value. An image that appears twice gets the same table twice.]])
+darktable.database.get_properties:set_main_parent(darktable.database)
+darktable.database.set_properties:set_text([[Writes properties of many images at once, in a single database transaction.]]..para()..
+[[All values are checked before any image is changed. The names are the ones of ]]..my_tostring(darktable.database.get_properties)..[[, restricted to the writable ones; local_copy can only be changed on each image.]])
+darktable.database.set_properties:add_parameter("images","table of "..my_tostring(types.dt_lua_image_t),[[The images to change]])
+darktable.database.set_properties:add_parameter("values","table",[[A table mapping names to values, applied to all images, or a list of such tables, one per image]])
+darktable.database.set_properties:set_main_parent(darktable.database)
 darktable.collection:set_text([[Allows to access the currently worked on images, i.e the ones selected by the collection lib. Filtering (rating etc) does not change that collection.]])
 
 
@@ -530,6 +541,9 @@ darktable.control.execute:add_parameter("command","string","The command to run,
 darktable.control.execute:add_return("int","The result of the system call")
 darktable.control.read:set_text("Block until a file is readable while not blocking darktable"..para()..emphasis("This function is not available on Windows builds"))
 darktable.control.read:add_parameter("file","file","The file object to wait for")
+darktable.control.job_stats:set_text([[Statistics of the background job queues: the number of jobs waiting per queue, the jobs finished per second and, per type of job, how long jobs waited in the queue and how long they ran.]]..para()..
+[[Times are in seconds. The histograms count jobs per bucket, with the upper bounds of the buckets in milliseconds given in histogram_ms.]])
+darktable.control.job_stats:add_return("table","A table with the fields queues, jobs_per_second, histogram_ms and types. types maps every job type to a table with count, jobs_per_second, wait and run, the latter two having mean, max and histogram")
 
 
 darktable.gettext:set_text([[This table contains functions related to translating lua scripts]])
@@ -670,6 +684,12 @@ darktable.debug.type:set_text([[Similar to the system function type() but it wil
 	types.dt_imageio_module_format_t.write_image:add_parameter("filename","string",[[The filename to export to.]])
 	types.dt_imageio_module_format_t.write_image:add_parameter("allow_upscale","boolean",[[Set to true to allow upscaling of the image.]]):set_attribute("optional",true)
 	types.dt_imageio_module_format_t.write_image:add_return("boolean",[[Returns true on success.]])
+	types.dt_imageio_module_format_t.write_images:set_text([[Exports images to files on background jobs, several at once. Returns right away, the batch object returned tells how far the export got.]])
+	types.dt_imageio_module_format_t.write_images:add_parameter("self",types.dt_imageio_module_format_t,[[The format that will be used to export.]]):set_attribute("is_self",true)
+	types.dt_imageio_module_format_t.write_images:add_parameter("images","table of "..my_tostring(types.dt_lua_image_t),[[The images to export.]])
+	types.dt_imageio_module_format_t.write_images:add_parameter("filenames","table of string",[[The filenames to export to, one per image.]])
+	types.dt_imageio_module_format_t.write_images:add_parameter("options","table",[[Any of the fields concurrency, the number of images exported at once (default: the one of the export module), high_quality and upscale (booleans), progress, a function called with the batch, the image, its filename and true on success after every image, and finished, a function called with the batch once it is done.]]):set_attribute("optional",true)
+	types.dt_imageio_module_format_t.write_images:add_return(types.dt_lua_batch_t,[[The running batch.]])
 
 	types.dt_imageio_module_format_data_png:set_text([[Type object describing parameters to export to png.]])
 	types.dt_imageio_module_format_data_png.bpp:set_text([[The bpp parameter to use when exporting.]])
@@ -782,6 +802,18 @@ darktable.debug.type:set_text([[Similar to the system function type() but it wil
 	types.dt_lua_backgroundjob_t:set_text([[A lua-managed entry in the backgroundjob lib]])
 	types.dt_lua_backgroundjob_t.percent:set_text([[The value of the progress bar, between 0 and 1. will return nil if there is no progress bar, will raise an error if read or written on an invalid job]])
 	types.dt_lua_backgroundjob_t.valid:set_text([[True if the job is displayed, set it to false to destroy the entry]]..para().."An invalid job cannot be made valid again")
+	types.dt_lua_batch_t:set_text([[Images being exported by ]]..my_tostring(types.dt_imageio_module_format_t.write_images))
+	types.dt_lua_batch_t.total:set_text([[The number of images in the batch.]])
+	types.dt_lua_batch_t.written:set_text([[The number of images exported so far.]])
+	types.dt_lua_batch_t.failed:set_text([[The number of images that failed to export so far.]])
+	types.dt_lua_batch_t.finished:set_text([[True once all background jobs of the batch are done.]])
+	types.dt_lua_batch_t.results:set_text([[A table with true or false at the index of every image exported or failed so far, nil for the images still pending or skipped after a cancel.]])
+	types.dt_lua_batch_t.cancel:set_text([[Stops the batch after the images being exported right now.]])
+	types.dt_lua_batch_t.cancel:add_parameter("self",types.dt_lua_batch_t,[[The batch to cancel.]]):set_attribute("is_self",true)
+	types.dt_lua_batch_t.wait:set_text([[Blocks until all background jobs of the batch are done.]])
+	types.dt_lua_batch_t.wait:set_attribute("implicit_yield",true)
+	types.dt_lua_batch_t.wait:add_parameter("self",types.dt_lua_batch_t,[[The batch to wait for.]]):set_attribute("is_self",true)
+	types.dt_lua_batch_t.wait:add_return("table",[[The results of the batch.]])
 
 
 	types.dt_lua_snapshot_t:set_text([[The description of a snapshot in the snapshot lib]])